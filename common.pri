@@ -16,4 +16,9 @@ DEFINES += IRIS_XMPP_JID_DEPRECATED
 
 	# don't build iris, app will include iris.pri
 	#CONFIG += iris_bundle
+
+	# compile in USDT tracepoints (needs <sys/sdt.h>), see iristrace.h
+	#CONFIG += iris_trace
 }
+
+iris_trace:DEFINES += IRIS_TRACE
@@ -0,0 +1 @@
+#include "../../src/irisnet/noncore/cutestuff/httpbind.h"
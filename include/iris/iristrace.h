@@ -0,0 +1 @@
+#include "../../src/irisnet/corelib/iristrace.h"
@@ -0,0 +1 @@
+#include "../../src/xmpp/xmpp-core/xmlatoms.h"
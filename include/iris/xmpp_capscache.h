@@ -0,0 +1 @@
+#include "../../src/xmpp/xmpp-im/xmpp_capscache.h"
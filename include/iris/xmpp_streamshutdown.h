@@ -0,0 +1 @@
+#include "../../src/xmpp/xmpp-core/xmpp_streamshutdown.h"
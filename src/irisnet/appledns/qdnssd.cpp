@@ -23,17 +23,38 @@
 #include <QtCore>
 #include <stdio.h>
 
-// for ntohs
+// for ntohs, select
 #ifdef Q_OS_WIN
 # include <windows.h>
 #else
 # include <netinet/in.h>
+# include <sys/select.h>
 #endif
 
 #include "dns_sd.h"
 
+// operations multiplex over one daemon connection, where the API has it
+#if defined(_DNS_SD_H) && _DNS_SD_H+0 >= 1500000
+# define QDNSSD_SHARE_CONNECTION
+#endif
+
+// results taken off a socket per wakeup at most, before returning to the
+//   event loop
+#define MAX_RESULTS_PER_WAKEUP 32
+
 namespace {
 
+bool socketReadable(int fd)
+{
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	return select(fd + 1, &fds, NULL, NULL, &tv) == 1;
+}
+
 // safeobj stuff, from qca
 
 void releaseAndDeleteLater(QObject *owner, QObject *obj)
@@ -260,6 +281,7 @@ public:
 		int _type;
 		int _id;
 		ServiceRef *_sdref;
+		bool _shared;
 		int _sockfd;
 		SafeSocketNotifier *_sn_read;
 		SafeTimer *_errorTrigger;
@@ -281,6 +303,7 @@ public:
 			_self(self),
 			_id(-1),
 			_sdref(0),
+			_shared(false),
 			_sockfd(-1),
 			_sn_read(0),
 			_errorTrigger(0),
@@ -314,15 +337,97 @@ public:
 	QHash<SafeTimer*,Request*> _requestsByTimer;
 	QHash<int,Request*> _requestsByRecId;
 
+	// the connection shared by all requests, if there is one.  the
+	//   callbacks note here which requests got results.
+	ServiceRef *_shared;
+	int _sharedFd;
+	SafeSocketNotifier *_sn_shared;
+	QList<int> _touched;
+
 	Private(QDnsSd *_q) :
 		QObject(_q),
-		q(_q)
+		q(_q),
+		_shared(0),
+		_sharedFd(-1),
+		_sn_shared(0)
 	{
 	}
 
 	~Private()
 	{
+		// operations on the shared connection go before it does
 		qDeleteAll(_requestsById);
+		resetShared();
+	}
+
+	void resetShared()
+	{
+		delete _sn_shared;
+		_sn_shared = 0;
+		delete _shared;
+		_shared = 0;
+		_sharedFd = -1;
+	}
+
+	// sets up the request's ref to go over the shared connection, and
+	//   returns the flag to pass for that.  0 if each request is to have
+	//   a connection of its own.
+	DNSServiceFlags prepareRef(Request *req)
+	{
+#ifdef QDNSSD_SHARE_CONNECTION
+		if(!_shared)
+		{
+			ServiceRef *ref = new ServiceRef;
+			if(DNSServiceCreateConnection(ref->data()) != kDNSServiceErr_NoError)
+			{
+				delete ref;
+				return 0;
+			}
+			ref->setInitialized();
+
+			int sockfd = DNSServiceRefSockFD(*(ref->data()));
+			if(sockfd == -1)
+			{
+				delete ref;
+				return 0;
+			}
+
+			_shared = ref;
+			_sharedFd = sockfd;
+			_sn_shared = new SafeSocketNotifier(sockfd, QSocketNotifier::Read, this);
+			connect(_sn_shared, SIGNAL(activated(int)), SLOT(sn_shared_activated()));
+		}
+
+		*(req->_sdref->data()) = *(_shared->data());
+		req->_shared = true;
+		return kDNSServiceFlagsShareConnection;
+#else
+		Q_UNUSED(req);
+		return 0;
+#endif
+	}
+
+	// after the operation started, waits for its results.  false if it
+	//   failed and an error is on the way.
+	bool watch(Request *req)
+	{
+		if(!req->_shared)
+		{
+			int sockfd = DNSServiceRefSockFD(*(req->_sdref->data()));
+			if(sockfd == -1)
+			{
+				setDelayedError(req, LowLevelError(
+					"DNSServiceRefSockFD", -1));
+				return false;
+			}
+
+			req->_sockfd = sockfd;
+			req->_sn_read = new SafeSocketNotifier(sockfd, QSocketNotifier::Read, this);
+			connect(req->_sn_read, SIGNAL(activated(int)), SLOT(sn_activated()));
+			_requestsBySocket.insert(req->_sn_read, req);
+		}
+		_requestsById.insert(req->_id, req);
+		return true;
 	}
 
 	void setDelayedError(Request *req, const LowLevelError &lowLevelError)
@@ -369,9 +474,10 @@ public:
 		req->_type = Request::Query;
 		req->_id = id;
 		req->_sdref = new ServiceRef;
+		DNSServiceFlags flags = prepareRef(req);
 
 		DNSServiceErrorType err = DNSServiceQueryRecord(
-			req->_sdref->data(), kDNSServiceFlagsLongLivedQuery,
+			req->_sdref->data(), flags | kDNSServiceFlagsLongLivedQuery,
 			0, name.constData(), qType, kDNSServiceClass_IN,
 			cb_queryRecordReply, req);
 		if(err != kDNSServiceErr_NoError)
@@ -382,21 +488,7 @@ public:
 		}
 
 		req->_sdref->setInitialized();
-
-		int sockfd = DNSServiceRefSockFD(*(req->_sdref->data()));
-		if(sockfd == -1)
-		{
-			setDelayedError(req, LowLevelError(
-				"DNSServiceRefSockFD", -1));
-			return id;
-		}
-
-		req->_sockfd = sockfd;
-		req->_sn_read = new SafeSocketNotifier(sockfd, QSocketNotifier::Read, this);
-		connect(req->_sn_read, SIGNAL(activated(int)), SLOT(sn_activated()));
-		_requestsById.insert(id, req);
-		_requestsBySocket.insert(req->_sn_read, req);
-
+		watch(req);
 		return id;
 	}
 
@@ -408,9 +500,10 @@ public:
 		req->_type = Request::Browse;
 		req->_id = id;
 		req->_sdref = new ServiceRef;
+		DNSServiceFlags flags = prepareRef(req);
 
 		DNSServiceErrorType err = DNSServiceBrowse(
-			req->_sdref->data(), 0, 0, serviceType.constData(),
+			req->_sdref->data(), flags, 0, serviceType.constData(),
 			!domain.isEmpty() ? domain.constData() : NULL,
 			cb_browseReply, req);
 		if(err != kDNSServiceErr_NoError)
@@ -421,21 +514,7 @@ public:
 		}
 
 		req->_sdref->setInitialized();
-
-		int sockfd = DNSServiceRefSockFD(*(req->_sdref->data()));
-		if(sockfd == -1)
-		{
-			setDelayedError(req, LowLevelError(
-				"DNSServiceRefSockFD", -1));
-			return id;
-		}
-
-		req->_sockfd = sockfd;
-		req->_sn_read = new SafeSocketNotifier(sockfd, QSocketNotifier::Read, this);
-		connect(req->_sn_read, SIGNAL(activated(int)), SLOT(sn_activated()));
-		_requestsById.insert(id, req);
-		_requestsBySocket.insert(req->_sn_read, req);
-
+		watch(req);
 		return id;
 	}
 
@@ -447,9 +526,10 @@ public:
 		req->_type = Request::Resolve;
 		req->_id = id;
 		req->_sdref = new ServiceRef;
+		DNSServiceFlags flags = prepareRef(req);
 
 		DNSServiceErrorType err = DNSServiceResolve(
-			req->_sdref->data(), 0, 0, serviceName.constData(),
+			req->_sdref->data(), flags, 0, serviceName.constData(),
 			serviceType.constData(), domain.constData(),
 			(DNSServiceResolveReply)cb_resolveReply, req);
 		if(err != kDNSServiceErr_NoError)
@@ -460,21 +540,7 @@ public:
 		}
 
 		req->_sdref->setInitialized();
-
-		int sockfd = DNSServiceRefSockFD(*(req->_sdref->data()));
-		if(sockfd == -1)
-		{
-			setDelayedError(req, LowLevelError(
-				"DNSServiceRefSockFD", -1));
-			return id;
-		}
-
-		req->_sockfd = sockfd;
-		req->_sn_read = new SafeSocketNotifier(sockfd, QSocketNotifier::Read, this);
-		connect(req->_sn_read, SIGNAL(activated(int)), SLOT(sn_activated()));
-		_requestsById.insert(id, req);
-		_requestsBySocket.insert(req->_sn_read, req);
-
+		watch(req);
 		return id;
 	}
 
@@ -496,9 +562,10 @@ public:
 		sport = htons(sport);
 
 		req->_sdref = new ServiceRef;
+		DNSServiceFlags flags = prepareRef(req);
 
 		DNSServiceErrorType err = DNSServiceRegister(
-			req->_sdref->data(), kDNSServiceFlagsNoAutoRename, 0,
+			req->_sdref->data(), flags | kDNSServiceFlagsNoAutoRename, 0,
 			serviceName.constData(), serviceType.constData(),
 			domain.constData(), NULL, sport, txtRecord.size(),
 			txtRecord.data(), cb_regReply, req);
@@ -510,21 +577,7 @@ public:
 		}
 
 		req->_sdref->setInitialized();
-
-		int sockfd = DNSServiceRefSockFD(*(req->_sdref->data()));
-		if(sockfd == -1)
-		{
-			setDelayedError(req, LowLevelError(
-				"DNSServiceRefSockFD", -1));
-			return id;
-		}
-
-		req->_sockfd = sockfd;
-		req->_sn_read = new SafeSocketNotifier(sockfd, QSocketNotifier::Read, this);
-		connect(req->_sn_read, SIGNAL(activated(int)), SLOT(sn_activated()));
-		_requestsById.insert(id, req);
-		_requestsBySocket.insert(req->_sn_read, req);
-
+		watch(req);
 		return id;
 	}
 
@@ -622,17 +675,32 @@ public:
 			removeRequest(req);
 	}
 
-private slots:
-	void sn_activated()
+	// the daemon connection went away, along with everything on it
+	void sharedFailed(DNSServiceErrorType err)
 	{
-		SafeSocketNotifier *sn_read = (SafeSocketNotifier *)sender();
-		Request *req = _requestsBySocket.value(sn_read);
-		if(!req)
-			return;
+		QPointer<QObject> self = this;
+		QList<int> ids;
+		foreach(const Request *req, _requestsById)
+		{
+			if(req->_shared)
+				ids += req->_id;
+		}
+		foreach(int id, ids)
+		{
+			Request *req = _requestsById.value(id);
+			if(!req)
+				continue;
+			handleResult(req, err);
+			if(!self)
+				return;
+		}
+		resetShared();
+	}
 
+	void handleResult(Request *req, DNSServiceErrorType err)
+	{
 		int id = req->_id;
-
-		DNSServiceErrorType err = DNSServiceProcessResult(*(req->_sdref->data()));
+		int type = req->_type;
 
 		// do error if the above function returns an error, or if we
 		//   collected an error during a callback
@@ -651,21 +719,21 @@ private slots:
 
 			removeRequest(req);
 
-			if(req->_type == Request::Query)
+			if(type == Request::Query)
 			{
 				QDnsSd::QueryResult r;
 				r.success = false;
 				r.lowLevelError = lowLevelError;
 				emit q->queryResult(id, r);
 			}
-			else if(req->_type == Request::Browse)
+			else if(type == Request::Browse)
 			{
 				QDnsSd::BrowseResult r;
 				r.success = false;
 				r.lowLevelError = lowLevelError;
 				emit q->browseResult(id, r);
 			}
-			else if(req->_type == Request::Resolve)
+			else if(type == Request::Resolve)
 			{
 				QDnsSd::ResolveResult r;
 				r.success = false;
@@ -745,6 +813,59 @@ private slots:
 		}
 	}
 
+private slots:
+	void sn_activated()
+	{
+		SafeSocketNotifier *sn_read = (SafeSocketNotifier *)sender();
+		Request *req = _requestsBySocket.value(sn_read);
+		if(!req)
+			return;
+
+		// take whatever is waiting, rather than one result per wakeup
+		QPointer<QObject> self = this;
+		int id = req->_id;
+		for(int n = 0; n < MAX_RESULTS_PER_WAKEUP; ++n)
+		{
+			DNSServiceErrorType err = DNSServiceProcessResult(*(req->_sdref->data()));
+			handleResult(req, err);
+			if(!self || _requestsById.value(id) != req)
+				return;
+			if(!socketReadable(req->_sockfd))
+				break;
+		}
+	}
+
+	void sn_shared_activated()
+	{
+		QPointer<QObject> self = this;
+		for(int n = 0; n < MAX_RESULTS_PER_WAKEUP; ++n)
+		{
+			// results for any of the operations on the connection
+			_touched.clear();
+			DNSServiceErrorType err = DNSServiceProcessResult(*(_shared->data()));
+			if(err != kDNSServiceErr_NoError)
+			{
+				sharedFailed(err);
+				return;
+			}
+
+			QList<int> ids = _touched;
+			_touched.clear();
+			foreach(int id, ids)
+			{
+				Request *req = _requestsById.value(id);
+				if(!req)
+					continue;
+				handleResult(req, kDNSServiceErr_NoError);
+				if(!self)
+					return;
+			}
+
+			if(!_shared || !socketReadable(_sharedFd))
+				break;
+		}
+	}
+
 	void doError()
 	{
 		SafeTimer *t = (SafeTimer *)sender();
@@ -799,6 +920,8 @@ private:
 		Q_UNUSED(rrclass);
 
 		Request *req = static_cast<Request *>(context);
+		if(req->_shared && !req->_self->_touched.contains(req->_id))
+			req->_self->_touched += req->_id;
 		req->_self->handle_queryRecordReply(req, flags, errorCode,
 			fullname, rrtype, rdlen, (const char *)rdata, ttl);
 	}
@@ -812,6 +935,8 @@ private:
 		Q_UNUSED(interfaceIndex);
 
 		Request *req = static_cast<Request *>(context);
+		if(req->_shared && !req->_self->_touched.contains(req->_id))
+			req->_self->_touched += req->_id;
 		req->_self->handle_browseReply(req, flags, errorCode,
 			serviceName, regtype, replyDomain);
 	}
@@ -827,6 +952,8 @@ private:
 		Q_UNUSED(interfaceIndex);
 
 		Request *req = static_cast<Request *>(context);
+		if(req->_shared && !req->_self->_touched.contains(req->_id))
+			req->_self->_touched += req->_id;
 		req->_self->handle_resolveReply(req, errorCode, fullname,
 			hosttarget, port, txtLen, txtRecord);
 	}
@@ -840,6 +967,8 @@ private:
 		Q_UNUSED(flags);
 
 		Request *req = static_cast<Request *>(context);
+		if(req->_shared && !req->_self->_touched.contains(req->_id))
+			req->_self->_touched += req->_id;
 		req->_self->handle_regReply(req, errorCode, name, regtype,
 			domain);
 	}
@@ -22,6 +22,9 @@
 #include "objectsession.h"
 #include "netnames.h"
 
+// how long an A answer waits for AAAA before it is passed on (RFC 8305, 3)
+#define RESOLUTION_DELAY 50
+
 namespace XMPP {
 
 class AddressResolver::Private : public QObject
@@ -44,14 +47,20 @@ public:
 	bool done4;
 	QList<QHostAddress> addrs6;
 	QList<QHostAddress> addrs4;
+	int minTtl;
+	int lastTtl;
+	bool partialSent;
 	QTimer *opTimer;
+	QTimer *resDelayTimer;
 
 	Private(AddressResolver *_q) :
 		QObject(_q),
 		q(_q),
 		sess(this),
 		req6(this),
-		req4(this)
+		req4(this),
+		minTtl(-1),
+		lastTtl(-1)
 	{
 		connect(&req6, SIGNAL(resultsReady(const QList<XMPP::NameRecord> &)), SLOT(req6_resultsReady(const QList<XMPP::NameRecord> &)));
 		connect(&req6, SIGNAL(error(XMPP::NameResolver::Error)), SLOT(req6_error(XMPP::NameResolver::Error)));
@@ -62,6 +71,10 @@ public:
 		opTimer = new QTimer(this);
 		connect(opTimer, SIGNAL(timeout()), SLOT(op_timeout()));
 		opTimer->setSingleShot(true);
+
+		resDelayTimer = new QTimer(this);
+		connect(resDelayTimer, SIGNAL(timeout()), SLOT(resDelay_timeout()));
+		resDelayTimer->setSingleShot(true);
 	}
 
 	~Private()
@@ -69,11 +82,18 @@ public:
 		opTimer->disconnect(this);
 		opTimer->setParent(0);
 		opTimer->deleteLater();
+
+		resDelayTimer->disconnect(this);
+		resDelayTimer->setParent(0);
+		resDelayTimer->deleteLater();
 	}
 
 	void start(const QByteArray &hostName)
 	{
 		state = AddressWait;
+		minTtl = -1;
+		lastTtl = -1;
+		partialSent = false;
 
 		// was an IP address used as input?
 		QHostAddress addr;
@@ -87,7 +107,7 @@ public:
 			else
 				addrs4 += addr;
 
-			sess.defer(this, "ipAddress_input");
+			sess.defer(this, &Private::ipAddress_input);
 			return;
 		}
 
@@ -115,16 +135,24 @@ private:
 		req6.stop();
 		req4.stop();
 		opTimer->stop();
+		resDelayTimer->stop();
 
 		addrs6.clear();
 		addrs4.clear();
 	}
 
+	void noteTtl(int ttl)
+	{
+		if(minTtl == -1 || ttl < minTtl)
+			minTtl = ttl;
+	}
+
 	bool tryDone()
 	{
 		if((done6 && done4) || (state == AddressFirstCome && (done6 || done4)))
 		{
 			QList<QHostAddress> results = addrs6 + addrs4;
+			lastTtl = minTtl;
 			cleanup();
 
 			if(!results.isEmpty())
@@ -138,14 +166,34 @@ private:
 		return false;
 	}
 
+	// one family is in, the other is still out
+	void tryPartial()
+	{
+		if(partialSent)
+			return;
+
+		if(done6 && !addrs6.isEmpty())
+		{
+			resDelayTimer->stop();
+			partialSent = true;
+			emit q->partialResultsReady(addrs6);
+		}
+		else if(done4 && !addrs4.isEmpty() && !resDelayTimer->isActive())
+			resDelayTimer->start(RESOLUTION_DELAY);
+	}
+
 private slots:
 	void req6_resultsReady(const QList<XMPP::NameRecord> &results)
 	{
 		foreach(const NameRecord &rec, results)
+		{
 			addrs6 += rec.address();
+			noteTtl(rec.ttl());
+		}
 
 		done6 = true;
-		tryDone();
+		if(!tryDone())
+			tryPartial();
 	}
 
 	void req6_error(XMPP::NameResolver::Error e)
@@ -159,10 +207,14 @@ private slots:
 	void req4_resultsReady(const QList<XMPP::NameRecord> &results)
 	{
 		foreach(const NameRecord &rec, results)
+		{
 			addrs4 += rec.address();
+			noteTtl(rec.ttl());
+		}
 
 		done4 = true;
-		tryDone();
+		if(!tryDone())
+			tryPartial();
 	}
 
 	void req4_error(XMPP::NameResolver::Error e)
@@ -181,6 +233,15 @@ private slots:
 			tryDone();
 	}
 
+	void resDelay_timeout()
+	{
+		if(partialSent || addrs4.isEmpty())
+			return;
+
+		partialSent = true;
+		emit q->partialResultsReady(addrs4);
+	}
+
 	void ipAddress_input()
 	{
 		tryDone();
@@ -208,6 +269,11 @@ void AddressResolver::stop()
 	d->stop();
 }
 
+int AddressResolver::ttl() const
+{
+	return d->lastTtl;
+}
+
 }
 
 #include "addressresolver.moc"
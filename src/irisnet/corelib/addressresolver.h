@@ -42,7 +42,17 @@ public:
 	void start(const QByteArray &hostName);
 	void stop();
 
+	// smallest ttl, in seconds, of the records behind the last results.
+	//   -1 if unknown, such as when an address was given as input.
+	int ttl() const;
+
 signals:
+	// the addresses of the first family to answer, while the other is
+	//   still being looked up, so that connecting can start early.  AAAA
+	//   answers come right away, A answers after a short wait for AAAA
+	//   (RFC 8305, 3).  comes at most once per start(), and resultsReady()
+	//   still follows with all of the addresses.
+	void partialResultsReady(const QList<QHostAddress> &results);
 	void resultsReady(const QList<QHostAddress> &results);
 	void error(XMPP::AddressResolver::Error e);
 
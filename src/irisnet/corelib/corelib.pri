@@ -9,6 +9,8 @@ INCLUDEPATH += $$PWD/../../jdns
 HEADERS += \
 	$$PWD/jdnsshared.h \
 	$$PWD/objectsession.h \
+	$$PWD/timerwheel.h \
+	$$PWD/iristrace.h \
 	$$PWD/irisnetexport.h \
 	$$PWD/irisnetplugin.h \
 	$$PWD/irisnetglobal.h \
@@ -21,6 +23,7 @@ HEADERS += \
 SOURCES += \
 	$$PWD/jdnsshared.cpp \
 	$$PWD/objectsession.cpp \
+	$$PWD/timerwheel.cpp \
 	$$PWD/irisnetplugin.cpp \
 	$$PWD/irisnetglobal.cpp \
 	$$PWD/netinterface.cpp \
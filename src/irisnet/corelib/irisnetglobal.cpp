@@ -128,17 +128,164 @@ public:
 	}
 };
 
+// what was found in each plugin file, so a later scan can skip loading
+//   the files that aren't providers.  a file is trusted for as long as
+//   its size and modification time stay the same
+class PluginCache
+{
+public:
+	class Entry
+	{
+	public:
+		QString fileName;
+		qint64 size;
+		QDateTime modified;
+
+		// empty if the file isn't a provider plugin
+		QString className;
+
+		bool seen;
+	};
+
+	QList<Entry> entries;
+
+	void read(const QString &cacheFile)
+	{
+		QSettings settings(cacheFile, QSettings::IniFormat);
+		int count = settings.beginReadArray("plugins");
+		for(int n = 0; n < count; ++n)
+		{
+			settings.setArrayIndex(n);
+
+			Entry e;
+			e.fileName = settings.value("file").toString();
+			e.size = settings.value("size").toLongLong();
+			e.modified = settings.value("modified").toDateTime();
+			e.className = settings.value("class").toString();
+			e.seen = false;
+			entries += e;
+		}
+		settings.endArray();
+	}
+
+	void write(const QString &cacheFile) const
+	{
+		QSettings settings(cacheFile, QSettings::IniFormat);
+		settings.remove("plugins");
+		settings.beginWriteArray("plugins", entries.count());
+		for(int n = 0; n < entries.count(); ++n)
+		{
+			settings.setArrayIndex(n);
+			settings.setValue("file", entries[n].fileName);
+			settings.setValue("size", entries[n].size);
+			settings.setValue("modified", entries[n].modified);
+			settings.setValue("class", entries[n].className);
+		}
+		settings.endArray();
+	}
+
+	// returns 0 if the file isn't known, or has changed since
+	Entry *find(const QString &fileName, const QFileInfo &fi)
+	{
+		for(int n = 0; n < entries.count(); ++n)
+		{
+			Entry &e = entries[n];
+			if(e.fileName == fileName)
+			{
+				if(e.size == fi.size() && e.modified == fi.lastModified())
+					return &e;
+				return 0;
+			}
+		}
+
+		return 0;
+	}
+
+	void set(const QString &fileName, const QFileInfo &fi, const QString &className)
+	{
+		Entry *e = 0;
+		for(int n = 0; n < entries.count(); ++n)
+		{
+			if(entries[n].fileName == fileName)
+			{
+				e = &entries[n];
+				break;
+			}
+		}
+
+		if(!e)
+		{
+			entries += Entry();
+			e = &entries.last();
+			e->fileName = fileName;
+		}
+
+		e->size = fi.size();
+		e->modified = fi.lastModified();
+		e->className = className;
+		e->seen = true;
+	}
+
+	// forget files that are gone.  returns true if any were
+	bool dropUnseen()
+	{
+		bool changed = false;
+		for(int n = 0; n < entries.count(); ++n)
+		{
+			if(!entries[n].seen)
+			{
+				entries.removeAt(n);
+				--n; // adjust position
+				changed = true;
+			}
+		}
+
+		return changed;
+	}
+};
+
+// a provider that is part of the library.  it is only instantiated once
+//   one of the kinds it provides is asked for
+class BuiltInProvider
+{
+public:
+	typedef IrisNetProvider *(*CreateFunc)();
+
+	const char *className;
+	CreateFunc create;
+	int kinds;
+	bool done;
+};
+
 class PluginManager
 {
 public:
-	bool builtin_done;
+	QList<BuiltInProvider> builtins;
 	QStringList paths;
+	bool scan_done;
+	QString cacheFile;
+	bool filterSet;
+	QStringList filter;
 	QList<PluginInstance*> plugins;
+
+	// from plugins, highest priority first
 	QList<IrisNetProvider*> providers;
 
+	// instantiated built-ins, in the order of the builtins list
+	QList<IrisNetProvider*> builtinProviders;
+
 	PluginManager()
 	{
-		builtin_done = false;
+		scan_done = false;
+		filterSet = false;
+
+#ifdef Q_OS_WIN
+		addBuiltIn("XMPP::WinNetProvider", irisnet_createWinNetProvider, IrisNetInterfaceKind);
+#endif
+#ifdef Q_OS_UNIX
+		addBuiltIn("XMPP::UnixNetProvider", irisnet_createUnixNetProvider, IrisNetInterfaceKind);
+#endif
+		addBuiltIn("XMPP::JDnsProvider", irisnet_createJDnsProvider, IrisNetNameInternetKind | IrisNetNameLocalKind | IrisNetServiceKind);
 	}
 
 	~PluginManager()
@@ -146,6 +293,32 @@ public:
 		unload();
 	}
 
+	void addBuiltIn(const char *className, BuiltInProvider::CreateFunc create, int kinds)
+	{
+		BuiltInProvider b;
+		b.className = className;
+		b.create = create;
+		b.kinds = kinds;
+		b.done = false;
+		builtins += b;
+	}
+
+	bool allowed(const QString &className) const
+	{
+		return (!filterSet || filter.contains(className));
+	}
+
+	bool haveClass(const QString &className) const
+	{
+		for(int n = 0; n < plugins.count(); ++n)
+		{
+			if(className == plugins[n]->instance()->metaObject()->className())
+				return true;
+		}
+
+		return false;
+	}
+
 	bool tryAdd(PluginInstance *i, bool lowPriority = false)
 	{
 		// is it the right kind of plugin?
@@ -153,6 +326,9 @@ public:
 		if(!p)
 			return false;
 
+		if(!allowed(p->metaObject()->className()))
+			return false;
+
 		// make sure we don't have it already
 		for(int n = 0; n < plugins.count(); ++n)
 		{
@@ -163,32 +339,35 @@ public:
 		i->claim();
 		plugins += i;
 		if(lowPriority)
-			providers.append(p);
+			builtinProviders.append(p);
 		else
 			providers.prepend(p);
 		return true;
 	}
 
-	void addBuiltIn(IrisNetProvider *p)
+	void ensureBuiltIns(int kinds)
 	{
-		PluginInstance *i = PluginInstance::fromInstance(p);
-		if(!tryAdd(i, true))
-			delete i;
+		for(int n = 0; n < builtins.count(); ++n)
+		{
+			BuiltInProvider &b = builtins[n];
+			if(b.done || !(b.kinds & kinds))
+				continue;
+
+			b.done = true;
+			if(!allowed(b.className))
+				continue;
+
+			PluginInstance *i = PluginInstance::fromInstance(b.create());
+			if(!tryAdd(i, true))
+				delete i;
+		}
 	}
 
 	void scan()
 	{
-		if(!builtin_done)
-		{
-#ifdef Q_OS_WIN
-			addBuiltIn(irisnet_createWinNetProvider());
-#endif
-#ifdef Q_OS_UNIX
-			addBuiltIn(irisnet_createUnixNetProvider());
-#endif
-			addBuiltIn(irisnet_createJDnsProvider());
-			builtin_done = true;
-		}
+		if(scan_done)
+			return;
+		scan_done = true;
 
 		QObjectList list = QPluginLoader::staticInstances();
 		for(int n = 0; n < list.count(); ++n)
@@ -197,6 +376,17 @@ public:
 			if(!tryAdd(i))
 				delete i;
 		}
+
+		if(paths.isEmpty())
+			return;
+
+		// files seen before are only loaded if they held a provider
+		//   we can still use
+		PluginCache cache;
+		if(!cacheFile.isEmpty())
+			cache.read(cacheFile);
+		bool cacheChanged = false;
+
 		for(int n = 0; n < paths.count(); ++n)
 		{
 			QDir dir(paths[n]);
@@ -210,7 +400,26 @@ public:
 				if(!fi.exists())
 					continue;
 				QString fname = fi.filePath();
+
+				PluginCache::Entry *e = cache.find(fname, fi);
+				if(e)
+				{
+					e->seen = true;
+					if(e->className.isEmpty() || !allowed(e->className) || haveClass(e->className))
+						continue;
+				}
+
 				PluginInstance *i = PluginInstance::fromFile(fname);
+				QString className;
+				if(i && qobject_cast<IrisNetProvider*>(i->instance()))
+					className = i->instance()->metaObject()->className();
+
+				if(!e || e->className != className)
+				{
+					cache.set(fname, fi, className);
+					cacheChanged = true;
+				}
+
 				if(!i)
 					continue;
 
@@ -218,6 +427,27 @@ public:
 					delete i;
 			}
 		}
+
+		if(cache.dropUnseen())
+			cacheChanged = true;
+
+		if(!cacheFile.isEmpty() && cacheChanged)
+			cache.write(cacheFile);
+	}
+
+	QList<IrisNetProvider*> providersFor(int kinds)
+	{
+		scan();
+		ensureBuiltIns(kinds);
+		return providers + builtinProviders;
+	}
+
+	void setPaths(const QStringList &_paths)
+	{
+		paths = _paths;
+
+		// look again, for anything new
+		scan_done = false;
 	}
 
 	void unload()
@@ -230,6 +460,7 @@ public:
 
 		plugins.clear();
 		providers.clear();
+		builtinProviders.clear();
 	}
 };
 
@@ -276,7 +507,24 @@ void irisNetSetPluginPaths(const QStringList &paths)
 	init();
 
 	QMutexLocker locker(&global->m);
-	global->pluginManager.paths = paths;
+	global->pluginManager.setPaths(paths);
+}
+
+void irisNetSetPluginCache(const QString &fileName)
+{
+	init();
+
+	QMutexLocker locker(&global->m);
+	global->pluginManager.cacheFile = fileName;
+}
+
+void irisNetSetProviderFilter(const QStringList &classNames)
+{
+	init();
+
+	QMutexLocker locker(&global->m);
+	global->pluginManager.filterSet = true;
+	global->pluginManager.filter = classNames;
 }
 
 void irisNetCleanup()
@@ -292,13 +540,12 @@ void irisNetAddPostRoutine(IrisNetCleanUpFunction func)
 	global->cleanupList.prepend(func);
 }
 
-QList<IrisNetProvider*> irisNetProviders()
+QList<IrisNetProvider*> irisNetProviders(int kinds)
 {
 	init();
 
 	QMutexLocker locker(&global->m);
-	global->pluginManager.scan();
-	return global->pluginManager.providers;
+	return global->pluginManager.providersFor(kinds);
 }
 
 }
@@ -30,6 +30,16 @@ namespace XMPP {
 // set the directories for plugins.  call before doing anything else.
 IRISNET_EXPORT void irisNetSetPluginPaths(const QStringList &paths);
 
+// remember in fileName what each file in the plugin paths turned out to
+//   be, so later runs only load the files holding providers.  call
+//   before doing anything else.
+IRISNET_EXPORT void irisNetSetPluginCache(const QString &fileName);
+
+// only use the providers with these class names, built-in or plugin,
+//   e.g. "XMPP::JDnsProvider".  the ones left must still cover what the
+//   application uses.  call before doing anything else.
+IRISNET_EXPORT void irisNetSetProviderFilter(const QStringList &classNames);
+
 // free any shared data and plugins.
 // note: this is automatically called when qapp shuts down.
 IRISNET_EXPORT void irisNetCleanup();
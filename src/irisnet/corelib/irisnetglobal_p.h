@@ -29,7 +29,19 @@ namespace XMPP {
 typedef void (*IrisNetCleanUpFunction)();
 
 IRISNET_EXPORT void irisNetAddPostRoutine(IrisNetCleanUpFunction func);
-IRISNET_EXPORT QList<IrisNetProvider*> irisNetProviders();
+// what a caller of irisNetProviders() is about to create.  built-in
+//   providers are only instantiated once asked for a kind they provide
+enum IrisNetProviderKind
+{
+	IrisNetInterfaceKind    = 0x01,
+	IrisNetAvailabilityKind = 0x02,
+	IrisNetNameInternetKind = 0x04,
+	IrisNetNameLocalKind    = 0x08,
+	IrisNetServiceKind      = 0x10,
+	IrisNetAllKinds         = 0x1f
+};
+
+IRISNET_EXPORT QList<IrisNetProvider*> irisNetProviders(int kinds = IrisNetAllKinds);
 
 }
 
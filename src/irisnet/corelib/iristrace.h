@@ -0,0 +1,60 @@
+/*
+ * iristrace.h - static tracepoints for profiling
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef IRISTRACE_H
+#define IRISTRACE_H
+
+// tracepoints are compiled in only when IRIS_TRACE is defined (configure
+//   with CONFIG+=iris_trace).  they are then USDT probes from systemtap's
+//   <sys/sdt.h>, under the provider name "iris", which perf, bpftrace,
+//   systemtap and lttng can all attach to.  an unattached probe costs a
+//   single nop.  without IRIS_TRACE the macros expand to nothing, and
+//   their arguments are not evaluated.
+//
+// arguments should be cheap to compute: pointers and integers, never
+//   strings that have to be built first.
+//
+// the probes, in begin/end pairs where there is a duration to measure:
+//
+//   xml_parse_begin(protocol), xml_parse_end(protocol, event type or -1)
+//   xml_serialize_begin(protocol), xml_serialize_end(protocol, bytes)
+//   task_dispatch_begin(root task), task_dispatch_end(root task, handled)
+//   layer_write_begin(securestream, bytes), layer_write_end(securestream)
+//   stun_transaction_begin(transaction)
+//   stun_transaction_retransmit(transaction, tries so far)
+//   stun_transaction_end(transaction, 0 = success, 1 = error, 2 = timeout)
+//   dns_query_begin(resolver, record type), dns_query_end(resolver, results or -1)
+//
+// for example, with bpftrace:
+//   bpftrace -e 'usdt:/usr/lib/libiris.so:iris:xml_parse_end { @[arg1] = count(); }'
+
+#ifdef IRIS_TRACE
+# include <sys/sdt.h>
+# define IRIS_TRACEPOINT0(name) DTRACE_PROBE(iris, name)
+# define IRIS_TRACEPOINT1(name, a) DTRACE_PROBE1(iris, name, a)
+# define IRIS_TRACEPOINT2(name, a, b) DTRACE_PROBE2(iris, name, a, b)
+# define IRIS_TRACEPOINT3(name, a, b, c) DTRACE_PROBE3(iris, name, a, b, c)
+#else
+# define IRIS_TRACEPOINT0(name) do {} while(0)
+# define IRIS_TRACEPOINT1(name, a) do {} while(0)
+# define IRIS_TRACEPOINT2(name, a, b) do {} while(0)
+# define IRIS_TRACEPOINT3(name, a, b, c) do {} while(0)
+#endif
+
+#endif
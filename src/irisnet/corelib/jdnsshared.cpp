@@ -35,6 +35,14 @@
 
 #include "jdnsshared.h"
 
+#if defined(Q_OS_LINUX)
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/inotify.h>
+#elif defined(Q_OS_WIN)
+# include <windows.h>
+#endif
+
 namespace {
 
 // safeobj stuff, from qca
@@ -81,34 +89,236 @@ private:
 	QTimer *t;
 };
 
-// for caching system info
+// for caching system info.  the current snapshot is read without a lock,
+//   and replaced once the files or registry keys it comes from change.
+//   replaced snapshots are kept until exit, since another thread may still
+//   be copying one, and there is only one per change.
 
-class SystemInfoCache
+// reload anyway after this long, in case a change went unnoticed
+#define SYSINFO_MAX_AGE 30000
+
+// where changes can't be watched for, as before
+#define SYSINFO_POLL_AGE 500
+
+class SystemInfoWatch
+{
+public:
+	SystemInfoWatch()
+	{
+#if defined(Q_OS_LINUX)
+		dirWd = -1;
+		fd = inotify_init();
+		if(fd != -1)
+		{
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+			// the files are often replaced rather than written to
+			dirWd = inotify_add_watch(fd, "/etc", IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+			if(dirWd == -1)
+			{
+				::close(fd);
+				fd = -1;
+			}
+		}
+#elif defined(Q_OS_WIN)
+		key = 0;
+		regEvent = 0;
+		if(RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"SYSTEM\\CurrentControlSet\\Services\\Tcpip\\Parameters", 0, KEY_NOTIFY, &key) == ERROR_SUCCESS)
+			regEvent = CreateEventW(0, TRUE, FALSE, 0);
+
+		wchar_t path[MAX_PATH + 32];
+		UINT len = GetSystemDirectoryW(path, MAX_PATH);
+		dirChange = INVALID_HANDLE_VALUE;
+		if(len > 0 && len < MAX_PATH)
+		{
+			wcscpy(path + len, L"\\drivers\\etc");
+			dirChange = FindFirstChangeNotificationW(path, FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+		}
+#endif
+	}
+
+	~SystemInfoWatch()
+	{
+#if defined(Q_OS_LINUX)
+		if(fd != -1)
+			::close(fd);
+#elif defined(Q_OS_WIN)
+		if(regEvent)
+			CloseHandle(regEvent);
+		if(key)
+			RegCloseKey(key);
+		if(dirChange != INVALID_HANDLE_VALUE)
+			FindCloseChangeNotification(dirChange);
+#endif
+	}
+
+	bool notifying() const
+	{
+#if defined(Q_OS_LINUX)
+		return fd != -1;
+#elif defined(Q_OS_WIN)
+		return regEvent && dirChange != INVALID_HANDLE_VALUE;
+#else
+		return false;
+#endif
+	}
+
+	// true if something changed since the last rearm().  may be called
+	//   from any thread, and only the first to look sees a change.
+	bool changed()
+	{
+		bool any = false;
+#if defined(Q_OS_LINUX)
+		if(fd == -1)
+			return false;
+		char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+		int r;
+		while((r = ::read(fd, buf, sizeof(buf))) > 0)
+		{
+			for(int at = 0; at < r; )
+			{
+				const struct inotify_event *e = (const struct inotify_event *)(buf + at);
+				if(e->wd != dirWd || (e->mask & IN_Q_OVERFLOW))
+					any = true;
+				else if(e->len > 0 && (qstrcmp(e->name, "resolv.conf") == 0 || qstrcmp(e->name, "hosts") == 0))
+					any = true;
+				at += sizeof(struct inotify_event) + e->len;
+			}
+		}
+#elif defined(Q_OS_WIN)
+		if(regEvent && WaitForSingleObject(regEvent, 0) == WAIT_OBJECT_0)
+			any = true;
+		if(dirChange != INVALID_HANDLE_VALUE && WaitForSingleObject(dirChange, 0) == WAIT_OBJECT_0)
+			any = true;
+#endif
+		return any;
+	}
+
+	// watch for the next change.  called before each reload, so that a
+	//   change while reading counts as well.
+	void rearm()
+	{
+#if defined(Q_OS_LINUX)
+		if(fd == -1)
+			return;
+
+		// the files themselves, in case they are links elsewhere.  a
+		//   watch that is there already is just updated.
+		inotify_add_watch(fd, "/etc/resolv.conf", IN_CLOSE_WRITE | IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF);
+		inotify_add_watch(fd, "/etc/hosts", IN_CLOSE_WRITE | IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF);
+#elif defined(Q_OS_WIN)
+		// note: the registry notification ends with the thread that asked
+		//   for it, which is what SYSINFO_MAX_AGE is there for
+		if(regEvent)
+		{
+			ResetEvent(regEvent);
+			RegNotifyChangeKeyValue(key, TRUE, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET, regEvent, TRUE);
+		}
+		if(dirChange != INVALID_HANDLE_VALUE && WaitForSingleObject(dirChange, 0) == WAIT_OBJECT_0)
+			FindNextChangeNotification(dirChange);
+#endif
+	}
+
+private:
+#if defined(Q_OS_LINUX)
+	int fd;
+	int dirWd;
+#elif defined(Q_OS_WIN)
+	HKEY key;
+	HANDLE regEvent;
+	HANDLE dirChange;
+#endif
+};
+
+static QByteArray normalizedHostName(const QByteArray &name)
+{
+	QByteArray out = name.toLower();
+	if(out.endsWith('.'))
+		out.truncate(out.size() - 1);
+	return out;
+}
+
+// the system info with the hosts file indexed, built once per change
+class SystemInfoSnapshot
 {
 public:
 	QJDns::SystemInfo info;
-	QTime time;
+
+	// by normalized name, the first address of each family in the file
+	QHash<QByteArray, QHostAddress> hosts4, hosts6;
+
+	SystemInfoSnapshot(const QJDns::SystemInfo &_info) :
+		info(_info)
+	{
+		foreach(const QJDns::DnsHost &h, info.hosts)
+		{
+			QHash<QByteArray, QHostAddress> &index = (h.address.protocol() == QAbstractSocket::IPv6Protocol) ? hosts6 : hosts4;
+			QByteArray key = normalizedHostName(h.name);
+			if(!index.contains(key))
+				index.insert(key, h.address);
+		}
+	}
+};
+
+class SystemInfoCache
+{
+public:
+	QMutex m; // taken only to reload
+	QAtomicPointer<SystemInfoSnapshot> info;
+	QList<SystemInfoSnapshot*> retired;
+	SystemInfoWatch watch;
+	QTime clock;
+	QAtomicInt loadedAt; // msecs on clock
+
+	SystemInfoCache() :
+		info(0)
+	{
+		clock.start();
+	}
+
+	~SystemInfoCache()
+	{
+		delete (SystemInfoSnapshot *)info;
+		qDeleteAll(retired);
+	}
 };
 
 }
 
-Q_GLOBAL_STATIC(QMutex, jdnsshared_mutex)
 Q_GLOBAL_STATIC(SystemInfoCache, jdnsshared_infocache)
 
-static QJDns::SystemInfo get_sys_info()
+static const SystemInfoSnapshot *reload_sys_info(SystemInfoCache *c, SystemInfoSnapshot *seen)
+{
+	QMutexLocker locker(&c->m);
+
+	// another thread got here first
+	SystemInfoSnapshot *cur = c->info;
+	if(cur != seen)
+		return cur;
+
+	c->watch.rearm();
+	SystemInfoSnapshot *i = new SystemInfoSnapshot(QJDns::systemInfo());
+	c->loadedAt.fetchAndStoreOrdered(c->clock.elapsed());
+	c->info.fetchAndStoreOrdered(i);
+	if(cur)
+		c->retired += cur;
+	return i;
+}
+
+// the snapshot stays valid after a newer one is swapped in
+static const SystemInfoSnapshot *get_sys_info()
 {
-	QMutexLocker locker(jdnsshared_mutex());
 	SystemInfoCache *c = jdnsshared_infocache();
+	SystemInfoSnapshot *i = c->info;
 
-	// cache info for 1/2 second, enough to prevent re-reading of sys
-	//   info 20 times because of all the different resolves
-	if(c->time.isNull() || c->time.elapsed() >= 500)
-	{
-		c->info = QJDns::systemInfo();
-		c->time.start();
-	}
+	// a clock gone backwards has wrapped around midnight
+	int age = c->clock.elapsed() - int(c->loadedAt);
+	int maxAge = c->watch.notifying() ? SYSINFO_MAX_AGE : SYSINFO_POLL_AGE;
+	if(!i || age < 0 || age >= maxAge || c->watch.changed())
+		return reload_sys_info(c, i);
 
-	return c->info;
+	return i;
 }
 
 static bool domainCompare(const QByteArray &a, const QByteArray &b)
@@ -437,6 +647,24 @@ public:
 		}
 	};
 
+	// identical unicast queries that are in flight at the same time share
+	//   one set of QJDns operations.  the group lives until its results
+	//   arrive or its last member cancels.
+	class QueryGroup
+	{
+	public:
+		QByteArray name;
+		int qType;
+		QList<Handle> handles;
+		QList<JDnsSharedRequest*> members;
+
+		QueryGroup() : qType(-1)
+		{
+		}
+	};
+
+	typedef QPair<QByteArray,int> QueryKey;
+
 	enum PreprocessMode
 	{
 		None,            // don't muck with anything
@@ -457,6 +685,9 @@ public:
 	QSet<JDnsSharedRequest*> requests;
 	QHash<Handle,JDnsSharedRequest*> requestForHandle;
 
+	QHash<QueryKey,QueryGroup*> groupForKey;
+	QHash<Handle,QueryGroup*> groupForHandle;
+
 	JDnsSharedPrivate(JDnsShared *_q) : QObject(_q), q(_q)
 	{
 	}
@@ -474,6 +705,9 @@ public:
 		connect(jdns, SIGNAL(error(int, QJDns::Error)), SLOT(jdns_error(int, QJDns::Error)));
 		connect(jdns, SIGNAL(shutdownFinished()), SLOT(jdns_shutdownFinished()));
 		connect(jdns, SIGNAL(debugLinesReady()), SLOT(jdns_debugLinesReady()));
+
+		// the lines would only be thrown away
+		jdns->setDebugEnabled(db != 0);
 	}
 
 	int getNewIndex() const
@@ -625,6 +859,8 @@ public:
 
 	void queryStart(JDnsSharedRequest *obj, const QByteArray &name, int qType);
 	void queryCancel(JDnsSharedRequest *obj);
+	void removeGroup(QueryGroup *g);
+	void groupFinished(QueryGroup *g, bool success, const QList<QJDns::Record> &results, JDnsSharedRequest::Error error);
 	void publishStart(JDnsSharedRequest *obj, QJDns::PublishMode m, const QJDns::Record &record);
 	void publishUpdate(JDnsSharedRequest *obj, const QJDns::Record &record);
 	void publishCancel(JDnsSharedRequest *obj);
@@ -668,12 +904,15 @@ public:
 	// use to weed out dups for multicast
 	QList<QJDns::Record> queryCache;
 
+	// shared unicast query we are waiting on, if any
+	JDnsSharedPrivate::QueryGroup *group;
+
 	bool success;
 	JDnsSharedRequest::Error error;
 	QList<QJDns::Record> results;
 	SafeTimer lateTimer;
 
-	JDnsSharedRequestPrivate(JDnsSharedRequest *_q) : QObject(_q), q(_q), lateTimer(this)
+	JDnsSharedRequestPrivate(JDnsSharedRequest *_q) : QObject(_q), q(_q), group(0), lateTimer(this)
 	{
 		connect(&lateTimer, SIGNAL(timeout()), SLOT(lateTimer_timeout()));
 	}
@@ -685,6 +924,7 @@ public:
 		handles.clear();
 		published.clear();
 		queryCache.clear();
+		group = 0;
 	}
 
 private slots:
@@ -734,7 +974,7 @@ void JDnsSharedRequest::publishUpdate(const QJDns::Record &record)
 void JDnsSharedRequest::cancel()
 {
 	d->lateTimer.stop();
-	if(!d->handles.isEmpty())
+	if(!d->handles.isEmpty() || d->group)
 	{
 		if(d->type == Query)
 			d->jsp->queryCancel(this);
@@ -785,6 +1025,9 @@ void JDnsShared::setDebug(JDnsSharedDebug *db, const QString &name)
 {
 	d->db = db;
 	d->dbname = name;
+
+	foreach(JDnsSharedPrivate::Instance *i, d->instances)
+		i->jdns->setDebugEnabled(db != 0);
 }
 
 bool JDnsShared::addInterface(const QHostAddress &addr)
@@ -811,7 +1054,7 @@ void JDnsShared::shutdown()
 
 QList<QByteArray> JDnsShared::domains()
 {
-	return get_sys_info().domains;
+	return get_sys_info()->info.domains;
 }
 
 void JDnsShared::waitForShutdown(const QList<JDnsShared*> &instances)
@@ -858,6 +1101,12 @@ bool JDnsSharedPrivate::addInterface(const QHostAddress &addr)
 			host.port = 5353;
 			jdns->setNameServers(QList<QJDns::NameServer>() << host);
 		}
+		else
+		{
+			// srv lookups hold up connecting, so don't let a dead
+			//   first nameserver cost them a timeout
+			jdns->setRace(QJDns::Srv, true);
+		}
 	}
 	else // Multicast
 	{
@@ -980,6 +1229,22 @@ void JDnsSharedPrivate::removeInterface(const QHostAddress &addr)
 			}
 		}
 
+		// remove shared query reference
+		if(obj->d->group)
+		{
+			QueryGroup *g = obj->d->group;
+			for(int n = 0; n < g->handles.count(); ++n)
+			{
+				Handle h = g->handles[n];
+				if(h.jdns == i->jdns)
+				{
+					g->handles.removeAt(n);
+					groupForHandle.remove(h);
+					break;
+				}
+			}
+		}
+
 		// remove published reference
 		if(obj->d->type == JDnsSharedRequest::Publish)
 		{
@@ -1006,7 +1271,27 @@ void JDnsSharedPrivate::removeInterface(const QHostAddress &addr)
 	//   handleless requests.
 	foreach(JDnsSharedRequest *obj, requests)
 	{
-		if(obj->d->handles.isEmpty())
+		// already resolved as part of a group below
+		if(!requests.contains(obj))
+			continue;
+
+		if(obj->d->group)
+		{
+			QueryGroup *g = obj->d->group;
+			if(g->handles.isEmpty())
+			{
+				foreach(JDnsSharedRequest *member, g->members)
+				{
+					member->d->group = 0;
+					requests.remove(member);
+					member->d->success = false;
+					member->d->error = JDnsSharedRequest::ErrorNoNet;
+					member->d->lateTimer.start();
+				}
+				removeGroup(g);
+			}
+		}
+		else if(obj->d->handles.isEmpty())
 		{
 			if(mode == JDnsShared::UnicastInternet || mode == JDnsShared::UnicastLocal)
 			{
@@ -1070,30 +1355,25 @@ void JDnsSharedPrivate::queryStart(JDnsSharedRequest *obj, const QByteArray &nam
 		}
 	}
 
-	QJDns::SystemInfo sysInfo = get_sys_info();
+	const SystemInfoSnapshot *sysInfo = get_sys_info();
 
 	// is the input name a known host and the qType is an address record?
 	if(qType == QJDns::Aaaa || qType == QJDns::A)
 	{
-		QByteArray lname = name.toLower();
-		QList<QJDns::DnsHost> known = sysInfo.hosts;
-		foreach(QJDns::DnsHost host, known)
+		const QHash<QByteArray, QHostAddress> &known = (qType == QJDns::Aaaa) ? sysInfo->hosts6 : sysInfo->hosts4;
+		QHash<QByteArray, QHostAddress>::ConstIterator it = known.find(normalizedHostName(name));
+		if(it != known.end())
 		{
-			if(((qType == QJDns::Aaaa && host.address.protocol() == QAbstractSocket::IPv6Protocol)
-				|| (qType == QJDns::A && host.address.protocol() == QAbstractSocket::IPv4Protocol))
-				&& host.name.toLower() == lname)
-			{
-				QJDns::Record rec;
-				rec.owner = name;
-				rec.type = qType;
-				rec.ttl = 120;
-				rec.haveKnown = true;
-				rec.address = host.address;
-				obj->d->success = true;
-				obj->d->results = QList<QJDns::Record>() << rec;
-				obj->d->lateTimer.start();
-				return;
-			}
+			QJDns::Record rec;
+			rec.owner = name;
+			rec.type = qType;
+			rec.ttl = 120;
+			rec.haveKnown = true;
+			rec.address = it.value();
+			obj->d->success = true;
+			obj->d->results = QList<QJDns::Record>() << rec;
+			obj->d->lateTimer.start();
+			return;
 		}
 	}
 
@@ -1111,7 +1391,7 @@ void JDnsSharedPrivate::queryStart(JDnsSharedRequest *obj, const QByteArray &nam
 		QList<QJDns::NameServer> ns_v6;
 		QList<QJDns::NameServer> ns_v4;
 		{
-			QList<QJDns::NameServer> nameServers = sysInfo.nameServers;
+			QList<QJDns::NameServer> nameServers = sysInfo->info.nameServers;
 			foreach(QJDns::NameServer ns, nameServers)
 			{
 				if(ns.address.protocol() == QAbstractSocket::IPv6Protocol)
@@ -1132,6 +1412,34 @@ void JDnsSharedPrivate::queryStart(JDnsSharedRequest *obj, const QByteArray &nam
 	// keep track of this request
 	requests += obj;
 
+	if(mode == JDnsShared::UnicastInternet || mode == JDnsShared::UnicastLocal)
+	{
+		// someone is already asking the same question?  wait on that
+		QueryKey key(name.toLower(), qType);
+		QueryGroup *g = groupForKey.value(key);
+		if(g)
+		{
+			g->members += obj;
+			obj->d->group = g;
+			return;
+		}
+
+		g = new QueryGroup;
+		g->name = name;
+		g->qType = qType;
+		g->members += obj;
+		obj->d->group = g;
+		groupForKey.insert(key, g);
+
+		foreach(Instance *i, instances)
+		{
+			Handle h(i->jdns, i->jdns->queryStart(name, qType));
+			g->handles += h;
+			groupForHandle.insert(h, g);
+		}
+		return;
+	}
+
 	// query on all jdns instances
 	foreach(Instance *i, instances)
 	{
@@ -1148,6 +1456,18 @@ void JDnsSharedPrivate::queryCancel(JDnsSharedRequest *obj)
 	if(!requests.contains(obj))
 		return;
 
+	if(obj->d->group)
+	{
+		// the query keeps running as long as anyone else wants it
+		QueryGroup *g = obj->d->group;
+		obj->d->group = 0;
+		g->members.removeAll(obj);
+		if(g->members.isEmpty())
+			removeGroup(g);
+		requests.remove(obj);
+		return;
+	}
+
 	foreach(Handle h, obj->d->handles)
 	{
 		h.jdns->queryCancel(h.id);
@@ -1158,6 +1478,42 @@ void JDnsSharedPrivate::queryCancel(JDnsSharedRequest *obj)
 	requests.remove(obj);
 }
 
+void JDnsSharedPrivate::removeGroup(QueryGroup *g)
+{
+	foreach(Handle h, g->handles)
+	{
+		h.jdns->queryCancel(h.id);
+		groupForHandle.remove(h);
+	}
+
+	groupForKey.remove(QueryKey(g->name.toLower(), g->qType));
+	delete g;
+}
+
+void JDnsSharedPrivate::groupFinished(QueryGroup *g, bool success, const QList<QJDns::Record> &results, JDnsSharedRequest::Error error)
+{
+	QList<JDnsSharedRequest*> members = g->members;
+	removeGroup(g);
+
+	foreach(JDnsSharedRequest *obj, members)
+	{
+		obj->d->group = 0;
+		requests.remove(obj);
+		obj->d->success = success;
+		if(success)
+			obj->d->results = results;
+		else
+			obj->d->error = error;
+	}
+
+	// the first requester hears about it right away.  the rest are told
+	//   from their late timers, so that whatever the first one does in
+	//   its slot (cancel or delete the others) is respected.
+	for(int n = 1; n < members.count(); ++n)
+		members[n]->d->lateTimer.start();
+	emit members.first()->resultsReady();
+}
+
 void JDnsSharedPrivate::publishStart(JDnsSharedRequest *obj, QJDns::PublishMode m, const QJDns::Record &record)
 {
 	obj->d->type = JDnsSharedRequest::Publish;
@@ -1221,6 +1577,20 @@ void JDnsSharedPrivate::publishCancel(JDnsSharedRequest *obj)
 void JDnsSharedPrivate::jdns_resultsReady(int id, const QJDns::Response &results)
 {
 	QJDns *jdns = (QJDns *)sender();
+
+	QueryGroup *g = groupForHandle.value(Handle(jdns, id));
+	if(g)
+	{
+		// only one response, so "cancel" it.  the related handles
+		//   are canceled along with the group.
+		Handle h(jdns, id);
+		g->handles.removeAll(h);
+		groupForHandle.remove(h);
+
+		groupFinished(g, true, results.answerRecords, JDnsSharedRequest::ErrorGeneric);
+		return;
+	}
+
 	JDnsSharedRequest *obj = findRequest(jdns, id);
 	Q_ASSERT(obj);
 
@@ -1333,9 +1703,35 @@ void JDnsSharedPrivate::jdns_published(int id)
 	}
 }
 
+static JDnsSharedRequest::Error queryError(QJDns::Error e)
+{
+	if(e == QJDns::ErrorNXDomain)
+		return JDnsSharedRequest::ErrorNXDomain;
+	else if(e == QJDns::ErrorTimeout)
+		return JDnsSharedRequest::ErrorTimeout;
+	else // ErrorGeneric
+		return JDnsSharedRequest::ErrorGeneric;
+}
+
 void JDnsSharedPrivate::jdns_error(int id, QJDns::Error e)
 {
 	QJDns *jdns = (QJDns *)sender();
+
+	QueryGroup *g = groupForHandle.value(Handle(jdns, id));
+	if(g)
+	{
+		Handle h(jdns, id);
+		g->handles.removeAll(h);
+		groupForHandle.remove(h);
+
+		// ignore the error if it is not the last error
+		if(!g->handles.isEmpty())
+			return;
+
+		groupFinished(g, false, QList<QJDns::Record>(), queryError(e));
+		return;
+	}
+
 	JDnsSharedRequest *obj = findRequest(jdns, id);
 	Q_ASSERT(obj);
 
@@ -1360,14 +1756,7 @@ void JDnsSharedPrivate::jdns_error(int id, QJDns::Error e)
 		requests.remove(obj);
 
 		obj->d->success = false;
-		JDnsSharedRequest::Error x = JDnsSharedRequest::ErrorGeneric;
-		if(e == QJDns::ErrorNXDomain)
-			x = JDnsSharedRequest::ErrorNXDomain;
-		else if(e == QJDns::ErrorTimeout)
-			x = JDnsSharedRequest::ErrorTimeout;
-		else // ErrorGeneric
-			x = JDnsSharedRequest::ErrorGeneric;
-		obj->d->error = x;
+		obj->d->error = queryError(e);
 		emit obj->resultsReady();
 	}
 	else // Publish
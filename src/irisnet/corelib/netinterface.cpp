@@ -41,8 +41,14 @@ public:
 		return info;
 	}
 
+	QString interfaceForAddress(const QHostAddress &a) {
+		QMutexLocker locker(&m);
+
+		return byAddress.value(a);
+	}
+
 	NetTracker() {
-		QList<IrisNetProvider*> list = irisNetProviders();
+		QList<IrisNetProvider*> list = irisNetProviders(IrisNetInterfaceKind);
 
 		c = 0;
 		foreach(IrisNetProvider* p, list) {
@@ -53,7 +59,7 @@ public:
 		connect(c, SIGNAL(updated()), SLOT(c_updated()));
 
 		c->start();
-		info = filterList(c->interfaces());
+		setInfo(filterList(c->interfaces()));
 	}
 
 	~NetTracker() {
@@ -76,11 +82,43 @@ private:
 		return out;
 	}
 
+	static const NetInterfaceProvider::Info *find(const QList<NetInterfaceProvider::Info> &list, const QString &id) {
+		for(int n = 0; n < list.count(); ++n)
+		{
+			if(list[n].id == id) return &list[n];
+		}
+		return 0;
+	}
+
+	// replace info and bring byAddress up to date, touching only the
+	//   interfaces whose addresses actually changed.  call with m held.
+	void setInfo(const QList<NetInterfaceProvider::Info> &newinfo) {
+		for(int n = 0; n < info.count(); ++n)
+		{
+			const NetInterfaceProvider::Info *i = find(newinfo, info[n].id);
+			if(i && i->addresses == info[n].addresses) continue;
+			foreach(const QHostAddress &a, info[n].addresses)
+			{
+				if(byAddress.value(a) == info[n].id) byAddress.remove(a);
+			}
+		}
+		for(int n = 0; n < newinfo.count(); ++n)
+		{
+			const NetInterfaceProvider::Info *i = find(info, newinfo[n].id);
+			if(i && i->addresses == newinfo[n].addresses) continue;
+			foreach(const QHostAddress &a, newinfo[n].addresses)
+			{
+				if(!byAddress.contains(a)) byAddress.insert(a, newinfo[n].id);
+			}
+		}
+		info = newinfo;
+	}
+
 private slots:
 	void c_updated() {
 		{
 			QMutexLocker locker(&m);
-			info = filterList(c->interfaces());
+			setInfo(filterList(c->interfaces()));
 		}
 		emit updated();
 	}
@@ -91,6 +129,7 @@ private:
 	NetInterfaceProvider *c;
 	QMutex m;
 	QList<NetInterfaceProvider::Info> info;
+	QHash<QHostAddress, QString> byAddress;
 
 };
 
@@ -133,6 +172,10 @@ public:
 		return nettracker->getInterfaces();
 	}
 
+	QString interfaceForAddress(const QHostAddress &a) {
+		return nettracker->interfaceForAddress(a);
+	}
+
 
 	~NetTrackerThread() {
 		// locked from caller
@@ -393,24 +436,29 @@ QStringList NetInterfaceManager::interfaces() const
 
 QString NetInterfaceManager::interfaceForAddress(const QHostAddress &a)
 {
-	NetInterfaceManager netman;
-	QStringList list = netman.interfaces();
-	for(int n = 0; n < list.count(); ++n) {
-		NetInterface iface(list[n], &netman);
-		if(iface.addresses().contains(a)) return list[n];
-	}
-	return QString();
+	NetTrackerThread *tracker = NetTrackerThread::getRef();
+	QString id = tracker->interfaceForAddress(a);
+	tracker->releaseRef();
+	return id;
 }
 
 void *NetInterfaceManager::reg(const QString &id, NetInterface *i)
 {
-	for(int n = 0; n < d->info.count(); ++n) {
-		if(d->info[n].id == id) {
-			d->listeners += i;
-			return new NetInterfaceProvider::Info(d->info[n]);
-		}
+	int n = NetInterfaceManagerPrivate::lookup(d->info, id);
+
+	// the id may have come from interfaceForAddress(), which looks at
+	//   the tracker directly rather than at our snapshot
+	if(n == -1) {
+		QList<NetInterfaceProvider::Info> latest = d->tracker->getInterfaces();
+		n = NetInterfaceManagerPrivate::lookup(latest, id);
+		if(n == -1)
+			return 0;
+		d->listeners += i;
+		return new NetInterfaceProvider::Info(latest[n]);
 	}
-	return 0;
+
+	d->listeners += i;
+	return new NetInterfaceProvider::Info(d->info[n]);
 }
 
 void NetInterfaceManager::unreg(NetInterface *i)
@@ -24,6 +24,10 @@
 
 // gateway detection currently only works on linux
 
+// changes are picked up from a netlink socket on linux, or a routing
+//   socket on the bsds.  elsewhere, or if the socket can't be opened, we
+//   fall back to polling.
+
 #include "irisnetplugin.h"
 
 #include <sys/types.h>
@@ -33,6 +37,17 @@
 #include <net/route.h>
 #include <netinet/in.h>
 #include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef Q_OS_LINUX
+# include <linux/netlink.h>
+# include <linux/rtnetlink.h>
+# define HAVE_NETLINK
+#elif defined(Q_OS_MAC) || defined(Q_OS_FREEBSD) || defined(Q_OS_NETBSD) || defined(Q_OS_OPENBSD)
+# define HAVE_ROUTE_SOCKET
+#endif
 
 // for solaris
 #ifndef SIOCGIFCONF
@@ -319,6 +334,86 @@ static QList<UnixGateway> get_unix_gateways()
 	return out;
 }
 
+// returns a non-blocking socket that becomes readable when interfaces,
+//   addresses or routes change, or -1 if there is no such thing here
+static int open_change_socket()
+{
+	int fd = -1;
+#if defined(HAVE_NETLINK)
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if(fd == -1)
+		return -1;
+
+	struct sockaddr_nl sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+	if(bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+#elif defined(HAVE_ROUTE_SOCKET)
+	fd = socket(PF_ROUTE, SOCK_RAW, 0);
+	if(fd == -1)
+		return -1;
+#else
+	return -1;
+#endif
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+}
+
+// drain the change socket.  returns true if anything we care about changed.
+static bool read_change_socket(int fd)
+{
+	bool changed = false;
+	char buf[8192];
+	while(1)
+	{
+		int ret = recv(fd, buf, sizeof(buf), 0);
+		if(ret == -1)
+		{
+			if(errno == EINTR)
+				continue;
+
+			// we fell behind and lost messages, so assume the worst
+			if(errno == ENOBUFS)
+				changed = true;
+			break;
+		}
+		if(ret == 0)
+			break;
+
+#if defined(HAVE_NETLINK)
+		int len = ret;
+		for(struct nlmsghdr *h = (struct nlmsghdr *)buf; NLMSG_OK(h, (unsigned int)len); h = NLMSG_NEXT(h, len))
+		{
+			switch(h->nlmsg_type)
+			{
+				case RTM_NEWLINK:
+				case RTM_DELLINK:
+				case RTM_NEWADDR:
+				case RTM_DELADDR:
+				case RTM_NEWROUTE:
+				case RTM_DELROUTE:
+					changed = true;
+					break;
+				default:
+					break;
+			}
+		}
+#else
+		// every routing socket message is about an interface, address
+		//   or route
+		changed = true;
+#endif
+	}
+	return changed;
+}
+
 namespace XMPP {
 
 class UnixNet : public NetInterfaceProvider
@@ -328,15 +423,37 @@ class UnixNet : public NetInterfaceProvider
 public:
 	QList<Info> info;
 	QTimer t;
+	int changeFd;
+	QSocketNotifier *sn;
+	QTimer settle;
 
-	UnixNet() : t(this)
+	UnixNet() : t(this), changeFd(-1), sn(0), settle(this)
 	{
 		connect(&t, SIGNAL(timeout()), SLOT(check()));
+
+		// changes tend to come in bursts, so wait for things to
+		//   quiet down a little before looking
+		settle.setSingleShot(true);
+		connect(&settle, SIGNAL(timeout()), SLOT(check()));
+	}
+
+	~UnixNet()
+	{
+		delete sn;
+		if(changeFd != -1)
+			close(changeFd);
 	}
 
 	void start()
 	{
-		t.start(5000);
+		changeFd = open_change_socket();
+		if(changeFd != -1)
+		{
+			sn = new QSocketNotifier(changeFd, QSocketNotifier::Read, this);
+			connect(sn, SIGNAL(activated(int)), SLOT(sn_activated()));
+		}
+		else
+			t.start(5000);
 		poll();
 	}
 
@@ -407,6 +524,13 @@ public slots:
 		poll();
 		emit updated();
 	}
+
+private slots:
+	void sn_activated()
+	{
+		if(read_change_socket(changeFd) && !settle.isActive())
+			settle.start(100);
+	}
 };
 
 class UnixNetProvider : public IrisNetProvider
@@ -24,6 +24,7 @@
 #include "irisnetplugin.h"
 #include "irisnetglobal_p.h"
 #include "addressresolver.h"
+#include "iristrace.h"
 
 namespace XMPP {
 
@@ -405,8 +406,15 @@ class NameManager;
 Q_GLOBAL_STATIC(QMutex, nman_mutex)
 static NameManager *g_nman = 0;
 
-class NameResolver::Private
+// the backend (NameManager and the providers it creates) runs in its own
+//   thread, shared by every thread that uses the front-end classes below.
+//   front-ends talk to the backend with queued calls, and the backend
+//   answers by queuing calls back onto the front-end's private object.
+//   each front-end is known to the backend only by an id.
+
+class NameResolver::Private : public QObject
 {
+	Q_OBJECT
 public:
 	NameResolver *q;
 
@@ -417,17 +425,38 @@ public:
 	Private(NameResolver *_q) : q(_q)
 	{
 	}
+
+private slots:
+	void backend_resultsReady(const QList<XMPP::NameRecord> &results);
+	void backend_error(XMPP::NameResolver::Error e);
 };
 
-class ServiceBrowser::Private
+class ServiceBrowser::Private : public QObject
 {
+	Q_OBJECT
 public:
 	ServiceBrowser *q;
 
 	int id;
 
-	Private(ServiceBrowser *_q) : q(_q)
+	Private(ServiceBrowser *_q) : q(_q), id(-1)
+	{
+	}
+
+private slots:
+	void backend_instanceAvailable(const XMPP::ServiceInstance &i)
+	{
+		emit q->instanceAvailable(i);
+	}
+
+	void backend_instanceUnavailable(const XMPP::ServiceInstance &i)
+	{
+		emit q->instanceUnavailable(i);
+	}
+
+	void backend_error()
 	{
+		emit q->error();
 	}
 };
 
@@ -443,6 +472,7 @@ public:
 	NameResolver dns;
 	AddressResolver adns;
 	int port;
+	QByteArray host;
 
 	class Server
 	{
@@ -453,18 +483,114 @@ public:
 		int weight;
 	};
 
-	QList<Server> servers;
+	// an srv target, its addresses looked up at the same time as the
+	//   others
+	class Target
+	{
+	public:
+		Server serv;
+		AddressResolver *adns;
+		QList<QHostAddress> addrs; // not handed out yet
+		QList<QHostAddress> seen;
+		bool done;
+	};
+
+	QList<Target*> targets; // in the order to try them
 	QList<QHostAddress> addrs;
+	bool waiting; // tryNext() is waiting on the first target
 
-	Private(ServiceResolver *_q) : q(_q)
+	Private(ServiceResolver *_q) : q(_q), id(-1)
 	{
 		mode = 3;
+		waiting = false;
 		connect(&dns, SIGNAL(resultsReady(const QList<XMPP::NameRecord> &)), SLOT(dns_resultsReady(const QList<XMPP::NameRecord> &)));
 		connect(&dns, SIGNAL(error(XMPP::NameResolver::Error)), SLOT(dns_error(XMPP::NameResolver::Error)));
 		connect(&adns, SIGNAL(resultsReady(const QList<QHostAddress> &)), SLOT(adns_resultsReady(const QList<QHostAddress> &)));
 		connect(&adns, SIGNAL(error(XMPP::AddressResolver::Error)), SLOT(adns_error(XMPP::AddressResolver::Error)));
 	}
 
+	~Private()
+	{
+		clearTargets();
+	}
+
+	void clearTargets()
+	{
+		foreach(Target *t, targets)
+		{
+			t->adns->disconnect(this);
+			t->adns->setParent(0);
+			t->adns->deleteLater();
+			delete t;
+		}
+		targets.clear();
+		waiting = false;
+	}
+
+	// rfc 2782: lowest priority first, and within a priority a random
+	//   order where each server's chance of coming next is its weight
+	static QList<Server> sortServers(QList<Server> in)
+	{
+		QList<Server> out;
+		while(!in.isEmpty())
+		{
+			int priority = in[0].priority;
+			for(int n = 1; n < in.count(); ++n)
+			{
+				if(in[n].priority < priority)
+					priority = in[n].priority;
+			}
+
+			QList<Server> group;
+			for(int n = 0; n < in.count(); ++n)
+			{
+				if(in[n].priority == priority)
+				{
+					// zero weights go first, so they get picked
+					//   only when nothing else is left to pick
+					if(in[n].weight == 0)
+						group.prepend(in[n]);
+					else
+						group += in[n];
+					in.removeAt(n);
+					--n; // adjust position
+				}
+			}
+
+			while(!group.isEmpty())
+			{
+				int total = 0;
+				for(int n = 0; n < group.count(); ++n)
+					total += group[n].weight;
+
+				int pick = total > 0 ? qrand() % (total + 1) : 0;
+				int sum = 0;
+				int at = group.count() - 1;
+				for(int n = 0; n < group.count(); ++n)
+				{
+					sum += group[n].weight;
+					if(sum >= pick)
+					{
+						at = n;
+						break;
+					}
+				}
+				out += group.takeAt(at);
+			}
+		}
+		return out;
+	}
+
+	Target *targetFor(QObject *obj) const
+	{
+		foreach(Target *t, targets)
+		{
+			if(t->adns == obj)
+				return t;
+		}
+		return 0;
+	}
+
 	void tryNext()
 	{
 		if(mode == 3)
@@ -473,22 +599,34 @@ public:
 		}
 		if(mode == 2)
 		{
-			if(!addrs.isEmpty())
+			// hand out addresses strictly in target order.  the
+			//   first target may still be resolving, while the
+			//   ones after it are already done
+			while(!targets.isEmpty())
 			{
-				QHostAddress addr = addrs.takeFirst();
-				QMetaObject::invokeMethod(q, "resultsReady", Qt::QueuedConnection, Q_ARG(QHostAddress, addr), Q_ARG(int, port));
-				return;
-			}
-
-			if(servers.isEmpty())
-			{
-				QMetaObject::invokeMethod(q, "finished", Qt::QueuedConnection);
-				return;
+				Target *t = targets.first();
+				if(!t->addrs.isEmpty())
+				{
+					QHostAddress addr = t->addrs.takeFirst();
+					host = t->serv.host;
+					QMetaObject::invokeMethod(q, "resultsReady", Qt::QueuedConnection, Q_ARG(QHostAddress, addr), Q_ARG(int, t->serv.port));
+					return;
+				}
+
+				if(!t->done)
+				{
+					waiting = true;
+					return;
+				}
+
+				targets.removeFirst();
+				t->adns->disconnect(this);
+				t->adns->setParent(0);
+				t->adns->deleteLater();
+				delete t;
 			}
 
-			Server serv = servers.takeFirst();
-			port = serv.port;
-			adns.start(serv.host);
+			QMetaObject::invokeMethod(q, "finished", Qt::QueuedConnection);
 		}
 		else
 		{
@@ -503,11 +641,36 @@ public:
 		}
 	}
 
+	void targetResults(Target *t, const QList<QHostAddress> &results)
+	{
+		QList<QHostAddress> fresh;
+		foreach(const QHostAddress &addr, results)
+		{
+			if(!t->seen.contains(addr))
+			{
+				t->seen += addr;
+				fresh += addr;
+			}
+		}
+		t->addrs += fresh;
+
+		if(!fresh.isEmpty())
+			emit q->hostResultsReady(t->serv.host, fresh, t->serv.port);
+
+		if(waiting && t == targets.first())
+		{
+			waiting = false;
+			tryNext();
+		}
+	}
+
 private slots:
 	void dns_resultsReady(const QList<XMPP::NameRecord> &results)
 	{
 		mode = 2;
-		servers.clear();
+		clearTargets();
+
+		QList<Server> servers;
 		for(int n = 0; n < results.count(); ++n)
 		{
 			Server serv;
@@ -515,8 +678,28 @@ private slots:
 			serv.port = results[n].port();
 			serv.priority = results[n].priority();
 			serv.weight = results[n].weight();
+
+			// a target of "." means there is no such service
+			if(serv.host.isEmpty() || serv.host == ".")
+				continue;
 			servers += serv;
 		}
+
+		// look up every target at once
+		servers = sortServers(servers);
+		foreach(const Server &serv, servers)
+		{
+			Target *t = new Target;
+			t->serv = serv;
+			t->done = false;
+			t->adns = new AddressResolver(this);
+			connect(t->adns, SIGNAL(partialResultsReady(const QList<QHostAddress> &)), SLOT(target_partialResultsReady(const QList<QHostAddress> &)));
+			connect(t->adns, SIGNAL(resultsReady(const QList<QHostAddress> &)), SLOT(target_resultsReady(const QList<QHostAddress> &)));
+			connect(t->adns, SIGNAL(error(XMPP::AddressResolver::Error)), SLOT(target_error(XMPP::AddressResolver::Error)));
+			targets += t;
+			t->adns->start(serv.host);
+		}
+
 		tryNext();
 	}
 
@@ -530,16 +713,8 @@ private slots:
 
 	void adns_resultsReady(const QList<QHostAddress> &results)
 	{
-		if(mode == 1)
-		{
-			addrs = results;
-			tryNext();
-		}
-		else
-		{
-			addrs += results;
-			tryNext();
-		}
+		addrs = results;
+		tryNext();
 	}
 
 	void adns_error(XMPP::AddressResolver::Error)
@@ -549,18 +724,61 @@ private slots:
 		else
 			tryNext(); // FIXME: probably shouldn't share this
 	}
+
+	void target_partialResultsReady(const QList<QHostAddress> &results)
+	{
+		Target *t = targetFor(sender());
+		if(t)
+			targetResults(t, results);
+	}
+
+	void target_resultsReady(const QList<QHostAddress> &results)
+	{
+		Target *t = targetFor(sender());
+		if(!t)
+			return;
+
+		t->done = true;
+		targetResults(t, results);
+	}
+
+	void target_error(XMPP::AddressResolver::Error)
+	{
+		Target *t = targetFor(sender());
+		if(!t)
+			return;
+
+		t->done = true;
+		if(waiting && t == targets.first())
+		{
+			waiting = false;
+			tryNext();
+		}
+	}
+
+	void backend_resultsReady(const QHostAddress &address, int port)
+	{
+		emit q->resultsReady(address, port);
+	}
 };
 
-class ServiceLocalPublisher::Private
+class ServiceLocalPublisher::Private : public QObject
 {
+	Q_OBJECT
 public:
 	ServiceLocalPublisher *q;
 
 	int id;
 
-	Private(ServiceLocalPublisher *_q) : q(_q)
+	Private(ServiceLocalPublisher *_q) : q(_q), id(-1)
 	{
 	}
+
+private slots:
+	void backend_published()
+	{
+		emit q->published();
+	}
 };
 
 class NameManager : public QObject
@@ -569,18 +787,46 @@ class NameManager : public QObject
 public:
 	NameProvider *p_net, *p_local;
 	ServiceProvider *p_serv;
-	QHash<int,NameResolver::Private*> res_instances;
-	QHash<int,int> res_sub_instances;
 
-	QHash<int,ServiceBrowser::Private*> br_instances;
-	QHash<int,ServiceResolver::Private*> sres_instances;
-	QHash<int,ServiceLocalPublisher::Private*> slp_instances;
+	// everything from here down to the slots is only touched from the
+	//   backend thread, except where noted
+
+	class ResolveItem
+	{
+	public:
+		int frontId;
+		int type;
+		bool longLived;
+
+		ResolveItem() : frontId(-1), type(-1), longLived(false)
+		{
+		}
+	};
+
+	QHash<int,ResolveItem> res_instances;  // by provider id
+	QHash<int,int> res_for_front;          // front id -> provider id
+	QHash<int,int> res_sub_instances;      // local provider id -> net provider id
+
+	QHash<int,int> br_instances;           // provider id -> front id
+	QHash<int,int> sres_instances;         // provider id -> front id
+	QHash<int,int> slp_instances;          // provider id -> front id
+	QHash<int,int> slp_for_front;          // front id -> provider id
+
+	// front-end registry, protected by nman_mutex
+	QHash<int,QObject*> fronts;
+	int next_front_id;
+
+	QThread *backendThread;
+	QThread *returnThread;
 
 	NameManager(QObject *parent = 0) : QObject(parent)
 	{
 		p_net = 0;
 		p_local = 0;
 		p_serv = 0;
+		next_front_id = 0;
+		backendThread = 0;
+		returnThread = 0;
 	}
 
 	~NameManager()
@@ -595,7 +841,21 @@ public:
 		QMutexLocker locker(nman_mutex());
 		if(!g_nman)
 		{
+			// results travel between threads, so register everything
+			//   up front
+			qRegisterMetaType< QList<XMPP::NameRecord> >("QList<XMPP::NameRecord>");
+			qRegisterMetaType<XMPP::NameRecord>("XMPP::NameRecord");
+			qRegisterMetaType<XMPP::NameResolver::Error>("XMPP::NameResolver::Error");
+			qRegisterMetaType<XMPP::ServiceInstance>("XMPP::ServiceInstance");
+			qRegisterMetaType<XMPP::ServiceBrowser::Error>("XMPP::ServiceBrowser::Error");
+			qRegisterMetaType<XMPP::ServiceLocalPublisher::Error>("XMPP::ServiceLocalPublisher::Error");
+			qRegisterMetaType<QHostAddress>("QHostAddress");
+			qRegisterMetaType< QList<XMPP::ServiceProvider::ResolveResult> >("QList<XMPP::ServiceProvider::ResolveResult>");
+
 			g_nman = new NameManager;
+			g_nman->backendThread = new QThread;
+			g_nman->moveToThread(g_nman->backendThread);
+			g_nman->backendThread->start();
 			irisNetAddPostRoutine(NetNames::cleanup);
 		}
 		return g_nman;
@@ -603,183 +863,222 @@ public:
 
 	static void cleanup()
 	{
-		delete g_nman;
-		g_nman = 0;
-	}
-
-	void resolve_start(NameResolver::Private *np, const QByteArray &name, int qType, bool longLived)
-	{
-		QMutexLocker locker(nman_mutex());
-
-		np->type = qType;
-		np->longLived = longLived;
-		if(!p_net)
+		NameManager *man;
 		{
-			NameProvider *c = 0;
-			QList<IrisNetProvider*> list = irisNetProviders();
-			for(int n = 0; n < list.count(); ++n)
-			{
-				IrisNetProvider *p = list[n];
-				c = p->createNameProviderInternet();
-				if(c)
-					break;
-			}
-			Q_ASSERT(c); // we have built-in support, so this should never fail
-			p_net = c;
-
-			// use queued connections
-			qRegisterMetaType< QList<XMPP::NameRecord> >("QList<XMPP::NameRecord>");
-			qRegisterMetaType<XMPP::NameResolver::Error>("XMPP::NameResolver::Error");
-			connect(p_net, SIGNAL(resolve_resultsReady(int, const QList<XMPP::NameRecord> &)), SLOT(provider_resolve_resultsReady(int, const QList<XMPP::NameRecord> &)));
-			connect(p_net, SIGNAL(resolve_error(int, XMPP::NameResolver::Error)), SLOT(provider_resolve_error(int, XMPP::NameResolver::Error)));
-			connect(p_net, SIGNAL(resolve_useLocal(int, const QByteArray &)), SLOT(provider_resolve_useLocal(int, const QByteArray &)));
+			QMutexLocker locker(nman_mutex());
+			man = g_nman;
+			g_nman = 0;
 		}
+		if(!man)
+			return;
 
-		np->id = p_net->resolve_start(name, qType, longLived);
+		// the providers must be destroyed in the thread they live in
+		man->returnThread = QThread::currentThread();
+		QMetaObject::invokeMethod(man, "shutdown", Qt::BlockingQueuedConnection);
 
-		//printf("assigning %d to %p\n", req_id, np);
-		res_instances.insert(np->id, np);
+		man->backendThread->quit();
+		man->backendThread->wait();
+		delete man->backendThread;
+		delete man;
 	}
 
-	void resolve_stop(NameResolver::Private *np)
+	// front-end side, any thread
+	int registerFront(QObject *obj)
 	{
-		// FIXME: stop sub instances?
-		p_net->resolve_stop(np->id);
-		resolve_cleanup(np);
+		QMutexLocker locker(nman_mutex());
+		int id;
+		do
+		{
+			id = next_front_id++;
+			if(next_front_id < 0)
+				next_front_id = 0;
+		} while(fronts.contains(id));
+		fronts.insert(id, obj);
+		return id;
 	}
 
-	void resolve_cleanup(NameResolver::Private *np)
+	// front-end side, any thread.  once this returns, the backend will
+	//   not queue anything more for the object
+	void unregisterFront(int id)
 	{
-		res_instances.remove(np->id);
-		NameResolver *q = np->q;
-		delete q->d;
-		q->d = 0;
+		QMutexLocker locker(nman_mutex());
+		fronts.remove(id);
 	}
 
-	void browse_start(ServiceBrowser::Private *np, const QString &type, const QString &domain)
+	// backend side.  anything already queued is dropped by Qt when the
+	//   front-end object is deleted
+	void postToFront(int id, const char *method, QGenericArgument val0 = QGenericArgument(0), QGenericArgument val1 = QGenericArgument())
 	{
 		QMutexLocker locker(nman_mutex());
+		QObject *obj = fronts.value(id);
+		if(obj)
+			QMetaObject::invokeMethod(obj, method, Qt::QueuedConnection, val0, val1);
+	}
+
+	bool ensureNet()
+	{
+		if(p_net)
+			return true;
 
-		if(!p_serv)
+		NameProvider *c = 0;
+		QList<IrisNetProvider*> list = irisNetProviders(IrisNetNameInternetKind);
+		for(int n = 0; n < list.count(); ++n)
 		{
-			ServiceProvider *c = 0;
-			QList<IrisNetProvider*> list = irisNetProviders();
-			for(int n = 0; n < list.count(); ++n)
-			{
-				IrisNetProvider *p = list[n];
-				c = p->createServiceProvider();
-				if(c)
-					break;
-			}
-			Q_ASSERT(c); // we have built-in support, so this should never fail
-			p_serv = c;
+			IrisNetProvider *p = list[n];
+			c = p->createNameProviderInternet();
+			if(c)
+				break;
+		}
+		Q_ASSERT(c); // we have built-in support, so this should never fail
+		p_net = c;
 
-			// use queued connections
-			qRegisterMetaType<XMPP::ServiceInstance>("XMPP::ServiceInstance");
-			qRegisterMetaType<XMPP::ServiceBrowser::Error>("XMPP::ServiceBrowser::Error");
+		connect(p_net, SIGNAL(resolve_resultsReady(int, const QList<XMPP::NameRecord> &)), SLOT(provider_resolve_resultsReady(int, const QList<XMPP::NameRecord> &)));
+		connect(p_net, SIGNAL(resolve_error(int, XMPP::NameResolver::Error)), SLOT(provider_resolve_error(int, XMPP::NameResolver::Error)));
+		connect(p_net, SIGNAL(resolve_useLocal(int, const QByteArray &)), SLOT(provider_resolve_useLocal(int, const QByteArray &)));
+		return true;
+	}
 
-			connect(p_serv, SIGNAL(browse_instanceAvailable(int, const XMPP::ServiceInstance &)), SLOT(provider_browse_instanceAvailable(int, const XMPP::ServiceInstance &)), Qt::QueuedConnection);
-			connect(p_serv, SIGNAL(browse_instanceUnavailable(int, const XMPP::ServiceInstance &)), SLOT(provider_browse_instanceUnavailable(int, const XMPP::ServiceInstance &)), Qt::QueuedConnection);
-			connect(p_serv, SIGNAL(browse_error(int, XMPP::ServiceBrowser::Error)), SLOT(provider_browse_error(int, XMPP::ServiceBrowser::Error)), Qt::QueuedConnection);
+	void ensureServ()
+	{
+		if(p_serv)
+			return;
+
+		ServiceProvider *c = 0;
+		QList<IrisNetProvider*> list = irisNetProviders(IrisNetServiceKind);
+		for(int n = 0; n < list.count(); ++n)
+		{
+			IrisNetProvider *p = list[n];
+			c = p->createServiceProvider();
+			if(c)
+				break;
 		}
+		Q_ASSERT(c); // we have built-in support, so this should never fail
+		p_serv = c;
+
+		// use queued connections
+		connect(p_serv, SIGNAL(browse_instanceAvailable(int, const XMPP::ServiceInstance &)), SLOT(provider_browse_instanceAvailable(int, const XMPP::ServiceInstance &)), Qt::QueuedConnection);
+		connect(p_serv, SIGNAL(browse_instanceUnavailable(int, const XMPP::ServiceInstance &)), SLOT(provider_browse_instanceUnavailable(int, const XMPP::ServiceInstance &)), Qt::QueuedConnection);
+		connect(p_serv, SIGNAL(browse_error(int, XMPP::ServiceBrowser::Error)), SLOT(provider_browse_error(int, XMPP::ServiceBrowser::Error)), Qt::QueuedConnection);
+		connect(p_serv, SIGNAL(resolve_resultsReady(int, const QList<XMPP::ServiceProvider::ResolveResult> &)), SLOT(provider_resolve_resultsReady(int, const QList<XMPP::ServiceProvider::ResolveResult> &)), Qt::QueuedConnection);
+		connect(p_serv, SIGNAL(publish_published(int)), SLOT(provider_publish_published(int)), Qt::QueuedConnection);
+		connect(p_serv, SIGNAL(publish_extra_published(int)), SLOT(provider_publish_extra_published(int)), Qt::QueuedConnection);
+	}
 
-		/*np->id = */
+	void resolve_cleanup(int id)
+	{
+		ResolveItem i = res_instances.take(id);
+		res_for_front.remove(i.frontId);
+	}
 
-		np->id = p_serv->browse_start(type, domain);
+public slots:
+	// backend side, called through queued invocations from the front-ends
 
-		br_instances.insert(np->id, np);
+	void resolve_start(int frontId, const QByteArray &name, int qType, bool longLived)
+	{
+		ensureNet();
+
+		ResolveItem i;
+		i.frontId = frontId;
+		i.type = qType;
+		i.longLived = longLived;
+
+		int id = p_net->resolve_start(name, qType, longLived);
+		res_instances.insert(id, i);
+		res_for_front.insert(frontId, id);
 	}
 
-	void resolve_instance_start(ServiceResolver::Private *np, const QByteArray &name)
+	void resolve_stop(int frontId)
 	{
-		QMutexLocker locker(nman_mutex());
+		// already finished?
+		if(!res_for_front.contains(frontId))
+			return;
 
-		if(!p_serv)
-		{
-			ServiceProvider *c = 0;
-			QList<IrisNetProvider*> list = irisNetProviders();
-			for(int n = 0; n < list.count(); ++n)
-			{
-				IrisNetProvider *p = list[n];
-				c = p->createServiceProvider();
-				if(c)
-					break;
-			}
-			Q_ASSERT(c); // we have built-in support, so this should never fail
-			p_serv = c;
+		// FIXME: stop sub instances?
+		int id = res_for_front.value(frontId);
+		p_net->resolve_stop(id);
+		resolve_cleanup(id);
+	}
 
-			// use queued connections
-			qRegisterMetaType<QHostAddress>("QHostAddress");
-			qRegisterMetaType< QList<XMPP::ServiceProvider::ResolveResult> >("QList<XMPP::ServiceProvider::ResolveResult>");
-			connect(p_serv, SIGNAL(resolve_resultsReady(int, const QList<XMPP::ServiceProvider::ResolveResult> &)), SLOT(provider_resolve_resultsReady(int, const QList<XMPP::ServiceProvider::ResolveResult> &)), Qt::QueuedConnection);
-		}
+	void browse_start(int frontId, const QString &type, const QString &domain)
+	{
+		ensureServ();
 
-		/*np->id = */
+		int id = p_serv->browse_start(type, domain);
+		br_instances.insert(id, frontId);
+	}
 
-		np->id = p_serv->resolve_start(name);
+	void resolve_instance_start(int frontId, const QByteArray &name)
+	{
+		ensureServ();
 
-		sres_instances.insert(np->id, np);
+		int id = p_serv->resolve_start(name);
+		sres_instances.insert(id, frontId);
 	}
 
-	void publish_start(ServiceLocalPublisher::Private *np, const QString &instance, const QString &type, int port, const QMap<QString,QByteArray> &attribs)
+	void publish_start(int frontId, const QString &instance, const QString &type, int port, const QVariantMap &attribs)
 	{
-		QMutexLocker locker(nman_mutex());
+		ensureServ();
 
-		if(!p_serv)
+		QMap<QString,QByteArray> attribMap;
+		QMapIterator<QString,QVariant> it(attribs);
+		while(it.hasNext())
 		{
-			ServiceProvider *c = 0;
-			QList<IrisNetProvider*> list = irisNetProviders();
-			for(int n = 0; n < list.count(); ++n)
-			{
-				IrisNetProvider *p = list[n];
-				c = p->createServiceProvider();
-				if(c)
-					break;
-			}
-			Q_ASSERT(c); // we have built-in support, so this should never fail
-			p_serv = c;
-
-			// use queued connections
-			qRegisterMetaType<XMPP::ServiceLocalPublisher::Error>("XMPP::ServiceLocalPublisher::Error");
-			connect(p_serv, SIGNAL(publish_published(int)), SLOT(provider_publish_published(int)), Qt::QueuedConnection);
-			connect(p_serv, SIGNAL(publish_extra_published(int)), SLOT(provider_publish_extra_published(int)), Qt::QueuedConnection);
+			it.next();
+			attribMap.insert(it.key(), it.value().toByteArray());
 		}
 
-		/*np->id = */
+		int id = p_serv->publish_start(instance, type, port, attribMap);
+		slp_instances.insert(id, frontId);
+		slp_for_front.insert(frontId, id);
+	}
 
-		np->id = p_serv->publish_start(instance, type, port, attribs);
+	void publish_extra_start(int frontId, const XMPP::NameRecord &rec)
+	{
+		if(!p_serv || !slp_for_front.contains(frontId))
+			return;
 
-		slp_instances.insert(np->id, np);
+		p_serv->publish_extra_start(slp_for_front.value(frontId), rec);
 	}
 
-	void publish_extra_start(ServiceLocalPublisher::Private *np, const NameRecord &rec)
+	void shutdown()
 	{
-		np->id = p_serv->publish_extra_start(np->id, rec);
+		delete p_net;
+		p_net = 0;
+		delete p_local;
+		p_local = 0;
+		delete p_serv;
+		p_serv = 0;
+
+		// hand ourselves back so we can be deleted after the thread ends
+		moveToThread(returnThread);
 	}
 
 private slots:
 	void provider_resolve_resultsReady(int id, const QList<XMPP::NameRecord> &results)
 	{
-		NameResolver::Private *np = res_instances.value(id);
-		NameResolver *q = np->q; // resolve_cleanup deletes np
-		if(!np->longLived)
-			resolve_cleanup(np);
-		emit q->resultsReady(results);
+		if(!res_instances.contains(id))
+			return;
+
+		ResolveItem i = res_instances.value(id);
+		if(!i.longLived)
+			resolve_cleanup(id);
+		postToFront(i.frontId, "backend_resultsReady", Q_ARG(QList<XMPP::NameRecord>, results));
 	}
 
 	void provider_resolve_error(int id, XMPP::NameResolver::Error e)
 	{
-		NameResolver::Private *np = res_instances.value(id);
-		NameResolver *q = np->q; // resolve_cleanup deletes np
-		resolve_cleanup(np);
-		emit q->error(e);
+		if(!res_instances.contains(id))
+			return;
+
+		ResolveItem i = res_instances.value(id);
+		resolve_cleanup(id);
+		postToFront(i.frontId, "backend_error", Q_ARG(XMPP::NameResolver::Error, e));
 	}
 
 	void provider_local_resolve_resultsReady(int id, const QList<XMPP::NameRecord> &results)
 	{
 		int par_id = res_sub_instances.value(id);
-		NameResolver::Private *np = res_instances.value(par_id);
-		if(!np->longLived)
+		if(!res_instances.value(par_id).longLived)
 			res_sub_instances.remove(id);
 		p_net->resolve_localResultsReady(par_id, results);
 	}
@@ -797,7 +1096,7 @@ private slots:
 		if(!p_local)
 		{
 			NameProvider *c = 0;
-			QList<IrisNetProvider*> list = irisNetProviders();
+			QList<IrisNetProvider*> list = irisNetProviders(IrisNetNameLocalKind);
 			for(int n = 0; n < list.count(); ++n)
 			{
 				IrisNetProvider *p = list[n];
@@ -810,74 +1109,72 @@ private slots:
 			p_local = c;
 
 			// use queued connections
-			qRegisterMetaType< QList<XMPP::NameRecord> >("QList<XMPP::NameRecord>");
-			qRegisterMetaType<XMPP::NameResolver::Error>("XMPP::NameResolver::Error");
 			connect(p_local, SIGNAL(resolve_resultsReady(int, const QList<XMPP::NameRecord> &)), SLOT(provider_local_resolve_resultsReady(int, const QList<XMPP::NameRecord> &)), Qt::QueuedConnection);
 			connect(p_local, SIGNAL(resolve_error(int, XMPP::NameResolver::Error)), SLOT(provider_local_resolve_error(int, XMPP::NameResolver::Error)), Qt::QueuedConnection);
 		}
 
-		NameResolver::Private *np = res_instances.value(id);
-
-		/*// transfer to local only
-		if(np->longLived)
-		{
-			res_instances.remove(np->id);
-
-			np->id = p_local->resolve_start(name, np->type, true);
-			res_instances.insert(np->id, np);
-		}
-		// sub request
-		else
-		{
-			int req_id = p_local->resolve_start(name, np->type, false);
-
-			res_sub_instances.insert(req_id, np->id);
-		}*/
+		ResolveItem i = res_instances.value(id);
 
-		int req_id = p_local->resolve_start(name, np->type, np->longLived);
-		res_sub_instances.insert(req_id, np->id);
+		int req_id = p_local->resolve_start(name, i.type, i.longLived);
+		res_sub_instances.insert(req_id, id);
 	}
 
 	void provider_browse_instanceAvailable(int id, const XMPP::ServiceInstance &i)
 	{
-		ServiceBrowser::Private *np = br_instances.value(id);
-		emit np->q->instanceAvailable(i);
+		postToFront(br_instances.value(id, -1), "backend_instanceAvailable", Q_ARG(XMPP::ServiceInstance, i));
 	}
 
 	void provider_browse_instanceUnavailable(int id, const XMPP::ServiceInstance &i)
 	{
-		ServiceBrowser::Private *np = br_instances.value(id);
-		emit np->q->instanceUnavailable(i);
+		postToFront(br_instances.value(id, -1), "backend_instanceUnavailable", Q_ARG(XMPP::ServiceInstance, i));
 	}
 
 	void provider_browse_error(int id, XMPP::ServiceBrowser::Error e)
 	{
 		Q_UNUSED(e);
-		ServiceBrowser::Private *np = br_instances.value(id);
 		// TODO
-		emit np->q->error();
+		postToFront(br_instances.value(id, -1), "backend_error");
 	}
 
 	void provider_resolve_resultsReady(int id, const QList<XMPP::ServiceProvider::ResolveResult> &results)
 	{
-		ServiceResolver::Private *np = sres_instances.value(id);
-		emit np->q->resultsReady(results[0].address, results[0].port);
+		postToFront(sres_instances.value(id, -1), "backend_resultsReady", Q_ARG(QHostAddress, results[0].address), Q_ARG(int, results[0].port));
 	}
 
 	void provider_publish_published(int id)
 	{
-		ServiceLocalPublisher::Private *np = slp_instances.value(id);
-		emit np->q->published();
+		postToFront(slp_instances.value(id, -1), "backend_published");
 	}
 
 	void provider_publish_extra_published(int id)
 	{
 		Q_UNUSED(id);
-		//ServiceLocalPublisher::Private *np = slp_instances.value(id);
-		//emit np->q->published();
 	}
 };
 
+void NameResolver::Private::backend_resultsReady(const QList<XMPP::NameRecord> &results)
+{
+	// a single lookup is over once results arrive.  detach first, so the
+	//   object can be reused from a slot.
+	if(!longLived)
+	{
+		NameManager::instance()->unregisterFront(id);
+		q->d = 0;
+		deleteLater();
+	}
+	IRIS_TRACEPOINT2(dns_query_end, q, results.count());
+	emit q->resultsReady(results);
+}
+
+void NameResolver::Private::backend_error(XMPP::NameResolver::Error e)
+{
+	NameManager::instance()->unregisterFront(id);
+	q->d = 0;
+	deleteLater();
+	IRIS_TRACEPOINT2(dns_query_end, q, -1);
+	emit q->error(e);
+}
+
 //----------------------------------------------------------------------------
 // NameResolver
 //----------------------------------------------------------------------------
@@ -931,14 +1228,22 @@ void NameResolver::start(const QByteArray &name, NameRecord::Type type, Mode mod
 	int qType = recordType2Rtype(type);
 	if(qType == -1)
 		qType = JDNS_RTYPE_A;
-	NameManager::instance()->resolve_start(d, name, qType, mode == NameResolver::LongLived ? true : false);
+	d->type = qType;
+	d->longLived = (mode == NameResolver::LongLived) ? true : false;
+
+	NameManager *man = NameManager::instance();
+	d->id = man->registerFront(d);
+	IRIS_TRACEPOINT2(dns_query_begin, this, qType);
+	QMetaObject::invokeMethod(man, "resolve_start", Qt::QueuedConnection, Q_ARG(int, d->id), Q_ARG(QByteArray, name), Q_ARG(int, qType), Q_ARG(bool, d->longLived));
 }
 
 void NameResolver::stop()
 {
 	if(d)
 	{
-		NameManager::instance()->resolve_stop(d);
+		NameManager *man = NameManager::instance();
+		man->unregisterFront(d->id);
+		QMetaObject::invokeMethod(man, "resolve_stop", Qt::QueuedConnection, Q_ARG(int, d->id));
 		delete d;
 		d = 0;
 	}
@@ -981,12 +1286,18 @@ ServiceBrowser::ServiceBrowser(QObject *parent)
 
 ServiceBrowser::~ServiceBrowser()
 {
+	if(d->id != -1)
+		NameManager::instance()->unregisterFront(d->id);
 	delete d;
 }
 
 void ServiceBrowser::start(const QString &type, const QString &domain)
 {
-	NameManager::instance()->browse_start(d, type, domain);
+	NameManager *man = NameManager::instance();
+	if(d->id != -1)
+		man->unregisterFront(d->id);
+	d->id = man->registerFront(d);
+	QMetaObject::invokeMethod(man, "browse_start", Qt::QueuedConnection, Q_ARG(int, d->id), Q_ARG(QString, type), Q_ARG(QString, domain));
 }
 
 void ServiceBrowser::stop()
@@ -1005,25 +1316,34 @@ ServiceResolver::ServiceResolver(QObject *parent)
 
 ServiceResolver::~ServiceResolver()
 {
+	if(d->id != -1)
+		NameManager::instance()->unregisterFront(d->id);
 	delete d;
 }
 
 void ServiceResolver::startFromInstance(const QByteArray &name)
 {
-	NameManager::instance()->resolve_instance_start(d, name);
+	NameManager *man = NameManager::instance();
+	if(d->id != -1)
+		man->unregisterFront(d->id);
+	d->id = man->registerFront(d);
+	QMetaObject::invokeMethod(man, "resolve_instance_start", Qt::QueuedConnection, Q_ARG(int, d->id), Q_ARG(QByteArray, name));
 }
 
 void ServiceResolver::startFromDomain(const QString &domain, const QString &type)
 {
+	d->clearTargets();
 	d->mode = 0;
 	d->dns.start(type.toLatin1() + '.' + domain.toLatin1(), NameRecord::Srv);
 }
 
 void ServiceResolver::startFromPlain(const QString &host, int port)
 {
+	d->clearTargets();
 	d->mode = 1;
 	d->port = port;
-	d->adns.start(host.toLatin1());
+	d->host = host.toLatin1();
+	d->adns.start(d->host);
 }
 
 void ServiceResolver::tryNext()
@@ -1035,6 +1355,11 @@ void ServiceResolver::stop()
 {
 }
 
+QByteArray ServiceResolver::hostName() const
+{
+	return d->host;
+}
+
 //----------------------------------------------------------------------------
 // ServiceLocalPublisher
 //----------------------------------------------------------------------------
@@ -1046,12 +1371,28 @@ ServiceLocalPublisher::ServiceLocalPublisher(QObject *parent)
 
 ServiceLocalPublisher::~ServiceLocalPublisher()
 {
+	if(d->id != -1)
+		NameManager::instance()->unregisterFront(d->id);
 	delete d;
 }
 
 void ServiceLocalPublisher::publish(const QString &instance, const QString &type, int port, const QMap<QString,QByteArray> &attributes)
 {
-	NameManager::instance()->publish_start(d, instance, type, port, attributes);
+	// QMap<QString,QByteArray> isn't a registered type, so ship the
+	//   attributes across as a variant map
+	QVariantMap attribs;
+	QMapIterator<QString,QByteArray> it(attributes);
+	while(it.hasNext())
+	{
+		it.next();
+		attribs.insert(it.key(), it.value());
+	}
+
+	NameManager *man = NameManager::instance();
+	if(d->id != -1)
+		man->unregisterFront(d->id);
+	d->id = man->registerFront(d);
+	QMetaObject::invokeMethod(man, "publish_start", Qt::QueuedConnection, Q_ARG(int, d->id), Q_ARG(QString, instance), Q_ARG(QString, type), Q_ARG(int, port), Q_ARG(QVariantMap, attribs));
 }
 
 void ServiceLocalPublisher::updateAttributes(const QMap<QString,QByteArray> &attributes)
@@ -1061,7 +1402,9 @@ void ServiceLocalPublisher::updateAttributes(const QMap<QString,QByteArray> &att
 
 void ServiceLocalPublisher::addRecord(const NameRecord &rec)
 {
-	NameManager::instance()->publish_extra_start(d, rec);
+	if(d->id == -1)
+		return;
+	QMetaObject::invokeMethod(NameManager::instance(), "publish_extra_start", Qt::QueuedConnection, Q_ARG(int, d->id), Q_ARG(XMPP::NameRecord, rec));
 }
 
 void ServiceLocalPublisher::cancel()
@@ -387,7 +387,7 @@ public:
 	enum Mode
 	{
 		Single,       ///< A normal DNS query with a single result set.
-		LongLived     ///< An endless query, with multiple result sets allowed.
+		LongLived     ///< An endless query, with multiple result sets allowed.  Internet names are asked for again shortly before their records expire, and only the changes are reported.
 	};
 
 	/**
@@ -440,7 +440,7 @@ signals:
 
 	   This signal is emitted when results of the lookup operation have arrived.  The \a results parameter is a list of NameRecords.  All records will be of the type queried for with start(), unless the NameRecord::Any type was specified, in which case the records may be of any type
 
-	   When using the NameResolver::Single mode, the lookup is stopped once results are ready.  However, with the NameResolver::LongLived mode, the lookup stays active, and in that case this signal may be emitted multiple times.
+	   When using the NameResolver::Single mode, the lookup is stopped once results are ready.  However, with the NameResolver::LongLived mode, the lookup stays active, and in that case this signal may be emitted multiple times.  For an internet name, the first emission has all the records, and each one after that only the records that were added, and the records that went away with a TTL of 0.
 	*/
 	void resultsReady(const QList<XMPP::NameRecord> &results);
 
@@ -511,11 +511,23 @@ public:
 	void tryNext();
 	void stop();
 
+	// the host behind the latest resultsReady(), for SASL and
+	//   certificate checks.  empty when started from an instance
+	QByteArray hostName() const;
+
 signals:
+	// from startFromDomain(), the targets are tried in SRV priority and
+	//   weight order, each one's addresses looked up at the same time.
+	//   tryNext() waits if the next target is still resolving
 	void resultsReady(const QHostAddress &address, int port);
 	void finished();
 	void error(); // SRV lookup failed
 
+	// addresses of one SRV target, as soon as they are known and in no
+	//   particular order, so that connecting can start before the whole
+	//   set is resolved
+	void hostResultsReady(const QByteArray &host, const QList<QHostAddress> &addresses, int port);
+
 private:
 	class Private;
 	friend class Private;
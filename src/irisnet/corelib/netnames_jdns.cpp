@@ -123,6 +123,29 @@ static QJDns::Record exportJDNSRecord(const NameRecord &in)
 	return out;
 }
 
+// identifies a record regardless of its ttl, to tell what changed
+//   between two answers
+static QByteArray recordKey(const QJDns::Record &r)
+{
+	QByteArray key = QByteArray::number(r.type) + ' ' + r.owner.toLower() + ' ';
+	if(!r.haveKnown)
+		return key + r.rdata;
+	key += r.address.toString().toLatin1() + ' ' + r.name.toLower() + ' ';
+	key += QByteArray::number(r.priority) + ' ' + QByteArray::number(r.weight) + ' ' + QByteArray::number(r.port);
+	foreach(const QByteArray &t, r.texts)
+		key += ' ' + t;
+	key += ' ' + r.cpu + ' ' + r.os;
+	return key;
+}
+
+// a long-lived internet query asks again when the first of its records
+//   is about to expire, within these bounds (ms)
+#define WATCH_REFRESH_MIN    30000
+#define WATCH_REFRESH_MAX    (60 * 60 * 1000)
+
+// and after this long if asking failed
+#define WATCH_RETRY          30000
+
 static bool validServiceType(const QByteArray &in)
 {
 	// can't be empty, or start/end with a dot
@@ -240,13 +263,15 @@ public:
 	JDnsSharedDebug db;
 	JDnsShared *uni_net, *uni_local, *mul;
 	QHostAddress mul_addr4, mul_addr6;
-	NetInterfaceManager netman;
+	// only multicast follows the interfaces.  created with it, so that
+	//   unicast lookups don't start the interface tracker
+	NetInterfaceManager *netman;
 	QList<NetInterface*> ifaces;
 	QTimer *updateTimer;
 
-	JDnsGlobal() :
-		netman(this)
+	JDnsGlobal()
 	{
+		netman = 0;
 		uni_net = 0;
 		uni_local = 0;
 		mul = 0;
@@ -283,6 +308,8 @@ public:
 		// calls shutdown on the list, waits for shutdownFinished, deletes
 		JDnsShared::waitForShutdown(list);
 
+		delete netman;
+
 		// get final debug
 		jdns_debugReady();
 	}
@@ -328,15 +355,16 @@ public:
 			mul = new JDnsShared(JDnsShared::Multicast, this);
 			mul->setDebug(&db, "M");
 
-			connect(&netman, SIGNAL(interfaceAvailable(const QString &)), SLOT(iface_available(const QString &)));
+			netman = new NetInterfaceManager(this);
+			connect(netman, SIGNAL(interfaceAvailable(const QString &)), SLOT(iface_available(const QString &)));
 
 			// get the current network interfaces.  this initial
 			//   fetching should not trigger any calls to
 			//   updateMulticastInterfaces().  only future
 			//   activity should do that.
-			foreach(const QString &id, netman.interfaces())
+			foreach(const QString &id, netman->interfaces())
 			{
-				NetInterface *iface = new NetInterface(id, &netman);
+				NetInterface *iface = new NetInterface(id, netman);
 				connect(iface, SIGNAL(unavailable()), SLOT(iface_unavailable()));
 				ifaces += iface;
 			}
@@ -373,7 +401,7 @@ private slots:
 
 	void iface_available(const QString &id)
 	{
-		NetInterface *iface = new NetInterface(id, &netman);
+		NetInterface *iface = new NetInterface(id, netman);
 		connect(iface, SIGNAL(unavailable()), SLOT(iface_unavailable()));
 		ifaces += iface;
 
@@ -462,17 +490,27 @@ public:
 		NameResolver::Error error;
 		NameResolver::Error localError;
 
+		// for a long-lived internet query: the records last reported,
+		//   by recordKey(), and when to ask again
+		QByteArray name;
+		QHash<QByteArray,QJDns::Record> watched;
+		bool watchAnswered;
+		QTimer *refresh;
+
 		Item(QObject *parent = 0) :
 			id(-1),
 			req(0),
 			sess(parent),
 			useLocal(false),
-			localResult(false)
+			localResult(false),
+			watchAnswered(false),
+			refresh(0)
 		{
 		}
 
 		~Item()
 		{
+			delete refresh;
 			delete req;
 		}
 	};
@@ -517,6 +555,17 @@ public:
 		return 0;
 	}
 
+	Item *getItemByTimer(QTimer *t)
+	{
+		for(int n = 0; n < items.count(); ++n)
+		{
+			if(items[n]->refresh == t)
+				return items[n];
+		}
+
+		return 0;
+	}
+
 	Item *getItemByReq(JDnsSharedRequest *req)
 	{
 		for(int n = 0; n < items.count(); ++n)
@@ -554,10 +603,9 @@ public:
 
 	virtual bool supportsLongLived() const
 	{
-		if(mode == Local)
-			return true;  // we support long-lived local queries
-		else
-			return false; // we do NOT support long-lived internet queries
+		// long-lived internet queries are done by asking again as the
+		//   records expire
+		return true;
 	}
 
 	virtual bool supportsRecordType(int type) const
@@ -582,11 +630,11 @@ public:
 				i->id = idman.reserveId();
 				i->longLived = longLived;
 				items += i;
-				i->sess.defer(this, "do_local", Q_ARG(int, i->id), Q_ARG(QByteArray, name));
+				i->sess.defer(this, &JDnsNameProvider::do_local, i->id, name);
 				return i->id;
 			}*/
 
-			// we don't support long-lived internet queries
+			// long-lived internet queries are refreshed by us
 			if(longLived)
 			{
 				// but we do support long-lived local queries
@@ -597,15 +645,20 @@ public:
 					i->longLived = longLived;
 					i->useLocal = true;
 					items += i;
-					i->sess.defer(this, "do_local", Q_ARG(int, i->id), Q_ARG(QByteArray, name));
+					i->sess.defer(this, &JDnsNameProvider::do_local, i->id, name);
 					return i->id;
 				}
 
 				Item *i = new Item(this);
 				i->id = idman.reserveId();
+				i->type = qType;
+				i->longLived = true;
+				i->name = name;
+				i->refresh = new QTimer(this);
+				i->refresh->setSingleShot(true);
+				connect(i->refresh, SIGNAL(timeout()), SLOT(refresh_timeout()));
 				items += i;
-				i->sess.defer(this, "do_error", Q_ARG(int, i->id),
-					Q_ARG(XMPP::NameResolver::Error, NameResolver::ErrorNoLongLived));
+				startWatchQuery(i);
 				return i->id;
 			}
 
@@ -622,7 +675,7 @@ public:
 			i->req->query(name, qType);
 			// if query ends in .local, simultaneously do local resolve
 			if(isLocalName)
-				i->sess.defer(this, "do_local", Q_ARG(int, i->id), Q_ARG(QByteArray, name));
+				i->sess.defer(this, &JDnsNameProvider::do_local, i->id, name);
 			return i->id;
 		}
 		else
@@ -635,8 +688,7 @@ public:
 				if(!global->ensure_mul())
 				{
 					items += i;
-					i->sess.defer(this, "do_error", Q_ARG(int, i->id),
-						Q_ARG(XMPP::NameResolver::Error, NameResolver::ErrorNoLocal));
+					i->sess.defer(this, &JDnsNameProvider::do_error, i->id, NameResolver::ErrorNoLocal);
 					return i->id;
 				}
 
@@ -672,8 +724,7 @@ public:
 		Q_ASSERT(!i->localResult);
 
 		i->localResult = true;
-		i->sess.defer(this, "do_local_ready", Q_ARG(int, id),
-			Q_ARG(QList<XMPP::NameRecord>, results));
+		i->sess.defer(this, &JDnsNameProvider::do_local_ready, id, results);
 	}
 
 	virtual void resolve_localError(int id, XMPP::NameResolver::Error e)
@@ -683,17 +734,119 @@ public:
 		Q_ASSERT(!i->localResult);
 
 		i->localResult = true;
-		i->sess.defer(this, "do_local_error", Q_ARG(int, id),
-			Q_ARG(XMPP::NameResolver::Error, e));
+		i->sess.defer(this, &JDnsNameProvider::do_local_error, id, e);
+	}
+
+	void startWatchQuery(Item *i)
+	{
+		delete i->req;
+		i->req = new JDnsSharedRequest(global->uni_net);
+		connect(i->req, SIGNAL(resultsReady()), SLOT(req_resultsReady()));
+		i->req->query(i->name, i->type);
+	}
+
+	// what changed since the last answer is reported: new records as
+	//   they are, records gone with a ttl of 0
+	void watchResults(Item *i)
+	{
+		JDnsSharedRequest *req = i->req;
+		i->req = 0;
+		req->deleteLater();
+
+		int id = i->id;
+		bool answered = req->success();
+		QHash<QByteArray,QJDns::Record> now;
+		if(answered)
+		{
+			foreach(const QJDns::Record &r, req->results())
+			{
+				if(i->type == QJDns::Any || r.type == i->type)
+					now.insert(recordKey(r), r);
+			}
+		}
+
+		if(!i->watchAnswered)
+		{
+			// nothing to keep up to date yet
+			if(now.isEmpty())
+			{
+				NameResolver::Error error = NameResolver::ErrorGeneric;
+				if(!answered && req->error() == JDnsSharedRequest::ErrorNXDomain)
+					error = NameResolver::ErrorNoName;
+				else if(!answered && req->error() == JDnsSharedRequest::ErrorTimeout)
+					error = NameResolver::ErrorTimeout;
+				releaseItem(i);
+				emit resolve_error(id, error);
+				return;
+			}
+			i->watchAnswered = true;
+		}
+
+		// a failure to ask says nothing about the records, unless the
+		//   name went away
+		if(!answered && req->error() != JDnsSharedRequest::ErrorNXDomain)
+		{
+			i->refresh->start(WATCH_RETRY);
+			return;
+		}
+
+		QList<NameRecord> out;
+		int minTtl = -1;
+		QHashIterator<QByteArray,QJDns::Record> it(now);
+		while(it.hasNext())
+		{
+			it.next();
+			if(minTtl == -1 || it.value().ttl < minTtl)
+				minTtl = it.value().ttl;
+			if(!i->watched.contains(it.key()))
+			{
+				NameRecord rec = importJDNSRecord(it.value());
+				if(!rec.isNull())
+					out += rec;
+			}
+		}
+		it = QHashIterator<QByteArray,QJDns::Record>(i->watched);
+		while(it.hasNext())
+		{
+			it.next();
+			if(!now.contains(it.key()))
+			{
+				NameRecord rec = importJDNSRecord(it.value());
+				rec.setTtl(0);
+				if(!rec.isNull())
+					out += rec;
+			}
+		}
+		i->watched = now;
+
+		// ask again a little before the first record expires
+		qint64 delay = minTtl == -1 ? WATCH_RETRY : (qint64)minTtl * 900;
+		i->refresh->start((int)qBound((qint64)WATCH_REFRESH_MIN, delay, (qint64)WATCH_REFRESH_MAX));
+
+		if(!out.isEmpty())
+			emit resolve_resultsReady(id, out);
 	}
 
 private slots:
+	void refresh_timeout()
+	{
+		Item *i = getItemByTimer((QTimer *)sender());
+		if(i)
+			startWatchQuery(i);
+	}
+
 	void req_resultsReady()
 	{
 		JDnsSharedRequest *req = (JDnsSharedRequest *)sender();
 		Item *i = getItemByReq(req);
 		Q_ASSERT(i);
 
+		if(i->refresh)
+		{
+			watchResults(i);
+			return;
+		}
+
 		int id = i->id;
 
 		NameResolver::Error error;
@@ -1311,7 +1464,7 @@ public:
 			pub6.cancel();
 			have6 = false;
 			if(!use4)
-				sess.defer(this, "doDisable");
+				sess.defer(this, &JDnsPublishAddresses::doDisable);
 		}
 	}
 
@@ -1341,7 +1494,7 @@ public:
 			pub4.cancel();
 			have4 = false;
 			if(!use6)
-				sess.defer(this, "doDisable");
+				sess.defer(this, &JDnsPublishAddresses::doDisable);
 		}
 	}
 
@@ -2234,8 +2387,7 @@ public:
 			BrowseItem *i = new BrowseItem(id, 0);
 			i->sess = new ObjectSession(this);
 			browseItemList.insert(i);
-			i->sess->defer(this, "do_browse_error", Q_ARG(int, i->id),
-				Q_ARG(XMPP::ServiceBrowser::Error, ServiceBrowser::ErrorNoWide));
+			i->sess->defer(this, &JDnsServiceProvider::do_browse_error, i->id, ServiceBrowser::ErrorNoWide);
 			return i->id;
 		}
 
@@ -2244,8 +2396,7 @@ public:
 			BrowseItem *i = new BrowseItem(id, 0);
 			i->sess = new ObjectSession(this);
 			browseItemList.insert(i);
-			i->sess->defer(this, "do_browse_error", Q_ARG(int, i->id),
-				Q_ARG(XMPP::ServiceBrowser::Error, ServiceBrowser::ErrorNoLocal));
+			i->sess->defer(this, &JDnsServiceProvider::do_browse_error, i->id, ServiceBrowser::ErrorNoLocal);
 			return i->id;
 		}
 
@@ -2255,8 +2406,7 @@ public:
 			BrowseItem *i = new BrowseItem(id, 0);
 			i->sess = new ObjectSession(this);
 			browseItemList.insert(i);
-			i->sess->defer(this, "do_browse_error", Q_ARG(int, i->id),
-				Q_ARG(XMPP::ServiceBrowser::Error, ServiceBrowser::ErrorGeneric));
+			i->sess->defer(this, &JDnsServiceProvider::do_browse_error, i->id, ServiceBrowser::ErrorGeneric);
 			return i->id;
 		}
 
@@ -2285,8 +2435,7 @@ public:
 			ResolveItem *i = new ResolveItem(id, 0);
 			i->sess = new ObjectSession(this);
 			resolveItemList.insert(i);
-			i->sess->defer(this, "do_resolve_error", Q_ARG(int, i->id),
-				Q_ARG(XMPP::ServiceResolver::Error, ServiceResolver::ErrorNoLocal));
+			i->sess->defer(this, &JDnsServiceProvider::do_resolve_error, i->id, ServiceResolver::ErrorNoLocal);
 			return i->id;
 		}
 
@@ -2315,8 +2464,7 @@ public:
 			PublishItem *i = new PublishItem(id, 0);
 			i->sess = new ObjectSession(this);
 			publishItemList.insert(i);
-			i->sess->defer(this, "do_publish_error", Q_ARG(int, i->id),
-				Q_ARG(XMPP::ServiceLocalPublisher::Error, ServiceLocalPublisher::ErrorNoLocal));
+			i->sess->defer(this, &JDnsServiceProvider::do_publish_error, i->id, ServiceLocalPublisher::ErrorNoLocal);
 			return i->id;
 		}
 
@@ -2326,8 +2474,7 @@ public:
 			PublishItem *i = new PublishItem(id, 0);
 			i->sess = new ObjectSession(this);
 			publishItemList.insert(i);
-			i->sess->defer(this, "do_publish_error", Q_ARG(int, i->id),
-				Q_ARG(XMPP::ServiceLocalPublisher::Error, ServiceLocalPublisher::ErrorGeneric));
+			i->sess->defer(this, &JDnsServiceProvider::do_publish_error, i->id, ServiceLocalPublisher::ErrorGeneric);
 			return i->id;
 		}
 
@@ -2358,7 +2505,7 @@ public:
 		Q_ASSERT(i);
 
 		// if we already have an error queued, do nothing
-		if(i->sess->isDeferred(this, "do_publish_error"))
+		if(i->sess->isDeferred(this, &JDnsServiceProvider::do_publish_error))
 			return;
 
 		i->publish->update(attributes);
@@ -2386,8 +2533,7 @@ public:
 			PublishExtraItem *i = new PublishExtraItem(id, 0);
 			i->sess = new ObjectSession(this);
 			publishExtraItemList.insert(i);
-			i->sess->defer(this, "do_publish_extra_error", Q_ARG(int, i->id),
-				Q_ARG(XMPP::ServiceLocalPublisher::Error, ServiceLocalPublisher::ErrorGeneric));
+			i->sess->defer(this, &JDnsServiceProvider::do_publish_extra_error, i->id, ServiceLocalPublisher::ErrorGeneric);
 			return i->id;
 		}
 
@@ -2413,15 +2559,14 @@ public:
 		Q_ASSERT(i);
 
 		// if we already have an error queued, do nothing
-		if(i->sess->isDeferred(this, "do_publish_extra_error"))
+		if(i->sess->isDeferred(this, &JDnsServiceProvider::do_publish_extra_error))
 			return;
 
 		QJDns::Record rec = exportJDNSRecord(name);
 		if(rec.type == -1)
 		{
 			i->sess = new ObjectSession(this);
-			i->sess->defer(this, "do_publish_extra_error", Q_ARG(int, i->id),
-				Q_ARG(XMPP::ServiceLocalPublisher::Error, ServiceLocalPublisher::ErrorGeneric));
+			i->sess->defer(this, &JDnsServiceProvider::do_publish_extra_error, i->id, ServiceLocalPublisher::ErrorGeneric);
 			return;
 		}
 
@@ -33,103 +33,129 @@ public:
 	ObjectSession *sess;
 };
 
-class ObjectSessionPrivate : public QObject
+// a call by method name, with its arguments copied through QMetaType
+class ObjectSession::NamedCall : public ObjectSession::Call
 {
-	Q_OBJECT
-
 public:
-	ObjectSession *q;
-
-	class MethodCall
+	QByteArray name;
+	class Argument
 	{
 	public:
-		QObject *obj;
-		QByteArray method;
-		class Argument
-		{
-		public:
-			int type;
-			void *data;
-		};
-		QList<Argument> args;
+		int type;
+		void *data;
+	};
+	QList<Argument> args;
 
-		MethodCall(QObject *_obj, const char *_method) :
-			obj(_obj),
-			method(_method)
-		{
-		}
+	NamedCall(QObject *_obj, const char *_name) :
+		Call(_obj),
+		name(_name)
+	{
+	}
 
-		~MethodCall()
-		{
-			clearArgs();
-		}
+	~NamedCall()
+	{
+		clearArgs();
+	}
 
-		void clearArgs()
+	void clearArgs()
+	{
+		for(int n = 0; n < args.count(); ++n)
+			QMetaType::destroy(args[n].type, args[n].data);
+		args.clear();
+	}
+
+	bool setArgs(QGenericArgument val0 = QGenericArgument(),
+		QGenericArgument val1 = QGenericArgument(),
+		QGenericArgument val2 = QGenericArgument(),
+		QGenericArgument val3 = QGenericArgument(),
+		QGenericArgument val4 = QGenericArgument(),
+		QGenericArgument val5 = QGenericArgument(),
+		QGenericArgument val6 = QGenericArgument(),
+		QGenericArgument val7 = QGenericArgument(),
+		QGenericArgument val8 = QGenericArgument(),
+		QGenericArgument val9 = QGenericArgument())
+	{
+		const char *arg_name[] =
 		{
-			for(int n = 0; n < args.count(); ++n)
-				QMetaType::destroy(args[n].type, args[n].data);
-			args.clear();
-		}
+			val0.name(), val1.name(), val2.name(),
+			val3.name(), val4.name(), val5.name(),
+			val6.name(), val7.name(), val8.name(),
+			val9.name()
+		};
 
-		bool setArgs(QGenericArgument val0 = QGenericArgument(),
-			QGenericArgument val1 = QGenericArgument(),
-			QGenericArgument val2 = QGenericArgument(),
-			QGenericArgument val3 = QGenericArgument(),
-			QGenericArgument val4 = QGenericArgument(),
-			QGenericArgument val5 = QGenericArgument(),
-			QGenericArgument val6 = QGenericArgument(),
-			QGenericArgument val7 = QGenericArgument(),
-			QGenericArgument val8 = QGenericArgument(),
-			QGenericArgument val9 = QGenericArgument())
+		void *arg_data[] =
 		{
-			const char *arg_name[] =
-			{
-				val0.name(), val1.name(), val2.name(),
-				val3.name(), val4.name(), val5.name(),
-				val6.name(), val7.name(), val8.name(),
-				val9.name()
-			};
+			val0.data(), val1.data(), val2.data(),
+			val3.data(), val4.data(), val5.data(),
+			val6.data(), val7.data(), val8.data(),
+			val9.data()
+		};
 
-			void *arg_data[] =
-			{
-				val0.data(), val1.data(), val2.data(),
-				val3.data(), val4.data(), val5.data(),
-				val6.data(), val7.data(), val8.data(),
-				val9.data()
-			};
+		clearArgs();
 
-			clearArgs();
+		for(int n = 0; n < 10; ++n)
+		{
+			if(arg_name[n] == 0)
+				break;
 
-			for(int n = 0; n < 10; ++n)
+			Argument arg;
+			arg.type = QMetaType::type(arg_name[n]);
+			if(!arg.type)
 			{
-				if(arg_name[n] == 0)
-					break;
-
-				Argument arg;
-				arg.type = QMetaType::type(arg_name[n]);
-				if(!arg.type)
-				{
-					clearArgs();
-					return false;
-				}
-
-				arg.data = QMetaType::construct(arg.type, arg_data[n]);
-				args += arg;
+				clearArgs();
+				return false;
 			}
 
-			return true;
+			arg.data = QMetaType::construct(arg.type, arg_data[n]);
+			args += arg;
 		}
-	};
 
-	QList<MethodCall*> pendingCalls;
+		return true;
+	}
+
+	virtual void call()
+	{
+		Q_ASSERT(args.count() <= 10);
+
+		QGenericArgument arg[10];
+		for(int n = 0; n < args.count(); ++n)
+			arg[n] = QGenericArgument(QMetaType::typeName(args[n].type), args[n].data);
+
+		bool ok;
+		ok = QMetaObject::invokeMethod(obj, name.data(),
+			Qt::DirectConnection,
+			arg[0], arg[1], arg[2], arg[3], arg[4],
+			arg[5], arg[6], arg[7], arg[8], arg[9]);
+		Q_ASSERT(ok);
+		Q_UNUSED(ok);
+	}
+};
+
+// plain calls kept for reuse
+#define MAX_SPARE_CALLS 32
+
+class ObjectSessionPrivate : public QObject
+{
+	Q_OBJECT
+
+public:
+	ObjectSession *q;
+
+	typedef ObjectSession::Call Call;
+	typedef ObjectSession::NamedCall NamedCall;
+
+	QList<Call*> pendingCalls;
+	QList<Call*> spareCalls;
 	QTimer *callTrigger;
 	bool paused;
+	bool *destroyedFlag;
 	QList<ObjectSessionWatcherPrivate*> watchers;
 
 	ObjectSessionPrivate(ObjectSession *_q) :
 		QObject(_q),
 		q(_q),
-		paused(false)
+		paused(false),
+		destroyedFlag(0)
 	{
 		callTrigger = new QTimer(this);
 		connect(callTrigger, SIGNAL(timeout()), SLOT(doCall()));
@@ -138,25 +164,66 @@ public:
 
 	~ObjectSessionPrivate()
 	{
+		if(destroyedFlag)
+			*destroyedFlag = true;
 		invalidateWatchers();
 
 		callTrigger->disconnect(this);
 		callTrigger->setParent(0);
 		callTrigger->deleteLater();
+
+		qDeleteAll(pendingCalls);
+		qDeleteAll(spareCalls);
 	}
 
-	void addPendingCall(MethodCall *call)
+	void addPendingCall(Call *call)
 	{
 		pendingCalls += call;
 		if(!paused && !callTrigger->isActive())
 			callTrigger->start();
 	}
 
+	Call *plainCall(QObject *obj, ObjectSession::Method method)
+	{
+		if(spareCalls.isEmpty())
+			return new Call(obj, method, true);
+		Call *call = spareCalls.takeLast();
+		call->obj = obj;
+		call->method = method;
+		return call;
+	}
+
+	void releaseCall(Call *call)
+	{
+		if(call->plain && spareCalls.count() < MAX_SPARE_CALLS)
+			spareCalls += call;
+		else
+			delete call;
+	}
+
+	void clearPendingCalls()
+	{
+		QList<Call*> list = pendingCalls;
+		pendingCalls.clear();
+		foreach(Call *call, list)
+			releaseCall(call);
+	}
+
 	bool havePendingCall(QObject *obj, const char *method) const
 	{
-		foreach(const MethodCall *call, pendingCalls)
+		foreach(const Call *call, pendingCalls)
 		{
-			if(call->obj == obj && qstrcmp(call->method.data(), method) == 0)
+			if(call->obj == obj && !call->method && qstrcmp(static_cast<const NamedCall*>(call)->name.data(), method) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	bool havePendingCall(QObject *obj, ObjectSession::Method method) const
+	{
+		foreach(const Call *call, pendingCalls)
+		{
+			if(call->obj == obj && call->method == method)
 				return true;
 		}
 		return false;
@@ -172,24 +239,25 @@ public:
 private slots:
 	void doCall()
 	{
-		MethodCall *call = pendingCalls.takeFirst();
+		Call *call = pendingCalls.takeFirst();
 		if(!pendingCalls.isEmpty())
 			callTrigger->start();
 
-		Q_ASSERT(call->args.count() <= 10);
-
-		QGenericArgument arg[10];
-		for(int n = 0; n < call->args.count(); ++n)
-                	arg[n] = QGenericArgument(QMetaType::typeName(call->args[n].type), call->args[n].data);
-
-		bool ok;
-		ok = QMetaObject::invokeMethod(call->obj, call->method.data(),
-			Qt::DirectConnection,
-			arg[0], arg[1], arg[2], arg[3], arg[4],
-			arg[5], arg[6], arg[7], arg[8], arg[9]);
-		Q_ASSERT(ok);
-
-		delete call;
+		// the call may delete the session, so don't touch it afterwards
+		//   unless it survived
+		bool destroyed = false;
+		bool *prevFlag = destroyedFlag;
+		destroyedFlag = &destroyed;
+		call->call();
+		if(destroyed)
+		{
+			if(prevFlag)
+				*prevFlag = true;
+			delete call;
+			return;
+		}
+		destroyedFlag = prevFlag;
+		releaseCall(call);
 	}
 };
 
@@ -233,7 +301,7 @@ void ObjectSession::reset()
 	d->invalidateWatchers();
 	if(d->callTrigger->isActive())
 		d->callTrigger->stop();
-	d->pendingCalls.clear();
+	d->clearPendingCalls();
 }
 
 bool ObjectSession::isDeferred(QObject *obj, const char *method)
@@ -241,6 +309,23 @@ bool ObjectSession::isDeferred(QObject *obj, const char *method)
 	return d->havePendingCall(obj, method);
 }
 
+bool ObjectSession::havePendingCall(QObject *obj, Method method) const
+{
+	return d->havePendingCall(obj, method);
+}
+
+void ObjectSession::addCall(QObject *obj, Method method, bool exclusive)
+{
+	if(exclusive && d->havePendingCall(obj, method))
+		return;
+	d->addPendingCall(d->plainCall(obj, method));
+}
+
+void ObjectSession::addCall(Call *call)
+{
+	d->addPendingCall(call);
+}
+
 void ObjectSession::defer(QObject *obj, const char *method,
 	QGenericArgument val0,
 	QGenericArgument val1,
@@ -253,7 +338,7 @@ void ObjectSession::defer(QObject *obj, const char *method,
 	QGenericArgument val8,
 	QGenericArgument val9)
 {
-	ObjectSessionPrivate::MethodCall *call = new ObjectSessionPrivate::MethodCall(obj, method);
+	NamedCall *call = new NamedCall(obj, method);
 	call->setArgs(val0, val1, val2, val3, val4, val5, val6, val7, val8, val9);
 	d->addPendingCall(call);
 }
@@ -273,7 +358,7 @@ void ObjectSession::deferExclusive(QObject *obj, const char *method,
 	if(d->havePendingCall(obj, method))
 		return;
 
-	ObjectSessionPrivate::MethodCall *call = new ObjectSessionPrivate::MethodCall(obj, method);
+	NamedCall *call = new NamedCall(obj, method);
 	call->setArgs(val0, val1, val2, val3, val4, val5, val6, val7, val8, val9);
 	d->addPendingCall(call);
 }
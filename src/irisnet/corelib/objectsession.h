@@ -62,12 +62,98 @@ public:
 		QGenericArgument val8 = QGenericArgument(),
 		QGenericArgument val9 = QGenericArgument());
 
+	// typed versions of the above, which skip looking the method up by
+	//   name and copying the arguments through QMetaType
+	template <typename T>
+	bool isDeferred(T *obj, void (T::*method)())
+	{
+		return havePendingCall(obj, static_cast<Method>(method));
+	}
+
+	template <typename T, typename P1, typename P2>
+	bool isDeferred(T *obj, void (T::*method)(P1, P2))
+	{
+		return havePendingCall(obj, reinterpret_cast<Method>(method));
+	}
+
+	template <typename T>
+	void defer(T *obj, void (T::*method)())
+	{
+		addCall(obj, static_cast<Method>(method), false);
+	}
+
+	template <typename T>
+	void deferExclusive(T *obj, void (T::*method)())
+	{
+		addCall(obj, static_cast<Method>(method), true);
+	}
+
+	template <typename T, typename P1, typename A1>
+	void defer(T *obj, void (T::*method)(P1), const A1 &a1)
+	{
+		addCall(new Call1<T, P1, A1>(obj, method, a1));
+	}
+
+	template <typename T, typename P1, typename P2, typename A1, typename A2>
+	void defer(T *obj, void (T::*method)(P1, P2), const A1 &a1, const A2 &a2)
+	{
+		addCall(new Call2<T, P1, P2, A1, A2>(obj, method, a1, a2));
+	}
+
 	void pause();
 	void resume();
 
 private:
 	friend class ObjectSessionWatcher;
+	friend class ObjectSessionPrivate;
 	ObjectSessionPrivate *d;
+
+	typedef void (QObject::*Method)();
+
+	// a deferred call.  the plain one is for methods without arguments,
+	//   and is recycled
+	class Call
+	{
+	public:
+		QObject *obj;
+		Method method; // for comparing, 0 if called by name
+		bool plain;
+
+		Call(QObject *_obj = 0, Method _method = 0, bool _plain = false) : obj(_obj), method(_method), plain(_plain) {}
+		virtual ~Call() {}
+		virtual void call() { (obj->*method)(); }
+	};
+
+	template <typename T, typename P1, typename A1>
+	class Call1 : public Call
+	{
+	public:
+		void (T::*m)(P1);
+		A1 a1;
+
+		Call1(T *_obj, void (T::*_m)(P1), const A1 &_a1) :
+			Call(_obj, reinterpret_cast<Method>(_m)), m(_m), a1(_a1) {}
+		virtual void call() { (static_cast<T*>(obj)->*m)(a1); }
+	};
+
+	template <typename T, typename P1, typename P2, typename A1, typename A2>
+	class Call2 : public Call
+	{
+	public:
+		void (T::*m)(P1, P2);
+		A1 a1;
+		A2 a2;
+
+		Call2(T *_obj, void (T::*_m)(P1, P2), const A1 &_a1, const A2 &_a2) :
+			Call(_obj, reinterpret_cast<Method>(_m)), m(_m), a1(_a1), a2(_a2) {}
+		virtual void call() { (static_cast<T*>(obj)->*m)(a1, a2); }
+	};
+
+	class NamedCall;
+
+	bool havePendingCall(QObject *obj, Method method) const;
+	void addCall(QObject *obj, Method method, bool exclusive);
+	void addCall(Call *call);
 };
 
 class ObjectSessionWatcher
@@ -0,0 +1,247 @@
+/*
+ * timerwheel.cpp - coarse timers that share one real timer per thread
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "timerwheel.h"
+
+#include <QMap>
+#include <QSet>
+#include <QPointer>
+#include <QThreadStorage>
+#include <QTime>
+#include <QTimer>
+
+// width of one tick of the wheel
+#define WHEEL_RESOLUTION 1000
+
+// WheelTimer::Private::tick values that aren't a tick
+#define TICK_NONE -1
+#define TICK_FIRING -2
+
+namespace XMPP {
+
+class WheelTimer::Private
+{
+public:
+	int interval;
+	bool singleShot;
+	TimerWheel *wheel; // the wheel tick is in
+	qint64 tick;
+};
+
+// one per thread.  time is cut into ticks of WHEEL_RESOLUTION.  rather
+//   than a fixed ring of buckets that would have to be stepped through
+//   even when idle, the occupied buckets are kept in a map by tick, and
+//   the real timer is only ever set for the earliest one
+class TimerWheel : public QObject
+{
+	Q_OBJECT
+
+public:
+	QMap<qint64, QSet<WheelTimer*> > buckets;
+	QTimer *timer;
+	qint64 armed; // tick the timer is set for
+	QTime clock;
+	qint64 base, last;
+
+	TimerWheel() :
+		armed(TICK_NONE),
+		base(0),
+		last(0)
+	{
+		timer = new QTimer(this);
+		timer->setSingleShot(true);
+		connect(timer, SIGNAL(timeout()), SLOT(timer_timeout()));
+		clock.start();
+	}
+
+	~TimerWheel()
+	{
+		// the thread is going away.  leave no timer pointing at us
+		QMap<qint64, QSet<WheelTimer*> >::ConstIterator it;
+		for(it = buckets.constBegin(); it != buckets.constEnd(); ++it) {
+			foreach(WheelTimer *t, it.value()) {
+				t->d->wheel = 0;
+				t->d->tick = TICK_NONE;
+			}
+		}
+	}
+
+	static TimerWheel *instance();
+
+	// QTime wraps every 24 hours, so keep our own running total
+	qint64 now()
+	{
+		qint64 t = base + clock.elapsed();
+		if(t < last) {
+			base += 24 * 60 * 60 * 1000;
+			t += 24 * 60 * 60 * 1000;
+		}
+		last = t;
+		return t;
+	}
+
+	void add(WheelTimer *t, int msecs)
+	{
+		// round up, so that we never fire early
+		qint64 tick = (now() + qMax(msecs, 0) + WHEEL_RESOLUTION - 1) / WHEEL_RESOLUTION;
+		buckets[tick].insert(t);
+		t->d->wheel = this;
+		t->d->tick = tick;
+		schedule();
+	}
+
+	void remove(WheelTimer *t)
+	{
+		if(t->d->tick >= 0) {
+			QMap<qint64, QSet<WheelTimer*> >::Iterator it = buckets.find(t->d->tick);
+			if(it != buckets.end()) {
+				it.value().remove(t);
+				if(it.value().isEmpty())
+					buckets.erase(it);
+			}
+		}
+		t->d->tick = TICK_NONE;
+
+		// the timer is left as is.  if its bucket emptied out, it merely
+		//   wakes up for nothing and reschedules
+	}
+
+	void schedule()
+	{
+		if(buckets.isEmpty()) {
+			timer->stop();
+			armed = TICK_NONE;
+			return;
+		}
+
+		qint64 first = buckets.begin().key();
+		if(armed == first && timer->isActive())
+			return;
+
+		armed = first;
+		qint64 wait = first * WHEEL_RESOLUTION - now();
+		timer->start((int)qMax(wait, (qint64)0));
+	}
+
+private slots:
+	void timer_timeout()
+	{
+		armed = TICK_NONE;
+
+		qint64 current = now() / WHEEL_RESOLUTION;
+		QList< QPointer<WheelTimer> > due;
+		while(!buckets.isEmpty() && buckets.begin().key() <= current) {
+			foreach(WheelTimer *t, buckets.begin().value()) {
+				t->d->tick = TICK_FIRING;
+				due += t;
+			}
+			buckets.erase(buckets.begin());
+		}
+
+		// a timeout handler may stop, restart or delete any of the others
+		foreach(const QPointer<WheelTimer> &t, due) {
+			if(!t || t->d->tick != TICK_FIRING)
+				continue;
+
+			t->d->tick = TICK_NONE;
+			if(!t->d->singleShot)
+				add(t, t->d->interval);
+			emit t->timeout();
+		}
+
+		schedule();
+	}
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<TimerWheel*>, wheels)
+
+TimerWheel *TimerWheel::instance()
+{
+	QThreadStorage<TimerWheel*> *w = wheels();
+	if(!w->hasLocalData())
+		w->setLocalData(new TimerWheel);
+	return w->localData();
+}
+
+//----------------------------------------------------------------------------
+// WheelTimer
+//----------------------------------------------------------------------------
+WheelTimer::WheelTimer(QObject *parent) :
+	QObject(parent)
+{
+	d = new Private;
+	d->interval = 0;
+	d->singleShot = false;
+	d->wheel = 0;
+	d->tick = TICK_NONE;
+}
+
+WheelTimer::~WheelTimer()
+{
+	stop();
+	delete d;
+}
+
+int WheelTimer::interval() const
+{
+	return d->interval;
+}
+
+void WheelTimer::setInterval(int msecs)
+{
+	d->interval = msecs;
+}
+
+bool WheelTimer::isSingleShot() const
+{
+	return d->singleShot;
+}
+
+void WheelTimer::setSingleShot(bool b)
+{
+	d->singleShot = b;
+}
+
+bool WheelTimer::isActive() const
+{
+	return d->tick >= 0;
+}
+
+void WheelTimer::start()
+{
+	stop();
+	TimerWheel::instance()->add(this, d->interval);
+}
+
+void WheelTimer::start(int msecs)
+{
+	d->interval = msecs;
+	start();
+}
+
+void WheelTimer::stop()
+{
+	if(d->wheel && d->tick >= 0)
+		d->wheel->remove(this);
+	d->tick = TICK_NONE;
+}
+
+}
+
+#include "timerwheel.moc"
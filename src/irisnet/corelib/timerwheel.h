@@ -0,0 +1,64 @@
+/*
+ * timerwheel.h - coarse timers that share one real timer per thread
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include "irisnetglobal.h"
+
+namespace XMPP {
+
+class TimerWheel;
+
+// a coarse timer, for keepalives, refreshes and other timeouts that
+//   don't need to be exact.  all the WheelTimers of a thread share one
+//   real timer: deadlines are rounded up to the wheel's resolution, so
+//   timers falling due within the same slot fire together, at most one
+//   resolution late.  the api follows QTimer.
+class IRISNET_EXPORT WheelTimer : public QObject
+{
+	Q_OBJECT
+
+public:
+	WheelTimer(QObject *parent = 0);
+	~WheelTimer();
+
+	int interval() const;
+	void setInterval(int msecs);
+	bool isSingleShot() const;
+	void setSingleShot(bool b);
+	bool isActive() const;
+
+public slots:
+	void start();
+	void start(int msecs);
+	void stop();
+
+signals:
+	void timeout();
+
+private:
+	friend class TimerWheel;
+	class Private;
+	Private *d;
+};
+
+}
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * cryptowarmup.cpp - load crypto providers ahead of their first use
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "cryptowarmup.h"
+
+#include <QThread>
+#include <QtCrypto>
+
+namespace XMPP {
+
+class WarmupThread : public QThread
+{
+	Q_OBJECT
+
+public:
+	QStringList missing;
+
+	WarmupThread(QObject *parent = 0) :
+		QThread(parent)
+	{
+	}
+
+protected:
+	virtual void run()
+	{
+		QByteArray sample("warmup");
+		foreach(const QString &f, CryptoWarmup::features())
+		{
+			if(!QCA::isSupported(f.toLatin1().constData()))
+			{
+				missing += f;
+				continue;
+			}
+
+			// each provider creates its context on first use
+			if(f == "tls")
+			{
+				QCA::TLS tls;
+			}
+			else if(f == "sha1" || f == "md5")
+			{
+				QCA::Hash(f).hash(sample);
+			}
+			else if(f == "hmac(sha1)")
+			{
+				QCA::MessageAuthenticationCode mac(f, QCA::SymmetricKey(sample));
+				mac.update(sample);
+				mac.final();
+			}
+			else if(f == "random")
+			{
+				QCA::Random::randomArray(12);
+			}
+		}
+
+		// read once and kept by QCA
+		if(QCA::haveSystemStore())
+			QCA::systemStore();
+	}
+};
+
+class CryptoWarmup::Private : public QObject
+{
+	Q_OBJECT
+
+public:
+	CryptoWarmup *q;
+	WarmupThread *thread;
+	bool done;
+	QStringList missing;
+
+	Private(CryptoWarmup *_q) :
+		QObject(_q),
+		q(_q),
+		thread(0),
+		done(false)
+	{
+	}
+
+	~Private()
+	{
+		if(thread)
+		{
+			thread->wait();
+			delete thread;
+		}
+	}
+
+	void start()
+	{
+		if(thread)
+			return;
+		done = false;
+		missing.clear();
+		thread = new WarmupThread;
+		connect(thread, SIGNAL(finished()), SLOT(thread_finished()), Qt::QueuedConnection);
+		thread->start(QThread::LowPriority);
+	}
+
+private slots:
+	void thread_finished()
+	{
+		thread->wait();
+		missing = thread->missing;
+		delete thread;
+		thread = 0;
+		done = true;
+		emit q->finished();
+	}
+};
+
+CryptoWarmup::CryptoWarmup(QObject *parent) :
+	QObject(parent)
+{
+	d = new Private(this);
+}
+
+CryptoWarmup::~CryptoWarmup()
+{
+	delete d;
+}
+
+void CryptoWarmup::start()
+{
+	d->start();
+}
+
+bool CryptoWarmup::isFinished() const
+{
+	return d->done;
+}
+
+QStringList CryptoWarmup::missing() const
+{
+	return d->missing;
+}
+
+QStringList CryptoWarmup::features()
+{
+	return QStringList() << "tls" << "sha1" << "hmac(sha1)" << "md5" << "random";
+}
+
+}
+
+#include "cryptowarmup.moc"
@@ -0,0 +1,65 @@
+/*
+ * cryptowarmup.h - load crypto providers ahead of their first use
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CRYPTOWARMUP_H
+#define CRYPTOWARMUP_H
+
+#include <QObject>
+#include <QStringList>
+
+namespace XMPP {
+
+// QCA loads its providers, and each provider sets up an algorithm, the
+//   first time it is asked for.  that would otherwise happen in the middle
+//   of the first TLS handshake, STUN integrity check, transaction id or
+//   SASL step.  this asks for everything the network code uses (see
+//   features()) on a thread of its own, and uses each once, so that it is
+//   all ready in advance.  the system certificate store is loaded too.  a
+//   QCA::Initializer must exist for as long as this runs.  start it early,
+//   e.g. right after the application object.  once finished(), missing()
+//   lists the features no provider supports.
+class CryptoWarmup : public QObject
+{
+	Q_OBJECT
+
+public:
+	CryptoWarmup(QObject *parent = 0);
+
+	// waits for a warm-up still going on
+	~CryptoWarmup();
+
+	void start();
+	bool isFinished() const;
+	QStringList missing() const;
+
+	// "tls", "sha1", "hmac(sha1)", "md5", "random"
+	static QStringList features();
+
+signals:
+	void finished();
+
+private:
+	class Private;
+	friend class Private;
+	Private *d;
+};
+
+}
+
+#endif
@@ -21,9 +21,36 @@
 #include <QTcpSocket>
 #include <QHostAddress>
 #include <QMetaType>
+#include <QSocketNotifier>
+#include <QPointer>
+#include <limits.h>
 
 #include "bsocket.h"
 
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#ifdef Q_OS_UNIX
+#include <sys/uio.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#endif
+
+// not in older headers, harmless where the kernel doesn't know it
+#if defined(Q_OS_LINUX) && !defined(TCP_FASTOPEN_CONNECT)
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+
 //#include "safedelete.h"
 #include "ndns.h"
 #include "srvresolver.h"
@@ -36,6 +63,16 @@
 
 #define READBUFSIZE 65536
 
+// most handed to one sendfile() call, so that reads get a turn
+#define SENDFILE_CHUNK (1024 * 1024)
+
+// queued writes handed to the kernel in one call
+#define WRITEV_MAX 64
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 // CS_NAMESPACE_BEGIN
 
 class QTcpSocketSignalRelay : public QObject
@@ -94,6 +131,24 @@ public slots:
 	}
 };
 
+//----------------------------------------------------------------------------
+// SocketOptions
+//----------------------------------------------------------------------------
+SocketOptions::SocketOptions()
+{
+	noDelay = true;
+	sendBufferSize = 0;
+	receiveBufferSize = 0;
+	keepAlive = false;
+	keepAliveIdle = 0;
+	keepAliveInterval = 0;
+	keepAliveCount = 0;
+	fastOpen = false;
+}
+
+//----------------------------------------------------------------------------
+// BSocket
+//----------------------------------------------------------------------------
 class BSocket::Private
 {
 public:
@@ -103,12 +158,39 @@ public:
 	{
 		qsock = 0;
 		qsock_relay = 0;
+		nativeFd = -1;
+		connectNotifier = 0;
+		outOffset = 0;
+		outBytes = 0;
+		sendFd = -1;
+		sendLeft = 0;
+		writeNotifier = 0;
 	}
 
 	QTcpSocket *qsock;
 	QTcpSocketSignalRelay *qsock_relay;
 	int state;
 
+	SocketOptions opts;
+
+	// a connect in progress outside of QTcpSocket
+	int nativeFd;
+	QSocketNotifier *connectNotifier;
+
+	// on unix, writes are queued here as they came and go out together
+	//   with sendmsg() once the socket is writable, instead of being
+	//   copied into QTcpSocket's buffer.  outOffset is how much of the
+	//   first one is out already
+	QList<QByteArray> outq;
+	int outOffset;
+	qlonglong outBytes;
+
+	// a sendFile() in progress, ahead of the queue
+	int sendFd;
+	qlonglong sendOffset, sendLeft;
+
+	QSocketNotifier *writeNotifier;
+
 	NDns ndns;
 	SrvResolver srv;
 	QString host;
@@ -157,6 +239,22 @@ void BSocket::reset(bool clear)
 			clearReadBuffer();
 	}
 
+	delete d->connectNotifier;
+	d->connectNotifier = 0;
+	delete d->writeNotifier;
+	d->writeNotifier = 0;
+	d->outq.clear();
+	d->outOffset = 0;
+	d->outBytes = 0;
+	d->sendFd = -1;
+	d->sendLeft = 0;
+	if(d->nativeFd != -1) {
+#ifdef Q_OS_UNIX
+		::close(d->nativeFd);
+#endif
+		d->nativeFd = -1;
+	}
+
 	if(d->srv.isBusy())
 		d->srv.stop();
 	if(d->ndns.isBusy())
@@ -222,6 +320,149 @@ void BSocket::setSocket(int s)
 	ensureSocket();
 	d->state = Connected;
 	d->qsock->setSocketDescriptor(s);
+	applyOptions();
+}
+
+void BSocket::setOptions(const SocketOptions &opts)
+{
+	d->opts = opts;
+	if(d->state == Connected)
+		applyOptions();
+}
+
+SocketOptions BSocket::options() const
+{
+	return d->opts;
+}
+
+void BSocket::applyOptions()
+{
+	int s = d->qsock ? d->qsock->socketDescriptor() : -1;
+	if(s == -1)
+		return;
+	const SocketOptions &o = d->opts;
+#ifdef Q_OS_UNIX
+	int x = o.noDelay ? 1 : 0;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &x, sizeof(x));
+	if(o.sendBufferSize > 0)
+		setsockopt(s, SOL_SOCKET, SO_SNDBUF, &o.sendBufferSize, sizeof(int));
+	if(o.receiveBufferSize > 0)
+		setsockopt(s, SOL_SOCKET, SO_RCVBUF, &o.receiveBufferSize, sizeof(int));
+	x = o.keepAlive ? 1 : 0;
+	setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, &x, sizeof(x));
+	if(o.keepAlive) {
+#if defined(TCP_KEEPIDLE)
+		if(o.keepAliveIdle > 0)
+			setsockopt(s, IPPROTO_TCP, TCP_KEEPIDLE, &o.keepAliveIdle, sizeof(int));
+#elif defined(TCP_KEEPALIVE)
+		if(o.keepAliveIdle > 0)
+			setsockopt(s, IPPROTO_TCP, TCP_KEEPALIVE, &o.keepAliveIdle, sizeof(int));
+#endif
+#ifdef TCP_KEEPINTVL
+		if(o.keepAliveInterval > 0)
+			setsockopt(s, IPPROTO_TCP, TCP_KEEPINTVL, &o.keepAliveInterval, sizeof(int));
+#endif
+#ifdef TCP_KEEPCNT
+		if(o.keepAliveCount > 0)
+			setsockopt(s, IPPROTO_TCP, TCP_KEEPCNT, &o.keepAliveCount, sizeof(int));
+#endif
+	}
+#elif QT_VERSION >= 0x040600
+	d->qsock->setSocketOption(QAbstractSocket::LowDelayOption, o.noDelay ? 1 : 0);
+	d->qsock->setSocketOption(QAbstractSocket::KeepAliveOption, o.keepAlive ? 1 : 0);
+#endif
+}
+
+// QTcpSocket creates its socket and connects in one go, which is too late
+//   for the receive buffer (the window scale goes out with the SYN) and
+//   for Fast Open.  when those are asked for, connect here and hand the
+//   socket to QTcpSocket once it is up.
+bool BSocket::nativeConnect()
+{
+#ifdef Q_OS_UNIX
+	const SocketOptions &o = d->opts;
+	if(o.sendBufferSize <= 0 && o.receiveBufferSize <= 0 && !o.fastOpen)
+		return false;
+
+	QHostAddress addr = d->addr.isNull() ? QHostAddress(d->host) : d->addr;
+	struct sockaddr_storage sa;
+	socklen_t salen;
+	memset(&sa, 0, sizeof(sa));
+	if(addr.protocol() == QAbstractSocket::IPv4Protocol) {
+		struct sockaddr_in *in = (struct sockaddr_in *)&sa;
+		in->sin_family = AF_INET;
+		in->sin_port = htons(d->port);
+		in->sin_addr.s_addr = htonl(addr.toIPv4Address());
+		salen = sizeof(struct sockaddr_in);
+	}
+	else if(addr.protocol() == QAbstractSocket::IPv6Protocol) {
+		struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&sa;
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = htons(d->port);
+		Q_IPV6ADDR a6 = addr.toIPv6Address();
+		memcpy(&in6->sin6_addr, &a6, sizeof(a6));
+		salen = sizeof(struct sockaddr_in6);
+	}
+	else
+		return false;
+
+	int s = ::socket(sa.ss_family, SOCK_STREAM, 0);
+	if(s == -1)
+		return false;
+	fcntl(s, F_SETFD, FD_CLOEXEC);
+	int flags = fcntl(s, F_GETFL);
+	fcntl(s, F_SETFL, flags | O_NONBLOCK);
+	if(o.sendBufferSize > 0)
+		setsockopt(s, SOL_SOCKET, SO_SNDBUF, &o.sendBufferSize, sizeof(int));
+	if(o.receiveBufferSize > 0)
+		setsockopt(s, SOL_SOCKET, SO_RCVBUF, &o.receiveBufferSize, sizeof(int));
+#ifdef TCP_FASTOPEN_CONNECT
+	// connect() then returns at once and the SYN waits for the first write
+	if(o.fastOpen) {
+		int on = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+	}
+#endif
+
+	// anything but a connect in progress goes the usual way, so that
+	//   errors come out of QTcpSocket as always
+	if(::connect(s, (struct sockaddr *)&sa, salen) == -1 && errno != EINPROGRESS) {
+		::close(s);
+		return false;
+	}
+
+	d->nativeFd = s;
+	d->connectNotifier = new QSocketNotifier(s, QSocketNotifier::Write, this);
+	connect(d->connectNotifier, SIGNAL(activated(int)), SLOT(sn_connected()));
+	return true;
+#else
+	return false;
+#endif
+}
+
+int BSocket::takeSocket()
+{
+#ifdef Q_OS_UNIX
+	if(d->state != Connected || !d->qsock || bytesToWrite() > 0)
+		return -1;
+	int s = ::dup(d->qsock->socketDescriptor());
+	if(s == -1)
+		return -1;
+
+	// no more signals, and keep what has been read so far
+	delete d->qsock_relay;
+	d->qsock_relay = 0;
+	QByteArray block(d->qsock->bytesAvailable(), 0);
+	d->qsock->read(block.data(), block.size());
+	appendRead(block);
+
+	// closes only our copy of the descriptor, the connection stays up
+	d->qsock->abort();
+	reset();
+	return s;
+#else
+	return -1;
+#endif
 }
 
 int BSocket::state() const
@@ -243,8 +484,11 @@ void BSocket::close()
 		return;
 
 	if(d->qsock) {
-		d->qsock->close();
+		// our own queue drains first, see sn_write()
 		d->state = Closing;
+		if(d->writeNotifier && d->writeNotifier->isEnabled())
+			return;
+		d->qsock->close();
 		if(d->qsock->bytesToWrite() == 0)
 			reset();
 	}
@@ -261,7 +505,48 @@ void BSocket::write(const QByteArray &a)
 	QString s = QString::fromUtf8(a);
 	fprintf(stderr, "BSocket: writing [%d]: {%s}\n", a.size(), s.latin1());
 #endif
+#ifdef Q_OS_UNIX
+	if(a.isEmpty())
+		return;
+	d->outq += a;
+	d->outBytes += a.size();
+	enableWriteNotifier();
+#else
 	d->qsock->write(a.data(), a.size());
+#endif
+}
+
+void BSocket::enableWriteNotifier()
+{
+	if(!d->writeNotifier) {
+		d->writeNotifier = new QSocketNotifier(d->qsock->socketDescriptor(), QSocketNotifier::Write, this);
+		connect(d->writeNotifier, SIGNAL(activated(int)), SLOT(sn_write()));
+	}
+	d->writeNotifier->setEnabled(true);
+}
+
+bool BSocket::sendFile(int fd, qlonglong offset, qlonglong count)
+{
+#ifdef Q_OS_LINUX
+	if(d->state != Connected || !d->qsock || bytesToWrite() > 0 || fd == -1 || count <= 0)
+		return false;
+
+	d->sendFd = fd;
+	d->sendOffset = offset;
+	d->sendLeft = count;
+	enableWriteNotifier();
+	return true;
+#else
+	Q_UNUSED(fd);
+	Q_UNUSED(offset);
+	Q_UNUSED(count);
+	return false;
+#endif
+}
+
+bool BSocket::isSendingFile() const
+{
+	return d->sendLeft > 0;
 }
 
 QByteArray BSocket::read(int bytes)
@@ -284,6 +569,33 @@ QByteArray BSocket::read(int bytes)
 	return block;
 }
 
+int BSocket::readInto(char *data, int size)
+{
+	int n;
+	if(d->qsock) {
+		n = (int)d->qsock->read(data, size);
+		if(n < 0)
+			n = 0;
+	}
+	else
+		n = ByteStream::readInto(data, size);
+
+#ifdef BS_DEBUG
+	fprintf(stderr, "BSocket: readInto [%d]\n", n);
+#endif
+	return n;
+}
+
+int BSocket::peek(char *data, int size) const
+{
+	if(d->qsock) {
+		int n = (int)d->qsock->peek(data, size);
+		return n < 0 ? 0 : n;
+	}
+	else
+		return ByteStream::peek(data, size);
+}
+
 int BSocket::bytesAvailable() const
 {
 	if(d->qsock)
@@ -296,7 +608,18 @@ int BSocket::bytesToWrite() const
 {
 	if(!d->qsock)
 		return 0;
-	return d->qsock->bytesToWrite();
+	qlonglong x = d->qsock->bytesToWrite() + d->outBytes + d->sendLeft;
+	return (int)qMin(x, (qlonglong)INT_MAX);
+}
+
+void BSocket::compact()
+{
+	ByteStream::compact();
+#ifdef Q_OS_UNIX
+	// a queue that once held many writes keeps its array
+	if(d->outq.isEmpty())
+		d->outq = QList<QByteArray>();
+#endif
 }
 
 QHostAddress BSocket::address() const
@@ -370,6 +693,8 @@ void BSocket::do_connect()
 #ifdef BS_DEBUG
 	fprintf(stderr, "BSocket: Connecting to %s:%d\n", d->host.latin1(), d->port);
 #endif
+	if(nativeConnect())
+		return;
 	ensureSocket();
 	if(!d->addr.isNull())
 		d->qsock->connectToHost(d->addr, d->port);
@@ -377,6 +702,33 @@ void BSocket::do_connect()
 		d->qsock->connectToHost(d->host, d->port);
 }
 
+void BSocket::sn_connected()
+{
+#ifdef Q_OS_UNIX
+	int s = d->nativeFd;
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if(getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+		err = errno;
+
+	// we are in its activated() signal
+	d->connectNotifier->setEnabled(false);
+	d->connectNotifier->deleteLater();
+	d->connectNotifier = 0;
+	d->nativeFd = -1;
+
+	if(err != 0) {
+		::close(s);
+		qs_error(err == ECONNREFUSED ? QAbstractSocket::ConnectionRefusedError : QAbstractSocket::NetworkError);
+		return;
+	}
+
+	ensureSocket();
+	d->qsock->setSocketDescriptor(s);
+	qs_connected();
+#endif
+}
+
 void BSocket::qs_hostFound()
 {
 	//SafeDeleteLock s(&d->sd);
@@ -385,6 +737,7 @@ void BSocket::qs_hostFound()
 void BSocket::qs_connected()
 {
 	d->state = Connected;
+	applyOptions();
 #ifdef BS_DEBUG
 	fprintf(stderr, "BSocket: Connected.\n");
 #endif
@@ -411,6 +764,140 @@ void BSocket::qs_readyRead()
 	readyRead();
 }
 
+// returns the bytes written, or -1 on error.  a full socket is no error
+qlonglong BSocket::writeFile()
+{
+#ifdef Q_OS_LINUX
+	int s = d->qsock->socketDescriptor();
+	qlonglong written = 0;
+	while(d->sendLeft > 0) {
+		off_t off = d->sendOffset;
+		ssize_t ret = ::sendfile(s, d->sendFd, &off, (size_t)qMin(d->sendLeft, (qlonglong)SENDFILE_CHUNK));
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		// an error, or the file ended before count
+		if(ret <= 0)
+			return -1;
+
+		d->sendOffset += ret;
+		d->sendLeft -= ret;
+		written += ret;
+
+		// one chunk per wakeup, the socket is likely full by now
+		if(written >= SENDFILE_CHUNK)
+			break;
+	}
+
+	if(d->sendLeft == 0)
+		d->sendFd = -1;
+	return written;
+#else
+	return -1;
+#endif
+}
+
+qlonglong BSocket::writeQueue()
+{
+#ifdef Q_OS_UNIX
+	int s = d->qsock->socketDescriptor();
+	qlonglong written = 0;
+	while(!d->outq.isEmpty()) {
+		struct iovec iov[WRITEV_MAX];
+		int count = qMin(d->outq.count(), WRITEV_MAX);
+		for(int n = 0; n < count; ++n) {
+			const QByteArray &buf = d->outq[n];
+			int skip = (n == 0) ? d->outOffset : 0;
+			iov[n].iov_base = (void *)(buf.data() + skip);
+			iov[n].iov_len = buf.size() - skip;
+		}
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		ssize_t ret = ::sendmsg(s, &msg, MSG_NOSIGNAL);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if(ret < 0)
+			return -1;
+
+		written += ret;
+		d->outBytes -= ret;
+		while(ret > 0) {
+			int left = d->outq.first().size() - d->outOffset;
+			if(ret < left) {
+				d->outOffset += ret;
+				break;
+			}
+			ret -= left;
+			d->outq.removeFirst();
+			d->outOffset = 0;
+		}
+
+		// the socket took less than offered, it is full
+		if(!d->outq.isEmpty() && d->outOffset > 0)
+			break;
+	}
+	return written;
+#else
+	return -1;
+#endif
+}
+
+void BSocket::sn_write()
+{
+	// a file goes out before anything written after it
+	qlonglong written = 0;
+	qlonglong x = 0;
+	if(d->sendLeft > 0)
+		x = writeFile();
+	if(x >= 0) {
+		written += x;
+		if(d->sendLeft == 0) {
+			x = writeQueue();
+			if(x >= 0)
+				written += x;
+		}
+	}
+	bool failed = (x < 0);
+	int err = failed ? errno : 0;
+
+	if(!failed && d->sendLeft == 0 && d->outq.isEmpty())
+		d->writeNotifier->setEnabled(false);
+
+	QPointer<QObject> self = this;
+	if(written > 0)
+		bytesWritten((int)qMin(written, (qlonglong)INT_MAX));
+	if(!self)
+		return;
+
+	if(failed) {
+		// the peer went away, as QTcpSocket would have told
+		if(err == EPIPE || err == ECONNRESET) {
+			reset();
+			connectionClosed();
+			return;
+		}
+		reset();
+		error(ErrWrite);
+		return;
+	}
+
+	// a close() waiting for the queue
+	if(d->state == Closing && d->qsock && !d->writeNotifier->isEnabled()) {
+		d->qsock->close();
+		if(d->qsock->bytesToWrite() == 0) {
+			reset();
+			delayedCloseFinished();
+		}
+	}
+}
+
 void BSocket::qs_bytesWritten(qint64 x64)
 {
 	int x = x64;
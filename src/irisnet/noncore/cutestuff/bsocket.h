@@ -31,6 +31,25 @@ class QByteArray;
 
 // CS_NAMESPACE_BEGIN
 
+// tuning for a TCP connection.  zero values leave the system default.
+class SocketOptions
+{
+public:
+	SocketOptions();
+
+	bool noDelay;          // TCP_NODELAY, on by default
+	int sendBufferSize;    // SO_SNDBUF, bytes
+	int receiveBufferSize; // SO_RCVBUF, bytes
+
+	// keepalive probes, with the idle time and interval in seconds
+	bool keepAlive;
+	int keepAliveIdle, keepAliveInterval, keepAliveCount;
+
+	// TCP Fast Open: the first data written goes out with the SYN, if
+	//   the system and the server allow it (Linux only)
+	bool fastOpen;
+};
+
 class BSocket : public ByteStream
 {
 	Q_OBJECT
@@ -45,15 +64,43 @@ public:
 	void connectToServer(const QString &srv, const QString &type);
 	int socket() const;
 	void setSocket(int);
+
+	// hands the connection over as a descriptor of its own, leaving the
+	//   socket idle.  data already received stays readable with read().
+	//   fails (returns -1) unless connected with nothing left to write,
+	//   and on platforms without dup().
+	int takeSocket();
+
+	// applied to every connection made from now on, and to the current
+	//   one as far as it still can be.  buffer sizes and Fast Open make
+	//   the connect go through the native socket API on unix.
+	void setOptions(const SocketOptions &);
+	SocketOptions options() const;
 	int state() const;
 
-	// from ByteStream
+	// from ByteStream.  on unix, writes are gathered and go out with one
+	//   sendmsg() per wakeup.  reads are left to QTcpSocket, which takes
+	//   everything available on each readiness event; a completion based
+	//   engine (io_uring) would have to replace QTcpSocket altogether
 	bool isOpen() const;
 	void close();
 	void write(const QByteArray &);
 	QByteArray read(int bytes=0);
+	int readInto(char *data, int size);
+	int peek(char *data, int size) const;
 	int bytesAvailable() const;
 	int bytesToWrite() const;
+	void compact();
+
+	// writes count bytes of the file fd, from offset on, by sendfile(),
+	//   so they go from the page cache to the socket without a copy in
+	//   this process.  bytesWritten() tells the progress, and an error
+	//   ends the connection with ErrWrite.  data written meanwhile goes
+	//   out after it.  fd is not owned and must stay open until
+	//   isSendingFile() is false.  fails (returns false) unless
+	//   connected with nothing left to write, and off linux.
+	bool sendFile(int fd, qlonglong offset, qlonglong count);
+	bool isSendingFile() const;
 
 	// local
 	QHostAddress address() const;
@@ -77,6 +124,8 @@ private slots:
 	void srv_done();
 	void ndns_done();
 	void do_connect();
+	void sn_connected();
+	void sn_write();
 
 private:
 	class Private;
@@ -84,6 +133,11 @@ private:
 
 	void reset(bool clear=false);
 	void ensureSocket();
+	bool nativeConnect();
+	void applyOptions();
+	void enableWriteNotifier();
+	qlonglong writeFile();
+	qlonglong writeQueue();
 };
 
 // CS_NAMESPACE_END
@@ -20,6 +20,8 @@
 
 #include "bytestream.h"
 #include <QByteArray>
+#include <QList>
+#include <string.h>
 
 // CS_NAMESPACE_BEGIN
 
@@ -54,13 +56,174 @@
 //!
 //! Also available are the static convenience functions ByteStream::appendArray()
 //! and ByteStream::takeArray(), which make dealing with byte queues very easy.
+//!
+//! The internal buffers are segmented: appending a block stores a shallow copy
+//! of it, and consuming a prefix only advances an offset, so draining a large
+//! buffer in small pieces does not move the remaining data around.  Use
+//! readInto() and peek() to consume data without an intermediate QByteArray.
+
+//----------------------------------------------------------------------------
+// ByteQueue
+//----------------------------------------------------------------------------
+class ByteQueue
+{
+public:
+	ByteQueue() : head(0), total(0), flatActive(false) {}
+
+	int size() const
+	{
+		if(flatActive)
+			return flat.size();
+		return total;
+	}
+
+	void clear()
+	{
+		chunks.clear();
+		flat.clear();
+		head = 0;
+		total = 0;
+		flatActive = false;
+	}
+
+	void append(const QByteArray &block)
+	{
+		if(block.isEmpty())
+			return;
+		absorbFlat();
+		chunks += block;
+		total += block.size();
+	}
+
+	// copies up to 'max' bytes from the front, without consuming them
+	int peek(char *data, int max) const
+	{
+		if(flatActive) {
+			int n = qMin(max, flat.size());
+			memcpy(data, flat.data(), n);
+			return n;
+		}
+
+		int n = qMin(max, total);
+		int done = 0;
+		int offset = head;
+		for(int i = 0; done < n; ++i) {
+			const QByteArray &c = chunks[i];
+			int x = qMin(n - done, c.size() - offset);
+			memcpy(data + done, c.data() + offset, x);
+			done += x;
+			offset = 0;
+		}
+		return n;
+	}
+
+	// removes up to 'size' bytes from the front
+	void skip(int size)
+	{
+		absorbFlat();
+		if(size >= total) {
+			chunks.clear();
+			head = 0;
+			total = 0;
+			return;
+		}
+		total -= size;
+		while(size > 0) {
+			int avail = chunks.first().size() - head;
+			if(size < avail) {
+				head += size;
+				break;
+			}
+			size -= avail;
+			chunks.removeFirst();
+			head = 0;
+		}
+	}
+
+	int takeInto(char *data, int max)
+	{
+		int n = peek(data, max);
+		skip(n);
+		return n;
+	}
+
+	// 'size' of 0 means everything
+	QByteArray take(int size, bool del)
+	{
+		absorbFlat();
+		if(size == 0 || size > total)
+			size = total;
+
+		QByteArray a;
+		if(size == 0)
+			return a;
+
+		// whole leading chunk?  hand it over without copying
+		if(head == 0 && chunks.first().size() == size)
+			a = chunks.first();
+		else {
+			a.resize(size);
+			peek(a.data(), size);
+		}
+		if(del)
+			skip(size);
+		return a;
+	}
+
+	// collapses the queue into a single array that the caller may modify.
+	//   the array is folded back in on the next queue operation.
+	QByteArray & toFlat()
+	{
+		if(!flatActive) {
+			flat = take(0, true);
+			flatActive = true;
+		}
+		return flat;
+	}
+
+	// gives back memory the queue holds beyond its contents: the
+	//   consumed part of a leading chunk and the slack of the flat array
+	void squeeze()
+	{
+		if(flatActive) {
+			flat.squeeze();
+			return;
+		}
+		if(chunks.isEmpty())
+			chunks = QList<QByteArray>();
+		else if(head > 0) {
+			chunks.first() = chunks.first().mid(head);
+			head = 0;
+		}
+	}
+
+private:
+	QList<QByteArray> chunks;
+	int head;
+	int total;
+	QByteArray flat;
+	bool flatActive;
+
+	void absorbFlat()
+	{
+		if(!flatActive)
+			return;
+		flatActive = false;
+		chunks.clear();
+		head = 0;
+		total = flat.size();
+		if(total > 0)
+			chunks += flat;
+		flat.clear();
+	}
+};
 
 class ByteStream::Private
 {
 public:
 	Private() {}
 
-	QByteArray readBuf, writeBuf;
+	ByteQueue readBuf, writeBuf;
 };
 
 //!
@@ -115,6 +278,22 @@ QByteArray ByteStream::read(int bytes)
 	return takeRead(bytes);
 }
 
+//!
+//! Reads up to \a size bytes of data from the stream into \a data, and returns
+//! the number of bytes copied.  This avoids building an intermediate array.
+int ByteStream::readInto(char *data, int size)
+{
+	return takeReadInto(data, size);
+}
+
+//!
+//! Copies up to \a size bytes from the front of the read buffer into \a data,
+//! without removing them, and returns the number of bytes copied.
+int ByteStream::peek(char *data, int size) const
+{
+	return d->readBuf.peek(data, size);
+}
+
 //!
 //! Returns the number of bytes available for reading.
 int ByteStream::bytesAvailable() const
@@ -129,32 +308,42 @@ int ByteStream::bytesToWrite() const
 	return d->writeBuf.size();
 }
 
+//!
+//! Releases buffer memory beyond what the pending data needs.  Meant for
+//! streams that sit idle for long periods.  Reimplementations should call
+//! this one as well.
+void ByteStream::compact()
+{
+	d->readBuf.squeeze();
+	d->writeBuf.squeeze();
+}
+
 //!
 //! Clears the read buffer.
 void ByteStream::clearReadBuffer()
 {
-	d->readBuf.resize(0);
+	d->readBuf.clear();
 }
 
 //!
 //! Clears the write buffer.
 void ByteStream::clearWriteBuffer()
 {
-	d->writeBuf.resize(0);
+	d->writeBuf.clear();
 }
 
 //!
 //! Appends \a block to the end of the read buffer.
 void ByteStream::appendRead(const QByteArray &block)
 {
-	appendArray(&d->readBuf, block);
+	d->readBuf.append(block);
 }
 
 //!
 //! Appends \a block to the end of the write buffer.
 void ByteStream::appendWrite(const QByteArray &block)
 {
-	appendArray(&d->writeBuf, block);
+	d->writeBuf.append(block);
 }
 
 //!
@@ -163,7 +352,7 @@ void ByteStream::appendWrite(const QByteArray &block)
 //! If \a del is TRUE, then the bytes are also removed.
 QByteArray ByteStream::takeRead(int size, bool del)
 {
-	return takeArray(&d->readBuf, size, del);
+	return d->readBuf.take(size, del);
 }
 
 //!
@@ -172,21 +361,41 @@ QByteArray ByteStream::takeRead(int size, bool del)
 //! If \a del is TRUE, then the bytes are also removed.
 QByteArray ByteStream::takeWrite(int size, bool del)
 {
-	return takeArray(&d->writeBuf, size, del);
+	return d->writeBuf.take(size, del);
+}
+
+//!
+//! Removes up to \a size bytes from the start of the read buffer, copying them
+//! into \a data.  Returns the number of bytes copied.
+int ByteStream::takeReadInto(char *data, int size)
+{
+	return d->readBuf.takeInto(data, size);
+}
+
+//!
+//! Removes up to \a size bytes from the start of the write buffer, copying them
+//! into \a data.  Returns the number of bytes copied.
+int ByteStream::takeWriteInto(char *data, int size)
+{
+	return d->writeBuf.takeInto(data, size);
 }
 
 //!
-//! Returns a reference to the read buffer.
+//! Returns a reference to the read buffer.  The buffer is collapsed into a
+//! single array for this, so prefer the take/append functions.  The reference
+//! is only valid until the next buffer operation.
 QByteArray & ByteStream::readBuf()
 {
-	return d->readBuf;
+	return d->readBuf.toFlat();
 }
 
 //!
-//! Returns a reference to the write buffer.
+//! Returns a reference to the write buffer.  The buffer is collapsed into a
+//! single array for this, so prefer the take/append functions.  The reference
+//! is only valid until the next buffer operation.
 QByteArray & ByteStream::writeBuf()
 {
-	return d->writeBuf;
+	return d->writeBuf.toFlat();
 }
 
 //!
@@ -39,8 +39,11 @@ public:
 	virtual void close();
 	virtual void write(const QByteArray &);
 	virtual QByteArray read(int bytes=0);
+	virtual int readInto(char *data, int size);
+	virtual int peek(char *data, int size) const;
 	virtual int bytesAvailable() const;
 	virtual int bytesToWrite() const;
+	virtual void compact();
 
 	static void appendArray(QByteArray *a, const QByteArray &b);
 	static QByteArray takeArray(QByteArray *from, int size=0, bool del=true);
@@ -59,6 +62,8 @@ protected:
 	void appendWrite(const QByteArray &);
 	QByteArray takeRead(int size=0, bool del=true);
 	QByteArray takeWrite(int size=0, bool del=true);
+	int takeReadInto(char *data, int size);
+	int takeWriteInto(char *data, int size);
 	QByteArray & readBuf();
 	QByteArray & writeBuf();
 	virtual int tryWrite();
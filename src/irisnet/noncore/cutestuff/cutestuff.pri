@@ -4,12 +4,22 @@ HEADERS += \
 	$$PWD/bytestream.h \
 	$$PWD/bsocket.h \
 	$$PWD/httpconnect.h \
+	$$PWD/httpbind.h \
+	$$PWD/httpparser.h \
 	$$PWD/httppoll.h \
-	$$PWD/socks.h
+	$$PWD/socketrelay.h \
+	$$PWD/socks.h \
+	$$PWD/websocket.h \
+	$$PWD/xmlsplitter.h
 
 SOURCES += \
 	$$PWD/bytestream.cpp \
 	$$PWD/bsocket.cpp \
 	$$PWD/httpconnect.cpp \
+	$$PWD/httpbind.cpp \
+	$$PWD/httpparser.cpp \
 	$$PWD/httppoll.cpp \
-	$$PWD/socks.cpp
+	$$PWD/socketrelay.cpp \
+	$$PWD/socks.cpp \
+	$$PWD/websocket.cpp \
+	$$PWD/xmlsplitter.cpp
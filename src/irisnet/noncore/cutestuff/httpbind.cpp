@@ -0,0 +1,962 @@
+/*
+ * httpbind.cpp - BOSH (XEP-0124, XEP-0206) transport
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "httpbind.h"
+
+#include <QUrl>
+#include <QMap>
+#include <QList>
+#include <QTimer>
+#include <QPointer>
+#include <QtCrypto>
+#include <stdlib.h>
+#include "bsocket.h"
+#include "httpparser.h"
+#include "xmlsplitter.h"
+
+#ifdef PROX_DEBUG
+#include <stdio.h>
+#endif
+
+#define NS_HTTPBIND "http://jabber.org/protocol/httpbind"
+#define NS_XBOSH    "urn:xmpp:xbosh"
+
+// CS_NAMESPACE_BEGIN
+
+// index of the '>' ending the tag that starts at 'start', or -1
+static int tagEnd(const QByteArray &buf, int start)
+{
+	char quote = 0;
+	for(int n = start; n < buf.size(); ++n) {
+		char c = buf[n];
+		if(quote) {
+			if(c == quote)
+				quote = 0;
+		}
+		else if(c == '\'' || c == '"')
+			quote = c;
+		else if(c == '>')
+			return n;
+	}
+	return -1;
+}
+
+//----------------------------------------------------------------------------
+// HttpBindConnection
+//----------------------------------------------------------------------------
+// one persistent HTTP/1.1 connection, carrying one request at a time
+class HttpBindConnection : public QObject
+{
+	Q_OBJECT
+public:
+	enum Error { ErrConnectionRefused, ErrHostNotFound, ErrRead, ErrTLS, ErrReply, ErrClosed };
+
+	HttpBindConnection(QObject *parent=0) :
+		QObject(parent),
+		sock(this),
+		tls(0),
+		port(0),
+		ssl(false)
+	{
+		connect(&sock, SIGNAL(connected()), SLOT(sock_connected()));
+		connect(&sock, SIGNAL(connectionClosed()), SLOT(sock_connectionClosed()));
+		connect(&sock, SIGNAL(readyRead()), SLOT(sock_readyRead()));
+		connect(&sock, SIGNAL(error(int)), SLOT(sock_error(int)));
+		abort();
+	}
+
+	~HttpBindConnection()
+	{
+		abort();
+	}
+
+	void setHost(const QString &_host, int _port, bool _ssl)
+	{
+		abort();
+		host = _host;
+		port = _port;
+		ssl = _ssl;
+	}
+
+	// connect ahead of the first request
+	void open()
+	{
+		opening = true;
+		if(!ready && !connecting)
+			connectSocket();
+	}
+
+	// send a complete HTTP request, connecting first if needed
+	void post(const QByteArray &_request)
+	{
+		request = _request;
+		busy = true;
+		if(ready)
+			send();
+		else if(!connecting)
+			connectSocket();
+	}
+
+	void abort()
+	{
+		closeSocket();
+		busy = false;
+		opening = false;
+		rid = 0;
+		kind = 0;
+		rawBytes = 0;
+		tries = 0;
+		request.clear();
+		resetResponse();
+	}
+
+	bool isBusy() const { return busy; }
+	int code() const { return resp.code(); }
+	QByteArray body() const { return resp.body(); }
+
+	// what HttpBind sent on it
+	qint64 rid;
+	int kind;
+	int rawBytes;
+	int tries;
+	QByteArray request;
+
+signals:
+	void connected();
+	void result();
+	void error(int);
+
+private slots:
+	void sock_connected()
+	{
+		connecting = false;
+		if(ssl) {
+			tls = new QCA::TLS(this);
+			connect(tls, SIGNAL(handshaken()), SLOT(tls_handshaken()));
+			connect(tls, SIGNAL(readyRead()), SLOT(tls_readyRead()));
+			connect(tls, SIGNAL(readyReadOutgoing()), SLOT(tls_readyReadOutgoing()));
+			connect(tls, SIGNAL(error()), SLOT(tls_error()));
+			tls->setTrustedCertificates(QCA::systemStore());
+			tls->startClient(host);
+		}
+		else
+			after_connected();
+	}
+
+	void sock_connectionClosed()
+	{
+		closeSocket();
+		if(!busy)
+			return;
+
+		// no length given, so the body ends with the connection
+		if(resp.finishAtClose()) {
+			finish();
+			return;
+		}
+		busy = false;
+		emit error(ErrClosed);
+	}
+
+	void sock_readyRead()
+	{
+		QByteArray block = sock.read();
+		if(tls)
+			tls->writeIncoming(block);
+		else
+			processData(block);
+	}
+
+	void sock_error(int x)
+	{
+#ifdef PROX_DEBUG
+		fprintf(stderr, "HttpBindConnection: socket error: %d\n", x);
+#endif
+		bool wanted = busy || opening;
+		// a kept-alive connection the server dropped before answering
+		bool dropped = busy && sent && !gotData;
+		closeSocket();
+		if(!wanted)
+			return;
+		busy = false;
+		opening = false;
+
+		if(dropped)
+			emit error(ErrClosed);
+		else if(x == BSocket::ErrHostNotFound)
+			emit error(ErrHostNotFound);
+		else if(x == BSocket::ErrConnectionRefused)
+			emit error(ErrConnectionRefused);
+		else
+			emit error(ErrRead);
+	}
+
+	void tls_handshaken()
+	{
+		if(tls->peerIdentityResult() != QCA::TLS::Valid) {
+#ifdef PROX_DEBUG
+			fprintf(stderr, "HttpBindConnection: certificate not valid: %d\n", tls->peerIdentityResult());
+#endif
+			closeSocket();
+			busy = false;
+			opening = false;
+			emit error(ErrTLS);
+			return;
+		}
+		tls->continueAfterStep();
+		after_connected();
+	}
+
+	void tls_readyRead()
+	{
+		processData(tls->read());
+	}
+
+	void tls_readyReadOutgoing()
+	{
+		sock.write(tls->readOutgoing());
+	}
+
+	void tls_error()
+	{
+		closeSocket();
+		busy = false;
+		opening = false;
+		emit error(ErrTLS);
+	}
+
+private:
+	BSocket sock;
+	QCA::TLS *tls;
+	QString host;
+	int port;
+	bool ssl;
+	bool connecting, ready, opening, busy, sent;
+
+	// response being read
+	HttpResponseParser resp;
+	bool gotData;
+
+	void connectSocket()
+	{
+		closeSocket();
+		connecting = true;
+#ifdef PROX_DEBUG
+		fprintf(stderr, "HttpBindConnection: Connecting to %s:%d\n", qPrintable(host), port);
+#endif
+		sock.connectToHost(host, port);
+	}
+
+	void closeSocket()
+	{
+		if(tls) {
+			delete tls;
+			tls = 0;
+		}
+		if(sock.state() != BSocket::Idle)
+			sock.close();
+		connecting = false;
+		ready = false;
+		sent = false;
+	}
+
+	void after_connected()
+	{
+		ready = true;
+		QPointer<QObject> self = this;
+		if(opening) {
+			opening = false;
+			emit connected();
+			if(!self)
+				return;
+		}
+		if(busy)
+			send();
+	}
+
+	void resetResponse()
+	{
+		resp.reset();
+		gotData = false;
+	}
+
+	void send()
+	{
+		resetResponse();
+		sent = true;
+		if(tls)
+			tls->write(request);
+		else
+			sock.write(request);
+	}
+
+	void processData(const QByteArray &block)
+	{
+		// nothing asked for, so nothing to expect
+		if(!busy || !sent)
+			return;
+
+		gotData = true;
+		resp.append(block);
+		if(resp.state() == HttpResponseParser::Error) {
+			closeSocket();
+			busy = false;
+			emit error(ErrReply);
+			return;
+		}
+		if(resp.state() == HttpResponseParser::Done)
+			finish();
+	}
+
+	void finish()
+	{
+		busy = false;
+		sent = false;
+		if(!resp.keepAlive())
+			closeSocket();
+		emit result();
+	}
+};
+
+//----------------------------------------------------------------------------
+// HttpBind
+//----------------------------------------------------------------------------
+class HttpBind::Private
+{
+public:
+	enum State { Idle, Connecting, Connected, Creating, Active };
+	enum Kind { Normal, Create, Restart, Terminate };
+
+	// a piece of the outgoing stream
+	struct Item
+	{
+		int kind;
+		QByteArray xml;
+	};
+
+	struct Response
+	{
+		int code;
+		int kind;
+		int rawBytes;
+		QByteArray body;
+	};
+
+	HttpBindConnection *conn[2];
+	QString host;
+	int port;
+	QString path, hostHeader;
+	bool use_proxy, use_ssl;
+	QString user, pass;
+
+	int state;
+	bool closing, terminateSent;
+	QTimer *sendTimer, *pollTimer;
+
+	// session
+	QString sid, to, lang, from;
+	qint64 rid, nextResponse;
+	QMap<qint64, Response> responses; // arrived ahead of an older one
+	int wait, hold, requests, polling;
+
+	// outgoing stream, split into top level elements
+	XmlSplitter splitter;
+	bool headerSeen;
+	QList<Item> out;
+	int rawBytes; // written since the last request
+
+	Private() :
+		splitter("stream:stream")
+	{
+	}
+
+	void resetFraming()
+	{
+		splitter.reset();
+		headerSeen = false;
+		out.clear();
+		rawBytes = 0;
+	}
+
+	void addItem(int kind, const QByteArray &xml=QByteArray())
+	{
+		Item i;
+		i.kind = kind;
+		i.xml = xml;
+		out += i;
+	}
+
+	void streamOpened(const QByteArray &tag)
+	{
+		if(!headerSeen) {
+			headerSeen = true;
+			to = XmlSplitter::attribute(tag, "to");
+			lang = XmlSplitter::attribute(tag, "xml:lang");
+			addItem(Create);
+		}
+		else
+			addItem(Restart);
+	}
+
+	// the stream written by ClientStream, cut at its top level elements.
+	//   the stream header and whitespace pings have no BOSH equivalent
+	//   and are dropped.
+	void frame(const QByteArray &a)
+	{
+		QList<XmlSplitter::Piece> list = splitter.append(a);
+		foreach(const XmlSplitter::Piece &i, list) {
+			if(i.type == XmlSplitter::StartTag)
+				streamOpened(i.data);
+			else if(i.type == XmlSplitter::EndTag)
+				addItem(Terminate);
+			else
+				addItem(Normal, i.data);
+		}
+	}
+
+	bool anyBusy() const
+	{
+		return conn[0]->isBusy() || conn[1]->isBusy();
+	}
+
+	HttpBindConnection *freeConnection() const
+	{
+		for(int n = 0; n < 2; ++n) {
+			if(!conn[n]->isBusy())
+				return conn[n];
+		}
+		return 0;
+	}
+
+	int busyCount() const
+	{
+		return (conn[0]->isBusy() ? 1 : 0) + (conn[1]->isBusy() ? 1 : 0);
+	}
+
+	// build the <body/> for the next request, taking items off the queue
+	QByteArray makeBody(int *kind)
+	{
+		QByteArray b = "<body rid='" + QByteArray::number(rid) + "'";
+		if(!out.isEmpty() && out.first().kind == Create) {
+			out.takeFirst();
+			*kind = Create;
+			b += " content='text/xml; charset=utf-8' hold='" + QByteArray::number(hold) + "'";
+			if(!to.isEmpty())
+				b += " to='" + XmlSplitter::escape(to) + "'";
+			b += " ver='1.6' wait='" + QByteArray::number(wait) + "'";
+			if(!lang.isEmpty())
+				b += " xml:lang='" + XmlSplitter::escape(lang) + "'";
+			b += " xmpp:version='1.0' xmlns='" NS_HTTPBIND "' xmlns:xmpp='" NS_XBOSH "'/>";
+			return b;
+		}
+
+		b += " sid='" + XmlSplitter::escape(sid) + "'";
+		if(!out.isEmpty() && out.first().kind == Restart) {
+			// a restart carries nothing else
+			out.takeFirst();
+			*kind = Restart;
+			if(!to.isEmpty())
+				b += " to='" + XmlSplitter::escape(to) + "'";
+			if(!lang.isEmpty())
+				b += " xml:lang='" + XmlSplitter::escape(lang) + "'";
+			b += " xmpp:restart='true' xmlns='" NS_HTTPBIND "' xmlns:xmpp='" NS_XBOSH "'/>";
+			return b;
+		}
+
+		QByteArray payload;
+		*kind = Normal;
+		while(!out.isEmpty()) {
+			int k = out.first().kind;
+			if(k == Normal)
+				payload += out.takeFirst().xml;
+			else if(k == Terminate) {
+				out.clear();
+				*kind = Terminate;
+				break;
+			}
+			else
+				break;
+		}
+		if(*kind == Terminate)
+			b += " type='terminate'";
+		b += " xmlns='" NS_HTTPBIND "'";
+		if(payload.isEmpty())
+			return b + "/>";
+		return b + '>' + payload + "</body>";
+	}
+
+	QByteArray makeRequest(const QByteArray &body) const
+	{
+		QString s;
+		s += QString("POST ") + path + " HTTP/1.1\r\n";
+		s += QString("Host: ") + hostHeader + "\r\n";
+		if(use_proxy) {
+			if(!user.isEmpty()) {
+				QString str = user + ':' + pass;
+				s += QString("Proxy-Authorization: Basic ") + QCA::Base64().encodeString(str) + "\r\n";
+			}
+			s += "Proxy-Connection: keep-alive\r\n";
+		}
+		s += "Content-Type: text/xml; charset=utf-8\r\n";
+		s += QString("Content-Length: ") + QString::number(body.size()) + "\r\n";
+		s += "\r\n";
+		return s.toLatin1() + body;
+	}
+
+	// what a server would have opened the stream with
+	QByteArray streamHeader() const
+	{
+		QByteArray h = "<?xml version='1.0'?><stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'";
+		if(!from.isEmpty())
+			h += " from='" + XmlSplitter::escape(from) + "'";
+		h += " id='" + XmlSplitter::escape(sid) + "'>";
+		return h;
+	}
+};
+
+HttpBind::HttpBind(QObject *parent)
+:ByteStream(parent)
+{
+	d = new Private;
+	for(int n = 0; n < 2; ++n) {
+		d->conn[n] = new HttpBindConnection(this);
+		connect(d->conn[n], SIGNAL(connected()), SLOT(conn_connected()));
+		connect(d->conn[n], SIGNAL(result()), SLOT(conn_result()));
+		connect(d->conn[n], SIGNAL(error(int)), SLOT(conn_error(int)));
+	}
+
+	// everything written in one go of the event loop goes out together
+	d->sendTimer = new QTimer(this);
+	d->sendTimer->setSingleShot(true);
+	d->sendTimer->setInterval(0);
+	connect(d->sendTimer, SIGNAL(timeout()), SLOT(do_send()));
+
+	// paces empty requests to servers that won't hold them
+	d->pollTimer = new QTimer(this);
+	d->pollTimer->setSingleShot(true);
+	connect(d->pollTimer, SIGNAL(timeout()), SLOT(do_send()));
+
+	d->wait = 60;
+	d->port = 0;
+	d->use_proxy = false;
+	d->use_ssl = false;
+	reset(true);
+}
+
+HttpBind::~HttpBind()
+{
+	reset(true);
+	delete d;
+}
+
+void HttpBind::reset(bool clear)
+{
+	for(int n = 0; n < 2; ++n)
+		d->conn[n]->abort();
+	if(clear)
+		clearReadBuffer();
+	clearWriteBuffer();
+	d->sendTimer->stop();
+	d->pollTimer->stop();
+	d->state = Private::Idle;
+	d->closing = false;
+	d->terminateSent = false;
+	d->sid.clear();
+	d->from.clear();
+	d->responses.clear();
+	d->hold = 1;
+	d->requests = 2;
+	d->polling = 5;
+	d->resetFraming();
+}
+
+void HttpBind::setAuth(const QString &user, const QString &pass)
+{
+	d->user = user;
+	d->pass = pass;
+}
+
+void HttpBind::connectToUrl(const QString &url)
+{
+	connectToHost("", 0, url);
+}
+
+void HttpBind::connectToHost(const QString &proxyHost, int proxyPort, const QString &url)
+{
+	reset(true);
+
+	QUrl u = url;
+	QString query = QString::fromLatin1(u.encodedQuery());
+	if(!proxyHost.isEmpty()) {
+		d->host = proxyHost;
+		d->port = proxyPort;
+		d->path = url;
+		d->use_proxy = true;
+		d->use_ssl = false;
+		d->hostHeader = u.host();
+		if(u.port() != -1)
+			d->hostHeader += ':' + QString::number(u.port());
+	}
+	else {
+		d->use_ssl = (u.scheme().toLower() == "https");
+		d->host = u.host();
+		d->port = u.port(d->use_ssl ? 443 : 80);
+		d->path = u.path();
+		if(d->path.isEmpty())
+			d->path = "/";
+		if(!query.isEmpty())
+			d->path += '?' + query;
+		d->use_proxy = false;
+		d->hostHeader = d->host;
+		if(u.port() != -1)
+			d->hostHeader += ':' + QString::number(u.port());
+	}
+
+	// the request id only has to be random enough not to be guessed,
+	//   and far enough from 2^53 not to run out
+	d->rid = 0;
+	for(int n = 0; n < 3; ++n)
+		d->rid = (d->rid << 16) | (rand() & 0xffff);
+	d->rid = (d->rid & Q_INT64_C(0xfffffffffff)) + 1;
+	d->nextResponse = d->rid;
+
+#ifdef PROX_DEBUG
+	fprintf(stderr, "HttpBind: Connecting to %s:%d [%s]\n", qPrintable(d->host), d->port, qPrintable(d->path));
+#endif
+	d->state = Private::Connecting;
+	for(int n = 0; n < 2; ++n)
+		d->conn[n]->setHost(d->host, d->port, d->use_ssl);
+	d->conn[0]->open();
+}
+
+int HttpBind::wait() const
+{
+	return d->wait;
+}
+
+void HttpBind::setWait(int seconds)
+{
+	d->wait = seconds;
+}
+
+QString HttpBind::sessionId() const
+{
+	return d->sid;
+}
+
+bool HttpBind::isOpen() const
+{
+	return d->state >= Private::Connected;
+}
+
+void HttpBind::close()
+{
+	if(d->state == Private::Idle || d->closing)
+		return;
+
+	if(d->state == Private::Active || d->state == Private::Creating) {
+		// end the session, rather than leaving it to time out
+		d->closing = true;
+		if(!d->terminateSent) {
+			d->addItem(Private::Terminate);
+			do_send();
+		}
+		return;
+	}
+
+	reset();
+}
+
+int HttpBind::tryWrite()
+{
+	QByteArray a = takeWrite();
+	d->rawBytes += a.size();
+	d->frame(a);
+	if(!d->sendTimer->isActive())
+		d->sendTimer->start();
+	return 0;
+}
+
+void HttpBind::do_send()
+{
+	d->sendTimer->stop();
+
+	if(d->state == Private::Connected) {
+		if(d->out.isEmpty() || d->out.first().kind != Private::Create)
+			return;
+		int kind;
+		QByteArray body = d->makeBody(&kind);
+		HttpBindConnection *c = d->conn[0];
+		c->rid = d->rid++;
+		c->kind = kind;
+		c->rawBytes = d->rawBytes;
+		c->tries = 0;
+		d->rawBytes = 0;
+		d->state = Private::Creating;
+		c->post(d->makeRequest(body));
+		return;
+	}
+
+	if(d->state != Private::Active || d->terminateSent)
+		return;
+
+	// hold + 1 requests may be open, so one can always be sent while
+	//   the server sits on the others
+	int max = qBound(1, qMin(d->requests, d->hold + 1), 2);
+	while(d->busyCount() < max) {
+		bool haveData = !d->out.isEmpty();
+		if(!haveData) {
+			// keep one request at the server for it to answer with
+			if(d->anyBusy())
+				break;
+			if(d->hold == 0 && d->pollTimer->isActive())
+				break;
+		}
+
+		int kind;
+		QByteArray body = d->makeBody(&kind);
+		HttpBindConnection *c = d->freeConnection();
+		c->rid = d->rid++;
+		c->kind = kind;
+		c->rawBytes = d->rawBytes;
+		c->tries = 0;
+		d->rawBytes = 0;
+		if(kind == Private::Terminate)
+			d->terminateSent = true;
+		if(d->hold == 0)
+			d->pollTimer->start(d->polling * 1000);
+		c->post(d->makeRequest(body));
+		if(kind == Private::Terminate || !haveData)
+			break;
+	}
+}
+
+void HttpBind::conn_connected()
+{
+	if(d->state != Private::Connecting)
+		return;
+
+	d->state = Private::Connected;
+	QPointer<QObject> self = this;
+	connected();
+	if(!self)
+		return;
+
+	do_send();
+}
+
+void HttpBind::conn_result()
+{
+	HttpBindConnection *c = static_cast<HttpBindConnection*>(sender());
+
+	Private::Response r;
+	r.code = c->code();
+	r.kind = c->kind;
+	r.rawBytes = c->rawBytes;
+	r.body = c->body();
+	d->responses.insert(c->rid, r);
+
+	QPointer<QObject> self = this;
+	processResponses();
+	if(!self)
+		return;
+
+	do_send();
+}
+
+void HttpBind::conn_error(int x)
+{
+	HttpBindConnection *c = static_cast<HttpBindConnection*>(sender());
+
+	// the server may close a kept-alive connection at any time.  sending
+	//   the same rid again is allowed, and gets the same answer.
+	if(x == HttpBindConnection::ErrClosed && c->tries < 2) {
+		++c->tries;
+		c->post(c->request);
+		return;
+	}
+
+	bool connecting = d->state < Private::Active;
+	if(x == HttpBindConnection::ErrTLS)
+		fail(ErrTLS);
+	else if(x == HttpBindConnection::ErrReply)
+		fail(connecting ? int(ErrProxyNeg) : int(ErrRead));
+	else if(!connecting)
+		fail(ErrRead);
+	else if(x == HttpBindConnection::ErrHostNotFound)
+		fail(d->use_proxy ? int(ErrProxyConnect) : int(ErrHostNotFound));
+	else if(x == HttpBindConnection::ErrConnectionRefused)
+		fail(d->use_proxy ? int(ErrProxyConnect) : int(ErrConnectionRefused));
+	else
+		fail(ErrRead);
+}
+
+void HttpBind::fail(int code)
+{
+#ifdef PROX_DEBUG
+	fprintf(stderr, "HttpBind: error %d\n", code);
+#endif
+	reset();
+	error(code);
+}
+
+// responses are handed on in the order the requests were sent, whichever
+//   connection they arrive on
+void HttpBind::processResponses()
+{
+	QPointer<QObject> self = this;
+	while(d->responses.contains(d->nextResponse)) {
+		Private::Response r = d->responses.take(d->nextResponse++);
+
+		if(r.code != 200) {
+			int err = ErrRead;
+			if(r.kind == Private::Create) {
+				if(r.code == 407)
+					err = ErrProxyAuth;
+				else if(r.code == 404)
+					err = ErrHostNotFound;
+				else if(r.code == 503)
+					err = ErrConnectionRefused;
+				else
+					err = ErrProxyNeg;
+			}
+			fail(err);
+			return;
+		}
+
+		if(!processBody(r.body, r.kind == Private::Restart, r.kind == Private::Create))
+			return;
+
+		if(r.kind == Private::Terminate) {
+			// not every server says so itself
+			appendRead("</stream:stream>");
+			readyRead();
+			if(!self)
+				return;
+			bool closing = d->closing;
+			reset();
+			if(closing)
+				delayedCloseFinished();
+			else
+				connectionClosed();
+			return;
+		}
+
+		if(r.rawBytes > 0) {
+			bytesWritten(r.rawBytes);
+			if(!self)
+				return;
+		}
+
+		if(d->hold == 0 && !d->pollTimer->isActive() && d->out.isEmpty())
+			d->pollTimer->start(d->polling * 1000);
+	}
+}
+
+// returns false if the session ended
+bool HttpBind::processBody(const QByteArray &body, bool restart, bool creation)
+{
+	int start = body.indexOf("<body");
+	int end = start != -1 ? tagEnd(body, start) : -1;
+	if(end == -1) {
+		fail(creation ? int(ErrProxyNeg) : int(ErrRead));
+		return false;
+	}
+
+	QByteArray tag = body.mid(start, end + 1 - start);
+	QByteArray content;
+	if(body[end - 1] != '/') {
+		int close = body.lastIndexOf("</body>");
+		if(close < end) {
+			fail(creation ? int(ErrProxyNeg) : int(ErrRead));
+			return false;
+		}
+		content = body.mid(end + 1, close - end - 1);
+	}
+
+	QString type = XmlSplitter::attribute(tag, "type");
+	if(type == "error") {
+		fail(ErrRead);
+		return false;
+	}
+
+	bool terminate = (type == "terminate");
+	if(creation) {
+		if(terminate && content.isEmpty()) {
+			QString condition = XmlSplitter::attribute(tag, "condition");
+			fail(condition == "host-unknown" ? int(ErrHostNotFound) : int(ErrProxyNeg));
+			return false;
+		}
+
+		d->sid = XmlSplitter::attribute(tag, "sid");
+		if(d->sid.isEmpty()) {
+			fail(ErrProxyNeg);
+			return false;
+		}
+		d->from = XmlSplitter::attribute(tag, "from");
+
+		bool ok;
+		int x = XmlSplitter::attribute(tag, "wait").toInt(&ok);
+		if(ok)
+			d->wait = x;
+		x = XmlSplitter::attribute(tag, "hold").toInt(&ok);
+		if(ok)
+			d->hold = x;
+		x = XmlSplitter::attribute(tag, "requests").toInt(&ok);
+		if(ok)
+			d->requests = x;
+		x = XmlSplitter::attribute(tag, "polling").toInt(&ok);
+		if(ok && x > 0)
+			d->polling = x;
+		d->state = Private::Active;
+#ifdef PROX_DEBUG
+		fprintf(stderr, "HttpBind: session %s, wait=%d hold=%d requests=%d\n", qPrintable(d->sid), d->wait, d->hold, d->requests);
+#endif
+	}
+
+	QByteArray in;
+	if(creation || restart)
+		in += d->streamHeader();
+	in += content;
+	if(terminate)
+		in += "</stream:stream>";
+
+	QPointer<QObject> self = this;
+	if(!in.isEmpty()) {
+		appendRead(in);
+		readyRead();
+		if(!self)
+			return false;
+	}
+
+	if(terminate) {
+		bool closing = d->closing;
+		reset();
+		if(closing)
+			delayedCloseFinished();
+		else
+			connectionClosed();
+		return false;
+	}
+	return true;
+}
+
+// CS_NAMESPACE_END
+
+#include "httpbind.moc"
@@ -0,0 +1,84 @@
+/*
+ * httpbind.h - BOSH (XEP-0124, XEP-0206) transport
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_HTTPBIND_H
+#define CS_HTTPBIND_H
+
+#include "bytestream.h"
+
+// CS_NAMESPACE_BEGIN
+
+// carries an XMPP stream over BOSH.  the stream header and closing tag
+//   written to it are turned into session creation, restart and terminate
+//   requests, and the server side of the stream is rebuilt from the
+//   response bodies, so to ClientStream it looks like a plain socket.
+//
+// the server holds one request open (long-polling), and up to two
+//   requests are in flight at a time, each on its own persistent HTTP/1.1
+//   connection.  everything written during one pass of the event loop is
+//   sent in a single request.  https URLs are supported when connecting
+//   directly, not through a proxy.
+class HttpBind : public ByteStream
+{
+	Q_OBJECT
+public:
+	enum Error { ErrConnectionRefused = ErrCustom, ErrHostNotFound, ErrProxyConnect, ErrProxyNeg, ErrProxyAuth, ErrTLS };
+	HttpBind(QObject *parent=0);
+	~HttpBind();
+
+	void setAuth(const QString &user, const QString &pass="");
+	void connectToUrl(const QString &url);
+	void connectToHost(const QString &proxyHost, int proxyPort, const QString &url);
+
+	// longest time the server may hold a request, in seconds.  applies
+	//   to sessions created afterwards.  the default is 60.
+	int wait() const;
+	void setWait(int seconds);
+
+	QString sessionId() const;
+
+	// from ByteStream
+	bool isOpen() const;
+	void close();
+
+signals:
+	void connected();
+
+protected:
+	int tryWrite();
+
+private slots:
+	void conn_connected();
+	void conn_result();
+	void conn_error(int);
+	void do_send();
+
+private:
+	class Private;
+	Private *d;
+
+	void reset(bool clear=false);
+	void processResponses();
+	bool processBody(const QByteArray &body, bool restart, bool creation);
+	void fail(int code);
+};
+
+// CS_NAMESPACE_END
+
+#endif
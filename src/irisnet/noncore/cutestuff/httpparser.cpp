@@ -0,0 +1,268 @@
+/*
+ * httpparser.cpp - incremental HTTP/1.x response parser
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "httpparser.h"
+
+#include <string.h>
+
+// a header that never ends is not a header
+#define MAX_HEADER_SIZE 65536
+
+// CS_NAMESPACE_BEGIN
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static QByteArray trimmed(const char *p, int len)
+{
+	while(len > 0 && isSpace(*p)) {
+		++p;
+		--len;
+	}
+	while(len > 0 && isSpace(p[len - 1]))
+		--len;
+	return QByteArray(p, len);
+}
+
+// 'token' appears in a comma separated header value
+static bool hasToken(const QByteArray &value, const char *token)
+{
+	int tlen = strlen(token);
+	int n = 0;
+	while(n < value.size()) {
+		int end = value.indexOf(',', n);
+		if(end == -1)
+			end = value.size();
+		QByteArray t = trimmed(value.constData() + n, end - n);
+		if(t.size() == tlen && qstrnicmp(t.constData(), token, tlen) == 0)
+			return true;
+		n = end + 1;
+	}
+	return false;
+}
+
+HttpResponseParser::HttpResponseParser()
+{
+	reset();
+}
+
+void HttpResponseParser::reset()
+{
+	st = Header;
+	buf.clear();
+	code_ = 0;
+	http11 = false;
+	keepAlive_ = false;
+	chunked = false;
+	toClose = false;
+	length = -1;
+	left = 0;
+	chunkLeft = -1;
+	headerList.clear();
+	body_.clear();
+}
+
+bool HttpResponseParser::keepAlive() const
+{
+	return keepAlive_ && !toClose && st != Error;
+}
+
+QByteArray HttpResponseParser::header(const char *name) const
+{
+	for(int n = 0; n < headerList.count(); ++n) {
+		if(qstricmp(headerList[n].first.constData(), name) == 0)
+			return headerList[n].second;
+	}
+	return QByteArray();
+}
+
+QByteArray HttpResponseParser::takeBody()
+{
+	QByteArray a = body_;
+	body_.clear();
+	return a;
+}
+
+QByteArray HttpResponseParser::takeRemaining()
+{
+	if(st != Done)
+		return QByteArray();
+	QByteArray a = buf;
+	buf.clear();
+	return a;
+}
+
+void HttpResponseParser::append(const QByteArray &a)
+{
+	buf += a;
+	if(st == Header) {
+		int end = buf.indexOf("\r\n\r\n");
+		if(end == -1) {
+			if(buf.size() > MAX_HEADER_SIZE)
+				st = Error;
+			return;
+		}
+		if(!parseHeader(buf.constData(), end)) {
+			st = Error;
+			return;
+		}
+		buf.remove(0, end + 4);
+		st = Body;
+	}
+	if(st == Body)
+		parseBody();
+}
+
+bool HttpResponseParser::finishAtClose()
+{
+	if(st == Body && toClose) {
+		st = Done;
+		return true;
+	}
+	return st == Done;
+}
+
+bool HttpResponseParser::parseHeader(const char *p, int len)
+{
+	// status line: HTTP/1.x code reason
+	const char *end = (const char *)memchr(p, '\r', len);
+	int lineLen = end ? end - p : len;
+	if(lineLen < 12 || qstrncmp(p, "HTTP/1.", 7) != 0 || p[8] != ' ')
+		return false;
+	http11 = (p[7] != '0');
+	code_ = 0;
+	for(int n = 9; n < 12; ++n) {
+		if(p[n] < '0' || p[n] > '9')
+			return false;
+		code_ = code_ * 10 + (p[n] - '0');
+	}
+
+	// fields
+	headerList.clear();
+	int at = lineLen + 2;
+	while(at < len) {
+		const char *line = p + at;
+		const char *lend = (const char *)memchr(line, '\r', len - at);
+		int llen = lend ? lend - line : len - at;
+		const char *colon = (const char *)memchr(line, ':', llen);
+		if(colon) {
+			int nlen = colon - line;
+			headerList += qMakePair(trimmed(line, nlen), trimmed(colon + 1, llen - nlen - 1));
+		}
+		at += llen + 2;
+	}
+
+	QByteArray conn = header("Connection");
+	if(conn.isEmpty())
+		conn = header("Proxy-Connection");
+	keepAlive_ = http11 ? !hasToken(conn, "close") : hasToken(conn, "keep-alive");
+
+	chunked = hasToken(header("Transfer-Encoding"), "chunked");
+	length = -1;
+	if(!chunked) {
+		QByteArray cl = header("Content-Length");
+		bool ok = false;
+		int x = cl.toInt(&ok);
+		if(ok && x >= 0)
+			length = x;
+	}
+
+	// no body at all
+	if((code_ >= 100 && code_ < 200) || code_ == 204 || code_ == 304)
+		length = 0;
+
+	toClose = (!chunked && length == -1);
+	left = length;
+	chunkLeft = -1;
+	return true;
+}
+
+void HttpResponseParser::parseBody()
+{
+	if(chunked) {
+		while(1) {
+			int eol = buf.indexOf("\r\n");
+			if(chunkLeft == -2) {
+				// trailer, up to an empty line
+				if(eol == -1)
+					return;
+				buf.remove(0, eol + 2);
+				if(eol == 0) {
+					st = Done;
+					return;
+				}
+			}
+			else if(chunkLeft == -1) {
+				if(eol == -1)
+					return;
+				int size = 0;
+				int n;
+				for(n = 0; n < eol; ++n) {
+					char c = buf[n];
+					int v;
+					if(c >= '0' && c <= '9')
+						v = c - '0';
+					else if(c >= 'a' && c <= 'f')
+						v = c - 'a' + 10;
+					else if(c >= 'A' && c <= 'F')
+						v = c - 'A' + 10;
+					else
+						break;
+					if(size > 0x7ffffff) {
+						st = Error;
+						return;
+					}
+					size = size * 16 + v;
+				}
+				if(n == 0) {
+					st = Error;
+					return;
+				}
+				buf.remove(0, eol + 2);
+				chunkLeft = (size == 0) ? -2 : size;
+			}
+			else {
+				// the chunk, and the CRLF after it
+				if(buf.size() < chunkLeft + 2)
+					return;
+				body_.append(buf.constData(), chunkLeft);
+				buf.remove(0, chunkLeft + 2);
+				chunkLeft = -1;
+			}
+		}
+	}
+	else if(length >= 0) {
+		int x = qMin(left, buf.size());
+		if(x > 0) {
+			body_.append(buf.constData(), x);
+			buf.remove(0, x);
+			left -= x;
+		}
+		if(left == 0)
+			st = Done;
+	}
+	else {
+		body_ += buf;
+		buf.clear();
+	}
+}
+
+// CS_NAMESPACE_END
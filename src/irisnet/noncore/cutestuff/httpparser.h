@@ -0,0 +1,79 @@
+/*
+ * httpparser.h - incremental HTTP/1.x response parser
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_HTTPPARSER_H
+#define CS_HTTPPARSER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+
+// CS_NAMESPACE_BEGIN
+
+// reads one response as it arrives, working on the raw bytes.  the body
+//   may be delimited by Content-Length, chunked, or run to the end of the
+//   connection, in which case finishAtClose() ends it.  whether the
+//   connection can carry another request afterwards is in keepAlive().
+class HttpResponseParser
+{
+public:
+	enum State { Header, Body, Done, Error };
+
+	HttpResponseParser();
+
+	void reset();
+	void append(const QByteArray &a);
+	State state() const { return st; }
+
+	// the connection closed.  returns true if that completed the response.
+	bool finishAtClose();
+
+	// valid once the header is in
+	int code() const { return code_; }
+	bool isHttp11() const { return http11; }
+	bool keepAlive() const;
+	int contentLength() const { return length; } // -1 if not given
+	QByteArray header(const char *name) const;   // case-insensitive, empty if missing
+	const QList< QPair<QByteArray,QByteArray> > & headers() const { return headerList; }
+
+	// body received so far.  takeBody() hands it over, for reading a
+	//   body as it comes.
+	const QByteArray & body() const { return body_; }
+	QByteArray takeBody();
+
+	// received after the end of the response
+	QByteArray takeRemaining();
+
+private:
+	State st;
+	QByteArray buf;
+	int code_;
+	bool http11, keepAlive_, chunked, toClose;
+	int length, left;
+	int chunkLeft; // -1 before a chunk size line, -2 in the trailer
+	QList< QPair<QByteArray,QByteArray> > headerList;
+	QByteArray body_;
+
+	bool parseHeader(const char *p, int len);
+	void parseBody();
+};
+
+// CS_NAMESPACE_END
+
+#endif
@@ -28,6 +28,7 @@
 #include <QByteArray>
 #include <stdlib.h>
 #include "bsocket.h"
+#include "httpparser.h"
 
 #ifdef PROX_DEBUG
 #include <stdio.h>
@@ -111,8 +112,8 @@ HttpPoll::~HttpPoll()
 
 void HttpPoll::reset(bool clear)
 {
-	if(d->http.isActive())
-		d->http.stop();
+	// also drops the kept connection
+	d->http.stop();
 	if(clear)
 		clearReadBuffer();
 	clearWriteBuffer();
@@ -385,49 +386,18 @@ const QString & HttpPoll::getKey(bool *last)
 //----------------------------------------------------------------------------
 // HttpProxyPost
 //----------------------------------------------------------------------------
-static QString extractLine(QByteArray *buf, bool *found)
-{
-	// scan for newline
-	int n;
-	for(n = 0; n < (int)buf->size()-1; ++n) {
-		if(buf->at(n) == '\r' && buf->at(n+1) == '\n') {
-			QByteArray cstr;
-			cstr.resize(n);
-			memcpy(cstr.data(), buf->data(), n);
-			n += 2; // hack off CR/LF
-
-			memmove(buf->data(), buf->data() + n, buf->size() - n);
-			buf->resize(buf->size() - n);
-			QString s = QString::fromUtf8(cstr);
-
-			if(found)
-				*found = true;
-			return s;
-		}
-	}
-
-	if(found)
-		*found = false;
-	return "";
-}
-
-static bool extractMainHeader(const QString &line, QString *proto, int *code, QString *msg)
+static int errorForCode(int code)
 {
-	int n = line.indexOf(' ');
-	if(n == -1)
-		return false;
-	if(proto)
-		*proto = line.mid(0, n);
-	++n;
-	int n2 = line.indexOf(' ', n);
-	if(n2 == -1)
-		return false;
-	if(code)
-		*code = line.mid(n, n2-n).toInt();
-	n = n2+1;
-	if(msg)
-		*msg = line.mid(n);
-	return true;
+	if(code == 407) // Authentication failed
+		return HttpProxyPost::ErrProxyAuth;
+	else if(code == 404) // Host not found
+		return HttpProxyPost::ErrHostNotFound;
+	else if(code == 403) // Access denied
+		return HttpProxyPost::ErrProxyNeg;
+	else if(code == 503) // Connection refused
+		return HttpProxyPost::ErrConnectionRefused;
+	else // invalid reply
+		return HttpProxyPost::ErrProxyNeg;
 }
 
 class HttpProxyPost::Private
@@ -439,13 +409,19 @@ public:
 	}
 
 	BSocket sock;
-	QByteArray postdata, recvBuf, body;
+	QByteArray postdata, body;
 	QString url;
 	QString user, pass;
-	bool inHeader;
-	QStringList headerLines;
 	bool asProxy;
 	QString host;
+	int port;
+	HttpResponseParser resp;
+
+	// the connection is kept between posts to the same host when the
+	//   server allows it
+	bool busy, ready, sent, retried;
+	QString connHost;
+	int connPort;
 };
 
 HttpProxyPost::HttpProxyPost(QObject *parent)
@@ -456,6 +432,12 @@ HttpProxyPost::HttpProxyPost(QObject *parent)
 	connect(&d->sock, SIGNAL(connectionClosed()), SLOT(sock_connectionClosed()));
 	connect(&d->sock, SIGNAL(readyRead()), SLOT(sock_readyRead()));
 	connect(&d->sock, SIGNAL(error(int)), SLOT(sock_error(int)));
+	d->busy = false;
+	d->ready = false;
+	d->sent = false;
+	d->retried = false;
+	d->port = 0;
+	d->connPort = 0;
 	reset(true);
 }
 
@@ -469,7 +451,10 @@ void HttpProxyPost::reset(bool clear)
 {
 	if(d->sock.state() != BSocket::Idle)
 		d->sock.close();
-	d->recvBuf.resize(0);
+	d->busy = false;
+	d->ready = false;
+	d->sent = false;
+	d->resp.reset();
 	if(clear)
 		d->body.resize(0);
 }
@@ -482,30 +467,47 @@ void HttpProxyPost::setAuth(const QString &user, const QString &pass)
 
 bool HttpProxyPost::isActive() const
 {
-	return (d->sock.state() == BSocket::Idle ? false: true);
+	return d->busy;
 }
 
 void HttpProxyPost::post(const QString &proxyHost, int proxyPort, const QString &url, const QByteArray &data, bool asProxy)
 {
-	reset(true);
+	bool reuse = (d->ready && !d->busy && d->connHost == proxyHost && d->connPort == proxyPort);
+	if(!reuse)
+		reset(true);
+	d->body.resize(0);
 
 	d->host = proxyHost;
+	d->port = proxyPort;
 	d->url = url;
 	d->postdata = data;
 	d->asProxy = asProxy;
+	d->busy = true;
+	d->retried = false;
+
+	if(reuse) {
+#ifdef PROX_DEBUG
+		fprintf(stderr, "HttpProxyPost: Reusing connection to %s:%d\n", qPrintable(proxyHost), proxyPort);
+#endif
+		sendRequest();
+		return;
+	}
 
 #ifdef PROX_DEBUG
-	fprintf(stderr, "HttpProxyPost: Connecting to %s:%d", proxyHost.latin1(), proxyPort);
+	fprintf(stderr, "HttpProxyPost: Connecting to %s:%d", qPrintable(proxyHost), proxyPort);
 	if(d->user.isEmpty())
 		fprintf(stderr, "\n");
 	else
-		fprintf(stderr, ", auth {%s,%s}\n", d->user.latin1(), d->pass.latin1());
+		fprintf(stderr, ", auth {%s,%s}\n", qPrintable(d->user), qPrintable(d->pass));
 #endif
+	d->connHost = proxyHost;
+	d->connPort = proxyPort;
 	d->sock.connectToHost(proxyHost, proxyPort);
 }
 
 void HttpProxyPost::stop()
 {
+	// a response may be on its way, so the connection can't be reused
 	reset();
 }
 
@@ -516,16 +518,7 @@ QByteArray HttpProxyPost::body() const
 
 QString HttpProxyPost::getHeader(const QString &var) const
 {
-	for(QStringList::ConstIterator it = d->headerLines.begin(); it != d->headerLines.end(); ++it) {
-		const QString &s = *it;
-		int n = s.indexOf(": ");
-		if(n == -1)
-			continue;
-		QString v = s.mid(0, n);
-		if(v.toLower() == var.toLower())
-			return s.mid(n+2);
-	}
-	return "";
+	return QString::fromLatin1(d->resp.header(var.toLatin1().constData()));
 }
 
 void HttpProxyPost::sock_connected()
@@ -533,20 +526,27 @@ void HttpProxyPost::sock_connected()
 #ifdef PROX_DEBUG
 	fprintf(stderr, "HttpProxyPost: Connected\n");
 #endif
-	d->inHeader = true;
-	d->headerLines.clear();
+	d->ready = true;
+	if(d->busy)
+		sendRequest();
+}
+
+void HttpProxyPost::sendRequest()
+{
+	d->resp.reset();
+	d->sent = true;
 
 	QUrl u = d->url;
 
-	// connected, now send the request
 	QString s;
-	s += QString("POST ") + d->url + " HTTP/1.0\r\n";
+	s += QString("POST ") + d->url + " HTTP/1.1\r\n";
 	if(d->asProxy) {
 		if(!d->user.isEmpty()) {
 			QString str = d->user + ':' + d->pass;
 			s += QString("Proxy-Authorization: Basic ") + QCA::Base64().encodeString(str) + "\r\n";
 		}
 		s += "Pragma: no-cache\r\n";
+		s += "Proxy-Connection: keep-alive\r\n";
 		s += QString("Host: ") + u.host() + "\r\n";
 	}
 	else {
@@ -556,101 +556,97 @@ void HttpProxyPost::sock_connected()
 	s += QString("Content-Length: ") + QString::number(d->postdata.size()) + "\r\n";
 	s += "\r\n";
 
-	// write request
-	d->sock.write(s.toUtf8());
+	// request and postdata in one write
+	QByteArray a = s.toUtf8();
+	a += d->postdata;
+	d->sock.write(a);
+}
 
-	// write postdata
-	d->sock.write(d->postdata);
+// the server closed a kept connection before it saw the request.  that may
+//   happen at any time, so try once more on a new connection.
+bool HttpProxyPost::retry()
+{
+	if(d->retried || !d->sent || d->resp.state() != HttpResponseParser::Header)
+		return false;
+
+#ifdef PROX_DEBUG
+	fprintf(stderr, "HttpProxyPost: kept connection dropped, reconnecting\n");
+#endif
+	if(d->sock.state() != BSocket::Idle)
+		d->sock.close();
+	d->ready = false;
+	d->sent = false;
+	d->retried = true;
+	d->sock.connectToHost(d->connHost, d->connPort);
+	return true;
 }
 
-void HttpProxyPost::sock_connectionClosed()
+void HttpProxyPost::finish()
 {
-	d->body = d->recvBuf;
-	reset();
+	d->body = d->resp.takeBody();
+	d->busy = false;
+	d->sent = false;
+	if(!d->resp.keepAlive()) {
+		if(d->sock.state() != BSocket::Idle)
+			d->sock.close();
+		d->ready = false;
+	}
 	result();
 }
 
+void HttpProxyPost::sock_connectionClosed()
+{
+	d->ready = false;
+	if(!d->busy)
+		return;
+
+	if(d->resp.finishAtClose()) {
+		finish();
+		return;
+	}
+	if(retry())
+		return;
+
+	reset(true);
+	error(ErrProxyNeg);
+}
+
 void HttpProxyPost::sock_readyRead()
 {
 	QByteArray block = d->sock.read();
-	ByteStream::appendArray(&d->recvBuf, block);
-
-	if(d->inHeader) {
-		// grab available lines
-		while(1) {
-			bool found;
-			QString line = extractLine(&d->recvBuf, &found);
-			if(!found)
-				break;
-			if(line.isEmpty()) {
-				d->inHeader = false;
-				break;
-			}
-			d->headerLines += line;
-		}
+	if(!d->busy || !d->sent)
+		return;
 
-		// done with grabbing the header?
-		if(!d->inHeader) {
-			QString str = d->headerLines.first();
-			d->headerLines.takeFirst();
+	bool inHeader = (d->resp.state() == HttpResponseParser::Header);
+	d->resp.append(block);
 
-			QString proto;
-			int code;
-			QString msg;
-			if(!extractMainHeader(str, &proto, &code, &msg)) {
+	if(d->resp.state() == HttpResponseParser::Error) {
 #ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyPost: invalid header!\n");
+		fprintf(stderr, "HttpProxyPost: invalid header!\n");
 #endif
-				reset(true);
-				error(ErrProxyNeg);
-				return;
-			}
-			else {
-#ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyPost: header proto=[%s] code=[%d] msg=[%s]\n", proto.latin1(), code, msg.latin1());
-				for(QStringList::ConstIterator it = d->headerLines.begin(); it != d->headerLines.end(); ++it)
-					fprintf(stderr, "HttpProxyPost: * [%s]\n", (*it).latin1());
-#endif
-			}
+		reset(true);
+		error(ErrProxyNeg);
+		return;
+	}
 
-			if(code == 200) { // OK
+	// done with grabbing the header?
+	if(inHeader && d->resp.state() != HttpResponseParser::Header) {
+		int code = d->resp.code();
 #ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyPost: << Success >>\n");
+		fprintf(stderr, "HttpProxyPost: header code=[%d]\n", code);
 #endif
-			}
-			else {
-				int err;
-				QString errStr;
-				if(code == 407) { // Authentication failed
-					err = ErrProxyAuth;
-					errStr = tr("Authentication failed");
-				}
-				else if(code == 404) { // Host not found
-					err = ErrHostNotFound;
-					errStr = tr("Host not found");
-				}
-				else if(code == 403) { // Access denied
-					err = ErrProxyNeg;
-					errStr = tr("Access denied");
-				}
-				else if(code == 503) { // Connection refused
-					err = ErrConnectionRefused;
-					errStr = tr("Connection refused");
-				}
-				else { // invalid reply
-					err = ErrProxyNeg;
-					errStr = tr("Invalid reply");
-				}
-
+		if(code != 200) {
 #ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyPost: << Error >> [%s]\n", errStr.latin1());
+			fprintf(stderr, "HttpProxyPost: << Error >> [%d]\n", code);
 #endif
-				reset(true);
-				error(err);
-				return;
-			}
+			reset(true);
+			error(errorForCode(code));
+			return;
 		}
 	}
+
+	if(d->resp.state() == HttpResponseParser::Done)
+		finish();
 }
 
 void HttpProxyPost::sock_error(int x)
@@ -658,6 +654,13 @@ void HttpProxyPost::sock_error(int x)
 #ifdef PROX_DEBUG
 	fprintf(stderr, "HttpProxyPost: socket error: %d\n", x);
 #endif
+	if(!d->busy) {
+		reset();
+		return;
+	}
+	if(x == BSocket::ErrRead && retry())
+		return;
+
 	reset(true);
 	if(x == BSocket::ErrHostNotFound)
 		error(ErrProxyConnect);
@@ -679,11 +682,10 @@ public:
 	}
 
 	BSocket sock;
-	QByteArray recvBuf;
 	QString url;
 	QString user, pass;
 	bool inHeader;
-	QStringList headerLines;
+	HttpResponseParser resp;
 	bool use_ssl;
 	bool asProxy;
 	QString host;
@@ -718,7 +720,7 @@ void HttpProxyGetStream::reset(bool /*clear*/)
 	}
 	if(d->sock.state() != BSocket::Idle)
 		d->sock.close();
-	d->recvBuf.resize(0);
+	d->resp.reset();
 	//if(clear)
 	//	d->body.resize(0);
 	d->length = -1;
@@ -761,16 +763,7 @@ void HttpProxyGetStream::stop()
 
 QString HttpProxyGetStream::getHeader(const QString &var) const
 {
-	for(QStringList::ConstIterator it = d->headerLines.begin(); it != d->headerLines.end(); ++it) {
-		const QString &s = *it;
-		int n = s.indexOf(": ");
-		if(n == -1)
-			continue;
-		QString v = s.mid(0, n);
-		if(v.toLower() == var.toLower())
-			return s.mid(n+2);
-	}
-	return "";
+	return QString::fromLatin1(d->resp.header(var.toLatin1().constData()));
 }
 
 int HttpProxyGetStream::length() const
@@ -792,7 +785,7 @@ void HttpProxyGetStream::sock_connected()
 	}
 
 	d->inHeader = true;
-	d->headerLines.clear();
+	d->resp.reset();
 
 	QUrl u = d->url;
 
@@ -838,108 +831,77 @@ void HttpProxyGetStream::sock_readyRead()
 
 void HttpProxyGetStream::processData(const QByteArray &block)
 {
-	printf("processData: %d bytes\n", block.size());
+	// the body is passed on as it comes, so only the header is parsed
 	if(!d->inHeader) {
 		emit dataReady(block);
 		return;
 	}
 
-	ByteStream::appendArray(&d->recvBuf, block);
-
-	if(d->inHeader) {
-		// grab available lines
-		while(1) {
-			bool found;
-			QString line = extractLine(&d->recvBuf, &found);
-			if(!found)
-				break;
-			if(line.isEmpty()) {
-				printf("empty line\n");
-				d->inHeader = false;
-				break;
-			}
-			d->headerLines += line;
-			printf("headerLine: [%s]\n", qPrintable(line));
-		}
-
-		// done with grabbing the header?
-		if(!d->inHeader) {
-			QString str = d->headerLines.first();
-			d->headerLines.takeFirst();
+	d->resp.append(block);
+	if(d->resp.state() == HttpResponseParser::Header)
+		return;
+	d->inHeader = false;
 
-			QString proto;
-			int code;
-			QString msg;
-			if(!extractMainHeader(str, &proto, &code, &msg)) {
+	if(d->resp.state() == HttpResponseParser::Error) {
 #ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyGetStream: invalid header!\n");
+		fprintf(stderr, "HttpProxyGetStream: invalid header!\n");
 #endif
-				reset(true);
-				error(ErrProxyNeg);
-				return;
-			}
-			else {
+		reset(true);
+		error(ErrProxyNeg);
+		return;
+	}
+
+	int code = d->resp.code();
 #ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyGetStream: header proto=[%s] code=[%d] msg=[%s]\n", proto.latin1(), code, msg.latin1());
-				for(QStringList::ConstIterator it = d->headerLines.begin(); it != d->headerLines.end(); ++it)
-					fprintf(stderr, "HttpProxyGetStream: * [%s]\n", (*it).latin1());
+	fprintf(stderr, "HttpProxyGetStream: header code=[%d]\n", code);
 #endif
-			}
 
-			if(code == 200) { // OK
+	if(code == 200) { // OK
 #ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyGetStream: << Success >>\n");
+		fprintf(stderr, "HttpProxyGetStream: << Success >>\n");
 #endif
+		d->length = d->resp.contentLength();
 
-				bool ok;
-				int x = getHeader("Content-Length").toInt(&ok);
-				if(ok)
-					d->length = x;
-
-				QPointer<QObject> self = this;
-				emit handshaken();
-				if(!self)
-					return;
-			}
-			else {
-				int err;
-				QString errStr;
-				if(code == 407) { // Authentication failed
-					err = ErrProxyAuth;
-					errStr = tr("Authentication failed");
-				}
-				else if(code == 404) { // Host not found
-					err = ErrHostNotFound;
-					errStr = tr("Host not found");
-				}
-				else if(code == 403) { // Access denied
-					err = ErrProxyNeg;
-					errStr = tr("Access denied");
-				}
-				else if(code == 503) { // Connection refused
-					err = ErrConnectionRefused;
-					errStr = tr("Connection refused");
-				}
-				else { // invalid reply
-					err = ErrProxyNeg;
-					errStr = tr("Invalid reply");
-				}
+		QPointer<QObject> self = this;
+		emit handshaken();
+		if(!self)
+			return;
+	}
+	else {
+		int err;
+		QString errStr;
+		if(code == 407) { // Authentication failed
+			err = ErrProxyAuth;
+			errStr = tr("Authentication failed");
+		}
+		else if(code == 404) { // Host not found
+			err = ErrHostNotFound;
+			errStr = tr("Host not found");
+		}
+		else if(code == 403) { // Access denied
+			err = ErrProxyNeg;
+			errStr = tr("Access denied");
+		}
+		else if(code == 503) { // Connection refused
+			err = ErrConnectionRefused;
+			errStr = tr("Connection refused");
+		}
+		else { // invalid reply
+			err = ErrProxyNeg;
+			errStr = tr("Invalid reply");
+		}
 
 #ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyGetStream: << Error >> [%s]\n", errStr.latin1());
+		fprintf(stderr, "HttpProxyGetStream: << Error >> [%s]\n", qPrintable(errStr));
 #endif
-				reset(true);
-				error(err);
-				return;
-			}
-
-			if(!d->recvBuf.isEmpty()) {
-				QByteArray a = d->recvBuf;
-				d->recvBuf.clear();
-				emit dataReady(a);
-			}
-		}
+		reset(true);
+		error(err);
+		return;
 	}
+
+	QByteArray a = d->resp.takeBody();
+	if(!a.isEmpty())
+		emit dataReady(a);
 }
 
 void HttpProxyGetStream::sock_error(int x)
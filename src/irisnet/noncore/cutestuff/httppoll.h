@@ -97,6 +97,9 @@ private:
 	Private *d;
 
 	void reset(bool clear=false);
+	void sendRequest();
+	bool retry();
+	void finish();
 };
 
 class HttpProxyGetStream : public QObject
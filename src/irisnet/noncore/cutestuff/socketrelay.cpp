@@ -0,0 +1,475 @@
+/*
+ * socketrelay.cpp - forward between two TCP connections without copying
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "socketrelay.h"
+
+#include <QPointer>
+#include <QSocketNotifier>
+
+#include "bsocket.h"
+#include "socks.h"
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#define HAVE_SPLICE
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// as much as a pipe holds by default
+#define CHUNK_SIZE 65536
+
+// reads per wakeup before giving the other direction a turn
+#define MAX_ROUNDS 16
+
+// CS_NAMESPACE_BEGIN
+
+#ifdef Q_OS_UNIX
+static void setNonBlocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if(flags != -1)
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static bool wouldBlock()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+#endif
+
+class RelayDirection
+{
+public:
+	enum FillResult { FillData, FillAgain, FillEnd, FillError };
+
+	int from, to;
+	QSocketNotifier *rn; // readable on 'from'
+	QSocketNotifier *wn; // writable on 'to'
+	int pipe[2];
+	int inPipe;
+	QByteArray buf;
+	int at, len;
+	bool useSplice, eof, done;
+	qint64 total;
+
+	RelayDirection()
+	{
+		from = -1;
+		to = -1;
+		rn = 0;
+		wn = 0;
+		pipe[0] = -1;
+		pipe[1] = -1;
+		inPipe = 0;
+		at = 0;
+		len = 0;
+		useSplice = false;
+		eof = false;
+		done = false;
+		total = 0;
+	}
+
+	bool held() const
+	{
+		return at < len || inPipe > 0;
+	}
+
+	void setup(int _from, int _to, QObject *parent)
+	{
+		from = _from;
+		to = _to;
+		rn = new QSocketNotifier(from, QSocketNotifier::Read, parent);
+		wn = new QSocketNotifier(to, QSocketNotifier::Write, parent);
+		wn->setEnabled(false);
+#ifdef HAVE_SPLICE
+		if(::pipe(pipe) == 0) {
+			setNonBlocking(pipe[0]);
+			setNonBlocking(pipe[1]);
+			useSplice = true;
+		}
+#endif
+	}
+
+	// what was read before the relay took over, written out first
+	void hold(const QByteArray &a)
+	{
+		if(a.isEmpty())
+			return;
+		buf = a;
+		at = 0;
+		len = a.size();
+		rn->setEnabled(false);
+		wn->setEnabled(true);
+	}
+
+	void closePipe()
+	{
+#ifdef Q_OS_UNIX
+		if(pipe[0] != -1)
+			::close(pipe[0]);
+		if(pipe[1] != -1)
+			::close(pipe[1]);
+#endif
+		pipe[0] = -1;
+		pipe[1] = -1;
+		useSplice = false;
+	}
+
+	void clear()
+	{
+		delete rn;
+		rn = 0;
+		delete wn;
+		wn = 0;
+		closePipe();
+		inPipe = 0;
+		buf.clear();
+		at = 0;
+		len = 0;
+		eof = false;
+		done = false;
+	}
+
+	// write out what is held.  returns false if the connection broke.
+	bool flush()
+	{
+#ifdef Q_OS_UNIX
+		while(at < len) {
+			int r = ::send(to, buf.constData() + at, len - at, MSG_NOSIGNAL);
+			if(r == -1)
+				return wouldBlock();
+			at += r;
+			total += r;
+		}
+#ifdef HAVE_SPLICE
+		while(inPipe > 0) {
+			int r = ::splice(pipe[0], 0, to, 0, inPipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if(r == -1)
+				return wouldBlock();
+			inPipe -= r;
+			total += r;
+		}
+#endif
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	FillResult fill()
+	{
+#ifdef Q_OS_UNIX
+#ifdef HAVE_SPLICE
+		if(useSplice) {
+			int r = ::splice(from, 0, pipe[1], 0, CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if(r > 0) {
+				inPipe = r;
+				return FillData;
+			}
+			if(r == 0)
+				return FillEnd;
+			if(wouldBlock())
+				return FillAgain;
+			if(errno != EINVAL && errno != ENOSYS)
+				return FillError;
+
+			// not for this kind of socket, copy instead
+			closePipe();
+		}
+#endif
+		if(buf.size() < CHUNK_SIZE)
+			buf.resize(CHUNK_SIZE);
+		int r = ::recv(from, buf.data(), CHUNK_SIZE, 0);
+		if(r > 0) {
+			at = 0;
+			len = r;
+			return FillData;
+		}
+		if(r == 0)
+			return FillEnd;
+		if(wouldBlock())
+			return FillAgain;
+#endif
+		return FillError;
+	}
+
+	// move as much as can be moved now.  returns false if a connection broke.
+	bool pump()
+	{
+		if(done)
+			return true;
+
+		for(int rounds = 0; rounds < MAX_ROUNDS; ++rounds) {
+			if(!held()) {
+				if(eof) {
+#ifdef Q_OS_UNIX
+					::shutdown(to, SHUT_WR);
+#endif
+					done = true;
+					rn->setEnabled(false);
+					wn->setEnabled(false);
+					return true;
+				}
+
+				FillResult r = fill();
+				if(r == FillError)
+					return false;
+				if(r == FillAgain) {
+					rn->setEnabled(true);
+					wn->setEnabled(false);
+					return true;
+				}
+				if(r == FillEnd) {
+					eof = true;
+					continue;
+				}
+			}
+
+			if(!flush())
+				return false;
+			if(held()) {
+				// the other side is full, wait until it takes more
+				rn->setEnabled(false);
+				wn->setEnabled(true);
+				return true;
+			}
+		}
+
+		// more may be waiting, let the other direction have a turn
+		rn->setEnabled(true);
+		wn->setEnabled(false);
+		return true;
+	}
+};
+
+class SocketRelay::Private
+{
+public:
+	int s1, s2;
+	RelayDirection toSecond, toFirst;
+	bool active;
+
+	QPointer<ByteStream> bs1, bs2;
+};
+
+SocketRelay::SocketRelay(QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+	d->s1 = -1;
+	d->s2 = -1;
+	d->active = false;
+}
+
+SocketRelay::~SocketRelay()
+{
+	stop();
+	delete d;
+}
+
+bool SocketRelay::start(ByteStream *first, ByteStream *second)
+{
+	stop();
+#ifdef Q_OS_UNIX
+	if((!qobject_cast<BSocket*>(first) && !qobject_cast<SocksClient*>(first))
+		|| (!qobject_cast<BSocket*>(second) && !qobject_cast<SocksClient*>(second)))
+		return false;
+	if(!first->isOpen() || !second->isOpen())
+		return false;
+
+	d->bs1 = first;
+	d->bs2 = second;
+	d->active = true;
+
+	// QTcpSocket has no way to give back what it hasn't written yet, so
+	//   wait for it to go out
+	if(first->bytesToWrite() > 0 || second->bytesToWrite() > 0) {
+		connect(first, SIGNAL(bytesWritten(int)), SLOT(stream_bytesWritten(int)));
+		connect(second, SIGNAL(bytesWritten(int)), SLOT(stream_bytesWritten(int)));
+		connect(first, SIGNAL(connectionClosed()), SLOT(stream_closed()));
+		connect(second, SIGNAL(connectionClosed()), SLOT(stream_closed()));
+		connect(first, SIGNAL(error(int)), SLOT(stream_closed()));
+		connect(second, SIGNAL(error(int)), SLOT(stream_closed()));
+		return true;
+	}
+
+	if(!take()) {
+		stop();
+		return false;
+	}
+	return true;
+#else
+	Q_UNUSED(first);
+	Q_UNUSED(second);
+	return false;
+#endif
+}
+
+bool SocketRelay::start(int first, int second)
+{
+	stop();
+#ifdef Q_OS_UNIX
+	if(first == -1 || second == -1)
+		return false;
+	d->toSecond.total = 0;
+	d->toFirst.total = 0;
+	setNonBlocking(first);
+	setNonBlocking(second);
+	d->s1 = first;
+	d->s2 = second;
+	d->toSecond.setup(first, second, this);
+	d->toFirst.setup(second, first, this);
+	connect(d->toSecond.rn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+	connect(d->toSecond.wn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+	connect(d->toFirst.rn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+	connect(d->toFirst.wn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+	d->active = true;
+	return true;
+#else
+	Q_UNUSED(first);
+	Q_UNUSED(second);
+	return false;
+#endif
+}
+
+void SocketRelay::stop()
+{
+	if(d->bs1)
+		d->bs1->disconnect(this);
+	if(d->bs2)
+		d->bs2->disconnect(this);
+	d->bs1 = 0;
+	d->bs2 = 0;
+
+	d->toSecond.clear();
+	d->toFirst.clear();
+#ifdef Q_OS_UNIX
+	if(d->s1 != -1)
+		::close(d->s1);
+	if(d->s2 != -1)
+		::close(d->s2);
+#endif
+	d->s1 = -1;
+	d->s2 = -1;
+	d->active = false;
+}
+
+bool SocketRelay::isActive() const
+{
+	return d->active;
+}
+
+bool SocketRelay::usingSplice() const
+{
+	return d->toSecond.useSplice && d->toFirst.useSplice;
+}
+
+qint64 SocketRelay::bytesToFirst() const
+{
+	return d->toFirst.total;
+}
+
+qint64 SocketRelay::bytesToSecond() const
+{
+	return d->toSecond.total;
+}
+
+bool SocketRelay::take()
+{
+	ByteStream *first = d->bs1;
+	ByteStream *second = d->bs2;
+	first->disconnect(this);
+	second->disconnect(this);
+	d->bs1 = 0;
+	d->bs2 = 0;
+
+	int s1, s2;
+	SocksClient *sc = qobject_cast<SocksClient*>(first);
+	s1 = sc ? sc->takeSocket() : static_cast<BSocket*>(first)->takeSocket();
+	if(s1 == -1)
+		return false;
+	sc = qobject_cast<SocksClient*>(second);
+	s2 = sc ? sc->takeSocket() : static_cast<BSocket*>(second)->takeSocket();
+	if(s2 == -1) {
+#ifdef Q_OS_UNIX
+		::close(s1);
+#endif
+		return false;
+	}
+
+	QByteArray toSecond = first->read();
+	QByteArray toFirst = second->read();
+	if(!start(s1, s2))
+		return false;
+	d->toSecond.hold(toSecond);
+	d->toFirst.hold(toFirst);
+	return true;
+}
+
+void SocketRelay::pump()
+{
+	if(!d->toSecond.pump() || !d->toFirst.pump()) {
+		fail();
+		return;
+	}
+	if(d->toSecond.done && d->toFirst.done) {
+		stop();
+		emit finished();
+	}
+}
+
+void SocketRelay::fail()
+{
+	stop();
+	emit error();
+}
+
+void SocketRelay::sn_activated(int)
+{
+	pump();
+}
+
+void SocketRelay::stream_bytesWritten(int)
+{
+	if(d->bs1.isNull() || d->bs2.isNull()) {
+		fail();
+		return;
+	}
+	if(d->bs1->bytesToWrite() > 0 || d->bs2->bytesToWrite() > 0)
+		return;
+	if(!take())
+		fail();
+}
+
+void SocketRelay::stream_closed()
+{
+	fail();
+}
+
+// CS_NAMESPACE_END
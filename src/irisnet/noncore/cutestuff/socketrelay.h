@@ -0,0 +1,81 @@
+/*
+ * socketrelay.h - forward between two TCP connections without copying
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_SOCKETRELAY_H
+#define CS_SOCKETRELAY_H
+
+#include <QObject>
+
+class ByteStream;
+
+// CS_NAMESPACE_BEGIN
+
+// joins two connected sockets, as a bytestream proxy does once both of
+//   its clients are through the SOCKS request.  the relay takes the
+//   connections over from their BSocket or SocksClient and moves the data
+//   itself: with splice() through a pipe on Linux so it never leaves the
+//   kernel, and through one fixed buffer per direction elsewhere.  an end
+//   of stream on one side is passed on as a half-close of the other, and
+//   finished() comes once both directions are done.  only available on
+//   unix.
+class SocketRelay : public QObject
+{
+	Q_OBJECT
+public:
+	SocketRelay(QObject *parent=0);
+	~SocketRelay();
+
+	// the streams must be connected BSockets or SocksClients.  anything
+	//   still queued for writing on them goes out first, and anything
+	//   they have read but not handed out is passed on to the other side.
+	//   the streams are left idle and may be deleted afterwards.  returns
+	//   false if the streams can't be relayed.
+	bool start(ByteStream *first, ByteStream *second);
+
+	// descriptors of connected sockets, which the relay closes when done
+	bool start(int first, int second);
+
+	void stop();
+	bool isActive() const;
+	bool usingSplice() const;
+
+	qint64 bytesToFirst() const;
+	qint64 bytesToSecond() const;
+
+signals:
+	void finished();
+	void error();
+
+private slots:
+	void sn_activated(int);
+	void stream_bytesWritten(int);
+	void stream_closed();
+
+private:
+	class Private;
+	Private *d;
+
+	bool take();
+	void pump();
+	void fail();
+};
+
+// CS_NAMESPACE_END
+
+#endif
@@ -73,7 +73,7 @@ SocksUDP::SocksUDP(SocksClient *sc, const QString &host, int port, const QHostAd
 	d = new Private;
 	d->sc = sc;
 	d->sd = new QUdpSocket(this);
-	connect(d->sd, SIGNAL(readyRead()), SLOT(sd_readyRead()));
+	connect(d->sd, SIGNAL(readyRead()), SLOT(sd_activated()));
 	d->host = host;
 	d->port = port;
 	d->routeAddr = routeAddr;
@@ -438,6 +438,9 @@ public:
 	bool udp;
 	QString udpAddr;
 	int udpPort;
+
+	int readHighWater;
+	bool readPaused, resumePosted;
 };
 
 SocksClient::SocksClient(QObject *parent)
@@ -461,6 +464,7 @@ SocksClient::SocksClient(int s, QObject *parent)
 void SocksClient::init()
 {
 	d = new Private(this);
+	d->readHighWater = 0;
 	connect(&d->sock, SIGNAL(connected()), SLOT(sock_connected()));
 	connect(&d->sock, SIGNAL(connectionClosed()), SLOT(sock_connectionClosed()));
 	connect(&d->sock, SIGNAL(delayedCloseFinished()), SLOT(sock_delayedCloseFinished()));
@@ -488,6 +492,43 @@ void SocksClient::reset(bool clear)
 	d->waiting = false;
 	d->udp = false;
 	d->pending = 0;
+	d->readPaused = false;
+	d->resumePosted = false;
+}
+
+void SocksClient::setSocketOptions(const SocketOptions &opts)
+{
+	d->sock.setOptions(opts);
+}
+
+void SocksClient::setReadHighWater(int bytes)
+{
+	d->readHighWater = qMax(bytes, 0);
+	if(d->readPaused && (d->readHighWater == 0 || ByteStream::bytesAvailable() < d->readHighWater))
+		resumeReading();
+}
+
+int SocksClient::readHighWater() const
+{
+	return d->readHighWater;
+}
+
+void SocksClient::resumeReading()
+{
+	if(d->resumePosted)
+		return;
+	d->resumePosted = true;
+	QMetaObject::invokeMethod(this, "doResumeReading", Qt::QueuedConnection);
+}
+
+void SocksClient::doResumeReading()
+{
+	d->resumePosted = false;
+	if(!d->readPaused)
+		return;
+	d->readPaused = false;
+	if(d->sock.bytesAvailable() > 0)
+		sock_readyRead();
 }
 
 bool SocksClient::isIncoming() const
@@ -554,7 +595,10 @@ void SocksClient::write(const QByteArray &buf)
 
 QByteArray SocksClient::read(int bytes)
 {
-	return ByteStream::read(bytes);
+	QByteArray a = ByteStream::read(bytes);
+	if(d->readPaused && ByteStream::bytesAvailable() <= d->readHighWater / 2)
+		resumeReading();
+	return a;
 }
 
 int SocksClient::bytesAvailable() const
@@ -562,6 +606,13 @@ int SocksClient::bytesAvailable() const
 	return ByteStream::bytesAvailable();
 }
 
+bool SocksClient::sendFile(int fd, qlonglong offset, qlonglong count)
+{
+	if(!d->active || d->udp)
+		return false;
+	return d->sock.sendFile(fd, offset, count);
+}
+
 int SocksClient::bytesToWrite() const
 {
 	if(d->active)
@@ -583,6 +634,9 @@ void SocksClient::sock_connected()
 void SocksClient::sock_connectionClosed()
 {
 	if(d->active) {
+		// what was held back while reading was paused
+		if(d->readPaused && !d->udp)
+			appendRead(d->sock.read());
 		reset();
 		connectionClosed();
 	}
@@ -601,6 +655,12 @@ void SocksClient::sock_delayedCloseFinished()
 
 void SocksClient::sock_readyRead()
 {
+	if(d->active && !d->udp && d->readHighWater > 0 && ByteStream::bytesAvailable() >= d->readHighWater) {
+		// leave it in the socket until the reader catches up
+		d->readPaused = true;
+		return;
+	}
+
 	QByteArray block = d->sock.read();
 
 	if(!d->active) {
@@ -1008,6 +1068,18 @@ SocksUDP *SocksClient::createUDP(const QString &host, int port, const QHostAddre
 	return new SocksUDP(this, host, port, routeAddr, routePort);
 }
 
+int SocksClient::takeSocket()
+{
+	if(!d->active || d->udp)
+		return -1;
+	int s = d->sock.takeSocket();
+	if(s == -1)
+		return -1;
+	appendRead(d->sock.read());
+	reset();
+	return s;
+}
+
 //----------------------------------------------------------------------------
 // SocksServer
 //----------------------------------------------------------------------------
@@ -1047,13 +1119,18 @@ bool SocksServer::isActive() const
 }
 
 bool SocksServer::listen(quint16 port, bool udp)
+{
+	return listen(QHostAddress::Any, port, udp);
+}
+
+bool SocksServer::listen(const QHostAddress &addr, quint16 port, bool udp)
 {
 	stop();
-	if(!d->serv.listen(port))
+	if(!d->serv.listen(port, addr))
 		return false;
 	if(udp) {
 		d->sd = new QUdpSocket(this);
-		if(!d->sd->bind(QHostAddress::LocalHost, port)) {
+		if(!d->sd->bind(addr == QHostAddress::Any ? QHostAddress(QHostAddress::LocalHost) : addr, port)) {
 			delete d->sd;
 			d->sd = 0;
 			d->serv.stop();
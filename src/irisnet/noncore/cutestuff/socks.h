@@ -28,6 +28,7 @@
 class QHostAddress;
 class SocksClient;
 class SocksServer;
+class SocketOptions;
 
 class SocksUDP : public QObject
 {
@@ -69,6 +70,16 @@ public:
 	void setAuth(const QString &user, const QString &pass="");
 	void connectToHost(const QString &proxyHost, int proxyPort, const QString &host, int port, bool udpMode=false);
 
+	// for the connection to the proxy, or the incoming one
+	void setSocketOptions(const SocketOptions &);
+
+	// once this much is waiting to be read, stop taking data off the
+	//   socket, so that a slow reader holds the sender back rather than
+	//   filling memory.  reading carries on below half of it.  0, the
+	//   default, is no limit.
+	void setReadHighWater(int bytes);
+	int readHighWater() const;
+
 	// incoming
 	void chooseMethod(int);
 	void authGrant(bool);
@@ -84,6 +95,9 @@ public:
 	int bytesAvailable() const;
 	int bytesToWrite() const;
 
+	// once the request is through, see BSocket::sendFile()
+	bool sendFile(int fd, qlonglong offset, qlonglong count);
+
 	// remote address
 	QHostAddress peerAddress() const;
 	quint16 peerPort() const;
@@ -93,6 +107,10 @@ public:
 	quint16 udpPort() const;
 	SocksUDP *createUDP(const QString &host, int port, const QHostAddress &routeAddr, int routePort);
 
+	// once the request is through, hands the connection over as a
+	//   descriptor (see BSocket::takeSocket()), e.g. for SocketRelay
+	int takeSocket();
+
 signals:
 	// outgoing
 	void connected();
@@ -111,6 +129,7 @@ private slots:
 	void sock_bytesWritten(int);
 	void sock_error(int);
 	void serve();
+	void doResumeReading();
 
 private:
 	class Private;
@@ -123,6 +142,7 @@ private:
 	void processIncoming(const QByteArray &);
 	void continueIncoming();
 	void writeData(const QByteArray &a);
+	void resumeReading();
 };
 
 class SocksServer : public QObject
@@ -134,6 +154,7 @@ public:
 
 	bool isActive() const;
 	bool listen(quint16 port, bool udp=false);
+	bool listen(const QHostAddress &addr, quint16 port, bool udp=false);
 	void stop();
 	int port() const;
 	QHostAddress address() const;
@@ -0,0 +1,515 @@
+/*
+ * websocket.cpp - WebSocket (RFC 6455) client carrying RFC 7395 XMPP
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "websocket.h"
+
+#include <QUrl>
+#include <QStringList>
+#include <QPointer>
+#include <QtCrypto>
+#include "bsocket.h"
+#include "httpconnect.h"
+#include "xmlsplitter.h"
+
+#ifdef PROX_DEBUG
+#include <stdio.h>
+#endif
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+// CS_NAMESPACE_BEGIN
+
+enum Opcode { OpContinuation = 0, OpText = 1, OpBinary = 2, OpClose = 8, OpPing = 9, OpPong = 10 };
+
+class WebSocket::Private
+{
+public:
+	enum State { Idle, Connecting, Handshaking, Open, Closing };
+
+	Private() :
+		bs(0),
+		tls(0),
+		port(0),
+		use_proxy(false),
+		use_ssl(false),
+		protocol("xmpp")
+	{
+	}
+
+	ByteStream *bs;
+	QCA::TLS *tls;
+	QString host;
+	int port;
+	QString path, hostHeader;
+	bool use_proxy, use_ssl;
+	QString user, pass;
+	QString protocol;
+
+	int state;
+	QString key;
+	QByteArray recv;
+	QByteArray message; // a fragmented message so far
+	XmlSplitter splitter;
+};
+
+WebSocket::WebSocket(QObject *parent)
+:ByteStream(parent)
+{
+	d = new Private;
+	reset(true);
+}
+
+WebSocket::~WebSocket()
+{
+	reset(true);
+	delete d;
+}
+
+void WebSocket::reset(bool clear)
+{
+	if(d->tls) {
+		delete d->tls;
+		d->tls = 0;
+	}
+	if(d->bs) {
+		d->bs->disconnect(this);
+		d->bs->deleteLater();
+		d->bs = 0;
+	}
+	if(clear)
+		clearReadBuffer();
+	clearWriteBuffer();
+	d->state = Private::Idle;
+	d->recv.clear();
+	d->message.clear();
+	d->splitter.reset();
+}
+
+void WebSocket::setAuth(const QString &user, const QString &pass)
+{
+	d->user = user;
+	d->pass = pass;
+}
+
+void WebSocket::setProtocol(const QString &protocol)
+{
+	d->protocol = protocol;
+}
+
+void WebSocket::connectToUrl(const QString &url)
+{
+	connectToHost("", 0, url);
+}
+
+void WebSocket::connectToHost(const QString &proxyHost, int proxyPort, const QString &url)
+{
+	reset(true);
+
+	QUrl u = url;
+	d->use_ssl = (u.scheme().toLower() == "wss" || u.scheme().toLower() == "https");
+	d->host = u.host();
+	d->port = u.port(d->use_ssl ? 443 : 80);
+	d->path = u.path();
+	if(d->path.isEmpty())
+		d->path = "/";
+	QString query = QString::fromLatin1(u.encodedQuery());
+	if(!query.isEmpty())
+		d->path += '?' + query;
+	d->hostHeader = d->host;
+	if(u.port() != -1)
+		d->hostHeader += ':' + QString::number(u.port());
+
+#ifdef PROX_DEBUG
+	fprintf(stderr, "WebSocket: Connecting to %s:%d [%s]\n", qPrintable(d->host), d->port, qPrintable(d->path));
+#endif
+	d->state = Private::Connecting;
+	if(!proxyHost.isEmpty()) {
+		// tunnel, the handshake still goes to the server itself
+		d->use_proxy = true;
+		HttpConnect *s = new HttpConnect(this);
+		d->bs = s;
+		connect(s, SIGNAL(connected()), SLOT(bs_connected()));
+		if(!d->user.isEmpty())
+			s->setAuth(d->user, d->pass);
+		s->connectToHost(proxyHost, proxyPort, d->host, d->port);
+	}
+	else {
+		d->use_proxy = false;
+		BSocket *s = new BSocket(this);
+		d->bs = s;
+		connect(s, SIGNAL(connected()), SLOT(bs_connected()));
+		s->connectToHost(d->host, d->port);
+	}
+	connect(d->bs, SIGNAL(connectionClosed()), SLOT(bs_connectionClosed()));
+	connect(d->bs, SIGNAL(delayedCloseFinished()), SLOT(bs_delayedCloseFinished()));
+	connect(d->bs, SIGNAL(readyRead()), SLOT(bs_readyRead()));
+	connect(d->bs, SIGNAL(error(int)), SLOT(bs_error(int)));
+}
+
+bool WebSocket::isOpen() const
+{
+	return d->state == Private::Open;
+}
+
+void WebSocket::close()
+{
+	if(d->state == Private::Idle || d->state == Private::Closing)
+		return;
+
+	if(d->state != Private::Open) {
+		reset();
+		return;
+	}
+
+	// normal closure, then wait for the server to close as well
+	QByteArray status(2, 0);
+	status[0] = (char)(1000 >> 8);
+	status[1] = (char)(1000 & 0xff);
+	sendFrame(OpClose, status);
+	d->state = Private::Closing;
+}
+
+void WebSocket::write(const QByteArray &a)
+{
+	if(d->state != Private::Open)
+		return;
+
+	// one message per element
+	QList<XmlSplitter::Piece> list = d->splitter.append(a);
+	foreach(const XmlSplitter::Piece &i, list)
+		sendFrame(OpText, i.data);
+	bytesWritten(a.size());
+}
+
+void WebSocket::writeRaw(const QByteArray &a)
+{
+	if(d->tls)
+		d->tls->write(a);
+	else
+		d->bs->write(a);
+}
+
+void WebSocket::sendFrame(int opcode, const QByteArray &payload)
+{
+	int len = payload.size();
+	QByteArray f;
+	f.reserve(len + 14);
+	f += (char)(0x80 | opcode);
+
+	// frames from a client are always masked
+	if(len < 126)
+		f += (char)(0x80 | len);
+	else if(len < 0x10000) {
+		f += (char)(0x80 | 126);
+		f += (char)(len >> 8);
+		f += (char)(len & 0xff);
+	}
+	else {
+		f += (char)(0x80 | 127);
+		quint64 x = len;
+		for(int n = 7; n >= 0; --n)
+			f += (char)((x >> (n * 8)) & 0xff);
+	}
+
+	QByteArray mask = QCA::Random::randomArray(4).toByteArray();
+	f += mask;
+	int start = f.size();
+	f += payload;
+	char *p = f.data() + start;
+	for(int n = 0; n < len; ++n)
+		p[n] ^= mask[n & 3];
+
+	writeRaw(f);
+}
+
+void WebSocket::bs_connected()
+{
+	if(d->use_ssl) {
+		d->tls = new QCA::TLS(this);
+		connect(d->tls, SIGNAL(handshaken()), SLOT(tls_handshaken()));
+		connect(d->tls, SIGNAL(readyRead()), SLOT(tls_readyRead()));
+		connect(d->tls, SIGNAL(readyReadOutgoing()), SLOT(tls_readyReadOutgoing()));
+		connect(d->tls, SIGNAL(error()), SLOT(tls_error()));
+		d->tls->setTrustedCertificates(QCA::systemStore());
+		d->tls->startClient(d->host);
+	}
+	else
+		sendHandshake();
+}
+
+void WebSocket::sendHandshake()
+{
+	d->state = Private::Handshaking;
+	d->key = QCA::Base64().arrayToString(QCA::Random::randomArray(16));
+
+	QString s;
+	s += QString("GET ") + d->path + " HTTP/1.1\r\n";
+	s += QString("Host: ") + d->hostHeader + "\r\n";
+	s += "Upgrade: websocket\r\n";
+	s += "Connection: Upgrade\r\n";
+	s += QString("Sec-WebSocket-Key: ") + d->key + "\r\n";
+	s += "Sec-WebSocket-Version: 13\r\n";
+	if(!d->protocol.isEmpty())
+		s += QString("Sec-WebSocket-Protocol: ") + d->protocol + "\r\n";
+	s += "\r\n";
+	writeRaw(s.toLatin1());
+}
+
+void WebSocket::bs_connectionClosed()
+{
+	bool closing = (d->state == Private::Closing);
+	bool open = (d->state == Private::Open);
+	reset();
+	if(closing)
+		delayedCloseFinished();
+	else if(open)
+		connectionClosed();
+	else
+		error(ErrProxyNeg);
+}
+
+void WebSocket::bs_delayedCloseFinished()
+{
+	// our own close of the socket, after the closing handshake
+	reset();
+	delayedCloseFinished();
+}
+
+void WebSocket::bs_readyRead()
+{
+	QByteArray block = d->bs->read();
+	if(d->tls)
+		d->tls->writeIncoming(block);
+	else
+		processData(block);
+}
+
+void WebSocket::bs_error(int x)
+{
+#ifdef PROX_DEBUG
+	fprintf(stderr, "WebSocket: socket error: %d\n", x);
+#endif
+	bool connecting = (d->state == Private::Connecting);
+	if(!connecting)
+		fail(ErrRead);
+	else if(d->use_proxy) {
+		if(x == HttpConnect::ErrConnectionRefused)
+			fail(ErrConnectionRefused);
+		else if(x == HttpConnect::ErrHostNotFound)
+			fail(ErrHostNotFound);
+		else if(x == HttpConnect::ErrProxyAuth)
+			fail(ErrProxyAuth);
+		else if(x == HttpConnect::ErrProxyNeg)
+			fail(ErrProxyNeg);
+		else
+			fail(ErrProxyConnect);
+	}
+	else if(x == BSocket::ErrHostNotFound)
+		fail(ErrHostNotFound);
+	else if(x == BSocket::ErrConnectionRefused)
+		fail(ErrConnectionRefused);
+	else
+		fail(ErrRead);
+}
+
+void WebSocket::tls_handshaken()
+{
+	if(d->tls->peerIdentityResult() != QCA::TLS::Valid) {
+#ifdef PROX_DEBUG
+		fprintf(stderr, "WebSocket: certificate not valid: %d\n", d->tls->peerIdentityResult());
+#endif
+		fail(ErrTLS);
+		return;
+	}
+	d->tls->continueAfterStep();
+	sendHandshake();
+}
+
+void WebSocket::tls_readyRead()
+{
+	processData(d->tls->read());
+}
+
+void WebSocket::tls_readyReadOutgoing()
+{
+	d->bs->write(d->tls->readOutgoing());
+}
+
+void WebSocket::tls_error()
+{
+	fail(d->state == Private::Open ? int(ErrRead) : int(ErrTLS));
+}
+
+void WebSocket::fail(int code)
+{
+	reset();
+	error(code);
+}
+
+void WebSocket::processData(const QByteArray &block)
+{
+	d->recv += block;
+
+	if(d->state == Private::Handshaking) {
+		if(!processHandshake())
+			return;
+	}
+
+	if(d->state == Private::Open || d->state == Private::Closing)
+		processFrames();
+}
+
+// returns true when the connection is open
+bool WebSocket::processHandshake()
+{
+	int end = d->recv.indexOf("\r\n\r\n");
+	if(end == -1)
+		return false;
+
+	QStringList lines = QString::fromLatin1(d->recv.left(end)).split("\r\n");
+	d->recv.remove(0, end + 4);
+
+	QStringList parts = lines.takeFirst().split(' ');
+	int code = parts.count() >= 2 ? parts[1].toInt() : 0;
+	QString upgrade, accept, protocol;
+	foreach(const QString &s, lines) {
+		int n = s.indexOf(':');
+		if(n == -1)
+			continue;
+		QString var = s.left(n).trimmed().toLower();
+		QString val = s.mid(n + 1).trimmed();
+		if(var == "upgrade")
+			upgrade = val.toLower();
+		else if(var == "sec-websocket-accept")
+			accept = val;
+		else if(var == "sec-websocket-protocol")
+			protocol = val;
+	}
+
+	QString expected = QCA::Base64().arrayToString(QCA::Hash("sha1").hash((d->key + WS_GUID).toLatin1()).toByteArray());
+	if(code != 101 || upgrade != "websocket" || accept != expected || (!d->protocol.isEmpty() && protocol != d->protocol)) {
+#ifdef PROX_DEBUG
+		fprintf(stderr, "WebSocket: handshake refused, code=%d protocol=[%s]\n", code, qPrintable(protocol));
+#endif
+		fail(code == 407 ? int(ErrProxyAuth) : int(ErrProxyNeg));
+		return false;
+	}
+
+	d->state = Private::Open;
+	QPointer<QObject> self = this;
+	connected();
+	if(!self)
+		return false;
+	return true;
+}
+
+// returns false if the connection went away
+bool WebSocket::processFrames()
+{
+	QPointer<QObject> self = this;
+	bool gotData = false;
+
+	while(1) {
+		int size = d->recv.size();
+		if(size < 2)
+			break;
+		const uchar *p = (const uchar *)d->recv.constData();
+		bool fin = (p[0] & 0x80) != 0;
+		int opcode = p[0] & 0x0f;
+		bool masked = (p[1] & 0x80) != 0;
+		quint64 len = p[1] & 0x7f;
+		int at = 2;
+		if(len == 126) {
+			if(size < 4)
+				break;
+			len = (p[2] << 8) | p[3];
+			at = 4;
+		}
+		else if(len == 127) {
+			if(size < 10)
+				break;
+			len = 0;
+			for(int n = 0; n < 8; ++n)
+				len = (len << 8) | p[2 + n];
+			at = 10;
+		}
+		if(len > 0x7fffffff) {
+			fail(ErrRead);
+			return false;
+		}
+		int maskAt = at;
+		if(masked)
+			at += 4;
+		if((quint64)size < at + len)
+			break;
+
+		QByteArray payload = d->recv.mid(at, len);
+		if(masked) {
+			const char *m = d->recv.constData() + maskAt;
+			for(int n = 0; n < payload.size(); ++n)
+				payload[n] = payload[n] ^ m[n & 3];
+		}
+		d->recv.remove(0, at + len);
+
+		if(opcode == OpPing) {
+			if(d->state == Private::Open)
+				sendFrame(OpPong, payload);
+		}
+		else if(opcode == OpPong) {
+			// nothing asked for one
+		}
+		else if(opcode == OpClose) {
+			if(d->state == Private::Open) {
+				// echo the status, then let the server close the socket
+				sendFrame(OpClose, payload.left(2));
+				d->state = Private::Closing;
+				if(gotData) {
+					readyRead();
+					if(!self)
+						return false;
+				}
+				reset();
+				connectionClosed();
+				return false;
+			}
+			// the answer to our close
+			d->bs->close();
+			if(d->bs && d->bs->bytesToWrite() == 0) {
+				reset();
+				delayedCloseFinished();
+			}
+			return false;
+		}
+		else {
+			// text or binary, the stream on top doesn't care
+			d->message += payload;
+			if(fin) {
+				appendRead(d->message);
+				d->message.clear();
+				gotData = true;
+			}
+		}
+	}
+
+	if(gotData)
+		readyRead();
+	return self;
+}
+
+// CS_NAMESPACE_END
@@ -0,0 +1,86 @@
+/*
+ * websocket.h - WebSocket (RFC 6455) client carrying RFC 7395 XMPP
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_WEBSOCKET_H
+#define CS_WEBSOCKET_H
+
+#include "bytestream.h"
+
+// CS_NAMESPACE_BEGIN
+
+// a ws:// or wss:// connection, directly or tunneled through an HTTP
+//   proxy with CONNECT.  each top level XML element written is sent as
+//   one text message, as RFC 7395 asks, so the stream on top has to be
+//   written with its <open/> and <close/> framing (see
+//   XmlProtocol::WebSocketFraming).  received messages are read back
+//   one after another.
+class WebSocket : public ByteStream
+{
+	Q_OBJECT
+public:
+	enum Error { ErrConnectionRefused = ErrCustom, ErrHostNotFound, ErrProxyConnect, ErrProxyNeg, ErrProxyAuth, ErrTLS };
+	WebSocket(QObject *parent=0);
+	~WebSocket();
+
+	void setAuth(const QString &user, const QString &pass="");
+
+	// the Sec-WebSocket-Protocol to ask for, "xmpp" by default.  the
+	//   server has to agree to it.
+	void setProtocol(const QString &protocol);
+
+	void connectToUrl(const QString &url);
+	void connectToHost(const QString &proxyHost, int proxyPort, const QString &url);
+
+	// from ByteStream
+	bool isOpen() const;
+	void close();
+	void write(const QByteArray &);
+
+signals:
+	void connected();
+
+private slots:
+	void bs_connected();
+	void bs_connectionClosed();
+	void bs_delayedCloseFinished();
+	void bs_readyRead();
+	void bs_error(int);
+
+	void tls_handshaken();
+	void tls_readyRead();
+	void tls_readyReadOutgoing();
+	void tls_error();
+
+private:
+	class Private;
+	Private *d;
+
+	void reset(bool clear=false);
+	void writeRaw(const QByteArray &);
+	void sendFrame(int opcode, const QByteArray &payload);
+	void sendHandshake();
+	void processData(const QByteArray &);
+	bool processHandshake();
+	bool processFrames();
+	void fail(int code);
+};
+
+// CS_NAMESPACE_END
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * xmlsplitter.cpp - cut a stream of XML into top level elements
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmlsplitter.h"
+
+// CS_NAMESPACE_BEGIN
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+XmlSplitter::XmlSplitter(const QByteArray &rootName)
+:root(rootName)
+{
+	reset();
+}
+
+void XmlSplitter::reset()
+{
+	buf.clear();
+	pos = 0;
+	depth = 0;
+	elementStart = 0;
+	tagStart = 0;
+	inTag = false;
+	quote = 0;
+}
+
+int XmlSplitter::pending() const
+{
+	return buf.size();
+}
+
+bool XmlSplitter::isRoot(const char *name, int len) const
+{
+	if(root.isEmpty() || len <= root.size())
+		return false;
+	if(qstrncmp(name, root.constData(), root.size()) != 0)
+		return false;
+	char c = name[root.size()];
+	return isSpace(c) || c == '>' || c == '/';
+}
+
+QList<XmlSplitter::Piece> XmlSplitter::append(const QByteArray &a)
+{
+	QList<Piece> list;
+	buf += a;
+	int n = pos;
+	while(n < buf.size()) {
+		char c = buf[n];
+		if(!inTag) {
+			if(c == '<') {
+				inTag = true;
+				quote = 0;
+				tagStart = n;
+			}
+			++n;
+			continue;
+		}
+		if(quote) {
+			if(c == quote)
+				quote = 0;
+			++n;
+			continue;
+		}
+		if(c == '\'' || c == '"') {
+			quote = c;
+			++n;
+			continue;
+		}
+		if(c != '>') {
+			++n;
+			continue;
+		}
+
+		// a whole tag, from tagStart to n
+		inTag = false;
+		++n;
+		const char *p = buf.constData() + tagStart;
+		int len = n - tagStart;
+		Piece i;
+		if(p[1] == '?' || p[1] == '!')
+			continue;
+		if(p[1] == '/') {
+			if(depth == 0) {
+				if(isRoot(p + 2, len - 2)) {
+					i.type = EndTag;
+					i.data = buf.mid(tagStart, len);
+					list += i;
+				}
+				continue;
+			}
+			if(--depth == 0) {
+				i.type = Element;
+				i.data = buf.mid(elementStart, n - elementStart);
+				list += i;
+			}
+		}
+		else if(p[len - 2] == '/') {
+			if(depth == 0) {
+				i.type = Element;
+				i.data = buf.mid(tagStart, len);
+				list += i;
+			}
+		}
+		else {
+			if(depth == 0 && isRoot(p + 1, len - 1)) {
+				i.type = StartTag;
+				i.data = buf.mid(tagStart, len);
+				list += i;
+				continue;
+			}
+			if(depth == 0)
+				elementStart = tagStart;
+			++depth;
+		}
+	}
+
+	// drop what has been dealt with
+	int keep;
+	if(depth > 0)
+		keep = elementStart;
+	else if(inTag)
+		keep = tagStart;
+	else
+		keep = n;
+	buf.remove(0, keep);
+	elementStart -= keep;
+	tagStart -= keep;
+	pos = n - keep;
+	return list;
+}
+
+QByteArray XmlSplitter::tagName(const QByteArray &tag)
+{
+	int start = tag.indexOf('<');
+	if(start == -1)
+		return QByteArray();
+	++start;
+	int n = start;
+	while(n < tag.size() && !isSpace(tag[n]) && tag[n] != '/' && tag[n] != '>')
+		++n;
+	return tag.mid(start, n - start);
+}
+
+QList< QPair<QByteArray,QByteArray> > XmlSplitter::attributes(const QByteArray &tag)
+{
+	QList< QPair<QByteArray,QByteArray> > list;
+	int start = tag.indexOf('<');
+	if(start == -1)
+		return list;
+	int n = start + 1 + tagName(tag).size();
+	while(n < tag.size()) {
+		while(n < tag.size() && isSpace(tag[n]))
+			++n;
+		if(n >= tag.size() || tag[n] == '/' || tag[n] == '>')
+			break;
+
+		int nameStart = n;
+		while(n < tag.size() && tag[n] != '=' && !isSpace(tag[n]) && tag[n] != '>')
+			++n;
+		QByteArray name = tag.mid(nameStart, n - nameStart);
+		while(n < tag.size() && isSpace(tag[n]))
+			++n;
+		if(n >= tag.size() || tag[n] != '=')
+			break;
+		++n;
+		while(n < tag.size() && isSpace(tag[n]))
+			++n;
+		if(n >= tag.size() || (tag[n] != '\'' && tag[n] != '"'))
+			break;
+		char q = tag[n++];
+		int end = tag.indexOf(q, n);
+		if(end == -1)
+			break;
+		list += qMakePair(name, tag.mid(n, end - n));
+		n = end + 1;
+	}
+	return list;
+}
+
+QString XmlSplitter::attribute(const QByteArray &tag, const char *name)
+{
+	QList< QPair<QByteArray,QByteArray> > list = attributes(tag);
+	for(int n = 0; n < list.count(); ++n) {
+		if(list[n].first == name)
+			return unescape(QString::fromUtf8(list[n].second));
+	}
+	return QString();
+}
+
+QByteArray XmlSplitter::escape(const QString &s)
+{
+	QString out = s;
+	out.replace('&', "&amp;");
+	out.replace('<', "&lt;");
+	out.replace('>', "&gt;");
+	out.replace('\'', "&apos;");
+	out.replace('"', "&quot;");
+	return out.toUtf8();
+}
+
+QString XmlSplitter::unescape(const QString &s)
+{
+	QString out = s;
+	out.replace("&lt;", "<");
+	out.replace("&gt;", ">");
+	out.replace("&apos;", "'");
+	out.replace("&quot;", "\"");
+	out.replace("&amp;", "&");
+	return out;
+}
+
+// CS_NAMESPACE_END
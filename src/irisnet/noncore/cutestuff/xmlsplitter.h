@@ -0,0 +1,80 @@
+/*
+ * xmlsplitter.h - cut a stream of XML into top level elements
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_XMLSPLITTER_H
+#define CS_XMLSPLITTER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+// CS_NAMESPACE_BEGIN
+
+// finds where the elements of an XML stream begin and end, without
+//   parsing them, for transports that frame each one separately.  only
+//   tags and quoting are looked at, so the input must be well formed.
+//   processing instructions, comments and text between elements are
+//   dropped.
+//
+// if a root name is given, that element's open and close tags are
+//   returned on their own rather than as one element, so that
+//   "<stream:stream>" and "</stream:stream>" can be told apart from the
+//   stanzas in between.
+class XmlSplitter
+{
+public:
+	enum Type { Element, StartTag, EndTag };
+	class Piece
+	{
+	public:
+		int type;
+		QByteArray data;
+	};
+
+	XmlSplitter(const QByteArray &rootName=QByteArray());
+
+	void reset();
+
+	// the pieces completed by this data, in order
+	QList<Piece> append(const QByteArray &a);
+
+	// input held back for an unfinished element
+	int pending() const;
+
+	// for the start tag at the beginning of 'tag'
+	static QByteArray tagName(const QByteArray &tag);
+	static QList< QPair<QByteArray,QByteArray> > attributes(const QByteArray &tag); // values not unescaped
+	static QString attribute(const QByteArray &tag, const char *name);
+	static QByteArray escape(const QString &s);
+	static QString unescape(const QString &s);
+
+private:
+	QByteArray root;
+	QByteArray buf;
+	int pos, depth, elementStart, tagStart;
+	bool inTag;
+	char quote;
+
+	bool isRoot(const char *name, int len) const;
+};
+
+// CS_NAMESPACE_END
+
+#endif
@@ -20,17 +20,40 @@
 
 #include "ice176.h"
 
+#include <QHash>
+#include <QPointer>
 #include <QSet>
+#include <QTime>
 #include <QTimer>
 #include <QUdpSocket>
+#include <QVector>
 #include <QtCrypto>
 #include "stuntransaction.h"
 #include "stunbinding.h"
 #include "stunmessage.h"
+#include "stunutil.h"
 #include "udpportreserver.h"
 #include "icelocaltransport.h"
 #include "iceturntransport.h"
 #include "icecomponent.h"
+#include "icelocaladdressset.h"
+#include "icerelayprobe.h"
+
+// pacing between starting connectivity checks ("Ta" in RFC 5245)
+#define ICE_TA_INTERVAL 20
+
+// consent freshness checks on selected pairs (RFC 7675)
+#define ICE_CONSENT_INTERVAL 5000
+
+// received datagrams queued per component.  must be a power of 2
+#define ICE_RECEIVE_SLOTS 512
+
+// how long to wait for the relays to answer the probe
+#define ICE_RELAY_PROBE_TIMEOUT 1000
+
+// a binding response: header, XOR-MAPPED-ADDRESS (ipv4),
+//   MESSAGE-INTEGRITY and FINGERPRINT
+#define ICE_RESPONSE_SIZE (20 + 12 + 24 + 8)
 
 namespace XMPP {
 
@@ -72,15 +95,6 @@ static qint64 calc_pair_priority(int a, int b)
 	return priority;
 }
 
-// see if candidates are considered the same for pruning purposes
-static bool compare_candidates(const IceComponent::CandidateInfo &a, const IceComponent::CandidateInfo &b)
-{
-	if(a.addr == b.addr && a.componentId == b.componentId)
-		return true;
-	else
-		return false;
-}
-
 // scope values: 0 = local, 1 = link-local, 2 = private, 3 = public
 // FIXME: dry (this is in psi avcall also)
 static int getAddressScope(const QHostAddress &a)
@@ -148,11 +162,22 @@ public:
 		bool isDefault;
 		bool isValid;
 		bool isNominated;
+		bool nominating; // the current check carries USE-CANDIDATE
 		CandidatePairState state;
 
 		qint64 priority;
 		QString foundation;
 
+		// identifies the pair to the check queue
+		int serial;
+
+		// path statistics.  rtt is smoothed as in RFC 6298
+		QTime checkTime;
+		int srtt, rttvar; // msecs, -1 if no sample yet
+		int consentRequests, consentResponses;
+		qint64 packetsSent, bytesSent;
+		qint64 packetsReceived, bytesReceived;
+
 		StunBinding *binding;
 
 		// FIXME: this is wrong i think, it should be in LocalTransport
@@ -160,17 +185,112 @@ public:
 		StunTransactionPool *pool;
 
 		CandidatePair() :
+			nominating(false),
+			serial(-1),
+			srtt(-1),
+			rttvar(-1),
+			consentRequests(0),
+			consentResponses(0),
+			packetsSent(0),
+			bytesSent(0),
+			packetsReceived(0),
+			bytesReceived(0),
 			binding(0),
 			pool(0)
 		{
 		}
 	};
 
+	// a waiting pair, with a copy of what compare_pair needs to order it
+	class CheckQueueItem
+	{
+	public:
+		int serial;
+		qint64 priority;
+		IceComponent::CandidateType remoteType;
+		QAbstractSocket::NetworkLayerProtocol remoteProtocol;
+	};
+
 	class CheckList
 	{
 	public:
+		// kept sorted with compare_pair
 		QList<CandidatePair> pairs;
 		CheckListState state;
+
+		// pair_key() of every entry in pairs, to its serial.  this is
+		//   also how incoming packets find their pair
+		QHash<QString, int> keys;
+
+		// position in pairs of each serial, rebuilt on demand after
+		//   pairs are inserted or removed
+		mutable QHash<int, int> positions;
+		mutable bool positionsValid;
+
+		// serial of the pair each check or consent pool belongs to
+		QHash<StunTransactionPool*, int> pools;
+
+		// binary heap of pairs in the PWaiting state, best first.
+		//   entries for pairs that have since been removed are
+		//   skipped when they come up
+		QList<CheckQueueItem> waiting;
+
+		CheckList() :
+			positionsValid(false)
+		{
+		}
+	};
+
+	// queue of received datagrams of one component, in preallocated
+	//   slots.  the buffers themselves are shared with the transport
+	//   that read them, not copied.  when full, the oldest datagram is
+	//   dropped, as stale media is of no use
+	class DatagramRing
+	{
+	public:
+		QVector<QByteArray> ring;
+		int head;
+		int count;
+		int dropped;
+
+		DatagramRing() :
+			ring(ICE_RECEIVE_SLOTS),
+			head(0),
+			count(0),
+			dropped(0)
+		{
+		}
+
+		bool isEmpty() const
+		{
+			return (count == 0);
+		}
+
+		void push(const QByteArray &buf)
+		{
+			if(count == ICE_RECEIVE_SLOTS)
+			{
+				ring[head] = QByteArray();
+				head = (head + 1) & (ICE_RECEIVE_SLOTS - 1);
+				--count;
+				++dropped;
+			}
+
+			ring[(head + count) & (ICE_RECEIVE_SLOTS - 1)] = buf;
+			++count;
+		}
+
+		QByteArray take()
+		{
+			if(count == 0)
+				return QByteArray();
+
+			QByteArray out = ring[head];
+			ring[head] = QByteArray();
+			head = (head + 1) & (ICE_RECEIVE_SLOTS - 1);
+			--count;
+			return out;
+		}
 	};
 
 	class Component
@@ -179,13 +299,41 @@ public:
 		int id;
 		IceComponent *ic;
 		bool localFinished;
+		bool gatheringComplete;
 		bool stopped;
 		bool lowOverhead;
 
+		// serial of the valid pair used for data, or -1
+		int selectedSerial;
+
+		// regular nomination has been started for this component
+		bool nominated;
+
+		// componentReady() has been emitted
+		bool ready;
+
+		int pairChanges;
+
+		// outstanding consent check on the selected pair
+		StunTransactionPool *consentPool;
+		StunBinding *consentBinding;
+		int consentSerial;
+		QTime consentTime; // when the last response arrived
+		bool consentValid;
+
 		Component() :
 			localFinished(false),
+			gatheringComplete(false),
 			stopped(false),
-			lowOverhead(false)
+			lowOverhead(false),
+			selectedSerial(-1),
+			nominated(false),
+			ready(false),
+			pairChanges(0),
+			consentPool(0),
+			consentBinding(0),
+			consentSerial(-1),
+			consentValid(false)
 		{
 		}
 	};
@@ -194,12 +342,16 @@ public:
 	Ice176::Mode mode;
 	State state;
 	TurnClient::Proxy proxy;
+	TurnConnectionPool *turnPool;
+	IceCandidatePool *candidatePool;
 	UdpPortReserver *portReserver;
 	int componentCount;
 	QList<Ice176::LocalAddress> localAddrs;
 	QList<Ice176::ExternalAddress> extAddrs;
 	QHostAddress stunBindAddr;
 	int stunBindPort;
+	QList<QHostAddress> moreStunBindAddrs;
+	QList<int> moreStunBindPorts;
 	QHostAddress stunRelayUdpAddr;
 	int stunRelayUdpPort;
 	QString stunRelayUdpUser;
@@ -208,33 +360,74 @@ public:
 	int stunRelayTcpPort;
 	QString stunRelayTcpUser;
 	QCA::SecureArray stunRelayTcpPass;
+
+	// more relays to pick the nearest from
+	class RelayService
+	{
+	public:
+		QHostAddress addr;
+		int port;
+		QString user;
+		QCA::SecureArray pass;
+	};
+	QList<RelayService> moreRelaysUdp, moreRelaysTcp;
+	IceRelayProbe *relayProbe;
+	QList<IceRelayProbe::Server> probeServers;
+
 	QString localUser, localPass;
 	QString peerUser, peerPass;
 	QList<Component> components;
 	QList<IceComponent::Candidate> localCandidates;
 	QSet<IceTransport*> iceTransports;
 	CheckList checkList;
-	QList< QList<QByteArray> > in;
+	QList<DatagramRing> in;
+	QList<Ice176::DatagramHandler*> handlers;
 	bool useLocal;
 	bool useStunBind;
 	bool useStunRelayUdp;
 	bool useStunRelayTcp;
+	bool useTcp;
 	bool useTrickle;
+	bool rtcpMux;
+	bool sharedStunBind;
 	QTimer *collectTimer;
+	QTimer *checkTimer;
+	QTimer *consentTimer;
+	int nextPairSerial;
+	Ice176::Nomination nomination;
+	int maxChecksInFlight;
+	int checksInFlight;
 
 	Private(Ice176 *_q) :
 		QObject(_q),
 		q(_q),
 		state(Stopped),
+		turnPool(0),
+		candidatePool(0),
 		portReserver(0),
 		componentCount(0),
+		relayProbe(0),
 		useLocal(true),
 		useStunBind(true),
 		useStunRelayUdp(true),
 		useStunRelayTcp(true),
+		useTcp(false),
 		useTrickle(false),
-		collectTimer(0)
+		rtcpMux(false),
+		sharedStunBind(false),
+		collectTimer(0),
+		nextPairSerial(0),
+		nomination(Ice176::AggressiveNomination),
+		maxChecksInFlight(0),
+		checksInFlight(0)
 	{
+		checkTimer = new QTimer(this);
+		connect(checkTimer, SIGNAL(timeout()), SLOT(check_timeout()));
+		checkTimer->setInterval(ICE_TA_INTERVAL);
+
+		consentTimer = new QTimer(this);
+		connect(consentTimer, SIGNAL(timeout()), SLOT(consent_timeout()));
+		consentTimer->setInterval(ICE_CONSENT_INTERVAL);
 	}
 
 	~Private()
@@ -245,6 +438,17 @@ public:
 			collectTimer->deleteLater();
 		}
 
+		checkTimer->disconnect(this);
+		checkTimer->setParent(0);
+		checkTimer->deleteLater();
+
+		consentTimer->disconnect(this);
+		consentTimer->setParent(0);
+		consentTimer->deleteLater();
+
+		for(int n = 0; n < components.count(); ++n)
+			releaseConsent(components[n]);
+
 		foreach(const Component &c, components)
 			delete c.ic;
 
@@ -319,10 +523,94 @@ public:
 		localUser = randomCredential(4);
 		localPass = randomCredential(22);
 
+		// with a choice of relays, find the nearest first
+		probeServers.clear();
+		if(useStunRelayUdp && !moreRelaysUdp.isEmpty())
+			addProbeServers(stunRelayUdpAddr, stunRelayUdpPort, moreRelaysUdp);
+		if(useStunRelayTcp && !moreRelaysTcp.isEmpty())
+			addProbeServers(stunRelayTcpAddr, stunRelayTcpPort, moreRelaysTcp);
+		if(probeServers.count() > 1)
+		{
+			relayProbe = new IceRelayProbe(this);
+			connect(relayProbe, SIGNAL(finished()), SLOT(relayProbe_finished()));
+			relayProbe->start(probeServers, ICE_RELAY_PROBE_TIMEOUT);
+			return;
+		}
+
+		startComponents();
+	}
+
+	void addProbeServers(const QHostAddress &addr, int port, const QList<RelayService> &more)
+	{
+		QList<IceRelayProbe::Server> list;
+		if(!addr.isNull())
+			list += IceRelayProbe::Server(addr, port);
+		foreach(const RelayService &rs, more)
+			list += IceRelayProbe::Server(rs.addr, rs.port);
+
+		foreach(const IceRelayProbe::Server &s, list)
+		{
+			bool found = false;
+			foreach(const IceRelayProbe::Server &i, probeServers)
+			{
+				if(i.addr == s.addr && i.port == s.port)
+				{
+					found = true;
+					break;
+				}
+			}
+			if(!found)
+				probeServers += s;
+		}
+	}
+
+	// the round trip measured to addr;port, or -1
+	int probedRtt(const QList<int> &rtts, const QHostAddress &addr, int port) const
+	{
+		for(int n = 0; n < probeServers.count(); ++n)
+		{
+			if(probeServers[n].addr == addr && probeServers[n].port == port)
+				return rtts[n];
+		}
+		return -1;
+	}
+
+	// replaces the relay service with the nearest of all the ones given.
+	//   if none answered, the one set with setStunRelay*Service() stays
+	void pickRelay(const QList<int> &rtts, QHostAddress *addr, int *port, QString *user, QCA::SecureArray *pass, const QList<RelayService> &more)
+	{
+		int best = addr->isNull() ? -1 : probedRtt(rtts, *addr, *port);
+		foreach(const RelayService &rs, more)
+		{
+			int rtt = probedRtt(rtts, rs.addr, rs.port);
+			if(rtt != -1 && (best == -1 || rtt < best))
+			{
+				best = rtt;
+				*addr = rs.addr;
+				*port = rs.port;
+				*user = rs.user;
+				*pass = rs.pass;
+			}
+		}
+
+		// nothing answered and nothing set, so take the first anyway
+		if(addr->isNull() && !more.isEmpty())
+		{
+			*addr = more[0].addr;
+			*port = more[0].port;
+			*user = more[0].user;
+			*pass = more[0].pass;
+		}
+	}
+
+	void startComponents()
+	{
 		QList<QUdpSocket*> socketList;
 		if(portReserver)
 			socketList = portReserver->borrowSockets(componentCount, this);
 
+		in.clear();
+
 		for(int n = 0; n < componentCount; ++n)
 		{
 			Component c;
@@ -332,15 +620,21 @@ public:
 			connect(c.ic, SIGNAL(candidateAdded(const XMPP::IceComponent::Candidate &)), SLOT(ic_candidateAdded(const XMPP::IceComponent::Candidate &)));
 			connect(c.ic, SIGNAL(candidateRemoved(const XMPP::IceComponent::Candidate &)), SLOT(ic_candidateRemoved(const XMPP::IceComponent::Candidate &)));
 			connect(c.ic, SIGNAL(localFinished()), SLOT(ic_localFinished()));
+			connect(c.ic, SIGNAL(reflexiveAddressFound(const QHostAddress &, const QHostAddress &)), SLOT(ic_reflexiveAddressFound(const QHostAddress &, const QHostAddress &)));
+			connect(c.ic, SIGNAL(gatheringComplete()), SLOT(ic_gatheringComplete()));
 			connect(c.ic, SIGNAL(stopped()), SLOT(ic_stopped()));
 			connect(c.ic, SIGNAL(debugLine(const QString &)), SLOT(ic_debugLine(const QString &)));
 
 			c.ic->setClientSoftwareNameAndVersion("Iris");
 			c.ic->setProxy(proxy);
+			c.ic->setTurnConnectionPool(turnPool);
+			c.ic->setCandidatePool(candidatePool);
 			if(portReserver)
 				c.ic->setPortReserver(portReserver);
 			c.ic->setLocalAddresses(localAddrs);
 			c.ic->setExternalAddresses(extAddrs);
+			for(int i = 0; i < moreStunBindAddrs.count(); ++i)
+				c.ic->addStunBindService(moreStunBindAddrs[i], moreStunBindPorts[i]);
 			if(!stunBindAddr.isNull())
 				c.ic->setStunBindService(stunBindAddr, stunBindPort);
 			if(!stunRelayUdpAddr.isNull())
@@ -348,13 +642,22 @@ public:
 			if(!stunRelayTcpAddr.isNull())
 				c.ic->setStunRelayTcpService(stunRelayTcpAddr, stunRelayTcpPort, stunRelayTcpUser, stunRelayTcpPass);
 
+			// later components learn their reflexive addresses from
+			//   the first one instead of binding themselves, and
+			//   with rtcp-mux they are only offered as a fallback
+			bool follower = n > 0 && (sharedStunBind || rtcpMux);
+
 			c.ic->setUseLocal(useLocal);
-			c.ic->setUseStunBind(useStunBind);
-			c.ic->setUseStunRelayUdp(useStunRelayUdp);
-			c.ic->setUseStunRelayTcp(useStunRelayTcp);
+			c.ic->setUseStunBind(useStunBind && !follower);
+			c.ic->setUseStunRelayUdp(useStunRelayUdp && !(n > 0 && rtcpMux));
+			c.ic->setUseStunRelayTcp(useStunRelayTcp && !(n > 0 && rtcpMux));
+			c.ic->setUseTcp(useTcp);
+
+			// don't burst all the bindings and allocations at once
+			c.ic->setStunPace(ICE_TA_INTERVAL);
 
 			// create an inbound queue for this component
-			in += QList<QByteArray>();
+			in += DatagramRing();
 
 			components += c;
 
@@ -375,6 +678,14 @@ public:
 
 		state = Stopping;
 
+		delete relayProbe;
+		relayProbe = 0;
+
+		checkTimer->stop();
+		consentTimer->stop();
+		for(int n = 0; n < components.count(); ++n)
+			releaseConsent(components[n]);
+
 		if(!components.isEmpty())
 		{
 			for(int n = 0; n < components.count(); ++n)
@@ -393,6 +704,15 @@ public:
 		foreach(const Candidate &c, list)
 		{
 			IceComponent::CandidateInfo ci;
+			if(c.protocol == "tcp")
+			{
+				int tcpType = string_to_tcpType(c.tcptype);
+				if(tcpType == -1)
+					continue;
+				ci.tcpType = (IceComponent::TcpType)tcpType;
+			}
+			else if(!c.protocol.isEmpty() && c.protocol != "udp")
+				continue;
 			ci.addr.addr = c.ip;
 			ci.addr.addr.setScopeId(QString());
 			ci.addr.port = c.port;
@@ -423,6 +743,14 @@ public:
 				if(lc.componentId != rc.componentId)
 					continue;
 
+				// udp goes with udp, and our active tcp with their
+				//   passive.  passive candidates don't send checks,
+				//   see triggerTcpCheck()
+				if(lc.tcpType == IceComponent::TcpPassive || rc.tcpType == IceComponent::TcpActive)
+					continue;
+				if((lc.tcpType == IceComponent::TcpActive) != (rc.tcpType == IceComponent::TcpPassive))
+					continue;
+
 				// don't pair ipv4 with ipv6.  FIXME: is this right?
 				if(lc.addr.addr.protocol() != rc.addr.addr.protocol())
 					continue;
@@ -454,255 +782,781 @@ public:
 
 		printf("%d pairs\n", pairs.count());
 
-		// combine pairs with existing, and sort
-		pairs = checkList.pairs + pairs;
-		checkList.pairs.clear();
-		foreach(const CandidatePair &pair, pairs)
-		{
-			int at;
-			for(at = 0; at < checkList.pairs.count(); ++at)
-			{
-				if(compare_pair(pair, checkList.pairs[at]) < 0)
-					break;
-			}
-
-			checkList.pairs.insert(at, pair);
-		}
-
-		// pruning
-
-		for(int n = 0; n < checkList.pairs.count(); ++n)
+		// merge the new pairs into the check list.  the list stays
+		//   sorted, and pairs that duplicate one already present
+		//   (same local base and remote) are pruned as they arrive
+		int added = 0;
+		foreach(CandidatePair pair, pairs)
 		{
-			CandidatePair &pair = checkList.pairs[n];
 			if(pair.local.type == IceComponent::ServerReflexiveType)
 				pair.local.addr = pair.local.base;
-		}
-
-		for(int n = 0; n < checkList.pairs.count(); ++n)
-		{
-			CandidatePair &pair = checkList.pairs[n];
-			printf("%d, %s:%d -> %s:%d\n", pair.local.componentId, qPrintable(pair.local.addr.addr.toString()), pair.local.addr.port, qPrintable(pair.remote.addr.addr.toString()), pair.remote.addr.port);
-
-			bool found = false;
-			for(int i = n - 1; i >= 0; --i)
-			{
-				if(compare_candidates(pair.local, checkList.pairs[i].local) && compare_candidates(pair.remote, checkList.pairs[i].remote))
-				{
-					found = true;
-					break;
-				}
-			}
 
-			if(found )
-			{
-				checkList.pairs.removeAt(n);
-				--n; // adjust position
-			}
+			if(insertPair(pair) != -1)
+				++added;
 		}
 
 		// max pairs is 100 * number of components
 		int max_pairs = 100 * components.count();
 		while(checkList.pairs.count() > max_pairs)
-			checkList.pairs.removeLast();
+			removePair(checkList.pairs.count() - 1);
 
 		printf("%d after pruning\n", checkList.pairs.count());
 
-		// set state
+		if(added == 0)
+			return;
+
+		// queue the survivors for checking
 		for(int n = 0; n < checkList.pairs.count(); ++n)
 		{
 			CandidatePair &pair = checkList.pairs[n];
+			if(pair.state == PWaiting && pair.serial >= nextPairSerial - added)
+				queuePair(pair);
+		}
 
-			// only initialize the new pairs
-			if(pair.state != PFrozen)
-				continue;
-
-			pair.foundation = pair.local.foundation + pair.remote.foundation;
-
-			// FIXME: for now we just do checks to everything immediately
-			pair.state = PInProgress;
-
-			int at = findLocalCandidate(pair.local.addr.addr, pair.local.addr.port);
-			Q_ASSERT(at != -1);
-
-			IceComponent::Candidate &lc = localCandidates[at];
+		// the first check goes out now, the rest are paced by Ta
+		if(!checkTimer->isActive())
+		{
+			if(canStartCheck())
+				startNextCheck();
+			if(!checkList.waiting.isEmpty())
+				checkTimer->start();
+		}
+	}
 
-			Component &c = components[findComponent(lc.info.componentId)];
+	// add pair to the check list in order, unless it duplicates one
+	//   already present.  returns the position, or -1
+	int insertPair(CandidatePair pair)
+	{
+		QString key = pair_key(pair);
+		if(checkList.keys.contains(key))
+			return -1;
 
-			pair.pool = new StunTransactionPool(StunTransaction::Udp, this);
-			connect(pair.pool, SIGNAL(outgoingMessage(const QByteArray &, const QHostAddress &, int)), SLOT(pool_outgoingMessage(const QByteArray &, const QHostAddress &, int)));
-			//pair.pool->setUsername(peerUser + ':' + localUser);
-			//pair.pool->setPassword(peerPass.toUtf8());
+		printf("%d, %s:%d -> %s:%d\n", pair.local.componentId, qPrintable(pair.local.addr.addr.toString()), pair.local.addr.port, qPrintable(pair.remote.addr.addr.toString()), pair.remote.addr.port);
 
-			pair.binding = new StunBinding(pair.pool);
-			connect(pair.binding, SIGNAL(success()), SLOT(binding_success()));
+		pair.foundation = pair.local.foundation + pair.remote.foundation;
+		pair.serial = nextPairSerial++;
 
-			int prflx_priority = c.ic->peerReflexivePriority(lc.iceTransport, lc.path);
-			pair.binding->setPriority(prflx_priority);
+		// FIXME: for now all pairs are unfrozen immediately
+		pair.state = PWaiting;
 
-			if(mode == Ice176::Initiator)
-			{
-				pair.binding->setIceControlling(0);
-				pair.binding->setUseCandidate(true);
-			}
+		// binary search for the insert position.  equal pairs go
+		//   after the ones already present
+		int lo = 0;
+		int hi = checkList.pairs.count();
+		while(lo < hi)
+		{
+			int mid = (lo + hi) / 2;
+			if(compare_pair(pair, checkList.pairs[mid]) < 0)
+				hi = mid;
 			else
-				pair.binding->setIceControlled(0);
-
-			pair.binding->setShortTermUsername(peerUser + ':' + localUser);
-			pair.binding->setShortTermPassword(peerPass);
-
-			pair.binding->start();
+				lo = mid + 1;
 		}
+
+		checkList.pairs.insert(lo, pair);
+		checkList.keys.insert(key, pair.serial);
+		checkList.positionsValid = false;
+		return lo;
 	}
 
-	void write(int componentIndex, const QByteArray &datagram)
+	// a check arrived over a connection to our passive tcp candidate.
+	//   the peer's active side only told us port 9, so the pair is
+	//   made here, with the address it connected from, and checked
+	//   back over the same connection (RFC 6544 section 7.2)
+	void triggerTcpCheck(const IceComponent::Candidate &cc, const QHostAddress &fromAddr, int fromPort, int priority)
 	{
-		int at = -1;
-		for(int n = 0; n < checkList.pairs.count(); ++n)
-		{
-			if(checkList.pairs[n].local.componentId - 1 == componentIndex && checkList.pairs[n].isValid)
-			{
-				at = n;
-				break;
-			}
-		}
-		if(at == -1)
+		if(state != Started || peerUser.isEmpty())
 			return;
 
-		CandidatePair &pair = checkList.pairs[at];
-
-		at = findLocalCandidate(pair.local.addr.addr, pair.local.addr.port);
-		if(at == -1) // FIXME: assert?
+		if(findPair(cc.info, fromAddr, fromPort) != -1)
 			return;
 
-		IceComponent::Candidate &lc = localCandidates[at];
-
-		IceTransport *sock = lc.iceTransport;
-		int path = lc.path;
+		CandidatePair pair;
+		pair.local = cc.info;
+		pair.remote.addr.addr = fromAddr;
+		pair.remote.addr.port = fromPort;
+		pair.remote.type = IceComponent::PeerReflexiveType;
+		pair.remote.tcpType = IceComponent::TcpActive;
+		pair.remote.componentId = cc.info.componentId;
+		pair.remote.priority = priority;
+		pair.remote.base = pair.remote.addr;
+		pair.remote.network = -1;
+		pair.isDefault = false;
+		pair.isValid = false;
+		pair.isNominated = false;
+		if(mode == Ice176::Initiator)
+			pair.priority = calc_pair_priority(pair.local.priority, priority);
+		else
+			pair.priority = calc_pair_priority(priority, pair.local.priority);
 
-		sock->writeDatagram(path, datagram, pair.remote.addr.addr, pair.remote.addr.port);
+		int at = insertPair(pair);
+		if(at == -1)
+			return;
 
-		// DOR-SR?
-		QMetaObject::invokeMethod(q, "datagramsWritten", Qt::QueuedConnection, Q_ARG(int, componentIndex), Q_ARG(int, 1));
+		startCheck(checkList.pairs[at], nomination == Ice176::AggressiveNomination);
 	}
 
-	void flagComponentAsLowOverhead(int componentIndex)
+	bool canStartCheck() const
 	{
-		// FIXME: ok to assume in order?
-		Component &c = components[componentIndex];
-		c.lowOverhead = true;
-
-		// FIXME: actually do something
+		return (maxChecksInFlight <= 0 || checksInFlight < maxChecksInFlight);
 	}
 
-private:
-	int findComponent(const IceComponent *ic) const
+	// called when a check has succeeded or failed
+	void checkFinished(CandidatePair &pair, CandidatePairState state)
 	{
-		for(int n = 0; n < components.count(); ++n)
+		if(pair.state == PInProgress)
+			--checksInFlight;
+		pair.state = state;
+
+		if(!checkList.waiting.isEmpty() && !checkTimer->isActive())
+			checkTimer->start();
+
+		if(mode == Ice176::Initiator && nomination == Ice176::RegularNomination)
 		{
-			if(components[n].ic == ic)
-				return n;
+			// the binding that just finished is still emitting, so
+			//   don't replace it from here
+			QMetaObject::invokeMethod(this, "nominate", Qt::QueuedConnection);
 		}
+	}
 
-		return -1;
+	static QString path_key(const IceComponent::CandidateInfo &local, const QHostAddress &addr, int port)
+	{
+		return QString::number(local.componentId) + ';' + QString::number(local.tcpType) + ';' +
+			local.addr.addr.toString() + ';' + QString::number(local.addr.port) + ';' +
+			addr.toString() + ';' + QString::number(port);
 	}
 
-	int findComponent(int id) const
+	static QString pair_key(const CandidatePair &pair)
 	{
-		for(int n = 0; n < components.count(); ++n)
-		{
-			if(components[n].id == id)
-				return n;
-		}
+		return path_key(pair.local, pair.remote.addr.addr, pair.remote.addr.port);
+	}
 
-		return -1;
+	// true if a should be checked before b
+	static bool queue_before(const CheckQueueItem &a, const CheckQueueItem &b)
+	{
+		int c = compare_pair_props(a.remoteType, a.remoteProtocol, a.priority, b.remoteType, b.remoteProtocol, b.priority);
+		if(c != 0)
+			return (c < 0);
+
+		// older pairs first
+		return (a.serial < b.serial);
 	}
 
-	int findLocalCandidate(const IceTransport *iceTransport, int path) const
+	void queuePair(const CandidatePair &pair)
 	{
-		for(int n = 0; n < localCandidates.count(); ++n)
+		CheckQueueItem i;
+		i.serial = pair.serial;
+		i.priority = pair.priority;
+		i.remoteType = pair.remote.type;
+		i.remoteProtocol = pair.remote.addr.addr.protocol();
+
+		QList<CheckQueueItem> &h = checkList.waiting;
+		h += i;
+
+		// sift up
+		int at = h.count() - 1;
+		while(at > 0)
 		{
-			const IceComponent::Candidate &cc = localCandidates[n];
-			if(cc.iceTransport == iceTransport && cc.path == path)
-				return n;
+			int parent = (at - 1) / 2;
+			if(!queue_before(h[at], h[parent]))
+				break;
+			h.swap(at, parent);
+			at = parent;
 		}
-
-		return -1;
 	}
 
-	int findLocalCandidate(const QHostAddress &fromAddr, int fromPort)
+	// remove the best entry from the queue and return its serial, or -1
+	//   if the queue is empty
+	int takeQueuedPair()
 	{
-		for(int n = 0; n < localCandidates.count(); ++n)
+		QList<CheckQueueItem> &h = checkList.waiting;
+		if(h.isEmpty())
+			return -1;
+
+		int serial = h.first().serial;
+		h.swap(0, h.count() - 1);
+		h.removeLast();
+
+		// sift down
+		int at = 0;
+		while(1)
 		{
-			const IceComponent::Candidate &cc = localCandidates[n];
-			if(cc.info.addr.addr == fromAddr && cc.info.addr.port == fromPort)
-				return n;
+			int best = at;
+			int left = (at * 2) + 1;
+			int right = left + 1;
+			if(left < h.count() && queue_before(h[left], h[best]))
+				best = left;
+			if(right < h.count() && queue_before(h[right], h[best]))
+				best = right;
+			if(best == at)
+				break;
+			h.swap(at, best);
+			at = best;
 		}
 
-		return -1;
+		return serial;
 	}
 
-	static QString candidateType_to_string(IceComponent::CandidateType type)
+	int findPairBySerial(int serial) const
 	{
-		QString out;
-		switch(type)
+		if(!checkList.positionsValid)
 		{
-			case IceComponent::HostType: out = "host"; break;
-			case IceComponent::PeerReflexiveType: out = "prflx"; break;
-			case IceComponent::ServerReflexiveType: out = "srflx"; break;
-			case IceComponent::RelayedType: out = "relay"; break;
-			default: Q_ASSERT(0);
+			checkList.positions.clear();
+			for(int n = 0; n < checkList.pairs.count(); ++n)
+				checkList.positions.insert(checkList.pairs[n].serial, n);
+			checkList.positionsValid = true;
 		}
-		return out;
+
+		return checkList.positions.value(serial, -1);
 	}
 
-	static int string_to_candidateType(const QString &in)
+	// the pair of local candidate info and the remote address, or -1
+	int findPair(const IceComponent::CandidateInfo &info, const QHostAddress &addr, int port) const
 	{
-		if(in == "host")
-			return IceComponent::HostType;
-		else if(in == "prflx")
-			return IceComponent::PeerReflexiveType;
-		else if(in == "srflx")
-			return IceComponent::ServerReflexiveType;
-		else if(in == "relay")
-			return IceComponent::RelayedType;
-		else
+		QHash<QString, int>::const_iterator it = checkList.keys.find(path_key(info, addr, port));
+		if(it == checkList.keys.constEnd())
 			return -1;
+
+		return findPairBySerial(it.value());
 	}
 
-	static int compare_pair(const CandidatePair &a, const CandidatePair &b)
+	// the pair a check or consent pool belongs to, or -1
+	int findPairByPool(StunTransactionPool *pool) const
 	{
-		// prefer remote srflx, for leap
-		if(a.remote.type == IceComponent::ServerReflexiveType && b.remote.type != IceComponent::ServerReflexiveType && b.remote.addr.addr.protocol() != QAbstractSocket::IPv6Protocol)
-			return -1;
-		else if(b.remote.type == IceComponent::ServerReflexiveType && a.remote.type != IceComponent::ServerReflexiveType && a.remote.addr.addr.protocol() != QAbstractSocket::IPv6Protocol)
-			return 1;
-
-		if(a.priority > b.priority)
+		QHash<StunTransactionPool*, int>::const_iterator it = checkList.pools.find(pool);
+		if(it == checkList.pools.constEnd())
 			return -1;
-		else if(b.priority > a.priority)
-			return 1;
 
-		return 0;
+		return findPairBySerial(it.value());
 	}
 
-private slots:
-	void postStop()
+	StunTransactionPool *createPool(const CandidatePair &pair)
 	{
-		state = Stopped;
-		emit q->stopped();
+		// no retransmissions over tcp
+		StunTransactionPool *pool = new StunTransactionPool(pair.local.tcpType != IceComponent::NoTcp ? StunTransaction::Tcp : StunTransaction::Udp, this);
+		connect(pool, SIGNAL(outgoingMessage(const QByteArray &, const QHostAddress &, int)), SLOT(pool_outgoingMessage(const QByteArray &, const QHostAddress &, int)));
+		checkList.pools.insert(pool, pair.serial);
+		return pool;
 	}
 
-	void ic_candidateAdded(const XMPP::IceComponent::Candidate &_cc)
+	void destroyPool(StunTransactionPool *pool)
 	{
-		IceComponent::Candidate cc = _cc;
-		cc.info.id = randomCredential(10); // FIXME: ensure unique
-		cc.info.foundation = "0"; // FIXME
-		// TODO
-		localCandidates += cc;
+		checkList.pools.remove(pool);
 
-		printf("C%d: candidate added: %s;%d\n", cc.info.componentId, qPrintable(cc.info.addr.addr.toString()), cc.info.addr.port);
+		pool->disconnect(this);
+		pool->setParent(0);
+		pool->deleteLater();
+	}
 
-		if(!iceTransports.contains(cc.iceTransport))
+	// start the best waiting check.  returns false if there was none
+	bool startNextCheck()
+	{
+		while(1)
+		{
+			int serial = takeQueuedPair();
+			if(serial == -1)
+				return false;
+
+			// skip pairs that were removed or started meanwhile
+			int at = findPairBySerial(serial);
+			if(at == -1 || checkList.pairs[at].state != PWaiting)
+				continue;
+
+			startCheck(checkList.pairs[at], nomination == Ice176::AggressiveNomination);
+			return true;
+		}
+	}
+
+	void releaseCheck(CandidatePair &pair)
+	{
+		if(pair.state == PInProgress)
+			--checksInFlight;
+
+		delete pair.binding;
+		pair.binding = 0;
+
+		if(pair.pool)
+		{
+			destroyPool(pair.pool);
+			pair.pool = 0;
+		}
+	}
+
+	void removePair(int at)
+	{
+		CandidatePair &pair = checkList.pairs[at];
+		int componentId = pair.local.componentId;
+		int serial = pair.serial;
+
+		releaseCheck(pair);
+
+		checkList.keys.remove(pair_key(pair));
+		checkList.pairs.removeAt(at);
+		checkList.positionsValid = false;
+
+		int cat = findComponent(componentId);
+		if(cat != -1 && components[cat].selectedSerial == serial)
+		{
+			// fall back to the best remaining valid pair
+			int next = -1;
+			for(int n = 0; n < checkList.pairs.count(); ++n)
+			{
+				if(checkList.pairs[n].local.componentId == componentId && checkList.pairs[n].isValid)
+				{
+					next = checkList.pairs[n].serial;
+					break;
+				}
+			}
+
+			selectPair(components[cat], next);
+		}
+	}
+
+	// make serial the selected pair of the component (-1 for none), and
+	//   report the change.  the report is queued since this may be
+	//   called while iterating the check list
+	void selectPair(Component &c, int serial)
+	{
+		bool hadPair = (c.selectedSerial != -1);
+		c.selectedSerial = serial;
+
+		// consent is per pair
+		releaseConsent(c);
+		c.consentValid = false;
+
+		if(hadPair)
+		{
+			++c.pairChanges;
+			QMetaObject::invokeMethod(q, "selectedPairChanged", Qt::QueuedConnection, Q_ARG(int, c.id - 1));
+		}
+
+		if(serial != -1 && !consentTimer->isActive())
+			consentTimer->start();
+	}
+
+	// safe to call from the binding's own signals
+	void releaseConsent(Component &c)
+	{
+		if(c.consentBinding)
+		{
+			c.consentBinding->disconnect(this);
+			c.consentBinding->setParent(0);
+			c.consentBinding->deleteLater();
+			c.consentBinding = 0;
+		}
+
+		if(c.consentPool)
+		{
+			destroyPool(c.consentPool);
+			c.consentPool = 0;
+		}
+
+		c.consentSerial = -1;
+	}
+
+	// RFC 6298 smoothing, with a granularity of 1ms
+	static void addRttSample(CandidatePair &pair, int rtt)
+	{
+		if(pair.srtt == -1)
+		{
+			pair.srtt = rtt;
+			pair.rttvar = rtt / 2;
+		}
+		else
+		{
+			pair.rttvar = (3 * pair.rttvar + qAbs(pair.srtt - rtt)) / 4;
+			pair.srtt = (7 * pair.srtt + rtt) / 8;
+		}
+	}
+
+	StunBinding *createBinding(CandidatePair &pair, StunTransactionPool *pool, bool useCandidate)
+	{
+		int at = findLocalCandidate(pair.local);
+		Q_ASSERT(at != -1);
+
+		IceComponent::Candidate &lc = localCandidates[at];
+
+		Component &c = components[findComponent(lc.info.componentId)];
+
+		StunBinding *binding = new StunBinding(pool);
+
+		int prflx_priority = c.ic->peerReflexivePriority(lc.iceTransport, lc.path);
+		binding->setPriority(prflx_priority);
+
+		if(mode == Ice176::Initiator)
+		{
+			binding->setIceControlling(0);
+			if(useCandidate)
+				binding->setUseCandidate(true);
+		}
+		else
+			binding->setIceControlled(0);
+
+		binding->setShortTermUsername(peerUser + ':' + localUser);
+		binding->setShortTermPassword(peerPass);
+
+		return binding;
+	}
+
+	Ice176::ComponentStats stats(int componentIndex) const
+	{
+		Ice176::ComponentStats out;
+
+		int cat = findComponent(componentIndex + 1);
+		if(cat == -1)
+			return out;
+
+		const Component &c = components[cat];
+		out.pairChanges = c.pairChanges;
+
+		int at = (c.selectedSerial != -1 ? findPairBySerial(c.selectedSerial) : -1);
+		if(at == -1)
+			return out;
+
+		const CandidatePair &pair = checkList.pairs[at];
+		out.hasSelectedPair = true;
+		out.localType = candidateType_to_string(pair.local.type);
+		out.localAddr = pair.local.addr.addr;
+		out.localPort = pair.local.addr.port;
+		out.remoteType = candidateType_to_string(pair.remote.type);
+		out.remoteAddr = pair.remote.addr.addr;
+		out.remotePort = pair.remote.addr.port;
+		out.isRelayed = (pair.local.type == IceComponent::RelayedType);
+		out.rtt = pair.srtt;
+		out.rttVariance = pair.rttvar;
+		out.consentRequests = pair.consentRequests;
+		out.consentResponses = pair.consentResponses;
+		out.consentAge = (c.consentValid ? c.consentTime.elapsed() : -1);
+		out.packetsSent = pair.packetsSent;
+		out.bytesSent = pair.bytesSent;
+		out.packetsReceived = pair.packetsReceived;
+		out.bytesReceived = pair.bytesReceived;
+		return out;
+	}
+
+	void startCheck(CandidatePair &pair, bool useCandidate)
+	{
+		pair.state = PInProgress;
+		pair.nominating = (mode == Ice176::Initiator && useCandidate);
+		++checksInFlight;
+
+		pair.pool = createPool(pair);
+		//pair.pool->setUsername(peerUser + ':' + localUser);
+		//pair.pool->setPassword(peerPass.toUtf8());
+
+		pair.binding = createBinding(pair, pair.pool, useCandidate);
+		connect(pair.binding, SIGNAL(success()), SLOT(binding_success()));
+		connect(pair.binding, SIGNAL(error(XMPP::StunBinding::Error)), SLOT(binding_error(XMPP::StunBinding::Error)));
+
+		pair.checkTime.start();
+		pair.binding->start();
+	}
+
+	// returns the index of the valid pair for the component, and the
+	//   local transport and path to send it through, or -1
+	int findWritePair(int componentIndex, IceTransport **sock, int *path)
+	{
+		int cat = findComponent(componentIndex + 1);
+		if(cat == -1 || components[cat].selectedSerial == -1)
+			return -1;
+
+		int at = findPairBySerial(components[cat].selectedSerial);
+		if(at == -1)
+			return -1;
+
+		CandidatePair &pair = checkList.pairs[at];
+
+		int lat = findLocalCandidate(pair.local);
+		if(lat == -1) // FIXME: assert?
+			return -1;
+
+		IceComponent::Candidate &lc = localCandidates[lat];
+		*sock = lc.iceTransport;
+		*path = lc.path;
+		return at;
+	}
+
+	void write(int componentIndex, const QByteArray &datagram)
+	{
+		IceTransport *sock;
+		int path;
+		int at = findWritePair(componentIndex, &sock, &path);
+		if(at == -1)
+			return;
+
+		CandidatePair &pair = checkList.pairs[at];
+		sock->writeDatagram(path, datagram, pair.remote.addr.addr, pair.remote.addr.port);
+
+		++pair.packetsSent;
+		pair.bytesSent += datagram.size();
+
+		// DOR-SR?
+		QMetaObject::invokeMethod(q, "datagramsWritten", Qt::QueuedConnection, Q_ARG(int, componentIndex), Q_ARG(int, 1));
+	}
+
+	void write(int componentIndex, const QList<QByteArray> &datagrams)
+	{
+		if(datagrams.isEmpty())
+			return;
+
+		IceTransport *sock;
+		int path;
+		int at = findWritePair(componentIndex, &sock, &path);
+		if(at == -1)
+			return;
+
+		CandidatePair &pair = checkList.pairs[at];
+		sock->writeDatagrams(path, datagrams, pair.remote.addr.addr, pair.remote.addr.port);
+
+		pair.packetsSent += datagrams.count();
+		foreach(const QByteArray &datagram, datagrams)
+			pair.bytesSent += datagram.size();
+
+		QMetaObject::invokeMethod(q, "datagramsWritten", Qt::QueuedConnection, Q_ARG(int, componentIndex), Q_ARG(int, datagrams.count()));
+	}
+
+	void flagComponentAsLowOverhead(int componentIndex)
+	{
+		// FIXME: ok to assume in order?
+		Component &c = components[componentIndex];
+		c.lowOverhead = true;
+
+		// FIXME: actually do something
+	}
+
+private:
+	int findComponent(const IceComponent *ic) const
+	{
+		for(int n = 0; n < components.count(); ++n)
+		{
+			if(components[n].ic == ic)
+				return n;
+		}
+
+		return -1;
+	}
+
+	int findComponent(int id) const
+	{
+		for(int n = 0; n < components.count(); ++n)
+		{
+			if(components[n].id == id)
+				return n;
+		}
+
+		return -1;
+	}
+
+	int findLocalCandidate(const IceTransport *iceTransport, int path) const
+	{
+		for(int n = 0; n < localCandidates.count(); ++n)
+		{
+			const IceComponent::Candidate &cc = localCandidates[n];
+			if(cc.iceTransport == iceTransport && cc.path == path)
+				return n;
+		}
+
+		return -1;
+	}
+
+	// udp and tcp candidates may share an address and port
+	static bool isSameLocal(const IceComponent::CandidateInfo &a, const IceComponent::CandidateInfo &b)
+	{
+		return (a.addr == b.addr && a.tcpType == b.tcpType);
+	}
+
+	int findLocalCandidate(const IceComponent::CandidateInfo &info)
+	{
+		for(int n = 0; n < localCandidates.count(); ++n)
+		{
+			if(isSameLocal(localCandidates[n].info, info))
+				return n;
+		}
+
+		return -1;
+	}
+
+	static Ice176::Candidate exportCandidate(const IceComponent::Candidate &cc)
+	{
+		Ice176::Candidate c;
+		c.component = cc.info.componentId;
+		c.foundation = cc.info.foundation;
+		c.generation = 0; // TODO
+		c.id = cc.info.id;
+		c.ip = cc.info.addr.addr;
+		c.ip.setScopeId(QString());
+		c.network = cc.info.network;
+		c.port = cc.info.addr.port;
+		c.priority = cc.info.priority;
+		if(cc.info.tcpType != IceComponent::NoTcp)
+		{
+			c.protocol = "tcp";
+			c.tcptype = tcpType_to_string(cc.info.tcpType);
+		}
+		else
+			c.protocol = "udp";
+		if(cc.info.type != IceComponent::HostType)
+		{
+			c.rel_addr = cc.info.base.addr;
+			c.rel_addr.setScopeId(QString());
+			c.rel_port = cc.info.base.port;
+		}
+		else
+		{
+			c.rel_addr = QHostAddress();
+			c.rel_port = -1;
+		}
+		c.rem_addr = QHostAddress();
+		c.rem_port = -1;
+		c.type = candidateType_to_string(cc.info.type);
+		return c;
+	}
+
+	static QString tcpType_to_string(IceComponent::TcpType type)
+	{
+		if(type == IceComponent::TcpActive)
+			return "active";
+		else if(type == IceComponent::TcpPassive)
+			return "passive";
+		else
+			return QString();
+	}
+
+	// -1 for kinds we don't do, such as simultaneous-open
+	static int string_to_tcpType(const QString &in)
+	{
+		if(in == "active")
+			return IceComponent::TcpActive;
+		else if(in == "passive")
+			return IceComponent::TcpPassive;
+		else
+			return -1;
+	}
+
+	static QString candidateType_to_string(IceComponent::CandidateType type)
+	{
+		QString out;
+		switch(type)
+		{
+			case IceComponent::HostType: out = "host"; break;
+			case IceComponent::PeerReflexiveType: out = "prflx"; break;
+			case IceComponent::ServerReflexiveType: out = "srflx"; break;
+			case IceComponent::RelayedType: out = "relay"; break;
+			default: Q_ASSERT(0);
+		}
+		return out;
+	}
+
+	static int string_to_candidateType(const QString &in)
+	{
+		if(in == "host")
+			return IceComponent::HostType;
+		else if(in == "prflx")
+			return IceComponent::PeerReflexiveType;
+		else if(in == "srflx")
+			return IceComponent::ServerReflexiveType;
+		else if(in == "relay")
+			return IceComponent::RelayedType;
+		else
+			return -1;
+	}
+
+	static int compare_pair_props(IceComponent::CandidateType aType, QAbstractSocket::NetworkLayerProtocol aProtocol, qint64 aPriority, IceComponent::CandidateType bType, QAbstractSocket::NetworkLayerProtocol bProtocol, qint64 bPriority)
+	{
+		// prefer remote srflx, for leap
+		if(aType == IceComponent::ServerReflexiveType && bType != IceComponent::ServerReflexiveType && bProtocol != QAbstractSocket::IPv6Protocol)
+			return -1;
+		else if(bType == IceComponent::ServerReflexiveType && aType != IceComponent::ServerReflexiveType && aProtocol != QAbstractSocket::IPv6Protocol)
+			return 1;
+
+		if(aPriority > bPriority)
+			return -1;
+		else if(bPriority > aPriority)
+			return 1;
+
+		return 0;
+	}
+
+	static int compare_pair(const CandidatePair &a, const CandidatePair &b)
+	{
+		return compare_pair_props(a.remote.type, a.remote.addr.addr.protocol(), a.priority, b.remote.type, b.remote.addr.addr.protocol(), b.priority);
+	}
+
+	// application data from the transport of cc.  it goes to the
+	//   handler of its component if there is one, otherwise it is
+	//   queued.  returns the component index if it was queued, or -1
+	int takeData(const IceComponent::Candidate &cc, const QByteArray &buf, const QHostAddress &fromAddr, int fromPort)
+	{
+		// prefer the pair the packet actually came in on, for
+		//   the statistics
+		int at = findPair(cc.info, fromAddr, fromPort);
+		if(at == -1)
+		{
+			for(int n = 0; n < checkList.pairs.count(); ++n)
+			{
+				if(isSameLocal(checkList.pairs[n].local, cc.info))
+				{
+					at = n;
+					break;
+				}
+			}
+		}
+		if(at == -1)
+		{
+			printf("the local transport does not seem to be associated with a candidate?!\n");
+			return -1;
+		}
+
+		CandidatePair &pair = checkList.pairs[at];
+		++pair.packetsReceived;
+		pair.bytesReceived += buf.size();
+
+		// FIXME: this assumes components are ordered by id in our local arrays
+		int componentIndex = pair.local.componentId - 1;
+
+		Ice176::DatagramHandler *handler = (componentIndex < handlers.count() ? handlers[componentIndex] : 0);
+		if(handler)
+		{
+			handler->datagramReceived(componentIndex, buf);
+			return -1;
+		}
+
+		in[componentIndex].push(buf);
+		return componentIndex;
+	}
+
+private slots:
+	void relayProbe_finished()
+	{
+		QList<int> rtts = relayProbe->rtts();
+		relayProbe->disconnect(this);
+		relayProbe->deleteLater();
+		relayProbe = 0;
+
+		if(useStunRelayUdp)
+			pickRelay(rtts, &stunRelayUdpAddr, &stunRelayUdpPort, &stunRelayUdpUser, &stunRelayUdpPass, moreRelaysUdp);
+		if(useStunRelayTcp)
+			pickRelay(rtts, &stunRelayTcpAddr, &stunRelayTcpPort, &stunRelayTcpUser, &stunRelayTcpPass, moreRelaysTcp);
+
+		startComponents();
+	}
+
+	void postStop()
+	{
+		state = Stopped;
+		emit q->stopped();
+	}
+
+	void ic_candidateAdded(const XMPP::IceComponent::Candidate &_cc)
+	{
+		IceComponent::Candidate cc = _cc;
+		cc.info.id = randomCredential(10); // FIXME: ensure unique
+		cc.info.foundation = "0"; // FIXME
+		// TODO
+		localCandidates += cc;
+
+		printf("C%d: candidate added: %s;%d\n", cc.info.componentId, qPrintable(cc.info.addr.addr.toString()), cc.info.addr.port);
+
+		if(!iceTransports.contains(cc.iceTransport))
 		{
 			connect(cc.iceTransport, SIGNAL(readyRead(int)), SLOT(it_readyRead(int)));
 			connect(cc.iceTransport, SIGNAL(datagramsWritten(int, int, const QHostAddress &, int)), SLOT(it_datagramsWritten(int, int, const QHostAddress &, int)));
@@ -714,32 +1568,7 @@ private slots:
 		{
 			QList<Ice176::Candidate> list;
 
-			Ice176::Candidate c;
-			c.component = cc.info.componentId;
-			c.foundation = cc.info.foundation;
-			c.generation = 0; // TODO
-			c.id = cc.info.id;
-			c.ip = cc.info.addr.addr;
-			c.ip.setScopeId(QString());
-			c.network = cc.info.network;
-			c.port = cc.info.addr.port;
-			c.priority = cc.info.priority;
-			c.protocol = "udp";
-			if(cc.info.type != IceComponent::HostType)
-			{
-				c.rel_addr = cc.info.base.addr;
-				c.rel_addr.setScopeId(QString());
-				c.rel_port = cc.info.base.port;
-			}
-			else
-			{
-				c.rel_addr = QHostAddress();
-				c.rel_port = -1;
-			}
-			c.rem_addr = QHostAddress();
-			c.rem_port = -1;
-			c.type = candidateType_to_string(cc.info.type);
-			list += c;
+			list += exportCandidate(cc);
 
 			emit q->localCandidatesReady(list);
 		}
@@ -782,19 +1611,7 @@ private slots:
 		{
 			if(idList.contains(checkList.pairs[n].local.id))
 			{
-				StunBinding *binding = checkList.pairs[n].binding;
-				StunTransactionPool *pool = checkList.pairs[n].pool;
-
-				delete binding;
-
-				if(pool)
-				{
-					pool->disconnect(this);
-					pool->setParent(0);
-					pool->deleteLater();
-				}
-
-				checkList.pairs.removeAt(n);
+				removePair(n);
 				--n; // adjust position
 			}
 		}
@@ -826,9 +1643,8 @@ private slots:
 
 			if(!useTrickle)
 			{
-				// FIXME: there should be a way to not wait if
-				//   we know for sure there is nothing else
-				//   possibly coming
+				// cut short by ic_gatheringComplete() once we
+				//   know for sure there is nothing else coming
 				collectTimer = new QTimer(this);
 				connect(collectTimer, SIGNAL(timeout()), SLOT(collect_timeout()));
 				collectTimer->setSingleShot(true);
@@ -840,38 +1656,54 @@ private slots:
 			QList<Ice176::Candidate> list;
 			foreach(const IceComponent::Candidate &cc, localCandidates)
 			{
-				Ice176::Candidate c;
-				c.component = cc.info.componentId;
-				c.foundation = cc.info.foundation;
-				c.generation = 0; // TODO
-				c.id = cc.info.id;
-				c.ip = cc.info.addr.addr;
-				c.ip.setScopeId(QString());
-				c.network = cc.info.network;
-				c.port = cc.info.addr.port;
-				c.priority = cc.info.priority;
-				c.protocol = "udp";
-				if(cc.info.type != IceComponent::HostType)
-				{
-					c.rel_addr = cc.info.base.addr;
-					c.rel_addr.setScopeId(QString());
-					c.rel_port = cc.info.base.port;
-				}
-				else
-				{
-					c.rel_addr = QHostAddress();
-					c.rel_port = -1;
-				}
-				c.rem_addr = QHostAddress();
-				c.rem_port = -1;
-				c.type = candidateType_to_string(cc.info.type);
-				list += c;
+				list += exportCandidate(cc);
 			}
 			if(!list.isEmpty())
 				emit q->localCandidatesReady(list);
 		}
 	}
 
+	void ic_reflexiveAddressFound(const QHostAddress &base, const QHostAddress &addr)
+	{
+		IceComponent *ic = (IceComponent *)sender();
+		int at = findComponent(ic);
+		Q_ASSERT(at != -1);
+
+		if(at != 0 || !(sharedStunBind || rtcpMux))
+			return;
+
+		for(int n = 1; n < components.count(); ++n)
+			components[n].ic->setReflexiveAddress(base, addr);
+	}
+
+	void ic_gatheringComplete()
+	{
+		IceComponent *ic = (IceComponent *)sender();
+		int at = findComponent(ic);
+		Q_ASSERT(at != -1);
+
+		components[at].gatheringComplete = true;
+
+		foreach(const Component &c, components)
+		{
+			if(!c.gatheringComplete)
+				return;
+		}
+
+		QPointer<QObject> self = this;
+
+		// nothing else can come, so don't wait out the collect timer
+		if(collectTimer)
+		{
+			collectTimer->stop();
+			collect_timeout();
+			if(!self)
+				return;
+		}
+
+		emit q->endOfCandidates();
+	}
+
 	void ic_stopped()
 	{
 		IceComponent *ic = (IceComponent *)sender();
@@ -913,32 +1745,7 @@ private slots:
 		QList<Ice176::Candidate> list;
 		foreach(const IceComponent::Candidate &cc, localCandidates)
 		{
-			Ice176::Candidate c;
-			c.component = cc.info.componentId;
-			c.foundation = cc.info.foundation;
-			c.generation = 0; // TODO
-			c.id = cc.info.id;
-			c.ip = cc.info.addr.addr;
-			c.ip.setScopeId(QString());
-			c.network = cc.info.network;
-			c.port = cc.info.addr.port;
-			c.priority = cc.info.priority;
-			c.protocol = "udp";
-			if(cc.info.type != IceComponent::HostType)
-			{
-				c.rel_addr = cc.info.base.addr;
-				c.rel_addr.setScopeId(QString());
-				c.rel_port = cc.info.base.port;
-			}
-			else
-			{
-				c.rel_addr = QHostAddress();
-				c.rel_port = -1;
-			}
-			c.rem_addr = QHostAddress();
-			c.rem_port = -1;
-			c.type = candidateType_to_string(cc.info.type);
-			list += c;
+			list += exportCandidate(cc);
 		}
 		if(!list.isEmpty())
 			emit q->localCandidatesReady(list);
@@ -954,6 +1761,9 @@ private slots:
 
 		IceTransport *sock = it;
 
+		// readyRead() once per component for the whole batch
+		QList<int> readyComponents;
+
 		while(sock->hasPendingDatagrams(path))
 		{
 			QHostAddress fromAddr;
@@ -962,6 +1772,16 @@ private slots:
 
 			//printf("port %d: received packet (%d bytes)\n", lt->sock->localPort(), buf.size());
 
+			// media doesn't look like stun, so it skips the
+			//   message parsing
+			if(!StunMessage::isProbablyStun(buf))
+			{
+				int componentIndex = takeData(cc, buf, fromAddr, fromPort);
+				if(componentIndex != -1 && !readyComponents.contains(componentIndex))
+					readyComponents += componentIndex;
+				continue;
+			}
+
 			QString requser = localUser + ':' + peerUser;
 			QByteArray reqkey = localPass.toUtf8();
 
@@ -970,7 +1790,9 @@ private slots:
 			if(!msg.isNull() && (msg.mclass() == StunMessage::Request || msg.mclass() == StunMessage::Indication))
 			{
 				printf("received validated request or indication from %s:%d\n", qPrintable(fromAddr.toString()), fromPort);
-				QString user = QString::fromUtf8(msg.attribute(0x0006)); // USERNAME
+				int ulen;
+				const quint8 *u = msg.attributeData(0x0006, &ulen); // USERNAME
+				QString user = u ? QString::fromUtf8((const char *)u, ulen) : QString();
 				if(requser != user)
 				{
 					printf("user [%s] is wrong.  it should be [%s].  skipping\n", qPrintable(user), qPrintable(requser));
@@ -983,16 +1805,18 @@ private slots:
 					continue;
 				}
 
-				StunMessage response;
-				response.setClass(StunMessage::SuccessResponse);
-				response.setMethod(0x001);
-				response.setId(msg.id());
+				// one of these goes out for every check the peer
+				//   makes, so build it in place
+				quint8 out[ICE_RESPONSE_SIZE];
+				StunMessage::Writer w(out, sizeof(out));
+				w.begin(StunMessage::SuccessResponse, 0x001, msg.id());
 
 				quint16 port16 = fromPort;
 				quint32 addr4 = fromAddr.toIPv4Address();
-				QByteArray val(8, 0);
-				quint8 *p = (quint8 *)val.data();
-				const quint8 *magic = response.magic();
+				const quint8 *magic = msg.magic();
+				quint8 *p = w.appendAttribute(0x0020, 8); // XOR-MAPPED-ADDRESS
+				if(!p)
+					continue;
 				p[0] = 0;
 				p[1] = 0x01;
 				p[2] = (port16 >> 8) & 0xff;
@@ -1008,16 +1832,20 @@ private slots:
 				p[7] = addr4 & 0xff;
 				p[7] ^= magic[3];
 
-				QList<StunMessage::Attribute> list;
-				StunMessage::Attribute attr;
-				attr.type = 0x0020;
-				attr.value = val;
-				list += attr;
-
-				response.setAttributes(list);
+				int size = w.finish(StunMessage::MessageIntegrity | StunMessage::Fingerprint, reqkey);
+				if(size == -1)
+					continue;
 
-				QByteArray packet = response.toBinary(StunMessage::MessageIntegrity | StunMessage::Fingerprint, reqkey);
+				QByteArray packet((const char *)out, size);
 				sock->writeDatagram(path, packet, fromAddr, fromPort);
+
+				if(cc.info.tcpType == IceComponent::TcpPassive)
+				{
+					int plen;
+					const quint8 *pri = msg.attributeData(0x0024, &plen); // PRIORITY
+					int priority = (pri && plen == 4) ? (int)StunUtil::read32(pri) : 0;
+					triggerTcpCheck(cc, fromAddr, fromPort, priority);
+				}
 			}
 			else
 			{
@@ -1027,49 +1855,97 @@ private slots:
 				{
 					printf("received validated response\n");
 
-					// FIXME: this is so gross and completely defeats the point of having pools
-					for(int n = 0; n < checkList.pairs.count(); ++n)
+					// responses come back from where the check
+					//   went, which identifies the pair
+					int at = findPair(cc.info, fromAddr, fromPort);
+					if(at == -1)
 					{
-						CandidatePair &pair = checkList.pairs[n];
-						if(pair.local.addr.addr == cc.info.addr.addr && pair.local.addr.port == cc.info.addr.port)
-							pair.pool->writeIncomingMessage(msg);
+						printf("response from %s:%d matches no pair, skipping\n", qPrintable(fromAddr.toString()), fromPort);
+						continue;
 					}
+
+					CandidatePair &pair = checkList.pairs[at];
+					int serial = pair.serial;
+					int cat = findComponent(pair.local.componentId);
+
+					if(pair.pool)
+						pair.pool->writeIncomingMessage(msg);
+
+					// looked up again, since a finished check can
+					//   move the selected pair and release consent
+					if(cat != -1 && components[cat].consentPool && components[cat].consentSerial == serial)
+						components[cat].consentPool->writeIncomingMessage(msg);
 				}
 				else
 				{
-					//printf("received some non-stun or invalid stun packet\n");
-
 					// FIXME: i don't know if this is good enough
-					if(StunMessage::isProbablyStun(buf))
-					{
-						printf("unexpected stun packet (loopback?), skipping.\n");
-						continue;
-					}
+					printf("unexpected stun packet (loopback?), skipping.\n");
+				}
+			}
+		}
 
-					int at = -1;
-					for(int n = 0; n < checkList.pairs.count(); ++n)
-					{
-						CandidatePair &pair = checkList.pairs[n];
-						if(pair.local.addr.addr == cc.info.addr.addr && pair.local.addr.port == cc.info.addr.port)
-						{
-							at = n;
-							break;
-						}
-					}
-					if(at == -1)
-					{
-						printf("the local transport does not seem to be associated with a candidate?!\n");
-						continue;
-					}
+		if(readyComponents.isEmpty())
+			return;
+
+		QPointer<QObject> self = this;
+		foreach(int componentIndex, readyComponents)
+		{
+			emit q->readyRead(componentIndex);
+			if(!self)
+				return;
+		}
+	}
+
+	void check_timeout()
+	{
+		if(checkList.waiting.isEmpty())
+		{
+			checkTimer->stop();
+			return;
+		}
+
+		// at the limit?  wait for a check to finish
+		if(!canStartCheck())
+			return;
+
+		if(!startNextCheck())
+			checkTimer->stop();
+	}
 
-					int componentIndex = checkList.pairs[at].local.componentId - 1;
-					//printf("packet is considered to be application data for component index %d\n", componentIndex);
+	// regular nomination: once all checks of a component are done,
+	//   repeat the check of its selected pair with USE-CANDIDATE
+	void nominate()
+	{
+		for(int n = 0; n < components.count(); ++n)
+		{
+			Component &c = components[n];
+			if(c.nominated || c.selectedSerial == -1)
+				continue;
 
-					// FIXME: this assumes components are ordered by id in our local arrays
-					in[componentIndex] += buf;
-					emit q->readyRead(componentIndex);
+			bool pending = false;
+			for(int k = 0; k < checkList.pairs.count(); ++k)
+			{
+				const CandidatePair &pair = checkList.pairs[k];
+				if(pair.local.componentId == c.id && (pair.state == PWaiting || pair.state == PInProgress))
+				{
+					pending = true;
+					break;
 				}
 			}
+			if(pending)
+				continue;
+
+			int at = findPairBySerial(c.selectedSerial);
+			if(at == -1)
+				continue;
+
+			CandidatePair &pair = checkList.pairs[at];
+			printf("nominating %s;%d -> %s;%d\n",
+				qPrintable(pair.local.addr.addr.toString()), pair.local.addr.port, qPrintable(pair.remote.addr.addr.toString()), pair.remote.addr.port);
+
+			c.nominated = true;
+			releaseCheck(pair);
+			startCheck(pair, true);
 		}
 	}
 
@@ -1087,22 +1963,13 @@ private slots:
 		Q_UNUSED(addr);
 		Q_UNUSED(port);
 
-		StunTransactionPool *pool = (StunTransactionPool *)sender();
-		int at = -1;
-		for(int n = 0; n < checkList.pairs.count(); ++n)
-		{
-			if(checkList.pairs[n].pool == pool)
-			{
-				at = n;
-				break;
-			}
-		}
+		int at = findPairByPool((StunTransactionPool *)sender());
 		if(at == -1) // FIXME: assert?
 			return;
 
 		CandidatePair &pair = checkList.pairs[at];
 
-		at = findLocalCandidate(pair.local.addr.addr, pair.local.addr.port);
+		at = findLocalCandidate(pair.local);
 		if(at == -1) // FIXME: assert?
 			return;
 
@@ -1117,22 +1984,19 @@ private slots:
 
 	void binding_success()
 	{
+		// the binding belongs to the pool of its pair
 		StunBinding *binding = (StunBinding *)sender();
-		int at = -1;
-		for(int n = 0; n < checkList.pairs.count(); ++n)
-		{
-			if(checkList.pairs[n].binding == binding)
-			{
-				at = n;
-				break;
-			}
-		}
-		if(at == -1)
+		int at = findPairByPool((StunTransactionPool *)binding->parent());
+		if(at == -1 || checkList.pairs[at].binding != binding)
 			return;
 
 		printf("check success\n");
 
 		CandidatePair &pair = checkList.pairs[at];
+		bool wasNominating = pair.nominating;
+		pair.nominating = false;
+
+		addRttSample(pair, pair.checkTime.elapsed());
 
 		// TODO: if we were cool, we'd do something with the peer
 		//   reflexive address received
@@ -1141,39 +2005,164 @@ private slots:
 		//   that currently we check everything anyway so this is not
 		//   relevant
 
-		// check if there's a candidate already valid
-		at = -1;
-		for(int n = 0; n < checkList.pairs.count(); ++n)
-		{
-			if(checkList.pairs[n].local.componentId == pair.local.componentId && checkList.pairs[n].isValid)
-			{
-				at = n;
-				break;
-			}
-		}
+		if(wasNominating)
+			pair.isNominated = true;
 
 		pair.isValid = true;
 
-		if(at == -1)
+		int cat = findComponent(pair.local.componentId);
+		Component &c = components[cat];
+
+		// data flows on the first valid pair right away, and moves to
+		//   a better one if that turns valid later.  the check list
+		//   is sorted, so "better" means earlier in it
+		bool first = !c.ready;
+		bool promote = false;
+		if(c.selectedSerial == -1)
+			promote = true;
+		else if(c.selectedSerial != pair.serial)
+		{
+			int sat = findPairBySerial(c.selectedSerial);
+			if(sat == -1 || at < sat)
+				promote = true;
+		}
+		c.ready = true;
+
+		if(promote)
 		{
-			int at = findComponent(pair.local.componentId);
-			Component &c = components[at];
+			selectPair(c, pair.serial);
+
 			if(c.lowOverhead)
 			{
 				printf("component is flagged for low overhead.  setting up for %s;%d -> %s;%d\n",
 					qPrintable(pair.local.addr.addr.toString()), pair.local.addr.port, qPrintable(pair.remote.addr.addr.toString()), pair.remote.addr.port);
-				at = findLocalCandidate(pair.local.addr.addr, pair.local.addr.port);
-				IceComponent::Candidate &cc = localCandidates[at];
+				int lat = findLocalCandidate(pair.local);
+				IceComponent::Candidate &cc = localCandidates[lat];
 				c.ic->flagPathAsLowOverhead(cc.id, pair.remote.addr.addr, pair.remote.addr.port);
 			}
+		}
 
+		checkFinished(pair, PSucceeded);
+
+		if(first)
+		{
 			emit q->componentReady(pair.local.componentId - 1);
 		}
+		else if(promote)
+		{
+			printf("component %d promoted to %s;%d -> %s;%d\n", pair.local.componentId,
+				qPrintable(pair.local.addr.addr.toString()), pair.local.addr.port, qPrintable(pair.remote.addr.addr.toString()), pair.remote.addr.port);
+		}
 		else
 		{
 			printf("component %d already active, not signalling\n", pair.local.componentId);
 		}
 	}
+
+	void consent_timeout()
+	{
+		bool any = false;
+		for(int n = 0; n < components.count(); ++n)
+		{
+			Component &c = components[n];
+			if(c.selectedSerial == -1)
+				continue;
+
+			int at = findPairBySerial(c.selectedSerial);
+			if(at == -1)
+				continue;
+
+			any = true;
+
+			// the previous check is still going?  let it be.  its
+			//   own retransmissions cover loss of single packets
+			if(c.consentBinding)
+				continue;
+
+			CandidatePair &pair = checkList.pairs[at];
+
+			releaseConsent(c);
+			c.consentPool = createPool(pair);
+			c.consentSerial = pair.serial;
+
+			c.consentBinding = createBinding(pair, c.consentPool, false);
+			connect(c.consentBinding, SIGNAL(success()), SLOT(consent_success()));
+			connect(c.consentBinding, SIGNAL(error(XMPP::StunBinding::Error)), SLOT(consent_error(XMPP::StunBinding::Error)));
+
+			++pair.consentRequests;
+			pair.checkTime.start();
+			c.consentBinding->start();
+		}
+
+		if(!any)
+			consentTimer->stop();
+	}
+
+	int findConsentComponent(StunBinding *binding) const
+	{
+		for(int n = 0; n < components.count(); ++n)
+		{
+			if(components[n].consentBinding == binding)
+				return n;
+		}
+
+		return -1;
+	}
+
+	void consent_success()
+	{
+		int cat = findConsentComponent((StunBinding *)sender());
+		if(cat == -1)
+			return;
+
+		Component &c = components[cat];
+		int at = findPairBySerial(c.consentSerial);
+		if(at != -1)
+		{
+			CandidatePair &pair = checkList.pairs[at];
+			++pair.consentResponses;
+			addRttSample(pair, pair.checkTime.elapsed());
+		}
+
+		c.consentValid = true;
+		c.consentTime.start();
+
+		releaseConsent(c);
+	}
+
+	void consent_error(XMPP::StunBinding::Error e)
+	{
+		Q_UNUSED(e);
+
+		int cat = findConsentComponent((StunBinding *)sender());
+		if(cat == -1)
+			return;
+
+		Component &c = components[cat];
+		printf("component %d: consent check failed\n", c.id);
+
+		releaseConsent(c);
+	}
+
+	void binding_error(XMPP::StunBinding::Error e)
+	{
+		Q_UNUSED(e);
+
+		// the binding belongs to the pool of its pair
+		StunBinding *binding = (StunBinding *)sender();
+		int at = findPairByPool((StunTransactionPool *)binding->parent());
+		if(at == -1 || checkList.pairs[at].binding != binding)
+			return;
+
+		printf("check failed\n");
+
+		CandidatePair &pair = checkList.pairs[at];
+		pair.nominating = false;
+
+		// a failed nomination leaves the pair valid, it just isn't
+		//   nominated
+		checkFinished(pair, pair.isValid ? PSucceeded : PFailed);
+	}
 };
 
 Ice176::Ice176(QObject *parent) :
@@ -1197,6 +2186,16 @@ void Ice176::setProxy(const TurnClient::Proxy &proxy)
 	d->proxy = proxy;
 }
 
+void Ice176::setTurnConnectionPool(TurnConnectionPool *pool)
+{
+	d->turnPool = pool;
+}
+
+void Ice176::setCandidatePool(IceCandidatePool *pool)
+{
+	d->candidatePool = pool;
+}
+
 void Ice176::setPortReserver(UdpPortReserver *portReserver)
 {
 	Q_ASSERT(d->state == Private::Stopped);
@@ -1209,6 +2208,16 @@ void Ice176::setLocalAddresses(const QList<LocalAddress> &addrs)
 	d->updateLocalAddresses(addrs);
 }
 
+void Ice176::setLocalAddressSet(IceLocalAddressSet *set)
+{
+	// for now, ignore address changes during operation
+	if(d->state != Private::Stopped)
+		return;
+
+	// the set has no duplicates, so the list can be kept as it is
+	d->localAddrs = set->addresses();
+}
+
 void Ice176::setExternalAddresses(const QList<ExternalAddress> &addrs)
 {
 	d->updateExternalAddresses(addrs);
@@ -1220,6 +2229,12 @@ void Ice176::setStunBindService(const QHostAddress &addr, int port)
 	d->stunBindPort = port;
 }
 
+void Ice176::addStunBindService(const QHostAddress &addr, int port)
+{
+	d->moreStunBindAddrs += addr;
+	d->moreStunBindPorts += port;
+}
+
 void Ice176::setStunRelayUdpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass)
 {
 	d->stunRelayUdpAddr = addr;
@@ -1236,6 +2251,26 @@ void Ice176::setStunRelayTcpService(const QHostAddress &addr, int port, const QS
 	d->stunRelayTcpPass = pass;
 }
 
+void Ice176::addStunRelayUdpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass)
+{
+	Private::RelayService rs;
+	rs.addr = addr;
+	rs.port = port;
+	rs.user = user;
+	rs.pass = pass;
+	d->moreRelaysUdp += rs;
+}
+
+void Ice176::addStunRelayTcpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass)
+{
+	Private::RelayService rs;
+	rs.addr = addr;
+	rs.port = port;
+	rs.user = user;
+	rs.pass = pass;
+	d->moreRelaysTcp += rs;
+}
+
 void Ice176::setUseLocal(bool enabled)
 {
 	d->useLocal = enabled;
@@ -1256,6 +2291,11 @@ void Ice176::setUseStunRelayTcp(bool enabled)
 	d->useStunRelayTcp = enabled;
 }
 
+void Ice176::setUseTcp(bool enabled)
+{
+	d->useTcp = enabled;
+}
+
 void Ice176::setComponentCount(int count)
 {
 	Q_ASSERT(d->state == Private::Stopped);
@@ -1263,11 +2303,40 @@ void Ice176::setComponentCount(int count)
 	d->componentCount = count;
 }
 
+int Ice176::componentCount() const
+{
+	return d->componentCount;
+}
+
 void Ice176::setLocalCandidateTrickle(bool enabled)
 {
 	d->useTrickle = enabled;
 }
 
+void Ice176::setRtcpMux(bool enabled)
+{
+	Q_ASSERT(d->state == Private::Stopped);
+
+	d->rtcpMux = enabled;
+}
+
+void Ice176::setSharedStunBind(bool enabled)
+{
+	Q_ASSERT(d->state == Private::Stopped);
+
+	d->sharedStunBind = enabled;
+}
+
+void Ice176::setNomination(Nomination nomination)
+{
+	d->nomination = nomination;
+}
+
+void Ice176::setMaxChecksInFlight(int count)
+{
+	d->maxChecksInFlight = count;
+}
+
 void Ice176::start(Mode mode)
 {
 	d->mode = mode;
@@ -1311,7 +2380,33 @@ bool Ice176::hasPendingDatagrams(int componentIndex) const
 
 QByteArray Ice176::readDatagram(int componentIndex)
 {
-	return d->in[componentIndex].takeFirst();
+	return d->in[componentIndex].take();
+}
+
+int Ice176::readDatagrams(int componentIndex, QList<QByteArray> *out, int max)
+{
+	Private::DatagramRing &ring = d->in[componentIndex];
+
+	int count = ring.count;
+	if(max >= 0 && max < count)
+		count = max;
+
+	out->reserve(out->count() + count);
+	for(int n = 0; n < count; ++n)
+		*out += ring.take();
+
+	return count;
+}
+
+void Ice176::setDatagramHandler(int componentIndex, DatagramHandler *handler)
+{
+	while(d->handlers.count() <= componentIndex)
+		d->handlers += 0;
+	d->handlers[componentIndex] = handler;
+}
+
+Ice176::DatagramHandler::~DatagramHandler()
+{
 }
 
 void Ice176::writeDatagram(int componentIndex, const QByteArray &datagram)
@@ -1319,6 +2414,16 @@ void Ice176::writeDatagram(int componentIndex, const QByteArray &datagram)
 	d->write(componentIndex, datagram);
 }
 
+void Ice176::writeDatagrams(int componentIndex, const QList<QByteArray> &datagrams)
+{
+	d->write(componentIndex, datagrams);
+}
+
+Ice176::ComponentStats Ice176::componentStats(int componentIndex) const
+{
+	return d->stats(componentIndex);
+}
+
 void Ice176::flagComponentAsLowOverhead(int componentIndex)
 {
 	d->flagComponentAsLowOverhead(componentIndex);
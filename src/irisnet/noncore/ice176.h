@@ -33,6 +33,8 @@ namespace QCA {
 namespace XMPP {
 
 class UdpPortReserver;
+class IceCandidatePool;
+class IceLocalAddressSet;
 
 class Ice176 : public QObject
 {
@@ -50,6 +52,16 @@ public:
 		Responder
 	};
 
+	enum Nomination
+	{
+		// every check carries USE-CANDIDATE
+		AggressiveNomination,
+
+		// checks run without USE-CANDIDATE, and the selected pair is
+		//   nominated by a final check once all others have finished
+		RegularNomination
+	};
+
 	class LocalAddress
 	{
 	public:
@@ -88,7 +100,8 @@ public:
 		int network; // -1 = unknown
 		int port;
 		int priority;
-		QString protocol;
+		QString protocol; // "udp" or "tcp"
+		QString tcptype; // "active" or "passive", for tcp (RFC 6544)
 		QHostAddress rel_addr;
 		int rel_port;
 		QHostAddress rem_addr;
@@ -107,6 +120,61 @@ public:
 		}
 	};
 
+	// statistics for the pair a component is currently sending on.
+	//   the rtt comes from connectivity checks and the periodic
+	//   consent checks on that pair
+	class ComponentStats
+	{
+	public:
+		bool hasSelectedPair;
+		QString localType, remoteType; // "host", "srflx", "prflx", "relay"
+		QHostAddress localAddr, remoteAddr;
+		int localPort, remotePort;
+		bool isRelayed;
+
+		int rtt; // smoothed, in msecs, -1 if unknown
+		int rttVariance;
+
+		// unanswered requests indicate loss on the path
+		int consentRequests;
+		int consentResponses;
+		int consentAge; // msecs since the last response, -1 if none
+
+		qint64 packetsSent, bytesSent;
+		qint64 packetsReceived, bytesReceived;
+
+		// number of times the selected pair has changed
+		int pairChanges;
+
+		ComponentStats() :
+			hasSelectedPair(false),
+			localPort(-1),
+			remotePort(-1),
+			isRelayed(false),
+			rtt(-1),
+			rttVariance(-1),
+			consentRequests(0),
+			consentResponses(0),
+			consentAge(-1),
+			packetsSent(0),
+			bytesSent(0),
+			packetsReceived(0),
+			bytesReceived(0),
+			pairChanges(0)
+		{
+		}
+	};
+
+	// receives datagrams without a signal per packet, see
+	//   setDatagramHandler()
+	class DatagramHandler
+	{
+	public:
+		virtual ~DatagramHandler();
+
+		virtual void datagramReceived(int componentIndex, const QByteArray &buf) = 0;
+	};
+
 	Ice176(QObject *parent = 0);
 	~Ice176();
 
@@ -114,6 +182,16 @@ public:
 
 	void setProxy(const TurnClient::Proxy &proxy);
 
+	// if set, TURN over TCP uses connections from the pool (see
+	//   TurnConnectionPool).  ownership is not passed
+	void setTurnConnectionPool(TurnConnectionPool *pool);
+
+	// if set, components take STUN ports from the pool that already know
+	//   their reflexive and relayed addresses, when the pool has them for
+	//   the same STUN/TURN services (see IceCandidatePool).  ownership is
+	//   not passed
+	void setCandidatePool(IceCandidatePool *pool);
+
 	// if set, ports will be drawn from the reserver if possible, before
 	//   binding to random ports
 	// note: ownership is not passed
@@ -121,13 +199,33 @@ public:
 
 	void setLocalAddresses(const QList<LocalAddress> &addrs);
 
+	// takes the current addresses of set, e.g. IceLocalAddressSet::instance(),
+	//   instead of a list gathered by the application.  the list is shared,
+	//   not enumerated again, and later changes to the set don't affect
+	//   this session
+	void setLocalAddressSet(IceLocalAddressSet *set);
+
 	// one per local address.  you must set local addresses first.
 	void setExternalAddresses(const QList<ExternalAddress> &addrs);
 
 	void setStunBindService(const QHostAddress &addr, int port);
+
+	// more STUN servers, asked in parallel with the one above.  the
+	//   server reflexive candidate comes from whichever answers first,
+	//   so a slow or unreachable server no longer holds up gathering
+	void addStunBindService(const QHostAddress &addr, int port);
+
 	void setStunRelayUdpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass);
 	void setStunRelayTcpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass);
 
+	// further relays to choose from, e.g. one per region.  when there is
+	//   more than one, start() first sends each a STUN binding request and
+	//   the relay is allocated on the one that answers soonest (one for
+	//   udp and one for tcp), instead of always on the one set above.
+	//   this takes up to a second longer before gathering begins
+	void addStunRelayUdpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass);
+	void addStunRelayTcpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass);
+
 	// these all start out enabled, but can be disabled for diagnostic
 	//   purposes
 	void setUseLocal(bool enabled);
@@ -135,9 +233,35 @@ public:
 	void setUseStunRelayUdp(bool enabled);
 	void setUseStunRelayTcp(bool enabled);
 
+	// also offer direct tcp host candidates (RFC 6544), which get past
+	//   networks that block udp without the relay hop of TURN.  they
+	//   rank below every udp pair but the relayed ones.  default false
+	void setUseTcp(bool enabled);
+
 	void setComponentCount(int count);
+	int componentCount() const;
 	void setLocalCandidateTrickle(bool enabled); // default false
 
+	// rtcp-mux is offered: components after the first are only a
+	//   fallback, and gather host candidates plus reflexive ones learned
+	//   from the first component, without STUN bindings or relays of
+	//   their own.  default false
+	void setRtcpMux(bool enabled);
+
+	// components after the first take their server reflexive addresses
+	//   from the first component's bindings instead of binding on their
+	//   own, assuming a NAT that keeps the port.  default false
+	void setSharedStunBind(bool enabled);
+
+	// only used in Initiator mode.  default AggressiveNomination.  in
+	//   either mode, data can flow as soon as a component has one
+	//   valid pair, and moves to a better pair if one turns valid later
+	void setNomination(Nomination nomination);
+
+	// limit on connectivity checks in progress at once.  new checks
+	//   are still paced at least 20ms apart.  default 0 (no limit)
+	void setMaxChecksInFlight(int count);
+
 	void start(Mode mode);
 	void stop();
 
@@ -151,8 +275,23 @@ public:
 
 	bool hasPendingDatagrams(int componentIndex) const;
 	QByteArray readDatagram(int componentIndex);
+
+	// take up to max queued datagrams of the component at once (all of
+	//   them if max is -1), appended to out.  returns how many
+	int readDatagrams(int componentIndex, QList<QByteArray> *out, int max = -1);
+
+	// deliver the datagrams of the component to handler as they are
+	//   read, instead of queueing them and emitting readyRead().  the
+	//   handler is called from within Ice176 and must not delete it.
+	//   pass 0 to go back to queueing.  ownership is not passed
+	void setDatagramHandler(int componentIndex, DatagramHandler *handler);
 	void writeDatagram(int componentIndex, const QByteArray &datagram);
 
+	// write several datagrams on one component at once.  where the
+	//   platform allows, they go out in a single system call, and
+	//   datagramsWritten() is emitted once with the total count
+	void writeDatagrams(int componentIndex, const QList<QByteArray> &datagrams);
+
 	// this call will ensure that TURN headers are minimized on this
 	//   component, with the drawback that packets might not be able to
 	//   be set as non-fragmentable.  use this on components that expect
@@ -161,6 +300,8 @@ public:
 	//   in short, use this on audio, but not on video.
 	void flagComponentAsLowOverhead(int componentIndex);
 
+	ComponentStats componentStats(int componentIndex) const;
+
 	// FIXME: this should probably be in netinterface.h or such
 	static bool isIPv6LinkLocalAddress(const QHostAddress &addr);
 
@@ -173,8 +314,14 @@ signals:
 	void error(XMPP::Ice176::Error e);
 
 	void localCandidatesReady(const QList<XMPP::Ice176::Candidate> &list);
+
+	// all local candidates have been announced and no more are coming
+	void endOfCandidates();
 	void componentReady(int index);
 
+	// the component has moved to a different pair, see componentStats()
+	void selectedPairChanged(int componentIndex);
+
 	void readyRead(int componentIndex);
 	void datagramsWritten(int componentIndex, int count);
 
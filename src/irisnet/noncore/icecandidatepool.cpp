@@ -0,0 +1,335 @@
+/*
+ * icecandidatepool.cpp - keep STUN/TURN candidates gathered ahead of time
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "icecandidatepool.h"
+
+#include <QTime>
+#include <QTimer>
+#include <QtCrypto>
+#include "icelocaltransport.h"
+
+// how often to look for aged transports and retry failed ones
+#define CHECK_INTERVAL 10000
+
+namespace XMPP {
+
+class IceCandidatePool::Private : public QObject
+{
+	Q_OBJECT
+
+public:
+	class Item
+	{
+	public:
+		IceLocalTransport *sock;
+		QHostAddress addr;
+		bool started;
+		bool ready;
+		QTime age;
+
+		Item() :
+			sock(0),
+			started(false),
+			ready(false)
+		{
+		}
+	};
+
+	IceCandidatePool *q;
+	QString clientSoftware;
+	QHostAddress stunBindAddr;
+	int stunBindPort;
+	QHostAddress stunRelayAddr;
+	int stunRelayPort;
+	QString stunRelayUser;
+	QCA::SecureArray stunRelayPass;
+	QList<QHostAddress> addrs;
+	int warmCount;
+	int maxAge;
+	QList<Item*> items;
+	QTimer checkTimer;
+
+	Private(IceCandidatePool *_q) :
+		QObject(_q),
+		q(_q),
+		stunBindPort(-1),
+		stunRelayPort(-1),
+		warmCount(1),
+		maxAge(90),
+		checkTimer(this)
+	{
+		connect(&checkTimer, SIGNAL(timeout()), SLOT(check()));
+		checkTimer.setInterval(CHECK_INTERVAL);
+	}
+
+	~Private()
+	{
+		while(!items.isEmpty())
+			drop(items.first());
+	}
+
+	bool haveServices() const
+	{
+		return !stunBindAddr.isNull() || (!stunRelayAddr.isNull() && !stunRelayUser.isEmpty());
+	}
+
+	int findItem(const IceLocalTransport *sock) const
+	{
+		for(int n = 0; n < items.count(); ++n)
+		{
+			if(items[n]->sock == sock)
+				return n;
+		}
+		return -1;
+	}
+
+	int countFor(const QHostAddress &addr) const
+	{
+		int count = 0;
+		foreach(const Item *i, items)
+		{
+			if(i->addr == addr)
+				++count;
+		}
+		return count;
+	}
+
+	void drop(Item *i)
+	{
+		items.removeAll(i);
+		i->sock->disconnect(this);
+
+		// let a TURN allocation be deleted on the server, rather than
+		//   left to time out there
+		if(i->ready && !stunRelayAddr.isNull())
+		{
+			connect(i->sock, SIGNAL(stopped()), i->sock, SLOT(deleteLater()));
+			connect(i->sock, SIGNAL(error(int)), i->sock, SLOT(deleteLater()));
+			i->sock->stop();
+		}
+		else
+			delete i->sock;
+
+		delete i;
+	}
+
+	void fill()
+	{
+		if(!haveServices())
+			return;
+
+		foreach(const QHostAddress &addr, addrs)
+		{
+			for(int n = countFor(addr); n < warmCount; ++n)
+			{
+				Item *i = new Item;
+				i->addr = addr;
+				i->sock = new IceLocalTransport(this);
+				connect(i->sock, SIGNAL(started()), SLOT(sock_started()));
+				connect(i->sock, SIGNAL(addressesChanged()), SLOT(sock_addressesChanged()));
+				connect(i->sock, SIGNAL(error(int)), SLOT(sock_error(int)));
+				items += i;
+
+				i->sock->setClientSoftwareNameAndVersion(clientSoftware);
+				i->sock->start(addr);
+			}
+		}
+
+		if(!items.isEmpty() && !checkTimer.isActive())
+			checkTimer.start();
+	}
+
+	bool isComplete(const Item *i) const
+	{
+		if(!stunBindAddr.isNull() && i->sock->serverReflexiveAddress().isNull())
+			return false;
+		if(!stunRelayAddr.isNull() && !stunRelayUser.isEmpty() && i->sock->relayedAddress().isNull())
+			return false;
+		return true;
+	}
+
+private slots:
+	void check()
+	{
+		QList<Item*> aged;
+		foreach(Item *i, items)
+		{
+			if(i->ready && i->age.elapsed() >= maxAge * 1000)
+				aged += i;
+		}
+		foreach(Item *i, aged)
+			drop(i);
+
+		// also brings back transports that failed
+		fill();
+
+		if(items.isEmpty())
+			checkTimer.stop();
+	}
+
+	void sock_started()
+	{
+		IceLocalTransport *sock = (IceLocalTransport *)sender();
+		int at = findItem(sock);
+		Q_ASSERT(at != -1);
+
+		Item *i = items[at];
+		i->started = true;
+		if(!stunBindAddr.isNull())
+			sock->setStunBindService(stunBindAddr, stunBindPort);
+		if(!stunRelayAddr.isNull() && !stunRelayUser.isEmpty())
+			sock->setStunRelayService(stunRelayAddr, stunRelayPort, stunRelayUser, stunRelayPass);
+		sock->stunStart();
+	}
+
+	void sock_addressesChanged()
+	{
+		IceLocalTransport *sock = (IceLocalTransport *)sender();
+		int at = findItem(sock);
+		Q_ASSERT(at != -1);
+
+		Item *i = items[at];
+		if(!i->ready && isComplete(i))
+		{
+			i->ready = true;
+			i->age.start();
+		}
+	}
+
+	void sock_error(int e)
+	{
+		Q_UNUSED(e);
+
+		IceLocalTransport *sock = (IceLocalTransport *)sender();
+		int at = findItem(sock);
+		Q_ASSERT(at != -1);
+
+		// replaced on the next check, not right away, in case the server
+		//   is down
+		Item *i = items.takeAt(at);
+		sock->disconnect(this);
+		sock->deleteLater();
+		delete i;
+	}
+};
+
+IceCandidatePool::IceCandidatePool(QObject *parent) :
+	QObject(parent)
+{
+	d = new Private(this);
+}
+
+IceCandidatePool::~IceCandidatePool()
+{
+	delete d;
+}
+
+void IceCandidatePool::setClientSoftwareNameAndVersion(const QString &str)
+{
+	d->clientSoftware = str;
+}
+
+void IceCandidatePool::setStunBindService(const QHostAddress &addr, int port)
+{
+	d->stunBindAddr = addr;
+	d->stunBindPort = port;
+}
+
+void IceCandidatePool::setStunRelayService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass)
+{
+	d->stunRelayAddr = addr;
+	d->stunRelayPort = port;
+	d->stunRelayUser = user;
+	d->stunRelayPass = pass;
+}
+
+void IceCandidatePool::setLocalAddresses(const QList<QHostAddress> &addrs)
+{
+	d->addrs.clear();
+	foreach(const QHostAddress &addr, addrs)
+	{
+		if(addr.protocol() != QAbstractSocket::IPv6Protocol && !d->addrs.contains(addr))
+			d->addrs += addr;
+	}
+
+	QList<Private::Item*> gone;
+	foreach(Private::Item *i, d->items)
+	{
+		if(!d->addrs.contains(i->addr))
+			gone += i;
+	}
+	foreach(Private::Item *i, gone)
+		d->drop(i);
+
+	d->fill();
+}
+
+void IceCandidatePool::setWarmCount(int count)
+{
+	d->warmCount = qMax(count, 0);
+	d->fill();
+}
+
+void IceCandidatePool::setMaxAge(int secs)
+{
+	d->maxAge = secs;
+}
+
+int IceCandidatePool::readyCount(const QHostAddress &addr) const
+{
+	int count = 0;
+	foreach(const Private::Item *i, d->items)
+	{
+		if(i->addr == addr && i->ready)
+			++count;
+	}
+	return count;
+}
+
+IceLocalTransport *IceCandidatePool::take(const QHostAddress &addr, const QHostAddress &stunBindAddr, int stunBindPort, const QHostAddress &stunRelayAddr, int stunRelayPort, const QString &stunRelayUser)
+{
+	if(stunBindAddr != d->stunBindAddr || (!stunBindAddr.isNull() && stunBindPort != d->stunBindPort))
+		return 0;
+	if(stunRelayAddr != d->stunRelayAddr || (!stunRelayAddr.isNull() && (stunRelayPort != d->stunRelayPort || stunRelayUser != d->stunRelayUser)))
+		return 0;
+
+	for(int n = 0; n < d->items.count(); ++n)
+	{
+		Private::Item *i = d->items[n];
+		if(i->addr != addr || !i->ready)
+			continue;
+
+		d->items.removeAt(n);
+		IceLocalTransport *sock = i->sock;
+		delete i;
+
+		sock->disconnect(d);
+		sock->setParent(0);
+
+		// replace it in the background
+		QMetaObject::invokeMethod(d, "check", Qt::QueuedConnection);
+		return sock;
+	}
+
+	return 0;
+}
+
+}
+
+#include "icecandidatepool.moc"
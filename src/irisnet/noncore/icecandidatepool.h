@@ -0,0 +1,84 @@
+/*
+ * icecandidatepool.h - keep STUN/TURN candidates gathered ahead of time
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ICECANDIDATEPOOL_H
+#define ICECANDIDATEPOOL_H
+
+#include <QObject>
+#include <QList>
+#include <QHostAddress>
+
+namespace QCA {
+	class SecureArray;
+}
+
+namespace XMPP {
+
+class IceLocalTransport;
+
+// keeps started IceLocalTransports around whose server reflexive and
+//   relayed addresses are already known, so that a new Ice176 session can
+//   have its STUN and TURN candidates right away instead of waiting a few
+//   round trips for them.  the pool keeps setWarmCount() transports ready
+//   per local address, and replaces a transport once it is taken.  TURN
+//   allocations of waiting transports are kept alive by their own refresh;
+//   transports older than setMaxAge() are replaced, so that the reflexive
+//   mapping of a NAT is never stale when handed out.  only IPv4 addresses
+//   are used, as with the STUN ports of IceComponent.
+class IceCandidatePool : public QObject
+{
+	Q_OBJECT
+
+public:
+	IceCandidatePool(QObject *parent = 0);
+	~IceCandidatePool();
+
+	void setClientSoftwareNameAndVersion(const QString &str);
+
+	// set these before setLocalAddresses().  a transport is only handed
+	//   out to a component set up with the same services.
+	void setStunBindService(const QHostAddress &addr, int port);
+	void setStunRelayService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass);
+
+	// starts gathering on each address.  addresses no longer listed are
+	//   dropped along with their transports.
+	void setLocalAddresses(const QList<QHostAddress> &addrs);
+
+	// default 1
+	void setWarmCount(int count);
+
+	// in seconds, default 90
+	void setMaxAge(int secs);
+
+	int readyCount(const QHostAddress &addr) const;
+
+	// returns a started transport on addr with stunStart() done and its
+	//   addresses known, or 0 if none is ready for these services.  pass a
+	//   null address for a service that isn't wanted.  the transport is
+	//   no longer connected to the pool and has no parent.
+	IceLocalTransport *take(const QHostAddress &addr, const QHostAddress &stunBindAddr, int stunBindPort, const QHostAddress &stunRelayAddr, int stunRelayPort, const QString &stunRelayUser);
+
+private:
+	class Private;
+	Private *d;
+};
+
+}
+
+#endif
@@ -20,11 +20,14 @@
 
 #include "icecomponent.h"
 
+#include <QTimer>
 #include <QUdpSocket>
 #include <QtCrypto>
 #include "objectsession.h"
 #include "udpportreserver.h"
+#include "icecandidatepool.h"
 #include "icelocaltransport.h"
+#include "icetcptransport.h"
 #include "iceturntransport.h"
 
 namespace XMPP {
@@ -54,6 +57,8 @@ public:
 
 		QHostAddress stunBindAddr;
 		int stunBindPort;
+		QList<QHostAddress> moreStunBindAddrs;
+		QList<int> moreStunBindPorts;
 
 		QHostAddress stunRelayUdpAddr;
 		int stunRelayUdpPort;
@@ -80,6 +85,7 @@ public:
 		bool stun_finished, turn_finished;
 		QHostAddress extAddr;
 		bool ext_finished;
+		bool pooled;
 
 		LocalTransport() :
 			qsock(0),
@@ -91,7 +97,26 @@ public:
 			stun_started(false),
 			stun_finished(false),
 			turn_finished(false),
-			ext_finished(false)
+			ext_finished(false),
+			pooled(false)
+		{
+		}
+	};
+
+	class TcpTransport
+	{
+	public:
+		QHostAddress addr;
+		IceTcpTransport *sock;
+		int network;
+		bool isVpn;
+		bool started;
+
+		TcpTransport() :
+			sock(0),
+			network(-1),
+			isVpn(false),
+			started(false)
 		{
 		}
 	};
@@ -101,6 +126,8 @@ public:
 	int id;
 	QString clientSoftware;
 	TurnClient::Proxy proxy;
+	TurnConnectionPool *turnPool;
+	IceCandidatePool *candidatePool;
 	UdpPortReserver *portReserver;
 	Config pending;
 	Config config;
@@ -108,29 +135,49 @@ public:
 	QList<LocalTransport*> localLeap;
 	QList<LocalTransport*> localStun;
 	IceTurnTransport *tt;
+	QList<TcpTransport*> localTcp;
+	bool tcp_setup;
 	QList<Candidate> localCandidates;
 	QHash<int, QSet<TransportAddress> > channelPeers;
 	bool useLocal;
 	bool useStunBind;
 	bool useStunRelayUdp;
 	bool useStunRelayTcp;
+	bool useTcp;
 	bool local_finished;
+	bool tt_finished;
+	bool gathering_complete;
 	int debugLevel;
 
+	// transports waiting for their turn to start stun, see setStunPace()
+	int stunPace;
+	QList<LocalTransport*> stunQueue;
+	QTimer *paceTimer;
+
 	Private(IceComponent *_q) :
 		QObject(_q),
 		q(_q),
 		sess(this),
+		turnPool(0),
+		candidatePool(0),
 		portReserver(0),
 		stopping(false),
 		tt(0),
+		tcp_setup(false),
 		useLocal(true),
 		useStunBind(true),
 		useStunRelayUdp(true),
 		useStunRelayTcp(true),
+		useTcp(false),
 		local_finished(false),
-		debugLevel(DL_None)
+		tt_finished(false),
+		gathering_complete(false),
+		debugLevel(DL_None),
+		stunPace(0)
 	{
+		paceTimer = new QTimer(this);
+		connect(paceTimer, SIGNAL(timeout()), SLOT(pace_timeout()));
+		paceTimer->setSingleShot(true);
 	}
 
 	~Private()
@@ -157,6 +204,11 @@ public:
 
 		qDeleteAll(localStun);
 
+		for(int n = 0; n < localTcp.count(); ++n)
+			delete localTcp[n]->sock;
+
+		qDeleteAll(localTcp);
+
 		delete tt;
 	}
 
@@ -219,6 +271,7 @@ public:
 				connect(lt->sock, SIGNAL(started()), SLOT(lt_started()));
 				connect(lt->sock, SIGNAL(stopped()), SLOT(lt_stopped()));
 				connect(lt->sock, SIGNAL(addressesChanged()), SLOT(lt_addressesChanged()));
+				connect(lt->sock, SIGNAL(stunFinished()), SLOT(lt_stunFinished()));
 				connect(lt->sock, SIGNAL(error(int)), SLOT(lt_error(int)));
 				connect(lt->sock, SIGNAL(debugLine(const QString &)), SLOT(lt_debugLine(const QString &)));
 				localLeap += lt;
@@ -228,6 +281,30 @@ public:
 			}
 		}
 
+		// tcp host ports on each local address, also only once
+		if(useLocal && useTcp && !tcp_setup && !config.localAddrs.isEmpty())
+		{
+			tcp_setup = true;
+
+			foreach(const Ice176::LocalAddress &la, config.localAddrs)
+			{
+				TcpTransport *tcp = new TcpTransport;
+				tcp->addr = la.addr;
+				tcp->sock = new IceTcpTransport(this);
+				tcp->sock->setDebugLevel((IceTransport::DebugLevel)debugLevel);
+				tcp->network = la.network;
+				tcp->isVpn = la.isVpn;
+				connect(tcp->sock, SIGNAL(started()), SLOT(tcp_started()));
+				connect(tcp->sock, SIGNAL(stopped()), SLOT(tcp_stopped()));
+				connect(tcp->sock, SIGNAL(error(int)), SLOT(tcp_error(int)));
+				connect(tcp->sock, SIGNAL(debugLine(const QString &)), SLOT(lt_debugLine(const QString &)));
+				localTcp += tcp;
+
+				tcp->sock->start(la.addr);
+				emit q->debugLine(QString("starting tcp transport ") + la.addr.toString() + " for component " + QString::number(id));
+			}
+		}
+
 		// extAddrs created on demand if present, but only once
 		if(!pending.extAddrs.isEmpty() && config.extAddrs.isEmpty())
 		{
@@ -264,7 +341,7 @@ public:
 			}
 
 			if(need_doExt)
-				sess.defer(this, "doExt");
+				sess.defer(this, &Private::doExt);
 		}
 
 		// only allow setting stun stuff once
@@ -272,6 +349,8 @@ public:
 		{
 			config.stunBindAddr = pending.stunBindAddr;
 			config.stunBindPort = pending.stunBindPort;
+			config.moreStunBindAddrs = pending.moreStunBindAddrs;
+			config.moreStunBindPorts = pending.moreStunBindPorts;
 			config.stunRelayUdpAddr = pending.stunRelayUdpAddr;
 			config.stunRelayUdpPort = pending.stunRelayUdpPort;
 			config.stunRelayUdpUser = pending.stunRelayUdpUser;
@@ -284,31 +363,65 @@ public:
 
 		// localStun sockets created on demand if stun settings are
 		//   present, but only once (cannot be changed, for now)
-		if(((useStunBind && !config.stunBindAddr.isNull()) || (useStunRelayUdp && !config.stunRelayUdpAddr.isNull() && !config.stunRelayUdpUser.isEmpty())) && !config.localAddrs.isEmpty() && localStun.isEmpty())
+		bool wantStunBind = useStunBind && !config.stunBindAddr.isNull();
+		bool wantStunRelayUdp = useStunRelayUdp && !config.stunRelayUdpAddr.isNull() && !config.stunRelayUdpUser.isEmpty();
+		if((wantStunBind || wantStunRelayUdp) && !config.localAddrs.isEmpty() && localStun.isEmpty())
 		{
+			bool need_doPooled = false;
+
 			foreach(const Ice176::LocalAddress &la, config.localAddrs)
 			{
 				// don't setup stun ports for ipv6
 				if(la.addr.protocol() == QAbstractSocket::IPv6Protocol)
 					continue;
 
+				IceLocalTransport *warm = 0;
+				if(candidatePool)
+				{
+					warm = candidatePool->take(la.addr,
+						wantStunBind ? config.stunBindAddr : QHostAddress(), config.stunBindPort,
+						wantStunRelayUdp ? config.stunRelayUdpAddr : QHostAddress(), config.stunRelayUdpPort, config.stunRelayUdpUser);
+				}
+
 				LocalTransport *lt = new LocalTransport;
 				lt->addr = la.addr;
-				lt->sock = new IceLocalTransport(this);
+				if(warm)
+				{
+					warm->setParent(this);
+					lt->sock = warm;
+				}
+				else
+					lt->sock = new IceLocalTransport(this);
 				lt->sock->setDebugLevel((IceTransport::DebugLevel)debugLevel);
 				lt->network = la.network;
 				lt->isVpn = la.isVpn;
 				connect(lt->sock, SIGNAL(started()), SLOT(lt_started()));
 				connect(lt->sock, SIGNAL(stopped()), SLOT(lt_stopped()));
 				connect(lt->sock, SIGNAL(addressesChanged()), SLOT(lt_addressesChanged()));
+				connect(lt->sock, SIGNAL(stunFinished()), SLOT(lt_stunFinished()));
 				connect(lt->sock, SIGNAL(error(int)), SLOT(lt_error(int)));
 				connect(lt->sock, SIGNAL(debugLine(const QString &)), SLOT(lt_debugLine(const QString &)));
 				localStun += lt;
 
+				if(warm)
+				{
+					// already gathered, the candidates are added
+					//   once we return
+					lt->started = true;
+					lt->stun_started = true;
+					lt->pooled = true;
+					need_doPooled = true;
+					emit q->debugLine(QString("using pooled transport ") + la.addr.toString() + ';' + QString::number(warm->localPort()) + " for component " + QString::number(id));
+					continue;
+				}
+
 				lt->sock->setClientSoftwareNameAndVersion(clientSoftware);
 				lt->sock->start(la.addr);
 				emit q->debugLine(QString("starting transport ") + la.addr.toString() + ";(dyn)" + " for component " + QString::number(id));
 			}
+
+			if(need_doPooled)
+				sess.defer(this, &Private::doPooled);
 		}
 
 		if((!config.stunBindAddr.isNull() || !config.stunRelayUdpAddr.isNull()) && !localStun.isEmpty())
@@ -316,7 +429,7 @@ public:
 			for(int n = 0; n < localStun.count(); ++n)
 			{
 				if(localStun[n]->started && !localStun[n]->stun_started)
-					tryStun(n);
+					queueStun(localStun[n]);
 			}
 		}
 
@@ -330,6 +443,7 @@ public:
 			connect(tt, SIGNAL(debugLine(const QString &)), SLOT(tt_debugLine(const QString &)));
 			tt->setClientSoftwareNameAndVersion(clientSoftware);
 			tt->setProxy(proxy);
+			tt->setConnectionPool(turnPool);
 			tt->setUsername(config.stunRelayTcpUser);
 			tt->setPassword(config.stunRelayTcpPass);
 			tt->start(config.stunRelayTcpAddr, config.stunRelayTcpPort);
@@ -337,11 +451,13 @@ public:
 			emit q->debugLine(QString("starting TURN transport with server ") + config.stunRelayTcpAddr.toString() + ';' + QString::number(config.stunRelayTcpPort) + " for component " + QString::number(id));
 		}
 
-		if(localLeap.isEmpty() && localStun.isEmpty() && !local_finished)
+		if(localLeap.isEmpty() && localStun.isEmpty() && localTcp.isEmpty() && !local_finished)
 		{
 			local_finished = true;
-			sess.defer(q, "localFinished");
+			sess.defer(q, &IceComponent::localFinished);
 		}
+
+		sess.defer(this, &Private::checkGatheringComplete);
 	}
 
 	void stop()
@@ -350,10 +466,13 @@ public:
 
 		stopping = true;
 
+		paceTimer->stop();
+		stunQueue.clear();
+
 		// nothing to stop?
 		if(allStopped())
 		{
-			sess.defer(this, "postStop");
+			sess.defer(this, &Private::postStop);
 			return;
 		}
 
@@ -363,6 +482,9 @@ public:
 		foreach(LocalTransport *lt, localStun)
 			lt->sock->stop();
 
+		foreach(TcpTransport *tcp, localTcp)
+			tcp->sock->stop();
+
 		if(tt)
 			tt->stop();
 	}
@@ -386,6 +508,13 @@ public:
 			// lower priority by making it seem like the last nic
 			addrAt = 1024;
 		}
+		else if(const IceTcpTransport *tcp = qobject_cast<const IceTcpTransport*>(iceTransport))
+		{
+			addrAt = findTcpTransport(tcp);
+			Q_ASSERT(addrAt != -1);
+
+			return choose_tcp_priority(PeerReflexiveType, path == IceTcpTransport::Active ? TcpActive : TcpPassive, addrAt, false, id);
+		}
 
 		Q_ASSERT(addrAt != -1);
 
@@ -417,6 +546,30 @@ public:
 		}
 	}
 
+	void setReflexiveAddress(const QHostAddress &base, const QHostAddress &addr)
+	{
+		int addrAt = findLocalAddr(base);
+		if(addrAt == -1 || stopping)
+			return;
+
+		ObjectSessionWatcher watch(&sess);
+
+		// same as when our own binding finds it
+		foreach(LocalTransport *i, localLeap)
+		{
+			if(i->extAddr.isNull() && i->sock->localAddress() == base)
+			{
+				i->extAddr = addr;
+				if(i->started)
+				{
+					ensureExt(i, addrAt);
+					if(!watch.isValid())
+						return;
+				}
+			}
+		}
+	}
+
 private:
 	// localPref is the priority of the network interface being used for
 	//   this candidate.  the value must be between 0-65535 and different
@@ -442,6 +595,23 @@ private:
 		return calc_priority(typePref, localPref, componentId);
 	}
 
+	// RFC 6544 priorities.  direct tcp comes after every udp path but
+	//   the relayed ones, so it is tried before falling back to turn.
+	//   addrAt picks the other-pref, as localPref does above
+	static int choose_tcp_priority(CandidateType type, TcpType tcpType, int addrAt, bool isVpn, int componentId)
+	{
+		int typePref;
+		if(type == HostType)
+			typePref = (isVpn ? 0 : 60);
+		else // PeerReflexiveType
+			typePref = 50;
+
+		int directionPref = (tcpType == TcpActive ? 6 : 4);
+		int localPref = (directionPref << 13) + qMax(8191 - addrAt, 0);
+
+		return calc_priority(typePref, localPref, componentId);
+	}
+
 	static QUdpSocket *takeFromSocketList(QList<QUdpSocket*> *socketList, const QHostAddress &addr, QObject *parent = 0)
 	{
 		for(int n = 0; n < socketList->count(); ++n)
@@ -510,15 +680,74 @@ private:
 		return -1;
 	}
 
-	void tryStun(int at)
+	int findTcpTransport(const IceTcpTransport *sock) const
 	{
-		LocalTransport *lt = localStun[at];
+		for(int n = 0; n < localTcp.count(); ++n)
+		{
+			if(localTcp[n]->sock == sock)
+				return n;
+		}
+
+		return -1;
+	}
+
+	// all the host ports are up, or have failed
+	bool allStarted() const
+	{
+		foreach(const LocalTransport *lt, localLeap)
+		{
+			if(!lt->started)
+				return false;
+		}
+
+		foreach(const LocalTransport *lt, localStun)
+		{
+			if(!lt->started)
+				return false;
+		}
+
+		foreach(const TcpTransport *tcp, localTcp)
+		{
+			if(!tcp->started)
+				return false;
+		}
+
+		return true;
+	}
+
+	void queueStun(LocalTransport *lt)
+	{
+		// taken now, so it is queued only once
+		lt->stun_started = true;
+
+		stunQueue += lt;
+		if(!paceTimer->isActive())
+			startQueuedStun();
+	}
 
+	void startQueuedStun()
+	{
+		while(!stunQueue.isEmpty())
+		{
+			doStun(stunQueue.takeFirst());
+			if(stunPace > 0)
+			{
+				if(!stunQueue.isEmpty())
+					paceTimer->start(stunPace);
+				break;
+			}
+		}
+	}
+
+	void doStun(LocalTransport *lt)
+	{
 		bool atLeastOne = false;
 		if(useStunBind && !config.stunBindAddr.isNull())
 		{
 			atLeastOne = true;
 			lt->sock->setStunBindService(config.stunBindAddr, config.stunBindPort);
+			for(int n = 0; n < config.moreStunBindAddrs.count(); ++n)
+				lt->sock->addStunBindService(config.moreStunBindAddrs[n], config.moreStunBindPorts[n]);
 		}
 		if(useStunRelayUdp && !config.stunRelayUdpAddr.isNull() && !config.stunRelayUdpUser.isEmpty())
 		{
@@ -528,10 +757,33 @@ private:
 
 		Q_ASSERT(atLeastOne);
 
-		lt->stun_started = true;
 		lt->sock->stunStart();
 	}
 
+	// no further candidates once local transports are up, all stun
+	//   transactions are through and the TURN TCP relay has answered
+	void checkGatheringComplete()
+	{
+		if(gathering_complete || !local_finished || stopping)
+			return;
+
+		foreach(const LocalTransport *lt, localStun)
+		{
+			if(!lt->stun_started || !lt->sock->isStunFinished())
+				return;
+		}
+		if(tt && !tt_finished)
+			return;
+
+		gathering_complete = true;
+		emit q->gatheringComplete();
+	}
+
+	void forgetLocalTransport(LocalTransport *lt)
+	{
+		stunQueue.removeAll(lt);
+	}
+
 	void ensureExt(LocalTransport *lt, int addrAt)
 	{
 		if(!lt->extAddr.isNull() && !lt->ext_finished)
@@ -583,7 +835,7 @@ private:
 
 	bool allStopped() const
 	{
-		if(localLeap.isEmpty() && localStun.isEmpty() && !tt)
+		if(localLeap.isEmpty() && localStun.isEmpty() && localTcp.isEmpty() && !tt)
 			return true;
 		else
 			return false;
@@ -595,38 +847,8 @@ private:
 			postStop();
 	}
 
-private slots:
-	void doExt()
-	{
-		if(stopping)
-			return;
-
-		ObjectSessionWatcher watch(&sess);
-
-		foreach(LocalTransport *lt, localLeap)
-		{
-			if(lt->started)
-			{
-				int addrAt = findLocalAddr(lt->addr);
-				Q_ASSERT(addrAt != -1);
-
-				ensureExt(lt, addrAt);
-				if(!watch.isValid())
-					return;
-			}
-		}
-	}
-
-	void postStop()
-	{
-		stopping = false;
-
-		emit q->stopped();
-	}
-
-	void lt_started()
+	void transportStarted(IceLocalTransport *sock)
 	{
-		IceLocalTransport *sock = (IceLocalTransport *)sender();
 		bool isLocalLeap = false;
 		int at = findLocalTransport(sock, &isLocalLeap);
 		Q_ASSERT(at != -1);
@@ -673,80 +895,28 @@ private slots:
 		}
 
 		if(!isLocalLeap && !lt->stun_started)
-			tryStun(at);
+			queueStun(lt);
 
-		bool allFinished = true;
-		foreach(const LocalTransport *lt, localLeap)
-		{
-			if(!lt->started)
-			{
-				allFinished = false;
-				break;
-			}
-		}
-		if(allFinished)
-		{
-			foreach(const LocalTransport *lt, localStun)
-			{
-				if(!lt->started)
-				{
-					allFinished = false;
-					break;
-				}
-			}
-		}
-
-		if(allFinished && !local_finished)
-		{
-			local_finished = true;
-			emit q->localFinished();
-		}
+		tryLocalFinished();
 	}
 
-	void lt_stopped()
+	void tryLocalFinished()
 	{
-		IceLocalTransport *sock = (IceLocalTransport *)sender();
-		bool isLocalLeap = false;
-		int at = findLocalTransport(sock, &isLocalLeap);
-		Q_ASSERT(at != -1);
-
-		LocalTransport *lt;
-		if(isLocalLeap)
-			lt = localLeap[at];
-		else
-			lt = localStun[at];
-
 		ObjectSessionWatcher watch(&sess);
 
-		removeLocalCandidates(lt->sock);
-		if(!watch.isValid())
-			return;
-
-		delete lt->sock;
-		lt->sock = 0;
-
-		if(isLocalLeap)
-		{
-			if(lt->borrowedSocket)
-				portReserver->returnSockets(QList<QUdpSocket*>() << lt->qsock);
-			else
-				lt->qsock->deleteLater();
-
-			delete lt;
-			localLeap.removeAt(at);
-		}
-		else
+		if(allStarted() && !local_finished)
 		{
-			delete lt;
-			localStun.removeAt(at);
+			local_finished = true;
+			emit q->localFinished();
+			if(!watch.isValid())
+				return;
 		}
 
-		tryStopped();
+		checkGatheringComplete();
 	}
 
-	void lt_addressesChanged()
+	void transportAddressesChanged(IceLocalTransport *sock)
 	{
-		IceLocalTransport *sock = (IceLocalTransport *)sender();
 		bool isLocalLeap = false;
 		int at = findLocalTransport(sock, &isLocalLeap);
 		Q_ASSERT(at != -1);
@@ -763,6 +933,10 @@ private slots:
 
 		if(useStunBind && !lt->sock->serverReflexiveAddress().isNull() && !lt->stun_finished)
 		{
+			emit q->reflexiveAddressFound(lt->addr, lt->sock->serverReflexiveAddress());
+			if(!watch.isValid())
+				return;
+
 			// automatically assign ext to related leaps, if possible
 			foreach(LocalTransport *i, localLeap)
 			{
@@ -831,6 +1005,125 @@ private slots:
 		}
 	}
 
+private slots:
+	void doExt()
+	{
+		if(stopping)
+			return;
+
+		ObjectSessionWatcher watch(&sess);
+
+		foreach(LocalTransport *lt, localLeap)
+		{
+			if(lt->started)
+			{
+				int addrAt = findLocalAddr(lt->addr);
+				Q_ASSERT(addrAt != -1);
+
+				ensureExt(lt, addrAt);
+				if(!watch.isValid())
+					return;
+			}
+		}
+	}
+
+	void postStop()
+	{
+		stopping = false;
+
+		emit q->stopped();
+	}
+
+	void lt_started()
+	{
+		transportStarted((IceLocalTransport *)sender());
+	}
+
+	void lt_addressesChanged()
+	{
+		transportAddressesChanged((IceLocalTransport *)sender());
+	}
+
+	void lt_stunFinished()
+	{
+		checkGatheringComplete();
+	}
+
+	void pace_timeout()
+	{
+		startQueuedStun();
+	}
+
+	// take the candidates of transports that came from the pool
+	//   ready-made, as if they had just been gathered
+	void doPooled()
+	{
+		if(stopping)
+			return;
+
+		ObjectSessionWatcher watch(&sess);
+
+		for(int n = 0; n < localStun.count(); ++n)
+		{
+			LocalTransport *lt = localStun[n];
+			if(!lt->pooled)
+				continue;
+
+			lt->pooled = false;
+			IceLocalTransport *sock = lt->sock;
+
+			transportStarted(sock);
+			if(!watch.isValid())
+				return;
+
+			transportAddressesChanged(sock);
+			if(!watch.isValid())
+				return;
+		}
+	}
+
+	void lt_stopped()
+	{
+		IceLocalTransport *sock = (IceLocalTransport *)sender();
+		bool isLocalLeap = false;
+		int at = findLocalTransport(sock, &isLocalLeap);
+		Q_ASSERT(at != -1);
+
+		LocalTransport *lt;
+		if(isLocalLeap)
+			lt = localLeap[at];
+		else
+			lt = localStun[at];
+
+		ObjectSessionWatcher watch(&sess);
+
+		removeLocalCandidates(lt->sock);
+		if(!watch.isValid())
+			return;
+
+		delete lt->sock;
+		lt->sock = 0;
+
+		if(isLocalLeap)
+		{
+			if(lt->borrowedSocket)
+				portReserver->returnSockets(QList<QUdpSocket*>() << lt->qsock);
+			else
+				lt->qsock->deleteLater();
+
+			delete lt;
+			localLeap.removeAt(at);
+		}
+		else
+		{
+			forgetLocalTransport(lt);
+			delete lt;
+			localStun.removeAt(at);
+		}
+
+		tryStopped();
+	}
+
 	void lt_error(int e)
 	{
 		Q_UNUSED(e);
@@ -867,9 +1160,12 @@ private slots:
 		}
 		else
 		{
+			forgetLocalTransport(lt);
 			delete lt;
 			localStun.removeAt(at);
 		}
+
+		checkGatheringComplete();
 	}
 
 	void lt_debugLine(const QString &line)
@@ -877,6 +1173,96 @@ private slots:
 		emit q->debugLine(line);
 	}
 
+	void tcp_started()
+	{
+		IceTcpTransport *sock = (IceTcpTransport *)sender();
+		int at = findTcpTransport(sock);
+		Q_ASSERT(at != -1);
+
+		TcpTransport *tcp = localTcp[at];
+		tcp->started = true;
+
+		int addrAt = findLocalAddr(tcp->addr);
+		Q_ASSERT(addrAt != -1);
+
+		ObjectSessionWatcher watch(&sess);
+
+		// the passive candidate takes connections, the active one
+		//   makes them from a port of the system's choosing, which
+		//   is announced as 9 (RFC 6544)
+		for(int n = 0; n < 2; ++n)
+		{
+			CandidateInfo ci;
+			ci.addr.addr = sock->localAddress();
+			ci.addr.port = (n == IceTcpTransport::Passive ? sock->localPort() : 9);
+			ci.type = HostType;
+			ci.tcpType = (n == IceTcpTransport::Passive ? TcpPassive : TcpActive);
+			ci.componentId = id;
+			ci.priority = choose_tcp_priority(ci.type, ci.tcpType, addrAt, tcp->isVpn, ci.componentId);
+			ci.base = ci.addr;
+			ci.network = tcp->network;
+
+			Candidate c;
+			c.id = getId();
+			c.info = ci;
+			c.iceTransport = sock;
+			c.path = n;
+
+			localCandidates += c;
+
+			emit q->candidateAdded(c);
+			if(!watch.isValid())
+				return;
+		}
+
+		tryLocalFinished();
+	}
+
+	void tcp_stopped()
+	{
+		IceTcpTransport *sock = (IceTcpTransport *)sender();
+		int at = findTcpTransport(sock);
+		Q_ASSERT(at != -1);
+
+		ObjectSessionWatcher watch(&sess);
+
+		removeLocalCandidates(sock);
+		if(!watch.isValid())
+			return;
+
+		sock->disconnect(this);
+		sock->setParent(0);
+		sock->deleteLater();
+		delete localTcp.takeAt(at);
+
+		tryStopped();
+	}
+
+	void tcp_error(int e)
+	{
+		Q_UNUSED(e);
+
+		IceTcpTransport *sock = (IceTcpTransport *)sender();
+		int at = findTcpTransport(sock);
+		Q_ASSERT(at != -1);
+
+		emit q->debugLine(QString("Warning: unable to listen for tcp on ") + localTcp[at]->addr.toString());
+
+		ObjectSessionWatcher watch(&sess);
+
+		removeLocalCandidates(sock);
+		if(!watch.isValid())
+			return;
+
+		sock->disconnect(this);
+		sock->setParent(0);
+		sock->deleteLater();
+		delete localTcp.takeAt(at);
+
+		// one less to wait for
+		tryLocalFinished();
+	}
+
 	void tt_started()
 	{
 		// lower priority by making it seem like the last nic
@@ -898,8 +1284,14 @@ private slots:
 		c.path = 0;
 
 		localCandidates += c;
+		tt_finished = true;
 
+		ObjectSessionWatcher watch(&sess);
 		emit q->candidateAdded(c);
+		if(!watch.isValid())
+			return;
+
+		checkGatheringComplete();
 	}
 
 	void tt_stopped()
@@ -928,6 +1320,8 @@ private slots:
 
 		delete tt;
 		tt = 0;
+
+		checkGatheringComplete();
 	}
 
 	void tt_debugLine(const QString &line)
@@ -963,6 +1357,16 @@ void IceComponent::setProxy(const TurnClient::Proxy &proxy)
 	d->proxy = proxy;
 }
 
+void IceComponent::setTurnConnectionPool(TurnConnectionPool *pool)
+{
+	d->turnPool = pool;
+}
+
+void IceComponent::setCandidatePool(IceCandidatePool *pool)
+{
+	d->candidatePool = pool;
+}
+
 void IceComponent::setPortReserver(UdpPortReserver *portReserver)
 {
 	d->portReserver = portReserver;
@@ -984,6 +1388,12 @@ void IceComponent::setStunBindService(const QHostAddress &addr, int port)
 	d->pending.stunBindPort = port;
 }
 
+void IceComponent::addStunBindService(const QHostAddress &addr, int port)
+{
+	d->pending.moreStunBindAddrs += addr;
+	d->pending.moreStunBindPorts += port;
+}
+
 void IceComponent::setStunRelayUdpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass)
 {
 	d->pending.stunRelayUdpAddr = addr;
@@ -1000,6 +1410,16 @@ void IceComponent::setStunRelayTcpService(const QHostAddress &addr, int port, co
 	d->pending.stunRelayTcpPass = pass;
 }
 
+void IceComponent::setStunPace(int msecs)
+{
+	d->stunPace = msecs;
+}
+
+void IceComponent::setReflexiveAddress(const QHostAddress &base, const QHostAddress &addr)
+{
+	d->setReflexiveAddress(base, addr);
+}
+
 void IceComponent::setUseLocal(bool enabled)
 {
 	d->useLocal = enabled;
@@ -1020,6 +1440,11 @@ void IceComponent::setUseStunRelayTcp(bool enabled)
 	d->useStunRelayTcp = enabled;
 }
 
+void IceComponent::setUseTcp(bool enabled)
+{
+	d->useTcp = enabled;
+}
+
 void IceComponent::update(QList<QUdpSocket*> *socketList)
 {
 	d->update(socketList);
@@ -31,6 +31,7 @@ class QUdpSocket;
 namespace XMPP {
 
 class UdpPortReserver;
+class IceCandidatePool;
 
 class IceComponent : public QObject
 {
@@ -76,11 +77,20 @@ public:
 		}
 	};
 
+	// RFC 6544 candidate kinds.  NoTcp for udp candidates
+	enum TcpType
+	{
+		NoTcp,
+		TcpActive,
+		TcpPassive
+	};
+
 	class CandidateInfo
 	{
 	public:
 		TransportAddress addr;
 		CandidateType type;
+		TcpType tcpType;
 		int priority;
 		QString foundation;
 		int componentId;
@@ -88,6 +98,11 @@ public:
 		TransportAddress related;
 		QString id;
 		int network;
+
+		CandidateInfo() :
+			tcpType(NoTcp)
+		{
+		}
 	};
 
 	class Candidate
@@ -122,6 +137,8 @@ public:
 
 	void setClientSoftwareNameAndVersion(const QString &str);
 	void setProxy(const TurnClient::Proxy &proxy);
+	void setTurnConnectionPool(TurnConnectionPool *pool);
+	void setCandidatePool(IceCandidatePool *pool);
 
 	void setPortReserver(UdpPortReserver *portReserver);
 
@@ -134,9 +151,21 @@ public:
 
 	// can be set at any time, but only once.  later changes are ignored
 	void setStunBindService(const QHostAddress &addr, int port);
+	// more STUN servers, asked in parallel with the one above
+	void addStunBindService(const QHostAddress &addr, int port);
 	void setStunRelayUdpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass);
 	void setStunRelayTcpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass);
 
+	// start the STUN bindings and allocations of the local addresses
+	//   this many msecs apart, rather than all at once.  default 0
+	void setStunPace(int msecs);
+
+	// reflexive address of local address base, learned elsewhere (such
+	//   as by another component's binding).  host transports on base
+	//   without an external address get addr as one, the way this
+	//   component's own bindings assign it
+	void setReflexiveAddress(const QHostAddress &base, const QHostAddress &addr);
+
 	// these all start out enabled, but can be disabled for diagnostic
 	//   purposes
 	void setUseLocal(bool enabled);
@@ -144,6 +173,10 @@ public:
 	void setUseStunRelayUdp(bool enabled);
 	void setUseStunRelayTcp(bool enabled);
 
+	// also gather active and passive tcp host candidates (RFC 6544),
+	//   for networks that block udp but allow direct tcp.  default false
+	void setUseTcp(bool enabled);
+
 	// if socketList is not null then port reserver must be set
 	void update(QList<QUdpSocket*> *socketList = 0);
 	void stop();
@@ -167,6 +200,15 @@ signals:
 	//   note that it is possible there are no HostType candidates.
 	void localFinished();
 
+	// a binding of this component found addr to be the reflexive
+	//   address of local address base
+	void reflexiveAddressFound(const QHostAddress &base, const QHostAddress &addr);
+
+	// everything that was set up by update() has been gathered or has
+	//   failed, and no more candidates are coming.  emitted once, after
+	//   localFinished()
+	void gatheringComplete();
+
 	void stopped();
 
 	// reports debug of iceTransports as well.  not DOR-SS/DS safe
@@ -0,0 +1,307 @@
+/*
+ * icelocaladdressset.cpp - local addresses for ICE, kept up to date
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "icelocaladdressset.h"
+
+#include <QCoreApplication>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTimer>
+#include "irisnetglobal_p.h"
+#include "netinterface.h"
+
+// interface changes tend to come in bursts (an address going away and
+//   coming back), so wait a little before redoing the list
+#define UPDATE_DELAY 100
+
+namespace XMPP {
+
+// scope values: 0 = local, 1 = link-local, 2 = private, 3 = public
+static int getAddressScope(const QHostAddress &a)
+{
+	if(a.protocol() == QAbstractSocket::IPv6Protocol)
+	{
+		if(a == QHostAddress(QHostAddress::LocalHostIPv6))
+			return 0;
+		else if(Ice176::isIPv6LinkLocalAddress(a))
+			return 1;
+	}
+	else if(a.protocol() == QAbstractSocket::IPv4Protocol)
+	{
+		quint32 v4 = a.toIPv4Address();
+		quint8 a0 = v4 >> 24;
+		quint8 a1 = (v4 >> 16) & 0xff;
+		if(a0 == 127)
+			return 0;
+		else if(a0 == 169 && a1 == 254)
+			return 1;
+		else if(a0 == 10)
+			return 2;
+		else if(a0 == 172 && a1 >= 16 && a1 <= 31)
+			return 2;
+		else if(a0 == 192 && a1 == 168)
+			return 2;
+	}
+
+	return 3;
+}
+
+// by name only, as that is all there is to go on portably
+static bool isVpnInterface(const QString &name)
+{
+	return (name.startsWith("tun") || name.startsWith("tap") || name.startsWith("ppp") || name.startsWith("utun") || name.startsWith("wg"));
+}
+
+// -1 = a is higher priority, 1 = b is higher priority, 0 = equal
+static int comparePriority(const Ice176::LocalAddress &a, const Ice176::LocalAddress &b)
+{
+	// prefer anything over a vpn
+	if(!a.isVpn && b.isVpn)
+		return -1;
+	else if(a.isVpn && !b.isVpn)
+		return 1;
+
+	// prefer closer scope
+	int a_scope = getAddressScope(a.addr);
+	int b_scope = getAddressScope(b.addr);
+	if(a_scope < b_scope)
+		return -1;
+	else if(a_scope > b_scope)
+		return 1;
+
+	// prefer ipv6
+	if(a.addr.protocol() == QAbstractSocket::IPv6Protocol && b.addr.protocol() != QAbstractSocket::IPv6Protocol)
+		return -1;
+	else if(b.addr.protocol() == QAbstractSocket::IPv6Protocol && a.addr.protocol() != QAbstractSocket::IPv6Protocol)
+		return 1;
+
+	return 0;
+}
+
+Q_GLOBAL_STATIC(QMutex, las_mutex)
+static IceLocalAddressSet *g_las = 0;
+
+class IceLocalAddressSet::Private : public QObject
+{
+	Q_OBJECT
+
+public:
+	IceLocalAddressSet *q;
+	NetInterfaceManager *netman;
+	QList<NetInterface*> ifaces;
+	QTimer *updateTimer;
+
+	// network numbers handed out so far, by interface id
+	QHash<QString,int> networks;
+	int nextNetwork;
+
+	// guarded by m, as snapshots may be taken from other threads
+	mutable QMutex m;
+	QList<Ice176::LocalAddress> addrs;
+	int generation;
+
+	Private(IceLocalAddressSet *_q) :
+		QObject(_q),
+		q(_q),
+		nextNetwork(0),
+		generation(0)
+	{
+		updateTimer = new QTimer(this);
+		updateTimer->setSingleShot(true);
+		connect(updateTimer, SIGNAL(timeout()), SLOT(doUpdate()));
+
+		netman = new NetInterfaceManager(this);
+		connect(netman, SIGNAL(interfaceAvailable(const QString &)), SLOT(iface_available(const QString &)));
+
+		foreach(const QString &id, netman->interfaces())
+			addInterface(id);
+
+		// the initial list is there right away, without a signal
+		update(false);
+	}
+
+	~Private()
+	{
+		qDeleteAll(ifaces);
+	}
+
+	void addInterface(const QString &id)
+	{
+		NetInterface *iface = new NetInterface(id, netman);
+		connect(iface, SIGNAL(unavailable()), SLOT(iface_unavailable()));
+		ifaces += iface;
+	}
+
+	void update(bool notify)
+	{
+		QList<Ice176::LocalAddress> list;
+		QHash<QString,int> newNetworks;
+
+		foreach(NetInterface *iface, ifaces)
+		{
+			QString id = iface->id();
+			int network;
+			if(networks.contains(id))
+				network = networks.value(id);
+			else
+				network = nextNetwork++;
+			newNetworks.insert(id, network);
+
+			bool isVpn = isVpnInterface(id) || isVpnInterface(iface->name());
+
+			foreach(QHostAddress h, iface->addresses())
+			{
+				// skip localhost and ipv4 link-local
+				int scope = getAddressScope(h);
+				if(scope == 0 || (scope == 1 && h.protocol() == QAbstractSocket::IPv4Protocol))
+					continue;
+
+				if(h.protocol() == QAbstractSocket::IPv6Protocol && Ice176::isIPv6LinkLocalAddress(h))
+					h.setScopeId(id);
+
+				Ice176::LocalAddress la;
+				la.addr = h;
+				la.network = network;
+				la.isVpn = isVpn;
+
+				// don't put the same address in twice.  this
+				//   also means that if there are two link-local
+				//   ipv6 interfaces with the exact same address,
+				//   we only use the first one
+				bool found = false;
+				foreach(const Ice176::LocalAddress &i, list)
+				{
+					if(i.addr == h)
+					{
+						found = true;
+						break;
+					}
+				}
+				if(found)
+					continue;
+
+				// keep the list sorted, stable for equals
+				int at;
+				for(at = 0; at < list.count(); ++at)
+				{
+					if(comparePriority(la, list[at]) < 0)
+						break;
+				}
+				list.insert(at, la);
+			}
+		}
+
+		// forget the numbers of interfaces that are gone, so that a new
+		//   interface of the same id is a new network
+		networks = newNetworks;
+
+		{
+			QMutexLocker locker(&m);
+			if(sameAddresses(list, addrs))
+				return;
+
+			addrs = list;
+			++generation;
+		}
+
+		if(notify)
+			emit q->changed();
+	}
+
+	static bool sameAddresses(const QList<Ice176::LocalAddress> &a, const QList<Ice176::LocalAddress> &b)
+	{
+		if(a.count() != b.count())
+			return false;
+
+		for(int n = 0; n < a.count(); ++n)
+		{
+			if(a[n].addr != b[n].addr || a[n].network != b[n].network || a[n].isVpn != b[n].isVpn)
+				return false;
+		}
+
+		return true;
+	}
+
+private slots:
+	void iface_available(const QString &id)
+	{
+		addInterface(id);
+		updateTimer->start(UPDATE_DELAY);
+	}
+
+	void iface_unavailable()
+	{
+		NetInterface *iface = (NetInterface *)sender();
+		ifaces.removeAll(iface);
+		delete iface;
+
+		updateTimer->start(UPDATE_DELAY);
+	}
+
+	void doUpdate()
+	{
+		update(true);
+	}
+};
+
+IceLocalAddressSet::IceLocalAddressSet(QObject *parent) :
+	QObject(parent)
+{
+	d = new Private(this);
+}
+
+IceLocalAddressSet::~IceLocalAddressSet()
+{
+	delete d;
+}
+
+IceLocalAddressSet *IceLocalAddressSet::instance()
+{
+	QMutexLocker locker(las_mutex());
+	if(!g_las)
+	{
+		g_las = new IceLocalAddressSet;
+		g_las->moveToThread(QCoreApplication::instance()->thread());
+		irisNetAddPostRoutine(cleanup);
+	}
+	return g_las;
+}
+
+void IceLocalAddressSet::cleanup()
+{
+	delete g_las;
+	g_las = 0;
+}
+
+QList<Ice176::LocalAddress> IceLocalAddressSet::addresses() const
+{
+	QMutexLocker locker(&d->m);
+	return d->addrs;
+}
+
+int IceLocalAddressSet::generation() const
+{
+	QMutexLocker locker(&d->m);
+	return d->generation;
+}
+
+}
+
+#include "icelocaladdressset.moc"
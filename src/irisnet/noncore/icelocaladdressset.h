@@ -0,0 +1,69 @@
+/*
+ * icelocaladdressset.h - local addresses for ICE, kept up to date
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ICELOCALADDRESSSET_H
+#define ICELOCALADDRESSSET_H
+
+#include <QObject>
+#include <QList>
+#include "ice176.h"
+
+namespace XMPP {
+
+// the usable local addresses of the machine, ready to be given to Ice176,
+//   so that each session doesn't have to enumerate the interfaces again.
+//   the list is kept ordered by preference, which is what IceComponent
+//   derives the local preference of host candidates from, and each
+//   address has its network (a number that stays the same for as long as
+//   its interface exists) and vpn flag filled in.  it is redone whenever
+//   an interface comes or goes.  loopback and link-local ipv4 addresses
+//   are left out
+class IceLocalAddressSet : public QObject
+{
+	Q_OBJECT
+
+public:
+	IceLocalAddressSet(QObject *parent = 0);
+	~IceLocalAddressSet();
+
+	// the shared set, living in the main thread.  it is freed by
+	//   irisNetCleanup()
+	static IceLocalAddressSet *instance();
+
+	// a snapshot of the current list.  safe to call from any thread, and
+	//   cheap, since the list is shared rather than copied
+	QList<Ice176::LocalAddress> addresses() const;
+
+	// counts the changes, so that a holder of a snapshot can tell if it
+	//   is still current
+	int generation() const;
+
+signals:
+	void changed();
+
+private:
+	class Private;
+	Private *d;
+
+	static void cleanup();
+};
+
+}
+
+#endif
@@ -29,10 +29,25 @@
 #include "stunbinding.h"
 #include "stunallocate.h"
 #include "turnclient.h"
+#include "udpportreserver.h"
+
+#if defined(Q_OS_LINUX) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 12))
+# define HAVE_RECVMMSG
+# if __GLIBC__ > 2 || __GLIBC_MINOR__ >= 14
+#  define HAVE_SENDMMSG
+# endif
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <string.h>
+#endif
 
 // don't queue more incoming packets than this per transmit path
 #define MAX_PACKET_QUEUE 64
 
+// batched receive: datagrams per call, and the size of each pool slot
+#define BATCH_COUNT 32
+#define BATCH_BUFSIZE 4096
+
 namespace XMPP {
 
 enum
@@ -49,10 +64,21 @@ class SafeUdpSocket : public QObject
 {
 	Q_OBJECT
 
+public:
+	class Datagram
+	{
+	public:
+		QHostAddress addr;
+		quint16 port;
+		QByteArray buf;
+	};
+
 private:
 	ObjectSession sess;
 	QUdpSocket *sock;
 	int writtenCount;
+	bool batched;
+	QByteArray pool;
 
 public:
 	SafeUdpSocket(QUdpSocket *_sock, QObject *parent = 0) :
@@ -65,6 +91,7 @@ public:
 		connect(sock, SIGNAL(bytesWritten(qint64)), SLOT(sock_bytesWritten(qint64)));
 
 		writtenCount = 0;
+		batched = false;
 	}
 
 	~SafeUdpSocket()
@@ -85,6 +112,11 @@ public:
 		return out;
 	}
 
+	QUdpSocket *socket() const
+	{
+		return sock;
+	}
+
 	QHostAddress localAddress() const
 	{
 		return sock->localAddress();
@@ -111,11 +143,156 @@ public:
 		return buf;
 	}
 
+	void setBatched(bool enabled)
+	{
+		batched = enabled;
+		if(!batched)
+			pool.clear();
+	}
+
+	// appends up to BATCH_COUNT datagrams to out, returns how many were
+	//   taken off the socket (including any dropped as oversized)
+	int readDatagrams(QList<Datagram> *out)
+	{
+		if(!batched)
+		{
+			if(!sock->hasPendingDatagrams())
+				return 0;
+
+			Datagram dg;
+			dg.buf = readDatagram(&dg.addr, &dg.port);
+			*out += dg;
+			return 1;
+		}
+
+#ifdef HAVE_RECVMMSG
+		if(pool.isEmpty())
+			pool.resize(BATCH_COUNT * BATCH_BUFSIZE);
+
+		struct mmsghdr msgs[BATCH_COUNT];
+		struct iovec iov[BATCH_COUNT];
+		struct sockaddr_storage from[BATCH_COUNT];
+		memset(msgs, 0, sizeof(msgs));
+		for(int n = 0; n < BATCH_COUNT; ++n)
+		{
+			iov[n].iov_base = pool.data() + n * BATCH_BUFSIZE;
+			iov[n].iov_len = BATCH_BUFSIZE;
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			msgs[n].msg_hdr.msg_name = &from[n];
+			msgs[n].msg_hdr.msg_namelen = sizeof(from[n]);
+		}
+
+		int count = recvmmsg(sock->socketDescriptor(), msgs, BATCH_COUNT, MSG_DONTWAIT, 0);
+		if(count <= 0)
+			return 0;
+
+		for(int n = 0; n < count; ++n)
+		{
+			// didn't fit in the pool slot
+			if(msgs[n].msg_hdr.msg_flags & MSG_TRUNC)
+				continue;
+
+			Datagram dg;
+			dg.addr.setAddress((struct sockaddr *)&from[n]);
+			if(from[n].ss_family == AF_INET6)
+				dg.port = ntohs(((struct sockaddr_in6 *)&from[n])->sin6_port);
+			else
+				dg.port = ntohs(((struct sockaddr_in *)&from[n])->sin_port);
+			dg.buf = QByteArray(pool.constData() + n * BATCH_BUFSIZE, msgs[n].msg_len);
+			*out += dg;
+		}
+		return count;
+#else
+		// no batching syscall here, so read into the pool and copy out
+		//   just the datagram, which saves asking for its size first
+		if(pool.isEmpty())
+			pool.resize(65536);
+
+		int count = 0;
+		while(count < BATCH_COUNT && sock->hasPendingDatagrams())
+		{
+			Datagram dg;
+			qint64 size = sock->readDatagram(pool.data(), pool.size(), &dg.addr, &dg.port);
+			if(size < 0)
+				break;
+			dg.buf = QByteArray(pool.constData(), (int)size);
+			*out += dg;
+			++count;
+		}
+		return count;
+#endif
+	}
+
 	void writeDatagram(const QByteArray &buf, const QHostAddress &address, quint16 port)
 	{
 		sock->writeDatagram(buf, address, port);
 	}
 
+	// every datagram is reported through datagramsWritten(), even one
+	//   the kernel refused, so callers can keep their write queues in step
+	void writeDatagrams(const QList<QByteArray> &bufs, const QHostAddress &address, quint16 port)
+	{
+#ifdef HAVE_SENDMMSG
+		// an IPv6 socket needs IPv4 destinations in v4-mapped form
+		QHostAddress dest = address;
+		if(address.protocol() == QAbstractSocket::IPv4Protocol && sock->localAddress().protocol() == QAbstractSocket::IPv6Protocol)
+			dest = QHostAddress(QString("::ffff:") + address.toString());
+
+		struct sockaddr_storage to;
+		memset(&to, 0, sizeof(to));
+		socklen_t tolen;
+		if(dest.protocol() == QAbstractSocket::IPv6Protocol)
+		{
+			struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)&to;
+			Q_IPV6ADDR a6 = dest.toIPv6Address();
+			sa6->sin6_family = AF_INET6;
+			sa6->sin6_port = htons(port);
+			memcpy(&sa6->sin6_addr, &a6, sizeof(a6));
+			sa6->sin6_scope_id = dest.scopeId().toUInt();
+			tolen = sizeof(struct sockaddr_in6);
+		}
+		else
+		{
+			struct sockaddr_in *sa = (struct sockaddr_in *)&to;
+			sa->sin_family = AF_INET;
+			sa->sin_port = htons(port);
+			sa->sin_addr.s_addr = htonl(dest.toIPv4Address());
+			tolen = sizeof(struct sockaddr_in);
+		}
+
+		int at = 0;
+		while(at < bufs.count())
+		{
+			int count = qMin(bufs.count() - at, BATCH_COUNT);
+			struct mmsghdr msgs[BATCH_COUNT];
+			struct iovec iov[BATCH_COUNT];
+			memset(msgs, 0, sizeof(struct mmsghdr) * count);
+			for(int n = 0; n < count; ++n)
+			{
+				const QByteArray &buf = bufs[at + n];
+				iov[n].iov_base = (void *)buf.constData();
+				iov[n].iov_len = buf.size();
+				msgs[n].msg_hdr.msg_iov = &iov[n];
+				msgs[n].msg_hdr.msg_iovlen = 1;
+				msgs[n].msg_hdr.msg_name = &to;
+				msgs[n].msg_hdr.msg_namelen = tolen;
+			}
+
+			// a short count means the send buffer is full.  udp may
+			//   drop anyway, so treat the rest of this chunk as sent
+			sendmmsg(sock->socketDescriptor(), msgs, count, MSG_DONTWAIT);
+			at += count;
+		}
+
+		writtenCount += bufs.count();
+		sess.deferExclusive(this, &SafeUdpSocket::processWritten);
+#else
+		foreach(const QByteArray &buf, bufs)
+			sock->writeDatagram(buf, address, port);
+#endif
+	}
+
 signals:
 	void readyRead();
 	void datagramsWritten(int count);
@@ -131,7 +308,7 @@ private slots:
 		Q_UNUSED(bytes);
 
 		++writtenCount;
-		sess.deferExclusive(this, "processWritten");
+		sess.deferExclusive(this, &SafeUdpSocket::processWritten);
 	}
 
 	void processWritten()
@@ -187,9 +364,11 @@ public:
 	QUdpSocket *extSock;
 	SafeUdpSocket *sock;
 	StunTransactionPool *pool;
-	StunBinding *stunBinding;
+	QList<StunBinding*> stunBindings; // asked in parallel, first answer wins
 	TurnClient *turn;
 	bool turnActivated;
+	bool bindPending, turnPending; // started by stunStart() and not over yet
+	bool stunDone;
 	QHostAddress addr;
 	int port;
 	QHostAddress refAddr;
@@ -198,6 +377,9 @@ public:
 	int relPort;
 	QHostAddress stunBindAddr;
 	int stunBindPort;
+	QList<QHostAddress> moreBindAddrs;
+	QList<int> moreBindPorts;
+	bool mappingVaries;
 	QHostAddress stunRelayAddr;
 	int stunRelayPort;
 	QString stunUser;
@@ -209,6 +391,8 @@ public:
 	int retryCount;
 	bool stopping;
 	int debugLevel;
+	bool batchedReceive;
+	bool pinToRelay;
 
 	Private(IceLocalTransport *_q) :
 		QObject(_q),
@@ -217,15 +401,20 @@ public:
 		extSock(0),
 		sock(0),
 		pool(0),
-		stunBinding(0),
 		turn(0),
 		turnActivated(false),
+		bindPending(false),
+		turnPending(false),
+		stunDone(false),
 		port(-1),
 		refPort(-1),
 		relPort(-1),
 		retryCount(0),
 		stopping(false),
-		debugLevel(IceTransport::DL_None)
+		debugLevel(IceTransport::DL_None),
+		batchedReceive(false),
+		pinToRelay(false),
+		mappingVaries(false)
 	{
 	}
 
@@ -238,8 +427,8 @@ public:
 	{
 		sess.reset();
 
-		delete stunBinding;
-		stunBinding = 0;
+		qDeleteAll(stunBindings);
+		stunBindings.clear();
 
 		delete turn;
 		turn = 0;
@@ -278,7 +467,7 @@ public:
 	{
 		Q_ASSERT(!sock);
 
-		sess.defer(this, "postStart");
+		sess.defer(this, &Private::postStart);
 	}
 
 	void stop()
@@ -291,7 +480,7 @@ public:
 		if(turn)
 			turn->close();
 		else
-			sess.defer(this, "postStop");
+			sess.defer(this, &Private::postStop);
 	}
 
 	void stunStart()
@@ -311,12 +500,16 @@ public:
 			pool->setPassword(stunPass);
 		}
 
+		bindPending = !stunBindAddr.isNull();
+		turnPending = !stunRelayAddr.isNull();
+
 		if(!stunBindAddr.isNull())
 		{
-			stunBinding = new StunBinding(pool);
-			connect(stunBinding, SIGNAL(success()), SLOT(binding_success()));
-			connect(stunBinding, SIGNAL(error(XMPP::StunBinding::Error)), SLOT(binding_error(XMPP::StunBinding::Error)));
-			stunBinding->start(stunBindAddr, stunBindPort);
+			// all at once, so that a slow or dead server costs nothing
+			//   as long as another one answers
+			startBinding(stunBindAddr, stunBindPort);
+			for(int n = 0; n < moreBindAddrs.count(); ++n)
+				startBinding(moreBindAddrs[n], moreBindPorts[n]);
 		}
 
 		if(!stunRelayAddr.isNull())
@@ -325,6 +518,27 @@ public:
 		}
 	}
 
+	void startBinding(const QHostAddress &addr, int port)
+	{
+		StunBinding *binding = new StunBinding(pool);
+		connect(binding, SIGNAL(success()), SLOT(binding_success()));
+		connect(binding, SIGNAL(error(XMPP::StunBinding::Error)), SLOT(binding_error(XMPP::StunBinding::Error)));
+		stunBindings += binding;
+		binding->start(addr, port);
+	}
+
+	bool isStunServer(const QHostAddress &addr, int port) const
+	{
+		if((addr == stunBindAddr && port == stunBindPort) || (addr == stunRelayAddr && port == stunRelayPort))
+			return true;
+		for(int n = 0; n < moreBindAddrs.count(); ++n)
+		{
+			if(addr == moreBindAddrs[n] && port == moreBindPorts[n])
+				return true;
+		}
+		return false;
+	}
+
 	void do_turn()
 	{
 		turn = new TurnClient(this);
@@ -340,6 +554,14 @@ public:
 
 		turn->setClientSoftwareNameAndVersion(clientSoftware);
 
+		// keep the server's replies from going to another socket of
+		//   the port's SO_REUSEPORT group
+		if(pinToRelay && !UdpPortReserver::pinPeer(sock->socket(), stunRelayAddr, stunRelayPort))
+		{
+			if(debugLevel >= IceTransport::DL_Info)
+				emit q->debugLine("unable to pin socket to the TURN server");
+		}
+
 		turn->connectToHost(pool, stunRelayAddr, stunRelayPort);
 	}
 
@@ -362,6 +584,7 @@ private:
 	{
 		addr = sock->localAddress();
 		port = sock->localPort();
+		sock->setBatched(batchedReceive);
 
 		connect(sock, SIGNAL(readyRead()), SLOT(sock_readyRead()));
 		connect(sock, SIGNAL(datagramsWritten(int)), SLOT(sock_datagramsWritten(int)));
@@ -423,8 +646,9 @@ private:
 		QHostAddress dataAddr;
 		int dataPort;
 
-		bool notStun;
-		if(!pool->writeIncomingMessage(buf, &notStun, fromAddr, fromPort) && turn)
+		// ChannelData can never be STUN, so don't bother the pool
+		bool notStun = (turn && buf.size() >= 4 && ((quint8)buf[0] & 0xc0) == 0x40);
+		if((notStun || !pool->writeIncomingMessage(buf, &notStun, fromAddr, fromPort)) && turn)
 		{
 			data = turn->processIncomingDatagram(buf, notStun, &dataAddr, &dataPort);
 			if(!data.isNull())
@@ -484,33 +708,37 @@ private slots:
 		QList<Datagram> dreads;
 		QList<Datagram> rreads;
 
-		while(sock->hasPendingDatagrams())
+		QList<SafeUdpSocket::Datagram> batch;
+		while(sock->readDatagrams(&batch) > 0)
 		{
-			QHostAddress from;
-			quint16 fromPort;
+			foreach(const SafeUdpSocket::Datagram &raw, batch)
+			{
+				const QHostAddress &from = raw.addr;
+				quint16 fromPort = raw.port;
 
-			Datagram dg;
+				Datagram dg;
 
-			QByteArray buf = sock->readDatagram(&from, &fromPort);
-			if((from == stunBindAddr && fromPort == stunBindPort) || (from == stunRelayAddr && fromPort == stunRelayPort))
-			{
-				bool haveData = processIncomingStun(buf, from, fromPort, &dg);
+				if(isStunServer(from, fromPort))
+				{
+					bool haveData = processIncomingStun(raw.buf, from, fromPort, &dg);
 
-				// processIncomingStun could cause signals to
-				//   emit.  for example, stopped()
-				if(!watch.isValid())
-					return;
+					// processIncomingStun could cause signals to
+					//   emit.  for example, stopped()
+					if(!watch.isValid())
+						return;
 
-				if(haveData)
-					rreads += dg;
-			}
-			else
-			{
-				dg.addr = from;
-				dg.port = fromPort;
-				dg.buf = buf;
-				dreads += dg;
+					if(haveData)
+						rreads += dg;
+				}
+				else
+				{
+					dg.addr = from;
+					dg.port = fromPort;
+					dg.buf = raw.buf;
+					dreads += dg;
+				}
 			}
+			batch.clear();
 		}
 
 		if(dreads.count() > 0)
@@ -615,23 +843,66 @@ private slots:
 		emit q->debugLine(line);
 	}
 
+	// once the binding and the allocation are each through, one way
+	//   or the other
+	void checkStunFinished()
+	{
+		if(stunDone || bindPending || turnPending)
+			return;
+
+		stunDone = true;
+		emit q->stunFinished();
+	}
+
 	void binding_success()
 	{
-		refAddr = stunBinding->reflexiveAddress();
-		refPort = stunBinding->reflexivePort();
+		StunBinding *binding = static_cast<StunBinding*>(sender());
+		QHostAddress addr = binding->reflexiveAddress();
+		int port = binding->reflexivePort();
+
+		stunBindings.removeAll(binding);
+		delete binding;
+
+		// a later answer only tells whether the NAT maps every
+		//   destination the same way
+		if(!bindPending)
+		{
+			if(!mappingVaries && (addr != refAddr || port != refPort))
+			{
+				mappingVaries = true;
+				if(debugLevel >= IceTransport::DL_Info)
+					emit q->debugLine(QString("STUN servers disagree on our address, also got ") + addr.toString() + ';' + QString::number(port));
+			}
+			return;
+		}
 
-		delete stunBinding;
-		stunBinding = 0;
+		refAddr = addr;
+		refPort = port;
+		bindPending = false;
 
+		ObjectSessionWatcher watch(&sess);
 		emit q->addressesChanged();
+		if(!watch.isValid())
+			return;
+
+		checkStunFinished();
 	}
 
 	void binding_error(XMPP::StunBinding::Error e)
 	{
 		Q_UNUSED(e);
 
-		delete stunBinding;
-		stunBinding = 0;
+		StunBinding *binding = static_cast<StunBinding*>(sender());
+		stunBindings.removeAll(binding);
+		delete binding;
+
+		// wait for the others
+		if(!bindPending || !stunBindings.isEmpty())
+			return;
+
+		bindPending = false;
+
+		checkStunFinished();
 
 		// don't report any error
 		//if(stunType == IceLocalTransport::Basic || (stunType == IceLocalTransport::Auto && !turn))
@@ -683,8 +954,14 @@ private slots:
 			emit q->debugLine(QString("Server relays via ") + relAddr.toString() + ';' + QString::number(relPort));
 
 		turnActivated = true;
+		turnPending = false;
 
+		ObjectSessionWatcher watch(&sess);
 		emit q->addressesChanged();
+		if(!watch.isValid())
+			return;
+
+		checkStunFinished();
 	}
 
 	void turn_packetsWritten(int count, const QHostAddress &addr, int port)
@@ -713,6 +990,9 @@ private slots:
 		if(wasActivated)
 			return;
 
+		turnPending = false;
+		checkStunFinished();
+
 		// don't report any error
 		//if(stunType == IceLocalTransport::Relay || (stunType == IceLocalTransport::Auto && !stunBinding))
 		//	emit q->addressesChanged();
@@ -748,6 +1028,18 @@ void IceLocalTransport::setClientSoftwareNameAndVersion(const QString &str)
 	d->clientSoftware = str;
 }
 
+void IceLocalTransport::setBatchedReceive(bool enabled)
+{
+	d->batchedReceive = enabled;
+	if(d->sock)
+		d->sock->setBatched(enabled);
+}
+
+void IceLocalTransport::setPinnedToRelay(bool enabled)
+{
+	d->pinToRelay = enabled;
+}
+
 void IceLocalTransport::start(QUdpSocket *sock)
 {
 	d->extSock = sock;
@@ -771,6 +1063,17 @@ void IceLocalTransport::setStunBindService(const QHostAddress &addr, int port)
 	d->stunBindPort = port;
 }
 
+void IceLocalTransport::addStunBindService(const QHostAddress &addr, int port)
+{
+	d->moreBindAddrs += addr;
+	d->moreBindPorts += port;
+}
+
+bool IceLocalTransport::reflexiveMappingVaries() const
+{
+	return d->mappingVaries;
+}
+
 void IceLocalTransport::setStunRelayService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass)
 {
 	d->stunRelayAddr = addr;
@@ -814,6 +1117,11 @@ int IceLocalTransport::relayedPort() const
 	return d->relPort;
 }
 
+bool IceLocalTransport::isStunFinished() const
+{
+	return d->stunDone;
+}
+
 void IceLocalTransport::addChannelPeer(const QHostAddress &addr, int port)
 {
 	if(d->turn)
@@ -874,6 +1182,22 @@ void IceLocalTransport::writeDatagram(int path, const QByteArray &buf, const QHo
 		Q_ASSERT(0);
 }
 
+void IceLocalTransport::writeDatagrams(int path, const QList<QByteArray> &bufs, const QHostAddress &addr, int port)
+{
+	if(path == Direct)
+	{
+		Private::WriteItem wi;
+		wi.type = Private::WriteItem::Direct;
+		wi.addr = addr;
+		wi.port = port;
+		for(int n = 0; n < bufs.count(); ++n)
+			d->pendingWrites += wi;
+		d->sock->writeDatagrams(bufs, addr, port);
+	}
+	else
+		IceTransport::writeDatagrams(path, bufs, addr, port);
+}
+
 void IceLocalTransport::setDebugLevel(DebugLevel level)
 {
 	d->debugLevel = level;
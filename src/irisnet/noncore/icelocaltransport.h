@@ -53,6 +53,19 @@ public:
 
 	void setClientSoftwareNameAndVersion(const QString &str);
 
+	// read incoming datagrams in batches of up to 32 per system call
+	//   (recvmmsg on Linux).  batched datagrams larger than 4KB are
+	//   dropped, so only turn this on for media-sized traffic.
+	void setBatchedReceive(bool enabled);
+
+	// for sockets from a UdpPortReserver with setReusePort() on: connect
+	//   the socket to the TURN server when the relay starts, so that the
+	//   server's datagrams reach this transport and not another socket
+	//   sharing the port (see UdpPortReserver::pinPeer()).  only the
+	//   relayed path is useful then, since the direct path no longer
+	//   receives from anyone but the server.  set before stunStart().
+	void setPinnedToRelay(bool enabled);
+
 	// passed socket must already be bind()'ed, don't support
 	//   ErrorMismatch retries
 	void start(QUdpSocket *sock);
@@ -62,6 +75,12 @@ public:
 	void start(const QHostAddress &addr);
 
 	void setStunBindService(const QHostAddress &addr, int port);
+
+	// more STUN servers, asked at the same time as the one above.  the
+	//   first answer gives the server reflexive address, the later ones
+	//   are compared with it.  set before stunStart()
+	void addStunBindService(const QHostAddress &addr, int port);
+
 	void setStunRelayService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass);
 
 	// obtain relay / reflexive
@@ -73,14 +92,24 @@ public:
 	QHostAddress serverReflexiveAddress() const;
 	int serverReflexivePort() const;
 
+	// true if the STUN servers reported different addresses: the NAT maps
+	//   each destination to a port of its own, and the peer is unlikely
+	//   to reach the server reflexive address
+	bool reflexiveMappingVaries() const;
+
 	QHostAddress relayedAddress() const;
 	int relayedPort() const;
 
+	// true once the binding and the allocation started by stunStart()
+	//   have each succeeded or failed, see stunFinished()
+	bool isStunFinished() const;
+
 	// reimplemented
 	virtual void stop();
 	virtual bool hasPendingDatagrams(int path) const;
 	virtual QByteArray readDatagram(int path, QHostAddress *addr, int *port);
 	virtual void writeDatagram(int path, const QByteArray &buf, const QHostAddress &addr, int port);
+	virtual void writeDatagrams(int path, const QList<QByteArray> &bufs, const QHostAddress &addr, int port);
 	virtual void addChannelPeer(const QHostAddress &addr, int port);
 	virtual void setDebugLevel(DebugLevel level);
 
@@ -92,6 +121,10 @@ signals:
 	//   and this signal will only be emitted to add addresses
 	void addressesChanged();
 
+	// emitted once, after the last addressesChanged() that stunStart()
+	//   leads to.  the addresses that are not set by then won't be
+	void stunFinished();
+
 private:
 	class Private;
 	friend class Private;
@@ -0,0 +1,201 @@
+/*
+ * icerelayprobe.cpp - measure the round trip to STUN/TURN servers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "icerelayprobe.h"
+
+#include <QTime>
+#include <QTimer>
+#include <QUdpSocket>
+#include "stuntransaction.h"
+#include "stunbinding.h"
+#include "stunmessage.h"
+
+namespace XMPP {
+
+class IceRelayProbe::Private : public QObject
+{
+	Q_OBJECT
+
+public:
+	IceRelayProbe *q;
+	QUdpSocket *sock4, *sock6;
+	StunTransactionPool *pool;
+	QTimer *timer;
+	QList<Server> servers;
+	QList<StunBinding*> bindings;
+	QList<int> rtts;
+	QTime time;
+	int pending;
+
+	Private(IceRelayProbe *_q) :
+		QObject(_q),
+		q(_q),
+		sock4(0),
+		sock6(0),
+		pool(0),
+		pending(0)
+	{
+		timer = new QTimer(this);
+		timer->setSingleShot(true);
+		connect(timer, SIGNAL(timeout()), SLOT(t_timeout()));
+	}
+
+	~Private()
+	{
+		// transactions go before the pool
+		qDeleteAll(bindings);
+		delete pool;
+	}
+
+	QUdpSocket *ensureSocket(const QHostAddress &addr)
+	{
+		bool v6 = addr.protocol() == QAbstractSocket::IPv6Protocol;
+		QUdpSocket *&sock = v6 ? sock6 : sock4;
+		if(!sock)
+		{
+			sock = new QUdpSocket(this);
+			connect(sock, SIGNAL(readyRead()), SLOT(sock_readyRead()));
+			if(!sock->bind(v6 ? QHostAddress(QHostAddress::AnyIPv6) : QHostAddress(QHostAddress::Any), 0))
+			{
+				delete sock;
+				sock = 0;
+			}
+		}
+		return sock;
+	}
+
+	void start(const QList<Server> &_servers, int timeout)
+	{
+		servers = _servers;
+		rtts.clear();
+		for(int n = 0; n < servers.count(); ++n)
+			rtts += -1;
+
+		pool = new StunTransactionPool(StunTransaction::Udp, this);
+		connect(pool, SIGNAL(outgoingMessage(const QByteArray &, const QHostAddress &, int)), SLOT(pool_outgoingMessage(const QByteArray &, const QHostAddress &, int)));
+
+		time.start();
+		for(int n = 0; n < servers.count(); ++n)
+		{
+			StunBinding *binding = 0;
+			if(ensureSocket(servers[n].addr))
+			{
+				binding = new StunBinding(pool);
+				connect(binding, SIGNAL(success()), SLOT(binding_success()));
+				connect(binding, SIGNAL(error(XMPP::StunBinding::Error)), SLOT(binding_error(XMPP::StunBinding::Error)));
+				++pending;
+			}
+			bindings += binding;
+		}
+
+		if(pending == 0)
+		{
+			QMetaObject::invokeMethod(q, "finished", Qt::QueuedConnection);
+			return;
+		}
+
+		timer->start(timeout);
+		for(int n = 0; n < bindings.count(); ++n)
+		{
+			if(bindings[n])
+				bindings[n]->start(servers[n].addr, servers[n].port);
+		}
+	}
+
+	void done(StunBinding *binding, bool ok)
+	{
+		int at = bindings.indexOf(binding);
+		if(at == -1 || pending == 0)
+			return;
+
+		if(ok)
+			rtts[at] = time.elapsed();
+		if(--pending == 0)
+		{
+			timer->stop();
+			emit q->finished();
+		}
+	}
+
+private slots:
+	void sock_readyRead()
+	{
+		QUdpSocket *sock = static_cast<QUdpSocket*>(sender());
+		while(sock->hasPendingDatagrams())
+		{
+			QByteArray buf(sock->pendingDatagramSize(), 0);
+			QHostAddress from;
+			quint16 fromPort;
+			sock->readDatagram(buf.data(), buf.size(), &from, &fromPort);
+
+			StunMessage message = StunMessage::fromBinary(buf);
+			if(!message.isNull())
+				pool->writeIncomingMessage(message, from, fromPort);
+		}
+	}
+
+	void pool_outgoingMessage(const QByteArray &packet, const QHostAddress &toAddress, int toPort)
+	{
+		QUdpSocket *sock = ensureSocket(toAddress);
+		if(sock)
+			sock->writeDatagram(packet, toAddress, toPort);
+	}
+
+	void binding_success()
+	{
+		done(static_cast<StunBinding*>(sender()), true);
+	}
+
+	void binding_error(XMPP::StunBinding::Error e)
+	{
+		Q_UNUSED(e);
+		done(static_cast<StunBinding*>(sender()), false);
+	}
+
+	void t_timeout()
+	{
+		pending = 0;
+		emit q->finished();
+	}
+};
+
+IceRelayProbe::IceRelayProbe(QObject *parent) :
+	QObject(parent)
+{
+	d = new Private(this);
+}
+
+IceRelayProbe::~IceRelayProbe()
+{
+	delete d;
+}
+
+void IceRelayProbe::start(const QList<Server> &servers, int timeout)
+{
+	d->start(servers, timeout);
+}
+
+QList<int> IceRelayProbe::rtts() const
+{
+	return d->rtts;
+}
+
+}
+
+#include "icerelayprobe.moc"
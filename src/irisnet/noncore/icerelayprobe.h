@@ -0,0 +1,78 @@
+/*
+ * icerelayprobe.h - measure the round trip to STUN/TURN servers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ICERELAYPROBE_H
+#define ICERELAYPROBE_H
+
+#include <QObject>
+#include <QList>
+#include <QHostAddress>
+
+namespace XMPP {
+
+// sends each server one unauthenticated STUN binding request, all at
+//   once from a single socket, and times the responses.  TURN servers
+//   answer these without an allocation, so this is how Ice176 picks the
+//   nearest of several relays.  finished() is emitted once every server
+//   has answered or failed, or the timeout is up
+class IceRelayProbe : public QObject
+{
+	Q_OBJECT
+
+public:
+	class Server
+	{
+	public:
+		QHostAddress addr;
+		int port;
+
+		Server() :
+			port(-1)
+		{
+		}
+
+		Server(const QHostAddress &_addr, int _port) :
+			addr(_addr),
+			port(_port)
+		{
+		}
+	};
+
+	IceRelayProbe(QObject *parent = 0);
+	~IceRelayProbe();
+
+	// timeout in msecs
+	void start(const QList<Server> &servers, int timeout);
+
+	// the round trip to each server in msecs, in the order given to
+	//   start(), or -1 for those that didn't answer
+	QList<int> rtts() const;
+
+signals:
+	void finished();
+
+private:
+	class Private;
+	friend class Private;
+	Private *d;
+};
+
+}
+
+#endif
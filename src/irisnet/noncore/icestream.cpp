@@ -0,0 +1,490 @@
+/*
+ * icestream.cpp - reliable byte stream over an ICE component
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "icestream.h"
+
+#include <QList>
+#include <QMap>
+#include <QTime>
+#include <QTimer>
+#include "ice176.h"
+
+// datagrams:
+//   data: type (1), flags (1), sequence number (4), payload
+//   ack:  type (1), 0 (1), next sequence number expected (4),
+//         datagrams the receiver still takes (2)
+// all numbers are big endian.  the fin flag marks the end of the stream
+//   and carries no payload
+
+#define TYPE_DATA 1
+#define TYPE_ACK  2
+#define FLAG_FIN  0x01
+
+#define HEADER_SIZE 6
+#define ACK_SIZE    8
+
+// payload per datagram.  stays below the path mtu with room for a TURN
+//   header, so that a relayed pair doesn't fragment either
+#define PAYLOAD_SIZE 1152
+
+// datagrams the receiver keeps out of order, which is also the most the
+//   sender puts in flight
+#define MAX_WINDOW 256
+
+// retransmits of the same datagram before giving up
+#define MAX_TRIES 8
+
+#define MIN_RTO 200
+#define MAX_RTO 60000
+#define INITIAL_RTO 1000
+
+namespace XMPP {
+
+static void write32(char *p, quint32 x)
+{
+	p[0] = (char)((x >> 24) & 0xff);
+	p[1] = (char)((x >> 16) & 0xff);
+	p[2] = (char)((x >> 8) & 0xff);
+	p[3] = (char)(x & 0xff);
+}
+
+static quint32 read32(const char *p)
+{
+	const uchar *u = (const uchar *)p;
+	return ((quint32)u[0] << 24) | ((quint32)u[1] << 16) | ((quint32)u[2] << 8) | (quint32)u[3];
+}
+
+// sequence numbers wrap, so compare by distance
+static inline int seqDiff(quint32 a, quint32 b)
+{
+	return (int)(qint32)(a - b);
+}
+
+class IceStream::Private
+{
+public:
+	class Segment
+	{
+	public:
+		QByteArray packet;
+		int size; // payload
+		bool fin;
+		int tries;
+		QTime sentAt;
+	};
+
+	Ice176 *ice;
+	int componentIndex;
+	QTimer *timer;
+	bool open;
+	bool closing, finSent;
+	bool peerClosed, closeSignalled;
+
+	// sending
+	quint32 sendBase; // first not acknowledged
+	quint32 sendNext;
+	QList<Segment> unacked; // sendBase up to sendNext
+	int unackedBytes;
+	double cwnd;
+	int ssthresh;
+	int peerWindow;
+	int dupAcks;
+	bool inRecovery;
+	quint32 recover; // recovery ends once this is acknowledged
+	int srtt, rttvar, rto;
+
+	// receiving
+	quint32 recvNext;
+	QMap<quint32, QByteArray> outOfOrder;
+	bool ackPending;
+	bool gotData;
+
+	Private() :
+		ice(0),
+		componentIndex(0),
+		timer(0),
+		open(true),
+		closing(false),
+		finSent(false),
+		peerClosed(false),
+		closeSignalled(false),
+		sendBase(0),
+		sendNext(0),
+		unackedBytes(0),
+		cwnd(2),
+		ssthresh(MAX_WINDOW),
+		peerWindow(MAX_WINDOW),
+		dupAcks(0),
+		inRecovery(false),
+		recover(0),
+		srtt(-1),
+		rttvar(0),
+		rto(INITIAL_RTO),
+		recvNext(0),
+		ackPending(false),
+		gotData(false)
+	{
+	}
+
+	void rttSample(int ms)
+	{
+		if(srtt < 0)
+		{
+			srtt = ms;
+			rttvar = ms / 2;
+		}
+		else
+		{
+			rttvar = (3 * rttvar + qAbs(srtt - ms)) / 4;
+			srtt = (7 * srtt + ms) / 8;
+		}
+		rto = qBound(MIN_RTO, srtt + qMax(10, 4 * rttvar), MAX_RTO);
+	}
+
+	// cut the window on loss, once per loss event
+	void enterRecovery()
+	{
+		ssthresh = qMax(unacked.count() / 2, 2);
+		inRecovery = true;
+		recover = sendNext;
+	}
+};
+
+IceStream::IceStream(Ice176 *ice, int componentIndex, QObject *parent) :
+	ByteStream(parent)
+{
+	d = new Private;
+	d->ice = ice;
+	d->componentIndex = componentIndex;
+	d->timer = new QTimer(this);
+	d->timer->setSingleShot(true);
+	connect(d->timer, SIGNAL(timeout()), SLOT(t_timeout()));
+
+	// the connectivity checks already measured the path
+	int rtt = ice->componentStats(componentIndex).rtt;
+	if(rtt > 0)
+		d->rto = qBound(MIN_RTO, 3 * rtt, MAX_RTO);
+
+	connect(ice, SIGNAL(readyRead(int)), SLOT(ice_readyRead(int)));
+
+	// the peer may have been quicker
+	if(ice->hasPendingDatagrams(componentIndex))
+		QTimer::singleShot(0, this, SLOT(doReadPending()));
+}
+
+IceStream::~IceStream()
+{
+	delete d;
+}
+
+int IceStream::congestionWindow() const
+{
+	return (int)d->cwnd;
+}
+
+int IceStream::rtt() const
+{
+	return d->srtt;
+}
+
+bool IceStream::isOpen() const
+{
+	return d->open;
+}
+
+void IceStream::close()
+{
+	if(!d->open || d->closing)
+		return;
+
+	d->closing = true;
+	sendMore();
+}
+
+void IceStream::write(const QByteArray &a)
+{
+	if(!d->open || d->closing || a.isEmpty())
+		return;
+
+	appendWrite(a);
+	sendMore();
+}
+
+int IceStream::bytesToWrite() const
+{
+	return ByteStream::bytesToWrite() + d->unackedBytes;
+}
+
+void IceStream::ice_readyRead(int componentIndex)
+{
+	if(componentIndex != d->componentIndex)
+		return;
+
+	QList<QByteArray> list;
+	d->ice->readDatagrams(d->componentIndex, &list);
+	foreach(const QByteArray &buf, list)
+		processDatagram(buf);
+
+	// one ack for the whole batch
+	if(d->ackPending)
+		sendAck();
+
+	if(d->gotData)
+	{
+		d->gotData = false;
+		emit readyRead();
+	}
+
+	if(d->peerClosed && !d->closeSignalled)
+	{
+		d->closeSignalled = true;
+		if(d->unacked.isEmpty() && ByteStream::bytesToWrite() == 0)
+			d->open = false;
+		emit connectionClosed();
+	}
+}
+
+void IceStream::doReadPending()
+{
+	ice_readyRead(d->componentIndex);
+}
+
+void IceStream::processDatagram(const QByteArray &buf)
+{
+	if(buf.size() < HEADER_SIZE)
+		return;
+
+	const char *p = buf.data();
+	quint32 seq = read32(p + 2);
+	if(p[0] == TYPE_DATA)
+	{
+		processData(seq, buf);
+	}
+	else if(p[0] == TYPE_ACK && buf.size() >= ACK_SIZE)
+	{
+		int window = ((uchar)p[6] << 8) | (uchar)p[7];
+		processAck(seq, window);
+	}
+}
+
+void IceStream::processData(quint32 seq, const QByteArray &buf)
+{
+	// duplicates get acknowledged again, in case the ack was lost
+	d->ackPending = true;
+
+	int offset = seqDiff(seq, d->recvNext);
+	if(offset < 0 || offset >= MAX_WINDOW)
+		return;
+
+	if(offset > 0)
+	{
+		d->outOfOrder.insert(seq, buf);
+		return;
+	}
+
+	QByteArray next = buf;
+	while(true)
+	{
+		if(next.size() > HEADER_SIZE)
+		{
+			appendRead(next.mid(HEADER_SIZE));
+			d->gotData = true;
+		}
+		if(next[1] & FLAG_FIN)
+			d->peerClosed = true;
+		++d->recvNext;
+
+		QMap<quint32, QByteArray>::Iterator it = d->outOfOrder.find(d->recvNext);
+		if(it == d->outOfOrder.end())
+			break;
+		next = it.value();
+		d->outOfOrder.erase(it);
+	}
+}
+
+void IceStream::processAck(quint32 next, int window)
+{
+	d->peerWindow = qMin(window, MAX_WINDOW);
+
+	int acked = seqDiff(next, d->sendBase);
+	if(acked < 0 || acked > d->unacked.count())
+		return;
+
+	if(acked == 0)
+	{
+		if(d->unacked.isEmpty())
+			return;
+
+		// fast retransmit
+		if(++d->dupAcks == 3 && !d->inRecovery)
+		{
+			d->enterRecovery();
+			d->cwnd = d->ssthresh;
+			resendFirst();
+		}
+		return;
+	}
+
+	d->dupAcks = 0;
+	int bytes = 0;
+	bool finAcked = false;
+	for(int n = 0; n < acked; ++n)
+	{
+		Private::Segment s = d->unacked.takeFirst();
+
+		// karn: retransmitted datagrams say nothing about the rtt
+		if(s.tries == 1)
+			d->rttSample(s.sentAt.elapsed());
+		bytes += s.size;
+		if(s.fin)
+			finAcked = true;
+
+		if(d->cwnd < d->ssthresh)
+			d->cwnd += 1;
+		else
+			d->cwnd += 1.0 / d->cwnd;
+	}
+	d->cwnd = qMin(d->cwnd, (double)MAX_WINDOW);
+	d->unackedBytes -= bytes;
+	d->sendBase = next;
+
+	if(d->inRecovery)
+	{
+		// a partial ack means the next one was lost as well
+		if(seqDiff(next, d->recover) >= 0)
+			d->inRecovery = false;
+		else if(!d->unacked.isEmpty())
+			resendFirst();
+	}
+
+	if(d->unacked.isEmpty())
+		d->timer->stop();
+	else
+		d->timer->start(d->rto);
+
+	sendMore();
+
+	if(bytes > 0)
+		emit bytesWritten(bytes);
+
+	if(finAcked)
+	{
+		d->open = false;
+		emit delayedCloseFinished();
+	}
+}
+
+void IceStream::sendMore()
+{
+	int window = qMin((int)d->cwnd, d->peerWindow);
+
+	// never stall completely on a zero window
+	window = qMax(window, 1);
+
+	QList<QByteArray> out;
+	while(d->unacked.count() < window)
+	{
+		Private::Segment s;
+		s.tries = 1;
+		s.fin = false;
+
+		if(ByteStream::bytesToWrite() > 0)
+		{
+			QByteArray payload = takeWrite(PAYLOAD_SIZE);
+			s.size = payload.size();
+			s.packet.resize(HEADER_SIZE + s.size);
+			memcpy(s.packet.data() + HEADER_SIZE, payload.data(), s.size);
+			s.packet[1] = 0;
+		}
+		else if(d->closing && !d->finSent)
+		{
+			s.size = 0;
+			s.fin = true;
+			s.packet.resize(HEADER_SIZE);
+			s.packet[1] = FLAG_FIN;
+			d->finSent = true;
+		}
+		else
+			break;
+
+		s.packet[0] = TYPE_DATA;
+		write32(s.packet.data() + 2, d->sendNext++);
+		s.sentAt.start();
+		d->unacked += s;
+		d->unackedBytes += s.size;
+		out += s.packet;
+	}
+
+	if(out.isEmpty())
+		return;
+
+	d->ice->writeDatagrams(d->componentIndex, out);
+	if(!d->timer->isActive())
+		d->timer->start(d->rto);
+}
+
+void IceStream::sendAck()
+{
+	d->ackPending = false;
+
+	QByteArray buf(ACK_SIZE, 0);
+	int window = MAX_WINDOW - d->outOfOrder.count();
+	buf[0] = TYPE_ACK;
+	write32(buf.data() + 2, d->recvNext);
+	buf[6] = (char)((window >> 8) & 0xff);
+	buf[7] = (char)(window & 0xff);
+	d->ice->writeDatagram(d->componentIndex, buf);
+}
+
+void IceStream::resendFirst()
+{
+	Private::Segment &s = d->unacked.first();
+	++s.tries;
+	s.sentAt.start();
+	d->ice->writeDatagram(d->componentIndex, s.packet);
+}
+
+void IceStream::t_timeout()
+{
+	if(d->unacked.isEmpty())
+		return;
+
+	if(d->unacked.first().tries >= MAX_TRIES)
+	{
+		lost();
+		return;
+	}
+
+	// back to slow start
+	d->enterRecovery();
+	d->cwnd = 1;
+	d->dupAcks = 0;
+	d->rto = qMin(d->rto * 2, MAX_RTO);
+	resendFirst();
+	d->timer->start(d->rto);
+}
+
+void IceStream::lost()
+{
+	d->timer->stop();
+	d->open = false;
+	emit error(ErrTimeout);
+}
+
+}
@@ -0,0 +1,83 @@
+/*
+ * icestream.h - reliable byte stream over an ICE component
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ICESTREAM_H
+#define ICESTREAM_H
+
+#include "bytestream.h"
+
+namespace XMPP {
+
+class Ice176;
+
+// a reliable, ordered byte stream over one component of an Ice176 session
+//   that is ready (see Ice176::componentReady()).  data goes out in
+//   numbered datagrams which the peer acknowledges, and what isn't
+//   acknowledged in time is sent again.  the amount in flight follows TCP
+//   congestion control (slow start, additive increase, halving on loss,
+//   RFC 5681), with the retransmit timeout taken from measured round trips
+//   (RFC 6298).  both sides need an IceStream on the component, and nothing
+//   else may read from it meanwhile.  close() ends the stream after the
+//   data written so far has been acknowledged, and the peer then gets
+//   connectionClosed()
+class IceStream : public ByteStream
+{
+	Q_OBJECT
+
+public:
+	// the peer stopped acknowledging
+	enum Error { ErrTimeout = ErrCustom };
+
+	// ownership of ice is not passed.  it has to outlive the stream
+	IceStream(Ice176 *ice, int componentIndex, QObject *parent = 0);
+	~IceStream();
+
+	// datagrams that may be in flight at once, and the smoothed round
+	//   trip time in msecs (-1 if not measured yet), for diagnostics
+	int congestionWindow() const;
+	int rtt() const;
+
+	// from ByteStream.  bytesToWrite() includes data sent but not
+	//   acknowledged yet, and bytesWritten() reports acknowledged data
+	bool isOpen() const;
+	void close();
+	void write(const QByteArray &);
+	int bytesToWrite() const;
+
+private slots:
+	void ice_readyRead(int componentIndex);
+	void t_timeout();
+	void doReadPending();
+
+private:
+	class Private;
+	Private *d;
+
+	void processDatagram(const QByteArray &buf);
+	void processAck(quint32 next, int window);
+	void processData(quint32 seq, const QByteArray &buf);
+	void sendMore();
+	void sendAck();
+	void resendFirst();
+	void lost();
+};
+
+}
+
+#endif
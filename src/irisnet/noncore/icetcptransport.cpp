@@ -0,0 +1,489 @@
+/*
+ * icetcptransport.cpp - ICE-TCP host transport (RFC 6544)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "icetcptransport.h"
+
+#include <QList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include "objectsession.h"
+
+// don't queue more incoming packets than this per transmit path
+#define MAX_PACKET_QUEUE 64
+
+// connections accepted or opened at once, per path
+#define MAX_CONNECTIONS 16
+
+// RFC 4571 frames carry a 16-bit length
+#define MAX_FRAME_SIZE 65535
+
+namespace XMPP {
+
+class IceTcpTransport::Private : public QObject
+{
+	Q_OBJECT
+
+public:
+	class Datagram
+	{
+	public:
+		QHostAddress addr;
+		int port;
+		QByteArray buf;
+	};
+
+	class Connection
+	{
+	public:
+		QTcpSocket *sock;
+		int path;
+
+		// the far end.  for accepted connections this is where the
+		//   peer connected from
+		QHostAddress addr;
+		int port;
+
+		// frames written before an active connection is up
+		QList<QByteArray> pendingWrites;
+
+		// frames handed to the socket but not yet written out
+		int framesToWrite;
+
+		// partial frame
+		QByteArray inbuf;
+
+		Connection() :
+			sock(0),
+			path(-1),
+			port(-1),
+			framesToWrite(0)
+		{
+		}
+	};
+
+	IceTcpTransport *q;
+	ObjectSession sess;
+	QTcpServer *server;
+	QHostAddress addr;
+	int port;
+	QList<Connection*> conns;
+	QList<Datagram> in[2];
+	bool stopping;
+	int debugLevel;
+
+	Private(IceTcpTransport *_q) :
+		QObject(_q),
+		q(_q),
+		sess(this),
+		server(0),
+		port(-1),
+		stopping(false),
+		debugLevel(IceTransport::DL_None)
+	{
+	}
+
+	~Private()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		sess.reset();
+
+		while(!conns.isEmpty())
+			removeConnection(conns.first());
+
+		delete server;
+		server = 0;
+
+		addr = QHostAddress();
+		port = -1;
+
+		in[0].clear();
+		in[1].clear();
+
+		stopping = false;
+	}
+
+	void start(const QHostAddress &_addr)
+	{
+		Q_ASSERT(!server);
+
+		addr = _addr;
+		sess.defer(this, &Private::postStart);
+	}
+
+	void stop()
+	{
+		Q_ASSERT(!stopping);
+
+		stopping = true;
+		sess.defer(this, &Private::postStop);
+	}
+
+	Connection *findConnection(int path, const QHostAddress &addr, int port) const
+	{
+		foreach(Connection *c, conns)
+		{
+			if(c->path == path && c->addr == addr && c->port == port)
+				return c;
+		}
+
+		return 0;
+	}
+
+	Connection *findConnection(QTcpSocket *sock) const
+	{
+		foreach(Connection *c, conns)
+		{
+			if(c->sock == sock)
+				return c;
+		}
+
+		return 0;
+	}
+
+	int connectionCount(int path) const
+	{
+		int count = 0;
+		foreach(const Connection *c, conns)
+		{
+			if(c->path == path)
+				++count;
+		}
+
+		return count;
+	}
+
+	Connection *addConnection(QTcpSocket *sock, int path, const QHostAddress &addr, int port)
+	{
+		Connection *c = new Connection;
+		c->sock = sock;
+		c->path = path;
+		c->addr = addr;
+		c->port = port;
+
+		sock->setParent(this);
+		connect(sock, SIGNAL(connected()), SLOT(sock_connected()));
+		connect(sock, SIGNAL(readyRead()), SLOT(sock_readyRead()));
+		connect(sock, SIGNAL(bytesWritten(qint64)), SLOT(sock_bytesWritten(qint64)));
+		connect(sock, SIGNAL(disconnected()), SLOT(sock_disconnected()));
+		connect(sock, SIGNAL(error(QAbstractSocket::SocketError)), SLOT(sock_error(QAbstractSocket::SocketError)));
+
+		conns += c;
+		return c;
+	}
+
+	// safe to call from the socket's own signals
+	void removeConnection(Connection *c)
+	{
+		conns.removeAll(c);
+
+		c->sock->disconnect(this);
+		c->sock->setParent(0);
+		c->sock->abort();
+		c->sock->deleteLater();
+		delete c;
+	}
+
+	static QByteArray frame(const QByteArray &buf)
+	{
+		QByteArray out(2, 0);
+		out[0] = (buf.size() >> 8) & 0xff;
+		out[1] = buf.size() & 0xff;
+		out += buf;
+		return out;
+	}
+
+	void writeFrame(Connection *c, const QByteArray &buf)
+	{
+		++c->framesToWrite;
+		c->sock->write(frame(buf));
+	}
+
+	void write(int path, const QByteArray &buf, const QHostAddress &toAddr, int toPort)
+	{
+		if(stopping || !server)
+			return;
+
+		if(buf.size() > MAX_FRAME_SIZE)
+		{
+			if(debugLevel >= IceTransport::DL_Info)
+				emit q->debugLine("packet too large for a frame, dropping");
+			return;
+		}
+
+		Connection *c = findConnection(path, toAddr, toPort);
+		if(!c)
+		{
+			// the passive side only answers on connections it
+			//   accepted
+			if(path == Passive)
+			{
+				if(debugLevel >= IceTransport::DL_Info)
+					emit q->debugLine(QString("no connection from ") + toAddr.toString() + ';' + QString::number(toPort) + ", dropping");
+				return;
+			}
+
+			if(connectionCount(Active) >= MAX_CONNECTIONS)
+			{
+				if(debugLevel >= IceTransport::DL_Info)
+					emit q->debugLine("too many connections, dropping");
+				return;
+			}
+
+			if(debugLevel >= IceTransport::DL_Info)
+				emit q->debugLine(QString("connecting to ") + toAddr.toString() + ';' + QString::number(toPort));
+
+			c = addConnection(new QTcpSocket, Active, toAddr, toPort);
+			c->pendingWrites += buf;
+			c->sock->connectToHost(toAddr, toPort);
+			return;
+		}
+
+		if(c->sock->state() != QAbstractSocket::ConnectedState)
+		{
+			c->pendingWrites += buf;
+			return;
+		}
+
+		writeFrame(c, buf);
+	}
+
+	void processIncoming(Connection *c)
+	{
+		c->inbuf += c->sock->readAll();
+
+		QList<Datagram> &queue = in[c->path];
+		bool any = false;
+		while(c->inbuf.size() >= 2)
+		{
+			int size = ((quint8)c->inbuf[0] << 8) | (quint8)c->inbuf[1];
+			if(c->inbuf.size() < size + 2)
+				break;
+
+			Datagram dg;
+			dg.addr = c->addr;
+			dg.port = c->port;
+			dg.buf = c->inbuf.mid(2, size);
+			c->inbuf = c->inbuf.mid(size + 2);
+
+			if(queue.count() >= MAX_PACKET_QUEUE)
+				queue.removeFirst();
+			queue += dg;
+			any = true;
+		}
+
+		if(any)
+			emit q->readyRead(c->path);
+	}
+
+private slots:
+	void postStart()
+	{
+		if(stopping)
+			return;
+
+		server = new QTcpServer(this);
+		connect(server, SIGNAL(newConnection()), SLOT(server_newConnection()));
+		if(!server->listen(addr, 0))
+		{
+			delete server;
+			server = 0;
+
+			emit q->error(IceTcpTransport::ErrorBind);
+			return;
+		}
+
+		port = server->serverPort();
+
+		if(debugLevel >= IceTransport::DL_Info)
+			emit q->debugLine(QString("listening on ") + addr.toString() + ';' + QString::number(port));
+
+		emit q->started();
+	}
+
+	void postStop()
+	{
+		reset();
+		emit q->stopped();
+	}
+
+	void server_newConnection()
+	{
+		while(server->hasPendingConnections())
+		{
+			QTcpSocket *sock = server->nextPendingConnection();
+
+			if(connectionCount(Passive) >= MAX_CONNECTIONS)
+			{
+				if(debugLevel >= IceTransport::DL_Info)
+					emit q->debugLine("too many connections, refusing");
+				sock->abort();
+				sock->deleteLater();
+				continue;
+			}
+
+			if(debugLevel >= IceTransport::DL_Info)
+				emit q->debugLine(QString("accepted connection from ") + sock->peerAddress().toString() + ';' + QString::number(sock->peerPort()));
+
+			addConnection(sock, Passive, sock->peerAddress(), sock->peerPort());
+		}
+	}
+
+	void sock_connected()
+	{
+		Connection *c = findConnection((QTcpSocket *)sender());
+		if(!c)
+			return;
+
+		if(debugLevel >= IceTransport::DL_Info)
+			emit q->debugLine(QString("connected to ") + c->addr.toString() + ';' + QString::number(c->port));
+
+		QList<QByteArray> list = c->pendingWrites;
+		c->pendingWrites.clear();
+		foreach(const QByteArray &buf, list)
+			writeFrame(c, buf);
+	}
+
+	void sock_readyRead()
+	{
+		Connection *c = findConnection((QTcpSocket *)sender());
+		if(!c)
+			return;
+
+		processIncoming(c);
+	}
+
+	void sock_bytesWritten(qint64 bytes)
+	{
+		Q_UNUSED(bytes);
+
+		Connection *c = findConnection((QTcpSocket *)sender());
+		if(!c || c->sock->bytesToWrite() > 0 || c->framesToWrite == 0)
+			return;
+
+		int count = c->framesToWrite;
+		c->framesToWrite = 0;
+		emit q->datagramsWritten(c->path, count, c->addr, c->port);
+	}
+
+	void sock_disconnected()
+	{
+		Connection *c = findConnection((QTcpSocket *)sender());
+		if(!c)
+			return;
+
+		if(debugLevel >= IceTransport::DL_Info)
+			emit q->debugLine(QString("connection with ") + c->addr.toString() + ';' + QString::number(c->port) + " closed");
+
+		removeConnection(c);
+	}
+
+	void sock_error(QAbstractSocket::SocketError e)
+	{
+		Q_UNUSED(e);
+
+		Connection *c = findConnection((QTcpSocket *)sender());
+		if(!c)
+			return;
+
+		// a failed connection only affects the pairs using it.  the
+		//   check list sees the checks time out
+		if(debugLevel >= IceTransport::DL_Info)
+			emit q->debugLine(QString("connection with ") + c->addr.toString() + ';' + QString::number(c->port) + " failed: " + c->sock->errorString());
+
+		removeConnection(c);
+	}
+};
+
+IceTcpTransport::IceTcpTransport(QObject *parent) :
+	IceTransport(parent)
+{
+	d = new Private(this);
+}
+
+IceTcpTransport::~IceTcpTransport()
+{
+	delete d;
+}
+
+void IceTcpTransport::start(const QHostAddress &addr)
+{
+	d->start(addr);
+}
+
+QHostAddress IceTcpTransport::localAddress() const
+{
+	return d->addr;
+}
+
+int IceTcpTransport::localPort() const
+{
+	return d->port;
+}
+
+void IceTcpTransport::stop()
+{
+	d->stop();
+}
+
+bool IceTcpTransport::hasPendingDatagrams(int path) const
+{
+	Q_ASSERT(path == Passive || path == Active);
+
+	return !d->in[path].isEmpty();
+}
+
+QByteArray IceTcpTransport::readDatagram(int path, QHostAddress *addr, int *port)
+{
+	Q_ASSERT(path == Passive || path == Active);
+
+	if(d->in[path].isEmpty())
+		return QByteArray();
+
+	Private::Datagram dg = d->in[path].takeFirst();
+	*addr = dg.addr;
+	*port = dg.port;
+	return dg.buf;
+}
+
+void IceTcpTransport::writeDatagram(int path, const QByteArray &buf, const QHostAddress &addr, int port)
+{
+	Q_ASSERT(path == Passive || path == Active);
+
+	d->write(path, buf, addr, port);
+}
+
+void IceTcpTransport::addChannelPeer(const QHostAddress &addr, int port)
+{
+	// no relay, so nothing to set up
+	Q_UNUSED(addr);
+	Q_UNUSED(port);
+}
+
+void IceTcpTransport::setDebugLevel(DebugLevel level)
+{
+	d->debugLevel = level;
+}
+
+}
+
+#include "icetcptransport.moc"
@@ -0,0 +1,79 @@
+/*
+ * icetcptransport.h - ICE-TCP host transport (RFC 6544)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ICETCPTRANSPORT_H
+#define ICETCPTRANSPORT_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHostAddress>
+#include "icetransport.h"
+
+namespace XMPP {
+
+// a host transport carrying packets over TCP, framed as in RFC 4571.
+//   path 0 is the passive candidate: a listening port that accepts
+//   connections from the peer.  path 1 is the active candidate: writing
+//   to an address opens a connection to it on first use.  either way,
+//   packets are read and written by the address of the far end, as with
+//   the udp transports
+
+class IceTcpTransport : public IceTransport
+{
+	Q_OBJECT
+
+public:
+	enum Error
+	{
+		ErrorBind = ErrorCustom
+	};
+
+	enum Path
+	{
+		Passive,
+		Active
+	};
+
+	IceTcpTransport(QObject *parent = 0);
+	~IceTcpTransport();
+
+	// listen on addr for the passive path.  started() is emitted once
+	//   the port is open
+	void start(const QHostAddress &addr);
+
+	QHostAddress localAddress() const;
+	int localPort() const;
+
+	// reimplemented
+	virtual void stop();
+	virtual bool hasPendingDatagrams(int path) const;
+	virtual QByteArray readDatagram(int path, QHostAddress *addr, int *port);
+	virtual void writeDatagram(int path, const QByteArray &buf, const QHostAddress &addr, int port);
+	virtual void addChannelPeer(const QHostAddress &addr, int port);
+	virtual void setDebugLevel(DebugLevel level);
+
+private:
+	class Private;
+	friend class Private;
+	Private *d;
+};
+
+}
+
+#endif
@@ -0,0 +1,334 @@
+/*
+ * icethread.cpp - run Ice176 on a network thread of its own
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "icethread.h"
+
+#include <QMetaType>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+// received datagrams held per component for the application.  when
+//   full, the oldest are dropped
+#define MAX_READ_QUEUE 512
+
+Q_DECLARE_METATYPE(XMPP::Ice176::Error)
+Q_DECLARE_METATYPE(QList<XMPP::Ice176::Candidate>)
+
+namespace XMPP {
+
+//----------------------------------------------------------------------------
+// IceWorker
+//----------------------------------------------------------------------------
+// lives on the network thread, next to the Ice176
+class IceWorker : public QObject, public Ice176::DatagramHandler
+{
+	Q_OBJECT
+
+public:
+	class Queue
+	{
+	public:
+		QList<QByteArray> in;
+		QList<QByteArray> out;
+
+		// a readyRead() is on its way to the application
+		bool notified;
+
+		Queue() :
+			notified(false)
+		{
+		}
+	};
+
+	Ice176 *ice;
+	QObject *app; // receives emitReadyRead(int)
+
+	// everything below is shared between the threads
+	QMutex m;
+	QList<Queue> queues;
+	bool flushPending;
+	QList<Ice176::Candidate> pendingCandidates;
+
+	IceWorker(Ice176 *_ice, QObject *_app) :
+		ice(_ice),
+		app(_app),
+		flushPending(false)
+	{
+		for(int n = 0; n < ice->componentCount(); ++n)
+		{
+			queues += Queue();
+			ice->setDatagramHandler(n, this);
+		}
+	}
+
+	// reimplemented, called on the network thread
+	virtual void datagramReceived(int componentIndex, const QByteArray &buf)
+	{
+		QMutexLocker locker(&m);
+
+		Queue &qu = queues[componentIndex];
+		if(qu.in.count() >= MAX_READ_QUEUE)
+			qu.in.removeFirst();
+		qu.in += buf;
+
+		if(!qu.notified)
+		{
+			qu.notified = true;
+			QMetaObject::invokeMethod(app, "emitReadyRead", Qt::QueuedConnection, Q_ARG(int, componentIndex));
+		}
+	}
+
+	// called with m held
+	void queueWrites(int componentIndex, const QList<QByteArray> &bufs)
+	{
+		queues[componentIndex].out += bufs;
+
+		if(!flushPending)
+		{
+			flushPending = true;
+			QMetaObject::invokeMethod(this, "flushWrites", Qt::QueuedConnection);
+		}
+	}
+
+public slots:
+	void doStart(int mode)
+	{
+		ice->start((Ice176::Mode)mode);
+	}
+
+	void doStop()
+	{
+		ice->stop();
+	}
+
+	void doSetPeerUfrag(const QString &ufrag)
+	{
+		ice->setPeerUfrag(ufrag);
+	}
+
+	void doSetPeerPassword(const QString &pass)
+	{
+		ice->setPeerPassword(pass);
+	}
+
+	void doAddRemoteCandidates()
+	{
+		QList<Ice176::Candidate> list;
+		{
+			QMutexLocker locker(&m);
+			list = pendingCandidates;
+			pendingCandidates.clear();
+		}
+
+		if(!list.isEmpty())
+			ice->addRemoteCandidates(list);
+	}
+
+	void flushWrites()
+	{
+		QList< QList<QByteArray> > writes;
+		{
+			QMutexLocker locker(&m);
+			flushPending = false;
+			for(int n = 0; n < queues.count(); ++n)
+			{
+				writes += queues[n].out;
+				queues[n].out.clear();
+			}
+		}
+
+		for(int n = 0; n < writes.count(); ++n)
+		{
+			if(!writes[n].isEmpty())
+				ice->writeDatagrams(n, writes[n]);
+		}
+	}
+
+	void shutdown()
+	{
+		delete ice;
+		ice = 0;
+	}
+};
+
+//----------------------------------------------------------------------------
+// IceThread
+//----------------------------------------------------------------------------
+class IceThread::Private : public QObject
+{
+	Q_OBJECT
+
+public:
+	IceThread *q;
+	QThread *thread;
+	IceWorker *worker;
+	Ice176 *ice;
+
+	Private(IceThread *_q) :
+		QObject(_q),
+		q(_q)
+	{
+	}
+
+	bool validIndex(int componentIndex) const
+	{
+		return (componentIndex >= 0 && componentIndex < worker->queues.count());
+	}
+
+public slots:
+	void emitReadyRead(int componentIndex)
+	{
+		{
+			QMutexLocker locker(&worker->m);
+			worker->queues[componentIndex].notified = false;
+		}
+
+		emit q->readyRead(componentIndex);
+	}
+};
+
+IceThread::IceThread(Ice176 *ice, QObject *parent) :
+	QObject(parent)
+{
+	Q_ASSERT(!ice->parent());
+
+	// for the signals of ice, connected across the threads
+	qRegisterMetaType<XMPP::Ice176::Error>();
+	qRegisterMetaType< QList<XMPP::Ice176::Candidate> >();
+
+	d = new Private(this);
+	d->ice = ice;
+	d->worker = new IceWorker(ice, d);
+	d->thread = new QThread;
+
+	ice->moveToThread(d->thread);
+	d->worker->moveToThread(d->thread);
+
+	d->thread->start(QThread::TimeCriticalPriority);
+}
+
+IceThread::~IceThread()
+{
+	QMetaObject::invokeMethod(d->worker, "shutdown", Qt::BlockingQueuedConnection);
+	d->thread->quit();
+	d->thread->wait();
+	delete d->worker;
+	delete d->thread;
+	delete d;
+}
+
+Ice176 *IceThread::ice() const
+{
+	return d->ice;
+}
+
+QThread *IceThread::networkThread() const
+{
+	return d->thread;
+}
+
+void IceThread::start(Ice176::Mode mode)
+{
+	QMetaObject::invokeMethod(d->worker, "doStart", Qt::QueuedConnection, Q_ARG(int, mode));
+}
+
+void IceThread::stop()
+{
+	QMetaObject::invokeMethod(d->worker, "doStop", Qt::QueuedConnection);
+}
+
+void IceThread::setPeerUfrag(const QString &ufrag)
+{
+	QMetaObject::invokeMethod(d->worker, "doSetPeerUfrag", Qt::QueuedConnection, Q_ARG(QString, ufrag));
+}
+
+void IceThread::setPeerPassword(const QString &pass)
+{
+	QMetaObject::invokeMethod(d->worker, "doSetPeerPassword", Qt::QueuedConnection, Q_ARG(QString, pass));
+}
+
+void IceThread::addRemoteCandidates(const QList<Ice176::Candidate> &list)
+{
+	{
+		QMutexLocker locker(&d->worker->m);
+		d->worker->pendingCandidates += list;
+	}
+
+	QMetaObject::invokeMethod(d->worker, "doAddRemoteCandidates", Qt::QueuedConnection);
+}
+
+bool IceThread::hasPendingDatagrams(int componentIndex) const
+{
+	QMutexLocker locker(&d->worker->m);
+	Q_ASSERT(d->validIndex(componentIndex));
+
+	return !d->worker->queues[componentIndex].in.isEmpty();
+}
+
+QByteArray IceThread::readDatagram(int componentIndex)
+{
+	QMutexLocker locker(&d->worker->m);
+	Q_ASSERT(d->validIndex(componentIndex));
+
+	QList<QByteArray> &in = d->worker->queues[componentIndex].in;
+	if(in.isEmpty())
+		return QByteArray();
+
+	return in.takeFirst();
+}
+
+int IceThread::readDatagrams(int componentIndex, QList<QByteArray> *out, int max)
+{
+	QMutexLocker locker(&d->worker->m);
+	Q_ASSERT(d->validIndex(componentIndex));
+
+	QList<QByteArray> &in = d->worker->queues[componentIndex].in;
+	if(max < 0 || max >= in.count())
+	{
+		int count = in.count();
+		*out += in;
+		in.clear();
+		return count;
+	}
+
+	for(int n = 0; n < max; ++n)
+		*out += in.takeFirst();
+	return max;
+}
+
+void IceThread::writeDatagram(int componentIndex, const QByteArray &datagram)
+{
+	QMutexLocker locker(&d->worker->m);
+	Q_ASSERT(d->validIndex(componentIndex));
+
+	d->worker->queueWrites(componentIndex, QList<QByteArray>() << datagram);
+}
+
+void IceThread::writeDatagrams(int componentIndex, const QList<QByteArray> &datagrams)
+{
+	QMutexLocker locker(&d->worker->m);
+	Q_ASSERT(d->validIndex(componentIndex));
+
+	d->worker->queueWrites(componentIndex, datagrams);
+}
+
+}
+
+#include "icethread.moc"
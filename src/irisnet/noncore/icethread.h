@@ -0,0 +1,85 @@
+/*
+ * icethread.h - run Ice176 on a network thread of its own
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ICETHREAD_H
+#define ICETHREAD_H
+
+#include <QObject>
+#include <QList>
+#include <QByteArray>
+#include "ice176.h"
+
+class QThread;
+
+namespace XMPP {
+
+// runs an Ice176, and everything it creates, on a thread of its own at
+//   the highest priority the platform grants, so connectivity checks,
+//   TURN unwrapping and media don't wait on the caller's event loop.
+//   datagrams cross between the threads through locked queues.
+//
+// set up the Ice176 completely before handing it over: addresses,
+//   services, component count, and connections to its signals, which
+//   are then delivered queued.  from then on, only control it through
+//   this class.  pools and port reservers given to it must not be used
+//   by objects of other threads.  the local credentials may be read
+//   from ice() once started() has arrived
+
+class IceThread : public QObject
+{
+	Q_OBJECT
+
+public:
+	// ice must not have a parent.  ownership is passed
+	IceThread(Ice176 *ice, QObject *parent = 0);
+
+	// deletes ice on its thread, then ends the thread
+	~IceThread();
+
+	Ice176 *ice() const;
+	QThread *networkThread() const;
+
+	// queued to the network thread
+	void start(Ice176::Mode mode);
+	void stop();
+	void setPeerUfrag(const QString &ufrag);
+	void setPeerPassword(const QString &pass);
+	void addRemoteCandidates(const QList<Ice176::Candidate> &list);
+
+	// these may be called from any thread
+	bool hasPendingDatagrams(int componentIndex) const;
+	QByteArray readDatagram(int componentIndex);
+	int readDatagrams(int componentIndex, QList<QByteArray> *out, int max = -1);
+	void writeDatagram(int componentIndex, const QByteArray &datagram);
+	void writeDatagrams(int componentIndex, const QList<QByteArray> &datagrams);
+
+signals:
+	// emitted in the thread of this object, once for all the datagrams
+	//   that arrived since it was last emitted
+	void readyRead(int componentIndex);
+
+private:
+	class Private;
+	friend class Private;
+	Private *d;
+};
+
+}
+
+#endif
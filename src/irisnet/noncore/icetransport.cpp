@@ -31,4 +31,10 @@ IceTransport::~IceTransport()
 {
 }
 
+void IceTransport::writeDatagrams(int path, const QList<QByteArray> &bufs, const QHostAddress &addr, int port)
+{
+	foreach(const QByteArray &buf, bufs)
+		writeDatagram(path, buf, addr, port);
+}
+
 }
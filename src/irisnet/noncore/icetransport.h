@@ -22,6 +22,7 @@
 #define ICETRANSPORT_H
 
 #include <QObject>
+#include <QList>
 #include <QByteArray>
 
 class QHostAddress;
@@ -54,6 +55,10 @@ public:
 	virtual bool hasPendingDatagrams(int path) const = 0;
 	virtual QByteArray readDatagram(int path, QHostAddress *addr, int *port) = 0;
 	virtual void writeDatagram(int path, const QByteArray &buf, const QHostAddress &addr, int port) = 0;
+
+	// write several datagrams to the same destination.  the default
+	//   implementation calls writeDatagram() for each
+	virtual void writeDatagrams(int path, const QList<QByteArray> &bufs, const QHostAddress &addr, int port);
 	virtual void addChannelPeer(const QHostAddress &addr, int port) = 0;
 
 	virtual void setDebugLevel(DebugLevel level) = 0;
@@ -183,6 +183,11 @@ void IceTurnTransport::setProxy(const TurnClient::Proxy &proxy)
 	d->turn.setProxy(proxy);
 }
 
+void IceTurnTransport::setConnectionPool(TurnConnectionPool *pool)
+{
+	d->turn.setConnectionPool(pool);
+}
+
 void IceTurnTransport::start(const QHostAddress &addr, int port, TurnClient::Mode mode)
 {
 	d->serverAddr = addr;
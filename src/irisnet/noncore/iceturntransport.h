@@ -51,6 +51,7 @@ public:
 	void setPassword(const QCA::SecureArray &pass);
 
 	void setProxy(const TurnClient::Proxy &proxy);
+	void setConnectionPool(TurnConnectionPool *pool);
 
 	void start(const QHostAddress &addr, int port, TurnClient::Mode mode = TurnClient::PlainMode);
 
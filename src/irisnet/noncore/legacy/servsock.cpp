@@ -51,12 +51,12 @@ bool ServSock::isActive() const
 	return (d->serv ? true: false);
 }
 
-bool ServSock::listen(quint16 port)
+bool ServSock::listen(quint16 port, const QHostAddress &addr)
 {
 	stop();
 
 	d->serv = new ServSockSignal(this);
-	if(!d->serv->listen(QHostAddress::Any, port)) {
+	if(!d->serv->listen(addr, port)) {
 		delete d->serv;
 		d->serv = 0;
 		return false;
@@ -34,7 +34,7 @@ public:
 	~ServSock();
 
 	bool isActive() const;
-	bool listen(quint16 port);
+	bool listen(quint16 port, const QHostAddress &addr = QHostAddress::Any);
 	void stop();
 	int port() const;
 	QHostAddress address() const;
@@ -26,6 +26,291 @@
 
 // CS_NAMESPACE_BEGIN
 
+// don't trust any cached record for more than a day
+#define SRVCACHE_TTL_MAX   86400
+#define SRVCACHE_MAX       256
+#define SRVCACHE_MAGIC     "IRISSRVCACHE"
+#define SRVCACHE_VERSION   1
+
+//----------------------------------------------------------------------------
+// SrvCache
+//----------------------------------------------------------------------------
+class SrvCacheData
+{
+public:
+	class ServerEntry
+	{
+	public:
+		QList<Q3Dns::Server> list;
+		uint expires;
+		QString lastHost;
+		quint16 lastPort;
+
+		ServerEntry() : expires(0), lastPort(0) {}
+	};
+
+	class AddressEntry
+	{
+	public:
+		QList<QHostAddress> list;
+		uint expires;
+
+		AddressEntry() : expires(0) {}
+	};
+
+	QMutex m;
+	bool enabled;
+	QString fileName;
+	QHash<QString,ServerEntry> servers;
+	QHash<QString,AddressEntry> addresses;
+
+	SrvCacheData() : enabled(false) {}
+
+	static uint now()
+	{
+		return QDateTime::currentDateTime().toUTC().toTime_t();
+	}
+
+	static uint expiresFor(int ttl)
+	{
+		return now() + (uint)qMin(ttl, SRVCACHE_TTL_MAX);
+	}
+
+	// drop expired entries, and the soonest to expire if still too big
+	template <typename T>
+	static void prune(QHash<QString,T> *hash)
+	{
+		uint t = now();
+		typename QHash<QString,T>::Iterator it = hash->begin();
+		while(it != hash->end()) {
+			if(it.value().expires <= t)
+				it = hash->erase(it);
+			else
+				++it;
+		}
+		while(hash->count() > SRVCACHE_MAX) {
+			typename QHash<QString,T>::Iterator oldest = hash->begin();
+			for(it = hash->begin(); it != hash->end(); ++it) {
+				if(it.value().expires < oldest.value().expires)
+					oldest = it;
+			}
+			hash->erase(oldest);
+		}
+	}
+
+	void load()
+	{
+		QFile f(fileName);
+		if(!f.open(QIODevice::ReadOnly))
+			return;
+
+		QDataStream in(&f);
+		in.setVersion(QDataStream::Qt_4_5);
+		QByteArray magic;
+		quint32 version;
+		in >> magic >> version;
+		if(magic != SRVCACHE_MAGIC || version != SRVCACHE_VERSION)
+			return;
+
+		quint32 count;
+		in >> count;
+		for(quint32 n = 0; n < count && in.status() == QDataStream::Ok; ++n) {
+			QString srv;
+			ServerEntry e;
+			quint32 scount;
+			in >> srv >> e.expires >> e.lastHost >> e.lastPort >> scount;
+			for(quint32 k = 0; k < scount && in.status() == QDataStream::Ok; ++k) {
+				Q3Dns::Server s;
+				in >> s.name >> s.priority >> s.weight >> s.port;
+				e.list += s;
+			}
+			servers.insert(srv, e);
+		}
+		in >> count;
+		for(quint32 n = 0; n < count && in.status() == QDataStream::Ok; ++n) {
+			QString host;
+			AddressEntry e;
+			in >> host >> e.expires >> e.list;
+			addresses.insert(host, e);
+		}
+
+		// don't keep anything from a damaged file
+		if(in.status() != QDataStream::Ok) {
+			servers.clear();
+			addresses.clear();
+		}
+		prune(&servers);
+		prune(&addresses);
+	}
+
+	void save()
+	{
+		if(fileName.isEmpty())
+			return;
+
+		// write to the side and swap it in, so a crash can't leave us
+		//   with half a file
+		QString tmpName = fileName + ".new";
+		QFile f(tmpName);
+		if(!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+			return;
+
+		QDataStream out(&f);
+		out.setVersion(QDataStream::Qt_4_5);
+		out << QByteArray(SRVCACHE_MAGIC) << (quint32)SRVCACHE_VERSION;
+
+		out << (quint32)servers.count();
+		QHashIterator<QString,ServerEntry> sit(servers);
+		while(sit.hasNext()) {
+			sit.next();
+			const ServerEntry &e = sit.value();
+			out << sit.key() << e.expires << e.lastHost << e.lastPort << (quint32)e.list.count();
+			foreach(const Q3Dns::Server &s, e.list)
+				out << s.name << s.priority << s.weight << s.port;
+		}
+
+		out << (quint32)addresses.count();
+		QHashIterator<QString,AddressEntry> ait(addresses);
+		while(ait.hasNext()) {
+			ait.next();
+			out << ait.key() << ait.value().expires << ait.value().list;
+		}
+
+		f.close();
+		QFile::remove(fileName);
+		QFile::rename(tmpName, fileName);
+	}
+};
+
+Q_GLOBAL_STATIC(SrvCacheData, srvcache)
+
+void SrvCache::setEnabled(bool b)
+{
+	SrvCacheData *c = srvcache();
+	QMutexLocker locker(&c->m);
+	c->enabled = b;
+}
+
+bool SrvCache::isEnabled()
+{
+	SrvCacheData *c = srvcache();
+	QMutexLocker locker(&c->m);
+	return c->enabled;
+}
+
+void SrvCache::setFileName(const QString &fileName)
+{
+	SrvCacheData *c = srvcache();
+	QMutexLocker locker(&c->m);
+	c->fileName = fileName;
+	if(!fileName.isEmpty())
+		c->load();
+}
+
+void SrvCache::clear()
+{
+	SrvCacheData *c = srvcache();
+	QMutexLocker locker(&c->m);
+	c->servers.clear();
+	c->addresses.clear();
+	c->save();
+}
+
+bool SrvCache::servers(const QString &srv, QList<Q3Dns::Server> *list)
+{
+	SrvCacheData *c = srvcache();
+	QMutexLocker locker(&c->m);
+	if(!c->enabled)
+		return false;
+
+	QString key = srv.toLower();
+	if(!c->servers.contains(key))
+		return false;
+	const SrvCacheData::ServerEntry &e = c->servers[key];
+	if(e.expires <= SrvCacheData::now())
+		return false;
+
+	*list = e.list;
+
+	// put the last target that worked up front
+	for(int n = 0; n < list->count(); ++n) {
+		const Q3Dns::Server &s = list->at(n);
+		if(s.name == e.lastHost && s.port == e.lastPort) {
+			list->move(n, 0);
+			break;
+		}
+	}
+	return true;
+}
+
+void SrvCache::storeServers(const QString &srv, const QList<Q3Dns::Server> &list, int ttl)
+{
+	SrvCacheData *c = srvcache();
+	QMutexLocker locker(&c->m);
+	if(!c->enabled || ttl <= 0 || list.isEmpty())
+		return;
+
+	QString key = srv.toLower();
+	SrvCacheData::ServerEntry &e = c->servers[key];
+	e.list = list;
+	e.expires = SrvCacheData::expiresFor(ttl);
+	SrvCacheData::prune(&c->servers);
+	c->save();
+}
+
+bool SrvCache::addresses(const QString &host, QList<QHostAddress> *list)
+{
+	SrvCacheData *c = srvcache();
+	QMutexLocker locker(&c->m);
+	if(!c->enabled)
+		return false;
+
+	QString key = host.toLower();
+	if(!c->addresses.contains(key))
+		return false;
+	const SrvCacheData::AddressEntry &e = c->addresses[key];
+	if(e.expires <= SrvCacheData::now())
+		return false;
+
+	*list = e.list;
+	return true;
+}
+
+void SrvCache::storeAddresses(const QString &host, const QList<QHostAddress> &list, int ttl)
+{
+	SrvCacheData *c = srvcache();
+	QMutexLocker locker(&c->m);
+	if(!c->enabled || ttl <= 0 || list.isEmpty())
+		return;
+
+	SrvCacheData::AddressEntry &e = c->addresses[host.toLower()];
+	e.list = list;
+	e.expires = SrvCacheData::expiresFor(ttl);
+	SrvCacheData::prune(&c->addresses);
+	c->save();
+}
+
+void SrvCache::setLastGood(const QString &srv, const QString &host, quint16 port)
+{
+	SrvCacheData *c = srvcache();
+	QMutexLocker locker(&c->m);
+	if(!c->enabled)
+		return;
+
+	QString key = srv.toLower();
+	if(!c->servers.contains(key))
+		return;
+	SrvCacheData::ServerEntry &e = c->servers[key];
+	if(e.lastHost == host && e.lastPort == port)
+		return;
+	e.lastHost = host;
+	e.lastPort = port;
+	c->save();
+}
+
+//----------------------------------------------------------------------------
+// SrvResolver
+//----------------------------------------------------------------------------
 static void sortSRVList(QList<Q3Dns::Server> &list)
 {
 	QList<Q3Dns::Server> tmp = list;
@@ -78,6 +363,7 @@ public:
 	QString srv;
 	QList<Q3Dns::Server> servers;
 	bool aaaa;
+	bool cacheHitPending;
 
 	QTimer t;
 };
@@ -87,6 +373,7 @@ SrvResolver::SrvResolver(QObject *parent)
 {
 	d = new Private(this);
 	d->nndns_busy = false;
+	d->cacheHitPending = false;
 
 	connect(&d->nndns, SIGNAL(resultsReady(const QList<XMPP::NameRecord> &)), SLOT(nndns_resultsReady(const QList<XMPP::NameRecord> &)));
 	connect(&d->nndns, SIGNAL(error(XMPP::NameResolver::Error)), SLOT(nndns_error(XMPP::NameResolver::Error)));
@@ -111,6 +398,8 @@ void SrvResolver::resolve(const QString &server, const QString &type, const QStr
 	d->failed = false;
 	d->srvonly = false;
 	d->srv = QString("_") + type + "._" + proto + '.' + server;
+	if(startFromCache())
+		return;
 	d->t.setSingleShot(true);
 	d->t.start(15000);
 	d->nndns_busy = true;
@@ -125,6 +414,8 @@ void SrvResolver::resolveSrvOnly(const QString &server, const QString &type, con
 	d->failed = false;
 	d->srvonly = true;
 	d->srv = QString("_") + type + "._" + proto + '.' + server;
+	if(startFromCache())
+		return;
 	d->t.setSingleShot(true);
 	d->t.start(15000);
 	d->nndns_busy = true;
@@ -152,6 +443,7 @@ void SrvResolver::stop()
 	if(d->ndns.isBusy())
 		d->ndns.stop();
 #endif
+	d->cacheHitPending = false;
 	d->resultAddress = QHostAddress();
 	d->resultPort = 0;
 	d->servers.clear();
@@ -162,9 +454,9 @@ void SrvResolver::stop()
 bool SrvResolver::isBusy() const
 {
 #ifndef NO_NDNS
-	if(d->nndns_busy || d->ndns.isBusy())
+	if(d->nndns_busy || d->cacheHitPending || d->ndns.isBusy())
 #else
-	if(d->nndns_busy)
+	if(d->nndns_busy || d->cacheHitPending)
 #endif
 		return true;
 	else
@@ -191,6 +483,36 @@ quint16 SrvResolver::resultPort() const
 	return d->resultPort;
 }
 
+bool SrvResolver::startFromCache()
+{
+	QList<Q3Dns::Server> list;
+	if(!SrvCache::servers(d->srv, &list))
+		return false;
+
+	// already sorted when stored, and possibly reordered for the last
+	//   good target
+	d->servers = list;
+	if(d->srvonly) {
+		// report asynchronously, like a real lookup
+		d->cacheHitPending = true;
+		QMetaObject::invokeMethod(this, "cache_hit", Qt::QueuedConnection);
+	}
+	else {
+		d->aaaa = true;
+		tryNext();
+	}
+	return true;
+}
+
+void SrvResolver::cache_hit()
+{
+	if(!d->cacheHitPending)
+		return;
+
+	d->cacheHitPending = false;
+	resultsReady();
+}
+
 void SrvResolver::tryNext()
 {
 #ifndef NO_NDNS
@@ -212,9 +534,12 @@ void SrvResolver::nndns_resultsReady(const QList<XMPP::NameRecord> &results)
 	if(d->nntype == XMPP::NameRecord::Srv) {
 		// grab the server list and destroy the qdns object
 		QList<Q3Dns::Server> list;
+		int ttl = -1;
 		for(int n = 0; n < results.count(); ++n)
 		{
 			list += Q3Dns::Server(QString::fromLatin1(results[n].name()), results[n].priority(), results[n].weight(), results[n].port());
+			if(ttl == -1 || results[n].ttl() < ttl)
+				ttl = results[n].ttl();
 		}
 
 		d->nndns_busy = false;
@@ -227,6 +552,7 @@ void SrvResolver::nndns_resultsReady(const QList<XMPP::NameRecord> &results)
 		}
 		sortSRVList(list);
 		d->servers = list;
+		SrvCache::storeServers(d->srv, list, ttl);
 
 		if(d->srvonly)
 			resultsReady();
@@ -70,12 +70,39 @@ private slots:
 	void nndns_error(XMPP::NameResolver::Error);
 	void ndns_done();
 	void t_timeout();
+	void cache_hit();
 
 private:
 	class Private;
 	Private *d;
 
 	void tryNext();
+	bool startFromCache();
+};
+
+// Process-wide cache of SRV lookups and host addresses, so that reconnecting
+//   to a server doesn't have to hit DNS again.  Entries expire by their DNS
+//   TTL.  The cache is disabled by default, and is only saved to disk if a
+//   file name is set.  All functions are thread-safe.
+class SrvCache
+{
+public:
+	static void setEnabled(bool b);
+	static bool isEnabled();
+
+	// load entries from fileName (if it exists), and save there from now on
+	static void setFileName(const QString &fileName);
+	static void clear();
+
+	// srv is the full query name, e.g. "_xmpp-client._tcp.example.com"
+	static bool servers(const QString &srv, QList<Q3Dns::Server> *list);
+	static void storeServers(const QString &srv, const QList<Q3Dns::Server> &list, int ttl);
+
+	static bool addresses(const QString &host, QList<QHostAddress> *list);
+	static void storeAddresses(const QString &host, const QList<QHostAddress> &list, int ttl);
+
+	// remember the target that worked, so it is tried first next time
+	static void setLastGood(const QString &srv, const QString &host, quint16 port);
 };
 
 // CS_NAMESPACE_END
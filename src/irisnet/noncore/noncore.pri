@@ -23,11 +23,18 @@ HEADERS += \
 	$$PWD/stunallocate.h \
 	$$PWD/turnclient.h \
 	$$PWD/udpportreserver.h \
+	$$PWD/cryptowarmup.h \
 	$$PWD/icetransport.h \
 	$$PWD/icelocaltransport.h \
 	$$PWD/iceturntransport.h \
+	$$PWD/icetcptransport.h \
+	$$PWD/icecandidatepool.h \
+	$$PWD/icerelayprobe.h \
+	$$PWD/icelocaladdressset.h \
 	$$PWD/icecomponent.h \
-	$$PWD/ice176.h
+	$$PWD/ice176.h \
+	$$PWD/icestream.h \
+	$$PWD/icethread.h
 
 SOURCES += \
 	$$PWD/processquit.cpp \
@@ -39,11 +46,18 @@ SOURCES += \
 	$$PWD/stunallocate.cpp \
 	$$PWD/turnclient.cpp \
 	$$PWD/udpportreserver.cpp \
+	$$PWD/cryptowarmup.cpp \
 	$$PWD/icetransport.cpp \
 	$$PWD/icelocaltransport.cpp \
 	$$PWD/iceturntransport.cpp \
+	$$PWD/icetcptransport.cpp \
+	$$PWD/icecandidatepool.cpp \
+	$$PWD/icerelayprobe.cpp \
+	$$PWD/icelocaladdressset.cpp \
 	$$PWD/icecomponent.cpp \
-	$$PWD/ice176.cpp
+	$$PWD/ice176.cpp \
+	$$PWD/icestream.cpp \
+	$$PWD/icethread.cpp
 
 INCLUDEPATH += $$PWD/legacy
 include(legacy/legacy.pri)
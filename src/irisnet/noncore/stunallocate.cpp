@@ -22,19 +22,29 @@
 
 #include <QMetaType>
 #include <QHostAddress>
-#include <QTimer>
 #include <QtCrypto>
 #include "objectsession.h"
+#include "timerwheel.h"
 #include "stunutil.h"
 #include "stunmessage.h"
 #include "stuntypes.h"
 #include "stuntransaction.h"
 
-// permissions last 5 minutes, update them every 4 minutes
+// permissions last 5 minutes, update them every 4 minutes.  this is also
+//   the cycle on which channels are refreshed
 #define PERM_INTERVAL  (4 * 60 * 1000)
 
-// channels last 10 minutes, update them every 9 minutes
-#define CHAN_INTERVAL  (9 * 60 * 1000)
+// channels last 10 minutes, update them every other permission cycle
+#define CHAN_CYCLES    2
+
+// CreatePermission requests carry at most this many addresses, keeping
+//   the message well under the minimum mtu even for ipv6 peers
+#define PERM_BATCH_MAX 32
+
+// channel numbers are handed out from the bottom of the range, so a small
+//   table indexed by number covers every allocation seen in practice
+#define CHAN_FIRST       0x4000
+#define CHAN_TABLE_SIZE  64
 
 namespace XMPP {
 
@@ -48,11 +58,11 @@ void releaseAndDeleteLater(QObject *owner, QObject *obj)
 // return size of channelData packet, or -1
 static int check_channelData(const quint8 *data, int size)
 {
-	// top two bits are never zero for ChannelData
-	if((data[0] & 0xc0) == 0)
+	if(size < 4)
 		return -1;
 
-	if(size < 4)
+	// top two bits are never zero for ChannelData
+	if((data[0] & 0xc0) == 0)
 		return -1;
 
 	quint16 len = StunUtil::read16(data + 2);
@@ -72,18 +82,44 @@ static int check_channelData(const quint8 *data, int size)
 	return need;
 }
 
-class StunAllocatePermission : public QObject
+// the state of one permission.  the CreatePermission requests themselves
+//   are sent by StunAllocatePermissionRequest, for many addresses at once
+class StunAllocatePermission
+{
+public:
+	QHostAddress addr;
+	bool active;
+
+	// a request for this address is in flight
+	bool pending;
+
+	// waiting to be included in the next request
+	bool due;
+
+	// a batch including this address failed, so it is requested on
+	//   its own until it succeeds
+	bool alone;
+
+	StunAllocatePermission(const QHostAddress &_addr) :
+		addr(_addr),
+		active(false),
+		pending(false),
+		due(false),
+		alone(false)
+	{
+	}
+};
+
+class StunAllocatePermissionRequest : public QObject
 {
 	Q_OBJECT
 
 public:
-	QTimer *timer;
 	StunTransactionPool *pool;
 	StunTransaction *trans;
 	QHostAddress stunAddr;
 	int stunPort;
-	QHostAddress addr;
-	bool active;
+	QList<QHostAddress> addrs;
 
 	enum Error
 	{
@@ -95,34 +131,31 @@ public:
 		ErrorTimeout
 	};
 
-	StunAllocatePermission(StunTransactionPool *_pool, const QHostAddress &_addr) :
+	StunAllocatePermissionRequest(StunTransactionPool *_pool, const QList<QHostAddress> &_addrs) :
 		QObject(_pool),
 		pool(_pool),
 		trans(0),
-		addr(_addr),
-		active(false)
+		addrs(_addrs)
 	{
-		timer = new QTimer(this);
-		connect(timer, SIGNAL(timeout()), SLOT(timer_timeout()));
-		timer->setSingleShot(true);
-		timer->setInterval(PERM_INTERVAL);
 	}
 
-	~StunAllocatePermission()
+	~StunAllocatePermissionRequest()
 	{
-		cleanup();
-
-		releaseAndDeleteLater(this, timer);
+		delete trans;
 	}
 
 	void start(const QHostAddress &_addr, int _port)
 	{
-		Q_ASSERT(!active);
+		Q_ASSERT(!trans);
 
 		stunAddr = _addr;
 		stunPort = _port;
 
-		doTransaction();
+		trans = new StunTransaction(this);
+		connect(trans, SIGNAL(createMessage(const QByteArray &)), SLOT(trans_createMessage(const QByteArray &)));
+		connect(trans, SIGNAL(finished(const XMPP::StunMessage &)), SLOT(trans_finished(const XMPP::StunMessage &)));
+		connect(trans, SIGNAL(error(XMPP::StunTransaction::Error)), SLOT(trans_error(XMPP::StunTransaction::Error)));
+		trans->start(pool, stunAddr, stunPort);
 	}
 
 	static StunAllocate::Error errorToStunAllocateError(Error e)
@@ -145,33 +178,7 @@ public:
 
 signals:
 	void ready();
-	void error(XMPP::StunAllocatePermission::Error e, const QString &reason);
-
-private:
-	void cleanup()
-	{
-		delete trans;
-		trans = 0;
-
-		timer->stop();
-
-		active = false;
-	}
-
-	void doTransaction()
-	{
-		Q_ASSERT(!trans);
-		trans = new StunTransaction(this);
-		connect(trans, SIGNAL(createMessage(const QByteArray &)), SLOT(trans_createMessage(const QByteArray &)));
-		connect(trans, SIGNAL(finished(const XMPP::StunMessage &)), SLOT(trans_finished(const XMPP::StunMessage &)));
-		connect(trans, SIGNAL(error(XMPP::StunTransaction::Error)), SLOT(trans_error(XMPP::StunTransaction::Error)));
-		trans->start(pool, stunAddr, stunPort);
-	}
-
-	void restartTimer()
-	{
-		timer->start();
-	}
+	void error(XMPP::StunAllocatePermissionRequest::Error e, const QString &reason);
 
 private slots:
 	void trans_createMessage(const QByteArray &transactionId)
@@ -183,10 +190,10 @@ private slots:
 
 		QList<StunMessage::Attribute> list;
 
-		// we only do one address per permission request, because
-		//   otherwise if we receive an error it would be ambiguous
-		//   as to which address the error applies to
-
+		// the server installs all of the addresses or none of them, so
+		//   an error can't be pinned on any one address.  the owner
+		//   retries the addresses separately to find out
+		foreach(const QHostAddress &addr, addrs)
 		{
 			StunMessage::Attribute a;
 			a.type = StunTypes::XOR_PEER_ADDRESS;
@@ -204,25 +211,16 @@ private slots:
 		delete trans;
 		trans = 0;
 
-		bool err = false;
-		int code;
-		QString reason;
 		if(response.mclass() == StunMessage::ErrorResponse)
 		{
+			int code;
+			QString reason;
 			if(!StunTypes::parseErrorCode(response.attribute(StunTypes::ERROR_CODE), &code, &reason))
 			{
-				cleanup();
 				emit error(ErrorProtocol, "Unable to parse ERROR-CODE in error response.");
 				return;
 			}
 
-			err = true;
-		}
-
-		if(err)
-		{
-			cleanup();
-
 			if(code == StunTypes::InsufficientCapacity)
 				emit error(ErrorCapacity, reason);
 			else if(code == StunTypes::Forbidden)
@@ -233,29 +231,19 @@ private slots:
 			return;
 		}
 
-		restartTimer();
-
-		if(!active)
-		{
-			active = true;
-			emit ready();
-		}
+		emit ready();
 	}
 
 	void trans_error(XMPP::StunTransaction::Error e)
 	{
-		cleanup();
+		delete trans;
+		trans = 0;
 
 		if(e == XMPP::StunTransaction::ErrorTimeout)
 			emit error(ErrorTimeout, "Request timed out.");
 		else
 			emit error(ErrorGeneric, "Generic transaction error.");
 	}
-
-	void timer_timeout()
-	{
-		doTransaction();
-	}
 };
 
 class StunAllocateChannel : public QObject
@@ -263,7 +251,6 @@ class StunAllocateChannel : public QObject
 	Q_OBJECT
 
 public:
-	QTimer *timer;
 	StunTransactionPool *pool;
 	StunTransaction *trans;
 	QHostAddress stunAddr;
@@ -273,6 +260,9 @@ public:
 	int port;
 	bool active;
 
+	// refresh cycles left before the binding needs renewing
+	int cyclesLeft;
+
 	enum Error
 	{
 		ErrorGeneric,
@@ -290,19 +280,14 @@ public:
 		channelId(_channelId),
 		addr(_addr),
 		port(_port),
-		active(false)
+		active(false),
+		cyclesLeft(0)
 	{
-		timer = new QTimer(this);
-		connect(timer, SIGNAL(timeout()), SLOT(timer_timeout()));
-		timer->setSingleShot(true);
-		timer->setInterval(CHAN_INTERVAL);
 	}
 
 	~StunAllocateChannel()
 	{
 		cleanup();
-
-		releaseAndDeleteLater(this, timer);
 	}
 
 	void start(const QHostAddress &_addr, int _port)
@@ -315,6 +300,16 @@ public:
 		doTransaction();
 	}
 
+	// called on every refresh cycle of the allocation
+	void cycle()
+	{
+		if(!active || trans)
+			return;
+
+		if(--cyclesLeft <= 0)
+			doTransaction();
+	}
+
 	static StunAllocate::Error errorToStunAllocateError(Error e)
 	{
 		switch(e)
@@ -343,7 +338,7 @@ private:
 		delete trans;
 		trans = 0;
 
-		timer->stop();
+		cyclesLeft = 0;
 
 		channelId = -1;
 		active = false;
@@ -361,7 +356,7 @@ private:
 
 	void restartTimer()
 	{
-		timer->start();
+		cyclesLeft = CHAN_CYCLES;
 	}
 
 private slots:
@@ -445,11 +440,6 @@ private slots:
 		else
 			emit error(ErrorGeneric, "Generic transaction error.");
 	}
-
-	void timer_timeout()
-	{
-		doTransaction();
-	}
 };
 
 class StunAllocate::Private : public QObject
@@ -488,9 +478,12 @@ public:
 	int reflexivePort, relayedPort;
 	StunMessage msg;
 	int allocateLifetime;
-	QTimer *allocateRefreshTimer;
+	WheelTimer *allocateRefreshTimer;
+	WheelTimer *cycleTimer;
 	QList<StunAllocatePermission*> perms;
+	QList<StunAllocatePermissionRequest*> permRequests;
 	QList<StunAllocateChannel*> channels;
+	StunAllocateChannel *channelTable[CHAN_TABLE_SIZE];
 	QList<QHostAddress> permsOut;
 	QList<StunAllocate::Channel> channelsOut;
 	int erroringCode;
@@ -506,9 +499,17 @@ public:
 		dfState(DF_Unknown),
 		erroringCode(-1)
 	{
-		allocateRefreshTimer = new QTimer(this);
+		clearChannelTable();
+
+		allocateRefreshTimer = new WheelTimer(this);
 		connect(allocateRefreshTimer, SIGNAL(timeout()), SLOT(refresh()));
 		allocateRefreshTimer->setSingleShot(true);
+
+		// permissions and channels are all refreshed together, rather
+		//   than each on a deadline of its own
+		cycleTimer = new WheelTimer(this);
+		connect(cycleTimer, SIGNAL(timeout()), SLOT(cycle_timeout()));
+		cycleTimer->setInterval(PERM_INTERVAL);
 	}
 
 	~Private()
@@ -516,6 +517,7 @@ public:
 		cleanup();
 
 		releaseAndDeleteLater(this, allocateRefreshTimer);
+		releaseAndDeleteLater(this, cycleTimer);
 	}
 
 	void start(const QHostAddress &_addr = QHostAddress(), int _port = -1)
@@ -583,6 +585,7 @@ public:
 				{
 					if(channels[j]->addr == perms[n]->addr)
 					{
+						clearChannelTable();
 						delete channels[j];
 						channels.removeAt(j);
 						--j; // adjust position
@@ -600,13 +603,13 @@ public:
 		if(freeCount > 0)
 		{
 			// removals count as a change, so emit the signal
-			sess.deferExclusive(q, "permissionsChanged");
+			sess.deferExclusive(q, &StunAllocate::permissionsChanged);
 
 			// wake up inactive perms now that we've freed space
 			for(int n = 0; n < perms.count(); ++n)
 			{
 				if(!perms[n]->active)
-					perms[n]->start(stunAddr, stunPort);
+					queuePermission(perms[n]);
 			}
 		}
 
@@ -625,11 +628,9 @@ public:
 
 			if(!found)
 			{
-				StunAllocatePermission *perm = new StunAllocatePermission(pool, newPerms[n]);
-				connect(perm, SIGNAL(ready()), SLOT(perm_ready()));
-				connect(perm, SIGNAL(error(XMPP::StunAllocatePermission::Error, const QString &)), SLOT(perm_error(XMPP::StunAllocatePermission::Error, const QString &)));
+				StunAllocatePermission *perm = new StunAllocatePermission(newPerms[n]);
 				perms += perm;
-				perm->start(stunAddr, stunPort);
+				queuePermission(perm);
 			}
 		}
 	}
@@ -661,6 +662,7 @@ public:
 			{
 				++freeCount;
 
+				clearChannelTable();
 				delete channels[n];
 				channels.removeAt(n);
 				--n; // adjust position
@@ -670,7 +672,7 @@ public:
 		if(freeCount > 0)
 		{
 			// removals count as a change, so emit the signal
-			sess.deferExclusive(q, "channelsChanged");
+			sess.deferExclusive(q, &StunAllocate::channelsChanged);
 
 			// wake up inactive channels now that we've freed space
 			for(int n = 0; n < channels.count(); ++n)
@@ -769,17 +771,45 @@ public:
 	//   ChannelBind success response is still processable
 	bool getAddressPort(int channelId, QHostAddress *addr, int *port)
 	{
+		StunAllocateChannel *c = findChannel(channelId);
+		if(!c)
+			return false;
+
+		*addr = c->addr;
+		*port = c->port;
+		return true;
+	}
+
+	// entries only cache the list.  a channel can change number when it
+	//   is restarted, so a hit is checked against the channel itself
+	StunAllocateChannel *findChannel(int channelId)
+	{
+		int slot = channelId - CHAN_FIRST;
+		if(slot >= 0 && slot < CHAN_TABLE_SIZE)
+		{
+			StunAllocateChannel *c = channelTable[slot];
+			if(c && c->channelId == channelId)
+				return c;
+		}
+
 		for(int n = 0; n < channels.count(); ++n)
 		{
 			if(channels[n]->channelId == channelId)
 			{
-				*addr = channels[n]->addr;
-				*port = channels[n]->port;
-				return true;
+				if(slot >= 0 && slot < CHAN_TABLE_SIZE)
+					channelTable[slot] = channels[n];
+				return channels[n];
 			}
 		}
 
-		return false;
+		return 0;
+	}
+
+	// call before deleting any channel
+	void clearChannelTable()
+	{
+		for(int n = 0; n < CHAN_TABLE_SIZE; ++n)
+			channelTable[n] = 0;
 	}
 
 private:
@@ -802,11 +832,16 @@ private:
 		trans = 0;
 
 		allocateRefreshTimer->stop();
+		cycleTimer->stop();
 
+		clearChannelTable();
 		qDeleteAll(channels);
 		channels.clear();
 		channelsOut.clear();
 
+		qDeleteAll(permRequests);
+		permRequests.clear();
+
 		qDeleteAll(perms);
 		perms.clear();
 		permsOut.clear();
@@ -828,6 +863,85 @@ private:
 		allocateRefreshTimer->start((allocateLifetime - 60) * 1000);
 	}
 
+	StunAllocatePermission *findPermission(const QHostAddress &addr) const
+	{
+		foreach(StunAllocatePermission *perm, perms)
+		{
+			if(perm->addr == addr)
+				return perm;
+		}
+
+		return 0;
+	}
+
+	// requests for everything queued within one pass of the event loop
+	//   go out together
+	void queuePermission(StunAllocatePermission *perm)
+	{
+		perm->due = true;
+		sess.deferExclusive(this, &Private::flushPermissions);
+	}
+
+	void flushPermissions()
+	{
+		QList<QHostAddress> batch;
+
+		foreach(StunAllocatePermission *perm, perms)
+		{
+			if(!perm->due || perm->pending)
+				continue;
+
+			perm->due = false;
+			perm->pending = true;
+
+			if(perm->alone)
+			{
+				startPermissionRequest(QList<QHostAddress>() << perm->addr);
+				continue;
+			}
+
+			batch += perm->addr;
+			if(batch.count() >= PERM_BATCH_MAX)
+			{
+				startPermissionRequest(batch);
+				batch.clear();
+			}
+		}
+
+		if(!batch.isEmpty())
+			startPermissionRequest(batch);
+	}
+
+	void startPermissionRequest(const QList<QHostAddress> &addrs)
+	{
+		StunAllocatePermissionRequest *req = new StunAllocatePermissionRequest(pool, addrs);
+		connect(req, SIGNAL(ready()), SLOT(perm_ready()));
+		connect(req, SIGNAL(error(XMPP::StunAllocatePermissionRequest::Error, const QString &)), SLOT(perm_error(XMPP::StunAllocatePermissionRequest::Error, const QString &)));
+		permRequests += req;
+		req->start(stunAddr, stunPort);
+	}
+
+	// the request is done with once its signal is handled
+	QList<QHostAddress> takePermissionRequest(StunAllocatePermissionRequest *req)
+	{
+		permRequests.removeAll(req);
+		releaseAndDeleteLater(this, req);
+
+		// permissions removed meanwhile are skipped by the callers
+		QList<QHostAddress> addrs;
+		foreach(const QHostAddress &addr, req->addrs)
+		{
+			StunAllocatePermission *perm = findPermission(addr);
+			if(perm)
+			{
+				perm->pending = false;
+				addrs += addr;
+			}
+		}
+
+		return addrs;
+	}
+
 	bool updatePermsOut()
 	{
 		QList<QHostAddress> newList;
@@ -1091,6 +1205,7 @@ private slots:
 
 			state = Started;
 			restartRefreshTimer();
+			cycleTimer->start();
 
 			emit q->started();
 		}
@@ -1153,34 +1268,82 @@ private slots:
 
 	void perm_ready()
 	{
+		StunAllocatePermissionRequest *req = (StunAllocatePermissionRequest *)sender();
+		QList<QHostAddress> addrs = takePermissionRequest(req);
+
+		foreach(const QHostAddress &addr, addrs)
+		{
+			StunAllocatePermission *perm = findPermission(addr);
+			perm->active = true;
+			perm->alone = false;
+		}
+
 		if(updatePermsOut())
 			emit q->permissionsChanged();
 	}
 
-	void perm_error(XMPP::StunAllocatePermission::Error e, const QString &reason)
+	void perm_error(XMPP::StunAllocatePermissionRequest::Error e, const QString &reason)
 	{
-		if(e == StunAllocatePermission::ErrorCapacity)
+		StunAllocatePermissionRequest *req = (StunAllocatePermissionRequest *)sender();
+		bool batched = (req->addrs.count() > 1);
+		QList<QHostAddress> addrs = takePermissionRequest(req);
+
+		if(batched && (e == StunAllocatePermissionRequest::ErrorCapacity || e == StunAllocatePermissionRequest::ErrorForbidden || e == StunAllocatePermissionRequest::ErrorRejected))
+		{
+			// the error could be due to any of the addresses, so try
+			//   each of them alone
+			foreach(const QHostAddress &addr, addrs)
+			{
+				StunAllocatePermission *perm = findPermission(addr);
+				perm->alone = true;
+				queuePermission(perm);
+			}
+			return;
+		}
+
+		if(e == StunAllocatePermissionRequest::ErrorCapacity)
 		{
 			// if we aren't allowed to make anymore permissions,
 			//   don't consider this an error.  the perm stays
 			//   in the list inactive.  we'll try it again if
 			//   any perms get removed.
+			foreach(const QHostAddress &addr, addrs)
+				findPermission(addr)->active = false;
 			return;
 		}
-		else if(e == StunAllocatePermission::ErrorForbidden)
+		else if(e == StunAllocatePermissionRequest::ErrorForbidden)
 		{
 			// silently discard the permission request
-			StunAllocatePermission *perm = (StunAllocatePermission *)sender();
-			QHostAddress addr = perm->addr;
-			delete perm;
-			perms.removeAll(perm);
-			emit q->debugLine(QString("Warning: permission forbidden to %1").arg(addr.toString()));
+			foreach(const QHostAddress &addr, addrs)
+			{
+				StunAllocatePermission *perm = findPermission(addr);
+				perms.removeAll(perm);
+				delete perm;
+				emit q->debugLine(QString("Warning: permission forbidden to %1").arg(addr.toString()));
+			}
+
+			if(updatePermsOut())
+				emit q->permissionsChanged();
 			return;
 		}
 
 		cleanup();
 		errorString = reason;
-		emit q->error(StunAllocatePermission::errorToStunAllocateError(e));
+		emit q->error(StunAllocatePermissionRequest::errorToStunAllocateError(e));
+	}
+
+	void cycle_timeout()
+	{
+		foreach(StunAllocatePermission *perm, perms)
+		{
+			if(perm->active)
+				perm->due = true;
+		}
+
+		flushPermissions();
+
+		foreach(StunAllocateChannel *channel, channels)
+			channel->cycle();
 	}
 
 	void channel_ready()
@@ -1400,18 +1563,31 @@ QByteArray StunAllocate::encode(const QByteArray &datagram, const QHostAddress &
 
 QByteArray StunAllocate::decode(const QByteArray &encoded, QHostAddress *addr, int *port)
 {
-	if(encoded.size() < 4)
+	int len = decodeChannelData((const quint8 *)encoded.constData(), encoded.size(), addr, port);
+	if(len == -1)
 		return QByteArray();
 
-	quint16 num = StunUtil::read16((const quint8 *)encoded.data());
-	quint16 len = StunUtil::read16((const quint8 *)encoded.data() + 2);
-	if(encoded.size() - 4 < (int)len)
-		return QByteArray();
+	return encoded.mid(4, len);
+}
+
+int StunAllocate::decodeChannelData(const quint8 *data, int size, QHostAddress *addr, int *port)
+{
+	if(size < 4)
+		return -1;
+
+	// top two bits are 01 for ChannelData
+	if((data[0] & 0xc0) != 0x40)
+		return -1;
+
+	quint16 num = StunUtil::read16(data);
+	quint16 len = StunUtil::read16(data + 2);
+	if(size - 4 < (int)len)
+		return -1;
 
 	if(!d->getAddressPort(num, addr, port))
-		return QByteArray();
+		return -1;
 
-	return encoded.mid(4, len);
+	return len;
 }
 
 QByteArray StunAllocate::decode(const StunMessage &encoded, QHostAddress *addr, int *port)
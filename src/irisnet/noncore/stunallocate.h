@@ -103,6 +103,11 @@ public:
 	QByteArray decode(const QByteArray &encoded, QHostAddress *addr = 0, int *port = 0);
 	QByteArray decode(const StunMessage &encoded, QHostAddress *addr = 0, int *port = 0);
 
+	// decode ChannelData in place.  returns the length of the payload,
+	//   which starts 4 bytes into data, or -1 if data is not ChannelData
+	//   for a known channel
+	int decodeChannelData(const quint8 *data, int size, QHostAddress *addr, int *port);
+
 	QString errorString() const;
 
 	static bool containsChannelData(const quint8 *data, int size);
@@ -21,6 +21,9 @@
 #include "stunmessage.h"
 
 #include <QSharedData>
+#include <QVarLengthArray>
+#include <QHash>
+#include <QMutex>
 #include <QtCrypto>
 #include "stunutil.h"
 
@@ -33,10 +36,37 @@ using namespace StunUtil;
 // some attribute types we need to explicitly support
 enum
 {
+	AttribUsername         = 0x0006,
 	AttribMessageIntegrity = 0x0008,
-	AttribFingerprint      = 0x8028
+	AttribErrorCode        = 0x0009,
+	AttribXorMappedAddress = 0x0020,
+	AttribPriority         = 0x0024,
+	AttribUseCandidate     = 0x0025,
+	AttribFingerprint      = 0x8028,
+	AttribIceControlled    = 0x8029,
+	AttribIceControlling   = 0x802a
 };
 
+// attribute types that get a direct lookup slot in a parsed message
+#define COMMON_SLOTS 9
+
+static int common_slot(quint16 type)
+{
+	switch(type)
+	{
+		case AttribUsername:         return 0;
+		case AttribMessageIntegrity: return 1;
+		case AttribErrorCode:        return 2;
+		case AttribXorMappedAddress: return 3;
+		case AttribPriority:         return 4;
+		case AttribUseCandidate:     return 5;
+		case AttribFingerprint:      return 6;
+		case AttribIceControlled:    return 7;
+		case AttribIceControlling:   return 8;
+		default:                     return -1;
+	}
+}
+
 // adapted from public domain source by Ross Williams and Eric Durbin
 unsigned long crctable[256] =
 {
@@ -106,6 +136,31 @@ unsigned long crctable[256] =
 	0xB40BBE37L, 0xC30C8EA1L, 0x5A05DF1BL, 0x2D02EF8DL
 };
 
+// slice-by-8 tables, derived from crctable.  table[0] is crctable itself,
+//   and table[k] advances a byte through k further zero bytes
+class Crc32Tables
+{
+public:
+	quint32 table[8][256];
+
+	Crc32Tables()
+	{
+		for(int n = 0; n < 256; ++n)
+			table[0][n] = (quint32)crctable[n];
+
+		for(int k = 1; k < 8; ++k)
+		{
+			for(int n = 0; n < 256; ++n)
+			{
+				quint32 prev = table[k - 1][n];
+				table[k][n] = (prev >> 8) ^ table[0][prev & 0xff];
+			}
+		}
+	}
+};
+
+static Crc32Tables crc32_tables;
+
 class Crc32
 {
 private:
@@ -122,10 +177,37 @@ public:
 		result = 0xffffffff;
 	}
 
+	void update(const quint8 *p, int size)
+	{
+		const quint32 (*t)[256] = crc32_tables.table;
+		quint32 crc = result;
+
+		// eight bytes per step.  the words are assembled bytewise so
+		//   this works the same regardless of host byte order
+		while(size >= 8)
+		{
+			quint32 one = crc ^ ((quint32)p[0] | ((quint32)p[1] << 8) | ((quint32)p[2] << 16) | ((quint32)p[3] << 24));
+			crc = t[7][one & 0xff] ^
+				t[6][(one >> 8) & 0xff] ^
+				t[5][(one >> 16) & 0xff] ^
+				t[4][one >> 24] ^
+				t[3][p[4]] ^
+				t[2][p[5]] ^
+				t[1][p[6]] ^
+				t[0][p[7]];
+			p += 8;
+			size -= 8;
+		}
+
+		while(size-- > 0)
+			crc = (crc >> 8) ^ t[0][(crc & 0xff) ^ *p++];
+
+		result = crc;
+	}
+
 	void update(const QByteArray &in)
 	{
-		for(int n = 0; n < in.size(); ++n)
-			result = (result >> 8) ^ (crctable[(result & 0xff) ^ (quint8)in[n]]);
+		update((const quint8 *)in.data(), in.size());
 	}
 
 	quint32 final()
@@ -139,10 +221,297 @@ public:
 		c.update(in);
 		return c.final();
 	}
+
+	static quint32 process(const quint8 *p, int size)
+	{
+		Crc32 c;
+		c.update(p, size);
+		return c.final();
+	}
+};
+
+#ifndef STUN_NO_BUILTIN_HMAC
+
+// minimal sha1, enough for hmac(sha1) over stun packets
+class Sha1
+{
+public:
+	quint32 h[5];
+	quint32 total; // stun packets are far below 2^32 bytes
+	quint8 block[64];
+	int blockLen;
+
+	Sha1()
+	{
+		h[0] = 0x67452301;
+		h[1] = 0xefcdab89;
+		h[2] = 0x98badcfe;
+		h[3] = 0x10325476;
+		h[4] = 0xc3d2e1f0;
+		total = 0;
+		blockLen = 0;
+	}
+
+	void update(const quint8 *p, int size)
+	{
+		total += size;
+
+		if(blockLen > 0)
+		{
+			int take = qMin(64 - blockLen, size);
+			memcpy(block + blockLen, p, take);
+			blockLen += take;
+			p += take;
+			size -= take;
+			if(blockLen < 64)
+				return;
+			compress(block);
+			blockLen = 0;
+		}
+
+		while(size >= 64)
+		{
+			compress(p);
+			p += 64;
+			size -= 64;
+		}
+
+		memcpy(block, p, size);
+		blockLen = size;
+	}
+
+	void final(quint8 *out) // 20 bytes
+	{
+		quint8 len[8];
+		write32(len, total >> 29);
+		write32(len + 4, total << 3);
+
+		quint8 pad[64];
+		memset(pad, 0, 64);
+		pad[0] = 0x80;
+		update(pad, (blockLen < 56) ? (56 - blockLen) : (120 - blockLen));
+		update(len, 8);
+
+		for(int n = 0; n < 5; ++n)
+			write32(out + (n * 4), h[n]);
+	}
+
+private:
+	static inline quint32 rol(quint32 x, int n)
+	{
+		return (x << n) | (x >> (32 - n));
+	}
+
+	void compress(const quint8 *p)
+	{
+		quint32 w[80];
+		for(int n = 0; n < 16; ++n)
+			w[n] = read32(p + (n * 4));
+		for(int n = 16; n < 80; ++n)
+			w[n] = rol(w[n - 3] ^ w[n - 8] ^ w[n - 14] ^ w[n - 16], 1);
+
+		quint32 a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for(int n = 0; n < 80; ++n)
+		{
+			quint32 f, k;
+			if(n < 20)
+			{
+				f = (b & c) | (~b & d);
+				k = 0x5a827999;
+			}
+			else if(n < 40)
+			{
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			}
+			else if(n < 60)
+			{
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8f1bbcdc;
+			}
+			else
+			{
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+
+			quint32 t = rol(a, 5) + f + e + k + w[n];
+			e = d;
+			d = c;
+			c = rol(b, 30);
+			b = a;
+			a = t;
+		}
+
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+};
+
+// sha1 states with the padded key already absorbed, so that each message
+//   costs only its own blocks plus the two final compressions
+class HmacKeyState
+{
+public:
+	Sha1 inner, outer;
+
+	HmacKeyState()
+	{
+	}
+
+	HmacKeyState(const QByteArray &key)
+	{
+		quint8 k[64];
+		memset(k, 0, 64);
+		if(key.size() > 64)
+		{
+			Sha1 s;
+			s.update((const quint8 *)key.data(), key.size());
+			s.final(k);
+		}
+		else
+			memcpy(k, key.data(), key.size());
+
+		quint8 pad[64];
+		for(int n = 0; n < 64; ++n)
+			pad[n] = k[n] ^ 0x36;
+		inner.update(pad, 64);
+		for(int n = 0; n < 64; ++n)
+			pad[n] = k[n] ^ 0x5c;
+		outer.update(pad, 64);
+	}
+};
+
+// keys repeat for the life of a session (one per credential), so keep
+//   the prepared states around.  the cache is simply dropped if it
+//   ever fills up
+#define HMAC_CACHE_MAX 32
+
+Q_GLOBAL_STATIC(QMutex, hmac_cache_mutex)
+typedef QHash<QByteArray,HmacKeyState> HmacCache;
+Q_GLOBAL_STATIC(HmacCache, hmac_cache)
+
+static HmacKeyState hmac_key_state(const QByteArray &key)
+{
+	QMutexLocker locker(hmac_cache_mutex());
+	HmacCache *cache = hmac_cache();
+	HmacCache::ConstIterator it = cache->constFind(key);
+	if(it != cache->constEnd())
+		return it.value();
+
+	if(cache->count() >= HMAC_CACHE_MAX)
+		cache->clear();
+
+	HmacKeyState state(key);
+	cache->insert(key, state);
+	return state;
+}
+
+class IntegrityHash
+{
+private:
+	Sha1 inner, outer;
+
+public:
+	IntegrityHash(const QByteArray &key)
+	{
+		HmacKeyState state = hmac_key_state(key);
+		inner = state.inner;
+		outer = state.outer;
+	}
+
+	void update(const quint8 *p, int size)
+	{
+		inner.update(p, size);
+	}
+
+	void final(quint8 *out) // 20 bytes
+	{
+		quint8 digest[20];
+		inner.final(digest);
+		outer.update(digest, 20);
+		outer.final(out);
+	}
+
+	QByteArray final()
+	{
+		QByteArray out(20, 0);
+		final((quint8 *)out.data());
+		return out;
+	}
 };
 
+#else
+
+class IntegrityHash
+{
+private:
+	QCA::MessageAuthenticationCode hmac;
+
+public:
+	IntegrityHash(const QByteArray &key) :
+		hmac("hmac(sha1)", key)
+	{
+	}
+
+	void update(const quint8 *p, int size)
+	{
+		hmac.update(QByteArray::fromRawData((const char *)p, size));
+	}
+
+	QByteArray final()
+	{
+		return hmac.final().toByteArray();
+	}
+
+	void final(quint8 *out) // 20 bytes
+	{
+		QByteArray result = final();
+		Q_ASSERT(result.size() == 20);
+		memcpy(out, result.data(), 20);
+	}
+};
+
+#endif
+
 static quint8 magic_cookie[4] = { 0x21, 0x12, 0xA4, 0x42 };
 
+// the message type field, with the class and method bits interleaved
+static quint16 encode_type(StunMessage::Class mclass, quint16 method)
+{
+	quint8 classbits = 0;
+	if(mclass == StunMessage::Request)
+		classbits = 0; // 00
+	else if(mclass == StunMessage::Indication)
+		classbits = 1; // 01
+	else if(mclass == StunMessage::SuccessResponse)
+		classbits = 2; // 10
+	else if(mclass == StunMessage::ErrorResponse)
+		classbits = 3; // 11
+	else
+		Q_ASSERT(0);
+
+	// method bits are split into 3 sections
+	quint16 m1, m2, m3;
+	m1 = method & 0x0f80; // M7-11
+	m1 <<= 2;
+	m2 = method & 0x0070; // M4-6
+	m2 <<= 1;
+	m3 = method & 0x000f; // M0-3
+
+	// class bits are split into 2 sections
+	quint16 c1, c2;
+	c1 = classbits & 0x02; // C1
+	c1 <<= 7;
+	c2 = classbits & 0x01; // C0
+	c2 <<= 4;
+
+	return m1 | m2 | m3 | c1 | c2;
+}
+
 // do 3-field check of stun packet
 // returns length of packet not counting the header, or -1 on error
 static int check_and_get_length(const QByteArray &buf)
@@ -194,19 +563,18 @@ static quint16 round_up_length(quint16 in)
 	return out;
 }
 
-// buf    = entire stun packet
+// p      = entire stun packet
+// size   = size of packet
 // offset = byte index of current attribute (first is offset=20)
 // type   = take attribute type
 // len    = take attribute value length (value is at offset + 4)
 // returns offset of next attribute, -1 if no more
-static int get_attribute_props(const QByteArray &buf, int offset, quint16 *type, int *len)
+static int get_attribute_props(const quint8 *p, int size, int offset, quint16 *type, int *len)
 {
 	Q_ASSERT(offset >= ATTRIBUTE_AREA_START);
 
-	const quint8 *p = (const quint8 *)buf.data();
-
 	// need at least 4 bytes for an attribute
-	if(offset + 4 > buf.size())
+	if(offset + 4 > size)
 		return -1;
 
 	quint16 _type = read16(p + offset);
@@ -217,7 +585,7 @@ static int get_attribute_props(const QByteArray &buf, int offset, quint16 *type,
 	// get physical length.  stun attributes are 4-byte aligned, and may
 	//   contain 0-3 bytes of padding.
 	quint16 plen = round_up_length(_alen);
-	if(offset + plen > buf.size())
+	if(offset + plen > size)
 		return -1;
 
 	*type = _type;
@@ -239,7 +607,7 @@ static int find_attribute(const QByteArray &buf, quint16 type, int *len, int *ne
 
 	while(1)
 	{
-		_next = get_attribute_props(buf, at, &_type, &_len);
+		_next = get_attribute_props((const quint8 *)buf.data(), buf.size(), at, &_type, &_len);
 		if(_next == -1)
 			break;
 		if(_type == type)
@@ -255,50 +623,9 @@ static int find_attribute(const QByteArray &buf, quint16 type, int *len, int *ne
 	return -1;
 }
 
-// buf  = stun packet to append attribute to
-// type = type of attribute
-// len  = length of value
-// returns offset of new attribute, or -1 if it can't fit
-// note: attribute value is located at offset + 4 and is uninitialized
-// note: padding following attribute is zeroed out
-static int append_attribute_uninitialized(QByteArray *buf, quint16 type, int len)
-{
-	if(len > ATTRIBUTE_VALUE_MAX)
-		return -1;
-
-	quint16 alen = (quint16)len;
-	quint16 plen = round_up_length(alen);
-
-	if((buf->size() - ATTRIBUTE_AREA_START) + 4 + plen > ATTRIBUTE_AREA_MAX)
-		return -1;
-
-	int at = buf->size();
-	buf->resize(buf->size() + 4 + plen);
-	quint8 *p = (quint8 *)buf->data();
-
-	write16(p + at, type);
-	write16(p + at + 2, alen);
-
-	// padding
-	for(int n = 0; n < plen - alen; ++n)
-		p[at + alen + n] = 0;
-
-	return at;
-}
-
 static quint32 fingerprint_calc(const quint8 *buf, int size)
 {
-	QByteArray region = QByteArray::fromRawData((const char *)buf, size);
-	return Crc32::process(region) ^ 0x5354554e;
-}
-
-static QByteArray message_integrity_calc(const quint8 *buf, int size, const QByteArray &key)
-{
-	QCA::MessageAuthenticationCode hmac("hmac(sha1)", key);
-	QByteArray region = QByteArray::fromRawData((const char *)buf, size);
-	QByteArray result = hmac.process(region).toByteArray();
-	Q_ASSERT(result.size() == 20);
-	return result;
+	return Crc32::process(buf, size) ^ 0x5354554e;
 }
 
 // look for fingerprint attribute and confirm it
@@ -320,16 +647,14 @@ static bool fingerprint_check(const QByteArray &buf)
 		return false;
 }
 
-// copy the input buffer and prepare for message integrity checking.  the
-//   packet is truncated after the message-integrity attribute (since nothing
-//   after it is protected), and the packet length is adjusted in the header
-//   accordingly.
-// buf    = input stun packet
-// out    = take output stun packet
-// offset = take offset of message-integrity attribute
-// returns true if message-integrity attribute exists and packet is prepared
-// note: message-integrity value is at offset + 4 and is exactly 20 bytes
-static bool message_integrity_prep(const QByteArray &buf, QByteArray *out, int *offset)
+// confirm message integrity.  nothing after the message-integrity
+//   attribute is protected, and the hash covers the header as if the
+//   packet ended there, so only the header is copied to adjust its length
+// buf  = input stun packet
+// key  = the HMAC key
+// end  = take offset just past the message-integrity attribute
+// returns true if message-integrity attribute exists and is correct
+static bool message_integrity_check(const QByteArray &buf, const QByteArray &key, int *end)
 {
 	int at, len, next;
 	at = find_attribute(buf, AttribMessageIntegrity, &len, &next);
@@ -343,40 +668,180 @@ static bool message_integrity_prep(const QByteArray &buf, QByteArray *out, int *
 	if(i % 4 != 0)
 		return false;
 
-	// copy truncated packet
-	*out = buf.mid(0, next);
+	const quint8 *p = (const quint8 *)buf.data();
+
+	quint8 header[ATTRIBUTE_AREA_START];
+	memcpy(header, p, ATTRIBUTE_AREA_START);
+	write16(header + 2, (quint16)i);
 
-	// set new length in header
-	quint16 newlen = (quint16)i;
-	write16((quint8 *)out->data() + 2, newlen);
+	IntegrityHash hmac(key);
+	hmac.update(header, ATTRIBUTE_AREA_START);
+	hmac.update(p + ATTRIBUTE_AREA_START, at - ATTRIBUTE_AREA_START);
+	QByteArray micalc = hmac.final();
+	if(micalc.size() != 20 || memcmp(micalc.data(), p + at + 4, 20) != 0)
+		return false;
 
-	*offset = at;
+	*end = next;
 	return true;
 }
 
-// confirm message integrity
-// buf    = prepared stun packet (from message_integrity_prep())
-// offset = offset of message-integrity attribute
-// key    = the HMAC key
-// returns true if correct
-static bool message_integrity_check(const QByteArray &buf, int offset, const QByteArray &key)
+//----------------------------------------------------------------------------
+// StunMessage::Writer
+//----------------------------------------------------------------------------
+StunMessage::Writer::Writer(quint8 *_buf, int _capacity) :
+	buf(_buf),
+	capacity(_capacity),
+	used(0),
+	ok(false)
 {
-	QByteArray mival = QByteArray::fromRawData(buf.data() + offset + 4, 20);
-	QByteArray micalc = message_integrity_calc((const quint8 *)buf.data(), offset, key);
-	if(mival == micalc)
-		return true;
-	else
+}
+
+void StunMessage::Writer::begin(Class mclass, quint16 method, const quint8 *id, const quint8 *magic)
+{
+	used = 0;
+	ok = (capacity >= ATTRIBUTE_AREA_START);
+	if(!ok)
+		return;
+
+	write16(buf, encode_type(mclass, method));
+	write16(buf + 2, 0);
+	memcpy(buf + 4, magic ? magic : magic_cookie, 4);
+	memcpy(buf + 8, id, 12);
+	used = ATTRIBUTE_AREA_START;
+}
+
+quint8 *StunMessage::Writer::appendAttribute(quint16 type, int len)
+{
+	if(!ok)
+		return 0;
+
+	if(len < 0 || len > ATTRIBUTE_VALUE_MAX)
+	{
+		ok = false;
+		return 0;
+	}
+
+	quint16 alen = (quint16)len;
+	quint16 plen = round_up_length(alen);
+
+	if((used - ATTRIBUTE_AREA_START) + 4 + plen > ATTRIBUTE_AREA_MAX || used + 4 + plen > capacity)
+	{
+		ok = false;
+		return 0;
+	}
+
+	quint8 *p = buf + used;
+	write16(p, type);
+	write16(p + 2, alen);
+
+	// padding
+	for(int n = alen; n < plen; ++n)
+		p[4 + n] = 0;
+
+	used += 4 + plen;
+	write16(buf + 2, used - ATTRIBUTE_AREA_START);
+	return p + 4;
+}
+
+bool StunMessage::Writer::appendAttribute(quint16 type, const quint8 *value, int len)
+{
+	quint8 *p = appendAttribute(type, len);
+	if(!p)
 		return false;
+
+	memcpy(p, value, len);
+	return true;
+}
+
+int StunMessage::Writer::finish(int validationFlags, const QByteArray &key)
+{
+	if(validationFlags & MessageIntegrity)
+	{
+		// the length field already counts the new attribute when
+		//   appendAttribute() returns, as the hash requires
+		int at = used;
+		quint8 *p = appendAttribute(AttribMessageIntegrity, 20); // size of hmac(sha1)
+		if(!p)
+			return -1;
+
+		IntegrityHash hmac(key);
+		hmac.update(buf, at);
+		hmac.final(p);
+	}
+
+	if(validationFlags & Fingerprint)
+	{
+		int at = used;
+		quint8 *p = appendAttribute(AttribFingerprint, 4); // size of crc32
+		if(!p)
+			return -1;
+
+		write32(p, fingerprint_calc(buf, at));
+	}
+
+	if(!ok)
+		return -1;
+
+	return used;
+}
+
+bool StunMessage::Writer::isValid() const
+{
+	return ok;
 }
 
+int StunMessage::Writer::size() const
+{
+	return used;
+}
+
+int StunMessage::Writer::attributeSize(int len)
+{
+	// values too large for an attribute are counted unpadded.  they
+	//   fail to append either way
+	if(len > ATTRIBUTE_VALUE_MAX)
+		return 4 + len;
+	return 4 + round_up_length((quint16)len);
+}
+
+int StunMessage::Writer::validationSize(int validationFlags)
+{
+	int size = 0;
+	if(validationFlags & MessageIntegrity)
+		size += 4 + 20;
+	if(validationFlags & Fingerprint)
+		size += 4 + 4;
+	return size;
+}
+
+//----------------------------------------------------------------------------
+// StunMessage
+//----------------------------------------------------------------------------
 class StunMessage::Private : public QSharedData
 {
 public:
+	// location of an attribute value within the parsed packet
+	class AttribRef
+	{
+	public:
+		quint16 type;
+		int offset;
+		int len;
+	};
+
 	StunMessage::Class mclass;
 	quint16 method;
 	quint8 magic[4];
 	quint8 id[12];
+
+	// a message built by the user keeps its attributes in 'attribs'.  a
+	//   message from fromBinary() instead shares the packet it was parsed
+	//   from and records where each attribute is in it
 	QList<Attribute> attribs;
+	bool parsed;
+	QByteArray raw;
+	QVarLengthArray<AttribRef, 16> refs;
+	int common[COMMON_SLOTS]; // first instance in refs, or -1
 
 	Private()
 	{
@@ -384,6 +849,29 @@ public:
 		method = 0;
 		memcpy(magic, magic_cookie, 4);
 		memset(id, 0, 12);
+		parsed = false;
+		clearCommon();
+	}
+
+	void clearCommon()
+	{
+		for(int n = 0; n < COMMON_SLOTS; ++n)
+			common[n] = -1;
+	}
+
+	// returns index into refs, or -1
+	int findRef(quint16 type) const
+	{
+		int slot = common_slot(type);
+		if(slot != -1)
+			return common[slot];
+
+		for(int n = 0; n < refs.count(); ++n)
+		{
+			if(refs[n].type == type)
+				return n;
+		}
+		return -1;
 	}
 };
 
@@ -439,13 +927,39 @@ const quint8 *StunMessage::id() const
 QList<StunMessage::Attribute> StunMessage::attributes() const
 {
 	Q_ASSERT(d);
-	return d->attribs;
+
+	if(!d->parsed)
+		return d->attribs;
+
+	QList<Attribute> list;
+	for(int n = 0; n < d->refs.count(); ++n)
+	{
+		Attribute attrib;
+		attrib.type = d->refs[n].type;
+		attrib.value = d->raw.mid(d->refs[n].offset, d->refs[n].len);
+		list += attrib;
+	}
+	return list;
 }
 
 QByteArray StunMessage::attribute(quint16 type) const
 {
 	Q_ASSERT(d);
 
+	if(d->parsed)
+	{
+		int at = d->findRef(type);
+		if(at == -1)
+			return QByteArray();
+
+		// mid() would give a null array for an empty value at the very
+		//   end of the packet, but a present attribute must be non-null
+		const Private::AttribRef &ref = d->refs[at];
+		if(ref.len == 0)
+			return QByteArray("");
+		return d->raw.mid(ref.offset, ref.len);
+	}
+
 	foreach(const Attribute &i, d->attribs)
 	{
 		if(i.type == type)
@@ -454,6 +968,39 @@ QByteArray StunMessage::attribute(quint16 type) const
 	return QByteArray();
 }
 
+bool StunMessage::hasAttribute(quint16 type) const
+{
+	return (attributeData(type, 0) ? true : false);
+}
+
+const quint8 *StunMessage::attributeData(quint16 type, int *len) const
+{
+	Q_ASSERT(d);
+
+	if(d->parsed)
+	{
+		int at = d->findRef(type);
+		if(at == -1)
+			return 0;
+
+		if(len)
+			*len = d->refs[at].len;
+		return (const quint8 *)d->raw.constData() + d->refs[at].offset;
+	}
+
+	for(int n = 0; n < d->attribs.count(); ++n)
+	{
+		const Attribute &i = d->attribs[n];
+		if(i.type == type)
+		{
+			if(len)
+				*len = i.value.size();
+			return (const quint8 *)i.value.constData();
+		}
+	}
+	return 0;
+}
+
 void StunMessage::setClass(Class mclass)
 {
 	ENSURE_D
@@ -482,98 +1029,62 @@ void StunMessage::setAttributes(const QList<Attribute> &attribs)
 {
 	ENSURE_D
 	d->attribs = attribs;
+	d->parsed = false;
+	d->raw.clear();
+	d->refs.clear();
+	d->clearCommon();
 }
 
 QByteArray StunMessage::toBinary(int validationFlags, const QByteArray &key) const
 {
 	Q_ASSERT(d);
 
-	// header
-	QByteArray buf(20, 0);
-	quint8 *p = (quint8 *)buf.data();
-
-	quint8 classbits = 0;
-	if(d->mclass == Request)
-		classbits = 0; // 00
-	else if(d->mclass == Indication)
-		classbits = 1; // 01
-	else if(d->mclass == SuccessResponse)
-		classbits = 2; // 10
-	else if(d->mclass == ErrorResponse)
-		classbits = 3; // 11
+	// size the packet up front, so that it is allocated only once
+	int total = ATTRIBUTE_AREA_START + Writer::validationSize(validationFlags);
+	if(d->parsed)
+	{
+		for(int n = 0; n < d->refs.count(); ++n)
+			total += Writer::attributeSize(d->refs[n].len);
+	}
 	else
-		Q_ASSERT(0);
-
-	// method bits are split into 3 sections
-	quint16 m1, m2, m3;
-	m1 = d->method & 0x0f80; // M7-11
-	m1 <<= 2;
-	m2 = d->method & 0x0070; // M4-6
-	m2 <<= 1;
-	m3 = d->method & 0x000f; // M0-3
-
-	// class bits are split into 2 sections
-	quint16 c1, c2;
-	c1 = classbits & 0x02; // C1
-	c1 <<= 7;
-	c2 = classbits & 0x01; // C0
-	c2 <<= 4;
-
-	quint16 type = m1 | m2 | m3 | c1 | c2;
-	write16(p, type);
-	write16(p + 2, 0);
-	memcpy(p + 4, d->magic, 4);
-	memcpy(p + 8, d->id, 12);
-
-	foreach(const Attribute &i, d->attribs)
 	{
-		int at = append_attribute_uninitialized(&buf, i.type, i.value.size());
-		if(at == -1)
-			return QByteArray();
-
-		p = (quint8 *)buf.data(); // follow the resize
-
-		memcpy(buf.data() + at + 4, i.value.data(), i.value.size());
+		foreach(const Attribute &i, d->attribs)
+			total += Writer::attributeSize(i.value.size());
 	}
 
-	// set attribute area size
-	write16(p + 2, buf.size() - ATTRIBUTE_AREA_START);
-
-	if(validationFlags & MessageIntegrity)
-	{
-		quint16 alen = 20; // size of hmac(sha1)
-		int at = append_attribute_uninitialized(&buf, AttribMessageIntegrity, alen);
-		if(at == -1)
-			return QByteArray();
+	if(total - ATTRIBUTE_AREA_START > ATTRIBUTE_AREA_MAX)
+		return QByteArray();
 
-		p = (quint8 *)buf.data(); // follow the resize
+	QByteArray buf;
+	buf.resize(total);
 
-		// set attribute area size to include the new attribute
-		write16(p + 2, buf.size() - ATTRIBUTE_AREA_START);
+	Writer w((quint8 *)buf.data(), buf.size());
+	w.begin(d->mclass, d->method, d->id, d->magic);
 
-		// now calculate the hash and fill in the value
-		QByteArray result = message_integrity_calc(p, at, key);
-		Q_ASSERT(result.size() == alen);
-		memcpy(p + at + 4, result.data(), alen);
+	if(d->parsed)
+	{
+		const quint8 *raw = (const quint8 *)d->raw.constData();
+		for(int n = 0; n < d->refs.count(); ++n)
+		{
+			const Private::AttribRef &ref = d->refs[n];
+			if(!w.appendAttribute(ref.type, raw + ref.offset, ref.len))
+				return QByteArray();
+		}
 	}
-
-	if(validationFlags & Fingerprint)
+	else
 	{
-		quint16 alen = 4; // size of crc32
-		int at = append_attribute_uninitialized(&buf, AttribFingerprint, alen);
-		if(at == -1)
-			return QByteArray();
-
-		p = (quint8 *)buf.data(); // follow the resize
-
-		// set attribute area size to include the new attribute
-		write16(p + 2, buf.size() - ATTRIBUTE_AREA_START);
-
-		// now calculate the fingerprint and fill in the value
-		quint32 fpcalc = fingerprint_calc(p, at);
-		write32(p + at + 4, fpcalc);
+		foreach(const Attribute &i, d->attribs)
+		{
+			if(!w.appendAttribute(i.type, (const quint8 *)i.value.data(), i.value.size()))
+				return QByteArray();
+		}
 	}
 
+	int size = w.finish(validationFlags, key);
+	if(size == -1)
+		return QByteArray();
+
+	Q_ASSERT(size == total);
 	return buf;
 }
 
@@ -597,31 +1108,23 @@ StunMessage StunMessage::fromBinary(const QByteArray &a, ConvertResult *result,
 		}
 	}
 
-	QByteArray in;
+	// attributes after message-integrity are not protected, so they are
+	//   not parsed when it is checked
+	int end = a.size();
 
 	if(validationFlags & MessageIntegrity)
 	{
-		int offset;
-		if(!message_integrity_prep(a, &in, &offset))
-		{
-			if(result)
-				*result = ErrorMessageIntegrity;
-			return StunMessage();
-		}
-
-		if(!message_integrity_check(in, offset, key))
+		if(!message_integrity_check(a, key, &end))
 		{
 			if(result)
 				*result = ErrorMessageIntegrity;
 			return StunMessage();
 		}
 	}
-	else
-		in = a;
 
 	// all validating complete, now just parse the packet
 
-	const quint8 *p = (const quint8 *)in.data();
+	const quint8 *p = (const quint8 *)a.data();
 
 	// method bits are split into 3 sections
 	quint16 m1, m2, m3;
@@ -657,7 +1160,11 @@ StunMessage StunMessage::fromBinary(const QByteArray &a, ConvertResult *result,
 	out.setMagic(p + 4);
 	out.setId(p + 8);
 
-	QList<Attribute> list;
+	// index the attributes in place.  'raw' shares the caller's buffer,
+	//   so no copy is made until a value is asked for
+	Private *od = out.d.data();
+	od->parsed = true;
+	od->raw = a;
 	int at = ATTRIBUTE_AREA_START;
 	while(1)
 	{
@@ -665,18 +1172,23 @@ StunMessage StunMessage::fromBinary(const QByteArray &a, ConvertResult *result,
 		int len;
 		int next;
 
-		next = get_attribute_props(in, at, &type, &len);
+		next = get_attribute_props(p, end, at, &type, &len);
 		if(next == -1)
 			break;
 
-		Attribute attrib;
-		attrib.type = type;
-		attrib.value = in.mid(at + 4, len);
-		list += attrib;
+		Private::AttribRef ref;
+		ref.type = type;
+		ref.offset = at + 4;
+		ref.len = len;
+
+		int slot = common_slot(type);
+		if(slot != -1 && od->common[slot] == -1)
+			od->common[slot] = od->refs.count();
+
+		od->refs.append(ref);
 
 		at = next;
 	}
-	out.setAttributes(list);
 
 	if(result)
 		*result = ConvertGood;
@@ -42,7 +42,9 @@ public:
 	{
 		Fingerprint      = 0x01,
 
-		// you must have the hmac(sha1) algorithm in QCA to use
+		// uses a built-in hmac(sha1).  if built with
+		//   STUN_NO_BUILTIN_HMAC, you must have the hmac(sha1)
+		//   algorithm in QCA to use
 		MessageIntegrity = 0x02
 	};
 
@@ -62,6 +64,44 @@ public:
 		QByteArray value;
 	};
 
+	// builds a packet in place, in a buffer supplied by the caller, for
+	//   messages that are sent often enough that building a StunMessage
+	//   and calling toBinary() would be too costly.  it doesn't allocate,
+	//   apart from preparing an integrity key the first time it is seen.
+	//   call begin(), then append the attributes in order, then finish(),
+	//   which adds MESSAGE-INTEGRITY and FINGERPRINT as requested.  once
+	//   anything fails to fit, all further calls fail too
+	class Writer
+	{
+	public:
+		Writer(quint8 *_buf, int _capacity);
+
+		void begin(Class mclass, quint16 method, const quint8 *id, const quint8 *magic = 0);
+
+		// returns a pointer to the value, to be filled in by the caller,
+		//   or null if it doesn't fit.  padding is zeroed already
+		quint8 *appendAttribute(quint16 type, int len);
+		bool appendAttribute(quint16 type, const quint8 *value, int len);
+
+		// returns the size of the finished packet, or -1 on error
+		int finish(int validationFlags = 0, const QByteArray &key = QByteArray());
+
+		bool isValid() const;
+		int size() const;
+
+		// the space taken by an attribute with a value of len bytes,
+		//   and by the validation attributes for the given flags, so that
+		//   a buffer can be sized up front
+		static int attributeSize(int len);
+		static int validationSize(int validationFlags);
+
+	private:
+		quint8 *buf;
+		int capacity;
+		int used;
+		bool ok;
+	};
+
 	StunMessage();
 	StunMessage(const StunMessage &from);
 	~StunMessage();
@@ -77,6 +117,12 @@ public:
 	// returns the first instance or null
 	QByteArray attribute(quint16 type) const;
 
+	// like attribute(), but without making a copy.  returns a pointer to
+	//   the value of the first instance and its length, or null.  the
+	//   pointer is valid until the message is modified or destroyed
+	const quint8 *attributeData(quint16 type, int *len) const;
+	bool hasAttribute(quint16 type) const;
+
 	void setClass(Class mclass);
 	void setMethod(quint16 method);
 	void setMagic(const quint8 *magic); // 4 bytes
@@ -84,6 +130,10 @@ public:
 	void setAttributes(const QList<Attribute> &attribs);
 
 	QByteArray toBinary(int validationFlags = 0, const QByteArray &key = QByteArray()) const;
+
+	// the result shares the data of 'a' rather than copying attributes
+	//   out of it, so 'a' must not be a QByteArray::fromRawData() array
+	//   that outlives its buffer
 	static StunMessage fromBinary(const QByteArray &a, ConvertResult *result = 0, int validationFlags = 0, const QByteArray &key = QByteArray());
 
 	// minimal 3-field check
@@ -22,17 +22,34 @@
 
 #include <QHash>
 #include <QMetaType>
+#include <QPointer>
 #include <QTime>
 #include <QTimer>
 #include <QtCrypto>
 #include "stunutil.h"
 #include "stunmessage.h"
 #include "stuntypes.h"
+#include "iristrace.h"
 
 Q_DECLARE_METATYPE(XMPP::StunTransaction::Error)
 
+// retransmissions are scheduled on a two level timer wheel in the pool.
+//   the near level covers WHEEL_NEAR ticks one slot per tick, the far level
+//   WHEEL_FAR times as much, which is well beyond the 39.5s of Ti
+#define WHEEL_TICK 10 // msecs
+#define WHEEL_NEAR 256
+#define WHEEL_FAR  64
+
+// bounds of the initial udp RTO learned per destination, and how many
+//   destinations to remember
+#define RTO_MIN 100
+#define RTO_MAX 3000
+#define RTT_DESTINATIONS 1000
+
 namespace XMPP {
 
+class StunTransactionPrivate;
+
 // parse a stun message, optionally performing validity checks.  the
 //   StunMessage class itself provides parsing with validity or parsing
 //   without validity, but it does not provide a way to do both together,
@@ -108,29 +125,86 @@ public:
 	QString nonce;
 	int debugLevel;
 
+	// md5(user:realm:pass), cleared whenever one of those changes
+	QByteArray longTermKey;
+
+	// the timers of all transactions, driven by one QTimer that only
+	//   runs while something is scheduled.  each slot is a list linked
+	//   through the transactions themselves
+	StunTransactionPrivate *wheelNear[WHEEL_NEAR];
+	StunTransactionPrivate *wheelFar[WHEEL_FAR];
+	int scheduled;
+	quint64 now, base, armedAt; // in ticks
+	QTime clock;
+	QTimer *tick;
+
+	// waiting for continueAfterParams()
+	QList<StunTransaction*> retries;
+
+	// smoothed round trip time and its variation per destination, as
+	//   RFC 6298 keeps them, to start new udp transactions with
+	class RttEstimate
+	{
+	public:
+		int srtt, rttvar;
+	};
+	QHash<QString,RttEstimate> rtts;
+
 	StunTransactionPoolPrivate(StunTransactionPool *_q) :
 		QObject(_q),
 		q(_q),
 		useLongTermAuth(false),
 		needLongTermAuth(false),
 		triedLongTermAuth(false),
-		debugLevel(StunTransactionPool::DL_None)
+		debugLevel(StunTransactionPool::DL_None),
+		scheduled(0),
+		now(0),
+		base(0),
+		armedAt(0)
 	{
+		for(int n = 0; n < WHEEL_NEAR; ++n)
+			wheelNear[n] = 0;
+		for(int n = 0; n < WHEEL_FAR; ++n)
+			wheelFar[n] = 0;
+
+		tick = new QTimer(this);
+		connect(tick, SIGNAL(timeout()), SLOT(tick_timeout()));
+		tick->setSingleShot(true);
 	}
 
 	QByteArray generateId() const;
+	QByteArray getLongTermKey();
 	void insert(StunTransaction *trans);
 	void remove(StunTransaction *trans);
 	void transmit(StunTransaction *trans);
+
+	void schedule(StunTransactionPrivate *trans, int msecs);
+	void unschedule(StunTransactionPrivate *trans);
+
+	int initialRto(const QHostAddress &addr, int port, int fallback) const;
+	void addRttSample(const QHostAddress &addr, int port, int msecs);
+
+private:
+	static QString destination(const QHostAddress &addr, int port)
+	{
+		return addr.toString() + ';' + QString::number(port);
+	}
+
+	void place(StunTransactionPrivate *trans);
+	void rearm();
+
+private slots:
+	void tick_timeout();
+	void doRetries();
 };
 
 //----------------------------------------------------------------------------
 // StunTransaction
 //----------------------------------------------------------------------------
-class StunTransactionPrivate : public QObject
+// no QObject of its own: the timer is in the pool, and StunTransaction
+//   is the only object a check costs
+class StunTransactionPrivate
 {
-	Q_OBJECT
-
 public:
 	StunTransaction *q;
 
@@ -144,9 +218,13 @@ public:
 	int to_port;
 
 	int rto, rc, rm, ti;
+	bool rtoSet;
 	int tries;
 	int last_interval;
-	QTimer *t;
+
+	// position on the pool's timer wheel
+	StunTransactionPrivate *wheelNext, **wheelSlot;
+	quint64 expires;
 
 	QString stuser;
 	QString stpass;
@@ -155,21 +233,20 @@ public:
 	QTime time;
 
 	StunTransactionPrivate(StunTransaction *_q) :
-		QObject(_q),
 		q(_q),
 		pool(0),
+		wheelNext(0),
+		wheelSlot(0),
+		expires(0),
 		fpRequired(false)
 	{
 		qRegisterMetaType<StunTransaction::Error>();
 
 		active = false;
 
-		t = new QTimer(this);
-		connect(t, SIGNAL(timeout()), SLOT(t_timeout()));
-		t->setSingleShot(true);
-
 		// defaults from RFC 5389
 		rto = 500;
+		rtoSet = false;
 		rc = 7;
 		rm = 16;
 		ti = 39500;
@@ -178,11 +255,10 @@ public:
 	~StunTransactionPrivate()
 	{
 		if(pool)
+		{
+			pool->d->unschedule(this);
 			pool->d->remove(q);
-
-		t->disconnect(this);
-		t->setParent(0);
-		t->deleteLater();
+		}
 	}
 
 	void start(StunTransactionPool *_pool, const QHostAddress &toAddress, int toPort)
@@ -192,6 +268,10 @@ public:
 		to_addr = toAddress;
 		to_port = toPort;
 
+		if(mode == StunTransaction::Udp && !rtoSet)
+			rto = pool->d->initialRto(to_addr, to_port, rto);
+
+		IRIS_TRACEPOINT1(stun_transaction_begin, q);
 		tryRequest();
 	}
 
@@ -216,6 +296,7 @@ public:
 		{
 			// since a transaction is not cancelable nor reusable,
 			//   there's no DOR-SR issue here
+			IRIS_TRACEPOINT2(stun_transaction_end, q, 1);
 			QMetaObject::invokeMethod(q, "error", Qt::QueuedConnection,
 				Q_ARG(XMPP::StunTransaction::Error, StunTransaction::ErrorGeneric));
 			return;
@@ -260,14 +341,7 @@ public:
 			}
 			out.setAttributes(list);
 
-			QCA::SecureArray buf;
-			buf += StunUtil::saslPrep(pool->d->user.toUtf8());
-			buf += QByteArray(1, ':');
-			buf += StunUtil::saslPrep(pool->d->realm.toUtf8());
-			buf += QByteArray(1, ':');
-			buf += StunUtil::saslPrep(pool->d->pass);
-
-			key = QCA::Hash("md5").process(buf).toByteArray();
+			key = pool->d->getLongTermKey();
 		}
 
 		if(!key.isEmpty())
@@ -279,6 +353,7 @@ public:
 		{
 			// since a transaction is not cancelable nor reusable,
 			//   there's no DOR-SR issue here
+			IRIS_TRACEPOINT2(stun_transaction_end, q, 1);
 			QMetaObject::invokeMethod(q, "error", Qt::QueuedConnection,
 				Q_ARG(XMPP::StunTransaction::Error, StunTransaction::ErrorGeneric));
 			return;
@@ -290,12 +365,12 @@ public:
 		if(mode == StunTransaction::Udp)
 		{
 			last_interval = rm * rto;
-			t->start(rto);
+			pool->d->schedule(this, rto);
 			rto *= 2;
 		}
 		else if(mode == StunTransaction::Tcp)
 		{
-			t->start(ti);
+			pool->d->schedule(this, ti);
 		}
 		else
 			Q_ASSERT(0);
@@ -305,12 +380,13 @@ public:
 		transmit();
 	}
 
-private slots:
-	void t_timeout()
+	// called by the pool when the timer is due
+	void timeout()
 	{
 		if(mode == StunTransaction::Tcp || tries == rc)
 		{
 			pool->d->remove(q);
+			IRIS_TRACEPOINT2(stun_transaction_end, q, 2);
 			emit q->error(StunTransaction::ErrorTimeout);
 			return;
 		}
@@ -318,14 +394,15 @@ private slots:
 		++tries;
 		if(tries == rc)
 		{
-			t->start(last_interval);
+			pool->d->schedule(this, last_interval);
 		}
 		else
 		{
-			t->start(rto);
+			pool->d->schedule(this, rto);
 			rto *= 2;
 		}
 
+		IRIS_TRACEPOINT2(stun_transaction_retransmit, q, tries);
 		transmit();
 	}
 
@@ -360,7 +437,12 @@ private:
 	void processIncoming(const StunMessage &msg, bool authed)
 	{
 		active = false;
-		t->stop();
+		pool->d->unschedule(this);
+
+		// a response to a retransmission could belong to any of the
+		//   requests, so only the first try tells the round trip time
+		if(mode == StunTransaction::Udp && tries == 1)
+			pool->d->addRttSample(to_addr, to_port, time.elapsed());
 
 		if(pool->d->debugLevel >= StunTransactionPool::DL_Packet)
 			emit pool->debugLine(QString("matched incoming response to existing request.  elapsed=") + QString::number(time.elapsed()));
@@ -389,7 +471,10 @@ private:
 						//   which will be used for all transactions
 						//   once creds are provided.
 						if(pool->d->realm.isEmpty())
+						{
 							pool->d->realm = realm;
+							pool->d->longTermKey.clear();
+						}
 						pool->d->nonce = nonce;
 
 						if(!pool->d->needLongTermAuth)
@@ -428,6 +513,7 @@ private:
 			return;
 
 		pool->d->remove(q);
+		IRIS_TRACEPOINT2(stun_transaction_end, q, 0);
 		emit q->finished(msg);
 	}
 
@@ -472,12 +558,6 @@ public:
 		processIncoming(msg, (validationFlags & StunMessage::MessageIntegrity) ? true : false);
 		return true;
 	}
-
-public slots:
-	void continueAfterParams()
-	{
-		retry();
-	}
 };
 
 StunTransaction::StunTransaction(QObject *parent) :
@@ -506,6 +586,7 @@ void StunTransaction::setRTO(int i)
 {
 	Q_ASSERT(!d->active);
 	d->rto = i;
+	d->rtoSet = true;
 }
 
 void StunTransaction::setRc(int i)
@@ -566,8 +647,26 @@ void StunTransactionPoolPrivate::insert(StunTransaction *trans)
 	idToTrans.insert(id, trans);
 }
 
+QByteArray StunTransactionPoolPrivate::getLongTermKey()
+{
+	if(longTermKey.isEmpty())
+	{
+		QCA::SecureArray buf;
+		buf += StunUtil::saslPrep(user.toUtf8());
+		buf += QByteArray(1, ':');
+		buf += StunUtil::saslPrep(realm.toUtf8());
+		buf += QByteArray(1, ':');
+		buf += StunUtil::saslPrep(pass);
+
+		longTermKey = QCA::Hash("md5").process(buf).toByteArray();
+	}
+
+	return longTermKey;
+}
+
 void StunTransactionPoolPrivate::remove(StunTransaction *trans)
 {
+	retries.removeAll(trans);
 	if(transactions.contains(trans))
 	{
 		transactions.remove(trans);
@@ -582,6 +681,167 @@ void StunTransactionPoolPrivate::transmit(StunTransaction *trans)
 	emit q->outgoingMessage(trans->d->packet, trans->d->to_addr, trans->d->to_port);
 }
 
+int StunTransactionPoolPrivate::initialRto(const QHostAddress &addr, int port, int fallback) const
+{
+	QHash<QString,RttEstimate>::ConstIterator it = rtts.find(destination(addr, port));
+	if(it == rtts.end())
+		return fallback;
+
+	// RTO = SRTT + max(G, 4 * RTTVAR)
+	int rto = it->srtt + qMax(WHEEL_TICK, 4 * it->rttvar);
+	return qBound(RTO_MIN, rto, RTO_MAX);
+}
+
+void StunTransactionPoolPrivate::addRttSample(const QHostAddress &addr, int port, int msecs)
+{
+	QString key = destination(addr, port);
+	QHash<QString,RttEstimate>::Iterator it = rtts.find(key);
+	if(it == rtts.end())
+	{
+		if(rtts.count() >= RTT_DESTINATIONS)
+			rtts.clear();
+
+		RttEstimate e;
+		e.srtt = msecs;
+		e.rttvar = msecs / 2;
+		rtts.insert(key, e);
+		return;
+	}
+
+	RttEstimate &e = it.value();
+	e.rttvar = (3 * e.rttvar + qAbs(e.srtt - msecs)) / 4;
+	e.srtt = (7 * e.srtt + msecs) / 8;
+}
+
+void StunTransactionPoolPrivate::schedule(StunTransactionPrivate *trans, int msecs)
+{
+	unschedule(trans);
+	if(scheduled == 0)
+	{
+		base = now;
+		clock.start();
+	}
+
+	// count from the clock.  now may lag behind it, which only makes
+	//   the timer sit on the wheel a little longer
+	quint64 cur = base + clock.elapsed() / WHEEL_TICK;
+	trans->expires = cur + qMax((msecs + WHEEL_TICK - 1) / WHEEL_TICK, 1);
+	place(trans);
+	++scheduled;
+
+	if(scheduled == 1 || trans->expires < armedAt)
+		rearm();
+}
+
+void StunTransactionPoolPrivate::unschedule(StunTransactionPrivate *trans)
+{
+	if(!trans->wheelSlot)
+		return;
+
+	StunTransactionPrivate **at = trans->wheelSlot;
+	while(*at != trans)
+		at = &(*at)->wheelNext;
+	*at = trans->wheelNext;
+	trans->wheelNext = 0;
+	trans->wheelSlot = 0;
+	--scheduled;
+}
+
+void StunTransactionPoolPrivate::place(StunTransactionPrivate *trans)
+{
+	StunTransactionPrivate **slot;
+	if(trans->expires - now < WHEEL_NEAR)
+	{
+		slot = &wheelNear[trans->expires % WHEEL_NEAR];
+	}
+	else
+	{
+		// beyond the far level, park it in its last slot and place it
+		//   again from there
+		quint64 at = qMin(trans->expires / WHEEL_NEAR, now / WHEEL_NEAR + WHEEL_FAR - 1);
+		slot = &wheelFar[at % WHEEL_FAR];
+	}
+
+	trans->wheelNext = *slot;
+	trans->wheelSlot = slot;
+	*slot = trans;
+}
+
+// sleep until the next occupied near slot, or the next cascade of the far
+//   level, whichever comes first
+void StunTransactionPoolPrivate::rearm()
+{
+	if(scheduled == 0)
+	{
+		tick->stop();
+		return;
+	}
+
+	quint64 k = 1;
+	for(; k < WHEEL_NEAR; ++k)
+	{
+		quint64 at = now + k;
+		if(at % WHEEL_NEAR == 0 || wheelNear[at % WHEEL_NEAR])
+			break;
+	}
+	armedAt = now + k;
+
+	qint64 wait = (qint64)(armedAt - base) * WHEEL_TICK - clock.elapsed();
+	tick->start((int)qMax(wait, (qint64)0));
+}
+
+void StunTransactionPoolPrivate::tick_timeout()
+{
+	QPointer<QObject> self = this;
+
+	quint64 target = base + clock.elapsed() / WHEEL_TICK;
+	while(now < target && scheduled > 0)
+	{
+		++now;
+
+		if(now % WHEEL_NEAR == 0)
+		{
+			StunTransactionPrivate **far = &wheelFar[(now / WHEEL_NEAR) % WHEEL_FAR];
+			StunTransactionPrivate *trans = *far;
+			*far = 0;
+			while(trans)
+			{
+				StunTransactionPrivate *next = trans->wheelNext;
+				place(trans);
+				trans = next;
+			}
+		}
+
+		// a timeout may schedule or delete other transactions, or the
+		//   pool, so take one at a time
+		StunTransactionPrivate **slot = &wheelNear[now % WHEEL_NEAR];
+		while(*slot)
+		{
+			StunTransactionPrivate *trans = *slot;
+			unschedule(trans);
+			trans->timeout();
+			if(!self)
+				return;
+		}
+	}
+
+	if(scheduled == 0)
+		now = target;
+	rearm();
+}
+
+void StunTransactionPoolPrivate::doRetries()
+{
+	QList<StunTransaction*> list = retries;
+	retries.clear();
+	foreach(StunTransaction *trans, list)
+	{
+		// gone meanwhile, or already going again?
+		if(transactions.contains(trans) && !trans->d->active)
+			trans->d->retry();
+	}
+}
+
 StunTransactionPool::StunTransactionPool(StunTransaction::Mode mode, QObject *parent) :
 	QObject(parent)
 {
@@ -686,16 +946,19 @@ QString StunTransactionPool::realm() const
 void StunTransactionPool::setUsername(const QString &username)
 {
 	d->user = username;
+	d->longTermKey.clear();
 }
 
 void StunTransactionPool::setPassword(const QCA::SecureArray &password)
 {
 	d->pass = password;
+	d->longTermKey.clear();
 }
 
 void StunTransactionPool::setRealm(const QString &realm)
 {
 	d->realm = realm;
+	d->longTermKey.clear();
 }
 
 void StunTransactionPool::continueAfterParams()
@@ -722,12 +985,13 @@ void StunTransactionPool::continueAfterParams()
 		//   list is if it is waiting for an auth retry
 		if(!trans->d->active)
 		{
-			// use queued call to prevent all sorts of DOR-SS
-			//   nastiness
-			QMetaObject::invokeMethod(trans->d, "continueAfterParams",
-				Qt::QueuedConnection);
+			d->retries += trans;
 		}
 	}
+
+	// use queued call to prevent all sorts of DOR-SS nastiness
+	if(!d->retries.isEmpty())
+		QMetaObject::invokeMethod(d, "doRetries", Qt::QueuedConnection);
 }
 
 QByteArray StunTransactionPool::generateId() const
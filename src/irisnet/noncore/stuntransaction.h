@@ -92,7 +92,10 @@ public:
 	void setMessage(const StunMessage &request);
 
 	// transmission/timeout parameters, from RFC 5389.  by default,
-	//   they are set to the recommended values from the RFC.
+	//   they are set to the recommended values from the RFC, except
+	//   that a udp transaction without setRTO() starts with an RTO
+	//   learned from earlier transactions of the pool to the same
+	//   destination, once there are any.
 	void setRTO(int i);
 	void setRc(int i);
 	void setRm(int i);
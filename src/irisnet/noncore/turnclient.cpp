@@ -31,8 +31,50 @@
 #include "httpconnect.h"
 #include "socks.h"
 
+#include <QTimer>
+
+// how long to wait before retrying a pre-warmed connection that failed
+#define WARM_RETRY_INTERVAL 5000
+
 namespace XMPP {
 
+// starts a connection to the server, through the proxy if one is set.
+//   the receiver gets connected() and error(int) in its bs_connected() and
+//   bs_error(int) slots.
+static ByteStream *startConnection(const TurnClient::Proxy &proxy, const QHostAddress &addr, int port, QObject *parent, QObject *receiver)
+{
+	ByteStream *bs;
+	if(proxy.type() == TurnClient::Proxy::HttpConnect)
+	{
+		HttpConnect *s = new HttpConnect(parent);
+		bs = s;
+		QObject::connect(s, SIGNAL(connected()), receiver, SLOT(bs_connected()));
+		QObject::connect(s, SIGNAL(error(int)), receiver, SLOT(bs_error(int)));
+		if(!proxy.user().isEmpty())
+			s->setAuth(proxy.user(), proxy.pass());
+		s->connectToHost(proxy.host(), proxy.port(), addr.toString(), port);
+	}
+	else if(proxy.type() == TurnClient::Proxy::Socks)
+	{
+		SocksClient *s = new SocksClient(parent);
+		bs = s;
+		QObject::connect(s, SIGNAL(connected()), receiver, SLOT(bs_connected()));
+		QObject::connect(s, SIGNAL(error(int)), receiver, SLOT(bs_error(int)));
+		if(!proxy.user().isEmpty())
+			s->setAuth(proxy.user(), proxy.pass());
+		s->connectToHost(proxy.host(), proxy.port(), addr.toString(), port);
+	}
+	else
+	{
+		BSocket *s = new BSocket(parent);
+		bs = s;
+		QObject::connect(s, SIGNAL(connected()), receiver, SLOT(bs_connected()));
+		QObject::connect(s, SIGNAL(error(int)), receiver, SLOT(bs_error(int)));
+		s->connectToHost(addr.toString(), port);
+	}
+	return bs;
+}
+
 //----------------------------------------------------------------------------
 // TurnClient::Proxy
 //----------------------------------------------------------------------------
@@ -119,6 +161,7 @@ public:
 	int retryCount;
 	QString errorString;
 	int debugLevel;
+	TurnConnectionPool *cpool;
 
 	class WriteItem
 	{
@@ -196,6 +239,7 @@ public:
 		allocate(0),
 		retryCount(0),
 		debugLevel(TurnClient::DL_None),
+		cpool(0),
 		writtenBytes(0),
 		stopping(false),
 		outPendingWrite(0)
@@ -247,41 +291,72 @@ public:
 			return;
 		}
 
-		if(proxy.type() == Proxy::HttpConnect)
-		{
-			HttpConnect *s = new HttpConnect(this);
-			bs = s;
-			connect(s, SIGNAL(connected()), SLOT(bs_connected()));
-			connect(s, SIGNAL(error(int)), SLOT(bs_error(int)));
-			if(!proxy.user().isEmpty())
-				s->setAuth(proxy.user(), proxy.pass());
-			s->connectToHost(proxy.host(), proxy.port(), serverAddr.toString(), serverPort);
-		}
-		else if(proxy.type() == Proxy::Socks)
-		{
-			SocksClient *s = new SocksClient(this);
-			bs = s;
-			connect(s, SIGNAL(connected()), SLOT(bs_connected()));
-			connect(s, SIGNAL(error(int)), SLOT(bs_error(int)));
-			if(!proxy.user().isEmpty())
-				s->setAuth(proxy.user(), proxy.pass());
-			s->connectToHost(proxy.host(), proxy.port(), serverAddr.toString(), serverPort);
-		}
-		else
+		// a connection that is ready already?
+		if(cpool && cpool->take(serverAddr, serverPort, mode, &bs, &tls))
 		{
-			BSocket *s = new BSocket(this);
-			bs = s;
-			connect(s, SIGNAL(connected()), SLOT(bs_connected()));
-			connect(s, SIGNAL(error(int)), SLOT(bs_error(int)));
-			s->connectToHost(serverAddr.toString(), serverPort);
+			if(debugLevel >= TurnClient::DL_Info)
+				emit q->debugLine("Using pooled connection");
+
+			bs->setParent(this);
+			connect(bs, SIGNAL(error(int)), SLOT(bs_error(int)));
+			connectStream();
+			if(tls)
+			{
+				tls->setParent(this);
+				connectTls();
+				tlsHandshaken = true;
+			}
+
+			sess.defer(this, &Private::pooled_connected);
+			return;
 		}
 
+		bs = startConnection(proxy, serverAddr, serverPort, this, this);
+		connectStream();
+	}
+
+	void connectStream()
+	{
 		connect(bs, SIGNAL(connectionClosed()), SLOT(bs_connectionClosed()));
 		connect(bs, SIGNAL(delayedCloseFinished()), SLOT(bs_delayedCloseFinished()));
 		connect(bs, SIGNAL(readyRead()), SLOT(bs_readyRead()));
 		connect(bs, SIGNAL(bytesWritten(int)), SLOT(bs_bytesWritten(int)));
 	}
 
+	void connectTls()
+	{
+		connect(tls, SIGNAL(handshaken()), SLOT(tls_handshaken()));
+		connect(tls, SIGNAL(readyRead()), SLOT(tls_readyRead()));
+		connect(tls, SIGNAL(readyReadOutgoing()), SLOT(tls_readyReadOutgoing()));
+		connect(tls, SIGNAL(closed()), SLOT(tls_closed()));
+		connect(tls, SIGNAL(error()), SLOT(tls_error()));
+	}
+
+	// hand the connection back to the pool once the allocation is gone.
+	//   returns false if it can't be reused.
+	bool returnToPool()
+	{
+		if(!cpool || !cpool->reuseAfterClose() || !bs || !inStream.isEmpty() || bs->bytesToWrite() > 0)
+			return false;
+		if(tls && !tlsHandshaken)
+			return false;
+
+		ByteStream *b = bs;
+		QCA::TLS *t = tls;
+		bs->disconnect(this);
+		bs->setParent(0);
+		bs = 0;
+		if(tls)
+		{
+			tls->disconnect(this);
+			tls->setParent(0);
+			tls = 0;
+		}
+
+		cpool->giveBack(serverAddr, serverPort, mode, b, t);
+		return true;
+	}
+
 	void do_close()
 	{
 		stopping = true;
@@ -303,7 +378,7 @@ public:
 			pool = 0;
 
 			if(udp)
-				sess.defer(q, "closed");
+				sess.defer(q, &TurnClient::closed);
 			else
 				do_transport_close();
 		}
@@ -334,7 +409,7 @@ public:
 		if(!waitForSignal)
 		{
 			cleanup();
-			sess.defer(q, "closed");
+			sess.defer(q, &TurnClient::closed);
 		}
 	}
 
@@ -419,18 +494,17 @@ public:
 
 	QByteArray processNonPoolPacket(const QByteArray &buf, bool notStun, QHostAddress *addr, int *port)
 	{
-		if(notStun)
+		// ChannelData is the common case once channels are bound, and
+		//   only needs its header stripped
+		int len = allocate->decodeChannelData((const quint8 *)buf.constData(), buf.size(), addr, port);
+		if(len != -1)
 		{
-			// not stun?  maybe it is a data packet
-			QByteArray data = allocate->decode(buf, addr, port);
-			if(!data.isNull())
-			{
-				if(debugLevel >= TurnClient::DL_Packet)
-					emit q->debugLine("Received ChannelData-based data packet");
-				return data;
-			}
+			if(debugLevel >= TurnClient::DL_Packet)
+				emit q->debugLine("Received ChannelData-based data packet");
+			return buf.mid(4, len);
 		}
-		else
+
+		if(!notStun)
 		{
 			// packet might be stun not owned by pool.
 			//   let's see
@@ -708,6 +782,23 @@ public:
 	}
 
 private slots:
+	void pooled_connected()
+	{
+		ObjectSessionWatcher watch(&sess);
+		emit q->connected();
+		if(!watch.isValid())
+			return;
+
+		if(tls)
+		{
+			emit q->tlsHandshaken();
+			if(!watch.isValid())
+				return;
+		}
+
+		after_connected();
+	}
+
 	void bs_connected()
 	{
 		ObjectSessionWatcher watch(&sess);
@@ -718,10 +809,7 @@ private slots:
 		if(mode == TurnClient::TlsMode)
 		{
 			tls = new QCA::TLS(this);
-			connect(tls, SIGNAL(handshaken()), SLOT(tls_handshaken()));
-			connect(tls, SIGNAL(readyRead()), SLOT(tls_readyRead()));
-			connect(tls, SIGNAL(readyReadOutgoing()), SLOT(tls_readyReadOutgoing()));
-			connect(tls, SIGNAL(error()), SLOT(tls_error()));
+			connectTls();
 			tlsHandshaken = false;
 			if(debugLevel >= TurnClient::DL_Info)
 				emit q->debugLine("TLS handshaking...");
@@ -940,6 +1028,11 @@ private slots:
 
 		if(udp)
 			emit q->closed();
+		else if(returnToPool())
+		{
+			cleanup();
+			emit q->closed();
+		}
 		else
 			do_transport_close();
 	}
@@ -1016,6 +1109,11 @@ void TurnClient::setClientSoftwareNameAndVersion(const QString &str)
 	d->clientSoftware = str;
 }
 
+void TurnClient::setConnectionPool(TurnConnectionPool *pool)
+{
+	d->cpool = pool;
+}
+
 void TurnClient::connectToHost(StunTransactionPool *pool, const QHostAddress &addr, int port)
 {
 	d->serverAddr = addr;
@@ -1136,6 +1234,339 @@ void TurnClient::setDebugLevel(DebugLevel level)
 		d->pool->setDebugLevel((StunTransactionPool::DebugLevel)level);
 }
 
+//----------------------------------------------------------------------------
+// TurnConnectionPool
+//----------------------------------------------------------------------------
+// one idle connection of the pool, either still being set up or ready
+class TurnPoolConnection : public QObject
+{
+	Q_OBJECT
+
+public:
+	QHostAddress addr;
+	int port;
+	TurnClient::Mode mode;
+	ByteStream *bs;
+	QCA::TLS *tls;
+	bool ready;
+
+	TurnPoolConnection(const QHostAddress &_addr, int _port, TurnClient::Mode _mode, QObject *parent) :
+		QObject(parent),
+		addr(_addr),
+		port(_port),
+		mode(_mode),
+		bs(0),
+		tls(0),
+		ready(false)
+	{
+	}
+
+	~TurnPoolConnection()
+	{
+		delete tls;
+		delete bs;
+	}
+
+	bool matches(const QHostAddress &_addr, int _port, TurnClient::Mode _mode) const
+	{
+		return addr == _addr && port == _port && mode == _mode;
+	}
+
+	void start(const TurnClient::Proxy &proxy)
+	{
+		bs = startConnection(proxy, addr, port, this, this);
+		connectStream();
+	}
+
+	// take over a connection that was in use
+	void adopt(ByteStream *_bs, QCA::TLS *_tls)
+	{
+		bs = _bs;
+		bs->setParent(this);
+		connect(bs, SIGNAL(error(int)), SLOT(bs_error(int)));
+		connectStream();
+		tls = _tls;
+		if(tls)
+		{
+			tls->setParent(this);
+			connectTls();
+		}
+		ready = true;
+	}
+
+	void release(ByteStream **_bs, QCA::TLS **_tls)
+	{
+		bs->disconnect(this);
+		bs->setParent(0);
+		*_bs = bs;
+		bs = 0;
+		if(tls)
+		{
+			tls->disconnect(this);
+			tls->setParent(0);
+		}
+		*_tls = tls;
+		tls = 0;
+	}
+
+signals:
+	void failed();
+
+private:
+	void connectStream()
+	{
+		connect(bs, SIGNAL(connectionClosed()), SLOT(fail()));
+		connect(bs, SIGNAL(readyRead()), SLOT(bs_readyRead()));
+	}
+
+	void connectTls()
+	{
+		connect(tls, SIGNAL(handshaken()), SLOT(tls_handshaken()));
+		connect(tls, SIGNAL(readyRead()), SLOT(fail()));
+		connect(tls, SIGNAL(readyReadOutgoing()), SLOT(tls_readyReadOutgoing()));
+		connect(tls, SIGNAL(closed()), SLOT(fail()));
+		connect(tls, SIGNAL(error()), SLOT(fail()));
+	}
+
+private slots:
+	void bs_connected()
+	{
+		if(mode == TurnClient::TlsMode)
+		{
+			tls = new QCA::TLS(this);
+			connectTls();
+			tls->startClient();
+		}
+		else
+			ready = true;
+	}
+
+	void bs_error(int)
+	{
+		fail();
+	}
+
+	void bs_readyRead()
+	{
+		QByteArray buf = bs->read();
+
+		// the server has no reason to send anything before an
+		//   allocation is requested
+		if(tls)
+			tls->writeIncoming(buf);
+		else
+			fail();
+	}
+
+	void tls_handshaken()
+	{
+		tls->continueAfterStep();
+		ready = true;
+	}
+
+	void tls_readyReadOutgoing()
+	{
+		bs->write(tls->readOutgoing());
+	}
+
+	void fail()
+	{
+		ready = false;
+		emit failed();
+	}
+};
+
+class TurnConnectionPool::Private : public QObject
+{
+	Q_OBJECT
+
+public:
+	class Target
+	{
+	public:
+		QHostAddress addr;
+		int port;
+		TurnClient::Mode mode;
+		int count;
+	};
+
+	TurnConnectionPool *q;
+	TurnClient::Proxy proxy;
+	bool reuse;
+	int maxIdle;
+	QList<Target> targets;
+	QList<TurnPoolConnection*> conns;
+	QTimer *retryTimer;
+
+	Private(TurnConnectionPool *_q) :
+		QObject(_q),
+		q(_q),
+		reuse(false),
+		maxIdle(4)
+	{
+		retryTimer = new QTimer(this);
+		retryTimer->setSingleShot(true);
+		connect(retryTimer, SIGNAL(timeout()), SLOT(refill()));
+	}
+
+	~Private()
+	{
+		qDeleteAll(conns);
+	}
+
+	int count(const QHostAddress &addr, int port, TurnClient::Mode mode, bool readyOnly) const
+	{
+		int n = 0;
+		foreach(const TurnPoolConnection *c, conns)
+		{
+			if(c->matches(addr, port, mode) && (c->ready || !readyOnly))
+				++n;
+		}
+		return n;
+	}
+
+	int warmCount(const QHostAddress &addr, int port, TurnClient::Mode mode) const
+	{
+		foreach(const Target &t, targets)
+		{
+			if(t.addr == addr && t.port == port && t.mode == mode)
+				return t.count;
+		}
+		return 0;
+	}
+
+	TurnPoolConnection *addConnection(const QHostAddress &addr, int port, TurnClient::Mode mode)
+	{
+		TurnPoolConnection *c = new TurnPoolConnection(addr, port, mode, this);
+		connect(c, SIGNAL(failed()), SLOT(conn_failed()));
+		conns += c;
+		return c;
+	}
+
+public slots:
+	void refill()
+	{
+		foreach(const Target &t, targets)
+		{
+			for(int n = count(t.addr, t.port, t.mode, false); n < t.count; ++n)
+				addConnection(t.addr, t.port, t.mode)->start(proxy);
+		}
+	}
+
+private slots:
+	void conn_failed()
+	{
+		TurnPoolConnection *c = static_cast<TurnPoolConnection*>(sender());
+		conns.removeAll(c);
+		c->disconnect(this);
+		c->deleteLater();
+
+		if(!retryTimer->isActive())
+			retryTimer->start(WARM_RETRY_INTERVAL);
+	}
+};
+
+TurnConnectionPool::TurnConnectionPool(QObject *parent) :
+	QObject(parent)
+{
+	d = new Private(this);
+}
+
+TurnConnectionPool::~TurnConnectionPool()
+{
+	delete d;
+}
+
+void TurnConnectionPool::setProxy(const TurnClient::Proxy &proxy)
+{
+	d->proxy = proxy;
+}
+
+TurnClient::Proxy TurnConnectionPool::proxy() const
+{
+	return d->proxy;
+}
+
+void TurnConnectionPool::setWarmCount(const QHostAddress &addr, int port, TurnClient::Mode mode, int count)
+{
+	for(int n = 0; n < d->targets.count(); ++n)
+	{
+		Private::Target &t = d->targets[n];
+		if(t.addr == addr && t.port == port && t.mode == mode)
+		{
+			if(count > 0)
+				t.count = count;
+			else
+				d->targets.removeAt(n);
+			d->refill();
+			return;
+		}
+	}
+
+	if(count <= 0)
+		return;
+
+	Private::Target t;
+	t.addr = addr;
+	t.port = port;
+	t.mode = mode;
+	t.count = count;
+	d->targets += t;
+	d->refill();
+}
+
+void TurnConnectionPool::setReuseAfterClose(bool enabled)
+{
+	d->reuse = enabled;
+}
+
+bool TurnConnectionPool::reuseAfterClose() const
+{
+	return d->reuse;
+}
+
+void TurnConnectionPool::setMaxIdle(int count)
+{
+	d->maxIdle = count;
+}
+
+int TurnConnectionPool::idleCount(const QHostAddress &addr, int port, TurnClient::Mode mode) const
+{
+	return d->count(addr, port, mode, true);
+}
+
+bool TurnConnectionPool::take(const QHostAddress &addr, int port, TurnClient::Mode mode, ByteStream **bs, QCA::TLS **tls)
+{
+	for(int n = 0; n < d->conns.count(); ++n)
+	{
+		TurnPoolConnection *c = d->conns[n];
+		if(c->ready && c->matches(addr, port, mode))
+		{
+			d->conns.removeAt(n);
+			c->release(bs, tls);
+			delete c;
+
+			// start warming the next one
+			d->refill();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TurnConnectionPool::giveBack(const QHostAddress &addr, int port, TurnClient::Mode mode, ByteStream *bs, QCA::TLS *tls)
+{
+	if(d->count(addr, port, mode, false) >= qMax(d->maxIdle, d->warmCount(addr, port, mode)))
+	{
+		delete tls;
+		delete bs;
+		return;
+	}
+
+	d->addConnection(addr, port, mode)->adopt(bs, tls);
+}
+
 }
 
 #include "turnclient.moc"
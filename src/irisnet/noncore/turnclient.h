@@ -26,14 +26,18 @@
 #include <QString>
 #include <QHostAddress>
 
+class ByteStream;
+
 namespace QCA {
 	class SecureArray;
+	class TLS;
 }
 
 namespace XMPP {
 
 class StunTransactionPool;
 class StunAllocate;
+class TurnConnectionPool;
 
 class TurnClient : public QObject
 {
@@ -119,6 +123,13 @@ public:
 	void setProxy(const Proxy &proxy);
 	void setClientSoftwareNameAndVersion(const QString &str);
 
+	// for TCP and TCP-TLS: take an already connected (and handshaken)
+	//   connection from the pool if it has one for the server, and hand
+	//   the connection back to it after the allocation is deleted.  does
+	//   not take ownership of the pool.  the proxy set on the pool is
+	//   used for the connections it makes.
+	void setConnectionPool(TurnConnectionPool *pool);
+
 	// for UDP.  does not take ownership of the pool.  stun transaction
 	//   I/O occurs through the pool.  transfer of data packets occurs
 	//   via processIncomingDatagram(), outgoingDatagram(), and
@@ -189,6 +200,50 @@ private:
 	Private *d;
 };
 
+// keeps TCP (and TLS) connections to TURN servers open ahead of time, so
+//   that a TurnClient using the pool can start allocating right away
+//   instead of going through the TCP and TLS handshakes first.  TURN
+//   ties an allocation to its connection, so a connection carries one
+//   allocation at a time.  with setReuseAfterClose(), a connection whose
+//   allocation was deleted cleanly comes back to the pool for the next
+//   one, which RFC 5766 allows but not every server supports.
+class TurnConnectionPool : public QObject
+{
+	Q_OBJECT
+
+public:
+	TurnConnectionPool(QObject *parent = 0);
+	~TurnConnectionPool();
+
+	void setProxy(const TurnClient::Proxy &proxy);
+	TurnClient::Proxy proxy() const;
+
+	// keep this many idle connections to the server ready.  connections
+	//   that fail are retried after a delay.  0 stops pre-warming.
+	void setWarmCount(const QHostAddress &addr, int port, TurnClient::Mode mode, int count);
+
+	void setReuseAfterClose(bool enabled); // default false
+	bool reuseAfterClose() const;
+
+	// most idle connections to keep per server, for those handed back
+	//   after use.  default 4
+	void setMaxIdle(int count);
+
+	int idleCount(const QHostAddress &addr, int port, TurnClient::Mode mode) const;
+
+	// used by TurnClient.  take() hands over a ready connection and its
+	//   TLS layer (0 in plain mode), unparented, or returns false if
+	//   there is none.  giveBack() takes them back, idle, or deletes them
+	//   if enough are idle already.
+	bool take(const QHostAddress &addr, int port, TurnClient::Mode mode, ByteStream **bs, QCA::TLS **tls);
+	void giveBack(const QHostAddress &addr, int port, TurnClient::Mode mode, ByteStream *bs, QCA::TLS *tls);
+
+private:
+	class Private;
+	friend class Private;
+	Private *d;
+};
+
 }
 
 #endif
@@ -20,10 +20,48 @@
 
 #include "udpportreserver.h"
 
+#include <QHash>
+#include <QSet>
 #include <QUdpSocket>
 
+#ifdef Q_OS_UNIX
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <string.h>
+# include <unistd.h>
+#endif
+
+#if defined(Q_OS_UNIX) && defined(SO_REUSEPORT)
+# define HAVE_REUSEPORT
+#endif
+
 namespace XMPP {
 
+#ifdef HAVE_REUSEPORT
+static int toSockAddr(const QHostAddress &addr, int port, sockaddr_storage *ss)
+{
+	memset(ss, 0, sizeof(sockaddr_storage));
+	if(addr.protocol() == QAbstractSocket::IPv6Protocol)
+	{
+		sockaddr_in6 *sa = (sockaddr_in6 *)ss;
+		sa->sin6_family = AF_INET6;
+		sa->sin6_port = htons(port);
+		Q_IPV6ADDR a = addr.toIPv6Address();
+		memcpy(sa->sin6_addr.s6_addr, a.c, 16);
+		return sizeof(sockaddr_in6);
+	}
+	else
+	{
+		sockaddr_in *sa = (sockaddr_in *)ss;
+		sa->sin_family = AF_INET;
+		sa->sin_port = htons(port);
+		sa->sin_addr.s_addr = htonl(addr.toIPv4Address());
+		return sizeof(sockaddr_in);
+	}
+}
+#endif
+
 class UdpPortReserver::Private : public QObject
 {
 	Q_OBJECT
@@ -34,6 +72,7 @@ public:
 	public:
 		int port; // port to reserve
 		bool lent;
+		bool reserved; // bound on all current addresses
 
 		// list of sockets for this port, one socket per address.
 		//   note that we may have sockets bound for addresses
@@ -46,7 +85,8 @@ public:
 
 		Item() :
 			port(-1),
-			lent(false)
+			lent(false),
+			reserved(false)
 		{
 		}
 
@@ -60,16 +100,29 @@ public:
 
 			return false;
 		}
+
+		bool operator<(const Item &other) const
+		{
+			return port < other.port;
+		}
 	};
 
 	UdpPortReserver *q;
+	bool reusePort;
 	QList<QHostAddress> addrs;
 	QList<int> ports; // sorted
+	QSet<int> portSet; // same as ports, for lookups
 	QList<Item> items; // in order sorted by port
+	QHash<QUdpSocket*,int> sockPorts; // every socket we have, to its port
+
+	// no item before this index is free to lend
+	int freeHint;
 
 	Private(UdpPortReserver *_q) :
 		QObject(_q),
-		q(_q)
+		q(_q),
+		reusePort(false),
+		freeHint(0)
 	{
 	}
 
@@ -104,45 +157,32 @@ public:
 
 	void updatePorts(const QList<int> &newPorts)
 	{
-		QList<int> added;
-		foreach(int x, newPorts)
-		{
-			bool found = false;
-			foreach(const Item &i, items)
-			{
-				if(i.port == x)
-				{
-					found = true;
-					break;
-				}
-			}
-
-			if(!found)
-				added += x;
-		}
+		QSet<int> have;
+		foreach(const Item &i, items)
+			have += i.port;
 
 		ports = newPorts;
 
 		// keep ports in sorted order
 		qSort(ports);
+		portSet = QSet<int>::fromList(ports);
 
-		foreach(int x, added)
+		bool added = false;
+		foreach(int x, ports)
 		{
-			int insert_before = items.count();
-			for(int n = 0; n < items.count(); ++n)
-			{
-				if(x < items[n].port)
-				{
-					insert_before = n;
-					break;
-				}
-			}
+			if(have.contains(x))
+				continue;
 
 			Item i;
 			i.port = x;
-			items.insert(insert_before, i);
+			items += i;
+			have += x;
+			added = true;
 		}
 
+		if(added)
+			qSort(items);
+
 		tryBind();
 		tryCleanup();
 	}
@@ -153,10 +193,10 @@ public:
 		foreach(const Item &i, items)
 		{
 			// skip ports we don't care about
-			if(!ports.contains(i.port))
+			if(!portSet.contains(i.port))
 				continue;
 
-			if(!isReserved(i))
+			if(!i.reserved)
 			{
 				ok = false;
 				break;
@@ -204,7 +244,10 @@ public:
 			// take the next available port
 			int at = findConsecutive(1, 1);
 			if(at != -1)
+			{
 				out += lendItem(&items[at], parent);
+				freeHint = at + 1;
+			}
 		}
 
 		return out;
@@ -214,15 +257,9 @@ public:
 	{
 		foreach(QUdpSocket *sock, sockList)
 		{
-			int at = -1;
-			for(int n = 0; n < items.count(); ++n)
-			{
-				if(items[n].sockList.contains(sock))
-				{
-					at = n;
-					break;
-				}
-			}
+			Q_ASSERT(sockPorts.contains(sock));
+
+			int at = indexOfPort(sockPorts.value(sock));
 
 			Q_ASSERT(at != -1);
 
@@ -239,9 +276,12 @@ public:
 			i.lentAddrs.removeAll(a);
 			if(i.lentAddrs.isEmpty())
 				i.lent = false;
-		}
 
-		tryCleanup();
+			// only this port can have become free or unwanted
+			if(!cleanupItem(i))
+				items.removeAt(at);
+			freeHint = qMin(freeHint, at);
+		}
 	}
 
 private slots:
@@ -255,6 +295,25 @@ private slots:
 	}
 
 private:
+	int indexOfPort(int port) const
+	{
+		int lo = 0;
+		int hi = items.count() - 1;
+		while(lo <= hi)
+		{
+			int mid = (lo + hi) / 2;
+			int x = items[mid].port;
+			if(x == port)
+				return mid;
+			if(x < port)
+				lo = mid + 1;
+			else
+				hi = mid - 1;
+		}
+
+		return -1;
+	}
+
 	void tryBind()
 	{
 		for(int n = 0; n < items.count(); ++n)
@@ -262,7 +321,7 @@ private:
 			Item &i = items[n];
 
 			// skip ports we don't care about
-			if(!ports.contains(i.port))
+			if(!portSet.contains(i.port))
 				continue;
 
 			QList<QHostAddress> neededAddrs;
@@ -274,54 +333,81 @@ private:
 
 			foreach(const QHostAddress &a, neededAddrs)
 			{
-				QUdpSocket *sock = new QUdpSocket(q);
-
-				if(!sock->bind(a, i.port))
+				QUdpSocket *sock;
+				if(reusePort)
+				{
+					sock = bindReusable(a, i.port, q);
+					if(!sock)
+						continue;
+				}
+				else
 				{
-					delete sock;
-					continue;
+					sock = new QUdpSocket(q);
+
+					if(!sock->bind(a, i.port))
+					{
+						delete sock;
+						continue;
+					}
 				}
 
 				connect(sock, SIGNAL(readyRead()), SLOT(sock_readyRead()));
 
 				i.sockList += sock;
+				sockPorts.insert(sock, i.port);
 			}
 		}
 	}
 
 	void tryCleanup()
 	{
+		QList<Item> kept;
 		for(int n = 0; n < items.count(); ++n)
 		{
-			Item &i = items[n];
+			if(cleanupItem(items[n]))
+				kept += items[n];
+		}
 
-			// don't care about this port anymore?
-			if(!i.lent && !ports.contains(i.port))
-			{
-				foreach(QUdpSocket *sock, i.sockList)
-					sock->deleteLater();
+		items = kept;
+		freeHint = 0;
+	}
 
-				items.removeAt(n);
-				--n; // adjust position
-				continue;
-			}
+	// returns false if the item should be dropped
+	bool cleanupItem(Item &i)
+	{
+		// don't care about this port anymore?
+		if(!i.lent && !portSet.contains(i.port))
+		{
+			foreach(QUdpSocket *sock, i.sockList)
+				releaseSocket(sock);
 
-			// any addresses we don't care about?
-			for(int k = 0; k < i.sockList.count(); ++k)
-			{
-				QUdpSocket *sock = i.sockList[k];
+			return false;
+		}
 
-				QHostAddress a = sock->localAddress();
+		// any addresses we don't care about?
+		for(int k = 0; k < i.sockList.count(); ++k)
+		{
+			QUdpSocket *sock = i.sockList[k];
 
-				if(!addrs.contains(a) && !i.lentAddrs.contains(a))
-				{
-					sock->deleteLater();
-					i.sockList.removeAt(k);
-					--k; // adjust position
-					continue;
-				}
+			QHostAddress a = sock->localAddress();
+
+			if(!addrs.contains(a) && !i.lentAddrs.contains(a))
+			{
+				releaseSocket(sock);
+				i.sockList.removeAt(k);
+				--k; // adjust position
+				continue;
 			}
 		}
+
+		i.reserved = isReserved(i);
+		return true;
+	}
+
+	void releaseSocket(QUdpSocket *sock)
+	{
+		sockPorts.remove(sock);
+		sock->deleteLater();
 	}
 
 	bool isReserved(const Item &i) const
@@ -348,7 +434,7 @@ private:
 		{
 			const Item &i = items[at + n];
 
-			if(i.lent || !isReserved(i))
+			if(i.lent || !i.reserved)
 				return false;
 
 			if(n > 0 && (i.port != items[at + n - 1].port + 1))
@@ -360,7 +446,9 @@ private:
 
 	int findConsecutive(int count, int align) const
 	{
-		for(int n = 0; n < items.count(); n += align)
+		// nothing before freeHint is free, so start at the first
+		//   aligned position that could be
+		for(int n = (freeHint / align) * align; n < items.count(); n += align)
 		{
 			if(isConsecutive(n, count))
 				return n;
@@ -397,6 +485,20 @@ UdpPortReserver::~UdpPortReserver()
 	delete d;
 }
 
+void UdpPortReserver::setReusePort(bool enabled)
+{
+	d->reusePort = enabled && isReusePortSupported();
+}
+
+bool UdpPortReserver::isReusePortSupported()
+{
+#ifdef HAVE_REUSEPORT
+	return true;
+#else
+	return false;
+#endif
+}
+
 void UdpPortReserver::setAddresses(const QList<QHostAddress> &addrs)
 {
 	d->updateAddresses(addrs);
@@ -430,6 +532,57 @@ void UdpPortReserver::returnSockets(const QList<QUdpSocket*> &sockList)
 	d->returnSockets(sockList);
 }
 
+QUdpSocket *UdpPortReserver::bindReusable(const QHostAddress &addr, int port, QObject *parent)
+{
+#ifdef HAVE_REUSEPORT
+	sockaddr_storage ss;
+	int len = toSockAddr(addr, port, &ss);
+
+	int fd = ::socket(ss.ss_family, SOCK_DGRAM, 0);
+	if(fd == -1)
+		return 0;
+
+	int on = 1;
+	if(ss.ss_family == AF_INET6)
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+	if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0
+		|| ::bind(fd, (sockaddr *)&ss, len) != 0)
+	{
+		::close(fd);
+		return 0;
+	}
+
+	QUdpSocket *sock = new QUdpSocket(parent);
+	if(!sock->setSocketDescriptor(fd, QAbstractSocket::BoundState))
+	{
+		delete sock;
+		::close(fd);
+		return 0;
+	}
+
+	return sock;
+#else
+	Q_UNUSED(addr);
+	Q_UNUSED(port);
+	Q_UNUSED(parent);
+	return 0;
+#endif
+}
+
+bool UdpPortReserver::pinPeer(QUdpSocket *sock, const QHostAddress &addr, int port)
+{
+#ifdef HAVE_REUSEPORT
+	sockaddr_storage ss;
+	int len = toSockAddr(addr, port, &ss);
+	return ::connect(sock->socketDescriptor(), (sockaddr *)&ss, len) == 0;
+#else
+	Q_UNUSED(sock);
+	Q_UNUSED(addr);
+	Q_UNUSED(port);
+	return false;
+#endif
+}
+
 }
 
 #include "udpportreserver.moc"
@@ -42,6 +42,15 @@ public:
 	UdpPortReserver(QObject *parent = 0);
 	~UdpPortReserver();
 
+	// bind with SO_REUSEPORT, so that several reservers can hold the same
+	//   ports at once, typically one per worker thread.  the kernel then
+	//   spreads the datagrams arriving on a port over the group by source
+	//   address; see pinPeer() for steering a peer to one socket.  set
+	//   this before the addresses and ports.  ignored where SO_REUSEPORT
+	//   is not available.
+	void setReusePort(bool enabled);
+	static bool isReusePortSupported();
+
 	void setAddresses(const QList<QHostAddress> &addrs);
 	void setPorts(int start, int len);
 	void setPorts(const QList<int> &ports);
@@ -64,6 +73,17 @@ public:
 
 	void returnSockets(const QList<QUdpSocket*> &sockList);
 
+	// bind a socket with SO_REUSEPORT.  returns 0 on failure.
+	static QUdpSocket *bindReusable(const QHostAddress &addr, int port, QObject *parent = 0);
+
+	// connect a socket to a peer, so that everything the peer sends to the
+	//   socket's port comes to this socket, even if other sockets of its
+	//   SO_REUSEPORT group are unconnected.  datagrams from other peers no
+	//   longer arrive on it, so this is for sockets that talk to a single
+	//   peer, such as a TURN server.  sending to other addresses still
+	//   works.
+	static bool pinPeer(QUdpSocket *sock, const QHostAddress &addr, int port);
+
 private:
 	class Private;
 	Private *d;
@@ -33,9 +33,27 @@
 #define JDNS_UDP_MUL_OUT_MAX  9000
 #define JDNS_UDP_MUL_IN_MAX   16384
 
+// udp payload size advertised with edns0 (rfc 6891).  1232 fits the minimum
+//   ipv6 mtu after headers, so answers up to it arrive unfragmented
+#define JDNS_UDP_UNI_EDNS_SIZE 1232
+#define JDNS_RTYPE_OPT        41
+
+// how long to wait for an answer over tcp before going back to udp, and how
+//   long an unused connection to a nameserver is kept open
+#define JDNS_TCP_TIMEOUT      5000
+#define JDNS_TCP_IDLE_MAX     10000
+
+// a name server that failed to answer in time ranks behind the others for
+//   this long, and round trip times are capped at the largest query timer
+#define JDNS_NS_PENALTY_TIME  60000
+#define JDNS_NS_RTT_MAX       1500
+
 // cache no more than 7 days
 #define JDNS_TTL_MAX          (86400 * 7)
 #define JDNS_CACHE_MAX        16384
+#define JDNS_CACHE_BUCKETS    4096
+// rfc 2308 suggests one to three hours as the ceiling for negative caching
+#define JDNS_NEG_TTL_MAX      (3600 * 3)
 #define JDNS_CNAME_MAX        16
 #define JDNS_QUERY_MAX        4096
 
@@ -45,6 +63,7 @@
 
 // declare this here, but implement it later after we define jdns_session_t
 static void _debug_line(jdns_session_t *s, const char *format, ...);
+static int _debug_enabled(const jdns_session_t *s);
 
 static unsigned char _hex_nibble(unsigned char c)
 {
@@ -317,6 +336,8 @@ static void _print_hexdump(jdns_session_t *s, const unsigned char *buf, int size
 	int n;
 	int lines;
 	int at, len;
+	if(!_debug_enabled(s))
+		return;
 
 	lines = size / 16;
 	if(size % 16 != 0)
@@ -349,6 +370,8 @@ static void _print_packet_resources(jdns_session_t *s, const jdns_list_t *reslis
 static void _print_packet(jdns_session_t *s, const jdns_packet_t *packet)
 {
 	int n;
+	if(!_debug_enabled(s))
+		return;
 	_debug_line(s, "Packet:");
 	_debug_line(s, "  id:   %d", packet->id);
 	_debug_line(s, "  opts: qr:%d, opcode:%d, aa:%d, tc:%d, rd:%d, ra:%d, z:%d, rcode:%d",
@@ -492,6 +515,8 @@ static void _print_rr(jdns_session_t *s, const jdns_rr_t *rr, const unsigned cha
 static void _print_records(jdns_session_t *s, const jdns_response_t *r, const unsigned char *owner)
 {
 	int n;
+	if(!_debug_enabled(s))
+		return;
 	_debug_line(s, "Records:");
 	_debug_line(s, "  Answer Records: %d", r->answerCount);
 	for(n = 0; n < r->answerCount; ++n)
@@ -612,6 +637,24 @@ typedef struct name_server
 	int id;
 	jdns_address_t *address;
 	int port;
+
+	// set once the server has refused a query carrying an opt record
+	int no_edns;
+
+	// smoothed round trip time in milliseconds (-1 until measured), and
+	//   how many queries in a row it failed to answer, the last at
+	//   fail_time
+	int srtt;
+	int failures;
+	int fail_time;
+
+	// tcp connection (handle 0 if none), when it was last used, and
+	//   received data not yet making up a whole message
+	int tcp_handle;
+	int tcp_readable;
+	int tcp_time;
+	unsigned char *tcp_buf;
+	int tcp_buf_size;
 } name_server_t;
 
 static void name_server_delete(name_server_t *ns);
@@ -621,6 +664,15 @@ static name_server_t *name_server_new()
 	name_server_t *ns = alloc_type(name_server_t);
 	ns->dtor = name_server_delete;
 	ns->address = 0;
+	ns->no_edns = 0;
+	ns->srtt = -1;
+	ns->failures = 0;
+	ns->fail_time = 0;
+	ns->tcp_handle = 0;
+	ns->tcp_readable = 0;
+	ns->tcp_time = 0;
+	ns->tcp_buf = 0;
+	ns->tcp_buf_size = 0;
 	return ns;
 }
 
@@ -629,6 +681,8 @@ void name_server_delete(name_server_t *ns)
 	if(!ns)
 		return;
 	jdns_address_delete(ns->address);
+	if(ns->tcp_buf)
+		free(ns->tcp_buf);
 	jdns_free(ns);
 }
 
@@ -690,6 +744,9 @@ typedef struct query
 	// packet id
 	int dns_id;
 
+	// name server asked over tcp after a truncated answer, or -1
+	int tcp_ns_id;
+
 	// what we are looking up
 	unsigned char *qname;
 	int qtype;
@@ -710,6 +767,17 @@ typedef struct query
 	int servers_failed_count;
 	int *servers_failed;
 
+	// servers a packet went to, as pairs of id and send time.  the time
+	//   is -1 once a reply can no longer be timed
+	int servers_sent_count;
+	int *servers_sent;
+
+	// which of the failed servers reported nxdomain, and the smallest
+	//  negative ttl any of them offered (-1 if none had an soa)
+	int servers_nxdomain_count;
+	int *servers_nxdomain;
+	int nxdomain_ttl;
+
 	// flag to indicate whether or not we've tried all available
 	//  nameservers already.  this means that all future
 	//  transmissions are likely repeats, and should be slowed
@@ -742,10 +810,16 @@ query_t *query_new()
 	q->req_ids_count = 0;
 	q->req_ids = 0;
 	q->qname = 0;
+	q->tcp_ns_id = -1;
 	q->servers_tried_count = 0;
 	q->servers_tried = 0;
 	q->servers_failed_count = 0;
 	q->servers_failed = 0;
+	q->servers_sent_count = 0;
+	q->servers_sent = 0;
+	q->servers_nxdomain_count = 0;
+	q->servers_nxdomain = 0;
+	q->nxdomain_ttl = -1;
 	q->cname_chain_count = 0;
 	q->cname_parent = 0;
 	q->cname_child = 0;
@@ -765,6 +839,10 @@ void query_delete(query_t *q)
 		free(q->servers_tried);
 	if(q->servers_failed)
 		free(q->servers_failed);
+	if(q->servers_sent)
+		free(q->servers_sent);
+	if(q->servers_nxdomain)
+		free(q->servers_nxdomain);
 	jdns_response_delete(q->mul_known);
 	jdns_free(q);
 }
@@ -832,6 +910,62 @@ void query_add_server_failed(query_t *q, int ns_id)
 	_intarray_add(&q->servers_failed, &q->servers_failed_count, ns_id);
 }
 
+void query_add_server_nxdomain(query_t *q, int ns_id, int ttl)
+{
+	if(_intarray_indexOf(q->servers_nxdomain, q->servers_nxdomain_count, ns_id) == -1)
+		_intarray_add(&q->servers_nxdomain, &q->servers_nxdomain_count, ns_id);
+	if(ttl != -1 && (q->nxdomain_ttl == -1 || ttl < q->nxdomain_ttl))
+		q->nxdomain_ttl = ttl;
+}
+
+// returns 1 if every server that failed did so with nxdomain
+int query_all_failed_nxdomain(const query_t *q)
+{
+	int n;
+	if(q->servers_failed_count == 0)
+		return 0;
+	for(n = 0; n < q->servers_failed_count; ++n)
+	{
+		if(_intarray_indexOf(q->servers_nxdomain, q->servers_nxdomain_count, q->servers_failed[n]) == -1)
+			return 0;
+	}
+	return 1;
+}
+
+// a reply to a packet sent more than once can't be timed, since there is no
+//   telling which one it answers (karn's algorithm)
+void query_add_server_sent(query_t *q, int ns_id, int now)
+{
+	int n;
+	for(n = 0; n < q->servers_sent_count; n += 2)
+	{
+		if(q->servers_sent[n] == ns_id)
+		{
+			q->servers_sent[n + 1] = -1;
+			return;
+		}
+	}
+	_intarray_add(&q->servers_sent, &q->servers_sent_count, ns_id);
+	_intarray_add(&q->servers_sent, &q->servers_sent_count, now);
+}
+
+// returns when the packet to the server went out, or -1 if unknown, and
+//   stops timing it
+int query_take_server_sent(query_t *q, int ns_id)
+{
+	int n, t;
+	for(n = 0; n < q->servers_sent_count; n += 2)
+	{
+		if(q->servers_sent[n] == ns_id)
+		{
+			t = q->servers_sent[n + 1];
+			q->servers_sent[n + 1] = -1;
+			return t;
+		}
+	}
+	return -1;
+}
+
 void query_name_server_gone(query_t *q, int ns_id)
 {
 	int pos;
@@ -843,6 +977,21 @@ void query_name_server_gone(query_t *q, int ns_id)
 	pos = _intarray_indexOf(q->servers_failed, q->servers_failed_count, ns_id);
 	if(pos != -1)
 		_intarray_remove(&q->servers_failed, &q->servers_failed_count, pos);
+
+	pos = _intarray_indexOf(q->servers_nxdomain, q->servers_nxdomain_count, ns_id);
+	if(pos != -1)
+		_intarray_remove(&q->servers_nxdomain, &q->servers_nxdomain_count, pos);
+
+	for(pos = 0; pos < q->servers_sent_count; pos += 2)
+	{
+		if(q->servers_sent[pos] == ns_id)
+		{
+			// remove the time, then the id
+			_intarray_remove(&q->servers_sent, &q->servers_sent_count, pos + 1);
+			_intarray_remove(&q->servers_sent, &q->servers_sent_count, pos);
+			break;
+		}
+	}
 }
 
 typedef struct datagram
@@ -893,6 +1042,15 @@ typedef struct cache_item
 	int time_start;
 	int ttl;
 	jdns_rr_t *record; // if zero, nxdomain is assumed
+
+	// index bookkeeping, owned by cache_t
+	unsigned int name_hash;
+	unsigned int record_hash;
+	struct cache_item *name_next;   // bucket chain by (qname, qtype)
+	struct cache_item *record_next; // bucket chain by (owner, type)
+	struct cache_item *lru_prev;
+	struct cache_item *lru_next;
+	int heap_pos;
 } cache_item_t;
 
 void cache_item_delete(cache_item_t *e);
@@ -903,6 +1061,13 @@ cache_item_t *cache_item_new()
 	a->dtor = cache_item_delete;
 	a->qname = 0;
 	a->record = 0;
+	a->name_hash = 0;
+	a->record_hash = 0;
+	a->name_next = 0;
+	a->record_next = 0;
+	a->lru_prev = 0;
+	a->lru_next = 0;
+	a->heap_pos = -1;
 	return a;
 }
 
@@ -916,6 +1081,246 @@ void cache_item_delete(cache_item_t *a)
 	jdns_free(a);
 }
 
+static int cache_item_expire_time(const cache_item_t *i)
+{
+	return i->time_start + (i->ttl * 1000);
+}
+
+// the session cache.  items are reachable three ways:
+//   - hashed by (qname, qtype), for lookups
+//   - hashed by (record owner, record type), for duplicate removal
+//   - a min-heap ordered by expiry time, for expiring items
+// additionally, items are kept in least-recently-used order so that the
+//   oldest entry can be evicted when the cache is full.
+typedef struct cache
+{
+	int count;
+	int max;
+	cache_item_t **names;
+	cache_item_t **records;
+	cache_item_t **heap;
+	int heap_alloc;
+	cache_item_t *lru_first; // least recently used
+	cache_item_t *lru_last;  // most recently used
+} cache_t;
+
+static unsigned int cache_hash(const unsigned char *name, int type)
+{
+	// FNV-1a over the lowercased name, so that it agrees with
+	//   jdns_domain_cmp
+	unsigned int h = 2166136261u;
+	const unsigned char *p;
+	for(p = name; *p; ++p)
+	{
+		h ^= (unsigned int)tolower(*p);
+		h *= 16777619u;
+	}
+	h ^= (unsigned int)type;
+	h *= 16777619u;
+	return h;
+}
+
+static cache_t *cache_new()
+{
+	cache_t *c = alloc_type(cache_t);
+	c->count = 0;
+	c->max = JDNS_CACHE_MAX;
+	c->names = (cache_item_t **)jdns_alloc(sizeof(cache_item_t *) * JDNS_CACHE_BUCKETS);
+	c->records = (cache_item_t **)jdns_alloc(sizeof(cache_item_t *) * JDNS_CACHE_BUCKETS);
+	memset(c->names, 0, sizeof(cache_item_t *) * JDNS_CACHE_BUCKETS);
+	memset(c->records, 0, sizeof(cache_item_t *) * JDNS_CACHE_BUCKETS);
+	c->heap = 0;
+	c->heap_alloc = 0;
+	c->lru_first = 0;
+	c->lru_last = 0;
+	return c;
+}
+
+static void cache_delete(cache_t *c)
+{
+	cache_item_t *i, *next;
+	if(!c)
+		return;
+	for(i = c->lru_first; i; i = next)
+	{
+		next = i->lru_next;
+		i->dtor(i);
+	}
+	jdns_free(c->names);
+	jdns_free(c->records);
+	if(c->heap)
+		free(c->heap);
+	jdns_free(c);
+}
+
+static void cache_heap_set(cache_t *c, int pos, cache_item_t *i)
+{
+	c->heap[pos] = i;
+	i->heap_pos = pos;
+}
+
+static void cache_heap_up(cache_t *c, int pos)
+{
+	cache_item_t *i = c->heap[pos];
+	int t = cache_item_expire_time(i);
+	while(pos > 0)
+	{
+		int parent = (pos - 1) / 2;
+		if(cache_item_expire_time(c->heap[parent]) <= t)
+			break;
+		cache_heap_set(c, pos, c->heap[parent]);
+		pos = parent;
+	}
+	cache_heap_set(c, pos, i);
+}
+
+static void cache_heap_down(cache_t *c, int pos)
+{
+	cache_item_t *i = c->heap[pos];
+	int t = cache_item_expire_time(i);
+	while(1)
+	{
+		int child = pos * 2 + 1;
+		if(child >= c->count)
+			break;
+		if(child + 1 < c->count && cache_item_expire_time(c->heap[child + 1]) < cache_item_expire_time(c->heap[child]))
+			++child;
+		if(t <= cache_item_expire_time(c->heap[child]))
+			break;
+		cache_heap_set(c, pos, c->heap[child]);
+		pos = child;
+	}
+	cache_heap_set(c, pos, i);
+}
+
+static void cache_lru_unlink(cache_t *c, cache_item_t *i)
+{
+	if(i->lru_prev)
+		i->lru_prev->lru_next = i->lru_next;
+	else
+		c->lru_first = i->lru_next;
+	if(i->lru_next)
+		i->lru_next->lru_prev = i->lru_prev;
+	else
+		c->lru_last = i->lru_prev;
+	i->lru_prev = 0;
+	i->lru_next = 0;
+}
+
+static void cache_lru_append(cache_t *c, cache_item_t *i)
+{
+	i->lru_prev = c->lru_last;
+	i->lru_next = 0;
+	if(c->lru_last)
+		c->lru_last->lru_next = i;
+	else
+		c->lru_first = i;
+	c->lru_last = i;
+}
+
+// mark an item as recently used
+static void cache_touch(cache_t *c, cache_item_t *i)
+{
+	if(c->lru_last == i)
+		return;
+	cache_lru_unlink(c, i);
+	cache_lru_append(c, i);
+}
+
+// append to the end of a bucket chain, so that lookups return records in
+//   the order they were added
+static void cache_chain_append(cache_item_t **bucket, cache_item_t *i, int by_record)
+{
+	cache_item_t **at = bucket;
+	while(*at)
+		at = by_record ? &(*at)->record_next : &(*at)->name_next;
+	*at = i;
+}
+
+static void cache_chain_remove(cache_item_t **bucket, cache_item_t *i, int by_record)
+{
+	cache_item_t **at = bucket;
+	while(*at && *at != i)
+		at = by_record ? &(*at)->record_next : &(*at)->name_next;
+	if(*at)
+		*at = by_record ? i->record_next : i->name_next;
+}
+
+// takes ownership of the item
+static void cache_insert(cache_t *c, cache_item_t *i)
+{
+	i->name_hash = cache_hash(i->qname, i->qtype);
+	i->name_next = 0;
+	cache_chain_append(&c->names[i->name_hash % JDNS_CACHE_BUCKETS], i, 0);
+	i->record_next = 0;
+	if(i->record)
+	{
+		i->record_hash = cache_hash(i->record->owner, i->record->type);
+		cache_chain_append(&c->records[i->record_hash % JDNS_CACHE_BUCKETS], i, 1);
+	}
+
+	if(c->count >= c->heap_alloc)
+	{
+		c->heap_alloc = c->heap_alloc ? c->heap_alloc * 2 : 16;
+		if(!c->heap)
+			c->heap = (cache_item_t **)malloc(sizeof(cache_item_t *) * c->heap_alloc);
+		else
+			c->heap = (cache_item_t **)realloc(c->heap, sizeof(cache_item_t *) * c->heap_alloc);
+	}
+	cache_heap_set(c, c->count, i);
+	++c->count;
+	cache_heap_up(c, i->heap_pos);
+
+	cache_lru_append(c, i);
+}
+
+// unlinks and deletes the item
+static void cache_remove(cache_t *c, cache_item_t *i)
+{
+	int pos;
+
+	cache_chain_remove(&c->names[i->name_hash % JDNS_CACHE_BUCKETS], i, 0);
+	if(i->record)
+		cache_chain_remove(&c->records[i->record_hash % JDNS_CACHE_BUCKETS], i, 1);
+
+	pos = i->heap_pos;
+	--c->count;
+	if(pos != c->count)
+	{
+		cache_item_t *last = c->heap[c->count];
+		cache_heap_set(c, pos, last);
+		cache_heap_up(c, pos);
+		cache_heap_down(c, last->heap_pos);
+	}
+
+	cache_lru_unlink(c, i);
+	i->dtor(i);
+}
+
+// return the item that expires soonest, or zero if the cache is empty
+static cache_item_t *cache_next_expiring(cache_t *c)
+{
+	return c->count > 0 ? c->heap[0] : 0;
+}
+
+// first item in the chain for (qname, qtype).  use cache_find_next to
+//   continue the search.
+static cache_item_t *cache_find_next(cache_item_t *i, const unsigned char *qname, int qtype, unsigned int hash)
+{
+	for(; i; i = i->name_next)
+	{
+		if(i->name_hash == hash && i->qtype == qtype && jdns_domain_cmp(i->qname, qname))
+			return i;
+	}
+	return 0;
+}
+
+static cache_item_t *cache_find(cache_t *c, const unsigned char *qname, int qtype)
+{
+	unsigned int hash = cache_hash(qname, qtype);
+	return cache_find_next(c->names[hash % JDNS_CACHE_BUCKETS], qname, qtype, hash);
+}
+
 typedef struct event
 {
 	void (*dtor)(struct event *);
@@ -993,13 +1398,21 @@ struct jdns_session
 	list_t *queries;
 	list_t *outgoing;
 	list_t *events;
-	list_t *cache;
+	cache_t *cache;
+	jdns_stats_t stats;
+
+	// record types whose first query goes to two name servers at once
+	int race_types_count;
+	int *race_types;
 
 	// for blocking req_ids from reuse until user explicitly releases
 	int do_hold_req_ids;
 	int held_req_ids_count;
 	int *held_req_ids;
 
+	// debug lines are formatted and passed on, see jdns_set_debug_enabled()
+	int debug_enabled;
+
 	// mdns
 	mdnsd mdns;
 	list_t *published;
@@ -1024,12 +1437,17 @@ jdns_session_t *jdns_session_new(jdns_callbacks_t *callbacks)
 	s->queries = list_new();
 	s->outgoing = list_new();
 	s->events = list_new();
-	s->cache = list_new();
+	s->cache = cache_new();
+	memset(&s->stats, 0, sizeof(jdns_stats_t));
+	s->race_types_count = 0;
+	s->race_types = 0;
 
 	s->do_hold_req_ids = 0;
 	s->held_req_ids_count = 0;
 	s->held_req_ids = 0;
 
+	s->debug_enabled = 1;
+
 	s->mdns = 0;
 	s->published = list_new();
 	s->maddr = 0;
@@ -1039,18 +1457,27 @@ jdns_session_t *jdns_session_new(jdns_callbacks_t *callbacks)
 
 void jdns_session_delete(jdns_session_t *s)
 {
+	int n;
 	if(!s)
 		return;
 	if(s->handle)
 		s->cb.udp_unbind(s, s->cb.app, s->handle);
+	for(n = 0; n < s->name_servers->count; ++n)
+	{
+		name_server_t *ns = (name_server_t *)s->name_servers->item[n];
+		if(ns->tcp_handle)
+			s->cb.tcp_close(s, s->cb.app, ns->tcp_handle);
+	}
 	list_delete(s->name_servers);
 	list_delete(s->queries);
 	list_delete(s->outgoing);
 	list_delete(s->events);
-	list_delete(s->cache);
+	cache_delete(s->cache);
 
 	if(s->held_req_ids)
 		free(s->held_req_ids);
+	if(s->race_types)
+		free(s->race_types);
 
 	if(s->mdns)
 		mdnsd_free(s->mdns);
@@ -1062,13 +1489,19 @@ void jdns_session_delete(jdns_session_t *s)
 }
 
 // declare some internal functions
-static int _callback_time_now(mdnsd d, void *arg);
+static int _debug_enabled(const jdns_session_t *s)
+{
+	return s->debug_enabled;
+}
+
+int _callback_time_now(mdnsd d, void *arg);
 static int _callback_rand_int(mdnsd d, void *arg);
 
 static void _append_event(jdns_session_t *s, jdns_event_t *event);
 static void _append_event_and_hold_id(jdns_session_t *s, jdns_event_t *event);
 static void _remove_name_server_datagrams(jdns_session_t *s, int ns_id);
 static void _remove_query_datagrams(jdns_session_t *s, const query_t *q);
+static void _tcp_close(jdns_session_t *s, name_server_t *ns);
 
 static int _unicast_query(jdns_session_t *s, const unsigned char *name, int qtype);
 static void _unicast_cancel(jdns_session_t *s, query_t *q);
@@ -1310,6 +1743,7 @@ void jdns_set_nameservers(jdns_session_t *s, const jdns_nameserverlist_t *nslist
 
 			// remove any pending packets to this nameserver
 			_remove_name_server_datagrams(s, ns->id);
+			_tcp_close(s, ns);
 
 			_debug_line(s, "ns [%s:%d] (id=%d) removed", ns->address->c_str, ns->port, ns->id);
 			ns_id = ns->id;
@@ -1393,6 +1827,7 @@ void jdns_probe(jdns_session_t *s)
 
 int jdns_query(jdns_session_t *s, const unsigned char *name, int rtype)
 {
+	++s->stats.queries;
 	if(s->mode == 0)
 		return _unicast_query(s, name, rtype);
 	else
@@ -1513,8 +1948,23 @@ int jdns_next_timer(jdns_session_t *s)
 
 void jdns_set_handle_readable(jdns_session_t *s, int handle)
 {
-	(void)handle;
-	s->handle_readable = 1;
+	int n;
+
+	if(handle == s->handle)
+	{
+		s->handle_readable = 1;
+		return;
+	}
+
+	for(n = 0; n < s->name_servers->count; ++n)
+	{
+		name_server_t *ns = (name_server_t *)s->name_servers->item[n];
+		if(ns->tcp_handle && ns->tcp_handle == handle)
+		{
+			ns->tcp_readable = 1;
+			return;
+		}
+	}
 }
 
 void jdns_set_handle_writable(jdns_session_t *s, int handle)
@@ -1541,6 +1991,43 @@ void jdns_set_hold_ids_enabled(jdns_session_t *s, int enabled)
 	_set_hold_ids_enabled(s, enabled);
 }
 
+void jdns_set_debug_enabled(jdns_session_t *s, int enabled)
+{
+	s->debug_enabled = enabled ? 1 : 0;
+}
+
+void jdns_get_stats(jdns_session_t *s, jdns_stats_t *stats)
+{
+	memcpy(stats, &s->stats, sizeof(jdns_stats_t));
+}
+
+void jdns_set_race(jdns_session_t *s, int qtype, int enabled)
+{
+	int pos = _intarray_indexOf(s->race_types, s->race_types_count, qtype);
+	if(enabled && pos == -1)
+		_intarray_add(&s->race_types, &s->race_types_count, qtype);
+	else if(!enabled && pos != -1)
+		_intarray_remove(&s->race_types, &s->race_types_count, pos);
+}
+
+void jdns_set_cache_max(jdns_session_t *s, int max)
+{
+	if(max < 0)
+		max = 0;
+	s->cache->max = max;
+
+	// trim down to the new size, least recently used first
+	while(s->cache->count > max)
+	{
+		jdns_string_t *str;
+		cache_item_t *i = s->cache->lru_first;
+		str = _make_printable_cstr((const char *)i->qname);
+		_debug_line(s, "cache evict [%s]", str->data);
+		jdns_string_delete(str);
+		cache_remove(s->cache, i);
+	}
+}
+
 //----------------------------------------------------------------------------
 // jdns - internal functions
 //----------------------------------------------------------------------------
@@ -1551,8 +2038,13 @@ void jdns_set_hold_ids_enabled(jdns_session_t *s, int enabled)
 //   plenty then.
 void _debug_line(jdns_session_t *s, const char *format, ...)
 {
-	char *buf = (char *)malloc(2048);
+	char *buf;
 	va_list ap;
+
+	if(!s->debug_enabled)
+		return;
+
+	buf = (char *)malloc(2048);
 	va_start(ap, format);
 	jdns_vsprintf_s(buf, 2048, format, ap);
 	va_end(ap);
@@ -1617,35 +2109,34 @@ void _remove_query_datagrams(jdns_session_t *s, const query_t *q)
 	}
 }
 
-void _process_message(jdns_session_t *s, jdns_packet_t *p, int now, query_t *q, name_server_t *ns);
+void _process_message(jdns_session_t *s, jdns_packet_t *p, int now, query_t *q, name_server_t *ns, int via_tcp);
 
 // return 1 if 'q' should be deleted, 0 if not
 int _process_response(jdns_session_t *s, jdns_response_t *r, int nxdomain, query_t *q);
 
 jdns_response_t *_cache_get_response(jdns_session_t *s, const unsigned char *qname, int qtype, int *_lowest_timeleft)
 {
-	int n;
 	int lowest_timeleft = -1;
 	int now = s->cb.time_now(s, s->cb.app);
+	unsigned int hash = cache_hash(qname, qtype);
 	jdns_response_t *r = 0;
-	for(n = 0; n < s->cache->count; ++n)
+	cache_item_t *i;
+	for(i = cache_find(s->cache, qname, qtype); i; i = cache_find_next(i->name_next, qname, qtype, hash))
 	{
-		cache_item_t *i = (cache_item_t *)s->cache->item[n];
-		if(jdns_domain_cmp(i->qname, qname) && i->qtype == qtype)
-		{
-			int passed, timeleft;
+		int passed, timeleft;
 
-			if(!r)
-				r = jdns_response_new();
+		if(!r)
+			r = jdns_response_new();
 
-			if(i->record)
-				jdns_response_append_answer(r, jdns_rr_copy(i->record));
+		if(i->record)
+			jdns_response_append_answer(r, i->record);
 
-			passed = now - i->time_start;
-			timeleft = (i->ttl * 1000) - passed;
-			if(lowest_timeleft == -1 || timeleft < lowest_timeleft)
-				lowest_timeleft = timeleft;
-		}
+		passed = now - i->time_start;
+		timeleft = (i->ttl * 1000) - passed;
+		if(lowest_timeleft == -1 || timeleft < lowest_timeleft)
+			lowest_timeleft = timeleft;
+
+		cache_touch(s->cache, i);
 	}
 	if(_lowest_timeleft)
 		*_lowest_timeleft = lowest_timeleft;
@@ -1679,6 +2170,7 @@ query_t *_get_query(jdns_session_t *s, const unsigned char *qname, int qtype, in
 					str = _make_printable_cstr((const char *)q->qname);
 					_debug_line(s, "[%d] reusing query for: [%s] [%s]", q->id, _qtype2str(qtype), str->data);
 					jdns_string_delete(str);
+					++s->stats.queries_joined;
 					return q;
 				}
 			}
@@ -1744,10 +2236,10 @@ void _unicast_cancel(jdns_session_t *s, query_t *q)
 	}
 }
 
-void _queue_packet(jdns_session_t *s, query_t *q, const name_server_t *ns, int recurse, int query_send_type)
+// returns an exported query packet, or 0 on error
+static jdns_packet_t *_make_query_packet(jdns_session_t *s, const query_t *q, int recurse, int edns)
 {
 	jdns_packet_t *packet;
-	datagram_t *a;
 
 	packet = jdns_packet_new();
 	packet->id = q->dns_id;
@@ -1761,12 +2253,36 @@ void _queue_packet(jdns_session_t *s, query_t *q, const name_server_t *ns, int r
 		jdns_list_insert(packet->questions, question, -1);
 		jdns_packet_question_delete(question);
 	}
+	if(edns)
+	{
+		// opt pseudo-record: root owner, the payload size in place of
+		//   the class, and no extended rcode, flags or options
+		jdns_packet_resource_t *opt = jdns_packet_resource_new();
+		opt->qname = jdns_string_new();
+		jdns_string_set_cstr(opt->qname, ".");
+		opt->qtype = JDNS_RTYPE_OPT;
+		opt->qclass = JDNS_UDP_UNI_EDNS_SIZE;
+		opt->ttl = 0;
+		jdns_list_insert(packet->additionalRecords, opt, -1);
+		jdns_packet_resource_delete(opt);
+	}
 	if(!jdns_packet_export(packet, JDNS_UDP_UNI_OUT_MAX))
 	{
 		_debug_line(s, "outgoing packet export error, not sending");
 		jdns_packet_delete(packet);
-		return;
+		return 0;
 	}
+	return packet;
+}
+
+void _queue_packet(jdns_session_t *s, query_t *q, const name_server_t *ns, int recurse, int query_send_type)
+{
+	jdns_packet_t *packet;
+	datagram_t *a;
+
+	packet = _make_query_packet(s, q, recurse, !ns->no_edns);
+	if(!packet)
+		return;
 
 	a = datagram_new();
 	a->handle = s->handle;
@@ -1783,12 +2299,193 @@ void _queue_packet(jdns_session_t *s, query_t *q, const name_server_t *ns, int r
 	list_insert(s->outgoing, a, -1);
 }
 
+// returns 1 if a query is waiting on the name server's tcp connection
+static int _tcp_in_use(jdns_session_t *s, const name_server_t *ns)
+{
+	int n;
+	for(n = 0; n < s->queries->count; ++n)
+	{
+		query_t *q = (query_t *)s->queries->item[n];
+		if(q->tcp_ns_id == ns->id)
+			return 1;
+	}
+	return 0;
+}
+
+// closes the tcp connection to a name server.  queries still waiting on it
+//   go back to udp right away
+void _tcp_close(jdns_session_t *s, name_server_t *ns)
+{
+	int n;
+
+	if(!ns->tcp_handle)
+		return;
+
+	_debug_line(s, "ns [%s:%d] tcp closed", ns->address->c_str, ns->port);
+	s->cb.tcp_close(s, s->cb.app, ns->tcp_handle);
+	ns->tcp_handle = 0;
+	ns->tcp_readable = 0;
+	if(ns->tcp_buf)
+	{
+		free(ns->tcp_buf);
+		ns->tcp_buf = 0;
+	}
+	ns->tcp_buf_size = 0;
+
+	for(n = 0; n < s->queries->count; ++n)
+	{
+		query_t *q = (query_t *)s->queries->item[n];
+		if(q->tcp_ns_id == ns->id)
+		{
+			q->tcp_ns_id = -1;
+			q->time_start = s->cb.time_now(s, s->cb.app);
+			q->time_next = 0;
+		}
+	}
+}
+
+// asks the query again over tcp, reusing the connection to the name server
+//   if there is one.  returns 0 if tcp can't be used
+static int _tcp_query(jdns_session_t *s, query_t *q, name_server_t *ns, int now)
+{
+	jdns_packet_t *packet;
+	unsigned char *buf;
+	int ret;
+
+	if(!s->cb.tcp_connect)
+		return 0;
+
+	if(!ns->tcp_handle)
+	{
+		ns->tcp_handle = s->cb.tcp_connect(s, s->cb.app, ns->address, ns->port);
+		if(!ns->tcp_handle)
+		{
+			_debug_line(s, "ns [%s:%d] tcp connect failed", ns->address->c_str, ns->port);
+			return 0;
+		}
+		_debug_line(s, "ns [%s:%d] tcp connecting", ns->address->c_str, ns->port);
+	}
+
+	// no opt record needed, tcp has no payload limit to advertise
+	packet = _make_query_packet(s, q, 1, 0);
+	if(!packet)
+		return 0;
+
+	// each message is prefixed with its length (rfc 1035, section 4.2.2)
+	buf = (unsigned char *)malloc(packet->raw_size + 2);
+	buf[0] = (unsigned char)((packet->raw_size >> 8) & 0xff);
+	buf[1] = (unsigned char)(packet->raw_size & 0xff);
+	memcpy(buf + 2, packet->raw_data, packet->raw_size);
+
+	_debug_line(s, "SEND %s:%d tcp (size=%d)", ns->address->c_str, ns->port, packet->raw_size);
+	_print_hexdump(s, packet->raw_data, packet->raw_size);
+
+	ret = s->cb.tcp_write(s, s->cb.app, ns->tcp_handle, buf, packet->raw_size + 2);
+	free(buf);
+	jdns_packet_delete(packet);
+	if(!ret)
+	{
+		_tcp_close(s, ns);
+		return 0;
+	}
+
+	++s->stats.tcp_queries;
+	ns->tcp_time = now;
+
+	// any udp packet still queued for this query is of no use now
+	_remove_query_datagrams(s, q);
+	q->tcp_ns_id = ns->id;
+	q->time_start = now;
+	q->time_next = JDNS_TCP_TIMEOUT;
+	return 1;
+}
+
+// lower is better.  servers that recently failed to answer come last, the
+//   more failures the later, and the measured ones ahead of the rest by
+//   round trip time.  equal ranks keep the configured order
+static int _ns_rank(const name_server_t *ns, int now)
+{
+	int rank = (ns->srtt != -1) ? ns->srtt : JDNS_NS_RTT_MAX + 1;
+	if(ns->failures > 0 && now - ns->fail_time < JDNS_NS_PENALTY_TIME)
+		rank += ns->failures * (JDNS_NS_RTT_MAX + 2);
+	return rank;
+}
+
+// the best ranked server this query hasn't tried yet, or 0
+static name_server_t *_ns_best_untried(jdns_session_t *s, const query_t *q, int now)
+{
+	name_server_t *best = 0;
+	int best_rank = 0;
+	int n;
+	for(n = 0; n < s->name_servers->count; ++n)
+	{
+		name_server_t *i = (name_server_t *)s->name_servers->item[n];
+		int rank;
+		if(query_server_tried(q, i->id))
+			continue;
+		rank = _ns_rank(i, now);
+		if(!best || rank < best_rank)
+		{
+			best = i;
+			best_rank = rank;
+		}
+	}
+	return best;
+}
+
+// a reply came from the server: fold its round trip time into the average
+//   (weighted 1/8, as tcp does), and forgive earlier failures
+static void _ns_answered(jdns_session_t *s, query_t *q, name_server_t *ns, int now)
+{
+	int rtt;
+	int sent = query_take_server_sent(q, ns->id);
+	if(sent == -1)
+		return;
+
+	rtt = _min(now - sent, JDNS_NS_RTT_MAX);
+	if(ns->srtt == -1)
+		ns->srtt = rtt;
+	else
+		ns->srtt += (rtt - ns->srtt) / 8;
+	ns->failures = 0;
+	_debug_line(s, "ns [%s:%d] rtt %d ms, average %d ms", ns->address->c_str, ns->port, rtt, ns->srtt);
+}
+
+// the query timed out: count it against each server that got a packet and
+//   hasn't answered, once per query
+static void _ns_unanswered(jdns_session_t *s, query_t *q, int now)
+{
+	int n, k;
+	for(n = 0; n < q->servers_sent_count; n += 2)
+	{
+		if(q->servers_sent[n + 1] == -1)
+			continue;
+		q->servers_sent[n + 1] = -1;
+
+		for(k = 0; k < s->name_servers->count; ++k)
+		{
+			name_server_t *ns = (name_server_t *)s->name_servers->item[k];
+			if(ns->id == q->servers_sent[n])
+			{
+				if(now - ns->fail_time >= JDNS_NS_PENALTY_TIME)
+					ns->failures = 0;
+				++ns->failures;
+				ns->fail_time = now;
+				_debug_line(s, "ns [%s:%d] no answer (%d in a row)", ns->address->c_str, ns->port, ns->failures);
+				break;
+			}
+		}
+	}
+}
+
 // return 1 if packets still need to be written
 int _unicast_do_writes(jdns_session_t *s, int now);
 
 // return 1 if packets still need to be read
 int _unicast_do_reads(jdns_session_t *s, int now);
 
+void _unicast_do_tcp_reads(jdns_session_t *s, int now);
+
 int jdns_step_unicast(jdns_session_t *s, int now)
 {
 	int n;
@@ -1807,21 +2504,35 @@ int jdns_step_unicast(jdns_session_t *s, int now)
 	}
 
 	// expire cached items
-	for(n = 0; n < s->cache->count; ++n)
+	while(1)
 	{
-		cache_item_t *i = (cache_item_t *)s->cache->item[n];
-		if(now >= i->time_start + (i->ttl * 1000))
-		{
-			jdns_string_t *str = _make_printable_cstr((const char *)i->qname);
-			_debug_line(s, "cache exp [%s]", str->data);
-			jdns_string_delete(str);
-			list_remove(s->cache, i);
-			--n; // adjust position
-		}
+		jdns_string_t *str;
+		cache_item_t *i = cache_next_expiring(s->cache);
+		if(!i || now < cache_item_expire_time(i))
+			break;
+
+		str = _make_printable_cstr((const char *)i->qname);
+		_debug_line(s, "cache exp [%s]", str->data);
+		jdns_string_delete(str);
+		cache_remove(s->cache, i);
 	}
 
 	need_write = _unicast_do_writes(s, now);
 	need_read = _unicast_do_reads(s, now);
+	_unicast_do_tcp_reads(s, now);
+
+	// answers may have queued packets of their own (asking again
+	//   without edns), send those now rather than at the next timer
+	if(s->outgoing->count > 0 && s->handle_writable)
+		need_write = _unicast_do_writes(s, now);
+
+	// close tcp connections that are no longer used
+	for(n = 0; n < s->name_servers->count; ++n)
+	{
+		name_server_t *ns = (name_server_t *)s->name_servers->item[n];
+		if(ns->tcp_handle && !_tcp_in_use(s, ns) && now - ns->tcp_time >= JDNS_TCP_IDLE_MAX)
+			_tcp_close(s, ns);
+	}
 
 	// calculate next timer (based on queries and cache)
 	for(n = 0; n < s->queries->count; ++n)
@@ -1838,11 +2549,24 @@ int jdns_step_unicast(jdns_session_t *s, int now)
 				smallest_time = timeleft;
 		}
 	}
-	for(n = 0; n < s->cache->count; ++n)
+	for(n = 0; n < s->name_servers->count; ++n)
 	{
-		cache_item_t *i = (cache_item_t *)(s->cache->item[n]);
-		int passed = now - i->time_start;
-		int timeleft = (i->ttl * 1000) - passed;
+		name_server_t *ns = (name_server_t *)s->name_servers->item[n];
+		if(ns->tcp_handle && !_tcp_in_use(s, ns))
+		{
+			int timeleft = JDNS_TCP_IDLE_MAX - (now - ns->tcp_time);
+			if(timeleft < 0)
+				timeleft = 0;
+
+			if(smallest_time == -1 || timeleft < smallest_time)
+				smallest_time = timeleft;
+		}
+	}
+	if(s->cache->count > 0)
+	{
+		// the heap top is the soonest to expire
+		cache_item_t *i = cache_next_expiring(s->cache);
+		int timeleft = cache_item_expire_time(i) - now;
 		if(timeleft < 0)
 			timeleft = 0;
 
@@ -1914,6 +2638,7 @@ int _unicast_do_writes(jdns_session_t *s, int now)
 				int nxdomain;
 
 				_debug_line(s, "[%d] using cached answer", q->id);
+				++s->stats.cache_hits;
 
 				// are any of the records about to expire in 3 minutes?
 				//  assume the client is interested in this record and
@@ -1938,6 +2663,9 @@ int _unicast_do_writes(jdns_session_t *s, int now)
 				}
 				continue;
 			}
+
+			if(q->step == 0)
+				++s->stats.cache_misses;
 		}
 
 		// inactive
@@ -1951,6 +2679,26 @@ int _unicast_do_writes(jdns_session_t *s, int now)
 			continue;
 		}
 
+		// no answer over tcp in time?  drop the connection and carry
+		//   on over udp
+		if(q->tcp_ns_id != -1)
+		{
+			for(k = 0; k < s->name_servers->count; ++k)
+			{
+				name_server_t *i = (name_server_t *)s->name_servers->item[k];
+				if(i->id == q->tcp_ns_id)
+				{
+					_debug_line(s, "[%d] no answer over tcp", q->id);
+					_tcp_close(s, i);
+					break;
+				}
+			}
+			q->tcp_ns_id = -1;
+		}
+
+		// servers that didn't answer in time rank lower from now on
+		_ns_unanswered(s, q, now);
+
 		giveup = 0;
 
 		// too many tries, give up
@@ -2048,17 +2796,8 @@ int _unicast_do_writes(jdns_session_t *s, int now)
 			q->retrying = 1;
 		}
 
-		// find a nameserver that has not been tried
-		ns = 0;
-		for(k = 0; k < s->name_servers->count; ++k)
-		{
-			name_server_t *i = (name_server_t *)s->name_servers->item[k];
-			if(!query_server_tried(q, i->id))
-			{
-				ns = i;
-				break;
-			}
-		}
+		// find the best nameserver that has not been tried
+		ns = _ns_best_untried(s, q, now);
 
 		// in theory, it is not possible for 'ns' to be null here
 
@@ -2076,10 +2815,27 @@ int _unicast_do_writes(jdns_session_t *s, int now)
 
 		// send the query, with recursion desired, normal query_send_type
 		if(!already_sending)
+		{
 			_queue_packet(s, q, ns, 1, 0);
+			if(q->step > 0)
+				++s->stats.retransmissions;
+		}
 
 		query_add_server_tried(q, ns->id);
 
+		// racing?  then the first step also goes to the next best
+		//   server, and whichever answers first is used
+		if(q->step == 0 && !q->retrying && !already_sending && _intarray_indexOf(s->race_types, s->race_types_count, q->qtype) != -1)
+		{
+			name_server_t *i = _ns_best_untried(s, q, now);
+			if(i)
+			{
+				_debug_line(s, "[%d] racing ns [%s:%d]", q->id, i->address->c_str, i->port);
+				_queue_packet(s, q, i, 1, 1);
+				query_add_server_tried(q, i->id);
+			}
+		}
+
 		// if there is one query, then do a trick on the first step
 		/*if(s->queries->count == 1 && q->step == 0 && !q->retrying)
 		{
@@ -2131,6 +2887,9 @@ int _unicast_do_writes(jdns_session_t *s, int now)
 			need_write = 1;
 			break;
 		}
+		++s->stats.packets_sent;
+		if(a->query)
+			query_add_server_sent(a->query, a->ns_id, now);
 
 		list_remove(s->outgoing, a);
 		--n; // adjust position
@@ -2145,8 +2904,19 @@ void _cache_add(jdns_session_t *s, const unsigned char *qname, int qtype, int ti
 	jdns_string_t *str;
 	if(ttl == 0)
 		return;
-	if(s->cache->count >= JDNS_CACHE_MAX)
+	if(s->cache->max <= 0)
 		return;
+
+	// full?  make room by evicting the least recently used entry
+	while(s->cache->count >= s->cache->max)
+	{
+		cache_item_t *old = s->cache->lru_first;
+		str = _make_printable_cstr((const char *)old->qname);
+		_debug_line(s, "cache evict [%s]", str->data);
+		jdns_string_delete(str);
+		cache_remove(s->cache, old);
+	}
+
 	i = cache_item_new();
 	i->qname = _ustrdup(qname);
 	i->qtype = qtype;
@@ -2154,43 +2924,45 @@ void _cache_add(jdns_session_t *s, const unsigned char *qname, int qtype, int ti
 	i->ttl = ttl;
 	if(record)
 		i->record = jdns_rr_copy(record);
-	list_insert(s->cache, i, -1);
+	cache_insert(s->cache, i);
 
-	str = _make_printable_cstr((const char *)i->qname);
-	_debug_line(s, "cache add [%s] for %d seconds", str->data, i->ttl);
-	jdns_string_delete(str);
+	if(s->debug_enabled)
+	{
+		str = _make_printable_cstr((const char *)i->qname);
+		_debug_line(s, "cache add [%s] for %d seconds", str->data, i->ttl);
+		jdns_string_delete(str);
+	}
 }
 
 void _cache_remove_all_of_kind(jdns_session_t *s, const unsigned char *qname, int qtype)
 {
-	int n;
-	for(n = 0; n < s->cache->count; ++n)
+	unsigned int hash = cache_hash(qname, qtype);
+	cache_item_t *i, *next;
+	for(i = cache_find(s->cache, qname, qtype); i; i = next)
 	{
-		cache_item_t *i = (cache_item_t *)s->cache->item[n];
-		if(jdns_domain_cmp(i->qname, qname) && i->qtype == qtype)
-		{
-			jdns_string_t *str = _make_printable_cstr((const char *)i->qname);
-			_debug_line(s, "cache del [%s]", str->data);
-			jdns_string_delete(str);
-			list_remove(s->cache, i);
-			--n; // adjust position
-		}
+		jdns_string_t *str;
+		next = cache_find_next(i->name_next, qname, qtype, hash);
+
+		str = _make_printable_cstr((const char *)i->qname);
+		_debug_line(s, "cache del [%s]", str->data);
+		jdns_string_delete(str);
+		cache_remove(s->cache, i);
 	}
 }
 
 void _cache_remove_all_of_record(jdns_session_t *s, const jdns_rr_t *record)
 {
-	int n;
-	for(n = 0; n < s->cache->count; ++n)
+	unsigned int hash = cache_hash(record->owner, record->type);
+	cache_item_t *i, *next;
+	for(i = s->cache->records[hash % JDNS_CACHE_BUCKETS]; i; i = next)
 	{
-		cache_item_t *i = (cache_item_t *)s->cache->item[n];
-		if(_cmp_rr(i->record, record))
+		next = i->record_next;
+		if(i->record_hash == hash && _cmp_rr(i->record, record))
 		{
 			jdns_string_t *str = _make_printable_cstr((const char *)i->qname);
 			_debug_line(s, "cache del [%s]", str->data);
 			jdns_string_delete(str);
-			list_remove(s->cache, i);
-			--n; // adjust position
+			cache_remove(s->cache, i);
 		}
 	}
 }
@@ -2242,6 +3014,7 @@ int _unicast_do_reads(jdns_session_t *s, int now)
 			break;
 		}
 
+		++s->stats.packets_received;
 		_debug_line(s, "RECV %s:%d (size=%d)", addr->c_str, port, bufsize);
 		_print_hexdump(s, buf, bufsize);
 
@@ -2333,14 +3106,150 @@ int _unicast_do_reads(jdns_session_t *s, int now)
 			continue;
 		}
 
-		_process_message(s, packet, now, q, ns);
+		if(ns)
+			_ns_answered(s, q, ns, now);
+
+		_process_message(s, packet, now, q, ns, 0);
 		jdns_packet_delete(packet);
 	}
 
 	return need_read;
 }
 
-void _process_message(jdns_session_t *s, jdns_packet_t *packet, int now, query_t *q, name_server_t *ns)
+// handles the whole messages at the front of the receive buffer
+static void _tcp_take_messages(jdns_session_t *s, name_server_t *ns, int now)
+{
+	int n;
+
+	while(ns->tcp_buf_size >= 2)
+	{
+		int size;
+		jdns_packet_t *packet;
+		query_t *q;
+
+		size = (ns->tcp_buf[0] << 8) + ns->tcp_buf[1];
+		if(ns->tcp_buf_size < size + 2)
+			break;
+
+		_debug_line(s, "RECV %s:%d tcp (size=%d)", ns->address->c_str, ns->port, size);
+		_print_hexdump(s, ns->tcp_buf + 2, size);
+
+		if(!jdns_packet_import(&packet, ns->tcp_buf + 2, size))
+			packet = 0;
+
+		ns->tcp_buf_size -= size + 2;
+		memmove(ns->tcp_buf, ns->tcp_buf + size + 2, ns->tcp_buf_size);
+
+		if(!packet)
+		{
+			_debug_line(s, "error parsing packet / too large");
+			continue;
+		}
+
+		_print_packet(s, packet);
+
+		q = 0;
+		for(n = 0; n < s->queries->count; ++n)
+		{
+			query_t *i = (query_t *)s->queries->item[n];
+			if(i->tcp_ns_id == ns->id && i->dns_id == packet->id)
+			{
+				q = i;
+				break;
+			}
+		}
+
+		if(!q)
+		{
+			_debug_line(s, "no such query for packet");
+			jdns_packet_delete(packet);
+			continue;
+		}
+
+		// if this doesn't finish the query, it moves on right away
+		q->tcp_ns_id = -1;
+		q->time_start = now;
+		q->time_next = 0;
+
+		_process_message(s, packet, now, q, ns, 1);
+		jdns_packet_delete(packet);
+	}
+}
+
+void _unicast_do_tcp_reads(jdns_session_t *s, int now)
+{
+	int n;
+
+	for(n = 0; n < s->name_servers->count; ++n)
+	{
+		name_server_t *ns = (name_server_t *)s->name_servers->item[n];
+		int closed = 0;
+
+		if(!ns->tcp_handle || !ns->tcp_readable)
+			continue;
+		ns->tcp_readable = 0;
+
+		while(1)
+		{
+			unsigned char buf[4096];
+			int bufsize = sizeof(buf);
+			unsigned char *p;
+			int ret;
+
+			ret = s->cb.tcp_read(s, s->cb.app, ns->tcp_handle, buf, &bufsize);
+			if(ret == 0)
+				break;
+			if(ret == -1)
+			{
+				closed = 1;
+				break;
+			}
+
+			p = (unsigned char *)realloc(ns->tcp_buf, ns->tcp_buf_size + bufsize);
+			if(!p)
+			{
+				closed = 1;
+				break;
+			}
+			ns->tcp_buf = p;
+			memcpy(ns->tcp_buf + ns->tcp_buf_size, buf, bufsize);
+			ns->tcp_buf_size += bufsize;
+			ns->tcp_time = now;
+
+			_tcp_take_messages(s, ns, now);
+		}
+
+		if(closed)
+			_tcp_close(s, ns);
+	}
+}
+
+// rfc 2308, section 5: the negative ttl is the smaller of the soa record's
+//   own ttl and its minimum field.  returns -1 if there is no soa, in which
+//   case the response must not be cached.
+static int _negative_ttl(const jdns_response_t *r)
+{
+	int n;
+	for(n = 0; n < r->authorityCount; ++n)
+	{
+		const jdns_rr_t *rr = r->authorityRecords[n];
+		const unsigned char *p;
+		int minimum;
+
+		// minimum is always the final 32 bits of the rdata, no matter
+		//   how the names in front of it were encoded
+		if(rr->type != JDNS_RTYPE_SOA || rr->rdlength < 22)
+			continue;
+		p = rr->rdata + rr->rdlength - 4;
+		minimum = (int)(((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | (unsigned long)p[3]);
+		if(minimum < 0)
+			minimum = 0;
+		return _min(_min(rr->ttl, minimum), JDNS_NEG_TTL_MAX);
+	}
+	return -1;
+}
+
+void _process_message(jdns_session_t *s, jdns_packet_t *packet, int now, query_t *q, name_server_t *ns, int via_tcp)
 {
 	int n;
 	int authoritative;
@@ -2369,6 +3278,45 @@ void _process_message(jdns_session_t *s, jdns_packet_t *packet, int now, query_t
 
 	r = 0;
 
+	// a server without edns answers formerr or notimp to the opt record
+	//   (rfc 6891, section 7).  one that understands it sends an opt
+	//   record back.  ask such a server again plainly.
+	if((packet->opts.rcode == 1 || packet->opts.rcode == 4) && ns && !ns->no_edns && !via_tcp)
+	{
+		int have_opt = 0;
+		for(n = 0; n < packet->additionalRecords->count; ++n)
+		{
+			jdns_packet_resource_t *res = (jdns_packet_resource_t *)packet->additionalRecords->item[n];
+			if(res->qtype == JDNS_RTYPE_OPT)
+			{
+				have_opt = 1;
+				break;
+			}
+		}
+		if(!have_opt)
+		{
+			_debug_line(s, "ns [%s:%d] has no edns, asking again without", ns->address->c_str, ns->port);
+			ns->no_edns = 1;
+			_queue_packet(s, q, ns, 1, 0);
+			return;
+		}
+	}
+
+	// the answer didn't fit.  ask again over tcp if we can, otherwise
+	//   make do with what arrived
+	if(truncated && ns && !via_tcp)
+	{
+		// already asked over tcp?  this is a late reply, ignore it
+		if(q->tcp_ns_id != -1)
+			return;
+
+		if(_tcp_query(s, q, ns, now))
+		{
+			_debug_line(s, "[%d] truncated, asking again over tcp", q->id);
+			return;
+		}
+	}
+
 	// nxdomain
 	if(packet->opts.rcode == 3)
 	{
@@ -2381,6 +3329,16 @@ void _process_message(jdns_session_t *s, jdns_packet_t *packet, int now, query_t
 		//   distinction is not all that useful.
 		//r = jdns_response_new();
 		//nxdomain = 1;
+
+		// but still remember that this server said so.  if every server
+		//   ends up agreeing, _process_response reports (and caches) a
+		//   proper nxdomain.
+		if(ns)
+		{
+			jdns_response_t *nr = _packet2response(packet, q->qname, q->qtype, 0xffff);
+			query_add_server_nxdomain(q, ns->id, _negative_ttl(nr));
+			jdns_response_delete(nr);
+		}
 	}
 	// normal
 	else if(packet->opts.rcode == 0)
@@ -2458,6 +3416,10 @@ void _process_message(jdns_session_t *s, jdns_packet_t *packet, int now, query_t
 				for(n = 0; n < r->additionalCount; ++n)
 				{
 					jdns_rr_t *record = r->additionalRecords[n];
+
+					// the opt pseudo-record is not data
+					if(record->type == JDNS_RTYPE_OPT)
+						continue;
 					_cache_add_no_dups(s, record->owner, record->type, now, _min(record->ttl, JDNS_TTL_MAX), record);
 				}
 			}
@@ -2513,13 +3475,26 @@ int _process_response(jdns_session_t *s, jdns_response_t *r, int nxdomain, query
 		if(!all_errored)
 			return 0;
 
+		// every server said the name doesn't exist
+		if(query_all_failed_nxdomain(q))
+		{
+			nxdomain = 1;
+
+			// negative caching, rfc 2308
+			if(q->qtype != JDNS_RTYPE_ANY && q->nxdomain_ttl > 0)
+			{
+				_cache_remove_all_of_kind(s, q->qname, q->qtype);
+				_cache_add(s, q->qname, q->qtype, s->cb.time_now(s, s->cb.app), q->nxdomain_ttl, 0);
+			}
+		}
+
 		// report event to any requests listening
 		for(k = 0; k < q->req_ids_count; ++k)
 		{
 			jdns_event_t *event = jdns_event_new();
 			event->type = JDNS_EVENT_RESPONSE;
 			event->id = q->req_ids[k];
-			event->status = JDNS_STATUS_ERROR;
+			event->status = nxdomain ? JDNS_STATUS_NXDOMAIN : JDNS_STATUS_ERROR;
 			_append_event_and_hold_id(s, event);
 		}
 
@@ -3365,6 +4340,7 @@ int jdns_step_multicast(jdns_session_t *s, int now)
 			need_write = 1;
 			break;
 		}
+		++s->stats.packets_sent;
 	}
 
 	if(s->shutdown == 1)
@@ -3402,6 +4378,7 @@ int jdns_step_multicast(jdns_session_t *s, int now)
 				break;
 			}
 
+			++s->stats.packets_received;
 			_debug_line(s, "RECV %s:%d (size=%d)", addr->c_str, port, bufsize);
 			_print_hexdump(s, buf, bufsize);
 
@@ -204,6 +204,7 @@ void jdns_dnsparams_append_host(jdns_dnsparams_t *a,
 #define JDNS_RTYPE_TXT      16
 #define JDNS_RTYPE_HINFO    13
 #define JDNS_RTYPE_NS        2
+#define JDNS_RTYPE_SOA       6
 #define JDNS_RTYPE_ANY     255
 
 typedef struct jdns_rr
@@ -356,6 +357,53 @@ typedef struct jdns_callbacks
 	int (*udp_write)(jdns_session_t *s, void *app, int handle,
 		const jdns_address_t *addr, int port, unsigned char *buf,
 		int bufsize);
+
+	// the tcp callbacks are optional, and used in unicast mode to ask
+	//   again when a response over udp comes back truncated.  set all of
+	//   them to 0 if tcp is not available.  a connection is kept open
+	//   per nameserver and reused for later queries until it sits idle.
+
+	// tcp_connect:
+	//   s: session
+	//   app: user-supplied context
+	//   addr: ip address of the nameserver
+	//   port: port of the nameserver
+	//   return: handle (>0) of the connection, or 0 on error
+	// note: the connection may still be in progress.  data written before
+	//   it completes must be held and sent once it does.  use
+	//   jdns_set_handle_readable() when data arrives or the connection
+	//   ends, with this handle
+	int (*tcp_connect)(jdns_session_t *s, void *app,
+		const jdns_address_t *addr, int port);
+
+	// tcp_close:
+	//   s: session
+	//   app: user-supplied context
+	//   handle: handle of connection obtained with tcp_connect
+	//   return: nothing
+	void (*tcp_close)(jdns_session_t *s, void *app, int handle);
+
+	// tcp_read:
+	//   s: session
+	//   app: user-supplied context
+	//   handle: handle of connection obtained with tcp_connect
+	//   buf: store received data
+	//   bufsize: value contains max size, to be changed to real size
+	//   return: 1 if data read, 0 if none available, -1 if the
+	//     connection is closed or failed
+	int (*tcp_read)(jdns_session_t *s, void *app, int handle,
+		unsigned char *buf, int *bufsize);
+
+	// tcp_write:
+	//   s: session
+	//   app: user-supplied context
+	//   handle: handle of connection obtained with tcp_connect
+	//   buf: data to send
+	//   bufsize: size of data
+	//   return: 1 if the data was taken for writing, 0 if the connection
+	//     is closed or failed
+	int (*tcp_write)(jdns_session_t *s, void *app, int handle,
+		const unsigned char *buf, int bufsize);
 } jdns_callbacks_t;
 
 typedef struct jdns_event
@@ -500,6 +548,56 @@ jdns_dnsparams_t *jdns_system_dnsparams();
 //   however new applications really should use it.
 void jdns_set_hold_ids_enabled(jdns_session_t *s, int enabled);
 
+// jdns_set_debug_enabled
+//   s: session
+//   enabled: whether to produce debug lines
+//   return: nothing
+// with debugging, every packet sent or received is dumped through the
+//   debug_line callback, which costs more than handling the packet.  an
+//   application that throws the lines away should disable it.  enabled by
+//   default.
+void jdns_set_debug_enabled(jdns_session_t *s, int enabled);
+
+// jdns_set_cache_max
+//   s: session
+//   max: maximum number of records to cache.  default is 16384
+//   return: nothing
+// when the cache is full, the least recently used record is evicted to make
+//   room for a new one.  a value of 0 disables unicast caching.  lowering the
+//   limit evicts records immediately.
+void jdns_set_cache_max(jdns_session_t *s, int max);
+
+// jdns_set_race
+//   s: session
+//   qtype: record type
+//   enabled: whether to race queries of this type
+//   return: nothing
+// unicast queries go to the best name server first, ranked by how often it
+//   failed to answer lately and then by round trip time.  with racing, the
+//   first packet of a query also goes to the next best server, and the first
+//   answer wins.  this costs a packet per query, for latency-critical lookups
+//   where the best server may be dead.  off for every type by default.
+void jdns_set_race(jdns_session_t *s, int qtype, int enabled);
+
+// counters kept since the session was created
+typedef struct jdns_stats
+{
+	int queries;          // jdns_query() calls
+	int queries_joined;   // of those, joined to one already in progress
+	int cache_hits;       // unicast queries answered from the cache
+	int cache_misses;     // unicast queries that had to be sent
+	int packets_sent;
+	int packets_received;
+	int retransmissions;  // unicast query packets sent again after a timeout
+	int tcp_queries;      // unicast queries asked again over tcp
+} jdns_stats_t;
+
+// jdns_get_stats
+//   s: session
+//   stats: filled in with the counters
+//   return: nothing
+void jdns_get_stats(jdns_session_t *s, jdns_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
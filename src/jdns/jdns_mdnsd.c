@@ -40,7 +40,7 @@
 
 // size of query/publish hashes
 #define SPRIME 108
-// size of cache hash
+// starting size of cache hash, it grows to keep chains short
 #define LPRIME 1009
 // brute force garbage cleanup frequency, rarely needed (daily default)
 #define GC 86400
@@ -85,9 +85,11 @@ struct unicast
 
 struct cached
 {
-    struct mdnsda_struct rr;
+    struct mdnsda_struct rr; // must be first, see mdnsd_list()
     struct query *q;
     struct cached *next;
+    unsigned int hash;
+    int heap_pos; // in the expiry heap, -1 if not there
 };
 
 struct mdnsdr_struct
@@ -106,8 +108,11 @@ struct mdnsd_struct
     unsigned long int expireall, checkqlist;
     struct mytimeval now, sleep, pause, probe, publish;
     int class, frame;
-    struct cached *cache[LPRIME];
+    struct cached **cache; // cache_size buckets
+    int cache_size;
     int cache_count;
+    struct cached **expiry; // min-heap of cache_count entries, by rr.ttl
+    int expiry_alloc;
     struct mdnsdr_struct *published[SPRIME], *probing, *a_now, *a_pause, *a_publish;
     struct unicast *uanswers;
     struct query *queries[SPRIME], *qlist;
@@ -161,17 +166,21 @@ int _namehash(const char *s)
     return (int)h;
 }
 
-// case-insensitive hash
+// case-insensitive hash, the same as _namehash() of the lowercased name
 int _namehash_nocase(const char *s)
 {
-    int n, len;
-    char *low = jdns_strdup(s);
-    len = strlen(low);
-    for(n = 0; n < len; ++n)
-        low[n] = tolower(low[n]);
-    n = _namehash(low);
-    jdns_free(low);
-    return n;
+    const unsigned char *name = (const unsigned char *)s;
+    unsigned long h = 0, g;
+
+    while (*name)
+    {
+        h = (h << 4) + (unsigned long)tolower(*name++);
+        if ((g = (h & 0xF0000000UL))!=0)
+            h ^= (g >> 24);
+        h &= ~g;
+    }
+
+    return (int)h;
 }
 
 // basic linked list and hash primitives
@@ -186,13 +195,140 @@ struct query *_q_next(mdnsd d, struct query *q, char *host, int type)
 }
 struct cached *_c_next(mdnsd d, struct cached *c, char *host, int type)
 {
-    if(c == 0) c = d->cache[_namehash_nocase(host) % LPRIME];
-    else c = c->next;
+    unsigned int hash;
+    if(c == 0)
+    {
+        hash = (unsigned int)_namehash_nocase(host);
+        c = d->cache[hash % d->cache_size];
+    }
+    else
+    {
+        hash = c->hash;
+        c = c->next;
+    }
     for(;c != 0; c = c->next)
-        if((type == c->rr.type || type == 255) && jdns_domain_cmp(c->rr.name, (unsigned char *)host))
+        if(c->hash == hash && (type == c->rr.type || type == 255) && jdns_domain_cmp(c->rr.name, (unsigned char *)host))
             return c;
     return 0;
 }
+
+// cache bookkeeping.  entries are hashed by name, and kept in a heap by
+//   rr.ttl so that expiring costs only what actually expires.
+void _c_heap_set(mdnsd d, int pos, struct cached *c)
+{
+    d->expiry[pos] = c;
+    c->heap_pos = pos;
+}
+
+void _c_heap_up(mdnsd d, int pos)
+{
+    struct cached *c = d->expiry[pos];
+    while(pos > 0)
+    {
+        int parent = (pos - 1) / 2;
+        if(d->expiry[parent]->rr.ttl <= c->rr.ttl)
+            break;
+        _c_heap_set(d, pos, d->expiry[parent]);
+        pos = parent;
+    }
+    _c_heap_set(d, pos, c);
+}
+
+void _c_heap_down(mdnsd d, int pos)
+{
+    struct cached *c = d->expiry[pos];
+    while(1)
+    {
+        int child = pos * 2 + 1;
+        if(child >= d->cache_count)
+            break;
+        if(child + 1 < d->cache_count && d->expiry[child + 1]->rr.ttl < d->expiry[child]->rr.ttl)
+            ++child;
+        if(c->rr.ttl <= d->expiry[child]->rr.ttl)
+            break;
+        _c_heap_set(d, pos, d->expiry[child]);
+        pos = child;
+    }
+    _c_heap_set(d, pos, c);
+}
+
+// change when an entry expires, keeping the heap in order
+void _c_set_ttl(mdnsd d, struct cached *c, unsigned long int ttl)
+{
+    unsigned long int old = c->rr.ttl;
+    c->rr.ttl = ttl;
+    if(c->heap_pos == -1)
+        return;
+    if(ttl < old)
+        _c_heap_up(d, c->heap_pos);
+    else if(ttl > old)
+        _c_heap_down(d, c->heap_pos);
+}
+
+void _c_grow(mdnsd d)
+{
+    int i, size = d->cache_size * 2 + 1;
+    struct cached **cache = (struct cached **)jdns_alloc(sizeof(struct cached *) * size);
+    bzero(cache, sizeof(struct cached *) * size);
+    for(i = 0; i < d->cache_size; ++i)
+    {
+        struct cached *c, *next;
+        for(c = d->cache[i]; c != 0; c = next)
+        {
+            next = c->next;
+            c->next = cache[c->hash % size];
+            cache[c->hash % size] = c;
+        }
+    }
+    jdns_free(d->cache);
+    d->cache = cache;
+    d->cache_size = size;
+}
+
+void _c_insert(mdnsd d, struct cached *c)
+{
+    int i;
+    c->hash = (unsigned int)_namehash_nocase((char *)c->rr.name);
+
+    // keep the average chain at one entry or less
+    if(d->cache_count >= d->cache_size)
+        _c_grow(d);
+    i = c->hash % d->cache_size;
+    c->next = d->cache[i];
+    d->cache[i] = c;
+
+    if(d->cache_count >= d->expiry_alloc)
+    {
+        d->expiry_alloc = d->expiry_alloc ? d->expiry_alloc * 2 : 64;
+        d->expiry = (struct cached **)jdns_realloc(d->expiry, sizeof(struct cached *) * d->expiry_alloc);
+    }
+    _c_heap_set(d, d->cache_count, c);
+    ++(d->cache_count);
+    _c_heap_up(d, c->heap_pos);
+}
+
+// take an entry out of the hash and the heap, it is not freed
+void _c_remove(mdnsd d, struct cached *c)
+{
+    struct cached **at = &d->cache[c->hash % d->cache_size];
+    int pos = c->heap_pos;
+
+    while(*at && *at != c)
+        at = &(*at)->next;
+    if(*at)
+        *at = c->next;
+    c->next = 0;
+
+    --(d->cache_count);
+    if(pos != d->cache_count)
+    {
+        struct cached *last = d->expiry[d->cache_count];
+        _c_heap_set(d, pos, last);
+        _c_heap_up(d, pos);
+        _c_heap_down(d, last->heap_pos);
+    }
+    c->heap_pos = -1;
+}
 mdnsdr _r_next(mdnsd d, mdnsdr r, char *host, int type)
 {
     if(r == 0) r = d->published[_namehash_nocase(host) % SPRIME];
@@ -306,11 +442,16 @@ void _r_send(mdnsd d, mdnsdr r)
         _r_push(&d->a_now,r);
         return;
     }
-    // set d->pause.tv_usec to random 20-120 msec
-    d->pause.tv_sec = d->now.tv_sec;
-    //d->pause.tv_usec = d->now.tv_usec + ((d->now.tv_usec % 100) + 20) * 1000;
-    d->pause.tv_usec = d->now.tv_usec;
-    d->pause.tv_usec += ((d->cb_rand_int(d, d->cb_arg) % 100) + 20) * 1000;
+    // set d->pause.tv_usec to random 20-120 msec.  if a pause is running
+    //   already, join it, so the answers go out together and later
+    //   queries don't keep pushing it back
+    if(!d->a_pause)
+    {
+        d->pause.tv_sec = d->now.tv_sec;
+        //d->pause.tv_usec = d->now.tv_usec + ((d->now.tv_usec % 100) + 20) * 1000;
+        d->pause.tv_usec = d->now.tv_usec;
+        d->pause.tv_usec += ((d->cb_rand_int(d, d->cb_arg) % 100) + 20) * 1000;
+    }
     _r_push(&d->a_pause,r);
 }
 
@@ -387,10 +528,57 @@ void _r_done(mdnsd d, mdnsdr r)
 
 void _q_answer(mdnsd d, struct cached *c)
 { // call the answer function with this cached entry
-    if(c->rr.ttl <= d->now.tv_sec) c->rr.ttl = 0;
+    if(c->rr.ttl <= d->now.tv_sec) _c_set_ttl(d, c, 0);
     if(c->q->answer(&c->rr,c->q->arg) == -1) _q_done(d, c->q);
 }
 
+// seconds a cached entry really has left.  rr.ttl is when it gets asked
+//   for again, just past half its life, see _cache()
+long int _c_remaining(mdnsd d, struct cached *c)
+{
+    return (long int)c->rr.ttl - d->now.tv_sec + c->rr.real_ttl / 2 - 8;
+}
+
+// rfc 6762, section 7.3: another host asked a question we are about to ask,
+//   and knew no answer we don't.  its answers reach us too, so count our
+//   own query as sent
+void _q_suppress(mdnsd d, jdns_packet_question_t *pq, const jdns_response_t *resp)
+{
+    struct query *q;
+    struct cached *c;
+    int j;
+
+    if(pq->qclass != d->class || (q = _q_next(d,0,(char *)pq->qname->data,pq->qtype)) == 0) return;
+    if(q->nexttry == 0 || q->nexttry > d->now.tv_sec + 1 || q->tries >= 3) return;
+
+    for(j=0;j<resp->answerCount;j++)
+    {
+        jdns_rr_t *an = resp->answerRecords[j];
+        if(pq->qtype != an->type || !jdns_domain_cmp(pq->qname->data, an->owner)) continue;
+        c = 0;
+        while((c = _c_next(d,c,q->name,q->type)) != 0)
+            if(c->rr.ttl > d->now.tv_sec + 8 && _a_match(an,&c->rr)) break;
+        if(c == 0) return; // they know something we don't, ask anyway
+    }
+
+    q->nexttry = d->now.tv_sec + ++q->tries;
+}
+
+// rfc 6762, section 7.4: another host answered with a record we were about
+//   to send.  drop ours if theirs has at least half our ttl left
+void _r_suppress(mdnsd d, const jdns_rr_t *an)
+{
+    mdnsdr cur, last = 0;
+    for(cur = d->a_pause; cur != 0; last = cur, cur = cur->list)
+    {
+        if(!_a_match(an,&cur->rr) || an->ttl < cur->rr.ttl / 2) continue;
+        if(last) last->list = cur->list;
+        else d->a_pause = cur->list;
+        cur->list = 0;
+        return;
+    }
+}
+
 void _conflict(mdnsd d, mdnsdr r)
 {
     r->pubresult(0, (char *)r->rr.name,r->rr.type,r->arg);
@@ -403,33 +591,23 @@ void _published(mdnsd d, mdnsdr r)
     r->pubresult(1, (char *)r->rr.name,r->rr.type,r->arg);
 }
 
-void _c_expire(mdnsd d, struct cached **list)
-{ // expire any old entries in this list
-    struct cached *next, *cur = *list, *last = 0;
-    while(cur != 0)
+void _c_expire(mdnsd d)
+{ // expire any old entries, soonest first
+    struct cached *cur;
+    while(d->cache_count > 0 && d->now.tv_sec >= d->expiry[0]->rr.ttl)
     {
-        next = cur->next;
-        if(d->now.tv_sec >= cur->rr.ttl)
-        {
-            if(last) last->next = next;
-            if(*list == cur) *list = next; // update list pointer if the first one expired
-            --(d->cache_count);
-            if(cur->q) _q_answer(d,cur);
-            mdnsda_content_free(&cur->rr);
-            jdns_free(cur);
-        }else{
-            last = cur;
-        }
-        cur = next;
+        cur = d->expiry[0];
+        _c_remove(d, cur);
+        if(cur->q) _q_answer(d,cur);
+        mdnsda_content_free(&cur->rr);
+        jdns_free(cur);
     }
 }
 
-// brute force expire any old cached records
+// periodic cleanup, the heap makes sure nothing old is left behind
 void _gc(mdnsd d)
 {
-    int i;
-    for(i=0;i<LPRIME;i++)
-        if(d->cache[i]) _c_expire(d,&d->cache[i]);
+    _c_expire(d);
     d->expireall = d->now.tv_sec + GC;
 }
 
@@ -450,7 +628,6 @@ struct cached *_find_exact(mdnsd d, const jdns_rr_t *r)
 void _cache(mdnsd d, const jdns_rr_t *r)
 {
     struct cached *c;
-    int i = _namehash_nocase((char *)r->owner) % LPRIME;
     struct cached *same_value;
 
     // do we already have it?
@@ -469,9 +646,9 @@ void _cache(mdnsd d, const jdns_rr_t *r)
         while((c = _c_next(d,c,(char *)r->owner,r->type)))
         {
             if(c != same_value)
-                c->rr.ttl = 0;
+                _c_set_ttl(d, c, 0);
         }
-        _c_expire(d,&d->cache[i]);
+        _c_expire(d);
 
         // we may have expired same_value here, so check for it again
         same_value = _find_exact(d, r);
@@ -480,8 +657,8 @@ void _cache(mdnsd d, const jdns_rr_t *r)
     if(r->ttl == 0)
     { // process deletes
         if(same_value)
-            same_value->rr.ttl = 0;
-        _c_expire(d,&d->cache[i]);
+            _c_set_ttl(d, same_value, 0);
+        _c_expire(d);
         return;
     }
 
@@ -490,7 +667,7 @@ void _cache(mdnsd d, const jdns_rr_t *r)
         //printf("updating ttl only\n");
 
         // only update ttl (this code directly copied from below)
-        same_value->rr.ttl = d->now.tv_sec + (r->ttl / 2) + 8;
+        _c_set_ttl(d, same_value, d->now.tv_sec + (r->ttl / 2) + 8);
         same_value->rr.real_ttl = r->ttl;
         return;
     }
@@ -501,6 +678,7 @@ void _cache(mdnsd d, const jdns_rr_t *r)
 
     c = (struct cached *)jdns_alloc(sizeof(struct cached));
     bzero(c,sizeof(struct cached));
+    c->heap_pos = -1;
     c->rr.name = (unsigned char *)jdns_strdup((char *)r->owner);
     c->rr.type = r->type;
     c->rr.ttl = d->now.tv_sec + (r->ttl / 2) + 8; // XXX hack for now, BAD SPEC, start retrying just after half-waypoint, then expire
@@ -524,8 +702,7 @@ void _cache(mdnsd d, const jdns_rr_t *r)
         c->rr.srv.priority = r->data.server->priority;
         break;
     }
-    c->next = d->cache[i];
-    d->cache[i] = c;
+    _c_insert(d, c);
     if((c->q = _q_next(d, 0, (char *)r->owner, r->type)))
         _q_answer(d,c);
     if(c->q && c->q->nexttry == 0)
@@ -602,6 +779,72 @@ void _a_copy(jdns_list_t *dest, unsigned char *name, unsigned short type, unsign
     jdns_packet_resource_delete(r);
 }
 
+// true if the section carries a record of this name and type already
+int _m_has(jdns_list_t *list, const unsigned char *name, int type)
+{
+    int i;
+    for(i = 0; i < list->count; ++i)
+    {
+        jdns_packet_resource_t *r = (jdns_packet_resource_t *)list->item[i];
+        if(r->qtype == type && jdns_domain_cmp(r->qname->data, name))
+            return 1;
+    }
+    return 0;
+}
+
+// put our settled records of this name and type in the additional section
+void _a_add(mdnsd d, jdns_packet_t *m, unsigned char *name, int type)
+{
+    mdnsdr r = 0;
+    unsigned short class;
+    if(_m_has(m->answerRecords, name, type) || _m_has(m->additionalRecords, name, type)) return;
+    while((r = _r_next(d,r,(char *)name,type)) != 0)
+    {
+        if(r->rr.ttl == 0 || (r->unique && r->unique < 5)) continue; // going away, or still probing
+        class = r->unique ? d->class | 0x8000 : d->class;
+        _a_copy(m->additionalRecords, r->rr.name, r->rr.type, class, r->rr.ttl, &r->rr);
+    }
+}
+
+// rfc 6762, section 12: whoever browses for a service wants its srv, txt
+//   and address records next, so send them along and save the asking
+void _r_additional(mdnsd d, jdns_packet_t *m, mdnsda a)
+{
+    mdnsdr srv = 0;
+    if(a->ttl == 0 || !a->rdname) return;
+    if(a->type == QTYPE_PTR)
+    {
+        _a_add(d, m, a->rdname, QTYPE_SRV);
+        _a_add(d, m, a->rdname, QTYPE_TXT);
+        while((srv = _r_next(d,srv,(char *)a->rdname,QTYPE_SRV)) != 0)
+        {
+            if(!srv->rr.rdname) continue;
+            _a_add(d, m, srv->rr.rdname, QTYPE_A);
+            _a_add(d, m, srv->rr.rdname, QTYPE_AAAA);
+        }
+    }
+    else if(a->type == QTYPE_SRV)
+    {
+        _a_add(d, m, a->rdname, QTYPE_A);
+        _a_add(d, m, a->rdname, QTYPE_AAAA);
+    }
+}
+
+// drop additional records that ended up among the answers after all
+void _m_prune_additional(jdns_packet_t *m)
+{
+    int i;
+    for(i = 0; i < m->additionalRecords->count; ++i)
+    {
+        jdns_packet_resource_t *r = (jdns_packet_resource_t *)m->additionalRecords->item[i];
+        if(_m_has(m->answerRecords, r->qname->data, r->qtype))
+        {
+            jdns_list_remove_at(m->additionalRecords, i);
+            --i; // adjust position
+        }
+    }
+}
+
 /*
 int _r_out(mdnsd d, struct message *m, mdnsdr *list)
 { // copy a published record into an outgoing message
@@ -633,6 +876,7 @@ int _r_out(mdnsd d, jdns_packet_t *m, mdnsdr *list)
         ret++;
         class = r->unique ? d->class | 0x8000 : d->class;
         _a_copy(m->answerRecords, r->rr.name, r->rr.type, class, r->rr.ttl, &r->rr);
+        _r_additional(d, m, &r->rr);
         if(r->rr.ttl == 0) _r_done(d,r);
     }
     return ret;
@@ -652,7 +896,12 @@ mdnsd mdnsd_new(int class, int frame, int port, int (*time_now)(mdnsd d, void *a
     d->expireall = d->now.tv_sec + GC;
     d->class = class;
     d->frame = frame;
+    d->cache_size = LPRIME;
+    d->cache = (struct cached **)jdns_alloc(sizeof(struct cached *) * d->cache_size);
+    bzero(d->cache, sizeof(struct cached *) * d->cache_size);
     d->cache_count = 0;
+    d->expiry = 0;
+    d->expiry_alloc = 0;
     d->port = port;
     return d;
 }
@@ -691,16 +940,14 @@ void mdnsd_free(mdnsd d)
     // loop through all hashes, free everything
     // free answers if any
 
-    for(i = 0; i < LPRIME; ++i)
+    for(i = 0; i < d->cache_count; ++i)
     {
-        while(d->cache[i])
-        {
-            struct cached *cur = d->cache[i];
-            d->cache[i] = cur->next;
-            mdnsda_content_free(&cur->rr);
-            jdns_free(cur);
-        }
+        mdnsda_content_free(&d->expiry[i]->rr);
+        jdns_free(d->expiry[i]);
     }
+    jdns_free(d->cache);
+    if(d->expiry)
+        jdns_free(d->expiry);
 
     for(i = 0; i < SPRIME; ++i)
     {
@@ -748,6 +995,8 @@ void mdnsd_in(mdnsd d, const jdns_packet_t *m, const jdns_response_t *resp, cons
         { // process each query
             jdns_packet_question_t *pq = (jdns_packet_question_t *)m->questions->item[i];
 
+            _q_suppress(d, pq, resp);
+
             if(pq->qclass != d->class || (r = _r_next(d,0,(char *)pq->qname->data,pq->qtype)) == 0) continue;
 
             // send the matching unicast reply
@@ -776,7 +1025,7 @@ void mdnsd_in(mdnsd d, const jdns_packet_t *m, const jdns_response_t *resp, cons
                 { // check the known answers for this question
                     jdns_rr_t *an = resp->answerRecords[j];
                     if(pq->qtype != an->type || !jdns_domain_cmp(pq->qname->data, an->owner)) continue;
-                    if(_a_match(an,&r->rr)) break; // they already have this answer
+                    if(_a_match(an,&r->rr) && an->ttl >= r->rr.ttl / 2) break; // they already have this answer, and for long enough
                 }
                 if(j == resp->answerCount) _r_send(d,r);
             }
@@ -788,6 +1037,7 @@ void mdnsd_in(mdnsd d, const jdns_packet_t *m, const jdns_response_t *resp, cons
     { // process each answer, check for a conflict, and cache
         jdns_rr_t *an = resp->answerRecords[i];
         if((r = _r_next(d,0,(char *)an->owner,an->type)) != 0 && r->unique && _a_match(an,&r->rr) == 0) _conflict(d,r);
+        _r_suppress(d,an);
         _cache(d,an);
     }
 
@@ -830,6 +1080,7 @@ int mdnsd_out(mdnsd d, jdns_packet_t **_m, jdns_address_t **addr, unsigned short
         m->id = u->id;
         _a_copyq(m->questions, u->r->rr.name, u->r->rr.type, (unsigned short)d->class);
         _a_copy(m->answerRecords, u->r->rr.name, u->r->rr.type, (unsigned short)d->class, u->r->rr.ttl, &u->r->rr);
+        _r_additional(d, m, &u->r->rr);
         jdns_free(u);
         ret = 1;
         goto end;
@@ -850,6 +1101,7 @@ int mdnsd_out(mdnsd d, jdns_packet_t **_m, jdns_address_t **addr, unsigned short
             ret++; cur->tries++;
             class = cur->unique ? d->class | 0x8000 : d->class;
             _a_copy(m->answerRecords, cur->rr.name, cur->rr.type, class, cur->rr.ttl, &cur->rr);
+            _r_additional(d, m, &cur->rr);
 
             if(cur->rr.ttl != 0 && cur->tries < 4)
             {
@@ -873,8 +1125,9 @@ int mdnsd_out(mdnsd d, jdns_packet_t **_m, jdns_address_t **addr, unsigned short
     if(d->shutdown)
         goto end;
 
-    // check if a_pause is ready
-    if(d->a_pause && _tvdiff(d->now, d->pause) <= 0) ret += _r_out(d, m, &d->a_pause);
+    // check if a_pause is ready.  if a packet is going out anyway, the
+    //   paused answers ride along rather than taking one of their own
+    if(d->a_pause && (ret || _tvdiff(d->now, d->pause) <= 0)) ret += _r_out(d, m, &d->a_pause);
 
     // now process questions
     if(ret)
@@ -939,7 +1192,7 @@ int mdnsd_out(mdnsd d, jdns_packet_t **_m, jdns_address_t **addr, unsigned short
             if(q->nexttry == 0 || q->nexttry > d->now.tv_sec) continue;
             if(q->tries == 3)
             { // done retrying, expire and reset
-                _c_expire(d,&d->cache[_namehash_nocase(q->name) % LPRIME]);
+                _c_expire(d);
                 _q_reset(d,q);
                 continue;
             }
@@ -951,7 +1204,7 @@ int mdnsd_out(mdnsd d, jdns_packet_t **_m, jdns_address_t **addr, unsigned short
             c = 0;
             while((c = _c_next(d,c,q->name,q->type)) != 0 && c->rr.ttl > d->now.tv_sec + 8 /* && message_packet_len(m) + _rr_len(&c->rr) < d->frame */)
             {
-                _a_copy(m->answerRecords, (unsigned char *)q->name, (unsigned short)q->type, (unsigned short)d->class, (unsigned long int)(c->rr.ttl - d->now.tv_sec), &c->rr);
+                _a_copy(m->answerRecords, (unsigned char *)q->name, (unsigned short)q->type, (unsigned short)d->class, (unsigned long int)_c_remaining(d, c), &c->rr);
             }
         }
         d->checkqlist = nextbest;
@@ -959,10 +1212,15 @@ int mdnsd_out(mdnsd d, jdns_packet_t **_m, jdns_address_t **addr, unsigned short
 
     if(d->now.tv_sec > d->expireall)
         _gc(d);
+    else
+        _c_expire(d);
 
 end:
     if(ret)
+    {
+        _m_prune_additional(m);
         *_m = m;
+    }
     else
         jdns_packet_delete(m);
 
@@ -1005,7 +1263,12 @@ struct mytimeval *mdnsd_sleep(mdnsd d)
         RET;
     }
 
-    // last resort, next gc expiration
+    // last resort, the next cache expiration or gc
+    if(d->cache_count > 0 && d->expiry[0]->rr.ttl < d->expireall)
+    {
+        if((sec = d->expiry[0]->rr.ttl - d->now.tv_sec) > 0) d->sleep.tv_sec = sec;
+        RET;
+    }
     if((sec = d->expireall - d->now.tv_sec) > 0) d->sleep.tv_sec = sec;
     RET;
 }
@@ -66,6 +66,14 @@ char *jdns_strdup(const char *s);
 unsigned char *jdns_copy_array(const unsigned char *src, int size);
 int jdns_domain_cmp(const unsigned char *a, const unsigned char *b);
 
+// scratch memory that is given back all at once.  the first block comes
+//   with the arena itself, so a job that stays within it costs one
+//   allocation.
+typedef struct jdns_arena jdns_arena_t;
+jdns_arena_t *jdns_arena_new(int blocksize);
+void *jdns_arena_alloc(jdns_arena_t *a, int size);
+void jdns_arena_delete(jdns_arena_t *a);
+
 int jdns_sprintf_s(char *str, int n, const char *format, ...);
 int jdns_vsprintf_s(char *str, int n, const char *format, va_list ap);
 FILE *jdns_fopen(const char *path, const char *mode);
@@ -78,40 +78,74 @@ static void long2net(unsigned long int l, unsigned char **bufp)
 	*bufp += 4;
 }
 
-// label stuff
+// label stuff.  while exporting, every name suffix written so far is kept
+//   for compression, hashed by its full (decompressed) value so that a
+//   suffix is found without comparing against all the others.  the bytes
+//   are already in the packet being built, so an entry just points there,
+//   and everything lives in one arena.
 typedef struct jdns_packet_label
 {
-	JDNS_OBJECT
 	int offset;
-	jdns_string_t *value;
+	const unsigned char *value;
+	int size;
+	unsigned int hash;
+	struct jdns_packet_label *next;
 } jdns_packet_label_t;
 
-static void jdns_packet_label_delete(jdns_packet_label_t *a);
-static jdns_packet_label_t *jdns_packet_label_copy(const jdns_packet_label_t *a);
-
-static jdns_packet_label_t *jdns_packet_label_new()
+typedef struct jdns_packet_lookup
 {
-	jdns_packet_label_t *a = JDNS_OBJECT_NEW(jdns_packet_label);
-	a->offset = 0;
-	a->value = 0;
-	return a;
-}
+	jdns_arena_t *arena;
+	jdns_packet_label_t **table;
+	int table_size; // a power of two
+	int count;
+} jdns_packet_lookup_t;
 
-jdns_packet_label_t *jdns_packet_label_copy(const jdns_packet_label_t *a)
+// enough for the labels of a typical packet
+#define LOOKUP_ARENA_SIZE 4096
+#define LOOKUP_TABLE_SIZE 64
+
+// compression pointers have 14 bits
+#define MAX_POINTER_OFFSET 0x3fff
+
+static void lookup_init(jdns_packet_lookup_t *lookup)
 {
-	jdns_packet_label_t *c = jdns_packet_label_new();
-	c->offset = a->offset;
-	if(a->value)
-		c->value = jdns_string_copy(a->value);
-	return c;
+	int size = sizeof(jdns_packet_label_t *) * LOOKUP_TABLE_SIZE;
+	lookup->arena = jdns_arena_new(LOOKUP_ARENA_SIZE);
+	lookup->table = (jdns_packet_label_t **)jdns_arena_alloc(lookup->arena, size);
+	memset(lookup->table, 0, size);
+	lookup->table_size = LOOKUP_TABLE_SIZE;
+	lookup->count = 0;
 }
 
-void jdns_packet_label_delete(jdns_packet_label_t *a)
+static void lookup_insert(jdns_packet_lookup_t *lookup, jdns_packet_label_t *pl)
 {
-	if(!a)
-		return;
-	jdns_string_delete(a->value);
-	jdns_object_free(a);
+	jdns_packet_label_t **b;
+
+	// keep chains short.  the old table stays in the arena until the end
+	if(lookup->count >= lookup->table_size)
+	{
+		int n, newsize = lookup->table_size * 2;
+		jdns_packet_label_t **table = (jdns_packet_label_t **)jdns_arena_alloc(lookup->arena, sizeof(jdns_packet_label_t *) * newsize);
+		memset(table, 0, sizeof(jdns_packet_label_t *) * newsize);
+		for(n = 0; n < lookup->table_size; ++n)
+		{
+			jdns_packet_label_t *i, *next;
+			for(i = lookup->table[n]; i; i = next)
+			{
+				next = i->next;
+				b = &table[i->hash & (newsize - 1)];
+				i->next = *b;
+				*b = i;
+			}
+		}
+		lookup->table = table;
+		lookup->table_size = newsize;
+	}
+
+	b = &lookup->table[pl->hash & (lookup->table_size - 1)];
+	pl->next = *b;
+	*b = pl;
+	++lookup->count;
 }
 
 // gets an offset for decompression.  does range and hop count checking also
@@ -302,8 +336,12 @@ int jdns_packet_name_isvalid(const unsigned char *name, int size)
 	if(name[size - 1] != '.')
 		return 0;
 
+	// the root is just the dot
+	if(size == 1)
+		return 1;
+
 	// first byte can't be a dot if there are characters after
-	if(size > 1 && name[0] == '.')
+	if(name[0] == '.')
 		return 0;
 
 	// each sublabel must be between 1 and MAX_SUBLABEL_LENGTH in length
@@ -369,28 +407,47 @@ static int name_to_label(const jdns_string_t *name, unsigned char *label)
 	return i;
 }
 
-// lookup list is made of jdns_packet_labels
-static int writelabel(const jdns_string_t *name, int at, int left, unsigned char **bufp, jdns_list_t *lookup)
+static int writelabel(const jdns_string_t *name, int at, int left, unsigned char **bufp, jdns_packet_lookup_t *lookup)
 {
 	unsigned char label[MAX_LABEL_LENGTH];
-	int n, i, len;
+	// each sublabel takes at least two bytes
+	int pos[MAX_LABEL_LENGTH / 2];
+	unsigned int hash[MAX_LABEL_LENGTH / 2];
+	int n, k, count, len;
 	unsigned char *l;
 	unsigned char *ref;
 	int refsize;
+	jdns_packet_label_t *pl;
 
 	len = name_to_label(name, label);
 	if(len == -1)
 		return 0;
 
-	ref = *bufp - at;
-	refsize = at + left;
+	// hash every suffix, from the root up: each one is the FNV-1a of its
+	//   first sublabel continued from the hash of the rest
+	count = 0;
 	for(n = 0; label[n]; n += label[n] + 1)
+		pos[count++] = n;
+	for(k = count - 1; k >= 0; --k)
 	{
-		for(i = 0; i < lookup->count; ++i)
+		unsigned int h = (k + 1 < count) ? hash[k + 1] : 2166136261u;
+		int i;
+		for(i = pos[k]; i < pos[k] + label[pos[k]] + 1; ++i)
 		{
-			jdns_packet_label_t *pl = (jdns_packet_label_t *)lookup->item[i];
+			h ^= label[i];
+			h *= 16777619u;
+		}
+		hash[k] = h;
+	}
 
-			if(matchlabel(label + n, len - n, pl->value->data, pl->value->size, ref, refsize, 8, 8))
+	ref = *bufp - at;
+	refsize = at + left;
+	for(k = 0; k < count; ++k)
+	{
+		n = pos[k];
+		for(pl = lookup->table[hash[k] & (lookup->table_size - 1)]; pl; pl = pl->next)
+		{
+			if(pl->hash == hash[k] && matchlabel(label + n, len - n, pl->value, pl->size, ref, refsize, 8, 8))
 			{
 				// set up a pointer right here, overwriting
 				//   the length byte and the first content
@@ -419,24 +476,46 @@ static int writelabel(const jdns_string_t *name, int at, int left, unsigned char
 	*bufp += len;
 
 	// for each new label, store its location for future compression
-	for(n = 0; l[n]; n += l[n] + 1)
+	for(k = 0, n = 0; l[n]; ++k, n += l[n] + 1)
 	{
-		jdns_string_t *str;
-		jdns_packet_label_t *pl;
 		if(l[n] & 0xc0)
 			break;
 
-		pl = jdns_packet_label_new();
-		str = jdns_string_new();
-		jdns_string_set(str, l + n, len - n);
+		// too far in to point at
+		if(l + n - ref > MAX_POINTER_OFFSET)
+			break;
+
+		pl = (jdns_packet_label_t *)jdns_arena_alloc(lookup->arena, sizeof(jdns_packet_label_t));
 		pl->offset = l + n - ref;
-		pl->value = str;
-		jdns_list_insert(lookup, pl, -1);
+		pl->value = l + n;
+		pl->size = len - n;
+		pl->hash = hash[k];
+		lookup_insert(lookup, pl);
 	}
 
 	return 1;
 }
 
+// value lists copy what is inserted.  these hand over an item made just for
+//   the list instead, with room for 'room' more items reserved up front.
+static void list_reserve(jdns_list_t *a, int count, int *room)
+{
+	*room = 0;
+	if(count <= 0)
+		return;
+	a->item = (void **)jdns_realloc(a->item, sizeof(void *) * (a->count + count));
+	*room = count;
+}
+
+static void list_append_owned(jdns_list_t *a, void *item, int *room)
+{
+	if(*room > 0)
+		--(*room);
+	else
+		a->item = (void **)jdns_realloc(a->item, sizeof(void *) * (a->count + 1));
+	a->item[a->count++] = item;
+}
+
 //----------------------------------------------------------------------------
 // jdns_packet_write
 //----------------------------------------------------------------------------
@@ -521,11 +600,20 @@ jdns_packet_resource_t *jdns_packet_resource_new()
 	a->rdlength = 0;
 	a->rdata = 0;
 
-	a->writelog = jdns_list_new();
-	a->writelog->valueList = 1;
+	// only records being written need one
+	a->writelog = 0;
 	return a;
 }
 
+static void ensure_writelog(jdns_packet_resource_t *a)
+{
+	if(!a->writelog)
+	{
+		a->writelog = jdns_list_new();
+		a->writelog->valueList = 1;
+	}
+}
+
 jdns_packet_resource_t *jdns_packet_resource_copy(const jdns_packet_resource_t *a)
 {
 	jdns_packet_resource_t *c = jdns_packet_resource_new();
@@ -536,9 +624,8 @@ jdns_packet_resource_t *jdns_packet_resource_copy(const jdns_packet_resource_t *
 	c->ttl = a->ttl;
 	c->rdlength = a->rdlength;
 	c->rdata = jdns_copy_array(a->rdata, a->rdlength);
-
-	jdns_list_delete(c->writelog);
-	c->writelog = jdns_list_copy(a->writelog);
+	if(a->writelog)
+		c->writelog = jdns_list_copy(a->writelog);
 	return c;
 }
 
@@ -555,21 +642,23 @@ void jdns_packet_resource_delete(jdns_packet_resource_t *a)
 
 void jdns_packet_resource_add_bytes(jdns_packet_resource_t *a, const unsigned char *data, int size)
 {
+	int room = 0;
 	jdns_packet_write_t *write = jdns_packet_write_new();
 	write->type = JDNS_PACKET_WRITE_RAW;
 	write->value = jdns_string_new();
 	jdns_string_set(write->value, data, size);
-	jdns_list_insert_value(a->writelog, write, -1);
-	jdns_packet_write_delete(write);
+	ensure_writelog(a);
+	list_append_owned(a->writelog, write, &room);
 }
 
 void jdns_packet_resource_add_name(jdns_packet_resource_t *a, const jdns_string_t *name)
 {
+	int room = 0;
 	jdns_packet_write_t *write = jdns_packet_write_new();
 	write->type = JDNS_PACKET_WRITE_NAME;
 	write->value = jdns_string_copy(name);
-	jdns_list_insert_value(a->writelog, write, -1);
-	jdns_packet_write_delete(write);
+	ensure_writelog(a);
+	list_append_owned(a->writelog, write, &room);
 }
 
 int jdns_packet_resource_read_name(const jdns_packet_resource_t *a, const jdns_packet_t *p, int *at, jdns_string_t **name)
@@ -588,11 +677,14 @@ int jdns_packet_resource_read_name(const jdns_packet_resource_t *a, const jdns_p
 static int process_qsection(jdns_list_t *dest, int count, const unsigned char *data, int size, const unsigned char **bufp)
 {
 	int n;
-	int offset, at;
+	int offset, at, room;
 	jdns_string_t *name = 0;
 	const unsigned char *buf;
 
 	buf = *bufp;
+
+	// a question takes at least 5 bytes, don't reserve for more than fit
+	list_reserve(dest, count < (size - (buf - data)) / 5 ? count : (size - (buf - data)) / 5, &room);
 	for(n = 0; n < count; ++n)
 	{
 		jdns_packet_question_t *q;
@@ -617,8 +709,7 @@ static int process_qsection(jdns_list_t *dest, int count, const unsigned char *d
 		q->qtype = net2short(&buf);
 		q->qclass = net2short(&buf);
 
-		jdns_list_insert_value(dest, q, -1);
-		jdns_packet_question_delete(q);
+		list_append_owned(dest, q, &room);
 	}
 
 	*bufp = buf;
@@ -632,11 +723,14 @@ error:
 static int process_rrsection(jdns_list_t *dest, int count, const unsigned char *data, int size, const unsigned char **bufp)
 {
 	int n;
-	int offset, at;
+	int offset, at, room;
 	jdns_string_t *name = 0;
 	const unsigned char *buf;
 
 	buf = *bufp;
+
+	// likewise a record takes at least 11
+	list_reserve(dest, count < (size - (buf - data)) / 11 ? count : (size - (buf - data)) / 11, &room);
 	for(n = 0; n < count; ++n)
 	{
 		jdns_packet_resource_t *r;
@@ -682,8 +776,7 @@ static int process_rrsection(jdns_list_t *dest, int count, const unsigned char *
 		r->rdata = jdns_copy_array(buf, r->rdlength);
 		buf += r->rdlength;
 
-		jdns_list_insert_value(dest, r, -1);
-		jdns_packet_resource_delete(r);
+		list_append_owned(dest, r, &room);
 	}
 
 	*bufp = buf;
@@ -694,7 +787,7 @@ error:
 	return 0;
 }
 
-static int append_qsection(const jdns_list_t *src, int at, int left, unsigned char **bufp, jdns_list_t *lookup)
+static int append_qsection(const jdns_list_t *src, int at, int left, unsigned char **bufp, jdns_packet_lookup_t *lookup)
 {
 	unsigned char *buf, *start, *last;
 	int n;
@@ -723,7 +816,7 @@ error:
 	return 0;
 }
 
-static int append_rrsection(const jdns_list_t *src, int at, int left, unsigned char **bufp, jdns_list_t *lookup)
+static int append_rrsection(const jdns_list_t *src, int at, int left, unsigned char **bufp, jdns_packet_lookup_t *lookup)
 {
 	unsigned char *buf, *start, *last, *rdlengthp;
 	int n, i, rdlength;
@@ -751,7 +844,7 @@ static int append_rrsection(const jdns_list_t *src, int at, int left, unsigned c
 
 		// play write log
 		rdlength = 0;
-		for(i = 0; i < r->writelog->count; ++i)
+		for(i = 0; r->writelog && i < r->writelog->count; ++i)
 		{
 			jdns_packet_write_t *write = (jdns_packet_write_t *)r->writelog->item[i];
 			if(write->type == JDNS_PACKET_WRITE_RAW)
@@ -926,7 +1019,7 @@ int jdns_packet_export(jdns_packet_t *a, int maxsize)
 	unsigned char *buf, *last;
 	unsigned char c;
 	int size;
-	jdns_list_t *lookup = 0; // to hold jdns_packet_label_t
+	jdns_packet_lookup_t lookup;
 
 	// clear out any existing raw data before we begin
 	if(a->raw_data)
@@ -936,6 +1029,8 @@ int jdns_packet_export(jdns_packet_t *a, int maxsize)
 		a->raw_size = 0;
 	}
 
+	lookup.arena = 0;
+
 	// preallocate
 	size = maxsize;
 	block = (unsigned char *)jdns_alloc(size);
@@ -971,20 +1066,19 @@ int jdns_packet_export(jdns_packet_t *a, int maxsize)
 	short2net((unsigned short int)a->additionalRecords->count, &buf);
 
 	// append sections
-	lookup = jdns_list_new();
-	lookup->autoDelete = 1;
+	lookup_init(&lookup);
 
-	if(!append_qsection(a->questions, buf - block, last - buf, &buf, lookup))
+	if(!append_qsection(a->questions, buf - block, last - buf, &buf, &lookup))
 		goto error;
-	if(!append_rrsection(a->answerRecords, buf - block, last - buf, &buf, lookup))
+	if(!append_rrsection(a->answerRecords, buf - block, last - buf, &buf, &lookup))
 		goto error;
-	if(!append_rrsection(a->authorityRecords, buf - block, last - buf, &buf, lookup))
+	if(!append_rrsection(a->authorityRecords, buf - block, last - buf, &buf, &lookup))
 		goto error;
-	if(!append_rrsection(a->additionalRecords, buf - block, last - buf, &buf, lookup))
+	if(!append_rrsection(a->additionalRecords, buf - block, last - buf, &buf, &lookup))
 		goto error;
 
 	// done with all sections
-	jdns_list_delete(lookup);
+	jdns_arena_delete(lookup.arena);
 
 	// condense
 	size = buf - block;
@@ -1001,7 +1095,7 @@ int jdns_packet_export(jdns_packet_t *a, int maxsize)
 	return 1;
 
 error:
-	jdns_list_delete(lookup);
+	jdns_arena_delete(lookup.arena);
 	if(block)
 		jdns_free(block);
 	return 0;
@@ -269,6 +269,18 @@ static jdns_string_t *file_nextline(FILE *f)
 	return str;
 }
 
+// appends h to a list that only ever grows this way, taking it over.  the
+//   array grows in powers of two rather than by one entry per host, since
+//   hosts files can be large.
+static void hostlist_take(jdns_dnshostlist_t *a, jdns_dnshost_t *h)
+{
+	if(!a->item)
+		a->item = (jdns_dnshost_t **)jdns_alloc(sizeof(jdns_dnshost_t *));
+	else if((a->count & (a->count - 1)) == 0)
+		a->item = (jdns_dnshost_t **)jdns_realloc(a->item, sizeof(jdns_dnshost_t *) * a->count * 2);
+	a->item[a->count++] = h;
+}
+
 static jdns_dnshostlist_t *read_hosts_file(const char *path)
 {
 	jdns_dnshostlist_t *out;
@@ -322,8 +334,7 @@ static jdns_dnshostlist_t *read_hosts_file(const char *path)
 			jdns_dnshost_t *h = jdns_dnshost_new();
 			h->name = jdns_string_copy(parts->item[n]);
 			h->address = jdns_address_copy(addr);
-			jdns_dnshostlist_append(out, h);
-			jdns_dnshost_delete(h);
+			hostlist_take(out, h);
 		}
 
 		jdns_address_delete(addr);
@@ -339,8 +350,20 @@ static void apply_hosts_file(jdns_dnsparams_t *a, const char *path)
 	jdns_dnshostlist_t *list;
 
 	list = read_hosts_file(path);
+	if(list->count == 0)
+	{
+		jdns_dnshostlist_delete(list);
+		return;
+	}
+
+	// move the entries over rather than copying them
+	if(!a->hosts->item)
+		a->hosts->item = (jdns_dnshost_t **)jdns_alloc(sizeof(jdns_dnshost_t *) * list->count);
+	else
+		a->hosts->item = (jdns_dnshost_t **)jdns_realloc(a->hosts->item, sizeof(jdns_dnshost_t *) * (a->hosts->count + list->count));
 	for(n = 0; n < list->count; ++n)
-		jdns_dnshostlist_append(a->hosts, list->item[n]);
+		a->hosts->item[a->hosts->count++] = list->item[n];
+	list->count = 0;
 	jdns_dnshostlist_delete(list);
 }
 
@@ -163,6 +163,78 @@ char *jdns_strcpy(char *dst, const char *src)
 #endif
 }
 
+//----------------------------------------------------------------------------
+// jdns_arena
+//----------------------------------------------------------------------------
+typedef struct jdns_arena_block
+{
+	struct jdns_arena_block *next;
+	int size, used;
+} jdns_arena_block_t;
+
+struct jdns_arena
+{
+	jdns_arena_block_t *blocks;
+	int blocksize;
+};
+
+// keep every allocation aligned for any type
+#define ARENA_ALIGN(x) (((x) + 7) & ~7)
+#define ARENA_ARENA_SIZE ARENA_ALIGN((int)sizeof(jdns_arena_t))
+#define ARENA_HEADER_SIZE ARENA_ALIGN((int)sizeof(jdns_arena_block_t))
+
+jdns_arena_t *jdns_arena_new(int blocksize)
+{
+	jdns_arena_t *a;
+	jdns_arena_block_t *b;
+
+	blocksize = ARENA_ALIGN(blocksize);
+	a = (jdns_arena_t *)jdns_alloc(ARENA_ARENA_SIZE + ARENA_HEADER_SIZE + blocksize);
+	b = (jdns_arena_block_t *)((char *)a + ARENA_ARENA_SIZE);
+	b->next = 0;
+	b->size = blocksize;
+	b->used = 0;
+	a->blocks = b;
+	a->blocksize = blocksize;
+	return a;
+}
+
+void *jdns_arena_alloc(jdns_arena_t *a, int size)
+{
+	jdns_arena_block_t *b = a->blocks;
+	void *p;
+
+	size = ARENA_ALIGN(size);
+	if(b->size - b->used < size)
+	{
+		int bsize = size > a->blocksize ? size : a->blocksize;
+		b = (jdns_arena_block_t *)jdns_alloc(ARENA_HEADER_SIZE + bsize);
+		b->next = a->blocks;
+		b->size = bsize;
+		b->used = 0;
+		a->blocks = b;
+	}
+
+	p = (char *)b + ARENA_HEADER_SIZE + b->used;
+	b->used += size;
+	return p;
+}
+
+void jdns_arena_delete(jdns_arena_t *a)
+{
+	jdns_arena_block_t *b, *next;
+	if(!a)
+		return;
+
+	// the last block in the chain is part of the arena allocation
+	for(b = a->blocks; b->next; b = next)
+	{
+		next = b->next;
+		jdns_free(b);
+	}
+	jdns_free(a);
+}
+
 //----------------------------------------------------------------------------
 // jdns_object
 //----------------------------------------------------------------------------
@@ -82,6 +82,44 @@ void print_record(const QJDns::Record &r)
 	}
 }
 
+int type_from_string(const QString &type)
+{
+	int x = QJDns::A;
+	if(type == "ptr")
+		x = QJDns::Ptr;
+	else if(type == "srv")
+		x = QJDns::Srv;
+	else if(type == "a")
+		x = QJDns::A;
+	else if(type == "aaaa")
+		x = QJDns::Aaaa;
+	else if(type == "mx")
+		x = QJDns::Mx;
+	else if(type == "txt")
+		x = QJDns::Txt;
+	else if(type == "hinfo")
+		x = QJDns::Hinfo;
+	else if(type == "cname")
+		x = QJDns::Cname;
+	else if(type == "any")
+		x = QJDns::Any;
+	else
+	{
+		bool ok;
+		int y = type.toInt(&ok);
+		if(ok)
+			x = y;
+	}
+	return x;
+}
+
+int percentile(const QList<int> &sorted, int p)
+{
+	if(sorted.isEmpty())
+		return 0;
+	return sorted[qMin(sorted.count() - 1, sorted.count() * p / 100)];
+}
+
 class App : public QObject
 {
 	Q_OBJECT
@@ -94,6 +132,18 @@ public:
 	QJDns jdns;
 	int req_id;
 
+	// bench and mflood.  names are queried in turn, so that a list
+	//   shorter than the count exercises the cache
+	int opt_count, opt_concurrency;
+	QList<QByteArray> names;
+	int qtype;
+	bool publishing;
+	int issued, finished;
+	QHash<int,int> startedAt; // request id -> msecs on clock
+	QTime clock;
+	QList<int> latencies;
+	int nxdomains, timeouts, conflicts, others;
+
 	App()
 	{
 		connect(&jdns, SIGNAL(resultsReady(int, const QJDns::Response &)), SLOT(jdns_resultsReady(int, const QJDns::Response &)));
@@ -110,7 +160,7 @@ public:
 public slots:
 	void start()
 	{
-		if(mode == "uni")
+		if(mode == "uni" || mode == "bench")
 		{
 			if(!jdns.init(QJDns::Unicast, opt_ipv6 ? QHostAddress::AnyIPv6 : QHostAddress::Any))
 			{
@@ -181,36 +231,35 @@ public slots:
 
 		if(mode == "uni" || mode == "mul")
 		{
-			int x = QJDns::A;
-			if(type == "ptr")
-				x = QJDns::Ptr;
-			else if(type == "srv")
-				x = QJDns::Srv;
-			else if(type == "a")
-				x = QJDns::A;
-			else if(type == "aaaa")
-				x = QJDns::Aaaa;
-			else if(type == "mx")
-				x = QJDns::Mx;
-			else if(type == "txt")
-				x = QJDns::Txt;
-			else if(type == "hinfo")
-				x = QJDns::Hinfo;
-			else if(type == "cname")
-				x = QJDns::Cname;
-			else if(type == "any")
-				x = QJDns::Any;
-			else
-			{
-				bool ok;
-				int y = type.toInt(&ok);
-				if(ok)
-					x = y;
-			}
-
+			int x = type_from_string(type);
 			req_id = jdns.queryStart(name.toLatin1(), x);
 			printf("[%d] Querying for [%s] type=%d ...\n", req_id, qPrintable(name), x);
 		}
+		else if(mode == "bench")
+		{
+			qtype = type_from_string(type);
+			QStringList list = name.split(',', QString::SkipEmptyParts);
+			for(int n = 0; n < list.count(); ++n)
+				names += list[n].toLatin1();
+			if(names.isEmpty())
+			{
+				printf("no names to query\n");
+				emit quit();
+				return;
+			}
+			printf("Benchmarking %d queries type=%d over %d names, %d at a time ...\n", opt_count, qtype, names.count(), opt_concurrency);
+			startRun(false);
+		}
+		else if(mode == "mflood")
+		{
+			// unique names, published first and then looked up
+			qtype = QJDns::A;
+			QByteArray base = "jdns-flood-" + QByteArray::number(QCoreApplication::applicationPid());
+			for(int n = 0; n < opt_count; ++n)
+				names += base + '-' + QByteArray::number(n) + ".local.";
+			printf("Publishing %d records, %d at a time ...\n", opt_count, opt_concurrency);
+			startRun(true);
+		}
 		else // publish
 		{
 			for(int n = 0; n < pubitems.count(); ++n)
@@ -234,6 +283,15 @@ signals:
 private slots:
 	void jdns_resultsReady(int id, const QJDns::Response &results)
 	{
+		if(mode == "bench" || mode == "mflood")
+		{
+			// multicast queries go on until cancelled
+			if(mode == "mflood")
+				jdns.queryCancel(id);
+			runItemDone(id, -1);
+			return;
+		}
+
 		printf("[%d] Results\n", id);
 		for(int n = 0; n < results.answerRecords.count(); ++n)
 			print_record(results.answerRecords[n]);
@@ -244,11 +302,23 @@ private slots:
 
 	void jdns_published(int id)
 	{
+		if(mode == "mflood")
+		{
+			runItemDone(id, -1);
+			return;
+		}
+
 		printf("[%d] Published\n", id);
 	}
 
 	void jdns_error(int id, QJDns::Error e)
 	{
+		if(mode == "bench" || mode == "mflood")
+		{
+			runItemDone(id, e);
+			return;
+		}
+
 		QString str;
 		if(e == QJDns::ErrorGeneric)
 			str = "Generic";
@@ -279,8 +349,110 @@ private slots:
 
 	void doShutdown()
 	{
+		if(mode == "bench" || mode == "mflood")
+			report();
 		jdns.shutdown();
 	}
+
+private:
+	void startRun(bool publish)
+	{
+		publishing = publish;
+		issued = 0;
+		finished = 0;
+		startedAt.clear();
+		latencies.clear();
+		nxdomains = 0;
+		timeouts = 0;
+		conflicts = 0;
+		others = 0;
+		clock.start();
+		fill();
+	}
+
+	void fill()
+	{
+		while(issued < opt_count && startedAt.count() < opt_concurrency)
+		{
+			const QByteArray &n = names[issued % names.count()];
+			int id;
+			if(publishing)
+			{
+				QJDns::Record rec;
+				rec.owner = n;
+				rec.type = QJDns::A;
+				rec.ttl = 120;
+				rec.haveKnown = true;
+				rec.address = QHostAddress(QString("192.0.2.%1").arg(issued % 254 + 1)); // TEST-NET-1
+				id = jdns.publishStart(QJDns::Unique, rec);
+			}
+			else
+				id = jdns.queryStart(n, qtype);
+			startedAt.insert(id, clock.elapsed());
+			++issued;
+		}
+	}
+
+	// e is a QJDns::Error, or -1 for success
+	void runItemDone(int id, int e)
+	{
+		QHash<int,int>::Iterator it = startedAt.find(id);
+		if(it == startedAt.end())
+			return;
+		int started = it.value();
+		startedAt.erase(it);
+
+		if(e == -1)
+			latencies += clock.elapsed() - started;
+		else if(e == QJDns::ErrorNXDomain)
+			++nxdomains;
+		else if(e == QJDns::ErrorTimeout)
+			++timeouts;
+		else if(e == QJDns::ErrorConflict)
+			++conflicts;
+		else
+			++others;
+
+		++finished;
+		if(finished < opt_count)
+		{
+			fill();
+			return;
+		}
+
+		report();
+
+		// on to looking up what was just published.  the records stay
+		//   published until shutdown
+		if(mode == "mflood" && publishing)
+		{
+			printf("Querying %d records, %d at a time ...\n", opt_count, opt_concurrency);
+			startRun(false);
+			return;
+		}
+
+		jdns.shutdown();
+	}
+
+	void report()
+	{
+		int msecs = clock.elapsed();
+		printf("%d of %d %s in %d ms, %.0f/sec\n", finished, opt_count, publishing ? "published" : "answered",
+			msecs, msecs > 0 ? finished * 1000.0 / msecs : 0.0);
+
+		QList<int> sorted = latencies;
+		qSort(sorted);
+		if(!sorted.isEmpty())
+			printf("  latency: p50 %d ms, p90 %d ms, p99 %d ms, max %d ms\n", percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99), sorted.last());
+		printf("  errors: nxdomain %d, timeout %d, conflict %d, other %d\n", nxdomains, timeouts, conflicts, others);
+
+		// counted over the whole session
+		QJDns::Statistics st = jdns.statistics();
+		int lookups = st.cacheHits + st.cacheMisses;
+		printf("  session: %d queries, %d joined, cache hits %d of %d (%.0f%%), %d retransmissions, %d over tcp, %d packets sent, %d received\n",
+			st.queries, st.queriesJoined, st.cacheHits, lookups, lookups > 0 ? st.cacheHits * 100.0 / lookups : 0.0,
+			st.retransmissions, st.tcpQueries, st.packetsSent, st.packetsReceived);
+	}
 };
 
 #include "main.moc"
@@ -290,12 +462,20 @@ void usage()
 	printf("usage: jdns (options) uni [type] [name] (nameserver(;port)|mul ...)\n");
 	printf("       jdns (options) mul [type] [name]\n");
 	printf("       jdns (options) pub [items ...]\n");
+	printf("       jdns (options) bench [type] [name,...] (nameserver(;port) ...)\n");
+	printf("       jdns (options) mflood\n");
 	printf("       jdns sys\n");
 	printf("\n");
 	printf("options:\n");
 	printf("  -d     show debug output\n");
 	printf("  -6     use ipv6\n");
 	printf("  -q x   quit x seconds after starting\n");
+	printf("  -n x   bench/mflood: number of queries or records (default 1000)\n");
+	printf("  -c x   bench/mflood: how many at a time (default 50)\n");
+	printf("\n");
+	printf("bench queries the names in turn, so fewer names than queries measures the\n");
+	printf("cache.  mflood publishes unique .local records over mdns and then queries them.\n");
+	printf("both report throughput, latency, errors and the session counters.\n");
 	printf("\n");
 	printf("uni/mul types: a aaaa ptr srv mx txt hinfo cname any\n");
 	printf("pub items: ptr:name,answer srv:name,answer,port a:name,ipaddr\n");
@@ -308,6 +488,8 @@ void usage()
 	printf("  jdns mul a foobar.local\n");
 	printf("  jdns mul ptr _services._dns-sd._udp.local\n");
 	printf("  jdns pub a:mybox.local.,192.168.0.55\n");
+	printf("  jdns -n 10000 -c 200 bench srv _xmpp-client._tcp.jabber.org,_xmpp-server._tcp.jabber.org\n");
+	printf("  jdns -n 200 mflood\n");
 	printf("\n");
 }
 
@@ -330,6 +512,8 @@ int main(int argc, char **argv)
 	bool opt_ipv6 = false;
 	bool opt_quit = false;
 	int quit_time = 0;
+	int opt_count = 1000;
+	int opt_concurrency = 50;
 	QString mode, type, name, ipaddr;
 	QStringList nslist;
 	QList<QJDns::Record> pubitems;
@@ -361,6 +545,30 @@ int main(int argc, char **argv)
 
 				args.removeAt(n + 1);
 			}
+			else if(args[n] == "-n" || args[n] == "-c")
+			{
+				if(n + 1 >= args.count())
+				{
+					printf("need to specify a number\n");
+					usage();
+					return 1;
+				}
+
+				int x = args[n + 1].toInt();
+				if(x < 1)
+				{
+					printf("bad number\n");
+					usage();
+					return 1;
+				}
+
+				if(args[n] == "-n")
+					opt_count = x;
+				else
+					opt_concurrency = x;
+
+				args.removeAt(n + 1);
+			}
 			else
 			{
 				printf("bad option\n");
@@ -372,8 +580,14 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if(args.isEmpty())
+	{
+		usage();
+		return 1;
+	}
+
 	mode = args[0];
-	if(mode == "uni" || mode == "mul")
+	if(mode == "uni" || mode == "mul" || mode == "bench")
 	{
 		if(args.count() < 3)
 		{
@@ -383,12 +597,16 @@ int main(int argc, char **argv)
 		}
 		type = args[1];
 		name = args[2];
-		if(mode == "uni")
+		if(mode == "uni" || mode == "bench")
 		{
 			for(int n = 3; n < args.count(); ++n)
 				nslist += QString(args[n]);
 		}
 	}
+	else if(mode == "mflood")
+	{
+		// no arguments
+	}
 	else if(mode == "pub")
 	{
 		if(args.count() < 2)
@@ -589,6 +807,8 @@ int main(int argc, char **argv)
 	a.ipaddr = ipaddr;
 	a.nslist = nslist;
 	a.pubitems = pubitems;
+	a.opt_count = opt_count;
+	a.opt_concurrency = opt_concurrency;
 	QObject::connect(&a, SIGNAL(quit()), &app, SLOT(quit()));
 	QTimer::singleShot(0, &a, SLOT(start()));
 	app.exec();
@@ -248,6 +248,18 @@ QJDns::NameServer::NameServer()
 	port = JDNS_UNICAST_PORT;
 }
 
+QJDns::Statistics::Statistics() :
+	queries(0),
+	queriesJoined(0),
+	cacheHits(0),
+	cacheMisses(0),
+	packetsSent(0),
+	packetsReceived(0),
+	retransmissions(0),
+	tcpQueries(0)
+{
+}
+
 //----------------------------------------------------------------------------
 // QJDns::Record
 //----------------------------------------------------------------------------
@@ -313,10 +325,14 @@ public:
 	QTime clock;
 	QStringList debug_strings;
 	bool new_debug_strings;
+	bool debug_enabled;
 	int next_handle;
 	bool need_handle;
 	QHash<int,QUdpSocket*> socketForHandle;
 	QHash<QUdpSocket*,int> handleForSocket;
+	QHash<int,QTcpSocket*> tcpForHandle;
+	QHash<QTcpSocket*,int> handleForTcp;
+	QHash<QTcpSocket*,QByteArray> tcpPendingWrites; // until connected
 	int pending;
 	bool pending_wait;
 	bool complete_shutdown;
@@ -341,6 +357,7 @@ public:
 		sess = 0;
 		shutting_down = false;
 		new_debug_strings = false;
+		debug_enabled = true;
 		pending = 0;
 
 		connect(&stepTrigger, SIGNAL(timeout()), SLOT(doNextStepSlot()));
@@ -379,6 +396,10 @@ public:
 		qDeleteAll(socketForHandle);
 		socketForHandle.clear();
 		handleForSocket.clear();
+		qDeleteAll(tcpForHandle);
+		tcpForHandle.clear();
+		handleForTcp.clear();
+		tcpPendingWrites.clear();
 
 		stepTrigger.stop();
 		stepTimeout.stop();
@@ -398,8 +419,13 @@ public:
 		callbacks.udp_unbind = cb_udp_unbind;
 		callbacks.udp_read = cb_udp_read;
 		callbacks.udp_write = cb_udp_write;
+		callbacks.tcp_connect = cb_tcp_connect;
+		callbacks.tcp_close = cb_tcp_close;
+		callbacks.tcp_read = cb_tcp_read;
+		callbacks.tcp_write = cb_tcp_write;
 		sess = jdns_session_new(&callbacks);
 		jdns_set_hold_ids_enabled(sess, 1);
+		jdns_set_debug_enabled(sess, debug_enabled ? 1 : 0);
 		next_handle = 1;
 		need_handle = false;
 
@@ -659,11 +685,14 @@ private slots:
 		}
 		else
 		{
-			// eat packet
-			QByteArray buf(4096, 0);
-			QHostAddress from_addr;
-			quint16 from_port;
-			sock->readDatagram(buf.data(), buf.size(), &from_addr, &from_port);
+			// eat everything waiting, or there would be another
+			//   readyRead for each packet
+			char buf[4096];
+			while(sock->hasPendingDatagrams())
+			{
+				if(sock->readDatagram(buf, sizeof(buf)) == -1)
+					break;
+			}
 		}
 	}
 
@@ -681,6 +710,38 @@ private slots:
 		}
 	}
 
+	// data arriving, the connection ending or failing are all picked up
+	//   by jdns with the next read
+	void tcp_readyRead()
+	{
+		QTcpSocket *sock = (QTcpSocket *)sender();
+		int handle = handleForTcp.value(sock);
+		if(!handle)
+			return;
+
+		jdns_set_handle_readable(sess, handle);
+		process();
+	}
+
+	void tcp_connected()
+	{
+		QTcpSocket *sock = (QTcpSocket *)sender();
+		QByteArray buf = tcpPendingWrites.take(sock);
+		if(!buf.isEmpty())
+			sock->write(buf);
+	}
+
+	void tcp_error(QAbstractSocket::SocketError)
+	{
+		QTcpSocket *sock = (QTcpSocket *)sender();
+		int handle = handleForTcp.value(sock);
+		if(!handle)
+			return;
+
+		jdns_set_handle_readable(sess, handle);
+		process();
+	}
+
 	void st_timeout()
 	{
 		doNextStep();
@@ -840,6 +901,76 @@ private:
 		++self->pending;
 		return 1;
 	}
+
+	static int cb_tcp_connect(jdns_session_t *, void *app, const jdns_address_t *addr, int port)
+	{
+		QJDns::Private *self = (QJDns::Private *)app;
+
+		QTcpSocket *sock = new QTcpSocket(self);
+		self->connect(sock, SIGNAL(connected()), SLOT(tcp_connected()));
+		self->connect(sock, SIGNAL(readyRead()), SLOT(tcp_readyRead()));
+		self->connect(sock, SIGNAL(disconnected()), SLOT(tcp_readyRead()));
+		self->connect(sock, SIGNAL(error(QAbstractSocket::SocketError)), SLOT(tcp_error(QAbstractSocket::SocketError)));
+		sock->connectToHost(addr2qt(addr), port);
+
+		int handle = self->next_handle++;
+		self->tcpForHandle.insert(handle, sock);
+		self->handleForTcp.insert(sock, handle);
+		return handle;
+	}
+
+	static void cb_tcp_close(jdns_session_t *, void *app, int handle)
+	{
+		QJDns::Private *self = (QJDns::Private *)app;
+
+		QTcpSocket *sock = self->tcpForHandle.value(handle);
+		if(!sock)
+			return;
+
+		self->tcpForHandle.remove(handle);
+		self->handleForTcp.remove(sock);
+		self->tcpPendingWrites.remove(sock);
+		releaseAndDeleteLater(self, sock);
+	}
+
+	static int cb_tcp_read(jdns_session_t *, void *app, int handle, unsigned char *buf, int *bufsize)
+	{
+		QJDns::Private *self = (QJDns::Private *)app;
+
+		QTcpSocket *sock = self->tcpForHandle.value(handle);
+		if(!sock)
+			return -1;
+
+		// hand over what is left before reporting the end
+		if(sock->bytesAvailable() > 0)
+		{
+			int ret = sock->read((char *)buf, *bufsize);
+			if(ret > 0)
+			{
+				*bufsize = ret;
+				return 1;
+			}
+		}
+
+		if(sock->state() == QAbstractSocket::UnconnectedState)
+			return -1;
+		return 0;
+	}
+
+	static int cb_tcp_write(jdns_session_t *, void *app, int handle, const unsigned char *buf, int bufsize)
+	{
+		QJDns::Private *self = (QJDns::Private *)app;
+
+		QTcpSocket *sock = self->tcpForHandle.value(handle);
+		if(!sock || sock->state() == QAbstractSocket::UnconnectedState)
+			return 0;
+
+		if(sock->state() == QAbstractSocket::ConnectedState)
+			sock->write((const char *)buf, bufsize);
+		else
+			self->tcpPendingWrites[sock].append((const char *)buf, bufsize);
+		return 1;
+	}
 };
 
 QJDns::QJDns(QObject *parent)
@@ -867,6 +998,15 @@ void QJDns::shutdown()
 	d->process();
 }
 
+void QJDns::setDebugEnabled(bool enabled)
+{
+	d->debug_enabled = enabled;
+	if(d->sess)
+		jdns_set_debug_enabled(d->sess, enabled ? 1 : 0);
+	if(!enabled)
+		d->debug_strings.clear();
+}
+
 QStringList QJDns::debugLines()
 {
 	QStringList tmp = d->debug_strings;
@@ -998,6 +1138,11 @@ void QJDns::setNameServers(const QList<NameServer> &list)
 	d->setNameServers(list);
 }
 
+void QJDns::setRace(int type, bool enabled)
+{
+	jdns_set_race(d->sess, type, enabled ? 1 : 0);
+}
+
 int QJDns::queryStart(const QByteArray &name, int type)
 {
 	int id = jdns_query(d->sess, (const unsigned char *)name.data(), type);
@@ -1044,4 +1189,23 @@ void QJDns::publishCancel(int id)
 	d->process();
 }
 
+QJDns::Statistics QJDns::statistics() const
+{
+	Statistics out;
+	if(!d->sess)
+		return out;
+
+	jdns_stats_t st;
+	jdns_get_stats(d->sess, &st);
+	out.queries = st.queries;
+	out.queriesJoined = st.queries_joined;
+	out.cacheHits = st.cache_hits;
+	out.cacheMisses = st.cache_misses;
+	out.packetsSent = st.packets_sent;
+	out.packetsReceived = st.packets_received;
+	out.retransmissions = st.retransmissions;
+	out.tcpQueries = st.tcp_queries;
+	return out;
+}
+
 #include "qjdns.moc"
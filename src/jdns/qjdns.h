@@ -122,6 +122,22 @@ public:
 		QList<Record> additionalRecords;
 	};
 
+	// counters since init(), see jdns_stats_t
+	class Statistics
+	{
+	public:
+		int queries;
+		int queriesJoined;
+		int cacheHits;
+		int cacheMisses;
+		int packetsSent;
+		int packetsReceived;
+		int retransmissions;
+		int tcpQueries;
+
+		Statistics();
+	};
+
 	QJDns(QObject *parent = 0);
 	~QJDns();
 
@@ -129,11 +145,19 @@ public:
 	void shutdown();
 	QStringList debugLines();
 
+	// on by default.  with it off, jdns produces no debug lines, and saves
+	//   formatting the dump of every packet
+	void setDebugEnabled(bool enabled);
+
 	static SystemInfo systemInfo();
 	static QHostAddress detectPrimaryMulticast(const QHostAddress &address);
 
 	void setNameServers(const QList<NameServer> &list);
 
+	// for unicast mode only.  the first packet of a query of this type
+	//   goes to the two best name servers at once, see jdns_set_race()
+	void setRace(int type, bool enabled);
+
 	int queryStart(const QByteArray &name, int type);
 	void queryCancel(int id);
 
@@ -142,6 +166,8 @@ public:
 	void publishUpdate(int id, const Record &record);
 	void publishCancel(int id);
 
+	Statistics statistics() const;
+
 signals:
 	void resultsReady(int id, const QJDns::Response &results);
 	void published(int id);
@@ -68,6 +68,13 @@
 #include "libidn/punycode.h"
 #include "libidn/idna.h"
 
+/* rfc3454.c */
+#define STRINGPREP_INDEX_BLOCKS 512
+extern const unsigned short stringprep_rfc3454_A_1_index[];
+extern const unsigned short stringprep_rfc3454_B_2_index[];
+extern const unsigned short stringprep_rfc3454_B_3_index[];
+extern const unsigned short stringprep_rfc3454_D_2_index[];
+
 /*! \mainpage GNU Internationalized Domain Name Library
  *
  * \section intro Introduction
@@ -3539,3 +3539,194 @@ Stringprep_table_element stringprep_rfc3454_D_2[] = {
   { 0 },
 };
 
+
+/*
+ * Two level lookup for the large tables.  For each block of 256 code
+ * points below STRINGPREP_INDEX_BLOCKS * 256, the position of the first
+ * entry that ends in or after the block; the last element is the same
+ * for everything above.  Derived from the tables above, which are sorted.
+ */
+
+const unsigned short stringprep_rfc3454_A_1_index[] = {
+  0, 0, 0, 4, 14, 18, 27, 35, 38, 38, 58, 87,
+  117, 142, 164, 185, 192, 201, 204, 223, 230, 231, 231, 234,
+  243, 246, 246, 246, 246, 246, 247, 249, 265, 272, 275, 275,
+  276, 279, 279, 282, 295, 295, 295, 295, 295, 295, 295, 298,
+  300, 302, 306, 311, 314, 314, 314, 314, 314, 314, 314, 314,
+  314, 314, 314, 314, 314, 314, 314, 314, 314, 314, 314, 314,
+  314, 314, 314, 314, 314, 314, 315, 315, 315, 315, 315, 315,
+  315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315,
+  315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315,
+  315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315,
+  315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315,
+  315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315,
+  315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315, 315,
+  315, 315, 315, 315, 316, 316, 316, 316, 316, 317, 317, 317,
+  317, 317, 317, 317, 318, 318, 318, 318, 318, 318, 318, 318,
+  318, 318, 318, 318, 318, 318, 318, 318, 318, 318, 318, 318,
+  318, 318, 318, 318, 318, 318, 318, 318, 318, 318, 318, 318,
+  318, 318, 318, 318, 318, 318, 318, 318, 318, 318, 318, 318,
+  319, 319, 319, 319, 319, 319, 319, 319, 319, 319, 319, 319,
+  319, 319, 319, 319, 319, 319, 319, 319, 319, 319, 319, 319,
+  319, 319, 319, 319, 319, 319, 319, 319, 319, 319, 319, 321,
+  329, 329, 333, 341, 349, 349, 349, 350, 353, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354, 354,
+  354, 354, 354, 354, 354, 354, 354, 354, 355, 356, 357, 357,
+  358, 368, 377, 378, 379, 379, 379, 379, 379, 379, 379, 379,
+  379, 379, 379, 379, 379, 379, 379, 379, 379, 379, 379, 379,
+  379, 379, 379, 379, 379, 379, 379, 379, 379, 379, 379, 379,
+  379, 379, 379, 379, 379, 379, 379, 379, 380,
+};
+
+const unsigned short stringprep_rfc3454_B_2_index[] = {
+  0, 58, 192, 218, 280, 399, 446, 446, 446, 446, 446, 446,
+  446, 446, 446, 446, 446, 446, 446, 446, 446, 446, 446, 446,
+  446, 446, 446, 446, 446, 446, 446, 572, 721, 722, 771, 771,
+  771, 797, 797, 797, 797, 797, 797, 797, 797, 797, 797, 797,
+  797, 797, 797, 797, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847, 847,
+  859, 859, 859, 859, 885, 885, 885, 885, 885, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923, 923,
+  923, 1045, 1163, 1292, 1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371,
+  1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371,
+  1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371,
+  1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371, 1371,
+};
+
+const unsigned short stringprep_rfc3454_B_3_index[] = {
+  0, 58, 192, 218, 276, 395, 442, 442, 442, 442, 442, 442,
+  442, 442, 442, 442, 442, 442, 442, 442, 442, 442, 442, 442,
+  442, 442, 442, 442, 442, 442, 442, 568, 717, 717, 736, 736,
+  736, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762, 762,
+  774, 774, 774, 774, 800, 800, 800, 800, 800, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838, 838,
+  838, 838, 838, 838, 838, 838, 838, 838, 838,
+};
+
+const unsigned short stringprep_rfc3454_D_2_index[] = {
+  0, 7, 7, 15, 22, 26, 31, 31, 31, 31, 53, 79,
+  111, 134, 154, 176, 188, 198, 201, 220, 228, 228, 228, 231,
+  244, 247, 247, 247, 247, 247, 247, 249, 268, 271, 285, 285,
+  287, 288, 288, 288, 288, 288, 288, 288, 288, 288, 288, 288,
+  288, 296, 299, 305, 308, 308, 308, 308, 308, 308, 308, 308,
+  308, 308, 308, 308, 308, 308, 308, 308, 308, 308, 308, 308,
+  308, 308, 308, 308, 308, 308, 309, 309, 309, 309, 309, 309,
+  309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309,
+  309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309,
+  309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309,
+  309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309,
+  309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309,
+  309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309, 309,
+  309, 309, 309, 309, 310, 310, 310, 310, 310, 311, 311, 311,
+  311, 311, 311, 311, 311, 311, 311, 311, 311, 311, 311, 311,
+  311, 311, 311, 311, 311, 311, 311, 311, 311, 311, 311, 311,
+  311, 311, 311, 311, 311, 311, 311, 311, 311, 311, 311, 311,
+  311, 311, 311, 311, 311, 311, 311, 311, 311, 311, 311, 311,
+  312, 312, 312, 312, 312, 312, 312, 312, 312, 312, 312, 312,
+  312, 312, 312, 312, 312, 312, 312, 312, 312, 312, 312, 312,
+  312, 312, 312, 312, 312, 312, 312, 312, 312, 312, 312, 314,
+  316, 316, 316, 316, 323, 323, 323, 323, 326, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328, 328,
+  328, 328, 328, 328, 328, 328, 328, 328, 328, 329, 335, 335,
+  335, 345, 354, 355, 356, 356, 356, 356, 356, 356, 356, 356,
+  356, 356, 356, 356, 356, 356, 356, 356, 356, 356, 356, 356,
+  356, 356, 356, 356, 356, 356, 356, 356, 356, 356, 356, 356,
+  356, 356, 356, 356, 356, 356, 356, 356, 356,
+};
@@ -21,12 +21,40 @@
 
 #include "internal.h"
 
+/* The block index of a table, for the tables that have one.  */
+static const unsigned short *
+stringprep_table_index (Stringprep_table_element * table)
+{
+  if (table == stringprep_rfc3454_A_1)
+    return stringprep_rfc3454_A_1_index;
+  if (table == stringprep_rfc3454_B_2)
+    return stringprep_rfc3454_B_2_index;
+  if (table == stringprep_rfc3454_B_3)
+    return stringprep_rfc3454_B_3_index;
+  if (table == stringprep_rfc3454_D_2)
+    return stringprep_rfc3454_D_2_index;
+  return NULL;
+}
+
 static ssize_t
 stringprep_find_character_in_table (my_uint32_t ucs4,
-				    Stringprep_table_element * table)
+				    Stringprep_table_element * table,
+				    const unsigned short *index)
 {
   ssize_t i;
 
+  if (index)
+    {
+      /* Sorted: start at the first range that can hold the character,
+         and stop once past it.  */
+      i = index[ucs4 < STRINGPREP_INDEX_BLOCKS * 256 ?
+		ucs4 >> 8 : STRINGPREP_INDEX_BLOCKS];
+      for (; table[i].start && table[i].start <= ucs4; i++)
+	if (ucs4 <= (table[i].end ? table[i].end : table[i].start))
+	  return i;
+      return -1;
+    }
+
   for (i = 0; table[i].start; i++)
     if (ucs4 >= table[i].start &&
 	ucs4 <= (table[i].end ? table[i].end : table[i].start))
@@ -41,11 +69,13 @@ stringprep_find_string_in_table (my_uint32_t * ucs4,
 				 size_t * tablepos,
 				 Stringprep_table_element * table)
 {
+  const unsigned short *index = stringprep_table_index (table);
   size_t j;
   ssize_t pos;
 
   for (j = 0; j < ucs4len; j++)
-    if ((pos = stringprep_find_character_in_table (ucs4[j], table)) != -1)
+    if ((pos = stringprep_find_character_in_table (ucs4[j], table,
+						   index)) != -1)
       {
 	if (tablepos)
 	  *tablepos = pos;
@@ -259,9 +289,11 @@ stringprep (char *in,
 	    if (contains_ral != -1)
 	      {
 		if (!(stringprep_find_character_in_table
-		      (ucs4[0], profile[contains_ral].table) != -1 &&
-		      stringprep_find_character_in_table
-		      (ucs4[ucs4len - 1], profile[contains_ral].table) != -1))
+		      (ucs4[0], profile[contains_ral].table,
+		       stringprep_table_index (profile[contains_ral].table)) != -1
+		      && stringprep_find_character_in_table
+		      (ucs4[ucs4len - 1], profile[contains_ral].table,
+		       stringprep_table_index (profile[contains_ral].table)) != -1))
 		  {
 		    rc = STRINGPREP_BIDI_LEADTRAIL_NOT_RAL;
 		    goto done;
@@ -3,8 +3,10 @@ DEPENDPATH += $$PWD/../..
 
 HEADERS += \
 	$$PWD/randomnumbergenerator.h \
-	$$PWD/randrandomnumbergenerator.h
+	$$PWD/randrandomnumbergenerator.h \
+	$$PWD/idgenerator.h
 
 SOURCES += \
-	$$PWD/randomnumbergenerator.cpp
+	$$PWD/randomnumbergenerator.cpp \
+	$$PWD/idgenerator.cpp
 
@@ -0,0 +1,55 @@
+/*
+ * idgenerator.cpp - stanza, task and session ids
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmpp/base/idgenerator.h"
+
+namespace XMPP {
+
+static const char hexDigits[] = "0123456789abcdef";
+
+QString IdGenerator::counterId(char prefix, quint32 n)
+{
+	// prefix and up to 8 digits, filled from the end
+	QChar buf[9];
+	int at = 9;
+	do {
+		buf[--at] = QLatin1Char(hexDigits[n & 0xf]);
+		n >>= 4;
+	} while(n);
+	buf[--at] = QLatin1Char(prefix);
+	return QString(buf + at, 9 - at);
+}
+
+QString IdGenerator::hexId(const char *prefix, const QByteArray &data)
+{
+	int plen = qstrlen(prefix);
+	QString s;
+	s.resize(plen + data.size() * 2);
+	QChar *p = s.data();
+	for(int n = 0; n < plen; ++n)
+		*(p++) = QLatin1Char(prefix[n]);
+	for(int n = 0; n < data.size(); ++n) {
+		uchar c = (uchar)data[n];
+		*(p++) = QLatin1Char(hexDigits[c >> 4]);
+		*(p++) = QLatin1Char(hexDigits[c & 0xf]);
+	}
+	return s;
+}
+
+}
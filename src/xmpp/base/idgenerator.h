@@ -0,0 +1,42 @@
+/*
+ * idgenerator.h - stanza, task and session ids
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef IDGENERATOR_H
+#define IDGENERATOR_H
+
+#include <QByteArray>
+#include <QString>
+
+namespace XMPP {
+	// ids written straight into their string, with no formatting on the
+	//   way, for the paths that make one per stanza.  session ids should
+	//   come from hexId() over bytes of the crypto rng, which are unique
+	//   enough that nobody has to look for a collision.
+	class IdGenerator
+	{
+		public:
+			// prefix, then n in lowercase hex
+			static QString counterId(char prefix, quint32 n);
+
+			// prefix, then data in lowercase hex
+			static QString hexId(const char *prefix, const QByteArray &data);
+	};
+}
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * idgeneratortest.cpp
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <QObject>
+#include <QtTest/QtTest>
+
+#include "qttestutil/qttestutil.h"
+#include "xmpp/base/idgenerator.h"
+
+using namespace XMPP;
+
+class IdGeneratorTest : public QObject
+{
+		Q_OBJECT
+
+	private slots:
+		void testCounterId() {
+			QCOMPARE(IdGenerator::counterId('a', 0xaaaa), QString("aaaaa"));
+		}
+
+		void testCounterId_Zero() {
+			QCOMPARE(IdGenerator::counterId('a', 0), QString("a0"));
+		}
+
+		void testCounterId_Maximum() {
+			QCOMPARE(IdGenerator::counterId('x', 0xffffffff), QString("xffffffff"));
+		}
+
+		void testHexId() {
+			QCOMPARE(IdGenerator::hexId("s5b_", QByteArray("\x01\xab\xff", 3)), QString("s5b_01abff"));
+		}
+
+		void testHexId_NoPrefix() {
+			QCOMPARE(IdGenerator::hexId("", QByteArray("\x10", 1)), QString("10"));
+		}
+};
+
+QTTESTUTIL_REGISTER_TEST(IdGeneratorTest);
+#include "idgeneratortest.moc"
@@ -1,3 +1,4 @@
 SOURCES += \
 	$$PWD/randrandomnumbergeneratortest.cpp \
-	$$PWD/randomnumbergeneratortest.cpp
+	$$PWD/randomnumbergeneratortest.cpp \
+	$$PWD/idgeneratortest.cpp
@@ -2,103 +2,187 @@
 
 namespace XMPP {
 
+static const char encodeTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// -1 specifies invalid
+// -2 specifies whitespace, which is skipped
+// 64 specifies padding
+// everything else specifies data
+enum { Invalid = -1, Space = -2, Pad = 64 };
+
+static const signed char decodeTable[256] = {
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-2,-2,-1,-1,-2,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
+	52,53,54,55,56,57,58,59,60,61,-1,-1,-1,64,-1,-1,
+	-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+	15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+	-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+	41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
 QString Base64::encode(const QByteArray &s)
 {
-	int i;
 	int len = s.size();
-	char tbl[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/=";
-	int a, b, c;
+	const unsigned char *in = (const unsigned char *)s.constData();
 
 	QByteArray p;
 	p.resize((len+2)/3*4);
-	int at = 0;
-	for( i = 0; i < len; i += 3 ) {
-		a = ((unsigned char)s[i] & 3) << 4;
-		if(i + 1 < len) {
-			a += (unsigned char)s[i + 1] >> 4;
-			b = ((unsigned char)s[i + 1] & 0xF) << 2;
-			if(i + 2 < len) {
-				b += (unsigned char)s[i + 2] >> 6;
-				c = (unsigned char)s[i + 2] & 0x3F;
-			}
-			else
-				c = 64;
-		}
-		else {
-			b = c = 64;
-		}
+	char *out = p.data();
+
+	// whole groups of three
+	int i = 0;
+	for(; i + 3 <= len; i += 3) {
+		unsigned int v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+		*out++ = encodeTable[v >> 18];
+		*out++ = encodeTable[(v >> 12) & 0x3F];
+		*out++ = encodeTable[(v >> 6) & 0x3F];
+		*out++ = encodeTable[v & 0x3F];
+	}
 
-		p[at++] = tbl[(unsigned char)s[i] >> 2];
-		p[at++] = tbl[a];
-		p[at++] = tbl[b];
-		p[at++] = tbl[c];
+	// trailing one or two bytes
+	if(i < len) {
+		unsigned int v = in[i] << 16;
+		if(i + 1 < len)
+			v |= in[i + 1] << 8;
+		*out++ = encodeTable[v >> 18];
+		*out++ = encodeTable[(v >> 12) & 0x3F];
+		*out++ = (i + 1 < len) ? encodeTable[(v >> 6) & 0x3F] : '=';
+		*out++ = '=';
 	}
-	return QString::fromAscii(p);
+
+	return QString::fromLatin1(p.constData(), p.size());
 }
 
 QByteArray Base64::decode(const QString& input)
 {
-	QByteArray s(QString(input).remove('\n').toUtf8());
+	// anything outside latin1 becomes '?', which is invalid anyway
+	return decode(input.toLatin1());
+}
+
+QByteArray Base64::decode(const QByteArray& input)
+{
+	Decoder dec;
 	QByteArray p;
+	if(!dec.update(input, &p) || !dec.finish())
+		return QByteArray();
+	return p;
+}
 
-	// -1 specifies invalid
-	// 64 specifies eof
-	// everything else specifies data
-
-	char tbl[] = {
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
-		52,53,54,55,56,57,58,59,60,61,-1,-1,-1,64,-1,-1,
-		-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
-		15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
-		-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
-		41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-	};
-
-	// this should be a multiple of 4
-	int len = s.size();
+//----------------------------------------------------------------------------
+// Base64::Decoder
+//----------------------------------------------------------------------------
+Base64::Decoder::Decoder()
+{
+	reset();
+}
 
-	if(len % 4) {
-		return p;
-	}
+void Base64::Decoder::reset()
+{
+	quad_ = 0;
+	have_ = 0;
+	pad_ = 0;
+	done_ = false;
+	error_ = false;
+}
 
-	p.resize(len / 4 * 3);
+/**
+ * \brief Decodes \a size bytes of \a data, appending the result to \a out.
+ *
+ * Returns false if the input is not valid base64.  Once that happens
+ * the decoder stays failed until reset().
+ */
+bool Base64::Decoder::update(const char *data, int size, QByteArray *out)
+{
+	if(error_)
+		return false;
+
+	const unsigned char *in = (const unsigned char *)data;
+	const unsigned char *end = in + size;
+
+	int start = out->size();
+	out->resize(start + (size / 4 + 1) * 3);
+	char *o = out->data() + start;
+
+	while(in < end) {
+		// fast path: whole groups of four data characters
+		if(have_ == 0 && !done_) {
+			while(end - in >= 4) {
+				int a = decodeTable[in[0]];
+				int b = decodeTable[in[1]];
+				int c = decodeTable[in[2]];
+				int d = decodeTable[in[3]];
+				if((a | b | c | d) & ~0x3F)
+					break;
+				unsigned int v = (a << 18) | (b << 12) | (c << 6) | d;
+				*o++ = (char)(v >> 16);
+				*o++ = (char)(v >> 8);
+				*o++ = (char)v;
+				in += 4;
+			}
+			if(in == end)
+				break;
+		}
 
-	int i;
-	int at = 0;
+		int v = decodeTable[*in++];
+		if(v == Space)
+			continue;
+		if(v == Invalid || done_) {
+			error_ = true;
+			break;
+		}
 
-	int a, b, c, d;
-	c = d = 0;
+		if(v == Pad) {
+			// padding may only fill the last one or two places
+			if(have_ < 2) {
+				error_ = true;
+				break;
+			}
+			++pad_;
+			v = 0;
+		}
+		else if(pad_) {
+			error_ = true;
+			break;
+		}
 
-	for( i = 0; i < len; i += 4 ) {
-		a = tbl[(int)s[i]];
-		b = tbl[(int)s[i + 1]];
-		c = tbl[(int)s[i + 2]];
-		d = tbl[(int)s[i + 3]];
-		if((a == 64 || b == 64) || (a < 0 || b < 0 || c < 0 || d < 0)) {
-			p.resize(0);
-			return p;
+		quad_ = (quad_ << 6) | v;
+		if(++have_ == 4) {
+			*o++ = (char)(quad_ >> 16);
+			if(pad_ < 2)
+				*o++ = (char)(quad_ >> 8);
+			if(pad_ < 1)
+				*o++ = (char)quad_;
+			if(pad_)
+				done_ = true;
+			quad_ = 0;
+			have_ = 0;
 		}
-		p[at++] = ((a & 0x3F) << 2) | ((b >> 4) & 0x03);
-		p[at++] = ((b & 0x0F) << 4) | ((c >> 2) & 0x0F);
-		p[at++] = ((c & 0x03) << 6) | ((d >> 0) & 0x3F);
 	}
 
-	if(c & 64)
-		p.resize(at - 2);
-	else if(d & 64)
-		p.resize(at - 1);
+	out->resize(o - out->constData());
+	return !error_;
+}
 
-	return p;
+bool Base64::Decoder::update(const QByteArray &data, QByteArray *out)
+{
+	return update(data.constData(), data.size(), out);
+}
+
+/**
+ * \brief Returns true if everything fed so far was valid and complete.
+ */
+bool Base64::Decoder::finish()
+{
+	return !error_ && have_ == 0;
 }
 
 }
@@ -10,6 +10,30 @@ namespace XMPP {
 		public:
 			static QString encode(const QByteArray&);
 			static QByteArray decode(const QString &s);
+			static QByteArray decode(const QByteArray &s);
+
+			/**
+			 * \brief Incremental decoder.
+			 *
+			 * Input can be fed in pieces of any size; whitespace is
+			 * skipped.  Call finish() at the end to check that the input
+			 * was complete.
+			 */
+			class Decoder
+			{
+				public:
+					Decoder();
+
+					void reset();
+					bool update(const char *data, int size, QByteArray *out);
+					bool update(const QByteArray &data, QByteArray *out);
+					bool finish();
+
+				private:
+					unsigned int quad_;
+					int have_, pad_;
+					bool done_, error_;
+			};
 	};
 }
 
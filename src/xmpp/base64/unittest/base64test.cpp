@@ -25,6 +25,51 @@ class Base64Test : public QObject
 			QString result = Base64::decode("QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaGlqa2xtbm9wcXJzdHV2d3h5ejEyMzQ1Njc4OTA=");
 			QCOMPARE(result, QString("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz1234567890"));
 		}
+
+		void testDecode_Whitespace() {
+			QByteArray result = Base64::decode(QByteArray("QUJD\r\nREVG R0hJ\tSks="));
+			QCOMPARE(result, QByteArray("ABCDEFGHIJK"));
+		}
+
+		void testDecode_Invalid() {
+			QVERIFY(Base64::decode(QByteArray("QUJ")).isEmpty());
+			QVERIFY(Base64::decode(QByteArray("QU!D")).isEmpty());
+			QVERIFY(Base64::decode(QByteArray("QQ==QUJD")).isEmpty());
+		}
+
+		void testDecoder_Incremental() {
+			QByteArray input = Base64::encode(testData()).toLatin1();
+			Base64::Decoder dec;
+			QByteArray result;
+			for(int n = 0; n < input.size(); n += 7)
+				QVERIFY(dec.update(input.mid(n, 7), &result));
+			QVERIFY(dec.finish());
+			QCOMPARE(result, testData());
+		}
+
+#if QT_VERSION >= 0x040500
+		void benchmarkEncode() {
+			QByteArray data = testData();
+			QBENCHMARK {
+				Base64::encode(data);
+			}
+		}
+
+		void benchmarkDecode() {
+			QByteArray input = Base64::encode(testData()).toLatin1();
+			QBENCHMARK {
+				Base64::decode(input);
+			}
+		}
+#endif
+
+	private:
+		static QByteArray testData() {
+			QByteArray data(64 * 1024, 0);
+			for(int n = 0; n < data.size(); ++n)
+				data[n] = (char)(n * 7 + (n >> 8));
+			return data;
+		}
 };
 
 QTTESTUTIL_REGISTER_TEST(Base64Test);
@@ -23,7 +23,12 @@
 
 #include <QCoreApplication>
 #include <QByteArray>
-#include <QHash>
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QThread>
+#include <limits.h>
 #include <libidn/stringprep.h>
 
 using namespace XMPP;
@@ -32,101 +37,66 @@ using namespace XMPP;
 //----------------------------------------------------------------------------
 // StringPrepCache
 //----------------------------------------------------------------------------
+// the cache is shared by all threads, since clients may run on several
+Q_GLOBAL_STATIC(QMutex, stringprep_mutex)
+
 class StringPrepCache : public QObject
 {
 public:
+	enum Profile { Nameprep, Nodeprep, Resourceprep };
+
 	static bool nameprep(const QString &in, int maxbytes, QString& out)
 	{
-		if (in.isEmpty()) {
-			out = QString();
-			return true;
-		}
-
-		StringPrepCache *that = get_instance();
-
-		Result *r = that->nameprep_table[in];
-		if (r) {
-			if(!r->norm) {
-				return false;
-			}
-			out = *(r->norm);
-			return true;
-		}
-
-		QByteArray cs = in.toUtf8();
-		cs.resize(maxbytes);
-		if(stringprep(cs.data(), maxbytes, (Stringprep_profile_flags)0, stringprep_nameprep) != 0)
-		{
-			that->nameprep_table.insert(in, new Result);
-			return false;
-		}
-
-		QString norm = QString::fromUtf8(cs);
-		that->nameprep_table.insert(in, new Result(norm));
-		out = norm;
-		return true;
+		return prep(Nameprep, in, maxbytes, out);
 	}
 
 	static bool nodeprep(const QString &in, int maxbytes, QString& out)
 	{
-		if(in.isEmpty()) {
-      out = QString();
-			return true;
-		}
-
-		StringPrepCache *that = get_instance();
-
-		Result *r = that->nodeprep_table[in];
-		if(r) {
-			if(!r->norm) {
-				return false;
-			}
-			out = *(r->norm);
-			return true;
-		}
+		return prep(Nodeprep, in, maxbytes, out);
+	}
 
-		QByteArray cs = in.toUtf8();
-		cs.resize(maxbytes);
-		if(stringprep(cs.data(), maxbytes, (Stringprep_profile_flags)0, stringprep_xmpp_nodeprep) != 0) {
-			that->nodeprep_table.insert(in, new Result);
-			return false;
-		}
+	static bool resourceprep(const QString &in, int maxbytes, QString& out)
+	{
+		return prep(Resourceprep, in, maxbytes, out);
+	}
 
-		QString norm = QString::fromUtf8(cs);
-		that->nodeprep_table.insert(in, new Result(norm));
-		out = norm;
-		return true;
+	static void setCapacity(int entries)
+	{
+		QMutexLocker locker(stringprep_mutex());
+		get_instance()->setCapacityInternal(entries);
 	}
 
-	static bool resourceprep(const QString &in, int maxbytes, QString& out)
+	static int currentCapacity()
 	{
-		if(in.isEmpty()) {
-      out = QString();
-			return true;
-		}
+		QMutexLocker locker(stringprep_mutex());
+		return get_instance()->capacity;
+	}
 
+	static StringPrepCacheStats stats()
+	{
+		QMutexLocker locker(stringprep_mutex());
 		StringPrepCache *that = get_instance();
+		StringPrepCacheStats st = that->st;
+		st.size = 0;
+		for(int n = 0; n < 3; ++n)
+			st.size += that->table[n].size();
+		st.capacity = that->capacity;
+		return st;
+	}
 
-		Result *r = that->resourceprep_table[in];
-		if(r) {
-			if(!r->norm) {
-				return false;
-			}
-			out = *(r->norm);
-			return true;
-		}
-
-		QByteArray cs = in.toUtf8();
-		cs.resize(maxbytes);
-		if(stringprep(cs.data(), maxbytes, (Stringprep_profile_flags)0, stringprep_xmpp_resourceprep) != 0) {
-			that->resourceprep_table.insert(in, new Result);
-			return false;
-		}
+	static void resetStats()
+	{
+		QMutexLocker locker(stringprep_mutex());
+		StringPrepCache *that = get_instance();
+		that->st = StringPrepCacheStats();
+	}
 
-		QString norm = QString::fromUtf8(cs);
-		that->resourceprep_table.insert(in, new Result(norm));
-		out = norm;
-		return true;
+	static void clear()
+	{
+		QMutexLocker locker(stringprep_mutex());
+		StringPrepCache *that = get_instance();
+		for(int n = 0; n < 3; ++n)
+			that->table[n].clear();
 	}
 
 private:
@@ -149,12 +119,14 @@ private:
 		}
 	};
 
-	QHash<QString,Result*> nameprep_table;
-	QHash<QString,Result*> nodeprep_table;
-	QHash<QString,Result*> resourceprep_table;
+	// least recently used entries are dropped once a table is full
+	QCache<QString,Result> table[3];
+	int capacity;
+	StringPrepCacheStats st;
 
 	static StringPrepCache *instance;
 
+	// call with stringprep_mutex held
 	static StringPrepCache *get_instance()
 	{
 		if(!instance)
@@ -163,24 +135,117 @@ private:
 	}
 
 	StringPrepCache()
-		: QObject(QCoreApplication::instance())
 	{
+		capacity = 0;
+		setCapacityInternal(DefaultCapacity);
+
+		// the first lookup may come from any thread, but the cache goes
+		//   away with the application
+		QCoreApplication *app = QCoreApplication::instance();
+		if(app) {
+			if(app->thread() != QThread::currentThread())
+				moveToThread(app->thread());
+			setParent(app);
+		}
+	}
+
+	enum { DefaultCapacity = 20000 };
+
+	void setCapacityInternal(int entries)
+	{
+		capacity = entries;
+		for(int n = 0; n < 3; ++n)
+			table[n].setMaxCost(entries > 0 ? entries : INT_MAX);
 	}
 
-	~StringPrepCache()
+	// Plain ASCII that the profile would leave as is does not need to go
+	//   through libidn at all: there is no normalization, bidi or case
+	//   folding to apply, only prohibited characters to rule out.
+	static bool asciiUnchanged(Profile p, const QString &in, int maxbytes)
 	{
-		foreach(Result* r, nameprep_table) {
-			delete r;
+		int len = in.length();
+		if(len >= maxbytes)
+			return false;
+		const QChar *u = in.unicode();
+		for(int n = 0; n < len; ++n) {
+			ushort c = u[n].unicode();
+			if(c < 0x20 || c > 0x7e)
+				return false;
+			if(p == Resourceprep)
+				continue;
+			if(c >= 'A' && c <= 'Z')
+				return false;
+			if(p == Nodeprep) {
+				switch(c) {
+					case ' ': case '"': case '&': case '\'':
+					case '/': case ':': case '<': case '>': case '@':
+						return false;
+					default:
+						break;
+				}
+			}
 		}
-		nameprep_table.clear();
-		foreach(Result* r, nodeprep_table) {
-			delete r;
+		return true;
+	}
+
+	static bool prep(Profile p, const QString &in, int maxbytes, QString& out)
+	{
+		if(in.isEmpty()) {
+			out = QString();
+			return true;
 		}
-		nodeprep_table.clear();
-		foreach(Result* r, resourceprep_table) {
-			delete r;
+
+		bool ascii = asciiUnchanged(p, in, maxbytes);
+
+		// looking up moves the entry to the front, so even that is a write
+		QMutexLocker locker(stringprep_mutex());
+		StringPrepCache *that = get_instance();
+
+		if(ascii) {
+			++that->st.asciiFastPath;
+			out = in;
+			return true;
+		}
+
+		Result *r = that->table[p].object(in);
+		if(r) {
+			++that->st.hits;
+			if(!r->norm) {
+				return false;
+			}
+			out = *(r->norm);
+			return true;
 		}
-		resourceprep_table.clear();
+		++that->st.misses;
+
+		// no need to hold up the other threads while libidn runs
+		locker.unlock();
+
+		Stringprep_profile *profile;
+		if(p == Nameprep)
+			profile = stringprep_nameprep;
+		else if(p == Nodeprep)
+			profile = stringprep_xmpp_nodeprep;
+		else
+			profile = stringprep_xmpp_resourceprep;
+
+		QByteArray cs = in.toUtf8();
+		cs.resize(maxbytes);
+		bool ok = (stringprep(cs.data(), maxbytes, (Stringprep_profile_flags)0, profile) == 0);
+
+		locker.relock();
+		QCache<QString,Result> &t = that->table[p];
+		if(t.size() >= t.maxCost())
+			++that->st.evictions;
+		if(!ok) {
+			t.insert(in, new Result);
+			return false;
+		}
+
+		QString norm = QString::fromUtf8(cs);
+		t.insert(in, new Result(norm));
+		out = norm;
+		return true;
 	}
 };
 
@@ -205,10 +270,37 @@ static inline bool validResource(const QString &s, QString& norm)
 	return StringPrepCache::resourceprep(s, 1024, norm);
 }
 
+// all null jids share one data object
+Q_GLOBAL_STATIC_WITH_ARGS(QSharedDataPointer<JidData>, shared_null, (new JidData))
+
+static const QSharedDataPointer<JidData> & nullData()
+{
+	return *shared_null();
+}
+
+Q_GLOBAL_STATIC(QMutex, domain_pool_mutex)
+Q_GLOBAL_STATIC(QSet<QString>, domain_pool)
+
+// Domains repeat a lot (every contact on a server shares one), so keep one
+//   copy of each and let the Jids share it.  The pool is bounded so that a
+//   flood of distinct domains can't grow it forever.
+static QString internDomain(const QString &domain)
+{
+	if(domain.isEmpty())
+		return domain;
+	QMutexLocker locker(domain_pool_mutex());
+	QSet<QString> *pool = domain_pool();
+	QSet<QString>::ConstIterator it = pool->constFind(domain);
+	if(it != pool->constEnd())
+		return *it;
+	if(pool->count() < 4096)
+		pool->insert(domain);
+	return domain;
+}
+
 Jid::Jid()
+	: p(nullData())
 {
-	valid = false;
-	null = true;
 }
 
 Jid::~Jid()
@@ -216,16 +308,19 @@ Jid::~Jid()
 }
 
 Jid::Jid(const QString &s)
+	: p(nullData())
 {
 	set(s);
 }
 
 Jid::Jid(const QString &node, const QString& domain, const QString& resource)
+	: p(nullData())
 {
 	set(domain, node, resource);
 }
 
 Jid::Jid(const char *s)
+	: p(nullData())
 {
 	set(QString(s));
 }
@@ -244,29 +339,37 @@ Jid & Jid::operator=(const char *s)
 
 void Jid::reset()
 {
-	f = QString();
-	b = QString();
-	d = QString();
-	n = QString();
-	r = QString();
-	valid = false;
-	null = true;
+	p = nullData();
 }
 
-void Jid::update()
+void Jid::build(const QString &node, const QString &domain, const QString &resource)
 {
-	// build 'bare' and 'full' jids
-	if(n.isEmpty())
-		b = d;
-	else
-		b = n + '@' + d;
-	if(r.isEmpty())
-		f = b;
-	else
-		f = b + '/' + r;
-	if(f.isEmpty())
-		valid = false;
-	null = f.isEmpty() && r.isEmpty();
+	JidData *x = new JidData;
+
+	// 'bare' and 'full' share storage with the parts wherever possible
+	x->n = node;
+	x->d = internDomain(domain);
+	x->r = resource;
+	if(x->n.isEmpty())
+		x->b = x->d;
+	else {
+		x->b.reserve(x->n.length() + x->d.length() + 1);
+		x->b += x->n;
+		x->b += '@';
+		x->b += x->d;
+	}
+	if(x->r.isEmpty())
+		x->f = x->b;
+	else {
+		x->f.reserve(x->b.length() + x->r.length() + 1);
+		x->f += x->b;
+		x->f += '/';
+		x->f += x->r;
+	}
+	x->hash = ::qHash(x->f);
+	x->valid = !x->f.isEmpty();
+	x->null = x->f.isEmpty() && x->r.isEmpty();
+	p = x;
 }
 
 void Jid::set(const QString &s)
@@ -301,12 +404,7 @@ void Jid::set(const QString &s)
 		return;
 	}
 
-	valid = true;
-	null = false;
-	d = norm_domain;
-	n = norm_node;
-	r = norm_resource;
-	update();
+	build(norm_node, norm_domain, norm_resource);
 }
 
 void Jid::set(const QString &domain, const QString &node, const QString &resource)
@@ -316,51 +414,43 @@ void Jid::set(const QString &domain, const QString &node, const QString &resourc
 		reset();
 		return;
 	}
-	valid = true;
-	null = false;
-	d = norm_domain;
-	n = norm_node;
-	r = norm_resource;
-	update();
+	build(norm_node, norm_domain, norm_resource);
 }
 
 void Jid::setDomain(const QString &s)
 {
-	if(!valid)
+	if(!p.constData()->valid)
 		return;
 	QString norm;
 	if(!validDomain(s, norm)) {
 		reset();
 		return;
 	}
-	d = norm;
-	update();
+	build(p.constData()->n, norm, p.constData()->r);
 }
 
 void Jid::setNode(const QString &s)
 {
-	if(!valid)
+	if(!p.constData()->valid)
 		return;
 	QString norm;
 	if(!validNode(s, norm)) {
 		reset();
 		return;
 	}
-	n = norm;
-	update();
+	build(norm, p.constData()->d, p.constData()->r);
 }
 
 void Jid::setResource(const QString &s)
 {
-	if(!valid)
+	if(!p.constData()->valid)
 		return;
 	QString norm;
 	if(!validResource(s, norm)) {
 		reset();
 		return;
 	}
-	r = norm;
-	update();
+	build(p.constData()->n, p.constData()->d, norm);
 }
 
 Jid Jid::withNode(const QString &s) const
@@ -379,24 +469,57 @@ Jid Jid::withResource(const QString &s) const
 
 bool Jid::isValid() const
 {
-	return valid;
+	return p->valid;
 }
 
 bool Jid::isEmpty() const
 {
-	return f.isEmpty();
+	return p->f.isEmpty();
+}
+
+void Jid::setStringPrepCacheCapacity(int entries)
+{
+	StringPrepCache::setCapacity(entries);
+}
+
+int Jid::stringPrepCacheCapacity()
+{
+	return StringPrepCache::currentCapacity();
+}
+
+StringPrepCacheStats Jid::stringPrepCacheStats()
+{
+	return StringPrepCache::stats();
+}
+
+void Jid::resetStringPrepCacheStats()
+{
+	StringPrepCache::resetStats();
+}
+
+void Jid::clearStringPrepCache()
+{
+	StringPrepCache::clear();
 }
 
 bool Jid::compare(const Jid &a, bool compareRes) const
 {
-	if(null && a.null)
+	if(p->null && a.p->null)
 		return true;
 
 	// only compare valid jids
-	if(!valid || !a.valid)
+	if(!p->valid || !a.p->valid)
 		return false;
 
-	if(compareRes ? (f != a.f) : (b != a.b))
+	// copies of the same jid
+	if(p == a.p)
+		return true;
+
+	if(compareRes) {
+		if(p->hash != a.p->hash || p->f != a.p->f)
+			return false;
+	}
+	else if(p->b != a.p->b)
 		return false;
 
 	return true;
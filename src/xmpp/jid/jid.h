@@ -22,6 +22,8 @@
 #define XMPP_JID_H
 
 #include <QString>
+#include <QSharedData>
+#include <QSharedDataPointer>
 
 #ifdef IRIS_XMPP_JID_DEPRECATED
 #define IRIS_XMPP_JID_DECL_DEPRECATED Q_DECL_DEPRECATED
@@ -31,6 +33,33 @@
 
 namespace XMPP 
 {
+	/** \brief Counters for the stringprep results cache shared by all Jids. */
+	class StringPrepCacheStats
+	{
+	public:
+		StringPrepCacheStats() : hits(0), misses(0), evictions(0), asciiFastPath(0), size(0), capacity(0) {}
+
+		int hits;          // answered from the cache
+		int misses;        // had to run libidn
+		int evictions;     // entries dropped to stay within capacity
+		int asciiFastPath; // plain ASCII input that needed no processing
+		int size;          // entries currently held
+		int capacity;      // entries allowed per profile, 0 is unlimited
+	};
+
+	// Storage for Jid, implicitly shared between copies.  'b' and 'f'
+	// share the buffer of the node or domain when there is nothing to
+	// append, and domains are interned.
+	class JidData : public QSharedData
+	{
+	public:
+		JidData() : hash(0), valid(false), null(true) {}
+
+		QString f, b, d, n, r;
+		uint hash;
+		bool valid, null;
+	};
+
 	class Jid
 	{
 	public:
@@ -43,12 +72,13 @@ namespace XMPP
 		Jid & operator=(const QString &s);
 		Jid & operator=(const char *s);
 
-		bool isNull() const { return null; }
-		const QString & domain() const { return d; }
-		const QString & node() const { return n; }
-		const QString & resource() const { return r; }
-		const QString & bare() const { return b; }
-		const QString & full() const { return f; }
+		bool isNull() const { return p->null; }
+		const QString & domain() const { return p->d; }
+		const QString & node() const { return p->n; }
+		const QString & resource() const { return p->r; }
+		const QString & bare() const { return p->b; }
+		const QString & full() const { return p->f; }
+		uint hash() const { return p->hash; }
 
 		Jid withNode(const QString &s) const;
 		Jid withResource(const QString &s) const;
@@ -59,11 +89,19 @@ namespace XMPP
 		inline bool operator==(const Jid &other) const { return compare(other, true); }
 		inline bool operator!=(const Jid &other) const { return !(*this == other); }
 
+		/** \brief Limit the stringprep cache to \a entries per profile.
+		    The least recently used entries are evicted.  0 means unlimited. */
+		static void setStringPrepCacheCapacity(int entries);
+		static int stringPrepCacheCapacity();
+		static StringPrepCacheStats stringPrepCacheStats();
+		static void resetStringPrepCacheStats();
+		static void clearStringPrepCache();
+
 
 #ifdef IRIS_XMPP_JID_DEPRECATED
-		IRIS_XMPP_JID_DECL_DEPRECATED const QString & host() const { return d; }
-		IRIS_XMPP_JID_DECL_DEPRECATED const QString & user() const { return n; }
-		IRIS_XMPP_JID_DECL_DEPRECATED const QString & userHost() const { return b; }
+		IRIS_XMPP_JID_DECL_DEPRECATED const QString & host() const { return p->d; }
+		IRIS_XMPP_JID_DECL_DEPRECATED const QString & user() const { return p->n; }
+		IRIS_XMPP_JID_DECL_DEPRECATED const QString & userHost() const { return p->b; }
 #endif
 
 	private:
@@ -79,11 +117,15 @@ namespace XMPP
 
 	private:
 		void reset();
-		void update();
+		void build(const QString &node, const QString &domain, const QString &resource);
 
-		QString f, b, d, n, r;
-		bool valid, null;
+		QSharedDataPointer<JidData> p;
 	};
+
+	inline uint qHash(const Jid &j)
+	{
+		return j.hash();
+	}
 }
 
 #endif
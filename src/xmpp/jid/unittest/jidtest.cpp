@@ -25,6 +25,73 @@ class JidTest : public QObject
 			QCOMPARE(testling.domain(), QString("bar"));
 			QCOMPARE(testling.resource(), QString("baz"));
 		}
+
+		void testCaseFolding() {
+			Jid testling("Foo@BAR/Baz");
+
+			QCOMPARE(testling.node(), QString("foo"));
+			QCOMPARE(testling.domain(), QString("bar"));
+			QCOMPARE(testling.resource(), QString("Baz"));
+		}
+
+		void testProhibitedNodeCharacter() {
+			Jid testling("fo'o@bar");
+
+			QVERIFY(!testling.isValid());
+		}
+
+		void testWithResource() {
+			Jid testling("foo@bar/baz");
+			Jid other = testling.withResource("qux");
+
+			QCOMPARE(other.full(), QString("foo@bar/qux"));
+			QCOMPARE(other.bare(), QString("foo@bar"));
+			QCOMPARE(testling.full(), QString("foo@bar/baz"));
+			QVERIFY(testling.compare(other, false));
+			QVERIFY(!testling.compare(other, true));
+		}
+
+		void testCopiesCompareEqual() {
+			Jid testling("foo@bar/baz");
+			Jid copy = testling;
+
+			QVERIFY(copy == testling);
+			QCOMPARE(qHash(copy), qHash(Jid("foo@bar/baz")));
+		}
+
+		void testNullJids() {
+			QVERIFY(Jid().isNull());
+			QVERIFY(Jid() == Jid(""));
+			QVERIFY(!Jid().isValid());
+		}
+
+		void testStringPrepCacheStats() {
+			Jid::clearStringPrepCache();
+			Jid::resetStringPrepCacheStats();
+
+			Jid("Foo@bar");
+			Jid("Foo@bar");
+			StringPrepCacheStats stats = Jid::stringPrepCacheStats();
+
+			QCOMPARE(stats.misses, 1);
+			QCOMPARE(stats.hits, 1);
+			QVERIFY(stats.asciiFastPath >= 2);
+		}
+
+		void testStringPrepCacheCapacity() {
+			int old = Jid::stringPrepCacheCapacity();
+			Jid::clearStringPrepCache();
+			Jid::resetStringPrepCacheStats();
+			Jid::setStringPrepCacheCapacity(1);
+
+			Jid("A@bar");
+			Jid("B@bar");
+			StringPrepCacheStats stats = Jid::stringPrepCacheStats();
+
+			QCOMPARE(stats.size, 1);
+			QCOMPARE(stats.evictions, 1);
+			Jid::setStringPrepCacheCapacity(old);
+		}
 };
 
 QTTESTUTIL_REGISTER_TEST(JidTest);
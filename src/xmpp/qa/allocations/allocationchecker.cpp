@@ -0,0 +1,33 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include <QCoreApplication>
+#include <QtCrypto>
+
+#include "qttestutil/testregistry.h"
+#include "qttestutil/allocationcounter.h"
+
+/**
+ * Runs all registered allocation checks, then writes their figures as CSV
+ * to $IRIS_ALLOCATION_OUTPUT (allocation-results.csv by default).  Pass
+ * an earlier output file in $IRIS_ALLOCATION_BASELINE to fail on
+ * regressions.
+ */
+int main(int argc, char* argv[])
+{
+	QCA::Initializer initializer;
+	QCoreApplication application(argc, argv);
+	if (!QtTestUtil::AllocationCounter::isAvailable())
+		qWarning("Allocations are not counted on this platform");
+	int result = QtTestUtil::TestRegistry::getInstance()->runTests(argc, argv);
+
+	QString fileName = QString::fromLocal8Bit(qgetenv("IRIS_ALLOCATION_OUTPUT"));
+	if (fileName.isEmpty())
+		fileName = "allocation-results.csv";
+	if (!QtTestUtil::writeAllocationResults(fileName)) {
+		qWarning("Unable to write %s", qPrintable(fileName));
+		return 1;
+	}
+	return result;
+}
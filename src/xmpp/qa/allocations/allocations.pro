@@ -0,0 +1,27 @@
+# Heap allocation checks for the XMPP core.  Run with 'make check'.
+
+include(../../../../iris.pri)
+include(../qttestutil/qttestutil.pri)
+include(../../common.pri)
+
+# FIXME
+include(../../../../../third-party/qca/qca.pri)
+
+QT += testlib xml network
+QT -= gui
+CONFIG -= app_bundle
+
+INCLUDEPATH *= $$PWD $$PWD/../../xmpp-core $$PWD/../../xmpp-im
+
+TARGET = allocations
+
+SOURCES += \
+	$$PWD/allocationchecker.cpp \
+	$$PWD/xmppallocations.cpp \
+	$$PWD/parserallocations.cpp \
+	$$PWD/stunallocations.cpp
+
+QMAKE_EXTRA_TARGETS = check
+check.commands = \$(MAKE) && ./allocations
+
+QMAKE_CLEAN += $(QMAKE_TARGET)
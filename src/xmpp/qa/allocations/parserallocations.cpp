@@ -0,0 +1,60 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include <QObject>
+#include <QtTest/QtTest>
+
+#include "qttestutil/qttestutil.h"
+#include "qttestutil/allocationcounter.h"
+#include "xmpp/xmpp-core/parser.h"
+
+using namespace XMPP;
+
+#define STANZAS 1000
+
+namespace {
+	QByteArray stream(int count)
+	{
+		QByteArray data = "<?xml version=\"1.0\"?><stream:stream xmlns=\"jabber:client\" xmlns:stream=\"http://etherx.jabber.org/streams\" from=\"example.com\" id=\"1\" version=\"1.0\">";
+		for (int i = 0; i < count; ++i)
+			data += "<message from=\"romeo@montague.net/orchard\" to=\"juliet@capulet.com/balcony\" type=\"chat\" id=\"" + QByteArray::number(i) + "\"><body>Art thou not Romeo, and a Montague?</body></message>";
+		return data;
+	}
+
+	// counts the elements that came out of the parser
+	int readAll(Parser* parser)
+	{
+		int elements = 0;
+		for (Parser::Event e = parser->readNext(); !e.isNull(); e = parser->readNext()) {
+			if (e.type() == Parser::Event::Error)
+				return -1;
+			if (e.type() == Parser::Event::Element)
+				++elements;
+		}
+		return elements;
+	}
+}
+
+class ParserAllocations : public QObject
+{
+		Q_OBJECT
+
+	private slots:
+		void testReadNext() {
+			Parser warmup;
+			warmup.appendData(stream(10));
+			readAll(&warmup);
+
+			Parser parser;
+			parser.appendData(stream(STANZAS));
+
+			QtTestUtil::AllocationCounter counter;
+			int elements = readAll(&parser);
+			QVERIFY(QtTestUtil::recordAllocations("parser_read_next", counter, STANZAS));
+			QCOMPARE(elements, STANZAS);
+		}
+};
+
+QTTESTUTIL_REGISTER_TEST(ParserAllocations);
+#include "parserallocations.moc"
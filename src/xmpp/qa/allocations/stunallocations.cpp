@@ -0,0 +1,84 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include <QObject>
+#include <QtTest/QtTest>
+
+#include "qttestutil/qttestutil.h"
+#include "qttestutil/allocationcounter.h"
+#include "stunmessage.h"
+#include "irisnet/noncore/stuntypes.h"
+
+using namespace XMPP;
+
+#define OPERATIONS 1000
+
+namespace {
+	QByteArray bindingResponse(int validationFlags, const QByteArray& key)
+	{
+		const quint8 magic[4] = { 0x21, 0x12, 0xA4, 0x42 };
+		quint8 id[12];
+		for (int n = 0; n < 12; ++n)
+			id[n] = n;
+
+		QList<StunMessage::Attribute> list;
+		StunMessage::Attribute attr;
+		attr.type = StunTypes::XOR_MAPPED_ADDRESS;
+		const char xaddr[8] = { 0x00, 0x01, 0x31, 0x5a, 0x5e, 0x12, (char)0xa4, 0x43 };
+		attr.value = QByteArray(xaddr, 8);
+		list += attr;
+		attr.type = StunTypes::SOFTWARE;
+		attr.value = "Iris";
+		list += attr;
+
+		StunMessage msg;
+		msg.setClass(StunMessage::SuccessResponse);
+		msg.setMethod(StunTypes::Binding);
+		msg.setMagic(magic);
+		msg.setId(id);
+		msg.setAttributes(list);
+		return msg.toBinary(validationFlags, key);
+	}
+}
+
+class StunAllocations : public QObject
+{
+		Q_OBJECT
+
+	private slots:
+		void testFromBinary() {
+			QByteArray packet = bindingResponse(0, QByteArray());
+			StunMessage::fromBinary(packet); // warm up
+
+			QtTestUtil::AllocationCounter counter;
+			int good = 0;
+			for (int i = 0; i < OPERATIONS; ++i) {
+				StunMessage::ConvertResult result;
+				StunMessage msg = StunMessage::fromBinary(packet, &result);
+				good += result == StunMessage::ConvertGood ? 1 : 0;
+			}
+			QVERIFY(QtTestUtil::recordAllocations("stun_from_binary", counter, OPERATIONS));
+			QCOMPARE(good, OPERATIONS);
+		}
+
+		void testFromBinaryValidated() {
+			int flags = StunMessage::Fingerprint | StunMessage::MessageIntegrity;
+			QByteArray key = "key";
+			QByteArray packet = bindingResponse(flags, key);
+			StunMessage::fromBinary(packet, 0, flags, key); // warm up
+
+			QtTestUtil::AllocationCounter counter;
+			int good = 0;
+			for (int i = 0; i < OPERATIONS; ++i) {
+				StunMessage::ConvertResult result;
+				StunMessage msg = StunMessage::fromBinary(packet, &result, flags, key);
+				good += result == StunMessage::ConvertGood ? 1 : 0;
+			}
+			QVERIFY(QtTestUtil::recordAllocations("stun_from_binary_validated", counter, OPERATIONS));
+			QCOMPARE(good, OPERATIONS);
+		}
+};
+
+QTTESTUTIL_REGISTER_TEST(StunAllocations);
+#include "stunallocations.moc"
@@ -0,0 +1,116 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include <QObject>
+#include <QtTest/QtTest>
+
+#include "qttestutil/qttestutil.h"
+#include "qttestutil/allocationcounter.h"
+#include "xmpp/jid/jid.h"
+#include "xmpp/base64/base64.h"
+#include "xmpp_stream.h"
+
+using namespace XMPP;
+
+#define OPERATIONS 1000
+
+namespace {
+	// just enough of a stream to create stanzas
+	class CheckStream : public Stream
+	{
+		public:
+			QDomDocument& doc() const { return doc_; }
+			QString baseNS() const { return "jabber:client"; }
+			bool old() const { return false; }
+
+			void close() {}
+			bool stanzaAvailable() const { return false; }
+			Stanza read() { return Stanza(); }
+			void write(const Stanza&) {}
+
+			int errorCondition() const { return 0; }
+			QString errorText() const { return QString(); }
+			QDomElement errorAppSpec() const { return QDomElement(); }
+
+		private:
+			mutable QDomDocument doc_;
+	};
+}
+
+class XmppAllocations : public QObject
+{
+		Q_OBJECT
+
+	private slots:
+		void testJidConstruct() {
+			QString s = "juliet@capulet.com/balcony";
+			Jid(s).full(); // warm up
+
+			QtTestUtil::AllocationCounter counter;
+			int valid = 0;
+			for (int i = 0; i < OPERATIONS; ++i) {
+				Jid j(s);
+				valid += j.isValid() ? 1 : 0;
+			}
+			QVERIFY(QtTestUtil::recordAllocations("jid_construct", counter, OPERATIONS));
+			QCOMPARE(valid, OPERATIONS);
+		}
+
+		void testJidCopy() {
+			Jid j("juliet@capulet.com/balcony");
+
+			QtTestUtil::AllocationCounter counter;
+			int valid = 0;
+			for (int i = 0; i < OPERATIONS; ++i) {
+				Jid copy(j);
+				valid += copy.isValid() ? 1 : 0;
+			}
+			// the data is implicitly shared, so copies are free
+			QCOMPARE(counter.allocations(), quint64(0));
+			QVERIFY(QtTestUtil::recordAllocations("jid_copy", counter, OPERATIONS));
+			QCOMPARE(valid, OPERATIONS);
+		}
+
+		void testStanzaCreate() {
+			CheckStream stream;
+			Jid to("juliet@capulet.com/balcony");
+			stream.createStanza(Stanza::Message, to, "chat", "1"); // warm up
+
+			QtTestUtil::AllocationCounter counter;
+			int created = 0;
+			for (int i = 0; i < OPERATIONS; ++i) {
+				Stanza s = stream.createStanza(Stanza::Message, to, "chat", "1");
+				created += s.isNull() ? 0 : 1;
+			}
+			QVERIFY(QtTestUtil::recordAllocations("stanza_create", counter, OPERATIONS));
+			QCOMPARE(created, OPERATIONS);
+		}
+
+		void testBase64Encode() {
+			QByteArray data(1024, 'x');
+			Base64::encode(data); // warm up
+
+			QtTestUtil::AllocationCounter counter;
+			int length = 0;
+			for (int i = 0; i < OPERATIONS; ++i)
+				length += Base64::encode(data).length();
+			QVERIFY(QtTestUtil::recordAllocations("base64_encode", counter, OPERATIONS));
+			QCOMPARE(length, OPERATIONS * 1368);
+		}
+
+		void testBase64Decode() {
+			QString text = Base64::encode(QByteArray(1024, 'x'));
+			Base64::decode(text); // warm up
+
+			QtTestUtil::AllocationCounter counter;
+			int size = 0;
+			for (int i = 0; i < OPERATIONS; ++i)
+				size += Base64::decode(text).size();
+			QVERIFY(QtTestUtil::recordAllocations("base64_decode", counter, OPERATIONS));
+			QCOMPARE(size, OPERATIONS * 1024);
+		}
+};
+
+QTTESTUTIL_REGISTER_TEST(XmppAllocations);
+#include "xmppallocations.moc"
@@ -0,0 +1,31 @@
+# Stanza throughput benchmarks.  Run with 'make bench'.
+
+include(../../../../iris.pri)
+include(../qttestutil/qttestutil.pri)
+include(../../common.pri)
+
+# FIXME
+include(../../../../../third-party/qca/qca.pri)
+
+QT += testlib xml network
+QT -= gui
+CONFIG -= app_bundle
+
+INCLUDEPATH *= $$PWD $$PWD/../../xmpp-core $$PWD/../../xmpp-im
+
+TARGET = benchmark
+
+HEADERS += \
+	$$PWD/benchmarkutil.h
+
+SOURCES += \
+	$$PWD/simplebenchmark.cpp \
+	$$PWD/benchmarkutil.cpp \
+	$$PWD/parserbenchmark.cpp \
+	$$PWD/protocolbenchmark.cpp \
+	$$PWD/imbenchmark.cpp
+
+QMAKE_EXTRA_TARGETS = bench
+bench.commands = \$(MAKE) && ./benchmark
+
+QMAKE_CLEAN += $(QMAKE_TARGET)
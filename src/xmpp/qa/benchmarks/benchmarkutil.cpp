@@ -0,0 +1,135 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include <QFile>
+#include <QList>
+#include <QTextStream>
+#include <QTime>
+
+#include "benchmarkutil.h"
+#include "qttestutil/allocationcounter.h"
+
+namespace Benchmark {
+
+	namespace {
+		struct Result
+		{
+			QString name;
+			qint64 items;
+			int msecs;
+			double allocsPerItem; // negative if not counted
+		};
+
+		QList<Result> results;
+
+		int minimumTime()
+		{
+			int msecs = qgetenv("IRIS_BENCHMARK_MSECS").toInt();
+			return msecs > 0 ? msecs : 1000;
+		}
+	}
+
+	quint64 allocationCount()
+	{
+		return QtTestUtil::AllocationCounter::totalAllocations();
+	}
+
+	bool isCountingAllocations()
+	{
+		return QtTestUtil::AllocationCounter::isAvailable();
+	}
+
+	bool measure(const QString& name, Workload* workload)
+	{
+		// warm up, so that lazily built tables don't count
+		if (workload->run() < 0)
+			return false;
+
+		Result r;
+		r.name = name;
+
+		quint64 before = allocationCount();
+		int items = workload->run();
+		if (items <= 0)
+			return false;
+		r.allocsPerItem = isCountingAllocations() ? double(allocationCount() - before) / items : -1;
+
+		r.items = 0;
+		QTime time;
+		time.start();
+		do {
+			int n = workload->run();
+			if (n < 0)
+				return false;
+			r.items += n;
+		} while (time.elapsed() < minimumTime());
+		r.msecs = qMax(time.elapsed(), 1);
+
+		qDebug("%s: %.0f items/sec, %.1f allocations/item", qPrintable(name), r.items * 1000.0 / r.msecs, r.allocsPerItem);
+		results += r;
+		return true;
+	}
+
+	bool writeResults(const QString& fileName)
+	{
+		QFile file(fileName);
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+			return false;
+
+		QTextStream out(&file);
+		out << "benchmark,items,msecs,items_per_sec,allocs_per_item\n";
+		foreach(const Result& r, results) {
+			out << r.name << ',' << r.items << ',' << r.msecs << ','
+				<< QString::number(r.items * 1000.0 / r.msecs, 'f', 1) << ','
+				<< (r.allocsPerItem < 0 ? QString() : QString::number(r.allocsPerItem, 'f', 2)) << '\n';
+		}
+		return true;
+	}
+
+	QByteArray streamHeader()
+	{
+		return
+			"<?xml version='1.0'?>"
+			"<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' "
+			"from='example.com' id='bench' version='1.0'>";
+	}
+
+	QByteArray streamFeatures()
+	{
+		return "<stream:features/>";
+	}
+
+	QByteArray stanzas(int count)
+	{
+		QByteArray out;
+		for (int n = 0; n < count; ++n) {
+			QByteArray from = "contact" + QByteArray::number(n % 97) + "@example.org/home";
+			switch (n % 4) {
+				case 0:
+				case 1:
+					out +=
+						"<message from='" + from + "' to='bench@example.com/bench' type='chat' id='m" + QByteArray::number(n) + "'>"
+						"<body>Message number " + QByteArray::number(n) + ", with a body of about the usual length &amp; an entity.</body>"
+						"<thread>t" + QByteArray::number(n % 7) + "</thread>"
+						"<active xmlns='http://jabber.org/protocol/chatstates'/>"
+						"</message>";
+					break;
+				case 2:
+					out +=
+						"<presence from='" + from + "' to='bench@example.com/bench'>"
+						"<show>away</show><status>Out for lunch</status><priority>5</priority>"
+						"<c xmlns='http://jabber.org/protocol/caps' hash='sha-1' node='http://psi-im.org' ver='QgayPKawpkPSDYmwT/WM94uAlu0='/>"
+						"</presence>";
+					break;
+				case 3:
+					out +=
+						"<iq from='" + from + "' to='bench@example.com/bench' type='result' id='q" + QByteArray::number(n) + "'>"
+						"<query xmlns='jabber:iq:version'><name>Psi</name><version>0.15</version><os>Linux</os></query>"
+						"</iq>";
+					break;
+			}
+		}
+		return out;
+	}
+}
@@ -0,0 +1,59 @@
+/*
+ * See COPYING for license details.
+ */
+
+#ifndef BENCHMARKUTIL_H
+#define BENCHMARKUTIL_H
+
+#include <QByteArray>
+#include <QString>
+
+namespace Benchmark {
+
+	/**
+	 * One unit of work for measure().
+	 * Every call to run() must do the same work, on the same canned input,
+	 * so that results can be compared between runs and between iris
+	 * versions.
+	 */
+	class Workload
+	{
+		public:
+			virtual ~Workload() {}
+
+			/**
+			 * Do the work once, and return the number of items (stanzas)
+			 * handled, or -1 on failure.
+			 */
+			virtual int run() = 0;
+	};
+
+	/**
+	 * Run a workload repeatedly and record items/sec and allocations per
+	 * item under the given name.
+	 * Returns false if the workload failed.
+	 */
+	bool measure(const QString& name, Workload* workload);
+
+	/**
+	 * Write all results recorded so far as CSV.
+	 */
+	bool writeResults(const QString& fileName);
+
+	/**
+	 * Number of heap allocations made by the process so far, or 0 if
+	 * allocations are not counted on this platform.
+	 */
+	quint64 allocationCount();
+	bool isCountingAllocations();
+
+	/**
+	 * Canned server-to-client traffic.  The stanzas are a fixed mix of
+	 * chat messages, presence with caps, and iq results.
+	 */
+	QByteArray streamHeader();
+	QByteArray streamFeatures();
+	QByteArray stanzas(int count);
+}
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include <QObject>
+#include <QList>
+#include <QtTest/QtTest>
+
+#include "qttestutil/qttestutil.h"
+#include "benchmarkutil.h"
+#include "xmpp/xmpp-core/parser.h"
+#include "xmpp_stream.h"
+#include "im.h"
+
+using namespace XMPP;
+
+#define STANZAS 1000
+
+namespace {
+	// just enough of a stream to create and hold stanzas
+	class BenchStream : public Stream
+	{
+		public:
+			QDomDocument& doc() const { return doc_; }
+			QString baseNS() const { return "jabber:client"; }
+			bool old() const { return false; }
+
+			void close() {}
+			bool stanzaAvailable() const { return false; }
+			Stanza read() { return Stanza(); }
+			void write(const Stanza&) {}
+
+			int errorCondition() const { return 0; }
+			QString errorText() const { return QString(); }
+			QDomElement errorAppSpec() const { return QDomElement(); }
+
+		private:
+			mutable QDomDocument doc_;
+	};
+
+	// parses the canned stanzas once, up front
+	class CannedStanzas
+	{
+		public:
+			CannedStanzas() {
+				parser_.appendData(Benchmark::streamHeader() + Benchmark::stanzas(STANZAS) + "</stream:stream>");
+				for (Parser::Event e = parser_.readNext(); !e.isNull(); e = parser_.readNext()) {
+					if (e.type() == Parser::Event::Element)
+						elements += e.element();
+				}
+			}
+
+			QList<QDomElement> elements;
+
+		private:
+			Parser parser_; // owns the elements
+	};
+
+	class MessageFromStanzaWorkload : public Benchmark::Workload
+	{
+		public:
+			MessageFromStanzaWorkload() {
+				foreach(const QDomElement& e, canned_.elements) {
+					if (e.tagName() == "message")
+						stanzas_ += stream_.createStanza(e);
+				}
+			}
+
+			int run() {
+				int bodies = 0;
+				foreach(const Stanza& s, stanzas_) {
+					Message m;
+					if (!m.fromStanza(s))
+						return -1;
+					bodies += m.body().isEmpty() ? 0 : 1;
+				}
+				return bodies == stanzas_.count() ? bodies : -1;
+			}
+
+		private:
+			CannedStanzas canned_;
+			BenchStream stream_;
+			QList<Stanza> stanzas_;
+	};
+
+	class MessageToStanzaWorkload : public Benchmark::Workload
+	{
+		public:
+			MessageToStanzaWorkload() {
+				foreach(const QDomElement& e, canned_.elements) {
+					Message m;
+					if (e.tagName() == "message" && m.fromStanza(stream_.createStanza(e)))
+						messages_ += m;
+				}
+			}
+
+			int run() {
+				int count = 0;
+				foreach(const Message& m, messages_) {
+					if (m.toStanza(&stream_).isNull())
+						return -1;
+					++count;
+				}
+				return count;
+			}
+
+		private:
+			CannedStanzas canned_;
+			BenchStream stream_;
+			QList<Message> messages_;
+	};
+
+	// Client::distribute() is private.  taking the stanza at the root task
+	// is what it does for every valid stanza, minus the sender check.
+	class DistributeWorkload : public Benchmark::Workload
+	{
+		public:
+			DistributeWorkload() {
+				client_.start("example.com", "bench", "", "bench");
+			}
+
+			int run() {
+				foreach(const QDomElement& e, canned_.elements)
+					client_.rootTask()->take(e);
+				return canned_.elements.count();
+			}
+
+		private:
+			CannedStanzas canned_;
+			Client client_;
+	};
+}
+
+class IMBenchmark : public QObject
+{
+		Q_OBJECT
+
+	private slots:
+		void benchmarkMessageFromStanza() {
+			MessageFromStanzaWorkload w;
+			QVERIFY(Benchmark::measure("message_from_stanza", &w));
+		}
+
+		void benchmarkMessageToStanza() {
+			MessageToStanzaWorkload w;
+			QVERIFY(Benchmark::measure("message_to_stanza", &w));
+		}
+
+		void benchmarkDistribute() {
+			DistributeWorkload w;
+			QVERIFY(Benchmark::measure("client_distribute", &w));
+		}
+};
+
+QTTESTUTIL_REGISTER_TEST(IMBenchmark);
+#include "imbenchmark.moc"
@@ -0,0 +1,102 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include <QObject>
+#include <QList>
+#include <QtTest/QtTest>
+
+#include "qttestutil/qttestutil.h"
+#include "benchmarkutil.h"
+#include "xmpp/xmpp-core/parser.h"
+#include "xmpp/xmpp-core/protocol.h"
+
+using namespace XMPP;
+
+#define STANZAS 1000
+#define CHUNK 4096
+
+namespace {
+	// feeds the canned stream the way a socket would, a chunk at a time
+	class ParseWorkload : public Benchmark::Workload
+	{
+		public:
+			ParseWorkload(Parser::Backend backend) : backend_(backend) {
+				data_ = Benchmark::streamHeader() + Benchmark::stanzas(STANZAS) + "</stream:stream>";
+			}
+
+			int run() {
+				Parser::Backend old = Parser::defaultBackend();
+				Parser::setDefaultBackend(backend_);
+				Parser parser;
+				Parser::setDefaultBackend(old);
+
+				int elements = 0;
+				for (int at = 0; at < data_.size(); at += CHUNK) {
+					parser.appendData(data_.mid(at, CHUNK));
+					while (true) {
+						Parser::Event e = parser.readNext();
+						if (e.isNull())
+							break;
+						if (e.type() == Parser::Event::Error)
+							return -1;
+						if (e.type() == Parser::Event::Element)
+							++elements;
+					}
+				}
+				return elements == STANZAS ? elements : -1;
+			}
+
+		private:
+			Parser::Backend backend_;
+			QByteArray data_;
+	};
+
+	class ElementToStringWorkload : public Benchmark::Workload
+	{
+		public:
+			ElementToStringWorkload() {
+				parser_.appendData(Benchmark::streamHeader() + Benchmark::stanzas(STANZAS) + "</stream:stream>");
+				for (Parser::Event e = parser_.readNext(); !e.isNull(); e = parser_.readNext()) {
+					if (e.type() == Parser::Event::Element)
+						elements_ += e.element();
+				}
+			}
+
+			int run() {
+				int size = 0;
+				foreach(const QDomElement& e, elements_)
+					size += protocol_.elementToString(e).size();
+				return size > 0 ? elements_.count() : -1;
+			}
+
+		private:
+			Parser parser_; // owns the elements
+			CoreProtocol protocol_;
+			QList<QDomElement> elements_;
+	};
+}
+
+class ParserBenchmark : public QObject
+{
+		Q_OBJECT
+
+	private slots:
+		void benchmarkParseSax() {
+			ParseWorkload w(Parser::SaxBackend);
+			QVERIFY(Benchmark::measure("parse_sax", &w));
+		}
+
+		void benchmarkParseStreamReader() {
+			ParseWorkload w(Parser::StreamReaderBackend);
+			QVERIFY(Benchmark::measure("parse_streamreader", &w));
+		}
+
+		void benchmarkElementToString() {
+			ElementToStringWorkload w;
+			QVERIFY(Benchmark::measure("element_to_string", &w));
+		}
+};
+
+QTTESTUTIL_REGISTER_TEST(ParserBenchmark);
+#include "parserbenchmark.moc"
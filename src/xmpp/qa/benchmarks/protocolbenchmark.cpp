@@ -0,0 +1,79 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include <QObject>
+#include <QtTest/QtTest>
+
+#include "qttestutil/qttestutil.h"
+#include "benchmarkutil.h"
+#include "xmpp/jid/jid.h"
+#include "xmpp/xmpp-core/protocol.h"
+
+using namespace XMPP;
+
+#define STANZAS 1000
+#define CHUNK 4096
+
+namespace {
+	// a client stream with authentication off goes straight from the
+	// server's features to ready, so the canned traffic needs no sasl
+	class CoreProtocolWorkload : public Benchmark::Workload
+	{
+		public:
+			CoreProtocolWorkload() {
+				data_ = Benchmark::streamHeader() + Benchmark::streamFeatures() + Benchmark::stanzas(STANZAS) + " ";
+			}
+
+			int run() {
+				CoreProtocol protocol;
+				protocol.startClientOut(Jid("bench@example.com/bench"), false, false, false, false);
+
+				int stanzas = 0;
+				int at = 0;
+				while (true) {
+					if (!protocol.processStep()) {
+						if (at >= data_.size())
+							break;
+						protocol.addIncomingData(data_.mid(at, CHUNK));
+						at += CHUNK;
+						continue;
+					}
+
+					switch (protocol.event) {
+						case CoreProtocol::EError:
+							return -1;
+						case CoreProtocol::ESend: {
+							QByteArray a = protocol.takeOutgoingData();
+							protocol.outgoingDataWritten(a.size());
+							break;
+						}
+						case CoreProtocol::EStanzaReady:
+							protocol.recvStanza();
+							++stanzas;
+							break;
+						default:
+							break;
+					}
+				}
+				return stanzas == STANZAS ? stanzas : -1;
+			}
+
+		private:
+			QByteArray data_;
+	};
+}
+
+class ProtocolBenchmark : public QObject
+{
+		Q_OBJECT
+
+	private slots:
+		void benchmarkCoreProtocolReceive() {
+			CoreProtocolWorkload w;
+			QVERIFY(Benchmark::measure("coreprotocol_receive", &w));
+		}
+};
+
+QTTESTUTIL_REGISTER_TEST(ProtocolBenchmark);
+#include "protocolbenchmark.moc"
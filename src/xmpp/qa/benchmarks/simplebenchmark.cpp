@@ -0,0 +1,29 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include <QCoreApplication>
+#include <QtCrypto>
+
+#include "qttestutil/testregistry.h"
+#include "benchmarkutil.h"
+
+/**
+ * Runs all registered benchmarks, then writes their results as CSV to
+ * $IRIS_BENCHMARK_OUTPUT (benchmark-results.csv by default).
+ */
+int main(int argc, char* argv[])
+{
+	QCA::Initializer initializer;
+	QCoreApplication application(argc, argv);
+	int result = QtTestUtil::TestRegistry::getInstance()->runTests(argc, argv);
+
+	QString fileName = QString::fromLocal8Bit(qgetenv("IRIS_BENCHMARK_OUTPUT"));
+	if (fileName.isEmpty())
+		fileName = "benchmark-results.csv";
+	if (!Benchmark::writeResults(fileName)) {
+		qWarning("Unable to write %s", qPrintable(fileName));
+		return 1;
+	}
+	return result;
+}
@@ -0,0 +1,234 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include "qttestutil/allocationcounter.h"
+
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QTextStream>
+#include <stdlib.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+
+// wrap the allocator.  operator new and qMalloc both end up here.
+extern "C" {
+	void* __libc_malloc(size_t);
+	void* __libc_calloc(size_t, size_t);
+	void* __libc_realloc(void*, size_t);
+	void __libc_free(void*);
+
+	static quint64 allocations = 0;
+	static quint64 allocatedBytes = 0;
+	static qint64 liveBytes = 0;
+	static qint64 peakLiveBytes = 0;
+
+	static inline void countAllocation(void* p)
+	{
+		if (!p)
+			return;
+		size_t size = malloc_usable_size(p);
+		++allocations;
+		allocatedBytes += size;
+		liveBytes += size;
+		if (liveBytes > peakLiveBytes)
+			peakLiveBytes = liveBytes;
+	}
+
+	void* malloc(size_t size) throw()
+	{
+		void* p = __libc_malloc(size);
+		countAllocation(p);
+		return p;
+	}
+
+	void* calloc(size_t n, size_t size) throw()
+	{
+		void* p = __libc_calloc(n, size);
+		countAllocation(p);
+		return p;
+	}
+
+	void* realloc(void* p, size_t size) throw()
+	{
+		qint64 old = p ? malloc_usable_size(p) : 0;
+		void* q = __libc_realloc(p, size);
+		// on failure the old block is still there, unless it was a free
+		if (q || size == 0)
+			liveBytes -= old;
+		countAllocation(q);
+		return q;
+	}
+
+	void free(void* p) throw()
+	{
+		if (p)
+			liveBytes -= malloc_usable_size(p);
+		__libc_free(p);
+	}
+}
+# define HAVE_ALLOCATION_COUNT
+#endif
+
+namespace QtTestUtil {
+
+namespace {
+	struct Result
+	{
+		QString name;
+		int operations;
+		double allocsPerOp;
+		double bytesPerOp;
+		qint64 peakBytes;
+	};
+
+	QList<Result> results;
+
+	// name -> allocations and bytes per operation
+	QHash<QString, QPair<double, double> > loadBaseline()
+	{
+		QHash<QString, QPair<double, double> > baseline;
+		QString fileName = QString::fromLocal8Bit(qgetenv("IRIS_ALLOCATION_BASELINE"));
+		if (fileName.isEmpty())
+			return baseline;
+
+		QFile file(fileName);
+		if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+			qWarning("Unable to read %s", qPrintable(fileName));
+			return baseline;
+		}
+
+		QTextStream in(&file);
+		in.readLine(); // header
+		while (!in.atEnd()) {
+			QStringList fields = in.readLine().split(',');
+			if (fields.count() >= 4)
+				baseline[fields[0]] = qMakePair(fields[2].toDouble(), fields[3].toDouble());
+		}
+		return baseline;
+	}
+
+	bool exceeds(double value, double baseline)
+	{
+		// some slack for rounding, so that 0 stays 0 but noise doesn't fail
+		return value > baseline * 1.1 + 0.01;
+	}
+}
+
+AllocationCounter::AllocationCounter()
+{
+	restart();
+}
+
+void AllocationCounter::restart()
+{
+#ifdef HAVE_ALLOCATION_COUNT
+	allocations_ = ::allocations;
+	bytes_ = ::allocatedBytes;
+	live_ = ::liveBytes;
+	::peakLiveBytes = ::liveBytes;
+#else
+	allocations_ = 0;
+	bytes_ = 0;
+	live_ = 0;
+#endif
+}
+
+quint64 AllocationCounter::allocations() const
+{
+#ifdef HAVE_ALLOCATION_COUNT
+	return ::allocations - allocations_;
+#else
+	return 0;
+#endif
+}
+
+quint64 AllocationCounter::bytes() const
+{
+#ifdef HAVE_ALLOCATION_COUNT
+	return ::allocatedBytes - bytes_;
+#else
+	return 0;
+#endif
+}
+
+qint64 AllocationCounter::peakBytes() const
+{
+#ifdef HAVE_ALLOCATION_COUNT
+	return ::peakLiveBytes - live_;
+#else
+	return 0;
+#endif
+}
+
+bool AllocationCounter::isAvailable()
+{
+#ifdef HAVE_ALLOCATION_COUNT
+	return true;
+#else
+	return false;
+#endif
+}
+
+quint64 AllocationCounter::totalAllocations()
+{
+#ifdef HAVE_ALLOCATION_COUNT
+	return ::allocations;
+#else
+	return 0;
+#endif
+}
+
+bool recordAllocations(const QString& name, const AllocationCounter& counter, int operations)
+{
+	// read everything before this function allocates anything itself
+	quint64 allocations = counter.allocations();
+	quint64 bytes = counter.bytes();
+	qint64 peak = counter.peakBytes();
+
+	if (!AllocationCounter::isAvailable() || operations <= 0)
+		return true;
+
+	Result r;
+	r.name = name;
+	r.operations = operations;
+	r.allocsPerOp = double(allocations) / operations;
+	r.bytesPerOp = double(bytes) / operations;
+	r.peakBytes = peak;
+	results += r;
+
+	qDebug("%s: %.2f allocations/op, %.1f bytes/op, peak %lld bytes", qPrintable(name), r.allocsPerOp, r.bytesPerOp, r.peakBytes);
+
+	static QHash<QString, QPair<double, double> > baseline = loadBaseline();
+	if (!baseline.contains(name))
+		return true;
+
+	QPair<double, double> b = baseline.value(name);
+	if (exceeds(r.allocsPerOp, b.first) || exceeds(r.bytesPerOp, b.second)) {
+		qWarning("%s: was %.2f allocations/op, %.1f bytes/op", qPrintable(name), b.first, b.second);
+		return false;
+	}
+	return true;
+}
+
+bool writeAllocationResults(const QString& fileName)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+
+	QTextStream out(&file);
+	out << "test,operations,allocs_per_op,bytes_per_op,peak_bytes\n";
+	foreach(const Result& r, results) {
+		out << r.name << ',' << r.operations << ','
+			<< QString::number(r.allocsPerOp, 'f', 2) << ','
+			<< QString::number(r.bytesPerOp, 'f', 1) << ','
+			<< r.peakBytes << '\n';
+	}
+	return true;
+}
+
+}
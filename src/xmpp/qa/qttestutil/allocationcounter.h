@@ -0,0 +1,74 @@
+/*
+ * See COPYING for license details.
+ */
+
+#ifndef QTTESTUTIL_ALLOCATIONCOUNTER_H
+#define QTTESTUTIL_ALLOCATIONCOUNTER_H
+
+#include <QString>
+
+namespace QtTestUtil {
+
+	/**
+	 * Counts the heap allocations made while it is alive.
+	 *
+	 * On glibc the test binary wraps malloc, calloc, realloc and free, so
+	 * operator new is counted too.  Sizes are the usable sizes of the
+	 * blocks, which may be a little larger than what was asked for.
+	 * Elsewhere nothing is counted, and isAvailable() returns false.
+	 *
+	 * Only one counter should be active at a time, and only its thread
+	 * should allocate, since the peak is tracked process-wide.
+	 */
+	class AllocationCounter
+	{
+		public:
+			AllocationCounter();
+
+			/**
+			 * Start counting again from zero.
+			 */
+			void restart();
+
+			quint64 allocations() const;
+
+			/**
+			 * Total size of the blocks allocated.
+			 */
+			quint64 bytes() const;
+
+			/**
+			 * Highest growth of the live heap since counting started.
+			 */
+			qint64 peakBytes() const;
+
+			static bool isAvailable();
+
+			/**
+			 * Allocations made by the process so far.
+			 */
+			static quint64 totalAllocations();
+
+		private:
+			quint64 allocations_;
+			quint64 bytes_;
+			qint64 live_;
+	};
+
+	/**
+	 * Record allocations and bytes per operation, and the peak, for
+	 * the named test.  If $IRIS_ALLOCATION_BASELINE names a CSV file
+	 * written by writeAllocationResults(), the figures are compared with
+	 * that baseline.
+	 * Returns false if allocations or bytes per operation grew by more
+	 * than 10% over the baseline.
+	 */
+	bool recordAllocations(const QString& name, const AllocationCounter& counter, int operations);
+
+	/**
+	 * Write all figures recorded so far as CSV.
+	 */
+	bool writeAllocationResults(const QString& fileName);
+}
+
+#endif
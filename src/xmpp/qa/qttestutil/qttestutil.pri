@@ -1,5 +1,9 @@
 INCLUDEPATH *= $$PWD/..
 DEPENDPATH *= $$PWD/..
 
+HEADERS += \
+	$$PWD/allocationcounter.h
+
 SOURCES += \
-	$$PWD/testregistry.cpp
+	$$PWD/testregistry.cpp \
+	$$PWD/allocationcounter.cpp
@@ -4,10 +4,16 @@ DEPENDPATH *= $$PWD/../..
 HEADERS += \
 	$$PWD/plainmessage.h \
 	$$PWD/digestmd5proplist.h \
-	$$PWD/digestmd5response.h
+	$$PWD/digestmd5response.h \
+	$$PWD/scramsha1credentials.h \
+	$$PWD/scramsha1message.h \
+	$$PWD/scramsha1response.h
 
 SOURCES += \
 	$$PWD/plainmessage.cpp \
 	$$PWD/digestmd5proplist.cpp \
-	$$PWD/digestmd5response.cpp
+	$$PWD/digestmd5response.cpp \
+	$$PWD/scramsha1credentials.cpp \
+	$$PWD/scramsha1message.cpp \
+	$$PWD/scramsha1response.cpp
 
@@ -0,0 +1,77 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include "xmpp/sasl/scramsha1credentials.h"
+
+#include <QtCrypto>
+
+namespace XMPP {
+
+// HMAC-SHA1 with the pads worked out once, so that the PBKDF2 loop only
+//   does the two hashes per round
+class HMACSHA1
+{
+	public:
+		HMACSHA1(const QByteArray& key) : hash_("sha1") {
+			QByteArray k = key;
+			if (k.size() > 64)
+				k = QCA::Hash("sha1").hash(k).toByteArray();
+			k.append(QByteArray(64 - k.size(), '\0'));
+
+			ipad_.resize(64);
+			opad_.resize(64);
+			for (int n = 0; n < 64; ++n) {
+				ipad_[n] = k[n] ^ 0x36;
+				opad_[n] = k[n] ^ 0x5c;
+			}
+		}
+
+		QByteArray mac(const QByteArray& data) {
+			hash_.clear();
+			hash_.update(ipad_);
+			hash_.update(data);
+			QByteArray inner = hash_.final().toByteArray();
+
+			hash_.clear();
+			hash_.update(opad_);
+			hash_.update(inner);
+			return hash_.final().toByteArray();
+		}
+
+	private:
+		QCA::Hash hash_;
+		QByteArray ipad_, opad_;
+};
+
+SCRAMSHA1Credentials::SCRAMSHA1Credentials() : iterations_(0)
+{
+}
+
+SCRAMSHA1Credentials::SCRAMSHA1Credentials(const QByteArray& password, const QByteArray& salt, int iterations) : salt_(salt), iterations_(iterations)
+{
+	if (iterations < 1)
+		return;
+
+	// SaltedPassword := Hi(password, salt, i)
+	HMACSHA1 prf(password);
+	QByteArray u = prf.mac(salt + QByteArray("\0\0\0\1", 4));
+	QByteArray salted = u;
+	for (int n = 1; n < iterations; ++n) {
+		u = prf.mac(u);
+		for (int i = 0; i < salted.size(); ++i)
+			salted[i] = salted[i] ^ u[i];
+	}
+
+	HMACSHA1 keys(salted);
+	clientKey_ = keys.mac("Client Key");
+	serverKey_ = keys.mac("Server Key");
+	storedKey_ = QCA::Hash("sha1").hash(clientKey_).toByteArray();
+}
+
+QByteArray SCRAMSHA1Credentials::hmac(const QByteArray& key, const QByteArray& data)
+{
+	return HMACSHA1(key).mac(data);
+}
+
+}
@@ -0,0 +1,61 @@
+/*
+ * See COPYING for license details.
+ */
+
+#ifndef SCRAMSHA1CREDENTIALS_H
+#define SCRAMSHA1CREDENTIALS_H
+
+#include <QByteArray>
+
+namespace XMPP {
+	/**
+	 * The keys SCRAM-SHA-1 derives from a password (RFC 5802).
+	 *
+	 * Deriving them is the expensive part of a login, and the result only
+	 * depends on the password, salt and iteration count, so it can be kept
+	 * and reused as long as the server keeps offering the same salt.
+	 */
+	class SCRAMSHA1Credentials
+	{
+		public:
+			SCRAMSHA1Credentials();
+			SCRAMSHA1Credentials(const QByteArray& password, const QByteArray& salt, int iterations);
+
+			bool isNull() const {
+				return clientKey_.isEmpty();
+			}
+
+			bool isFor(const QByteArray& salt, int iterations) const {
+				return !isNull() && salt_ == salt && iterations_ == iterations;
+			}
+
+			const QByteArray& getSalt() const {
+				return salt_;
+			}
+
+			int getIterations() const {
+				return iterations_;
+			}
+
+			const QByteArray& getClientKey() const {
+				return clientKey_;
+			}
+
+			const QByteArray& getStoredKey() const {
+				return storedKey_;
+			}
+
+			const QByteArray& getServerKey() const {
+				return serverKey_;
+			}
+
+			static QByteArray hmac(const QByteArray& key, const QByteArray& data);
+
+		private:
+			QByteArray salt_;
+			int iterations_;
+			QByteArray clientKey_, storedKey_, serverKey_;
+	};
+}
+
+#endif
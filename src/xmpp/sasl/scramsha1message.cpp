@@ -0,0 +1,47 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include "xmpp/sasl/scramsha1message.h"
+
+#include "xmpp/base/randomnumbergenerator.h"
+#include "xmpp/base64/base64.h"
+
+namespace XMPP {
+
+SCRAMSHA1Message::SCRAMSHA1Message(const QString& authzid, const QString& authcid, const RandomNumberGenerator& rand)
+{
+	QByteArray a;
+	a.resize(24);
+	for (int n = 0; n < a.size(); ++n) {
+		a[n] = (char) rand.generateNumberBetween(0, 255);
+	}
+	clientNonce_ = Base64::encode(a).toLatin1();
+
+	// no channel binding
+	gs2Header_ = "n,";
+	if (!authzid.isEmpty())
+		gs2Header_ += "a=" + saslName(authzid);
+	gs2Header_ += ',';
+
+	value_ = gs2Header_ + "n=" + saslName(authcid) + ",r=" + clientNonce_;
+}
+
+// RFC 5802: ',' and '=' are escaped.  the name is expected to be
+//   prepared already, as QCA offers no SASLprep.
+QByteArray SCRAMSHA1Message::saslName(const QString& s)
+{
+	QByteArray in = s.toUtf8();
+	QByteArray out;
+	for (int n = 0; n < in.size(); ++n) {
+		if (in[n] == ',')
+			out += "=2C";
+		else if (in[n] == '=')
+			out += "=3D";
+		else
+			out += in[n];
+	}
+	return out;
+}
+
+}
@@ -0,0 +1,49 @@
+/*
+ * See COPYING for license details.
+ */
+
+#ifndef SCRAMSHA1MESSAGE_H
+#define SCRAMSHA1MESSAGE_H
+
+#include <QByteArray>
+#include <QString>
+
+namespace XMPP {
+	class RandomNumberGenerator;
+
+	/**
+	 * The SCRAM-SHA-1 client-first-message.
+	 */
+	class SCRAMSHA1Message
+	{
+		public:
+			SCRAMSHA1Message(const QString& authzid, const QString& authcid, const RandomNumberGenerator& rand);
+
+			const QByteArray& getValue() const {
+				return value_;
+			}
+
+			// the message without the GS2 header, as it goes into the
+			// AuthMessage
+			QByteArray getBareValue() const {
+				return value_.mid(gs2Header_.size());
+			}
+
+			const QByteArray& getGS2Header() const {
+				return gs2Header_;
+			}
+
+			const QByteArray& getClientNonce() const {
+				return clientNonce_;
+			}
+
+			static QByteArray saslName(const QString& s);
+
+		private:
+			QByteArray value_;
+			QByteArray gs2Header_;
+			QByteArray clientNonce_;
+	};
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include "xmpp/sasl/scramsha1response.h"
+
+#include <QList>
+#include <QtCrypto>
+
+#include "xmpp/base64/base64.h"
+
+namespace XMPP {
+
+// "a=x,b=y" -> value of attribute 'attr', or null if it isn't there
+static QByteArray attribute(const QByteArray& message, char attr)
+{
+	QList<QByteArray> parts = message.split(',');
+	foreach (const QByteArray& part, parts) {
+		if (part.size() >= 2 && part[0] == attr && part[1] == '=')
+			return part.mid(2);
+	}
+	return QByteArray();
+}
+
+SCRAMSHA1Response::SCRAMSHA1Response(const QByteArray& server_first_message, const QByteArray& password, const QByteArray& client_first_message_bare, const QByteArray& gs2_header, const QByteArray& client_nonce, const SCRAMSHA1Credentials& credentials) : isValid_(false)
+{
+	// mandatory extensions we don't know about are an error
+	if (server_first_message.startsWith("m="))
+		return;
+
+	QByteArray nonce = attribute(server_first_message, 'r');
+	QByteArray salt = Base64::decode(attribute(server_first_message, 's'));
+	bool ok;
+	int iterations = attribute(server_first_message, 'i').toInt(&ok);
+
+	// the server's nonce must extend ours
+	if (!ok || iterations < 1 || salt.isEmpty() || nonce.size() <= client_nonce.size() || !nonce.startsWith(client_nonce))
+		return;
+
+	if (credentials.isFor(salt, iterations))
+		credentials_ = credentials;
+	else
+		credentials_ = SCRAMSHA1Credentials(password, salt, iterations);
+	if (credentials_.isNull())
+		return;
+
+	QByteArray without_proof = "c=" + Base64::encode(gs2_header).toLatin1() + ",r=" + nonce;
+	QByteArray auth_message = client_first_message_bare + ',' + server_first_message + ',' + without_proof;
+
+	QByteArray proof = SCRAMSHA1Credentials::hmac(credentials_.getStoredKey(), auth_message);
+	const QByteArray& clientKey = credentials_.getClientKey();
+	for (int n = 0; n < proof.size(); ++n)
+		proof[n] = proof[n] ^ clientKey[n];
+
+	serverSignature_ = SCRAMSHA1Credentials::hmac(credentials_.getServerKey(), auth_message);
+	value_ = without_proof + ",p=" + Base64::encode(proof).toLatin1();
+	isValid_ = true;
+}
+
+bool SCRAMSHA1Response::verifyServerFinal(const QByteArray& server_final_message) const
+{
+	if (!isValid_)
+		return false;
+	return Base64::decode(attribute(server_final_message, 'v')) == serverSignature_;
+}
+
+}
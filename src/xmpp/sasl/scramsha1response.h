@@ -0,0 +1,56 @@
+/*
+ * See COPYING for license details.
+ */
+
+#ifndef SCRAMSHA1RESPONSE_H
+#define SCRAMSHA1RESPONSE_H
+
+#include <QByteArray>
+
+#include "xmpp/sasl/scramsha1credentials.h"
+
+namespace XMPP {
+	/**
+	 * The SCRAM-SHA-1 client-final-message, built from the server's
+	 * server-first-message.
+	 *
+	 * If \a credentials were derived for the salt and iteration count
+	 * the server asks for, they are used as they are; otherwise new ones
+	 * are derived from \a password, and can be had from getCredentials()
+	 * to be kept for next time.
+	 */
+	class SCRAMSHA1Response
+	{
+		public:
+			SCRAMSHA1Response(
+					const QByteArray& server_first_message,
+					const QByteArray& password,
+					const QByteArray& client_first_message_bare,
+					const QByteArray& gs2_header,
+					const QByteArray& client_nonce,
+					const SCRAMSHA1Credentials& credentials = SCRAMSHA1Credentials());
+
+			const QByteArray& getValue() const {
+				return value_;
+			}
+
+			bool isValid() const {
+				return isValid_;
+			}
+
+			const SCRAMSHA1Credentials& getCredentials() const {
+				return credentials_;
+			}
+
+			// checks the server-final-message
+			bool verifyServerFinal(const QByteArray& server_final_message) const;
+
+		private:
+			bool isValid_;
+			QByteArray value_;
+			QByteArray serverSignature_;
+			SCRAMSHA1Credentials credentials_;
+	};
+}
+
+#endif
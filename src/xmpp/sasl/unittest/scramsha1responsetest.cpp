@@ -0,0 +1,88 @@
+/*
+ * See COPYING for license details.
+ */
+
+#include <QObject>
+#include <QtTest/QtTest>
+#include <QtCrypto>
+
+#include "qttestutil/qttestutil.h"
+#include "xmpp/sasl/scramsha1message.h"
+#include "xmpp/sasl/scramsha1response.h"
+#include "xmpp/base/unittest/incrementingrandomnumbergenerator.h"
+
+using namespace XMPP;
+
+// test vectors from RFC 5802, section 5
+class SCRAMSHA1ResponseTest : public QObject
+{
+		Q_OBJECT
+
+	private slots:
+		void testMessage() {
+			SCRAMSHA1Message message("", "us,er", IncrementingRandomNumberGenerator(255));
+
+			QCOMPARE(message.getValue(), QByteArray("n,,n=us=2Cer,r=AAECAwQFBgcICQoLDA0ODxAREhMUFRYX"));
+			QCOMPARE(message.getBareValue(), QByteArray("n=us=2Cer,r=AAECAwQFBgcICQoLDA0ODxAREhMUFRYX"));
+			QCOMPARE(message.getClientNonce(), QByteArray("AAECAwQFBgcICQoLDA0ODxAREhMUFRYX"));
+		}
+
+		void testMessage_WithAuthzid() {
+			SCRAMSHA1Message message("admin", "user", IncrementingRandomNumberGenerator(255));
+
+			QCOMPARE(message.getGS2Header(), QByteArray("n,a=admin,"));
+		}
+
+		void testResponse() {
+			SCRAMSHA1Response response(serverFirst(), "pencil", clientFirstBare(), "n,,", clientNonce());
+
+			QVERIFY(response.isValid());
+			QCOMPARE(response.getValue(), QByteArray("c=biws,r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,p=v0X8v3Bz2T0CJGbJQyF0X+HI4Ts="));
+			QVERIFY(response.verifyServerFinal("v=rmF9pqV8S7suAoZWja4dJRkFsKQ="));
+			QVERIFY(!response.verifyServerFinal("v=AAAAAAAAAAAAAAAAAAAAAAAAAAA="));
+		}
+
+		void testResponse_WithCredentials() {
+			SCRAMSHA1Credentials credentials("pencil", QCA::Base64().stringToArray("QSXCR+Q6sek8bf92").toByteArray(), 4096);
+
+			// the password is not looked at when the credentials fit
+			SCRAMSHA1Response response(serverFirst(), "wrong", clientFirstBare(), "n,,", clientNonce(), credentials);
+
+			QVERIFY(response.isValid());
+			QCOMPARE(response.getValue(), QByteArray("c=biws,r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,p=v0X8v3Bz2T0CJGbJQyF0X+HI4Ts="));
+		}
+
+		void testResponse_WithStaleCredentials() {
+			SCRAMSHA1Credentials credentials("pencil", "othersalt", 4096);
+
+			SCRAMSHA1Response response(serverFirst(), "pencil", clientFirstBare(), "n,,", clientNonce(), credentials);
+
+			QVERIFY(response.isValid());
+			QCOMPARE(response.getValue(), QByteArray("c=biws,r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,p=v0X8v3Bz2T0CJGbJQyF0X+HI4Ts="));
+			QVERIFY(response.getCredentials().isFor(QCA::Base64().stringToArray("QSXCR+Q6sek8bf92").toByteArray(), 4096));
+		}
+
+		void testResponse_WithForeignNonce() {
+			SCRAMSHA1Response response("r=somethingelse,s=QSXCR+Q6sek8bf92,i=4096", "pencil", clientFirstBare(), "n,,", clientNonce());
+
+			QVERIFY(!response.isValid());
+		}
+
+	private:
+		static QByteArray clientNonce() {
+			return "fyko+d2lbbFgONRv9qkxdawL";
+		}
+
+		static QByteArray clientFirstBare() {
+			return "n=user,r=fyko+d2lbbFgONRv9qkxdawL";
+		}
+
+		static QByteArray serverFirst() {
+			return "r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,s=QSXCR+Q6sek8bf92,i=4096";
+		}
+
+		QCA::Initializer initializer;
+};
+
+QTTESTUTIL_REGISTER_TEST(SCRAMSHA1ResponseTest);
+#include "scramsha1responsetest.moc"
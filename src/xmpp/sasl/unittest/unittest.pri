@@ -1,3 +1,4 @@
 SOURCES += \
 	$$PWD/plainmessagetest.cpp \
-	$$PWD/digestmd5responsetest.cpp
+	$$PWD/digestmd5responsetest.cpp \
+	$$PWD/scramsha1responsetest.cpp
@@ -5,11 +5,12 @@
 #include "xmpp/zlib/zlibcompressor.h"
 #include "xmpp/zlib/zlibdecompressor.h"
 
-CompressionHandler::CompressionHandler()
-	: errorCode_(0)
+CompressionHandler::CompressionHandler(int level, int windowBits)
+	: errorCode_(0), flushPolicy_(FlushEachWrite), maxPending_(0), flushScheduled_(false), plainFlushed_(0)
 {
+	windowBits = qBound(9, windowBits, MAX_WBITS);
 	outgoing_buffer_.open(QIODevice::ReadWrite);
-	compressor_ = new ZLibCompressor(&outgoing_buffer_);
+	compressor_ = new ZLibCompressor(&outgoing_buffer_, qBound(-1, level, 9), windowBits, qBound(1, windowBits - 7, 8));
 	
 	incoming_buffer_.open(QIODevice::ReadWrite);
 	decompressor_ = new ZLibDecompressor(&incoming_buffer_);
@@ -21,6 +22,21 @@ CompressionHandler::~CompressionHandler()
 	delete decompressor_;
 }
 
+void CompressionHandler::setFlushPolicy(FlushPolicy policy, int maxPending)
+{
+	flushPolicy_ = policy;
+	maxPending_ = maxPending;
+
+	// don't leave anything behind when switching to per-write flushing
+	if (flushPolicy_ == FlushEachWrite && compressor_->pending() > 0)
+		sync();
+}
+
+void CompressionHandler::setAdaptive(bool enabled)
+{
+	compressor_->setAdaptive(enabled);
+}
+
 void CompressionHandler::writeIncoming(const QByteArray& a)
 {
 	//qDebug("CompressionHandler::writeIncoming");
@@ -35,13 +51,55 @@ void CompressionHandler::writeIncoming(const QByteArray& a)
 void CompressionHandler::write(const QByteArray& a)
 {
 	//qDebug() << QString("CompressionHandler::write(%1)").arg(a.size());
+	if (flushPolicy_ == FlushBatched) {
+		errorCode_ = compressor_->writeDeferred(a);
+		if (errorCode_) {
+			QTimer::singleShot(0, this, SIGNAL(error()));
+		}
+		else if (maxPending_ > 0 && compressor_->pending() >= maxPending_) {
+			sync();
+		}
+		else if (!flushScheduled_) {
+			flushScheduled_ = true;
+			QTimer::singleShot(0, this, SLOT(flushPending()));
+		}
+		return;
+	}
+
 	errorCode_ = compressor_->write(a);
+	plainFlushed_ += a.size();
+	if (!errorCode_)
+		QTimer::singleShot(0, this, SIGNAL(readyReadOutgoing()));
+	else
+		QTimer::singleShot(0, this, SIGNAL(error()));
+}
+
+void CompressionHandler::sync()
+{
+	plainFlushed_ += compressor_->pending();
+	errorCode_ = compressor_->sync();
 	if (!errorCode_)
 		QTimer::singleShot(0, this, SIGNAL(readyReadOutgoing()));
 	else
 		QTimer::singleShot(0, this, SIGNAL(error()));
 }
 
+void CompressionHandler::flushPending()
+{
+	flushScheduled_ = false;
+
+	// already pushed out by hitting maxPending_
+	if (compressor_->pending() == 0)
+		return;
+
+	plainFlushed_ += compressor_->pending();
+	errorCode_ = compressor_->sync();
+	if (!errorCode_)
+		emit readyReadOutgoing();
+	else
+		emit error();
+}
+
 QByteArray CompressionHandler::read()
 {
 	//qDebug("CompressionHandler::read");
@@ -58,7 +116,11 @@ QByteArray CompressionHandler::readOutgoing(int* i)
 	QByteArray b = outgoing_buffer_.buffer();
 	outgoing_buffer_.buffer().clear();
 	outgoing_buffer_.reset();
-	*i = b.size();
+
+	// report the plain bytes this output accounts for, so the layer
+	// tracker can map written bytes back to the caller's data
+	*i = plainFlushed_;
+	plainFlushed_ = 0;
 	return b;
 }
 
@@ -66,3 +128,11 @@ int CompressionHandler::errorCode()
 {
 	return errorCode_;
 }
+
+void CompressionHandler::compact()
+{
+	compressor_->compact();
+	decompressor_->compact();
+	outgoing_buffer_.buffer().squeeze();
+	incoming_buffer_.buffer().squeeze();
+}
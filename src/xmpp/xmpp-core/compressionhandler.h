@@ -12,24 +12,52 @@ class CompressionHandler : public QObject
 	Q_OBJECT
 
 public:
-	CompressionHandler();
+	// FlushEachWrite sync flushes after every write.  FlushBatched
+	// collects the writes of one event loop turn (or up to maxPending
+	// plain bytes, if set) and flushes them together, which compresses
+	// better and costs less CPU.
+	enum FlushPolicy { FlushEachWrite, FlushBatched };
+
+	// level as for zlib, -1 for its default.  windowBits from 9 to 15
+	//   sizes the compressor's history: deflate takes about
+	//   2^(windowBits + 3) bytes, 256 KB at 15 and 8 KB at 10.  the
+	//   decompressor always takes whatever the peer sends
+	CompressionHandler(int level = -1, int windowBits = 15);
 	~CompressionHandler();
+	void setFlushPolicy(FlushPolicy policy, int maxPending = 0);
+
+	// let the compressor move its level with the traffic, starting from
+	//   the one given above, see ZLibCompressor::setAdaptive()
+	void setAdaptive(bool enabled);
 	void writeIncoming(const QByteArray& a);
 	void write(const QByteArray& a);
 	QByteArray read();
 	QByteArray readOutgoing(int*);
 	int errorCode();
 
+	// releases the buffers of both directions.  the zlib streams keep
+	//   their state (and memory), which the peer's side depends on
+	void compact();
+
 signals:
 	void readyRead();
 	void readyReadOutgoing();
 	void error();
 
+private slots:
+	void flushPending();
+
 private: 
+	void sync();
+
 	ZLibCompressor* compressor_;
 	ZLibDecompressor* decompressor_;
 	QBuffer outgoing_buffer_, incoming_buffer_;
 	int errorCode_;
+	FlushPolicy flushPolicy_;
+	int maxPending_;
+	bool flushScheduled_;
+	int plainFlushed_;
 };
 
 #endif
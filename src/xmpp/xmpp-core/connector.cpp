@@ -41,11 +41,16 @@
 #include "bsocket.h"
 #include "httpconnect.h"
 #include "httppoll.h"
+#include "httpbind.h"
+#include "websocket.h"
 #include "socks.h"
 #include "srvresolver.h"
 
 //#define XMPP_DEBUG
 
+// delay between starting parallel connection attempts (RFC 8305, 5)
+#define RACE_ATTEMPT_DELAY 250
+
 using namespace XMPP;
 
 //----------------------------------------------------------------------------
@@ -177,6 +182,30 @@ void AdvancedConnector::Proxy::setHttpPoll(const QString &host, quint16 port, co
 	v_url = url;
 }
 
+/** \brief Set type of connection to BOSH (XEP-0124, XEP-0206).
+    \param host HTTP proxy to go through. If it is empty, the host from the URL will be used.
+    \param port Proxy port
+    \param url URL of the connection manager. */
+void AdvancedConnector::Proxy::setHttpBind(const QString &host, quint16 port, const QString &url)
+{
+	t = HttpBind;
+	v_host = host;
+	v_port = port;
+	v_url = url;
+}
+
+/** \brief Set type of connection to WebSocket (RFC 7395).
+    \param host HTTP proxy to tunnel through with CONNECT. If it is empty, the host from the URL is connected to directly.
+    \param port Proxy port
+    \param url ws:// or wss:// URL of the server's endpoint. */
+void AdvancedConnector::Proxy::setWebSocket(const QString &host, quint16 port, const QString &url)
+{
+	t = WebSocket;
+	v_host = host;
+	v_port = port;
+	v_url = url;
+}
+
 void AdvancedConnector::Proxy::setSocks(const QString &host, quint16 port)
 {
 	t = Socks;
@@ -212,6 +241,7 @@ public:
 	QStringList opt_hosts;
 	int opt_port;
 	bool opt_probe, opt_ssl;
+	SocketOptions opt_sock;
 	Proxy proxy;
 
 	QStringList hostsToTry;
@@ -230,19 +260,67 @@ public:
 	SafeDelete sd;
 
 	QTimer *connectTimeout;
+
+	// direct connections are raced, RFC 8305 style: a new attempt is
+	//   started every RACE_ATTEMPT_DELAY ms (or as soon as one fails),
+	//   and the first socket to connect wins
+	class Attempt
+	{
+	public:
+		BSocket *sock;
+		QString host;
+		int port;
+	};
+
+	// addresses found in SrvCache, waiting to be delivered
+	bool cachedAddrsPending;
+	QList<QHostAddress> cachedAddrs;
+
+	bool racing;
+	bool raceResolving;
+	bool raceHaveAddr;
+	QString raceHost;
+	QList<QHostAddress> raceEarly; // handed out before the lookup finished
+	QList<Attempt> attempts;
+	QTimer *raceTimer;
 };
 
+// alternate address families, starting with IPv6 (RFC 8305, 4)
+static QList<QHostAddress> interleaveFamilies(const QList<QHostAddress> &in)
+{
+	QList<QHostAddress> v6, v4;
+	foreach(const QHostAddress &addr, in) {
+		if(addr.protocol() == QAbstractSocket::IPv6Protocol)
+			v6 += addr;
+		else
+			v4 += addr;
+	}
+
+	QList<QHostAddress> out;
+	while(!v6.isEmpty() || !v4.isEmpty()) {
+		if(!v6.isEmpty())
+			out += v6.takeFirst();
+		if(!v4.isEmpty())
+			out += v4.takeFirst();
+	}
+	return out;
+}
+
 AdvancedConnector::AdvancedConnector(QObject *parent)
 :Connector(parent)
 {
 	d = new Private;
 	d->bs = 0;
 	d->connectTimeout = new QTimer(this);
+	connect(&d->dns, SIGNAL(partialResultsReady(const QList<QHostAddress> &)), SLOT(dns_partialResultsReady(const QList<QHostAddress> &)));
 	connect(&d->dns, SIGNAL(resultsReady(const QList<QHostAddress> &)), SLOT(dns_resultsReady(const QList<QHostAddress> &)));
 	connect(&d->dns, SIGNAL(error(XMPP::AddressResolver::Error)), SLOT(dns_error(XMPP::AddressResolver::Error)));
 	connect(&d->srv, SIGNAL(resultsReady()), SLOT(srv_done()));
 	connect(d->connectTimeout, SIGNAL(timeout()), SLOT(t_timeout()));
 	d->connectTimeout->setSingleShot(true);
+	d->raceTimer = new QTimer(this);
+	connect(d->raceTimer, SIGNAL(timeout()), SLOT(race_timeout()));
+	d->raceTimer->setSingleShot(true);
 	d->opt_probe = false;
 	d->opt_ssl = false;
 	cleanup();
@@ -255,6 +333,9 @@ AdvancedConnector::~AdvancedConnector()
 	d->connectTimeout->disconnect(this);
 	d->connectTimeout->setParent(0);
 	d->connectTimeout->deleteLater();
+	d->raceTimer->disconnect(this);
+	d->raceTimer->setParent(0);
+	d->raceTimer->deleteLater();
 	delete d;
 }
 
@@ -274,6 +355,16 @@ void AdvancedConnector::cleanup()
 	delete d->bs;
 	d->bs = 0;
 
+	d->cachedAddrsPending = false;
+	d->cachedAddrs.clear();
+
+	race_cancel();
+	d->racing = false;
+	d->raceResolving = false;
+	d->raceHaveAddr = false;
+	d->raceHost.clear();
+	d->raceEarly.clear();
+
 	d->multi = false;
 	d->using_srv = false;
 	d->will_be_ssl = false;
@@ -330,6 +421,13 @@ void AdvancedConnector::setOptSSL(bool b)
 	d->opt_ssl = b;
 }
 
+void AdvancedConnector::setSocketOptions(const SocketOptions &opts)
+{
+	if(d->mode != Idle)
+		return;
+	d->opt_sock = opts;
+}
+
 void AdvancedConnector::connectToServer(const QString &server)
 {
 	if(d->mode != Idle)
@@ -342,6 +440,10 @@ void AdvancedConnector::connectToServer(const QString &server)
 	d->mode = Connecting;
 	d->connectHost.clear();
 
+	// race direct connections.  probing needs the attempts in order, and
+	//   proxies only ever get one at a time
+	d->racing = (d->proxy.type() == Proxy::None && !d->opt_probe);
+
 	// Encode the servername
 	d->server = QUrl::toAce(server);
 	//char* server_encoded;
@@ -373,6 +475,32 @@ void AdvancedConnector::connectToServer(const QString &server)
 		else
 			s->connectToHost(d->proxy.host(), d->proxy.port(), d->proxy.url());
 	}
+	else if(d->proxy.type() == Proxy::HttpBind) {
+		HttpBind *s = new HttpBind;
+		d->bs = s;
+		connect(s, SIGNAL(connected()), SLOT(bs_connected()));
+		connect(s, SIGNAL(error(int)), SLOT(bs_error(int)));
+		if(!d->proxy.user().isEmpty())
+			s->setAuth(d->proxy.user(), d->proxy.pass());
+
+		if(d->proxy.host().isEmpty())
+			s->connectToUrl(d->proxy.url());
+		else
+			s->connectToHost(d->proxy.host(), d->proxy.port(), d->proxy.url());
+	}
+	else if(d->proxy.type() == Proxy::WebSocket) {
+		WebSocket *s = new WebSocket;
+		d->bs = s;
+		connect(s, SIGNAL(connected()), SLOT(bs_connected()));
+		connect(s, SIGNAL(error(int)), SLOT(bs_error(int)));
+		if(!d->proxy.user().isEmpty())
+			s->setAuth(d->proxy.user(), d->proxy.pass());
+
+		if(d->proxy.host().isEmpty())
+			s->connectToUrl(d->proxy.url());
+		else
+			s->connectToHost(d->proxy.host(), d->proxy.port(), d->proxy.url());
+	}
 	else if (d->proxy.type() == Proxy::HttpConnect) {
 		if(!d->opt_hosts.isEmpty()) {
 			d->hostsToTry = d->opt_hosts;
@@ -436,11 +564,60 @@ void AdvancedConnector::do_resolve()
 #ifdef XMPP_DEBUG
 	printf("resolving [%s]\n", qPrintable(d->host));
 #endif
+	if(SrvCache::addresses(d->host, &d->cachedAddrs)) {
+		// deliver asynchronously, like a real lookup
+		d->cachedAddrsPending = true;
+		QMetaObject::invokeMethod(this, "dns_cached", Qt::QueuedConnection);
+		return;
+	}
+
 	d->dns.start(d->host.toLatin1());
 }
 
+void AdvancedConnector::dns_cached()
+{
+	if(!d->cachedAddrsPending)
+		return;
+
+	d->cachedAddrsPending = false;
+	QList<QHostAddress> results = d->cachedAddrs;
+	d->cachedAddrs.clear();
+	dns_resultsReady(results);
+}
+
+void AdvancedConnector::rememberTarget()
+{
+	if(d->using_srv)
+		SrvCache::setLastGood(QString("_xmpp-client._tcp.") + d->server, d->connectHost, d->port);
+}
+
+// one address family while the other is still being looked up.  only a
+//   race can use these, other connects wait for everything.
+void AdvancedConnector::dns_partialResultsReady(const QList<QHostAddress> &results)
+{
+	if(!d->racing)
+		return;
+
+	// still resolving, so race_next() waits for the rest once these are used up
+	d->raceHaveAddr = true;
+	d->raceHost = d->host;
+	d->raceEarly = results;
+	d->addrList += results;
+
+	if(!d->raceTimer->isActive())
+		race_next();
+}
+
 void AdvancedConnector::dns_resultsReady(const QList<QHostAddress> &results)
 {
+	if(sender() == &d->dns && !results.isEmpty())
+		SrvCache::storeAddresses(d->host, results, d->dns.ttl());
+
+	if(d->racing) {
+		race_dnsResults(results);
+		return;
+	}
+
 	if(results.isEmpty()) {
 #ifdef XMPP_DEBUG
 		printf("dns1\n");
@@ -522,6 +699,7 @@ void AdvancedConnector::do_connect()
 #endif
 		BSocket *s = new BSocket;
 		d->bs = s;
+		s->setOptions(d->opt_sock);
 		connect(s, SIGNAL(connected()), SLOT(bs_connected()));
 		connect(s, SIGNAL(error(int)), SLOT(bs_error(int)));
 		if(!d->curAddr.isNull())
@@ -547,6 +725,7 @@ void AdvancedConnector::do_connect()
 #endif
 		SocksClient *s = new SocksClient;
 		d->bs = s;
+		s->setSocketOptions(d->opt_sock);
 		connect(s, SIGNAL(connected()), SLOT(bs_connected()));
 		connect(s, SIGNAL(error(int)), SLOT(bs_error(int)));
 		if(!d->proxy.user().isEmpty())
@@ -628,6 +807,8 @@ void AdvancedConnector::bs_connected()
 	else if(d->will_be_ssl)
 		setUseSSL(true);
 
+	rememberTarget();
+
 	d->mode = Connected;
 	connected();
 }
@@ -685,6 +866,36 @@ void AdvancedConnector::bs_error(int x)
 				err = ErrProxyConnect;
 		}
 	}
+	else if(t == Proxy::HttpBind) {
+		if(x == HttpBind::ErrConnectionRefused)
+			err = ErrConnectionRefused;
+		else if(x == HttpBind::ErrHostNotFound)
+			err = ErrHostNotFound;
+		else {
+			proxyError = true;
+			if(x == HttpBind::ErrProxyAuth)
+				err = ErrProxyAuth;
+			else if(x == HttpBind::ErrProxyNeg)
+				err = ErrProxyNeg;
+			else
+				err = ErrProxyConnect;
+		}
+	}
+	else if(t == Proxy::WebSocket) {
+		if(x == WebSocket::ErrConnectionRefused)
+			err = ErrConnectionRefused;
+		else if(x == WebSocket::ErrHostNotFound)
+			err = ErrHostNotFound;
+		else {
+			proxyError = true;
+			if(x == WebSocket::ErrProxyAuth)
+				err = ErrProxyAuth;
+			else if(x == WebSocket::ErrProxyNeg)
+				err = ErrProxyNeg;
+			else
+				err = ErrProxyConnect;
+		}
+	}
 	else if(t == Proxy::Socks) {
 		if(x == SocksClient::ErrConnectionRefused)
 			err = ErrConnectionRefused;
@@ -754,6 +965,140 @@ void AdvancedConnector::bs_error(int x)
 	}
 }
 
+void AdvancedConnector::race_dnsResults(const QList<QHostAddress> &results)
+{
+	d->raceResolving = false;
+
+	// those handed out early are being tried already
+	QList<QHostAddress> fresh;
+	foreach(const QHostAddress &addr, results) {
+		if(!d->raceEarly.contains(addr))
+			fresh += addr;
+	}
+	d->raceEarly.clear();
+
+	if(!fresh.isEmpty()) {
+		d->raceHaveAddr = true;
+		d->raceHost = d->host;
+		d->addrList = interleaveFamilies(d->addrList + fresh);
+	}
+
+	// if the stagger delay ran out while we were resolving, go right away
+	if(!d->raceTimer->isActive())
+		race_next();
+	else if(d->attempts.isEmpty() && !d->raceResolving && d->addrList.isEmpty())
+		race_fail();
+}
+
+// start the next attempt, resolving the next target if we're out of
+//   addresses.  fails the connect if there is nothing left at all.
+void AdvancedConnector::race_next()
+{
+	if(d->addrList.isEmpty()) {
+		if(d->raceResolving)
+			return;
+
+		if(!d->hostsToTry.isEmpty()) {
+			d->raceResolving = true;
+			d->host = d->hostsToTry.takeFirst();
+			do_resolve();
+			return;
+		}
+
+		if(d->using_srv && !d->servers.isEmpty()) {
+			d->raceResolving = true;
+			tryNextSrv();
+			return;
+		}
+
+		if(d->attempts.isEmpty())
+			race_fail();
+		return;
+	}
+
+	Private::Attempt a;
+	a.host = d->raceHost;
+	a.port = d->port;
+	a.sock = new BSocket;
+	a.sock->setOptions(d->opt_sock);
+	connect(a.sock, SIGNAL(connected()), SLOT(race_connected()));
+	connect(a.sock, SIGNAL(error(int)), SLOT(race_error(int)));
+	d->attempts += a;
+
+	QHostAddress addr = d->addrList.takeFirst();
+#ifdef XMPP_DEBUG
+	printf("racing %s:%d\n", qPrintable(addr.toString()), a.port);
+#endif
+	a.sock->connectToHost(addr, a.port);
+
+	d->raceTimer->start(RACE_ATTEMPT_DELAY);
+}
+
+void AdvancedConnector::race_fail()
+{
+	int err = d->raceHaveAddr ? ErrConnectionRefused : ErrHostNotFound;
+	cleanup();
+	d->errorCode = err;
+	error();
+}
+
+// drop all attempts in progress.  the sockets may be the ones signalling
+//   us right now, so they are deleted later.
+void AdvancedConnector::race_cancel()
+{
+	d->raceTimer->stop();
+	foreach(const Private::Attempt &a, d->attempts) {
+		a.sock->disconnect(this);
+		a.sock->deleteLater();
+	}
+	d->attempts.clear();
+}
+
+void AdvancedConnector::race_timeout()
+{
+	race_next();
+}
+
+void AdvancedConnector::race_connected()
+{
+	BSocket *s = static_cast<BSocket*>(sender());
+	for(int n = 0; n < d->attempts.count(); ++n) {
+		if(d->attempts[n].sock == s) {
+			d->connectHost = d->attempts[n].host;
+			d->port = d->attempts[n].port;
+			d->attempts.removeAt(n);
+			break;
+		}
+	}
+
+	// the winner takes the place of the usual bytestream
+	race_cancel();
+	d->addrList.clear();
+	s->disconnect(this);
+	d->bs = s;
+	connect(s, SIGNAL(connected()), SLOT(bs_connected()));
+	connect(s, SIGNAL(error(int)), SLOT(bs_error(int)));
+
+	bs_connected();
+}
+
+void AdvancedConnector::race_error(int)
+{
+	BSocket *s = static_cast<BSocket*>(sender());
+	for(int n = 0; n < d->attempts.count(); ++n) {
+		if(d->attempts[n].sock == s) {
+			d->attempts.removeAt(n);
+			break;
+		}
+	}
+	s->disconnect(this);
+	s->deleteLater();
+
+	// a failure means we don't have to wait out the delay
+	d->raceTimer->stop();
+	race_next();
+}
+
 void AdvancedConnector::http_syncStarted()
 {
 	httpSyncStarted();
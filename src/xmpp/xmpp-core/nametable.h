@@ -0,0 +1,58 @@
+/*
+ * nametable.h - hashed lookup over static name tables
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_NAMETABLE_H
+#define XMPP_NAMETABLE_H
+
+#include <QHash>
+#include <QString>
+
+namespace XMPP
+{
+	// finds the value for a name in one of the static { name, value }
+	//   tables that map protocol strings such as error conditions, without
+	//   comparing against every entry (and converting every entry to a
+	//   QString on the way).  the table ends with a null name.  meant to
+	//   be built once, as a function-level static:
+	//
+	//     static NameTable t(condTable, &CondEntry::str, &CondEntry::cond);
+	class NameTable
+	{
+	public:
+		template <typename T>
+		NameTable(const T *table, const char * T::*name, int T::*value)
+		{
+			for(int n = 0; table[n].*name; ++n) {
+				QString s = QString::fromLatin1(table[n].*name);
+				if(!hash.contains(s))
+					hash.insert(s, table[n].*value);
+			}
+		}
+
+		inline int value(const QString &s, int notFound = -1) const
+		{
+			return hash.value(s, notFound);
+		}
+
+	private:
+		QHash<QString,int> hash;
+	};
+}
+
+#endif
@@ -48,18 +48,290 @@
 */
 
 #include "parser.h"
+#include "xmlatoms.h"
 
 #include <qtextcodec.h>
+#if QT_VERSION >= 0x040300
+# include <QXmlStreamReader>
+#endif
 #include <string.h>
 
 using namespace XMPP;
 
 static bool qt_bug_check = false;
 static bool qt_bug_have;
+static Parser::Backend default_backend = Parser::SaxBackend;
+
+//----------------------------------------------------------------------------
+// ParserLimits
+//----------------------------------------------------------------------------
+// see Parser::setLimits().  shared by the parser with its backend
+class ParserLimits
+{
+public:
+	int maxBytes, maxDepth, maxAttributes;
+	bool hit;
+
+	ParserLimits() :
+		maxBytes(0),
+		maxDepth(0),
+		maxAttributes(0),
+		hit(false)
+	{
+	}
+
+	// for an element opened at 'depth', the stanza being at depth 1
+	bool checkElement(int depth, int attributes)
+	{
+		if((maxDepth > 0 && depth > maxDepth) || (maxAttributes > 0 && attributes > maxAttributes))
+			hit = true;
+		return !hit;
+	}
+
+	bool checkSize(int size)
+	{
+		if(maxBytes > 0 && size > maxBytes)
+			hit = true;
+		return !hit;
+	}
+
+	// a string takes at least one byte per character, and at most three
+	bool checkString(const QString &str)
+	{
+		if(maxBytes <= 0 || str.length() * 3 <= maxBytes)
+			return !hit;
+		return checkSize(str.length() > maxBytes ? str.length() : str.toUtf8().size());
+	}
+};
+
+//----------------------------------------------------------------------------
+// ParserFilters
+//----------------------------------------------------------------------------
+namespace XMPP
+{
+	// see Parser::setFilters().  shared by the parser with its backend, and
+	//   keeps track of the stanza being read.  the backend calls begin()
+	//   with each depth 1 element and child() with each depth 2 one, and
+	//   builds nothing more of the stanza while skip is set
+	class ParserFilters
+	{
+	public:
+		QList<StanzaFilter> list;
+		bool skip;
+
+		ParserFilters() :
+			skip(false)
+		{
+		}
+
+		void reset()
+		{
+			skip = false;
+			pending.clear();
+		}
+
+		// a stanza half read is dropped if it was going to be already,
+		//   and kept otherwise
+		void setList(const QList<StanzaFilter> &_list)
+		{
+			list = _list;
+			pending.clear();
+		}
+
+		void begin(const QDomElement &e)
+		{
+			reset();
+			if(list.isEmpty() || !StanzaFilter::isFilterable(e))
+				return;
+			for(int n = 0; n < list.count(); ++n) {
+				const StanzaFilter &f = list[n];
+				if(!f.matchesStanza(e))
+					continue;
+				if(f.children.isEmpty()) {
+					skip = true;
+					pending.clear();
+					return;
+				}
+				Pending p;
+				p.filter = n;
+				p.seen = 0;
+				pending += p;
+			}
+		}
+
+		// false if the stanza is to be dropped after all, in which case
+		//   'e' isn't wanted either
+		bool child(const QDomElement &e)
+		{
+			for(int n = 0; n < pending.count();) {
+				Pending &p = pending[n];
+				const StanzaFilter &f = list[p.filter];
+				bool ruledOut = false;
+				for(int k = 0; k < f.children.count(); ++k) {
+					const StanzaFilter::Child &c = f.children[k];
+					if(!c.matches(e))
+						continue;
+					if(!c.present) {
+						ruledOut = true;
+						break;
+					}
+					p.seen |= quint32(1) << k;
+				}
+				if(ruledOut) {
+					pending.removeAt(n);
+					continue;
+				}
+
+				// with no child to rule it out, this is as good as the end
+				if(!f.hasAbsent && p.seen == f.presentMask) {
+					skip = true;
+					pending.clear();
+					return false;
+				}
+				++n;
+			}
+			return true;
+		}
+
+		// the stanza is complete.  true if it is to be dropped
+		bool end()
+		{
+			bool drop = skip;
+			foreach(const Pending &p, pending) {
+				if(p.seen == list[p.filter].presentMask)
+					drop = true;
+			}
+			reset();
+			return drop;
+		}
+
+		// drops the children of a stanza that turned out to match
+		static void strip(QDomElement *e)
+		{
+			while(e->hasChildNodes())
+				e->removeChild(e->firstChild());
+		}
+
+	private:
+		class Pending
+		{
+		public:
+			int filter;
+			quint32 seen; // the present children of it found so far
+		};
+
+		// filters that match the stanza so far but look at its children
+		QList<Pending> pending;
+	};
+}
 
 //----------------------------------------------------------------------------
 // StreamInput
 //----------------------------------------------------------------------------
+
+// most of a stream is ASCII, or UTF-8, which is taken over in runs of up to
+//   this many bytes rather than through the decoder one byte at a time
+#define RUN_MAX 4096
+
+// decoded characters already handed out and no longer part of the last
+//   data are dropped once there are this many
+#define OUT_COMPACT_SIZE 4096
+
+// decodes as much valid UTF-8 from 'p' as there is in one go, ASCII eight
+//   bytes at a time.  stops before a sequence that is invalid or incomplete,
+//   which is left to QTextDecoder.  returns the number of bytes used.
+static int decodeUtf8Run(const uchar *p, int size, QString *s)
+{
+	s->resize(size); // never more characters than bytes
+	QChar *d = s->data();
+	int i = 0;
+	int o = 0;
+	while(i < size) {
+		while(i + 8 <= size) {
+			quint64 w;
+			memcpy(&w, p + i, 8);
+			if(w & Q_UINT64_C(0x8080808080808080))
+				break;
+			for(int k = 0; k < 8; ++k)
+				d[o++] = QChar((ushort)p[i + k]);
+			i += 8;
+		}
+		if(i == size)
+			break;
+
+		uchar c = p[i];
+		if(c < 0x80) {
+			d[o++] = QChar((ushort)c);
+			++i;
+			continue;
+		}
+
+		int len;
+		uint uc, min;
+		if((c & 0xe0) == 0xc0) {
+			len = 2;
+			uc = c & 0x1f;
+			min = 0x80;
+		}
+		else if((c & 0xf0) == 0xe0) {
+			len = 3;
+			uc = c & 0x0f;
+			min = 0x800;
+		}
+		else if((c & 0xf8) == 0xf0) {
+			len = 4;
+			uc = c & 0x07;
+			min = 0x10000;
+		}
+		else
+			break;
+		if(i + len > size)
+			break;
+		int k;
+		for(k = 1; k < len; ++k) {
+			uchar cc = p[i + k];
+			if((cc & 0xc0) != 0x80)
+				break;
+			uc = (uc << 6) | (cc & 0x3f);
+		}
+		// overlong forms, surrogates and beyond unicode aren't valid
+		if(k < len || uc < min || uc > 0x10ffff || (uc >= 0xd800 && uc <= 0xdfff))
+			break;
+
+		if(uc >= 0x10000) {
+			uc -= 0x10000;
+			d[o++] = QChar((ushort)(0xd800 + (uc >> 10)));
+			d[o++] = QChar((ushort)(0xdc00 + (uc & 0x3ff)));
+		}
+		else
+			d[o++] = QChar((ushort)uc);
+		i += len;
+	}
+	s->resize(o);
+	return i;
+}
+
+// bytes a character took as UTF-8, a surrogate pair counting on its first half
+static inline int utf8Size(QChar c)
+{
+	ushort u = c.unicode();
+	if(u < 0x80)
+		return 1;
+	if(u < 0x800)
+		return 2;
+	if(u >= 0xd800 && u < 0xdc00)
+		return 4;
+	if(u >= 0xdc00 && u < 0xe000)
+		return 0;
+	return 3;
+}
+
+// the characters decoded so far are kept in 'out', and handed out from
+//   'outPos' onward.  the last data is the span from 'lastMark' to what has
+//   been handed out (plus a peeked character).  'in' holds the raw bytes,
+//   decoded up to 'at'.  a run is decoded ahead of the reader, but it is
+//   ASCII or valid UTF-8, so unprocessed() can still tell which bytes the
+//   reader hasn't got to.
 class StreamInput : public QXmlInputSource
 {
 public:
@@ -78,8 +350,12 @@ public:
 	{
 		delete dec;
 		dec = 0;
+		asciiRuns = false;
+		utf8Runs = false;
+		decPending = false;
+		bomChecked = false;
 		in.resize(0);
-		out = "";
+		clearOut();
 		at = 0;
 		paused = false;
 		mightChangeEncoding = true;
@@ -91,12 +367,39 @@ public:
 
 	void resetLastData()
 	{
-		last_string = "";
+		lastMark = delivered();
 	}
 
 	QString lastString() const
 	{
-		return last_string;
+		return out.mid(lastMark, delivered() - lastMark);
+	}
+
+	// what the last data has grown to, counting what is not decoded yet
+	//   as well
+	int pendingSize() const
+	{
+		return (out.size() - lastMark) + (in.size() - at);
+	}
+
+	// lets go of what was read already, and of the slack the buffers
+	//   grew while the last stanzas came in
+	void compact()
+	{
+		if(lastMark > 0) {
+			out.remove(0, lastMark);
+			outPos -= lastMark;
+			lastMark = 0;
+		}
+
+		// unprocessed() counts back from 'at' over a run
+		if(at > 0 && !runTail) {
+			in.remove(0, at);
+			at = 0;
+		}
+
+		out.squeeze();
+		in.squeeze();
 	}
 
 	void appendData(const QByteArray &a)
@@ -128,19 +431,23 @@ public:
 		if(mightChangeEncoding)
 			c = EndOfData;
 		else {
-			if(out.isEmpty()) {
+			if(outPos == out.size()) {
+				compactOut();
 				QString s;
-				if(!tryExtractPart(&s))
-					c = EndOfData;
+				if(tryExtractPart(&s))
+					out += s;
+			}
+			if(outPos == out.size())
+				c = EndOfData;
+			else {
+				c = out[outPos];
+				if(peek)
+					peeked = true;
 				else {
-					out = s;
-					c = out[0];
+					++outPos;
+					peeked = false;
 				}
 			}
-			else
-				c = out[0];
-			if(!peek)
-				out.remove(0, 1);
 		}
 		if(c == EndOfData) {
 #ifdef XMPP_PARSER_DEBUG
@@ -159,10 +466,13 @@ public:
 
 	QByteArray unprocessed() const
 	{
-		QByteArray a;
-		a.resize(in.size() - at);
-		memcpy(a.data(), in.data() + at, a.size());
-		return a;
+		// what is left of a run hasn't been read yet
+		int from = at;
+		if(runTail) {
+			for(int n = delivered(); n < out.size(); ++n)
+				from -= utf8Size(out[n]);
+		}
+		return in.mid(from);
 	}
 
 	void pause(bool b)
@@ -182,16 +492,61 @@ public:
 
 private:
 	QTextDecoder *dec;
+	bool asciiRuns, utf8Runs;
+	bool decPending; // the decoder holds part of a character
+	bool bomChecked;
 	QByteArray in;
 	QString out;
+	int outPos, lastMark;
+	bool peeked, runTail;
 	int at;
 	bool paused;
 	bool mightChangeEncoding;
 	QChar last;
 	QString v_encoding;
-	QString last_string;
 	bool checkBad;
 
+	// end of what the reader has been given, a peeked character included
+	int delivered() const
+	{
+		return (peeked && outPos < out.size()) ? outPos + 1 : outPos;
+	}
+
+	void clearOut()
+	{
+		out.truncate(0);
+		outPos = 0;
+		lastMark = 0;
+		peeked = false;
+		runTail = false;
+		bomChecked = false;
+	}
+
+	void compactOut()
+	{
+		if(lastMark < OUT_COMPACT_SIZE)
+			return;
+		out.remove(0, lastMark);
+		outPos -= lastMark;
+		lastMark = 0;
+	}
+
+	void setDecoder(QTextCodec *codec)
+	{
+		delete dec;
+		v_encoding = codec->name();
+		dec = codec->makeDecoder();
+
+		// Latin-1 and ASCII map bytes below 0x80 to themselves.  UTF-8
+		//   is decoded here, and the byte order mark skipped as the
+		//   decoder does.
+		int mib = codec->mibEnum();
+		utf8Runs = (mib == 106);
+		asciiRuns = (mib == 4 || mib == 3);
+		decPending = false;
+		bomChecked = false;
+	}
+
 	void processBuf()
 	{
 #ifdef XMPP_PARSER_DEBUG
@@ -220,8 +575,7 @@ private:
 			else
 				codec = QTextCodec::codecForMib(106); // UTF-8
 
-			v_encoding = codec->name();
-			dec = codec->makeDecoder();
+			setDecoder(codec);
 
 			// for utf16, put in the byte order mark
 			if(utf16) {
@@ -245,15 +599,11 @@ private:
 							codec = QTextCodec::codecForName(enc.toLatin1());
 
 						// changing codecs
-						if(codec) {
-							v_encoding = codec->name();
-							delete dec;
-							dec = codec->makeDecoder();
-						}
+						if(codec)
+							setDecoder(codec);
 						mightChangeEncoding = false;
-						out.truncate(0);
+						clearOut();
 						at = 0;
-						resetLastData();
 						break;
 					}
 				}
@@ -263,9 +613,8 @@ private:
 				if(checkBad && checkForBadChars(s)) {
 					// go to the parser
 					mightChangeEncoding = false;
-					out.truncate(0);
+					clearOut();
 					at = 0;
-					resetLastData();
 					break;
 				}
 				out += s;
@@ -302,12 +651,58 @@ private:
 			return "";
 	}
 
+	// only called once everything decoded has been handed out
 	bool tryExtractPart(QString *s)
 	{
+		// free processed data?
+		if(at >= 1024) {
+			char *p = in.data();
+			int size = in.size() - at;
+			memmove(p, p + at, size);
+			in.resize(size);
+			at = 0;
+		}
+
 		int size = in.size() - at;
 		if(size == 0)
 			return false;
-		uchar *p = (uchar *)in.data() + at;
+		const uchar *p = (const uchar *)in.constData() + at;
+
+		if(utf8Runs && !decPending) {
+			if(!bomChecked) {
+				if(size < 3 && p[0] == 0xef)
+					return false;
+				bomChecked = true;
+				if(size >= 3 && p[0] == 0xef && p[1] == 0xbb && p[2] == 0xbf) {
+					p += 3;
+					at += 3;
+					size -= 3;
+					if(size == 0)
+						return false;
+				}
+			}
+			int n = decodeUtf8Run(p, qMin(size, RUN_MAX), s);
+			if(n > 0) {
+				at += n;
+				runTail = true;
+				return true;
+			}
+		}
+		else if(asciiRuns) {
+			int n = 0;
+			while(n < size && n < RUN_MAX && p[n] < 0x80)
+				++n;
+			if(n > 0) {
+				*s = QString::fromLatin1((const char *)p, n);
+				at += n;
+				runTail = true;
+				return true;
+			}
+		}
+
+		// anything else a byte at a time, so that 'at' stays on a
+		//   character boundary
+		runTail = false;
 		QString nextChars;
 		while(1) {
 			nextChars = dec->toUnicode((const char *)p, 1);
@@ -315,21 +710,13 @@ private:
 			++at;
 			if(!nextChars.isEmpty())
 				break;
-			if(at == (int)in.size())
+			if(at == (int)in.size()) {
+				decPending = true;
 				return false;
+			}
 		}
-		last_string += nextChars;
+		decPending = false;
 		*s = nextChars;
-
-		// free processed data?
-		if(at >= 1024) {
-			char *p = in.data();
-			int size = in.size() - at;
-			memmove(p, p + at, size);
-			in.resize(size);
-			at = 0;
-		}
-
 		return true;
 	}
 
@@ -357,10 +744,12 @@ namespace XMPP
 	class ParserHandler : public QXmlDefaultHandler
 	{
 	public:
-		ParserHandler(StreamInput *_in, QDomDocument *_doc)
+		ParserHandler(StreamInput *_in, QDomDocument *_doc, ParserLimits *_limits, ParserFilters *_filters)
 		{
 			in = _in;
 			doc = _doc;
+			limits = _limits;
+			filters = _filters;
 			needMore = false;
 		}
 
@@ -393,6 +782,10 @@ namespace XMPP
 
 		bool startElement(const QString &namespaceURI, const QString &localName, const QString &qName, const QXmlAttributes &atts)
 		{
+			// failing here stops the reader with an error
+			if(!limits->checkElement(depth, atts.length()))
+				return false;
+
 			if(depth == 0) {
 				Parser::Event *e = new Parser::Event;
 				QXmlAttributes a;
@@ -412,7 +805,14 @@ namespace XMPP
 				in->pause(true);
 			}
 			else {
-				QDomElement e = doc->createElementNS(namespaceURI, qName);
+				// a stanza being dropped isn't built any further
+				if(filters->skip) {
+					++depth;
+					return true;
+				}
+
+				const XmlAtoms &a = XmlAtoms::get();
+				QDomElement e = doc->createElementNS(a.intern(namespaceURI), a.intern(qName));
 				for(int n = 0; n < atts.length(); ++n) {
 					QString uri = atts.uri(n);
 					QString ln = atts.localName(n);
@@ -425,13 +825,16 @@ namespace XMPP
 					else
 						have = e.hasAttribute(ln);
 					if(!have)
-						e.setAttributeNS(uri, atts.qName(n), atts.value(n));
+						e.setAttributeNS(a.intern(uri), a.intern(atts.qName(n)), a.intern(atts.value(n)));
 				}
 
 				if(depth == 1) {
 					elem = e;
 					current = e;
+					filters->begin(e);
 				}
+				else if(depth == 2 && !filters->child(e))
+					ParserFilters::strip(&elem);
 				else {
 					current.appendChild(e);
 					current = e;
@@ -456,6 +859,10 @@ namespace XMPP
 				// done with a depth 1 element?
 				if(depth == 1) {
 					Parser::Event *e = new Parser::Event;
+					if(filters->end()) {
+						ParserFilters::strip(&elem);
+						e->setFiltered();
+					}
 					e->setElement(elem);
 					e->setActualString(in->lastString());
 					in->resetLastData();
@@ -465,7 +872,7 @@ namespace XMPP
 					elem = QDomElement();
 					current = QDomElement();
 				}
-				else
+				else if(!filters->skip)
 					current = current.parentNode().toElement();
 			}
 
@@ -482,7 +889,7 @@ namespace XMPP
 				if(content.isEmpty())
 					return true;
 
-				if(!current.isNull()) {
+				if(!current.isNull() && !filters->skip) {
 					QDomText text = doc->createTextNode(content);
 					current.appendChild(text);
 				}
@@ -497,6 +904,12 @@ namespace XMPP
 			return true;
 		}*/
 
+		// a depth 1 element is being built
+		bool busy() const
+		{
+			return !elem.isNull();
+		}
+
 		void checkNeedMore()
 		{
 			// Here we will work around QXmlSimpleReader strangeness and self-closing tags.
@@ -541,6 +954,8 @@ namespace XMPP
 
 		StreamInput *in;
 		QDomDocument *doc;
+		ParserLimits *limits;
+		ParserFilters *filters;
 		int depth;
 		QStringList nsnames, nsvalues;
 		QDomElement elem, current;
@@ -550,6 +965,279 @@ namespace XMPP
 };
 
 
+#if QT_VERSION >= 0x040300
+//----------------------------------------------------------------------------
+// StreamParser
+//----------------------------------------------------------------------------
+// Alternative to StreamInput/ParserHandler.  Incoming bytes are decoded in
+// bulk and handed to QXmlStreamReader, which is driven only as far as the
+// next document open/close or depth-1 element.  The decoded text of the
+// current event is kept in 'pending' so that actualString() and
+// unprocessed() behave exactly like the SAX backend.
+namespace XMPP
+{
+	class StreamParser
+	{
+	public:
+		StreamParser(QDomDocument *_doc, ParserLimits *_limits, ParserFilters *_filters)
+		{
+			doc = _doc;
+			limits = _limits;
+			filters = _filters;
+			dec = 0;
+			reset();
+		}
+
+		~StreamParser()
+		{
+			delete dec;
+		}
+
+		void reset()
+		{
+			delete dec;
+			dec = 0;
+			reader.clear();
+			reader.setNamespaceProcessing(true);
+			in.resize(0);
+			at = 0;
+			fed = 0;
+			utf16 = false;
+			pending = QString();
+			pendingBase = 0;
+			depth = 0;
+			elem = QDomElement();
+			current = QDomElement();
+			v_encoding = "";
+		}
+
+		void appendData(const QByteArray &a)
+		{
+			appendArray(&in, a);
+			decode();
+		}
+
+		// returns false if more data is needed
+		bool readNext(Parser::Event *e)
+		{
+			while(1) {
+				QXmlStreamReader::TokenType t = reader.readNext();
+				if(t == QXmlStreamReader::Invalid) {
+					if(reader.error() == QXmlStreamReader::PrematureEndOfDocumentError)
+						return false;
+					e->setError();
+					return true;
+				}
+
+				if(t == QXmlStreamReader::StartElement) {
+					if(!limits->checkElement(depth, reader.attributes().count())) {
+						e->setError();
+						return true;
+					}
+
+					if(depth == 0) {
+						QXmlAttributes a;
+						QXmlStreamAttributes sa = reader.attributes();
+						for(int n = 0; n < sa.count(); ++n) {
+							const QXmlStreamAttribute &i = sa.at(n);
+							a.append(i.qualifiedName().toString(), i.namespaceUri().toString(), i.name().toString(), i.value().toString());
+						}
+						QStringList nsnames, nsvalues;
+						QXmlStreamNamespaceDeclarations decl = reader.namespaceDeclarations();
+						for(int n = 0; n < decl.count(); ++n) {
+							nsnames += decl.at(n).prefix().toString();
+							nsvalues += decl.at(n).namespaceUri().toString();
+						}
+						e->setDocumentOpen(reader.namespaceUri().toString(), reader.name().toString(), reader.qualifiedName().toString(), a, nsnames, nsvalues);
+						++depth;
+						takeActualString(e);
+						return true;
+					}
+
+					// a stanza being dropped isn't built any further
+					if(filters->skip) {
+						++depth;
+						continue;
+					}
+
+					// the reader rejects duplicate attributes itself, so
+					//   there is no need for a hasAttributeNS() check here
+					// well-known names and values come from the atom table
+					//   rather than new strings
+					const XmlAtoms &at = XmlAtoms::get();
+					QDomElement i = doc->createElementNS(at.intern(reader.namespaceUri()), at.intern(reader.qualifiedName()));
+					QXmlStreamAttributes sa = reader.attributes();
+					for(int n = 0; n < sa.count(); ++n) {
+						const QXmlStreamAttribute &a = sa.at(n);
+						i.setAttributeNS(at.intern(a.namespaceUri()), at.intern(a.qualifiedName()), at.intern(a.value()));
+					}
+					if(depth == 1) {
+						elem = i;
+						filters->begin(i);
+					}
+					else if(depth == 2 && !filters->child(i)) {
+						ParserFilters::strip(&elem);
+						++depth;
+						continue;
+					}
+					else
+						current.appendChild(i);
+					current = i;
+					++depth;
+				}
+				else if(t == QXmlStreamReader::EndElement) {
+					--depth;
+					if(depth == 0) {
+						e->setDocumentClose(reader.namespaceUri().toString(), reader.name().toString(), reader.qualifiedName().toString());
+						takeActualString(e);
+						return true;
+					}
+					else if(depth == 1) {
+						if(filters->end()) {
+							ParserFilters::strip(&elem);
+							e->setFiltered();
+						}
+						e->setElement(elem);
+						elem = QDomElement();
+						current = QDomElement();
+						takeActualString(e);
+						return true;
+					}
+					else if(!filters->skip)
+						current = current.parentNode().toElement();
+				}
+				else if(t == QXmlStreamReader::Characters) {
+					if(depth >= 2 && !filters->skip && !reader.text().isEmpty())
+						current.appendChild(doc->createTextNode(reader.text().toString()));
+				}
+				// comments, processing instructions and the rest are
+				//   ignored, just like QXmlDefaultHandler does
+			}
+		}
+
+		QByteArray unprocessed() const
+		{
+			return in.mid(at);
+		}
+
+		// bytes since the last event
+		int pendingSize() const
+		{
+			return in.size() - at;
+		}
+
+		// a depth 1 element is being built
+		bool busy() const
+		{
+			return !elem.isNull();
+		}
+
+		void compact()
+		{
+			if(at > 0) {
+				in.remove(0, at);
+				fed -= at;
+				at = 0;
+			}
+			in.squeeze();
+			pending.squeeze();
+		}
+
+		QString encoding() const
+		{
+			return v_encoding;
+		}
+
+	private:
+		QDomDocument *doc;
+		ParserLimits *limits;
+		ParserFilters *filters;
+		QXmlStreamReader reader;
+		QTextDecoder *dec;
+		QByteArray in;  // raw bytes, starting at the last event boundary
+		int at;         // bytes before 'fed' that belong to reported events
+		int fed;        // bytes handed to the decoder so far
+		bool utf16;
+		QString pending;
+		qint64 pendingBase;
+		int depth;
+		QDomElement elem, current;
+		QString v_encoding;
+
+		static void appendArray(QByteArray *a, const QByteArray &b)
+		{
+			int oldsize = a->size();
+			a->resize(oldsize + b.size());
+			memcpy(a->data() + oldsize, b.data(), b.size());
+		}
+
+		void decode()
+		{
+			if(!dec) {
+				const uchar *p = (const uchar *)in.data();
+				int size = in.size();
+				if(size == 0)
+					return;
+				if(p[0] == 0xfe || p[0] == 0xff) {
+					// probably going to be a UTF-16 byte order mark
+					if(size < 2)
+						return;
+					if((p[0] == 0xfe && p[1] == 0xff) || (p[0] == 0xff && p[1] == 0xfe)) {
+						utf16 = true;
+						at = 2;
+					}
+				}
+				else if(p[0] == 0xef) {
+					// UTF-8 byte order mark?
+					if(size < 3)
+						return;
+					if(p[1] == 0xbb && p[2] == 0xbf)
+						at = 3;
+				}
+
+				// the decoders eat the byte order mark, so it is
+				//   accounted for in 'at' above
+				QTextCodec *codec = QTextCodec::codecForMib(utf16 ? 1000 : 106);
+				v_encoding = codec->name();
+				dec = codec->makeDecoder();
+			}
+
+			if(fed >= in.size())
+				return;
+			QString s = dec->toUnicode(in.data() + fed, in.size() - fed);
+			fed = in.size();
+			if(s.isEmpty())
+				return;
+			pending += s;
+			reader.addData(s);
+		}
+
+		void takeActualString(Parser::Event *e)
+		{
+			qint64 offset = reader.characterOffset();
+			int len = (int)(offset - pendingBase);
+			QString str = pending.left(len);
+			e->setActualString(str);
+			pending.remove(0, len);
+			pendingBase = offset;
+
+			// account for the bytes that produced this string
+			if(utf16)
+				at += str.length() * 2;
+			else
+				at += str.toUtf8().size();
+
+			// free processed data
+			if(at >= 1024) {
+				in.remove(0, at);
+				fed -= at;
+				at = 0;
+			}
+		}
+	};
+}
+#endif
+
 //----------------------------------------------------------------------------
 // Event
 //----------------------------------------------------------------------------
@@ -562,6 +1250,12 @@ public:
 	QDomElement e;
 	QString str;
 	QStringList nsnames, nsvalues;
+	bool filtered;
+
+	Private() :
+		filtered(false)
+	{
+	}
 };
 
 Parser::Event::Event()
@@ -643,6 +1337,11 @@ QDomElement Parser::Event::element() const
 	return d->e;
 }
 
+bool Parser::Event::isFiltered() const
+{
+	return d->filtered;
+}
+
 void Parser::Event::setDocumentOpen(const QString &namespaceURI, const QString &localName, const QString &qName, const QXmlAttributes &atts, const QStringList &nsnames, const QStringList &nsvalues)
 {
 	if(!d)
@@ -674,6 +1373,13 @@ void Parser::Event::setElement(const QDomElement &elem)
 	d->e = elem;
 }
 
+void Parser::Event::setFiltered()
+{
+	if(!d)
+		d = new Private;
+	d->filtered = true;
+}
+
 void Parser::Event::setError()
 {
 	if(!d)
@@ -694,10 +1400,16 @@ class Parser::Private
 public:
 	Private()
 	{
-		doc = 0;
+		backend = default_backend;
+		sharedDoc = false;
 		in = 0;
 		handler = 0;
 		reader = 0;
+#if QT_VERSION >= 0x040300
+		sp = 0;
+#else
+		backend = SaxBackend;
+#endif
 		reset();
 	}
 
@@ -711,12 +1423,30 @@ public:
 		delete reader;
 		delete handler;
 		delete in;
-		delete doc;
+#if QT_VERSION >= 0x040300
+		delete sp;
+		sp = 0;
+#endif
+		reader = 0;
+		handler = 0;
+		in = 0;
+		limits.hit = false;
+		filters.reset();
+
+		// a document of our own starts over, which lets go of everything
+		//   the last stream left in it
+		if(!sharedDoc)
+			doc = QDomDocument();
 
 		if(create) {
-			doc = new QDomDocument;
+#if QT_VERSION >= 0x040300
+			if(backend == StreamReaderBackend) {
+				sp = new StreamParser(&doc, &limits, &filters);
+				return;
+			}
+#endif
 			in = new StreamInput;
-			handler = new ParserHandler(in, doc);
+			handler = new ParserHandler(in, &doc, &limits, &filters);
 			reader = new QXmlSimpleReader;
 			reader->setContentHandler(handler);
 
@@ -727,10 +1457,37 @@ public:
 		}
 	}
 
-	QDomDocument *doc;
+	void compact()
+	{
+		bool busy = false;
+#if QT_VERSION >= 0x040300
+		if(sp) {
+			sp->compact();
+			busy = sp->busy();
+		}
+#endif
+		if(in) {
+			in->compact();
+			busy = handler->busy();
+		}
+
+		// elements handed out already hold on to the old document, so
+		//   only what nobody uses anymore goes away
+		if(!sharedDoc && !busy)
+			doc = QDomDocument();
+	}
+
+	Backend backend;
+	QDomDocument doc;
+	bool sharedDoc;
+	ParserLimits limits;
+	ParserFilters filters;
 	StreamInput *in;
 	ParserHandler *handler;
 	QXmlSimpleReader *reader;
+#if QT_VERSION >= 0x040300
+	StreamParser *sp;
+#endif
 };
 
 Parser::Parser()
@@ -740,7 +1497,7 @@ Parser::Parser()
 	// check for evil bug in Qt <= 3.2.1
 	if(!qt_bug_check) {
 		qt_bug_check = true;
-		QDomElement e = d->doc->createElementNS("someuri", "somename");
+		QDomElement e = d->doc.createElementNS("someuri", "somename");
 		if(e.hasAttributeNS("someuri", "somename"))
 			qt_bug_have = true;
 		else
@@ -753,13 +1510,50 @@ Parser::~Parser()
 	delete d;
 }
 
+void Parser::setDefaultBackend(Backend b)
+{
+	default_backend = b;
+}
+
+Parser::Backend Parser::defaultBackend()
+{
+	return default_backend;
+}
+
+Parser::Backend Parser::backend() const
+{
+	return d->backend;
+}
+
 void Parser::reset()
 {
 	d->reset();
 }
 
+void Parser::compact()
+{
+	d->compact();
+}
+
+void Parser::setDocument(const QDomDocument &doc)
+{
+	d->sharedDoc = !doc.isNull();
+	d->doc = doc;
+}
+
+QDomDocument Parser::document() const
+{
+	return d->doc;
+}
+
 void Parser::appendData(const QByteArray &a)
 {
+#if QT_VERSION >= 0x040300
+	if(d->sp) {
+		d->sp->appendData(a);
+		return;
+	}
+#endif
 	d->in->appendData(a);
 
 	// if handler was waiting for more, give it a kick
@@ -767,9 +1561,46 @@ void Parser::appendData(const QByteArray &a)
 		d->handler->checkNeedMore();
 }
 
+void Parser::setLimits(int maxStanzaBytes, int maxDepth, int maxAttributes)
+{
+	d->limits.maxBytes = qMax(maxStanzaBytes, 0);
+	d->limits.maxDepth = qMax(maxDepth, 0);
+	d->limits.maxAttributes = qMax(maxAttributes, 0);
+}
+
+bool Parser::limitExceeded() const
+{
+	return d->limits.hit;
+}
+
+void Parser::setFilters(const QList<StanzaFilter> &filters)
+{
+	d->filters.setList(filters);
+}
+
 Parser::Event Parser::readNext()
 {
 	Event e;
+	if(d->limits.hit) {
+		e.setError();
+		return e;
+	}
+
+#if QT_VERSION >= 0x040300
+	if(d->sp) {
+		// with no event, all there is belongs to the one coming
+		if(!d->sp->readNext(&e))
+			d->limits.checkSize(d->sp->pendingSize());
+		else if(e.type() == Event::Element)
+			d->limits.checkString(e.actualString());
+
+		if(d->limits.hit && e.type() != Event::Error) {
+			e = Event();
+			e.setError();
+		}
+		return e;
+	}
+#endif
 	if(d->handler->needMore)
 		return e;
 	Event *ep = d->handler->takeEvent();
@@ -779,20 +1610,36 @@ Parser::Event Parser::readNext()
 			return e;
 		}
 		ep = d->handler->takeEvent();
-		if(!ep)
+		if(!ep) {
+			if(!d->limits.checkSize(d->in->pendingSize()))
+				e.setError();
 			return e;
+		}
 	}
 	e = *ep;
 	delete ep;
+
+	if(e.type() == Event::Element && !d->limits.checkString(e.actualString())) {
+		e = Event();
+		e.setError();
+	}
 	return e;
 }
 
 QByteArray Parser::unprocessed() const
 {
+#if QT_VERSION >= 0x040300
+	if(d->sp)
+		return d->sp->unprocessed();
+#endif
 	return d->in->unprocessed();
 }
 
 QString Parser::encoding() const
 {
+#if QT_VERSION >= 0x040300
+	if(d->sp)
+		return d->sp->encoding();
+#endif
 	return d->in->encoding();
 }
@@ -23,15 +23,28 @@
 
 #include <qdom.h>
 #include <qxml.h>
+#include "xmpp_stanzafilter.h"
 
 namespace XMPP
 {
 	class Parser
 	{
 	public:
+		// SaxBackend is the original QXmlSimpleReader/QDom builder.
+		// StreamReaderBackend tokenizes with QXmlStreamReader and builds
+		// each depth-1 element directly, without the per-character
+		// QXmlInputSource round trip.  It requires Qt 4.3 or greater and
+		// only accepts UTF-8/UTF-16 streams (see RFC 3920 section 11.5).
+		enum Backend { SaxBackend, StreamReaderBackend };
+
 		Parser();
 		~Parser();
 
+		// applies to Parser objects constructed after the call
+		static void setDefaultBackend(Backend b);
+		static Backend defaultBackend();
+		Backend backend() const;
+
 		class Event
 		{
 		public:
@@ -53,8 +66,11 @@ namespace XMPP
 			QString qName() const;
 			QXmlAttributes atts() const;
 
-			// for element
+			// for element.  a filtered element is one that matched a
+			//   filter, and is what the stanza would have been without
+			//   its children
 			QDomElement element() const;
+			bool isFiltered() const;
 
 			// for any
 			QString actualString() const;
@@ -63,6 +79,7 @@ namespace XMPP
 			void setDocumentOpen(const QString &namespaceURI, const QString &localName, const QString &qName, const QXmlAttributes &atts, const QStringList &nsnames, const QStringList &nsvalues);
 			void setDocumentClose(const QString &namespaceURI, const QString &localName, const QString &qName);
 			void setElement(const QDomElement &elem);
+			void setFiltered();
 			void setError();
 			void setActualString(const QString &);
 
@@ -71,6 +88,32 @@ namespace XMPP
 			Private *d;
 		};
 
+		// received elements are created in the given document, which is
+		//   kept across reset().  a null document goes back to one of the
+		//   parser's own, renewed at every reset().
+		void setDocument(const QDomDocument &doc);
+		QDomDocument document() const;
+
+		// bounds on what the peer may send, 0 for none (the default).
+		//   a depth-1 element of more than maxStanzaBytes, an element
+		//   nested deeper than maxDepth (counting the depth-1 element as
+		//   1), or one with more than maxAttributes attributes turns
+		//   readNext() into an Error, and limitExceeded() true until
+		//   reset().  checked as the data comes in, so no more than about
+		//   maxStanzaBytes is held.  kept across reset().
+		void setLimits(int maxStanzaBytes, int maxDepth, int maxAttributes);
+		bool limitExceeded() const;
+
+		// stanzas to drop, see StanzaFilter.  they still come out of
+		//   readNext(), bare and with Event::isFiltered(), so as to be
+		//   counted where that matters.  kept across reset().
+		void setFilters(const QList<StanzaFilter> &filters);
+
+		// gives back buffer memory, and renews a document of the parser's
+		//   own unless an element is half read.  for streams that have
+		//   gone idle; parsing goes on as before
+		void compact();
+
 		void reset();
 		void appendData(const QByteArray &a);
 		Event readNext();
@@ -28,8 +28,13 @@
 #include <qca.h>
 #include <QList>
 #include <QByteArray>
+#include <QDateTime>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QtCrypto>
 
+#include "nametable.h"
+
 #ifdef XMPP_TEST
 #include "td.h"
 #endif
@@ -88,6 +93,8 @@ StreamFeatures::StreamFeatures()
 	bind_supported = false;
 	tls_required = false;
 	compress_supported = false;
+	sm_supported = false;
+	rosterver_supported = false;
 }
 
 //----------------------------------------------------------------------------
@@ -138,6 +145,7 @@ BasicProtocol::BasicProtocol()
 :XmlProtocol()
 {
 	init();
+	setDocument(QDomDocument(QString()));
 }
 
 BasicProtocol::~BasicProtocol()
@@ -154,6 +162,17 @@ void BasicProtocol::init()
 	ready = false;
 	stanzasPending = 0;
 	stanzasWritten = 0;
+	sm_enabled = false;
+	sm_in_h = 0;
+	sm_out_h = 0;
+	sm_unacked.clear();
+	sm_ackRequested = false;
+}
+
+void BasicProtocol::setDocument(const QDomDocument &d)
+{
+	doc = d.isNull() ? QDomDocument(QString()) : d;
+	XmlProtocol::setDocument(doc);
 }
 
 void BasicProtocol::reset()
@@ -184,6 +203,61 @@ void BasicProtocol::sendStanza(const QDomElement &e)
 	sendList += i;
 }
 
+void BasicProtocol::smAcked(quint32 h)
+{
+	// h counts up from the start of the session, wrapping at 2^32
+	quint32 n = h - sm_out_h;
+	if(n > (quint32)sm_unacked.count())
+		n = sm_unacked.count();
+	for(quint32 k = 0; k < n; ++k)
+		sm_unacked.removeFirst();
+	sm_out_h = h;
+	sm_ackRequested = false;
+}
+
+void BasicProtocol::smRequeueUnacked()
+{
+	for(int n = sm_unacked.count() - 1; n >= 0; --n) {
+		SendItem i;
+		i.stanzaToSend = sm_unacked[n];
+		i.doWhitespace = false;
+		sendList.prepend(i);
+	}
+	sm_unacked.clear();
+}
+
+void BasicProtocol::writeQueuedStanzas()
+{
+	QList<SendItem> rest;
+	foreach(const SendItem &i, sendList) {
+		if(!i.stanzaToSend.isNull()) {
+			++stanzasPending;
+			writeElement(i.stanzaToSend, TypeStanza, true);
+		}
+		else
+			rest += i;
+	}
+	sendList = rest;
+}
+
+QList<QDomElement> BasicProtocol::smPendingStanzas() const
+{
+	QList<QDomElement> list = sm_unacked;
+	foreach(const SendItem &i, sendList) {
+		if(!i.stanzaToSend.isNull())
+			list += i.stanzaToSend;
+	}
+	return list;
+}
+
+void BasicProtocol::sendStanzaBytes(const QByteArray &a)
+{
+	Q_ASSERT(!sm_enabled);
+	SendItem i;
+	i.stanzaBytesToSend = a;
+	sendList += i;
+}
+
 void BasicProtocol::sendDirect(const QString &s)
 {
 	SendItem i;
@@ -259,20 +333,14 @@ void BasicProtocol::setSASLAuthed()
 
 int BasicProtocol::stringToSASLCond(const QString &s)
 {
-	for(int n = 0; saslCondTable[n].str; ++n) {
-		if(s == saslCondTable[n].str)
-			return saslCondTable[n].cond;
-	}
-	return -1;
+	static NameTable t(saslCondTable, &SASLCondEntry::str, &SASLCondEntry::cond);
+	return t.value(s);
 }
 
 int BasicProtocol::stringToStreamCond(const QString &s)
 {
-	for(int n = 0; streamCondTable[n].str; ++n) {
-		if(s == streamCondTable[n].str)
-			return streamCondTable[n].cond;
-	}
-	return -1;
+	static NameTable t(streamCondTable, &StreamCondEntry::str, &StreamCondEntry::cond);
+	return t.value(s);
 }
 
 QString BasicProtocol::saslCondToString(int x)
@@ -479,6 +547,8 @@ void BasicProtocol::handleDocOpen(const Parser::Event &pe)
 
 bool BasicProtocol::handleError()
 {
+	if(parserLimitExceeded())
+		return errorAndClose(PolicyViolation);
 	if(isIncoming())
 		return errorAndClose(XmlNotWellFormed);
 	else
@@ -540,9 +610,16 @@ bool BasicProtocol::doStep(const QDomElement &e)
 			// outgoing stanza?
 			if(!i.stanzaToSend.isNull()) {
 				++stanzasPending;
+				if(sm_enabled)
+					sm_unacked += i.stanzaToSend;
 				writeElement(i.stanzaToSend, TypeStanza, true);
 				event = ESend;
 			}
+			else if(!i.stanzaBytesToSend.isEmpty()) {
+				++stanzasPending;
+				writeData(i.stanzaBytesToSend, TypeStanza, true);
+				event = ESend;
+			}
 			// direct send?
 			else if(!i.stringToSend.isEmpty()) {
 				writeString(i.stringToSend, TypeDirect, true);
@@ -556,6 +633,14 @@ bool BasicProtocol::doStep(const QDomElement &e)
 			return true;
 		}
 		else {
+			// a burst went out, so ask the server to account for it
+			if(sm_enabled && !sm_unacked.isEmpty() && !sm_ackRequested) {
+				sm_ackRequested = true;
+				send(doc.createElementNS(NS_SM, "r"));
+				event = ESend;
+				return true;
+			}
+
 			// if we have pending outgoing stanzas, ask for write notification
 			if(stanzasPending)
 				notify |= NSend;
@@ -593,6 +678,47 @@ void BasicProtocol::handleStreamOpen(const Parser::Event &)
 //----------------------------------------------------------------------------
 // CoreProtocol
 //----------------------------------------------------------------------------
+// dialback pairs granted by any stream, as "to from" of the db:result,
+//   with the time until which they are trusted
+class DialbackCache
+{
+public:
+	QMutex m;
+	int secs;
+	QHash<QString,uint> until;
+
+	DialbackCache() : secs(0) {}
+
+	static QString keyOf(const QString &to, const QString &from)
+	{
+		return to + ' ' + from;
+	}
+
+	bool contains(const QString &to, const QString &from)
+	{
+		QMutexLocker locker(&m);
+		if(secs <= 0)
+			return false;
+		QHash<QString,uint>::Iterator it = until.find(keyOf(to, from));
+		if(it == until.end())
+			return false;
+		if(it.value() < QDateTime::currentDateTime().toTime_t()) {
+			until.erase(it);
+			return false;
+		}
+		return true;
+	}
+
+	void insert(const QString &to, const QString &from)
+	{
+		QMutexLocker locker(&m);
+		if(secs > 0)
+			until.insert(keyOf(to, from), QDateTime::currentDateTime().toTime_t() + secs);
+	}
+};
+
+Q_GLOBAL_STATIC(DialbackCache, dialbackCache)
+
 CoreProtocol::CoreProtocol()
 :BasicProtocol()
 {
@@ -611,6 +737,7 @@ void CoreProtocol::init()
 	server = false;
 	dialback = false;
 	dialback_verify = false;
+	component = false;
 
 	// settings
 	jid_ = Jid();
@@ -621,6 +748,16 @@ void CoreProtocol::init()
 	doAuth = true;
 	doCompress = true;
 	doBinding = true;
+	doSM = false;
+	doPipeline = false;
+	pipelineBind = false;
+	bind_pipelined = false;
+	sm_id = QString();
+	smResume = StreamManagementState();
+	dbrequests.clear();
+	dbpending.clear();
+	dbvalidated.clear();
+	dbItem = DBItem();
 
 	// input
 	user = QString();
@@ -628,6 +765,7 @@ void CoreProtocol::init()
 
 	// status
 	old = false;
+	resumed = false;
 	digest = false;
 	tls_started = false;
 	sasl_started = false;
@@ -682,6 +820,16 @@ void CoreProtocol::startDialbackVerifyOut(const QString &_to, const QString &_fr
 	startConnect();
 }
 
+void CoreProtocol::startComponentOut(const QString &domain, const QString &secret)
+{
+	component = true;
+	to = domain;
+	password = secret;
+	// component streams carry no version
+	version = Version(0,0);
+	startConnect();
+}
+
 void CoreProtocol::startClientIn(const QString &_id)
 {
 	id = _id;
@@ -735,6 +883,126 @@ void CoreProtocol::setDialbackKey(const QString &s)
 	dialback_key = s;
 }
 
+void CoreProtocol::requestDialback(const QString &_from, const QString &key)
+{
+	queueDialback(DBItem::ResultRequest, to, _from, QString(), key, false);
+}
+
+// to and from are those of the request, the answer goes the other way
+void CoreProtocol::grantDialback(const QString &_to, const QString &_from, bool ok)
+{
+	queueDialback(DBItem::ResultGrant, _from, _to, QString(), QString(), ok);
+}
+
+void CoreProtocol::grantDialbackVerify(const QString &_to, const QString &_from, const QString &_id, bool ok)
+{
+	queueDialback(DBItem::VerifyGrant, _from, _to, _id, QString(), ok);
+}
+
+bool CoreProtocol::isValidated(const QString &_to, const QString &_from) const
+{
+	return dbvalidated.contains(DBKey(_to, _from, DBItem::Validated));
+}
+
+void CoreProtocol::setDialbackCacheTime(int secs)
+{
+	DialbackCache *c = dialbackCache();
+	QMutexLocker locker(&c->m);
+	c->secs = secs;
+	if(secs <= 0)
+		c->until.clear();
+}
+
+void CoreProtocol::clearDialbackCache()
+{
+	DialbackCache *c = dialbackCache();
+	QMutexLocker locker(&c->m);
+	c->until.clear();
+}
+
+void CoreProtocol::queueDialback(int type, const QString &_to, const QString &_from, const QString &_id, const QString &key, bool ok)
+{
+	DBItem i;
+	i.type = type;
+	i.to = _to;
+	i.from = _from;
+	i.id = _id;
+	i.key = key;
+	i.ok = ok;
+	dbrequests += i;
+}
+
+void CoreProtocol::setValidated(const DBItem &i)
+{
+	DBItem v = i;
+	v.type = DBItem::Validated;
+	v.ok = true;
+	dbvalidated.insert(DBKey(v.to.full(), v.from.full(), DBItem::Validated), v);
+}
+
+void CoreProtocol::setStreamManagement(bool b)
+{
+	doSM = b;
+}
+
+void CoreProtocol::setResumeState(const StreamManagementState &s)
+{
+	smResume = s;
+}
+
+void CoreProtocol::setPipelining(bool b)
+{
+	doPipeline = b;
+}
+
+bool CoreProtocol::canResume() const
+{
+	return sm_enabled && !sm_id.isEmpty();
+}
+
+StreamManagementState CoreProtocol::resumeState() const
+{
+	StreamManagementState s;
+	if(!canResume())
+		return s;
+	s.id = sm_id;
+	s.jid = jid_;
+	s.in_h = sm_in_h;
+	s.out_h = sm_out_h;
+	s.unacked = smPendingStanzas();
+	return s;
+}
+
+QDomElement CoreProtocol::bindRequest()
+{
+	QDomElement e = doc.createElement("iq");
+	e.setAttribute("type", "set");
+	e.setAttribute("id", "bind_1");
+	QDomElement b = doc.createElementNS(NS_BIND, "bind");
+
+	// request specific resource?
+	QString resource = jid_.resource();
+	if(!resource.isEmpty()) {
+		QDomElement r = doc.createElement("resource");
+		r.appendChild(doc.createTextNode(jid_.resource()));
+		b.appendChild(r);
+	}
+
+	e.appendChild(b);
+	return e;
+}
+
+void CoreProtocol::docOpenSent()
+{
+	if(!pipelineBind)
+		return;
+	pipelineBind = false;
+
+	writeElement(bindRequest(), TypeElement, false);
+	writeQueuedStanzas();
+	bind_pipelined = true;
+}
+
 bool CoreProtocol::loginComplete()
 {
 	setReady(true);
@@ -783,10 +1051,13 @@ bool CoreProtocol::stepRequiresElement() const
 		case GetCompressProceed:
 		case GetSASLChallenge:
 		case GetBindResponse:
+		case GetSMEnabled:
+		case GetSMResumed:
 		case GetAuthGetResponse:
 		case GetAuthSetResponse:
 		case GetRequest:
 		case GetSASLResponse:
+		case GetHandshakeResponse:
 			return true;
 	}
 	return false;
@@ -808,7 +1079,9 @@ void CoreProtocol::stringRecv(const QString &s)
 
 QString CoreProtocol::defaultNamespace()
 {
-	if(server)
+	if(component)
+		return NS_COMPONENT;
+	else if(server)
 		return NS_SERVER;
 	else
 		return NS_CLIENT;
@@ -848,7 +1121,8 @@ void CoreProtocol::handleStreamOpen(const Parser::Event &pe)
 		}
 	}
 	else {
-		if(!dialback) {
+		// components speak no version, and that is not "old" here
+		if(!dialback && !component) {
 			if(version.major >= 1 && !oldOnly)
 				old = false;
 			else
@@ -875,6 +1149,8 @@ bool CoreProtocol::doStep2(const QDomElement &e)
 {
 	if(dialback)
 		return dialbackStep(e);
+	else if(component)
+		return componentStep(e);
 	else
 		return normalStep(e);
 }
@@ -882,7 +1158,8 @@ bool CoreProtocol::doStep2(const QDomElement &e)
 bool CoreProtocol::isValidStanza(const QDomElement &e) const
 {
 	QString s = e.tagName();
-	if(e.namespaceURI() == (server ? NS_SERVER : NS_CLIENT) && (s == "message" || s == "presence" || s == "iq"))
+	QString ns = component ? NS_COMPONENT : (server ? NS_SERVER : NS_CLIENT);
+	if(e.namespaceURI() == ns && (s == "message" || s == "presence" || s == "iq"))
 		return true;
 	else
 		return false;
@@ -890,21 +1167,20 @@ bool CoreProtocol::isValidStanza(const QDomElement &e) const
 
 bool CoreProtocol::grabPendingItem(const Jid &to, const Jid &from, int type, DBItem *item)
 {
-	for(QList<DBItem>::Iterator it = dbpending.begin(); it != dbpending.end(); ++it) {
-		const DBItem &i = *it;
-		if(i.type == type && i.to.compare(to) && i.from.compare(from)) {
-			const DBItem &i = (*it);
-			*item = i;
-			dbpending.erase(it);
-			return true;
-		}
-	}
-	return false;
+	QHash<DBKey, DBItem>::Iterator it = dbpending.find(DBKey(to.full(), from.full(), type));
+	if(it == dbpending.end())
+		return false;
+	*item = it.value();
+	dbpending.erase(it);
+	return true;
 }
 
 bool CoreProtocol::dialbackStep(const QDomElement &e)
 {
 	if(step == Start) {
+		// a verify stream has nothing else to do
+		if(dialback_verify)
+			queueDialback(DBItem::VerifyRequest, to, self_from, dialback_id, dialback_key, false);
 		setReady(true);
 		step = Done;
 		event = EReady;
@@ -913,12 +1189,7 @@ bool CoreProtocol::dialbackStep(const QDomElement &e)
 
 	if(!dbrequests.isEmpty()) {
 		// process a request
-		DBItem i;
-		{
-			QList<DBItem>::Iterator it = dbrequests.begin();
-			i = (*it);
-			dbrequests.erase(it);
-		}
+		DBItem i = dbrequests.takeFirst();
 
 		QDomElement r;
 		if(i.type == DBItem::ResultRequest) {
@@ -926,7 +1197,7 @@ bool CoreProtocol::dialbackStep(const QDomElement &e)
 			r.setAttribute("to", i.to.full());
 			r.setAttribute("from", i.from.full());
 			r.appendChild(doc.createTextNode(i.key));
-			dbpending += i;
+			dbpending.insert(DBKey(i.to.full(), i.from.full(), i.type), i);
 		}
 		else if(i.type == DBItem::ResultGrant) {
 			r = doc.createElementNS(NS_DIALBACK, "db:result");
@@ -934,8 +1205,12 @@ bool CoreProtocol::dialbackStep(const QDomElement &e)
 			r.setAttribute("from", i.from.full());
 			r.setAttribute("type", i.ok ? "valid" : "invalid");
 			if(i.ok) {
-				i.type = DBItem::Validated;
-				dbvalidated += i;
+				// remembered the way the request came in
+				DBItem v = i;
+				v.to = i.from;
+				v.from = i.to;
+				setValidated(v);
+				dialbackCache()->insert(v.to.full(), v.from.full());
 			}
 			else {
 				// TODO: disconnect after writing element
@@ -947,7 +1222,7 @@ bool CoreProtocol::dialbackStep(const QDomElement &e)
 			r.setAttribute("from", i.from.full());
 			r.setAttribute("id", i.id);
 			r.appendChild(doc.createTextNode(i.key));
-			dbpending += i;
+			dbpending.insert(DBKey(i.to.full(), i.from.full(), i.type), i);
 		}
 		// VerifyGrant
 		else {
@@ -969,22 +1244,31 @@ bool CoreProtocol::dialbackStep(const QDomElement &e)
 				Jid to(Jid(e.attribute("to")).domain());
 				Jid from(Jid(e.attribute("from")).domain());
 				if(isIncoming()) {
-					QString key = e.text();
-					// TODO: report event
+					// verified by another stream not long ago
+					if(dialbackCache()->contains(to.full(), from.full())) {
+						grantDialback(to.full(), from.full(), true);
+						return dialbackStep(QDomElement());
+					}
+
+					dbItem = DBItem();
+					dbItem.type = DBItem::ResultRequest;
+					dbItem.to = to;
+					dbItem.from = from;
+					dbItem.key = e.text();
+					dbItem.ok = false;
+					event = EDBResult;
+					return true;
 				}
 				else {
 					bool ok = (e.attribute("type") == "valid") ? true: false;
 					DBItem i;
 					if(grabPendingItem(from, to, DBItem::ResultRequest, &i)) {
-						if(ok) {
-							i.type = DBItem::Validated;
-							i.ok = true;
-							dbvalidated += i;
-							// TODO: report event
-						}
-						else {
-							// TODO: report event
-						}
+						i.ok = ok;
+						if(ok)
+							setValidated(i);
+						dbItem = i;
+						event = EDBAnswered;
+						return true;
 					}
 				}
 			}
@@ -993,32 +1277,36 @@ bool CoreProtocol::dialbackStep(const QDomElement &e)
 				Jid from(Jid(e.attribute("from")).domain());
 				QString id = e.attribute("id");
 				if(isIncoming()) {
-					QString key = e.text();
-					// TODO: report event
+					dbItem = DBItem();
+					dbItem.type = DBItem::VerifyRequest;
+					dbItem.to = to;
+					dbItem.from = from;
+					dbItem.id = id;
+					dbItem.key = e.text();
+					dbItem.ok = false;
+					event = EDBVerify;
+					return true;
 				}
 				else {
 					bool ok = (e.attribute("type") == "valid") ? true: false;
 					DBItem i;
 					if(grabPendingItem(from, to, DBItem::VerifyRequest, &i)) {
-						if(ok) {
-							// TODO: report event
-						}
-						else {
-							// TODO: report event
-						}
+						i.ok = ok;
+						dbItem = i;
+						event = EDBAnswered;
+						return true;
 					}
 				}
 			}
 		}
 		else {
-			if(isReady()) {
-				if(isValidStanza(e)) {
-					// TODO: disconnect if stanza is from unverified sender
-					// TODO: ignore packets from receiving servers
-					stanzaToRecv = e;
-					event = EStanzaReady;
-					return true;
-				}
+			// only stanzas between validated domains, and none on
+			//   the streams we send over
+			if(isReady() && isIncoming() && isValidStanza(e)
+				&& isValidated(Jid(e.attribute("to")).domain(), Jid(e.attribute("from")).domain())) {
+				stanzaToRecv = e;
+				event = EStanzaReady;
+				return true;
 			}
 		}
 	}
@@ -1028,6 +1316,41 @@ bool CoreProtocol::dialbackStep(const QDomElement &e)
 	return false;
 }
 
+bool CoreProtocol::componentStep(const QDomElement &e)
+{
+	if(step == Start) {
+		// the server's stream id salts the secret
+		QDomElement h = doc.createElementNS(NS_COMPONENT, "handshake");
+		QByteArray cs = id.toUtf8() + password.toUtf8();
+		h.appendChild(doc.createTextNode(QCA::Hash("sha1").hashToString(cs)));
+
+		send(h, true);
+		event = ESend;
+		step = GetHandshakeResponse;
+		return true;
+	}
+	else if(step == GetHandshakeResponse) {
+		// an empty <handshake/> is the only success
+		if(e.namespaceURI() == NS_COMPONENT && e.tagName() == "handshake")
+			return loginComplete();
+
+		event = EError;
+		errorCode = ErrProtocol;
+		return true;
+	}
+
+	// stanzas go to any address of the domain; anything else is ignored
+	if(!e.isNull() && isReady() && isValidStanza(e)) {
+		stanzaToRecv = e;
+		event = EStanzaReady;
+		return true;
+	}
+
+	need = NNotify;
+	notify |= NRecv;
+	return false;
+}
+
 bool CoreProtocol::normalStep(const QDomElement &e)
 {
 	if(step == Start) {
@@ -1106,6 +1429,24 @@ bool CoreProtocol::normalStep(const QDomElement &e)
 				return loginComplete();
 		}
 
+		// bind already went out with the stream header
+		if(bind_pipelined) {
+			step = GetBindResponse;
+			return processStep();
+		}
+
+		// pick up where the last stream left off?
+		if(smResume.isValid() && features.sm_supported) {
+			QDomElement e = doc.createElementNS(NS_SM, "resume");
+			e.setAttribute("previd", smResume.id);
+			e.setAttribute("h", QString::number(smResume.in_h));
+
+			send(e);
+			event = ESend;
+			step = GetSMResumed;
+			return true;
+		}
+
 		// deal with bind
 		if(!features.bind_supported) {
 			// bind MUST be supported
@@ -1114,22 +1455,7 @@ bool CoreProtocol::normalStep(const QDomElement &e)
 			return true;
 		}
 
-		QDomElement e = doc.createElement("iq");
-		e.setAttribute("type", "set");
-		e.setAttribute("id", "bind_1");
-		QDomElement b = doc.createElementNS(NS_BIND, "bind");
-
-		// request specific resource?
-		QString resource = jid_.resource();
-		if(!resource.isEmpty()) {
-			QDomElement r = doc.createElement("resource");
-			r.appendChild(doc.createTextNode(jid_.resource()));
-			b.appendChild(r);
-		}
-
-		e.appendChild(b);
-
-		send(e);
+		send(bindRequest());
 		event = ESend;
 		step = GetBindResponse;
 		return true;
@@ -1196,6 +1522,10 @@ bool CoreProtocol::normalStep(const QDomElement &e)
 		}
 	}
 	else if(step == HandleSASLSuccess) {
+		// a resume has to see the features first
+		if(doPipeline && doBinding && !server && !smResume.isValid())
+			pipelineBind = true;
+
 		need = NSASLLayer;
 		spare = resetStream();
 		step = Start;
@@ -1254,7 +1584,7 @@ bool CoreProtocol::normalStep(const QDomElement &e)
 	// server
 	else if(step == SendFeatures) {
 		QDomElement f = doc.createElementNS(NS_ETHERX, "stream:features");
-		if(!tls_started && !sasl_authed) { // don't offer tls if we are already sasl'd
+		if(doTLS && !tls_started && !sasl_authed) { // don't offer tls if we are already sasl'd
 			QDomElement tls = doc.createElementNS(NS_TLS, "starttls");
 			f.appendChild(tls);
 		}
@@ -1323,6 +1653,10 @@ bool CoreProtocol::normalStep(const QDomElement &e)
 			QDomElement b = e.elementsByTagNameNS(NS_BIND, "bind").item(0).toElement();
 			if(!b.isNull())
 				f.bind_supported = true;
+			if(!e.elementsByTagNameNS(NS_SM, "sm").item(0).isNull())
+				f.sm_supported = true;
+			if(!e.elementsByTagNameNS(NS_ROSTERVER, "ver").item(0).isNull())
+				f.rosterver_supported = true;
 			QDomElement h = e.elementsByTagNameNS(NS_HOSTS, "hosts").item(0).toElement();
 			if(!h.isNull()) {
 				QDomNodeList l = h.elementsByTagNameNS(NS_HOSTS, "host");
@@ -1489,6 +1823,16 @@ bool CoreProtocol::normalStep(const QDomElement &e)
 						return true;
 					}
 					jid_ = j;
+
+					if(doSM && features.sm_supported) {
+						QDomElement en = doc.createElementNS(NS_SM, "enable");
+						en.setAttribute("resume", "true");
+
+						send(en);
+						event = ESend;
+						step = GetSMEnabled;
+						return true;
+					}
 					return loginComplete();
 				}
 				else {
@@ -1528,6 +1872,56 @@ bool CoreProtocol::normalStep(const QDomElement &e)
 			// ignore
 		}
 	}
+	else if(step == GetSMEnabled) {
+		if(e.namespaceURI() == NS_SM) {
+			if(e.tagName() == "enabled") {
+				sm_enabled = true;
+				QString r = e.attribute("resume");
+				if(r == "true" || r == "1")
+					sm_id = e.attribute("id");
+			}
+
+			// on <failed/> we simply go without
+			return loginComplete();
+		}
+		else {
+			// ignore
+		}
+	}
+	else if(step == GetSMResumed) {
+		if(e.namespaceURI() == NS_SM) {
+			if(e.tagName() == "resumed") {
+				StreamManagementState s = smResume;
+				smResume = StreamManagementState();
+
+				sm_enabled = true;
+				sm_id = s.id;
+				sm_in_h = s.in_h;
+				sm_out_h = s.out_h;
+				sm_unacked = s.unacked;
+				smAcked(e.attribute("h").toUInt());
+
+				// whatever the server never got goes out again,
+				//   ahead of anything new
+				smRequeueUnacked();
+
+				jid_ = s.jid;
+				resumed = true;
+				return loginComplete();
+			}
+			else if(e.tagName() == "failed") {
+				// the old session is gone, so start a new one.  stanzas
+				//   that were never acknowledged are dropped, as they may
+				//   or may not have been delivered.
+				smResume = StreamManagementState();
+				step = HandleFeatures;
+				return processStep();
+			}
+		}
+		else {
+			// ignore
+		}
+	}
 	else if(step == GetAuthGetResponse) {
 		// waiting for an iq
 		if(e.namespaceURI() == NS_CLIENT && e.tagName() == "iq") {
@@ -1679,7 +2073,22 @@ bool CoreProtocol::normalStep(const QDomElement &e)
 	}
 
 	if(isReady()) {
-		if(!e.isNull() && isValidStanza(e)) {
+		if(!e.isNull() && sm_enabled && e.namespaceURI() == NS_SM) {
+			if(e.tagName() == "r") {
+				QDomElement a = doc.createElementNS(NS_SM, "a");
+				a.setAttribute("h", QString::number(sm_in_h));
+
+				send(a);
+				event = ESend;
+				return true;
+			}
+			else if(e.tagName() == "a") {
+				smAcked(e.attribute("h").toUInt());
+			}
+		}
+		else if(!e.isNull() && isValidStanza(e)) {
+			if(sm_enabled)
+				++sm_in_h;
 			stanzaToRecv = e;
 			event = EStanzaReady;
 			setIncomingAsExternal();
@@ -24,6 +24,7 @@
 #include <qpair.h>
 //Added by qt3to4:
 #include <QList>
+#include <QHash>
 #include "xmlprotocol.h"
 #include "xmpp.h"
 
@@ -31,6 +32,7 @@
 #define NS_CLIENT   "jabber:client"
 #define NS_SERVER   "jabber:server"
 #define NS_DIALBACK "jabber:server:dialback"
+#define NS_COMPONENT "jabber:component:accept"
 #define NS_STREAMS  "urn:ietf:params:xml:ns:xmpp-streams"
 #define NS_TLS      "urn:ietf:params:xml:ns:xmpp-tls"
 #define NS_SASL     "urn:ietf:params:xml:ns:xmpp-sasl"
@@ -40,6 +42,8 @@
 #define NS_COMPRESS_FEATURE "http://jabber.org/features/compress"
 #define NS_COMPRESS_PROTOCOL "http://jabber.org/protocol/compress"
 #define NS_HOSTS    "http://barracuda.com/xmppextensions/hosts"
+#define NS_SM       "urn:xmpp:sm:3"
+#define NS_ROSTERVER "urn:xmpp:features:rosterver"
 
 namespace XMPP
 {
@@ -57,13 +61,27 @@ namespace XMPP
 	public:
 		StreamFeatures();
 
-		bool tls_supported, sasl_supported, bind_supported, compress_supported;
+		bool tls_supported, sasl_supported, bind_supported, compress_supported, sm_supported, rosterver_supported;
 		bool tls_required;
 		QStringList sasl_mechs;
 		QStringList compression_mechs;
 		QStringList hosts;
 	};
 
+	// what it takes to resume a stream (XEP-0198) on a new connection
+	class StreamManagementState
+	{
+	public:
+		StreamManagementState() : in_h(0), out_h(0) {}
+		bool isValid() const { return !id.isEmpty(); }
+
+		QString id;
+		Jid jid;
+		quint32 in_h;  // stanzas we handled from the server
+		quint32 out_h; // stanzas of ours the server acknowledged
+		QList<QDomElement> unacked; // sent or queued, not yet acknowledged
+	};
+
 	class BasicProtocol : public XmlProtocol
 	{
 	public:
@@ -142,9 +160,14 @@ namespace XMPP
 
 		void reset();
 
-		// for outgoing xml
+		// for outgoing xml, and the one received stanzas are built in
 		QDomDocument doc;
 
+		// use another document, such as the one of the client reading
+		//   the stanzas, so that stanzas and replies need no importing.
+		//   only while idle: what the old one holds is not carried over.
+		void setDocument(const QDomDocument &d);
+
 		// sasl-related
 		QString saslMech() const;
 		QByteArray saslStep() const;
@@ -159,6 +182,12 @@ namespace XMPP
 		void sendWhitespace();
 		QDomElement recvStanza();
 
+		// a stanza serialized by elementToUtf8(), counted like any other.
+		//   not kept for stream management, so only while that is off
+		void sendStanzaBytes(const QByteArray &a);
+		inline bool streamManagementEnabled() const { return sm_enabled; }
+		inline bool saslAuthenticated() const { return sasl_authed; }
+
 		// shutdown
 		void shutdown();
 		void shutdownWithError(int cond, const QString &otherHost="");
@@ -216,6 +245,18 @@ namespace XMPP
 
 		QDomElement stanzaToRecv;
 
+		// XEP-0198 stream management
+		bool sm_enabled;
+		quint32 sm_in_h, sm_out_h;
+		QList<QDomElement> sm_unacked;
+		bool sm_ackRequested;
+
+		void writeQueuedStanzas();
+
+		void smAcked(quint32 h);
+		void smRequeueUnacked();
+		QList<QDomElement> smPendingStanzas() const;
+
 	private:
 		struct SASLCondEntry
 		{
@@ -234,6 +275,7 @@ namespace XMPP
 		struct SendItem
 		{
 			QDomElement stanzaToSend;
+			QByteArray stanzaBytesToSend; // serialized already
 			QString stringToSend;
 			bool doWhitespace;
 		};
@@ -251,10 +293,22 @@ namespace XMPP
 	public:
 		enum {
 			NPassword = NCustom,  // need password for old-mode
-			EDBVerify = ECustom,  // breakpoint after db:verify request
+			EDBVerify = ECustom,  // breakpoint after db:verify request, see dbItem
+			EDBResult,            // breakpoint after db:result request, see dbItem
+			EDBAnswered,          // breakpoint after our db:result or db:verify was answered, see dbItem
 			ErrPlain = ErrCustom  // server only supports plain, but allowPlain is false locally
 		};
 
+		class DBItem
+		{
+		public:
+			enum { ResultRequest, ResultGrant, VerifyRequest, VerifyGrant, Validated };
+			int type;
+			Jid to, from;
+			QString key, id;
+			bool ok;
+		};
+
 		CoreProtocol();
 		~CoreProtocol();
 
@@ -266,6 +320,13 @@ namespace XMPP
 		void startDialbackVerifyOut(const QString &to, const QString &from, const QString &id, const QString &key);
 		void startClientIn(const QString &id);
 		void startServerIn(const QString &id);
+		// an external component (XEP-0114) of the server at the other
+		//   end, serving every jid of 'domain'.  there is no sasl, tls or
+		//   bind: the handshake proves the shared secret, and then
+		//   stanzas may be from any address of the domain.  a rejected
+		//   secret comes back as ErrStream with StreamNotAuthorized.
+		void startComponentOut(const QString &domain, const QString &secret);
+		bool isComponent() const { return component; }
 
 		void setLang(const QString &s);
 		void setAllowTLS(bool b);
@@ -277,27 +338,48 @@ namespace XMPP
 		void setFrom(const QString &s);
 		void setDialbackKey(const QString &s);
 
+		// dialback.  any number of local domains can be validated over
+		//   one outgoing stream, each with its own db:result, and then
+		//   send over it.  the receiving side answers EDBResult and
+		//   EDBVerify with the grant calls, unless the pair is cached.
+		//   to and from are always those of the request.
+		void requestDialback(const QString &from, const QString &key);
+		void grantDialback(const QString &to, const QString &from, bool ok);
+		void grantDialbackVerify(const QString &to, const QString &from, const QString &id, bool ok);
+		bool isValidated(const QString &to, const QString &from) const;
+		DBItem dbItem; // of the last dialback event
+
+		// pairs validated by any stream are trusted for this many
+		//   seconds, and streams receiving a db:result for them grant it
+		//   without a round trip to the authoritative server.  0, the
+		//   default, turns the cache off.
+		static void setDialbackCacheTime(int secs);
+		static void clearDialbackCache();
+
+		// stream management.  if a resume state is set, resuming it is
+		//   tried in place of binding a resource.
+		void setStreamManagement(bool b);
+		void setResumeState(const StreamManagementState &s);
+		bool canResume() const;
+		StreamManagementState resumeState() const;
+
+		// pipelined login: after sasl, the bind request and any stanzas
+		//   already queued go out right behind the new stream header,
+		//   without waiting for the server's features
+		void setPipelining(bool b);
+
 		// input
 		QString user, host;
 
 		// status
 		bool old;
+		bool resumed; // the previous stream was resumed, rather than a new session bound
 
 		StreamFeatures features;
 		QStringList hosts;
 
 		//static QString xmlToString(const QDomElement &e, bool clip=false);
 
-		class DBItem
-		{
-		public:
-			enum { ResultRequest, ResultGrant, VerifyRequest, VerifyGrant, Validated };
-			int type;
-			Jid to, from;
-			QString key, id;
-			bool ok;
-		};
-
 	private:
 		enum Step {
 			Start,
@@ -316,15 +398,31 @@ namespace XMPP
 			GetSASLNext,        // perform sasl next step using provided data
 			HandleSASLSuccess,  // handle what must be done after reporting sasl success
 			GetBindResponse,    // read bind response
+			GetSMEnabled,       // read stream management enable response
+			GetSMResumed,       // read stream management resume response
 			HandleAuthGet,      // send old-protocol auth-get
 			GetAuthGetResponse, // read auth-get response
 			HandleAuthSet,      // send old-protocol auth-set
-			GetAuthSetResponse  // read auth-set response
+			GetAuthSetResponse, // read auth-set response
+			GetHandshakeResponse // read component handshake response
+		};
+
+		// pending and validated items are found by (to, from, type)
+		class DBKey
+		{
+		public:
+			DBKey(const QString &_to, const QString &_from, int _type) : to(_to), from(_from), type(_type) {}
+			bool operator==(const DBKey &other) const { return type == other.type && to == other.to && from == other.from; }
+
+			QString to, from;
+			int type;
 		};
+		friend inline uint qHash(const DBKey &key) { return ::qHash(key.to) ^ (::qHash(key.from) << 1) ^ key.type; }
 
-		QList<DBItem> dbrequests, dbpending, dbvalidated;
+		QList<DBItem> dbrequests;
+		QHash<DBKey, DBItem> dbpending, dbvalidated;
 
-		bool server, dialback, dialback_verify;
+		bool server, dialback, dialback_verify, component;
 		int step;
 
 		bool digest;
@@ -333,7 +431,10 @@ namespace XMPP
 		Jid jid_;
 		bool oldOnly;
 		bool allowPlain;
-		bool doTLS, doAuth, doBinding, doCompress;
+		bool doTLS, doAuth, doBinding, doCompress, doSM, doPipeline;
+		bool pipelineBind, bind_pipelined;
+		QString sm_id;
+		StreamManagementState smResume;
 		QString password;
 
 		QString dialback_id, dialback_key;
@@ -342,11 +443,15 @@ namespace XMPP
 		void init();
 		static int getOldErrorCode(const QDomElement &e);
 		bool loginComplete();
+		QDomElement bindRequest();
 
 		bool isValidStanza(const QDomElement &e) const;
 		bool grabPendingItem(const Jid &to, const Jid &from, int type, DBItem *item);
+		void queueDialback(int type, const QString &to, const QString &from, const QString &id, const QString &key, bool ok);
+		void setValidated(const DBItem &i);
 		bool normalStep(const QDomElement &e);
 		bool dialbackStep(const QDomElement &e);
+		bool componentStep(const QDomElement &e);
 
 		// reimplemented
 		bool stepAdvancesParser() const;
@@ -356,6 +461,7 @@ namespace XMPP
 		QString defaultNamespace();
 		QStringList extraNamespaces();
 		void handleStreamOpen(const Parser::Event &pe);
+		void docOpenSent();
 		bool doStep2(const QDomElement &e);
 		void elementSend(const QDomElement &e);
 		void elementRecv(const QDomElement &e);
@@ -29,13 +29,25 @@
 #include "securestream.h"
 
 #include <qpointer.h>
+#include <QElapsedTimer>
 #include <QList>
+#include <QVector>
 #include <qtimer.h>
 
 #ifdef USE_TLSHANDLER
 #include "xmpp.h"
 #endif
 #include "compressionhandler.h"
+#include "iristrace.h"
+
+// dynamic tls record sizing.  after an idle moment, plain data goes into
+//   records that fit a single packet, so the first bytes can be decrypted
+//   as soon as they arrive.  once a burst has gone on long enough for the
+//   connection to have opened up, the records grow to the maximum size
+#define TLS_RECORD_SMALL  1400
+#define TLS_RECORD_MAX    16384
+#define TLS_RECORD_BURST  (1024 * 1024) // bytes before growing
+#define TLS_RECORD_IDLE   1000          // msecs of quiet before shrinking
 
 //----------------------------------------------------------------------------
 // LayerTracker
@@ -57,18 +69,25 @@ public:
 	int finished(int encoded);
 
 	int p;
-	QList<Item> list;
+
+	// pending items, oldest first, kept in a ring so that neither end
+	//   costs an allocation once it has grown to the working size
+	QVector<Item> ring;
+	int head, count;
 };
 
 LayerTracker::LayerTracker()
 {
 	p = 0;
+	head = 0;
+	count = 0;
 }
 
 void LayerTracker::reset()
 {
 	p = 0;
-	list.clear();
+	head = 0;
+	count = 0;
 }
 
 void LayerTracker::addPlain(int plain)
@@ -82,17 +101,27 @@ void LayerTracker::specifyEncoded(int encoded, int plain)
 	if(plain > p)
 		plain = p;
 	p -= plain;
-	Item i;
+
+	// full?  grow, unwrapping the contents to the front
+	if(count == ring.size()) {
+		QVector<Item> bigger(ring.isEmpty() ? 16 : ring.size() * 2);
+		for(int n = 0; n < count; ++n)
+			bigger[n] = ring[(head + n) % ring.size()];
+		ring = bigger;
+		head = 0;
+	}
+
+	Item &i = ring[(head + count) % ring.size()];
 	i.plain = plain;
 	i.encoded = encoded;
-	list += i;
+	++count;
 }
 
 int LayerTracker::finished(int encoded)
 {
 	int plain = 0;
-	for(QList<Item>::Iterator it = list.begin(); it != list.end();) {
-		Item &i = *it;
+	while(count > 0) {
+		Item &i = ring[head];
 
 		// not enough?
 		if(encoded < i.encoded) {
@@ -102,7 +131,8 @@ int LayerTracker::finished(int encoded)
 
 		encoded -= i.encoded;
 		plain += i.plain;
-		it = list.erase(it);
+		head = (head + 1) % ring.size();
+		--count;
 	}
 	return plain;
 }
@@ -128,6 +158,16 @@ public:
 	bool tls_done;
 	int prebytes;
 
+	// see TLS_RECORD_SMALL
+	bool sizeRecords;
+	QElapsedTimer lastWrite;
+	qint64 burstBytes;
+
+	// neighbours in the stack, nearest the socket first.  data is
+	//   handed along by direct call, and only the ends touch the stream.
+	SecureStream *stream;
+	SecureLayer *below, *above;
+
 	SecureLayer(QCA::TLS *t)
 	{
 		type = TLS;
@@ -179,21 +219,84 @@ public:
 	{
 		tls_done = false;
 		prebytes = 0;
+		sizeRecords = false;
+		burstBytes = 0;
+		stream = 0;
+		below = 0;
+		above = 0;
+	}
+
+	// decoded data goes up to the next layer, or out of the stream
+	void passUp(const QByteArray &a)
+	{
+		if(above)
+			above->writeIncoming(a);
+		else
+			stream->incomingData(a);
+	}
+
+	// encoded data goes down to the next layer, or to the socket
+	void passDown(const QByteArray &a)
+	{
+		if(below)
+			below->write(a);
+		else
+			stream->writeRawData(a);
 	}
 
 	void write(const QByteArray &a)
 	{
 		layer.addPlain(a.size());
 		switch(type) {
-			case TLS:  { p.tls->write(a); break; }
+			case TLS:  { writeRecords(a); break; }
 			case SASL: { p.sasl->write(a); break; }
 #ifdef USE_TLSHANDLER
-			case TLSH: { p.tlsHandler->write(a); break; }
+			case TLSH: { writeRecords(a); break; }
 #endif
 			case Compression: { p.compressionHandler->write(a); break; }
 		}
 	}
 
+	void writeTls(const QByteArray &a)
+	{
+#ifdef USE_TLSHANDLER
+		if(type == TLSH) {
+			p.tlsHandler->write(a);
+			return;
+		}
+#endif
+		p.tls->write(a);
+	}
+
+	// each write to the tls object comes out as records of its own, so
+	//   the record size is set by how the data is handed to it
+	void writeRecords(const QByteArray &a)
+	{
+		if(!sizeRecords || !tls_done) {
+			writeTls(a);
+			return;
+		}
+
+		if(!lastWrite.isValid() || lastWrite.elapsed() >= TLS_RECORD_IDLE)
+			burstBytes = 0;
+		lastWrite.start();
+
+		int at = 0;
+		while(at < a.size()) {
+			int left = a.size() - at;
+			if(burstBytes >= TLS_RECORD_BURST || left <= TLS_RECORD_SMALL) {
+				// the rest goes in one piece
+				writeTls(at == 0 ? a : a.mid(at));
+				burstBytes += left;
+				break;
+			}
+
+			writeTls(a.mid(at, TLS_RECORD_SMALL));
+			burstBytes += TLS_RECORD_SMALL;
+			at += TLS_RECORD_SMALL;
+		}
+	}
+
 	void writeIncoming(const QByteArray &a)
 	{
 		switch(type) {
@@ -206,6 +309,13 @@ public:
 		}
 	}
 
+	void compact()
+	{
+		// tls and sasl keep their buffers inside qca
+		if(type == Compression)
+			p.compressionHandler->compact();
+	}
+
 	int finished(int plain)
 	{
 		int written = 0;
@@ -234,8 +344,6 @@ public:
 signals:
 	void tlsHandshaken();
 	void tlsClosed(const QByteArray &);
-	void readyRead(const QByteArray &);
-	void needWrite(const QByteArray &);
 	void error(int);
 
 private slots:
@@ -248,7 +356,7 @@ private slots:
 	void tls_readyRead()
 	{
 		QByteArray a = p.tls->read();
-		readyRead(a);
+		passUp(a);
 	}
 
 	void tls_readyReadOutgoing(int plainBytes)
@@ -256,7 +364,7 @@ private slots:
 		QByteArray a = p.tls->readOutgoing();
 		if(tls_done)
 			layer.specifyEncoded(a.size(), plainBytes);
-		needWrite(a);
+		passDown(a);
 	}
 
 	void tls_closed()
@@ -273,7 +381,7 @@ private slots:
 	void sasl_readyRead()
 	{
 		QByteArray a = p.sasl->read();
-		readyRead(a);
+		passUp(a);
 	}
 
 	void sasl_readyReadOutgoing()
@@ -281,7 +389,7 @@ private slots:
 		int plainBytes;
 		QByteArray a = p.sasl->readOutgoing(&plainBytes);
 		layer.specifyEncoded(a.size(), plainBytes);
-		needWrite(a);
+		passDown(a);
 	}
 
 	void sasl_error()
@@ -292,7 +400,7 @@ private slots:
 	void compressionHandler_readyRead()
 	{
 		QByteArray a = p.compressionHandler->read();
-		readyRead(a);
+		passUp(a);
 	}
 
 	void compressionHandler_readyReadOutgoing()
@@ -300,7 +408,7 @@ private slots:
 		int plainBytes;
 		QByteArray a = p.compressionHandler->readOutgoing(&plainBytes);
 		layer.specifyEncoded(a.size(), plainBytes);
-		needWrite(a);
+		passDown(a);
 	}
 
 	void compressionHandler_error()
@@ -327,14 +435,14 @@ private slots:
 
 	void tlsHandler_readyRead(const QByteArray &a)
 	{
-		readyRead(a);
+		passUp(a);
 	}
 
 	void tlsHandler_readyReadOutgoing(const QByteArray &a, int plainBytes)
 	{
 		if(tls_done)
 			layer.specifyEncoded(a.size(), plainBytes);
-		needWrite(a);
+		passDown(a);
 	}
 #endif
 };
@@ -350,6 +458,9 @@ public:
 	int errorCode;
 	bool active;
 	bool topInProgress;
+	bool readEnabled;
+	bool dynamicRecords;
+	qint64 wireIn, wireOut, plainIn, plainOut;
 
 	bool haveTLS() const
 	{
@@ -396,6 +507,9 @@ SecureStream::SecureStream(ByteStream *s)
 	d->pending = 0;
 	d->active = true;
 	d->topInProgress = false;
+	d->readEnabled = true;
+	d->dynamicRecords = true;
+	d->wireIn = d->wireOut = d->plainIn = d->plainOut = 0;
 }
 
 SecureStream::~SecureStream()
@@ -403,13 +517,18 @@ SecureStream::~SecureStream()
 	delete d;
 }
 
-void SecureStream::linkLayer(QObject *s)
+void SecureStream::linkLayer(SecureLayer *s)
 {
 	connect(s, SIGNAL(tlsHandshaken()), SLOT(layer_tlsHandshaken()));
 	connect(s, SIGNAL(tlsClosed(const QByteArray &)), SLOT(layer_tlsClosed(const QByteArray &)));
-	connect(s, SIGNAL(readyRead(const QByteArray &)), SLOT(layer_readyRead(const QByteArray &)));
-	connect(s, SIGNAL(needWrite(const QByteArray &)), SLOT(layer_needWrite(const QByteArray &)));
 	connect(s, SIGNAL(error(int)), SLOT(layer_error(int)));
+
+	s->stream = this;
+	s->sizeRecords = d->dynamicRecords;
+	if(!d->layers.isEmpty()) {
+		s->below = d->layers.last();
+		s->below->above = s;
+	}
 }
 
 int SecureStream::calcPrebytes() const
@@ -449,12 +568,17 @@ void SecureStream::startTLSServer(QCA::TLS *t, const QByteArray &spare)
 	insertData(spare);
 }
 
-void SecureStream::setLayerCompress(const QByteArray& spare)
+void SecureStream::setLayerCompress(const QByteArray& spare, bool batchFlush, int flushBytes, int level, int windowBits, bool adaptive)
 {
 	if(!d->active || d->topInProgress || d->haveCompress())
 		return;
 
-	SecureLayer *s = new SecureLayer(new CompressionHandler());
+	CompressionHandler *c = new CompressionHandler(level, windowBits);
+	if(batchFlush)
+		c->setFlushPolicy(CompressionHandler::FlushBatched, flushBytes);
+	if(adaptive)
+		c->setAdaptive(true);
+	SecureLayer *s = new SecureLayer(c);
 	s->prebytes = calcPrebytes();
 	linkLayer(s);
 	d->layers.append(s);
@@ -504,6 +628,13 @@ void SecureStream::closeTLS()
 	}
 }
 
+void SecureStream::setDynamicRecordSize(bool b)
+{
+	d->dynamicRecords = b;
+	foreach(SecureLayer *s, d->layers)
+		s->sizeRecords = b;
+}
+
 int SecureStream::errorCode() const
 {
 	return d->errorCode;
@@ -520,8 +651,10 @@ void SecureStream::write(const QByteArray &a)
 		return;
 
 	d->pending += a.size();
+	d->plainOut += a.size();
 
 	// send to the last layer
+	IRIS_TRACEPOINT2(layer_write_begin, this, a.size());
 	if (!d->layers.isEmpty()) {
 		SecureLayer *s = d->layers.last();
 		s->write(a);
@@ -529,6 +662,7 @@ void SecureStream::write(const QByteArray &a)
 	else {
 		writeRawData(a);
 	}
+	IRIS_TRACEPOINT1(layer_write_end, this);
 }
 
 int SecureStream::bytesToWrite() const
@@ -536,9 +670,59 @@ int SecureStream::bytesToWrite() const
 	return d->pending;
 }
 
+void SecureStream::compact()
+{
+	ByteStream::compact();
+	foreach(SecureLayer *s, d->layers)
+		s->compact();
+	d->bs->compact();
+}
+
+void SecureStream::setReadEnabled(bool b)
+{
+	if(d->readEnabled == b)
+		return;
+	d->readEnabled = b;
+
+	// pick up what arrived meanwhile, from the event loop, since the
+	//   caller is likely in the middle of handling what came before
+	if(b && d->bs->bytesAvailable() > 0)
+		QMetaObject::invokeMethod(this, "bs_readyRead", Qt::QueuedConnection);
+}
+
+bool SecureStream::isReadEnabled() const
+{
+	return d->readEnabled;
+}
+
+qint64 SecureStream::wireBytesRead() const
+{
+	return d->wireIn;
+}
+
+qint64 SecureStream::wireBytesWritten() const
+{
+	return d->wireOut;
+}
+
+qint64 SecureStream::plainBytesRead() const
+{
+	return d->plainIn;
+}
+
+qint64 SecureStream::plainBytesWritten() const
+{
+	return d->plainOut;
+}
+
 void SecureStream::bs_readyRead()
 {
+	// leave it with the socket, whose buffer filling up stops the peer
+	if(!d->readEnabled)
+		return;
+
 	QByteArray a = d->bs->read();
+	d->wireIn += a.size();
 
 	// send to the first layer
 	if (!d->layers.isEmpty()) {
@@ -577,48 +761,6 @@ void SecureStream::layer_tlsClosed(const QByteArray &)
 	tlsClosed();
 }
 
-void SecureStream::layer_readyRead(const QByteArray &a)
-{
-	SecureLayer *s = (SecureLayer *)sender();
-	QList<SecureLayer*>::Iterator it(d->layers.begin());
-	while((*it) != s) {
-		Q_ASSERT(it != d->layers.end());
-		++it;
-	}
-	Q_ASSERT(it != d->layers.end());
-
-	// pass upwards
-	++it;
-	if (it != d->layers.end()) {
-		s = (*it);
-		s->writeIncoming(a);
-	}
-	else {
-		incomingData(a);
-	}
-}
-
-void SecureStream::layer_needWrite(const QByteArray &a)
-{
-	SecureLayer *s = (SecureLayer *)sender();
-	QList<SecureLayer*>::Iterator it(d->layers.begin());
-	while((*it) != s) {
-		Q_ASSERT(it != d->layers.end());
-		++it;
-	}
-	Q_ASSERT(it != d->layers.end());
-
-	// pass downwards
-	if (it != d->layers.begin()) {
-		--it;
-		s = (*it);
-		s->write(a);
-	}
-	else {
-		writeRawData(a);
-	}
-}
-
 void SecureStream::layer_error(int x)
 {
 	SecureLayer *s = (SecureLayer *)sender();
@@ -653,11 +795,13 @@ void SecureStream::insertData(const QByteArray &a)
 
 void SecureStream::writeRawData(const QByteArray &a)
 {
+	d->wireOut += a.size();
 	d->bs->write(a);
 }
 
 void SecureStream::incomingData(const QByteArray &a)
 {
+	d->plainIn += a.size();
 	appendRead(a);
 	if(bytesAvailable())
 		readyRead();
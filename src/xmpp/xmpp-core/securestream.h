@@ -34,7 +34,13 @@ namespace XMPP
 #endif
 
 class CompressionHandler;
+class SecureLayer;
 
+// the layers work on buffers in user space.  handing an established TLS
+//   session to the kernel (TCP_ULP "tls") would need the traffic keys,
+//   IVs and record sequence numbers, and QCA::TLS gives none of them out,
+//   so every record is sealed here.  to keep the number of records down,
+//   write in bursts: see ClientStream::cork() and setAutoCork()
 class SecureStream : public ByteStream
 {
 	Q_OBJECT
@@ -45,7 +51,7 @@ public:
 
 	void startTLSClient(QCA::TLS *t, const QByteArray &spare=QByteArray());
 	void startTLSServer(QCA::TLS *t, const QByteArray &spare=QByteArray());
-	void setLayerCompress(const QByteArray &spare=QByteArray());
+	void setLayerCompress(const QByteArray &spare=QByteArray(), bool batchFlush=false, int flushBytes=0, int level=-1, int windowBits=15, bool adaptive=false);
 	void setLayerSASL(QCA::SASL *s, const QByteArray &spare=QByteArray());
 #ifdef USE_TLSHANDLER
 	void startTLSClient(XMPP::TLSHandler *t, const QString &server, const QByteArray &spare=QByteArray());
@@ -54,10 +60,28 @@ public:
 	void closeTLS();
 	int errorCode() const;
 
+	// size the tls records by traffic: records that fit in a packet after
+	//   idle moments, growing to the maximum size during a sustained
+	//   burst.  on by default
+	void setDynamicRecordSize(bool);
+
+	// while disabled, nothing is read from the underlying stream.  data
+	//   already read and decrypted stays available.
+	void setReadEnabled(bool);
+	bool isReadEnabled() const;
+
 	// reimplemented
 	bool isOpen() const;
 	void write(const QByteArray &);
 	int bytesToWrite() const;
+	void compact();
+
+	// byte counts since creation.  wire bytes went through the
+	//   underlying stream, plain bytes are above all the layers.
+	qint64 wireBytesRead() const;
+	qint64 wireBytesWritten() const;
+	qint64 plainBytesRead() const;
+	qint64 plainBytesWritten() const;
 
 signals:
 	void tlsHandshaken();
@@ -69,12 +93,12 @@ private slots:
 
 	void layer_tlsHandshaken();
 	void layer_tlsClosed(const QByteArray &);
-	void layer_readyRead(const QByteArray &);
-	void layer_needWrite(const QByteArray &);
 	void layer_error(int);
 
 private:
-	void linkLayer(QObject *);
+	friend class SecureLayer;
+
+	void linkLayer(SecureLayer *);
 	int calcPrebytes() const;
 	void insertData(const QByteArray &a);
 	void writeRawData(const QByteArray &a);
@@ -28,12 +28,50 @@
 #include <stdlib.h>
 #include <QtCrypto>
 #include <QDebug>
+#include <QHash>
+#include <QMutex>
 
 #include "xmpp/sasl/plainmessage.h"
 #include "xmpp/sasl/digestmd5response.h"
+#include "xmpp/sasl/scramsha1message.h"
+#include "xmpp/sasl/scramsha1response.h"
 #include "xmpp/base/randrandomnumbergenerator.h"
 
+// accounts whose SCRAM keys are kept
+#define SCRAM_CACHE_MAX 16384
+
 namespace XMPP {
+
+// SCRAM-SHA-1 keys derived so far, so that logging in to the same account
+//   again skips the PBKDF2 step.  entries are keyed by host, user and a
+//   hash of the password, and still have to match the server's salt.
+class SCRAMCredentialCache
+{
+public:
+	QMutex m;
+	QHash<QByteArray, SCRAMSHA1Credentials> entries;
+
+	static QByteArray key(const QString &host, const QString &user, const QByteArray &password)
+	{
+		return host.toUtf8() + '\0' + user.toUtf8() + '\0' + QCA::Hash("sha1").hash(password).toByteArray();
+	}
+
+	SCRAMSHA1Credentials get(const QByteArray &k)
+	{
+		QMutexLocker locker(&m);
+		return entries.value(k);
+	}
+
+	void put(const QByteArray &k, const SCRAMSHA1Credentials &c)
+	{
+		QMutexLocker locker(&m);
+		if(!entries.contains(k) && entries.count() >= SCRAM_CACHE_MAX)
+			entries.erase(entries.begin());
+		entries.insert(k, c);
+	}
+};
+
+Q_GLOBAL_STATIC(SCRAMCredentialCache, scramcache)
 class SimpleSASLContext : public QCA::SASLContext
 {
 public:
@@ -80,8 +118,13 @@ public:
 	QByteArray result_to_net_, result_to_app_;
 	int encoded_;
 
+	// SCRAM-SHA-1 state between steps
+	QByteArray scram_bare, scram_gs2, scram_nonce;
+	SCRAMSHA1Response *scram_response;
+
 	SimpleSASLContext(QCA::Provider* p) : QCA::SASLContext(p)
 	{
+		scram_response = 0;
 		reset();
 	}
 
@@ -115,6 +158,11 @@ public:
 		out_mech = QString();
 		out_buf.resize(0);
 		authCondition_ = QCA::SASL::AuthFail;
+		scram_bare.clear();
+		scram_gs2.clear();
+		scram_nonce.clear();
+		delete scram_response;
+		scram_response = 0;
 	}
 
 	virtual void setConstraints(QCA::SASL::AuthFlags flags, int ssfMin, int) {
@@ -133,15 +181,14 @@ public:
 	virtual void startClient(const QStringList &mechlist, bool allowClientSendFirst) {
 		Q_UNUSED(allowClientSendFirst);
 
+		// strongest first
 		mechanism_ = QString();
-		foreach(QString mech, mechlist) {
-			if (mech == "DIGEST-MD5") {
-				mechanism_ = "DIGEST-MD5";
-				break;
-			}
-			if (mech == "PLAIN" && allow_plain) 
-				mechanism_ = "PLAIN";
-		}
+		if (mechlist.contains("SCRAM-SHA-1"))
+			mechanism_ = "SCRAM-SHA-1";
+		else if (mechlist.contains("DIGEST-MD5"))
+			mechanism_ = "DIGEST-MD5";
+		else if (mechlist.contains("PLAIN") && allow_plain)
+			mechanism_ = "PLAIN";
 
 		if(!capable || mechanism_.isEmpty()) {
 			result_ = Error;
@@ -189,12 +236,63 @@ public:
 				}
 				out_buf = PLAINMessage(authz, user, pass.toByteArray()).getValue();
 			}
+			// SCRAM-SHA-1 also speaks first
+			else if (out_mech == "SCRAM-SHA-1") {
+				if(need.user || need.pass) {
+					qWarning("simplesasl.cpp: Did not receive necessary auth parameters");
+					result_ = Error;
+					goto ready;
+				}
+				if(!have.user)
+					need.user = true;
+				if(!have.pass)
+					need.pass = true;
+				if(need.user || need.pass) {
+					result_ = Params;
+					goto ready;
+				}
+				SCRAMSHA1Message message(authz, user, RandRandomNumberGenerator());
+				out_buf = message.getValue();
+				scram_bare = message.getBareValue();
+				scram_gs2 = message.getGS2Header();
+				scram_nonce = message.getClientNonce();
+			}
 			++step;
 			if (out_mech == "PLAIN")
 				result_ = Success;
 			else
 				result_ = Continue;
 		}
+		else if(step == 1 && out_mech == "SCRAM-SHA-1") {
+			QByteArray password = pass.toByteArray();
+			QByteArray k = SCRAMCredentialCache::key(host, user, password);
+			SCRAMSHA1Credentials known = scramcache()->get(k);
+
+			scram_response = new SCRAMSHA1Response(in_buf, password, scram_bare, scram_gs2, scram_nonce, known);
+			if (!scram_response->isValid()) {
+				authCondition_ = QCA::SASL::BadProtocol;
+				result_ = Error;
+				goto ready;
+			}
+			if (!scram_response->getCredentials().isFor(known.getSalt(), known.getIterations()))
+				scramcache()->put(k, scram_response->getCredentials());
+
+			out_buf = scram_response->getValue();
+			++step;
+			result_ = Continue;
+		}
+		else if(step == 2 && out_mech == "SCRAM-SHA-1") {
+			// server-final-message: the server has to prove it knew the
+			//   password too
+			if (!scram_response || !scram_response->verifyServerFinal(in_buf)) {
+				authCondition_ = QCA::SASL::BadServer;
+				result_ = Error;
+				goto ready;
+			}
+			out_buf.resize(0);
+			++step;
+			result_ = Success;
+		}
 		else if(step == 1) {
 			Q_ASSERT(out_mech != "PLAIN");
 
@@ -269,7 +367,7 @@ ready:
 	}
 	
 	virtual bool haveClientInit() const {
-		return out_mech == "PLAIN";
+		return out_mech == "PLAIN" || out_mech == "SCRAM-SHA-1";
 	}
 	
 	virtual QByteArray stepData() const {
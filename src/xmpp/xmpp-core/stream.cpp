@@ -48,6 +48,10 @@
 #include <qpointer.h>
 #include <qtimer.h>
 #include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QThreadStorage>
 #include <QByteArray>
 #include <stdlib.h>
 #include "bytestream.h"
@@ -56,6 +60,9 @@
 #include "simplesasl.h"
 #include "securestream.h"
 #include "protocol.h"
+#include "timerwheel.h"
+#include "xmpp_streamserver.h"
+#include "xmpp/base/idgenerator.h"
 
 #ifdef XMPP_TEST
 #include "td.h"
@@ -63,6 +70,9 @@
 
 //#define XMPP_DEBUG
 
+// push corked data out anyway once this much has piled up
+#define CORK_MAX_BYTES 65536
+
 using namespace XMPP;
 
 static Debug *debug_ptr = 0;
@@ -71,28 +81,17 @@ void XMPP::setDebug(Debug *p)
 	debug_ptr = p;
 }
 
-static QByteArray randomArray(int size)
-{
-	QByteArray a;
-	a.resize(size);
-	for(int n = 0; n < size; ++n)
-		a[n] = (char)(256.0*rand()/(RAND_MAX+1.0));
-	return a;
-}
-
 static QString genId()
 {
-	// need SHA1 here
-	//if(!QCA::isSupported(QCA::CAP_SHA1))
-	//	QCA::insertProvider(createProviderHash());
-
-	return QCA::Hash("sha1").hashToString(randomArray(128));
+	return IdGenerator::hexId("", QCA::Random::randomArray(20).toByteArray());
 }
 
 //----------------------------------------------------------------------------
 // Stream
 //----------------------------------------------------------------------------
-static XmlProtocol *foo = 0;
+// one per thread, as streams may be running on several
+Q_GLOBAL_STATIC(QThreadStorage<XmlProtocol*>, foo)
+
 Stream::Stream(QObject *parent)
 :QObject(parent)
 {
@@ -114,9 +113,9 @@ Stanza Stream::createStanza(const QDomElement &e)
 
 QString Stream::xmlToString(const QDomElement &e, bool clip)
 {
-	if(!foo)
-		foo = new CoreProtocol;
-	return foo->elementToString(e, clip);
+	if(!foo()->hasLocalData())
+		foo()->setLocalData(new CoreProtocol);
+	return foo()->localData()->elementToString(e, clip);
 }
 
 //----------------------------------------------------------------------------
@@ -128,6 +127,7 @@ enum {
 	WaitVersion,
 	WaitTLS,
 	NeedParams,
+	Standby,
 	Active,
 	Closing
 };
@@ -157,9 +157,36 @@ public:
 		maximumSSF = 0;
 		doBinding = true;
                 doCompress = false;
+		compressFlush = CompressFlushBatched;
+		compressFlushBytes = 8192;
+		compressLevel = -1;
+		compressWindowBits = 15;
+		compressAdaptive = false;
+		autoCork = false;
+		doSM = false;
+		pipelinedLogin = false;
+		standby = false;
+		standbyAuth = false;
+		component = false;
 		lang = "";
 
 		in_rrsig = false;
+		immediateDelivery = false;
+		delivering = false;
+
+		worker = 0;
+		readyPosted = false;
+		readHighWater = 0;
+
+		writeHighWater = 0;
+		for(int n = 0; n < 3; ++n) {
+			writeRate[n] = 0;
+			writeTokens[n] = 0;
+		}
+		writeClock.start();
+		writeRefilled = 0;
+		pumping = false;
+		idle_compact = 0;
 
 		reset();
 	}
@@ -172,6 +199,42 @@ public:
 		sasl_ssf = 0;
 		tls_warned = false;
 		using_tls = false;
+		corkCount = 0;
+		autoCorked = false;
+		corkBuf.clear();
+		for(int n = 0; n < 3; ++n)
+			writeQueue[n].clear();
+		readPaused = false;
+		resumePosted = false;
+	}
+
+	// called under inMutex after a stanza was taken from 'in'.  true if
+	//   reading should resume, which the caller has to post to the
+	//   stream's thread.
+	bool wantResume()
+	{
+		if(!readPaused || resumePosted || in.count() > readHighWater / 2)
+			return false;
+		resumePosted = true;
+		return true;
+	}
+
+	// tokens a class earned since the last refill, up to a second's worth
+	void refillWriteTokens()
+	{
+		qint64 now = writeClock.usecsElapsed();
+		qint64 usecs = now - writeRefilled;
+		writeRefilled = now;
+		for(int n = 0; n < 3; ++n) {
+			if(writeRate[n] <= 0)
+				continue;
+			writeTokens[n] = qMin(writeTokens[n] + usecs * writeRate[n] / 1000000, qint64(writeRate[n]));
+		}
+	}
+
+	bool throttled(int prio) const
+	{
+		return writeHighWater > 0 && writeRate[prio] > 0 && writeTokens[prio] <= 0;
 	}
 
 	Jid jid;
@@ -200,6 +263,7 @@ public:
 	QString lang;
 
 	QString defRealm;
+	ServerContext ctx; // server mode
 
 	int mode;
 	int state;
@@ -209,8 +273,19 @@ public:
 	bool tls_warned, using_tls;
 	bool doAuth;
 	bool doCompress;
-
-	QStringList sasl_mechlist;
+	CompressFlushType compressFlush;
+	int compressFlushBytes;
+	int compressLevel, compressWindowBits;
+	bool compressAdaptive;
+	bool autoCork, autoCorked;
+	int corkCount;
+	QByteArray corkBuf;
+	bool doSM;
+	bool pipelinedLogin;
+	bool standby, standbyAuth; // see setStandby()
+	StreamManagementState smResume; // from the last stream that dropped
+	bool component; // see connectAsComponent()
+	QString componentSecret;
 
 	int errCond;
 	QString errText;
@@ -218,8 +293,54 @@ public:
 
 	QList<Stanza*> in;
 
-	QTimer noopTimer;
+	// see setImmediateDelivery().  delivering is set while readyRead()
+	//   is being emitted from processNext()
+	bool immediateDelivery;
+	bool delivering;
+
+	// worker mode.  'in' and 'queued' are shared with the thread that
+	//   uses the stream, under inMutex.  readyPosted is set while a
+	//   readyRead() is on its way and nobody has found 'in' empty since.
+	struct QueuedWrite
+	{
+		Stanza stanza;
+		int prio;
+		QString str; // for writeDirect(), if stanza is null
+	};
+	QThread *worker;
+	QMutex inMutex;
+	bool readyPosted;
+	QList<QueuedWrite> queued;
+
+	// ingest limit, see setReadHighWater().  readPaused and resumePosted
+	//   are under inMutex as well.
+	int readHighWater;
+	bool readPaused;
+	bool resumePosted;
+
+	// stanza counts, and byte counts of securestreams already deleted
+	StreamStatistics stats;
+
+	WheelTimer noopTimer; // coarse: shares its wakeups with other streams
 	int noop_time;
+	QTimer corkTimer;
+
+	// outgoing stanzas held back by priority, see setWriteHighWater().
+	//   rates are in bytes per second, and tokens are bytes a class may
+	//   still send, going below zero for a stanza larger than what was left.
+	int writeHighWater;
+	QList<Stanza> writeQueue[3];
+	int writeRate[3];
+	qint64 writeTokens[3];
+	StatisticsTimer writeClock;
+	qint64 writeRefilled; // usecs on writeClock
+	QTimer writeTimer;
+	bool pumping;
+
+	// buffers are compacted after this long without traffic, see
+	//   setIdleCompaction()
+	int idle_compact;
+	QTimer compactTimer;
 };
 
 ClientStream::ClientStream(Connector *conn, TLSHandler *tlsHandler, QObject *parent)
@@ -234,6 +355,15 @@ ClientStream::ClientStream(Connector *conn, TLSHandler *tlsHandler, QObject *par
 	d->noop_time = 0;
 	connect(&d->noopTimer, SIGNAL(timeout()), SLOT(doNoop()));
 
+	d->corkTimer.setSingleShot(true);
+	connect(&d->corkTimer, SIGNAL(timeout()), SLOT(doAutoUncork()));
+
+	d->writeTimer.setSingleShot(true);
+	connect(&d->writeTimer, SIGNAL(timeout()), SLOT(pumpWrites()));
+
+	d->compactTimer.setSingleShot(true);
+	connect(&d->compactTimer, SIGNAL(timeout()), SLOT(doIdleCompaction()));
+
 	d->tlsHandler = tlsHandler;
 }
 
@@ -241,6 +371,18 @@ ClientStream::ClientStream(const QString &host, const QString &defRealm, ByteStr
 :Stream(parent)
 {
 	d = new Private;
+	srvInit(ServerContext(host, defRealm), bs, tls);
+}
+
+ClientStream::ClientStream(const ServerContext &context, ByteStream *bs, QObject *parent)
+:Stream(parent)
+{
+	d = new Private;
+	srvInit(context, bs, 0);
+}
+
+void ClientStream::srvInit(const ServerContext &context, ByteStream *bs, QCA::TLS *tls)
+{
 	d->mode = Server;
 	d->bs = bs;
 	connect(d->bs, SIGNAL(connectionClosed()), SLOT(bs_connectionClosed()));
@@ -256,10 +398,16 @@ ClientStream::ClientStream(const QString &host, const QString &defRealm, ByteStr
 	connect(d->ss, SIGNAL(tlsClosed()), SLOT(ss_tlsClosed()));
 	connect(d->ss, SIGNAL(error(int)), SLOT(ss_error(int)));
 
-	d->server = host;
-	d->defRealm = defRealm;
+	d->compactTimer.setSingleShot(true);
+	connect(&d->compactTimer, SIGNAL(timeout()), SLOT(doIdleCompaction()));
+
+	d->ctx = context;
+	d->server = context.host();
+	d->defRealm = context.defaultRealm();
 
+	// with a context, tls is only made if the peer asks for it
 	d->tls = tls;
+	d->srv.setAllowTLS(tls || context.haveTLS());
 
 	d->srv.startClientIn(genId());
 	//d->srv.startServerIn(genId());
@@ -276,10 +424,23 @@ ClientStream::~ClientStream()
 
 void ClientStream::reset(bool all)
 {
+	// a live session going away without a close can be resumed later
+	if(d->mode == Client && d->state == Active && d->client.canResume())
+		d->smResume = d->client.resumeState();
+
 	d->reset();
 	d->noopTimer.stop();
-
-	// delete securestream
+	d->corkTimer.stop();
+	d->writeTimer.stop();
+	d->compactTimer.stop();
+
+	// delete securestream, keeping its counts
+	if(d->ss) {
+		d->stats.wireBytesIn += d->ss->wireBytesRead();
+		d->stats.wireBytesOut += d->ss->wireBytesWritten();
+		d->stats.plainBytesIn += d->ss->plainBytesRead();
+		d->stats.plainBytesOut += d->ss->plainBytesWritten();
+	}
 	delete d->ss;
 	d->ss = 0;
 
@@ -318,9 +479,11 @@ void ClientStream::reset(bool all)
 	}
 
 	if(all) {
+		QMutexLocker locker(&d->inMutex);
 		while (!d->in.isEmpty()) {
 			delete d->in.takeFirst();
 		}
+		d->readyPosted = false;
 	}
 }
 
@@ -331,17 +494,45 @@ Jid ClientStream::jid() const
 
 void ClientStream::connectToServer(const Jid &jid, bool auth)
 {
+	if(queueCall("doConnectToServer", Q_ARG(QString, jid.full()), Q_ARG(bool, auth)))
+		return;
+
 	reset(true);
 	d->state = Connecting;
 	d->jid = jid;
 	d->doAuth = auth;
 	d->server = d->jid.domain();
+	d->component = false;
 
 	d->conn->connectToServer(d->server);
 }
 
+void ClientStream::connectAsComponent(const Jid &domain, const QString &secret)
+{
+	if(queueCall("doConnectAsComponent", Q_ARG(QString, domain.full()), Q_ARG(QString, secret)))
+		return;
+
+	reset(true);
+	d->state = Connecting;
+	d->jid = Jid(domain.domain());
+	d->doAuth = true;
+	d->server = d->jid.domain();
+	d->component = true;
+	d->componentSecret = secret;
+
+	d->conn->connectToServer(d->server);
+}
+
+bool ClientStream::isComponent() const
+{
+	return d->component;
+}
+
 void ClientStream::continueAfterWarning()
 {
+	if(queueCall("continueAfterWarning"))
+		return;
+
 	if(d->state == WaitVersion) {
 		// if we don't have TLS yet, then we're never going to get it
 		if(!d->tls_warned && !d->using_tls) {
@@ -406,6 +597,9 @@ void ClientStream::setAuthzid(const QString &s)
 
 void ClientStream::continueAfterParams()
 {
+	if(queueCall("continueAfterParams"))
+		return;
+
 	if(d->state == NeedParams) {
 		d->state = Connecting;
 		if(d->client.old) {
@@ -430,6 +624,9 @@ void ClientStream::setLang(const QString& lang)
 
 void ClientStream::setNoopTime(int mills)
 {
+	if(queueCall("setNoopTime", Q_ARG(int, mills)))
+		return;
+
 	d->noop_time = mills;
 
 	if(d->state != Active)
@@ -442,6 +639,30 @@ void ClientStream::setNoopTime(int mills)
 	d->noopTimer.start(d->noop_time);
 }
 
+void ClientStream::setIdleCompaction(int mills)
+{
+	if(queueCall("setIdleCompaction", Q_ARG(int, mills)))
+		return;
+
+	d->idle_compact = mills;
+	if(d->idle_compact > 0 && d->ss)
+		d->compactTimer.start(d->idle_compact);
+	else
+		d->compactTimer.stop();
+}
+
+void ClientStream::doIdleCompaction()
+{
+	if(!d->ss)
+		return;
+
+	if(d->mode == Client)
+		d->client.compact();
+	else
+		d->srv.compact();
+	d->ss->compact();
+}
+
 QString ClientStream::saslMechanism() const
 {
 	return d->client.saslMech();
@@ -464,9 +685,127 @@ void ClientStream::setLocalAddr(const QHostAddress &addr, quint16 port)
 	d->localPort = port;
 }
 
-void ClientStream::setCompress(bool compress) 
+void ClientStream::setCompress(bool compress, CompressFlushType flush, int flushBytes)
 {
 	d->doCompress = compress;
+	d->compressFlush = flush;
+	d->compressFlushBytes = flushBytes;
+}
+
+void ClientStream::setCompressionLevel(int level, int windowBits)
+{
+	d->compressLevel = level;
+	d->compressWindowBits = windowBits;
+}
+
+void ClientStream::setAdaptiveCompression(bool b)
+{
+	d->compressAdaptive = b;
+}
+
+void ClientStream::setPipelinedLogin(bool b)
+{
+	d->pipelinedLogin = b;
+}
+
+void ClientStream::setStreamManagement(bool b)
+{
+	d->doSM = b;
+	if(!b)
+		d->smResume = StreamManagementState();
+}
+
+bool ClientStream::isResumed() const
+{
+	return d->client.resumed;
+}
+
+void ClientStream::setStandby(bool enabled, bool authenticate)
+{
+	d->standby = enabled;
+	d->standbyAuth = authenticate;
+}
+
+bool ClientStream::isStandby() const
+{
+	return d->state == Standby;
+}
+
+void ClientStream::takeSession(ClientStream *other)
+{
+	if(!d->doSM || !other->d->smResume.isValid())
+		return;
+	d->smResume = other->d->smResume;
+	other->d->smResume = StreamManagementState();
+}
+
+void ClientStream::continueFromStandby()
+{
+	if(queueCall("continueFromStandby"))
+		return;
+	if(d->state != Standby)
+		return;
+
+	// the session may have come from another stream since connecting
+	d->standby = false;
+	if(d->doSM && d->smResume.isValid() && d->smResume.jid.compare(d->jid, false))
+		d->client.setResumeState(d->smResume);
+	d->state = Connecting;
+	processNext();
+}
+
+bool ClientStream::isRosterVersioningSupported() const
+{
+	return d->client.features.rosterver_supported;
+}
+
+void ClientStream::cork()
+{
+	if(queueCall("cork"))
+		return;
+
+	++d->corkCount;
+}
+
+void ClientStream::uncork()
+{
+	if(queueCall("uncork"))
+		return;
+
+	if(d->corkCount > 0 && --d->corkCount == 0)
+		flushCork();
+}
+
+void ClientStream::setAutoCork(bool b)
+{
+	if(queueCall("setAutoCork", Q_ARG(bool, b)))
+		return;
+
+	d->autoCork = b;
+	if(!b && d->autoCorked) {
+		d->corkTimer.stop();
+		doAutoUncork();
+	}
+}
+
+void ClientStream::doAutoUncork()
+{
+	if(!d->autoCorked)
+		return;
+	d->autoCorked = false;
+	uncork();
+}
+
+void ClientStream::flushCork()
+{
+	if(d->corkBuf.isEmpty() || !d->ss)
+		return;
+
+	// one write means one pass through the tls/compression layers.  the
+	//   protocol tracks written bytes, not writes, so accounting is fine.
+	QByteArray a = d->corkBuf;
+	d->corkBuf.clear();
+	d->ss->write(a);
 }
 
 int ClientStream::errorCondition() const
@@ -491,7 +830,27 @@ bool ClientStream::old() const
 
 void ClientStream::close()
 {
+	if(queueCall("close"))
+		return;
+
+	// closing ends the session for good
+	d->smResume = StreamManagementState();
+
 	if(d->state == Active) {
+		// stanzas held back by shaping were already accepted from the
+		//   caller, so they go out ahead of the closing tag
+		QPointer<QObject> self = this;
+		for(int n = 0; n < 3; ++n) {
+			while(d->state == Active && !d->writeQueue[n].isEmpty()) {
+				sendNow(d->writeQueue[n].takeFirst());
+				if(!self)
+					return;
+			}
+		}
+		if(d->state != Active)
+			return;
+		d->writeTimer.stop();
+
 		d->state = Closing;
 		d->client.shutdown();
 		processNext();
@@ -506,9 +865,14 @@ QDomDocument & ClientStream::doc() const
 	return d->client.doc;
 }
 
+void ClientStream::setDocument(const QDomDocument &doc)
+{
+	d->client.setDocument(doc);
+}
+
 QString ClientStream::baseNS() const
 {
-	return NS_CLIENT;
+	return d->component ? NS_COMPONENT : NS_CLIENT;
 }
 
 void ClientStream::setAllowPlain(AllowPlainType a)
@@ -534,27 +898,339 @@ void ClientStream::setOldOnly(bool b)
 
 bool ClientStream::stanzaAvailable() const
 {
-	return (!d->in.isEmpty());
+	QMutexLocker locker(&d->inMutex);
+	if(d->in.isEmpty()) {
+		// the next stanza needs a readyRead() of its own
+		d->readyPosted = false;
+		if(d->wantResume())
+			QMetaObject::invokeMethod(const_cast<ClientStream*>(this), "resumeReading", Qt::QueuedConnection);
+		return false;
+	}
+	return true;
 }
 
 Stanza ClientStream::read()
 {
-	if(d->in.isEmpty())
+	QMutexLocker locker(&d->inMutex);
+	if(d->in.isEmpty()) {
+		d->readyPosted = false;
 		return Stanza();
+	}
 	else {
 		Stanza *sp = d->in.takeFirst();
 		Stanza s = *sp;
 		delete sp;
+		if(d->wantResume())
+			QMetaObject::invokeMethod(this, "resumeReading", Qt::QueuedConnection);
 		return s;
 	}
 }
 
 void ClientStream::write(const Stanza &s)
+{
+	write(s, writePriority(s));
+}
+
+void ClientStream::write(const Stanza &s, WritePriority prio)
+{
+	// from another thread, queue it up.  the first one of a batch has the
+	//   worker called, which sends whatever has been queued by then.
+	if(d->worker && QThread::currentThread() != thread()) {
+		Private::QueuedWrite w;
+		w.stanza = s;
+		w.prio = prio;
+		QMutexLocker locker(&d->inMutex);
+		d->queued += w;
+		if(d->queued.count() == 1)
+			QMetaObject::invokeMethod(this, "flushQueuedWrites", Qt::QueuedConnection);
+		return;
+	}
+
+	writeNow(s, prio);
+}
+
+ClientStream::WritePriority ClientStream::writePriority(const Stanza &s)
+{
+	QDomElement e = s.element();
+	if(s.kind() == Stanza::IQ) {
+		QString type = e.attribute("type");
+		if(type == "result" || type == "error")
+			return PriorityControl;
+	}
+	for(QDomNode n = e.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		QDomElement i = n.toElement();
+		if(i.isNull())
+			continue;
+		QString ns = i.namespaceURI();
+		if(ns == "urn:xmpp:ping" && i.tagName() == "ping")
+			return PriorityControl;
+		if(ns == "http://jabber.org/protocol/ibb" && i.tagName() == "data")
+			return PriorityBulk;
+		if(ns == "vcard-temp" && e.attribute("type") == "set")
+			return PriorityBulk;
+	}
+	return PriorityInteractive;
+}
+
+void ClientStream::setWriteHighWater(int bytes)
+{
+	if(queueCall("setWriteHighWater", Q_ARG(int, bytes)))
+		return;
+
+	d->writeHighWater = qMax(bytes, 0);
+	pumpWrites();
+}
+
+void ClientStream::setWriteRate(int prio, int bytesPerSecond)
+{
+	if(queueCall("setWriteRate", Q_ARG(int, prio), Q_ARG(int, bytesPerSecond)))
+		return;
+
+	if(prio <= PriorityControl || prio > PriorityBulk)
+		return;
+	d->refillWriteTokens();
+	d->writeRate[prio] = qMax(bytesPerSecond, 0);
+	d->writeTokens[prio] = d->writeRate[prio];
+	pumpWrites();
+}
+
+void ClientStream::writeNow(const Stanza &s, int prio)
+{
+	// anything but control waits its turn while shaping is on, even when
+	//   it could go out right away, so that a class stays in order
+	if(d->state == Active && d->writeHighWater > 0 && prio != PriorityControl) {
+		d->writeQueue[prio] += s;
+		pumpWrites();
+		return;
+	}
+
+	sendNow(s);
+}
+
+void ClientStream::sendNow(const Stanza &s)
 {
 	if(d->state == Active) {
+		if(d->autoCork && !d->autoCorked) {
+			d->autoCorked = true;
+			cork();
+			d->corkTimer.start(0);
+		}
 		d->client.sendStanza(s.element());
+		++d->stats.stanzasOut;
 		processNext();
 	}
+	// held until they can go out behind the bind request
+	else if(d->pipelinedLogin && d->mode == Client && d->state != Idle && d->state != Closing) {
+		d->client.sendStanza(s.element());
+		++d->stats.stanzasOut;
+	}
+}
+
+StanzaTemplate ClientStream::createTemplate(const Stanza &s)
+{
+	StanzaTemplate t;
+	if(s.isNull())
+		return t;
+
+	QDomElement e = s.element().cloneNode(true).toElement();
+	e.removeAttribute("to");
+	e.removeAttribute("id");
+
+	// the protocol belongs to the worker, if there is one
+	QByteArray marked;
+	if(d->state == Active && (!d->worker || QThread::currentThread() == thread())) {
+		QDomElement m = e.cloneNode(true).toElement();
+		m.setAttribute("to", StanzaTemplate::toMarker());
+		m.setAttribute("id", StanzaTemplate::idMarker());
+		marked = d->client.elementToUtf8(m);
+	}
+	t.setContent(e, this, marked);
+	return t;
+}
+
+void ClientStream::write(const StanzaTemplate &t, const Jid &to, const QString &id)
+{
+	if(t.isNull())
+		return;
+
+	QByteArray a;
+	if(t.owner() == this && canWriteUtf8())
+		a = t.toUtf8(to, id);
+	if(a.isEmpty()) {
+		Stanza s = createStanza(t.element().cloneNode(true).toElement());
+		if(!to.isEmpty())
+			s.setTo(to);
+		if(!id.isEmpty())
+			s.setId(id);
+		write(s, PriorityInteractive);
+		return;
+	}
+
+	writeUtf8(a);
+}
+
+bool ClientStream::canWriteUtf8() const
+{
+	return ((!d->worker || QThread::currentThread() == thread())
+		&& d->state == Active
+		&& d->writeHighWater <= 0
+		&& !d->client.streamManagementEnabled());
+}
+
+QString ClientStream::writeScopeNS() const
+{
+	return d->client.writeScopeNS();
+}
+
+void ClientStream::writeUtf8(const QByteArray &a)
+{
+	Q_ASSERT(canWriteUtf8());
+	if(d->autoCork && !d->autoCorked) {
+		d->autoCorked = true;
+		cork();
+		d->corkTimer.start(0);
+	}
+	d->client.sendStanzaBytes(a);
+	++d->stats.stanzasOut;
+	processNext();
+}
+
+int ClientStream::pendingWriteBytes() const
+{
+	return (d->ss ? d->ss->bytesToWrite() : 0) + d->corkBuf.size();
+}
+
+void ClientStream::pumpWrites()
+{
+	// a stanza written while sending another is picked up by the loop
+	if(d->pumping)
+		return;
+
+	d->pumping = true;
+	d->refillWriteTokens();
+	QPointer<QObject> self = this;
+	while(d->state == Active) {
+		// ss_bytesWritten() comes back once the socket has taken more
+		if(d->writeHighWater > 0 && pendingWriteBytes() > d->writeHighWater)
+			break;
+
+		int prio = -1;
+		for(int n = 0; n < 3; ++n) {
+			if(!d->writeQueue[n].isEmpty() && !d->throttled(n)) {
+				prio = n;
+				break;
+			}
+		}
+		if(prio == -1)
+			break;
+
+		Stanza s = d->writeQueue[prio].takeFirst();
+		int before = pendingWriteBytes();
+		sendNow(s);
+		if(!self)
+			return;
+		if(d->writeRate[prio] > 0)
+			d->writeTokens[prio] -= qMax(pendingWriteBytes() - before, 0);
+	}
+	d->pumping = false;
+
+	// come back when the first throttled class has earned a byte again
+	qint64 wait = -1;
+	for(int n = 0; n < 3; ++n) {
+		if(d->writeQueue[n].isEmpty() || !d->throttled(n))
+			continue;
+		qint64 usecs = (1 - d->writeTokens[n]) * 1000000 / d->writeRate[n];
+		if(wait == -1 || usecs < wait)
+			wait = usecs;
+	}
+	if(wait != -1 && d->state == Active) {
+		int msecs = int(qMax((wait + 999) / 1000, qint64(1)));
+		if(!d->writeTimer.isActive() || d->writeTimer.interval() > msecs)
+			d->writeTimer.start(msecs);
+	}
+}
+
+void ClientStream::flushQueuedWrites()
+{
+	QList<Private::QueuedWrite> list;
+	{
+		QMutexLocker locker(&d->inMutex);
+		list = d->queued;
+		d->queued.clear();
+	}
+
+	// one write for the lot
+	QPointer<QObject> self = this;
+	cork();
+	for(int n = 0; n < list.count() && self; ++n) {
+		if(!list[n].stanza.isNull())
+			writeNow(list[n].stanza, list[n].prio);
+		else
+			writeDirect(list[n].str);
+	}
+	if(self)
+		uncork();
+}
+
+void ClientStream::doConnectToServer(const QString &jid, bool auth)
+{
+	connectToServer(Jid(jid), auth);
+}
+
+void ClientStream::doConnectAsComponent(const QString &domain, const QString &secret)
+{
+	connectAsComponent(Jid(domain), secret);
+}
+
+void ClientStream::setWorkerThread(QThread *thread)
+{
+	if(d->worker || !thread || thread == this->thread() || d->state != Idle)
+		return;
+
+	d->worker = thread;
+	moveToThread(thread);
+	d->noopTimer.moveToThread(thread);
+	d->corkTimer.moveToThread(thread);
+	d->writeTimer.moveToThread(thread);
+	d->compactTimer.moveToThread(thread);
+	if(d->conn && !d->conn->parent())
+		d->conn->moveToThread(thread);
+	if(d->tlsHandler && !d->tlsHandler->parent())
+		d->tlsHandler->moveToThread(thread);
+	if(d->bs && !d->bs->parent())
+		d->bs->moveToThread(thread);
+}
+
+QThread *ClientStream::workerThread() const
+{
+	return d->worker;
+}
+
+// in worker mode a call from another thread is queued to the worker.
+//   returns true if it was.
+bool ClientStream::queueCall(const char *method, QGenericArgument a0, QGenericArgument a1, QGenericArgument a2)
+{
+	if(!d->worker || QThread::currentThread() == thread())
+		return false;
+	QMetaObject::invokeMethod(this, method, Qt::QueuedConnection, a0, a1, a2);
+	return true;
+}
+
+StreamStatistics ClientStream::statistics() const
+{
+	StreamStatistics s = d->stats;
+	if(d->ss) {
+		s.wireBytesIn += d->ss->wireBytesRead();
+		s.wireBytesOut += d->ss->wireBytesWritten();
+		s.plainBytesIn += d->ss->plainBytesRead();
+		s.plainBytesOut += d->ss->plainBytesWritten();
+		s.bytesToWrite = d->ss->bytesToWrite();
+	}
+
+	const CoreProtocol &p = (d->mode == Client) ? d->client : d->srv;
+	s.parseTime = p.parseTime;
+	s.serializeTime = p.serializeTime;
+	return s;
 }
 
 void ClientStream::cr_connected()
@@ -576,11 +1252,21 @@ void ClientStream::cr_connected()
 	//d->client.startDialbackOut("andbit.net", "im.pyxa.org");
 	//d->client.startServerOut(d->server);
 
-	d->client.startClientOut(d->jid, d->oldOnly, d->conn->useSSL(), d->doAuth, d->doCompress);
+	if(d->component)
+		d->client.startComponentOut(d->server, d->componentSecret);
+	else
+		d->client.startClientOut(d->jid, d->oldOnly, d->conn->useSSL(), d->doAuth, d->doCompress);
+	// RFC 7395 framing over WebSocket connections
+	d->client.setFraming(d->bs->inherits("WebSocket") ? XmlProtocol::WebSocketFraming : XmlProtocol::StreamFraming);
 	d->client.setAllowTLS(d->tlsHandler ? true: false);
 	d->client.setAllowBind(d->doBinding);
 	d->client.setAllowPlain(d->allowPlain == AllowPlain || (d->allowPlain == AllowPlainOverTLS && d->conn->useSSL()));
 	d->client.setLang(d->lang);
+	d->client.setStreamManagement(d->doSM);
+	// a standby binds long after sasl, not along with it
+	d->client.setPipelining(d->pipelinedLogin && !d->standby);
+	if(d->doSM && d->smResume.isValid() && d->smResume.jid.compare(d->jid, false))
+		d->client.setResumeState(d->smResume);
 
 	/*d->client.jid = d->jid;
 	d->client.server = d->server;
@@ -628,9 +1314,65 @@ void ClientStream::bs_error(int)
 	// TODO
 }
 
+void ClientStream::setImmediateDelivery(bool b)
+{
+	d->immediateDelivery = b;
+}
+
+void ClientStream::setReadHighWater(int stanzas)
+{
+	if(queueCall("setReadHighWater", Q_ARG(int, stanzas)))
+		return;
+
+	bool resume;
+	{
+		QMutexLocker locker(&d->inMutex);
+		d->readHighWater = qMax(stanzas, 0);
+		resume = d->readPaused && (d->readHighWater == 0 || d->in.count() < d->readHighWater);
+	}
+	if(resume)
+		resumeReading();
+}
+
+void ClientStream::setStanzaLimits(int maxBytes, int maxDepth, int maxAttributes)
+{
+	if(queueCall("setStanzaLimits", Q_ARG(int, maxBytes), Q_ARG(int, maxDepth), Q_ARG(int, maxAttributes)))
+		return;
+
+	d->client.setParserLimits(maxBytes, maxDepth, maxAttributes);
+	d->srv.setParserLimits(maxBytes, maxDepth, maxAttributes);
+}
+
+void ClientStream::setStanzaFilters(const QList<StanzaFilter> &filters)
+{
+	d->client.setStanzaFilters(filters);
+}
+
+void ClientStream::resumeReading()
+{
+	{
+		QMutexLocker locker(&d->inMutex);
+		d->resumePosted = false;
+		if(!d->readPaused)
+			return;
+		d->readPaused = false;
+	}
+	if(!d->ss)
+		return;
+	d->ss->setReadEnabled(true);
+	if(d->ss->bytesAvailable() > 0)
+		ss_readyRead();
+}
+
 void ClientStream::ss_readyRead()
 {
+	// the rest waits in the securestream until the app has caught up
+	if(!d->ss->isReadEnabled())
+		return;
+
 	QByteArray a = d->ss->read();
+	if(d->idle_compact > 0)
+		d->compactTimer.start(d->idle_compact);
 
 #ifdef XMPP_DEBUG
 	fprintf(stderr, "ClientStream: recv: %d [%s]\n", a.size(), a.data());
@@ -650,6 +1392,9 @@ void ClientStream::ss_readyRead()
 
 void ClientStream::ss_bytesWritten(int bytes)
 {
+	if(d->idle_compact > 0)
+		d->compactTimer.start(d->idle_compact);
+
 	if(d->mode == Client)
 		d->client.outgoingDataWritten(bytes);
 	else
@@ -659,8 +1404,14 @@ void ClientStream::ss_bytesWritten(int bytes)
 #ifdef XMPP_DEBUG
 		printf("We were waiting for data to be written, so let's process\n");
 #endif
+		QPointer<QObject> self = this;
 		processNext();
+		if(!self)
+			return;
 	}
+
+	if(d->writeHighWater > 0)
+		pumpWrites();
 }
 
 void ClientStream::ss_tlsHandshaken()
@@ -770,57 +1521,85 @@ void ClientStream::sasl_error()
 	error(ErrAuth);
 }
 
+void ClientStream::srvStartSASL()
+{
+	d->sasl = new QCA::SASL;
+	connect(d->sasl, SIGNAL(authCheck(const QString &, const QString &)), SLOT(sasl_authCheck(const QString &, const QString &)));
+	connect(d->sasl, SIGNAL(nextStep(const QByteArray &)), SLOT(sasl_nextStep(const QByteArray &)));
+	connect(d->sasl, SIGNAL(authenticated()), SLOT(sasl_authenticated()));
+	connect(d->sasl, SIGNAL(error()), SLOT(sasl_error()));
+
+	//d->sasl->setAllowAnonymous(false);
+	//d->sasl->setRequirePassCredentials(true);
+	//d->sasl->setExternalAuthID("localhost");
+	QCA::SASL::AuthFlags auth_flags = (QCA::SASL::AuthFlags) 0;
+	d->sasl->setConstraints(auth_flags,0,256);
+
+	// TODO: d->server is probably wrong here
+	d->sasl->startServer("xmpp", d->server, d->defRealm, QCA::SASL::AllowServerSendLast);
+}
+
 void ClientStream::srvProcessNext()
 {
 	while(1) {
+#ifdef XMPP_DEBUG
 		printf("Processing step...\n");
+#endif
 		if(!d->srv.processStep()) {
 			int need = d->srv.need;
 			if(need == CoreProtocol::NNotify) {
 				d->notify = d->srv.notify;
+#ifdef XMPP_DEBUG
 				if(d->notify & CoreProtocol::NSend)
 					printf("More data needs to be written to process next step\n");
 				if(d->notify & CoreProtocol::NRecv)
 					printf("More data is needed to process next step\n");
+#endif
 			}
 			else if(need == CoreProtocol::NSASLMechs) {
-				if(!d->sasl) {
-					d->sasl = new QCA::SASL;
-					connect(d->sasl, SIGNAL(authCheck(const QString &, const QString &)), SLOT(sasl_authCheck(const QString &, const QString &)));
-					connect(d->sasl, SIGNAL(nextStep(const QByteArray &)), SLOT(sasl_nextStep(const QByteArray &)));
-					connect(d->sasl, SIGNAL(authenticated()), SLOT(sasl_authenticated()));
-					connect(d->sasl, SIGNAL(error()), SLOT(sasl_error()));
-
-					//d->sasl->setAllowAnonymous(false);
-					//d->sasl->setRequirePassCredentials(true);
-					//d->sasl->setExternalAuthID("localhost");
-					QCA::SASL::AuthFlags auth_flags = (QCA::SASL::AuthFlags) 0;
-					d->sasl->setConstraints(auth_flags,0,256);
-
-					QStringList list;
-					// TODO: d->server is probably wrong here
-					d->sasl->startServer("xmpp", d->server, d->defRealm, QCA::SASL::AllowServerSendLast);
-					d->sasl_mechlist = list;
+				// a shared list spares idle streams a sasl object
+				QStringList mechs = d->ctx.saslMechanisms();
+				if(mechs.isEmpty()) {
+					if(!d->sasl)
+						srvStartSASL();
+					mechs = d->sasl->mechanismList();
 				}
-				d->srv.setSASLMechList(d->sasl_mechlist);
+				d->srv.setSASLMechList(mechs);
 				continue;
 			}
 			else if(need == CoreProtocol::NStartTLS) {
+#ifdef XMPP_DEBUG
 				printf("Need StartTLS\n");
-				//if(!d->tls->startServer()) {
+#endif
+				if(!d->tls)
+					d->tls = d->ctx.createTLS(this);
+				if(!d->tls) {
+					reset();
+					d->errCond = TLSStart;
+					error(ErrTLS);
+					return;
+				}
 				d->tls->startServer();
 				QByteArray a = d->srv.spare;
 				d->ss->startTLSServer(d->tls, a);
 			}
 			else if(need == CoreProtocol::NSASLFirst) {
+#ifdef XMPP_DEBUG
 				printf("Need SASL First Step\n");
+#endif
+				if(!d->sasl)
+					srvStartSASL();
 				QByteArray a = d->srv.saslStep();
 				d->sasl->putServerFirstStep(d->srv.saslMech(), a);
 			}
 			else if(need == CoreProtocol::NSASLNext) {
+#ifdef XMPP_DEBUG
 				printf("Need SASL Next Step\n");
+#endif
 				QByteArray a = d->srv.saslStep();
+#ifdef XMPP_DEBUG
 				printf("[%s]\n", a.data());
+#endif
 				d->sasl->putStep(a);
 			}
 			else if(need == CoreProtocol::NSASLLayer) {
@@ -835,10 +1614,14 @@ void ClientStream::srvProcessNext()
 		d->notify = 0;
 
 		int event = d->srv.event;
+#ifdef XMPP_DEBUG
 		printf("event: %d\n", event);
+#endif
 		switch(event) {
 			case CoreProtocol::EError: {
+#ifdef XMPP_DEBUG
 				printf("Error! Code=%d\n", d->srv.errorCode);
+#endif
 				reset();
 				error(ErrProtocol);
 				//handleError();
@@ -846,20 +1629,17 @@ void ClientStream::srvProcessNext()
 			}
 			case CoreProtocol::ESend: {
 				QByteArray a = d->srv.takeOutgoingData();
+#ifdef XMPP_DEBUG
 				printf("Need Send: {%s}\n", a.data());
+#endif
 				d->ss->write(a);
 				break;
 			}
 			case CoreProtocol::ERecvOpen: {
+#ifdef XMPP_DEBUG
 				printf("Break (RecvOpen)\n");
-
-				// calculate key
-				QByteArray str = QCA::Hash("sha1").hashToString("secret").toUtf8();
-				str = QCA::Hash("sha1").hashToString(str + "im.pyxa.org").toUtf8();
-				str = QCA::Hash("sha1").hashToString(str + d->srv.id.toUtf8()).toUtf8();
-				d->srv.setDialbackKey(str);
-
-				//d->srv.setDialbackKey("3c5d721ea2fcc45b163a11420e4e358f87e3142a");
+#endif
+				d->srv.setDialbackKey(d->ctx.dialbackKey(d->srv.id));
 
 				if(d->srv.to != d->server) {
 					// host-gone, host-unknown, see-other-host
@@ -870,7 +1650,9 @@ void ClientStream::srvProcessNext()
 				break;
 			}
 			case CoreProtocol::ESASLSuccess: {
+#ifdef XMPP_DEBUG
 				printf("Break SASL Success\n");
+#endif
 				disconnect(d->sasl, SIGNAL(error()), this, SLOT(sasl_error()));
 				QByteArray a = d->srv.spare;
 				d->ss->setLayerSASL(d->sasl, a);
@@ -878,7 +1660,9 @@ void ClientStream::srvProcessNext()
 			}
 			case CoreProtocol::EPeerClosed: {
 				// TODO: this isn' an error
+#ifdef XMPP_DEBUG
 				printf("peer closed\n");
+#endif
 				reset();
 				error(ErrProtocol);
 				return;
@@ -896,6 +1680,27 @@ void ClientStream::doReadyRead()
 	//d->in_rrsig = false;
 }
 
+void ClientStream::connectNotify(const char *)
+{
+	updateRecordTransfers();
+}
+
+void ClientStream::disconnectNotify(const char *)
+{
+	updateRecordTransfers();
+}
+
+// the protocol only keeps copies of what went over the wire if someone is
+//   listening for it
+void ClientStream::updateRecordTransfers()
+{
+	if(queueCall("updateRecordTransfers"))
+		return;
+
+	bool want = receivers(SIGNAL(incomingXml(QString))) > 0 || receivers(SIGNAL(outgoingXml(QString))) > 0;
+	d->client.setRecordTransfers(want);
+}
+
 void ClientStream::processNext()
 {
 	if(d->mode == Server) {
@@ -910,7 +1715,8 @@ void ClientStream::processNext()
 		printf("Processing step...\n");
 #endif
 		bool ok = d->client.processStep();
-		// deal with send/received items
+		// deal with send/received items.  the list stays empty unless
+		//   updateRecordTransfers() found a listener.
 		for(QList<XmlProtocol::TransferItem>::ConstIterator it = d->client.transferItemList.begin(); it != d->client.transferItemList.end(); ++it) {
 			const XmlProtocol::TransferItem &i = *it;
 			if(i.isExternal)
@@ -931,13 +1737,44 @@ void ClientStream::processNext()
 		}
 
 		if(!ok) {
+			// the protocol is waiting on a write, so it can't stay corked
+			if(d->client.notify & CoreProtocol::NSend)
+				flushCork();
+
 			bool cont = handleNeed();
 
 			// now we can announce stanzas
 			//if(!d->in_rrsig && !d->in.isEmpty()) {
-			if(!d->in.isEmpty()) {
+			if(d->worker) {
+				// once per batch: readyRead() is queued to the other
+				//   thread, which reads everything there is by then
+				bool post = false;
+				{
+					QMutexLocker locker(&d->inMutex);
+					if(!d->in.isEmpty() && !d->readyPosted) {
+						d->readyPosted = true;
+						post = true;
+					}
+				}
+				if(post)
+					readyRead();
+			}
+			else if(!d->in.isEmpty()) {
 				//d->in_rrsig = true;
-				QTimer::singleShot(0, this, SLOT(doReadyRead()));
+				if(d->immediateDelivery && !d->delivering) {
+					// stanzas written by the receiver can bring us
+					//   back here.  those read meanwhile are for the
+					//   receiver's loop, or else for the next turn
+					d->delivering = true;
+					readyRead();
+					if(!self)
+						return;
+					d->delivering = false;
+					if(!d->in.isEmpty())
+						QTimer::singleShot(0, this, SLOT(doReadyRead()));
+				}
+				else if(!d->immediateDelivery)
+					QTimer::singleShot(0, this, SLOT(doReadyRead()));
 			}
 
 			if(cont)
@@ -960,7 +1797,17 @@ void ClientStream::processNext()
 #ifdef XMPP_DEBUG
 				printf("Need Send: {%s}\n", a.data());
 #endif
-				d->ss->write(a);
+				// only hold data back once the session is up, so that
+				//   negotiation and layer switches see it in order
+				if(d->corkCount > 0 && d->state == Active) {
+					d->corkBuf += a;
+					if(d->corkBuf.size() >= CORK_MAX_BYTES)
+						flushCork();
+				}
+				else {
+					flushCork();
+					d->ss->write(a);
+				}
 				break;
 			}
 			case CoreProtocol::ERecvOpen: {
@@ -993,6 +1840,18 @@ void ClientStream::processNext()
 					warning(WarnNoTLS);
 					return;
 				}
+
+				// wait here for continueFromStandby(), past TLS, and past
+				//   sasl if asked to be
+				if(d->standby) {
+					bool authed = d->client.saslAuthenticated();
+					bool secured = d->using_tls || !d->client.features.tls_supported || !d->tlsHandler;
+					if(d->standbyAuth ? authed : (secured && !authed)) {
+						d->state = Standby;
+						standbyReady();
+						return;
+					}
+				}
 				break;
 			}
 			case CoreProtocol::ESASLSuccess: {
@@ -1005,9 +1864,12 @@ void ClientStream::processNext()
 #ifdef XMPP_DEBUG
 				printf("Done!\n");
 #endif
-				// grab the JID, in case it changed
-				d->jid = d->client.jid();
+				// grab the JID, in case it changed.  a component has
+				//   its domain and no bound jid
+				if(!d->component)
+					d->jid = d->client.jid();
 				d->state = Active;
+				d->smResume = StreamManagementState();
 				setNoopTime(d->noop_time);
 				authenticated();
 				if(!self)
@@ -1026,11 +1888,32 @@ void ClientStream::processNext()
 #ifdef XMPP_DEBUG
 				printf("StanzaReady\n");
 #endif
+				// counted for stream management already, but of no use
+				//   to anyone
+				if(d->client.elementFiltered()) {
+					d->client.recvStanza();
+					++d->stats.stanzasFiltered;
+					break;
+				}
+
 				// store the stanza for now, announce after processing all events
 				Stanza s = createStanza(d->client.recvStanza());
 				if(s.isNull())
 					break;
-				d->in.append(new Stanza(s));
+				bool pause = false;
+				{
+					QMutexLocker locker(&d->inMutex);
+					d->in.append(new Stanza(s));
+					if(d->readHighWater > 0 && !d->readPaused && d->in.count() >= d->readHighWater) {
+						d->readPaused = true;
+						pause = true;
+					}
+				}
+				// what the parser already has is still handled, but no
+				//   more is read from the socket
+				if(pause && d->ss)
+					d->ss->setReadEnabled(false);
+				++d->stats.stanzasIn;
 				break;
 			}
 			case CoreProtocol::EStanzaSent: {
@@ -1082,7 +1965,7 @@ bool ClientStream::handleNeed()
 #ifdef XMPP_DEBUG
 			printf("Need compress\n");
 #endif
-			d->ss->setLayerCompress(d->client.spare);
+			d->ss->setLayerCompress(d->client.spare, d->compressFlush == CompressFlushBatched, d->compressFlushBytes, d->compressLevel, d->compressWindowBits, d->compressAdaptive);
 			return true;
 		}
 		case CoreProtocol::NSASLFirst: {
@@ -1204,6 +2087,18 @@ void ClientStream::doNoop()
 
 void ClientStream::writeDirect(const QString &s)
 {
+	// queued along with the stanzas, to keep the order
+	if(d->worker && QThread::currentThread() != thread()) {
+		Private::QueuedWrite w;
+		w.prio = PriorityControl;
+		w.str = s;
+		QMutexLocker locker(&d->inMutex);
+		d->queued += w;
+		if(d->queued.count() == 1)
+			QMetaObject::invokeMethod(this, "flushQueuedWrites", Qt::QueuedConnection);
+		return;
+	}
+
 	if(d->state == Active) {
 #ifdef XMPP_DEBUG
 		printf("writeDirect\n");
@@ -1245,7 +2140,7 @@ void ClientStream::handleError()
 			case CoreProtocol::InvalidId: { break; } // should NOT happen (clients don't specify id)
 			case CoreProtocol::InvalidNamespace: { break; } // should NOT happen (we set the right ns)
 			case CoreProtocol::InvalidXml: { strErr = InvalidXml; break; } // shouldn't happen either, but just in case ...
-			case CoreProtocol::StreamNotAuthorized: { break; } // should NOT happen (we're not stupid)
+			case CoreProtocol::StreamNotAuthorized: { break; } // should NOT happen (we're not stupid), unless it is a component handshake
 			case CoreProtocol::PolicyViolation: { strErr = PolicyViolation; break; }
 			case CoreProtocol::RemoteConnectionFailed: { connErr = RemoteConnectionFailed; break; }
 			case CoreProtocol::ResourceConstraint: { strErr = ResourceConstraint; break; }
@@ -1264,7 +2159,12 @@ void ClientStream::handleError()
 
 		d->errText = text;
 		d->errAppSpec = appSpec;
-		if(connErr != -1) {
+		// a component's secret is refused with a stream error
+		if(d->component && x == CoreProtocol::StreamNotAuthorized) {
+			d->errCond = NotAuthorized;
+			error(ErrAuth);
+		}
+		else if(connErr != -1) {
 			d->errCond = connErr;
 			error(ErrNeg);
 		}
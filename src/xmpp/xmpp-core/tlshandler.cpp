@@ -21,8 +21,18 @@
 #include "xmpp.h"
 
 #include <qtimer.h>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
 #include "qca.h"
 
+// sessions kept at most, across all hosts
+#define TLS_SESSION_CACHE_MAX 64
+
+// verified chains kept at most, and for how long (secs) at most
+#define TLS_CERT_CACHE_MAX 64
+#define TLS_CERT_CACHE_TTL 3600
+
 using namespace XMPP;
 
 // FIXME: remove this code once qca cert host checking works ...
@@ -317,6 +327,44 @@ TLSHandler::~TLSHandler()
 //----------------------------------------------------------------------------
 // QCATLSHandler
 //----------------------------------------------------------------------------
+class TLSSessionCache
+{
+public:
+	QMutex m;
+	bool enabled;
+	QHash<QString, QCA::TLSSession> sessions;
+	int hits, misses;
+
+	TLSSessionCache() : enabled(false), hits(0), misses(0)
+	{
+	}
+};
+
+Q_GLOBAL_STATIC(TLSSessionCache, tlssessioncache)
+
+class TLSCertCache
+{
+public:
+	class Entry
+	{
+	public:
+		QCA::Validity validity;
+		QCA::TLS::IdentityResult result;
+		QDateTime expires; // utc
+	};
+
+	QMutex m;
+	bool enabled;
+	QHash<QByteArray, Entry> entries;
+	int hits, misses;
+
+	TLSCertCache() : enabled(false), hits(0), misses(0)
+	{
+	}
+};
+
+Q_GLOBAL_STATIC(TLSCertCache, tlscertcache)
+
 class QCATLSHandler::Private
 {
 public:
@@ -324,6 +372,8 @@ public:
 	int state, err;
 	QString host;
 	bool internalHostMatch;
+	QString sessionKey; // set while the session cache is in use
+	bool sessionOffered;
 };
 
 QCATLSHandler::QCATLSHandler(QCA::TLS *parent)
@@ -339,6 +389,7 @@ QCATLSHandler::QCATLSHandler(QCA::TLS *parent)
 	d->state = 0;
 	d->err = -1;
 	d->internalHostMatch = false;
+	d->sessionOffered = false;
 }
 
 QCATLSHandler::~QCATLSHandler()
@@ -389,11 +440,191 @@ void QCATLSHandler::reset()
 	d->state = 0;
 }
 
+void QCATLSHandler::setSessionCacheEnabled(bool b)
+{
+	TLSSessionCache *c = tlssessioncache();
+	QMutexLocker locker(&c->m);
+	c->enabled = b;
+	if(!b)
+		c->sessions.clear();
+}
+
+bool QCATLSHandler::isSessionCacheEnabled()
+{
+	TLSSessionCache *c = tlssessioncache();
+	QMutexLocker locker(&c->m);
+	return c->enabled;
+}
+
+void QCATLSHandler::clearSessionCache()
+{
+	TLSSessionCache *c = tlssessioncache();
+	QMutexLocker locker(&c->m);
+	c->sessions.clear();
+	c->hits = 0;
+	c->misses = 0;
+}
+
+int QCATLSHandler::sessionCacheHits()
+{
+	TLSSessionCache *c = tlssessioncache();
+	QMutexLocker locker(&c->m);
+	return c->hits;
+}
+
+int QCATLSHandler::sessionCacheMisses()
+{
+	TLSSessionCache *c = tlssessioncache();
+	QMutexLocker locker(&c->m);
+	return c->misses;
+}
+
+QCA::TLS::IdentityResult QCATLSHandler::verifyPeer(QCA::Validity *validity)
+{
+	QCA::CertificateChain chain = d->tls->peerCertificateChain();
+	if(chain.isEmpty()) {
+		if(validity)
+			*validity = QCA::ErrorValidityUnknown;
+		return QCA::TLS::NoCertificate;
+	}
+
+	QCA::CertificateCollection trusted = d->tls->trustedCertificates();
+
+	// the whole leaf rather than a digest of it, so no hash algorithm
+	//   is needed.  the size of the trusted set stands in for its
+	//   contents, so that changing it doesn't reuse old results
+	QByteArray key = chain.primary().toDER();
+	key += '\0';
+	key += d->host.toLower().toUtf8();
+	key += '\0';
+	key += QByteArray::number(trusted.certificates().count());
+	key += ',';
+	key += QByteArray::number(trusted.crls().count());
+	key += ',';
+	key += d->internalHostMatch ? '1' : '0';
+
+	TLSCertCache *c = tlscertcache();
+	{
+		QMutexLocker locker(&c->m);
+		if(c->enabled) {
+			QHash<QByteArray, TLSCertCache::Entry>::Iterator it = c->entries.find(key);
+			if(it != c->entries.end()) {
+				if(it.value().expires > QDateTime::currentDateTime().toUTC()) {
+					++c->hits;
+					if(validity)
+						*validity = it.value().validity;
+					return it.value().result;
+				}
+				c->entries.erase(it);
+			}
+			++c->misses;
+		}
+	}
+
+	QCA::Validity v = chain.validate(trusted, trusted.crls(), QCA::UsageTLSServer, QCA::ValidateAll);
+
+	QCA::TLS::IdentityResult result;
+	if(v != QCA::ValidityGood)
+		result = QCA::TLS::InvalidCertificate;
+	else if(d->internalHostMatch && !certMatchesHostname())
+		result = QCA::TLS::HostMismatch;
+	else
+		result = QCA::TLS::Valid;
+
+	if(validity)
+		*validity = v;
+
+	// good until anything it relied on runs out
+	QDateTime now = QDateTime::currentDateTime().toUTC();
+	QDateTime expires = now.addSecs(TLS_CERT_CACHE_TTL);
+	foreach(const QCA::Certificate &cert, chain) {
+		QDateTime t = cert.notValidAfter().toUTC();
+		if(t < expires)
+			expires = t;
+	}
+	foreach(const QCA::CRL &crl, trusted.crls()) {
+		QDateTime t = crl.nextUpdate().toUTC();
+		if(t.isValid() && t < expires)
+			expires = t;
+	}
+
+	{
+		QMutexLocker locker(&c->m);
+		if(c->enabled && expires > now) {
+			if(!c->entries.contains(key) && c->entries.count() >= TLS_CERT_CACHE_MAX)
+				c->entries.erase(c->entries.begin());
+
+			TLSCertCache::Entry e;
+			e.validity = v;
+			e.result = result;
+			e.expires = expires;
+			c->entries.insert(key, e);
+		}
+	}
+
+	return result;
+}
+
+void QCATLSHandler::setCertCacheEnabled(bool b)
+{
+	TLSCertCache *c = tlscertcache();
+	QMutexLocker locker(&c->m);
+	c->enabled = b;
+	if(!b)
+		c->entries.clear();
+}
+
+bool QCATLSHandler::isCertCacheEnabled()
+{
+	TLSCertCache *c = tlscertcache();
+	QMutexLocker locker(&c->m);
+	return c->enabled;
+}
+
+void QCATLSHandler::clearCertCache()
+{
+	TLSCertCache *c = tlscertcache();
+	QMutexLocker locker(&c->m);
+	c->entries.clear();
+	c->hits = 0;
+	c->misses = 0;
+}
+
+int QCATLSHandler::certCacheHits()
+{
+	TLSCertCache *c = tlscertcache();
+	QMutexLocker locker(&c->m);
+	return c->hits;
+}
+
+int QCATLSHandler::certCacheMisses()
+{
+	TLSCertCache *c = tlscertcache();
+	QMutexLocker locker(&c->m);
+	return c->misses;
+}
+
 void QCATLSHandler::startClient(const QString &host)
 {
 	d->state = 0;
 	d->err = -1;
 	if (d->internalHostMatch) d->host = host;
+
+	d->sessionKey = QString();
+	d->sessionOffered = false;
+	{
+		TLSSessionCache *c = tlssessioncache();
+		QMutexLocker locker(&c->m);
+		if(c->enabled && !host.isEmpty()) {
+			d->sessionKey = host.toLower();
+			QHash<QString, QCA::TLSSession>::ConstIterator it = c->sessions.find(d->sessionKey);
+			if(it != c->sessions.end()) {
+				d->tls->setSession(it.value());
+				d->sessionOffered = true;
+			}
+		}
+	}
+
 	d->tls->startClient(d->internalHostMatch ? QString() : host);
 }
 
@@ -419,6 +650,24 @@ void QCATLSHandler::continueAfterHandshake()
 void QCATLSHandler::tls_handshaken()
 {
 	d->state = 2;
+
+	if(!d->sessionKey.isEmpty()) {
+		bool reused = d->tls->isSessionReused();
+		QCA::TLSSession s = d->tls->session();
+
+		TLSSessionCache *c = tlssessioncache();
+		QMutexLocker locker(&c->m);
+		if(reused)
+			++c->hits;
+		else
+			++c->misses;
+		if(c->enabled && !s.isNull()) {
+			if(!c->sessions.contains(d->sessionKey) && c->sessions.count() >= TLS_SESSION_CACHE_MAX)
+				c->sessions.erase(c->sessions.begin());
+			c->sessions.insert(d->sessionKey, s);
+		}
+	}
+
 	tlsHandshaken();
 }
 
@@ -441,6 +690,13 @@ void QCATLSHandler::tls_closed()
 
 void QCATLSHandler::tls_error()
 {
+	// don't offer a session that may have been the problem again
+	if(d->sessionOffered) {
+		TLSSessionCache *c = tlssessioncache();
+		QMutexLocker locker(&c->m);
+		c->sessions.remove(d->sessionKey);
+	}
+
 	d->err = d->tls->errorCode();
 	d->state = 0;
 	fail();
@@ -0,0 +1,151 @@
+/*
+ * xmlatoms.cpp - shared copies of well-known XML names
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmlatoms.h"
+
+#include <string.h>
+
+XmlAtoms::XmlAtoms()
+{
+	add(&addressNS, "http://jabber.org/protocol/address");
+	add(&chatStatesNS, "http://jabber.org/protocol/chatstates");
+	add(&delayNS, "urn:xmpp:delay");
+	add(&httpAuthNS, "http://jabber.org/protocol/http-auth");
+	add(&mucUserNS, "http://jabber.org/protocol/muc#user");
+	add(&nickNS, "http://jabber.org/protocol/nick");
+	add(&pubsubEventNS, "http://jabber.org/protocol/pubsub#event");
+	add(&receiptsNS, "urn:xmpp:receipts");
+	add(&rosterxNS, "http://jabber.org/protocol/rosterx");
+	add(&sxeNS, "http://jabber.org/protocol/sxe");
+	add(&xhtmlNS, "http://www.w3.org/1999/xhtml");
+	add(&xhtmlImNS, "http://jabber.org/protocol/xhtml-im");
+	add(&xConferenceNS, "jabber:x:conference");
+	add(&xDataNS, "jabber:x:data");
+	add(&xDelayNS, "jabber:x:delay");
+	add(&xEncryptedNS, "jabber:x:encrypted");
+	add(&xEventNS, "jabber:x:event");
+	add(&xOobNS, "jabber:x:oob");
+	add(&clientNS, "jabber:client");
+	add(&serverNS, "jabber:server");
+	add(&stanzasNS, "urn:ietf:params:xml:ns:xmpp-stanzas");
+	add(&rosterNS, "jabber:iq:roster");
+	add(&versionNS, "jabber:iq:version");
+	add(&discoInfoNS, "http://jabber.org/protocol/disco#info");
+	add(&discoItemsNS, "http://jabber.org/protocol/disco#items");
+	add(&pingNS, "urn:xmpp:ping");
+
+	add(&active, "active");
+	add(&addresses, "addresses");
+	add(&body, "body");
+	add(&composing, "composing");
+	add(&confirm, "confirm");
+	add(&delay, "delay");
+	add(&event, "event");
+	add(&gone, "gone");
+	add(&html, "html");
+	add(&inactive, "inactive");
+	add(&nick, "nick");
+	add(&paused, "paused");
+	add(&priority, "priority");
+	add(&received, "received");
+	add(&request, "request");
+	add(&show, "show");
+	add(&status, "status");
+	add(&sxe, "sxe");
+	add(&x, "x");
+	add(&iq, "iq");
+	add(&message, "message");
+	add(&presence, "presence");
+	add(&query, "query");
+	add(&item, "item");
+	add(&error, "error");
+	add(&id, "id");
+	add(&type, "type");
+	add(&from, "from");
+	add(&to, "to");
+	add(&xmlns, "xmlns");
+	add(&code, "code");
+	add(&jid, "jid");
+	add(&node, "node");
+	add(&ver, "ver");
+
+	add(&getType, "get");
+	add(&setType, "set");
+	add(&resultType, "result");
+	add(&unavailableType, "unavailable");
+	add(&chatType, "chat");
+	add(&groupchatType, "groupchat");
+}
+
+const XmlAtoms & XmlAtoms::get()
+{
+	static XmlAtoms atoms;
+	return atoms;
+}
+
+QString XmlAtoms::intern(const QString &s) const
+{
+	int at = find(s.unicode(), s.length());
+	return at != -1 ? table[at] : s;
+}
+
+QString XmlAtoms::intern(const QStringRef &s) const
+{
+	int at = find(s.unicode(), s.length());
+	return at != -1 ? table[at] : s.toString();
+}
+
+void XmlAtoms::add(QString *atom, const char *str)
+{
+	*atom = QString::fromLatin1(str);
+	uint h = hashChars(atom->unicode(), atom->length());
+	for(uint n = 0; n < TableSize; ++n) {
+		QString &slot = table[(h + n) % TableSize];
+		if(slot.isNull()) {
+			slot = *atom;
+			return;
+		}
+	}
+	Q_ASSERT(false);
+}
+
+int XmlAtoms::find(const QChar *p, int len) const
+{
+	// names in the table are all short
+	if(len == 0 || len > 64)
+		return -1;
+	uint h = hashChars(p, len);
+	for(uint n = 0; n < TableSize; ++n) {
+		int at = (h + n) % TableSize;
+		const QString &slot = table[at];
+		if(slot.isNull())
+			return -1;
+		if(slot.length() == len && memcmp(slot.unicode(), p, len * sizeof(QChar)) == 0)
+			return at;
+	}
+	return -1;
+}
+
+uint XmlAtoms::hashChars(const QChar *p, int len)
+{
+	uint h = len;
+	for(int n = 0; n < len; ++n)
+		h = h * 31 + p[n].unicode();
+	return h;
+}
@@ -0,0 +1,69 @@
+/*
+ * xmlatoms.h - shared copies of well-known XML names
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMLATOMS_H
+#define XMLATOMS_H
+
+#include <QString>
+#include <QStringRef>
+
+// shared copies of the names that stanza parsers look for, so that a
+//   lookup doesn't build a QString out of a literal every time.  the
+//   parser puts these in the elements it builds in place of equal names
+//   and values it reads, and QString compares shared data by pointer
+//   before it compares characters, so most checks against an atom end
+//   there.
+class XmlAtoms
+{
+public:
+	static const XmlAtoms & get();
+
+	// the atom equal to s, or s itself
+	QString intern(const QString &s) const;
+	// the same, without making a string when there is an atom
+	QString intern(const QStringRef &s) const;
+
+	// namespaces
+	QString addressNS, chatStatesNS, delayNS, httpAuthNS, mucUserNS, nickNS;
+	QString pubsubEventNS, receiptsNS, rosterxNS, sxeNS, xhtmlNS, xhtmlImNS;
+	QString xConferenceNS, xDataNS, xDelayNS, xEncryptedNS, xEventNS, xOobNS;
+	QString clientNS, serverNS, stanzasNS, rosterNS, versionNS, discoInfoNS, discoItemsNS, pingNS;
+
+	// names
+	QString active, addresses, body, composing, confirm, delay, event, gone;
+	QString html, inactive, nick, paused, priority, received, request;
+	QString show, status, sxe, x;
+	QString iq, message, presence, query, item, error;
+	QString id, type, from, to, xmlns, code, jid, node, ver;
+
+	// attribute values
+	QString getType, setType, resultType, unavailableType, chatType, groupchatType;
+
+private:
+	// open addressing over the atoms, by hashChars()
+	enum { TableSize = 256 };
+	QString table[TableSize];
+
+	XmlAtoms();
+	void add(QString *atom, const char *str);
+	int find(const QChar *p, int len) const;
+	static uint hashChars(const QChar *p, int len);
+};
+
+#endif
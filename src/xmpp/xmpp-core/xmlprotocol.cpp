@@ -21,10 +21,12 @@
 #include "xmlprotocol.h"
 
 #include "bytestream.h"
+#include "iristrace.h"
 //Added by qt3to4:
 #include <QList>
 #include <QTextStream>
 #include <QByteArray>
+#include <QMap>
 #include <QApplication>
 
 using namespace XMPP;
@@ -167,6 +169,19 @@ static inline bool highSurrogate(const quint32 ch)
 }
 
 
+// true for the characters sanitizeForStream has to look at: markup, quotes,
+//  controls and everything from the surrogates up.  anything else is copied
+//  through, which is almost all of a stanza
+static inline bool sanitizeStop(const ushort c)
+{
+	if(c < 0x40) {
+		if(c < 0x20)
+			return c != 0x9 && c != 0xA && c != 0xD;
+		return c == '<' || c == '>' || c == '"' || c == '\'';
+	}
+	return c >= 0xD800;
+}
+
 // force encoding of '>'.  this function is needed for XMPP-Core, which
 //  requires the '>' character to be encoded as "&gt;" even though this is
 //  not required by the XML spec.
@@ -174,27 +189,33 @@ static inline bool highSurrogate(const quint32 ch)
 //  and invalid surrogate pairs
 static QString sanitizeForStream(const QString &in)
 {
+	const QChar *p = in.unicode();
+	int inlength = in.length();
 	QString out;
+	bool changed = false;
+	int start = 0; // first char not yet copied to out
 	bool intag = false;
 	bool inquote = false;
-	QChar quotechar;
-	int inlength = in.length();
+	ushort quotechar = 0;
 	for(int n = 0; n < inlength; ++n)
 	{
-		QChar c = in[n];
+		ushort c = p[n].unicode();
+		if(!sanitizeStop(c))
+			continue;
+
 		bool escape = false;
 		if(c == '<')
 		{
 			intag = true;
+			continue;
 		}
 		else if(c == '>')
 		{
-			if(inquote) {
-				escape = true;
-			} else if(!intag) {
+			if(inquote || !intag) {
 				escape = true;
 			} else {
 				intag = false;
+				continue;
 			}
 		}
 		else if(c == '\'' || c == '\"')
@@ -206,38 +227,258 @@ static QString sanitizeForStream(const QString &in)
 					inquote = true;
 					quotechar = c;
 				}
-				else
+				else if(quotechar == c)
 				{
-					if(quotechar == c) {
-						inquote = false;
-					}
+					inquote = false;
 				}
 			}
+			continue;
+		}
+		// don't silently drop invalid chars in element or attribute names,
+		// because that's something that should not happen.
+		else if((intag && !inquote) || validChar(c))
+		{
+			continue;
+		}
+		else if(highSurrogate(c) && (n+1 < inlength) && lowSurrogate(p[n+1].unicode()))
+		{
+			// we don't need to recheck this, because 0x10000 <= unicode <= 0x100000 is always true
+			++n;
+			continue;
+		}
+		else
+		{
+			qDebug("Dropping invalid XML char U+%04x",c);
 		}
 
-		if(escape) {
+		// escaped or dropped: copy the clean span before it in one go
+		if(!changed) {
+			out.reserve(inlength + 16);
+			changed = true;
+		}
+		out += QString::fromRawData(p + start, n - start);
+		if(escape)
 			out += "&gt;";
-		 } else {
-			// don't silently drop invalid chars in element or attribute names,
-			// because that's something that should not happen.
-			if (intag && (!inquote)) {
-				out += c;
-			} else if (validChar(c.unicode()))  {
-				out += c;
-			} else if (highSurrogate(c.unicode()) && (n+1 < inlength) && lowSurrogate(in[n+1].unicode())) {
-				//uint unicode = (c.unicode() & 0x3FF) << 10 | in[n+1].unicode() & 0x3FF + 0x10000;
-				// we don't need to recheck this, because 0x10000 <= unicode <= 0x100000 is always true
-				out += c;
-				out += in[n+1];
-				++n;
-			} else {
-				qDebug("Dropping invalid XML char U+%04x",c.unicode());
+		start = n + 1;
+	}
+
+	// nothing to change, share the input
+	if(!changed)
+		return in;
+	out += QString::fromRawData(p + start, inlength - start);
+	return out;
+}
+
+
+// appendUtf8
+//
+// Appends 'in' to 'out' as UTF-8, escaping markup as required by XMPP-Core
+// (including '>') and dropping characters that are not allowed in XML, the
+// same way sanitizeForStream does.  Attribute values additionally get quotes
+// and whitespace escaped, like QDom does.
+static void appendUtf8(QByteArray *out, const QString &in, bool attr)
+{
+	const QChar *p = in.unicode();
+	int len = in.length();
+	for(int n = 0; n < len; ++n) {
+		ushort c = p[n].unicode();
+		if(c < 0x80) {
+			switch(c) {
+				case '<': out->append("&lt;"); continue;
+				case '>': out->append("&gt;"); continue;
+				case '&': out->append("&amp;"); continue;
+				case '"':
+					if(attr) {
+						out->append("&quot;");
+						continue;
+					}
+					break;
+				case '\n':
+					if(attr) {
+						out->append("&#xa;");
+						continue;
+					}
+					break;
+				case '\r':
+					if(attr) {
+						out->append("&#xd;");
+						continue;
+					}
+					break;
+				case '\t':
+					if(attr) {
+						out->append("&#x9;");
+						continue;
+					}
+					break;
+				default:
+					break;
+			}
+			if(!validChar(c)) {
+				qDebug("Dropping invalid XML char U+%04x", c);
+				continue;
+			}
+			out->append((char)c);
+		}
+		else if(c < 0x800) {
+			out->append((char)(0xc0 | (c >> 6)));
+			out->append((char)(0x80 | (c & 0x3f)));
+		}
+		else if(highSurrogate(c) && n + 1 < len && lowSurrogate(p[n+1].unicode())) {
+			uint u = 0x10000 + (((uint)c & 0x3ff) << 10) + (p[n+1].unicode() & 0x3ff);
+			++n;
+			out->append((char)(0xf0 | (u >> 18)));
+			out->append((char)(0x80 | ((u >> 12) & 0x3f)));
+			out->append((char)(0x80 | ((u >> 6) & 0x3f)));
+			out->append((char)(0x80 | (u & 0x3f)));
+		}
+		else if(!validChar(c)) {
+			qDebug("Dropping invalid XML char U+%04x", c);
+		}
+		else {
+			out->append((char)(0xe0 | (c >> 12)));
+			out->append((char)(0x80 | ((c >> 6) & 0x3f)));
+			out->append((char)(0x80 | (c & 0x3f)));
+		}
+	}
+}
+
+static void appendNSDecl(QByteArray *out, const QString &prefix, const QString &uri)
+{
+	out->append(" xmlns");
+	if(!prefix.isEmpty()) {
+		out->append(':');
+		out->append(prefix.toUtf8());
+	}
+	out->append("=\"");
+	appendUtf8(out, uri, true);
+	out->append('"');
+}
+
+// writeElementUtf8
+//
+// Serializes 'e' straight into 'out', without cloning the element or going
+// through QTextStream.  'defns' and 'prefixes' describe the namespaces in
+// scope at the parent, so that only necessary xmlns declarations get
+// written, as with stripExtraNS.
+static void writeElementUtf8(QByteArray *out, const QDomElement &e, QString defns, QMap<QString,QString> prefixes)
+{
+	QString ns = e.namespaceURI();
+	QString prefix = e.prefix();
+	QDomNamedNodeMap al = e.attributes();
+	int x;
+
+	out->append('<');
+	int nameStart = out->size();
+	if(!ns.isNull() && !prefix.isEmpty()) {
+		out->append(prefix.toUtf8());
+		out->append(':');
+		out->append(e.localName().toUtf8());
+	}
+	else if(!ns.isNull())
+		out->append(e.localName().toUtf8());
+	else
+		out->append(e.tagName().toUtf8());
+	QByteArray name = out->mid(nameStart);
+
+	// namespace of the element itself
+	if(!ns.isNull()) {
+		if(prefix.isEmpty()) {
+			if(ns != defns) {
+				appendNSDecl(out, QString(), ns);
+				defns = ns;
 			}
 		}
+		else if(prefixes.value(prefix) != ns) {
+			appendNSDecl(out, prefix, ns);
+			prefixes.insert(prefix, ns);
+		}
 	}
-	return out;
+
+	for(x = 0; x < al.count(); ++x) {
+		QDomAttr a = al.item(x).toAttr();
+		QString ans = a.namespaceURI();
+		QString aname;
+		if(ans == NS_XML)
+			aname = QString("xml:") + a.localName();
+		else if(!ans.isEmpty()) {
+			QString apre = a.prefix();
+			if(apre.isEmpty())
+				apre = "ns";
+			if(prefixes.value(apre) != ans) {
+				appendNSDecl(out, apre, ans);
+				prefixes.insert(apre, ans);
+			}
+			aname = apre + ':' + a.localName();
+		}
+		else {
+			aname = a.name();
+
+			// old-style namespace attributes
+			if(aname == "xmlns") {
+				if(!ns.isNull())
+					continue;
+				if(a.value() == defns)
+					continue;
+				defns = a.value();
+			}
+			else if(aname.startsWith("xmlns:")) {
+				QString apre = aname.mid(6);
+				if(prefixes.value(apre) == a.value())
+					continue;
+				prefixes.insert(apre, a.value());
+			}
+		}
+		out->append(' ');
+		out->append(aname.toUtf8());
+		out->append("=\"");
+		appendUtf8(out, a.value(), true);
+		out->append('"');
+	}
+
+	QDomNode n = e.firstChild();
+	if(n.isNull()) {
+		out->append("/>");
+		return;
+	}
+	out->append('>');
+	for(; !n.isNull(); n = n.nextSibling()) {
+		if(n.isElement())
+			writeElementUtf8(out, n.toElement(), defns, prefixes);
+		else if(n.isText())
+			appendUtf8(out, n.toText().data(), false);
+	}
+	out->append("</");
+	out->append(name);
+	out->append('>');
 }
 
+// the namespaces a root element puts in scope for its children
+static void rootNamespaces(const QDomElement &root, QString *defns, QMap<QString,QString> *prefixes)
+{
+	*defns = QString();
+	prefixes->clear();
+	if(!root.prefix().isEmpty())
+		prefixes->insert(root.prefix(), root.namespaceURI());
+	else
+		*defns = root.namespaceURI();
+	QDomNamedNodeMap al = root.attributes();
+	for(int n = 0; n < al.count(); ++n) {
+		QDomAttr a = al.item(n).toAttr();
+		QString s = a.name();
+		if(s == "xmlns")
+			*defns = a.value();
+		else if(s.startsWith("xmlns:"))
+			prefixes->insert(s.mid(6), a.value());
+	}
+}
+
+static QString rootQName(const QDomElement &root)
+{
+	if(!root.prefix().isEmpty())
+		return root.prefix() + ':' + root.localName();
+	return root.tagName();
+}
 
 //----------------------------------------------------------------------------
 // Protocol
@@ -265,6 +506,12 @@ XmlProtocol::TransferItem::TransferItem(const QDomElement &_elem, bool sent, boo
 XmlProtocol::XmlProtocol()
 	: QObject(qApp)
 {
+	recording = false;
+	sharedDoc = false;
+	framingMode = StreamFraming;
+	parseUsecs = 0;
+	elemFiltered = false;
+	resetTracking();
 	init();
 }
 
@@ -284,53 +531,137 @@ void XmlProtocol::reset()
 	init();
 
 	elem = QDomElement();
-	elemDoc = QDomDocument();
+	elemDefaultNS = QString();
+	elemPrefixes.clear();
+	if(!sharedDoc)
+		elemDoc = QDomDocument();
 	tagOpen = QString();
 	tagClose = QString();
 	xml.reset();
+	framed.reset();
+	parseUsecs = 0;
+	elemFiltered = false;
 	outData.resize(0);
-	trackQueue.clear();
+	resetTracking();
 	transferItemList.clear();
 }
 
 void XmlProtocol::addIncomingData(const QByteArray &a)
 {
-	xml.appendData(a);
+	// some backends parse here rather than in readNext()
+	StatisticsTimer t;
+	t.start();
+	if(framingMode == WebSocketFraming)
+		addFramedData(a);
+	else
+		xml.appendData(a);
+	parseUsecs += t.usecsElapsed();
+}
+
+// the parser wants one document, so give it back the root element in
+//   place of <open/> and <close/>.  anything else, including what
+//   resetStream() hands back to be fed in again, goes through as it is.
+void XmlProtocol::addFramedData(const QByteArray &a)
+{
+	QList<XmlSplitter::Piece> list = framed.append(a);
+	foreach(const XmlSplitter::Piece &i, list) {
+		QByteArray name = XmlSplitter::tagName(i.data);
+		bool framing = (i.type == XmlSplitter::Element && (name == "open" || name == "close") && XmlSplitter::attribute(i.data, "xmlns") == NS_FRAMING);
+		if(!framing) {
+			xml.appendData(i.data);
+			continue;
+		}
+
+		// not cached, the root may still change before ours is sent
+		QDomElement root = docElement();
+		QByteArray qn = rootQName(root).toUtf8();
+		if(name == "close") {
+			xml.appendData("</" + qn + '>');
+			continue;
+		}
+
+		QString defns;
+		QMap<QString,QString> prefixes;
+		rootNamespaces(root, &defns, &prefixes);
+		QByteArray s = "<?xml version=\"1.0\"?><" + qn;
+		if(!defns.isEmpty())
+			appendNSDecl(&s, QString(), defns);
+		for(QMap<QString,QString>::ConstIterator it = prefixes.begin(); it != prefixes.end(); ++it)
+			appendNSDecl(&s, it.key(), it.value());
+		QList< QPair<QByteArray,QByteArray> > attrs = XmlSplitter::attributes(i.data);
+		for(int n = 0; n < attrs.count(); ++n) {
+			const QByteArray &aname = attrs[n].first;
+			if(aname == "xmlns" || aname.startsWith("xmlns:"))
+				continue;
+			// still escaped, so only the quote needs care
+			char q = attrs[n].second.contains('"') ? '\'' : '"';
+			s += ' ' + aname + '=' + q + attrs[n].second + q;
+		}
+		s += '>';
+		xml.appendData(s);
+	}
 }
 
 QByteArray XmlProtocol::takeOutgoingData()
 {
-	QByteArray a = outData;
-	outData.resize(0);
+	// hand the buffer over as it is, the next write starts a new one
+	QByteArray a;
+	qSwap(a, outData);
 	return a;
 }
 
 void XmlProtocol::outgoingDataWritten(int bytes)
 {
-	for(QList<TrackItem>::Iterator it = trackQueue.begin(); it != trackQueue.end();) {
-		TrackItem &i = *it;
+	// bytes beyond what is queued belong to data from before a reset
+	trackWritten = qMin(trackWritten + bytes, trackQueued);
 
-		// enough bytes?
-		if(bytes < i.size) {
-			i.size -= bytes;
-			break;
-		}
-		int type = i.type;
-		int id = i.id;
-		int size = i.size;
-		bytes -= i.size;
-		it = trackQueue.erase(it);
+	// each finished item is visited once, as it may need reporting.
+	//   the condition is checked before every item, since itemWritten()
+	//   may write more (or even be acknowledged) before returning
+	while(trackHead < trackQueue.count() && trackQueue[trackHead].end <= trackWritten) {
+		TrackItem i = trackQueue[trackHead++];
 
-		if(type == TrackItem::Raw) {
+		if(i.type == TrackItem::Raw) {
 			// do nothing
 		}
-		else if(type == TrackItem::Close) {
+		else if(i.type == TrackItem::Close) {
 			closeWritten = true;
 		}
-		else if(type == TrackItem::Custom) {
-			itemWritten(id, size);
+		else if(i.type == TrackItem::Custom) {
+			itemWritten(i.id, i.size);
 		}
 	}
+
+	// drop the finished items once they are the larger part, which
+	//   keeps the cost of the move constant per item
+	if(trackHead == trackQueue.count()) {
+		trackQueue.resize(0);
+		trackHead = 0;
+	}
+	else if(trackHead >= 32 && trackHead * 2 >= trackQueue.count()) {
+		trackQueue.remove(0, trackHead);
+		trackHead = 0;
+	}
+}
+
+void XmlProtocol::addTrackItem(TrackItem::Type t, int id, int size)
+{
+	trackQueued += size;
+
+	TrackItem i;
+	i.type = t;
+	i.id = id;
+	i.size = size;
+	i.end = trackQueued;
+	trackQueue += i;
+}
+
+void XmlProtocol::resetTracking()
+{
+	trackQueue.resize(0);
+	trackHead = 0;
+	trackWritten = 0;
+	trackQueued = 0;
 }
 
 bool XmlProtocol::processStep()
@@ -341,18 +672,25 @@ bool XmlProtocol::processStep()
 
 	if(state != Closing && (state == RecvOpen || stepAdvancesParser())) {
 		// if we get here, then it's because we're in some step that advances the parser
+		StatisticsTimer t;
+		t.start();
+		IRIS_TRACEPOINT1(xml_parse_begin, this);
 		pe = xml.readNext();
+		IRIS_TRACEPOINT2(xml_parse_end, this, pe.isNull() ? -1 : (int)pe.type());
+		parseUsecs += t.usecsElapsed();
 		if(!pe.isNull()) {
 			// note: error/close events should be handled for ALL steps, so do them here
 			switch(pe.type()) {
 				case Parser::Event::DocumentOpen: {
-					transferItemList += TransferItem(pe.actualString(), false);
+					if(recording)
+						transferItemList += TransferItem(pe.actualString(), false);
 
 					//stringRecv(pe.actualString());
 					break;
 				}
 				case Parser::Event::DocumentClose: {
-					transferItemList += TransferItem(pe.actualString(), false);
+					if(recording)
+						transferItemList += TransferItem(pe.actualString(), false);
 
 					//stringRecv(pe.actualString());
 					if(incoming) {
@@ -367,17 +705,25 @@ bool XmlProtocol::processStep()
 					return true;
 				}
 				case Parser::Event::Element: {
-					QDomElement e = elemDoc.importNode(pe.element(),true).toElement();
-					transferItemList += TransferItem(e, false);
+					parseTime.add(parseUsecs);
+					parseUsecs = 0;
+					elemFiltered = pe.isFiltered();
+
+					if(recording) {
+						QDomElement e = pe.element();
+						if(e.ownerDocument() != elemDoc)
+							e = elemDoc.importNode(e, true).toElement();
+						transferItemList += TransferItem(e, false);
+					}
 
 					//elementRecv(pe.element());
 					break;
 				}
 				case Parser::Event::Error: {
-					if(incoming) {
+					if(incoming || xml.limitExceeded()) {
 						// If we get a parse error during the initial element exchange,
 						// flip immediately into 'open' mode so that we can report an error.
-						if(state == RecvOpen) {
+						if(incoming && state == RecvOpen) {
 							sendTagOpen();
 							state = Open;
 						}
@@ -403,15 +749,63 @@ bool XmlProtocol::processStep()
 	return baseStep(pe);
 }
 
+void XmlProtocol::setParserLimits(int maxStanzaBytes, int maxDepth, int maxAttributes)
+{
+	xml.setLimits(maxStanzaBytes, maxDepth, maxAttributes);
+}
+
+void XmlProtocol::setStanzaFilters(const QList<StanzaFilter> &filters)
+{
+	xml.setFilters(filters);
+}
+
+void XmlProtocol::compact()
+{
+	// emptied buffers keep the capacity of their busiest moment
+	if(outData.isEmpty())
+		outData = QByteArray();
+	if(trackHead == trackQueue.count()) {
+		trackQueue = QVector<TrackItem>();
+		trackHead = 0;
+	}
+	xml.compact();
+}
+
 QString XmlProtocol::xmlEncoding() const
 {
 	return xml.encoding();
 }
 
+void XmlProtocol::ensureRootElement()
+{
+	if(!elem.isNull())
+		return;
+	elem = docElement();
+	if(elem.ownerDocument() != elemDoc)
+		elem = elemDoc.importNode(elem, true).toElement();
+
+	// collect the namespaces that the root element puts in scope for
+	//   the direct writer
+	rootNamespaces(elem, &elemDefaultNS, &elemPrefixes);
+}
+
+void XmlProtocol::setDocument(const QDomDocument &doc)
+{
+	sharedDoc = !doc.isNull();
+	elemDoc = doc;
+	elem = QDomElement();
+	xml.setDocument(doc);
+}
+
+void XmlProtocol::setFraming(Framing f)
+{
+	framingMode = f;
+	framed.reset();
+}
+
 QString XmlProtocol::elementToString(const QDomElement &e, bool clip)
 {
-	if(elem.isNull())
-		elem = elemDoc.importNode(docElement(), true).toElement();
+	ensureRootElement();
 
 	// Determine the appropriate 'fakeNS' to use
 	QString ns;
@@ -467,6 +861,11 @@ void XmlProtocol::itemWritten(int, int)
 	// default does nothing
 }
 
+void XmlProtocol::docOpenSent()
+{
+	// default does nothing
+}
+
 void XmlProtocol::stringSend(const QString &)
 {
 	// default does nothing
@@ -509,7 +908,8 @@ bool XmlProtocol::close()
 
 int XmlProtocol::writeString(const QString &s, int id, bool external)
 {
-	transferItemList += TransferItem(s, true, external);
+	if(recording)
+		transferItemList += TransferItem(s, true, external);
 	return internalWriteString(s, TrackItem::Custom, id);
 }
 
@@ -517,11 +917,67 @@ int XmlProtocol::writeElement(const QDomElement &e, int id, bool external, bool
 {
 	if(e.isNull())
 		return 0;
-	transferItemList += TransferItem(e, true, external);
+	if(recording)
+		transferItemList += TransferItem(e, true, external);
+
+	// serialize directly into the outgoing buffer.  nothing trails the
+	//   element here, so 'clip' has nothing to remove.
+	Q_UNUSED(clip);
+	int oldsize = outData.size();
+	StatisticsTimer t;
+	t.start();
+	IRIS_TRACEPOINT1(xml_serialize_begin, this);
+	appendElement(&outData, e);
+	IRIS_TRACEPOINT2(xml_serialize_end, this, outData.size() - oldsize);
+	serializeTime.add(t.usecsElapsed());
+
+	int size = outData.size() - oldsize;
+	addTrackItem(TrackItem::Custom, id, size);
+	return size;
+}
 
-	//elementSend(e);
-	QString out = sanitizeForStream(elementToString(e, clip));
-	return internalWriteString(out, TrackItem::Custom, id);
+int XmlProtocol::writeData(const QByteArray &a, int id, bool external)
+{
+	if(recording)
+		transferItemList += TransferItem(QString::fromUtf8(a), true, external);
+	return internalWriteData(a, TrackItem::Custom, id);
+}
+
+QByteArray XmlProtocol::elementToUtf8(const QDomElement &e)
+{
+	QByteArray out;
+	appendElement(&out, e);
+	return out;
+}
+
+void XmlProtocol::appendEscaped(QByteArray *out, const QString &s, bool attr)
+{
+	appendUtf8(out, s, attr);
+}
+
+QString XmlProtocol::writeScopeNS()
+{
+	ensureRootElement();
+	return framingMode == WebSocketFraming ? QString() : elemDefaultNS;
+}
+
+// the bytes writeElement() puts on the wire for e
+void XmlProtocol::appendElement(QByteArray *out, const QDomElement &e)
+{
+	ensureRootElement();
+	if(framingMode == WebSocketFraming) {
+		// nothing is in scope, an element without a namespace gets the
+		//   stream's default one spelled out
+		if(e.namespaceURI().isNull() && !e.hasAttribute("xmlns")) {
+			QDomElement c = e.cloneNode(true).toElement();
+			c.setAttribute("xmlns", elemDefaultNS);
+			writeElementUtf8(out, c, QString(), QMap<QString,QString>());
+		}
+		else
+			writeElementUtf8(out, e, QString(), QMap<QString,QString>());
+	}
+	else
+		writeElementUtf8(out, e, elemDefaultNS, elemPrefixes);
 }
 
 QByteArray XmlProtocol::resetStream()
@@ -540,26 +996,47 @@ QByteArray XmlProtocol::resetStream()
 
 int XmlProtocol::internalWriteData(const QByteArray &a, TrackItem::Type t, int id)
 {
-	TrackItem i;
-	i.type = t;
-	i.id = id;
-	i.size = a.size();
-	trackQueue += i;
+	addTrackItem(t, id, a.size());
 
-	ByteStream::appendArray(&outData, a);
+	// an empty buffer can simply share the data
+	if(outData.isEmpty())
+		outData = a;
+	else
+		ByteStream::appendArray(&outData, a);
 	return a.size();
 }
 
 int XmlProtocol::internalWriteString(const QString &s, TrackItem::Type t, int id)
 {
-	QString out=sanitizeForStream(s);
 	return internalWriteData(s.toUtf8(), t, id);
 }
 
 void XmlProtocol::sendTagOpen()
 {
-	if(elem.isNull())
-		elem = elemDoc.importNode(docElement(), true).toElement();
+	ensureRootElement();
+
+	if(framingMode == WebSocketFraming) {
+		// the root's attributes, less its namespaces
+		QByteArray s = "<open xmlns=\"" NS_FRAMING "\"";
+		QDomNamedNodeMap al = elem.attributes();
+		for(int n = 0; n < al.count(); ++n) {
+			QDomAttr a = al.item(n).toAttr();
+			QString aname = a.namespaceURI() == NS_XML ? QString("xml:") + a.localName() : a.name();
+			if(aname == "xmlns" || aname.startsWith("xmlns:"))
+				continue;
+			s += ' ' + aname.toUtf8() + "=\"";
+			appendUtf8(&s, a.value(), true);
+			s += '"';
+		}
+		s += "/>";
+		tagOpen = QString::fromUtf8(s);
+		tagClose = "<close xmlns=\"" NS_FRAMING "\"/>";
+
+		if(recording)
+			transferItemList += TransferItem(tagOpen, true);
+		internalWriteData(s, TrackItem::Raw);
+		return;
+	}
 
 	QString xmlHeader;
 	createRootXmlTags(elem, &xmlHeader, &tagOpen, &tagClose);
@@ -568,8 +1045,10 @@ void XmlProtocol::sendTagOpen()
 	s += xmlHeader + '\n';
 	s += sanitizeForStream(tagOpen) + '\n';
 
-	transferItemList += TransferItem(xmlHeader, true);
-	transferItemList += TransferItem(tagOpen, true);
+	if(recording) {
+		transferItemList += TransferItem(xmlHeader, true);
+		transferItemList += TransferItem(tagOpen, true);
+	}
 
 	//stringSend(xmlHeader);
 	//stringSend(tagOpen);
@@ -578,7 +1057,8 @@ void XmlProtocol::sendTagOpen()
 
 void XmlProtocol::sendTagClose()
 {
-	transferItemList += TransferItem(tagClose, true);
+	if(recording)
+		transferItemList += TransferItem(tagClose, true);
 
 	//stringSend(tagClose);
 	internalWriteString(tagClose, TrackItem::Close);
@@ -589,6 +1069,7 @@ bool XmlProtocol::baseStep(const Parser::Event &pe)
 	// Basic
 	if(state == SendOpen) {
 		sendTagOpen();
+		docOpenSent();
 		event = ESend;
 		if(incoming)
 			state = Open;
@@ -630,6 +1111,13 @@ bool XmlProtocol::baseStep(const Parser::Event &pe)
 	}
 }
 
+void XmlProtocol::setRecordTransfers(bool b)
+{
+	recording = b;
+	if(!recording)
+		transferItemList.clear();
+}
+
 void XmlProtocol::setIncomingAsExternal()
 {
 	for(QList<TransferItem>::Iterator it = transferItemList.begin(); it != transferItemList.end(); ++it) {
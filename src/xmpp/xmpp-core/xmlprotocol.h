@@ -23,10 +23,15 @@
 
 #include <qdom.h>
 #include <QList>
+#include <QMap>
 #include <QObject>
+#include <QVector>
 #include "parser.h"
+#include "xmlsplitter.h"
+#include "xmpp_statistics.h"
 
 #define NS_XML "http://www.w3.org/XML/1998/namespace"
+#define NS_FRAMING "urn:ietf:params:xml:ns:xmpp-framing"
 
 namespace XMPP
 {
@@ -54,6 +59,13 @@ namespace XMPP
 			NRecv = 0x02  // need incoming data
 		};
 
+		// how the stream looks on the wire.  with WebSocketFraming (RFC
+		//   7395) the root element is sent as <open/> and <close/>, and
+		//   every element declares its own namespaces, so that each can be
+		//   a message of its own.  received <open/> and <close/> are turned
+		//   back into the root element for the parser.  kept across reset().
+		enum Framing { StreamFraming, WebSocketFraming };
+
 		XmlProtocol();
 		virtual ~XmlProtocol();
 
@@ -74,6 +86,37 @@ namespace XMPP
 		QString xmlEncoding() const;
 		QString elementToString(const QDomElement &e, bool clip=false);
 
+		// e as writeElement() would send it
+		QByteArray elementToUtf8(const QDomElement &e);
+		// escaped as text, or as an attribute value
+		static void appendEscaped(QByteArray *out, const QString &s, bool attr);
+		// the default namespace an element written as bytes is in the
+		//   scope of: the root element's, or none with WebSocketFraming
+		QString writeScopeNS();
+
+		void setFraming(Framing f);
+		inline Framing framing() const { return framingMode; }
+
+		// see Parser::setLimits().  kept across reset().  exceeding them
+		//   goes to handleError(), on both sides of the stream
+		void setParserLimits(int maxStanzaBytes, int maxDepth, int maxAttributes);
+		inline bool parserLimitExceeded() const { return xml.limitExceeded(); }
+
+		// see Parser::setFilters().  kept across reset().  a stanza that
+		//   matched reaches doStep() bare, with elementFiltered() true
+		void setStanzaFilters(const QList<StanzaFilter> &filters);
+		inline bool elementFiltered() const { return elemFiltered; }
+
+		// lets go of buffer memory kept from earlier traffic.  for a
+		//   stream with nothing in flight, see Parser::compact()
+		void compact();
+
+		// the document received elements are built in and the root
+		//   element is kept in.  kept across reset().  a null document
+		//   goes back to private ones, renewed at every reset().
+		void setDocument(const QDomDocument &doc);
+		inline QDomDocument document() const { return elemDoc; }
+
 		class TransferItem
 		{
 		public:
@@ -90,6 +133,14 @@ namespace XMPP
 		QList<TransferItem> transferItemList;
 		void setIncomingAsExternal();
 
+		// transferItemList is only filled in while recording is on
+		void setRecordTransfers(bool b);
+		inline bool recordTransfers() const { return recording; }
+
+		// time spent in the parser per received element, and in the
+		//   serializer per sent element.  kept across reset().
+		TimeHistogram parseTime, serializeTime;
+
 	protected:
 		virtual QDomElement docElement()=0;
 		virtual void handleDocOpen(const Parser::Event &pe)=0;
@@ -99,6 +150,7 @@ namespace XMPP
 		virtual bool stepRequiresElement() const;
 		virtual bool doStep(const QDomElement &e)=0;
 		virtual void itemWritten(int id, int size);
+		virtual void docOpenSent(); // right after our root open tag is written
 
 		// 'debug'
 		virtual void stringSend(const QString &s);
@@ -111,32 +163,51 @@ namespace XMPP
 		bool close();
 		int writeString(const QString &s, int id, bool external);
 		int writeElement(const QDomElement &e, int id, bool external, bool clip=false);
+		int writeData(const QByteArray &a, int id, bool external); // already serialized
 		QByteArray resetStream();
 
 	private:
 		enum { SendOpen, RecvOpen, Open, Closing };
+		// end is where the item stops in the stream of all bytes
+		//   written, so partial writes need no bookkeeping per item
 		class TrackItem
 		{
 		public:
 			enum Type { Raw, Close, Custom };
 			int type, id, size;
+			qint64 end;
 		};
 
 		bool incoming;
+		bool recording;
+		bool sharedDoc;
 		QDomDocument elemDoc;
 		QDomElement elem;
+		QString elemDefaultNS;
+		QMap<QString,QString> elemPrefixes;
 		QString tagOpen, tagClose;
 		int state;
 		bool peerClosed;
 		bool closeWritten;
 
 		Parser xml;
+		Framing framingMode;
+		XmlSplitter framed; // incoming, with WebSocketFraming
+		qint64 parseUsecs; // parser time not yet given to an element
+		bool elemFiltered; // the last element received, see setStanzaFilters()
 		QByteArray outData;
-		QList<TrackItem> trackQueue;
+		QVector<TrackItem> trackQueue; // pending items start at trackHead
+		int trackHead;
+		qint64 trackWritten, trackQueued; // byte totals
 
 		void init();
+		void ensureRootElement();
+		void appendElement(QByteArray *out, const QDomElement &e);
+		void addTrackItem(TrackItem::Type t, int id, int size);
+		void resetTracking();
 		int internalWriteData(const QByteArray &a, TrackItem::Type t, int id=-1);
 		int internalWriteString(const QString &s, TrackItem::Type t, int id=-1);
+		void addFramedData(const QByteArray &a);
 		void sendTagOpen();
 		void sendTagClose();
 		bool baseStep(const Parser::Event &pe);
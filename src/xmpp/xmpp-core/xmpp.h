@@ -42,6 +42,7 @@ namespace QCA
 
 #ifndef CS_XMPP
 class ByteStream;
+class SocketOptions;
 #endif
 
 #include <QtCrypto> // For QCA::SASL::Params
@@ -51,6 +52,7 @@ namespace XMPP
 	// CS_IMPORT_BEGIN cutestuff/bytestream.h
 #ifdef CS_XMPP
 	class ByteStream;
+	class SocketOptions;
 #endif
 	// CS_IMPORT_END
 
@@ -113,7 +115,7 @@ namespace XMPP
 		class Proxy
 		{
 		public:
-			enum { None, HttpConnect, HttpPoll, Socks };
+			enum { None, HttpConnect, HttpPoll, Socks, HttpBind, WebSocket };
 			Proxy();
 			~Proxy();
 
@@ -127,6 +129,8 @@ namespace XMPP
 
 			void setHttpConnect(const QString &host, quint16 port);
 			void setHttpPoll(const QString &host, quint16 port, const QString &url);
+			void setHttpBind(const QString &host, quint16 port, const QString &url);
+			void setWebSocket(const QString &host, quint16 port, const QString &url);
 			void setSocks(const QString &host, quint16 port);
 			void setUserPass(const QString &user, const QString &pass);
 			void setPollInterval(int secs);
@@ -144,6 +148,7 @@ namespace XMPP
 		void setOptHostsPort(const QStringList &hosts, quint16 port);
 		void setOptProbe(bool);
 		void setOptSSL(bool);
+		void setSocketOptions(const SocketOptions &opts);
 
 		void changePollInterval(int secs);
 
@@ -162,6 +167,7 @@ namespace XMPP
 		void httpSyncFinished();
 
 	private slots:
+		void dns_partialResultsReady(const QList<QHostAddress> &results);
 		void dns_resultsReady(const QList<QHostAddress> &results);
 		void dns_error(XMPP::AddressResolver::Error e);
 		void srv_done();
@@ -170,6 +176,10 @@ namespace XMPP
 		void http_syncStarted();
 		void http_syncFinished();
 		void t_timeout();
+		void race_timeout();
+		void race_connected();
+		void race_error(int);
+		void dns_cached();
 
 	private:
 		class Private;
@@ -179,6 +189,11 @@ namespace XMPP
 		void do_resolve();
 		void do_connect();
 		void tryNextSrv();
+		void race_dnsResults(const QList<QHostAddress> &results);
+		void race_next();
+		void race_fail();
+		void race_cancel();
+		void rememberTarget();
 	};
 
 	class TLSHandler : public QObject
@@ -220,6 +235,33 @@ namespace XMPP
 		void write(const QByteArray &a);
 		void writeIncoming(const QByteArray &a);
 
+		// process-wide session cache, keyed by host.  when enabled,
+		//   startClient() offers the last session for the host so that
+		//   a reconnect can skip the full handshake.
+		static void setSessionCacheEnabled(bool b);
+		static bool isSessionCacheEnabled();
+		static void clearSessionCache();
+		static int sessionCacheHits();
+		static int sessionCacheMisses();
+
+		// full path validation of the peer's chain, once handshaken:
+		//   against the trusted certificates and crls set on the tls
+		//   object, for use by a tls server, plus the host name check of
+		//   certMatchesHostname() if XMPPCertCheck() is on.  the result
+		//   of the chain validation is put in validity, if given.
+		QCA::TLS::IdentityResult verifyPeer(QCA::Validity *validity = 0);
+
+		// process-wide cache of verifyPeer() results, keyed by the peer's
+		//   certificate and host.  an entry is kept until a certificate of
+		//   the chain or a crl it was checked against expires, for an hour
+		//   at most.  when enabled, reconnecting to a known server skips
+		//   the validation.
+		static void setCertCacheEnabled(bool b);
+		static bool isCertCacheEnabled();
+		static void clearCertCache();
+		static int certCacheHits();
+		static int certCacheMisses();
+
 	signals:
 		void tlsHandshaken();
 
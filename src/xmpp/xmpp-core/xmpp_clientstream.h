@@ -23,6 +23,8 @@
 #include <QtCrypto>
 
 #include "xmpp_stream.h"
+#include "xmpp_statistics.h"
+#include "xmpp_stanzafilter.h"
 
 class QByteArray;
 class QString;
@@ -31,10 +33,12 @@ class QDomElement;
 class QObject;
 class ByteStream;
 class QHostAddress;
+class QThread;
 
 namespace XMPP
 {
 	class TLSHandler;
+	class ServerContext;
 	class Connector;
 
         /** \brief Class for connecting to XMPP server, handles basic network parameters and stream security. */
@@ -91,15 +95,30 @@ namespace XMPP
 			AllowPlain,
 			AllowPlainOverTLS
 		};
+		enum CompressFlushType {
+			CompressFlushEachWrite,     // sync flush after every stanza
+			CompressFlushBatched        // flush once per event loop turn, or after flushBytes
+		};
 
                 /** \brief Create client stream using connector.
                     \param conn might be simple Connector or AdvancedConnection with proxy connection support. */
 		ClientStream(Connector *conn, TLSHandler *tlsHandler=0, QObject *parent=0);
 		ClientStream(const QString &host, const QString &defRealm, ByteStream *bs, QCA::TLS *tls=0, QObject *parent=0); // server
+                /** \brief Create a server-mode stream over the accepted \a bs, with settings shared through \a context.
+                    TLS and SASL objects are only made once the peer asks for them.  See StreamServer. */
+		ClientStream(const ServerContext &context, ByteStream *bs, QObject *parent=0);
 		~ClientStream();
 
 		Jid jid() const;
 		void connectToServer(const Jid &jid, bool auth=true);
+                /** \brief Connect as the external component (XEP-0114) serving \a domain, proving \a secret with the handshake.
+                    There is no TLS negotiation, SASL or resource binding: authenticated() follows an accepted handshake, a refused one
+                    is ErrAuth with NotAuthorized.  Stanzas are then read and written for any address of the domain.  Components are
+                    reached on a port of their own, so give the connector a host and port rather than let it look up the client service.
+                    See ComponentClient. */
+		void connectAsComponent(const Jid &domain, const QString &secret);
+                /** \brief True if the stream was connected with connectAsComponent(). */
+		bool isComponent() const;
 		void accept(); // server
 		bool isActive() const;
 		bool isAuthenticated() const;
@@ -109,7 +128,7 @@ namespace XMPP
 		void setPassword(const QString &s);
 		void setRealm(const QString &s);
 		void setAuthzid(const QString &s);
-		void continueAfterParams();
+		Q_INVOKABLE void continueAfterParams();
 
 		// SASL information
 		QString saslMechanism() const;
@@ -134,14 +153,126 @@ namespace XMPP
 		void setLocalAddr(const QHostAddress &addr, quint16 port);
 
 		// Compression
-		void setCompress(bool);
+                /** \brief Request XEP-0138 zlib compression.
+                    \param flush when to push compressed data out.  Batching gives a better ratio and costs less CPU.
+                    \param flushBytes with CompressFlushBatched, also flush once this many plain bytes are pending (0 for no limit). */
+		void setCompress(bool, CompressFlushType flush=CompressFlushBatched, int flushBytes=8192);
+                /** \brief Tune the compressor for the device, before connecting.
+                    \param level zlib level from 0 to 9, or -1 for zlib's default.  1 costs far less CPU for not much less ratio on stanzas.
+                    \param windowBits history size from 9 to 15.  The compressor takes about 2^(windowBits+3) bytes, 256 KB at the default 15.
+                    There is no EXI (XEP-0322) stream encoding; zlib is the only compression offered. */
+		void setCompressionLevel(int level, int windowBits=15);
+                /** \brief Let the compression level follow the traffic, starting from the one set with setCompressionLevel().
+                    Poorly compressible stretches, such as Base64 of images or encrypted bodies, are sent stored, and the level
+                    is stepped down while deflating is costly and up while it is cheap.  Off by default. */
+		void setAdaptiveCompression(bool);
+
+		// Pipelined login
+                /** \brief Send the bind request right behind the post-SASL stream restart, without waiting for the server's features.
+                    In this mode stanzas written before the stream is active (such as a roster get and initial presence) are held and sent along with the bind request, rather than dropped. */
+		void setPipelinedLogin(bool);
+
+		// Stream management
+                /** \brief Enable XEP-0198 stream management, so that a dropped connection can be resumed.
+                    After a drop, the next connectToServer() for the same account tries to resume the old session, resending anything the server never acknowledged. */
+		void setStreamManagement(bool);
+                /** \brief True if the current session was resumed, in which case roster and presence are still in place on the server. */
+		bool isResumed() const;
+
+		// Hot standby
+                /** \brief Have connectToServer() stop short of a session, and wait for continueFromStandby() instead.
+                    The stream gets as far as TLS, or with \a authenticate through SASL as well, then emits standbyReady().  A standby
+                    connected ahead of time takes over from a failed stream in a round trip or two, as DNS, TCP, TLS and SASL are
+                    done already.  Pipelined login is off for it.  See Client::setStandbyStream(). */
+		void setStandby(bool enabled, bool authenticate=true);
+                /** \brief True while waiting in standby. */
+		bool isStandby() const;
+                /** \brief Take over the session \a other could resume (XEP-0198), so that continueFromStandby() resumes it rather than bind anew.
+                    \a other can't resume it anymore.  Needs stream management on this stream. */
+		void takeSession(ClientStream *other);
+                /** \brief Go on from standby to bind, or resume, as a normal login.  authenticated() follows. */
+		Q_INVOKABLE void continueFromStandby();
+
+		// Roster versioning
+                /** \brief True if the server advertised XEP-0237 roster versioning, so a roster get may carry the version of a cached copy. */
+		bool isRosterVersioningSupported() const;
+
+		// Write coalescing
+                /** \brief Hold back outgoing data until the matching uncork(), so that a burst of stanzas goes out as one write.  Calls nest. */
+		Q_INVOKABLE void cork();
+                /** \brief Release data held back since the matching cork(). */
+		Q_INVOKABLE void uncork();
+                /** \brief Coalesce everything written during one event loop turn into a single write. */
+		Q_INVOKABLE void setAutoCork(bool);
+
+		// Incoming flow control
+                /** \brief Stop reading from the socket while \a stanzas received stanzas wait to be read(), and go on once half of them are gone.
+                    The server then sees TCP flow control rather than the stream buffering all it sends.  0, the default, reads without limit. */
+		Q_INVOKABLE void setReadHighWater(int stanzas);
+                /** \brief Emit readyRead() as soon as received stanzas are parsed, instead of from the next event loop turn.
+                    Stanzas then reach the receiver in the same turn that read them from the socket.  A stanza that arrives while readyRead() is being handled, such as through a reply it writes, is not announced from within the handler; if it is still unread afterwards, it is announced in the next turn.
+                    Has no effect with a worker thread, where readyRead() crosses threads anyway.  Off by default. */
+		void setImmediateDelivery(bool);
+                /** \brief Close the stream with a policy-violation error when the peer sends a stanza of more than \a maxBytes,
+                    elements nested more than \a maxDepth deep in a stanza, or an element with more than \a maxAttributes attributes.
+                    They are enforced while the data comes in, so a stanza never takes more than about \a maxBytes to hold.  0, the default, means no limit. */
+		Q_INVOKABLE void setStanzaLimits(int maxBytes, int maxDepth=0, int maxAttributes=0);
+                /** \brief Drop received stanzas that match any of \a filters, as they are parsed, rather than build and hand them out.
+                    They are never read(), but count in StreamStatistics::stanzasFiltered, and for stream management.  Replaces the filters
+                    set before; an empty list, the default, drops nothing.  With a worker thread, set them before connecting. */
+		void setStanzaFilters(const QList<StanzaFilter> &filters);
+
+		// Outgoing priorities
+		enum WritePriority { PriorityControl, PriorityInteractive, PriorityBulk };
+                /** \brief Hold back stanzas below control priority while more than \a bytes wait to go out on the socket, and send them by priority once it drains.
+                    Replies, errors and pings always go out at once, so they never wait behind a file transfer or a vCard upload.  0, the default, writes everything in order as it comes. */
+		Q_INVOKABLE void setWriteHighWater(int bytes);
+                /** \brief Limit stanzas of priority \a prio (a WritePriority) to \a bytesPerSecond, with bursts of up to a second's worth.  0, the default, means no limit.
+                    Only applies while a high water mark is set, and never to control stanzas. */
+		Q_INVOKABLE void setWriteRate(int prio, int bytesPerSecond);
+                /** \brief The priority write() gives \a s: control for iq results, errors and pings, bulk for in-band bytestream data and vCard uploads, interactive for anything else. */
+		static WritePriority writePriority(const Stanza &s);
+                /** \brief Write \a s with priority \a prio rather than the one writePriority() would give it. */
+		void write(const Stanza &s, WritePriority prio);
+
+		// Fan-out
+                /** \brief Serialize \a s once, for sending to many recipients with write(const StanzaTemplate &, const Jid &, const QString &).
+                    Make it once authenticated, from the stream's thread.  Its own 'to' and 'id' are replaced at each write. */
+		StanzaTemplate createTemplate(const Stanza &s);
+                /** \brief Send \a t to \a to with id \a id (none if empty), at interactive priority.
+                    The bytes made by createTemplate() go out with the recipient spliced in.  While stream management or a write high water mark
+                    is on, or when called from another thread, the stanza is built and written as usual instead. */
+		void write(const StanzaTemplate &t, const Jid &to, const QString &id=QString());
+
+		// Stanzas written without QDom
+                /** \brief True if a stanza serialized by the caller, with XmlWriter, can go out through writeUtf8().
+                    Not while stream management or a write high water mark is on, before the stream is active, or from another thread: write a Stanza then. */
+		bool canWriteUtf8() const;
+                /** \brief The default namespace to give XmlWriter as the scope of such a stanza. */
+		QString writeScopeNS() const;
+                /** \brief Send \a stanza, one complete stanza in UTF-8, at interactive priority.  Only when canWriteUtf8() is true. */
+		void writeUtf8(const QByteArray &stanza);
+
+		// Worker thread
+                /** \brief Run the stream on \a thread: the connection, TLS, compression and XML parsing, so that streams of several clients can use several cores.
+                    Call this from the thread that owns the stream, while it is idle, before connectToServer().  The connector and TLS handler move along, so they must not have a parent other than the stream.
+                    Afterwards the stream can still be used from its old thread: received stanzas are handed over in batches through readyRead(), written ones are queued and sent together, and connectToServer(), connectAsComponent(), continueAfterWarning(), continueAfterParams(), close(), cork(), uncork(), setAutoCork(), setNoopTime(), setIdleCompaction() and writeDirect() are passed on to the worker.  Login parameters may be set while the stream waits for them after needAuthParams().
+                    Delete the stream with deleteLater(), and keep the thread running until it is gone. */
+		void setWorkerThread(QThread *thread);
+                /** \brief The thread set with setWorkerThread(), or 0. */
+		QThread *workerThread() const;
+
+		// Statistics
+                /** \brief Snapshot of the stream's counters, kept across reconnects.
+                    The counters are plain integers updated by the stream as it works, so this is cheap, but it must be called from the stream's thread. */
+		StreamStatistics statistics() const;
 
 		// reimplemented
 		QDomDocument & doc() const;
 		QString baseNS() const;
 		bool old() const;
 
-		void close();
+		Q_INVOKABLE void close();
 		bool stanzaAvailable() const;
 		Stanza read();
 		void write(const Stanza &s);
@@ -151,8 +282,14 @@ namespace XMPP
 		QDomElement errorAppSpec() const;
 
 		// extra
-		void writeDirect(const QString &s);
-		void setNoopTime(int mills);
+		Q_INVOKABLE void writeDirect(const QString &s);
+		Q_INVOKABLE void setNoopTime(int mills);
+                /** \brief Give back the memory of the stream's buffers, and the parser's document, once nothing was read or written for \a mills milliseconds.
+                    Meant for sessions that stay connected but quiet for a long time.  The compressor's zlib state is kept, as the peer decodes against it.  0, the default, turns it off. */
+		Q_INVOKABLE void setIdleCompaction(int mills);
+                /** \brief Build received stanzas in \a doc, and return it from doc(), so that stanzas and the replies to them share one document.
+                    Client::connectToServer() passes its own.  Only call this while the stream is not connected: elements of the previous document are not carried over. */
+		void setDocument(const QDomDocument &doc);
 
 		// barracuda extension
 		QStringList hosts() const;
@@ -164,6 +301,8 @@ namespace XMPP
 		void needAuthParams(bool user, bool pass, bool realm);
                 /** \brief Signal is emmited after you are successfuly authenticated */
 		void authenticated();
+                /** \brief In standby, see setStandby(). */
+		void standbyReady();
 		void warning(int);
                 /** \brief Incoming XML data as text string, useful for debugging output. */
 		void incomingXml(const QString &s);
@@ -195,17 +334,36 @@ namespace XMPP
 		void sasl_error();
 
 		void doNoop();
+		void doIdleCompaction();
 		void doReadyRead();
+		void doAutoUncork();
+		void doConnectToServer(const QString &jid, bool auth);
+		void doConnectAsComponent(const QString &domain, const QString &secret);
+		void flushQueuedWrites();
+		void pumpWrites();
+		void resumeReading();
+		void updateRecordTransfers();
+
+	protected:
+		void connectNotify(const char *signal);
+		void disconnectNotify(const char *signal);
 
 	private:
 		class Private;
 		Private *d;
 
+		bool queueCall(const char *method, QGenericArgument a0=QGenericArgument(0), QGenericArgument a1=QGenericArgument(0), QGenericArgument a2=QGenericArgument(0));
+		void writeNow(const Stanza &s, int prio);
+		void sendNow(const Stanza &s);
+		int pendingWriteBytes() const;
+		void flushCork();
 		void reset(bool all=false);
 		void processNext();
 		int convertedSASLCond() const;
 		bool handleNeed();
 		void handleError();
+		void srvInit(const ServerContext &context, ByteStream *bs, QCA::TLS *tls);
+		void srvStartSASL();
 		void srvProcessNext();
 	};
 }
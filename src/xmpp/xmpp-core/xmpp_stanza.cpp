@@ -22,6 +22,8 @@
 #include <QCoreApplication>
 #include "xmpp/jid/jid.h"
 #include "xmpp_stream.h"
+#include "xmlatoms.h"
+#include "xmlprotocol.h"
 
 using namespace XMPP;
 
@@ -116,11 +118,8 @@ public:
 
 	static int stringToErrorType(const QString &s)
 	{
-		for(int n = 0; errorTypeTable[n].str; ++n) {
-			if(s == errorTypeTable[n].str)
-				return errorTypeTable[n].type;
-		}
-		return -1;
+		static NameTable t(errorTypeTable, &ErrorTypeEntry::str, &ErrorTypeEntry::type);
+		return t.value(s);
 	}
 
 	static QString errorTypeToString(int x)
@@ -134,11 +133,8 @@ public:
 
 	static int stringToErrorCond(const QString &s)
 	{
-		for(int n = 0; errorCondTable[n].str; ++n) {
-			if(s == errorCondTable[n].str)
-				return errorCondTable[n].cond;
-		}
-		return -1;
+		static NameTable t(errorCondTable, &ErrorCondEntry::str, &ErrorCondEntry::cond);
+		return t.value(s);
 	}
 
 	static QString errorCondToString(int x)
@@ -312,13 +308,15 @@ bool Stanza::Error::fromCode(int code)
 */
 bool Stanza::Error::fromXml(const QDomElement &e, const QString &baseNS)
 {
-	if(e.tagName() != "error" && e.namespaceURI() != baseNS)
+	const XmlAtoms &a = XmlAtoms::get();
+	if(e.tagName() != a.error && e.namespaceURI() != baseNS)
 		return false;
 
 	// type
-	type = Private::stringToErrorType(e.attribute("type"));
+	type = Private::stringToErrorType(e.attribute(a.type));
 
 	// condition
+	const QString &stanzasNS = a.stanzasNS;
 	QDomNodeList nl = e.childNodes();
 	QDomElement t;
 	condition = -1;
@@ -328,7 +326,7 @@ bool Stanza::Error::fromXml(const QDomElement &e, const QString &baseNS)
 		t = i.toElement();
 		if(!t.isNull()) {
 			// FIX-ME: this shouldn't be needed
-			if(t.namespaceURI() == NS_STANZAS || t.attribute("xmlns") == NS_STANZAS) {
+			if(t.namespaceURI() == stanzasNS || t.attribute(a.xmlns) == stanzasNS) {
 				condition = Private::stringToErrorCond(t.tagName());
 				if (condition != -1)
 					break;
@@ -337,7 +335,7 @@ bool Stanza::Error::fromXml(const QDomElement &e, const QString &baseNS)
 	}
 
 	// code
-	originalCode = e.attribute("code").toInt();
+	originalCode = e.attribute(a.code).toInt();
 
 	// try to guess type/condition
 	if(type == -1 || condition == -1) {
@@ -432,30 +430,44 @@ QPair<QString,QString> Stanza::Error::description() const
 class Stanza::Private
 {
 public:
+
+	// tag names from the parser are the atoms themselves, so these
+	//   usually end at a pointer check
 	static int stringToKind(const QString &s)
 	{
-		if(s == "message")
+		const XmlAtoms &a = XmlAtoms::get();
+		if(s == a.message)
 			return Message;
-		else if(s == "presence")
+		else if(s == a.presence)
 			return Presence;
-		else if(s == "iq")
+		else if(s == a.iq)
 			return IQ;
-		else
-			return -1;
+		return -1;
 	}
 
 	static QString kindToString(Kind k)
 	{
+		const XmlAtoms &a = XmlAtoms::get();
 		if(k == Message)
-			return "message";
+			return a.message;
 		else if(k == Presence)
-			return "presence";
+			return a.presence;
 		else
-			return "iq";
+			return a.iq;
+	}
+
+	Private() : toParsed(false), fromParsed(false)
+	{
 	}
 
 	Stream *s;
 	QDomElement e;
+
+	// addressing, parsed on first use.  kept along with the attribute
+	//   text it came from, so that edits made through element() are seen
+	mutable QString toText, fromText;
+	mutable Jid toJid, fromJid;
+	mutable bool toParsed, fromParsed;
 };
 
 Stanza::Stanza()
@@ -573,22 +585,34 @@ void Stanza::setKind(Kind k)
 
 Jid Stanza::to() const
 {
-	return Jid(d->e.attribute("to"));
+	QString s = d->e.attribute(XmlAtoms::get().to);
+	if(!d->toParsed || s != d->toText) {
+		d->toText = s;
+		d->toJid = Jid(s);
+		d->toParsed = true;
+	}
+	return d->toJid;
 }
 
 Jid Stanza::from() const
 {
-	return Jid(d->e.attribute("from"));
+	QString s = d->e.attribute(XmlAtoms::get().from);
+	if(!d->fromParsed || s != d->fromText) {
+		d->fromText = s;
+		d->fromJid = Jid(s);
+		d->fromParsed = true;
+	}
+	return d->fromJid;
 }
 
 QString Stanza::id() const
 {
-	return d->e.attribute("id");
+	return d->e.attribute(XmlAtoms::get().id);
 }
 
 QString Stanza::type() const
 {
-	return d->e.attribute("type");
+	return d->e.attribute(XmlAtoms::get().type);
 }
 
 QString Stanza::lang() const
@@ -598,22 +622,28 @@ QString Stanza::lang() const
 
 void Stanza::setTo(const Jid &j)
 {
-	d->e.setAttribute("to", j.full());
+	d->toText = j.full();
+	d->toJid = j;
+	d->toParsed = true;
+	d->e.setAttribute(XmlAtoms::get().to, d->toText);
 }
 
 void Stanza::setFrom(const Jid &j)
 {
-	d->e.setAttribute("from", j.full());
+	d->fromText = j.full();
+	d->fromJid = j;
+	d->fromParsed = true;
+	d->e.setAttribute(XmlAtoms::get().from, d->fromText);
 }
 
 void Stanza::setId(const QString &id)
 {
-	d->e.setAttribute("id", id);
+	d->e.setAttribute(XmlAtoms::get().id, id);
 }
 
 void Stanza::setType(const QString &type)
 {
-	d->e.setAttribute("type", type);
+	d->e.setAttribute(XmlAtoms::get().type, type);
 }
 
 void Stanza::setLang(const QString &lang)
@@ -652,3 +682,139 @@ void Stanza::clearError()
 		d->e.removeChild(errElem);
 }
 
+
+//----------------------------------------------------------------------------
+// StanzaTemplate
+//----------------------------------------------------------------------------
+class StanzaTemplate::Private : public QSharedData
+{
+public:
+	enum Slot { SlotTo, SlotId };
+
+	Private() : owner(0), first(SlotTo)
+	{
+	}
+
+	QDomElement e; // without to and id
+	const void *owner;
+
+	// the start tag split where to and id go, in the order they come
+	QByteArray head, mid, tail;
+	Slot first;
+
+	static void appendSlot(QByteArray *out, Slot slot, const Jid &to, const QString &id)
+	{
+		if(slot == SlotTo) {
+			if(to.isEmpty())
+				return;
+			out->append(" to=\"");
+			XmlProtocol::appendEscaped(out, to.full(), true);
+			out->append('"');
+		}
+		else {
+			if(id.isEmpty())
+				return;
+			out->append(" id=\"");
+			XmlProtocol::appendEscaped(out, id, true);
+			out->append('"');
+		}
+	}
+};
+
+StanzaTemplate::StanzaTemplate()
+{
+	d = new Private;
+}
+
+StanzaTemplate::StanzaTemplate(const StanzaTemplate &from)
+:d(from.d)
+{
+}
+
+StanzaTemplate & StanzaTemplate::operator=(const StanzaTemplate &from)
+{
+	d = from.d;
+	return *this;
+}
+
+StanzaTemplate::~StanzaTemplate()
+{
+}
+
+bool StanzaTemplate::isNull() const
+{
+	return d->e.isNull();
+}
+
+QDomElement StanzaTemplate::element() const
+{
+	return d->e;
+}
+
+const void *StanzaTemplate::owner() const
+{
+	return d->owner;
+}
+
+// private use characters, so that they are written out as they are
+QString StanzaTemplate::toMarker()
+{
+	return QString(QChar(0xe000));
+}
+
+QString StanzaTemplate::idMarker()
+{
+	return QString(QChar(0xe001));
+}
+
+// marked is the stanza serialized with the markers as its to and id.  if
+//   they can't be told apart from the content, only the element is kept,
+//   and toUtf8() returns nothing
+void StanzaTemplate::setContent(const QDomElement &e, const void *owner, const QByteArray &marked)
+{
+	d->e = e;
+	d->owner = 0;
+	d->head.clear();
+	d->mid.clear();
+	d->tail.clear();
+
+	QByteArray toAttr = " to=\"" + toMarker().toUtf8() + '"';
+	QByteArray idAttr = " id=\"" + idMarker().toUtf8() + '"';
+	int at = marked.indexOf(toAttr);
+	int ai = marked.indexOf(idAttr);
+	int end = marked.indexOf('>');
+	if(at == -1 || ai == -1 || at > end || ai > end)
+		return;
+	if(marked.indexOf(toMarker().toUtf8(), at + toAttr.size()) != -1 || marked.indexOf(idMarker().toUtf8(), ai + idAttr.size()) != -1)
+		return;
+
+	d->owner = owner;
+	if(at < ai) {
+		d->first = Private::SlotTo;
+		d->head = marked.left(at);
+		d->mid = marked.mid(at + toAttr.size(), ai - at - toAttr.size());
+		d->tail = marked.mid(ai + idAttr.size());
+	}
+	else {
+		d->first = Private::SlotId;
+		d->head = marked.left(ai);
+		d->mid = marked.mid(ai + idAttr.size(), at - ai - idAttr.size());
+		d->tail = marked.mid(at + toAttr.size());
+	}
+}
+
+QByteArray StanzaTemplate::toUtf8(const Jid &to, const QString &id) const
+{
+	if(!d->owner)
+		return QByteArray();
+
+	Private::Slot second = d->first == Private::SlotTo ? Private::SlotId : Private::SlotTo;
+	QByteArray out;
+	out.reserve(d->head.size() + d->mid.size() + d->tail.size() + to.full().size() + id.size() + 16);
+	out += d->head;
+	Private::appendSlot(&out, d->first, to, id);
+	out += d->mid;
+	Private::appendSlot(&out, second, to, id);
+	out += d->tail;
+	return out;
+}
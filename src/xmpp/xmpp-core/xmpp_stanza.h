@@ -23,6 +23,7 @@
 #include <QPair>
 #include <QString>
 #include <QDomElement>
+#include <QSharedDataPointer>
 
 class QDomDocument;
 
@@ -152,6 +153,35 @@ namespace XMPP
 		class Private;
 		Private *d;
 	};
+
+        /** \brief A stanza serialized once, to be sent to many recipients.
+            Made by ClientStream::createTemplate(), and sent by ClientStream::write(const StanzaTemplate &, const Jid &, const QString &),
+            which splices each recipient's 'to' and 'id' into the bytes rather than building and serializing the stanza again.
+            Copies are cheap and share the bytes. */
+	class StanzaTemplate
+	{
+	public:
+		StanzaTemplate();
+		StanzaTemplate(const StanzaTemplate &from);
+		StanzaTemplate & operator=(const StanzaTemplate &from);
+		~StanzaTemplate();
+
+		bool isNull() const;
+
+	private:
+		friend class ClientStream;
+
+		class Private;
+		QSharedDataPointer<Private> d;
+
+		QDomElement element() const;
+		const void *owner() const;
+		void setContent(const QDomElement &e, const void *owner, const QByteArray &marked);
+		QByteArray toUtf8(const Jid &to, const QString &id) const;
+
+		static QString toMarker();
+		static QString idMarker();
+	};
 }
 
 #endif
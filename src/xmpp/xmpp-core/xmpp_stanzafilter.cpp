@@ -0,0 +1,142 @@
+/*
+ * xmpp_stanzafilter.cpp - received stanzas to drop while parsing
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmpp_stanzafilter.h"
+
+#define NS_CLIENT "jabber:client"
+#define NS_SERVER "jabber:server"
+#define NS_COMPONENT "jabber:component:accept"
+
+using namespace XMPP;
+
+// the domain part of a jid is between the '@', if any, and the '/', if any
+static bool jidHasDomain(const QString &jid, const QString &domain)
+{
+	int end = jid.indexOf('/');
+	if(end == -1)
+		end = jid.length();
+	int start = 0;
+	for(int n = 0; n < end; ++n) {
+		if(jid[n] == '@') {
+			start = n + 1;
+			break;
+		}
+	}
+	if(end - start != domain.length())
+		return false;
+	return jid.midRef(start, end - start).compare(domain, Qt::CaseInsensitive) == 0;
+}
+
+StanzaFilter::StanzaFilter(const QString &tagName, const QString &ns) :
+	v_tagName(tagName),
+	v_ns(ns),
+	presentMask(0),
+	hasAbsent(false)
+{
+}
+
+void StanzaFilter::addAttribute(const QString &name, const QString &value, AttributeMatch match)
+{
+	Attribute a;
+	a.name = name;
+	a.value = value;
+	a.match = match;
+	attrs += a;
+}
+
+void StanzaFilter::addChild(const QString &tagName, const QString &ns)
+{
+	// the bits in presentMask go by position in children
+	if(children.count() >= 32)
+		return;
+	Child c;
+	c.tagName = tagName;
+	c.ns = ns;
+	c.present = true;
+	presentMask |= quint32(1) << children.count();
+	children += c;
+}
+
+void StanzaFilter::addNoChild(const QString &tagName, const QString &ns)
+{
+	if(children.count() >= 32)
+		return;
+	Child c;
+	c.tagName = tagName;
+	c.ns = ns;
+	c.present = false;
+	hasAbsent = true;
+	children += c;
+}
+
+bool StanzaFilter::Child::matches(const QDomElement &e) const
+{
+	if(!tagName.isEmpty() && e.localName() != tagName)
+		return false;
+	if(!ns.isEmpty() && e.namespaceURI() != ns)
+		return false;
+	return true;
+}
+
+// the stanza itself, with its attributes, leaving the children
+bool StanzaFilter::matchesStanza(const QDomElement &e) const
+{
+	if(!v_tagName.isEmpty() && e.localName() != v_tagName)
+		return false;
+	if(!v_ns.isEmpty() && e.namespaceURI() != v_ns)
+		return false;
+
+	foreach(const Attribute &a, attrs) {
+		switch(a.match) {
+			case Equals:
+				if(!e.hasAttribute(a.name) || e.attribute(a.name) != a.value)
+					return false;
+				break;
+			case Present:
+				if(!e.hasAttribute(a.name))
+					return false;
+				break;
+			case Absent:
+				if(e.hasAttribute(a.name))
+					return false;
+				break;
+			case JidDomain:
+				if(!jidHasDomain(e.attribute(a.name), a.value))
+					return false;
+				break;
+		}
+	}
+	return true;
+}
+
+bool StanzaFilter::isFilterable(const QDomElement &e)
+{
+	QString ns = e.namespaceURI();
+	if(ns != NS_CLIENT && ns != NS_SERVER && ns != NS_COMPONENT)
+		return false;
+
+	QString tagName = e.localName();
+	if(tagName == "message" || tagName == "presence")
+		return true;
+	if(tagName == "iq") {
+		QString type = e.attribute("type");
+		return type == "result" || type == "error";
+	}
+	return false;
+}
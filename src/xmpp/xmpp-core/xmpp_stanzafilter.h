@@ -0,0 +1,84 @@
+/*
+ * xmpp_stanzafilter.h - received stanzas to drop while parsing
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_STANZAFILTER_H
+#define XMPP_STANZAFILTER_H
+
+#include <QString>
+#include <QList>
+#include <qdom.h>
+
+namespace XMPP
+{
+	class ParserFilters;
+
+        /** \brief A kind of received stanza the application has no use for, see ClientStream::setStanzaFilters().
+            A stanza matches if it has the tag name and namespace given (either empty for any), every attribute condition holds,
+            it has a child for each addChild() and none for any addNoChild().  Only the children of the stanza itself are looked at.
+            The parser checks this as the stanza comes in: once it is known to match, nothing more of it is built, so a matched
+            stanza costs little more than reading past its bytes.  Requests (iq of type get or set) are never dropped, as they
+            need an answer. */
+	class StanzaFilter
+	{
+	public:
+		enum AttributeMatch
+		{
+			Equals,    // the attribute has the value given
+			Present,   // the attribute is there, with any value
+			Absent,    // the attribute isn't there
+			JidDomain  // the attribute is a jid of the domain given, compared without case
+		};
+
+		StanzaFilter(const QString &tagName=QString(), const QString &ns=QString());
+
+		void addAttribute(const QString &name, const QString &value=QString(), AttributeMatch match=Equals);
+                /** \brief Needs a child \a tagName in \a ns, either empty for any.  Up to 32 children can be asked for. */
+		void addChild(const QString &tagName, const QString &ns=QString());
+		void addNoChild(const QString &tagName, const QString &ns=QString());
+
+	private:
+		class Attribute
+		{
+		public:
+			QString name, value;
+			AttributeMatch match;
+		};
+
+		class Child
+		{
+		public:
+			QString tagName, ns;
+			bool present;
+
+			bool matches(const QDomElement &e) const;
+		};
+
+		friend class ParserFilters;
+		QString v_tagName, v_ns;
+		QList<Attribute> attrs;
+		QList<Child> children;
+		quint32 presentMask; // a bit for each of children that must be there
+		bool hasAbsent;
+
+		bool matchesStanza(const QDomElement &e) const;
+		static bool isFilterable(const QDomElement &e);
+	};
+}
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * xmpp_statistics.h - counters for streams and bytestreams
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_STATISTICS_H
+#define XMPP_STATISTICS_H
+
+#include <QtGlobal>
+#if QT_VERSION >= 0x040800
+# include <QElapsedTimer>
+#else
+# include <QTime>
+#endif
+
+namespace XMPP
+{
+	/** \brief Distribution of durations, in power of two microsecond buckets.
+	    Bucket 0 counts durations under 1us, bucket n those under 2^n us, and
+	    the last bucket everything longer. */
+	class TimeHistogram
+	{
+	public:
+		enum { Buckets = 16 };
+
+		TimeHistogram() { clear(); }
+
+		void add(qint64 usecs)
+		{
+			int n = 0;
+			while(n < Buckets - 1 && usecs >= (Q_INT64_C(1) << n))
+				++n;
+			++b[n];
+			++samples;
+			sum += usecs;
+			if(usecs > max)
+				max = usecs;
+		}
+
+		// adds the samples of another histogram, to sum up several streams
+		void merge(const TimeHistogram &other)
+		{
+			for(int n = 0; n < Buckets; ++n)
+				b[n] += other.b[n];
+			samples += other.samples;
+			sum += other.sum;
+			if(other.max > max)
+				max = other.max;
+		}
+
+		void clear()
+		{
+			for(int n = 0; n < Buckets; ++n)
+				b[n] = 0;
+			samples = 0;
+			sum = 0;
+			max = 0;
+		}
+
+		int count(int bucket) const { return b[bucket]; }
+		// upper limit of a bucket in usecs, -1 for the last one
+		static qint64 bucketLimit(int bucket) { return bucket < Buckets - 1 ? (Q_INT64_C(1) << bucket) : -1; }
+
+		int samples;
+		qint64 sum; // usecs
+		qint64 max; // usecs
+
+	private:
+		int b[Buckets];
+	};
+
+	// measures one duration for a TimeHistogram.  microsecond resolution
+	//   needs Qt 4.8, older versions only have milliseconds.
+	class StatisticsTimer
+	{
+	public:
+		void start() { t.start(); }
+#if QT_VERSION >= 0x040800
+		qint64 usecsElapsed() const { return t.nsecsElapsed() / 1000; }
+	private:
+		QElapsedTimer t;
+#else
+		qint64 usecsElapsed() const { return qint64(t.elapsed()) * 1000; }
+	private:
+		QTime t;
+#endif
+	};
+
+	/** \brief Counters for a ClientStream, kept since it was created.
+	    "Wire" bytes are what went through the socket, so below TLS and
+	    compression, and "plain" bytes are the XML above those layers. */
+	class StreamStatistics
+	{
+	public:
+		StreamStatistics() : stanzasIn(0), stanzasOut(0), stanzasFiltered(0), wireBytesIn(0), wireBytesOut(0), plainBytesIn(0), plainBytesOut(0), bytesToWrite(0) {}
+
+		qint64 stanzasIn, stanzasOut;
+		qint64 stanzasFiltered;      // received and dropped, see ClientStream::setStanzaFilters()
+		qint64 wireBytesIn, wireBytesOut;
+		qint64 plainBytesIn, plainBytesOut;
+		int bytesToWrite;            // plain bytes written but not yet on the wire
+		TimeHistogram parseTime;     // per received element
+		TimeHistogram serializeTime; // per sent element
+	};
+
+	/** \brief Counters for a bytestream (IBB, SOCKS5), kept since it was created. */
+	class TransferStatistics
+	{
+	public:
+		TransferStatistics() : bytesIn(0), bytesOut(0), packetsIn(0), packetsOut(0), packetsDropped(0), bytesToWrite(0) {}
+
+		qint64 bytesIn, bytesOut;
+		qint64 packetsIn, packetsOut; // IBB data packets, or SOCKS5 UDP datagrams
+		qint64 packetsDropped;        // datagrams that came in faster than they were read
+		int bytesToWrite;
+	};
+}
+
+#endif
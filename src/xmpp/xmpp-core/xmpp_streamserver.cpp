@@ -0,0 +1,249 @@
+/*
+ * xmpp_streamserver.cpp - accept inbound streams
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmpp_streamserver.h"
+
+#include <QList>
+#include <QSharedData>
+
+#include "bsocket.h"
+#include "servsock.h"
+#include "xmpp_clientstream.h"
+
+using namespace XMPP;
+
+//----------------------------------------------------------------------------
+// ServerContext
+//----------------------------------------------------------------------------
+class ServerContext::Private : public QSharedData
+{
+public:
+	QString host, defRealm;
+	QCA::CertificateChain cert;
+	QCA::PrivateKey key;
+	QStringList mechs;
+	QString secret;
+};
+
+ServerContext::ServerContext()
+{
+}
+
+ServerContext::ServerContext(const QString &host, const QString &defRealm)
+:d(new Private)
+{
+	d->host = host;
+	d->defRealm = defRealm;
+	d->secret = QCA::arrayToHex(QCA::Random::randomArray(20).toByteArray());
+}
+
+ServerContext::ServerContext(const ServerContext &from)
+:d(from.d)
+{
+}
+
+ServerContext::~ServerContext()
+{
+}
+
+ServerContext & ServerContext::operator=(const ServerContext &from)
+{
+	d = from.d;
+	return *this;
+}
+
+bool ServerContext::isNull() const
+{
+	return !d;
+}
+
+QString ServerContext::host() const
+{
+	return d ? d->host : QString();
+}
+
+QString ServerContext::defaultRealm() const
+{
+	return d ? d->defRealm : QString();
+}
+
+void ServerContext::setCertificate(const QCA::CertificateChain &cert, const QCA::PrivateKey &key)
+{
+	if(!d)
+		d = new Private;
+	d->cert = cert;
+	d->key = key;
+}
+
+bool ServerContext::haveTLS() const
+{
+	return d && !d->cert.isEmpty() && !d->key.isNull();
+}
+
+QCA::TLS *ServerContext::createTLS(QObject *parent) const
+{
+	if(!haveTLS())
+		return 0;
+	QCA::TLS *tls = new QCA::TLS(parent);
+	tls->setCertificate(d->cert, d->key);
+	return tls;
+}
+
+void ServerContext::setSASLMechanisms(const QStringList &mechs)
+{
+	if(!d)
+		d = new Private;
+	d->mechs = mechs;
+}
+
+QStringList ServerContext::saslMechanisms() const
+{
+	return d ? d->mechs : QStringList();
+}
+
+void ServerContext::setDialbackSecret(const QString &secret)
+{
+	if(!d)
+		d = new Private;
+	d->secret = secret;
+}
+
+QString ServerContext::dialbackKey(const QString &id) const
+{
+	if(!d)
+		return QString();
+
+	// sha1(sha1(sha1(secret) + host) + id), as the server mode always did
+	QByteArray str = QCA::Hash("sha1").hashToString(d->secret.toUtf8()).toUtf8();
+	str = QCA::Hash("sha1").hashToString(str + d->host.toUtf8()).toUtf8();
+	return QCA::Hash("sha1").hashToString(str + id.toUtf8());
+}
+
+//----------------------------------------------------------------------------
+// StreamServer
+//----------------------------------------------------------------------------
+class StreamServer::Private
+{
+public:
+	ServerContext context;
+	ServSock *serv;
+	QList<ClientStream*> incoming;
+	QCA::SASL *probe;
+};
+
+StreamServer::StreamServer(const ServerContext &context, QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+	d->context = context;
+	d->probe = 0;
+	d->serv = new ServSock(this);
+	connect(d->serv, SIGNAL(connectionReady(int)), SLOT(ss_connectionReady(int)));
+}
+
+StreamServer::~StreamServer()
+{
+	stop();
+	delete d->probe;
+	qDeleteAll(d->incoming);
+	delete d;
+}
+
+ServerContext StreamServer::context() const
+{
+	return d->context;
+}
+
+void StreamServer::setContext(const ServerContext &context)
+{
+	d->context = context;
+}
+
+void StreamServer::probeSASLMechanisms()
+{
+	if(d->probe || !d->context.saslMechanisms().isEmpty() || !QCA::isSupported("sasl"))
+		return;
+	d->probe = new QCA::SASL;
+	connect(d->probe, SIGNAL(serverStarted()), SLOT(sasl_serverStarted()));
+	connect(d->probe, SIGNAL(error()), SLOT(sasl_serverStarted()));
+	d->probe->startServer("xmpp", d->context.host(), d->context.defaultRealm(), QCA::SASL::AllowServerSendLast);
+}
+
+bool StreamServer::listen(quint16 port, const QHostAddress &addr)
+{
+	return d->serv->listen(port, addr);
+}
+
+void StreamServer::stop()
+{
+	d->serv->stop();
+}
+
+bool StreamServer::isActive() const
+{
+	return d->serv->isActive();
+}
+
+int StreamServer::port() const
+{
+	return d->serv->port();
+}
+
+ClientStream *StreamServer::createStream(int s, QObject *parent) const
+{
+	BSocket *bs = new BSocket;
+	bs->setSocket(s);
+	ClientStream *cs = createStream(bs, parent);
+	// the socket goes wherever the stream goes, ClientPool threads included
+	bs->setParent(cs);
+	return cs;
+}
+
+ClientStream *StreamServer::createStream(ByteStream *bs, QObject *parent) const
+{
+	return new ClientStream(d->context, bs, parent);
+}
+
+int StreamServer::incomingCount() const
+{
+	return d->incoming.count();
+}
+
+ClientStream *StreamServer::takeIncoming()
+{
+	if(d->incoming.isEmpty())
+		return 0;
+	return d->incoming.takeFirst();
+}
+
+void StreamServer::ss_connectionReady(int s)
+{
+	d->incoming += createStream(s);
+	emit incomingReady();
+}
+
+void StreamServer::sasl_serverStarted()
+{
+	QStringList mechs = d->probe->mechanismList();
+	d->probe->disconnect(this);
+	d->probe->deleteLater();
+	d->probe = 0;
+	if(!mechs.isEmpty() && d->context.saslMechanisms().isEmpty())
+		d->context.setSASLMechanisms(mechs);
+}
@@ -0,0 +1,120 @@
+/*
+ * xmpp_streamserver.h - accept inbound streams
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_STREAMSERVER_H
+#define XMPP_STREAMSERVER_H
+
+#include <QObject>
+#include <QSharedDataPointer>
+#include <QStringList>
+#include <QHostAddress>
+#include <QtCrypto>
+
+class ByteStream;
+
+namespace XMPP
+{
+	class ClientStream;
+
+        /** \brief Settings shared by every server-mode ClientStream of one host.
+            Copies are cheap and share one set of data, so a stream only costs a pointer for them.
+            A stream keeps the settings it was created with; changing a copy afterwards doesn't affect it. */
+	class ServerContext
+	{
+	public:
+                /** \brief A null context. */
+		ServerContext();
+                /** \brief Serve \a host.  A random dialback secret is chosen, and neither TLS nor a fixed SASL mechanism list is set. */
+		ServerContext(const QString &host, const QString &defRealm = QString());
+		ServerContext(const ServerContext &from);
+		~ServerContext();
+		ServerContext & operator=(const ServerContext &from);
+
+		bool isNull() const;
+		QString host() const;
+		QString defaultRealm() const;
+
+                /** \brief Certificate and key to offer STARTTLS with.  Without them, STARTTLS isn't offered. */
+		void setCertificate(const QCA::CertificateChain &cert, const QCA::PrivateKey &key);
+		bool haveTLS() const;
+                /** \brief A server-side TLS object set up with the certificate, or 0 if there is none. */
+		QCA::TLS *createTLS(QObject *parent=0) const;
+
+                /** \brief Mechanisms to offer.  With a list set, streams don't create their SASL object until
+                    the peer picks a mechanism; otherwise each stream asks QCA while sending its features. */
+		void setSASLMechanisms(const QStringList &mechs);
+		QStringList saslMechanisms() const;
+
+                /** \brief Secret the dialback keys are derived from.  Servers in a cluster have to share it. */
+		void setDialbackSecret(const QString &secret);
+                /** \brief The dialback key of stream \a id from this host. */
+		QString dialbackKey(const QString &id) const;
+
+	private:
+		class Private;
+		QSharedDataPointer<Private> d;
+	};
+
+        /** \brief Listens for inbound connections and turns each into a server-mode ClientStream.
+            Streams share the ServerContext, and get their TLS and SASL objects only once the peer asks for them,
+            so an idle stream holds little more than its socket and parser. */
+	class StreamServer : public QObject
+	{
+		Q_OBJECT
+	public:
+		StreamServer(const ServerContext &context, QObject *parent=0);
+		~StreamServer();
+
+		ServerContext context() const;
+                /** \brief Use \a context for streams accepted from now on. */
+		void setContext(const ServerContext &context);
+
+                /** \brief Ask QCA once for the SASL mechanisms it can serve, and put them in the context.
+                    Does nothing if the context has a list already.  Streams accepted before the answer
+                    came in ask for themselves. */
+		void probeSASLMechanisms();
+
+		bool listen(quint16 port, const QHostAddress &addr = QHostAddress::Any);
+		void stop();
+		bool isActive() const;
+		int port() const;
+
+                /** \brief Wrap an accepted socket \a s in a server-mode stream.  The socket belongs to the stream. */
+		ClientStream *createStream(int s, QObject *parent=0) const;
+                /** \brief Wrap an open \a bs in a server-mode stream.  \a bs should be deleted after the stream. */
+		ClientStream *createStream(ByteStream *bs, QObject *parent=0) const;
+
+		int incomingCount() const;
+                /** \brief Take the next stream accepted by listen(), or 0.  Call ClientStream::accept() on it to start. */
+		ClientStream *takeIncoming();
+
+	signals:
+		void incomingReady();
+
+	private slots:
+		void ss_connectionReady(int s);
+		void sasl_serverStarted();
+
+	private:
+		class Private;
+		Private *d;
+	};
+}
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * xmpp_streamshutdown.cpp - close streams cleanly before the process exits
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmpp_streamshutdown.h"
+
+#include <QCoreApplication>
+#include <QList>
+#include <QPointer>
+#include <QTimer>
+
+#include "processquit.h"
+#include "xmpp_clientstream.h"
+#include "xmpp_streamserver.h"
+
+using namespace XMPP;
+
+class StreamShutdown::Private
+{
+public:
+	QList<ClientStream*> streams;
+	QPointer<StreamServer> server;
+	QTimer deadline;
+	bool active;
+	bool quitWhenFinished;
+	bool finishing;
+};
+
+StreamShutdown::StreamShutdown(QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+	d->active = false;
+	d->quitWhenFinished = true;
+	d->finishing = false;
+	d->deadline.setSingleShot(true);
+	d->deadline.setInterval(5000);
+	connect(&d->deadline, SIGNAL(timeout()), SLOT(deadline_timeout()));
+
+	connect(ProcessQuit::instance(), SIGNAL(quit()), SLOT(start()));
+}
+
+StreamShutdown::~StreamShutdown()
+{
+	delete d;
+}
+
+void StreamShutdown::addStream(ClientStream *stream)
+{
+	if(d->streams.contains(stream))
+		return;
+
+	d->streams += stream;
+	connect(stream, SIGNAL(destroyed(QObject *)), SLOT(stream_destroyed(QObject *)));
+
+	if(d->active)
+		closeStream(stream);
+}
+
+void StreamShutdown::removeStream(ClientStream *stream)
+{
+	if(!d->streams.removeAll(stream))
+		return;
+
+	stream->disconnect(this);
+	if(d->active)
+		checkFinished();
+}
+
+void StreamShutdown::setStreamServer(StreamServer *server)
+{
+	d->server = server;
+}
+
+void StreamShutdown::setDeadline(int msecs)
+{
+	d->deadline.setInterval(msecs);
+}
+
+void StreamShutdown::setQuitWhenFinished(bool b)
+{
+	d->quitWhenFinished = b;
+}
+
+bool StreamShutdown::isShuttingDown() const
+{
+	return d->active;
+}
+
+int StreamShutdown::pendingStreams() const
+{
+	return d->streams.count();
+}
+
+void StreamShutdown::start()
+{
+	if(d->active)
+		return;
+
+	d->active = true;
+
+	if(d->server)
+		d->server->stop();
+
+	QPointer<QObject> self = this;
+	emit shuttingDown();
+	if(!self)
+		return;
+
+	d->deadline.start();
+
+	// work on a copy, as closing can finish a stream right away
+	QList<ClientStream*> list = d->streams;
+	foreach(ClientStream *stream, list) {
+		if(d->streams.contains(stream))
+			closeStream(stream);
+	}
+
+	checkFinished();
+}
+
+void StreamShutdown::closeStream(ClientStream *stream)
+{
+	// a stream that never got going has nothing to drain
+	if(!stream->isActive()) {
+		d->streams.removeAll(stream);
+		stream->disconnect(this);
+		stream->close();
+		return;
+	}
+
+	connect(stream, SIGNAL(delayedCloseFinished()), SLOT(stream_done()));
+	connect(stream, SIGNAL(connectionClosed()), SLOT(stream_done()));
+	connect(stream, SIGNAL(error(int)), SLOT(stream_done()));
+	stream->close();
+}
+
+void StreamShutdown::checkFinished()
+{
+	// deferred, so that finished() doesn't come from inside a stream's
+	//   signal or from start()
+	if(d->streams.isEmpty() && !d->finishing) {
+		d->finishing = true;
+		QMetaObject::invokeMethod(this, "doFinish", Qt::QueuedConnection);
+	}
+}
+
+void StreamShutdown::stream_done()
+{
+	ClientStream *stream = static_cast<ClientStream*>(sender());
+	d->streams.removeAll(stream);
+	stream->disconnect(this);
+	checkFinished();
+}
+
+void StreamShutdown::stream_destroyed(QObject *obj)
+{
+	d->streams.removeAll(static_cast<ClientStream*>(obj));
+	if(d->active)
+		checkFinished();
+}
+
+void StreamShutdown::deadline_timeout()
+{
+	if(d->finishing)
+		return;
+
+	d->finishing = true;
+	doFinish();
+}
+
+void StreamShutdown::doFinish()
+{
+	d->deadline.stop();
+
+	int remaining = d->streams.count();
+	foreach(ClientStream *stream, d->streams)
+		stream->disconnect(this);
+	d->streams.clear();
+
+	bool quit = d->quitWhenFinished;
+	emit finished(remaining);
+
+	if(quit)
+		QCoreApplication::quit();
+}
@@ -0,0 +1,82 @@
+/*
+ * xmpp_streamshutdown.h - close streams cleanly before the process exits
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_STREAMSHUTDOWN_H
+#define XMPP_STREAMSHUTDOWN_H
+
+#include <QObject>
+
+namespace XMPP
+{
+	class ClientStream;
+	class StreamServer;
+
+        /** \brief Drains streams on a termination request, and quits once they are closed.
+            On ProcessQuit::quit(), or a call to start(), the stream server given stops listening and shuttingDown() is emitted, so the
+            application can stop taking on new work.  Every stream is then closed: what it still holds for writing goes out, followed by
+            the closing tag, and the stream counts as done once the peer closes its side too.  When all are done, or the deadline passes,
+            finished() is emitted and the application's event loop is told to quit. */
+	class StreamShutdown : public QObject
+	{
+		Q_OBJECT
+	public:
+		StreamShutdown(QObject *parent=0);
+		~StreamShutdown();
+
+                /** \brief Close the streams in \a stream's place once shutting down.  Streams that are deleted are forgotten.
+                    Streams added while shutting down are closed right away. */
+		void addStream(ClientStream *stream);
+		void removeStream(ClientStream *stream);
+                /** \brief Stop \a server from accepting connections when shutting down. */
+		void setStreamServer(StreamServer *server);
+                /** \brief Give up waiting on the streams after \a msecs.  The default is 5 seconds. */
+		void setDeadline(int msecs);
+                /** \brief Whether to quit the event loop after finished().  The default is true. */
+		void setQuitWhenFinished(bool);
+
+		bool isShuttingDown() const;
+                /** \brief Streams added and not yet closed. */
+		int pendingStreams() const;
+
+	public slots:
+                /** \brief Begin shutting down, without waiting for a termination request.  Does nothing if already begun. */
+		void start();
+
+	signals:
+                /** \brief Stop taking on new work.  Emitted before any stream is closed. */
+		void shuttingDown();
+                /** \brief All streams are closed, or the deadline passed with \a remaining of them still open. */
+		void finished(int remaining);
+
+	private slots:
+		void stream_done();
+		void stream_destroyed(QObject *obj);
+		void deadline_timeout();
+		void doFinish();
+
+	private:
+		class Private;
+		Private *d;
+
+		void closeStream(ClientStream *stream);
+		void checkFinished();
+	};
+}
+
+#endif
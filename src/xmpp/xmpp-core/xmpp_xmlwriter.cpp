@@ -0,0 +1,109 @@
+/*
+ * xmpp_xmlwriter.cpp - writes XML tokens straight to UTF-8
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmpp_xmlwriter.h"
+
+#include "xmlprotocol.h"
+
+using namespace XMPP;
+
+XmlWriter::XmlWriter(QByteArray *_out, const QString &scopeNS)
+:out(_out), tagOpen(false)
+{
+	scopes += scopeNS;
+}
+
+void XmlWriter::closeTag()
+{
+	if(tagOpen) {
+		out->append('>');
+		tagOpen = false;
+	}
+}
+
+void XmlWriter::startElement(const char *name, const QString &ns)
+{
+	closeTag();
+	out->append('<');
+	out->append(name);
+
+	const QString &scope = scopes.last();
+	if(!ns.isNull() && ns != scope) {
+		out->append(" xmlns=\"");
+		XmlProtocol::appendEscaped(out, ns, true);
+		out->append('"');
+		scopes += ns;
+	}
+	else
+		scopes += scope;
+
+	names += name;
+	tagOpen = true;
+}
+
+void XmlWriter::attribute(const char *name, const QString &value)
+{
+	Q_ASSERT(tagOpen);
+	out->append(' ');
+	out->append(name);
+	out->append("=\"");
+	XmlProtocol::appendEscaped(out, value, true);
+	out->append('"');
+}
+
+void XmlWriter::text(const QString &s)
+{
+	closeTag();
+	XmlProtocol::appendEscaped(out, s, false);
+}
+
+void XmlWriter::endElement()
+{
+	Q_ASSERT(!names.isEmpty());
+	if(tagOpen) {
+		out->append("/>");
+		tagOpen = false;
+	}
+	else {
+		out->append("</");
+		out->append(names.last());
+		out->append('>');
+	}
+	names.resize(names.count() - 1);
+	scopes.resize(scopes.count() - 1);
+}
+
+void XmlWriter::textElement(const char *name, const QString &s, const QString &ns)
+{
+	startElement(name, ns);
+	if(!s.isEmpty())
+		text(s);
+	endElement();
+}
+
+void XmlWriter::emptyElement(const char *name, const QString &ns)
+{
+	startElement(name, ns);
+	endElement();
+}
+
+bool XmlWriter::isComplete() const
+{
+	return names.isEmpty();
+}
@@ -0,0 +1,65 @@
+/*
+ * xmpp_xmlwriter.h - writes XML tokens straight to UTF-8
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_XMLWRITER_H
+#define XMPP_XMLWRITER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+namespace XMPP
+{
+        /** \brief Writes an element token by token, as UTF-8, without building a QDomElement.
+
+        Only default namespaces are tracked: an element given a namespace other
+        than the one in scope declares it, an element given none inherits it.
+        Text and attribute values are escaped, and characters XML can't carry
+        are dropped, as XmlProtocol does for elements.  Attributes go between
+        startElement() and the first child or text. */
+	class XmlWriter
+	{
+	public:
+                /** \brief Append to \a out, with \a scopeNS as the default namespace around the element. */
+		XmlWriter(QByteArray *out, const QString &scopeNS = QString());
+
+		void startElement(const char *name, const QString &ns = QString());
+		void attribute(const char *name, const QString &value);
+		void text(const QString &s);
+		void endElement();
+
+                /** \brief An element holding only \a s. */
+		void textElement(const char *name, const QString &s, const QString &ns = QString());
+                /** \brief An element without content. */
+		void emptyElement(const char *name, const QString &ns = QString());
+
+                /** \brief True once every started element is ended. */
+		bool isComplete() const;
+
+	private:
+		QByteArray *out;
+		QVector<const char *> names;
+		QVector<QString> scopes; // default namespace in each open element
+		bool tagOpen;
+
+		void closeTag();
+	};
+}
+
+#endif
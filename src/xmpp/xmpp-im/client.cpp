@@ -71,16 +71,20 @@
 
 #include <stdarg.h>
 #include <qobject.h>
+#include <QHash>
 #include <QMap>
 #include <qtimer.h>
 #include <qpointer.h>
 //Added by qt3to4:
 #include <QList>
+#include <QSet>
 #include "xmpp_tasks.h"
 #include "xmpp_xmlcommon.h"
+#include "xmpp_capscache.h"
 #include "s5b.h"
 #include "xmpp_ibb.h"
 #include "filetransfer.h"
+#include "xmpp/base/idgenerator.h"
 
 /*#include <stdio.h>
 #include <stdarg.h>
@@ -101,6 +105,18 @@ using namespace Jabber;*/
 #define vsnprintf _vsnprintf
 #endif
 
+// stanzas handled per event loop turn, the rest wait for the next one
+#define STANZAS_PER_TURN 100
+
+// recipients per XEP-0033 stanza.  servers limit the size of the list,
+//   and longer fan-outs are split over several stanzas
+#define MULTICAST_MAX_ADDRESSES 50
+
+#define MULTICAST_NS "http://jabber.org/protocol/address"
+
+// how soon a standby is connected again after it failed
+#define STANDBY_RETRY_DELAY 10000
+
 namespace XMPP
 {
 
@@ -111,11 +127,14 @@ class Client::GroupChat
 {
 public:
 	enum { Connecting, Connected, Closing };
-	GroupChat() {}
+	GroupChat() : light(false) {}
 
 	Jid j;
 	int status;
 	QString password;
+	QHash<QString, Status> occupants; // nick -> last presence
+	bool light;
+	QHash<QString, QString> lightOccupants; // nick -> show, the others with light occupants
 };
 
 class Client::ClientPrivate
@@ -125,7 +144,14 @@ public:
 
 	ClientStream *stream;
 	QDomDocument doc;
-	int id_seed;
+
+	// see setStandbyStream()
+	ClientStream *standby;
+	Jid standbyJid;
+	bool standbyAuth;
+	int standbyRefresh;
+	QTimer *standbyTimer;
+	quint32 id_seed;
 	Task *root;
 	QString host, user, pass, resource;
 	QString osname, tzname, clientName, clientVersion, capsNode, capsVersion, capsExt;
@@ -135,14 +161,66 @@ public:
 	int tzoffset;
 	bool useTzoffset;	// manual tzoffset is old way of doing utc<->local translations
 	bool active;
+	bool streamXml; // forwarding the stream's xml signals
+	int iqTimeout;
+	int maxOutstandingIq;
+	int iqCacheTime;
+	QSet<QString> pubsubNodes;
+	bool notificationFastPath;
 
 	LiveRoster roster;
 	ResourceList resourceList;
+
+	// roster versioning.  cachedRoster mirrors what the cache holds and
+	//   is kept current with pushes; rosterLive is set while the live
+	//   roster was built from it, so an unchanged result needs no import
+	RosterCache *rosterCache;
+	Roster cachedRoster;
+	QString rosterVer;
+	QString cachedFor;
+	bool rosterLive;
+	bool rosterStorePending;
+
 	S5BManager *s5bman;
 	IBBManager *ibbman;
 	FileTransferManager *ftman;
 	bool ftEnabled;
-	QList<GroupChat> groupChatList;
+	QHash<QString, GroupChat> groupChats; // bare jid -> room
+
+	// presences waiting for the end of this event loop turn
+	bool presenceBatching;
+	QList<QPair<Jid, Status> > presenceQueue;
+	QSet<QString> occupantsChanged; // light rooms to emit groupChatOccupantsChanged() for
+
+	// addressing of the stanza being distributed, parsed once for all the
+	//   tasks it is offered to
+	class Incoming
+	{
+	public:
+		QDomElement e;
+		Jid from;
+		mutable Jid to;
+		mutable bool toParsed;
+	};
+	Incoming *incoming;
+
+	// whether the server relays XEP-0033 addressing.  asked once per
+	//   session, on the first fan-out.  fan-outs made while waiting for
+	//   the answer are queued
+	enum MulticastState { MulticastUnknown, MulticastProbing, MulticastYes, MulticastNo };
+	class FanOut
+	{
+	public:
+		QDomElement x;
+		QList<Jid> to;
+	};
+	MulticastState multicast;
+	DiscoInfoTask *multicastProbe;
+	QList<FanOut> fanOutQueue;
+
+	// XEP-0115 ver of the disco#info we answer with, hashed on demand
+	QString capsVer;
+	bool capsVerKnown;
 };
 
 
@@ -159,24 +237,44 @@ Client::Client(QObject *par)
 	d->capsNode = "";
 	d->capsVersion = "";
 	d->capsExt = "";
+	d->rosterCache = 0;
+	d->rosterLive = false;
+	d->rosterStorePending = false;
+	d->presenceBatching = false;
+	d->iqTimeout = 0;
+	d->maxOutstandingIq = 0;
+	d->iqCacheTime = 0;
+	d->notificationFastPath = false;
+	d->incoming = 0;
+	d->multicast = ClientPrivate::MulticastUnknown;
+	d->multicastProbe = 0;
+	d->capsVerKnown = false;
 
 	d->id_seed = 0xaaaa;
 	d->root = new Task(this, true);
 
 	d->stream = 0;
-
-	d->s5bman = new S5BManager(this);
-	connect(d->s5bman, SIGNAL(incomingReady()), SLOT(s5b_incomingReady()));
-
-	d->ibbman = new IBBManager(this);
-	connect(d->ibbman, SIGNAL(incomingReady()), SLOT(ibb_incomingReady()));
-
+	d->streamXml = false;
+
+	d->standby = 0;
+	d->standbyAuth = true;
+	d->standbyRefresh = 0;
+	d->standbyTimer = new QTimer(this);
+	d->standbyTimer->setSingleShot(true);
+	connect(d->standbyTimer, SIGNAL(timeout()), SLOT(standbyRefresh()));
+
+	// the managers, and the push tasks they add to the root task, are
+	//   only made once file transfer is enabled or they are asked for
+	d->s5bman = 0;
+	d->ibbman = 0;
 	d->ftman = 0;
 }
 
 Client::~Client()
 {
 	close(true);
+	if(d->rosterStorePending)
+		storeRosterCache();
 
 	delete d->ftman;
 	delete d->ibbman;
@@ -187,18 +285,95 @@ Client::~Client()
 }
 
 void Client::connectToServer(ClientStream *s, const Jid &j, bool auth)
+{
+	attachStream(s);
+	d->stream->connectToServer(j, auth);
+}
+
+void Client::attachStream(ClientStream *s)
 {
 	d->stream = s;
+
+	// have the stream build what it receives in our document, so that the
+	//   stanzas handed to tasks and the replies built from doc() share one
+	if(d->doc.isNull())
+		d->doc = QDomDocument(QString());
+	d->stream->setDocument(d->doc);
+
 	//connect(d->stream, SIGNAL(connected()), SLOT(streamConnected()));
 	//connect(d->stream, SIGNAL(handshaken()), SLOT(streamHandshaken()));
 	connect(d->stream, SIGNAL(error(int)), SLOT(streamError(int)));
 	//connect(d->stream, SIGNAL(sslCertificateReady(const QSSLCert &)), SLOT(streamSSLCertificateReady(const QSSLCert &)));
 	connect(d->stream, SIGNAL(readyRead()), SLOT(streamReadyRead()));
 	//connect(d->stream, SIGNAL(closeFinished()), SLOT(streamCloseFinished()));
-	connect(d->stream, SIGNAL(incomingXml(const QString &)), SLOT(streamIncomingXml(const QString &)));
-	connect(d->stream, SIGNAL(outgoingXml(const QString &)), SLOT(streamOutgoingXml(const QString &)));
+	d->streamXml = false;
+	updateStreamXml();
+}
 
-	d->stream->connectToServer(j, auth);
+void Client::setStandbyStream(ClientStream *s, const Jid &j, bool auth, int refreshSecs)
+{
+	if(d->standby) {
+		d->standby->disconnect(this);
+		d->standby->setStandby(false);
+		d->standby->close();
+	}
+	d->standbyTimer->stop();
+
+	d->standby = s;
+	d->standbyJid = j;
+	d->standbyAuth = auth;
+	d->standbyRefresh = refreshSecs;
+	if(!s)
+		return;
+
+	connect(s, SIGNAL(error(int)), SLOT(standbyError()));
+	standbyRefresh();
+}
+
+ClientStream *Client::standbyStream() const
+{
+	return d->standby;
+}
+
+void Client::standbyRefresh()
+{
+	if(!d->standby)
+		return;
+	d->standby->close();
+	d->standby->setStandby(true, d->standbyAuth);
+	d->standby->connectToServer(d->standbyJid, d->standbyAuth);
+	if(d->standbyRefresh > 0)
+		d->standbyTimer->start(d->standbyRefresh * 1000);
+}
+
+void Client::standbyError()
+{
+	d->standbyTimer->start(STANDBY_RETRY_DELAY);
+}
+
+// the standby takes the place of the failed stream.  false if there is
+//   none ready
+bool Client::failOver()
+{
+	ClientStream *s = d->standby;
+	if(!s || !s->isStandby())
+		return false;
+
+	d->standby = 0;
+	d->standbyTimer->stop();
+	s->disconnect(this);
+
+	ClientStream *old = d->stream;
+	old->disconnect(this);
+	s->takeSession(old);
+	attachStream(s);
+
+	QPointer<QObject> self = this;
+	failedOver(old);
+	if(!self || d->stream != s)
+		return true;
+	s->continueFromStandby();
+	return true;
 }
 
 void Client::start(const QString &host, const QString &user, const QString &pass, const QString &_resource)
@@ -216,12 +391,15 @@ void Client::start(const QString &host, const QString &user, const QString &pass
 	JT_PushPresence *pp = new JT_PushPresence(rootTask());
 	connect(pp, SIGNAL(subscription(const Jid &, const QString &, const QString&)), SLOT(ppSubscription(const Jid &, const QString &, const QString&)));
 	connect(pp, SIGNAL(presence(const Jid &, const Status &)), SLOT(ppPresence(const Jid &, const Status &)));
+	connect(pp, SIGNAL(occupant(const Jid &, bool, const QString &)), SLOT(ppOccupant(const Jid &, bool, const QString &)));
 
 	JT_PushMessage *pm = new JT_PushMessage(rootTask());
 	connect(pm, SIGNAL(message(const Message &)), SLOT(pmMessage(const Message &)));
+	connect(pm, SIGNAL(chatState(const Jid &, const QString &, ChatState)), SLOT(pmChatState(const Jid &, const QString &, ChatState)));
+	connect(pm, SIGNAL(receipt(const Jid &, const QString &, const QString &)), SLOT(pmReceipt(const Jid &, const QString &, const QString &)));
 
 	JT_PushRoster *pr = new JT_PushRoster(rootTask());
-	connect(pr, SIGNAL(roster(const Roster &)), SLOT(prRoster(const Roster &)));
+	connect(pr, SIGNAL(roster(const Roster &, const QString &)), SLOT(prRoster(const Roster &, const QString &)));
 
 	new JT_ServInfo(rootTask());
 
@@ -231,8 +409,11 @@ void Client::start(const QString &host, const QString &user, const QString &pass
 void Client::setFileTransferEnabled(bool b)
 {
 	if(b) {
-		if(!d->ftman)
+		if(!d->ftman) {
+			// incoming offers need the bytestream to be served
+			s5bManager();
 			d->ftman = new FileTransferManager(this);
+		}
 	}
 	else {
 		if(d->ftman) {
@@ -249,11 +430,19 @@ FileTransferManager *Client::fileTransferManager() const
 
 S5BManager *Client::s5bManager() const
 {
+	if(!d->s5bman) {
+		d->s5bman = new S5BManager(const_cast<Client *>(this));
+		connect(d->s5bman, SIGNAL(incomingReady()), this, SLOT(s5b_incomingReady()));
+	}
 	return d->s5bman;
 }
 
 IBBManager *Client::ibbManager() const
 {
+	if(!d->ibbman) {
+		d->ibbman = new IBBManager(const_cast<Client *>(this));
+		connect(d->ibbman, SIGNAL(incomingReady()), this, SLOT(ibb_incomingReady()));
+	}
 	return d->ibbman;
 }
 
@@ -265,63 +454,66 @@ bool Client::isActive() const
 QString Client::groupChatPassword(const QString& host, const QString& room) const
 {
 	Jid jid(room + "@" + host);
-	foreach(GroupChat i, d->groupChatList) {
-		if(i.j.compare(jid, false)) {
-			return i.password;
-		}
-	}
+	QHash<QString, GroupChat>::ConstIterator it = d->groupChats.find(jid.bare());
+	if(it != d->groupChats.end())
+		return it.value().password;
 	return QString();
 }
 
 void Client::groupChatChangeNick(const QString &host, const QString &room, const QString &nick, const Status &_s)
 {
 	Jid jid(room + "@" + host + "/" + nick);
-	for(QList<GroupChat>::Iterator it = d->groupChatList.begin(); it != d->groupChatList.end(); it++) {
-		GroupChat &i = *it;
-		if(i.j.compare(jid, false)) {
-			i.j = jid;
-
-			Status s = _s;
-			s.setIsAvailable(true);
+	QHash<QString, GroupChat>::Iterator it = d->groupChats.find(jid.bare());
+	if(it == d->groupChats.end())
+		return;
+	it.value().j = jid;
 
-			JT_Presence *j = new JT_Presence(rootTask());
-			j->pres(jid, s);
-			j->go(true);
+	Status s = _s;
+	s.setIsAvailable(true);
 
-			break;
-		}
-	}
+	JT_Presence *j = new JT_Presence(rootTask());
+	j->pres(jid, s);
+	j->go(true);
 }
 
 bool Client::groupChatJoin(const QString &host, const QString &room, const QString &nick, const QString& password, int maxchars, int maxstanzas, int seconds, const Status& _s)
+{
+	GroupChatJoinOptions opts;
+	opts.password = password;
+	opts.maxChars = maxchars;
+	opts.maxStanzas = maxstanzas;
+	opts.seconds = seconds;
+	opts.status = _s;
+	return groupChatJoin(host, room, nick, opts);
+}
+
+bool Client::groupChatJoin(const QString &host, const QString &room, const QString &nick, const GroupChatJoinOptions &opts)
 {
 	Jid jid(room + "@" + host + "/" + nick);
-	for(QList<GroupChat>::Iterator it = d->groupChatList.begin(); it != d->groupChatList.end();) {
-		GroupChat &i = *it;
-		if(i.j.compare(jid, false)) {
-			// if this room is shutting down, then free it up
-			if(i.status == GroupChat::Closing)
-				it = d->groupChatList.erase(it);
-			else
-				return false;
-		}
+	QHash<QString, GroupChat>::Iterator it = d->groupChats.find(jid.bare());
+	if(it != d->groupChats.end()) {
+		// if this room is shutting down, then free it up
+		if(it.value().status == GroupChat::Closing)
+			d->groupChats.erase(it);
 		else
-			++it;
+			return false;
 	}
 
 	debug(QString("Client: Joined: [%1]\n").arg(jid.full()));
 	GroupChat i;
 	i.j = jid;
 	i.status = GroupChat::Connecting;
-	i.password = password;
-	d->groupChatList += i;
+	i.password = opts.password;
+	i.light = opts.lightOccupants;
+	d->groupChats.insert(jid.bare(), i);
 
 	JT_Presence *j = new JT_Presence(rootTask());
-	Status s = _s;
+	Status s = opts.status;
 	s.setMUC();
-	s.setMUCHistory(maxchars,maxstanzas,seconds);
-	if (!password.isEmpty()) {
-		s.setMUCPassword(password);
+	s.setMUCHistory(opts.maxChars, opts.maxStanzas, opts.seconds);
+	s.setMUCHistorySince(opts.since);
+	if (!opts.password.isEmpty()) {
+		s.setMUCPassword(opts.password);
 	}
 	j->pres(jid,s);
 	j->go(true);
@@ -332,17 +524,10 @@ bool Client::groupChatJoin(const QString &host, const QString &room, const QStri
 void Client::groupChatSetStatus(const QString &host, const QString &room, const Status &_s)
 {
 	Jid jid(room + "@" + host);
-	bool found = false;
-	for(QList<GroupChat>::ConstIterator it = d->groupChatList.begin(); it != d->groupChatList.end(); it++) {
-		const GroupChat &i = *it;
-		if(i.j.compare(jid, false)) {
-			found = true;
-			jid = i.j;
-			break;
-		}
-	}
-	if(!found)
+	QHash<QString, GroupChat>::ConstIterator it = d->groupChats.find(jid.bare());
+	if(it == d->groupChats.end())
 		return;
+	jid = it.value().j;
 
 	Status s = _s;
 	s.setIsAvailable(true);
@@ -352,26 +537,88 @@ void Client::groupChatSetStatus(const QString &host, const QString &room, const
 	j->go(true);
 }
 
-void Client::groupChatLeave(const QString &host, const QString &room)
+void Client::groupChatSetStatus(const Status &_s)
 {
-	Jid jid(room + "@" + host);
-	for(QList<GroupChat>::Iterator it = d->groupChatList.begin(); it != d->groupChatList.end(); it++) {
-		GroupChat &i = *it;
+	if(!d->stream)
+		return;
+
+	Status s = _s;
+	s.setIsAvailable(true);
 
-		if(!i.j.compare(jid, false))
+	// the presence is the same for every room but the 'to', so it is
+	//   built and serialized once
+	StanzaTemplate t = createTemplate(JT_Presence::presenceElement(doc(), s));
+	for(QHash<QString, GroupChat>::ConstIterator it = d->groupChats.begin(); it != d->groupChats.end(); ++it) {
+		const GroupChat &i = it.value();
+		if(i.status != GroupChat::Connected)
 			continue;
 
-		i.status = GroupChat::Closing;
-		debug(QString("Client: Leaving: [%1]\n").arg(i.j.full()));
+		if(!t.isNull()) {
+			send(t, i.j);
+			continue;
+		}
 
 		JT_Presence *j = new JT_Presence(rootTask());
-		Status s;
-		s.setIsAvailable(false);
 		j->pres(i.j, s);
 		j->go(true);
 	}
 }
 
+void Client::groupChatLeave(const QString &host, const QString &room)
+{
+	Jid jid(room + "@" + host);
+	QHash<QString, GroupChat>::Iterator it = d->groupChats.find(jid.bare());
+	if(it == d->groupChats.end())
+		return;
+
+	GroupChat &i = it.value();
+	i.status = GroupChat::Closing;
+	debug(QString("Client: Leaving: [%1]\n").arg(i.j.full()));
+
+	JT_Presence *j = new JT_Presence(rootTask());
+	Status s;
+	s.setIsAvailable(false);
+	j->pres(i.j, s);
+	j->go(true);
+}
+
+QStringList Client::groupChatOccupants(const Jid &room) const
+{
+	QHash<QString, GroupChat>::ConstIterator it = d->groupChats.find(room.bare());
+	if(it == d->groupChats.end())
+		return QStringList();
+	return it.value().occupants.keys() + it.value().lightOccupants.keys();
+}
+
+bool Client::groupChatOccupant(const Jid &occupant, Status *status) const
+{
+	QHash<QString, GroupChat>::ConstIterator it = d->groupChats.find(occupant.bare());
+	if(it == d->groupChats.end())
+		return false;
+	QHash<QString, Status>::ConstIterator oit = it.value().occupants.find(occupant.resource());
+	if(oit == it.value().occupants.end()) {
+		QHash<QString, QString>::ConstIterator lit = it.value().lightOccupants.find(occupant.resource());
+		if(lit == it.value().lightOccupants.end())
+			return false;
+		if(status)
+			*status = Status(lit.value());
+		return true;
+	}
+	if(status)
+		*status = oit.value();
+	return true;
+}
+
+bool Client::groupChatLightOccupant(const Jid &occupant) const
+{
+	QHash<QString, GroupChat>::ConstIterator it = d->groupChats.find(occupant.bare());
+	if(it == d->groupChats.end())
+		return false;
+	const GroupChat &i = it.value();
+	// our own presence tells whether we got in, so it always gets parsed
+	return i.light && i.status != GroupChat::Closing && !occupant.resource().isEmpty() && occupant.resource() != i.j.resource();
+}
+
 /*void Client::start()
 {
 	if(d->stream->old()) {
@@ -387,10 +634,12 @@ void Client::groupChatLeave(const QString &host, const QString &room)
 // TODO: fast close
 void Client::close(bool)
 {
+	setStandbyStream(0, Jid());
+
 	if(d->stream) {
 		if(d->active) {
-			for(QList<GroupChat>::Iterator it = d->groupChatList.begin(); it != d->groupChatList.end(); it++) {
-				GroupChat &i = *it;
+			for(QHash<QString, GroupChat>::Iterator it = d->groupChats.begin(); it != d->groupChats.end(); ++it) {
+				GroupChat &i = it.value();
 				i.status = GroupChat::Closing;
 
 				JT_Presence *j = new JT_Presence(rootTask());
@@ -404,6 +653,7 @@ void Client::close(bool)
 		d->stream->disconnect(this);
 		d->stream->close();
 		d->stream = 0;
+		d->streamXml = false;
 	}
 	disconnected();
 	cleanup();
@@ -413,7 +663,11 @@ void Client::cleanup()
 {
 	d->active = false;
 	//d->authed = false;
-	d->groupChatList.clear();
+	d->groupChats.clear();
+	d->presenceQueue.clear();
+	d->multicast = ClientPrivate::MulticastUnknown;
+	d->multicastProbe = 0;
+	d->fanOutQueue.clear();
 }
 
 /*void Client::continueAfterCert()
@@ -436,6 +690,9 @@ void Client::streamError(int)
 	//StreamError e = err;
 	//error(e);
 
+	if(failOver())
+		return;
+
 	//if(!e.isWarning()) {
 		disconnected();
 		cleanup();
@@ -494,18 +751,61 @@ void Client::streamReadyRead()
 	// HACK HACK HACK
 	QPointer<ClientStream> pstream = d->stream;
 
-	while(pstream && d->stream->stanzaAvailable()) {
+	for(int n = 0; pstream && d->stream->stanzaAvailable(); ++n) {
+		if(n == STANZAS_PER_TURN) {
+			QTimer::singleShot(0, this, SLOT(streamReadyRead()));
+			return;
+		}
 		Stanza s = d->stream->read();
 
-		QString out = s.toString();
-		debug(QString("Client: incoming: [\n%1]\n").arg(out));
-		xmlIncoming(out);
+		// only serialize the stanza if someone is listening
+		bool wantDebug = receivers(SIGNAL(debugText(QString))) > 0;
+		bool wantXml = receivers(SIGNAL(xmlIncoming(QString))) > 0;
+		if(wantDebug || wantXml) {
+			QString out = s.toString();
+			if(wantDebug)
+				debug(QString("Client: incoming: [\n%1]\n").arg(out));
+			if(wantXml)
+				xmlIncoming(out);
+		}
 
 		QDomElement x = oldStyleNS(s.element());
 		distribute(x);
 	}
 }
 
+void Client::connectNotify(const char *)
+{
+	updateStreamXml();
+}
+
+void Client::disconnectNotify(const char *)
+{
+	updateStreamXml();
+}
+
+// only hook up to the stream's xml signals while someone wants ours, so
+//   that the stream doesn't have to keep and serialize every element
+void Client::updateStreamXml()
+{
+	if(!d->stream)
+		return;
+
+	bool want = receivers(SIGNAL(xmlIncoming(QString))) > 0 || receivers(SIGNAL(xmlOutgoing(QString))) > 0;
+	if(want == d->streamXml)
+		return;
+
+	d->streamXml = want;
+	if(want) {
+		connect(d->stream, SIGNAL(incomingXml(const QString &)), SLOT(streamIncomingXml(const QString &)));
+		connect(d->stream, SIGNAL(outgoingXml(const QString &)), SLOT(streamOutgoingXml(const QString &)));
+	}
+	else {
+		disconnect(d->stream, SIGNAL(incomingXml(const QString &)), this, SLOT(streamIncomingXml(const QString &)));
+		disconnect(d->stream, SIGNAL(outgoingXml(const QString &)), this, SLOT(streamOutgoingXml(const QString &)));
+	}
+}
+
 void Client::streamIncomingXml(const QString &s)
 {
 	QString str = s;
@@ -529,8 +829,7 @@ void Client::debug(const QString &str)
 
 QString Client::genUniqueId()
 {
-	QString s;
-	s.sprintf("a%x", d->id_seed);
+	QString s = IdGenerator::counterId('a', d->id_seed);
 	d->id_seed += 0x10;
 	return s;
 }
@@ -540,6 +839,71 @@ Task *Client::rootTask()
 	return d->root;
 }
 
+int Client::taskCount() const
+{
+	int count = 0;
+	foreach(QObject *obj, d->root->children()) {
+		if(obj->inherits("XMPP::Task"))
+			++count;
+	}
+	return count;
+}
+
+void Client::setIqTimeout(int msecs)
+{
+	d->iqTimeout = qMax(msecs, 0);
+}
+
+int Client::iqTimeout() const
+{
+	return d->iqTimeout;
+}
+
+void Client::setMaxOutstandingIq(int count)
+{
+	d->maxOutstandingIq = qMax(count, 0);
+}
+
+int Client::maxOutstandingIq() const
+{
+	return d->maxOutstandingIq;
+}
+
+void Client::setIqCacheTime(int msecs)
+{
+	d->iqCacheTime = qMax(msecs, 0);
+}
+
+int Client::iqCacheTime() const
+{
+	return d->iqCacheTime;
+}
+
+void Client::setPubSubNodeFilter(const QStringList &nodes)
+{
+	d->pubsubNodes = nodes.toSet();
+}
+
+QStringList Client::pubSubNodeFilter() const
+{
+	return d->pubsubNodes.toList();
+}
+
+bool Client::acceptsPubSubNode(const QString &node) const
+{
+	return d->pubsubNodes.isEmpty() || d->pubsubNodes.contains(node);
+}
+
+void Client::setNotificationFastPath(bool b)
+{
+	d->notificationFastPath = b;
+}
+
+bool Client::notificationFastPath() const
+{
+	return d->notificationFastPath;
+}
+
 QDomDocument *Client::doc() const
 {
 	return &d->doc;
@@ -547,19 +911,36 @@ QDomDocument *Client::doc() const
 
 void Client::distribute(const QDomElement &x)
 {
-	if(x.hasAttribute("from")) {
-		Jid j(x.attribute("from"));
-		if(!j.isValid()) {
+	const XmlAtoms &a = XmlAtoms::get();
+	QString from = x.attribute(a.from);
+
+	ClientPrivate::Incoming in;
+	in.e = x;
+	in.toParsed = false;
+	if(x.hasAttribute(a.from)) {
+		in.from = Jid(from);
+		if(!in.from.isValid()) {
 			debug("Client: bad 'from' JID\n");
 			return;
 		}
 	}
 
-	if(!rootTask()->take(x) && (x.attribute("type") == "get" || x.attribute("type") == "set") ) {
+	// a task may have a stanza distributed while taking another
+	ClientPrivate::Incoming *prev = d->incoming;
+	d->incoming = &in;
+	QPointer<QObject> self = this;
+	bool taken = rootTask()->take(x);
+	if(!self)
+		return;
+	d->incoming = prev;
+	if(taken)
+		return;
+	QString type = x.attribute(a.type);
+	if(type == a.getType || type == a.setType) {
 		debug("Client: Unrecognized IQ.\n");
 
 		// Create reply element
-		QDomElement reply = createIQ(doc(), "error", x.attribute("from"), x.attribute("id"));
+		QDomElement reply = createIQ(doc(), a.error, from, x.attribute(a.id));
 
 		// Copy children
 		for (QDomNode n = x.firstChild(); !n.isNull(); n = n.nextSibling()) {
@@ -572,13 +953,33 @@ void Client::distribute(const QDomElement &x)
 		reply.appendChild(error);
 
 		QDomElement error_type = doc()->createElement("feature-not-implemented");
-		error_type.setAttribute("xmlns","urn:ietf:params:xml:ns:xmpp-stanzas");
+		error_type.setAttribute(a.xmlns, a.stanzasNS);
 		error.appendChild(error_type);
 
 		send(reply);
 	}
 }
 
+Jid Client::stanzaFrom(const QDomElement &x) const
+{
+	if(d->incoming && d->incoming->e == x)
+		return d->incoming->from;
+	return Jid(x.attribute(XmlAtoms::get().from));
+}
+
+Jid Client::stanzaTo(const QDomElement &x) const
+{
+	const ClientPrivate::Incoming *in = d->incoming;
+	if(in && in->e == x) {
+		if(!in->toParsed) {
+			in->to = Jid(x.attribute(XmlAtoms::get().to));
+			in->toParsed = true;
+		}
+		return in->to;
+	}
+	return Jid(x.attribute(XmlAtoms::get().to));
+}
+
 void Client::send(const QDomElement &x)
 {
 	if(!d->stream)
@@ -599,20 +1000,170 @@ void Client::send(const QDomElement &x)
 		return;
 	}
 
-	QString out = s.toString();
-	debug(QString("Client: outgoing: [\n%1]\n").arg(out));
-	xmlOutgoing(out);
-
 	//printf("x[%s] x2[%s] s[%s]\n", Stream::xmlToString(x).toLatin1(), Stream::xmlToString(e).toLatin1(), s.toString().toLatin1());
+	send(s);
+}
+
+void Client::send(const Stanza &s)
+{
+	if(!d->stream || s.isNull())
+		return;
+
+	bool wantDebug = receivers(SIGNAL(debugText(QString))) > 0;
+	bool wantXml = receivers(SIGNAL(xmlOutgoing(QString))) > 0;
+	if(wantDebug || wantXml) {
+		QString out = s.toString();
+		if(wantDebug)
+			debug(QString("Client: outgoing: [\n%1]\n").arg(out));
+		if(wantXml)
+			xmlOutgoing(out);
+	}
+
 	d->stream->write(s);
 }
 
+StanzaTemplate Client::createTemplate(const QDomElement &x)
+{
+	if(!d->stream)
+		return StanzaTemplate();
+
+	Stanza s = d->stream->createStanza(addCorrectNS(x));
+	if(s.isNull())
+		return StanzaTemplate();
+	return d->stream->createTemplate(s);
+}
+
+void Client::send(const StanzaTemplate &t, const Jid &to, const QString &id)
+{
+	if(!d->stream || t.isNull())
+		return;
+
+	if(receivers(SIGNAL(debugText(QString))) > 0)
+		debug(QString("Client: outgoing template to %1\n").arg(to.full()));
+
+	d->stream->write(t, to, id);
+}
+
+bool Client::canSendUtf8() const
+{
+	return (d->stream && d->stream->canWriteUtf8()
+		&& receivers(SIGNAL(debugText(QString))) == 0
+		&& receivers(SIGNAL(xmlOutgoing(QString))) == 0);
+}
+
+void Client::sendUtf8(const QByteArray &stanza)
+{
+	d->stream->writeUtf8(stanza);
+}
+
+QString Client::writeScopeNS() const
+{
+	return d->stream ? d->stream->writeScopeNS() : QString();
+}
+
+void Client::sendToMany(const QDomElement &x, const QList<Jid> &to)
+{
+	if(!d->stream || to.isEmpty())
+		return;
+
+	// only messages and presences may carry addresses
+	if(to.count() == 1 || x.tagName() == "iq") {
+		fanOut(x, to, false);
+		return;
+	}
+
+	switch(d->multicast) {
+		case ClientPrivate::MulticastYes:
+			fanOut(x, to, true);
+			break;
+		case ClientPrivate::MulticastNo:
+			fanOut(x, to, false);
+			break;
+		case ClientPrivate::MulticastUnknown: {
+			d->multicast = ClientPrivate::MulticastProbing;
+			d->multicastProbe = new DiscoInfoTask(rootTask());
+			connect(d->multicastProbe, SIGNAL(finished()), SLOT(multicastProbeFinished()));
+			d->multicastProbe->get(Jid(jid().domain()));
+			d->multicastProbe->go(true);
+		}
+			// fall through
+		case ClientPrivate::MulticastProbing: {
+			ClientPrivate::FanOut f;
+			f.x = x.cloneNode(true).toElement();
+			f.to = to;
+			d->fanOutQueue += f;
+			break;
+		}
+	}
+}
+
+bool Client::serverSupportsMulticast() const
+{
+	return d->multicast == ClientPrivate::MulticastYes;
+}
+
+void Client::fanOut(const QDomElement &x, const QList<Jid> &to, bool multicast)
+{
+	if(multicast) {
+		Jid service(jid().domain());
+		for(int at = 0; at < to.count(); at += MULTICAST_MAX_ADDRESSES) {
+			Stanza s = d->stream->createStanza(addCorrectNS(x));
+			if(s.isNull())
+				return;
+
+			// bcc, so that each recipient sees only itself, as with
+			//   separate stanzas
+			QDomElement as = s.createElement(MULTICAST_NS, "addresses");
+			int end = qMin(at + MULTICAST_MAX_ADDRESSES, to.count());
+			for(int n = at; n < end; ++n)
+				as.appendChild(Address(Address::Bcc, to[n]).toXml(s));
+			s.appendChild(as);
+			s.setTo(service);
+			send(s);
+		}
+		return;
+	}
+
+	QString id = x.attribute("id");
+	StanzaTemplate t = createTemplate(x);
+	foreach(const Jid &j, to) {
+		if(!t.isNull()) {
+			send(t, j, id);
+			continue;
+		}
+
+		QDomElement e = x.cloneNode(true).toElement();
+		e.setAttribute("to", j.full());
+		send(e);
+	}
+}
+
+void Client::multicastProbeFinished()
+{
+	DiscoInfoTask *t = (DiscoInfoTask *)sender();
+	if(t != d->multicastProbe)
+		return;
+	d->multicastProbe = 0;
+
+	d->multicast = (t->success() && t->item().features().canMulticast()) ? ClientPrivate::MulticastYes : ClientPrivate::MulticastNo;
+
+	QPointer<Client> self = this;
+	QList<ClientPrivate::FanOut> queue = d->fanOutQueue;
+	d->fanOutQueue.clear();
+	foreach(const ClientPrivate::FanOut &f, queue) {
+		if(!self || !d->stream)
+			return;
+		fanOut(f.x, f.to, d->multicast == ClientPrivate::MulticastYes);
+	}
+}
+
 void Client::send(const QString &str)
 {
 	if(!d->stream)
 		return;
 
-	debug(QString("Client: outgoing: [\n%1]\n").arg(str));
+	if(receivers(SIGNAL(debugText(QString))) > 0)
+		debug(QString("Client: outgoing: [\n%1]\n").arg(str));
 	xmlOutgoing(str);
 	static_cast<ClientStream*>(d->stream)->writeDirect(str);
 }
@@ -677,51 +1228,138 @@ void Client::ppSubscription(const Jid &j, const QString &s, const QString& n)
 }
 
 void Client::ppPresence(const Jid &j, const Status &s)
+{
+	if(!d->presenceBatching) {
+		applyPresence(j, s, 0);
+		return;
+	}
+
+	if(d->presenceQueue.isEmpty())
+		QTimer::singleShot(0, this, SLOT(processPresenceBatch()));
+	d->presenceQueue += qMakePair(j, s);
+}
+
+void Client::ppOccupant(const Jid &j, bool available, const QString &show)
+{
+	QHash<QString, GroupChat>::Iterator it = d->groupChats.find(j.bare());
+	if(it == d->groupChats.end())
+		return;
+	GroupChat &i = it.value();
+	if(available)
+		i.lightOccupants.insert(j.resource(), show);
+	else if(!i.lightOccupants.remove(j.resource()))
+		return;
+
+	// a join brings in the whole room at once, so say it once
+	if(d->occupantsChanged.isEmpty())
+		QTimer::singleShot(0, this, SLOT(emitOccupantsChanged()));
+	d->occupantsChanged += j.bare();
+}
+
+void Client::emitOccupantsChanged()
+{
+	QSet<QString> rooms = d->occupantsChanged;
+	d->occupantsChanged.clear();
+
+	QPointer<QObject> self = this;
+	foreach(const QString &room, rooms) {
+		// a slot may have left the room, or deleted us
+		if(!d->groupChats.contains(room))
+			continue;
+		emit groupChatOccupantsChanged(Jid(room));
+		if(!self)
+			return;
+	}
+}
+
+void Client::setPresenceBatching(bool b)
+{
+	if(b == d->presenceBatching)
+		return;
+	d->presenceBatching = b;
+	if(!b)
+		processPresenceBatch();
+}
+
+bool Client::presenceBatching() const
+{
+	return d->presenceBatching;
+}
+
+void Client::processPresenceBatch()
+{
+	if(d->presenceQueue.isEmpty())
+		return;
+
+	QList<QPair<Jid, Status> > queue = d->presenceQueue;
+	d->presenceQueue.clear();
+
+	// only the last presence of each full jid matters.  keep those, in
+	//   the order they arrived in
+	QSet<QString> seen;
+	QList<QPair<Jid, Status> > last;
+	for(int n = queue.count() - 1; n >= 0; --n) {
+		QString key = queue[n].first.full();
+		if(seen.contains(key))
+			continue;
+		seen += key;
+		last.prepend(queue[n]);
+	}
+
+	QList<PresenceChange> changes;
+	for(int n = 0; n < last.count(); ++n)
+		applyPresence(last[n].first, last[n].second, &changes);
+
+	if(!changes.isEmpty())
+		emit presenceBatch(changes);
+}
+
+// with a batch, the presence and resource signals are collected there
+//   instead of emitted
+void Client::applyPresence(const Jid &j, const Status &s, QList<PresenceChange> *batch)
 {
 	if(s.isAvailable())
 		debug(QString("Client: %1 is available.\n").arg(j.full()));
 	else
 		debug(QString("Client: %1 is unavailable.\n").arg(j.full()));
 
-	for(QList<GroupChat>::Iterator it = d->groupChatList.begin(); it != d->groupChatList.end(); it++) {
-		GroupChat &i = *it;
-
-		if(i.j.compare(j, false)) {
-			bool us = (i.j.resource() == j.resource() || j.resource().isEmpty()) ? true: false;
-
-			debug(QString("for groupchat i=[%1] pres=[%2], [us=%3].\n").arg(i.j.full()).arg(j.full()).arg(us));
-			switch(i.status) {
-				case GroupChat::Connecting:
-					if(us && s.hasError()) {
-						Jid j = i.j;
-						d->groupChatList.erase(it);
-						groupChatError(j, s.errorCode(), s.errorString());
-					}
-					else {
-						// don't signal success unless it is a non-error presence
-						if(!s.hasError()) {
-							i.status = GroupChat::Connected;
-							groupChatJoined(i.j);
-						}
-						groupChatPresence(j, s);
+	QHash<QString, GroupChat>::Iterator it = d->groupChats.find(j.bare());
+	if(it != d->groupChats.end()) {
+		GroupChat &i = it.value();
+		bool us = (i.j.resource() == j.resource() || j.resource().isEmpty()) ? true: false;
+
+		debug(QString("for groupchat i=[%1] pres=[%2], [us=%3].\n").arg(i.j.full()).arg(j.full()).arg(us));
+		switch(i.status) {
+			case GroupChat::Connecting:
+				if(us && s.hasError()) {
+					Jid j = i.j;
+					d->groupChats.erase(it);
+					groupChatError(j, s.errorCode(), s.errorString());
+				}
+				else {
+					// don't signal success unless it is a non-error presence
+					if(!s.hasError()) {
+						i.status = GroupChat::Connected;
+						groupChatJoined(i.j);
 					}
-					break;
-				case GroupChat::Connected:
-					groupChatPresence(j, s);
-					break;
-				case GroupChat::Closing:
-					if(us && !s.isAvailable()) {
-						Jid j = i.j;
-						d->groupChatList.erase(it);
-						groupChatLeft(j);
-					}
-					break;
-				default:
-					break;
-			}
-
-			return;
+					updateOccupant(j, s, batch);
+				}
+				break;
+			case GroupChat::Connected:
+				updateOccupant(j, s, batch);
+				break;
+			case GroupChat::Closing:
+				if(us && !s.isAvailable()) {
+					Jid j = i.j;
+					d->groupChats.erase(it);
+					groupChatLeft(j);
+				}
+				break;
+			default:
+				break;
 		}
+
+		return;
 	}
 
 	if(s.hasError()) {
@@ -731,12 +1369,13 @@ void Client::ppPresence(const Jid &j, const Status &s)
 
 	// is it me?
 	if(j.compare(jid(), false)) {
-		updateSelfPresence(j, s);
+		updateSelfPresence(j, s, batch);
 	}
 	else {
 		// update all relavent roster entries
-		for(LiveRoster::Iterator it = d->roster.begin(); it != d->roster.end(); ++it) {
-			LiveRosterItem &i = *it;
+		QList<int> list = d->roster.indexesOf(j);
+		foreach(int n, list) {
+			LiveRosterItem &i = d->roster[n];
 
 			if(!i.jid().compare(j, false))
 				continue;
@@ -747,12 +1386,43 @@ void Client::ppPresence(const Jid &j, const Status &s)
 					continue;
 			}
 
-			updatePresence(&i, j, s);
+			updatePresence(&i, j, s, batch);
+		}
+	}
+}
+
+// signal an occupant presence of a joined room, and keep its occupant
+//   table up to date
+void Client::updateOccupant(const Jid &j, const Status &s, QList<PresenceChange> *batch)
+{
+	// a slot may have left the room meanwhile
+	QHash<QString, GroupChat>::Iterator it = d->groupChats.find(j.bare());
+	int change = -1; // 0 = joined, 1 = changed, 2 = left
+	if(it != d->groupChats.end() && !s.hasError() && !j.resource().isEmpty()) {
+		QHash<QString, Status> &occupants = it.value().occupants;
+		if(s.isAvailable()) {
+			change = occupants.contains(j.resource()) ? 1 : 0;
+			occupants.insert(j.resource(), s);
 		}
+		else if(occupants.remove(j.resource()))
+			change = 2;
 	}
+
+	if(batch) {
+		*batch += PresenceChange(PresenceChange::GroupChatOccupant, j, s);
+		return;
+	}
+
+	groupChatPresence(j, s);
+	if(change == 0)
+		groupChatOccupantJoined(j, s);
+	else if(change == 1)
+		groupChatOccupantChanged(j, s);
+	else if(change == 2)
+		groupChatOccupantLeft(j, s);
 }
 
-void Client::updateSelfPresence(const Jid &j, const Status &s)
+void Client::updateSelfPresence(const Jid &j, const Status &s, QList<PresenceChange> *batch)
 {
 	ResourceList::Iterator rit = d->resourceList.find(j.resource());
 	bool found = (rit == d->resourceList.end()) ? false: true;
@@ -762,7 +1432,11 @@ void Client::updateSelfPresence(const Jid &j, const Status &s)
 		if(found) {
 			debug(QString("Client: Removing self resource: name=[%1]\n").arg(j.resource()));
 			(*rit).setStatus(s);
-			resourceUnavailable(j, *rit);
+			d->resourceList.invalidatePriority();
+			if(batch)
+				*batch += PresenceChange(PresenceChange::SelfResource, j, s);
+			else
+				resourceUnavailable(j, *rit);
 			d->resourceList.erase(rit);
 		}
 	}
@@ -776,15 +1450,19 @@ void Client::updateSelfPresence(const Jid &j, const Status &s)
 		}
 		else {
 			(*rit).setStatus(s);
+			d->resourceList.invalidatePriority();
 			r = *rit;
 			debug(QString("Client: Updating self resource: name=[%1]\n").arg(j.resource()));
 		}
 
-		emit resourceAvailable(j, r);
+		if(batch)
+			*batch += PresenceChange(PresenceChange::SelfResource, j, s);
+		else
+			emit resourceAvailable(j, r);
 	}
 }
 
-void Client::updatePresence(LiveRosterItem *i, const Jid &j, const Status &s)
+void Client::updatePresence(LiveRosterItem *i, const Jid &j, const Status &s, QList<PresenceChange> *batch)
 {
 	ResourceList::Iterator rit = i->resourceList().find(j.resource());
 	bool found = (rit == i->resourceList().end()) ? false: true;
@@ -793,11 +1471,19 @@ void Client::updatePresence(LiveRosterItem *i, const Jid &j, const Status &s)
 	if(!s.isAvailable()) {
 		if(found) {
 			(*rit).setStatus(s);
+			i->resourceList().invalidatePriority();
 			debug(QString("Client: Removing resource from [%1]: name=[%2]\n").arg(i->jid().full()).arg(j.resource()));
-			resourceUnavailable(j, *rit);
+			if(batch)
+				*batch += PresenceChange(PresenceChange::RosterResource, j, s);
+			else
+				resourceUnavailable(j, *rit);
 			i->resourceList().erase(rit);
 			i->setLastUnavailableStatus(s);
 		}
+		else if(batch) {
+			*batch += PresenceChange(PresenceChange::RosterResource, j, s);
+			i->setLastUnavailableStatus(s);
+		}
 		else {
 			// create the resource just for the purpose of emit
 			Resource r = Resource(j.resource(), s);
@@ -818,11 +1504,15 @@ void Client::updatePresence(LiveRosterItem *i, const Jid &j, const Status &s)
 		}
 		else {
 			(*rit).setStatus(s);
+			i->resourceList().invalidatePriority();
 			r = *rit;
 			debug(QString("Client: Updating resource to [%1]: name=[%2]\n").arg(i->jid().full()).arg(j.resource()));
 		}
 
-		emit resourceAvailable(j, r);
+		if(batch)
+			*batch += PresenceChange(PresenceChange::RosterResource, j, s);
+		else
+			emit resourceAvailable(j, r);
 	}
 }
 
@@ -830,24 +1520,35 @@ void Client::pmMessage(const Message &m)
 {
 	debug(QString("Client: Message from %1\n").arg(m.from().full()));
 
-	if(m.type() == "groupchat") {
-		for(QList<GroupChat>::Iterator it = d->groupChatList.begin(); it != d->groupChatList.end(); it++) {
-			const GroupChat &i = *it;
+	if(fromJoinedRoom(m.from(), m.type()))
+		messageReceived(m);
+}
 
-			if(!i.j.compare(m.from(), false))
-				continue;
+// groupchat notifications only count from rooms we are in, as messages do
+bool Client::fromJoinedRoom(const Jid &from, const QString &type) const
+{
+	if(type != "groupchat")
+		return true;
+	QHash<QString, GroupChat>::ConstIterator it = d->groupChats.find(from.bare());
+	return it != d->groupChats.end() && it.value().status == GroupChat::Connected;
+}
 
-			if(i.status == GroupChat::Connected)
-				messageReceived(m);
-		}
-	}
-	else
-		messageReceived(m);
+void Client::pmChatState(const Jid &from, const QString &type, ChatState state)
+{
+	if(fromJoinedRoom(from, type))
+		chatStateReceived(from, state);
 }
 
-void Client::prRoster(const Roster &r)
+void Client::pmReceipt(const Jid &from, const QString &type, const QString &id)
+{
+	if(fromJoinedRoom(from, type))
+		receiptReceived(from, id);
+}
+
+void Client::prRoster(const Roster &r, const QString &ver)
 {
 	importRoster(r);
+	updateRosterCache(r, ver);
 }
 
 void Client::rosterRequest()
@@ -857,11 +1558,85 @@ void Client::rosterRequest()
 
 	JT_Roster *r = new JT_Roster(rootTask());
 	connect(r, SIGNAL(finished()), SLOT(slotRosterRequestFinished()));
-	r->get();
+	if(d->rosterCache && d->stream->isRosterVersioningSupported()) {
+		QString account = jid().bare();
+		if(d->cachedFor != account) {
+			d->cachedRoster.clear();
+			d->rosterVer = QString();
+			d->rosterLive = false;
+			if(!d->rosterCache->load(Jid(account), &d->cachedRoster, &d->rosterVer)) {
+				d->cachedRoster.clear();
+				d->rosterVer = QString();
+			}
+			d->cachedFor = account;
+		}
+		r->get(d->rosterVer);
+	}
+	else
+		r->get();
 	d->roster.flagAllForDelete(); // mod_groups patch
 	r->go(true);
 }
 
+void Client::setRosterCache(RosterCache *cache)
+{
+	if(d->rosterStorePending)
+		storeRosterCache();
+
+	d->rosterCache = cache;
+	d->cachedRoster.clear();
+	d->rosterVer = QString();
+	d->cachedFor = QString();
+	d->rosterLive = false;
+}
+
+RosterCache *Client::rosterCache() const
+{
+	return d->rosterCache;
+}
+
+void Client::updateRosterCache(const Roster &r, const QString &ver)
+{
+	if(d->cachedFor.isEmpty())
+		return;
+
+	for(Roster::ConstIterator it = r.begin(); it != r.end(); ++it) {
+		Roster::Iterator ci = d->cachedRoster.find((*it).jid());
+		if((*it).subscription().type() == Subscription::Remove) {
+			if(ci != d->cachedRoster.end())
+				d->cachedRoster.erase(ci);
+		}
+		else {
+			RosterItem i = *it;
+			i.setIsPush(false);
+			if(ci != d->cachedRoster.end())
+				*ci = i;
+			else
+				d->cachedRoster += i;
+		}
+	}
+	if(!ver.isEmpty())
+		d->rosterVer = ver;
+
+	// pushes tend to come in bursts, so store once they are through
+	if(!d->rosterStorePending) {
+		d->rosterStorePending = true;
+		QTimer::singleShot(0, this, SLOT(storeRosterCache()));
+	}
+}
+
+void Client::storeRosterCache()
+{
+	if(!d->rosterStorePending)
+		return;
+	d->rosterStorePending = false;
+
+	// without a version the server can't tell us what changed, so
+	//   there is no point keeping the roster
+	if(d->rosterCache && !d->cachedFor.isEmpty() && !d->rosterVer.isEmpty())
+		d->rosterCache->store(Jid(d->cachedFor), d->cachedRoster, d->rosterVer);
+}
+
 void Client::slotRosterRequestFinished()
 {
 	JT_Roster *r = (JT_Roster *)sender();
@@ -869,17 +1644,23 @@ void Client::slotRosterRequestFinished()
 	if(r->success()) {
 		//d->roster.flagAllForDelete(); // mod_groups patch
 
-		importRoster(r->roster());
-
-		for(LiveRoster::Iterator it = d->roster.begin(); it != d->roster.end();) {
-			LiveRosterItem &i = *it;
-			if(i.flagForDelete()) {
-				rosterItemRemoved(i);
-				it = d->roster.erase(it);
+		if(r->rosterUnchanged()) {
+			// the cached copy is current.  anything newer follows as pushes
+			if(d->rosterLive) {
+				for(LiveRoster::Iterator it = d->roster.begin(); it != d->roster.end(); ++it)
+					(*it).setFlagForDelete(false);
 			}
 			else
-				++it;
+				mergeRoster(d->cachedRoster);
 		}
+		else {
+			mergeRoster(r->roster());
+			if(!d->cachedFor.isEmpty()) {
+				d->cachedRoster = r->roster();
+				updateRosterCache(Roster(), r->rosterVersion());
+			}
+		}
+		d->rosterLive = !d->cachedFor.isEmpty();
 	}
 	else {
 		// don't report a disconnect.  Client::error() will do that.
@@ -900,6 +1681,73 @@ void Client::importRoster(const Roster &r)
 	emit endImportRoster();
 }
 
+static bool sameRosterItem(const RosterItem &a, const RosterItem &b)
+{
+	return a.jid().full() == b.jid().full()
+		&& a.name() == b.name()
+		&& a.groups() == b.groups()
+		&& a.subscription().type() == b.subscription().type()
+		&& a.ask() == b.ask();
+}
+
+// apply a whole roster to the live one.  items still flagged for delete
+//   afterwards weren't in it.  only what differs is signalled, and the
+//   removals are done in one pass, so that a reconnect with an unchanged
+//   roster costs a lookup per item
+void Client::mergeRoster(const Roster &r)
+{
+	QList<RosterItem> added, changed, removed;
+
+	emit beginImportRoster();
+	for(Roster::ConstIterator it = r.begin(); it != r.end(); ++it) {
+		const RosterItem &item = *it;
+		if(item.subscription().type() == Subscription::Remove)
+			continue;
+
+		LiveRoster::Iterator lit = d->roster.find(item.jid());
+		if(lit != d->roster.end()) {
+			LiveRosterItem &i = *lit;
+			i.setFlagForDelete(false);
+			if(sameRosterItem(i, item))
+				continue;
+			i.setRosterItem(item);
+			rosterItemUpdated(i);
+			changed += i;
+			debug(QString("Client: (Updated) %1\n").arg(item.jid().full()));
+		}
+		else {
+			LiveRosterItem i(item);
+			d->roster += i;
+			rosterItemAdded(i);
+			added += i;
+			debug(QString("Client: (Added)   %1\n").arg(item.jid().full()));
+		}
+	}
+
+	QList<LiveRosterItem> gone;
+	for(LiveRoster::ConstIterator it = d->roster.begin(); it != d->roster.end(); ++it) {
+		if((*it).flagForDelete())
+			gone += *it;
+	}
+	if(!gone.isEmpty()) {
+		LiveRoster kept;
+		for(LiveRoster::ConstIterator it = d->roster.begin(); it != d->roster.end(); ++it) {
+			if(!(*it).flagForDelete())
+				kept += *it;
+		}
+		d->roster = kept;
+		foreach(const LiveRosterItem &i, gone) {
+			rosterItemRemoved(i);
+			removed += i;
+			debug(QString("Client: (Removed) %1\n").arg(i.jid().full()));
+		}
+	}
+	emit endImportRoster();
+
+	if(!added.isEmpty() || !changed.isEmpty() || !removed.isEmpty())
+		emit rosterMerged(added, changed, removed);
+}
+
 void Client::importRosterItem(const RosterItem &item)
 {
 	QString substr;
@@ -1039,6 +1887,7 @@ QString Client::capsExt() const
 void Client::setOSName(const QString &name)
 {
 	d->osname = name;
+	selfInfoUpdated();
 }
 
 void Client::setTimeZone(const QString &name, int offset)
@@ -1051,21 +1900,25 @@ void Client::setTimeZone(const QString &name, int offset)
 void Client::setClientName(const QString &s)
 {
 	d->clientName = s;
+	selfInfoUpdated();
 }
 
 void Client::setClientVersion(const QString &s)
 {
 	d->clientVersion = s;
+	selfInfoUpdated();
 }
 
 void Client::setCapsNode(const QString &s)
 {
 	d->capsNode = s;
+	selfInfoUpdated();
 }
 
 void Client::setCapsVersion(const QString &s)
 {
 	d->capsVersion = s;
+	selfInfoUpdated();
 }
 
 DiscoItem::Identity Client::identity()
@@ -1076,11 +1929,13 @@ DiscoItem::Identity Client::identity()
 void Client::setIdentity(DiscoItem::Identity identity)
 {
 	d->identity = identity;
+	selfInfoUpdated();
 }
 
 void Client::setFeatures(const Features& f)
 {
 	d->features = f;
+	selfInfoUpdated();
 }
 
 const Features& Client::features() const
@@ -1093,6 +1948,7 @@ void Client::addExtension(const QString& ext, const Features& features)
 	if (!ext.isEmpty()) {
 		d->extension_features[ext] = features;
 		d->capsExt = extensions().join(" ");
+		selfInfoUpdated();
 	}
 }
 
@@ -1101,6 +1957,7 @@ void Client::removeExtension(const QString& ext)
 	if (d->extension_features.contains(ext)) {
 		d->extension_features.remove(ext);
 		d->capsExt = extensions().join(" ");
+		selfInfoUpdated();
 	}
 }
 
@@ -1114,6 +1971,103 @@ const Features& Client::extension(const QString& ext) const
 	return d->extension_features[ext];
 }
 
+QDomElement Client::selfDiscoInfo(const QString &node) const
+{
+	QDomDocument *doc = &d->doc;
+	QDomElement query = doc->createElement("query");
+	query.setAttribute("xmlns", "http://jabber.org/protocol/disco#info");
+	if (!node.isEmpty())
+		query.setAttribute("node", node);
+
+	// Identity
+	QDomElement id = doc->createElement("identity");
+	if (!d->identity.category.isEmpty() && !d->identity.type.isEmpty()) {
+		id.setAttribute("category",d->identity.category);
+		id.setAttribute("type",d->identity.type);
+		if (!d->identity.name.isEmpty()) {
+			id.setAttribute("name",d->identity.name);
+		}
+	}
+	else {
+		// Default values
+		id.setAttribute("category","client");
+		id.setAttribute("type","pc");
+	}
+	query.appendChild(id);
+
+	QDomElement feature;
+	if (node.isEmpty() || node == d->capsNode + "#" + d->capsVersion) {
+		// Standard features
+		feature = doc->createElement("feature");
+		feature.setAttribute("var", "http://jabber.org/protocol/bytestreams");
+		query.appendChild(feature);
+
+		feature = doc->createElement("feature");
+		feature.setAttribute("var", "http://jabber.org/protocol/si");
+		query.appendChild(feature);
+
+		feature = doc->createElement("feature");
+		feature.setAttribute("var", "http://jabber.org/protocol/si/profile/file-transfer");
+		query.appendChild(feature);
+
+		feature = doc->createElement("feature");
+		feature.setAttribute("var", "http://jabber.org/protocol/disco#info");
+		query.appendChild(feature);
+
+		// Client-specific features
+		QStringList clientFeatures = d->features.list();
+		for (QStringList::ConstIterator i = clientFeatures.begin(); i != clientFeatures.end(); ++i) {
+			feature = doc->createElement("feature");
+			feature.setAttribute("var", *i);
+			query.appendChild(feature);
+		}
+
+		if (node.isEmpty()) {
+			// Extended features
+			for (QMap<QString,Features>::ConstIterator i = d->extension_features.begin(); i != d->extension_features.end(); ++i) {
+				const QStringList& l = i.value().list();
+				for ( QStringList::ConstIterator j = l.begin(); j != l.end(); ++j ) {
+					feature = doc->createElement("feature");
+					feature.setAttribute("var", *j);
+					query.appendChild(feature);
+				}
+			}
+		}
+	}
+	else if (node.startsWith(d->capsNode + "#")) {
+		QString ext = node.right(node.length()-d->capsNode.length()-1);
+		if (!d->extension_features.contains(ext))
+			return QDomElement();
+
+		const QStringList& l = d->extension_features[ext].list();
+		for ( QStringList::ConstIterator it = l.begin(); it != l.end(); ++it ) {
+			feature = doc->createElement("feature");
+			feature.setAttribute("var", *it);
+			query.appendChild(feature);
+		}
+	}
+	else {
+		return QDomElement();
+	}
+
+	return query;
+}
+
+QString Client::capsVer() const
+{
+	if(!d->capsVerKnown) {
+		d->capsVer = CapsCache::computeVer(selfDiscoInfo(d->capsNode + "#" + d->capsVersion), "sha-1");
+		d->capsVerKnown = true;
+	}
+	return d->capsVer;
+}
+
+void Client::selfInfoUpdated()
+{
+	d->capsVerKnown = false;
+	emit selfInfoChanged();
+}
+
 void Client::s5b_incomingReady()
 {
 	S5BConnection *c = d->s5bman->takeIncoming();
@@ -1138,77 +2092,93 @@ void Client::ibb_incomingReady()
 //---------------------------------------------------------------------------
 // LiveRosterItem
 //---------------------------------------------------------------------------
+class LiveRosterItem::Private : public QSharedData
+{
+public:
+	Private() : flagForDelete(false) {}
+
+	ResourceList resourceList;
+	Status lastUnavailableStatus;
+	bool flagForDelete;
+};
+
 LiveRosterItem::LiveRosterItem(const Jid &jid)
-:RosterItem(jid)
+:RosterItem(jid), d(new Private)
 {
-	setFlagForDelete(false);
 }
 
 LiveRosterItem::LiveRosterItem(const RosterItem &i)
+:RosterItem(i), d(new Private)
+{
+}
+
+LiveRosterItem::LiveRosterItem(const LiveRosterItem &from)
+:RosterItem(from), d(from.d)
 {
-	setRosterItem(i);
-	setFlagForDelete(false);
 }
 
 LiveRosterItem::~LiveRosterItem()
 {
 }
 
+LiveRosterItem & LiveRosterItem::operator=(const LiveRosterItem &from)
+{
+	RosterItem::operator=(from);
+	d = from.d;
+	return *this;
+}
+
 void LiveRosterItem::setRosterItem(const RosterItem &i)
 {
-	setJid(i.jid());
-	setName(i.name());
-	setGroups(i.groups());
-	setSubscription(i.subscription());
-	setAsk(i.ask());
-	setIsPush(i.isPush());
+	// keeps the resources, and shares the roster data with i
+	RosterItem::operator=(i);
 }
 
 ResourceList & LiveRosterItem::resourceList()
 {
-	return v_resourceList;
+	return d->resourceList;
 }
 
 ResourceList::Iterator LiveRosterItem::priority()
 {
-	return v_resourceList.priority();
+	return d->resourceList.priority();
 }
 
 const ResourceList & LiveRosterItem::resourceList() const
 {
-	return v_resourceList;
+	return d->resourceList;
 }
 
 ResourceList::ConstIterator LiveRosterItem::priority() const
 {
-	return v_resourceList.priority();
+	return d->resourceList.priority();
 }
 
 bool LiveRosterItem::isAvailable() const
 {
-	if(v_resourceList.count() > 0)
+	if(d->resourceList.count() > 0)
 		return true;
 	return false;
 }
 
 const Status & LiveRosterItem::lastUnavailableStatus() const
 {
-	return v_lastUnavailableStatus;
+	return d->lastUnavailableStatus;
 }
 
 bool LiveRosterItem::flagForDelete() const
 {
-	return v_flagForDelete;
+	return d->flagForDelete;
 }
 
 void LiveRosterItem::setLastUnavailableStatus(const Status &s)
 {
-	v_lastUnavailableStatus = s;
+	d->lastUnavailableStatus = s;
 }
 
 void LiveRosterItem::setFlagForDelete(bool b)
 {
-	v_flagForDelete = b;
+	d->flagForDelete = b;
 }
 
 //---------------------------------------------------------------------------
@@ -1217,6 +2187,7 @@ void LiveRosterItem::setFlagForDelete(bool b)
 LiveRoster::LiveRoster()
 :QList<LiveRosterItem>()
 {
+	v_indexed = 0;
 }
 
 LiveRoster::~LiveRoster()
@@ -1229,24 +2200,87 @@ void LiveRoster::flagAllForDelete()
 		(*it).setFlagForDelete(true);
 }
 
-LiveRoster::Iterator LiveRoster::find(const Jid &j, bool compareRes)
+void LiveRoster::ensureIndex() const
 {
-	Iterator it;
-	for(it = begin(); it != end(); ++it) {
-		if((*it).jid().compare(j, compareRes))
-			break;
+	if(v_indexed == count())
+		return;
+
+	v_index.clear();
+	for(int n = 0; n < count(); ++n)
+		v_index.insert(at(n).jid().bare(), n);
+	v_indexed = count();
+}
+
+int LiveRoster::findIndex(const Jid &j, bool compareRes) const
+{
+	ensureIndex();
+
+	// several items may share a bare jid, so return the first match
+	//   in list order, like a linear search would
+	int found = -1;
+	QMultiHash<QString,int>::ConstIterator it = v_index.constFind(j.bare());
+	for(; it != v_index.constEnd() && it.key() == j.bare(); ++it) {
+		int n = it.value();
+		if((found == -1 || n < found) && at(n).jid().compare(j, compareRes))
+			found = n;
 	}
-	return it;
+	return found;
+}
+
+LiveRoster::Iterator LiveRoster::find(const Jid &j, bool compareRes)
+{
+	int n = findIndex(j, compareRes);
+	if(n == -1)
+		return end();
+	return begin() + n;
 }
 
 LiveRoster::ConstIterator LiveRoster::find(const Jid &j, bool compareRes) const
 {
-	ConstIterator it;
-	for(it = begin(); it != end(); ++it) {
-		if((*it).jid().compare(j, compareRes))
-			break;
-	}
-	return it;
+	int n = findIndex(j, compareRes);
+	if(n == -1)
+		return end();
+	return begin() + n;
+}
+
+/**
+ * \brief Returns the positions of all items with the bare jid of \a j,
+ * in ascending order.
+ */
+QList<int> LiveRoster::indexesOf(const Jid &j) const
+{
+	ensureIndex();
+	QList<int> list = v_index.values(j.bare());
+	qSort(list);
+	return list;
+}
+
+void LiveRoster::append(const LiveRosterItem &i)
+{
+	ensureIndex();
+	QList<LiveRosterItem>::append(i);
+	v_index.insert(i.jid().bare(), count() - 1);
+	v_indexed = count();
+}
+
+LiveRoster & LiveRoster::operator+=(const LiveRosterItem &i)
+{
+	append(i);
+	return *this;
+}
+
+LiveRoster::Iterator LiveRoster::erase(LiveRoster::Iterator it)
+{
+	// positions shift, so reindex on the next lookup
+	v_indexed = -1;
+	return QList<LiveRosterItem>::erase(it);
+}
+
+void LiveRoster::clear()
+{
+	QList<LiveRosterItem>::clear();
+	v_index.clear();
+	v_indexed = 0;
 }
 
 }
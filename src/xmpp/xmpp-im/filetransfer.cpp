@@ -24,13 +24,96 @@
 #include <qtimer.h>
 #include <qpointer.h>
 #include <qfileinfo.h>
+#include <QFile>
+#include <QtCrypto>
 #include "xmpp_xmlcommon.h"
+#include "xmpp/base64/base64.h"
 #include "s5b.h"
 
 #define SENDBUFSIZE 65536
+#define READBLOCKSIZE 16384
+
+// between a broken stream and offering the file again
+#define RESUME_DELAY 3000
+
+// how long a receiver waits for a hash to follow the data
+#define CHECKSUM_TIMEOUT 30000
+
+#define NS_HASHES "urn:xmpp:hashes:2"
+#define NS_JINGLE_FT "urn:xmpp:jingle:apps:file-transfer:5"
 
 using namespace XMPP;
 
+// the hash algorithms of XEP-0300 that we can check, weakest first, and
+//   their names in QCA.  md5 is what the hash attribute of XEP-0096
+//   carries.
+static const char *hashAlgos[][2] =
+{
+	{ "md5", "md5" },
+	{ "sha-1", "sha1" },
+	{ "sha-256", "sha256" },
+	{ "sha-512", "sha512" },
+	{ 0, 0 }
+};
+
+static int hashAlgoIndex(const QString &algo)
+{
+	for(int n = 0; hashAlgos[n][0]; ++n) {
+		if(algo == QLatin1String(hashAlgos[n][0]))
+			return QCA::isSupported(hashAlgos[n][1]) ? n : -1;
+	}
+	return -1;
+}
+
+static QDomElement hashElement(QDomDocument *doc, const QString &algo, const QByteArray &hash)
+{
+	QDomElement e;
+	if(hash.isEmpty())
+		e = doc->createElement("hash-used");
+	else {
+		e = doc->createElement("hash");
+		e.appendChild(doc->createTextNode(Base64::encode(hash)));
+	}
+	e.setAttribute("xmlns", NS_HASHES);
+	e.setAttribute("algo", algo);
+	return e;
+}
+
+// the strongest hash under 'file' we can check.  false if there is none.
+static bool readHash(const QDomElement &file, QString *algo, QByteArray *hash)
+{
+	int best = -1;
+	for(QDomNode n = file.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		QDomElement e = n.toElement();
+		if(e.isNull() || e.attribute("xmlns") != NS_HASHES)
+			continue;
+		if(e.tagName() != "hash" && e.tagName() != "hash-used")
+			continue;
+		int at = hashAlgoIndex(e.attribute("algo"));
+		if(at <= best)
+			continue;
+		QByteArray h;
+		if(e.tagName() == "hash") {
+			h = Base64::decode(e.text().trimmed());
+			if(h.isEmpty())
+				continue;
+		}
+		best = at;
+		*algo = hashAlgos[at][0];
+		*hash = h;
+	}
+
+	if(best == -1 && file.hasAttribute("hash") && hashAlgoIndex("md5") != -1) {
+		QByteArray h = QByteArray::fromHex(file.attribute("hash").toLatin1());
+		if(h.size() == 16) {
+			best = 0;
+			*algo = "md5";
+			*hash = h;
+		}
+	}
+	return best != -1;
+}
+
 // firstChildElement
 //
 // Get an element's first child element
@@ -65,6 +148,26 @@ public:
 	Jid proxy;
 	int state;
 	bool sender;
+	QPointer<QIODevice> dev;
+	uchar *map;
+	qlonglong readPos;
+	bool zeroCopy; // the socket sends the file by itself
+
+	// see setAutoResume().  rangeEnd is where the range asked for ends.
+	bool autoResume, resuming;
+	int resumeTries, resumeLeft;
+	qlonglong rangeEnd;
+	QTimer *resumeTimer;
+
+	// see setHash().  hashAlgo and hash are the sender's, hasher runs
+	//   over the data as it passes, having taken in the first hashPos
+	//   bytes of the file.
+	QString hashAlgo, computeAlgo;
+	QByteArray hash, digest;
+	QCA::Hash *hasher;
+	qlonglong hashPos;
+	int hashResult;
+	QTimer *checksumTimer;
 };
 
 FileTransfer::FileTransfer(FileTransferManager *m, QObject *parent)
@@ -74,6 +177,18 @@ FileTransfer::FileTransfer(FileTransferManager *m, QObject *parent)
 	d->m = m;
 	d->ft = 0;
 	d->c = 0;
+	d->map = 0;
+	d->zeroCopy = false;
+	d->autoResume = false;
+	d->resumeTries = 0;
+	d->resumeTimer = new QTimer(this);
+	d->resumeTimer->setSingleShot(true);
+	connect(d->resumeTimer, SIGNAL(timeout()), SLOT(doResume()));
+	d->hasher = 0;
+	d->hashResult = HashUnknown;
+	d->checksumTimer = new QTimer(this);
+	d->checksumTimer->setSingleShot(true);
+	connect(d->checksumTimer, SIGNAL(timeout()), SLOT(checksum_timeout()));
 	reset();
 }
 
@@ -85,6 +200,15 @@ FileTransfer::FileTransfer(const FileTransfer& other)
 	d->m = other.d->m;
 	d->ft = 0;
 	d->c = 0;
+	d->dev = 0;
+	d->map = 0;
+	d->resumeTimer = new QTimer(this);
+	d->resumeTimer->setSingleShot(true);
+	connect(d->resumeTimer, SIGNAL(timeout()), SLOT(doResume()));
+	d->hasher = 0;
+	d->checksumTimer = new QTimer(this);
+	d->checksumTimer->setSingleShot(true);
+	connect(d->checksumTimer, SIGNAL(timeout()), SLOT(checksum_timeout()));
 	reset();
 
 	if (d->m->isActive(&other))
@@ -103,6 +227,25 @@ FileTransfer *FileTransfer::copy() const
 }
 
 void FileTransfer::reset()
+{
+	dropConnection();
+	d->resumeTimer->stop();
+	d->checksumTimer->stop();
+	d->dev = 0;
+	delete d->hasher;
+	d->hasher = 0;
+	d->hashPos = 0;
+
+	d->state = Idle;
+	d->needStream = false;
+	d->sent = 0;
+	d->sender = false;
+	d->resuming = false;
+	d->resumeLeft = d->resumeTries;
+}
+
+// everything that goes with one stream, leaving what is known of the file
+void FileTransfer::dropConnection()
 {
 	d->m->unlink(this);
 
@@ -112,10 +255,63 @@ void FileTransfer::reset()
 	delete d->c;
 	d->c = 0;
 
-	d->state = Idle;
+	// only after the connection is gone, it may still hold mapped blocks
+#if QT_VERSION >= 0x040400
+	if(d->map) {
+		QFile *f = qobject_cast<QFile*>(d->dev);
+		if(f)
+			f->unmap(d->map);
+	}
+#endif
+	d->map = 0;
+	d->zeroCopy = false;
+	if(d->dev)
+		disconnect(d->dev, 0, this, 0);
+	d->readPos = 0;
 	d->needStream = false;
-	d->sent = 0;
-	d->sender = false;
+}
+
+void FileTransfer::setAutoResume(bool enabled, int tries)
+{
+	d->autoResume = enabled;
+	d->resumeTries = tries;
+	d->resumeLeft = tries;
+}
+
+// keep the transfer for a resume, if it may be.  true if it was kept.
+bool FileTransfer::interrupt()
+{
+	if(!d->autoResume || d->state != Active)
+		return false;
+	if(d->sender) {
+		// a stream can't be rewound to where the receiver got to
+		if(d->resumeLeft <= 0 || (d->dev && d->dev->isSequential()))
+			return false;
+	}
+	else if(!d->rangeSupported)
+		return false;
+
+	dropConnection();
+	d->state = Interrupted;
+	if(d->sender) {
+		--d->resumeLeft;
+		d->resumeTimer->start(RESUME_DELAY);
+	}
+	else {
+		// what arrived so far counts as the start of the range from now on
+		d->rangeOffset += d->sent;
+		d->sent = 0;
+		d->m->keepResumable(this);
+	}
+	interrupted();
+	return true;
+}
+
+void FileTransfer::doResume()
+{
+	d->resuming = true;
+	d->state = Requesting;
+	request();
 }
 
 void FileTransfer::setProxy(const Jid &proxy)
@@ -131,16 +327,146 @@ void FileTransfer::sendFile(const Jid &to, const QString &fname, qlonglong size,
 	d->size = size;
 	d->desc = desc;
 	d->sender = true;
+	if(d->hash.isEmpty() && !d->computeAlgo.isEmpty()) {
+		d->hashAlgo = d->computeAlgo;
+		startHash();
+	}
+	request();
+}
+
+void FileTransfer::request()
+{
 	d->id = d->m->link(this);
 
 	d->ft = new JT_FT(d->m->client()->rootTask());
 	connect(d->ft, SIGNAL(finished()), SLOT(ft_finished()));
 	QStringList list;
 	list += "http://jabber.org/protocol/bytestreams";
-	d->ft->request(to, d->id, fname, size, desc, list);
+	d->ft->request(d->peer, d->id, d->fname, d->size, d->desc, list, d->hashAlgo, d->hash);
 	d->ft->go(true);
 }
 
+void FileTransfer::setHash(const QString &algo, const QByteArray &hash)
+{
+	d->hashAlgo = algo;
+	d->hash = hash;
+}
+
+void FileTransfer::setComputeHash(const QString &algo)
+{
+	d->computeAlgo = algo;
+}
+
+QString FileTransfer::hashAlgorithm() const
+{
+	return d->hashAlgo;
+}
+
+QByteArray FileTransfer::hash() const
+{
+	return d->hash;
+}
+
+int FileTransfer::hashResult() const
+{
+	return d->hashResult;
+}
+
+void FileTransfer::startHash()
+{
+	delete d->hasher;
+	d->hasher = 0;
+	d->hashPos = 0;
+	d->digest.clear();
+	d->hashResult = HashUnknown;
+
+	int at = hashAlgoIndex(d->hashAlgo);
+	if(at != -1)
+		d->hasher = new QCA::Hash(hashAlgos[at][1]);
+}
+
+// take in data at 'pos' in the file.  what was hashed already, as when
+//   a resume goes back a little, is skipped.  past a gap the hash can't
+//   be had any more.
+void FileTransfer::feedHash(qlonglong pos, const QByteArray &a)
+{
+	if(!d->hasher)
+		return;
+	if(pos > d->hashPos) {
+		delete d->hasher;
+		d->hasher = 0;
+		return;
+	}
+
+	qlonglong end = pos + a.size();
+	if(end <= d->hashPos)
+		return;
+	int skip = (int)(d->hashPos - pos);
+	if(skip == 0)
+		d->hasher->update(a);
+	else
+		d->hasher->update(QByteArray::fromRawData(a.data() + skip, a.size() - skip));
+	d->hashPos = end;
+}
+
+// the hash of the file, if all of it went by
+QByteArray FileTransfer::takeDigest()
+{
+	QByteArray digest;
+	if(d->hasher && d->hashPos == d->size)
+		digest = d->hasher->final().toByteArray();
+	delete d->hasher;
+	d->hasher = 0;
+	return digest;
+}
+
+void FileTransfer::sendChecksum()
+{
+	if(!d->hash.isEmpty())
+		return;
+	QByteArray digest = takeDigest();
+	if(digest.isEmpty())
+		return;
+
+	d->hash = digest;
+	JT_FTChecksum *t = new JT_FTChecksum(d->m->client()->rootTask());
+	t->request(d->peer, d->id, d->hashAlgo, d->hash);
+	t->go(true);
+}
+
+// the data is all in, with 'digest' its hash
+void FileTransfer::checkHash(const QByteArray &digest)
+{
+	d->digest = digest;
+	if(d->hash.isEmpty()) {
+		// the sender's is yet to come
+		d->m->awaitChecksum(this);
+		d->checksumTimer->start(CHECKSUM_TIMEOUT);
+		return;
+	}
+
+	d->m->unlink(this);
+	d->hashResult = (d->digest == d->hash) ? HashVerified : HashFailed;
+	hashChecked(d->hashResult);
+}
+
+void FileTransfer::man_checksum(const QString &algo, const QByteArray &hash)
+{
+	if(algo != d->hashAlgo || !d->hash.isEmpty())
+		return;
+	d->hash = hash;
+	if(!d->digest.isEmpty()) {
+		d->checksumTimer->stop();
+		checkHash(d->digest);
+	}
+}
+
+void FileTransfer::checksum_timeout()
+{
+	d->m->unlink(this);
+	hashChecked(HashUnknown);
+}
+
 int FileTransfer::dataSizeNeeded() const
 {
 	int pending = d->c->bytesToWrite();
@@ -167,9 +493,84 @@ void FileTransfer::writeFileData(const QByteArray &a)
 	}
 	else
 		block = a;
+	feedHash(d->rangeOffset + d->sent + pending, block);
 	d->c->write(block);
 }
 
+void FileTransfer::setSource(QIODevice *dev)
+{
+	d->dev = dev;
+}
+
+void FileTransfer::setSink(QIODevice *dev)
+{
+	d->dev = dev;
+}
+
+void FileTransfer::startSource()
+{
+	d->readPos = 0;
+	d->zeroCopy = false;
+
+	// a plain file can go from the kernel straight to the socket, and
+	//   failing that be mapped
+	QFile *f = qobject_cast<QFile*>(d->dev);
+	if(f && f->handle() != -1 && d->length > 0 && !d->hasher && d->c->sendFile(f->handle(), d->rangeOffset, d->length)) {
+		d->zeroCopy = true;
+		return;
+	}
+
+#if QT_VERSION >= 0x040400
+	// a plain file can be mapped and sent without copying it through
+	//   read buffers.  this fails for huge files on 32-bit, so fall back.
+	if(f && d->length > 0)
+		d->map = f->map(d->rangeOffset, d->length);
+#endif
+
+	if(!d->map) {
+		if(!d->dev->isSequential())
+			d->dev->seek(d->rangeOffset);
+		connect(d->dev, SIGNAL(readyRead()), SLOT(dev_readyRead()));
+	}
+
+	pumpSource();
+}
+
+void FileTransfer::pumpSource()
+{
+	// keep the outgoing buffer topped up to SENDBUFSIZE
+	while(d->c && d->dev && d->state == Active && !d->zeroCopy) {
+		int size = dataSizeNeeded();
+		if(size <= 0)
+			return;
+		if(size > READBLOCKSIZE)
+			size = READBLOCKSIZE;
+
+		QByteArray block;
+		if(d->map)
+			block = QByteArray::fromRawData((const char *)d->map + d->readPos, size);
+		else
+			block = d->dev->read(size);
+
+		if(block.isEmpty()) {
+			// sequential devices tell us with readyRead() when there is more
+			if(d->dev->isSequential() && !d->dev->atEnd())
+				return;
+			reset();
+			error(ErrDevice);
+			return;
+		}
+
+		d->readPos += block.size();
+		writeFileData(block);
+	}
+}
+
+void FileTransfer::dev_readyRead()
+{
+	pumpSource();
+}
+
 Jid FileTransfer::peer() const
 {
 	return d->peer;
@@ -208,12 +609,15 @@ qlonglong FileTransfer::length() const
 void FileTransfer::accept(qlonglong offset, qlonglong length)
 {
 	d->state = Connecting;
+	if(!d->resuming)
+		startHash();
 	d->rangeOffset = offset;
 	d->rangeLength = length;
 	if(length > 0)
 		d->length = length;
 	else
-		d->length = d->size;
+		d->length = d->size - offset;
+	d->rangeEnd = offset + d->length;
 	d->streamType = "http://jabber.org/protocol/bytestreams";
 	d->m->con_accept(this);
 }
@@ -245,6 +649,7 @@ void FileTransfer::ft_finished()
 		d->length = ft->rangeLength();
 		if(d->length == 0)
 			d->length = d->size - d->rangeOffset;
+		d->sent = 0;
 		d->streamType = ft->streamType();
 		d->c = d->m->client()->s5bManager()->createConnection();
 		connect(d->c, SIGNAL(connected()), SLOT(s5b_connected()));
@@ -284,11 +689,24 @@ void FileTransfer::takeConnection(S5BConnection *c)
 void FileTransfer::s5b_connected()
 {
 	d->state = Active;
-	connected();
+	QPointer<QObject> self = this;
+	if(d->resuming) {
+		d->resuming = false;
+		resumed(d->rangeOffset);
+	}
+	else
+		connected();
+	if(!self)
+		return;
+
+	if(d->sender && d->dev && d->state == Active)
+		startSource();
 }
 
 void FileTransfer::s5b_connectionClosed()
 {
+	if(interrupt())
+		return;
 	reset();
 	error(ErrStream);
 }
@@ -299,22 +717,55 @@ void FileTransfer::s5b_readyRead()
 	qlonglong need = d->length - d->sent;
 	if((qlonglong)a.size() > need)
 		a.resize((uint)need);
+	bool toDevice = !d->dev.isNull();
+	if(toDevice && d->dev->write(a) != a.size()) {
+		reset();
+		error(ErrDevice);
+		return;
+	}
+
+	feedHash(d->rangeOffset + d->sent, a);
 	d->sent += a.size();
-	if(d->sent == d->length)
+	QByteArray digest;
+	bool done = (d->sent == d->length);
+	if(done) {
+		digest = takeDigest();
 		reset();
-	readyRead(a);
+	}
+
+	QPointer<QObject> self = this;
+	if(toDevice)
+		bytesWritten(a.size());
+	else
+		readyRead(a);
+	if(!self || !done)
+		return;
+
+	if(!digest.isEmpty())
+		checkHash(digest);
+	else if(!d->hashAlgo.isEmpty())
+		hashChecked(HashUnknown);
 }
 
 void FileTransfer::s5b_bytesWritten(int x)
 {
 	d->sent += x;
-	if(d->sent == d->length)
+	if(d->sent == d->length) {
+		sendChecksum();
 		reset();
+	}
+	QPointer<QObject> self = this;
 	bytesWritten(x);
+	if(!self)
+		return;
+
+	pumpSource();
 }
 
 void FileTransfer::s5b_error(int x)
 {
+	if(interrupt())
+		return;
 	reset();
 	if(x == S5BConnection::ErrRefused || x == S5BConnection::ErrConnect)
 		error(ErrConnect);
@@ -334,6 +785,25 @@ void FileTransfer::man_waitForAccept(const FTRequest &req)
 	d->size = req.size;
 	d->desc = req.desc;
 	d->rangeSupported = req.rangeSupported;
+	d->hashAlgo = req.hashAlgo;
+	d->hash = req.hash;
+}
+
+// the sender offering this file again after the stream broke.  ask for
+//   the part not received yet.
+bool FileTransfer::man_resume(const FTRequest &req)
+{
+	if(!req.rangeSupported)
+		return false;
+
+	d->resumeTimer->stop();
+	d->resuming = true;
+	d->peer = req.from;
+	d->id = req.id;
+	d->iq_id = req.iq_id;
+	d->rangeSupported = true;
+	accept(d->rangeOffset, d->rangeEnd - d->rangeOffset);
+	return true;
 }
 
 void FileTransfer::doAccept()
@@ -349,6 +819,8 @@ class FileTransferManager::Private
 public:
 	Client *client;
 	QList<FileTransfer*> list, incoming;
+	QList<FileTransfer*> resumable; // interrupted incoming, see FileTransfer::setAutoResume()
+	QList<FileTransfer*> checking; // received, waiting for the sender's hash
 	JT_PushFT *pft;
 };
 
@@ -360,6 +832,7 @@ FileTransferManager::FileTransferManager(Client *client)
 
 	d->pft = new JT_PushFT(d->client->rootTask());
 	connect(d->pft, SIGNAL(incoming(const FTRequest &)), SLOT(pft_incoming(const FTRequest &)));
+	connect(d->pft, SIGNAL(checksum(const XMPP::Jid &, const QString &, const QString &, const QString &, const QByteArray &)), SLOT(pft_checksum(const XMPP::Jid &, const QString &, const QString &, const QString &, const QByteArray &)));
 }
 
 FileTransferManager::~FileTransferManager()
@@ -417,12 +890,39 @@ void FileTransferManager::pft_incoming(const FTRequest &req)
 		return;
 	}
 
+	// the rest of a transfer that broke off
+	foreach(FileTransfer *i, d->resumable) {
+		if(i->d->peer.compare(req.from, false) && i->d->fname == req.fname && i->d->size == req.size) {
+			d->resumable.removeAll(i);
+			d->list.append(i);
+			if(i->man_resume(req))
+				return;
+			d->list.removeAll(i);
+			d->resumable.append(i);
+			break;
+		}
+	}
+
 	FileTransfer *ft = new FileTransfer(this);
 	ft->man_waitForAccept(req);
 	d->incoming.append(ft);
 	incomingReady();
 }
 
+// the hash may come in before the last of the data has been read
+void FileTransferManager::pft_checksum(const Jid &from, const QString &iq_id, const QString &sid, const QString &algo, const QByteArray &hash)
+{
+	QList<FileTransfer*> all = d->checking + d->list;
+	foreach(FileTransfer *i, all) {
+		if(!i->d->sender && i->d->peer.compare(from) && i->d->id == sid) {
+			d->pft->respondChecksum(from, iq_id, true);
+			i->man_checksum(algo, hash);
+			return;
+		}
+	}
+	d->pft->respondChecksum(from, iq_id, false);
+}
+
 void FileTransferManager::s5b_incomingReady(S5BConnection *c)
 {
 	FileTransfer *ft = 0;
@@ -460,6 +960,20 @@ void FileTransferManager::con_reject(FileTransfer *ft)
 void FileTransferManager::unlink(FileTransfer *ft)
 {
 	d->list.removeAll(ft);
+	d->resumable.removeAll(ft);
+	d->checking.removeAll(ft);
+}
+
+void FileTransferManager::keepResumable(FileTransfer *ft)
+{
+	if(!d->resumable.contains(ft))
+		d->resumable.append(ft);
+}
+
+void FileTransferManager::awaitChecksum(FileTransfer *ft)
+{
+	if(!d->checking.contains(ft))
+		d->checking.append(ft);
 }
 
 //----------------------------------------------------------------------------
@@ -486,7 +1000,7 @@ JT_FT::~JT_FT()
 	delete d;
 }
 
-void JT_FT::request(const Jid &to, const QString &_id, const QString &fname, qlonglong size, const QString &desc, const QStringList &streamTypes)
+void JT_FT::request(const Jid &to, const QString &_id, const QString &fname, qlonglong size, const QString &desc, const QStringList &streamTypes, const QString &hashAlgo, const QByteArray &hash)
 {
 	QDomElement iq;
 	d->to = to;
@@ -507,6 +1021,8 @@ void JT_FT::request(const Jid &to, const QString &_id, const QString &fname, qlo
 	}
 	QDomElement range = doc()->createElement("range");
 	file.appendChild(range);
+	if(!hashAlgo.isEmpty())
+		file.appendChild(hashElement(doc(), hashAlgo, hash));
 	si.appendChild(file);
 
 	QDomElement feature = doc()->createElement("feature");
@@ -641,6 +1157,48 @@ bool JT_FT::take(const QDomElement &x)
 	return true;
 }
 
+//----------------------------------------------------------------------------
+// JT_FTChecksum
+//----------------------------------------------------------------------------
+JT_FTChecksum::JT_FTChecksum(Task *parent)
+:Task(parent)
+{
+}
+
+JT_FTChecksum::~JT_FTChecksum()
+{
+}
+
+void JT_FTChecksum::request(const Jid &_to, const QString &_id, const QString &hashAlgo, const QByteArray &hash)
+{
+	to = _to;
+	iq = createIQ(doc(), "set", to.full(), id());
+	QDomElement checksum = doc()->createElement("checksum");
+	checksum.setAttribute("xmlns", NS_JINGLE_FT);
+	checksum.setAttribute("sid", _id);
+	QDomElement file = doc()->createElement("file");
+	file.appendChild(hashElement(doc(), hashAlgo, hash));
+	checksum.appendChild(file);
+	iq.appendChild(checksum);
+}
+
+void JT_FTChecksum::onGo()
+{
+	send(iq);
+}
+
+bool JT_FTChecksum::take(const QDomElement &x)
+{
+	if(!iqVerify(x, to, id()))
+		return false;
+
+	if(x.attribute("type") == "result")
+		setSuccess();
+	else
+		setError(x);
+	return true;
+}
+
 //----------------------------------------------------------------------------
 // JT_PushFT
 //----------------------------------------------------------------------------
@@ -700,6 +1258,14 @@ void JT_PushFT::respondError(const Jid &to, const QString &id, int code, const Q
 	send(iq);
 }
 
+void JT_PushFT::respondChecksum(const Jid &to, const QString &id, bool ok)
+{
+	if(ok)
+		send(createIQ(doc(), "result", to.full(), id));
+	else
+		respondError(to, id, 404, "Unknown transfer");
+}
+
 bool JT_PushFT::take(const QDomElement &e)
 {
 	// must be an iq-set tag
@@ -709,12 +1275,24 @@ bool JT_PushFT::take(const QDomElement &e)
 		return false;
 
 	QDomElement si = firstChildElement(e);
+	if(si.tagName() == "checksum" && si.attribute("xmlns") == NS_JINGLE_FT) {
+		QString algo;
+		QByteArray hash;
+		QDomElement file = si.elementsByTagName("file").item(0).toElement();
+		Jid from = client()->stanzaFrom(e);
+		if(file.isNull() || !readHash(file, &algo, &hash) || hash.isEmpty()) {
+			respondError(from, e.attribute("id"), 400, "No usable hash");
+			return true;
+		}
+		checksum(from, e.attribute("id"), si.attribute("sid"), algo, hash);
+		return true;
+	}
 	if(si.attribute("xmlns") != "http://jabber.org/protocol/si" || si.tagName() != "si")
 		return false;
 	if(si.attribute("profile") != "http://jabber.org/protocol/si/profile/file-transfer")
 		return false;
 
-	Jid from(e.attribute("from"));
+	Jid from = client()->stanzaFrom(e);
 	QString id = si.attribute("id");
 
 	QDomElement file = si.elementsByTagName("file").item(0).toElement();
@@ -750,6 +1328,10 @@ bool JT_PushFT::take(const QDomElement &e)
 	if(!range.isNull())
 		rangeSupported = true;
 
+	QString hashAlgo;
+	QByteArray hash;
+	readHash(file, &hashAlgo, &hash);
+
 	QStringList streamTypes;
 	QDomElement feature = si.elementsByTagName("feature").item(0).toElement();
 	if(!feature.isNull() && feature.attribute("xmlns") == "http://jabber.org/protocol/feature-neg") {
@@ -777,6 +1359,8 @@ bool JT_PushFT::take(const QDomElement &e)
 	r.desc = desc;
 	r.rangeSupported = rangeSupported;
 	r.streamTypes = streamTypes;
+	r.hashAlgo = hashAlgo;
+	r.hash = hash;
 
 	incoming(r);
 	return true;
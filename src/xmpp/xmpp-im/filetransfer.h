@@ -23,6 +23,8 @@
 
 #include "im.h"
 
+class QIODevice;
+
 namespace XMPP
 {
 	class S5BConnection;
@@ -44,8 +46,9 @@ namespace XMPP
 	{
 		Q_OBJECT
 	public:
-		enum { ErrReject, ErrNeg, ErrConnect, ErrProxy, ErrStream, Err400 };
-		enum { Idle, Requesting, Connecting, WaitingForAccept, Active };
+		enum { ErrReject, ErrNeg, ErrConnect, ErrProxy, ErrStream, Err400, ErrDevice };
+		enum { Idle, Requesting, Connecting, WaitingForAccept, Active, Interrupted };
+		enum { HashUnknown, HashVerified, HashFailed };
 		~FileTransfer();
 
 		FileTransfer *copy() const;
@@ -59,6 +62,21 @@ namespace XMPP
 		int dataSizeNeeded() const;
 		void writeFileData(const QByteArray &a);
 
+		// let the transfer read the file itself once connected, instead
+		//   of the app feeding writeFileData().  the device is not owned,
+		//   and is seeked to offset() if it is random-access.  an open
+		//   QFile is sent with sendfile() where the platform has it, so
+		//   its data never passes through this process.
+		void setSource(QIODevice *dev);
+
+		// integrity (XEP-0300).  a hash of the whole file known up front
+		//   goes in the offer, algo being e.g. "sha-256".  otherwise the
+		//   file can be hashed as it is sent, and the hash follows once
+		//   all of it is written.  this keeps a source file off the
+		//   sendfile() path, as its data has to pass through here.
+		void setHash(const QString &algo, const QByteArray &hash);
+		void setComputeHash(const QString &algo);
+
 		// receive
 		Jid peer() const;
 		QString fileName() const;
@@ -67,16 +85,45 @@ namespace XMPP
 		bool rangeSupported() const;
 		void accept(qlonglong offset=0, qlonglong length=0);
 
+		// write received data straight to a device.  readyRead() is then
+		//   not emitted; bytesWritten() reports data stored instead.
+		void setSink(QIODevice *dev);
+
+		// the hash the sender gave, and what came of comparing it with
+		//   the data.  the data is hashed as it arrives, so this costs no
+		//   second pass over the file.  hashChecked() is emitted once
+		//   after the last of the data, with HashUnknown if the sender's
+		//   hash doesn't turn up, or the file wasn't received from the
+		//   start.  sending, hash() is the computed one once it is done.
+		QString hashAlgorithm() const;
+		QByteArray hash() const;
+		int hashResult() const;
+
 		// both
 		void close(); // reject, or stop sending/receiving
 		S5BConnection *s5bConnection() const; // active link
 
+		// carry on after the stream breaks, rather than failing.  the
+		//   sender offers the file again up to 'tries' times, a few
+		//   seconds apart, and the receiver takes such an offer of the
+		//   same file from the same account as the rest of this one,
+		//   asking for a range from where it got to.  interrupted() is
+		//   emitted in between, resumed() once data flows again, and the
+		//   sender's data then comes from the new offset().  a source or
+		//   sink device stays in use, an app feeding writeFileData() has
+		//   to start over at offset().  needs range support on the other
+		//   side to avoid sending again what got through.
+		void setAutoResume(bool enabled, int tries=3);
+
 	signals:
 		void accepted(); // indicates S5BConnection has started
 		void connected();
 		void readyRead(const QByteArray &a);
 		void bytesWritten(int);
 		void error(int);
+		void interrupted();
+		void resumed(qlonglong offset);
+		void hashChecked(int result);
 
 	private slots:
 		void ft_finished();
@@ -86,17 +133,32 @@ namespace XMPP
 		void s5b_bytesWritten(int);
 		void s5b_error(int);
 		void doAccept();
+		void dev_readyRead();
+		void doResume();
+		void checksum_timeout();
 
 	private:
 		class Private;
 		Private *d;
 
 		void reset();
+		void dropConnection();
+		bool interrupt();
+		void request();
+		void startSource();
+		void pumpSource();
+		void startHash();
+		void feedHash(qlonglong pos, const QByteArray &a);
+		QByteArray takeDigest();
+		void sendChecksum();
+		void checkHash(const QByteArray &digest);
 
 		friend class FileTransferManager;
 		FileTransfer(FileTransferManager *, QObject *parent=0);
 		FileTransfer(const FileTransfer& other);
 		void man_waitForAccept(const FTRequest &req);
+		bool man_resume(const FTRequest &req);
+		void man_checksum(const QString &algo, const QByteArray &hash);
 		void takeConnection(S5BConnection *c);
 	};
 
@@ -118,6 +180,7 @@ namespace XMPP
 
 	private slots:
 		void pft_incoming(const FTRequest &req);
+		void pft_checksum(const XMPP::Jid &from, const QString &iq_id, const QString &sid, const QString &algo, const QByteArray &hash);
 
 	private:
 		class Private;
@@ -131,6 +194,8 @@ namespace XMPP
 		void con_accept(FileTransfer *);
 		void con_reject(FileTransfer *);
 		void unlink(FileTransfer *);
+		void keepResumable(FileTransfer *);
+		void awaitChecksum(FileTransfer *);
 	};
 
 	class JT_FT : public Task
@@ -140,7 +205,8 @@ namespace XMPP
 		JT_FT(Task *parent);
 		~JT_FT();
 
-		void request(const Jid &to, const QString &id, const QString &fname, qlonglong size, const QString &desc, const QStringList &streamTypes);
+		// a hashAlgo with no hash says one will follow, see JT_FTChecksum
+		void request(const Jid &to, const QString &id, const QString &fname, qlonglong size, const QString &desc, const QStringList &streamTypes, const QString &hashAlgo = QString(), const QByteArray &hash = QByteArray());
 		qlonglong rangeOffset() const;
 		qlonglong rangeLength() const;
 		QString streamType() const;
@@ -153,6 +219,26 @@ namespace XMPP
 		Private *d;
 	};
 
+	// the hash of a file, sent once all of it is written.  SI has no
+	//   message for the end of a transfer, so this is the checksum of
+	//   XEP-0234 in an iq of its own, going by the SI id.
+	class JT_FTChecksum : public Task
+	{
+		Q_OBJECT
+	public:
+		JT_FTChecksum(Task *parent);
+		~JT_FTChecksum();
+
+		void request(const Jid &to, const QString &id, const QString &hashAlgo, const QByteArray &hash);
+
+		void onGo();
+		bool take(const QDomElement &);
+
+	private:
+		QDomElement iq;
+		Jid to;
+	};
+
 	struct FTRequest
 	{
 		Jid from;
@@ -162,6 +248,8 @@ namespace XMPP
 		QString desc;
 		bool rangeSupported;
 		QStringList streamTypes;
+		QString hashAlgo; // the strongest we can check, if any
+		QByteArray hash; // empty if it is to follow
 	};
 	class JT_PushFT : public Task
 	{
@@ -172,11 +260,13 @@ namespace XMPP
 
 		void respondSuccess(const Jid &to, const QString &id, qlonglong rangeOffset, qlonglong rangeLength, const QString &streamType);
 		void respondError(const Jid &to, const QString &id, int code, const QString &str);
+		void respondChecksum(const Jid &to, const QString &id, bool ok);
 
 		bool take(const QDomElement &);
 
 	signals:
 		void incoming(const FTRequest &req);
+		void checksum(const XMPP::Jid &from, const QString &iq_id, const QString &sid, const QString &algo, const QByteArray &hash);
 	};
 }
 
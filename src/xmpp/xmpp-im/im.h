@@ -42,14 +42,17 @@
 #include "xmpp_rosteritem.h"
 #include "xmpp_liverosteritem.h"
 #include "xmpp_liveroster.h"
+#include "xmpp_rostercache.h"
 #include "xmpp_rosterx.h"
 #include "xmpp_xdata.h"
 #include "xmpp_discoitem.h"
+#include "xmpp_capscache.h"
 #include "xmpp_agentitem.h"
 #include "xmpp_client.h"
 #include "xmpp_address.h"
 #include "xmpp_pubsubitem.h"
 #include "xmpp_pubsubretraction.h"
+#include "xmpp_pubsubevent.h"
 
 namespace XMPP
 {
@@ -22,6 +22,9 @@
 
 #include <qtimer.h>
 #include <qpointer.h>
+#include <QTime>
+#include <QHash>
+#include <QVector>
 #include <QByteArray>
 #include <stdlib.h>
 #include <qca.h>
@@ -29,6 +32,7 @@
 #include "im.h"
 #include "socks.h"
 #include "safedelete.h"
+#include "xmpp/base/idgenerator.h"
 
 #ifdef Q_OS_WIN
 # include <windows.h>
@@ -38,6 +42,20 @@
 
 #define MAXSTREAMHOSTS 5
 
+// delay before racing the next streamhost candidate
+#define S5B_STAGGER_DELAY 250
+
+// how long a proxy's streamhost address is kept, and how long one that
+//   didn't answer is left alone
+#define PROXY_CACHE_TTL  (60 * 60 * 1000)
+#define PROXY_RETRY_TTL  (60 * 1000)
+
+// asking the proxies again, well before their addresses expire
+#define PROXY_PROBE_INTERVAL  (30 * 60 * 1000)
+
+// incoming datagrams kept by default, see S5BConnection::setDatagramQueueSize()
+#define DATAGRAM_QUEUE_SIZE 256
+
 //#define S5B_DEBUG
 
 namespace XMPP {
@@ -57,6 +75,17 @@ static bool haveHost(const StreamHostList &list, const Jid &j)
 	return false;
 }
 
+// so slow or dead proxies show up in the debug log
+static void debugTimings(Client *client, const S5BConnector *conn)
+{
+	QList<S5BConnector::HostTiming> list = conn->hostTimings();
+	foreach(const S5BConnector::HostTiming &ht, list) {
+		client->debug(QString("S5BConnector: %1 [%2:%3] %4 after %5 ms\n")
+			.arg(ht.host.jid().full()).arg(ht.host.host()).arg(ht.host.port())
+			.arg(ht.success ? "connected" : "failed").arg(ht.msecs));
+	}
+}
+
 class S5BManager::Item : public QObject
 {
 	Q_OBJECT
@@ -134,10 +163,42 @@ S5BDatagram::S5BDatagram()
 }
 
 S5BDatagram::S5BDatagram(int source, int dest, const QByteArray &data)
+{
+	_buf.resize(data.size() + 4);
+	memcpy(_buf.data() + 4, data.data(), data.size());
+	setPorts(source, dest);
+}
+
+S5BDatagram::S5BDatagram(int source, int dest, int size)
+{
+	_buf.resize(size + 4);
+	setPorts(source, dest);
+}
+
+void S5BDatagram::setPorts(int source, int dest)
 {
 	_source = source;
 	_dest = dest;
-	_buf = data;
+	ushort ssp = htons(source);
+	ushort sdp = htons(dest);
+	memcpy(_buf.data(), &ssp, 2);
+	memcpy(_buf.data() + 2, &sdp, 2);
+}
+
+// takes a packet as it came in, sharing its data
+bool S5BDatagram::fromPacket(const QByteArray &packet)
+{
+	// must be at least 4 bytes, to accomodate virtual ports
+	if(packet.size() < 4)
+		return false;
+
+	ushort ssp, sdp;
+	memcpy(&ssp, packet.data(), 2);
+	memcpy(&sdp, packet.data() + 2, 2);
+	_source = ntohs(ssp);
+	_dest = ntohs(sdp);
+	_buf = packet;
+	return true;
 }
 
 int S5BDatagram::sourcePort() const
@@ -152,7 +213,28 @@ int S5BDatagram::destPort() const
 
 QByteArray S5BDatagram::data() const
 {
-	return _buf;
+	if(_buf.size() <= 4)
+		return QByteArray();
+	return QByteArray(_buf.constData() + 4, _buf.size() - 4);
+}
+
+const char *S5BDatagram::constData() const
+{
+	if(_buf.isEmpty())
+		return 0;
+	return _buf.constData() + 4;
+}
+
+char *S5BDatagram::payload()
+{
+	if(_buf.isEmpty())
+		return 0;
+	return _buf.data() + 4;
+}
+
+int S5BDatagram::size() const
+{
+	return _buf.isEmpty() ? 0 : _buf.size() - 4;
 }
 
 //----------------------------------------------------------------------------
@@ -174,7 +256,18 @@ public:
 	S5BRequest req;
 	Jid proxy;
 	Mode mode;
-	QList<S5BDatagram*> dglist;
+	TransferStatistics stats;
+
+	int readBufferSize;
+	int writeHigh, writeLow;
+	bool writeBlocked;
+
+	// incoming datagrams, a ring of dgQueue.size() slots starting at
+	//   dgFirst.  the slots are reused, so the queue doesn't allocate
+	//   once it is full.
+	QVector<S5BDatagram> dgQueue;
+	int dgFirst, dgCount;
+	bool dgNotify;
 };
 
 static int id_conn = 0;
@@ -187,6 +280,14 @@ S5BConnection::S5BConnection(S5BManager *m, QObject *parent)
 	d->m = m;
 	d->sc = 0;
 	d->su = 0;
+	d->dgQueue.resize(DATAGRAM_QUEUE_SIZE);
+	d->dgFirst = 0;
+	d->dgCount = 0;
+	d->dgNotify = false;
+	d->readBufferSize = 0;
+	d->writeHigh = 0;
+	d->writeLow = 0;
+	d->writeBlocked = false;
 
 	++num_conn;
 	d->id = id_conn++;
@@ -219,11 +320,13 @@ void S5BConnection::reset(bool clear)
 	delete d->su;
 	d->su = 0;
 	if(clear) {
-		while (!d->dglist.isEmpty()) {
-			delete d->dglist.takeFirst();
-		}
+		for(int n = 0; n < d->dgQueue.size(); ++n)
+			d->dgQueue[n] = S5BDatagram();
+		d->dgFirst = 0;
+		d->dgCount = 0;
 	}
 	d->state = Idle;
+	d->writeBlocked = false;
 	d->peer = Jid();
 	d->sid = QString();
 	d->remote = false;
@@ -320,14 +423,51 @@ bool S5BConnection::isOpen() const
 
 void S5BConnection::write(const QByteArray &buf)
 {
-	if(d->state == Active && d->mode == Stream)
+	if(d->state == Active && d->mode == Stream) {
+		d->stats.bytesOut += buf.size();
 		d->sc->write(buf);
+		if(d->writeHigh > 0 && d->sc->bytesToWrite() > d->writeHigh)
+			d->writeBlocked = true;
+	}
 }
 
-QByteArray S5BConnection::read(int bytes)
+bool S5BConnection::sendFile(int fd, qlonglong offset, qlonglong count)
+{
+	if(d->state != Active || d->mode != Stream || !d->sc->sendFile(fd, offset, count))
+		return false;
+
+	d->stats.bytesOut += count;
+	if(d->writeHigh > 0 && d->sc->bytesToWrite() > d->writeHigh)
+		d->writeBlocked = true;
+	return true;
+}
+
+void S5BConnection::setReadBufferSize(int bytes)
 {
+	d->readBufferSize = bytes;
 	if(d->sc)
-		return d->sc->read(bytes);
+		d->sc->setReadHighWater(bytes);
+}
+
+void S5BConnection::setWriteWatermarks(int high, int low)
+{
+	d->writeHigh = high;
+	d->writeLow = qMin(low, high);
+	d->writeBlocked = d->writeHigh > 0 && bytesToWrite() > d->writeHigh;
+}
+
+bool S5BConnection::isWritable() const
+{
+	return d->state == Active && !d->writeBlocked;
+}
+
+QByteArray S5BConnection::read(int bytes)
+{
+	if(d->sc) {
+		QByteArray a = d->sc->read(bytes);
+		d->stats.bytesIn += a.size();
+		return a;
+	}
 	else
 		return QByteArray();
 }
@@ -350,30 +490,54 @@ int S5BConnection::bytesToWrite() const
 
 void S5BConnection::writeDatagram(const S5BDatagram &i)
 {
-	QByteArray buf;
-	buf.resize(i.data().size() + 4);
-	ushort ssp = htons(i.sourcePort());
-	ushort sdp = htons(i.destPort());
-	QByteArray data = i.data();
-	memcpy(buf.data(), &ssp, 2);
-	memcpy(buf.data() + 2, &sdp, 2);
-	memcpy(buf.data() + 4, data.data(), data.size());
-	sendUDP(buf);
+	if(i._buf.isEmpty())
+		return;
+	++d->stats.packetsOut;
+	d->stats.bytesOut += i.size();
+	sendUDP(i._buf);
 }
 
 S5BDatagram S5BConnection::readDatagram()
 {
-	if(d->dglist.isEmpty())
+	if(d->dgCount == 0)
 		return S5BDatagram();
-	S5BDatagram *i = d->dglist.takeFirst();
-	S5BDatagram val = *i;
-	delete i;
+	S5BDatagram &slot = d->dgQueue[d->dgFirst];
+	S5BDatagram val = slot;
+	slot = S5BDatagram();
+	d->dgFirst = (d->dgFirst + 1) % d->dgQueue.size();
+	--d->dgCount;
 	return val;
 }
 
 int S5BConnection::datagramsAvailable() const
 {
-	return d->dglist.count();
+	return d->dgCount;
+}
+
+void S5BConnection::setDatagramQueueSize(int size)
+{
+	if(size < 1)
+		size = 1;
+	if(size == d->dgQueue.size())
+		return;
+
+	// keep the newest that fit
+	QVector<S5BDatagram> q(size);
+	int skip = qMax(d->dgCount - size, 0);
+	d->stats.packetsDropped += skip;
+	int count = d->dgCount - skip;
+	for(int n = 0; n < count; ++n)
+		q[n] = d->dgQueue[(d->dgFirst + skip + n) % d->dgQueue.size()];
+	d->dgQueue = q;
+	d->dgFirst = 0;
+	d->dgCount = count;
+}
+
+TransferStatistics S5BConnection::statistics() const
+{
+	TransferStatistics s = d->stats;
+	s.bytesToWrite = bytesToWrite();
+	return s;
 }
 
 void S5BConnection::man_waitForAccept(const S5BRequest &r)
@@ -389,6 +553,7 @@ void S5BConnection::man_waitForAccept(const S5BRequest &r)
 void S5BConnection::man_clientReady(SocksClient *sc, SocksUDP *sc_udp)
 {
 	d->sc = sc;
+	d->sc->setReadHighWater(d->readBufferSize);
 	connect(d->sc, SIGNAL(connectionClosed()), SLOT(sc_connectionClosed()));
 	connect(d->sc, SIGNAL(delayedCloseFinished()), SLOT(sc_delayedCloseFinished()));
 	connect(d->sc, SIGNAL(readyRead()), SLOT(sc_readyRead()));
@@ -490,7 +655,15 @@ void S5BConnection::sc_readyRead()
 void S5BConnection::sc_bytesWritten(int x)
 {
 	// echo
+	QPointer<QObject> self = this;
 	bytesWritten(x);
+	if(!self)
+		return;
+
+	if(d->writeBlocked && d->sc && d->sc->bytesToWrite() <= d->writeLow) {
+		d->writeBlocked = false;
+		writable();
+	}
 }
 
 void S5BConnection::sc_error(int)
@@ -510,17 +683,31 @@ void S5BConnection::handleUDP(const QByteArray &buf)
 	if(buf.size() < 4)
 		return; // drop
 
-	ushort ssp, sdp;
-	memcpy(&ssp, buf.data(), 2);
-	memcpy(&sdp, buf.data() + 2, 2);
-	int source = ntohs(ssp);
-	int dest = ntohs(sdp);
-	QByteArray data;
-	data.resize(buf.size() - 4);
-	memcpy(data.data(), buf.data() + 4, data.size());
-	d->dglist.append(new S5BDatagram(source, dest, data));
+	int size = d->dgQueue.size();
+	if(d->dgCount == size) {
+		// full, the oldest is least likely to still be of use
+		d->dgFirst = (d->dgFirst + 1) % size;
+		--d->dgCount;
+		++d->stats.packetsDropped;
+	}
+	S5BDatagram &slot = d->dgQueue[(d->dgFirst + d->dgCount) % size];
+	slot.fromPacket(buf);
+	++d->dgCount;
+	++d->stats.packetsIn;
+	d->stats.bytesIn += slot.size();
 
-	datagramReady();
+	// everything read off the socket in this go is announced at once
+	if(!d->dgNotify) {
+		d->dgNotify = true;
+		QMetaObject::invokeMethod(this, "doDatagramReady", Qt::QueuedConnection);
+	}
+}
+
+void S5BConnection::doDatagramReady()
+{
+	d->dgNotify = false;
+	if(d->dgCount > 0)
+		datagramReady();
 }
 
 void S5BConnection::sendUDP(const QByteArray &buf)
@@ -552,6 +739,7 @@ public:
 	S5BConnection *c;
 	Item *i;
 	QString sid;
+	QString key; // our incoming hash, once there is an Item
 	JT_S5B *query;
 	StreamHost proxyInfo;
 	QPointer<S5BServer> relatedServer;
@@ -564,11 +752,40 @@ public:
 class S5BManager::Private
 {
 public:
+	class ProxyInfo
+	{
+	public:
+		StreamHost host;
+		bool ok;
+		QTime fetched;
+	};
+
 	Client *client;
 	S5BServer *serv;
 	QList<Entry*> activeList;
+	QHash<QString, Entry*> keyIndex;
 	S5BConnectionList incomingConns;
+
+	// lookups into the above, which can run into the thousands on a
+	//   busy relay.  by (peer, sid) are the entries that have an Item,
+	//   and the incoming connections.
+	QHash<S5BConnection*, Entry*> connIndex;
+	QHash<Item*, Entry*> itemIndex;
+	QHash<QPair<QString, QString>, Entry*> sidIndex;
+	QHash<QPair<QString, QString>, S5BConnection*> incomingIndex;
+
+	static QPair<QString, QString> sidKey(const Jid &peer, const QString &sid)
+	{
+		return qMakePair(peer.full(), sid);
+	}
+
 	JT_PushS5B *ps;
+
+	// by proxy jid, see probeProxy()
+	QHash<QString, ProxyInfo> proxyCache;
+	QHash<JT_S5B*, QString> probes;
+	QStringList probed;
+	QTimer *probeTimer;
 };
 
 S5BManager::S5BManager(Client *parent)
@@ -581,6 +798,8 @@ S5BManager::S5BManager(Client *parent)
 	d = new Private;
 	d->client = parent;
 	d->serv = 0;
+	d->probeTimer = new QTimer(this);
+	connect(d->probeTimer, SIGNAL(timeout()), SLOT(probeTimer_timeout()));
 
 	d->ps = new JT_PushS5B(d->client->rootTask());
 	connect(d->ps, SIGNAL(incoming(const S5BRequest &)), SLOT(ps_incoming(const S5BRequest &)));
@@ -591,6 +810,7 @@ S5BManager::S5BManager(Client *parent)
 S5BManager::~S5BManager()
 {
 	setServer(0);
+	d->incomingIndex.clear();
 	while (!d->incomingConns.isEmpty()) {
 		delete d->incomingConns.takeFirst();
 	}
@@ -618,6 +838,10 @@ void S5BManager::setServer(S5BServer *serv)
 	if(serv) {
 		d->serv = serv;
 		d->serv->link(this);
+
+		QHash<QString, Entry*>::ConstIterator it;
+		for(it = d->keyIndex.constBegin(); it != d->keyIndex.constEnd(); ++it)
+			d->serv->addKey(it.key(), this);
 	}
 }
 
@@ -633,12 +857,16 @@ S5BConnection *S5BManager::takeIncoming()
 		return 0;
 
 	S5BConnection *c = d->incomingConns.takeFirst();
+	QPair<QString, QString> k = Private::sidKey(c->d->peer, c->d->sid);
+	if(d->incomingIndex.value(k) == c)
+		d->incomingIndex.remove(k);
 
 	// move to activeList
 	Entry *e = new Entry;
 	e->c = c;
 	e->sid = c->d->sid;
 	d->activeList.append(e);
+	d->connIndex.insert(c, e);
 
 	return c;
 }
@@ -690,6 +918,8 @@ void S5BManager::ps_incoming(const S5BRequest &req)
 	c = new S5BConnection(this);
 	c->man_waitForAccept(req);
 	d->incomingConns.append(c);
+	if(req.from.isValid() && !d->incomingIndex.contains(Private::sidKey(req.from, req.sid)))
+		d->incomingIndex.insert(Private::sidKey(req.from, req.sid), c);
 	incomingReady();
 }
 
@@ -728,20 +958,10 @@ void S5BManager::doActivate(const Jid &peer, const QString &sid, const Jid &stre
 
 QString S5BManager::genUniqueSID(const Jid &peer) const
 {
-	// get unused key
-	QString sid;
-	do {
-		sid = "s5b_";
-		for(int i = 0; i < 4; ++i) {
-			int word = rand() & 0xffff;
-			for(int n = 0; n < 4; ++n) {
-				QString s;
-				s.sprintf("%x", (word >> (n * 4)) & 0xf);
-				sid.append(s);
-			}
-		}
-	} while(!isAcceptableSID(peer, sid));
-	return sid;
+	Q_UNUSED(peer);
+
+	// 128 bits from the crypto rng won't collide with anything in use
+	return IdGenerator::hexId("s5b_", QCA::Random::randomArray(16).toByteArray());
 }
 
 bool S5BManager::isAcceptableSID(const Jid &peer, const QString &sid) const
@@ -763,60 +983,85 @@ bool S5BManager::isAcceptableSID(const Jid &peer, const QString &sid) const
 
 S5BConnection *S5BManager::findIncoming(const Jid &from, const QString &sid) const
 {
-	foreach(S5BConnection *c, d->incomingConns) {
-		if(c->d->peer.compare(from) && c->d->sid == sid)
-			return c;
-	}
-	return 0;
+	// invalid jids never compare equal
+	if(!from.isValid())
+		return 0;
+	return d->incomingIndex.value(Private::sidKey(from, sid));
 }
 
 S5BManager::Entry *S5BManager::findEntry(S5BConnection *c) const
 {
-	foreach(Entry *e, d->activeList) {
-		if(e->c == c)
-			return e;
-	}
-	return 0;
+	return d->connIndex.value(c);
 }
 
 S5BManager::Entry *S5BManager::findEntry(Item *i) const
 {
-	foreach(Entry *e, d->activeList) {
-		if(e->i == i)
-			return e;
-	}
-	return 0;
+	return d->itemIndex.value(i);
 }
 
 S5BManager::Entry *S5BManager::findEntryByHash(const QString &key) const
 {
-	foreach(Entry *e, d->activeList) {
-		if(e->i && e->i->key == key)
-			return e;
-	}
-	return 0;
+	return d->keyIndex.value(key);
 }
 
 S5BManager::Entry *S5BManager::findEntryBySID(const Jid &peer, const QString &sid) const
 {
-	foreach(Entry *e, d->activeList) {
-		if(e->i && e->i->peer.compare(peer) && e->sid == sid)
-			return e;
-	}
-	return 0;
+	if(!peer.isValid())
+		return 0;
+	return d->sidIndex.value(Private::sidKey(peer, sid));
 }
 
 S5BManager::Entry *S5BManager::findServerEntryByHash(const QString &key) const
 {
-	const QList<S5BManager*> &manList = d->serv->managerList();
-	foreach(S5BManager *m, manList) {
-		Entry *e = m->findEntryByHash(key);
-		if(e)
-			return e;
-	}
+	S5BManager *m = d->serv->managerForKey(key);
+	if(m)
+		return m->findEntryByHash(key);
 	return 0;
 }
 
+void S5BManager::indexEntry(Entry *e)
+{
+	d->keyIndex.insert(e->key, e);
+	if(d->serv)
+		d->serv->addKey(e->key, this);
+}
+
+void S5BManager::unindexEntry(Entry *e)
+{
+	if(e->key.isEmpty() || d->keyIndex.value(e->key) != e)
+		return;
+	d->keyIndex.remove(e->key);
+	if(d->serv)
+		d->serv->removeKey(e->key, this);
+}
+
+// as with the list scan this replaces, the first entry with a given
+//   peer and sid is the one found.  only a loopback transfer has two.
+void S5BManager::indexSID(Entry *e)
+{
+	d->itemIndex.insert(e->i, e);
+	QPair<QString, QString> k = Private::sidKey(e->c->d->peer, e->sid);
+	if(e->c->d->peer.isValid() && !d->sidIndex.contains(k))
+		d->sidIndex.insert(k, e);
+}
+
+void S5BManager::unindexSID(Entry *e)
+{
+	if(!e->i)
+		return;
+	d->itemIndex.remove(e->i);
+	QPair<QString, QString> k = Private::sidKey(e->c->d->peer, e->sid);
+	if(d->sidIndex.value(k) != e)
+		return;
+	d->sidIndex.remove(k);
+	foreach(Entry *i, d->activeList) {
+		if(i != e && i->i && i->c->d->peer.compare(e->c->d->peer) && i->sid == e->sid) {
+			d->sidIndex.insert(k, i);
+			break;
+		}
+	}
+}
+
 bool S5BManager::srv_ownsHash(const QString &key) const
 {
 	if(findEntryByHash(key))
@@ -884,6 +1129,7 @@ void S5BManager::con_connect(S5BConnection *c)
 	e->c = c;
 	e->sid = c->d->sid;
 	d->activeList.append(e);
+	d->connIndex.insert(c, e);
 
 	if(c->d->proxy.isValid()) {
 		queryProxy(e);
@@ -921,6 +1167,9 @@ void S5BManager::con_unlink(S5BConnection *c)
 	// active incoming request?  cancel it
 	if(e->i && e->i->conn)
 		d->ps->respondError(e->i->peer, e->i->out_id, 406, "Not acceptable");
+	unindexEntry(e);
+	unindexSID(e);
+	d->connIndex.remove(c);
 	delete e->i;
 	d->activeList.removeAll(e);
 	delete e;
@@ -1005,6 +1254,12 @@ void S5BManager::entryContinue(Entry *e)
 	connect(e->i, SIGNAL(connected()), SLOT(item_connected()));
 	connect(e->i, SIGNAL(error(int)), SLOT(item_error(int)));
 
+	// same hash the item computes.  index it before starting, since
+	//   starting may fail and unlink the entry right away
+	e->key = makeKey(e->sid, d->client->jid(), e->c->d->peer);
+	indexEntry(e);
+	indexSID(e);
+
 	if(e->c->isRemote()) {
 		const S5BRequest &req = e->c->d->req;
 		e->i->startTarget(e->sid, d->client->jid(), e->c->d->peer, req.hosts, req.id, req.fast, req.udp);
@@ -1022,6 +1277,26 @@ void S5BManager::queryProxy(Entry *e)
 	if(!self)
 		return;
 
+	// keep it fresh for the next transfer
+	Jid proxy = e->c->d->proxy;
+	if(!d->probed.contains(proxy.full())) {
+		d->probed += proxy.full();
+		if(!d->probeTimer->isActive())
+			d->probeTimer->start(PROXY_PROBE_INTERVAL);
+	}
+
+	StreamHost host;
+	bool ok;
+	if(cachedProxy(proxy, &host, &ok)) {
+		if(ok)
+			e->proxyInfo = host;
+		e->c->proxyResult(ok); // signal
+		if(!self)
+			return;
+		entryContinue(e);
+		return;
+	}
+
 #ifdef S5B_DEBUG
 	printf("querying proxy: [%s]\n", qPrintable(e->c->d->proxy.full()));
 #endif
@@ -1044,6 +1319,7 @@ void S5BManager::query_finished()
 	if(!e)
 		return;
 	e->query = 0;
+	storeProxy(e->c->d->proxy, query);
 
 #ifdef S5B_DEBUG
 	printf("query finished: ");
@@ -1068,6 +1344,74 @@ void S5BManager::query_finished()
 	entryContinue(e);
 }
 
+bool S5BManager::cachedProxy(const Jid &proxy, StreamHost *host, bool *ok) const
+{
+	QHash<QString, Private::ProxyInfo>::const_iterator it = d->proxyCache.find(proxy.full());
+	if(it == d->proxyCache.end())
+		return false;
+	int age = it->fetched.elapsed();
+	if(age < 0 || age >= (it->ok ? PROXY_CACHE_TTL : PROXY_RETRY_TTL))
+		return false;
+	*host = it->host;
+	*ok = it->ok;
+	return true;
+}
+
+void S5BManager::storeProxy(const Jid &proxy, JT_S5B *query)
+{
+	Private::ProxyInfo &pi = d->proxyCache[proxy.full()];
+	pi.ok = query->success();
+	pi.host = pi.ok ? query->proxyInfo() : StreamHost();
+	pi.fetched.start();
+}
+
+void S5BManager::probeProxy(const Jid &proxy)
+{
+	if(!proxy.isValid())
+		return;
+	if(!d->probed.contains(proxy.full()))
+		d->probed += proxy.full();
+	if(!d->probeTimer->isActive())
+		d->probeTimer->start(PROXY_PROBE_INTERVAL);
+
+	// one question at a time per proxy
+	foreach(const QString &s, d->probes) {
+		if(s == proxy.full())
+			return;
+	}
+
+	JT_S5B *query = new JT_S5B(d->client->rootTask());
+	connect(query, SIGNAL(finished()), SLOT(probe_finished()));
+	d->probes.insert(query, proxy.full());
+	query->requestProxyInfo(proxy);
+	query->go(true);
+}
+
+bool S5BManager::proxyAvailable(const Jid &proxy) const
+{
+	StreamHost host;
+	bool ok;
+	return cachedProxy(proxy, &host, &ok) && ok;
+}
+
+void S5BManager::probe_finished()
+{
+	JT_S5B *query = (JT_S5B *)sender();
+	QString proxy = d->probes.take(query);
+	if(proxy.isEmpty())
+		return;
+	storeProxy(proxy, query);
+}
+
+void S5BManager::probeTimer_timeout()
+{
+	// not while offline, the answers would all be failures
+	if(!d->client->isActive())
+		return;
+	foreach(const QString &s, d->probed)
+		probeProxy(s);
+}
+
 bool S5BManager::targetShouldOfferProxy(Entry *e)
 {
 	if(!e->c->d->proxy.isValid())
@@ -1212,12 +1556,17 @@ void S5BManager::Item::doOutgoing()
 	S5BServer *serv = m->server();
 	if(serv && serv->isActive() && !haveHost(in_hosts, m->client()->jid())) {
 		QStringList hostList = serv->hostList();
-		for(QStringList::ConstIterator it = hostList.begin(); it != hostList.end(); ++it) {
-			StreamHost h;
-			h.setJid(m->client()->jid());
-			h.setHost(*it);
-			h.setPort(serv->port());
-			hosts += h;
+		QList<int> ports = serv->ports();
+
+		// the peer only looks at the first few, so the primary port goes first
+		foreach(int port, ports) {
+			for(QStringList::ConstIterator it = hostList.begin(); it != hostList.end(); ++it) {
+				StreamHost h;
+				h.setJid(m->client()->jid());
+				h.setHost(*it);
+				h.setPort(port);
+				hosts += h;
+			}
 		}
 	}
 
@@ -1422,6 +1771,7 @@ void S5BManager::Item::conn_result(bool b)
 		SocksClient *sc = conn->takeClient();
 		SocksUDP *sc_udp = conn->takeUDP();
 		StreamHost h = conn->streamHostUsed();
+		debugTimings(m->client(), conn);
 		delete conn;
 		conn = 0;
 		connSuccess = true;
@@ -1457,6 +1807,7 @@ void S5BManager::Item::conn_result(bool b)
 		}
 	}
 	else {
+		debugTimings(m->client(), conn);
 		delete conn;
 		conn = 0;
 
@@ -1478,6 +1829,7 @@ void S5BManager::Item::proxy_result(bool b)
 	if(b) {
 		SocksClient *sc = proxy_conn->takeClient();
 		SocksUDP *sc_udp = proxy_conn->takeUDP();
+		debugTimings(m->client(), proxy_conn);
 		delete proxy_conn;
 		proxy_conn = 0;
 
@@ -1498,6 +1850,7 @@ void S5BManager::Item::proxy_result(bool b)
 		proxy_task->go(true);
 	}
 	else {
+		debugTimings(m->client(), proxy_conn);
 		delete proxy_conn;
 		proxy_conn = 0;
 		reset();
@@ -1748,6 +2101,7 @@ public:
 	int udp_tries;
 	QTimer t;
 	Jid jid;
+	QTime elapsed;
 
 	Item(const Jid &self, const StreamHost &_host, const QString &_key, bool _udp) : QObject(0)
 	{
@@ -1769,9 +2123,15 @@ public:
 
 	void start()
 	{
+		elapsed.start();
 		client->connectToHost(host.host(), host.port(), key, 0, udp);
 	}
 
+	bool started() const
+	{
+		return elapsed.isValid();
+	}
+
 	void udpSuccess()
 	{
 		t.stop();
@@ -1847,11 +2207,36 @@ public:
 	SocksClient *active;
 	SocksUDP *active_udp;
 	QList<Item*> itemList;
+	QList<Item*> waiting; // not yet started, in racing order
 	QString key;
 	StreamHost activeHost;
-	QTimer t;
+	QTimer t, stagger;
+	QList<HostTiming> timings;
 };
 
+// literal IPv6 addresses go first, alternating with everything else,
+//   so that a broken v6 path costs only one stagger delay
+static StreamHostList raceOrder(const StreamHostList &hosts)
+{
+	StreamHostList v6, other;
+	for(StreamHostList::ConstIterator it = hosts.begin(); it != hosts.end(); ++it) {
+		QHostAddress addr;
+		if(addr.setAddress((*it).host()) && addr.protocol() == QAbstractSocket::IPv6Protocol)
+			v6 += *it;
+		else
+			other += *it;
+	}
+
+	StreamHostList list;
+	while(!v6.isEmpty() || !other.isEmpty()) {
+		if(!v6.isEmpty())
+			list += v6.takeFirst();
+		if(!other.isEmpty())
+			list += other.takeFirst();
+	}
+	return list;
+}
+
 S5BConnector::S5BConnector(QObject *parent)
 :QObject(parent)
 {
@@ -1859,6 +2244,8 @@ S5BConnector::S5BConnector(QObject *parent)
 	d->active = 0;
 	d->active_udp = 0;
 	connect(&d->t, SIGNAL(timeout()), SLOT(t_timeout()));
+	d->stagger.setSingleShot(true);
+	connect(&d->stagger, SIGNAL(timeout()), SLOT(startNext()));
 }
 
 S5BConnector::~S5BConnector()
@@ -1870,6 +2257,8 @@ S5BConnector::~S5BConnector()
 void S5BConnector::reset()
 {
 	d->t.stop();
+	d->stagger.stop();
+	d->waiting.clear();
 	delete d->active_udp;
 	d->active_udp = 0;
 	delete d->active;
@@ -1886,15 +2275,48 @@ void S5BConnector::start(const Jid &self, const StreamHostList &hosts, const QSt
 #ifdef S5B_DEBUG
 	printf("S5BConnector: starting [%p]!\n", this);
 #endif
-	for(StreamHostList::ConstIterator it = hosts.begin(); it != hosts.end(); ++it) {
+	d->timings.clear();
+	StreamHostList list = raceOrder(hosts);
+	for(StreamHostList::ConstIterator it = list.begin(); it != list.end(); ++it) {
 		Item *i = new Item(self, *it, key, udp);
 		connect(i, SIGNAL(result(bool)), SLOT(item_result(bool)));
 		d->itemList.append(i);
-		i->start();
+		d->waiting.append(i);
 	}
+	startNext();
 	d->t.start(timeout * 1000);
 }
 
+// start the next candidate now, and schedule the one after it.  a
+//   failure also moves the race along without waiting for the delay
+void S5BConnector::startNext()
+{
+	if(d->waiting.isEmpty())
+		return;
+
+	Item *i = d->waiting.takeFirst();
+#ifdef S5B_DEBUG
+	printf("S5BConnector: trying %s:%d\n", qPrintable(i->host.host()), i->host.port());
+#endif
+	if(!d->waiting.isEmpty())
+		d->stagger.start(S5B_STAGGER_DELAY);
+	i->start();
+}
+
+void S5BConnector::addTiming(Item *i, bool success)
+{
+	HostTiming ht;
+	ht.host = i->host;
+	ht.msecs = i->elapsed.elapsed();
+	ht.success = success;
+	d->timings += ht;
+}
+
+QList<S5BConnector::HostTiming> S5BConnector::hostTimings() const
+{
+	return d->timings;
+}
+
 SocksClient *S5BConnector::takeClient()
 {
 	SocksClient *c = d->active;
@@ -1917,7 +2339,10 @@ StreamHost S5BConnector::streamHostUsed() const
 void S5BConnector::item_result(bool b)
 {
 	Item *i = (Item *)sender();
+	addTiming(i, b);
 	if(b) {
+		d->stagger.stop();
+		d->waiting.clear();
 		d->active = i->client;
 		i->client = 0;
 		d->active_udp = i->client_udp;
@@ -1935,7 +2360,11 @@ void S5BConnector::item_result(bool b)
 	else {
 		d->itemList.removeAll(i);
 		delete i;
-		if(d->itemList.isEmpty()) {
+		if(!d->waiting.isEmpty()) {
+			d->stagger.stop();
+			startNext();
+		}
+		else if(d->itemList.isEmpty()) {
 			d->t.stop();
 #ifdef S5B_DEBUG
 			printf("S5BConnector: failed! [%p]\n", this);
@@ -1947,6 +2376,10 @@ void S5BConnector::item_result(bool b)
 
 void S5BConnector::t_timeout()
 {
+	foreach(Item *i, d->itemList) {
+		if(i->started())
+			addTiming(i, false);
+	}
 	reset();
 #ifdef S5B_DEBUG
 	printf("S5BConnector: failed! (timeout)\n");
@@ -2037,9 +2470,10 @@ private slots:
 class S5BServer::Private
 {
 public:
-	SocksServer serv;
+	QList<SocksServer*> servList; // the first one is the primary
 	QStringList hostList;
 	QList<S5BManager*> manList;
+	QHash<QString, S5BManager*> keys;
 	QList<Item*> itemList;
 };
 
@@ -2047,31 +2481,49 @@ S5BServer::S5BServer(QObject *parent)
 :QObject(parent)
 {
 	d = new Private;
-	connect(&d->serv, SIGNAL(incomingReady()), SLOT(ss_incomingReady()));
-	connect(&d->serv, SIGNAL(incomingUDP(const QString &, int, const QHostAddress &, int, const QByteArray &)), SLOT(ss_incomingUDP(const QString &, int, const QHostAddress &, int, const QByteArray &)));
 }
 
 S5BServer::~S5BServer()
 {
 	unlinkAll();
+	stop();
+	while (!d->itemList.isEmpty()) {
+		delete d->itemList.takeFirst();
+	}
 	delete d;
 }
 
 bool S5BServer::isActive() const
 {
-	return d->serv.isActive();
+	return !d->servList.isEmpty();
 }
 
 bool S5BServer::start(int port)
 {
-	d->serv.stop();
-	//return d->serv.listen(port, true);
-	return d->serv.listen(port);
+	stop();
+	return listen(QHostAddress::Any, port);
+}
+
+// listen on one more address and port, in addition to any already open
+bool S5BServer::listen(const QHostAddress &addr, int port)
+{
+	SocksServer *serv = new SocksServer(this);
+	//if(!serv->listen(addr, port, true)) {
+	if(!serv->listen(addr, port)) {
+		delete serv;
+		return false;
+	}
+	connect(serv, SIGNAL(incomingReady()), SLOT(ss_incomingReady()));
+	connect(serv, SIGNAL(incomingUDP(const QString &, int, const QHostAddress &, int, const QByteArray &)), SLOT(ss_incomingUDP(const QString &, int, const QHostAddress &, int, const QByteArray &)));
+	d->servList.append(serv);
+	return true;
 }
 
 void S5BServer::stop()
 {
-	d->serv.stop();
+	while (!d->servList.isEmpty()) {
+		delete d->servList.takeFirst();
+	}
 }
 
 void S5BServer::setHostList(const QStringList &list)
@@ -2086,17 +2538,35 @@ QStringList S5BServer::hostList() const
 
 int S5BServer::port() const
 {
-	return d->serv.port();
+	if(d->servList.isEmpty())
+		return -1;
+	return d->servList.first()->port();
+}
+
+QList<int> S5BServer::ports() const
+{
+	QList<int> list;
+	foreach(SocksServer *serv, d->servList) {
+		if(!list.contains(serv->port()))
+			list += serv->port();
+	}
+	return list;
 }
 
 void S5BServer::ss_incomingReady()
 {
-	Item *i = new Item(d->serv.takeIncoming());
+	SocksServer *serv = (SocksServer *)sender();
+
+	// drain everything queued, so a burst is handled in one go
+	SocksClient *c;
+	while((c = serv->takeIncoming())) {
+		Item *i = new Item(c);
 #ifdef S5B_DEBUG
-	printf("S5BServer: incoming connection from %s:%d\n", qPrintable(i->client->peerAddress().toString()), i->client->peerPort());
+		printf("S5BServer: incoming connection from %s:%d\n", qPrintable(i->client->peerAddress().toString()), i->client->peerPort());
 #endif
-	connect(i, SIGNAL(result(bool)), SLOT(item_result(bool)));
-	d->itemList.append(i);
+		connect(i, SIGNAL(result(bool)), SLOT(item_result(bool)));
+		d->itemList.append(i);
+	}
 }
 
 void S5BServer::ss_incomingUDP(const QString &host, int port, const QHostAddress &addr, int sourcePort, const QByteArray &data)
@@ -2104,12 +2574,9 @@ void S5BServer::ss_incomingUDP(const QString &host, int port, const QHostAddress
 	if(port != 0 || port != 1)
 		return;
 
-	foreach(S5BManager* m, d->manList) {
-		if(m->srv_ownsHash(host)) {
-			m->srv_incomingUDP(port == 1 ? true : false, addr, sourcePort, host, data);
-			return;
-		}
-	}
+	S5BManager *m = d->keys.value(host);
+	if(m)
+		m->srv_incomingUDP(port == 1 ? true : false, addr, sourcePort, host, data);
 }
 
 void S5BServer::item_result(bool b)
@@ -2131,11 +2598,10 @@ void S5BServer::item_result(bool b)
 	delete i;
 
 	// find the appropriate manager for this incoming connection
-	foreach(S5BManager *m, d->manList) {
-		if(m->srv_ownsHash(key)) {
-			m->srv_incomingReady(c, key);
-			return;
-		}
+	S5BManager *m = d->keys.value(key);
+	if(m) {
+		m->srv_incomingReady(c, key);
+		return;
 	}
 
 #ifdef S5B_DEBUG
@@ -2154,6 +2620,14 @@ void S5BServer::link(S5BManager *m)
 void S5BServer::unlink(S5BManager *m)
 {
 	d->manList.removeAll(m);
+
+	QHash<QString, S5BManager*>::Iterator it = d->keys.begin();
+	while(it != d->keys.end()) {
+		if(it.value() == m)
+			it = d->keys.erase(it);
+		else
+			++it;
+	}
 }
 
 void S5BServer::unlinkAll()
@@ -2162,6 +2636,7 @@ void S5BServer::unlinkAll()
 		m->srv_unlink();
 	}
 	d->manList.clear();
+	d->keys.clear();
 }
 
 const QList<S5BManager*> & S5BServer::managerList() const
@@ -2171,7 +2646,24 @@ const QList<S5BManager*> & S5BServer::managerList() const
 
 void S5BServer::writeUDP(const QHostAddress &addr, int port, const QByteArray &data)
 {
-	d->serv.writeUDP(addr, port, data);
+	if(!d->servList.isEmpty())
+		d->servList.first()->writeUDP(addr, port, data);
+}
+
+void S5BServer::addKey(const QString &key, S5BManager *m)
+{
+	d->keys.insert(key, m);
+}
+
+void S5BServer::removeKey(const QString &key, S5BManager *m)
+{
+	if(d->keys.value(key) == m)
+		d->keys.remove(key);
+}
+
+S5BManager *S5BServer::managerForKey(const QString &key) const
+{
+	return d->keys.value(key);
 }
 
 //----------------------------------------------------------------------------
@@ -2390,7 +2882,7 @@ bool JT_PushS5B::take(const QDomElement &e)
 	if(queryNS(e) != "http://jabber.org/protocol/bytestreams")
 		return false;
 
-	Jid from(e.attribute("from"));
+	Jid from = client()->stanzaFrom(e);
 	QDomElement q = queryTag(e);
 	QString sid = q.attribute("sid");
 
@@ -28,6 +28,7 @@
 #include "bytestream.h"
 #include "xmpp/jid/jid.h"
 #include "xmpp_task.h"
+#include "xmpp_statistics.h"
 
 class SocksClient;
 class SocksUDP;
@@ -43,19 +44,33 @@ namespace XMPP
 	typedef QList<StreamHost> StreamHostList;
 	typedef QList<S5BConnection*> S5BConnectionList;
 
+	// a datagram is kept as it goes on the wire, the virtual ports in
+	//   front of the payload, so that writing and reading it doesn't copy
+	//   the payload.  data() does make a copy, use constData() and size()
+	//   to avoid it, or the size constructor and payload() to fill in a
+	//   datagram for sending.
 	class S5BDatagram
 	{
 	public:
 		S5BDatagram();
 		S5BDatagram(int source, int dest, const QByteArray &data);
+		S5BDatagram(int source, int dest, int size);
 
 		int sourcePort() const;
 		int destPort() const;
 		QByteArray data() const;
 
+		const char *constData() const;
+		char *payload();
+		int size() const;
+
 	private:
+		friend class S5BConnection;
 		int _source, _dest;
 		QByteArray _buf;
+
+		void setPorts(int source, int dest);
+		bool fromPacket(const QByteArray &packet);
 	};
 
 	class S5BConnection : public ByteStream
@@ -86,10 +101,35 @@ namespace XMPP
 		int bytesAvailable() const;
 		int bytesToWrite() const;
 
+		// in stream mode, send count bytes of the file fd from offset
+		//   on without copying them through this process, see
+		//   BSocket::sendFile().  progress comes with bytesWritten().
+		//   false if not possible, write() the data then.
+		bool sendFile(int fd, qlonglong offset, qlonglong count);
+
+		// flow control for stream mode.  the read buffer is filled up to
+		//   'bytes' and then left to the socket, so the sender waits
+		//   until some of it has been read (0, the default, takes all
+		//   that comes).  once more than 'high' bytes are queued for
+		//   writing, isWritable() is false until the queue is down to
+		//   'low' again, announced with writable().  write() itself
+		//   still takes everything.
+		void setReadBufferSize(int bytes);
+		void setWriteWatermarks(int high, int low);
+		bool isWritable() const;
+
 		void writeDatagram(const S5BDatagram &);
 		S5BDatagram readDatagram();
 		int datagramsAvailable() const;
 
+		// datagrams waiting to be read are kept up to this many, the
+		//   oldest dropped to make room for a new one.  default 256.
+		void setDatagramQueueSize(int size);
+
+		// counters since the connection was created.  call from the
+		//   connection's thread.
+		TransferStatistics statistics() const;
+
 	signals:
 		void proxyQuery();                             // querying proxy for streamhost information
 		void proxyResult(bool b);                      // query success / fail
@@ -99,10 +139,12 @@ namespace XMPP
 		void proxyConnect();                           // connecting to proxy
 		void waitingForActivation();                   // waiting for activation (target only)
 		void connected();                              // connection active
-		void datagramReady();
+		void writable();                               // write queue down to the low mark, see setWriteWatermarks()
+		void datagramReady();                          // once for all datagrams arriving together, read until none are available
 
 	private slots:
 		void doPending();
+		void doDatagramReady();
 
 		void sc_connectionClosed();
 		void sc_delayedCloseFinished();
@@ -145,6 +187,16 @@ namespace XMPP
 		S5BConnection *createConnection();
 		S5BConnection *takeIncoming();
 
+		// a proxy's streamhost address is asked for once and then kept
+		//   for an hour, so that transfers through it can offer it right
+		//   away.  a proxy that didn't answer is left alone for a minute.
+		//   proxies used, and those passed here (e.g. right after login),
+		//   are asked again in the background before their address
+		//   expires.  proxyAvailable() tells whether the last answer was
+		//   good, without asking.
+		void probeProxy(const Jid &proxy);
+		bool proxyAvailable(const Jid &proxy) const;
+
 		class Item;
 		class Entry;
 
@@ -162,6 +214,8 @@ namespace XMPP
 		void item_connected();
 		void item_error(int);
 		void query_finished();
+		void probe_finished();
+		void probeTimer_timeout();
 
 	private:
 		class Private;
@@ -173,9 +227,15 @@ namespace XMPP
 		Entry *findEntryByHash(const QString &key) const;
 		Entry *findEntryBySID(const Jid &peer, const QString &sid) const;
 		Entry *findServerEntryByHash(const QString &key) const;
+		void indexEntry(Entry *e);
+		void unindexEntry(Entry *e);
+		void indexSID(Entry *e);
+		void unindexSID(Entry *e);
 
 		void entryContinue(Entry *e);
 		void queryProxy(Entry *e);
+		bool cachedProxy(const Jid &proxy, StreamHost *host, bool *ok) const;
+		void storeProxy(const Jid &proxy, JT_S5B *query);
 		bool targetShouldOfferProxy(Entry *e);
 
 		friend class S5BConnection;
@@ -204,11 +264,19 @@ namespace XMPP
 		S5BConnector(QObject *parent=0);
 		~S5BConnector();
 
+		struct HostTiming
+		{
+			StreamHost host;
+			int msecs;    // from starting the attempt until it finished
+			bool success;
+		};
+
 		void reset();
 		void start(const Jid &self, const StreamHostList &hosts, const QString &key, bool udp, int timeout);
 		SocksClient *takeClient();
 		SocksUDP *takeUDP();
 		StreamHost streamHostUsed() const;
+		QList<HostTiming> hostTimings() const;
 
 		class Item;
 
@@ -218,11 +286,14 @@ namespace XMPP
 	private slots:
 		void item_result(bool);
 		void t_timeout();
+		void startNext();
 
 	private:
 		class Private;
 		Private *d;
 
+		void addTiming(Item *i, bool success);
+
 		friend class S5BManager;
 		void man_udpSuccess(const Jid &streamHost);
 	};
@@ -237,8 +308,10 @@ namespace XMPP
 
 		bool isActive() const;
 		bool start(int port);
+		bool listen(const QHostAddress &addr, int port);
 		void stop();
 		int port() const;
+		QList<int> ports() const;
 		void setHostList(const QStringList &);
 		QStringList hostList() const;
 
@@ -259,6 +332,9 @@ namespace XMPP
 		void unlinkAll();
 		const QList<S5BManager*> & managerList() const;
 		void writeUDP(const QHostAddress &addr, int port, const QByteArray &data);
+		void addKey(const QString &key, S5BManager *m);
+		void removeKey(const QString &key, S5BManager *m);
+		S5BManager *managerForKey(const QString &key) const;
 	};
 
 	class JT_S5B : public Task
@@ -25,8 +25,12 @@
 #include <qapplication.h>
 //Added by qt3to4:
 #include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
 
 #include "xmpp_xmlcommon.h"
+#include "xmpp_xmlwriter.h"
 #define NS_XML     "http://www.w3.org/XML/1998/namespace"
 
 namespace XMPP
@@ -884,7 +888,7 @@ QString HTMLElement::text() const
 //----------------------------------------------------------------------------
 // Message
 //----------------------------------------------------------------------------
-class Message::Private
+class Message::Private : public QSharedData
 {
 public:
 	Jid to, from;
@@ -922,6 +926,29 @@ public:
 	QString mucPassword;
 
 	bool spooled, wasEncrypted;
+
+	// fromStanza() only decodes the basic fields.  the extensions are
+	//   decoded from this element the first time one of them is used.
+	//   decoding happens in const getters too, and then applies to every
+	//   copy sharing this data, which is fine since they all hold the same
+	//   element.  like any other const access, it is not thread safe.
+	QDomElement pending;
+	QDomElement pubsubEvent;        // found along with the basic fields
+	bool pendingUseTimeZoneOffset;
+	int pendingTimeZoneOffset;
+
+	Private() : threadSend(false), timeStampSend(false), chatState(StateNone), messageReceipt(ReceiptNone), spooled(false), wasEncrypted(false)
+	{
+	}
+
+	void decodePending() const
+	{
+		if(!pending.isNull())
+			const_cast<Private*>(this)->decodeExtensions();
+	}
+
+	void clearExtensions();
+	void decodeExtensions();
 };
 
 //! \brief Constructs Message with given target Jid information.
@@ -932,16 +959,6 @@ Message::Message(const Jid &to)
 {
 	d = new Private;
 	d->to = to;
-	d->spooled = false;
-	d->threadSend = false;
-	d->timeStampSend = false;
-	d->wasEncrypted = false;
-	/*d->flag = false;
-	d->spooled = false;
-	d->wasEncrypted = false;
-	d->errorCode = -1;*/
-	d->chatState = StateNone;
-	d->messageReceipt = ReceiptNone;
 }
 
 //! \brief Constructs a copy of Message object
@@ -949,23 +966,20 @@ Message::Message(const Jid &to)
 //! Overloaded constructor which will constructs a exact copy of the Message
 //! object that was passed to the constructor.
 //! \param from - Message object you want to copy
-Message::Message(const Message &from)
+Message::Message(const Message &from) : d(from.d)
 {
-	d = new Private;
-	*this = from;
 }
 
 //! \brief Required for internel use.
 Message & Message::operator=(const Message &from)
 {
-	*d = *from.d;
+	d = from.d;
 	return *this;
 }
 
 //! \brief Destroy Message object.
 Message::~Message()
 {
-	delete d;
 }
 
 //! \brief Return receiver's Jid information.
@@ -1026,6 +1040,7 @@ QString Message::body(const QString &lang) const
 //! \note The return string is in xhtml
 HTMLElement Message::html(const QString &lang) const
 {
+	d->decodePending();
 	if(containsHTML()) {
 		if (d->htmlElements.contains(lang))
 			return d->htmlElements[lang];
@@ -1042,6 +1057,7 @@ HTMLElement Message::html(const QString &lang) const
 //! in the message.
 bool Message::containsHTML() const
 {
+	d->decodePending();
 	return !(d->htmlElements.isEmpty());
 }
 
@@ -1116,6 +1132,7 @@ void Message::setBody(const QString &s, const QString &lang)
 //! \note The body should be in xhtml.
 void Message::setHTML(const HTMLElement &e, const QString &lang)
 {
+	d->decodePending();
 	d->htmlElements[lang] = e;
 }
 
@@ -1132,26 +1149,36 @@ void Message::setError(const Stanza::Error &err)
 
 const QString& Message::pubsubNode() const
 {
+	d->decodePending();
 	return d->pubsubNode;
 }
 
 const QList<PubSubItem>& Message::pubsubItems() const
 {
+	d->decodePending();
 	return d->pubsubItems;
 }
 
 const QList<PubSubRetraction>& Message::pubsubRetractions() const
 {
+	d->decodePending();
 	return d->pubsubRetractions;
 }
 
+PubSubEvent Message::pubsubEvent() const
+{
+	return PubSubEvent(d->pubsubEvent);
+}
+
 QDateTime Message::timeStamp() const
 {
+	d->decodePending();
 	return d->timeStamp;
 }
 
 void Message::setTimeStamp(const QDateTime &ts, bool send)
 {
+	d->decodePending();
 	d->timeStampSend = send;
 	d->timeStamp = ts;
 }
@@ -1159,6 +1186,7 @@ void Message::setTimeStamp(const QDateTime &ts, bool send)
 //! \brief Return list of urls attached to message.
 UrlList Message::urlList() const
 {
+	d->decodePending();
 	return d->urlList;
 }
 
@@ -1167,12 +1195,14 @@ UrlList Message::urlList() const
 //! \param url - url to append
 void Message::urlAdd(const Url &u)
 {
+	d->decodePending();
 	d->urlList += u;
 }
 
 //! \brief clear out the url list.
 void Message::urlsClear()
 {
+	d->decodePending();
 	d->urlList.clear();
 }
 
@@ -1181,12 +1211,14 @@ void Message::urlsClear()
 //! \param urlList - list of urls to send
 void Message::setUrlList(const UrlList &list)
 {
+	d->decodePending();
 	d->urlList = list;
 }
 
 //! \brief Return list of addresses attached to message.
 AddressList Message::addresses() const
 {
+	d->decodePending();
 	return d->addressList;
 }
 
@@ -1195,17 +1227,20 @@ AddressList Message::addresses() const
 //! \param address - address to append
 void Message::addAddress(const Address &a)
 {
+	d->decodePending();
 	d->addressList += a;
 }
 
 //! \brief clear out the address list.
 void Message::clearAddresses()
 {
+	d->decodePending();
 	d->addressList.clear();
 }
 
 AddressList Message::findAddresses(Address::Type t) const
 {
+	d->decodePending();
 	AddressList matches;
 	foreach(Address a, d->addressList) {
 		if (a.type() == t)
@@ -1219,41 +1254,49 @@ AddressList Message::findAddresses(Address::Type t) const
 //! \param list - list of addresses to send
 void Message::setAddresses(const AddressList &list)
 {
+	d->decodePending();
 	d->addressList = list;
 }
 
 const RosterExchangeItems& Message::rosterExchangeItems() const
 {
+	d->decodePending();
 	return d->rosterExchangeItems;
 }
 
 void Message::setRosterExchangeItems(const RosterExchangeItems& items)
 {
+	d->decodePending();
 	d->rosterExchangeItems = items;
 }
 
 QString Message::eventId() const
 {
+	d->decodePending();
 	return d->eventId;
 }
 
 void Message::setEventId(const QString& id)
 {
+	d->decodePending();
 	d->eventId = id;
 }
 
 bool Message::containsEvents() const
 {
+	d->decodePending();
 	return !d->eventList.isEmpty();
 }
 
 bool Message::containsEvent(MsgEvent e) const
 {
+	d->decodePending();
 	return d->eventList.contains(e);
 }
 
 void Message::addEvent(MsgEvent e)
 {
+	d->decodePending();
 	if (!d->eventList.contains(e)) {
 		if (e == CancelEvent || containsEvent(CancelEvent)) 
 			d->eventList.clear(); // Reset list
@@ -1263,141 +1306,169 @@ void Message::addEvent(MsgEvent e)
 
 ChatState Message::chatState() const
 {
+	d->decodePending();
 	return d->chatState;
 }
 
 void Message::setChatState(ChatState state)
 {
+	d->decodePending();
 	d->chatState = state;
 }
 
 MessageReceipt Message::messageReceipt() const
 {
+	d->decodePending();
 	return d->messageReceipt;
 }
 
 void Message::setMessageReceipt(MessageReceipt messageReceipt)
 {
+	d->decodePending();
 	d->messageReceipt = messageReceipt;
 }
 
 QString Message::xencrypted() const
 {
+	d->decodePending();
 	return d->xencrypted;
 }
 
 void Message::setXEncrypted(const QString &s)
 {
+	d->decodePending();
 	d->xencrypted = s;
 }
 
 const QList<int>& Message::getMUCStatuses() const
 {
+	d->decodePending();
 	return d->mucStatuses;
 }
 
 void Message::addMUCStatus(int i)
 {
+	d->decodePending();
 	d->mucStatuses += i;
 }
 
 void Message::addMUCInvite(const MUCInvite& i)
 {
+	d->decodePending();
 	d->mucInvites += i;
 }
 
 const QList<MUCInvite>& Message::mucInvites() const
 {
+	d->decodePending();
 	return d->mucInvites;
 }
 
 void Message::setMUCDecline(const MUCDecline& de)
 {
+	d->decodePending();
 	d->mucDecline = de;
 }
 
 const MUCDecline& Message::mucDecline() const
 {
+	d->decodePending();
 	return d->mucDecline;
 }
 
 const QString& Message::mucPassword() const
 {
+	d->decodePending();
 	return d->mucPassword;
 }
 
 void Message::setMUCPassword(const QString& p) 
 {
+	d->decodePending();
 	d->mucPassword = p;
 }
 
 QString Message::invite() const
 {
+	d->decodePending();
 	return d->invite;
 }
 
 void Message::setInvite(const QString &s)
 {
+	d->decodePending();
 	d->invite = s;
 }
 
 const QString& Message::nick() const
 {
+	d->decodePending();
 	return d->nick;
 }
 
 void Message::setNick(const QString& n)
 {
+	d->decodePending();
 	d->nick = n;
 }
 
 void Message::setHttpAuthRequest(const HttpAuthRequest &req)
 {
+	d->decodePending();
 	d->httpAuthRequest = req;
 }
 
 HttpAuthRequest Message::httpAuthRequest() const
 {
+	d->decodePending();
 	return d->httpAuthRequest;
 }
 
 void Message::setForm(const XData &form)
 {
+	d->decodePending();
 	d->xdata = form;
 }
 
 const XData& Message::getForm() const
 {
+	d->decodePending();
 	return d->xdata;
 }
 
 const QDomElement& Message::sxe() const
 {
+	d->decodePending();
 	return d->sxe;
 }
 
 void Message::setSxe(const QDomElement& e)
 {
+	d->decodePending();
 	d->sxe = e;
 }
 
 const QDomElement& Message::whiteboard() const
 {
+	d->decodePending();
 	return d->wb;
 }
 
 void Message::setWhiteboard(const QDomElement& e)
 {
+	d->decodePending();
 	d->wb = e;
 }
 
 bool Message::spooled() const
 {
+	d->decodePending();
 	return d->spooled;
 }
 
 void Message::setSpooled(bool b)
 {
+	d->decodePending();
 	d->spooled = b;
 }
 
@@ -1411,8 +1482,10 @@ void Message::setWasEncrypted(bool b)
 	d->wasEncrypted = b;
 }
 
+// keep writeXml() in step with this
 Stanza Message::toStanza(Stream *stream) const
 {
+	d->decodePending();
 	Stanza s = stream->createStanza(Stanza::Message, d->to, d->type);
 	if(!d->from.isEmpty())
 		s.setFrom(d->from);
@@ -1461,7 +1534,7 @@ Stanza Message::toStanza(Stream *stream) const
 	// timestamp
 	if(d->timeStampSend && !d->timeStamp.isNull()) {
 		QDomElement e = s.createElement("urn:xmpp:delay", "delay");
-		e.setAttribute("stamp", d->timeStamp.toUTC().toString(Qt::ISODate) + "Z");
+		e.setAttribute("stamp", TS2isoStamp(d->timeStamp));
 		s.appendChild(e);
 
 		e = s.createElement("jabber:x:delay", "x");
@@ -1625,6 +1698,120 @@ Stanza Message::toStanza(Stream *stream) const
 	return s;
 }
 
+bool Message::writeXml(XmlWriter *w, const QString &ns) const
+{
+	d->decodePending();
+
+	// the rest carry elements of their own, left to toStanza()
+	if(containsHTML() || d->type == "error"
+		|| !d->addressList.isEmpty() || !d->rosterExchangeItems.isEmpty()
+		|| !d->sxe.isNull() || !d->wb.isNull()
+		|| !d->mucInvites.isEmpty() || !d->mucDecline.isNull()
+		|| !d->httpAuthRequest.isEmpty()
+		|| !d->xdata.fields().empty() || d->xdata.type() == XData::Data_Cancel)
+		return false;
+
+	w->startElement("message", ns);
+	if(d->to.isValid())
+		w->attribute("to", d->to.full());
+	if(!d->type.isEmpty())
+		w->attribute("type", d->type);
+	if(!d->from.isEmpty())
+		w->attribute("from", d->from.full());
+	if(!d->id.isEmpty())
+		w->attribute("id", d->id);
+	if(!d->lang.isEmpty())
+		w->attribute("xml:lang", d->lang);
+
+	StringMap::ConstIterator it;
+	for(it = d->subject.begin(); it != d->subject.end(); ++it) {
+		if(it.value().isEmpty())
+			continue;
+		w->startElement("subject");
+		if(!it.key().isEmpty())
+			w->attribute("xml:lang", it.key());
+		w->text(it.value());
+		w->endElement();
+	}
+	for(it = d->body.begin(); it != d->body.end(); ++it) {
+		if(it.value().isEmpty())
+			continue;
+		w->startElement("body");
+		if(!it.key().isEmpty())
+			w->attribute("xml:lang", it.key());
+		w->text(it.value());
+		w->endElement();
+	}
+
+	if(d->threadSend && !d->thread.isEmpty())
+		w->textElement("thread", d->thread);
+
+	if(d->timeStampSend && !d->timeStamp.isNull()) {
+		w->startElement("delay", "urn:xmpp:delay");
+		w->attribute("stamp", TS2isoStamp(d->timeStamp));
+		w->endElement();
+		w->startElement("x", "jabber:x:delay");
+		w->attribute("stamp", TS2stamp(d->timeStamp.toUTC()));
+		w->endElement();
+	}
+
+	for(QList<Url>::ConstIterator uit = d->urlList.begin(); uit != d->urlList.end(); ++uit) {
+		w->startElement("x", "jabber:x:oob");
+		w->textElement("url", (*uit).url());
+		if(!(*uit).desc().isEmpty())
+			w->textElement("desc", (*uit).desc());
+		w->endElement();
+	}
+
+	if(!d->eventList.isEmpty()) {
+		w->startElement("x", "jabber:x:event");
+		if(d->body.isEmpty())
+			w->textElement("id", d->eventId);
+		foreach(MsgEvent ev, d->eventList) {
+			switch(ev) {
+				case OfflineEvent: w->emptyElement("offline"); break;
+				case DeliveredEvent: w->emptyElement("delivered"); break;
+				case DisplayedEvent: w->emptyElement("displayed"); break;
+				case ComposingEvent: w->emptyElement("composing"); break;
+				case CancelEvent: break;
+			}
+		}
+		w->endElement();
+	}
+
+	const char *state = 0;
+	switch(d->chatState) {
+		case StateActive: state = "active"; break;
+		case StateComposing: state = "composing"; break;
+		case StatePaused: state = "paused"; break;
+		case StateInactive: state = "inactive"; break;
+		case StateGone: state = "gone"; break;
+		default: break;
+	}
+	if(state)
+		w->emptyElement(state, "http://jabber.org/protocol/chatstates");
+
+	if(d->messageReceipt == ReceiptRequest)
+		w->emptyElement("request", "urn:xmpp:receipts");
+	else if(d->messageReceipt == ReceiptReceived)
+		w->emptyElement("received", "urn:xmpp:receipts");
+
+	if(!d->xencrypted.isEmpty())
+		w->textElement("x", d->xencrypted, "jabber:x:encrypted");
+
+	if(!d->invite.isEmpty()) {
+		w->startElement("x", "jabber:x:conference");
+		w->attribute("jid", d->invite);
+		w->endElement();
+	}
+
+	if(!d->nick.isEmpty())
+		w->textElement("nick", d->nick, "http://jabber.org/protocol/nick");
+
+	w->endElement();
+	return true;
+}
+
 /**
   \brief Create Message from Stanza \a s, using given \a timeZoneOffset (old style)
   */
@@ -1662,255 +1849,295 @@ bool Message::fromStanza(const Stanza &s, bool useTimeZoneOffset, int timeZoneOf
 
 	d->subject.clear();
 	d->body.clear();
-	d->htmlElements.clear();
 	d->thread = QString();
+	d->pubsubEvent = QDomElement();
 
 	QDomElement root = s.element();
+	const XmlAtoms &a = XmlAtoms::get();
 
-	XDomNodeList nl = root.childNodes();
+	for(QDomNode i = root.firstChild(); !i.isNull(); i = i.nextSibling()) {
+		QDomElement e = i.toElement();
+		if(e.isNull())
+			continue;
+		if(e.tagName() == a.event && d->pubsubEvent.isNull() && e.namespaceURI() == a.pubsubEventNS) {
+			d->pubsubEvent = e;
+			continue;
+		}
+		if(e.namespaceURI() != s.baseNS())
+			continue;
+		if(e.tagName() == "subject") {
+			QString lang = e.attributeNS(NS_XML, "lang", "");
+			d->subject[lang] = e.text();
+		}
+		else if(e.tagName() == "body") {
+			QString lang = e.attributeNS(NS_XML, "lang", "");
+			d->body[lang] = e.text();
+		}
+		else if(e.tagName() == "thread")
+			d->thread = e.text();
+	}
+
+	if(s.type() == "error")
+		d->error = s.error();
+
+	// the rest waits until it is asked for.  the arrival time can't wait,
+	//   it is the timestamp unless the message was delayed.
+	d->clearExtensions();
+	d->timeStamp = QDateTime::currentDateTime();
+	d->spooled = false;
+	d->pending = root;
+	d->pendingUseTimeZoneOffset = useTimeZoneOffset;
+	d->pendingTimeZoneOffset = timeZoneOffset;
+
+	return true;
+}
+
+void Message::Private::clearExtensions()
+{
+	pending = QDomElement();
+	htmlElements.clear();
+	urlList.clear();
+	addressList.clear();
+	rosterExchangeItems.clear();
+	eventList.clear();
+	eventId = QString();
+	pubsubNode = QString();
+	pubsubItems.clear();
+	pubsubRetractions.clear();
+	xencrypted = QString();
+	invite = QString();
+	chatState = StateNone;
+	messageReceipt = ReceiptNone;
+	nick = QString();
+	httpAuthRequest = HttpAuthRequest();
+	xdata = XData();
+	sxe = QDomElement();
+	wb = QDomElement();
+	mucStatuses.clear();
+	mucInvites.clear();
+	mucDecline = MUCDecline();
+	mucPassword = QString();
+}
+
+void Message::Private::decodeExtensions()
+{
+	QDomElement root = pending;
+	bool useTimeZoneOffset = pendingUseTimeZoneOffset;
+	int timeZoneOffset = pendingTimeZoneOffset;
+	pending = QDomElement();
+
+	// one walk over the children, for all the lookups below
+	XmlChildIndex ix(root);
+	const XmlAtoms &a = XmlAtoms::get();
+
+	XDomNodeList nl;
+	QDomElement t;
 	int n;
+
+	// pubsub
+	nl = ix.all(a.pubsubEventNS, a.event);
 	for(n = 0; n < nl.count(); ++n) {
-		QDomNode i = nl.item(n);
-		if(i.isElement()) {
-			QDomElement e = i.toElement();
-			if(e.namespaceURI() == s.baseNS()) {
-				if(e.tagName() == "subject") {
-					QString lang = e.attributeNS(NS_XML, "lang", "");
-					d->subject[lang] = e.text();
-				}
-				else if(e.tagName() == "body") {
-					QString lang = e.attributeNS(NS_XML, "lang", "");
-					d->body[lang] = e.text();
-				}
-				else if(e.tagName() == "thread")
-					d->thread = e.text();
-			}
-			else if(e.tagName() == "event" && e.namespaceURI() == "http://jabber.org/protocol/pubsub#event") {
-				for(QDomNode enode = e.firstChild(); !enode.isNull(); enode = enode.nextSibling()) {
-					QDomElement eel = enode.toElement();
-					if (eel.tagName() == "items") {
-						d->pubsubNode = eel.attribute("node");
-						for(QDomNode inode = eel.firstChild(); !inode.isNull(); inode = inode.nextSibling()) {
-							QDomElement o = inode.toElement();
-							if (o.tagName() == "item") {
-								for(QDomNode j = o.firstChild(); !j.isNull(); j = j.nextSibling()) {
-									QDomElement item = j.toElement();
-									if (!item.isNull()) {
-										d->pubsubItems += PubSubItem(o.attribute("id"),item);
-									}
-								}
-							}
-							if (o.tagName() == "retract") {
-								d->pubsubRetractions += PubSubRetraction(o.attribute("id"));
+		QDomElement e = nl.item(n).toElement();
+		for(QDomNode enode = e.firstChild(); !enode.isNull(); enode = enode.nextSibling()) {
+			QDomElement eel = enode.toElement();
+			if (eel.tagName() == "items") {
+				pubsubNode = eel.attribute("node");
+				for(QDomNode inode = eel.firstChild(); !inode.isNull(); inode = inode.nextSibling()) {
+					QDomElement o = inode.toElement();
+					if (o.tagName() == "item") {
+						for(QDomNode j = o.firstChild(); !j.isNull(); j = j.nextSibling()) {
+							QDomElement item = j.toElement();
+							if (!item.isNull()) {
+								pubsubItems += PubSubItem(o.attribute("id"),item);
 							}
 						}
 					}
+					if (o.tagName() == "retract") {
+						pubsubRetractions += PubSubRetraction(o.attribute("id"));
+					}
 				}
 			}
-			else {
-				//printf("extension element: [%s]\n", e.tagName().latin1());
-			}
 		}
 	}
 
-	if(s.type() == "error")
-		d->error = s.error();
-
 	// xhtml-im
-	nl = childElementsByTagNameNS(root, "http://jabber.org/protocol/xhtml-im", "html");
-	if (nl.count()) {
-		nl = nl.item(0).childNodes();
+	t = ix.first(a.xhtmlImNS, a.html);
+	if (!t.isNull()) {
+		nl = t.childNodes();
 		for(n = 0; n < nl.count(); ++n) {
 			QDomElement e = nl.item(n).toElement();
-			if (e.tagName() == "body" && e.namespaceURI() == "http://www.w3.org/1999/xhtml") {
+			if (e.tagName() == a.body && e.namespaceURI() == a.xhtmlNS) {
 				QString lang = e.attributeNS(NS_XML, "lang", "");
-				d->htmlElements[lang] = e;
+				htmlElements[lang] = e;
 			}
 		}
 	}
 
 	// timestamp
-	QDomElement t = childElementsByTagNameNS(root, "urn:xmpp:delay", "delay").item(0).toElement();
+	t = ix.first(a.delayNS, a.delay);
 	QDateTime stamp;
 	if (!t.isNull()) {
-		stamp = QDateTime::fromString(t.attribute("stamp").left(19), Qt::ISODate);
+		stamp = isoStamp2TS(t.attribute("stamp"));
 	} else {
-		t = childElementsByTagNameNS(root, "jabber:x:delay", "x").item(0).toElement();
+		t = ix.first(a.xDelayNS, a.x);
 		if (!t.isNull()) {
 			stamp = stamp2TS(t.attribute("stamp"));
 		}
 	}
 	if (!stamp.isNull()) {
 		if (useTimeZoneOffset) {			
-			d->timeStamp = stamp.addSecs(timeZoneOffset * 3600);
+			timeStamp = stamp.addSecs(timeZoneOffset * 3600);
+			timeStamp.setTimeSpec(Qt::LocalTime);
 		} else {
-			stamp.setTimeSpec(Qt::UTC);
-			d->timeStamp = stamp.toLocalTime();
+			timeStamp = utc2Local(stamp);
 		}
-		d->spooled = true;
-	}
-	else {
-		d->timeStamp = QDateTime::currentDateTime();
-		d->spooled = false;
+		spooled = true;
 	}
 
 	// urls
-	d->urlList.clear();
-	nl = childElementsByTagNameNS(root, "jabber:x:oob", "x");
+	urlList.clear();
+	nl = ix.all(a.xOobNS, a.x);
 	for(n = 0; n < nl.count(); ++n) {
 		QDomElement t = nl.item(n).toElement();
 		Url u;
 		u.setUrl(t.elementsByTagName("url").item(0).toElement().text());
 		u.setDesc(t.elementsByTagName("desc").item(0).toElement().text());
-		d->urlList += u;
+		urlList += u;
 	}
 	
     // events
-	d->eventList.clear();
-	nl = childElementsByTagNameNS(root, "jabber:x:event", "x");
-	if (nl.count()) {
-		nl = nl.item(0).childNodes();
+	eventList.clear();
+	t = ix.first(a.xEventNS, a.x);
+	if (!t.isNull()) {
+		nl = t.childNodes();
 		for(n = 0; n < nl.count(); ++n) {
 			QString evtag = nl.item(n).toElement().tagName();
 			if (evtag == "id") {
-				d->eventId =  nl.item(n).toElement().text();
+				eventId =  nl.item(n).toElement().text();
 			}
 			else if (evtag == "displayed")
-				d->eventList += DisplayedEvent;
+				eventList += DisplayedEvent;
 			else if (evtag == "composing")
-				d->eventList += ComposingEvent;
+				eventList += ComposingEvent;
 			else if (evtag == "delivered")
-				d->eventList += DeliveredEvent;
+				eventList += DeliveredEvent;
 		}
-		if (d->eventList.isEmpty())
-			d->eventList += CancelEvent;
+		if (eventList.isEmpty())
+			eventList += CancelEvent;
 	}
 
 	// Chat states
-	QString chatStateNS = "http://jabber.org/protocol/chatstates";
-	t = childElementsByTagNameNS(root, chatStateNS, "active").item(0).toElement();
-	if(!t.isNull())
-		d->chatState = StateActive;
-	t = childElementsByTagNameNS(root, chatStateNS, "composing").item(0).toElement();
-	if(!t.isNull())
-		d->chatState = StateComposing;
-	t = childElementsByTagNameNS(root, chatStateNS, "paused").item(0).toElement();
-	if(!t.isNull())
-		d->chatState = StatePaused;
-	t = childElementsByTagNameNS(root, chatStateNS, "inactive").item(0).toElement();
-	if(!t.isNull())
-		d->chatState = StateInactive;
-	t = childElementsByTagNameNS(root, chatStateNS, "gone").item(0).toElement();
-	if(!t.isNull())
-		d->chatState = StateGone;
+	if(ix.has(a.chatStatesNS, a.active))
+		chatState = StateActive;
+	if(ix.has(a.chatStatesNS, a.composing))
+		chatState = StateComposing;
+	if(ix.has(a.chatStatesNS, a.paused))
+		chatState = StatePaused;
+	if(ix.has(a.chatStatesNS, a.inactive))
+		chatState = StateInactive;
+	if(ix.has(a.chatStatesNS, a.gone))
+		chatState = StateGone;
 
 	// message receipts
-	QString messageReceiptNS = "urn:xmpp:receipts";
-	t = childElementsByTagNameNS(root, messageReceiptNS, "request").item(0).toElement();
-	if(!t.isNull())
-		d->messageReceipt = ReceiptRequest;
-	t = childElementsByTagNameNS(root, messageReceiptNS, "received").item(0).toElement();
-	if(!t.isNull())
-		d->messageReceipt = ReceiptReceived;
+	if(ix.has(a.receiptsNS, a.request))
+		messageReceipt = ReceiptRequest;
+	if(ix.has(a.receiptsNS, a.received))
+		messageReceipt = ReceiptReceived;
 
 	// xencrypted
-	t = childElementsByTagNameNS(root, "jabber:x:encrypted", "x").item(0).toElement();
+	t = ix.first(a.xEncryptedNS, a.x);
 	if(!t.isNull())
-		d->xencrypted = t.text();
+		xencrypted = t.text();
 	else
-		d->xencrypted = QString();
+		xencrypted = QString();
 		
 	// addresses
-	d->addressList.clear();
-	nl = childElementsByTagNameNS(root, "http://jabber.org/protocol/address", "addresses");
-	if (nl.count()) {
-		QDomElement t = nl.item(0).toElement();
+	addressList.clear();
+	t = ix.first(a.addressNS, a.addresses);
+	if (!t.isNull()) {
 		nl = t.elementsByTagName("address");
 		for(n = 0; n < nl.count(); ++n) {
-			d->addressList += Address(nl.item(n).toElement());
+			addressList += Address(nl.item(n).toElement());
 		}
 	}
 	
 	// roster item exchange
-	d->rosterExchangeItems.clear();
-	nl = childElementsByTagNameNS(root, "http://jabber.org/protocol/rosterx", "x");
-	if (nl.count()) {
-		QDomElement t = nl.item(0).toElement();
+	rosterExchangeItems.clear();
+	t = ix.first(a.rosterxNS, a.x);
+	if (!t.isNull()) {
 		nl = t.elementsByTagName("item");
 		for(n = 0; n < nl.count(); ++n) {
 			RosterExchangeItem it = RosterExchangeItem(nl.item(n).toElement());
 			if (!it.isNull())
-				d->rosterExchangeItems += it;
+				rosterExchangeItems += it;
 		}
 	}
 
 	// invite
-	t = childElementsByTagNameNS(root, "jabber:x:conference", "x").item(0).toElement();
+	t = ix.first(a.xConferenceNS, a.x);
 	if(!t.isNull())
-		d->invite = t.attribute("jid");
+		invite = t.attribute("jid");
 	else
-		d->invite = QString();
+		invite = QString();
 	
 	// nick
-	t = childElementsByTagNameNS(root, "http://jabber.org/protocol/nick", "nick").item(0).toElement();
+	t = ix.first(a.nickNS, a.nick);
 	if(!t.isNull())
-		d->nick = t.text();
+		nick = t.text();
 	else
-		d->nick = QString();
+		nick = QString();
 
 	// sxe
-	t = childElementsByTagNameNS(root, "http://jabber.org/protocol/sxe", "sxe").item(0).toElement();
+	t = ix.first(a.sxeNS, a.sxe);
 	if(!t.isNull())
-		d->sxe = t;
+		sxe = t;
 	else
-		d->sxe = QDomElement();
+		sxe = QDomElement();
 
 	// wb
 	t = root.elementsByTagNameNS("http://jabber.org/protocol/svgwb", "wb").item(0).toElement();
 	if(!t.isNull())
-		d->wb = t;
+		wb = t;
 	else
-		d->wb = QDomElement();
+		wb = QDomElement();
 
-	t = childElementsByTagNameNS(root, "http://jabber.org/protocol/muc#user", "x").item(0).toElement();
+	t = ix.first(a.mucUserNS, a.x);
 	if(!t.isNull()) {
 		for(QDomNode muc_n = t.firstChild(); !muc_n.isNull(); muc_n = muc_n.nextSibling()) {
 			QDomElement muc_e = muc_n.toElement();
 			if(muc_e.isNull())
 				continue;
 			if (muc_e.tagName() == "status") {
-				addMUCStatus(muc_e.attribute("code").toInt());
+				mucStatuses += muc_e.attribute("code").toInt();
 			}
 			else if (muc_e.tagName() == "invite") {
 				MUCInvite inv(muc_e);
 				if (!inv.isNull())
-					addMUCInvite(inv);
+					mucInvites += inv;
 			}
 			else if (muc_e.tagName() == "decline") {
-				setMUCDecline(MUCDecline(muc_e));
+				mucDecline = MUCDecline(muc_e);
 			}
 			else if (muc_e.tagName() == "password") {
-				setMUCPassword(muc_e.text());
+				mucPassword = muc_e.text();
 			}
 		}
 	}
 
 	// http auth
-	t = childElementsByTagNameNS(root, "http://jabber.org/protocol/http-auth", "confirm").item(0).toElement();
+	t = ix.first(a.httpAuthNS, a.confirm);
 	if(!t.isNull()){
-		d->httpAuthRequest = HttpAuthRequest(t);
+		httpAuthRequest = HttpAuthRequest(t);
 	}
 	else {
-		d->httpAuthRequest = HttpAuthRequest();
+		httpAuthRequest = HttpAuthRequest();
 	}
 
 	// data form
-	t = childElementsByTagNameNS(root, "jabber:x:data", "x").item(0).toElement();
+	t = ix.first(a.xDataNS, a.x);
 	if(!t.isNull()){
-		d->xdata.fromXml(t);
+		xdata.fromXml(t);
 	}
-
-	return true;
 }
 
 /*!
@@ -2218,37 +2445,44 @@ void Status::setTimeStamp(const QDateTime & _timestamp)
 
 void Status::setKeyID(const QString &key)
 {
+	decode();
 	v_key = key;
 }
 
 void Status::setXSigned(const QString &s)
 {
+	decode();
 	v_xsigned = s;
 }
 
 void Status::setSongTitle(const QString & _songtitle)
 {
+	decode();
 	v_songTitle = _songtitle;
 }
 
 void Status::setCapsNode(const QString & _capsNode)
 {
+	decode();
 	v_capsNode = _capsNode;
 }
 
 void Status::setCapsVersion(const QString & _capsVersion)
 {
+	decode();
 	v_capsVersion = _capsVersion;
 }
 
 void Status::setCapsExt(const QString & _capsExt)
 {
+	decode();
 	v_capsExt = _capsExt;
 }
 
 void Status::setCapsHash(const QString & _capsHash)
 {
-    v_capsHash = _capsHash;
+	decode();
+	v_capsHash = _capsHash;
 }
 
 void Status::setMUC() 
@@ -2258,12 +2492,14 @@ void Status::setMUC()
 
 void Status::setMUCItem(const MUCItem& i)
 {
+	decode();
 	v_hasMUCItem = true;
 	v_mucItem = i;
 }
 
 void Status::setMUCDestroy(const MUCDestroy& i)
 {
+	decode();
 	v_hasMUCDestroy = true;
 	v_mucDestroy = i;
 }
@@ -2275,20 +2511,102 @@ void Status::setMUCHistory(int maxchars, int maxstanzas, int seconds)
 	v_mucHistorySeconds = seconds;
 }
 
+void Status::setMUCHistorySince(const QDateTime &since)
+{
+	v_mucHistorySince = since;
+}
+
+void Status::setExtensions(const QDomElement &presence)
+{
+	v_ext = presence;
+}
+
+void Status::decode() const
+{
+	if(!v_ext.isNull())
+		const_cast<Status*>(this)->decodeExtensions();
+}
+
+void Status::decodeExtensions()
+{
+	QDomElement e = v_ext;
+	v_ext = QDomElement(); // the setters below decode() too
+
+	for(QDomNode n = e.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		QDomElement i = n.toElement();
+		if(i.isNull())
+			continue;
+
+		if(i.tagName() == "x" && i.attribute("xmlns") == "gabber:x:music:info") {
+			QDomElement t;
+			bool found;
+			QString title, state;
+
+			t = findSubTag(i, "title", &found);
+			if(found)
+				title = tagContent(t);
+			t = findSubTag(i, "state", &found);
+			if(found)
+				state = tagContent(t);
+
+			if(!title.isEmpty() && state == "playing")
+				setSongTitle(title);
+		}
+		else if(i.tagName() == "x" && i.attribute("xmlns") == "jabber:x:signed") {
+			setXSigned(tagContent(i));
+		}
+		else if(i.tagName() == "x" && i.attribute("xmlns") == "http://jabber.org/protocol/e2e") {
+			setKeyID(tagContent(i));
+		}
+		else if(i.tagName() == "c" && i.attribute("xmlns") == "http://jabber.org/protocol/caps") {
+			setCapsNode(i.attribute("node"));
+			setCapsVersion(i.attribute("ver"));
+			setCapsExt(i.attribute("ext"));
+			setCapsHash(i.attribute("hash"));
+		}
+		else if(i.tagName() == "x" && i.attribute("xmlns") == "vcard-temp:x:update") {
+			QDomElement t;
+			bool found;
+			t = findSubTag(i, "photo", &found);
+			if (found)
+				setPhotoHash(tagContent(t));
+			else
+				setPhotoHash("");
+		}
+		else if(i.tagName() == "x" && i.attribute("xmlns") == "http://jabber.org/protocol/muc#user") {
+			for(QDomNode muc_n = i.firstChild(); !muc_n.isNull(); muc_n = muc_n.nextSibling()) {
+				QDomElement muc_e = muc_n.toElement();
+				if(muc_e.isNull())
+					continue;
+
+				if (muc_e.tagName() == "item")
+					setMUCItem(MUCItem(muc_e));
+				else if (muc_e.tagName() == "status")
+					addMUCStatus(muc_e.attribute("code").toInt());
+				else if (muc_e.tagName() == "destroy")
+					setMUCDestroy(MUCDestroy(muc_e));
+			}
+		}
+	}
+}
+
 
 const QString& Status::photoHash() const
 {
+	decode();
 	return v_photoHash;
 }
 
 void Status::setPhotoHash(const QString& h)
 {
+	decode();
 	v_photoHash = h;
 	v_hasPhotoHash = true;
 }
 
 bool Status::hasPhotoHash() const
 {
+	decode();
 	return v_hasPhotoHash;
 }
 
@@ -2367,37 +2685,44 @@ QDateTime Status::timeStamp() const
 
 const QString & Status::keyID() const
 {
+	decode();
 	return v_key;
 }
 
 const QString & Status::xsigned() const
 {
+	decode();
 	return v_xsigned;
 }
 
 const QString & Status::songTitle() const
 {
+	decode();
 	return v_songTitle;
 }
 
 const QString & Status::capsNode() const
 {
+	decode();
 	return v_capsNode;
 }
 
 const QString & Status::capsVersion() const
 {
+	decode();
 	return v_capsVersion;
 }
 
 const QString & Status::capsExt() const
 {
+	decode();
 	return v_capsExt;
 }
 
 const QString & Status::capsHash() const 
 {
-        return v_capsHash;
+	decode();
+	return v_capsHash;
 }
 
 bool Status::isMUC() const
@@ -2407,31 +2732,37 @@ bool Status::isMUC() const
 
 bool Status::hasMUCItem() const
 {
+	decode();
 	return v_hasMUCItem;
 }
 
 const MUCItem& Status::mucItem() const
 {
+	decode();
 	return v_mucItem;
 }
 
 bool Status::hasMUCDestroy() const
 {
+	decode();
 	return v_hasMUCDestroy;
 }
 
 const MUCDestroy& Status::mucDestroy() const
 {
+	decode();
 	return v_mucDestroy;
 }
 
 const QList<int>& Status::getMUCStatuses() const
 {
+	decode();
 	return v_mucStatuses;
 }
 
 void Status::addMUCStatus(int i)
 {
+	decode();
 	v_mucStatuses += i;
 }
 
@@ -2442,7 +2773,7 @@ const QString& Status::mucPassword() const
 
 bool Status::hasMUCHistory() const
 {
-	return v_mucHistoryMaxChars >= 0 || v_mucHistoryMaxStanzas >= 0 || v_mucHistorySeconds >= 0;
+	return v_mucHistoryMaxChars >= 0 || v_mucHistoryMaxStanzas >= 0 || v_mucHistorySeconds >= 0 || v_mucHistorySince.isValid();
 }
 
 int Status::mucHistoryMaxChars() const
@@ -2460,6 +2791,11 @@ int Status::mucHistorySeconds() const
 	return v_mucHistorySeconds;
 }
 
+QDateTime Status::mucHistorySince() const
+{
+	return v_mucHistorySince;
+}
+
 void Status::setMUCPassword(const QString& i)
 {
 	v_mucPassword = i;
@@ -2521,6 +2857,8 @@ void Resource::setStatus(const Status & _status)
 ResourceList::ResourceList()
 :QList<Resource>()
 {
+	v_priority = -1;
+	v_priorityCount = 0;
 }
 
 ResourceList::~ResourceList()
@@ -2537,18 +2875,30 @@ ResourceList::Iterator ResourceList::find(const QString & _find)
 	return end();
 }
 
-ResourceList::Iterator ResourceList::priority()
+int ResourceList::priorityIndex() const
 {
-	ResourceList::Iterator highest = end();
+	if(v_priority != -1 && v_priorityCount == count())
+		return v_priority;
 
-	for(ResourceList::Iterator it = begin(); it != end(); ++it) {
-		if(highest == end() || (*it).priority() > (*highest).priority())
-			highest = it;
+	int highest = -1;
+	for(int n = 0; n < count(); ++n) {
+		if(highest == -1 || at(n).priority() > at(highest).priority())
+			highest = n;
 	}
 
+	v_priority = highest;
+	v_priorityCount = count();
 	return highest;
 }
 
+ResourceList::Iterator ResourceList::priority()
+{
+	int n = priorityIndex();
+	if(n == -1)
+		return end();
+	return begin() + n;
+}
+
 ResourceList::ConstIterator ResourceList::find(const QString & _find) const
 {
 	for(ResourceList::ConstIterator it = begin(); it != end(); ++it) {
@@ -2561,97 +2911,168 @@ ResourceList::ConstIterator ResourceList::find(const QString & _find) const
 
 ResourceList::ConstIterator ResourceList::priority() const
 {
-	ResourceList::ConstIterator highest = end();
+	int n = priorityIndex();
+	if(n == -1)
+		return end();
+	return begin() + n;
+}
 
-	for(ResourceList::ConstIterator it = begin(); it != end(); ++it) {
-		if(highest == end() || (*it).priority() > (*highest).priority())
-			highest = it;
-	}
+void ResourceList::append(const Resource &r)
+{
+	QList<Resource>::append(r);
+	v_priority = -1;
+}
 
-	return highest;
+ResourceList & ResourceList::operator+=(const Resource &r)
+{
+	append(r);
+	return *this;
+}
+
+ResourceList::Iterator ResourceList::erase(ResourceList::Iterator it)
+{
+	v_priority = -1;
+	return QList<Resource>::erase(it);
+}
+
+void ResourceList::clear()
+{
+	QList<Resource>::clear();
+	v_priority = -1;
+}
+
+void ResourceList::invalidatePriority()
+{
+	v_priority = -1;
 }
 
 
 //---------------------------------------------------------------------------
 // RosterItem
 //---------------------------------------------------------------------------
+// most of a roster shares a handful of groups, so keep one copy of each
+//   name.  rosters are filled from many threads with a ClientPool
+class GroupNames
+{
+public:
+	QMutex m;
+	QSet<QString> names;
+};
+Q_GLOBAL_STATIC(GroupNames, groupNames)
+
+static QString internGroup(const QString &g)
+{
+	GroupNames *gn = groupNames();
+	if(!gn)
+		return g;
+	QMutexLocker locker(&gn->m);
+	QSet<QString>::ConstIterator it = gn->names.constFind(g);
+	if(it != gn->names.constEnd())
+		return *it;
+	gn->names.insert(g);
+	return g;
+}
+
+class RosterItem::Private : public QSharedData
+{
+public:
+	Private() : push(false) {}
+
+	Jid jid;
+	QString name;
+	QStringList groups;
+	Subscription subscription;
+	QString ask;
+	bool push;
+};
+
 RosterItem::RosterItem(const Jid &_jid)
+:d(new Private)
+{
+	d->jid = _jid;
+}
+
+RosterItem::RosterItem(const RosterItem &from)
+:d(from.d)
 {
-	v_jid = _jid;
-	v_push = false;
 }
 
 RosterItem::~RosterItem()
 {
 }
 
+RosterItem & RosterItem::operator=(const RosterItem &from)
+{
+	d = from.d;
+	return *this;
+}
+
 const Jid & RosterItem::jid() const
 {
-	return v_jid;
+	return d->jid;
 }
 
 const QString & RosterItem::name() const
 {
-	return v_name;
+	return d->name;
 }
 
 const QStringList & RosterItem::groups() const
 {
-	return v_groups;
+	return d->groups;
 }
 
 const Subscription & RosterItem::subscription() const
 {
-	return v_subscription;
+	return d->subscription;
 }
 
 const QString & RosterItem::ask() const
 {
-	return v_ask;
+	return d->ask;
 }
 
 bool RosterItem::isPush() const
 {
-	return v_push;
+	return d->push;
 }
 
 bool RosterItem::inGroup(const QString &g) const
 {
-	for(QStringList::ConstIterator it = v_groups.begin(); it != v_groups.end(); ++it) {
-		if(*it == g)
-			return true;
-	}
-	return false;
+	return d->groups.contains(g);
 }
 
 void RosterItem::setJid(const Jid &_jid)
 {
-	v_jid = _jid;
+	d->jid = _jid;
 }
 
 void RosterItem::setName(const QString &_name)
 {
-	v_name = _name;
+	d->name = _name;
 }
 
 void RosterItem::setGroups(const QStringList &_groups)
 {
-	v_groups = _groups;
+	QStringList list;
+	foreach(const QString &g, _groups)
+		list += internGroup(g);
+	d->groups = list;
 }
 
 void RosterItem::setSubscription(const Subscription &type)
 {
-	v_subscription = type;
+	d->subscription = type;
 }
 
 void RosterItem::setAsk(const QString &_ask)
 {
-	v_ask = _ask;
+	d->ask = _ask;
 }
 
 void RosterItem::setIsPush(bool b)
 {
-	v_push = b;
+	d->push = b;
 }
 
 bool RosterItem::addGroup(const QString &g)
@@ -2659,31 +3080,28 @@ bool RosterItem::addGroup(const QString &g)
 	if(inGroup(g))
 		return false;
 
-	v_groups += g;
+	d->groups += internGroup(g);
 	return true;
 }
 
 bool RosterItem::removeGroup(const QString &g)
 {
-	for(QStringList::Iterator it = v_groups.begin(); it != v_groups.end(); ++it) {
-		if(*it == g) {
-			v_groups.erase(it);
-			return true;
-		}
-	}
+	if(!inGroup(g))
+		return false;
 
-	return false;
+	d->groups.removeOne(g);
+	return true;
 }
 
 QDomElement RosterItem::toXml(QDomDocument *doc) const
 {
 	QDomElement item = doc->createElement("item");
-	item.setAttribute("jid", v_jid.full());
-	item.setAttribute("name", v_name);
-	item.setAttribute("subscription", v_subscription.toString());
-	if(!v_ask.isEmpty())
-		item.setAttribute("ask", v_ask);
-	for(QStringList::ConstIterator it = v_groups.begin(); it != v_groups.end(); ++it)
+	item.setAttribute("jid", d->jid.full());
+	item.setAttribute("name", d->name);
+	item.setAttribute("subscription", d->subscription.toString());
+	if(!d->ask.isEmpty())
+		item.setAttribute("ask", d->ask);
+	for(QStringList::ConstIterator it = d->groups.begin(); it != d->groups.end(); ++it)
 		item.appendChild(textTag(doc, "group", *it));
 
 	return item;
@@ -2710,11 +3128,11 @@ bool RosterItem::fromXml(const QDomElement &item)
 	}
 	QString a = item.attribute("ask");
 
-	v_jid = j;
-	v_name = na;
-	v_subscription = s;
-	v_groups = g;
-	v_ask = a;
+	d->jid = j;
+	d->name = na;
+	d->subscription = s;
+	setGroups(g);
+	d->ask = a;
 
 	return true;
 }
@@ -3002,6 +3420,65 @@ const QDomElement& PubSubItem::payload() const
 }
 
 
+PubSubEvent::PubSubEvent() : end_(false)
+{
+}
+
+PubSubEvent::PubSubEvent(const QDomElement &event) : end_(false)
+{
+	for(QDomNode n = event.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		QDomElement e = n.toElement();
+		if(e.tagName() == "items") {
+			items_ = e;
+			break;
+		}
+	}
+}
+
+bool PubSubEvent::isNull() const
+{
+	return items_.isNull();
+}
+
+QString PubSubEvent::node() const
+{
+	return items_.attribute("node");
+}
+
+bool PubSubEvent::next()
+{
+	if(end_)
+		return false;
+	QDomNode n = cur_.isNull() ? items_.firstChild() : cur_.nextSibling();
+	for(; !n.isNull(); n = n.nextSibling()) {
+		QDomElement e = n.toElement();
+		if(e.tagName() == "item" || e.tagName() == "retract") {
+			cur_ = e;
+			return true;
+		}
+	}
+	cur_ = QDomElement();
+	end_ = true;
+	return false;
+}
+
+bool PubSubEvent::isRetraction() const
+{
+	return cur_.tagName() == "retract";
+}
+
+QString PubSubEvent::id() const
+{
+	return cur_.attribute("id");
+}
+
+QDomElement PubSubEvent::payload() const
+{
+	if(isRetraction())
+		return QDomElement();
+	return cur_.firstChildElement();
+}
+
 PubSubRetraction::PubSubRetraction() 
 {
 }
@@ -0,0 +1,105 @@
+/*
+ * xmpp_avatarcache.cpp - process-wide cache of vCard photos (XEP-0153)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <QCache>
+#include <QMutex>
+#include <QtCrypto>
+
+#include "xmpp_avatarcache.h"
+
+// enough for a large roster of the usual 96x96 avatars
+#define AVATAR_CACHE_DEFAULT (4 * 1024 * 1024)
+
+using namespace XMPP;
+
+class AvatarCacheData
+{
+public:
+	QMutex m;
+	QCache<QString, QByteArray> photos; // cost is the size in bytes
+
+	AvatarCacheData()
+	{
+		photos.setMaxCost(AVATAR_CACHE_DEFAULT);
+	}
+};
+
+Q_GLOBAL_STATIC(AvatarCacheData, avatarcache)
+
+QByteArray AvatarCache::get(const QString &sha1)
+{
+	AvatarCacheData *c = avatarcache();
+	QMutexLocker locker(&c->m);
+	QByteArray *photo = c->photos.object(sha1.toLower());
+	return photo ? *photo : QByteArray();
+}
+
+QByteArray AvatarCache::insert(const QByteArray &photo, QString *sha1)
+{
+	QString key = photo.isEmpty() ? QString() : hash(photo);
+	if(sha1)
+		*sha1 = key;
+	if(key.isEmpty())
+		return photo;
+
+	AvatarCacheData *c = avatarcache();
+	QMutexLocker locker(&c->m);
+	QByteArray *cached = c->photos.object(key);
+	if(cached)
+		return *cached;
+
+	// QCache refuses, and deletes, anything over its capacity
+	c->photos.insert(key, new QByteArray(photo), photo.size());
+	return photo;
+}
+
+void AvatarCache::clear()
+{
+	AvatarCacheData *c = avatarcache();
+	QMutexLocker locker(&c->m);
+	c->photos.clear();
+}
+
+int AvatarCache::count()
+{
+	AvatarCacheData *c = avatarcache();
+	QMutexLocker locker(&c->m);
+	return c->photos.count();
+}
+
+void AvatarCache::setCapacity(int bytes)
+{
+	AvatarCacheData *c = avatarcache();
+	QMutexLocker locker(&c->m);
+	c->photos.setMaxCost(qMax(bytes, 0));
+}
+
+int AvatarCache::capacity()
+{
+	AvatarCacheData *c = avatarcache();
+	QMutexLocker locker(&c->m);
+	return c->photos.maxCost();
+}
+
+QString AvatarCache::hash(const QByteArray &photo)
+{
+	if(!QCA::isSupported("sha1"))
+		return QString();
+	return QString::fromLatin1(QCA::Hash("sha1").hash(photo).toByteArray().toHex());
+}
@@ -0,0 +1,53 @@
+/*
+ * xmpp_avatarcache.h - process-wide cache of vCard photos (XEP-0153)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_AVATARCACHE_H
+#define XMPP_AVATARCACHE_H
+
+#include <QByteArray>
+#include <QString>
+
+namespace XMPP
+{
+        /** \brief Decoded vCard photos shared by every client in the process, keyed by their SHA-1.
+            The key is the hex SHA-1 of the image data, which is what XEP-0153 puts in presence, so a
+            client that sees a known hash there can use get() instead of fetching the vCard.
+            VCard::photo() adds each photo it decodes, and contacts with the same avatar then share
+            one copy.  The least recently used photos are dropped beyond capacity(). */
+	class AvatarCache
+	{
+	public:
+                /** \brief Look up the photo with hex SHA-1 \a sha1, or return an empty array. */
+		static QByteArray get(const QString &sha1);
+                /** \brief Add \a photo, and return the copy to keep, which is the cached one if it was there already.
+                    Its hash is stored in \a sha1, if given. */
+		static QByteArray insert(const QByteArray &photo, QString *sha1 = 0);
+		static void clear();
+		static int count();
+
+                /** \brief Limit the cache to \a bytes of photo data.  0 disables caching. */
+		static void setCapacity(int bytes);
+		static int capacity();
+
+                /** \brief The XEP-0153 hash of \a photo: hex SHA-1, or an empty string if SHA-1 is unsupported. */
+		static QString hash(const QByteArray &photo);
+	};
+}
+
+#endif
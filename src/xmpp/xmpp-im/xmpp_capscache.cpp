@@ -0,0 +1,238 @@
+/*
+ * xmpp_capscache.cpp - process-wide cache of entity capabilities (XEP-0115)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <QDomDocument>
+#include <QDomElement>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QStringList>
+#include <QtCrypto>
+
+#include "xmpp/base64/base64.h"
+#include "xmpp_features.h"
+#include "xmpp_capscache.h"
+
+// there are only so many client versions around, but don't let a
+//   flood of made-up hashes grow it without bound
+#define CAPS_CACHE_MAX 4096
+
+#define NS_XML "http://www.w3.org/XML/1998/namespace"
+
+using namespace XMPP;
+
+class CapsCacheData
+{
+public:
+	QMutex m;
+	QHash<QString, DiscoItem> items;
+	QStringList order; // oldest first
+};
+
+Q_GLOBAL_STATIC(CapsCacheData, capscache)
+
+static QString capsKey(const QString &hash, const QString &ver)
+{
+	return hash + ' ' + ver;
+}
+
+bool CapsCache::get(const QString &hash, const QString &ver, DiscoItem *item)
+{
+	CapsCacheData *c = capscache();
+	QMutexLocker locker(&c->m);
+	QHash<QString, DiscoItem>::ConstIterator it = c->items.constFind(capsKey(hash, ver));
+	if(it == c->items.constEnd())
+		return false;
+	*item = it.value();
+	return true;
+}
+
+void CapsCache::insert(const QString &hash, const QString &ver, const DiscoItem &item)
+{
+	CapsCacheData *c = capscache();
+	QMutexLocker locker(&c->m);
+	QString key = capsKey(hash, ver);
+	if(c->items.contains(key))
+		return;
+
+	while(c->order.count() >= CAPS_CACHE_MAX)
+		c->items.remove(c->order.takeFirst());
+
+	// only what the hash covers is worth keeping
+	DiscoItem i;
+	i.setNode(item.node());
+	i.setIdentities(item.identities());
+	i.setFeatures(item.features());
+	c->items.insert(key, i);
+	c->order += key;
+}
+
+void CapsCache::clear()
+{
+	CapsCacheData *c = capscache();
+	QMutexLocker locker(&c->m);
+	c->items.clear();
+	c->order.clear();
+}
+
+int CapsCache::count()
+{
+	CapsCacheData *c = capscache();
+	QMutexLocker locker(&c->m);
+	return c->items.count();
+}
+
+QDomElement CapsCache::toXml(QDomDocument *doc)
+{
+	CapsCacheData *c = capscache();
+	QMutexLocker locker(&c->m);
+
+	QDomElement caps = doc->createElement("capabilities");
+	foreach(const QString &key, c->order) {
+		const DiscoItem &item = c->items[key];
+		int at = key.indexOf(' ');
+
+		QDomElement info = doc->createElement("info");
+		info.setAttribute("hash", key.left(at));
+		info.setAttribute("ver", key.mid(at + 1));
+		if(!item.node().isEmpty())
+			info.setAttribute("node", item.node());
+		foreach(const DiscoItem::Identity &id, item.identities()) {
+			QDomElement i = doc->createElement("identity");
+			i.setAttribute("category", id.category);
+			i.setAttribute("type", id.type);
+			if(!id.name.isEmpty())
+				i.setAttribute("name", id.name);
+			info.appendChild(i);
+		}
+		foreach(const QString &f, item.features().list()) {
+			QDomElement i = doc->createElement("feature");
+			i.setAttribute("var", f);
+			info.appendChild(i);
+		}
+		caps.appendChild(info);
+	}
+	return caps;
+}
+
+bool CapsCache::fromXml(const QDomElement &e)
+{
+	if(e.tagName() != "capabilities")
+		return false;
+
+	for(QDomNode n = e.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		QDomElement info = n.toElement();
+		if(info.isNull() || info.tagName() != "info")
+			continue;
+
+		DiscoItem item;
+		DiscoItem::Identities identities;
+		QStringList features;
+		item.setNode(info.attribute("node"));
+		for(QDomNode in = info.firstChild(); !in.isNull(); in = in.nextSibling()) {
+			QDomElement i = in.toElement();
+			if(i.tagName() == "identity") {
+				DiscoItem::Identity id;
+				id.category = i.attribute("category");
+				id.type = i.attribute("type");
+				id.name = i.attribute("name");
+				identities += id;
+			}
+			else if(i.tagName() == "feature")
+				features += i.attribute("var");
+		}
+		item.setIdentities(identities);
+		item.setFeatures(features);
+		insert(info.attribute("hash"), info.attribute("ver"), item);
+	}
+	return true;
+}
+
+// returns false on a duplicate, which makes the whole query invalid
+static bool appendSorted(QString *s, QStringList l)
+{
+	l.sort();
+	for(int n = 0; n < l.count(); ++n) {
+		if(n > 0 && l[n] == l[n - 1])
+			return false;
+		*s += l[n] + '<';
+	}
+	return true;
+}
+
+QString CapsCache::computeVer(const QDomElement &query, const QString &hash)
+{
+	if(hash != "sha-1" || !QCA::isSupported("sha1"))
+		return QString();
+
+	QStringList identities, features;
+	QMap<QString, QDomElement> forms;
+	for(QDomNode n = query.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		QDomElement e = n.toElement();
+		if(e.isNull())
+			continue;
+
+		if(e.tagName() == "identity") {
+			QString lang = e.attributeNS(NS_XML, "lang", e.attribute("xml:lang"));
+			identities += e.attribute("category") + '/' + e.attribute("type") + '/' + lang + '/' + e.attribute("name");
+		}
+		else if(e.tagName() == "feature")
+			features += e.attribute("var");
+		else if(e.tagName() == "x" && (e.namespaceURI() == "jabber:x:data" || e.attribute("xmlns") == "jabber:x:data")) {
+			// only forms with a FORM_TYPE take part
+			for(QDomNode fn = e.firstChild(); !fn.isNull(); fn = fn.nextSibling()) {
+				QDomElement f = fn.toElement();
+				if(f.tagName() == "field" && f.attribute("var") == "FORM_TYPE") {
+					QString type = f.firstChildElement("value").text();
+					if(forms.contains(type))
+						return QString();
+					forms.insert(type, e);
+					break;
+				}
+			}
+		}
+	}
+
+	QString s;
+	if(!appendSorted(&s, identities) || !appendSorted(&s, features))
+		return QString();
+
+	// QMap hands the forms back ordered by FORM_TYPE
+	for(QMap<QString, QDomElement>::ConstIterator it = forms.begin(); it != forms.end(); ++it) {
+		s += it.key() + '<';
+		QMap<QString, QStringList> fields;
+		for(QDomNode fn = it.value().firstChild(); !fn.isNull(); fn = fn.nextSibling()) {
+			QDomElement f = fn.toElement();
+			if(f.tagName() != "field" || f.attribute("var") == "FORM_TYPE")
+				continue;
+			QStringList values;
+			for(QDomElement v = f.firstChildElement("value"); !v.isNull(); v = v.nextSiblingElement("value"))
+				values += v.text();
+			values.sort();
+			fields.insert(f.attribute("var"), values);
+		}
+		for(QMap<QString, QStringList>::ConstIterator fit = fields.begin(); fit != fields.end(); ++fit) {
+			s += fit.key() + '<';
+			foreach(const QString &v, fit.value())
+				s += v + '<';
+		}
+	}
+
+	return Base64::encode(QCA::Hash("sha1").hash(s.toUtf8()).toByteArray());
+}
@@ -0,0 +1,53 @@
+/*
+ * xmpp_capscache.h - process-wide cache of entity capabilities (XEP-0115)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_CAPSCACHE_H
+#define XMPP_CAPSCACHE_H
+
+#include <QString>
+
+#include "xmpp_discoitem.h"
+
+class QDomDocument;
+class QDomElement;
+
+namespace XMPP
+{
+        /** \brief Disco#info results shared by every client in the process, keyed by caps verification string.
+            Entries are only added once the reply hashed back to the advertised ver, so one entity cannot
+            poison the answer for others.  DiscoInfoTask::getCaps() consults it.  To keep it between runs,
+            save toXml() and feed it back to fromXml(). */
+	class CapsCache
+	{
+	public:
+                /** \brief Look up the identities and features behind \a ver, hashed with \a hash (such as "sha-1"). */
+		static bool get(const QString &hash, const QString &ver, DiscoItem *item);
+		static void insert(const QString &hash, const QString &ver, const DiscoItem &item);
+		static void clear();
+		static int count();
+
+		static QDomElement toXml(QDomDocument *doc);
+		static bool fromXml(const QDomElement &e);
+
+                /** \brief Compute the ver a disco#info \a query hashes to, or an empty string if \a hash is unsupported or the query is malformed. */
+		static QString computeVer(const QDomElement &query, const QString &hash);
+	};
+}
+
+#endif
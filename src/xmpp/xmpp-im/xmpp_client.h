@@ -25,6 +25,7 @@
 
 #include "xmpp/jid/jid.h"
 #include "xmpp_status.h"
+#include "xmpp_chatstate.h"
 #include "xmpp_discoitem.h"
 
 class QString;
@@ -42,14 +43,49 @@ namespace XMPP {
 	class Resource;
 	class ResourceList;
 	class Roster;
+	class RosterCache;
 	class RosterItem;
 	class S5BManager;
+	class Stanza;
 	class Stream;
 	class Task;
 }
 
 namespace XMPP
 {
+        /** \brief One presence applied while Client batches presences, see Client::setPresenceBatching().
+            For roster and own resources, the resulting state is also in Client::roster() and
+            Client::resourceList(); an unavailable resource is no longer there. */
+	class PresenceChange
+	{
+	public:
+		enum Kind { RosterResource, SelfResource, GroupChatOccupant };
+
+		PresenceChange() : kind(RosterResource) {}
+		PresenceChange(Kind k, const Jid &j, const Status &s) : kind(k), jid(j), status(s) {}
+
+		Kind kind;
+		Jid jid;
+		Status status;
+	};
+
+        /** \brief How Client::groupChatJoin() enters a room.
+            The history limits are those of XEP-0045: -1 leaves one to the room, and a maxStanzas of 0 asks for no history at all. */
+	class GroupChatJoinOptions
+	{
+	public:
+		GroupChatJoinOptions() : maxChars(-1), maxStanzas(-1), seconds(-1), lightOccupants(false) {}
+
+		QString password;
+		int maxChars, maxStanzas, seconds;
+		QDateTime since; // only history after this, if valid
+		Status status;   // presence to enter with
+                /** \brief Only keep a nick and a show for the other occupants, taken from their presences without building a Status.
+                    Their presences are then only announced with groupChatOccupantsChanged(), not groupChatPresence() and the
+                    groupChatOccupant*() signals; our own presence in the room still goes the full way. */
+		bool lightOccupants;
+	};
+
         /** \brief Full features main class that represents one connection to XMPP server. */
 	class Client : public QObject
 	{
@@ -65,6 +101,16 @@ namespace XMPP
 		void start(const QString &host, const QString &user, const QString &pass, const QString &resource);
 		void close(bool fast=false);
 
+                /** \brief Keep \a s connected through TLS, and SASL with \a auth, to take over when the stream in use fails.
+                    See ClientStream::setStandby().  The connector of \a s would best point at another server of the SRV set than the main stream's, and \a s needs the
+                    same login params and, to resume the session (XEP-0198), stream management.  It is connected again every
+                    \a refreshSecs, as servers drop connections left unauthenticated, and after it fails.  On an error of the stream in
+                    use, failedOver() is emitted and \a s goes on to bind or resume in its place, in well under a second.  \a s then
+                    becomes the stream in use, and the standby is gone: set another for the next failure.  Null for none.
+                    Client doesn't own either stream. */
+		void setStandbyStream(ClientStream *s, const Jid &j, bool auth=true, int refreshSecs=240);
+		ClientStream *standbyStream() const;
+
 		Stream & stream();
 		QString streamBaseNS() const;
 		const LiveRoster & roster() const;
@@ -73,7 +119,29 @@ namespace XMPP
                 /** \brief Send XML subtree over wire.
                     You should use \see Stanza class to form that subtree. */
 		void send(const QDomElement &);
+                /** \brief Send a stanza as it is, without the namespace rewriting that send(const QDomElement &) does.
+                    The stanza must belong to stream() and have its namespaces set, as Message::toStanza() and Stream::createStanza() make it. */
+		void send(const Stanza &);
 		void send(const QString &);
+                /** \brief Serialize \a x once, with the namespace rewriting of send(const QDomElement &), for sending to many recipients.
+                    Null while not connected.  See ClientStream::createTemplate(). */
+		StanzaTemplate createTemplate(const QDomElement &x);
+                /** \brief Send \a t to \a to, with \a id if not empty.  debugText() only gets a line naming the recipient. */
+		void send(const StanzaTemplate &t, const Jid &to, const QString &id=QString());
+                /** \brief True if a stanza written with XmlWriter can go out through sendUtf8(), skipping QDom.
+                    Not while debugText() or xmlOutgoing() have receivers, as they want the element, nor while ClientStream::canWriteUtf8() is false. */
+		bool canSendUtf8() const;
+                /** \brief Send one complete stanza in UTF-8, written in the scope of ClientStream::writeScopeNS().  Only when canSendUtf8() is true. */
+		void sendUtf8(const QByteArray &stanza);
+                /** \brief The default namespace to write such a stanza in the scope of, see ClientStream::writeScopeNS(). */
+		QString writeScopeNS() const;
+                /** \brief Send the message or presence \a x to each of \a to.
+                    If the server relays extended addressing (XEP-0033), this is one stanza to the server listing the recipients
+                    as bcc, otherwise one stanza per recipient built from one template.  The server is asked on the first call of
+                    a session, and sends wait for its answer.  The 'to' of \a x is ignored. */
+		void sendToMany(const QDomElement &x, const QList<Jid> &to);
+                /** \brief Whether the server has been found to relay extended addressing, see sendToMany(). */
+		bool serverSupportsMulticast() const;
 
 		QString host() const;
 		QString user() const;
@@ -82,16 +150,57 @@ namespace XMPP
 		Jid jid() const;
 
 		void rosterRequest();
+                /** \brief Keep the roster in \a cache between sessions and only fetch changes (XEP-0237).
+                    The cache is not owned by Client.  Pass 0 to always fetch the full roster. */
+		void setRosterCache(RosterCache *cache);
+		RosterCache *rosterCache() const;
 		void sendMessage(const Message &);
 		void sendSubscription(const Jid &, const QString &, const QString& nick = QString());
                 /** \brief Change my presence information to specified status. */
 		void setPresence(const Status &);
+                /** \brief Collect the presences received in one event loop turn and apply them together.
+                    Only the last presence of each full jid in a turn is applied.  Instead of
+                    resourceAvailable(), resourceUnavailable() and groupChatPresence() for each one,
+                    presenceBatch() is emitted once per turn.  Group chat joins, leaves and errors,
+                    and presenceError(), are still signalled as they happen.  Off by default. */
+		void setPresenceBatching(bool b);
+		bool presenceBatching() const;
 
 		void debug(const QString &);
                 /** \brief Generate unique identifier that can be used in new IQ requests or messages. */
 		QString genUniqueId();
                 /** \brief Get task that distributes incoming stanzas to other tasks. */
 		Task *rootTask();
+                /** \brief Number of tasks currently attached to the root task, such as requests awaiting their reply.
+                    Counting is linear in the number of tasks, which is fine for periodic monitoring. */
+		int taskCount() const;
+                /** \brief Fail IQ requests with Task::ErrTimeout when their reply doesn't arrive within \a msecs.
+                    0, the default, waits forever.  Tasks may set their own with Task::setTimeout(). */
+		void setIqTimeout(int msecs);
+		int iqTimeout() const;
+                /** \brief Send at most \a count IQ requests to one JID at a time.
+                    Further requests to it wait, in order, until one of those is answered or times out.  0, the default, means no limit. */
+		void setMaxOutstandingIq(int count);
+		int maxOutstandingIq() const;
+                /** \brief Reuse the results of disco#info, disco#items and vCard queries for \a msecs after they came in.
+                    Identical queries sent at the same time are always merged into one.  0, the default, caches nothing,
+                    and a long time may hand out stale results, so keep this short, e.g. to get through a login. */
+		void setIqCacheTime(int msecs);
+		int iqCacheTime() const;
+                /** \brief Only pass on pubsub events from these \a nodes.  A message with an event from another node and no body is dropped
+                    before it is decoded.  Empty, the default, passes on all events. */
+		void setPubSubNodeFilter(const QStringList &nodes);
+		QStringList pubSubNodeFilter() const;
+		bool acceptsPubSubNode(const QString &node) const;
+                /** \brief Pass messages that carry nothing but a chat state or a delivery receipt to chatStateReceived() and receiptReceived(),
+                    without building a Message for them, rather than to messageReceived().  Off by default. */
+		void setNotificationFastPath(bool);
+		bool notificationFastPath() const;
+                /** \brief The 'from' of \a x.  While \a x is being offered to the tasks, this is the Jid parsed and checked once as it came in;
+                    for any other element the attribute is parsed. */
+		Jid stanzaFrom(const QDomElement &x) const;
+                /** \brief The 'to' of \a x, parsed at most once while \a x is being offered to the tasks.  See stanzaFrom(). */
+		Jid stanzaTo(const QDomElement &x) const;
 		QDomDocument *doc() const;
 
 		QString OSName() const;
@@ -127,7 +236,14 @@ namespace XMPP
 		void removeExtension(const QString& ext);
 		const Features& extension(const QString& ext) const;
 		QStringList extensions() const;
+                /** \brief The disco#info query that answers for \a node about this client, built from the identity, features
+                    and extensions.  Null if \a node is not ours. */
+		QDomElement selfDiscoInfo(const QString &node = QString()) const;
+                /** \brief The sha-1 verification string of the features of capsNode()#capsVersion(), as in XEP-0115 1.5.
+                    Kept until the identity, features or extensions change. */
+		QString capsVer() const;
 		
+                /** \brief The bytestream managers, made on first use.  Until then, bytestream offers are refused. */
 		S5BManager *s5bManager() const;
 		IBBManager *ibbManager() const;
 		JidLinkManager *jidLinkManager() const;
@@ -137,13 +253,25 @@ namespace XMPP
 
 		QString groupChatPassword(const QString& host, const QString& room) const;
 		bool groupChatJoin(const QString &host, const QString &room, const QString &nick, const QString& password = QString(), int maxchars = -1, int maxstanzas = -1, int seconds = -1, const Status& = Status());
+		bool groupChatJoin(const QString &host, const QString &room, const QString &nick, const GroupChatJoinOptions &opts);
 		void groupChatSetStatus(const QString &host, const QString &room, const Status &);
+                /** \brief Set \a status in every joined room.  The presence is built and serialized once and only its 'to' differs per room. */
+		void groupChatSetStatus(const Status &status);
 		void groupChatChangeNick(const QString &host, const QString &room, const QString &nick, const Status &);
 		void groupChatLeave(const QString &host, const QString &room);
+                /** \brief Nicks of the occupants of \a room, a room joined with groupChatJoin(), as its presences have told so far. */
+		QStringList groupChatOccupants(const Jid &room) const;
+                /** \brief Fill in the last presence of \a occupant (room\@host/nick).  Returns false if it isn't in the room. */
+		bool groupChatOccupant(const Jid &occupant, Status *status) const;
+                /** \brief Whether a presence from \a occupant is only recorded, see GroupChatJoinOptions::lightOccupants. */
+		bool groupChatLightOccupant(const Jid &occupant) const;
 
 	signals:
 		void activated();
 		void disconnected();
+                /** \brief The standby took over from \a old, which failed.  Its authenticated() follows once bound, and
+                    ClientStream::isResumed() then tells if roster and presence have to be set up again. */
+		void failedOver(XMPP::ClientStream *old);
 		//void authFinished(bool, int, const QString &);
 		void rosterRequestFinished(bool, int, const QString &);
 		void rosterItemAdded(const RosterItem &);
@@ -154,6 +282,10 @@ namespace XMPP
 		void presenceError(const Jid &, int, const QString &);
 		void subscription(const Jid &, const QString &, const QString &);
 		void messageReceived(const Message &);
+                /** \brief A chat state on its own, see setNotificationFastPath(). */
+		void chatStateReceived(const Jid &from, ChatState state);
+                /** \brief A receipt on its own for the message with id \a id, see setNotificationFastPath(). */
+		void receiptReceived(const Jid &from, const QString &id);
 		void debugText(const QString &);
 		void xmlIncoming(const QString &);
 		void xmlOutgoing(const QString &);
@@ -161,11 +293,27 @@ namespace XMPP
 		void groupChatLeft(const Jid &);
 		void groupChatPresence(const Jid &, const Status &);
 		void groupChatError(const Jid &, int, const QString &);
+                /** \brief Changes of the occupant table of a joined room, one occupant (room\@host/nick) at a time.
+                    Emitted along with groupChatPresence(), but not while presences are batched, see setPresenceBatching(). */
+		void groupChatOccupantJoined(const Jid &, const Status &);
+		void groupChatOccupantChanged(const Jid &, const Status &);
+		void groupChatOccupantLeft(const Jid &, const Status &);
+		void presenceBatch(const QList<PresenceChange> &);
+                /** \brief The occupants of \a room changed, for a room joined with GroupChatJoinOptions::lightOccupants.
+                    Emitted once for all the presences that came in together. */
+		void groupChatOccupantsChanged(const Jid &room);
 
 		void incomingJidLink();
 
 		void beginImportRoster();
 		void endImportRoster();
+                /** \brief A whole roster, as received when (re)connecting, was applied.  Lists the items added, changed and removed
+                    by it, after their rosterItemAdded(), rosterItemUpdated() and rosterItemRemoved().  Items that stayed the same
+                    are not signalled at all. */
+		void rosterMerged(const QList<RosterItem> &added, const QList<RosterItem> &changed, const QList<RosterItem> &removed);
+                /** \brief What this client answers to version and disco#info queries changed, by one of the setters
+                    such as setFeatures(), setIdentity(), addExtension() or setClientName(). */
+		void selfInfoChanged();
 
 	private slots:
 		//void streamConnected();
@@ -177,27 +325,51 @@ namespace XMPP
 		void streamReadyRead();
 		void streamIncomingXml(const QString &);
 		void streamOutgoingXml(const QString &);
+		void standbyError();
+		void standbyRefresh();
 
 		void slotRosterRequestFinished();
+		void storeRosterCache();
 
 		// basic daemons
 		void ppSubscription(const Jid &, const QString &, const QString&);
 		void ppPresence(const Jid &, const Status &);
+		void processPresenceBatch();
+		void ppOccupant(const Jid &, bool available, const QString &show);
+		void emitOccupantsChanged();
 		void pmMessage(const Message &);
-		void prRoster(const Roster &);
+		void pmChatState(const Jid &, const QString &, ChatState);
+		void pmReceipt(const Jid &, const QString &, const QString &);
+		void prRoster(const Roster &, const QString &ver);
 
 		void s5b_incomingReady();
 		void ibb_incomingReady();
+		void multicastProbeFinished();
 
 	public:
 		class GroupChat;
+
+	protected:
+		void connectNotify(const char *signal);
+		void disconnectNotify(const char *signal);
+
 	private:
+		void updateStreamXml();
 		void cleanup();
+		void attachStream(ClientStream *s);
+		bool failOver();
+		void selfInfoUpdated();
 		void distribute(const QDomElement &);
+		void fanOut(const QDomElement &x, const QList<Jid> &to, bool multicast);
 		void importRoster(const Roster &);
 		void importRosterItem(const RosterItem &);
-		void updateSelfPresence(const Jid &, const Status &);
-		void updatePresence(LiveRosterItem *, const Jid &, const Status &);
+		void mergeRoster(const Roster &);
+		void updateRosterCache(const Roster &, const QString &ver);
+		void applyPresence(const Jid &, const Status &, QList<PresenceChange> *batch);
+		void updateOccupant(const Jid &, const Status &, QList<PresenceChange> *batch);
+		bool fromJoinedRoom(const Jid &from, const QString &type) const;
+		void updateSelfPresence(const Jid &, const Status &, QList<PresenceChange> *batch);
+		void updatePresence(LiveRosterItem *, const Jid &, const Status &, QList<PresenceChange> *batch);
 
 		class ClientPrivate;
 		ClientPrivate *d;
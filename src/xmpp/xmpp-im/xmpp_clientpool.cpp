@@ -0,0 +1,226 @@
+/*
+ * xmpp_clientpool.cpp - run many clients on a few threads
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmpp_clientpool.h"
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QThread>
+
+#include "xmpp_client.h"
+#include "xmpp_clientstream.h"
+
+using namespace XMPP;
+
+// lives on a shard's thread and does the work there that has to be
+//   done on the thread owning the clients
+class ShardHost : public QObject
+{
+	Q_OBJECT
+public:
+	class Pending
+	{
+	public:
+		Client *client;
+		ClientStream *stream;
+		Jid jid;
+		bool auth;
+	};
+
+	// taken by the pool as well, to count and find clients
+	mutable QMutex m;
+	QHash<QObject*, ClientStream*> clients;
+	QList<Pending> pending;
+
+	ShardHost() {}
+
+public slots:
+	void startPending()
+	{
+		QList<Pending> list;
+		{
+			QMutexLocker locker(&m);
+			list = pending;
+			pending.clear();
+		}
+		foreach(const Pending &p, list) {
+			connect(p.client, SIGNAL(destroyed(QObject *)), SLOT(client_destroyed(QObject *)), Qt::DirectConnection);
+			p.client->connectToServer(p.stream, p.jid, p.auth);
+		}
+	}
+
+	void collect(void *out)
+	{
+		ShardStatistics *st = static_cast<ShardStatistics*>(out);
+		QMutexLocker locker(&m);
+		st->clients = clients.count();
+		foreach(ClientStream *cs, clients) {
+			StreamStatistics s = cs->statistics();
+			StreamStatistics &t = st->streams;
+			t.stanzasIn += s.stanzasIn;
+			t.stanzasOut += s.stanzasOut;
+			t.stanzasFiltered += s.stanzasFiltered;
+			t.wireBytesIn += s.wireBytesIn;
+			t.wireBytesOut += s.wireBytesOut;
+			t.plainBytesIn += s.plainBytesIn;
+			t.plainBytesOut += s.plainBytesOut;
+			t.bytesToWrite += s.bytesToWrite;
+			t.parseTime.merge(s.parseTime);
+			t.serializeTime.merge(s.serializeTime);
+		}
+	}
+
+	void deleteClients()
+	{
+		QList<QObject*> list;
+		{
+			QMutexLocker locker(&m);
+			list = clients.keys();
+		}
+		qDeleteAll(list);
+	}
+
+private slots:
+	void client_destroyed(QObject *obj)
+	{
+		ClientStream *cs;
+		{
+			QMutexLocker locker(&m);
+			cs = clients.take(obj);
+		}
+		delete cs;
+	}
+};
+
+class ClientPool::Private
+{
+public:
+	QList<QThread*> threads;
+	QList<ShardHost*> hosts;
+
+	ShardHost *hostOf(int shard) const
+	{
+		if(shard < 0 || shard >= hosts.count())
+			return 0;
+		return hosts[shard];
+	}
+};
+
+ClientPool::ClientPool(int shards, QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+	if(shards <= 0)
+		shards = qMax(QThread::idealThreadCount(), 1);
+	for(int n = 0; n < shards; ++n) {
+		QThread *t = new QThread;
+		ShardHost *h = new ShardHost;
+		h->moveToThread(t);
+		t->start();
+		d->threads += t;
+		d->hosts += h;
+	}
+}
+
+ClientPool::~ClientPool()
+{
+	for(int n = 0; n < d->hosts.count(); ++n) {
+		QMetaObject::invokeMethod(d->hosts[n], "deleteClients", Qt::BlockingQueuedConnection);
+		d->threads[n]->quit();
+		d->threads[n]->wait();
+		delete d->hosts[n];
+		delete d->threads[n];
+	}
+	delete d;
+}
+
+int ClientPool::shardCount() const
+{
+	return d->hosts.count();
+}
+
+QThread *ClientPool::shardThread(int shard) const
+{
+	if(shard < 0 || shard >= d->threads.count())
+		return 0;
+	return d->threads[shard];
+}
+
+int ClientPool::add(Client *client, ClientStream *stream, const Jid &jid, bool auth)
+{
+	int best = 0;
+	for(int n = 1; n < d->hosts.count(); ++n) {
+		if(clientCount(n) < clientCount(best))
+			best = n;
+	}
+
+	ShardHost *h = d->hosts[best];
+	client->moveToThread(d->threads[best]);
+	stream->moveToThread(d->threads[best]);
+
+	ShardHost::Pending p;
+	p.client = client;
+	p.stream = stream;
+	p.jid = jid;
+	p.auth = auth;
+	{
+		QMutexLocker locker(&h->m);
+		h->clients.insert(client, stream);
+		h->pending += p;
+	}
+	QMetaObject::invokeMethod(h, "startPending", Qt::QueuedConnection);
+	return best;
+}
+
+int ClientPool::shardOf(Client *client) const
+{
+	for(int n = 0; n < d->hosts.count(); ++n) {
+		QMutexLocker locker(&d->hosts[n]->m);
+		if(d->hosts[n]->clients.contains(client))
+			return n;
+	}
+	return -1;
+}
+
+int ClientPool::clientCount(int shard) const
+{
+	ShardHost *h = d->hostOf(shard);
+	if(!h)
+		return 0;
+	QMutexLocker locker(&h->m);
+	return h->clients.count();
+}
+
+ShardStatistics ClientPool::statistics(int shard) const
+{
+	ShardStatistics st;
+	ShardHost *h = d->hostOf(shard);
+	if(!h)
+		return st;
+	if(QThread::currentThread() == h->thread())
+		h->collect(&st);
+	else
+		QMetaObject::invokeMethod(h, "collect", Qt::BlockingQueuedConnection, Q_ARG(void*, &st));
+	return st;
+}
+
+#include "xmpp_clientpool.moc"
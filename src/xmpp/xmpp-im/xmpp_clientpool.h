@@ -0,0 +1,81 @@
+/*
+ * xmpp_clientpool.h - run many clients on a few threads
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_CLIENTPOOL_H
+#define XMPP_CLIENTPOOL_H
+
+#include <QObject>
+
+#include "xmpp_statistics.h"
+
+class QThread;
+
+namespace XMPP
+{
+	class Client;
+	class ClientStream;
+	class Jid;
+
+        /** \brief Counters summed over the clients of one ClientPool shard. */
+	class ShardStatistics
+	{
+	public:
+		ShardStatistics() : clients(0) {}
+
+		int clients;
+		StreamStatistics streams;
+	};
+
+        /** \brief Hosts many accounts in one process, spread over a fixed set of threads ("shards").
+            Each client added is moved, along with its stream, to the shard with the fewest clients,
+            and from then on lives entirely on that thread: its tasks, parsing, TLS and timers all run
+            there, and clients on different shards don't wait for each other.  The caps cache, the
+            avatar cache, name resolution and the stringprep cache are shared by all shards.
+            A client on a shard must only be used from its thread, or through queued connections
+            and QMetaObject::invokeMethod(), as with any QObject living on another thread. */
+	class ClientPool : public QObject
+	{
+		Q_OBJECT
+	public:
+                /** \brief Start \a shards threads, or one per core if 0. */
+		ClientPool(int shards=0, QObject *parent=0);
+                /** \brief Stop the threads.  Clients still on them are deleted first. */
+		~ClientPool();
+
+		int shardCount() const;
+		QThread *shardThread(int shard) const;
+
+                /** \brief Move \a client and \a stream to the least loaded shard and connect \a client to \a jid there, as Client::connectToServer() would.
+                    Neither may have a parent, and both must belong to the calling thread.  The stream is deleted along with the client.
+                    Returns the shard used.  The pool forgets the client once it is deleted, which has to happen on its shard, e.g. with deleteLater(). */
+		int add(Client *client, ClientStream *stream, const Jid &jid, bool auth=true);
+                /** \brief The shard \a client runs on, or -1 if it isn't in the pool. */
+		int shardOf(Client *client) const;
+		int clientCount(int shard) const;
+
+                /** \brief Counters of the clients on \a shard, gathered on its thread.  Blocks until that thread has time for it. */
+		ShardStatistics statistics(int shard) const;
+
+	private:
+		class Private;
+		Private *d;
+	};
+}
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * xmpp_componentclient.cpp - many jids over one component stream
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmpp_componentclient.h"
+
+#include <QHash>
+#include <QPointer>
+#include <QTimer>
+
+#include "xmpp_clientstream.h"
+#include "xmpp/base/idgenerator.h"
+
+// like Client, leave the event loop some air between large batches
+#define STANZAS_PER_TURN 100
+
+using namespace XMPP;
+
+class ComponentClient::Private
+{
+public:
+	Private() : stream(0), active(false), id_seed(0xaaaa) {}
+
+	ClientStream *stream;
+	Jid domain;
+	bool active;
+	int id_seed;
+
+	// by bare jid, or by the domain for the domain itself
+	QHash<QString, Handler*> handlers;
+};
+
+ComponentClient::ComponentClient(QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+}
+
+ComponentClient::~ComponentClient()
+{
+	close();
+	delete d;
+}
+
+void ComponentClient::connectToServer(ClientStream *s, const Jid &domain, const QString &secret)
+{
+	if(d->stream)
+		d->stream->disconnect(this);
+	cleanup();
+
+	d->stream = s;
+	d->domain = Jid(domain.domain());
+	connect(d->stream, SIGNAL(authenticated()), SLOT(streamAuthenticated()));
+	connect(d->stream, SIGNAL(readyRead()), SLOT(streamReadyRead()));
+	connect(d->stream, SIGNAL(error(int)), SLOT(streamError(int)));
+	connect(d->stream, SIGNAL(connectionClosed()), SLOT(streamClosed()));
+	connect(d->stream, SIGNAL(delayedCloseFinished()), SLOT(streamClosed()));
+
+	d->stream->connectAsComponent(d->domain, secret);
+}
+
+void ComponentClient::close()
+{
+	if(d->stream) {
+		d->stream->disconnect(this);
+		d->stream->close();
+		d->stream = 0;
+	}
+	cleanup();
+}
+
+void ComponentClient::cleanup()
+{
+	d->active = false;
+}
+
+bool ComponentClient::isActive() const
+{
+	return d->active;
+}
+
+Jid ComponentClient::domain() const
+{
+	return d->domain;
+}
+
+ClientStream *ComponentClient::stream() const
+{
+	return d->stream;
+}
+
+bool ComponentClient::isLocal(const Jid &j) const
+{
+	return !j.isEmpty() && !d->domain.isEmpty() && j.domain() == d->domain.domain();
+}
+
+void ComponentClient::setHandler(const Jid &j, Handler *h)
+{
+	if(h)
+		d->handlers.insert(j.bare(), h);
+	else
+		d->handlers.remove(j.bare());
+}
+
+ComponentClient::Handler *ComponentClient::handler(const Jid &j) const
+{
+	return d->handlers.value(j.bare());
+}
+
+Stanza ComponentClient::createStanza(Stanza::Kind k, const Jid &from, const Jid &to, const QString &type, const QString &id)
+{
+	Stanza s = d->stream->createStanza(k, to, type, id);
+	s.setFrom(from);
+	return s;
+}
+
+bool ComponentClient::send(const Stanza &s)
+{
+	if(!d->active)
+		return false;
+
+	Stanza out = s;
+	if(out.from().isEmpty())
+		out.setFrom(d->domain);
+	// the server would close the stream over it
+	else if(!isLocal(out.from()))
+		return false;
+
+	d->stream->write(out);
+	return true;
+}
+
+QString ComponentClient::genUniqueId()
+{
+	QString s = IdGenerator::counterId('c', d->id_seed);
+	d->id_seed += 0x10;
+	return s;
+}
+
+void ComponentClient::streamAuthenticated()
+{
+	d->active = true;
+	connected();
+}
+
+void ComponentClient::streamReadyRead()
+{
+	QPointer<QObject> self = this;
+
+	for(int n = 0; self && d->stream && d->stream->stanzaAvailable(); ++n) {
+		if(n == STANZAS_PER_TURN) {
+			QTimer::singleShot(0, this, SLOT(streamReadyRead()));
+			return;
+		}
+		distribute(d->stream->read());
+	}
+}
+
+void ComponentClient::distribute(const Stanza &s)
+{
+	// the user's handler first, then the domain's
+	Handler *h = d->handlers.value(s.to().bare());
+	if(h && h->incoming(s))
+		return;
+	Handler *dh = d->handlers.value(d->domain.bare());
+	if(dh && dh != h && dh->incoming(s))
+		return;
+
+	if(receivers(SIGNAL(stanzaReceived(const XMPP::Stanza &))) > 0) {
+		stanzaReceived(s);
+		return;
+	}
+
+	// requests must be answered, even by nobody
+	if(s.kind() == Stanza::IQ && (s.type() == "get" || s.type() == "set")) {
+		Stanza r = createStanza(Stanza::IQ, s.to(), s.from(), "error", s.id());
+		r.setError(Stanza::Error(Stanza::Error::Cancel, Stanza::Error::ServiceUnavailable));
+		d->stream->write(r);
+	}
+}
+
+void ComponentClient::streamError(int x)
+{
+	cleanup();
+	error(x);
+}
+
+void ComponentClient::streamClosed()
+{
+	cleanup();
+	disconnected();
+}
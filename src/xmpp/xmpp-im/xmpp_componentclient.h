@@ -0,0 +1,103 @@
+/*
+ * xmpp_componentclient.h - many jids over one component stream
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_COMPONENTCLIENT_H
+#define XMPP_COMPONENTCLIENT_H
+
+#include <QObject>
+
+#include "xmpp_stanza.h"
+#include "xmpp/jid/jid.h"
+
+namespace XMPP
+{
+	class ClientStream;
+
+        /** \brief Serves every address of a domain over one external component stream (XEP-0114).
+            Meant for gateways and services that would otherwise need a Client and a connection for each of their users: here a user
+            costs no more than an entry in a hash, with no roster, tasks or stream of its own.  Received stanzas are routed to the
+            Handler set for the bare jid they are addressed to, or else to the one of the domain, and stanzas may be sent from any
+            address of the domain. */
+	class ComponentClient : public QObject
+	{
+		Q_OBJECT
+	public:
+                /** \brief Takes the stanzas routed to it; see setHandler(). */
+		class Handler
+		{
+		public:
+			virtual ~Handler() {}
+
+                        /** \brief Return false to leave \a s to stanzaReceived(). */
+			virtual bool incoming(const Stanza &s)=0;
+		};
+
+		ComponentClient(QObject *parent=0);
+		~ComponentClient();
+
+                /** \brief Connect \a stream as \a domain with the shared \a secret.  The stream is not owned, as with Client.
+                    See ClientStream::connectAsComponent() for the connector it needs. */
+		void connectToServer(ClientStream *stream, const Jid &domain, const QString &secret);
+		void close();
+
+		bool isActive() const;
+		Jid domain() const;
+		ClientStream *stream() const;
+
+                /** \brief True if \a j is an address of the domain, and so may be sent from. */
+		bool isLocal(const Jid &j) const;
+
+                /** \brief Route stanzas to \a j, a bare jid of the domain or the domain itself, through \a h.
+                    The handler is not owned; 0 removes it.  Routes stay across reconnects. */
+		void setHandler(const Jid &j, Handler *h);
+		Handler *handler(const Jid &j) const;
+
+                /** \brief A stanza of kind \a k from \a from, an address of the domain, to \a to.  Build its content with the stanza's doc(). */
+		Stanza createStanza(Stanza::Kind k, const Jid &from, const Jid &to, const QString &type="", const QString &id="");
+                /** \brief Send \a s, from the domain itself if it has no 'from'.
+                    False, and nothing sent, if it is from an address outside the domain or the component isn't active. */
+		bool send(const Stanza &s);
+                /** \brief An id to tell requests apart, unique for the stream. */
+		QString genUniqueId();
+
+	signals:
+		void connected();
+		void disconnected();
+                /** \brief See ClientStream::Error.  The stream is closed by then, and may be connected again. */
+		void error(int);
+                /** \brief A stanza no handler took.  iq requests that no handler took are answered with service-unavailable
+                    while nothing is connected to this signal. */
+		void stanzaReceived(const XMPP::Stanza &s);
+
+	private slots:
+		void streamAuthenticated();
+		void streamReadyRead();
+		void streamError(int);
+		void streamClosed();
+
+	private:
+		class Private;
+		Private *d;
+
+		void cleanup();
+		void distribute(const Stanza &s);
+	};
+}
+
+#endif
@@ -19,24 +19,45 @@
 
 #include <QDomElement>
 #include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QTimer>
 
 #include "xmpp_task.h"
 #include "xmpp/jid/jid.h"
 #include "xmpp_discoitem.h"
 #include "xmpp_discoinfotask.h"
 #include "xmpp_xmlcommon.h"
+#include "xmpp_capscache.h"
 
 using namespace XMPP;
 
+// caps queries on the wire, one per hash, and the tasks waiting on them
+class CapsInFlight
+{
+public:
+	QMutex m;
+	QHash<QString, DiscoInfoTask*> leaders;
+	QMultiHash<QString, DiscoInfoTask*> waiters;
+};
+
+Q_GLOBAL_STATIC(CapsInFlight, capsinflight)
+
 class DiscoInfoTask::Private
 {
 public:
-	Private() { }
+	Private() : leading(false), waiting(false) { }
 
 	QDomElement iq;
 	Jid jid;
 	QString node;
 	DiscoItem item;
+
+	// caps query
+	QString capsHash, capsVer;
+	bool leading, waiting;
+
+	QString capsKey() const { return capsHash + ' ' + capsVer; }
 };
 
 DiscoInfoTask::DiscoInfoTask(Task *parent)
@@ -47,6 +68,13 @@ DiscoInfoTask::DiscoInfoTask(Task *parent)
 
 DiscoInfoTask::~DiscoInfoTask()
 {
+	if(d->leading)
+		capsFinished(false);
+	else if(d->waiting) {
+		CapsInFlight *f = capsinflight();
+		QMutexLocker locker(&f->m);
+		f->waiters.remove(d->capsKey(), this);
+	}
 	delete d;
 }
 
@@ -61,6 +89,8 @@ void DiscoInfoTask::get(const DiscoItem &item)
 void DiscoInfoTask::get (const Jid &j, const QString &node, DiscoItem::Identity ident)
 {
 	d->item = DiscoItem(); // clear item
+	d->capsHash = QString();
+	d->capsVer = QString();
 
 	d->jid = j;
 	d->node = node;
@@ -86,6 +116,13 @@ void DiscoInfoTask::get (const Jid &j, const QString &node, DiscoItem::Identity
 	d->iq.appendChild(query);
 }
 
+void DiscoInfoTask::getCaps(const Jid &j, const QString &node, const QString &ver, const QString &hash)
+{
+	get(j, node + '#' + ver);
+	d->capsHash = hash;
+	d->capsVer = ver;
+}
+
 
 /**
  * Original requested jid.
@@ -116,7 +153,99 @@ const DiscoItem &DiscoInfoTask::item() const
 
 void DiscoInfoTask::onGo ()
 {
-	send(d->iq);
+	if(!d->capsVer.isEmpty()) {
+		DiscoItem item;
+		if(CapsCache::get(d->capsHash, d->capsVer, &item)) {
+			item.setJid(d->jid);
+			item.setNode(d->node);
+			d->item = item;
+
+			// finish from the event loop, as if the reply had come in
+			QTimer::singleShot(0, this, SLOT(capsReady()));
+			return;
+		}
+
+		// if somebody is already asking about this hash, wait for them
+		CapsInFlight *f = capsinflight();
+		QMutexLocker locker(&f->m);
+		DiscoInfoTask *leader = f->leaders.value(d->capsKey());
+		if(leader && leader->thread() == thread()) {
+			f->waiters.insert(d->capsKey(), this);
+			d->waiting = true;
+			return;
+		}
+		if(!leader) {
+			f->leaders.insert(d->capsKey(), this);
+			d->leading = true;
+		}
+	}
+
+	// plain queries without an identity are the same for everybody
+	if(d->capsVer.isEmpty() && queryTag(d->iq).firstChild().isNull())
+		sendShared(d->iq, "disco#info\n" + d->jid.full() + '\n' + d->node);
+	else
+		send(d->iq);
+}
+
+void DiscoInfoTask::onDisconnect()
+{
+	// waiters get their own disconnect, so just step out of the way
+	if(d->leading || d->waiting) {
+		CapsInFlight *f = capsinflight();
+		QMutexLocker locker(&f->m);
+		if(d->leading && f->leaders.value(d->capsKey()) == this)
+			f->leaders.remove(d->capsKey());
+		else if(d->waiting)
+			f->waiters.remove(d->capsKey(), this);
+		d->leading = false;
+		d->waiting = false;
+	}
+
+	Task::onDisconnect();
+}
+
+void DiscoInfoTask::capsReady()
+{
+	setSuccess(true);
+}
+
+void DiscoInfoTask::capsFinished(bool verified)
+{
+	d->leading = false;
+
+	CapsInFlight *f = capsinflight();
+	QString key = d->capsKey();
+	QList<DiscoInfoTask*> waiters;
+	DiscoInfoTask *next = 0;
+	{
+		QMutexLocker locker(&f->m);
+		if(f->leaders.value(key) == this)
+			f->leaders.remove(key);
+		waiters = f->waiters.values(key);
+		f->waiters.remove(key);
+
+		// an unverified reply says nothing about the others, so the next
+		//   one in line asks its own entity
+		if(!verified && !waiters.isEmpty()) {
+			next = waiters.takeFirst();
+			f->leaders.insert(key, next);
+			foreach(DiscoInfoTask *t, waiters)
+				f->waiters.insert(key, t);
+			next->d->waiting = false;
+			next->d->leading = true;
+			waiters.clear();
+		}
+	}
+
+	foreach(DiscoInfoTask *t, waiters) {
+		t->d->waiting = false;
+		t->d->item = d->item;
+		t->d->item.setJid(t->d->jid);
+		t->d->item.setNode(t->d->node);
+		QTimer::singleShot(0, t, SLOT(capsReady()));
+	}
+	if(next)
+		next->send(next->d->iq);
 }
 
 bool DiscoInfoTask::take(const QDomElement &x)
@@ -159,9 +288,18 @@ bool DiscoInfoTask::take(const QDomElement &x)
 
 		d->item = item;
 
+		if(d->leading) {
+			bool verified = (CapsCache::computeVer(q, d->capsHash) == d->capsVer);
+			if(verified)
+				CapsCache::insert(d->capsHash, d->capsVer, item);
+			capsFinished(verified);
+		}
+
 		setSuccess(true);
 	}
 	else {
+		if(d->leading)
+			capsFinished(false);
 		setError(x);
 	}
 
@@ -46,6 +46,11 @@ namespace XMPP
                     \param node Specify node attribute, if you do not want generic request. */	
 		void get(const Jid &, const QString &node = QString::null, const DiscoItem::Identity = DiscoItem::Identity());
 		void get(const DiscoItem &);
+                /** \brief Configure a query for the features behind an entity capabilities (XEP-0115) ver.
+                    The answer comes from CapsCache when the hash is known there.  Otherwise only one
+                    query per hash is sent at a time, and tasks asking for the same hash meanwhile
+                    share its verified reply. */
+		void getCaps(const Jid &, const QString &node, const QString &ver, const QString &hash = "sha-1");
 	
 		const DiscoItem &item() const;
 		const Jid& jid() const;
@@ -53,10 +58,18 @@ namespace XMPP
 	
 		void onGo();
 		bool take(const QDomElement &);
+
+	protected:
+		void onDisconnect();
+
+	private slots:
+		void capsReady();
 	
 	private:
 		class Private;
 		Private *d;
+
+		void capsFinished(bool verified);
 	};
 
 	// Deprecated name
@@ -50,121 +50,97 @@ Features::~Features()
 
 QStringList Features::list() const
 {
-	return _list;
+	QStringList l = _set.toList();
+	l.sort();
+	return l;
 }
 
 void Features::setList(const QStringList &l)
 {
-	_list = l;
+	_set = l.toSet();
 }
 
 void Features::addFeature(const QString& s)
 {
-	_list += s;
+	_set += s;
 }
 
 bool Features::test(const QStringList &ns) const
 {
 	QStringList::ConstIterator it = ns.begin();
 	for ( ; it != ns.end(); ++it) {
-		if ( _list.contains( *it )) {
+		if ( _set.contains( *it )) {
 			return true;
 		}
 	}
 	return false;
 }
 
+bool Features::test(const QString &ns) const
+{
+	return _set.contains(ns);
+}
+
 #define FID_MULTICAST "http://jabber.org/protocol/address"
 bool Features::canMulticast() const
 {
-	QStringList ns;
-	ns << FID_MULTICAST;
-
-	return test(ns);
+	return test(FID_MULTICAST);
 }
 
 #define FID_AHCOMMAND "http://jabber.org/protocol/commands"
 bool Features::canCommand() const
 {
-	QStringList ns;
-	ns << FID_AHCOMMAND;
-
-	return test(ns);
+	return test(FID_AHCOMMAND);
 }
 
 #define FID_REGISTER "jabber:iq:register"
 bool Features::canRegister() const
 {
-	QStringList ns;
-	ns << FID_REGISTER;
-
-	return test(ns);
+	return test(FID_REGISTER);
 }
 
 #define FID_SEARCH "jabber:iq:search"
 bool Features::canSearch() const
 {
-	QStringList ns;
-	ns << FID_SEARCH;
-
-	return test(ns);
+	return test(FID_SEARCH);
 }
 
 #define FID_GROUPCHAT "jabber:iq:conference"
 bool Features::canGroupchat() const
 {
-	QStringList ns;
-	ns << "http://jabber.org/protocol/muc";
-	ns << FID_GROUPCHAT;
-
-	return test(ns);
+	return test("http://jabber.org/protocol/muc") || test(FID_GROUPCHAT);
 }
 
 #define FID_VOICE "http://www.google.com/xmpp/protocol/voice/v1"
 bool Features::canVoice() const
 {
-	QStringList ns;
-	ns << FID_VOICE;
-
-	return test(ns);
+	return test(FID_VOICE);
 }
 
 #define FID_GATEWAY "jabber:iq:gateway"
 bool Features::isGateway() const
 {
-	QStringList ns;
-	ns << FID_GATEWAY;
-
-	return test(ns);
+	return test(FID_GATEWAY);
 }
 
 #define FID_DISCO "http://jabber.org/protocol/disco"
 bool Features::canDisco() const
 {
-	QStringList ns;
-	ns << FID_DISCO;
-	ns << "http://jabber.org/protocol/disco#info";
-	ns << "http://jabber.org/protocol/disco#items";
-
-	return test(ns);
+	return test(FID_DISCO)
+		|| test("http://jabber.org/protocol/disco#info")
+		|| test("http://jabber.org/protocol/disco#items");
 }
 
 #define FID_CHATSTATE "http://jabber.org/protocol/chatstates"
 bool Features::canChatState() const
 {
-	QStringList ns;
-	ns << FID_CHATSTATE;
-
-	return test(ns);
+	return test(FID_CHATSTATE);
 }
 
 #define FID_VCARD "vcard-temp"
 bool Features::haveVCard() const
 {
-	QStringList ns;
-	ns << FID_VCARD;
-
-	return test(ns);
+	return test(FID_VCARD);
 }
 
 // custom Psi acitons
@@ -217,7 +193,7 @@ static Features::FeatureName *featureName = 0;
 
 long Features::id() const
 {
-	if ( _list.count() > 1 )
+	if ( _set.count() > 1 )
 		return FID_Invalid;
 	else if ( canRegister() )
 		return FID_Register;
@@ -233,7 +209,7 @@ long Features::id() const
 		return FID_VCard;
 	else if ( canCommand() )
 		return FID_AHCommand;
-	else if ( test(QStringList(FID_ADD)) )
+	else if ( test(FID_ADD) )
 		return FID_Add;
 
 	return FID_None;
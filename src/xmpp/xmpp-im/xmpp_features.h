@@ -22,6 +22,7 @@
 #define XMPP_FEATURES_H
 
 #include <QStringList>
+#include <QSet>
 
 class QString;
 
@@ -68,6 +69,7 @@ namespace XMPP
 
 		// useful functions
 		bool test(const QStringList &) const;
+		bool test(const QString &) const;
 
 		QString name() const;
 		static QString name(long id);
@@ -79,7 +81,7 @@ namespace XMPP
 
 		class FeatureName;
 	private:
-		QStringList _list;
+		QSet<QString> _set;
 	};
 }
 
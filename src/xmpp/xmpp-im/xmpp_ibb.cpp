@@ -21,12 +21,16 @@
 #include "xmpp_ibb.h"
 
 #include <qtimer.h>
+#include <QHash>
 #include "xmpp_xmlcommon.h"
+#include "xmpp/base/idgenerator.h"
+#include "xmpp/base64/base64.h"
 #include <QtCrypto>
 
 #include <stdlib.h>
 
 #define IBB_PACKET_SIZE   4096
+#define IBB_WINDOW_SIZE   4
 #define IBB_PACKET_DELAY  0
 
 using namespace XMPP;
@@ -50,9 +54,12 @@ public:
 	QDomElement comment;
 	QString iq_id;
 
-	int blockSize;
+	int blockSize, windowSize;
+	QHash<JT_IBB*,int> inFlight; // unacked data packets and their sizes
 	QByteArray recvbuf, sendbuf;
+	int sendOffset; // bytes of sendbuf already handed to a packet
 	bool closePending, closing;
+	TransferStatistics stats;
 
 	int id;
 };
@@ -63,6 +70,8 @@ IBBConnection::IBBConnection(IBBManager *m)
 	d = new Private;
 	d->m = m;
 	d->j = 0;
+	d->blockSize = IBB_PACKET_SIZE;
+	d->windowSize = IBB_WINDOW_SIZE;
 	reset();
 
 	++num_conn;
@@ -80,8 +89,11 @@ void IBBConnection::reset(bool clear)
 
 	delete d->j;
 	d->j = 0;
+	qDeleteAll(d->inFlight.keys());
+	d->inFlight.clear();
 
 	d->sendbuf.resize(0);
+	d->sendOffset = 0;
 	if(clear)
 		d->recvbuf.resize(0);
 }
@@ -111,7 +123,7 @@ void IBBConnection::connectToJid(const Jid &peer, const QDomElement &comment)
 
 	d->j = new JT_IBB(d->m->client()->rootTask());
 	connect(d->j, SIGNAL(finished()), SLOT(ibb_finished()));
-	d->j->request(d->peer, comment);
+	d->j->request(d->peer, comment, d->blockSize);
 	d->j->go(true);
 }
 
@@ -179,6 +191,26 @@ QDomElement IBBConnection::comment() const
 	return d->comment;
 }
 
+void IBBConnection::setWindowSize(int packets)
+{
+	d->windowSize = qMax(packets, 1);
+}
+
+int IBBConnection::windowSize() const
+{
+	return d->windowSize;
+}
+
+void IBBConnection::setBlockSize(int bytes)
+{
+	d->blockSize = qMax(bytes, 1);
+}
+
+int IBBConnection::blockSize() const
+{
+	return d->blockSize;
+}
+
 bool IBBConnection::isOpen() const
 {
 	if(d->state == Active)
@@ -192,10 +224,14 @@ void IBBConnection::write(const QByteArray &a)
 	if(d->state != Active || d->closePending || d->closing)
 		return;
 
+	// drop what has already been sent before the buffer grows again
+	if(d->sendOffset > 0) {
+		d->sendbuf = d->sendbuf.mid(d->sendOffset);
+		d->sendOffset = 0;
+	}
+
 	// append to the end of our send buffer
-	int oldsize = d->sendbuf.size();
-	d->sendbuf.resize(oldsize + a.size());
-	memcpy(d->sendbuf.data() + oldsize, a.data(), a.size());
+	d->sendbuf += a;
 
 	trySend();
 }
@@ -215,7 +251,14 @@ int IBBConnection::bytesAvailable() const
 
 int IBBConnection::bytesToWrite() const
 {
-	return d->sendbuf.size();
+	return d->sendbuf.size() - d->sendOffset;
+}
+
+TransferStatistics IBBConnection::statistics() const
+{
+	TransferStatistics s = d->stats;
+	s.bytesToWrite = bytesToWrite();
+	return s;
 }
 
 void IBBConnection::waitForAccept(const Jid &peer, const QString &sid, const QDomElement &comment, const QString &iq_id)
@@ -230,12 +273,39 @@ void IBBConnection::waitForAccept(const Jid &peer, const QString &sid, const QDo
 	d->iq_id = iq_id;
 }
 
-void IBBConnection::takeIncomingData(const QByteArray &a, bool close)
+// decodes the base64 text of a data packet onto the end of our recv
+//   buffer, without a byte array of its own in between.  returns the
+//   number of bytes added, or -1 if the text is not valid base64
+int IBBConnection::decodeIncomingData(const QString &text)
 {
-	// append to the end of our recv buffer
 	int oldsize = d->recvbuf.size();
-	d->recvbuf.resize(oldsize + a.size());
-	memcpy(d->recvbuf.data() + oldsize, a.data(), a.size());
+	d->recvbuf.reserve(oldsize + text.length() * 3 / 4 + 3);
+
+	Base64::Decoder dec;
+	char piece[1024];
+	const QChar *in = text.unicode();
+	int len = text.length();
+	bool ok = true;
+	for(int at = 0; ok && at < len; at += (int)sizeof(piece)) {
+		int n = qMin((int)sizeof(piece), len - at);
+		for(int i = 0; i < n; ++i)
+			piece[i] = in[at + i].toLatin1();
+		ok = dec.update(piece, n, &d->recvbuf);
+	}
+	if(!ok || !dec.finish()) {
+		d->recvbuf.resize(oldsize);
+		return -1;
+	}
+
+	return d->recvbuf.size() - oldsize;
+}
+
+void IBBConnection::takeIncomingData(int bytes, bool close)
+{
+	if(bytes > 0) {
+		++d->stats.packetsIn;
+		d->stats.bytesIn += bytes;
+	}
 
 	readyRead();
 
@@ -247,13 +317,18 @@ void IBBConnection::takeIncomingData(const QByteArray &a, bool close)
 
 void IBBConnection::ibb_finished()
 {
-	JT_IBB *j = d->j;
-	d->j = 0;
+	JT_IBB *j = (JT_IBB *)sender();
 
-	if(j->success()) {
-		if(j->mode() == JT_IBB::ModeRequest) {
+	if(j == d->j) {
+		d->j = 0;
+
+		if(j->success()) {
 			d->sid = j->streamid();
 
+			// the peer may ask for smaller packets
+			if(j->blockSize() > 0 && j->blockSize() < d->blockSize)
+				d->blockSize = j->blockSize();
+
 			QString dstr; dstr.sprintf("IBBConnection[%d]: %s [%s] accepted.\n", d->id, d->peer.full().toLatin1().data(), d->sid.toLatin1().data());
 			d->m->client()->debug(dstr);
 
@@ -262,73 +337,87 @@ void IBBConnection::ibb_finished()
 			connected();
 		}
 		else {
-			bytesWritten(d->blockSize);
-
-			if(d->closing) {
-				reset();
-				delayedCloseFinished();
-			}
-
-			if(!d->sendbuf.isEmpty() || d->closePending)
-				QTimer::singleShot(IBB_PACKET_DELAY, this, SLOT(trySend()));
-		}
-	}
-	else {
-		if(j->mode() == JT_IBB::ModeRequest) {
 			QString dstr; dstr.sprintf("IBBConnection[%d]: %s refused.\n", d->id, d->peer.full().toLatin1().data());
 			d->m->client()->debug(dstr);
 
 			reset(true);
 			error(ErrRequest);
 		}
-		else {
-			reset(true);
-			error(ErrData);
+		return;
+	}
+
+	if(!d->inFlight.contains(j))
+		return;
+	int size = d->inFlight.take(j);
+
+	if(j->success()) {
+		bytesWritten(size);
+
+		if(d->closing) {
+			if(d->inFlight.isEmpty()) {
+				reset();
+				delayedCloseFinished();
+			}
+			return;
 		}
+
+		if(bytesToWrite() > 0 || d->closePending)
+			QTimer::singleShot(IBB_PACKET_DELAY, this, SLOT(trySend()));
+	}
+	else {
+		reset(true);
+		error(ErrData);
 	}
 }
 
 void IBBConnection::trySend()
 {
-	// if we already have an active task, then don't do anything
-	if(d->j)
+	// still negotiating the stream, or the close packet is out
+	if(d->j || d->closing)
 		return;
 
-	QByteArray a;
-	if(!d->sendbuf.isEmpty()) {
-		// take a chunk
-		if(d->sendbuf.size() < IBB_PACKET_SIZE)
-			a.resize(d->sendbuf.size());
-		else
-			a.resize(IBB_PACKET_SIZE);
-		memcpy(a.data(), d->sendbuf.data(), a.size());
-		d->sendbuf.resize(d->sendbuf.size() - a.size());
-	}
+	// keep up to windowSize packets in flight
+	while(d->inFlight.count() < d->windowSize) {
+		QByteArray a;
+		int left = bytesToWrite();
+		if(left > 0) {
+			// take a chunk
+			int size = qMin(left, d->blockSize);
+			a = d->sendbuf.mid(d->sendOffset, size);
+			d->sendOffset += size;
+			if(d->sendOffset == d->sendbuf.size()) {
+				d->sendbuf.resize(0);
+				d->sendOffset = 0;
+			}
+		}
 
-	bool doClose = false;
-	if(d->sendbuf.isEmpty() && d->closePending)
-		doClose = true;
+		bool doClose = false;
+		if(bytesToWrite() == 0 && d->closePending)
+			doClose = true;
 
-	// null operation?
-	if(a.isEmpty() && !doClose)
-		return;
+		// null operation?
+		if(a.isEmpty() && !doClose)
+			return;
 
-	printf("IBBConnection[%d]: sending [%d] bytes ", d->id, a.size());
-	if(doClose)
-		printf("and closing.\n");
-	else
-		printf("(%d bytes left)\n", d->sendbuf.size());
+		if(doClose) {
+			d->closePending = false;
+			d->closing = true;
+		}
 
-	if(doClose) {
-		d->closePending = false;
-		d->closing = true;
-	}
+		JT_IBB *j = new JT_IBB(d->m->client()->rootTask());
+		connect(j, SIGNAL(finished()), SLOT(ibb_finished()));
+		j->sendData(d->peer, d->sid, a, doClose);
+		d->inFlight.insert(j, a.size());
+		j->go(true);
 
-	d->blockSize = a.size();
-	d->j = new JT_IBB(d->m->client()->rootTask());
-	connect(d->j, SIGNAL(finished()), SLOT(ibb_finished()));
-	d->j->sendData(d->peer, d->sid, a, doClose);
-	d->j->go(true);
+		if(!a.isEmpty()) {
+			++d->stats.packetsOut;
+			d->stats.bytesOut += a.size();
+		}
+
+		if(doClose)
+			return;
+	}
 }
 
 
@@ -341,7 +430,7 @@ public:
 	Private() {}
 
 	Client *client;
-	IBBConnectionList activeConns;
+	QMultiHash<QString, IBBConnection*> activeConns; // by stream id
 	IBBConnectionList incomingConns;
 	JT_IBB *ibb;
 };
@@ -352,9 +441,10 @@ IBBManager::IBBManager(Client *parent)
 	d = new Private;
 	d->client = parent;
 	
+	// data packets come to takeIncomingData() rather than by signal
 	d->ibb = new JT_IBB(d->client->rootTask(), true);
+	d->ibb->setManager(this);
 	connect(d->ibb, SIGNAL(incomingRequest(const Jid &, const QString &, const QDomElement &)), SLOT(ibb_incomingRequest(const Jid &, const QString &, const QDomElement &)));
-	connect(d->ibb, SIGNAL(incomingData(const Jid &, const QString &, const QString &, const QByteArray &, bool)), SLOT(ibb_incomingData(const Jid &, const QString &, const QString &, const QByteArray &, bool)));
 }
 
 IBBManager::~IBBManager()
@@ -391,62 +481,47 @@ void IBBManager::ibb_incomingRequest(const Jid &from, const QString &id, const Q
 	incomingReady();
 }
 
-void IBBManager::ibb_incomingData(const Jid &from, const QString &streamid, const QString &id, const QByteArray &data, bool close)
+void IBBManager::takeIncomingData(const Jid &from, const QString &streamid, const QString &id, const QString &data, bool close)
 {
 	IBBConnection *c = findConnection(streamid, from);
 	if(!c) {
 		d->ibb->respondError(from, id, 404, "No such stream");
+		return;
 	}
-	else {
-		d->ibb->respondAck(from, id);
-		c->takeIncomingData(data, close);
-	}
-}
-
-QString IBBManager::genKey() const
-{
-	QString key = "ibb_";
 
-	for(int i = 0; i < 4; ++i) {
-		int word = rand() & 0xffff;
-		for(int n = 0; n < 4; ++n) {
-			QString s;
-			s.sprintf("%x", (word >> (n * 4)) & 0xf);
-			key.append(s);
-		}
+	int bytes = c->decodeIncomingData(data);
+	if(bytes == -1) {
+		d->ibb->respondError(from, id, 400, "Bad data");
+		return;
 	}
 
-	return key;
+	d->ibb->respondAck(from, id);
+	c->takeIncomingData(bytes, close);
 }
 
 QString IBBManager::genUniqueKey() const
 {
-	// get unused key
-	QString key;
-	while(1) {
-		key = genKey();
-
-		if(!findConnection(key))
-			break;
-	}
-
-	return key;
+	// 128 bits from the crypto rng won't collide with anything in use
+	return IdGenerator::hexId("ibb_", QCA::Random::randomArray(16).toByteArray());
 }
 
+// the stream id of a connection doesn't change while it is linked
 void IBBManager::link(IBBConnection *c)
 {
-	d->activeConns.append(c);
+	d->activeConns.insert(c->streamid(), c);
 }
 
 void IBBManager::unlink(IBBConnection *c)
 {
-	d->activeConns.removeAll(c);
+	d->activeConns.remove(c->streamid(), c);
 }
 
 IBBConnection *IBBManager::findConnection(const QString &sid, const Jid &peer) const
 {
-	foreach(IBBConnection* c, d->activeConns) {
-		if(c->streamid() == sid && (peer.isEmpty() || c->peer().compare(peer)) )
+	QMultiHash<QString, IBBConnection*>::ConstIterator it = d->activeConns.find(sid);
+	for(; it != d->activeConns.end() && it.key() == sid; ++it) {
+		IBBConnection *c = it.value();
+		if(peer.isEmpty() || c->peer().compare(peer))
 			return c;
 	}
 	return 0;
@@ -476,6 +551,9 @@ public:
 	bool serve;
 	Jid to;
 	QString streamid;
+	int blockSize;
+	IBBManager *manager;
+	StanzaTemplate ack; // the empty result acking each data packet
 };
 
 JT_IBB::JT_IBB(Task *parent, bool serve)
@@ -483,6 +561,8 @@ JT_IBB::JT_IBB(Task *parent, bool serve)
 {
 	d = new Private;
 	d->serve = serve;
+	d->blockSize = 0;
+	d->manager = 0;
 }
 
 JT_IBB::~JT_IBB()
@@ -490,7 +570,7 @@ JT_IBB::~JT_IBB()
 	delete d;
 }
 
-void JT_IBB::request(const Jid &to, const QDomElement &comment)
+void JT_IBB::request(const Jid &to, const QDomElement &comment, int blockSize)
 {
 	d->mode = ModeRequest;
 	QDomElement iq;
@@ -498,6 +578,8 @@ void JT_IBB::request(const Jid &to, const QDomElement &comment)
 	iq = createIQ(doc(), "set", to.full(), id());
 	QDomElement query = doc()->createElement("query");
 	query.setAttribute("xmlns", "http://jabber.org/protocol/ibb");
+	if(blockSize > 0)
+		query.setAttribute("block-size", QString::number(blockSize));
 	iq.appendChild(query);
 	query.appendChild(comment);
 	d->iq = iq;
@@ -543,8 +625,20 @@ void JT_IBB::respondError(const Jid &to, const QString &id, int code, const QStr
 
 void JT_IBB::respondAck(const Jid &to, const QString &id)
 {
-	QDomElement iq = createIQ(doc(), "result", to.full(), id);
-	send(iq);
+	if(d->ack.isNull())
+		d->ack = client()->createTemplate(createIQ(doc(), "result", QString(), QString()));
+	if(d->ack.isNull()) {
+		QDomElement iq = createIQ(doc(), "result", to.full(), id);
+		send(iq);
+		return;
+	}
+
+	client()->send(d->ack, to, id);
+}
+
+void JT_IBB::setManager(IBBManager *m)
+{
+	d->manager = m;
 }
 
 void JT_IBB::onGo()
@@ -562,7 +656,7 @@ bool JT_IBB::take(const QDomElement &e)
 		if(queryNS(e) != "http://jabber.org/protocol/ibb")
 			return false;
 
-		Jid from(e.attribute("from"));
+		Jid from = client()->stanzaFrom(e);
 		QString id = e.attribute("id");
 		QDomElement q = queryTag(e);
 
@@ -574,22 +668,26 @@ bool JT_IBB::take(const QDomElement &e)
 		}
 		else {
 			QString sid = tagContent(s);
-			QByteArray a;
+			QString text;
 			bool close = false;
 			s = findSubTag(q, "data", &found);
 			if(found)
-				a = QCA::Base64().stringToArray(tagContent(s)).toByteArray();
+				text = tagContent(s);
 			s = findSubTag(q, "close", &found);
 			if(found)
 				close = true;
 
-			incomingData(from, sid, id, a, close);
+			// the manager decodes straight into the connection
+			if(d->manager)
+				d->manager->takeIncomingData(from, sid, id, text, close);
+			else
+				incomingData(from, sid, id, QCA::Base64().stringToArray(text).toByteArray(), close);
 		}
 
 		return true;
 	}
 	else {
-		Jid from(e.attribute("from"));
+		Jid from = client()->stanzaFrom(e);
 		if(e.attribute("id") != id() || !d->to.compare(from))
 			return false;
 
@@ -604,6 +702,7 @@ bool JT_IBB::take(const QDomElement &e)
 					d->streamid = tagContent(s);
 				else
 					d->streamid = "";
+				d->blockSize = q.attribute("block-size").toInt();
 				setSuccess();
 			}
 			// sendData
@@ -635,3 +734,8 @@ int JT_IBB::mode() const
 	return d->mode;
 }
 
+int JT_IBB::blockSize() const
+{
+	return d->blockSize;
+}
+
@@ -27,6 +27,7 @@
 #include <qstring.h>
 #include "bytestream.h"
 #include "im.h"
+#include "xmpp_statistics.h"
 
 namespace XMPP
 {
@@ -52,12 +53,23 @@ namespace XMPP
 		QString streamid() const;
 		QDomElement comment() const;
 
+		// how many data packets may await an ack at once, and how big
+		//   each one is.  the block size may be lowered by the peer.
+		void setWindowSize(int packets);
+		int windowSize() const;
+		void setBlockSize(int bytes);
+		int blockSize() const;
+
 		bool isOpen() const;
 		void write(const QByteArray &);
 		QByteArray read(int bytes=0);
 		int bytesAvailable() const;
 		int bytesToWrite() const;
 
+		// counters since the connection was created.  call from the
+		//   connection's thread.
+		TransferStatistics statistics() const;
+
 	signals:
 		void connected();
 
@@ -73,7 +85,8 @@ namespace XMPP
 
 		friend class IBBManager;
 		void waitForAccept(const Jid &peer, const QString &sid, const QDomElement &comment, const QString &iq_id);
-		void takeIncomingData(const QByteArray &, bool close);
+		int decodeIncomingData(const QString &text);
+		void takeIncomingData(int bytes, bool close);
 	};
 
 	typedef QList<IBBConnection*> IBBConnectionList;
@@ -93,15 +106,15 @@ namespace XMPP
 
 	private slots:
 		void ibb_incomingRequest(const Jid &from, const QString &id, const QDomElement &);
-		void ibb_incomingData(const Jid &from, const QString &streamid, const QString &id, const QByteArray &data, bool close);
 
 	private:
 		class Private;
 		Private *d;
 
-		QString genKey() const;
 
 		friend class IBBConnection;
+		friend class JT_IBB;
+		void takeIncomingData(const Jid &from, const QString &streamid, const QString &id, const QString &data, bool close);
 		IBBConnection *findConnection(const QString &sid, const Jid &peer="") const;
 		QString genUniqueKey() const;
 		void link(IBBConnection *);
@@ -118,7 +131,7 @@ namespace XMPP
 		JT_IBB(Task *, bool serve=false);
 		~JT_IBB();
 
-		void request(const Jid &, const QDomElement &comment);
+		void request(const Jid &, const QDomElement &comment, int blockSize=0);
 		void sendData(const Jid &, const QString &streamid, const QByteArray &data, bool close);
 		void respondSuccess(const Jid &, const QString &id, const QString &streamid);
 		void respondError(const Jid &, const QString &id, int code, const QString &str);
@@ -130,14 +143,19 @@ namespace XMPP
 		QString streamid() const;
 		Jid jid() const;
 		int mode() const;
+		int blockSize() const;
 
 	signals:
 		void incomingRequest(const Jid &from, const QString &id, const QDomElement &);
+		// not emitted when serving an IBBManager
 		void incomingData(const Jid &from, const QString &streamid, const QString &id, const QByteArray &data, bool close);
 
 	private:
 		class Private;
 		Private *d;
+
+		friend class IBBManager;
+		void setManager(IBBManager *);
 	};
 }
 
@@ -0,0 +1,770 @@
+/*
+ * xmpp_jingle.cpp - Jingle file transfer over ICE-UDP
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmpp_jingle.h"
+
+#include <QFileInfo>
+#include <QTimer>
+#include <qca.h>
+#include "xmpp_xmlcommon.h"
+#include "xmpp/base/idgenerator.h"
+#include "icelocaladdressset.h"
+#include "icestream.h"
+
+#define JINGLE_NS "urn:xmpp:jingle:1"
+#define JINGLE_FT_NS "urn:xmpp:jingle:apps:file-transfer:5"
+#define JINGLE_ICE_UDP_NS "urn:xmpp:jingle:transports:ice-udp:1"
+
+// how long ICE may take to find a working pair after the offer is taken
+#define CONNECT_TIMEOUT 30000
+
+using namespace XMPP;
+
+static QDomElement jingleElement(QDomDocument *doc, const QString &action, const QString &sid)
+{
+	QDomElement jingle = doc->createElement("jingle");
+	jingle.setAttribute("xmlns", JINGLE_NS);
+	jingle.setAttribute("action", action);
+	jingle.setAttribute("sid", sid);
+	return jingle;
+}
+
+// the sender's content.  which one the file goes in doesn't matter, there is only one
+static QDomElement contentElement(QDomDocument *doc)
+{
+	QDomElement content = doc->createElement("content");
+	content.setAttribute("creator", "initiator");
+	content.setAttribute("name", "file");
+	content.setAttribute("senders", "initiator");
+	return content;
+}
+
+static QDomElement candidateElement(QDomDocument *doc, const Ice176::Candidate &c)
+{
+	QDomElement e = doc->createElement("candidate");
+	e.setAttribute("component", QString::number(c.component));
+	e.setAttribute("foundation", c.foundation);
+	e.setAttribute("generation", QString::number(c.generation));
+	e.setAttribute("id", c.id);
+	e.setAttribute("ip", c.ip.toString());
+	if(c.network != -1)
+		e.setAttribute("network", QString::number(c.network));
+	e.setAttribute("port", QString::number(c.port));
+	e.setAttribute("priority", QString::number(c.priority));
+	e.setAttribute("protocol", c.protocol);
+	e.setAttribute("type", c.type);
+	if(!c.rel_addr.isNull()) {
+		e.setAttribute("rel-addr", c.rel_addr.toString());
+		e.setAttribute("rel-port", QString::number(c.rel_port));
+	}
+	return e;
+}
+
+static QDomElement transportElement(QDomDocument *doc, const QString &ufrag, const QString &pwd, const QList<Ice176::Candidate> &list)
+{
+	QDomElement transport = doc->createElement("transport");
+	transport.setAttribute("xmlns", JINGLE_ICE_UDP_NS);
+	transport.setAttribute("ufrag", ufrag);
+	transport.setAttribute("pwd", pwd);
+	foreach(const Ice176::Candidate &c, list) {
+		// ice-udp has no place for tcp candidates
+		if(c.protocol == "udp")
+			transport.appendChild(candidateElement(doc, c));
+	}
+	return transport;
+}
+
+static bool candidateFromElement(const QDomElement &e, Ice176::Candidate *c)
+{
+	bool ok;
+	c->component = e.attribute("component").toInt(&ok);
+	if(!ok || c->component < 1)
+		return false;
+	c->foundation = e.attribute("foundation");
+	c->generation = e.attribute("generation").toInt();
+	c->id = e.attribute("id");
+	if(!c->ip.setAddress(e.attribute("ip")))
+		return false;
+	c->network = e.hasAttribute("network") ? e.attribute("network").toInt() : -1;
+	c->port = e.attribute("port").toInt(&ok);
+	if(!ok || c->port < 1 || c->port > 65535)
+		return false;
+	c->priority = e.attribute("priority").toInt(&ok);
+	if(!ok)
+		return false;
+	c->protocol = e.attribute("protocol");
+	if(c->protocol != "udp")
+		return false;
+	c->type = e.attribute("type");
+	if(e.hasAttribute("rel-addr")) {
+		c->rel_addr.setAddress(e.attribute("rel-addr"));
+		c->rel_port = e.attribute("rel-port").toInt();
+	}
+	return true;
+}
+
+static QDomElement childElement(const QDomElement &e, const QString &tagName, const QString &ns)
+{
+	for(QDomNode n = e.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		QDomElement i = n.toElement();
+		if(!i.isNull() && i.tagName() == tagName && i.attribute("xmlns") == ns)
+			return i;
+	}
+	return QDomElement();
+}
+
+//----------------------------------------------------------------------------
+// JingleFileTransfer
+//----------------------------------------------------------------------------
+class JingleFileTransfer::Private
+{
+public:
+	JingleManager *m;
+	Jid peer;
+	QString sid;
+	bool initiator;
+	int state;
+	QString fname;
+	qlonglong size;
+	QString desc;
+
+	Ice176 *ice;
+	bool iceStarted;
+	bool candidatesSent; // the offer or answer went out
+	IceStream *stream;
+	bool streamDone;
+	QTimer *timer;
+
+	// from the peer, until ice can take them
+	QString peerUfrag, peerPass;
+	QList<Ice176::Candidate> remoteCandidates;
+
+	JT_Jingle *initiate;
+};
+
+JingleFileTransfer::JingleFileTransfer(JingleManager *m, QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+	d->m = m;
+	d->initiator = false;
+	d->state = Idle;
+	d->size = 0;
+	d->ice = 0;
+	d->iceStarted = false;
+	d->candidatesSent = false;
+	d->stream = 0;
+	d->streamDone = false;
+	d->initiate = 0;
+	d->timer = new QTimer(this);
+	d->timer->setSingleShot(true);
+	connect(d->timer, SIGNAL(timeout()), SLOT(t_timeout()));
+}
+
+JingleFileTransfer::~JingleFileTransfer()
+{
+	close();
+	delete d;
+}
+
+void JingleFileTransfer::reset()
+{
+	d->m->unlink(this);
+	d->timer->stop();
+
+	delete d->initiate;
+	d->initiate = 0;
+
+	// may be called from their signals
+	if(d->stream) {
+		d->stream->disconnect(this);
+		d->stream->deleteLater();
+		d->stream = 0;
+	}
+	if(d->ice) {
+		d->ice->disconnect();
+		d->ice->deleteLater();
+		d->ice = 0;
+	}
+
+	d->iceStarted = false;
+	d->candidatesSent = false;
+	d->streamDone = false;
+	d->peerUfrag = QString();
+	d->peerPass = QString();
+	d->remoteCandidates.clear();
+	d->state = Idle;
+}
+
+void JingleFileTransfer::sendFile(const Jid &to, const QString &fname, qlonglong size, const QString &desc)
+{
+	d->state = Requesting;
+	d->initiator = true;
+	d->peer = to;
+	d->fname = fname;
+	d->size = size;
+	d->desc = desc;
+	d->sid = d->m->link(this);
+
+	// the offer goes out with the first candidates
+	startIce(true);
+}
+
+Jid JingleFileTransfer::peer() const
+{
+	return d->peer;
+}
+
+QString JingleFileTransfer::sid() const
+{
+	return d->sid;
+}
+
+QString JingleFileTransfer::fileName() const
+{
+	return d->fname;
+}
+
+qlonglong JingleFileTransfer::fileSize() const
+{
+	return d->size;
+}
+
+QString JingleFileTransfer::description() const
+{
+	return d->desc;
+}
+
+void JingleFileTransfer::accept()
+{
+	if(d->state != WaitingForAccept)
+		return;
+
+	// the answer goes out with the first candidates
+	d->state = Connecting;
+	startIce(false);
+	d->timer->start(CONNECT_TIMEOUT);
+}
+
+int JingleFileTransfer::state() const
+{
+	return d->state;
+}
+
+void JingleFileTransfer::close()
+{
+	if(d->state == Idle)
+		return;
+
+	if(d->state == WaitingForAccept)
+		terminate("decline");
+	else if(!d->streamDone)
+		terminate("cancel");
+	else
+		terminate("success");
+	reset();
+}
+
+ByteStream *JingleFileTransfer::stream() const
+{
+	return d->stream;
+}
+
+void JingleFileTransfer::startIce(bool initiator)
+{
+	d->ice = new Ice176(this);
+	connect(d->ice, SIGNAL(started()), SLOT(ice_started()));
+	connect(d->ice, SIGNAL(error(XMPP::Ice176::Error)), SLOT(ice_error()));
+	connect(d->ice, SIGNAL(localCandidatesReady(const QList<XMPP::Ice176::Candidate> &)), SLOT(ice_localCandidatesReady(const QList<XMPP::Ice176::Candidate> &)));
+	connect(d->ice, SIGNAL(componentReady(int)), SLOT(ice_componentReady(int)));
+
+	d->m->configureIce(d->ice);
+	d->ice->setComponentCount(1);
+	d->ice->setLocalCandidateTrickle(true);
+	d->ice->start(initiator ? Ice176::Initiator : Ice176::Responder);
+}
+
+// takes the peer's credentials and candidates, or keeps them until ice is started
+void JingleFileTransfer::takeRemote(const QDomElement &transport)
+{
+	if(transport.hasAttribute("ufrag")) {
+		d->peerUfrag = transport.attribute("ufrag");
+		d->peerPass = transport.attribute("pwd");
+		if(d->iceStarted) {
+			d->ice->setPeerUfrag(d->peerUfrag);
+			d->ice->setPeerPassword(d->peerPass);
+		}
+	}
+
+	QList<Ice176::Candidate> list;
+	for(QDomNode n = transport.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		QDomElement e = n.toElement();
+		Ice176::Candidate c;
+		if(!e.isNull() && e.tagName() == "candidate" && candidateFromElement(e, &c))
+			list += c;
+	}
+
+	// checks need the peer's credentials
+	if(d->iceStarted && !d->peerUfrag.isEmpty()) {
+		if(!d->remoteCandidates.isEmpty()) {
+			list = d->remoteCandidates + list;
+			d->remoteCandidates.clear();
+		}
+		if(!list.isEmpty())
+			d->ice->addRemoteCandidates(list);
+	}
+	else
+		d->remoteCandidates += list;
+}
+
+void JingleFileTransfer::terminate(const char *reason)
+{
+	JT_Jingle *j = new JT_Jingle(d->m->client()->rootTask());
+	QDomElement jingle = jingleElement(j->doc(), "session-terminate", d->sid);
+	QDomElement r = j->doc()->createElement("reason");
+	r.appendChild(j->doc()->createElement(reason));
+	jingle.appendChild(r);
+	j->request(d->peer, jingle);
+	j->go(true);
+}
+
+void JingleFileTransfer::fail(int x, const char *reason)
+{
+	terminate(reason);
+	reset();
+	error(x);
+}
+
+void JingleFileTransfer::ice_started()
+{
+	d->iceStarted = true;
+
+	// the responder already has the offer
+	if(!d->peerUfrag.isEmpty()) {
+		d->ice->setPeerUfrag(d->peerUfrag);
+		d->ice->setPeerPassword(d->peerPass);
+		if(!d->remoteCandidates.isEmpty()) {
+			d->ice->addRemoteCandidates(d->remoteCandidates);
+			d->remoteCandidates.clear();
+		}
+	}
+}
+
+void JingleFileTransfer::ice_error()
+{
+	fail(ErrConnect, "failed-transport");
+}
+
+void JingleFileTransfer::ice_localCandidatesReady(const QList<XMPP::Ice176::Candidate> &list)
+{
+	QString action;
+	if(!d->candidatesSent)
+		action = d->initiator ? "session-initiate" : "session-accept";
+	else
+		action = "transport-info";
+
+	JT_Jingle *j = new JT_Jingle(d->m->client()->rootTask());
+	QDomDocument *doc = j->doc();
+	QDomElement jingle = jingleElement(doc, action, d->sid);
+	if(action == "session-initiate")
+		jingle.setAttribute("initiator", d->m->client()->jid().full());
+	else if(action == "session-accept")
+		jingle.setAttribute("responder", d->m->client()->jid().full());
+
+	QDomElement content = contentElement(doc);
+	if(action == "session-initiate") {
+		QDomElement description = doc->createElement("description");
+		description.setAttribute("xmlns", JINGLE_FT_NS);
+		QDomElement file = doc->createElement("file");
+		file.appendChild(textTag(doc, "name", d->fname));
+		file.appendChild(textTag(doc, "size", QString::number(d->size)));
+		if(!d->desc.isEmpty())
+			file.appendChild(textTag(doc, "desc", d->desc));
+		description.appendChild(file);
+		content.appendChild(description);
+	}
+	content.appendChild(transportElement(doc, d->ice->localUfrag(), d->ice->localPassword(), list));
+	jingle.appendChild(content);
+	j->request(d->peer, jingle);
+
+	if(action == "session-initiate") {
+		d->initiate = j;
+		connect(j, SIGNAL(finished()), SLOT(initiate_finished()));
+		j->go(false);
+	}
+	else
+		j->go(true);
+	d->candidatesSent = true;
+}
+
+void JingleFileTransfer::initiate_finished()
+{
+	JT_Jingle *j = d->initiate;
+	d->initiate = 0;
+	j->safeDelete();
+
+	if(!j->success()) {
+		reset();
+		error(j->statusCode() == 403 || j->statusCode() == 405 ? ErrReject : ErrNeg);
+		return;
+	}
+
+	// unless the answer came in already
+	if(d->state == Requesting)
+		d->state = WaitingForAccept;
+}
+
+void JingleFileTransfer::ice_componentReady(int index)
+{
+	if(index != 0 || d->stream)
+		return;
+
+	d->timer->stop();
+	d->state = Active;
+	d->stream = new IceStream(d->ice, 0, this);
+	connect(d->stream, SIGNAL(delayedCloseFinished()), SLOT(stream_delayedCloseFinished()));
+	connect(d->stream, SIGNAL(connectionClosed()), SLOT(stream_connectionClosed()));
+	connect(d->stream, SIGNAL(error(int)), SLOT(stream_error(int)));
+	connected();
+}
+
+// the sender's end: everything got through
+void JingleFileTransfer::stream_delayedCloseFinished()
+{
+	d->streamDone = true;
+	terminate("success");
+	reset();
+	finished();
+}
+
+// the receiver's end: the sender waits for its data to be acknowledged,
+//   then ends the session
+void JingleFileTransfer::stream_connectionClosed()
+{
+	d->streamDone = true;
+}
+
+void JingleFileTransfer::stream_error(int)
+{
+	fail(ErrStream, "connectivity-error");
+}
+
+void JingleFileTransfer::t_timeout()
+{
+	fail(ErrConnect, "connectivity-error");
+}
+
+void JingleFileTransfer::man_waitForAccept(const Jid &from, const QString &sid, const QDomElement &content)
+{
+	d->state = WaitingForAccept;
+	d->initiator = false;
+	d->peer = from;
+	d->sid = sid;
+
+	QDomElement file = childElement(content, "description", JINGLE_FT_NS).firstChildElement("file");
+	d->fname = QFileInfo(file.firstChildElement("name").text()).fileName(); // ensure kosher
+	d->size = file.firstChildElement("size").text().toLongLong();
+	d->desc = file.firstChildElement("desc").text();
+
+	takeRemote(childElement(content, "transport", JINGLE_ICE_UDP_NS));
+}
+
+void JingleFileTransfer::man_action(const QString &action, const QDomElement &jingle)
+{
+	QDomElement content = jingle.firstChildElement("content");
+	QDomElement transport = childElement(content, "transport", JINGLE_ICE_UDP_NS);
+
+	if(action == "session-accept") {
+		if(!d->initiator || (d->state != Requesting && d->state != WaitingForAccept))
+			return;
+		takeRemote(transport);
+		d->state = Connecting;
+		d->timer->start(CONNECT_TIMEOUT);
+		accepted();
+	}
+	else if(action == "transport-info") {
+		takeRemote(transport);
+	}
+	else if(action == "session-terminate") {
+		QDomElement reason = jingle.firstChildElement("reason");
+		bool success = !reason.firstChildElement("success").isNull();
+		int oldState = d->state;
+		bool done = d->streamDone;
+		reset();
+		if(done && success)
+			finished();
+		else if(oldState == Requesting || oldState == WaitingForAccept)
+			error(ErrReject);
+		else
+			error(oldState == Active ? ErrStream : ErrConnect);
+	}
+}
+
+//----------------------------------------------------------------------------
+// JingleManager
+//----------------------------------------------------------------------------
+class JingleManager::Private
+{
+public:
+	Client *client;
+	QList<JingleFileTransfer*> list, incoming;
+	JT_PushJingle *push;
+
+	QList<Ice176::LocalAddress> localAddrs;
+	QHostAddress stunBindAddr;
+	int stunBindPort;
+	QHostAddress stunRelayAddr;
+	int stunRelayPort;
+	QString stunRelayUser;
+	QCA::SecureArray stunRelayPass;
+};
+
+JingleManager::JingleManager(Client *client)
+:QObject(client)
+{
+	d = new Private;
+	d->client = client;
+	d->stunBindPort = -1;
+	d->stunRelayPort = -1;
+
+	d->push = new JT_PushJingle(d->client->rootTask());
+	connect(d->push, SIGNAL(incoming(const XMPP::Jid &, const QString &, const QDomElement &)), SLOT(push_incoming(const XMPP::Jid &, const QString &, const QDomElement &)));
+}
+
+JingleManager::~JingleManager()
+{
+	while(!d->incoming.isEmpty())
+		delete d->incoming.takeFirst();
+	delete d->push;
+	delete d;
+}
+
+Client *JingleManager::client() const
+{
+	return d->client;
+}
+
+void JingleManager::setLocalAddresses(const QList<Ice176::LocalAddress> &addrs)
+{
+	d->localAddrs = addrs;
+}
+
+void JingleManager::setStunBindService(const QHostAddress &addr, int port)
+{
+	d->stunBindAddr = addr;
+	d->stunBindPort = port;
+}
+
+void JingleManager::setStunRelayUdpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass)
+{
+	d->stunRelayAddr = addr;
+	d->stunRelayPort = port;
+	d->stunRelayUser = user;
+	d->stunRelayPass = pass;
+}
+
+JingleFileTransfer *JingleManager::createTransfer()
+{
+	return new JingleFileTransfer(this);
+}
+
+JingleFileTransfer *JingleManager::takeIncoming()
+{
+	if(d->incoming.isEmpty())
+		return 0;
+
+	// stays linked, it is the app's now
+	return d->incoming.takeFirst();
+}
+
+QString JingleManager::link(JingleFileTransfer *ft)
+{
+	d->list.append(ft);
+	return IdGenerator::hexId("j", QCA::Random::randomArray(16).toByteArray());
+}
+
+void JingleManager::unlink(JingleFileTransfer *ft)
+{
+	d->list.removeAll(ft);
+	d->incoming.removeAll(ft);
+}
+
+void JingleManager::configureIce(Ice176 *ice) const
+{
+	if(!d->localAddrs.isEmpty())
+		ice->setLocalAddresses(d->localAddrs);
+	else
+		ice->setLocalAddressSet(IceLocalAddressSet::instance());
+
+	if(d->stunBindPort != -1)
+		ice->setStunBindService(d->stunBindAddr, d->stunBindPort);
+	if(d->stunRelayPort != -1)
+		ice->setStunRelayUdpService(d->stunRelayAddr, d->stunRelayPort, d->stunRelayUser, d->stunRelayPass);
+
+	// no tcp candidates in ice-udp
+	ice->setUseStunRelayTcp(false);
+}
+
+void JingleManager::push_incoming(const XMPP::Jid &from, const QString &iq_id, const QDomElement &jingle)
+{
+	QString action = jingle.attribute("action");
+	QString sid = jingle.attribute("sid");
+
+	if(action == "session-initiate") {
+		QDomElement content = jingle.firstChildElement("content");
+		if(sid.isEmpty() || content.isNull()) {
+			d->push->respondError(from, iq_id, 400, "Bad request");
+			return;
+		}
+		foreach(JingleFileTransfer *i, d->list) {
+			if(i->d->sid == sid && i->d->peer.compare(from)) {
+				d->push->respondError(from, iq_id, 409, "SID in use");
+				return;
+			}
+		}
+		d->push->respondSuccess(from, iq_id);
+
+		JingleFileTransfer *ft = new JingleFileTransfer(this);
+		ft->d->peer = from;
+		ft->d->sid = sid;
+
+		// turned down the way XEP-0166 wants it, after the ack
+		const char *unsupported = 0;
+		if(childElement(content, "description", JINGLE_FT_NS).isNull())
+			unsupported = "unsupported-applications";
+		else if(childElement(content, "transport", JINGLE_ICE_UDP_NS).isNull())
+			unsupported = "unsupported-transports";
+		if(unsupported) {
+			ft->terminate(unsupported);
+			delete ft;
+			return;
+		}
+
+		d->list.append(ft);
+		d->incoming.append(ft);
+		ft->man_waitForAccept(from, sid, content);
+		incomingReady();
+		return;
+	}
+
+	JingleFileTransfer *ft = 0;
+	foreach(JingleFileTransfer *i, d->list) {
+		if(i->d->sid == sid && i->d->peer.compare(from)) {
+			ft = i;
+			break;
+		}
+	}
+	if(!ft) {
+		d->push->respondError(from, iq_id, 404, "Unknown session");
+		return;
+	}
+
+	d->push->respondSuccess(from, iq_id);
+	ft->man_action(action, jingle);
+}
+
+//----------------------------------------------------------------------------
+// JT_Jingle
+//----------------------------------------------------------------------------
+class JT_Jingle::Private
+{
+public:
+	QDomElement iq;
+	Jid to;
+};
+
+JT_Jingle::JT_Jingle(Task *parent)
+:Task(parent)
+{
+	d = new Private;
+}
+
+JT_Jingle::~JT_Jingle()
+{
+	delete d;
+}
+
+void JT_Jingle::request(const Jid &to, const QDomElement &jingle)
+{
+	d->to = to;
+	d->iq = createIQ(doc(), "set", to.full(), id());
+	d->iq.appendChild(jingle);
+}
+
+void JT_Jingle::onGo()
+{
+	send(d->iq);
+}
+
+bool JT_Jingle::take(const QDomElement &x)
+{
+	if(!iqVerify(x, d->to, id()))
+		return false;
+
+	if(x.attribute("type") == "result")
+		setSuccess();
+	else
+		setError(x);
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// JT_PushJingle
+//----------------------------------------------------------------------------
+JT_PushJingle::JT_PushJingle(Task *parent)
+:Task(parent)
+{
+	addRoute("iq", JINGLE_NS);
+}
+
+JT_PushJingle::~JT_PushJingle()
+{
+}
+
+void JT_PushJingle::respondSuccess(const Jid &to, const QString &id)
+{
+	QDomElement iq = createIQ(doc(), "result", to.full(), id);
+	send(iq);
+}
+
+void JT_PushJingle::respondError(const Jid &to, const QString &id, int code, const QString &str)
+{
+	QDomElement iq = createIQ(doc(), "error", to.full(), id);
+	QDomElement err = textTag(doc(), "error", str);
+	err.setAttribute("code", QString::number(code));
+	iq.appendChild(err);
+	send(iq);
+}
+
+bool JT_PushJingle::take(const QDomElement &e)
+{
+	// must be an iq-set tag
+	if(e.tagName() != "iq")
+		return false;
+	if(e.attribute("type") != "set")
+		return false;
+
+	QDomElement jingle = e.firstChildElement("jingle");
+	if(jingle.isNull() || jingle.attribute("xmlns") != JINGLE_NS)
+		return false;
+
+	incoming(client()->stanzaFrom(e), e.attribute("id"), jingle);
+	return true;
+}
@@ -0,0 +1,181 @@
+/*
+ * xmpp_jingle.h - Jingle file transfer over ICE-UDP
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_JINGLE_H
+#define XMPP_JINGLE_H
+
+#include <QObject>
+#include <QList>
+#include <QHostAddress>
+#include <qdom.h>
+
+#include "im.h"
+#include "ice176.h"
+
+namespace QCA {
+	class SecureArray;
+}
+
+class ByteStream;
+
+namespace XMPP
+{
+	class Client;
+	class JingleManager;
+
+	/** \brief A file offered or taken through a Jingle session (XEP-0166, XEP-0234), sent over an ICE-UDP transport (XEP-0176).
+
+	The two ends exchange ICE candidates over XMPP and the data then goes
+	over the best pair ICE finds, directly between NAT-ed peers where
+	possible, through a TURN relay otherwise.  On that pair runs an
+	IceStream, which gives reliable, ordered, congestion controlled
+	delivery.  Once connected() is emitted, stream() carries the file: the
+	sender writes it and closes the stream at the end, the receiver reads
+	until connectionClosed().  finished() follows once the session is
+	over. */
+	class JingleFileTransfer : public QObject
+	{
+		Q_OBJECT
+	public:
+		enum { ErrReject, ErrNeg, ErrConnect, ErrStream };
+		enum { Idle, Requesting, WaitingForAccept, Connecting, Active };
+		~JingleFileTransfer();
+
+		// send
+		void sendFile(const Jid &to, const QString &fname, qlonglong size, const QString &desc);
+
+		// receive
+		Jid peer() const;
+		QString sid() const;
+		QString fileName() const;
+		qlonglong fileSize() const;
+		QString description() const;
+		void accept();
+
+		// both
+		int state() const;
+                /** \brief Reject the offer, or end the session before the file is through. */
+		void close();
+                /** \brief The data connection once connected(), owned by the transfer. */
+		ByteStream *stream() const;
+
+	signals:
+		void accepted();
+		void connected();
+		void finished();
+		void error(int);
+
+	private slots:
+		void ice_started();
+		void ice_error();
+		void ice_localCandidatesReady(const QList<XMPP::Ice176::Candidate> &list);
+		void ice_componentReady(int index);
+		void stream_delayedCloseFinished();
+		void stream_connectionClosed();
+		void stream_error(int);
+		void initiate_finished();
+		void t_timeout();
+
+	private:
+		class Private;
+		Private *d;
+
+		void reset();
+		void startIce(bool initiator);
+		void takeRemote(const QDomElement &transport);
+		void terminate(const char *reason);
+		void fail(int x, const char *reason);
+
+		friend class JingleManager;
+		JingleFileTransfer(JingleManager *, QObject *parent=0);
+		void man_waitForAccept(const Jid &from, const QString &sid, const QDomElement &content);
+		void man_action(const QString &action, const QDomElement &jingle);
+	};
+
+	/** \brief Sets up Jingle file transfers for a Client, and takes the incoming ones. */
+	class JingleManager : public QObject
+	{
+		Q_OBJECT
+	public:
+		JingleManager(Client *);
+		~JingleManager();
+
+		Client *client() const;
+
+		/** \brief ICE settings for the sessions started from now on.
+		    Without local addresses, those of IceLocalAddressSet::instance() are used. */
+		void setLocalAddresses(const QList<Ice176::LocalAddress> &addrs);
+		void setStunBindService(const QHostAddress &addr, int port);
+		void setStunRelayUdpService(const QHostAddress &addr, int port, const QString &user, const QCA::SecureArray &pass);
+
+		JingleFileTransfer *createTransfer();
+		JingleFileTransfer *takeIncoming();
+
+	signals:
+		void incomingReady();
+
+	private slots:
+		void push_incoming(const XMPP::Jid &from, const QString &iq_id, const QDomElement &jingle);
+
+	private:
+		class Private;
+		Private *d;
+
+		friend class JingleFileTransfer;
+		QString link(JingleFileTransfer *);
+		void unlink(JingleFileTransfer *);
+		void configureIce(Ice176 *ice) const;
+	};
+
+	class JT_Jingle : public Task
+	{
+		Q_OBJECT
+	public:
+		JT_Jingle(Task *parent);
+		~JT_Jingle();
+
+                /** \brief Send \a jingle, made with doc(), to \a to. */
+		void request(const Jid &to, const QDomElement &jingle);
+
+		void onGo();
+		bool take(const QDomElement &);
+
+	private:
+		class Private;
+		Private *d;
+	};
+
+	class JT_PushJingle : public Task
+	{
+		Q_OBJECT
+	public:
+		JT_PushJingle(Task *parent);
+		~JT_PushJingle();
+
+		void respondSuccess(const Jid &to, const QString &id);
+		void respondError(const Jid &to, const QString &id, int code, const QString &str);
+
+		bool take(const QDomElement &);
+
+	signals:
+		void incoming(const XMPP::Jid &from, const QString &iq_id, const QDomElement &jingle);
+	};
+}
+
+#endif
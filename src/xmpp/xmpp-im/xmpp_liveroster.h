@@ -21,6 +21,7 @@
 #define XMPP_LIVEROSTER_H
 
 #include <QList>
+#include <QMultiHash>
 
 #include "xmpp_liverosteritem.h"
 
@@ -37,6 +38,21 @@ namespace XMPP
 		void flagAllForDelete();
 		LiveRoster::Iterator find(const Jid &, bool compareRes=true);
 		LiveRoster::ConstIterator find(const Jid &, bool compareRes=true) const;
+		QList<int> indexesOf(const Jid &) const;
+
+		// these keep the bare jid index up to date.  other modifications
+		//   are detected by a change in size and cause a full reindex.
+		void append(const LiveRosterItem &);
+		LiveRoster & operator+=(const LiveRosterItem &);
+		LiveRoster::Iterator erase(LiveRoster::Iterator);
+		void clear();
+
+	private:
+		mutable QMultiHash<QString,int> v_index;
+		mutable int v_indexed;
+
+		void ensureIndex() const;
+		int findIndex(const Jid &, bool compareRes) const;
 	};
 }
 
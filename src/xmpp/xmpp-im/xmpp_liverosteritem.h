@@ -26,12 +26,15 @@
 
 namespace XMPP
 {
+        /** \brief A roster entry with the presence of its resources.  Shared like RosterItem. */
 	class LiveRosterItem : public RosterItem
 	{
 	public:
 		LiveRosterItem(const Jid &j="");
 		LiveRosterItem(const RosterItem &);
+		LiveRosterItem(const LiveRosterItem &from);
 		~LiveRosterItem();
+		LiveRosterItem & operator=(const LiveRosterItem &from);
 
 		void setRosterItem(const RosterItem &);
 
@@ -49,9 +52,8 @@ namespace XMPP
 		void setFlagForDelete(bool);
 
 	private:
-		ResourceList v_resourceList;
-		Status v_lastUnavailableStatus;
-		bool v_flagForDelete;
+		class Private;
+		QSharedDataPointer<Private> d;
 	};
 }
 
@@ -20,6 +20,8 @@
 #ifndef XMPP_MESSAGE_H
 #define XMPP_MESSAGE_H
 
+#include <QSharedDataPointer>
+
 #include "xmpp_stanza.h"
 #include "xmpp_url.h"
 #include "xmpp_chatstate.h"
@@ -27,6 +29,7 @@
 #include "xmpp_address.h"
 #include "xmpp_rosterx.h"
 #include "xmpp_muc.h"
+#include "xmpp_pubsubevent.h"
 
 class QString;
 class QDateTime;
@@ -38,6 +41,7 @@ namespace XMPP {
 	class HTMLElement;
 	class HttpAuthRequest;
 	class XData;
+	class XmlWriter;
 
 	typedef enum { OfflineEvent, DeliveredEvent, DisplayedEvent,
 			ComposingEvent, CancelEvent } MsgEvent;
@@ -74,6 +78,8 @@ namespace XMPP {
 		const QString& pubsubNode() const;
 		const QList<PubSubItem>& pubsubItems() const;
 		const QList<PubSubRetraction>& pubsubRetractions() const;
+                /** \brief The pubsub event of a message made by fromStanza(), to walk without building the lists above.  Null if there is none. */
+		PubSubEvent pubsubEvent() const;
 
 		// JEP-0091
 		QDateTime timeStamp() const;
@@ -161,13 +167,22 @@ namespace XMPP {
 		void setWasEncrypted(bool);
 
 		Stanza toStanza(Stream *stream) const;
+		// writes what toStanza() would build, in the namespace ns, without
+		//   QDom.  false, with nothing written, if the message holds
+		//   anything other than addressing, subject, body, thread,
+		//   timestamp, urls, events, chat state, receipt, encrypted data,
+		//   invite and nick
+		bool writeXml(XmlWriter *w, const QString &ns) const;
+		// only the addressing, subject, body, thread and error are read
+		//   here.  the extensions are decoded from the stanza element, which
+		//   is kept, the first time one of them is used.
 		bool fromStanza(const Stanza &s);
 		bool fromStanza(const Stanza &s, int tzoffset);
 		bool fromStanza(const Stanza &s, bool useTimeZoneOffset, int timeZoneOffset);
 
 	private:		
 		class Private;
-		Private *d;
+		QSharedDataPointer<Private> d;
 	};
 }
 
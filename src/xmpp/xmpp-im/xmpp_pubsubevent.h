@@ -0,0 +1,65 @@
+/*
+ * xmpp_pubsubevent.h - walk a pubsub event where it was received
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_PUBSUBEVENT_H
+#define XMPP_PUBSUBEVENT_H
+
+#include <QString>
+#include <QDomElement>
+
+namespace XMPP
+{
+        /** \brief Hands out the items and retractions of a pubsub event (XEP-0060) one at a time, as they are in the received stanza.
+            Unlike Message::pubsubItems(), no list is built and nothing else in the message is decoded.  The payloads are the
+            elements of the stanza itself, so they are only valid while a Message or PubSubEvent refers to it, and changing
+            them changes the stanza.
+
+            \code
+            PubSubEvent e = m.pubsubEvent();
+            while(e.next()) {
+                if(!e.isRetraction())
+                    handle(e.id(), e.payload());
+            }
+            \endcode */
+	class PubSubEvent
+	{
+	public:
+		PubSubEvent();
+                /** \brief Walk \a event, an \<event/\> element in the pubsub#event namespace. */
+		PubSubEvent(const QDomElement &event);
+
+		bool isNull() const;
+                /** \brief Node the items are from. */
+		QString node() const;
+
+                /** \brief Go to the next item or retraction.  Returns false when there are no more.  Call once before the first one. */
+		bool next();
+		bool isRetraction() const;
+		QString id() const;
+                /** \brief Payload of the current item, or a null element for retractions and items without one. */
+		QDomElement payload() const;
+
+	private:
+		QDomElement items_;
+		QDomElement cur_;
+		bool end_;
+	};
+}
+
+#endif
@@ -39,6 +39,20 @@ namespace XMPP
 
 		ResourceList::ConstIterator find(const QString &) const;
 		ResourceList::ConstIterator priority() const;
+
+		// the highest priority resource is cached.  these drop the cache,
+		//   call invalidatePriority() after changing a Resource in place.
+		void append(const Resource &);
+		ResourceList & operator+=(const Resource &);
+		ResourceList::Iterator erase(ResourceList::Iterator);
+		void clear();
+		void invalidatePriority();
+
+	private:
+		mutable int v_priority;
+		mutable int v_priorityCount;
+
+		int priorityIndex() const;
 	};
 }
 
@@ -0,0 +1,49 @@
+/*
+ * xmpp_rostercache.h - storage interface for XEP-0237 roster versioning
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_ROSTERCACHE_H
+#define XMPP_ROSTERCACHE_H
+
+#include <QString>
+
+namespace XMPP
+{
+	class Jid;
+	class Roster;
+
+        /** \brief Persistent storage for a versioned roster (XEP-0237).
+            Give one to Client::setRosterCache() and, on servers that support
+            roster versioning, login only transfers what changed since the
+            stored copy.  How and where the roster is kept is up to the
+            application; RosterFileCache is a ready one, and RosterItem::toXml()
+            and fromXml() are another way. */
+	class RosterCache
+	{
+	public:
+		virtual ~RosterCache() {}
+
+                /** \brief Fetch the stored roster of \a account and its version.
+                    Return false if nothing is stored. */
+		virtual bool load(const Jid &account, Roster *roster, QString *ver) = 0;
+                /** \brief Replace the stored roster of \a account. */
+		virtual void store(const Jid &account, const Roster &roster, const QString &ver) = 0;
+	};
+}
+
+#endif
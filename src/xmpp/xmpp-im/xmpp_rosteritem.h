@@ -20,6 +20,7 @@
 #ifndef XMPP_ROSTERITEM_H
 #define XMPP_ROSTERITEM_H
 
+#include <QSharedDataPointer>
 #include <QString>
 #include <QStringList>
 
@@ -43,11 +44,15 @@ namespace XMPP
 		SubType value;
 	};
 
+        /** \brief A roster entry.  Copies share their data until one is changed, and group names
+            are shared by every item in the process that is in the same group. */
 	class RosterItem
 	{
 	public:
 		RosterItem(const Jid &jid="");
+		RosterItem(const RosterItem &from);
 		virtual ~RosterItem();
+		RosterItem & operator=(const RosterItem &from);
 
 		const Jid & jid() const;
 		const QString & name() const;
@@ -70,12 +75,8 @@ namespace XMPP
 		bool fromXml(const QDomElement &);
 
 	private:
-		Jid v_jid;
-		QString v_name;
-		QStringList v_groups;
-		Subscription v_subscription;
-		QString v_ask;
-		bool v_push;
+		class Private;
+		QSharedDataPointer<Private> d;
 	};
 }
 
@@ -0,0 +1,498 @@
+/*
+ * xmpp_rosterstore.cpp - compact on-disk rosters and vCards
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmpp_rosterstore.h"
+
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QUrl>
+#include <QtEndian>
+#include <qdom.h>
+#include <string.h>
+
+#include "xmpp/jid/jid.h"
+#include "xmpp_avatarcache.h"
+#include "xmpp_roster.h"
+#include "xmpp_rosteritem.h"
+#include "xmpp_vcard.h"
+
+// all numbers are little-endian 32-bit words, and every string is UTF-8
+//   addressed by offset and length from the start of the file.
+//
+// roster:  "IRRS", format, items, group refs, strings, version string
+//          items:      jid, name, ask, subscription, first group ref, groups
+//          group refs: string
+//          strings:    offset, length
+//
+// vcards:  "IRVC", format, count
+//          entries, sorted by jid: jid, jid length, xml, xml length,
+//                                  photo, photo length
+#define STORE_FORMAT 1
+
+#define ROSTER_HEADER 6
+#define ROSTER_ITEM   6
+#define VCARD_HEADER  3
+#define VCARD_ENTRY   6
+
+using namespace XMPP;
+
+static void putWord(QByteArray *out, quint32 x)
+{
+	uchar buf[4];
+	qToLittleEndian<quint32>(x, buf);
+	out->append((const char *)buf, 4);
+}
+
+// write next to the old file first, so a crash leaves one of the two
+static bool saveFile(const QString &fileName, const QByteArray &data)
+{
+	QString tmp = fileName + ".new";
+	QFile f(tmp);
+	if(!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+	if(f.write(data) != data.size()) {
+		f.close();
+		f.remove();
+		return false;
+	}
+	f.close();
+	QFile::remove(fileName);
+	return QFile::rename(tmp, fileName);
+}
+
+// a file mapped read-only, read with bounds checks
+class MappedFile
+{
+public:
+	QFile file;
+	const uchar *data;
+	quint64 size;
+
+	MappedFile() : data(0), size(0) {}
+
+	bool open(const QString &fileName, const char *magic, int headerWords)
+	{
+		close();
+		file.setFileName(fileName);
+		if(!file.open(QIODevice::ReadOnly))
+			return false;
+		size = file.size();
+		if(size >= (quint64)headerWords * 4)
+			data = file.map(0, size);
+		if(!data || memcmp(data, magic, 4) != 0 || word(1) != STORE_FORMAT) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+		if(data)
+			file.unmap(const_cast<uchar *>(data));
+		file.close();
+		data = 0;
+		size = 0;
+	}
+
+	bool fits(quint64 at, quint64 len) const
+	{
+		return at <= size && len <= size - at;
+	}
+
+	// word n of the file, which the caller made sure is there
+	quint32 word(quint64 n) const
+	{
+		return qFromLittleEndian<quint32>(data + n * 4);
+	}
+
+	QByteArray bytes(quint32 at, quint32 len) const
+	{
+		if(!fits(at, len))
+			return QByteArray();
+		return QByteArray((const char *)data + at, len);
+	}
+
+	QString string(quint32 at, quint32 len) const
+	{
+		if(!fits(at, len))
+			return QString();
+		return QString::fromUtf8((const char *)data + at, len);
+	}
+};
+
+// every distinct string once
+class StringTable
+{
+public:
+	QHash<QString, quint32> index;
+	QList<QByteArray> strings;
+
+	quint32 add(const QString &s)
+	{
+		QHash<QString, quint32>::ConstIterator it = index.find(s);
+		if(it != index.constEnd())
+			return it.value();
+		quint32 n = strings.count();
+		index.insert(s, n);
+		strings += s.toUtf8();
+		return n;
+	}
+};
+
+//----------------------------------------------------------------------------
+// MappedRoster
+//----------------------------------------------------------------------------
+class MappedRoster::Private
+{
+public:
+	MappedFile f;
+	quint32 items, groupRefs, strings;
+	quint64 groupsAt, stringsAt; // in words
+
+	QString string(quint32 n) const
+	{
+		if(n >= strings)
+			return QString();
+		quint64 at = stringsAt + (quint64)n * 2;
+		return f.string(f.word(at), f.word(at + 1));
+	}
+
+	quint32 field(int n, int i) const
+	{
+		return f.word(ROSTER_HEADER + (quint64)n * ROSTER_ITEM + i);
+	}
+};
+
+MappedRoster::MappedRoster()
+{
+	d = new Private;
+	d->items = d->groupRefs = d->strings = 0;
+	d->groupsAt = d->stringsAt = 0;
+}
+
+MappedRoster::~MappedRoster()
+{
+	delete d;
+}
+
+bool MappedRoster::open(const QString &fileName)
+{
+	close();
+	if(!d->f.open(fileName, "IRRS", ROSTER_HEADER))
+		return false;
+
+	quint32 items = d->f.word(2);
+	quint32 groupRefs = d->f.word(3);
+	quint32 strings = d->f.word(4);
+	quint64 groupsAt = ROSTER_HEADER + (quint64)items * ROSTER_ITEM;
+	quint64 stringsAt = groupsAt + groupRefs;
+	if(!d->f.fits(0, (stringsAt + (quint64)strings * 2) * 4)) {
+		d->f.close();
+		return false;
+	}
+
+	d->items = items;
+	d->groupRefs = groupRefs;
+	d->strings = strings;
+	d->groupsAt = groupsAt;
+	d->stringsAt = stringsAt;
+	return true;
+}
+
+void MappedRoster::close()
+{
+	d->f.close();
+	d->items = d->groupRefs = d->strings = 0;
+}
+
+bool MappedRoster::isOpen() const
+{
+	return d->f.data != 0;
+}
+
+QString MappedRoster::version() const
+{
+	if(!isOpen())
+		return QString();
+	return d->string(d->f.word(5));
+}
+
+int MappedRoster::count() const
+{
+	return d->items;
+}
+
+QString MappedRoster::jid(int n) const
+{
+	if(n < 0 || (quint32)n >= d->items)
+		return QString();
+	return d->string(d->field(n, 0));
+}
+
+QString MappedRoster::name(int n) const
+{
+	if(n < 0 || (quint32)n >= d->items)
+		return QString();
+	return d->string(d->field(n, 1));
+}
+
+RosterItem MappedRoster::item(int n) const
+{
+	if(n < 0 || (quint32)n >= d->items)
+		return RosterItem();
+
+	RosterItem i(Jid(d->string(d->field(n, 0))));
+	i.setName(d->string(d->field(n, 1)));
+	i.setAsk(d->string(d->field(n, 2)));
+	quint32 sub = d->field(n, 3);
+	if(sub <= Subscription::Remove)
+		i.setSubscription(Subscription((Subscription::SubType)sub));
+
+	quint32 first = d->field(n, 4);
+	quint32 groups = d->field(n, 5);
+	if(first <= d->groupRefs && groups <= d->groupRefs - first) {
+		QStringList list;
+		for(quint32 g = 0; g < groups; ++g)
+			list += d->string(d->f.word(d->groupsAt + first + g));
+		i.setGroups(list);
+	}
+	return i;
+}
+
+Roster MappedRoster::roster() const
+{
+	Roster r;
+	for(int n = 0; n < count(); ++n)
+		r += item(n);
+	return r;
+}
+
+bool MappedRoster::write(const QString &fileName, const Roster &roster, const QString &ver)
+{
+	StringTable table;
+	QByteArray items, groups;
+	quint32 groupRefs = 0;
+	foreach(const RosterItem &i, roster) {
+		putWord(&items, table.add(i.jid().full()));
+		putWord(&items, table.add(i.name()));
+		putWord(&items, table.add(i.ask()));
+		putWord(&items, i.subscription().type());
+		putWord(&items, groupRefs);
+		putWord(&items, i.groups().count());
+		foreach(const QString &g, i.groups())
+			putWord(&groups, table.add(g));
+		groupRefs += i.groups().count();
+	}
+	quint32 verString = table.add(ver);
+
+	QByteArray out;
+	out += "IRRS";
+	putWord(&out, STORE_FORMAT);
+	putWord(&out, roster.count());
+	putWord(&out, groupRefs);
+	putWord(&out, table.strings.count());
+	putWord(&out, verString);
+	out += items;
+	out += groups;
+
+	quint32 at = out.size() + table.strings.count() * 8;
+	foreach(const QByteArray &s, table.strings) {
+		putWord(&out, at);
+		putWord(&out, s.size());
+		at += s.size();
+	}
+	foreach(const QByteArray &s, table.strings)
+		out += s;
+
+	return saveFile(fileName, out);
+}
+
+//----------------------------------------------------------------------------
+// MappedVCards
+//----------------------------------------------------------------------------
+class MappedVCards::Private
+{
+public:
+	MappedFile f;
+	quint32 count;
+
+	quint32 field(int n, int i) const
+	{
+		return f.word(VCARD_HEADER + (quint64)n * VCARD_ENTRY + i);
+	}
+};
+
+MappedVCards::MappedVCards()
+{
+	d = new Private;
+	d->count = 0;
+}
+
+MappedVCards::~MappedVCards()
+{
+	delete d;
+}
+
+bool MappedVCards::open(const QString &fileName)
+{
+	close();
+	if(!d->f.open(fileName, "IRVC", VCARD_HEADER))
+		return false;
+
+	quint32 count = d->f.word(2);
+	if(!d->f.fits(0, (VCARD_HEADER + (quint64)count * VCARD_ENTRY) * 4)) {
+		d->f.close();
+		return false;
+	}
+	d->count = count;
+	return true;
+}
+
+void MappedVCards::close()
+{
+	d->f.close();
+	d->count = 0;
+}
+
+bool MappedVCards::isOpen() const
+{
+	return d->f.data != 0;
+}
+
+int MappedVCards::count() const
+{
+	return d->count;
+}
+
+QString MappedVCards::jid(int n) const
+{
+	if(n < 0 || (quint32)n >= d->count)
+		return QString();
+	return d->f.string(d->field(n, 0), d->field(n, 1));
+}
+
+int MappedVCards::indexOf(const QString &jid) const
+{
+	QByteArray key = jid.toUtf8();
+	int lo = 0, hi = (int)d->count - 1;
+	while(lo <= hi) {
+		int mid = (lo + hi) / 2;
+		quint32 at = d->field(mid, 0);
+		quint32 len = d->field(mid, 1);
+		if(!d->f.fits(at, len))
+			return -1;
+		int c = memcmp(d->f.data + at, key.constData(), qMin((int)len, key.size()));
+		if(c == 0)
+			c = (int)len - key.size();
+		if(c == 0)
+			return mid;
+		if(c < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+VCard MappedVCards::vcard(int n) const
+{
+	VCard v;
+	if(n < 0 || (quint32)n >= d->count)
+		return v;
+
+	QDomDocument doc;
+	if(!doc.setContent(d->f.bytes(d->field(n, 2), d->field(n, 3))) || !v.fromXml(doc.documentElement()))
+		return VCard();
+	QByteArray p = photo(n);
+	if(!p.isEmpty())
+		v.setPhoto(AvatarCache::insert(p));
+	return v;
+}
+
+QByteArray MappedVCards::photo(int n) const
+{
+	if(n < 0 || (quint32)n >= d->count)
+		return QByteArray();
+	return d->f.bytes(d->field(n, 4), d->field(n, 5));
+}
+
+bool MappedVCards::write(const QString &fileName, const QMap<QString, VCard> &vcards)
+{
+	// sorted by the bytes indexOf() compares
+	QMap<QByteArray, QPair<QByteArray, QByteArray> > entries;
+	for(QMap<QString, VCard>::ConstIterator it = vcards.begin(); it != vcards.end(); ++it) {
+		VCard v = it.value();
+		QByteArray photo = v.photo();
+		v.setPhoto(QByteArray());
+		QDomDocument doc;
+		doc.appendChild(v.toXml(&doc));
+		entries.insert(it.key().toUtf8(), qMakePair(doc.toByteArray(0), photo));
+	}
+
+	QByteArray out, data;
+	out += "IRVC";
+	putWord(&out, STORE_FORMAT);
+	putWord(&out, entries.count());
+
+	quint32 at = out.size() + entries.count() * VCARD_ENTRY * 4;
+	for(QMap<QByteArray, QPair<QByteArray, QByteArray> >::ConstIterator it = entries.begin(); it != entries.end(); ++it) {
+		const QByteArray *parts[3] = { &it.key(), &it.value().first, &it.value().second };
+		for(int i = 0; i < 3; ++i) {
+			putWord(&out, at + data.size());
+			putWord(&out, parts[i]->size());
+			data += *parts[i];
+		}
+	}
+	out += data;
+
+	return saveFile(fileName, out);
+}
+
+//----------------------------------------------------------------------------
+// RosterFileCache
+//----------------------------------------------------------------------------
+RosterFileCache::RosterFileCache(const QString &dir)
+:v_dir(dir)
+{
+}
+
+QString RosterFileCache::fileName(const Jid &account) const
+{
+	return v_dir + '/' + QString::fromLatin1(QUrl::toPercentEncoding(account.bare())) + ".roster";
+}
+
+bool RosterFileCache::load(const Jid &account, Roster *roster, QString *ver)
+{
+	MappedRoster m;
+	if(!m.open(fileName(account)))
+		return false;
+	*roster = m.roster();
+	*ver = m.version();
+	return true;
+}
+
+void RosterFileCache::store(const Jid &account, const Roster &roster, const QString &ver)
+{
+	QDir().mkpath(v_dir);
+	MappedRoster::write(fileName(account), roster, ver);
+}
@@ -0,0 +1,115 @@
+/*
+ * xmpp_rosterstore.h - compact on-disk rosters and vCards
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_ROSTERSTORE_H
+#define XMPP_ROSTERSTORE_H
+
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+
+#include "xmpp_rostercache.h"
+
+namespace XMPP
+{
+	class Jid;
+	class Roster;
+	class RosterItem;
+	class VCard;
+
+        /** \brief Read-only view of a roster file written by write(), mapped into memory.
+            Opening only checks the tables; an item is decoded when it is asked for, so a large
+            roster costs next to nothing until it is used.  Strings the items share, such as group
+            names, are stored once.  The view is invalid once the file is written again. */
+	class MappedRoster
+	{
+	public:
+		MappedRoster();
+		~MappedRoster();
+
+		bool open(const QString &fileName);
+		void close();
+		bool isOpen() const;
+
+		QString version() const;
+		int count() const;
+		QString jid(int n) const;
+		QString name(int n) const;
+		RosterItem item(int n) const;
+		Roster roster() const;
+
+                /** \brief Store \a roster with roster version \a ver in \a fileName, replacing it. */
+		static bool write(const QString &fileName, const Roster &roster, const QString &ver);
+
+	private:
+		class Private;
+		Private *d;
+
+		MappedRoster(const MappedRoster &);
+		MappedRoster & operator=(const MappedRoster &);
+	};
+
+        /** \brief Read-only view of a file of vCards written by write(), mapped into memory.
+            The photos are kept as raw data beside the rest of each vCard, so photo() gets one
+            without touching any XML, and vcard() only parses the entry asked for. */
+	class MappedVCards
+	{
+	public:
+		MappedVCards();
+		~MappedVCards();
+
+		bool open(const QString &fileName);
+		void close();
+		bool isOpen() const;
+
+		int count() const;
+		QString jid(int n) const;
+                /** \brief Position of the vCard of bare \a jid, or -1. */
+		int indexOf(const QString &jid) const;
+		VCard vcard(int n) const;
+		QByteArray photo(int n) const;
+
+                /** \brief Store \a vcards, by bare jid, in \a fileName, replacing it. */
+		static bool write(const QString &fileName, const QMap<QString, VCard> &vcards);
+
+	private:
+		class Private;
+		Private *d;
+
+		MappedVCards(const MappedVCards &);
+		MappedVCards & operator=(const MappedVCards &);
+	};
+
+        /** \brief A RosterCache keeping one MappedRoster file per account in a directory. */
+	class RosterFileCache : public RosterCache
+	{
+	public:
+		RosterFileCache(const QString &dir);
+
+		QString fileName(const Jid &account) const;
+
+		bool load(const Jid &account, Roster *roster, QString *ver);
+		void store(const Jid &account, const Roster &roster, const QString &ver);
+
+	private:
+		QString v_dir;
+	};
+}
+
+#endif
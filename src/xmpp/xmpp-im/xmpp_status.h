@@ -24,6 +24,7 @@
 #include <QList>
 #include <QString>
 #include <QDateTime>
+#include <QDomElement>
 
 #include "xmpp_muc.h"
 
@@ -70,6 +71,7 @@ namespace XMPP
 		int mucHistoryMaxChars() const;
 		int mucHistoryMaxStanzas() const;
 		int mucHistorySeconds() const;
+		QDateTime mucHistorySince() const;
 
 		void setPriority(int);
 		void setType(Type);
@@ -92,9 +94,14 @@ namespace XMPP
 		void addMUCStatus(int);
 		void setMUCPassword(const QString&);
 		void setMUCHistory(int maxchars, int maxstanzas, int seconds);
+                /** \brief Only ask for the room history after \a since, sent along with the limits of setMUCHistory(). */
+		void setMUCHistorySince(const QDateTime &since);
 
 		void setXSigned(const QString &);
 		void setSongTitle(const QString &);
+                /** \brief Decode the optional extensions of \a presence (caps, MUC user, photo hash, signing, e2e key, song)
+                    only when one of them is first asked for.  The element, and so its document, is kept until then. */
+		void setExtensions(const QDomElement &presence);
 
 		// JEP-153: VCard-based Avatars
 		const QString& photoHash() const;
@@ -122,9 +129,15 @@ namespace XMPP
 		QList<int> v_mucStatuses;
 		QString v_mucPassword;
 		int v_mucHistoryMaxChars, v_mucHistoryMaxStanzas, v_mucHistorySeconds;
+		QDateTime v_mucHistorySince;
 
 		int ecode;
 		QString estr;
+
+		// presence whose extensions aren't decoded yet
+		QDomElement v_ext;
+		void decode() const;
+		void decodeExtensions();
 	};
 
 }
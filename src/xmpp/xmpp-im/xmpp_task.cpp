@@ -18,15 +18,28 @@
  */
 
 #include <QTimer>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QPointer>
+#include <QStringList>
 
 #include "safedelete.h"
 #include "xmpp_task.h"
 #include "xmpp_client.h"
 #include "xmpp_xmlcommon.h"
 #include "xmpp_stanza.h"
+#include "xmpp_statistics.h"
+#include "iristrace.h"
 
 using namespace XMPP;
 
+// key used by the root task's push route index
+static QString routeKey(const QString &kind, const QString &ns)
+{
+	return kind + '\n' + ns;
+}
+
 class Task::TaskPrivate
 {
 public:
@@ -40,8 +53,44 @@ public:
 	bool insig, deleteme, autoDelete;
 	bool done;
         Stanza::Error *error;
+
+	// dispatch index, kept by the root task for its direct children
+	bool isRoot;
+	Task *indexRoot;                // root that indexes this task, if any
+	QString replyKey;               // id this task is waiting on, if any
+	QStringList routeKeys;          // push routes declared by this task
+	QHash<QString, Task*> replies;  // root only: id -> task
+	QHash<QString, QList<Task*> > routes; // root only: kind/ns -> tasks
+	QList<Task*> generic;           // root only: tasks without any index entry
+
+	// request timeouts and the per-jid limit, for direct children of the
+	//   root task like the index
+	int timeout, retries;
+	int wait, retriesLeft;          // of the request in flight
+	QDomElement request;            // kept for resending, or
+	Stanza requestStanza;           //   this one if sent as a stanza
+	qint64 deadline;                // -1 if none is set
+	QString slotKey;                // jid our request counts against
+	bool holdsSlot, queued;
+	StatisticsTimer clock;                  // root only: time base for deadlines
+	QTimer *deadlineTimer;                  // root only
+	QMultiMap<qint64, Task*> deadlines;     // root only: deadline -> task
+	QHash<QString, int> inFlight;           // root only: jid -> requests sent
+	QHash<QString, QList<Task*> > waiting;  // root only: jid -> requests held back
+
+	// shared requests, see sendShared()
+	QString sharedKey;
+	QDomElement sharedRequest;
+	QDomElement sharedReply;        // handed to us, for sharedReady()
+	bool sharedLeading, sharedWaiting;
+	QHash<QString, Task*> sharedLeaders;            // root only: key -> task on the wire
+	QHash<QString, QList<Task*> > sharedWaiters;    // root only: key -> tasks waiting for it
+	QHash<QString, QPair<qint64, QDomElement> > sharedCache; // root only: key -> expiry, result
 };
 
+// cached results are only looked through for expired ones past this size
+#define SHARED_CACHE_PRUNE 256
+
 /*! \brief Create Task from rootTask */
 Task::Task(Task *parent)
 :QObject(parent)
@@ -51,6 +100,11 @@ Task::Task(Task *parent)
 	d->client = parent->client();
 	d->id = client()->genUniqueId();
 	connect(d->client, SIGNAL(disconnected()), SLOT(clientDisconnected()));
+
+	if(parent->d->isRoot) {
+		d->indexRoot = parent;
+		parent->d->generic += this;
+	}
 }
 
 Task::Task(Client *parent, bool)
@@ -59,11 +113,32 @@ Task::Task(Client *parent, bool)
 	init();
 
 	d->client = parent;
+	d->isRoot = true;
+	d->clock.start();
+	d->deadlineTimer = new QTimer;
+	d->deadlineTimer->setSingleShot(true);
+	connect(d->deadlineTimer, SIGNAL(timeout()), SLOT(deadlineTimeout()));
 	connect(d->client, SIGNAL(disconnected()), SLOT(clientDisconnected()));
 }
 
 Task::~Task()
 {
+	if(d->isRoot) {
+		delete d->deadlineTimer;
+
+		// children are destroyed after us, so detach them from the index
+		foreach(Task *t, d->generic)
+			t->d->indexRoot = 0;
+		foreach(Task *t, d->replies)
+			t->d->indexRoot = 0;
+		foreach(const QList<Task*> &l, d->routes) {
+			foreach(Task *t, l)
+				t->d->indexRoot = 0;
+		}
+	}
+	else
+		unindex();
+
         if (d->error)
             delete d->error;
 	delete d;
@@ -78,6 +153,18 @@ void Task::init()
 	d->autoDelete = false;
 	d->done = false;
         d->error = NULL;
+	d->isRoot = false;
+	d->indexRoot = 0;
+	d->timeout = 0;
+	d->retries = 0;
+	d->wait = 0;
+	d->retriesLeft = 0;
+	d->deadline = -1;
+	d->holdsSlot = false;
+	d->queued = false;
+	d->deadlineTimer = 0;
+	d->sharedLeading = false;
+	d->sharedWaiting = false;
 }
 
 Task *Task::parent() const
@@ -115,6 +202,17 @@ const QString & Task::statusString() const
 	return d->statusString;
 }
 
+void Task::setTimeout(int msecs, int retries)
+{
+	d->timeout = qMax(msecs, 0);
+	d->retries = qMax(retries, 0);
+}
+
+int Task::timeout() const
+{
+	return d->timeout > 0 ? d->timeout : client()->iqTimeout();
+}
+
 void Task::go(bool autoDelete)
 {
 	d->autoDelete = autoDelete;
@@ -134,9 +232,22 @@ void Task::go(bool autoDelete)
     and process element.
     \param x XML stanza to process.
     \return True if stanza was handled by this Task, false if not.
+
+    The root task does not scan its children linearly.  IQ replies go straight
+    to the task that sent the request with the same id, stanzas matching a
+    route declared with addRoute() go to those tasks, the ones that asked for
+    a namespace first, and only the remaining tasks are offered the stanza
+    in turn.
 */
 bool Task::take(const QDomElement &x)
 {
+	if(d->isRoot) {
+		IRIS_TRACEPOINT1(task_dispatch_begin, this);
+		bool ret = rootTake(x);
+		IRIS_TRACEPOINT2(task_dispatch_end, this, ret ? 1 : 0);
+		return ret;
+	}
+
 	const QObjectList p = children();
 
 	// pass along the xml
@@ -154,6 +265,124 @@ bool Task::take(const QDomElement &x)
 	return false;
 }
 
+bool Task::rootTake(const QDomElement &x)
+{
+	const XmlAtoms &a = XmlAtoms::get();
+	QString kind = x.tagName();
+
+	// replies to our own requests
+	if(kind == a.iq) {
+		QString type = x.attribute(a.type);
+		if(type == a.resultType || type == a.error) {
+			Task *t = d->replies.value(x.attribute(a.id));
+			if(t && t->d->sharedLeading) {
+				// the tasks sharing this request are answered too,
+				//   whatever the leader makes of it
+				QString key = t->d->sharedKey;
+				QList<Task*> sharers = d->sharedWaiters.take(key);
+				d->sharedLeaders.remove(key);
+				t->d->sharedLeading = false;
+
+				// the waiting ones may be deleted as the leader finishes
+				QList< QPointer<Task> > guards;
+				foreach(Task *i, sharers)
+					guards += i;
+				if(t->take(x)) {
+					sharers.clear();
+					foreach(const QPointer<Task> &i, guards) {
+						if(i)
+							sharers += i;
+					}
+					passShared(key, x, sharers);
+					return true;
+				}
+				t->d->sharedLeading = true;
+				d->sharedLeaders.insert(key, t);
+				d->sharedWaiters[key] = sharers + d->sharedWaiters.value(key);
+			}
+			else if(t && t->take(x))
+				return true;
+		}
+	}
+
+	// declared push routes, those for a namespace before those taking
+	//   every stanza of a kind
+	if(!d->routes.isEmpty()) {
+		QList<Task*> tried;
+		QList<Task*> list;
+		for(QDomNode n = x.firstChild(); !n.isNull(); n = n.nextSibling()) {
+			QDomElement i = n.toElement();
+			if(i.isNull())
+				continue;
+			QString ns = i.attribute(a.xmlns);
+			if(ns.isEmpty())
+				ns = i.namespaceURI();
+			if(!ns.isEmpty())
+				list += d->routes.value(routeKey(kind, ns));
+		}
+		list += d->routes.value(routeKey(kind, QString()));
+		foreach(Task *t, list) {
+			if(tried.contains(t))
+				continue;
+			tried += t;
+			if(t->take(x))
+				return true;
+		}
+	}
+
+	// everything else
+	QList<Task*> list = d->generic;
+	foreach(Task *t, list) {
+		if(t->take(x))
+			return true;
+	}
+
+	return false;
+}
+
+void Task::unindex()
+{
+	Task *root = d->indexRoot;
+	if(!root)
+		return;
+	unschedule();
+	releaseSlot();
+	leaveShared();
+	if(!d->replyKey.isEmpty()) {
+		if(root->d->replies.value(d->replyKey) == this)
+			root->d->replies.remove(d->replyKey);
+		d->replyKey = QString();
+	}
+	foreach(const QString &key, d->routeKeys) {
+		QHash<QString, QList<Task*> >::Iterator it = root->d->routes.find(key);
+		if(it != root->d->routes.end()) {
+			it.value().removeAll(this);
+			if(it.value().isEmpty())
+				root->d->routes.erase(it);
+		}
+	}
+	d->routeKeys.clear();
+	root->d->generic.removeAll(this);
+}
+
+/*! \brief Declare that this task handles pushes of the given stanza kind
+    ("iq", "message" or "presence"), optionally only those carrying a child
+    element in namespace \a ns.  Once a task has declared a route, the root
+    task only offers it stanzas that match one of its routes.  Only has an
+    effect for direct children of the root task. */
+void Task::addRoute(const QString &kind, const QString &ns)
+{
+	Task *root = d->indexRoot;
+	if(!root)
+		return;
+	QString key = routeKey(kind, ns);
+	if(d->routeKeys.contains(key))
+		return;
+	root->d->generic.removeAll(this);
+	d->routeKeys += key;
+	root->d->routes[key] += this;
+}
+
 /*! \brief Schedule this Task to be deleted, after it exits all functions.
     Can be called more than once, will be deleted only one time. */
 void Task::safeDelete()
@@ -187,10 +416,327 @@ void Task::onDisconnect()
 	}
 }
 
-/*! \brief Send stanza using configured client. */
+/*! \brief Send stanza using configured client.
+    Sending an IQ request that carries this task's id() registers the task in
+    the root task's reply index: from then on the task is only offered IQ
+    replies with that id, which is what iqVerify() checks for anyway. */
 void Task::send(const QDomElement &x)
 {
-	client()->send(x);
+	const XmlAtoms &a = XmlAtoms::get();
+	QString kind = x.tagName();
+	QString type = x.attribute(a.type);
+	QString id = x.attribute(a.id);
+	indexReply(kind, type, id);
+	if(isRequest(kind, type, id)) {
+		d->request = x;
+		d->requestStanza = Stanza();
+		sendRequest(Jid(x.attribute(a.to)).full());
+	}
+	else
+		client()->send(x);
+}
+
+void Task::send(const Stanza &s)
+{
+	if(!s.isNull() && s.kind() == Stanza::IQ) {
+		const QString &iq = XmlAtoms::get().iq;
+		indexReply(iq, s.type(), s.id());
+		if(isRequest(iq, s.type(), s.id())) {
+			d->request = QDomElement();
+			d->requestStanza = s;
+			sendRequest(s.to().full());
+			return;
+		}
+	}
+	client()->send(s);
+}
+
+// a get or set sent with our id is answered with that id, so file the
+//   task for the reply
+void Task::indexReply(const QString &kind, const QString &type, const QString &id)
+{
+	Task *root = d->indexRoot;
+	const XmlAtoms &a = XmlAtoms::get();
+	if(root && d->replyKey.isEmpty() && d->routeKeys.isEmpty() && kind == a.iq) {
+		if((type == a.getType || type == a.setType) && id == d->id) {
+			root->d->generic.removeAll(this);
+			d->replyKey = d->id;
+			root->d->replies.insert(d->replyKey, this);
+		}
+	}
+}
+
+bool Task::isRequest(const QString &kind, const QString &type, const QString &id) const
+{
+	const XmlAtoms &a = XmlAtoms::get();
+	return d->indexRoot && kind == a.iq && (type == a.getType || type == a.setType) && id == d->id;
+}
+
+// requests are held back while their recipient has as many outstanding
+//   as Client::maxOutstandingIq() allows, and go out as earlier ones are
+//   answered
+void Task::sendRequest(const QString &to)
+{
+	Task *root = d->indexRoot;
+	int max = client()->maxOutstandingIq();
+	if(max > 0 && !d->holdsSlot) {
+		d->slotKey = to;
+		d->holdsSlot = true;
+		if(root->d->inFlight.value(to) >= max) {
+			d->queued = true;
+			root->d->waiting[to] += this;
+			return;
+		}
+		++root->d->inFlight[to];
+	}
+	startRequest();
+}
+
+void Task::startRequest()
+{
+	d->wait = timeout();
+	d->retriesLeft = d->retries;
+	transmit();
+	schedule(d->wait);
+}
+
+void Task::transmit()
+{
+	if(!d->requestStanza.isNull())
+		client()->send(d->requestStanza);
+	else
+		client()->send(d->request);
+}
+
+void Task::expire()
+{
+	if(d->done)
+		return;
+
+	if(d->retriesLeft > 0) {
+		--d->retriesLeft;
+		d->wait *= 2;
+		transmit();
+		schedule(d->wait);
+		return;
+	}
+
+	setError(ErrTimeout, tr("Timed out"));
+}
+
+// all deadlines are kept by the root task, in order, with one timer set
+//   for the earliest
+void Task::schedule(int msecs)
+{
+	Task *root = d->indexRoot;
+	unschedule();
+	if(!root || msecs <= 0)
+		return;
+	d->deadline = root->d->clock.usecsElapsed() / 1000 + msecs;
+	root->d->deadlines.insert(d->deadline, this);
+	root->armDeadlineTimer();
+}
+
+void Task::unschedule()
+{
+	Task *root = d->indexRoot;
+	if(d->deadline == -1)
+		return;
+	if(root) {
+		bool first = root->d->deadlines.begin().value() == this;
+		root->d->deadlines.remove(d->deadline, this);
+		if(first)
+			root->armDeadlineTimer();
+	}
+	d->deadline = -1;
+}
+
+void Task::armDeadlineTimer()
+{
+	if(d->deadlines.isEmpty()) {
+		d->deadlineTimer->stop();
+		return;
+	}
+	qint64 wait = d->deadlines.begin().key() - d->clock.usecsElapsed() / 1000;
+	d->deadlineTimer->start(int(qMax(wait, qint64(0))));
+}
+
+void Task::deadlineTimeout()
+{
+	qint64 now = d->clock.usecsElapsed() / 1000;
+	QList< QPointer<Task> > expired;
+	while(!d->deadlines.isEmpty() && d->deadlines.begin().key() <= now) {
+		Task *t = d->deadlines.begin().value();
+		d->deadlines.erase(d->deadlines.begin());
+		t->d->deadline = -1;
+		expired += t;
+	}
+	armDeadlineTimer();
+
+	// a task may delete others as it fails
+	foreach(const QPointer<Task> &t, expired) {
+		if(t)
+			t->expire();
+	}
+}
+
+// give up our place among the requests to a jid, and let the next one
+//   waiting for it go out
+void Task::releaseSlot()
+{
+	Task *root = d->indexRoot;
+	if(!d->holdsSlot)
+		return;
+	d->holdsSlot = false;
+	if(!root)
+		return;
+
+	QString key = d->slotKey;
+	if(d->queued) {
+		d->queued = false;
+		QHash<QString, QList<Task*> >::Iterator it = root->d->waiting.find(key);
+		if(it != root->d->waiting.end()) {
+			it.value().removeAll(this);
+			if(it.value().isEmpty())
+				root->d->waiting.erase(it);
+		}
+		return;
+	}
+
+	QHash<QString, int>::Iterator it = root->d->inFlight.find(key);
+	if(it == root->d->inFlight.end())
+		return;
+	if(--it.value() <= 0)
+		root->d->inFlight.erase(it);
+
+	QHash<QString, QList<Task*> >::Iterator wit = root->d->waiting.find(key);
+	if(wit == root->d->waiting.end())
+		return;
+	Task *t = wit.value().takeFirst();
+	if(wit.value().isEmpty())
+		root->d->waiting.erase(wit);
+	t->d->queued = false;
+	++root->d->inFlight[key];
+	t->startRequest();
+}
+
+void Task::sendShared(const QDomElement &iq, const QString &key)
+{
+	Task *root = d->indexRoot;
+	if(!root) {
+		send(iq);
+		return;
+	}
+
+	leaveShared();
+	d->sharedKey = key;
+	d->sharedRequest = iq;
+
+	QHash<QString, QPair<qint64, QDomElement> >::Iterator it = root->d->sharedCache.find(key);
+	if(it != root->d->sharedCache.end()) {
+		if(it.value().first > root->d->clock.usecsElapsed() / 1000) {
+			// answer from the event loop, as if the reply had come in
+			d->sharedReply = it.value().second;
+			QTimer::singleShot(0, this, SLOT(sharedReady()));
+			return;
+		}
+		root->d->sharedCache.erase(it);
+	}
+
+	if(root->d->sharedLeaders.contains(key)) {
+		d->sharedWaiting = true;
+		root->d->sharedWaiters[key] += this;
+		return;
+	}
+
+	d->sharedLeading = true;
+	root->d->sharedLeaders.insert(key, this);
+	send(iq);
+}
+
+void Task::dropShared(const QString &key)
+{
+	Task *root = d->isRoot ? this : d->indexRoot;
+	if(root)
+		root->d->sharedCache.remove(key);
+}
+
+// called on the root task with the reply to a shared request
+void Task::passShared(const QString &key, const QDomElement &x, const QList<Task*> &sharers)
+{
+	int ttl = client()->iqCacheTime();
+	if(ttl > 0 && x.attribute(XmlAtoms::get().type) == XmlAtoms::get().resultType) {
+		qint64 now = d->clock.usecsElapsed() / 1000;
+		if(d->sharedCache.count() >= SHARED_CACHE_PRUNE) {
+			QHash<QString, QPair<qint64, QDomElement> >::Iterator it = d->sharedCache.begin();
+			while(it != d->sharedCache.end()) {
+				if(it.value().first <= now)
+					it = d->sharedCache.erase(it);
+				else
+					++it;
+			}
+		}
+		d->sharedCache.insert(key, qMakePair(now + ttl, x.cloneNode(true).toElement()));
+	}
+
+	foreach(Task *t, sharers) {
+		t->d->sharedWaiting = false;
+		t->d->sharedReply = x;
+		QTimer::singleShot(0, t, SLOT(sharedReady()));
+	}
+}
+
+void Task::sharedReady()
+{
+	if(d->done || d->sharedReply.isNull())
+		return;
+
+	QDomElement x = d->sharedReply.cloneNode(true).toElement();
+	d->sharedReply = QDomElement();
+	x.setAttribute(XmlAtoms::get().id, d->id);
+	if(!take(x)) {
+		// not what we expected after all, so ask ourselves
+		d->sharedLeading = false;
+		send(d->sharedRequest);
+	}
+}
+
+// step out of a shared request.  a leader that goes without a reply
+//   leaves its request to the next task waiting for it
+void Task::leaveShared()
+{
+	Task *root = d->indexRoot;
+	d->sharedReply = QDomElement();
+	if(!root || (!d->sharedLeading && !d->sharedWaiting))
+		return;
+
+	QString key = d->sharedKey;
+	if(d->sharedWaiting) {
+		d->sharedWaiting = false;
+		QHash<QString, QList<Task*> >::Iterator it = root->d->sharedWaiters.find(key);
+		if(it != root->d->sharedWaiters.end()) {
+			it.value().removeAll(this);
+			if(it.value().isEmpty())
+				root->d->sharedWaiters.erase(it);
+		}
+		return;
+	}
+
+	d->sharedLeading = false;
+	if(root->d->sharedLeaders.value(key) != this)
+		return;
+	root->d->sharedLeaders.remove(key);
+
+	QHash<QString, QList<Task*> >::Iterator it = root->d->sharedWaiters.find(key);
+	if(it == root->d->sharedWaiters.end())
+		return;
+	Task *t = it.value().takeFirst();
+	if(it.value().isEmpty())
+		root->d->sharedWaiters.erase(it);
+	t->d->sharedWaiting = false;
+	t->d->sharedLeading = true;
+	root->d->sharedLeaders.insert(key, t);
+	t->send(t->d->sharedRequest);
 }
 
 /*! \brief Call this method to mark result as success.
@@ -238,6 +784,10 @@ void Task::done()
 		return;
 	d->done = true;
 
+	unschedule();
+	releaseSlot();
+	leaveShared();
+
 	if(d->deleteme || d->autoDelete)
 		d->deleteme = true;
 
@@ -251,6 +801,28 @@ void Task::done()
 
 void Task::clientDisconnected()
 {
+	if(d->isRoot) {
+		// nothing more goes out, the tasks fail as they are disconnected
+		for(QHash<QString, QList<Task*> >::ConstIterator it = d->waiting.constBegin(); it != d->waiting.constEnd(); ++it) {
+			foreach(Task *t, it.value()) {
+				t->d->queued = false;
+				t->d->holdsSlot = false;
+			}
+		}
+		d->waiting.clear();
+		d->inFlight.clear();
+
+		foreach(Task *t, d->sharedLeaders)
+			t->d->sharedLeading = false;
+		for(QHash<QString, QList<Task*> >::ConstIterator it = d->sharedWaiters.constBegin(); it != d->sharedWaiters.constEnd(); ++it) {
+			foreach(Task *t, it.value())
+				t->d->sharedWaiting = false;
+		}
+		d->sharedLeaders.clear();
+		d->sharedWaiters.clear();
+		d->sharedCache.clear();
+	}
+
 	onDisconnect();
 }
 
@@ -286,10 +858,11 @@ void Task::debug(const QString &str)
 
 bool Task::iqVerify(const QDomElement &x, const Jid &to, const QString &id, const QString &xmlns)
 {
-	if(x.tagName() != "iq")
+	const XmlAtoms &a = XmlAtoms::get();
+	if(x.tagName() != a.iq)
 		return false;
 
-	Jid from(x.attribute("from"));
+	Jid from = client()->stanzaFrom(x);
 	Jid local = client()->jid();
 	Jid server = client()->host();
 
@@ -312,7 +885,7 @@ bool Task::iqVerify(const QDomElement &x, const Jid &to, const QString &id, cons
 	}
 
 	if(!id.isEmpty()) {
-		if(x.attribute("id") != id)
+		if(x.attribute(a.id) != id)
 			return false;
 	}
 
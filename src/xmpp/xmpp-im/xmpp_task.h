@@ -46,7 +46,7 @@ namespace XMPP {
 	{
 		Q_OBJECT
 	public:
-		enum { ErrDisc };
+		enum { ErrDisc, ErrTimeout };
 		Task(Task *parent);
 		Task(Client *, bool isRoot);
 		virtual ~Task();
@@ -73,6 +73,12 @@ namespace XMPP {
 		virtual bool take(const QDomElement &);
 		void safeDelete();
 
+                /** @brief Fail with ErrTimeout if the reply to our IQ request doesn't arrive within \a msecs of sending it.
+                    The request is sent again up to \a retries times before that, each time waiting twice as long as the time before.
+                    0 uses Client::iqTimeout().  Set before go().  Only has an effect for direct children of the root task. */
+		void setTimeout(int msecs, int retries=0);
+		int timeout() const;
+
 	signals:
                 /** @brief Signal that reply arrived and is parsed. */
 		void finished();
@@ -83,6 +89,15 @@ namespace XMPP {
 		virtual void onGo();
 		virtual void onDisconnect();
 		void send(const QDomElement &);
+                /** @brief Send a stanza that already has its namespaces, see Client::send(const Stanza &). */
+		void send(const Stanza &);
+                /** @brief Send an IQ get as send() does, unless another task of this client is waiting for the reply to a get with the same \a key.
+                    Only one of those requests goes out.  The other tasks are then given a copy of its reply through take(), as if it had come
+                    to them.  With Client::setIqCacheTime() a result is also given to tasks asking for \a key for that long after it came in.
+                    The key has to stand for everything that makes up the request, such as the namespace, the jid and the node. */
+		void sendShared(const QDomElement &iq, const QString &key);
+                /** @brief Forget the cached result for \a key, e.g. after changing what it describes. */
+		void dropShared(const QString &key);
                 /** @brief Set request was successful. 
                   Expected to be called from \function take. 
                   It will emit finished signal. */
@@ -104,14 +119,31 @@ namespace XMPP {
                     Designed to be used in /function take() method.
                     */
 		bool iqVerify(const QDomElement &x, const Jid &to, const QString &id, const QString &xmlns="");
+		void addRoute(const QString &kind, const QString &ns=QString());
 
         static Stanza::Error * getStanzaErrorFromElement(const QDomElement &e, const QString &baseNs);
 	private slots:
 		void clientDisconnected();
 		void done();
+		void deadlineTimeout();
+		void sharedReady();
 
 	private:
 		void init();
+		bool rootTake(const QDomElement &x);
+		void unindex();
+		void indexReply(const QString &kind, const QString &type, const QString &id);
+		bool isRequest(const QString &kind, const QString &type, const QString &id) const;
+		void sendRequest(const QString &to);
+		void startRequest();
+		void transmit();
+		void expire();
+		void schedule(int msecs);
+		void unschedule();
+		void armDeadlineTimer();
+		void releaseSlot();
+		void leaveShared();
+		void passShared(const QString &key, const QDomElement &x, const QList<Task*> &sharers);
 
 		class TaskPrivate;
 		TaskPrivate *d;
@@ -26,9 +26,12 @@
 //#include "xmpp_stream.h"
 //#include "xmpp_types.h"
 #include "xmpp_vcard.h"
+#include "xmpp_xmlwriter.h"
 
 #include <qregexp.h>
 #include <QList>
+#include <QHash>
+#include <QPointer>
 
 using namespace XMPP;
 
@@ -255,7 +258,7 @@ bool JT_Register::take(const QDomElement &x)
 	if(!iqVerify(x, to, id()))
 		return false;
 
-	Jid from(x.attribute("from"));
+	Jid from = client()->stanzaFrom(x);
 	if(x.attribute("type") == "result") {
 		if(d->type == 3) {
 			d->form.clear();
@@ -359,9 +362,11 @@ void JT_UnRegister::unregFinished()
 class JT_Roster::Private
 {
 public:
-	Private() {}
+	Private() : unchanged(false) {}
 
 	Roster roster;
+	QString ver;
+	bool unchanged;
 	QList<QDomElement> itemList;
 };
 
@@ -388,6 +393,17 @@ void JT_Roster::get()
 	iq.appendChild(query);
 }
 
+/** @brief Request roster from server, using roster versioning (XEP-0237).
+    @param ver Version of the cached copy, or empty if there is none.
+    If the server's roster still matches \a ver, the result carries no
+    items (see rosterUnchanged()) and the changes since come as pushes.
+    Only use this if the server advertised support for versioning. */
+void JT_Roster::get(const QString &ver)
+{
+	get();
+	queryTag(iq).setAttribute("ver", ver);
+}
+
 /** @brief Push new contact to my roster.
     @param jid JabberId of contact we are adding.
     @param name Nickname user set for new contact. If not specified, empty.
@@ -439,6 +455,18 @@ const Roster & JT_Roster::roster() const
 	return d->roster;
 }
 
+/** @brief Version of the roster returned, if the server versions it. */
+QString JT_Roster::rosterVersion() const
+{
+	return d->ver;
+}
+
+/** @brief True if a versioned get found the cached roster up to date. */
+bool JT_Roster::rosterUnchanged() const
+{
+	return d->unchanged;
+}
+
 QString JT_Roster::toString() const
 {
 	if(type != 1)
@@ -481,11 +509,19 @@ bool JT_Roster::take(const QDomElement &x)
 	if(!iqVerify(x, client()->host(), id()))
 		return false;
 
+	const XmlAtoms &a = XmlAtoms::get();
+
 	// get
 	if(type == 0) {
-		if(x.attribute("type") == "result") {
+		if(x.attribute(a.type) == a.resultType) {
 			QDomElement q = queryTag(x);
-			d->roster = xmlReadRoster(q, false);
+			// an empty result means the version we sent is current
+			if(q.isNull())
+				d->unchanged = true;
+			else {
+				d->roster = xmlReadRoster(q, false);
+				d->ver = q.attribute(a.ver);
+			}
 			setSuccess();
 		}
 		else {
@@ -496,7 +532,7 @@ bool JT_Roster::take(const QDomElement &x)
 	}
 	// set
 	else if(type == 1) {
-		if(x.attribute("type") == "result")
+		if(x.attribute(a.type) == a.resultType)
 			setSuccess();
 		else
 			setError(x);
@@ -519,6 +555,7 @@ bool JT_Roster::take(const QDomElement &x)
 JT_PushRoster::JT_PushRoster(Task *parent)
 :Task(parent)
 {
+	addRoute("iq", "jabber:iq:roster");
 }
 
 JT_PushRoster::~JT_PushRoster()
@@ -527,15 +564,18 @@ JT_PushRoster::~JT_PushRoster()
 
 bool JT_PushRoster::take(const QDomElement &e)
 {
+	const XmlAtoms &a = XmlAtoms::get();
+
 	// must be an iq-set tag
-	if(e.tagName() != "iq" || e.attribute("type") != "set")
+	if(e.tagName() != a.iq || e.attribute(a.type) != a.setType)
 		return false;
 
-	if(!iqVerify(e, client()->host(), "", "jabber:iq:roster"))
+	if(!iqVerify(e, client()->host(), "", a.rosterNS))
 		return false;
 
-	roster(xmlReadRoster(queryTag(e), true));
-	send(createIQ(doc(), "result", e.attribute("from"), e.attribute("id")));
+	QDomElement q = queryTag(e);
+	roster(xmlReadRoster(q, true), q.attribute(a.ver));
+	send(createIQ(doc(), a.resultType, e.attribute(a.from), e.attribute(a.id)));
 
 	return true;
 }
@@ -544,51 +584,67 @@ bool JT_PushRoster::take(const QDomElement &e)
 //----------------------------------------------------------------------------
 // JT_Presence
 //----------------------------------------------------------------------------
+class JT_Presence::Private
+{
+public:
+	// for pres(), the stanza is only built if it can't be written
+	Status status;
+	Jid to;
+};
+
 JT_Presence::JT_Presence(Task *parent)
 :Task(parent)
 {
+	d = new Private;
 	type = -1;
 }
 
 JT_Presence::~JT_Presence()
 {
+	delete d;
 }
 
 /** \brief Construct presence stanza from given Status class */
 void JT_Presence::pres(const Status &s)
 {
 	type = 0;
+	d->status = s;
+	d->to = Jid();
+}
 
-	tag = doc()->createElement("presence");
+/** \brief Build the presence stanza for \a s, without a destination, in \a doc. */
+QDomElement JT_Presence::presenceElement(QDomDocument *doc, const Status &s)
+{
+	QDomElement tag = doc->createElement("presence");
 	if(!s.isAvailable()) {
 		tag.setAttribute("type", "unavailable");
 		if(!s.status().isEmpty())
-			tag.appendChild(textTag(doc(), "status", s.status()));
+			tag.appendChild(textTag(doc, "status", s.status()));
 	}
 	else {
 		if(s.isInvisible())
 			tag.setAttribute("type", "invisible");
 
 		if(!s.show().isEmpty())
-			tag.appendChild(textTag(doc(), "show", s.show()));
+			tag.appendChild(textTag(doc, "show", s.show()));
 		if(!s.status().isEmpty())
-			tag.appendChild(textTag(doc(), "status", s.status()));
+			tag.appendChild(textTag(doc, "status", s.status()));
 
-		tag.appendChild( textTag(doc(), "priority", QString("%1").arg(s.priority()) ) );
+		tag.appendChild( textTag(doc, "priority", QString("%1").arg(s.priority()) ) );
 
 		if(!s.keyID().isEmpty()) {
-			QDomElement x = textTag(doc(), "x", s.keyID());
+			QDomElement x = textTag(doc, "x", s.keyID());
 			x.setAttribute("xmlns", "http://jabber.org/protocol/e2e");
 			tag.appendChild(x);
 		}
 		if(!s.xsigned().isEmpty()) {
-			QDomElement x = textTag(doc(), "x", s.xsigned());
+			QDomElement x = textTag(doc, "x", s.xsigned());
 			x.setAttribute("xmlns", "jabber:x:signed");
 			tag.appendChild(x);
 		}
 
 		if(!s.capsNode().isEmpty() && !s.capsVersion().isEmpty()) {
-			QDomElement c = doc()->createElement("c");
+			QDomElement c = doc->createElement("c");
 			c.setAttribute("xmlns","http://jabber.org/protocol/caps");
 			c.setAttribute("node",s.capsNode());
 			c.setAttribute("ver",s.capsVersion());
@@ -600,31 +656,103 @@ void JT_Presence::pres(const Status &s)
 		}
 
 		if(s.isMUC()) {
-			QDomElement m = doc()->createElement("x");
+			QDomElement m = doc->createElement("x");
 			m.setAttribute("xmlns","http://jabber.org/protocol/muc");
 			if (!s.mucPassword().isEmpty()) {
-				m.appendChild(textTag(doc(),"password",s.mucPassword()));
+				m.appendChild(textTag(doc,"password",s.mucPassword()));
 			}
 			if (s.hasMUCHistory()) {
-				QDomElement h = doc()->createElement("history");
+				QDomElement h = doc->createElement("history");
 				if (s.mucHistoryMaxChars() >= 0)
 					h.setAttribute("maxchars",s.mucHistoryMaxChars());
 				if (s.mucHistoryMaxStanzas() >= 0)
 					h.setAttribute("maxstanzas",s.mucHistoryMaxStanzas());
 				if (s.mucHistorySeconds() >= 0)
 					h.setAttribute("seconds",s.mucHistorySeconds());
+				if (s.mucHistorySince().isValid())
+					h.setAttribute("since",s.mucHistorySince().toUTC().toString("yyyy-MM-dd'T'hh:mm:ss'Z'"));
 				m.appendChild(h);
 			}
 			tag.appendChild(m);
 		}
 
 		if(s.hasPhotoHash()) {
-			QDomElement m = doc()->createElement("x");
+			QDomElement m = doc->createElement("x");
 			m.setAttribute("xmlns", "vcard-temp:x:update");
-			m.appendChild(textTag(doc(), "photo", s.photoHash()));
+			m.appendChild(textTag(doc, "photo", s.photoHash()));
 			tag.appendChild(m);
 		}
 	}
+
+	return tag;
+}
+
+/** \brief Write the presence stanza for \a s to \a to (none if empty) in the namespace \a ns, as presenceElement() builds it. */
+void JT_Presence::writePresence(XmlWriter *w, const QString &ns, const Status &s, const Jid &to)
+{
+	w->startElement("presence", ns);
+	if(!to.isEmpty())
+		w->attribute("to", to.full());
+	if(!s.isAvailable()) {
+		w->attribute("type", "unavailable");
+		if(!s.status().isEmpty())
+			w->textElement("status", s.status());
+		w->endElement();
+		return;
+	}
+
+	if(s.isInvisible())
+		w->attribute("type", "invisible");
+
+	if(!s.show().isEmpty())
+		w->textElement("show", s.show());
+	if(!s.status().isEmpty())
+		w->textElement("status", s.status());
+
+	w->textElement("priority", QString::number(s.priority()));
+
+	if(!s.keyID().isEmpty())
+		w->textElement("x", s.keyID(), "http://jabber.org/protocol/e2e");
+	if(!s.xsigned().isEmpty())
+		w->textElement("x", s.xsigned(), "jabber:x:signed");
+
+	if(!s.capsNode().isEmpty() && !s.capsVersion().isEmpty()) {
+		w->startElement("c", "http://jabber.org/protocol/caps");
+		w->attribute("node", s.capsNode());
+		w->attribute("ver", s.capsVersion());
+		if(!s.capsExt().isEmpty())
+			w->attribute("ext", s.capsExt());
+		if(!s.capsHash().isEmpty())
+			w->attribute("hash", s.capsHash());
+		w->endElement();
+	}
+
+	if(s.isMUC()) {
+		w->startElement("x", "http://jabber.org/protocol/muc");
+		if(!s.mucPassword().isEmpty())
+			w->textElement("password", s.mucPassword());
+		if(s.hasMUCHistory()) {
+			w->startElement("history");
+			if(s.mucHistoryMaxChars() >= 0)
+				w->attribute("maxchars", QString::number(s.mucHistoryMaxChars()));
+			if(s.mucHistoryMaxStanzas() >= 0)
+				w->attribute("maxstanzas", QString::number(s.mucHistoryMaxStanzas()));
+			if(s.mucHistorySeconds() >= 0)
+				w->attribute("seconds", QString::number(s.mucHistorySeconds()));
+			if(s.mucHistorySince().isValid())
+				w->attribute("since", s.mucHistorySince().toUTC().toString("yyyy-MM-dd'T'hh:mm:ss'Z'"));
+			w->endElement();
+		}
+		w->endElement();
+	}
+
+	if(s.hasPhotoHash()) {
+		w->startElement("x", "vcard-temp:x:update");
+		w->textElement("photo", s.photoHash());
+		w->endElement();
+	}
+
+	w->endElement();
 }
 
 /** \brief Construct XML tree of presence stanza with destination jid.
@@ -637,7 +765,7 @@ void JT_Presence::pres(const Status &s)
 void JT_Presence::pres(const Jid &to, const Status &s)
 {
 	pres(s);
-	tag.setAttribute("to", to.full());
+	d->to = to;
 }
 
 void JT_Presence::sub(const Jid &to, const QString &subType, const QString& nick)
@@ -665,6 +793,21 @@ void JT_Presence::probe(const Jid &to)
 
 void JT_Presence::onGo()
 {
+	if(type == 0) {
+		if(client()->canSendUtf8()) {
+			QByteArray a;
+			XmlWriter w(&a, client()->writeScopeNS());
+			writePresence(&w, client()->stream().baseNS(), d->status, d->to);
+			client()->sendUtf8(a);
+			setSuccess();
+			return;
+		}
+
+		tag = presenceElement(doc(), d->status);
+		if(!d->to.isEmpty())
+			tag.setAttribute("to", d->to.full());
+	}
+
 	send(tag);
 	setSuccess();
 }
@@ -676,6 +819,7 @@ void JT_Presence::onGo()
 JT_PushPresence::JT_PushPresence(Task *parent)
 :Task(parent)
 {
+	addRoute("presence");
 }
 
 JT_PushPresence::~JT_PushPresence()
@@ -687,18 +831,31 @@ JT_PushPresence::~JT_PushPresence()
     */
 bool JT_PushPresence::take(const QDomElement &e)
 {
-	if(e.tagName() != "presence")
+	const XmlAtoms &a = XmlAtoms::get();
+	if(e.tagName() != a.presence)
 		return false;
 
-	Jid j(e.attribute("from"));
+	Jid j = client()->stanzaFrom(e);
+
+	// the crowd of a big room: just who is there and their show
+	if(client()->groupChatLightOccupant(j)) {
+		QString type = e.attribute(a.type);
+		if(type.isEmpty() || type == a.unavailableType) {
+			bool available = type.isEmpty();
+			occupant(j, available, available ? e.firstChildElement(a.show).text() : QString());
+			return true;
+		}
+	}
+
 	Status p;
+	XmlChildIndex ix(e);
 
-	if(e.hasAttribute("type")) {
-		QString type = e.attribute("type");
-		if(type == "unavailable") {
+	if(e.hasAttribute(a.type)) {
+		QString type = e.attribute(a.type);
+		if(type == a.unavailableType) {
 			p.setIsAvailable(false);
 		}
-		else if(type == "error") {
+		else if(type == a.error) {
 			QString str = "";
 			int code = 0;
 			getErrorFromElement(e, client()->stream().baseNS(), &code, &str);
@@ -706,9 +863,8 @@ bool JT_PushPresence::take(const QDomElement &e)
 		}
 		else if(type == "subscribe" || type == "subscribed" || type == "unsubscribe" || type == "unsubscribed") {
 			QString nick;
-			bool found;
-			QDomElement tag = findSubTag(e, "nick", &found);
-			if (found && tag.attribute("xmlns") == "http://jabber.org/protocol/nick") {
+			QDomElement tag = ix.first(a.nick);
+			if (!tag.isNull() && tag.attribute(a.xmlns) == a.nickNS) {
 				nick = tagContent(tag);
 			}
 			subscription(j, type, nick);
@@ -716,95 +872,37 @@ bool JT_PushPresence::take(const QDomElement &e)
 		}
 	}
 
-	QDomElement tag;
-	bool found;
-
-	tag = findSubTag(e, "status", &found);
-	if(found)
-		p.setStatus(tagContent(tag));
-	tag = findSubTag(e, "show", &found);
-	if(found)
-		p.setShow(tagContent(tag));
-	tag = findSubTag(e, "priority", &found);
-	if(found)
-		p.setPriority(tagContent(tag).toInt());
+	if(ix.has(a.status))
+		p.setStatus(ix.text(a.status));
+	if(ix.has(a.show))
+		p.setShow(ix.text(a.show));
+	if(ix.has(a.priority))
+		p.setPriority(ix.text(a.priority).toInt());
 
+	// only the delay is needed up front, the rest waits until asked for
 	QDateTime stamp;
-
-	for(QDomNode n = e.firstChild(); !n.isNull(); n = n.nextSibling()) {
+	for(QDomNode n = e.firstChild(); !n.isNull() && !stamp.isValid(); n = n.nextSibling()) {
 		QDomElement i = n.toElement();
 		if(i.isNull())
 			continue;
 
 		if(i.tagName() == "x" && i.attribute("xmlns") == "jabber:x:delay") {
-			if(i.hasAttribute("stamp") && !stamp.isValid()) {
+			if(i.hasAttribute("stamp"))
 				stamp = stamp2TS(i.attribute("stamp"));
-			}
 		}
 		else if(i.tagName() == "delay" && i.attribute("xmlns") == "urn:xmpp:delay") {
-			if(i.hasAttribute("stamp") && !stamp.isValid()) {
-				stamp = QDateTime::fromString(i.attribute("stamp").left(19), Qt::ISODate);
-			}
-		}
-		else if(i.tagName() == "x" && i.attribute("xmlns") == "gabber:x:music:info") {
-			QDomElement t;
-			bool found;
-			QString title, state;
-
-			t = findSubTag(i, "title", &found);
-			if(found)
-				title = tagContent(t);
-			t = findSubTag(i, "state", &found);
-			if(found)
-				state = tagContent(t);
-
-			if(!title.isEmpty() && state == "playing")
-				p.setSongTitle(title);
-		}
-		else if(i.tagName() == "x" && i.attribute("xmlns") == "jabber:x:signed") {
-			p.setXSigned(tagContent(i));
-		}
-		else if(i.tagName() == "x" && i.attribute("xmlns") == "http://jabber.org/protocol/e2e") {
-			p.setKeyID(tagContent(i));
-		}
- 		else if(i.tagName() == "c" && i.attribute("xmlns") == "http://jabber.org/protocol/caps") {
- 			p.setCapsNode(i.attribute("node"));
- 			p.setCapsVersion(i.attribute("ver"));
- 			p.setCapsExt(i.attribute("ext"));
-                        p.setCapsHash(i.attribute("hash"));
-  		}
-		else if(i.tagName() == "x" && i.attribute("xmlns") == "vcard-temp:x:update") {
-			QDomElement t;
-			bool found;
-			t = findSubTag(i, "photo", &found);
-			if (found)
-				p.setPhotoHash(tagContent(t));
-			else
-				p.setPhotoHash("");
-		}
-		else if(i.tagName() == "x" && i.attribute("xmlns") == "http://jabber.org/protocol/muc#user") {
-			for(QDomNode muc_n = i.firstChild(); !muc_n.isNull(); muc_n = muc_n.nextSibling()) {
-				QDomElement muc_e = muc_n.toElement();
-				if(muc_e.isNull())
-					continue;
-
-				if (muc_e.tagName() == "item") 
-					p.setMUCItem(MUCItem(muc_e));
-				else if (muc_e.tagName() == "status") 
-					p.addMUCStatus(muc_e.attribute("code").toInt());
-				else if (muc_e.tagName() == "destroy")
-					p.setMUCDestroy(MUCDestroy(muc_e));
-			}
+			if(i.hasAttribute("stamp"))
+				stamp = isoStamp2TS(i.attribute("stamp"));
 		}
 	}
-
+	p.setExtensions(e);
 
 	if (stamp.isValid()) {
 		if (client()->manualTimeZoneOffset()) {
 			stamp = stamp.addSecs(client()->timeZoneOffset() * 3600);
+			stamp.setTimeSpec(Qt::LocalTime);
 		} else {
-			stamp.setTimeSpec(Qt::UTC);
-			stamp = stamp.toLocalTime();
+			stamp = utc2Local(stamp);
 		}
 		p.setTimeStamp(stamp);
 	}
@@ -818,43 +916,6 @@ bool JT_PushPresence::take(const QDomElement &e)
 //----------------------------------------------------------------------------
 // JT_Message
 //----------------------------------------------------------------------------
-static QDomElement oldStyleNS(const QDomElement &e)
-{
-	// find closest parent with a namespace
-	QDomNode par = e.parentNode();
-	while(!par.isNull() && par.namespaceURI().isNull())
-		par = par.parentNode();
-	bool noShowNS = false;
-	if(!par.isNull() && par.namespaceURI() == e.namespaceURI())
-		noShowNS = true;
-
-	QDomElement i;
-	int x;
-	//if(noShowNS)
-		i = e.ownerDocument().createElement(e.tagName());
-	//else
-	//	i = e.ownerDocument().createElementNS(e.namespaceURI(), e.tagName());
-
-	// copy attributes
-	QDomNamedNodeMap al = e.attributes();
-	for(x = 0; x < al.count(); ++x)
-		i.setAttributeNode(al.item(x).cloneNode().toAttr());
-
-	if(!noShowNS)
-		i.setAttribute("xmlns", e.namespaceURI());
-
-	// copy children
-	QDomNodeList nl = e.childNodes();
-	for(x = 0; x < nl.count(); ++x) {
-		QDomNode n = nl.item(x);
-		if(n.isElement())
-			i.appendChild(oldStyleNS(n.toElement()));
-		else
-			i.appendChild(n.cloneNode());
-	}
-	return i;
-}
-
 JT_Message::JT_Message(Task *parent, const Message &msg)
 :Task(parent)
 {
@@ -869,9 +930,19 @@ JT_Message::~JT_Message()
 
 void JT_Message::onGo()
 {
-	Stanza s = m.toStanza(&(client()->stream()));
-	QDomElement e = oldStyleNS(s.element());
-	send(e);
+	// the common messages are written without building them
+	if(client()->canSendUtf8()) {
+		QByteArray a;
+		XmlWriter w(&a, client()->writeScopeNS());
+		if(m.writeXml(&w, client()->stream().baseNS())) {
+			client()->sendUtf8(a);
+			setSuccess();
+			return;
+		}
+	}
+
+	// the stanza already has its namespaces, so it goes out as it is
+	send(m.toStanza(&(client()->stream())));
 	setSuccess();
 }
 
@@ -882,17 +953,106 @@ void JT_Message::onGo()
 JT_PushMessage::JT_PushMessage(Task *parent)
 :Task(parent)
 {
+	addRoute("message");
 }
 
 JT_PushMessage::~JT_PushMessage()
 {
 }
 
+// node of the pubsub event in message e, or a null string if it has none
+static QString eventNode(const QDomElement &e)
+{
+	for(QDomNode n = e.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		QDomElement i = n.toElement();
+		if(i.tagName() != "event")
+			continue;
+		QString ns = i.attribute("xmlns");
+		if(ns.isEmpty())
+			ns = i.namespaceURI();
+		if(ns != "http://jabber.org/protocol/pubsub#event")
+			continue;
+		QString node = i.firstChildElement().attribute("node");
+		return node.isNull() ? QString("") : node;
+	}
+	return QString();
+}
+
+// true if message e carries nothing but a chat state and/or a delivery
+//   receipt (and maybe a thread), which are then filled in
+static bool notificationOnly(const QDomElement &e, ChatState *state, QString *receiptId)
+{
+	const XmlAtoms &a = XmlAtoms::get();
+	if(e.attribute(a.type) == a.error)
+		return false;
+
+	*state = StateNone;
+	*receiptId = QString();
+	bool any = false;
+	for(QDomNode n = e.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		QDomElement i = n.toElement();
+		if(i.isNull())
+			continue;
+		QString tag = i.tagName();
+		if(tag == "thread")
+			continue;
+		QString ns = i.attribute("xmlns");
+		if(ns.isEmpty())
+			ns = i.namespaceURI();
+		if(ns == a.chatStatesNS) {
+			if(tag == a.active)
+				*state = StateActive;
+			else if(tag == a.composing)
+				*state = StateComposing;
+			else if(tag == a.paused)
+				*state = StatePaused;
+			else if(tag == a.inactive)
+				*state = StateInactive;
+			else if(tag == a.gone)
+				*state = StateGone;
+			else
+				return false;
+		}
+		else if(ns == a.receiptsNS && tag == a.received) {
+			// early versions of XEP-0184 don't name the message
+			*receiptId = i.attribute("id");
+			if(receiptId->isEmpty())
+				*receiptId = e.attribute("id");
+		}
+		else
+			return false;
+		any = true;
+	}
+	return any;
+}
+
 bool JT_PushMessage::take(const QDomElement &e)
 {
-	if(e.tagName() != "message")
+	const XmlAtoms &a = XmlAtoms::get();
+	if(e.tagName() != a.message)
 		return false;
 
+	// events nobody asked for go no further
+	QString node = eventNode(e);
+	if(!node.isNull() && !client()->acceptsPubSubNode(node) && e.firstChildElement(a.body).isNull())
+		return true;
+
+	// typing notifications and receipts, without building a Message
+	if(client()->notificationFastPath()) {
+		ChatState state;
+		QString receiptId;
+		if(notificationOnly(e, &state, &receiptId)) {
+			Jid from = client()->stanzaFrom(e);
+			QString type = e.attribute(a.type);
+			QPointer<QObject> self = this;
+			if(state != StateNone)
+				chatState(from, type, state);
+			if(self && !receiptId.isNull())
+				receipt(from, type, receiptId);
+			return true;
+		}
+	}
+
 	Stanza s = client()->stream().createStanza(addCorrectNS(e));
 	if(s.isNull()) {
 		//printf("take: bad stanza??\n");
@@ -1073,10 +1233,18 @@ void JT_VCard::set(const Jid &j, const VCard &card)
 	d->iq.appendChild(card.toXml(doc()) );
 }
 
+static QString vcardKey(const Jid &j)
+{
+	return "vcard\n" + j.full();
+}
+
 /** @brief Send created request. */
 void JT_VCard::onGo()
 {
-	send(d->iq);
+	if(type == 0)
+		sendShared(d->iq, vcardKey(d->jid));
+	else
+		send(d->iq);
 }
 
 bool JT_VCard::take(const QDomElement &x)
@@ -1106,6 +1274,8 @@ bool JT_VCard::take(const QDomElement &x)
 			return true;
 		}
 		else {
+			// whatever was cached for it is outdated now
+			dropShared(vcardKey(d->jid.isEmpty() ? client()->jid().bare() : d->jid.full()));
 			setSuccess();
 			return true;
 		}
@@ -1236,7 +1406,7 @@ bool JT_Search::take(const QDomElement &x)
 	if(!iqVerify(x, d->jid, id()))
 		return false;
 
-	Jid from(x.attribute("from"));
+	Jid from = client()->stanzaFrom(x);
 	if(x.attribute("type") == "result") {
 		if(type == 0) {
 			d->form.clear();
@@ -1435,30 +1605,72 @@ bool JT_ClientTime::take(const QDomElement &x)
 // JT_ServInfo
 //----------------------------------------------------------------------------
 /** @brief Create request to list features and version of JID. */
+class JT_ServInfo::Private
+{
+public:
+	// replies to queries about this client, keyed by "version" or by
+	//   "info " and the node.  dropped when they change
+	QHash<QString, StanzaTemplate> replies;
+};
+
 JT_ServInfo::JT_ServInfo(Task *parent)
 :Task(parent)
 {
+	d = new Private;
+	addRoute("iq");
+	connect(client(), SIGNAL(selfInfoChanged()), SLOT(selfInfoChanged()));
 }
 
 JT_ServInfo::~JT_ServInfo()
 {
+	delete d;
+}
+
+void JT_ServInfo::selfInfoChanged()
+{
+	d->replies.clear();
+}
+
+void JT_ServInfo::reply(const QString &key, const QDomElement &query, const QDomElement &e)
+{
+	QString to = e.attribute("from");
+	QString id = e.attribute("id");
+
+	QHash<QString, StanzaTemplate>::ConstIterator it = d->replies.find(key);
+	if(it == d->replies.end()) {
+		QDomElement iq = createIQ(doc(), "result", QString(), QString());
+		iq.appendChild(query);
+		StanzaTemplate t = client()->createTemplate(iq);
+		if(t.isNull()) {
+			if(!to.isEmpty())
+				iq.setAttribute("to", to);
+			iq.setAttribute("id", id);
+			send(iq);
+			return;
+		}
+		it = d->replies.insert(key, t);
+	}
+
+	client()->send(it.value(), Jid(to), id);
 }
 
 bool JT_ServInfo::take(const QDomElement &e)
 {
-	if(e.tagName() != "iq" || e.attribute("type") != "get")
+	const XmlAtoms &a = XmlAtoms::get();
+	if(e.tagName() != a.iq || e.attribute(a.type) != a.getType)
 		return false;
 
 	QString ns = queryNS(e);
-	if(ns == "jabber:iq:version") {
-		QDomElement iq = createIQ(doc(), "result", e.attribute("from"), e.attribute("id"));
-		QDomElement query = doc()->createElement("query");
-		query.setAttribute("xmlns", "jabber:iq:version");
-		iq.appendChild(query);
-		query.appendChild(textTag(doc(), "name", client()->clientName()));
-		query.appendChild(textTag(doc(), "version", client()->clientVersion()));
-		query.appendChild(textTag(doc(), "os", client()->OSName()));
-		send(iq);
+	if(ns == a.versionNS) {
+		QDomElement query;
+		if(!d->replies.contains("version")) {
+			query = doc()->createElement("query");
+			query.setAttribute("xmlns", "jabber:iq:version");
+			query.appendChild(textTag(doc(), "name", client()->clientName()));
+			query.appendChild(textTag(doc(), "version", client()->clientVersion()));
+			query.appendChild(textTag(doc(), "os", client()->OSName()));
+		}
+		reply("version", query, e);
 		return true;
 	}
 	//else if(ns == "jabber:iq:time") {
@@ -1477,97 +1689,19 @@ bool JT_ServInfo::take(const QDomElement &e)
 	//}
 	else if(ns == "http://jabber.org/protocol/disco#info") {
 		// Find out the node
-		bool invalid_node = false;
 		QString node;
 		bool found;
 		QDomElement q = findSubTag(e, "query", &found);
 		if(found) // NOTE: Should always be true, since a NS was found above
 			node = q.attribute("node");
-		
-		QDomElement iq = createIQ(doc(), "result", e.attribute("from"), e.attribute("id"));
-		QDomElement query = doc()->createElement("query");
-		query.setAttribute("xmlns", "http://jabber.org/protocol/disco#info");
-		if (!node.isEmpty())
-			query.setAttribute("node", node);
-		iq.appendChild(query);
 
-		// Identity
-		DiscoItem::Identity identity = client()->identity();
-		QDomElement id = doc()->createElement("identity");
-		if (!identity.category.isEmpty() && !identity.type.isEmpty()) {
-			id.setAttribute("category",identity.category);
-			id.setAttribute("type",identity.type);
-			if (!identity.name.isEmpty()) {
-				id.setAttribute("name",identity.name);
-			}
-		}
-		else {
-			// Default values
-			id.setAttribute("category","client");
-			id.setAttribute("type","pc");
-		}
-		query.appendChild(id);
-
-		QDomElement feature;
-		if (node.isEmpty() || node == client()->capsNode() + "#" + client()->capsVersion()) {
-			// Standard features
-			feature = doc()->createElement("feature");
-			feature.setAttribute("var", "http://jabber.org/protocol/bytestreams");
-			query.appendChild(feature);
-
-			feature = doc()->createElement("feature");
-			feature.setAttribute("var", "http://jabber.org/protocol/si");
-			query.appendChild(feature);
-
-			feature = doc()->createElement("feature");
-			feature.setAttribute("var", "http://jabber.org/protocol/si/profile/file-transfer");
-			query.appendChild(feature);
-			
-			feature = doc()->createElement("feature");
-			feature.setAttribute("var", "http://jabber.org/protocol/disco#info");
-			query.appendChild(feature);
-
-			// Client-specific features
-			QStringList clientFeatures = client()->features().list();
-			for (QStringList::ConstIterator i = clientFeatures.begin(); i != clientFeatures.end(); ++i) {
-				feature = doc()->createElement("feature");
-				feature.setAttribute("var", *i);
-				query.appendChild(feature);
-			}
+		QString key = "info " + node;
+		QDomElement query;
+		if(!d->replies.contains(key))
+			query = client()->selfDiscoInfo(node);
 
-			if (node.isEmpty()) {
-				// Extended features
-				QStringList exts = client()->extensions();
-				for (QStringList::ConstIterator i = exts.begin(); i != exts.end(); ++i) {
-					const QStringList& l = client()->extension(*i).list();
-					for ( QStringList::ConstIterator j = l.begin(); j != l.end(); ++j ) {
-						feature = doc()->createElement("feature");
-						feature.setAttribute("var", *j);
-						query.appendChild(feature);
-					}
-				}
-			}
-		}
-		else if (node.startsWith(client()->capsNode() + "#")) {
-			QString ext = node.right(node.length()-client()->capsNode().length()-1);
-			if (client()->extensions().contains(ext)) {
-				const QStringList& l = client()->extension(ext).list();
-				for ( QStringList::ConstIterator it = l.begin(); it != l.end(); ++it ) {
-					feature = doc()->createElement("feature");
-					feature.setAttribute("var", *it);
-					query.appendChild(feature);
-				}
-			}
-			else {
-				invalid_node = true;
-			}
-		}
-		else {
-			invalid_node = true;
-		}
-		
-		if (!invalid_node) {
-			send(iq);
+		if (d->replies.contains(key) || !query.isNull()) {
+			reply(key, query, e);
 		}
 		else {
 			// Create error reply
@@ -1821,14 +1955,25 @@ bool JT_Browse::take(const QDomElement &x)
 //----------------------------------------------------------------------------
 // JT_DiscoItems
 //----------------------------------------------------------------------------
+#define RSM_NS "http://jabber.org/protocol/rsm"
+
 class JT_DiscoItems::Private
 {
 public:
-	Private() { }
+	Private() : pageSize(0), maxItems(0), streaming(false), fetched(0), complete(false), count(-1) { }
 
-	QDomElement iq;
 	Jid jid;
+	QString node;
 	DiscoList items;
+
+	int pageSize, maxItems;
+	bool streaming;
+	QString after;
+
+	int fetched;
+	bool complete;
+	QString last;
+	int count;
 };
 
 JT_DiscoItems::JT_DiscoItems(Task *parent)
@@ -1850,16 +1995,33 @@ void JT_DiscoItems::get(const DiscoItem &item)
 void JT_DiscoItems::get (const Jid &j, const QString &node)
 {
 	d->items.clear();
+	d->fetched = 0;
+	d->complete = false;
+	d->last = QString();
+	d->count = -1;
 
 	d->jid = j;
-	d->iq = createIQ(doc(), "get", d->jid.full(), id());
-	QDomElement query = doc()->createElement("query");
-	query.setAttribute("xmlns", "http://jabber.org/protocol/disco#items");
+	d->node = node;
+}
 
-	if ( !node.isEmpty() )
-		query.setAttribute("node", node);
+void JT_DiscoItems::setPageSize(int max)
+{
+	d->pageSize = max;
+}
 
-	d->iq.appendChild(query);
+void JT_DiscoItems::setMaxItems(int max)
+{
+	d->maxItems = max;
+}
+
+void JT_DiscoItems::setStreaming(bool b)
+{
+	d->streaming = b;
+}
+
+void JT_DiscoItems::setAfter(const QString &id)
+{
+	d->after = id;
 }
 
 const DiscoList &JT_DiscoItems::items() const
@@ -1867,9 +2029,56 @@ const DiscoList &JT_DiscoItems::items() const
 	return d->items;
 }
 
+bool JT_DiscoItems::complete() const
+{
+	return d->complete;
+}
+
+QString JT_DiscoItems::last() const
+{
+	return d->last;
+}
+
+int JT_DiscoItems::count() const
+{
+	return d->count;
+}
+
 void JT_DiscoItems::onGo ()
 {
-	send(d->iq);
+	sendPage();
+}
+
+// every page goes out with the same iq id.  identical requests of other
+//   tasks share the reply, page by page
+void JT_DiscoItems::sendPage()
+{
+	QDomElement iq = createIQ(doc(), "get", d->jid.full(), id());
+	QDomElement query = doc()->createElement("query");
+	query.setAttribute("xmlns", "http://jabber.org/protocol/disco#items");
+
+	if ( !d->node.isEmpty() )
+		query.setAttribute("node", d->node);
+
+	QString key = "disco#items\n" + d->jid.full() + '\n' + d->node;
+
+	int max = d->pageSize;
+	if(d->maxItems > 0 && (max <= 0 || d->maxItems - d->fetched < max))
+		max = d->maxItems - d->fetched;
+	if(d->pageSize > 0 || d->maxItems > 0 || !d->after.isEmpty()) {
+		QDomElement set = doc()->createElement("set");
+		set.setAttribute("xmlns", RSM_NS);
+		if(max > 0)
+			set.appendChild(textTag(doc(), "max", QString::number(max)));
+		if(!d->after.isEmpty())
+			set.appendChild(textTag(doc(), "after", d->after));
+		query.appendChild(set);
+
+		key += '\n' + QString::number(max) + '\n' + d->after;
+	}
+
+	iq.appendChild(query);
+	sendShared(iq, key);
 }
 
 bool JT_DiscoItems::take(const QDomElement &x)
@@ -1879,6 +2088,7 @@ bool JT_DiscoItems::take(const QDomElement &x)
 
 	if(x.attribute("type") == "result") {
 		QDomElement q = queryTag(x);
+		DiscoList page;
 
 		for(QDomNode n = q.firstChild(); !n.isNull(); n = n.nextSibling()) {
 			QDomElement e = n.toElement();
@@ -1886,6 +2096,10 @@ bool JT_DiscoItems::take(const QDomElement &x)
 				continue;
 
 			if ( e.tagName() == "item" ) {
+				// a server without paging sends everything
+				if(d->maxItems > 0 && d->fetched >= d->maxItems)
+					break;
+
 				DiscoItem item;
 
 				item.setJid ( e.attribute("jid")  );
@@ -1893,10 +2107,42 @@ bool JT_DiscoItems::take(const QDomElement &x)
 				item.setNode( e.attribute("node") );
 				item.setAction( DiscoItem::string2action(e.attribute("action")) );
 
-				d->items.append( item );
+				page.append( item );
+				++d->fetched;
 			}
 		}
 
+		QDomElement set = q.firstChildElement("set");
+		QString last = set.firstChildElement("last").text();
+		if(!last.isEmpty())
+			d->last = last;
+		QDomElement count = set.firstChildElement("count");
+		if(!count.isNull())
+			d->count = count.text().toInt();
+
+		if(!d->streaming)
+			d->items += page;
+
+		if(!page.isEmpty()) {
+			QPointer<QObject> self = this;
+			emit itemsReady(page);
+			if(!self)
+				return true;
+		}
+
+		// there is more as long as the server pages and the last page
+		//   wasn't empty or the end by the count
+		bool more = !set.isNull() && !last.isEmpty() && !page.isEmpty();
+		if(more && d->count != -1 && d->fetched >= d->count)
+			more = false;
+		d->complete = !more;
+
+		if(more && d->pageSize > 0 && (d->maxItems <= 0 || d->fetched < d->maxItems)) {
+			d->after = d->last;
+			sendPage();
+			return true;
+		}
+
 		setSuccess(true);
 	}
 	else {
@@ -1980,3 +2226,235 @@ bool JT_DiscoPublish::take(const QDomElement &x)
 	return true;
 }
 
+
+//----------------------------------------------------------------------------
+// JT_MessageArchive
+//----------------------------------------------------------------------------
+#define MAM_NS "urn:xmpp:mam:2"
+
+class JT_MessageArchive::Private
+{
+public:
+	Private() : pageSize(100), batchSize(50), fields(Body), autoPage(false), page(0), complete(false), count(-1) {}
+
+	Jid archive, with;
+	QDateTime start, end;
+	QString after;
+	int pageSize, batchSize, fields;
+	bool autoPage;
+
+	int page;
+	QString queryId;
+	bool complete;
+	QString last;
+	int count;
+	QList<Item> batch;
+};
+
+JT_MessageArchive::JT_MessageArchive(Task *parent)
+:Task(parent)
+{
+	d = new Private;
+}
+
+JT_MessageArchive::~JT_MessageArchive()
+{
+	delete d;
+}
+
+void JT_MessageArchive::query(const Jid &archive, const Jid &with, const QDateTime &start, const QDateTime &end)
+{
+	d->archive = archive;
+	d->with = with;
+	d->start = start;
+	d->end = end;
+}
+
+void JT_MessageArchive::setAfter(const QString &id)
+{
+	d->after = id;
+}
+
+void JT_MessageArchive::setPageSize(int max)
+{
+	d->pageSize = max;
+}
+
+void JT_MessageArchive::setBatchSize(int count)
+{
+	d->batchSize = count;
+}
+
+void JT_MessageArchive::setFields(int fields)
+{
+	d->fields = fields;
+}
+
+void JT_MessageArchive::setAutoPage(bool b)
+{
+	d->autoPage = b;
+}
+
+bool JT_MessageArchive::complete() const
+{
+	return d->complete;
+}
+
+QString JT_MessageArchive::last() const
+{
+	return d->last;
+}
+
+int JT_MessageArchive::count() const
+{
+	return d->count;
+}
+
+static QDomElement formField(QDomDocument *doc, const QString &var, const QString &value, const QString &type=QString())
+{
+	QDomElement f = doc->createElement("field");
+	f.setAttribute("var", var);
+	if(!type.isEmpty())
+		f.setAttribute("type", type);
+	f.appendChild(textTag(doc, "value", value));
+	return f;
+}
+
+void JT_MessageArchive::onGo()
+{
+	sendPage();
+
+	// results come as messages, ahead of the reply
+	addRoute("message", MAM_NS);
+}
+
+// further pages go out with the same iq id, so the reply index keeps
+//   finding this task, and a query id of their own
+void JT_MessageArchive::sendPage()
+{
+	d->queryId = id() + '_' + QString::number(d->page++);
+
+	QDomElement iq = createIQ(doc(), "set", d->archive.full(), id());
+	QDomElement query = doc()->createElement("query");
+	query.setAttribute("xmlns", MAM_NS);
+	query.setAttribute("queryid", d->queryId);
+
+	QDomElement form = doc()->createElement("x");
+	form.setAttribute("xmlns", "jabber:x:data");
+	form.setAttribute("type", "submit");
+	form.appendChild(formField(doc(), "FORM_TYPE", MAM_NS, "hidden"));
+	if(!d->with.isEmpty())
+		form.appendChild(formField(doc(), "with", d->with.full()));
+	if(!d->start.isNull())
+		form.appendChild(formField(doc(), "start", TS2isoStamp(d->start)));
+	if(!d->end.isNull())
+		form.appendChild(formField(doc(), "end", TS2isoStamp(d->end)));
+	query.appendChild(form);
+
+	QDomElement set = doc()->createElement("set");
+	set.setAttribute("xmlns", RSM_NS);
+	if(d->pageSize > 0)
+		set.appendChild(textTag(doc(), "max", QString::number(d->pageSize)));
+	if(!d->after.isEmpty())
+		set.appendChild(textTag(doc(), "after", d->after));
+	query.appendChild(set);
+
+	iq.appendChild(query);
+	send(iq);
+}
+
+bool JT_MessageArchive::take(const QDomElement &x)
+{
+	if(x.tagName() == "message")
+		return takeResult(x);
+
+	if(!iqVerify(x, d->archive, id()))
+		return false;
+
+	if(x.attribute("type") != "result") {
+		flush();
+		setError(x);
+		return true;
+	}
+
+	QDomElement fin = x.firstChildElement("fin");
+	d->complete = fin.attribute("complete") == "true";
+	QDomElement set = fin.firstChildElement("set");
+	QString last = set.firstChildElement("last").text();
+	if(!last.isEmpty())
+		d->last = last;
+	QDomElement count = set.firstChildElement("count");
+	if(!count.isNull())
+		d->count = count.text().toInt();
+
+	QPointer<QObject> self = this;
+	flush();
+	if(!self)
+		return true;
+
+	// an empty page means the end too, whatever the archive says
+	if(d->autoPage && !d->complete && !last.isEmpty()) {
+		d->after = d->last;
+		sendPage();
+		return true;
+	}
+
+	setSuccess();
+	return true;
+}
+
+// one archived message: only what was asked for is taken out of it
+bool JT_MessageArchive::takeResult(const QDomElement &x)
+{
+	QDomElement result = x.firstChildElement("result");
+	if(result.isNull() || result.attribute("queryid") != d->queryId)
+		return false;
+
+	// from the archive asked, which is our own account if none was
+	Jid from = client()->stanzaFrom(x);
+	if(!from.isEmpty()) {
+		Jid archive = d->archive.isEmpty() ? client()->jid() : d->archive;
+		if(!from.compare(archive, false))
+			return false;
+	}
+
+	QDomElement forwarded = result.firstChildElement("forwarded");
+	QDomElement m = forwarded.firstChildElement("message");
+	if(m.isNull())
+		return true;
+
+	Item i;
+	i.archiveId = result.attribute("id");
+	QDomElement delay = forwarded.firstChildElement("delay");
+	if(!delay.isNull()) {
+		i.stamp = isoStamp2TS(delay.attribute("stamp"));
+	}
+	i.from = Jid(m.attribute("from"));
+	i.to = Jid(m.attribute("to"));
+	i.type = m.attribute("type");
+	i.id = m.attribute("id");
+	if(d->fields & Body)
+		i.body = m.firstChildElement("body").text();
+	if(d->fields & Subject)
+		i.subject = m.firstChildElement("subject").text();
+	if(d->fields & Thread)
+		i.thread = m.firstChildElement("thread").text();
+	if(d->fields & Element)
+		i.element = m;
+
+	if(!i.archiveId.isEmpty())
+		d->last = i.archiveId;
+	d->batch += i;
+	if(d->batchSize > 0 && d->batch.count() >= d->batchSize)
+		flush();
+	return true;
+}
+
+void JT_MessageArchive::flush()
+{
+	if(d->batch.isEmpty())
+		return;
+	QList<Item> list = d->batch;
+	d->batch.clear();
+	emit itemsReady(list);
+}
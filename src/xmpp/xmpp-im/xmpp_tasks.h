@@ -34,6 +34,7 @@ namespace XMPP
 {
 	class Roster;
 	class Status;
+	class XmlWriter;
 
         /** @brief Task for registering to server, usually new account. */
 	class JT_Register : public Task
@@ -97,10 +98,13 @@ namespace XMPP
 		~JT_Roster();
 
 		void get();
+		void get(const QString &ver);
 		void set(const Jid &, const QString &name, const QStringList &groups);
 		void remove(const Jid &);
 
 		const Roster & roster() const;
+		QString rosterVersion() const;
+		bool rosterUnchanged() const;
 
 		QString toString() const;
 		bool fromString(const QString &);
@@ -127,7 +131,7 @@ namespace XMPP
 		bool take(const QDomElement &);
 
 	signals:
-		void roster(const Roster &);
+		void roster(const Roster &, const QString &ver);
 
 	private:
 		class Private;
@@ -147,6 +151,9 @@ namespace XMPP
 		void sub(const Jid &, const QString &subType, const QString& nick = QString());
 		void probe(const Jid &to);
 
+		static QDomElement presenceElement(QDomDocument *doc, const Status &s);
+		static void writePresence(XmlWriter *w, const QString &ns, const Status &s, const Jid &to = Jid());
+
 		void onGo();
 
 	private:
@@ -169,6 +176,8 @@ namespace XMPP
 	signals:
 		void presence(const Jid &, const Status &);
 		void subscription(const Jid &, const QString &, const QString&);
+                /** \brief Presence of an occupant of a room joined with light occupants, see Client::groupChatLightOccupant(). */
+		void occupant(const Jid &, bool available, const QString &show);
 
 	private:
 		class Private;
@@ -210,6 +219,8 @@ namespace XMPP
 
 	signals:
 		void message(const Message &);
+		void chatState(const Jid &from, const QString &type, ChatState state);
+		void receipt(const Jid &from, const QString &type, const QString &id);
 
 	private:
 		class Private;
@@ -341,6 +352,15 @@ namespace XMPP
 		~JT_ServInfo();
 
 		bool take(const QDomElement &);
+
+	private slots:
+		void selfInfoChanged();
+
+	private:
+		void reply(const QString &key, const QDomElement &query, const QDomElement &e);
+
+		class Private;
+		Private *d;
 	};
 
         /** @brief Task to get JID from username on foreign network gateways. */
@@ -395,7 +415,15 @@ namespace XMPP
 		AgentItem browseHelper (const QDomElement &i);
 	};
 
-        /** @brief Task to list services or or commands from server or jid. */
+        /** @brief Task to list services or or commands from server or jid.
+
+        With setPageSize() the list is fetched in XEP-0059 pages, one after
+        the other, and every page is passed on through itemsReady() as it
+        comes.  setMaxItems() stops the task once it has that many items, and
+        setStreaming() keeps them out of items(), for lists too long to hold.
+        A server without paging sends the whole list at once, which is then
+        cut to setMaxItems().
+        */
 	class JT_DiscoItems : public Task
 	{
 		Q_OBJECT
@@ -405,15 +433,36 @@ namespace XMPP
 	
 		void get(const Jid &, const QString &node = QString::null);
 		void get(const DiscoItem &);
+
+                /** @brief Items per page asked for.  0, the default, asks for the whole list in one reply. */
+		void setPageSize(int max);
+                /** @brief Stop after \a max items in all.  0, the default, means no limit. */
+		void setMaxItems(int max);
+                /** @brief Only pass the items through itemsReady(), leaving items() empty. */
+		void setStreaming(bool);
+                /** @brief Start after the item with the result set id \a id, such as last() of a previous task. */
+		void setAfter(const QString &id);
 	
 		const DiscoList &items() const;
+
+                /** @brief True once the server said there is nothing more after last(), or sent the list unpaged. */
+		bool complete() const;
+                /** @brief Result set id of the last page's last item, to continue from with setAfter(). */
+		QString last() const;
+                /** @brief Items in the whole list, as far as the server told, or -1. */
+		int count() const;
 	
 		void onGo();
 		bool take(const QDomElement &);
+
+	signals:
+		void itemsReady(const XMPP::DiscoList &items);
 	
 	private:
 		class Private;
 		Private *d;
+
+		void sendPage();
 	};
 
 	class JT_DiscoPublish : public Task
@@ -432,6 +481,72 @@ namespace XMPP
 		class Private;
 		Private *d;
 	};
+
+        /** @brief Task to fetch messages from a XEP-0313 message archive.
+
+        Archived messages come in as they arrive, through itemsReady(), in
+        batches of setBatchSize() and at the end of every page.  They are not
+        passed to Client::messageReceived(), and only the fields asked for
+        with setFields() are taken from them rather than a full Message.
+        With setAutoPage() the task asks for one page after the other until
+        the archive is through, otherwise it stops after the first one and
+        the next page can be had from a new task with setAfter(last()).
+        */
+	class JT_MessageArchive : public Task
+	{
+		Q_OBJECT
+	public:
+		enum Field { Body = 0x01, Subject = 0x02, Thread = 0x04, Element = 0x08 };
+
+                /** @brief One archived message. */
+		class Item
+		{
+		public:
+			QString archiveId; // the id given by the archive, for setAfter()
+			QDateTime stamp;   // when the archive got it, in UTC
+			Jid from, to;
+			QString type, id;
+			QString body, subject, thread; // as asked for with setFields()
+			QDomElement element;           // the forwarded <message/>, with Element
+		};
+
+		JT_MessageArchive(Task *parent);
+		~JT_MessageArchive();
+
+                /** @brief Ask the archive at \a archive (the own account if empty) for messages exchanged with \a with, between \a start and \a end.
+                    Any of them may be left empty or null for no limit. */
+		void query(const Jid &archive=Jid(), const Jid &with=Jid(), const QDateTime &start=QDateTime(), const QDateTime &end=QDateTime());
+                /** @brief Start after the message with archive id \a id, such as last() of a previous query. */
+		void setAfter(const QString &id);
+                /** @brief Messages per page asked for, 100 by default. */
+		void setPageSize(int max);
+                /** @brief Messages per itemsReady(), 50 by default. */
+		void setBatchSize(int count);
+                /** @brief Or-ed Field values to keep of every message, Body by default. */
+		void setFields(int fields);
+		void setAutoPage(bool);
+
+                /** @brief True once the archive said there is nothing more after last(). */
+		bool complete() const;
+                /** @brief Archive id of the last message fetched. */
+		QString last() const;
+                /** @brief Messages the archive had for the query, as far as it told, or -1. */
+		int count() const;
+
+		void onGo();
+		bool take(const QDomElement &);
+
+	signals:
+		void itemsReady(const QList<XMPP::JT_MessageArchive::Item> &items);
+
+	private:
+		class Private;
+		Private *d;
+
+		void sendPage();
+		bool takeResult(const QDomElement &e);
+		void flush();
+	};
 }
 
 #endif
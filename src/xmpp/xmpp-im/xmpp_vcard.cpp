@@ -31,6 +31,8 @@
 #include <QtDebug>
 
 #include "xmpp_xmlcommon.h"
+#include "xmpp_avatarcache.h"
+#include "xmpp/base64/base64.h"
 
 using namespace XMPP;
 using namespace XMLHelper;
@@ -91,7 +93,10 @@ public:
 	QString familyName, givenName, middleName, prefixName, suffixName;
 	QString nickName;
 
-	QByteArray photo;
+	// photos are kept as the BINVAL text until photo() is called
+	mutable QByteArray photo;
+	mutable QString photoBase64;
+	mutable QString photoHash;
 	QString photoURI;
 
 	QString bday;
@@ -129,6 +134,7 @@ public:
 	QByteArray key;
 
 	bool isEmpty();
+	void decodePhoto() const;
 };
 
 VCard::Private::Private()
@@ -142,13 +148,41 @@ VCard::Private::~Private()
 	delete agent;
 }
 
+void VCard::Private::decodePhoto() const
+{
+	if(photoBase64.isEmpty())
+		return;
+
+	// decode the text in pieces rather than making a latin1 copy first
+	Base64::Decoder dec;
+	QByteArray data, piece;
+	data.reserve(photoBase64.length() * 3 / 4);
+	const QChar *in = photoBase64.unicode();
+	int len = photoBase64.length();
+	bool ok = true;
+	for(int at = 0; ok && at < len; at += 4096) {
+		int n = qMin(4096, len - at);
+		piece.resize(n);
+		char *p = piece.data();
+		for(int i = 0; i < n; ++i)
+			p[i] = in[at + i].toLatin1();
+		ok = dec.update(piece, &data);
+	}
+	photoBase64 = QString();
+	if(!ok || !dec.finish())
+		return;
+
+	// contacts with the same avatar share the cached copy
+	photo = AvatarCache::insert(data, &photoHash);
+}
+
 bool VCard::Private::isEmpty()
 {
 	if (	!version.isEmpty() ||
 		!fullName.isEmpty() ||
 		!familyName.isEmpty() || !givenName.isEmpty() || !middleName.isEmpty() || !prefixName.isEmpty() || !suffixName.isEmpty() ||
 		!nickName.isEmpty() ||
-		!photo.isEmpty() || !photoURI.isEmpty() ||
+		!photo.isEmpty() || !photoBase64.isEmpty() || !photoURI.isEmpty() ||
 		!bday.isEmpty() ||
 		!addressList.isEmpty() ||
 		!labelList.isEmpty() ||
@@ -244,6 +278,7 @@ QDomElement VCard::toXml(QDomDocument *doc) const
 	if ( !d->nickName.isEmpty() )
 		v.appendChild( textTag(doc, "NICKNAME",	d->nickName) );
 
+	d->decodePhoto();
 	if ( !d->photo.isEmpty() || !d->photoURI.isEmpty() ) {
 		QDomElement w = doc->createElement("PHOTO");
 
@@ -550,7 +585,9 @@ bool VCard::fromXml(const QDomElement &q)
 		else if ( tag == "NICKNAME" )
 			d->nickName = i.text().trimmed();
 		else if ( tag == "PHOTO" ) {
-			d->photo = QCA::Base64().stringToArray(subTagText(i, "BINVAL").replace("\n","")).toByteArray();
+			d->photo = QByteArray();
+			d->photoBase64 = subTagText(i, "BINVAL");
+			d->photoHash = QString();
 			d->photoURI = subTagText(i, "EXTVAL");
 		}
 		else if ( tag == "BDAY" )
@@ -868,12 +905,22 @@ void VCard::setNickName(const QString &n)
 
 const QByteArray &VCard::photo() const
 {
+	d->decodePhoto();
 	return d->photo;
 }
 
 void VCard::setPhoto(const QByteArray &i)
 {
 	d->photo = i;
+	d->photoBase64 = QString();
+	d->photoHash = QString();
+}
+
+const QString &VCard::photoHash() const
+{
+	if(d->photoHash.isEmpty() && !photo().isEmpty())
+		d->photoHash = AvatarCache::hash(d->photo);
+	return d->photoHash;
 }
 
 const QString &VCard::photoURI() const
@@ -70,8 +70,11 @@ namespace XMPP
 		void setNickName(const QString &);
 
 
+		// decoded on first use, see AvatarCache
 		const QByteArray &photo() const;
 		void setPhoto(const QByteArray &);
+		// XEP-0153 hash of photo()
+		const QString &photoHash() const;
 
 		const QString &photoURI() const;
 		void setPhotoURI(const QString &);
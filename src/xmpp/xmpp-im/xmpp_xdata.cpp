@@ -29,8 +29,6 @@
 using namespace XMPP;
 using namespace XMLHelper;
 
-// TODO: report, item
-
 //----------------------------------------------------------------------------
 // XData::Field
 //----------------------------------------------------------------------------
@@ -291,7 +289,6 @@ QDomElement XData::Field::toXml(QDomDocument *doc, bool submitForm) const
 XData::XData()
 {
 	d = new Private;
-	d->type = Data_Form;
 }
 
 QString XData::title() const
@@ -326,11 +323,13 @@ void XData::setType(Type t)
 
 XData::FieldList XData::fields() const
 {
+	decodeFields();
 	return d->fields;
 }
 
 void XData::setFields(const FieldList &f)
 {
+	d->fieldsPending = false;
 	d->fields = f;
 }
 
@@ -353,58 +352,143 @@ void XData::fromXml(const QDomElement &e)
 	d->instructions = subTagText(e, "instructions");
 
 	d->fields.clear();
+	d->report.clear();
+	d->reportItems.clear();
+	d->table = ReportTable();
+	d->pending = e;
+	d->fieldsPending = true;
+	d->reportPending = true;
+	d->reportItemsPending = true;
+}
 
-	QDomNode n = e.firstChild();
+void XData::decodeFields() const
+{
+	if ( !d->fieldsPending )
+		return;
+	Private *p = const_cast<Private*>(d.constData());
+	p->fieldsPending = false;
+
+	QDomNode n = p->pending.firstChild();
 	for ( ; !n.isNull(); n = n.nextSibling() ) {
 		QDomElement i = n.toElement();
-		if ( i.isNull() )
-			continue;
-
 		if ( i.tagName() == "field" ) {
 			Field f;
 			f.fromXml(i);
-			d->fields.append(f);
+			p->fields.append(f);
 		}
-		else if ( i.tagName() == "reported" ) {
-			d->report.clear();
-			d->reportItems.clear();
+	}
+}
+
+void XData::decodeReport() const
+{
+	if ( !d->reportPending )
+		return;
+	Private *p = const_cast<Private*>(d.constData());
+	p->reportPending = false;
+	ReportTable &t = p->table;
+
+	// each distinct value once, only while building
+	QHash<QString, int> ids;
+
+	QDomNode n = p->pending.firstChild();
+	for ( ; !n.isNull(); n = n.nextSibling() ) {
+		QDomElement i = n.toElement();
+		if ( i.isNull() )
+			continue;
+
+		if ( i.tagName() == "reported" ) {
+			t = ReportTable();
+			ids.clear();
 
 			QDomNode nn = i.firstChild();
 			for ( ; !nn.isNull(); nn = nn.nextSibling() ) {
 				QDomElement ii = nn.toElement();
-				if ( ii.isNull() )
-					continue;
-
 				if ( ii.tagName() == "field" ) {
-					d->report.append( ReportField( ii.attribute("label"), ii.attribute("var") ) );
+					QString var = ii.attribute("var");
+					if ( t.index.contains(var) )
+						continue;
+					t.index.insert( var, t.fields.count() );
+					t.fields.append( ReportField( ii.attribute("label"), var ) );
+					t.cells.append( QVector<int>() );
 				}
 			}
 		}
 		else if ( i.tagName() == "item" ) {
-			ReportItem item;
+			int row = t.rows++;
+			for ( int c = 0; c < t.cells.count(); ++c )
+				t.cells[c].append( -1 );
 
 			QDomNode nn = i.firstChild();
 			for ( ; !nn.isNull(); nn = nn.nextSibling() ) {
 				QDomElement ii = nn.toElement();
-				if ( ii.isNull() )
+				if ( ii.tagName() != "field" )
 					continue;
 
-				if ( ii.tagName() == "field" ) {
-					QString name = ii.attribute("var");
-					QString value;
-
-					bool found;
-					QDomElement e = findSubTag( ii, "value", &found );
-					if ( found )
-						value = e.text();
+				QString var = ii.attribute("var");
+				int c = t.index.value( var, -1 );
+				if ( c == -1 ) {
+					// not announced in <reported/>, but keep it anyway
+					c = t.fields.count();
+					t.index.insert( var, c );
+					t.fields.append( ReportField( QString(), var ) );
+					t.cells.append( QVector<int>( t.rows, -1 ) );
+				}
 
-					item[name] = value;
+				bool found;
+				QDomElement e = findSubTag( ii, "value", &found );
+				QString value = found ? e.text() : QString("");
+
+				QHash<QString, int>::ConstIterator it = ids.find( value );
+				int id;
+				if ( it != ids.end() )
+					id = it.value();
+				else {
+					id = t.strings.count();
+					t.strings.append( value );
+					ids.insert( value, id );
 				}
+				t.cells[c][row] = id;
 			}
-
-			d->reportItems.append( item );
 		}
 	}
+
+	p->report = t.fields;
+}
+
+void XData::decodeReportItems() const
+{
+	decodeReport();
+	if ( !d->reportItemsPending )
+		return;
+	Private *p = const_cast<Private*>(d.constData());
+	p->reportItemsPending = false;
+
+	for ( int row = 0; row < p->table.rows; ++row )
+		p->reportItems.append( p->table.item(row) );
+}
+
+QString XData::ReportTable::value(int row, int column) const
+{
+	if ( column < 0 || column >= cells.count() || row < 0 || row >= rows )
+		return QString();
+	int id = cells[column][row];
+	return id == -1 ? QString() : strings[id];
+}
+
+QString XData::ReportTable::value(int row, const QString &var) const
+{
+	return value( row, columnOf(var) );
+}
+
+XData::ReportItem XData::ReportTable::item(int row) const
+{
+	ReportItem item;
+	for ( int c = 0; c < cells.count(); ++c ) {
+		int id = cells[c][row];
+		if ( id != -1 )
+			item[fields[c].name] = strings[id];
+	}
+	return item;
 }
 
 QDomElement XData::toXml(QDomDocument *doc, bool submitForm) const
@@ -427,6 +511,7 @@ QDomElement XData::toXml(QDomDocument *doc, bool submitForm) const
 	if ( !submitForm && !d->instructions.isEmpty() )
 		x.appendChild( textTag(doc, "instructions", d->instructions) );
 
+	decodeFields();
 	if ( !d->fields.isEmpty() ) {
 		FieldList::ConstIterator it = d->fields.begin();
 		for ( ; it != d->fields.end(); ++it) {
@@ -441,16 +526,25 @@ QDomElement XData::toXml(QDomDocument *doc, bool submitForm) const
 
 const QList<XData::ReportField> &XData::report() const
 {
+	decodeReport();
 	return d->report;
 }
 
 const QList<XData::ReportItem> &XData::reportItems() const
 {
+	decodeReportItems();
 	return d->reportItems;
 }
 
+const XData::ReportTable &XData::reportTable() const
+{
+	decodeReport();
+	return d->table;
+}
+
 bool XData::isValid() const
 {
+	decodeFields();
 	foreach(Field f, d->fields) {
 		if (!f.isValid())
 			return false;
@@ -24,11 +24,13 @@
 
 #include <QString>
 #include <QMap>
+#include <QHash>
 #include <QList>
+#include <QVector>
 #include <QSharedDataPointer>
 #include <QStringList>
+#include <QDomElement>
 
-class QDomElement;
 class QDomDocument;
 
 namespace XMPP {
@@ -63,8 +65,39 @@ namespace XMPP {
 		const QList<ReportField> &report() const;
 
 		typedef QMap<QString, QString> ReportItem;
+		// builds a map for every item out of reportTable(), which is
+		//   costly for large results
 		const QList<ReportItem> &reportItems() const;
 
+		// the reported items of a result, stored by column.  a value that
+		//   occurs more than once, as in most columns of a search result,
+		//   is only kept once.
+		class ReportTable {
+		public:
+			int rowCount() const { return rows; }
+			int columnCount() const { return fields.count(); }
+			const ReportField &column(int c) const { return fields[c]; }
+			// -1 if there is no such column
+			int columnOf(const QString &var) const { return index.value(var, -1); }
+
+			// null if the item has no value for the column
+			QString value(int row, int column) const;
+			QString value(int row, const QString &var) const;
+			ReportItem item(int row) const;
+
+			ReportTable() : rows(0) {}
+
+		private:
+			friend class XData;
+
+			int rows;
+			QList<ReportField> fields;
+			QHash<QString, int> index;      // var -> column
+			QVector< QVector<int> > cells;  // column, row -> string, or -1
+			QStringList strings;
+		};
+		const ReportTable &reportTable() const;
+
 		void fromXml(const QDomElement &);
 		QDomElement toXml(QDomDocument *, bool submitForm = true) const;
 		bool isValid() const;
@@ -146,8 +179,22 @@ namespace XMPP {
 			FieldList fields;
 			QList<ReportField> report;
 			QList<ReportItem>  reportItems;
+			ReportTable table;
+
+			// fromXml() leaves the fields and the reported items in
+			//   the form until they are first asked for.  like
+			//   Message, the decoding applies to every copy sharing
+			//   this data, and is not thread safe.
+			QDomElement pending;
+			bool fieldsPending, reportPending, reportItemsPending;
+
+			Private() : type(Data_Form), fieldsPending(false), reportPending(false), reportItemsPending(false) {}
 		};
 		QSharedDataPointer<Private> d;
+
+		void decodeFields() const;
+		void decodeReport() const;
+		void decodeReportItems() const;
 	};
 
 };
@@ -24,6 +24,8 @@
 #include <qstring.h>
 #include <qdom.h>
 #include <qdatetime.h>
+#include <QMutex>
+#include <QMutexLocker>
 #include <qsize.h>
 #include <qrect.h>
 #include <qstringlist.h>
@@ -83,30 +85,144 @@ void XDomNodeList::append(const QDomNode &i)
 }
 
 
-QDateTime stamp2TS(const QString &ts)
+//----------------------------------------------------------------------------
+// XmlChildIndex
+//----------------------------------------------------------------------------
+XmlChildIndex::XmlChildIndex()
 {
-	if(ts.length() != 17)
-		return QDateTime();
+	built = false;
+}
+
+XmlChildIndex::XmlChildIndex(const QDomElement &e)
+{
+	elem = e;
+	built = false;
+}
+
+void XmlChildIndex::setElement(const QDomElement &e)
+{
+	elem = e;
+	built = false;
+	byName.clear();
+	byTag.clear();
+}
+
+// namespace of an element, from its xmlns attribute if it was built
+//   without one
+static QString elementNS(const QDomElement &e, const QString &parentNS)
+{
+	QString ns = e.namespaceURI();
+	if(!ns.isNull())
+		return ns;
+	const QString &xmlns = XmlAtoms::get().xmlns;
+	if(e.hasAttribute(xmlns))
+		return e.attribute(xmlns);
+	return parentNS;
+}
+
+void XmlChildIndex::build() const
+{
+	built = true;
+	QString parentNS = elementNS(elem, QString());
+	for(QDomNode n = elem.firstChild(); !n.isNull(); n = n.nextSibling()) {
+		if(!n.isElement())
+			continue;
+		QDomElement i = n.toElement();
+		QString tag = i.tagName();
+		QString name = i.localName();
+		if(name.isEmpty())
+			name = tag;
+		byName[Key(elementNS(i, parentNS), name)].append(i);
+		if(!byTag.contains(tag))
+			byTag.insert(tag, i);
+	}
+}
+
+QDomElement XmlChildIndex::first(const QString &nsURI, const QString &localName) const
+{
+	if(!built)
+		build();
+	QHash<Key, XDomNodeList>::ConstIterator it = byName.find(Key(nsURI, localName));
+	if(it == byName.end())
+		return QDomElement();
+	return it.value().item(0).toElement();
+}
 
-	int year  = ts.mid(0,4).toInt();
-	int month = ts.mid(4,2).toInt();
-	int day   = ts.mid(6,2).toInt();
+XDomNodeList XmlChildIndex::all(const QString &nsURI, const QString &localName) const
+{
+	if(!built)
+		build();
+	return byName.value(Key(nsURI, localName));
+}
 
-	int hour  = ts.mid(9,2).toInt();
-	int min   = ts.mid(12,2).toInt();
-	int sec   = ts.mid(15,2).toInt();
+bool XmlChildIndex::has(const QString &nsURI, const QString &localName) const
+{
+	if(!built)
+		build();
+	return byName.contains(Key(nsURI, localName));
+}
+
+QDomElement XmlChildIndex::first(const QString &tagName) const
+{
+	if(!built)
+		build();
+	return byTag.value(tagName);
+}
+
+bool XmlChildIndex::has(const QString &tagName) const
+{
+	if(!built)
+		build();
+	return byTag.contains(tagName);
+}
+
+QString XmlChildIndex::text(const QString &tagName) const
+{
+	QDomElement i = first(tagName);
+	if(i.isNull())
+		return QString();
+	return tagContent(i);
+}
 
-	QDate xd;
-	xd.setYMD(year, month, day);
-	if(!xd.isValid())
+// n decimal digits at p, or -1
+static inline int stampDigits(const QChar *p, int n)
+{
+	int v = 0;
+	for(int i = 0; i < n; ++i) {
+		ushort c = p[i].unicode();
+		if(c < '0' || c > '9')
+			return -1;
+		v = v * 10 + (c - '0');
+	}
+	return v;
+}
+
+static QDateTime stampDateTime(int year, int month, int day, int hour, int min, int sec, Qt::TimeSpec spec)
+{
+	if(year < 0 || month < 0 || day < 0 || hour < 0 || min < 0 || sec < 0)
 		return QDateTime();
+	if(!QDate::isValid(year, month, day) || !QTime::isValid(hour, min, sec))
+		return QDateTime();
+	return QDateTime(QDate(year, month, day), QTime(hour, min, sec), spec);
+}
 
-	QTime xt;
-	xt.setHMS(hour, min, sec);
-	if(!xt.isValid())
+static inline void putDigits(QChar *p, int v, int n)
+{
+	for(int i = n - 1; i >= 0; --i) {
+		p[i] = QChar('0' + v % 10);
+		v /= 10;
+	}
+}
+
+/** \brief Parse a legacy (XEP-0091) stamp, CCYYMMDDThh:mm:ss.  Null if malformed. */
+QDateTime stamp2TS(const QString &ts)
+{
+	if(ts.length() != 17)
 		return QDateTime();
 
-	return QDateTime(xd, xt);
+	const QChar *p = ts.unicode();
+	return stampDateTime(stampDigits(p, 4), stampDigits(p + 4, 2), stampDigits(p + 6, 2),
+		stampDigits(p + 9, 2), stampDigits(p + 12, 2), stampDigits(p + 15, 2), Qt::LocalTime);
 }
 
 bool stamp2TS(const QString &ts, QDateTime *d)
@@ -122,19 +238,122 @@ bool stamp2TS(const QString &ts, QDateTime *d)
 
 QString TS2stamp(const QDateTime &d)
 {
-	QString str;
+	QDate date = d.date();
+	QTime time = d.time();
+
+	QString str(17, QChar('T'));
+	QChar *p = str.data();
+	putDigits(p, date.year(), 4);
+	putDigits(p + 4, date.month(), 2);
+	putDigits(p + 6, date.day(), 2);
+	putDigits(p + 9, time.hour(), 2);
+	p[11] = ':';
+	putDigits(p + 12, time.minute(), 2);
+	p[14] = ':';
+	putDigits(p + 15, time.second(), 2);
+	return str;
+}
 
-	str.sprintf("%04d%02d%02dT%02d:%02d:%02d",
-		d.date().year(),
-		d.date().month(),
-		d.date().day(),
-		d.time().hour(),
-		d.time().minute(),
-		d.time().second());
+/** \brief Parse an XEP-0082 DateTime, CCYY-MM-DDThh:mm:ss[.sss][TZD], as used by XEP-0203 delays.
+    The result is in UTC.  A stamp without a zone is taken as UTC, fractions of a second are dropped.  Null if malformed. */
+QDateTime isoStamp2TS(const QString &ts)
+{
+	int len = ts.length();
+	if(len < 19)
+		return QDateTime();
 
+	const QChar *p = ts.unicode();
+	if(p[4] != '-' || p[7] != '-' || p[10] != 'T' || p[13] != ':' || p[16] != ':')
+		return QDateTime();
+	QDateTime dt = stampDateTime(stampDigits(p, 4), stampDigits(p + 5, 2), stampDigits(p + 8, 2),
+		stampDigits(p + 11, 2), stampDigits(p + 14, 2), stampDigits(p + 17, 2), Qt::UTC);
+	if(dt.isNull())
+		return dt;
+
+	int at = 19;
+	if(at < len && p[at] == '.') {
+		++at;
+		while(at < len && p[at].unicode() >= '0' && p[at].unicode() <= '9')
+			++at;
+	}
+
+	// +hh:mm or -hh:mm is local time ahead of or behind utc
+	if(at + 6 == len && (p[at] == '+' || p[at] == '-') && p[at + 3] == ':') {
+		int h = stampDigits(p + at + 1, 2);
+		int m = stampDigits(p + at + 4, 2);
+		if(h >= 0 && m >= 0) {
+			int offset = h * 3600 + m * 60;
+			dt = dt.addSecs(p[at] == '+' ? -offset : offset);
+		}
+	}
+	return dt;
+}
+
+/** \brief Format \a d as an XEP-0082 DateTime in UTC, CCYY-MM-DDThh:mm:ssZ. */
+QString TS2isoStamp(const QDateTime &d)
+{
+	QDateTime utc = d.toUTC();
+	QDate date = utc.date();
+	QTime time = utc.time();
+
+	QString str(20, QChar('-'));
+	QChar *p = str.data();
+	putDigits(p, date.year(), 4);
+	putDigits(p + 5, date.month(), 2);
+	putDigits(p + 8, date.day(), 2);
+	p[10] = 'T';
+	putDigits(p + 11, time.hour(), 2);
+	p[13] = ':';
+	putDigits(p + 14, time.minute(), 2);
+	p[16] = ':';
+	putDigits(p + 17, time.second(), 2);
+	p[19] = 'Z';
 	return str;
 }
 
+// the offset of local time from utc, for the last hour converted.  asking
+//   the system (localtime) for every delayed stanza is what made history
+//   and offline messages slow to take in
+class LocalOffsetCache
+{
+public:
+	QMutex m;
+	uint hour;
+	int offset;
+
+	LocalOffsetCache() : hour(uint(-1)), offset(0) {}
+};
+
+Q_GLOBAL_STATIC(LocalOffsetCache, localOffsetCache)
+
+/** \brief \a utc in local time, like toLocalTime(), but asking the system at most once per hour of time converted. */
+QDateTime utc2Local(const QDateTime &utc)
+{
+	QDateTime u = utc;
+	u.setTimeSpec(Qt::UTC);
+	uint t = u.toTime_t();
+	LocalOffsetCache *c = localOffsetCache();
+	if(t == uint(-1) || !c)
+		return u.toLocalTime();
+
+	int offset;
+	{
+		QMutexLocker locker(&c->m);
+		if(c->hour == t / 3600) {
+			offset = c->offset;
+		}
+		else {
+			QDateTime local = u.toLocalTime();
+			offset = u.secsTo(QDateTime(local.date(), local.time(), Qt::UTC));
+			c->hour = t / 3600;
+			c->offset = offset;
+		}
+	}
+
+	QDateTime shifted = u.addSecs(offset);
+	return QDateTime(shifted.date(), shifted.time(), Qt::LocalTime);
+}
+
 QDomElement textTag(QDomDocument *doc, const QString &name, const QString &content)
 {
 	QDomElement tag = doc->createElement(name);
@@ -219,13 +438,14 @@ XDomNodeList childElementsByTagNameNS(const QDomElement &e, const QString &nsURI
 */
 QDomElement createIQ(QDomDocument *doc, const QString &type, const QString &to, const QString &id)
 {
-	QDomElement iq = doc->createElement("iq");
+	const XmlAtoms &a = XmlAtoms::get();
+	QDomElement iq = doc->createElement(a.iq);
 	if(!type.isEmpty())
-		iq.setAttribute("type", type);
+		iq.setAttribute(a.type, type);
 	if(!to.isEmpty())
-		iq.setAttribute("to", to);
+		iq.setAttribute(a.to, to);
 	if(!id.isEmpty())
-		iq.setAttribute("id", id);
+		iq.setAttribute(a.id, id);
 
 	return iq;
 }
@@ -236,16 +456,16 @@ QDomElement createIQ(QDomDocument *doc, const QString &type, const QString &to,
 QDomElement queryTag(const QDomElement &e)
 {
 	bool found;
-	QDomElement q = findSubTag(e, "query", &found);
+	QDomElement q = findSubTag(e, XmlAtoms::get().query, &found);
 	return q;
 }
 
 QString queryNS(const QDomElement &e)
 {
 	bool found;
-	QDomElement q = findSubTag(e, "query", &found);
+	QDomElement q = findSubTag(e, XmlAtoms::get().query, &found);
 	if(found)
-		return q.attribute("xmlns");
+		return q.attribute(XmlAtoms::get().xmlns);
 
 	return "";
 }
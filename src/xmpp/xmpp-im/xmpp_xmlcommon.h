@@ -23,6 +23,10 @@
 
 #include <qdom.h>
 #include <qlist.h>
+#include <qhash.h>
+#include <qpair.h>
+
+#include "xmlatoms.h"
 
 #include "xmpp_xmlcommon.h"
 
@@ -61,9 +65,49 @@ private:
 	QList<QDomNode> list;
 };
 
+// the children of one element, filed in one pass on the first lookup, for
+//   parsers that look for many of them.  a child is filed under its
+//   namespace and local name, and under its tag name for the lookups that
+//   ignore namespaces the way findSubTag() does.  namespaces given as
+//   xmlns attributes count as well, so that elements from Client tasks
+//   index the same as the ones from the stream.  the element must not
+//   change while the index is in use.
+class XmlChildIndex
+{
+public:
+	XmlChildIndex();
+	explicit XmlChildIndex(const QDomElement &e);
+
+	void setElement(const QDomElement &e);
+	QDomElement element() const { return elem; }
+
+	// by namespace and local name
+	QDomElement first(const QString &nsURI, const QString &localName) const;
+	XDomNodeList all(const QString &nsURI, const QString &localName) const;
+	bool has(const QString &nsURI, const QString &localName) const;
+
+	// by tag name, in any namespace
+	QDomElement first(const QString &tagName) const;
+	bool has(const QString &tagName) const;
+	QString text(const QString &tagName) const; // empty if missing
+
+private:
+	typedef QPair<QString,QString> Key;
+
+	QDomElement elem;
+	mutable bool built;
+	mutable QHash<Key, XDomNodeList> byName;
+	mutable QHash<QString, QDomElement> byTag;
+
+	void build() const;
+};
+
 QDateTime stamp2TS(const QString &ts);
 bool stamp2TS(const QString &ts, QDateTime *d);
 QString TS2stamp(const QDateTime &d);
+QDateTime isoStamp2TS(const QString &ts);
+QString TS2isoStamp(const QDateTime &d);
+QDateTime utc2Local(const QDateTime &utc);
 QDomElement textTag(QDomDocument *doc, const QString &name, const QString &content);
 QString tagContent(const QDomElement &e);
 QDomElement findSubTag(const QDomElement &e, const QString &name, bool *found);
@@ -33,28 +33,43 @@ HEADERS += \
 	$$PWD/xmpp-core/protocol.h \
 	$$PWD/xmpp-core/compressionhandler.h \
 	$$PWD/xmpp-core/td.h \
+	$$PWD/xmpp-core/nametable.h \
+	$$PWD/xmpp-core/xmlatoms.h \
 	$$PWD/xmpp-im/xmpp_tasks.h \
 	$$PWD/xmpp-im/xmpp_discoinfotask.h \
+	$$PWD/xmpp-im/xmpp_capscache.h \
+	$$PWD/xmpp-im/xmpp_avatarcache.h \
 	$$PWD/xmpp-im/xmpp_xmlcommon.h \
 	$$PWD/xmpp-im/xmpp_vcard.h \
 	$$PWD/xmpp-im/s5b.h \
 	$$PWD/xmpp-im/xmpp_ibb.h \
 	$$PWD/xmpp-im/filetransfer.h \
+	$$PWD/xmpp-im/xmpp_jingle.h \
 	$$PWD/xmpp-core/xmpp.h \
 	$$PWD/xmpp-im/xmpp_url.h \
 	$$PWD/xmpp-im/xmpp_chatstate.h \
 	$$PWD/xmpp-im/xmpp_receipts.h \
 	$$PWD/xmpp-im/xmpp_client.h \
+	$$PWD/xmpp-im/xmpp_clientpool.h \
+	$$PWD/xmpp-im/xmpp_componentclient.h \
 	$$PWD/xmpp-core/xmpp_clientstream.h \
 	$$PWD/xmpp-core/xmpp_stanza.h \
+	$$PWD/xmpp-core/xmpp_xmlwriter.h \
 	$$PWD/xmpp-core/xmpp_stream.h \
+	$$PWD/xmpp-core/xmpp_streamserver.h \
+	$$PWD/xmpp-core/xmpp_streamshutdown.h \
+	$$PWD/xmpp-core/xmpp_statistics.h \
+	$$PWD/xmpp-core/xmpp_stanzafilter.h \
 	$$PWD/xmpp-im/xmpp_address.h \
 	$$PWD/xmpp-im/xmpp_htmlelement.h \
 	$$PWD/xmpp-im/xmpp_muc.h \
 	$$PWD/xmpp-im/xmpp_message.h \
 	$$PWD/xmpp-im/xmpp_pubsubitem.h \
+	$$PWD/xmpp-im/xmpp_pubsubevent.h \
 	$$PWD/xmpp-im/xmpp_resource.h \
 	$$PWD/xmpp-im/xmpp_roster.h \
+	$$PWD/xmpp-im/xmpp_rostercache.h \
+	$$PWD/xmpp-im/xmpp_rosterstore.h \
 	$$PWD/xmpp-im/xmpp_rosterx.h \
 	$$PWD/xmpp-im/xmpp_xdata.h \
 	$$PWD/xmpp-im/xmpp_rosteritem.h \
@@ -78,13 +93,23 @@ SOURCES += \
 	$$PWD/xmpp-core/protocol.cpp \
 	$$PWD/xmpp-core/compressionhandler.cpp \
 	$$PWD/xmpp-core/stream.cpp \
+	$$PWD/xmpp-core/xmpp_streamserver.cpp \
+	$$PWD/xmpp-core/xmpp_streamshutdown.cpp \
 	$$PWD/xmpp-core/simplesasl.cpp \
 	$$PWD/xmpp-core/xmpp_stanza.cpp \
+	$$PWD/xmpp-core/xmpp_stanzafilter.cpp \
+	$$PWD/xmpp-core/xmpp_xmlwriter.cpp \
+	$$PWD/xmpp-core/xmlatoms.cpp \
 	$$PWD/xmpp-im/types.cpp \
 	$$PWD/xmpp-im/client.cpp \
+	$$PWD/xmpp-im/xmpp_clientpool.cpp \
+	$$PWD/xmpp-im/xmpp_componentclient.cpp \
 	$$PWD/xmpp-im/xmpp_features.cpp \
 	$$PWD/xmpp-im/xmpp_discoitem.cpp \
 	$$PWD/xmpp-im/xmpp_discoinfotask.cpp \
+	$$PWD/xmpp-im/xmpp_capscache.cpp \
+	$$PWD/xmpp-im/xmpp_avatarcache.cpp \
+	$$PWD/xmpp-im/xmpp_rosterstore.cpp \
 	$$PWD/xmpp-im/xmpp_xdata.cpp \
 	$$PWD/xmpp-im/xmpp_task.cpp \
 	$$PWD/xmpp-im/xmpp_tasks.cpp \
@@ -92,4 +117,5 @@ SOURCES += \
 	$$PWD/xmpp-im/xmpp_vcard.cpp \
 	$$PWD/xmpp-im/s5b.cpp \
 	$$PWD/xmpp-im/xmpp_ibb.cpp \
-	$$PWD/xmpp-im/filetransfer.cpp
+	$$PWD/xmpp-im/filetransfer.cpp \
+	$$PWD/xmpp-im/xmpp_jingle.cpp
@@ -7,15 +7,37 @@
 
 #include "common.h"
 
-ZLibCompressor::ZLibCompressor(QIODevice* device, int compression) : device_(device)
+// plain bytes between adaptive level decisions
+#define ADAPT_WINDOW 16384
+
+// output/input above this isn't worth the CPU, so send stored
+#define INCOMPRESSIBLE_RATIO 0.8
+
+// stretches to store before trying to compress again
+#define STORED_WINDOWS 8
+
+// nanoseconds per plain byte to step down above, and up below
+#define CPU_HIGH_NSECS 100
+#define CPU_LOW_NSECS 25
+
+ZLibCompressor::ZLibCompressor(QIODevice* device, int compression, int windowBits, int memLevel) : device_(device)
 {
 	zlib_stream_ = (z_stream*) malloc(sizeof(z_stream));
 	initZStream(zlib_stream_);
-	int result = deflateInit(zlib_stream_, compression);
+	int result = deflateInit2(zlib_stream_, compression, Z_DEFLATED, windowBits, memLevel, Z_DEFAULT_STRATEGY);
 	Q_ASSERT(result == Z_OK);
 	Q_UNUSED(result);
 	connect(device, SIGNAL(aboutToClose()), this, SLOT(flush()));
 	flushed_ = false;
+	pending_ = 0;
+
+	adaptive_ = false;
+	level_ = compression == Z_DEFAULT_COMPRESSION ? 6 : compression;
+	resumeLevel_ = level_;
+	storedLeft_ = 0;
+	windowIn_ = 0;
+	windowOut_ = 0;
+	windowNsecs_ = 0;
 }
 
 ZLibCompressor::~ZLibCompressor()
@@ -30,64 +52,151 @@ void ZLibCompressor::flush()
 		return;
 	
 	// Flush
-	write(QByteArray(),true);
+	deflateInput(0, 0, Z_FINISH);
 	int result = deflateEnd(zlib_stream_);
 	if (result != Z_OK) 
 		qWarning() << QString("compressor.c: deflateEnd failed (%1)").arg(result);
 	
+	pending_ = 0;
 	flushed_ = true;
 }
 
 int ZLibCompressor::write(const QByteArray& input)
 {
-	return write(input,false);
+	pending_ = 0;
+	int result = deflateInput(input.data(), input.size(), Z_SYNC_FLUSH);
+	if (result == 0)
+		adapt();
+	return result;
+}
+
+int ZLibCompressor::writeDeferred(const QByteArray& input)
+{
+	pending_ += input.size();
+	return deflateInput(input.data(), input.size(), Z_NO_FLUSH);
+}
+
+int ZLibCompressor::sync()
+{
+	if (pending_ == 0)
+		return 0;
+	pending_ = 0;
+	int result = deflateInput(0, 0, Z_SYNC_FLUSH);
+	if (result == 0)
+		adapt();
+	return result;
+}
+
+int ZLibCompressor::pending() const
+{
+	return pending_;
+}
+
+void ZLibCompressor::compact()
+{
+	output_ = QByteArray();
+}
+
+void ZLibCompressor::setAdaptive(bool enabled)
+{
+	adaptive_ = enabled;
+	windowIn_ = 0;
+	windowOut_ = 0;
+	windowNsecs_ = 0;
 }
 
-int ZLibCompressor::write(const QByteArray& input, bool flush)
+int ZLibCompressor::level() const
+{
+	return level_;
+}
+
+// called right after a sync flush, where a level change costs nothing
+void ZLibCompressor::adapt()
+{
+	if (!adaptive_ || flushed_ || windowIn_ < ADAPT_WINDOW)
+		return;
+
+	int level = level_;
+	if (storedLeft_ > 0) {
+		if (--storedLeft_ == 0)
+			level = resumeLevel_;
+	}
+	else {
+		double ratio = (double) windowOut_ / windowIn_;
+		qint64 nsecs = windowNsecs_ / windowIn_;
+		if (ratio > INCOMPRESSIBLE_RATIO) {
+			resumeLevel_ = level_;
+			storedLeft_ = STORED_WINDOWS;
+			level = 0;
+		}
+		else if (nsecs > CPU_HIGH_NSECS && level_ > 1)
+			--level;
+		else if (nsecs < CPU_LOW_NSECS && level_ < 9)
+			++level;
+	}
+
+	windowIn_ = 0;
+	windowOut_ = 0;
+	windowNsecs_ = 0;
+	if (level != level_)
+		setLevel(level);
+}
+
+void ZLibCompressor::setLevel(int level)
+{
+	// older zlibs may emit the end of a block here
+	if (output_.size() < CHUNK_SIZE)
+		output_.resize(CHUNK_SIZE);
+	zlib_stream_->avail_in = 0;
+	zlib_stream_->next_out = (Bytef*) output_.data();
+	zlib_stream_->avail_out = output_.size();
+	int result = deflateParams(zlib_stream_, level, Z_DEFAULT_STRATEGY);
+	if (result != Z_OK) {
+		qWarning() << QString("compressor.cpp: deflateParams failed (%1)").arg(result);
+		return;
+	}
+	int produced = output_.size() - zlib_stream_->avail_out;
+	if (produced > 0)
+		device_->write(output_.constData(), produced);
+	level_ = level;
+}
+
+int ZLibCompressor::deflateInput(const char* data, int size, int mode)
 {
 	int result;
-	zlib_stream_->avail_in = input.size();
-	zlib_stream_->next_in = (Bytef*) input.data();
-	QByteArray output;
+	if (adaptive_)
+		timer_.start();
+	zlib_stream_->avail_in = size;
+	zlib_stream_->next_in = (Bytef*) data;
 
-	// Write the data
+	// output_ is kept between calls, so it only grows until it fits
+	// the largest burst we have produced
 	int output_position = 0;
 	do {
-		output.resize(output_position + CHUNK_SIZE);
-		zlib_stream_->avail_out = CHUNK_SIZE;
-		zlib_stream_->next_out = (Bytef*) (output.data() + output_position);
-		result = deflate(zlib_stream_,(flush ? Z_FINISH : Z_NO_FLUSH));
+		if (output_position == output_.size())
+			output_.resize(output_.size() + CHUNK_SIZE);
+		zlib_stream_->avail_out = output_.size() - output_position;
+		zlib_stream_->next_out = (Bytef*) (output_.data() + output_position);
+		result = deflate(zlib_stream_, mode);
 		if (result == Z_STREAM_ERROR) {
 			qWarning() << QString("compressor.cpp: Error ('%1')").arg(zlib_stream_->msg);
 			return result;
 		}
-		output_position += CHUNK_SIZE;
+		output_position = output_.size() - zlib_stream_->avail_out;
 	}
 	while (zlib_stream_->avail_out == 0);
 	if (zlib_stream_->avail_in != 0) {
 		qWarning("ZLibCompressor: avail_in != 0");
 	}
-	output_position -= zlib_stream_->avail_out;
-
-	// Flush the data
-	if (!flush) {
-		do {
-			output.resize(output_position + CHUNK_SIZE);
-			zlib_stream_->avail_out = CHUNK_SIZE;
-			zlib_stream_->next_out = (Bytef*) (output.data() + output_position);
-			result = deflate(zlib_stream_,Z_SYNC_FLUSH);
-			if (result == Z_STREAM_ERROR) {
-				qWarning() << QString("compressor.cpp: Error ('%1')").arg(zlib_stream_->msg);
-				return result;
-			}
-			output_position += CHUNK_SIZE;
-		}
-		while (zlib_stream_->avail_out == 0);
-		output_position -= zlib_stream_->avail_out;
+
+	if (adaptive_) {
+		windowNsecs_ += timer_.nsecsElapsed();
+		windowIn_ += size;
+		windowOut_ += output_position;
 	}
-	output.resize(output_position);
 
 	// Write the compressed data
-	device_->write(output);
+	if (output_position > 0)
+		device_->write(output_.constData(), output_position);
 	return 0;
 }
@@ -2,6 +2,8 @@
 #define ZLIBCOMPRESSOR_H
 
 #include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
 
 #include "zlib.h"
 
@@ -12,21 +14,52 @@ class ZLibCompressor : public QObject
 	Q_OBJECT
 
 public:
-	ZLibCompressor(QIODevice* device, int compression = Z_DEFAULT_COMPRESSION);
+	// windowBits and memLevel as for deflateInit2().  smaller values save
+	//   memory at some cost in ratio; any peer's inflater takes them
+	ZLibCompressor(QIODevice* device, int compression = Z_DEFAULT_COMPRESSION, int windowBits = MAX_WBITS, int memLevel = 8);
 	~ZLibCompressor();
 
+	// compresses and sync flushes, so the peer can decode everything so far
 	int write(const QByteArray&);
 
+	// compresses without flushing; call sync() to push the data out
+	int writeDeferred(const QByteArray&);
+	int sync();
+	int pending() const;
+
+	// drops the output buffer, which otherwise keeps the size of the
+	//   largest write
+	void compact();
+
+	// adjusts the level as the traffic changes.  every 16 KB of input,
+	//   the ratio and the CPU time per byte of the last stretch decide:
+	//   data that doesn't shrink by a fifth (already compressed or
+	//   encrypted payloads) goes out stored for a while, costly deflating
+	//   steps the level down, cheap deflating steps it up towards 9.
+	//   changes take effect at the next flush point
+	void setAdaptive(bool enabled);
+	int level() const;
+
 protected slots:
 	void flush();
 
-protected:
-	int write(const QByteArray&, bool flush);
-
 private:
+	int deflateInput(const char* data, int size, int mode);
+	void adapt();
+	void setLevel(int level);
+
 	QIODevice* device_;
 	z_stream* zlib_stream_;
 	bool flushed_;
+	QByteArray output_;
+	int pending_;
+
+	bool adaptive_;
+	int level_;
+	int resumeLevel_; // to go back to after stored stretches
+	int storedLeft_; // stretches still to store
+	qint64 windowIn_, windowOut_, windowNsecs_;
+	QElapsedTimer timer_;
 };
 
 #endif
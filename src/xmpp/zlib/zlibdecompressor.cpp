@@ -30,7 +30,7 @@ void ZLibDecompressor::flush()
 		return;
 	
 	// Flush
-	write(QByteArray(),true);
+	inflateInput(0, 0, Z_FINISH);
 	int result = inflateEnd(zlib_stream_);
 	if (result != Z_OK) 
 		qWarning() << QString("compressor.c: inflateEnd failed (%1)").arg(result);
@@ -40,28 +40,34 @@ void ZLibDecompressor::flush()
 
 int ZLibDecompressor::write(const QByteArray& input)
 {
-	return write(input,false);
+	return inflateInput(input.data(), input.size(), Z_SYNC_FLUSH);
 }
 
-int ZLibDecompressor::write(const QByteArray& input, bool flush)
+void ZLibDecompressor::compact()
+{
+	output_ = QByteArray();
+}
+
+int ZLibDecompressor::inflateInput(const char* data, int size, int mode)
 {
 	int result;
-	zlib_stream_->avail_in = input.size();
-	zlib_stream_->next_in = (Bytef*) input.data();
-	QByteArray output;
+	zlib_stream_->avail_in = size;
+	zlib_stream_->next_in = (Bytef*) data;
 
-	// Write the data
+	// output_ is kept between calls, so it only grows until it fits
+	// the largest burst we have produced
 	int output_position = 0;
 	do {
-		output.resize(output_position + CHUNK_SIZE);
-		zlib_stream_->avail_out = CHUNK_SIZE;
-		zlib_stream_->next_out = (Bytef*) (output.data() + output_position);
-		result = inflate(zlib_stream_,(flush ? Z_FINISH : Z_NO_FLUSH));
+		if (output_position == output_.size())
+			output_.resize(output_.size() + CHUNK_SIZE);
+		zlib_stream_->avail_out = output_.size() - output_position;
+		zlib_stream_->next_out = (Bytef*) (output_.data() + output_position);
+		result = inflate(zlib_stream_, mode);
 		if (result == Z_STREAM_ERROR) {
 			qWarning() << QString("compressor.cpp: Error ('%1')").arg(zlib_stream_->msg);
 			return result;
 		}
-		output_position += CHUNK_SIZE;
+		output_position = output_.size() - zlib_stream_->avail_out;
 	}
 	while (zlib_stream_->avail_out == 0);
 	//Q_ASSERT(zlib_stream_->avail_in == 0);
@@ -69,27 +75,9 @@ int ZLibDecompressor::write(const QByteArray& input, bool flush)
 		qWarning() << "ZLibDecompressor: Unexpected state: avail_in=" << zlib_stream_->avail_in << ",avail_out=" << zlib_stream_->avail_out << ",result=" << result;
 		return Z_STREAM_ERROR; // FIXME: Should probably return 'result'
 	}
-	output_position -= zlib_stream_->avail_out;
-
-	// Flush the data
-	if (!flush) {
-		do {
-			output.resize(output_position + CHUNK_SIZE);
-			zlib_stream_->avail_out = CHUNK_SIZE;
-			zlib_stream_->next_out = (Bytef*) (output.data() + output_position);
-			result = inflate(zlib_stream_,Z_SYNC_FLUSH);
-			if (result == Z_STREAM_ERROR) {
-				qWarning() << QString("compressor.cpp: Error ('%1')").arg(zlib_stream_->msg);
-				return result;
-			}
-			output_position += CHUNK_SIZE;
-		}
-		while (zlib_stream_->avail_out == 0);
-		output_position -= zlib_stream_->avail_out;
-	}
-	output.resize(output_position);
 
-	// Write the compressed data
-	device_->write(output);
+	// Write the decompressed data
+	if (output_position > 0)
+		device_->write(output_.constData(), output_position);
 	return 0;
 }
@@ -2,6 +2,7 @@
 #define ZLIBDECOMPRESSOR_H
 
 #include <QObject>
+#include <QByteArray>
 
 #include "zlib.h"
 
@@ -17,16 +18,20 @@ public:
 
 	int write(const QByteArray&);
 
+	// drops the output buffer, which otherwise keeps the size of the
+	//   largest write
+	void compact();
+
 protected slots:
 	void flush();
 
-protected:
-	int write(const QByteArray&, bool flush);
-
 private:
+	int inflateInput(const char* data, int size, int mode);
+
 	QIODevice* device_;
 	z_stream* zlib_stream_;
 	bool flushed_;
+	QByteArray output_;
 };
 
 #endif
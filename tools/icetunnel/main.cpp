@@ -23,6 +23,7 @@
 #include <QUdpSocket>
 #include <QNetworkInterface>
 #include <QNetworkAddressEntry>
+#include <QFile>
 #include <QtCrypto>
 #include <iris/netnames.h>
 #include <iris/netinterface.h>
@@ -414,6 +415,219 @@ private slots:
 		return;
 }*/
 
+static void printLatency(const char *name, QList<int> samples)
+{
+	if(samples.isEmpty())
+	{
+		printf("  %s: no samples\n", name);
+		return;
+	}
+
+	qSort(samples);
+	int last = samples.count() - 1;
+	printf("  %s (ms): min=%d p50=%d p90=%d p99=%d max=%d (%d samples)\n", name,
+		samples[0], samples[last * 50 / 100], samples[last * 90 / 100],
+		samples[last * 99 / 100], samples[last], samples.count());
+}
+
+// blasts paced datagrams on every component and measures what the peer
+//   sends back the same way.  packet format: type (8 bits), sequence
+//   number (32 bits), sender's clock in msecs (32 bits), then padding.
+//   every tenth packet asks the peer for an immediate probe reply, which
+//   is used to measure rtt.
+class IceBench : public QObject
+{
+	Q_OBJECT
+
+public:
+	enum PacketType
+	{
+		Data,
+		DataProbe,
+		ProbeReply
+	};
+
+	class Stats
+	{
+	public:
+		int sent;
+		int received;
+		int expected; // highest sequence number seen, plus one
+		qint64 bytes;
+		int firstAt, lastAt;
+		double jitter; // RFC 3550 style interarrival jitter, in msecs
+		bool haveTransit;
+		int lastTransit;
+		QList<int> rtts;
+
+		Stats() :
+			sent(0),
+			received(0),
+			expected(0),
+			bytes(0),
+			firstAt(-1),
+			lastAt(-1),
+			jitter(0),
+			haveTransit(false),
+			lastTransit(0)
+		{
+		}
+	};
+
+	XMPP::Ice176 *ice;
+	int rate; // per component, packets per second
+	int size;
+	int duration; // secs
+	QString path; // expected path, or empty
+	QList<Stats> stats;
+	QTimer *sendTimer;
+	QTime clock;
+
+	IceBench(XMPP::Ice176 *_ice, int componentCount, QObject *parent = 0) :
+		QObject(parent),
+		ice(_ice)
+	{
+		for(int n = 0; n < componentCount; ++n)
+			stats += Stats();
+
+		sendTimer = new QTimer(this);
+		connect(sendTimer, SIGNAL(timeout()), SLOT(sendTimer_timeout()));
+		sendTimer->setInterval(10);
+	}
+
+	void start()
+	{
+		printf("Sending %d-byte datagrams at %d/sec on %d component(s) for %d sec...\n", size, rate, stats.count(), duration);
+
+		clock.start();
+		sendTimer->start();
+		QTimer::singleShot(duration * 1000, this, SLOT(stopSending()));
+	}
+
+	void processDatagram(int componentIndex, const QByteArray &buf)
+	{
+		if(buf.size() < 9)
+			return;
+
+		QDataStream in(buf);
+		quint8 type;
+		quint32 seq;
+		qint32 sentAt;
+		in >> type >> seq >> sentAt;
+
+		Stats &s = stats[componentIndex];
+		int now = clock.elapsed();
+
+		if(type == ProbeReply)
+		{
+			s.rtts += now - sentAt;
+			return;
+		}
+
+		++s.received;
+		s.bytes += buf.size();
+		s.expected = qMax(s.expected, (int)seq + 1);
+		if(s.firstAt == -1)
+			s.firstAt = now;
+		s.lastAt = now;
+
+		// the peer's clock is offset from ours, but the offset cancels
+		//   out in the difference between two transit times
+		int transit = now - sentAt;
+		if(s.haveTransit)
+			s.jitter += (qAbs(transit - s.lastTransit) - s.jitter) / 16;
+		s.lastTransit = transit;
+		s.haveTransit = true;
+
+		if(type == DataProbe)
+			ice->writeDatagram(componentIndex, makePacket(ProbeReply, seq, sentAt, 9));
+	}
+
+signals:
+	void finished();
+
+private:
+	static QByteArray makePacket(quint8 type, quint32 seq, qint32 sentAt, int size)
+	{
+		QByteArray buf(qMax(size, 9), 0);
+		QDataStream out(&buf, QIODevice::WriteOnly);
+		out << type << seq << sentAt;
+		return buf;
+	}
+
+	bool pathMatches(const XMPP::Ice176::ComponentStats &cs) const
+	{
+		if(path == "relay")
+			return cs.isRelayed;
+		else if(path == "srflx")
+			return !cs.isRelayed && (cs.localType != "host" || cs.remoteType != "host");
+		else if(path == "host")
+			return cs.localType == "host" && cs.remoteType == "host";
+		return true;
+	}
+
+	void report()
+	{
+		for(int n = 0; n < stats.count(); ++n)
+		{
+			const Stats &s = stats[n];
+			XMPP::Ice176::ComponentStats cs = ice->componentStats(n);
+
+			printf("Component %d: %s -> %s%s\n", n, qPrintable(cs.localType), qPrintable(cs.remoteType), cs.isRelayed ? " (relayed)" : "");
+			if(!pathMatches(cs))
+				printf("  Warning: selected pair is not a %s path\n", qPrintable(path));
+
+			int lost = s.expected - s.received;
+			printf("  Sent: %d, received: %d of %d (%.2f%% loss)\n", s.sent, s.received, s.expected,
+				s.expected > 0 ? lost * 100.0 / s.expected : 0.0);
+			if(s.received > 1)
+			{
+				int elapsed = qMax(s.lastAt - s.firstAt, 1);
+				printf("  Goodput: %.1f kbit/s, jitter: %.1f ms\n", s.bytes * 8.0 / elapsed, s.jitter);
+			}
+			printLatency("Round trip", s.rtts);
+			if(cs.rtt != -1)
+				printf("  ICE consent rtt: %d ms\n", cs.rtt);
+		}
+	}
+
+private slots:
+	void sendTimer_timeout()
+	{
+		// catch up to where the rate says we should be
+		int now = clock.elapsed();
+		int target = (int)((qint64)rate * now / 1000) + 1;
+		for(int n = 0; n < stats.count(); ++n)
+		{
+			Stats &s = stats[n];
+			QList<QByteArray> list;
+			while(s.sent < target)
+			{
+				list += makePacket(s.sent % 10 == 0 ? DataProbe : Data, s.sent, now, size);
+				++s.sent;
+			}
+
+			if(!list.isEmpty())
+				ice->writeDatagrams(n, list);
+		}
+	}
+
+	void stopSending()
+	{
+		sendTimer->stop();
+
+		// give the peer's last packets and probe replies a chance to
+		//   arrive.  this also covers a peer that started a little later
+		QTimer::singleShot(2000, this, SLOT(finish()));
+	}
+
+	void finish()
+	{
+		report();
+		emit finished();
+	}
+};
+
 class App : public QObject
 {
 	Q_OBJECT
@@ -442,6 +656,12 @@ public:
 	StunServiceType opt_stunType;
 	QString opt_user, opt_pass;
 	bool opt_ipv6_only, opt_relay_udp_only, opt_relay_tcp_only;
+	bool opt_regular_nomination;
+	int opt_checks;
+	bool opt_bench;
+	QString opt_offerIn, opt_offerOut;
+	QString opt_path;
+	int opt_rate, opt_size, opt_duration;
 
 	XMPP::NameResolver dns;
 	QHostAddress stunAddr;
@@ -453,18 +673,23 @@ public:
 	IceBlockReader *reader;
 	EnterPrompt *prompt;
 	IceOffer inOffer;
+	QTimer *offerTimer;
+	IceBench *bench;
 
 	App() :
 		portReserver(this),
 		ice(0),
 		console(0),
 		reader(0),
-		prompt(0)
+		prompt(0),
+		offerTimer(0),
+		bench(0)
 	{
 	}
 
 	~App()
 	{
+		delete bench;
 		delete prompt;
 		delete reader;
 		delete console;
@@ -522,6 +747,16 @@ public:
 		{
 			Channel chan;
 
+			// in bench mode the data is generated here, not forwarded
+			if(opt_bench)
+			{
+				chan.sock6 = 0;
+				chan.sock4 = 0;
+				chan.ready = false;
+				channels += chan;
+				continue;
+			}
+
 			int port = opt_localBase + 32 + n;
 			chan.sock6 = setupSocket(QHostAddress::LocalHostIPv6, port);
 			chan.sock4 = setupSocket(QHostAddress::LocalHost, port);
@@ -629,6 +864,8 @@ public:
 
 		ice->setComponentCount(opt_channels);
 		ice->setLocalCandidateTrickle(false);
+		ice->setNomination(opt_regular_nomination ? XMPP::Ice176::RegularNomination : XMPP::Ice176::AggressiveNomination);
+		ice->setMaxChecksInFlight(opt_checks);
 
 		if(!stunAddr.isNull())
 		{
@@ -643,12 +880,26 @@ public:
 			printf("STUN service: %s\n", qPrintable(stunAddr.toString()));
 		}
 
-		if(opt_relay_udp_only)
+		if(opt_relay_udp_only || opt_path == "relay")
 		{
 			ice->setUseLocal(false);
 			ice->setUseStunBind(false);
 			ice->setUseStunRelayTcp(false);
 		}
+		else if(opt_path == "host")
+		{
+			ice->setUseStunBind(false);
+			ice->setUseStunRelayUdp(false);
+			ice->setUseStunRelayTcp(false);
+		}
+		else if(opt_path == "srflx")
+		{
+			// reflexive candidates are still gathered from the local
+			//   sockets, they just aren't offered as host candidates
+			ice->setUseLocal(false);
+			ice->setUseStunRelayUdp(false);
+			ice->setUseStunRelayTcp(false);
+		}
 
 		if(opt_mode == 0)
 			ice->start(XMPP::Ice176::Initiator);
@@ -705,6 +956,9 @@ private slots:
 
 	void ice_started()
 	{
+		if(opt_bench)
+			return;
+
 		if(channels.count() > 1)
 		{
 			printf("Local ports: %d-%d\n", opt_localBase, opt_localBase + channels.count() - 1);
@@ -735,6 +989,38 @@ private slots:
 		out.pass = ice->localPassword();
 		out.candidates = list;
 		QStringList block = iceblock_create(out);
+
+		if(opt_bench)
+		{
+			if(!opt_offerOut.isEmpty())
+			{
+				QFile file(opt_offerOut);
+				if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+				{
+					printf("Unable to write %s.\n", qPrintable(opt_offerOut));
+					emit quit();
+					return;
+				}
+
+				QTextStream ts(&file);
+				foreach(const QString &s, block)
+					ts << s << '\n';
+			}
+			else
+			{
+				foreach(const QString &s, block)
+					printf("%s\n", qPrintable(s));
+			}
+
+			// the peer may not have written its offer yet
+			printf("Waiting for peer ICE block in %s...\n", qPrintable(opt_offerIn));
+			offerTimer = new QTimer(this);
+			connect(offerTimer, SIGNAL(timeout()), SLOT(offerTimer_timeout()));
+			offerTimer->start(500);
+			offerTimer_timeout();
+			return;
+		}
+
 		foreach(const QString &s, block)
 			printf("%s\n", qPrintable(s));
 
@@ -765,6 +1051,17 @@ private slots:
 		if(allReady)
 		{
 			printf("Tunnel established!\n");
+
+			if(opt_bench && !bench)
+			{
+				bench = new IceBench(ice, channels.count(), this);
+				bench->rate = opt_rate;
+				bench->size = opt_size;
+				bench->duration = opt_duration;
+				bench->path = opt_path;
+				connect(bench, SIGNAL(finished()), SLOT(bench_finished()));
+				bench->start();
+			}
 		}
 	}
 
@@ -773,6 +1070,14 @@ private slots:
 		while(ice->hasPendingDatagrams(componentIndex))
 		{
 			QByteArray buf = ice->readDatagram(componentIndex);
+			if(opt_bench)
+			{
+				// the peer may start sending before we are ready
+				if(bench)
+					bench->processDatagram(componentIndex, buf);
+				continue;
+			}
+
 			if(channels[componentIndex].sock6)
 				channels[componentIndex].sock6->writeDatagram(buf, QHostAddress::LocalHostIPv6, opt_localBase + componentIndex);
 			if(channels[componentIndex].sock4)
@@ -826,6 +1131,42 @@ private slots:
 		ice->addRemoteCandidates(inOffer.candidates);
 	}
 
+	void offerTimer_timeout()
+	{
+		QFile file(opt_offerIn);
+		if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+			return;
+
+		QStringList lines;
+		QTextStream ts(&file);
+		while(!ts.atEnd())
+			lines += ts.readLine();
+
+		// partially written
+		if(lines.isEmpty() || lines.last() != "-----END ICE-----")
+			return;
+
+		delete offerTimer;
+		offerTimer = 0;
+
+		inOffer = iceblock_parse(lines);
+		if(inOffer.user.isEmpty())
+		{
+			printf("Error parsing ICE block.\n");
+			emit quit();
+			return;
+		}
+
+		ice->setPeerUfrag(inOffer.user);
+		ice->setPeerPassword(inOffer.pass);
+		ice->addRemoteCandidates(inOffer.candidates);
+	}
+
+	void bench_finished()
+	{
+		ice->stop();
+	}
+
 	void prompt_error()
 	{
 		delete prompt;
@@ -887,6 +1228,18 @@ void usage()
 	printf(" --ipv6-only         only use IPv6 network interface addresses\n");
 	printf(" --relay-udp-only    only offer UDP relay candidate\n");
 	printf(" --relay-tcp-only    only offer TCP relay candidate\n");
+	printf(" --nomination=[type] aggressive or regular (default=aggressive)\n");
+	printf(" --checks=[n]        max connectivity checks at once (default=0 (No limit))\n");
+	printf("\n");
+	printf("benchmark mode:\n");
+	printf(" --bench             send test datagrams and report instead of tunneling\n");
+	printf(" --offer-in=[file]   read peer ICE block from file, waiting for it (required)\n");
+	printf(" --offer-out=[file]  write local ICE block to file (default=stdout)\n");
+	printf(" --path=[type]       host, srflx, or relay (default=any)\n");
+	printf(" --rate=[n]          datagrams per second per channel (default=50)\n");
+	printf(" --size=[n]          datagram size (default=160)\n");
+	printf(" --duration=[n]      seconds to send for (default=10)\n");
+	printf("remove old offer files before each run, so that a stale block isn't used.\n");
 	printf("\n");
 }
 
@@ -908,6 +1261,14 @@ int main(int argc, char **argv)
 	bool ipv6_only = false;
 	bool relay_udp_only = false;
 	bool relay_tcp_only = false;
+	bool regular_nomination = false;
+	int checks = 0;
+	bool bench = false;
+	QString offerIn, offerOut;
+	QString path;
+	int rate = 50;
+	int size = 160;
+	int duration = 10;
 
 	for(int n = 0; n < args.count(); ++n)
 	{
@@ -970,6 +1331,41 @@ int main(int argc, char **argv)
 			relay_udp_only = true;
 		else if(var == "relay-tcp-only")
 			relay_tcp_only = true;
+		else if(var == "nomination")
+		{
+			if(val == "aggressive")
+				regular_nomination = false;
+			else if(val == "regular")
+				regular_nomination = true;
+			else
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if(var == "checks")
+			checks = val.toInt();
+		else if(var == "bench")
+			bench = true;
+		else if(var == "offer-in")
+			offerIn = val;
+		else if(var == "offer-out")
+			offerOut = val;
+		else if(var == "path")
+		{
+			if(val != "host" && val != "srflx" && val != "relay")
+			{
+				usage();
+				return 1;
+			}
+			path = val;
+		}
+		else if(var == "rate")
+			rate = val.toInt();
+		else if(var == "size")
+			size = val.toInt();
+		else if(var == "duration")
+			duration = val.toInt();
 		else
 			known = false;
 
@@ -995,6 +1391,30 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if(bench && offerIn.isEmpty())
+	{
+		fprintf(stderr, "Benchmark mode needs --offer-in.\n");
+		return 1;
+	}
+
+	if(rate < 1 || size < 1 || duration < 1)
+	{
+		usage();
+		return 1;
+	}
+
+	if(path == "srflx" && stunHost.isEmpty())
+	{
+		fprintf(stderr, "The srflx path needs --stunhost.\n");
+		return 1;
+	}
+
+	if(path == "relay" && (stunHost.isEmpty() || user.isEmpty()))
+	{
+		fprintf(stderr, "The relay path needs --stunhost and --user.\n");
+		return 1;
+	}
+
 	int mode = -1;
 	if(args[0] == "initiator")
 		mode = 0;
@@ -1026,6 +1446,15 @@ int main(int argc, char **argv)
 	app.opt_ipv6_only = ipv6_only;
 	app.opt_relay_udp_only = relay_udp_only;
 	app.opt_relay_tcp_only = relay_tcp_only;
+	app.opt_regular_nomination = regular_nomination;
+	app.opt_checks = checks;
+	app.opt_bench = bench;
+	app.opt_offerIn = offerIn;
+	app.opt_offerOut = offerOut;
+	app.opt_path = path;
+	app.opt_rate = rate;
+	app.opt_size = size;
+	app.opt_duration = duration;
 
 	QObject::connect(&app, SIGNAL(quit()), &qapp, SLOT(quit()));
 	QTimer::singleShot(0, &app, SLOT(start()));
@@ -870,6 +870,680 @@ private slots:
 	}
 };
 
+// print min/percentiles/max of a list of millisecond samples
+static void printLatency(const char *name, QList<int> samples)
+{
+	if(samples.isEmpty())
+	{
+		printf("%s: no samples\n", name);
+		return;
+	}
+
+	qSort(samples);
+	int last = samples.count() - 1;
+	printf("%s (ms): min=%d p50=%d p90=%d p99=%d max=%d (%d samples)\n", name,
+		samples[0], samples[last * 50 / 100], samples[last * 90 / 100],
+		samples[last * 99 / 100], samples[last], samples.count());
+}
+
+// encode/decode a typical binding response, with no sockets involved
+static void stunCodecBench(int msecs)
+{
+	// attribute types, from RFC 5389
+	const quint16 XOR_MAPPED_ADDRESS = 0x0020;
+	const quint16 SOFTWARE = 0x8022;
+	const quint8 magic[4] = { 0x21, 0x12, 0xA4, 0x42 };
+
+	quint8 id[12];
+	for(int n = 0; n < 12; ++n)
+		id[n] = n;
+
+	QList<StunMessage::Attribute> list;
+	StunMessage::Attribute attr;
+	attr.type = XOR_MAPPED_ADDRESS;
+	const char xaddr[8] = { 0x00, 0x01, 0x31, 0x5a, 0x5e, 0x12, (char)0xa4, 0x43 };
+	attr.value = QByteArray(xaddr, 8);
+	list += attr;
+	attr.type = SOFTWARE;
+	attr.value = "nettool (Iris)";
+	list += attr;
+
+	StunMessage msg;
+	msg.setClass(StunMessage::SuccessResponse);
+	msg.setMethod(0x001); // binding
+	msg.setMagic(magic);
+	msg.setId(id);
+	msg.setAttributes(list);
+
+	int flags = StunMessage::Fingerprint | StunMessage::MessageIntegrity;
+	QByteArray key = "nettool";
+
+	QByteArray packet;
+	int count = 0;
+	QTime time;
+	time.start();
+	do
+	{
+		packet = msg.toBinary(flags, key);
+		++count;
+	} while(time.elapsed() < msecs);
+	printf("encode: %d bytes, %.0f msgs/sec\n", packet.size(), count * 1000.0 / time.elapsed());
+
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		int vflags = (pass == 0) ? 0 : flags;
+		count = 0;
+		time.start();
+		do
+		{
+			StunMessage::ConvertResult result;
+			StunMessage out = StunMessage::fromBinary(packet, &result, vflags, key);
+			if(out.isNull() || result != StunMessage::ConvertGood)
+			{
+				printf("Error: decode failed\n");
+				return;
+			}
+			++count;
+		} while(time.elapsed() < msecs);
+		printf("decode%s: %.0f msgs/sec\n", (pass == 0) ? "" : " (validated)", count * 1000.0 / time.elapsed());
+	}
+}
+
+// runs bindings back to back through its own pool and socket
+class StunLoadWorker : public QObject
+{
+	Q_OBJECT
+public:
+	bool debug;
+	QHostAddress addr;
+	int port;
+	int count;
+	QUdpSocket *sock;
+	StunTransactionPool *pool;
+	StunBinding *binding;
+	QTime time;
+	int done, failed, sent;
+	QList<int> latencies;
+
+	StunLoadWorker(QObject *parent = 0) :
+		QObject(parent),
+		sock(0),
+		pool(0),
+		binding(0),
+		done(0),
+		failed(0),
+		sent(0)
+	{
+	}
+
+	~StunLoadWorker()
+	{
+		// make sure transactions are always deleted before the pool
+		delete binding;
+	}
+
+	// every binding sends one request, so anything more is a retransmit
+	int retransmits() const
+	{
+		return sent - (done + failed);
+	}
+
+public slots:
+	void start()
+	{
+		sock = new QUdpSocket(this);
+		connect(sock, SIGNAL(readyRead()), SLOT(sock_readyRead()));
+
+		pool = new StunTransactionPool(StunTransaction::Udp, this);
+		if(debug)
+		{
+			pool->setDebugLevel(StunTransactionPool::DL_Packet);
+			connect(pool, SIGNAL(debugLine(const QString &)), SLOT(pool_debugLine(const QString &)));
+		}
+		connect(pool, SIGNAL(outgoingMessage(const QByteArray &, const QHostAddress &, int)), SLOT(pool_outgoingMessage(const QByteArray &, const QHostAddress &, int)));
+
+		if(!sock->bind())
+		{
+			printf("Error binding to local port.\n");
+			failed = count;
+			emit finished();
+			return;
+		}
+
+		next();
+	}
+
+signals:
+	void finished();
+
+private slots:
+	void next()
+	{
+		delete binding;
+		binding = 0;
+
+		if(done + failed >= count)
+		{
+			emit finished();
+			return;
+		}
+
+		binding = new StunBinding(pool);
+		connect(binding, SIGNAL(success()), SLOT(binding_success()));
+		connect(binding, SIGNAL(error(XMPP::StunBinding::Error)), SLOT(binding_error(XMPP::StunBinding::Error)));
+		time.start();
+		binding->start();
+	}
+
+	void sock_readyRead()
+	{
+		while(sock->hasPendingDatagrams())
+		{
+			QByteArray buf(sock->pendingDatagramSize(), 0);
+			QHostAddress from;
+			quint16 fromPort;
+
+			sock->readDatagram(buf.data(), buf.size(), &from, &fromPort);
+			if(from == addr && fromPort == port)
+				pool->writeIncomingMessage(buf);
+		}
+	}
+
+	void pool_outgoingMessage(const QByteArray &packet, const QHostAddress &toAddress, int toPort)
+	{
+		Q_UNUSED(toAddress);
+		Q_UNUSED(toPort);
+
+		++sent;
+		sock->writeDatagram(packet, addr, port);
+	}
+
+	void pool_debugLine(const QString &line)
+	{
+		printf("%s\n", qPrintable(line));
+	}
+
+	void binding_success()
+	{
+		latencies += time.elapsed();
+		++done;
+
+		// the binding can't be deleted from its own signal
+		QTimer::singleShot(0, this, SLOT(next()));
+	}
+
+	void binding_error(XMPP::StunBinding::Error e)
+	{
+		Q_UNUSED(e);
+		if(debug)
+			printf("Error: %s\n", qPrintable(binding->errorString()));
+		++failed;
+		QTimer::singleShot(0, this, SLOT(next()));
+	}
+};
+
+class StunLoad : public QObject
+{
+	Q_OBJECT
+public:
+	bool debug;
+	QHostAddress addr;
+	int port;
+	int pools;
+	int count;
+	QList<StunLoadWorker*> workers;
+	int finished;
+	QTime time;
+
+	StunLoad() :
+		finished(0)
+	{
+	}
+
+	~StunLoad()
+	{
+		qDeleteAll(workers);
+	}
+
+public slots:
+	void start()
+	{
+		printf("Running %d binding(s) on each of %d pool(s) against %s;%d...\n", count, pools, qPrintable(addr.toString()), port);
+
+		time.start();
+		for(int n = 0; n < pools; ++n)
+		{
+			StunLoadWorker *w = new StunLoadWorker;
+			w->debug = debug;
+			w->addr = addr;
+			w->port = port;
+			w->count = count;
+			connect(w, SIGNAL(finished()), SLOT(worker_finished()));
+			workers += w;
+		}
+
+		// start the workers only after the list is complete, in case one
+		//   finishes right away
+		foreach(StunLoadWorker *w, workers)
+			w->start();
+	}
+
+signals:
+	void quit();
+
+private slots:
+	void worker_finished()
+	{
+		if(++finished < workers.count())
+			return;
+
+		int elapsed = qMax(time.elapsed(), 1);
+		int done = 0;
+		int failed = 0;
+		int sent = 0;
+		int retransmits = 0;
+		QList<int> latencies;
+		foreach(StunLoadWorker *w, workers)
+		{
+			done += w->done;
+			failed += w->failed;
+			sent += w->sent;
+			retransmits += w->retransmits();
+			latencies += w->latencies;
+		}
+
+		printf("Bindings: %d succeeded, %d failed, in %d ms (%.1f/sec)\n", done, failed, elapsed, done * 1000.0 / elapsed);
+		printf("Requests sent: %d, retransmits: %d\n", sent, retransmits);
+		printLatency("Transaction latency", latencies);
+		emit quit();
+	}
+};
+
+// one UDP TURN allocation, sending paced packets to a peer that echoes
+//   them back.  each packet carries a sequence number and a send time.
+class TurnLoadWorker : public QObject
+{
+	Q_OBJECT
+public:
+	bool debug;
+	QHostAddress relayAddr;
+	int relayPort;
+	QString relayUser, relayPass, relayRealm;
+	QHostAddress peerAddr;
+	int peerPort;
+	int packets;
+	int size;
+	int rate; // packets per second
+	const QTime *clock; // shared by all workers
+
+	QUdpSocket *udp;
+	StunTransactionPool *pool;
+	QList<bool> writeItems; // true = turn-originated, false = external
+	TurnClient *turn;
+	QTimer *sendTimer;
+
+	int startedAt;
+	int sendStartedAt;
+	int allocLatency; // -1 if not activated
+	int sent, received, controlSent;
+	qint64 bytesReceived;
+	int lastReceivedAt;
+	QList<int> rtts;
+	QString errorString;
+	bool isFinished;
+
+	TurnLoadWorker(QObject *parent = 0) :
+		QObject(parent),
+		udp(0),
+		pool(0),
+		turn(0),
+		sendTimer(0),
+		allocLatency(-1),
+		sent(0),
+		received(0),
+		controlSent(0),
+		bytesReceived(0),
+		lastReceivedAt(-1),
+		isFinished(false)
+	{
+	}
+
+	~TurnLoadWorker()
+	{
+		// make sure transactions are always deleted before the pool
+		delete turn;
+	}
+
+public slots:
+	void start()
+	{
+		turn = new TurnClient(this);
+		if(debug)
+		{
+			turn->setDebugLevel(TurnClient::DL_Packet);
+			connect(turn, SIGNAL(debugLine(const QString &)), SLOT(turn_debugLine(const QString &)));
+		}
+
+		connect(turn, SIGNAL(closed()), SLOT(turn_closed()));
+		connect(turn, SIGNAL(activated()), SLOT(turn_activated()));
+		connect(turn, SIGNAL(error(XMPP::TurnClient::Error)), SLOT(turn_error(XMPP::TurnClient::Error)));
+		connect(turn, SIGNAL(outgoingDatagram(const QByteArray &)), SLOT(turn_outgoingDatagram(const QByteArray &)));
+
+		turn->setClientSoftwareNameAndVersion("nettool (Iris)");
+
+		udp = new QUdpSocket(this);
+		connect(udp, SIGNAL(readyRead()), SLOT(udp_readyRead()));
+
+		// QUdpSocket bytesWritten is not DOR-DS safe, so we queue
+		connect(udp, SIGNAL(bytesWritten(qint64)), SLOT(udp_bytesWritten(qint64)),
+			Qt::QueuedConnection);
+
+		pool = new StunTransactionPool(StunTransaction::Udp, this);
+		if(debug)
+		{
+			pool->setDebugLevel(StunTransactionPool::DL_Packet);
+			connect(pool, SIGNAL(debugLine(const QString &)), SLOT(turn_debugLine(const QString &)));
+		}
+		connect(pool, SIGNAL(outgoingMessage(const QByteArray &, const QHostAddress &, int)), SLOT(pool_outgoingMessage(const QByteArray &, const QHostAddress &, int)));
+		connect(pool, SIGNAL(needAuthParams()), SLOT(pool_needAuthParams()));
+
+		// there is no prompting with many allocations at once, so
+		//   credentials must be provided up front
+		pool->setLongTermAuthEnabled(true);
+		if(!relayUser.isEmpty())
+		{
+			pool->setUsername(relayUser);
+			pool->setPassword(relayPass.toUtf8());
+			if(!relayRealm.isEmpty())
+				pool->setRealm(relayRealm);
+		}
+
+		sendTimer = new QTimer(this);
+		connect(sendTimer, SIGNAL(timeout()), SLOT(sendTimer_timeout()));
+		sendTimer->setInterval(10);
+
+		if(!udp->bind())
+		{
+			fail("Error binding to local port.");
+			return;
+		}
+
+		startedAt = clock->elapsed();
+		turn->connectToHost(pool);
+	}
+
+	void stop()
+	{
+		if(!turn || isFinished)
+			return;
+
+		sendTimer->stop();
+		turn->close();
+	}
+
+signals:
+	void finished();
+
+private:
+	// a failed allocation may still emit closed() or error() later
+	void finish()
+	{
+		if(isFinished)
+			return;
+
+		isFinished = true;
+		if(sendTimer)
+			sendTimer->stop();
+		emit finished();
+	}
+
+	void fail(const QString &str)
+	{
+		errorString = str;
+		finish();
+	}
+
+	void processDatagram(const QByteArray &buf)
+	{
+		QHostAddress fromAddr;
+		int fromPort;
+
+		bool notStun;
+		if(!pool->writeIncomingMessage(buf, &notStun))
+		{
+			QByteArray data = turn->processIncomingDatagram(buf, notStun, &fromAddr, &fromPort);
+			if(data.size() >= 8)
+			{
+				QDataStream in(data);
+				qint32 seq, sentAt;
+				in >> seq >> sentAt;
+				Q_UNUSED(seq);
+
+				lastReceivedAt = clock->elapsed();
+				rtts += lastReceivedAt - sentAt;
+				++received;
+				bytesReceived += data.size();
+			}
+		}
+	}
+
+private slots:
+	void udp_readyRead()
+	{
+		while(udp->hasPendingDatagrams())
+		{
+			QByteArray buf(udp->pendingDatagramSize(), 0);
+			QHostAddress from;
+			quint16 fromPort;
+
+			udp->readDatagram(buf.data(), buf.size(), &from, &fromPort);
+			if(from == relayAddr && fromPort == relayPort)
+				processDatagram(buf);
+		}
+	}
+
+	void udp_bytesWritten(qint64 bytes)
+	{
+		Q_UNUSED(bytes);
+		bool wasTurnOriginated = writeItems.takeFirst();
+		if(wasTurnOriginated)
+			turn->outgoingDatagramsWritten(1);
+	}
+
+	void pool_outgoingMessage(const QByteArray &packet, const QHostAddress &toAddress, int toPort)
+	{
+		Q_UNUSED(toAddress);
+		Q_UNUSED(toPort);
+
+		++controlSent;
+		writeItems += false;
+		udp->writeDatagram(packet, relayAddr, relayPort);
+	}
+
+	void pool_needAuthParams()
+	{
+		fail("Server requires credentials, use --user and --pass.");
+	}
+
+	void sendTimer_timeout()
+	{
+		// catch up to where the rate says we should be
+		int elapsed = clock->elapsed() - sendStartedAt;
+		int target = qMin(packets, (int)((qint64)rate * elapsed / 1000) + 1);
+		while(sent < target)
+		{
+			QByteArray buf(qMax(size, 8), 0);
+			QDataStream out(&buf, QIODevice::WriteOnly);
+			out << (qint32)sent << (qint32)clock->elapsed();
+			turn->write(buf, peerAddr, peerPort);
+			++sent;
+		}
+
+		if(sent >= packets)
+		{
+			sendTimer->stop();
+
+			// give the last echoes a chance to come back
+			QTimer::singleShot(2000, this, SLOT(stop()));
+		}
+	}
+
+	void turn_activated()
+	{
+		allocLatency = clock->elapsed() - startedAt;
+
+		turn->addChannelPeer(peerAddr, peerPort);
+
+		sendStartedAt = clock->elapsed();
+		sendTimer->start();
+	}
+
+	void turn_closed()
+	{
+		finish();
+	}
+
+	void turn_error(XMPP::TurnClient::Error e)
+	{
+		Q_UNUSED(e);
+		fail(turn->errorString());
+	}
+
+	void turn_outgoingDatagram(const QByteArray &buf)
+	{
+		writeItems += true;
+		udp->writeDatagram(buf, relayAddr, relayPort);
+	}
+
+	void turn_debugLine(const QString &line)
+	{
+		printf("%s\n", qPrintable(line));
+	}
+};
+
+class TurnLoad : public QObject
+{
+	Q_OBJECT
+public:
+	bool debug;
+	QHostAddress relayAddr;
+	int relayPort;
+	QString relayUser, relayPass, relayRealm;
+	QHostAddress peerAddr;
+	int peerPort;
+	int allocations;
+	int packets;
+	int size;
+	int rate;
+	QList<TurnLoadWorker*> workers;
+	int finished;
+	QTime clock;
+
+	TurnLoad() :
+		finished(0)
+	{
+	}
+
+	~TurnLoad()
+	{
+		qDeleteAll(workers);
+	}
+
+public slots:
+	void start()
+	{
+		connect(ProcessQuit::instance(), SIGNAL(quit()), SLOT(do_quit()));
+
+		printf("Relaying %d packet(s) of %d bytes at %d/sec on each of %d allocation(s) to %s;%d...\n",
+			packets, size, rate, allocations, qPrintable(peerAddr.toString()), peerPort);
+
+		clock.start();
+		for(int n = 0; n < allocations; ++n)
+		{
+			TurnLoadWorker *w = new TurnLoadWorker;
+			w->debug = debug;
+			w->relayAddr = relayAddr;
+			w->relayPort = relayPort;
+			w->relayUser = relayUser;
+			w->relayPass = relayPass;
+			w->relayRealm = relayRealm;
+			w->peerAddr = peerAddr;
+			w->peerPort = peerPort;
+			w->packets = packets;
+			w->size = size;
+			w->rate = rate;
+			w->clock = &clock;
+			connect(w, SIGNAL(finished()), SLOT(worker_finished()));
+			workers += w;
+		}
+
+		foreach(TurnLoadWorker *w, workers)
+			w->start();
+	}
+
+signals:
+	void quit();
+
+private slots:
+	void do_quit()
+	{
+		ProcessQuit::cleanup();
+
+		foreach(TurnLoadWorker *w, workers)
+			w->stop();
+	}
+
+	void worker_finished()
+	{
+		if(++finished < workers.count())
+			return;
+
+		int activated = 0;
+		int sent = 0;
+		int received = 0;
+		int controlSent = 0;
+		qint64 bytes = 0;
+		int firstSend = -1;
+		int lastReceive = -1;
+		QList<int> allocLatencies;
+		QList<int> rtts;
+		foreach(TurnLoadWorker *w, workers)
+		{
+			if(!w->errorString.isEmpty())
+				printf("Error: %s\n", qPrintable(w->errorString));
+			if(w->allocLatency == -1)
+				continue;
+
+			++activated;
+			allocLatencies += w->allocLatency;
+			sent += w->sent;
+			received += w->received;
+			controlSent += w->controlSent;
+			bytes += w->bytesReceived;
+			rtts += w->rtts;
+			if(firstSend == -1 || w->sendStartedAt < firstSend)
+				firstSend = w->sendStartedAt;
+			if(w->lastReceivedAt > lastReceive)
+				lastReceive = w->lastReceivedAt;
+		}
+
+		printf("Allocations: %d of %d activated\n", activated, workers.count());
+		printLatency("Allocation latency", allocLatencies);
+		printf("STUN control messages sent: %d\n", controlSent);
+		if(sent > 0)
+		{
+			printf("Packets: %d sent, %d echoed (%.2f%% loss)\n", sent, received, (sent - received) * 100.0 / sent);
+			if(received > 0)
+			{
+				int elapsed = qMax(lastReceive - firstSend, 1);
+				printf("Relayed goodput: %.1f kbit/s (%.1f packets/sec)\n", bytes * 8.0 / elapsed, received * 1000.0 / elapsed);
+			}
+			printLatency("Echo round trip", rtts);
+		}
+		emit quit();
+	}
+};
+
 void usage()
 {
 	printf("nettool: simple testing utility\n");
@@ -887,6 +1561,9 @@ void usage()
 	printf(" pserv [inst] [type] [port] (attr) (-a [rec])      publish service instance\n");
 	printf(" stun [addr](;port) (local port)                   STUN binding\n");
 	printf(" turn [mode] [relayaddr](;port) [peeraddr](;port)  TURN UDP echo test\n");
+	printf(" stunbench (msecs)                                 STUN encode/decode speed\n");
+	printf(" stunload [addr](;port) [pools] (count)            STUN binding load test\n");
+	printf(" turnload [relayaddr](;port) [peeraddr](;port) [n] TURN UDP allocation load test\n");
 	printf("\n");
 	printf("record types: a aaaa ptr srv mx txt hinfo null\n");
 	printf("service types: _service._proto format (e.g. \"_xmpp-client._tcp\")\n");
@@ -894,6 +1571,9 @@ void usage()
 	printf("rname -r: for null type, dump raw record data to stdout\n");
 	printf("pserv -a: add extra record.  format: null:filename.dat\n");
 	printf("turn modes: udp tcp tcp-tls\n");
+	printf("stunload: count is bindings per pool (default = 100)\n");
+	printf("turnload: [n] may be followed by (packets) (size) (rate), per allocation\n");
+	printf("  (default = 1000 160 50).  the peer should echo packets back.\n");
 	printf("\n");
 }
 
@@ -1280,6 +1960,163 @@ int main(int argc, char **argv)
 		QTimer::singleShot(0, &a, SLOT(start()));
 		qapp.exec();
 	}
+	else if(args[0] == "stunbench")
+	{
+		int msecs = 1000;
+		if(args.count() >= 2)
+			msecs = args[1].toInt();
+		if(msecs <= 0)
+		{
+			usage();
+			return 1;
+		}
+
+		stunCodecBench(msecs);
+	}
+	else if(args[0] == "stunload")
+	{
+		if(args.count() < 3)
+		{
+			usage();
+			return 1;
+		}
+
+		QString addrstr, portstr;
+		int x = args[1].indexOf(';');
+		if(x != -1)
+		{
+			addrstr = args[1].mid(0, x);
+			portstr = args[1].mid(x + 1);
+		}
+		else
+			addrstr = args[1];
+
+		QHostAddress addr = QHostAddress(addrstr);
+		if(addr.isNull())
+		{
+			printf("Error: addr must be an IP address\n");
+			return 1;
+		}
+
+		int port = 3478;
+		if(!portstr.isEmpty())
+			port = portstr.toInt();
+
+		int pools = args[2].toInt();
+		int count = 100;
+		if(args.count() >= 4)
+			count = args[3].toInt();
+		if(pools <= 0 || count <= 0)
+		{
+			usage();
+			return 1;
+		}
+
+		if(!QCA::isSupported("hmac(sha1)"))
+		{
+			printf("Error: Need hmac(sha1) support to use STUN.\n");
+			return 1;
+		}
+
+		StunLoad a;
+		a.debug = debug;
+		a.addr = addr;
+		a.port = port;
+		a.pools = pools;
+		a.count = count;
+		QObject::connect(&a, SIGNAL(quit()), &qapp, SLOT(quit()));
+		QTimer::singleShot(0, &a, SLOT(start()));
+		qapp.exec();
+	}
+	else if(args[0] == "turnload")
+	{
+		if(args.count() < 4)
+		{
+			usage();
+			return 1;
+		}
+
+		QString addrstr, portstr;
+		int x = args[1].indexOf(';');
+		if(x != -1)
+		{
+			addrstr = args[1].mid(0, x);
+			portstr = args[1].mid(x + 1);
+		}
+		else
+			addrstr = args[1];
+
+		QHostAddress raddr = QHostAddress(addrstr);
+		if(raddr.isNull())
+		{
+			printf("Error: relayaddr must be an IP address\n");
+			return 1;
+		}
+
+		int rport = 3478;
+		if(!portstr.isEmpty())
+			rport = portstr.toInt();
+
+		portstr.clear();
+		x = args[2].indexOf(';');
+		if(x != -1)
+		{
+			addrstr = args[2].mid(0, x);
+			portstr = args[2].mid(x + 1);
+		}
+		else
+			addrstr = args[2];
+
+		QHostAddress paddr = QHostAddress(addrstr);
+		if(paddr.isNull())
+		{
+			printf("Error: peeraddr must be an IP address\n");
+			return 1;
+		}
+
+		int pport = 4588;
+		if(!portstr.isEmpty())
+			pport = portstr.toInt();
+
+		int allocations = args[3].toInt();
+		int packets = 1000;
+		int size = 160;
+		int rate = 50;
+		if(args.count() >= 5)
+			packets = args[4].toInt();
+		if(args.count() >= 6)
+			size = args[5].toInt();
+		if(args.count() >= 7)
+			rate = args[6].toInt();
+		if(allocations <= 0 || packets <= 0 || size <= 0 || rate <= 0)
+		{
+			usage();
+			return 1;
+		}
+
+		if(!QCA::isSupported("hmac(sha1)"))
+		{
+			printf("Error: Need hmac(sha1) support to use TURN.\n");
+			return 1;
+		}
+
+		TurnLoad a;
+		a.debug = debug;
+		a.relayAddr = raddr;
+		a.relayPort = rport;
+		a.relayUser = user;
+		a.relayPass = pass;
+		a.relayRealm = realm;
+		a.peerAddr = paddr;
+		a.peerPort = pport;
+		a.allocations = allocations;
+		a.packets = packets;
+		a.size = size;
+		a.rate = rate;
+		QObject::connect(&a, SIGNAL(quit()), &qapp, SLOT(quit()));
+		QTimer::singleShot(0, &a, SLOT(start()));
+		qapp.exec();
+	}
 	else
 	{
 		usage();
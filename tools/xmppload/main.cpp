@@ -0,0 +1,707 @@
+/*
+ * xmppload - log in many XMPP clients at once and measure them
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <QCoreApplication>
+#include <QHash>
+#include <QStringList>
+#include <QTimer>
+#include <QtCrypto>
+#include <iris/xmpp_statistics.h>
+#include "xmpp.h"
+#include "im.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef Q_OS_UNIX
+# include <sys/resource.h>
+#endif
+
+// rates are paced on this tick
+#define TICK_MSECS 10
+
+// clients still logging in this long after the last one was started are
+//   given up on
+#define LOGIN_TIMEOUT 30000
+
+using namespace XMPP;
+
+// peak resident set size of the process in KB, or -1 if unknown
+static qint64 memoryHighWater()
+{
+#ifdef Q_OS_UNIX
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0)
+		return -1;
+# ifdef Q_OS_MAC
+	return ru.ru_maxrss / 1024; // bytes there
+# else
+	return ru.ru_maxrss;
+# endif
+#else
+	return -1;
+#endif
+}
+
+// user and system time of the process in usecs, or -1 if unknown
+static qint64 cpuTime()
+{
+#ifdef Q_OS_UNIX
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0)
+		return -1;
+	return qint64(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#else
+	return -1;
+#endif
+}
+
+static qint64 percentile(const QList<qint64> &sorted, int p)
+{
+	if(sorted.isEmpty())
+		return 0;
+	return sorted[qMin(sorted.count() - 1, sorted.count() * p / 100)];
+}
+
+static void reportTimes(const char *name, QList<qint64> list)
+{
+	if(list.isEmpty())
+	{
+		printf("%s: no samples\n", name);
+		return;
+	}
+
+	qSort(list);
+	printf("%s: %d samples, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", name, list.count(),
+		percentile(list, 50) / 1000.0, percentile(list, 90) / 1000.0, percentile(list, 99) / 1000.0, list.last() / 1000.0);
+}
+
+// spreads events evenly over the ticks, at 'rate' per second
+class Pacer
+{
+public:
+	double rate;
+
+	Pacer() : rate(0), owed(0), last(0)
+	{
+	}
+
+	void start(qint64 now)
+	{
+		owed = 0;
+		last = now;
+	}
+
+	int due(qint64 now)
+	{
+		owed += rate * (now - last) / 1000000;
+		last = now;
+		int n = (int)owed;
+		owed -= n;
+		return n;
+	}
+
+private:
+	double owed;
+	qint64 last;
+};
+
+class Options
+{
+public:
+	QString host;
+	int port;
+	QString jid; // %1 is the client number
+	QString pass;
+	int clients;
+	double loginRate, messageRate, presenceRate;
+	int payload;
+	int duration; // seconds
+	bool tls, ssl, allowPlain;
+
+	Options() : port(0), clients(1), loginRate(10), messageRate(10), presenceRate(0), payload(100), duration(30), tls(true), ssl(false), allowPlain(false)
+	{
+	}
+};
+
+class Load;
+
+// one account.  messages go to its own full jid, so that the server
+//   routes them back, and the time until they arrive is the round trip
+class LoadClient : public QObject
+{
+	Q_OBJECT
+
+public:
+	enum State { Idle, LoggingIn, Active, Failed };
+
+	Load *load;
+	Jid jid;
+	State state;
+	qint64 startedAt;
+	AdvancedConnector *conn;
+	QCA::TLS *tls;
+	QCATLSHandler *tlsHandler;
+	ClientStream *stream;
+	Client *client;
+	QHash<QString, qint64> outstanding; // message id -> when sent
+	int nextId;
+
+	LoadClient(Load *_load, const Jid &_jid);
+	~LoadClient();
+
+	void start();
+	void sendMessage(const QString &body);
+	void sendPresence(const QString &text);
+
+private slots:
+	void tls_handshaken();
+	void cs_needAuthParams(bool user, bool pass, bool realm);
+	void cs_authenticated();
+	void cs_warning(int);
+	void cs_error(int);
+	void cs_connectionClosed();
+	void client_messageReceived(const Message &m);
+
+private:
+	void fail(const QString &reason);
+};
+
+class Load : public QObject
+{
+	Q_OBJECT
+
+public:
+	Options o;
+	QList<LoadClient*> clients;
+	QList<LoadClient*> active;
+	int started, finished;
+	QList<qint64> loginTimes, roundTrips;
+	QHash<QString, int> failures; // reason -> count
+	bool traffic;
+	int next; // round robin over the active clients
+	qint64 messagesSent, presencesSent;
+
+	Load(const Options &_o) : o(_o), started(0), finished(0), traffic(false), next(0), messagesSent(0), presencesSent(0),
+		memoryBefore(-1), memoryLoggedIn(-1), cpuBefore(-1)
+	{
+		clock.start();
+
+		connect(&tick, SIGNAL(timeout()), SLOT(doTick()));
+		loginDeadline.setSingleShot(true);
+		connect(&loginDeadline, SIGNAL(timeout()), SLOT(startTraffic()));
+		endTimer.setSingleShot(true);
+		connect(&endTimer, SIGNAL(timeout()), SLOT(finish()));
+
+		body.fill('x', o.payload);
+		logins.rate = o.loginRate;
+		messages.rate = o.messageRate;
+		presences.rate = o.presenceRate;
+	}
+
+	~Load()
+	{
+		qDeleteAll(clients);
+	}
+
+	qint64 now() const
+	{
+		return clock.usecsElapsed();
+	}
+
+	void start()
+	{
+		printf("%d clients, %.1f logins/sec; then %.1f messages/sec and %.1f presences/sec of %d bytes, for %d sec\n",
+			o.clients, o.loginRate, o.messageRate, o.presenceRate, o.payload, o.duration);
+
+		memoryBefore = memoryHighWater();
+		logins.start(now());
+		tick.start(TICK_MSECS);
+	}
+
+	void loggedIn(LoadClient *c)
+	{
+		loginTimes += now() - c->startedAt;
+		active += c;
+		loginDone();
+	}
+
+	void failed(LoadClient *c, const QString &reason)
+	{
+		++failures[reason];
+		if(active.removeAll(c) == 0 && !traffic)
+			loginDone();
+	}
+
+	void roundTrip(qint64 usecs)
+	{
+		roundTrips += usecs;
+	}
+
+private slots:
+	void doTick()
+	{
+		qint64 t = now();
+
+		if(started < o.clients)
+		{
+			int n = qMin(logins.due(t), o.clients - started);
+			for(int i = 0; i < n; ++i)
+				startClient();
+			if(started == o.clients)
+				loginDeadline.start(LOGIN_TIMEOUT);
+		}
+
+		if(!traffic || active.isEmpty())
+			return;
+
+		int n = messages.due(t);
+		for(int i = 0; i < n; ++i)
+		{
+			nextActive()->sendMessage(body);
+			++messagesSent;
+		}
+
+		n = presences.due(t);
+		for(int i = 0; i < n; ++i)
+		{
+			nextActive()->sendPresence(QString::number(presencesSent));
+			++presencesSent;
+		}
+	}
+
+	void startTraffic()
+	{
+		if(traffic)
+			return;
+		traffic = true;
+		loginDeadline.stop();
+
+		foreach(LoadClient *c, clients)
+		{
+			if(c->state == LoadClient::LoggingIn)
+			{
+				c->state = LoadClient::Failed;
+				++failures["login timed out"];
+			}
+		}
+
+		printf("%d of %d clients logged in\n", active.count(), o.clients);
+		reportTimes("login", loginTimes);
+		memoryLoggedIn = memoryHighWater();
+
+		if(active.isEmpty())
+		{
+			finish();
+			return;
+		}
+
+		cpuBefore = cpuTime();
+		totalsBefore = totals();
+		messages.start(now());
+		presences.start(now());
+		endTimer.start(o.duration * 1000);
+	}
+
+	void finish()
+	{
+		tick.stop();
+		endTimer.stop();
+
+		qint64 cpu = cpuTime() - cpuBefore;
+		StreamStatistics after = totals();
+
+		if(traffic && !active.isEmpty())
+		{
+			qint64 lost = 0;
+			foreach(LoadClient *c, clients)
+				lost += c->outstanding.count();
+
+			printf("sent %lld messages and %lld presences, %lld messages not back\n", messagesSent, presencesSent, lost);
+			reportTimes("round trip", roundTrips);
+
+			qint64 stanzas = (after.stanzasIn - totalsBefore.stanzasIn) + (after.stanzasOut - totalsBefore.stanzasOut);
+			if(cpuBefore >= 0 && stanzas > 0)
+				printf("cpu: %lld ms for %lld stanzas in and out, %.1f us/stanza\n", cpu / 1000, stanzas, (double)cpu / stanzas);
+		}
+
+		// what iris itself spends, over all the streams and the whole run
+		if(after.parseTime.samples > 0)
+			printf("parse: %.1f us/element, serialize: %.1f us/element\n", (double)after.parseTime.sum / after.parseTime.samples,
+				after.serializeTime.samples > 0 ? (double)after.serializeTime.sum / after.serializeTime.samples : 0);
+		printf("wire bytes: %lld in, %lld out\n", after.wireBytesIn, after.wireBytesOut);
+
+		if(memoryBefore >= 0 && !loginTimes.isEmpty())
+			printf("memory high-water: %lld KB, %lld KB per logged in client\n", memoryLoggedIn,
+				(memoryLoggedIn - memoryBefore) / loginTimes.count());
+
+		int failCount = 0;
+		QHashIterator<QString, int> it(failures);
+		while(it.hasNext())
+		{
+			it.next();
+			printf("failed: %d x %s\n", it.value(), qPrintable(it.key()));
+			failCount += it.value();
+		}
+
+		QCoreApplication::exit(failCount > 0 || active.isEmpty() ? 1 : 0);
+	}
+
+private:
+	StatisticsTimer clock;
+	QTimer tick, loginDeadline, endTimer;
+	Pacer logins, messages, presences;
+	QString body;
+	qint64 memoryBefore, memoryLoggedIn;
+	qint64 cpuBefore;
+	StreamStatistics totalsBefore;
+
+	void startClient()
+	{
+		++started;
+		QString s = o.jid;
+		if(s.contains("%1"))
+			s = s.arg(started);
+		else
+			s += "/load" + QString::number(started);
+
+		LoadClient *c = new LoadClient(this, Jid(s));
+		clients += c;
+		c->start();
+	}
+
+	void loginDone()
+	{
+		++finished;
+		if(finished == o.clients)
+			startTraffic();
+	}
+
+	LoadClient *nextActive()
+	{
+		if(next >= active.count())
+			next = 0;
+		return active[next++];
+	}
+
+	StreamStatistics totals() const
+	{
+		StreamStatistics t;
+		foreach(LoadClient *c, clients)
+		{
+			StreamStatistics s = c->stream->statistics();
+			t.stanzasIn += s.stanzasIn;
+			t.stanzasOut += s.stanzasOut;
+			t.wireBytesIn += s.wireBytesIn;
+			t.wireBytesOut += s.wireBytesOut;
+			t.parseTime.merge(s.parseTime);
+			t.serializeTime.merge(s.serializeTime);
+		}
+		return t;
+	}
+};
+
+LoadClient::LoadClient(Load *_load, const Jid &_jid) :
+	load(_load),
+	jid(_jid),
+	state(Idle),
+	startedAt(0),
+	nextId(0)
+{
+	conn = new AdvancedConnector;
+	if(!load->o.host.isEmpty())
+		conn->setOptHostPort(load->o.host, load->o.port);
+	conn->setOptSSL(load->o.ssl);
+
+	if((load->o.tls || load->o.ssl) && QCA::isSupported("tls"))
+	{
+		tls = new QCA::TLS;
+		tlsHandler = new QCATLSHandler(tls);
+		connect(tlsHandler, SIGNAL(tlsHandshaken()), SLOT(tls_handshaken()));
+	}
+	else
+	{
+		tls = 0;
+		tlsHandler = 0;
+	}
+
+	stream = new ClientStream(conn, tlsHandler);
+	stream->setAllowPlain(load->o.allowPlain ? ClientStream::AllowPlain : ClientStream::NoAllowPlain);
+	connect(stream, SIGNAL(needAuthParams(bool, bool, bool)), SLOT(cs_needAuthParams(bool, bool, bool)));
+	connect(stream, SIGNAL(authenticated()), SLOT(cs_authenticated()));
+	connect(stream, SIGNAL(warning(int)), SLOT(cs_warning(int)));
+	connect(stream, SIGNAL(error(int)), SLOT(cs_error(int)));
+	connect(stream, SIGNAL(connectionClosed()), SLOT(cs_connectionClosed()));
+
+	client = new Client;
+	connect(client, SIGNAL(messageReceived(const Message &)), SLOT(client_messageReceived(const Message &)));
+}
+
+LoadClient::~LoadClient()
+{
+	delete client;
+	delete stream;
+	delete tls; // this destroys the TLSHandler also
+	delete conn;
+}
+
+void LoadClient::start()
+{
+	state = LoggingIn;
+	startedAt = load->now();
+	client->connectToServer(stream, jid);
+}
+
+void LoadClient::sendMessage(const QString &body)
+{
+	QString id = "load" + QString::number(nextId++);
+	outstanding.insert(id, load->now());
+
+	Message m(client->jid());
+	m.setType("chat");
+	m.setId(id);
+	m.setBody(body);
+	client->sendMessage(m);
+}
+
+void LoadClient::sendPresence(const QString &text)
+{
+	client->setPresence(Status("", text));
+}
+
+void LoadClient::tls_handshaken()
+{
+	// load testing, the certificate isn't checked
+	tlsHandler->continueAfterHandshake();
+}
+
+void LoadClient::cs_needAuthParams(bool user, bool pass, bool realm)
+{
+	if(user)
+		stream->setUsername(jid.node());
+	if(pass)
+		stream->setPassword(load->o.pass);
+	if(realm)
+		stream->setRealm(jid.domain());
+	stream->continueAfterParams();
+}
+
+void LoadClient::cs_authenticated()
+{
+	// given up on already
+	if(state != LoggingIn)
+		return;
+
+	// the resource is the one the server bound
+	Jid j = stream->jid();
+	client->start(j.domain(), j.node(), load->o.pass, j.resource());
+	client->setPresence(Status());
+
+	state = Active;
+	load->loggedIn(this);
+}
+
+void LoadClient::cs_warning(int warn)
+{
+	Q_UNUSED(warn);
+	stream->continueAfterWarning();
+}
+
+void LoadClient::cs_error(int err)
+{
+	QString s;
+	if(err == ClientStream::ErrConnection)
+		s = "connection error";
+	else if(err == ClientStream::ErrAuth)
+		s = "authentication failed";
+	else if(err == ClientStream::ErrTLS)
+		s = "tls error";
+	else if(err == ClientStream::ErrStream)
+		s = QString("stream error %1").arg(stream->errorCondition());
+	else if(err == ClientStream::ErrNeg)
+		s = QString("negotiation error %1").arg(stream->errorCondition());
+	else
+		s = QString("error %1").arg(err);
+	fail(s);
+}
+
+void LoadClient::cs_connectionClosed()
+{
+	fail("closed by the server");
+}
+
+void LoadClient::client_messageReceived(const Message &m)
+{
+	QHash<QString, qint64>::Iterator it = outstanding.find(m.id());
+	if(it == outstanding.end())
+		return;
+
+	load->roundTrip(load->now() - it.value());
+	outstanding.erase(it);
+}
+
+void LoadClient::fail(const QString &reason)
+{
+	if(state == Failed)
+		return;
+	state = Failed;
+	load->failed(this, reason);
+}
+
+void usage()
+{
+	printf("xmppload: log in many XMPP clients at once and measure them\n");
+	printf("usage: xmppload --jid=[jid] --pass=[password] (options)\n");
+	printf("\n");
+	printf(" --jid=[jid]            %%1 is replaced by the client number, from 1.  without it,\n");
+	printf("                        all clients use the account, with resources load1, load2, ...\n");
+	printf(" --pass=[password]      the same for all clients\n");
+	printf(" --server=[host:port]   connect here instead of looking up the domain\n");
+	printf(" --clients=[n]          (default=1)\n");
+	printf(" --login-rate=[n]       clients started per second (default=10)\n");
+	printf(" --message-rate=[n]     messages per second, over all clients (default=10)\n");
+	printf(" --presence-rate=[n]    presence changes per second, over all clients (default=0)\n");
+	printf(" --payload=[n]          message body size in bytes (default=100)\n");
+	printf(" --duration=[n]         seconds of traffic once all are logged in (default=30)\n");
+	printf(" --tls=[mode]           starttls, ssl or none (default=starttls)\n");
+	printf(" --allow-plain          allow plaintext authentication\n");
+	printf("\n");
+	printf("every client sends messages to itself, so the time until they come back is the\n");
+	printf("round trip through the server. certificates are not checked. reports login\n");
+	printf("latency, round trips, and cpu per stanza of this process during the traffic.\n");
+	printf("exits with 1 if any client failed.\n");
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	QCA::Initializer qcaInit;
+	QCoreApplication qapp(argc, argv);
+
+	// seed the random number generator (needed at least for HttpPoll)
+	srand(time(NULL));
+
+	QStringList args = qapp.arguments();
+	args.removeFirst();
+
+	Options o;
+	for(int n = 0; n < args.count(); ++n)
+	{
+		QString s = args[n];
+		if(!s.startsWith("--"))
+		{
+			usage();
+			return 1;
+		}
+		QString var;
+		QString val;
+		int x = s.indexOf('=');
+		if(x != -1)
+		{
+			var = s.mid(2, x - 2);
+			val = s.mid(x + 1);
+		}
+		else
+		{
+			var = s.mid(2);
+		}
+
+		if(var == "jid")
+			o.jid = val;
+		else if(var == "pass")
+			o.pass = val;
+		else if(var == "server")
+		{
+			x = val.lastIndexOf(':');
+			if(x != -1)
+			{
+				o.host = val.mid(0, x);
+				o.port = val.mid(x + 1).toInt();
+			}
+			else
+			{
+				o.host = val;
+				o.port = 5222;
+			}
+		}
+		else if(var == "clients")
+			o.clients = val.toInt();
+		else if(var == "login-rate")
+			o.loginRate = val.toDouble();
+		else if(var == "message-rate")
+			o.messageRate = val.toDouble();
+		else if(var == "presence-rate")
+			o.presenceRate = val.toDouble();
+		else if(var == "payload")
+			o.payload = val.toInt();
+		else if(var == "duration")
+			o.duration = val.toInt();
+		else if(var == "tls")
+		{
+			if(val == "starttls")
+				o.tls = true;
+			else if(val == "ssl")
+				o.ssl = true;
+			else if(val == "none")
+				o.tls = false;
+			else
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if(var == "allow-plain")
+			o.allowPlain = true;
+		else
+		{
+			fprintf(stderr, "Unknown option: %s\n", qPrintable(var));
+			return 1;
+		}
+	}
+
+	if(o.jid.isEmpty() || o.clients < 1 || o.loginRate <= 0 || o.messageRate < 0 || o.presenceRate < 0 || o.payload < 0 || o.duration < 1)
+	{
+		usage();
+		return 1;
+	}
+
+	if((o.tls || o.ssl) && !QCA::isSupported("tls"))
+	{
+		if(o.ssl)
+		{
+			fprintf(stderr, "Error: TLS not available.\n");
+			return 1;
+		}
+		o.tls = false;
+	}
+
+	int ret;
+	{
+		Load load(o);
+		load.start();
+		ret = qapp.exec();
+	}
+
+	// we need this for a clean exit
+	QCA::unloadAllPlugins();
+
+	return ret;
+}
+
+#include "main.moc"
@@ -0,0 +1,11 @@
+IRIS_BASE = ../..
+include(../../confapp.pri)
+
+CONFIG += console
+CONFIG -= app_bundle
+QT -= gui
+QT += xml network
+
+include(../../iris.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,607 @@
+/*
+ * xmppreplay - replay captured XMPP streams through the parser
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QStringList>
+#include <QtCrypto>
+#include <iris/xmpp_statistics.h>
+#include "xmpp/jid/jid.h"
+#include "xmpp/xmpp-core/parser.h"
+#include "xmpp/xmpp-core/protocol.h"
+#include <stdio.h>
+
+#ifdef Q_OS_UNIX
+# include <sys/resource.h>
+#endif
+
+using namespace XMPP;
+
+// peak resident set size of the process in KB, or -1 if unknown
+static qint64 memoryHighWater()
+{
+#ifdef Q_OS_UNIX
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0)
+		return -1;
+# ifdef Q_OS_MAC
+	return ru.ru_maxrss / 1024; // bytes there
+# else
+	return ru.ru_maxrss;
+# endif
+#else
+	return -1;
+#endif
+}
+
+static double mbPerSec(qint64 bytes, qint64 usecs)
+{
+	if(usecs <= 0)
+		return 0;
+	return (double)bytes / usecs; // bytes per usec is MB/s
+}
+
+// one stream out of a capture.  a capture holds the bytes the server sent,
+//   and a stream restart (after starttls, sasl or compression) begins a new
+//   document, so the capture is split there and each part is parsed on
+//   its own, like ClientStream does with a fresh parser.
+class Segment
+{
+public:
+	QString file;
+	int offset;
+	QByteArray data;
+};
+
+static int streamStart(const QByteArray &data, int from)
+{
+	int at = data.indexOf("<stream:stream", from);
+	if(at == -1)
+		return -1;
+
+	// include an xml declaration right before it
+	int decl = data.lastIndexOf("<?xml", at);
+	if(decl >= from)
+	{
+		int end = data.indexOf("?>", decl);
+		if(end != -1 && end < at && data.mid(end + 2, at - end - 2).trimmed().isEmpty())
+			return decl;
+	}
+	return at;
+}
+
+static QList<Segment> splitCapture(const QString &file, const QByteArray &data)
+{
+	QList<Segment> list;
+	int start = 0;
+	while(start < data.size())
+	{
+		// the next stream begins after the header of this one
+		int header = data.indexOf("<stream:stream", start);
+		int next = header != -1 ? streamStart(data, header + 1) : -1;
+
+		Segment s;
+		s.file = file;
+		s.offset = start;
+		s.data = data.mid(start, next == -1 ? -1 : next - start);
+		list += s;
+
+		if(next == -1)
+			break;
+		start = next;
+	}
+	return list;
+}
+
+// shape of a received element, to explain why it was slow.  walks the
+//   tree without recursion, since deep nesting is one of the things we
+//   are looking for.
+class Shape
+{
+public:
+	int depth, maxAttributes, nodes;
+
+	Shape(const QDomElement &e) : depth(0), maxAttributes(0), nodes(0)
+	{
+		QList<QPair<QDomNode, int> > stack;
+		stack += qMakePair(QDomNode(e), 1);
+		while(!stack.isEmpty())
+		{
+			QPair<QDomNode, int> i = stack.takeLast();
+			++nodes;
+			if(i.second > depth)
+				depth = i.second;
+			if(i.first.isElement())
+			{
+				int atts = i.first.attributes().count();
+				if(atts > maxAttributes)
+					maxAttributes = atts;
+			}
+			for(QDomNode n = i.first.firstChild(); !n.isNull(); n = n.nextSibling())
+				stack += qMakePair(n, i.second + 1);
+		}
+	}
+};
+
+class ElementCost
+{
+public:
+	const Segment *segment;
+	int position; // bytes of the segment appended when it came out
+	int size;     // characters
+	qint64 usecs;
+	QDomElement element;
+
+	double cost() const { return size > 0 ? (double)usecs / size : 0; }
+};
+
+class Replay
+{
+public:
+	Parser::Backend backend;
+	int chunk;
+	int loops;
+	double threshold;
+
+	Replay() : backend(Parser::defaultBackend()), chunk(4096), loops(1), threshold(10)
+	{
+	}
+
+	// returns elements parsed, or -1 on a parse error.  costs of the
+	//   elements are collected if 'costs' is set.
+	int parse(const Segment &s, QList<ElementCost> *costs)
+	{
+		Parser::Backend old = Parser::defaultBackend();
+		Parser::setDefaultBackend(backend);
+		Parser parser;
+		Parser::setDefaultBackend(old);
+
+		int elements = 0;
+		StatisticsTimer t;
+		for(int at = 0; at < s.data.size(); at += chunk)
+		{
+			parser.appendData(s.data.mid(at, chunk));
+			while(1)
+			{
+				t.start();
+				Parser::Event e = parser.readNext();
+				qint64 usecs = t.usecsElapsed();
+				if(e.isNull())
+					break;
+				if(e.type() == Parser::Event::Error)
+					return -1;
+				if(e.type() == Parser::Event::Element)
+				{
+					++elements;
+					if(costs)
+					{
+						ElementCost c;
+						c.segment = &s;
+						c.position = qMin(at + chunk, s.data.size());
+						c.size = e.actualString().length();
+						c.usecs = usecs;
+						// only what might get reported, so that the
+						//   documents don't pile up
+						if(usecs >= 1000)
+							c.element = e.element();
+						*costs += c;
+					}
+				}
+			}
+		}
+		return elements;
+	}
+
+	// returns stanzas received, or -1 on a protocol error.  the stream
+	//   is taken as already authenticated, so sasl and tls elements in the
+	//   capture just pass through.
+	int protocol(const Segment &s)
+	{
+		Parser::Backend old = Parser::defaultBackend();
+		Parser::setDefaultBackend(backend);
+		CoreProtocol p;
+		Parser::setDefaultBackend(old);
+		p.startClientOut(Jid("replay@example.com/replay"), false, false, false, false);
+
+		int stanzas = 0;
+		int at = 0;
+		while(1)
+		{
+			if(!p.processStep())
+			{
+				if(at >= s.data.size())
+					break;
+				p.addIncomingData(s.data.mid(at, chunk));
+				at += chunk;
+				continue;
+			}
+
+			if(p.event == CoreProtocol::EError)
+				return -1;
+			else if(p.event == CoreProtocol::ESend)
+			{
+				QByteArray a = p.takeOutgoingData();
+				p.outgoingDataWritten(a.size());
+			}
+			else if(p.event == CoreProtocol::EStanzaReady)
+			{
+				p.recvStanza();
+				++stanzas;
+			}
+			else if(p.event == CoreProtocol::EPeerClosed || p.event == CoreProtocol::EClosed)
+				break;
+		}
+		return stanzas;
+	}
+};
+
+static bool costlier(const ElementCost &a, const ElementCost &b)
+{
+	return a.cost() > b.cost();
+}
+
+static void reportCosts(const QList<ElementCost> &costs, double threshold)
+{
+	if(costs.isEmpty())
+		return;
+
+	QList<double> sorted;
+	foreach(const ElementCost &c, costs)
+		sorted += c.cost();
+	qSort(sorted);
+	double median = sorted[sorted.count() / 2];
+	printf("median parse cost: %.3f us/char\n", median);
+
+	// slow for their size, but ignore anything too quick to time reliably.
+	//   the parse loop keeps the element for the same cutoff.
+	QList<ElementCost> slow;
+	foreach(const ElementCost &c, costs)
+	{
+		if(c.usecs >= 1000 && c.cost() > median * threshold)
+			slow += c;
+	}
+
+	if(slow.isEmpty())
+	{
+		printf("no pathological elements (threshold %.0fx median)\n", threshold);
+		return;
+	}
+
+	printf("%d pathological elements (over %.0fx median):\n", slow.count(), threshold);
+	// worst first, and only the first few
+	qSort(slow.begin(), slow.end(), costlier);
+	for(int n = 0; n < slow.count() && n < 10; ++n)
+	{
+		const ElementCost &c = slow[n];
+		Shape shape(c.element);
+		printf("  %s @%d: <%s> %d chars, %lld us (%.0fx), depth %d, max attributes %d, nodes %d\n",
+			qPrintable(c.segment->file), c.segment->offset + c.position, qPrintable(c.element.tagName()),
+			c.size, c.usecs, median > 0 ? c.cost() / median : 0, shape.depth, shape.maxAttributes, shape.nodes);
+	}
+}
+
+static int replay(const QStringList &files, Replay *r, bool doParser, bool doProtocol)
+{
+	QList<Segment> segments;
+	qint64 totalBytes = 0;
+	foreach(const QString &file, files)
+	{
+		QFile f(file);
+		if(!f.open(QFile::ReadOnly))
+		{
+			fprintf(stderr, "Error: unable to read %s\n", qPrintable(file));
+			return 1;
+		}
+		QList<Segment> list = splitCapture(file, f.readAll());
+		foreach(const Segment &s, list)
+			totalBytes += s.data.size();
+		segments += list;
+	}
+
+	printf("%d files, %d streams, %lld bytes, backend %s, chunk %d\n", files.count(), segments.count(), totalBytes,
+		r->backend == Parser::StreamReaderBackend ? "stream" : "sax", r->chunk);
+
+	int errors = 0;
+
+	if(doParser)
+	{
+		// first pass collects per-element costs and the memory each
+		//   stream adds, later passes are for throughput only
+		QList<ElementCost> costs;
+		qint64 worstGrowth = 0;
+		const Segment *worst = 0;
+		qint64 elements = 0;
+		qint64 usecs = 0;
+		StatisticsTimer t;
+		for(int loop = 0; loop < r->loops; ++loop)
+		{
+			for(int n = 0; n < segments.count(); ++n)
+			{
+				const Segment &s = segments[n];
+				qint64 before = memoryHighWater();
+				t.start();
+				int count = r->parse(s, loop == 0 ? &costs : 0);
+				usecs += t.usecsElapsed();
+				if(count < 0)
+				{
+					if(loop == 0)
+					{
+						printf("parse error in %s, stream at %d\n", qPrintable(s.file), s.offset);
+						++errors;
+					}
+					continue;
+				}
+				elements += count;
+
+				qint64 growth = memoryHighWater() - before;
+				if(loop == 0 && growth > worstGrowth)
+				{
+					worstGrowth = growth;
+					worst = &s;
+				}
+			}
+		}
+		printf("parser: %lld elements in %lld ms, %.0f elements/sec, %.2f MB/sec\n",
+			elements, usecs / 1000, usecs > 0 ? elements * 1000000.0 / usecs : 0, mbPerSec(totalBytes * r->loops, usecs));
+		if(worst)
+			printf("largest memory jump: %lld KB, in %s, stream at %d\n", worstGrowth, qPrintable(worst->file), worst->offset);
+
+		reportCosts(costs, r->threshold);
+	}
+
+	if(doProtocol)
+	{
+		qint64 stanzas = 0;
+		qint64 usecs = 0;
+		StatisticsTimer t;
+		for(int loop = 0; loop < r->loops; ++loop)
+		{
+			foreach(const Segment &s, segments)
+			{
+				t.start();
+				int count = r->protocol(s);
+				usecs += t.usecsElapsed();
+				if(count < 0)
+				{
+					if(loop == 0)
+					{
+						printf("protocol error in %s, stream at %d\n", qPrintable(s.file), s.offset);
+						++errors;
+					}
+					continue;
+				}
+				stanzas += count;
+			}
+		}
+		printf("protocol: %lld stanzas in %lld ms, %.0f stanzas/sec, %.2f MB/sec\n",
+			stanzas, usecs / 1000, usecs > 0 ? stanzas * 1000000.0 / usecs : 0, mbPerSec(totalBytes * r->loops, usecs));
+	}
+
+	qint64 hw = memoryHighWater();
+	if(hw >= 0)
+		printf("memory high-water: %lld KB\n", hw);
+
+	return errors > 0 ? 1 : 0;
+}
+
+// generated documents that grow one dimension of an element, to see how
+//   parse time scales with it.  a linear parser takes about twice as long
+//   for each doubling.
+static QByteArray synthStream(const QString &kind, int n)
+{
+	QByteArray body;
+	if(kind == "depth")
+	{
+		for(int i = 0; i < n; ++i)
+			body += "<x>";
+		for(int i = 0; i < n; ++i)
+			body += "</x>";
+	}
+	else if(kind == "attributes")
+	{
+		body = "<x";
+		for(int i = 0; i < n; ++i)
+			body += " a" + QByteArray::number(i) + "='v'";
+		body += "/>";
+	}
+	else if(kind == "children")
+	{
+		for(int i = 0; i < n; ++i)
+			body += "<x/>";
+	}
+	else // text
+	{
+		body = QByteArray(n * 8, 'x');
+	}
+
+	return "<?xml version='1.0'?><stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>"
+		"<message>" + body + "</message>";
+}
+
+static int synth(Replay *r)
+{
+	QStringList kinds;
+	kinds << "depth" << "attributes" << "children" << "text";
+
+	int quadratic = 0;
+	foreach(const QString &kind, kinds)
+	{
+		printf("%s:\n", qPrintable(kind));
+		qint64 last = 0;
+		double worstRatio = 0;
+		for(int n = 1000; n <= 16000; n *= 2)
+		{
+			Segment s;
+			s.file = kind;
+			s.offset = 0;
+			s.data = synthStream(kind, n);
+
+			qint64 best = -1;
+			StatisticsTimer t;
+			for(int loop = 0; loop < r->loops; ++loop)
+			{
+				t.start();
+				if(r->parse(s, 0) != 1)
+				{
+					printf("  %d: parse failed\n", n);
+					best = -1;
+					break;
+				}
+				qint64 usecs = t.usecsElapsed();
+				if(best == -1 || usecs < best)
+					best = usecs;
+			}
+			if(best < 0)
+				break;
+
+			if(last > 0)
+			{
+				double ratio = (double)best / last;
+				if(ratio > worstRatio)
+					worstRatio = ratio;
+				printf("  %6d: %8lld us (x%.1f)\n", n, best, ratio);
+			}
+			else
+				printf("  %6d: %8lld us\n", n, best);
+			last = best;
+		}
+
+		// quadratic is x4 per doubling, leave room for noise
+		if(worstRatio > 3)
+		{
+			printf("  probably worse than linear\n");
+			++quadratic;
+		}
+	}
+	return quadratic > 0 ? 1 : 0;
+}
+
+void usage()
+{
+	printf("xmppreplay: replay captured XMPP streams through the parser\n");
+	printf("usage: xmppreplay (options) [file] (file) ...\n");
+	printf("       xmppreplay --synth (options)\n");
+	printf("\n");
+	printf(" --mode=[mode]       parser, protocol or both (default=both)\n");
+	printf(" --backend=[type]    sax or stream (default=library default)\n");
+	printf(" --chunk=[n]         bytes appended at a time (default=4096)\n");
+	printf(" --loops=[n]         times to replay the corpus (default=1)\n");
+	printf(" --threshold=[n]     report elements n times slower per char than the median (default=10)\n");
+	printf(" --synth             parse generated elements of growing depth, attribute count,\n");
+	printf("                     children and text, and report how parse time scales\n");
+	printf("\n");
+	printf("files are raw server-to-client XML, such as a decrypted capture or an XML\n");
+	printf("console log, starting from the stream header. stream restarts are detected\n");
+	printf("and parsed as separate documents.\n");
+	printf("exits with 1 if there were errors, or if --synth found worse than linear\n");
+	printf("scaling.\n");
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	QCA::Initializer qcaInit;
+	QCoreApplication qapp(argc, argv);
+
+	QStringList args = qapp.arguments();
+	args.removeFirst();
+
+	Replay r;
+	bool doParser = true;
+	bool doProtocol = true;
+	bool doSynth = false;
+	QStringList files;
+
+	for(int n = 0; n < args.count(); ++n)
+	{
+		QString s = args[n];
+		if(!s.startsWith("--"))
+		{
+			files += s;
+			continue;
+		}
+		QString var;
+		QString val;
+		int x = s.indexOf('=');
+		if(x != -1)
+		{
+			var = s.mid(2, x - 2);
+			val = s.mid(x + 1);
+		}
+		else
+		{
+			var = s.mid(2);
+		}
+
+		if(var == "mode")
+		{
+			if(val == "parser")
+				doProtocol = false;
+			else if(val == "protocol")
+				doParser = false;
+			else if(val != "both")
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if(var == "backend")
+		{
+			if(val == "sax")
+				r.backend = Parser::SaxBackend;
+			else if(val == "stream")
+				r.backend = Parser::StreamReaderBackend;
+			else
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if(var == "chunk")
+			r.chunk = val.toInt();
+		else if(var == "loops")
+			r.loops = val.toInt();
+		else if(var == "threshold")
+			r.threshold = val.toDouble();
+		else if(var == "synth")
+			doSynth = true;
+		else
+		{
+			fprintf(stderr, "Unknown option: %s\n", qPrintable(var));
+			return 1;
+		}
+	}
+
+	if(r.chunk < 1 || r.loops < 1 || r.threshold <= 0)
+	{
+		usage();
+		return 1;
+	}
+
+	if(doSynth)
+		return synth(&r);
+
+	if(files.isEmpty())
+	{
+		usage();
+		return 1;
+	}
+
+	return replay(files, &r, doParser, doProtocol);
+}
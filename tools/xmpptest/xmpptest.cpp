@@ -600,8 +600,7 @@ private slots:
 	void tls_handshaken()
 	{
 		//QCA::Certificate cert = tls->peerCertificate();
-		int vr = tls->peerIdentityResult();
-		if (vr == QCA::TLS::Valid && !tlsHandler->certMatchesHostname()) vr = QCA::TLS::HostMismatch;
+		int vr = tlsHandler->verifyPeer();
 
 		appendSysMsg("Successful TLS handshake.");
 		if(vr == QCA::TLS::Valid)